@@ -8,6 +8,9 @@ set -eu
 
 CHECK_ONLY=0
 SMOKE_ONLY=0
+GATE=0
+SAVE_BASELINE=0
+COMPARE_CSV=""
 while [ "$#" -gt 0 ]; do
     case "$1" in
         --check)
@@ -16,8 +19,18 @@ while [ "$#" -gt 0 ]; do
         --smoke)
             SMOKE_ONLY=1
             ;;
+        --gate)
+            GATE=1
+            ;;
+        --save-baseline)
+            SAVE_BASELINE=1
+            ;;
+        --compare)
+            COMPARE_CSV="${2:-}"
+            [ -n "$COMPARE_CSV" ] && shift
+            ;;
         *)
-            printf 'Usage: %s [--check] [--smoke]\n' "$0" >&2
+            printf 'Usage: %s [--check] [--smoke] [--gate] [--save-baseline] [--compare results.csv]\n' "$0" >&2
             exit 1
             ;;
     esac
@@ -28,6 +41,10 @@ if [ "$CHECK_ONLY" -eq 1 ] && [ "$SMOKE_ONLY" -eq 1 ]; then
     printf 'ERROR: --check and --smoke cannot be used together\n' >&2
     exit 1
 fi
+if [ "$CHECK_ONLY" -eq 1 ] && [ "$((GATE + SAVE_BASELINE))" -gt 0 ]; then
+    printf 'ERROR: --check does not run benchmarks to gate or save\n' >&2
+    exit 1
+fi
 
 SERVER_PORT="${SERVER_PORT:-3000}"
 BASE_URL="http://localhost:${SERVER_PORT}"
@@ -44,6 +61,23 @@ RETRY_INITIAL_BACKOFF="${RETRY_INITIAL_BACKOFF:-1}"
 RETRY_MAX_BACKOFF="${RETRY_MAX_BACKOFF:-8}"
 SMOKE_CONNECTIONS="${SMOKE_CONNECTIONS:-12}"
 SMOKE_DURATION="${SMOKE_DURATION:-5}"
+# build/miniweb-loadgen (make all) replaces wrk when it is there: fixed
+# arrival rates, pipelining, percentile graphs and an endpoint mix run.
+LOADGEN="${LOADGEN:-build/miniweb-loadgen}"
+RATE="${RATE:-0}"                       # req/s per run; 0: closed loop
+PIPELINE="${PIPELINE:-1}"
+MIX_CONNECTIONS="${MIX_CONNECTIONS:-50}"
+USE_LOADGEN=0
+[ -x "$LOADGEN" ] && USE_LOADGEN=1
+# Regression gate (--gate, --compare): a run fails when an endpoint's
+# req/s drops more than GATE_TPUT_DROP percent below the baseline or its
+# p99 rises more than GATE_P99_RISE percent plus GATE_P99_SLACK_MS above
+# it. GATE_OVERRIDES holds per-endpoint "ID:tput_drop:p99_rise" pairs.
+BASELINE_CSV="${BASELINE_CSV:-${OUTPUT_ROOT}/benchmark_baseline.csv}"
+GATE_TPUT_DROP="${GATE_TPUT_DROP:-10}"
+GATE_P99_RISE="${GATE_P99_RISE:-25}"
+GATE_P99_SLACK_MS="${GATE_P99_SLACK_MS:-0.5}"
+GATE_OVERRIDES="${GATE_OVERRIDES:-API_PKG_SEARCH:20:50 MAN_PDF:20:50 MAN_PS:20:50}"
 
 if [ "$SMOKE_ONLY" -eq 1 ]; then
     TEST_DURATION="$SMOKE_DURATION"
@@ -52,7 +86,8 @@ fi
 
 # ---------------------------------------------------------------------------
 # Endpoint definitions  (IDs, URLs, human names — must stay in sync)
-# PDF and PS endpoints are excluded: wrk cannot benchmark binary streams.
+# PDF and PS endpoints are only added for miniweb-loadgen: wrk cannot
+# benchmark binary streams.
 # ---------------------------------------------------------------------------
 set -A ENDPOINT_IDS -- \
     "STATIC_HTML"    "STATIC_CSS"      "STATIC_JS"       "STATIC_IMG" \
@@ -75,6 +110,15 @@ set -A ENDPOINT_NAMES -- \
     "Package Search"      \
     "Man Page (HTML)"      "Man Page (.html)"      "Man Page (Markdown)"
 
+if [ "$USE_LOADGEN" -eq 1 ]; then
+    n=${#ENDPOINT_IDS[*]}
+    ENDPOINT_IDS[$n]="MAN_PDF";   ENDPOINT_URLS[$n]="/man/system/1/ls.pdf"
+    ENDPOINT_NAMES[$n]="Man Page (PDF)"
+    n=$((n + 1))
+    ENDPOINT_IDS[$n]="MAN_PS";    ENDPOINT_URLS[$n]="/man/system/1/ls.ps"
+    ENDPOINT_NAMES[$n]="Man Page (PostScript)"
+fi
+
 # ---------------------------------------------------------------------------
 # Helper functions
 # ---------------------------------------------------------------------------
@@ -157,6 +201,191 @@ check_endpoint_with_retry() {
     return 1
 }
 
+# run_wrk conns url: one wrk run; sets run_output and the CSV fields.
+run_wrk() {
+    typeset conn="$1" url="$2" transfer_raw latency_line
+
+    run_output="$(wrk -t"$THREADS" -c"$conn" -d"${TEST_DURATION}"s --latency "${BASE_URL}${url}" 2>&1)"
+    printf '%s\n' "$run_output" > "${ASSETS_DIR}/${safe_name}_${conn}.txt"
+
+    req_sec="$(printf '%s\n' "$run_output" | awk '/Requests\/sec:/ {print $2; exit}')"
+    [ -z "$req_sec" ] && req_sec="0"
+
+    transfer_raw="$(printf '%s\n' "$run_output" | awk '/Transfer\/sec:/ {print $2; exit}')"
+    [ -z "$transfer_raw" ] && transfer_raw="0MB"
+
+    total_requests="$(printf '%s\n' "$run_output" | awk '/requests in/ {print $1; exit}')"
+    [ -z "$total_requests" ] && total_requests="0"
+
+    non_2xx="$(printf '%s\n' "$run_output" | awk '/Non-2xx or 3xx responses:/ {print $5; exit}')"
+    [ -z "$non_2xx" ] && non_2xx="0"
+
+    latency_line="$(printf '%s\n' "$run_output" | awk '/^[[:space:]]*Latency/ {print; exit}')"
+    if [ -n "$latency_line" ]; then
+        latency_avg="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $2}')")"
+        latency_stdev="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $3}')")"
+        latency_max="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $4}')")"
+    else
+        latency_avg="0"; latency_stdev="0"; latency_max="0"
+    fi
+
+    latency_p99="$(to_ms "$(printf '%s\n' "$run_output" | awk '/^[[:space:]]*99%/ {print $2; exit}')")"
+    transfer_mb="$(to_mbsec "$transfer_raw")"
+}
+
+# run_loadgen conns prefix id=url...: one miniweb-loadgen run; sets
+# run_output and the CSV fields from its ALL line, writes prefix.txt and
+# the prefix*.hgrm latency distributions.
+run_loadgen() {
+    typeset conn="$1" prefix="$2" all
+    shift 2
+
+    run_output="$("$LOADGEN" -t "$THREADS" -c "$conn" -d "$TEST_DURATION" \
+        -p "$PIPELINE" -r "$RATE" -o "$prefix" \
+        "localhost:${SERVER_PORT}" "$@" 2>&1)"
+    printf '%s\n' "$run_output" > "${prefix}.txt"
+
+    all="$(printf '%s\n' "$run_output" | awk -F'\t' '$1=="ALL" {print; exit}')"
+    [ -z "$all" ] && all="ALL	0	0	0	0	0	0	0	0	0	0	0	0"
+    req_sec="$(printf '%s\n' "$all" | awk -F'\t' '{print $5}')"
+    transfer_mb="$(printf '%s\n' "$all" | awk -F'\t' '{print $6}')"
+    total_requests="$(printf '%s\n' "$all" | awk -F'\t' '{print $2}')"
+    non_2xx="$(printf '%s\n' "$all" | awk -F'\t' '{print $3 + $4}')"
+    latency_avg="$(printf '%s\n' "$all" | awk -F'\t' '{print $7}')"
+    latency_stdev="$(printf '%s\n' "$all" | awk -F'\t' '{print $8}')"
+    latency_max="$(printf '%s\n' "$all" | awk -F'\t' '{print $13}')"
+    latency_p99="$(printf '%s\n' "$all" | awk -F'\t' '{print $11}')"
+}
+
+# plot_percentiles out title label:hgrm...: latency by percentile, one
+# line per .hgrm file, on a log scale of 1/(1-p) like HdrHistogram's plotter.
+plot_percentiles() {
+    typeset out="$1" title="$2" sep arg
+    shift 2
+
+    {
+    printf 'set datafile separator whitespace\n'
+    printf 'set key outside right top\n'
+    printf 'set grid\n'
+    printf 'set border lw 1.2\n'
+    printf 'set terminal svg size 900,380 dynamic enhanced font "Arial,11"\n'
+    printf 'set output "%s"\n' "$out"
+    printf 'set title "%s"\n' "$title"
+    printf 'set logscale x\n'
+    printf 'set xtics ("0%%" 1, "90%%" 10, "99%%" 100, "99.9%%" 1000, "99.99%%" 10000, "99.999%%" 100000)\n'
+    printf 'set xlabel "Percentile"\n'
+    printf 'set ylabel "Latency (ms)"\n'
+    printf 'plot'
+    sep=" "
+    for arg in "$@"; do
+        printf '%s"%s" using 4:1 skip 2 with lines lw 2 title "%s"' \
+            "$sep" "${arg#*:}" "${arg%%:*}"
+        sep=", "
+    done
+    printf '\n'
+    } > "${out%.svg}.gp"
+    gnuplot "${out%.svg}.gp"
+}
+
+# gate_compare baseline current: every endpoint/connections row of
+# current that the baseline also has OK, with its throughput and p99
+# change; returns 1 when any of them regressed.
+gate_compare() {
+    typeset base="$1" cur="$2"
+
+    if [ ! -f "$base" ]; then
+        printf 'ERROR: no baseline at %s (run with --save-baseline first)\n' "$base" >&2
+        return 1
+    fi
+    if [ ! -f "$cur" ]; then
+        printf 'ERROR: no results at %s\n' "$cur" >&2
+        return 1
+    fi
+
+    printf '\nRegression gate: %s against %s\n' "$cur" "$base"
+    printf 'Allowed: req/s -%s%%, p99 +%s%% +%sms (overrides: %s)\n\n' \
+        "$GATE_TPUT_DROP" "$GATE_P99_RISE" "$GATE_P99_SLACK_MS" "${GATE_OVERRIDES:-none}"
+
+    awk -F, -v tput="$GATE_TPUT_DROP" -v rise="$GATE_P99_RISE" \
+        -v slack="$GATE_P99_SLACK_MS" -v over="$GATE_OVERRIDES" '
+        function pct(now, was) {
+            return was > 0 ? sprintf("%+.1f%%", (now - was) * 100 / was) : "-"
+        }
+        BEGIN {
+            n = split(over, o, " ")
+            for (i = 1; i <= n; i++) {
+                split(o[i], f, ":")
+                otput[f[1]] = f[2]; orise[f[1]] = f[3]
+            }
+            printf "%-16s %5s %10s %10s %8s %9s %9s %8s  %s\n", "endpoint", "conns",
+                "base req/s", "req/s", "change", "base p99", "p99", "change", "verdict"
+        }
+        FNR == 1 { next }
+        NR == FNR {
+            if ($13 == "OK") {
+                breq[$1 "," $2] = $3
+                bp99[$1 "," $2] = NF >= 14 ? $14 : ""
+            }
+            next
+        }
+        {
+            key = $1 "," $2
+            if (!(key in breq))
+                next
+            compared++
+            t = ($1 in otput) ? otput[$1] : tput
+            r = ($1 in orise) ? orise[$1] : rise
+            why = ""
+            p99 = NF >= 14 ? $14 : ""
+            if ($13 != "OK") {
+                why = $13
+            } else {
+                if ($3 < breq[key] * (1 - t / 100))
+                    why = "req/s"
+                if (bp99[key] != "" && p99 != "" && bp99[key] > 0 &&
+                    p99 > bp99[key] * (1 + r / 100) + slack)
+                    why = why == "" ? "p99" : why ", p99"
+            }
+            if (why != "")
+                bad++
+            printf "%-16s %5s %10.1f %10.1f %8s %9s %9s %8s  %s\n", $1, $2,
+                breq[key], $3, pct($3, breq[key]),
+                bp99[key] == "" ? "-" : sprintf("%.2f", bp99[key]),
+                p99 == "" ? "-" : sprintf("%.2f", p99),
+                bp99[key] == "" || p99 == "" ? "-" : pct(p99, bp99[key]),
+                why == "" ? "ok" : "REGRESSED (" why ")"
+        }
+        END {
+            if (compared == 0) {
+                printf "\nNothing to compare: no endpoint/connections row is in both files.\n"
+                exit 1
+            }
+            if (bad > 0) {
+                printf "\nGate failed: %d of %d row(s) regressed.\n", bad, compared
+                exit 1
+            }
+            printf "\nGate passed: %d row(s) within thresholds.\n", compared
+        }' "$base" "$cur"
+}
+
+# finish_run: gate the results, then keep them as the next baseline.
+finish_run() {
+    if [ "$GATE" -eq 1 ] && ! gate_compare "$BASELINE_CSV" "$CSV_FILE"; then
+        exit 1
+    fi
+    if [ "$SAVE_BASELINE" -eq 1 ]; then
+        cp "$CSV_FILE" "$BASELINE_CSV"
+        printf 'Baseline saved to %s\n' "$BASELINE_CSV"
+    fi
+}
+
+if [ -n "$COMPARE_CSV" ]; then
+    if gate_compare "$BASELINE_CSV" "$COMPARE_CSV"; then
+        exit 0
+    fi
+    exit 1
+fi
+
 # ---------------------------------------------------------------------------
 # Startup banner + dependency checks
 # ---------------------------------------------------------------------------
@@ -165,7 +394,12 @@ printf '=============================================\n'
 printf 'Server URL  : %s\n' "$BASE_URL"
 printf 'Threads     : %s\n' "$THREADS"
 printf 'Duration    : %ss\n' "$TEST_DURATION"
-printf 'Connections : %s\n\n' "$CONNECTIONS"
+printf 'Connections : %s\n' "$CONNECTIONS"
+if [ "$USE_LOADGEN" -eq 1 ]; then
+    printf 'Load tool   : %s (rate %s, pipeline %s)\n\n' "$LOADGEN" "$RATE" "$PIPELINE"
+else
+    printf 'Load tool   : wrk\n\n'
+fi
 if [ "$CHECK_ONLY" -eq 1 ]; then
     printf 'Mode        : preflight (--check)\n\n'
 elif [ "$SMOKE_ONLY" -eq 1 ]; then
@@ -174,7 +408,9 @@ elif [ "$SMOKE_ONLY" -eq 1 ]; then
     printf 'Smoke dur   : %ss\n\n' "$SMOKE_DURATION"
 fi
 
-for cmd in wrk gnuplot curl awk sed; do
+deps="gnuplot curl awk sed"
+[ "$USE_LOADGEN" -eq 0 ] && deps="wrk ${deps}"
+for cmd in $deps; do
     if ! command -v "$cmd" >/dev/null 2>&1; then
         printf 'ERROR: missing dependency "%s"\n' "$cmd" >&2
         exit 1
@@ -222,7 +458,7 @@ fi
 mkdir -p "$ASSETS_DIR"
 
 # CSV header
-printf 'endpoint_id,connections,req_sec,latency_avg_ms,latency_stdev_ms,latency_max_ms,transfer_mb_sec,total_requests,errors_non_2xx,endpoint_name,endpoint_url,http_code,status\n' \
+printf 'endpoint_id,connections,req_sec,latency_avg_ms,latency_stdev_ms,latency_max_ms,transfer_mb_sec,total_requests,errors_non_2xx,endpoint_name,endpoint_url,http_code,status,latency_p99_ms\n' \
     > "$CSV_FILE"
 
 # ---------------------------------------------------------------------------
@@ -263,7 +499,7 @@ while [ "$i" -lt "$total_endpoints" ]; do
     else
             printf 'FAILED (HTTP %s) — skipping endpoint\n' "$http_check"
             for conn in $CONNECTIONS; do
-                printf '%s,%s,0,0,0,0,0,0,0,"%s","%s",%s,HEALTH_FAILED\n' \
+                printf '%s,%s,0,0,0,0,0,0,0,"%s","%s",%s,HEALTH_FAILED,0\n' \
                     "$id" "$conn" "$name" "$url" "$http_check" >> "$CSV_FILE"
             done
             i=$((i + 1))
@@ -273,38 +509,17 @@ while [ "$i" -lt "$total_endpoints" ]; do
     for conn in $CONNECTIONS; do
         printf '  Connections: %3d ... ' "$conn"
 
-        full_url="${BASE_URL}${url}"
-        run_output="$(wrk -t"$THREADS" -c"$conn" -d"${TEST_DURATION}"s --latency "$full_url" 2>&1)"
-        printf '%s\n' "$run_output" > "${ASSETS_DIR}/${safe_name}_${conn}.txt"
-
-        req_sec="$(printf '%s\n' "$run_output" | awk '/Requests\/sec:/ {print $2; exit}')"
-        [ -z "$req_sec" ] && req_sec="0"
-
-        transfer_raw="$(printf '%s\n' "$run_output" | awk '/Transfer\/sec:/ {print $2; exit}')"
-        [ -z "$transfer_raw" ] && transfer_raw="0MB"
-
-        total_requests="$(printf '%s\n' "$run_output" | awk '/requests in/ {print $1; exit}')"
-        [ -z "$total_requests" ] && total_requests="0"
-
-        non_2xx="$(printf '%s\n' "$run_output" | awk '/Non-2xx or 3xx responses:/ {print $5; exit}')"
-        [ -z "$non_2xx" ] && non_2xx="0"
-
-        latency_line="$(printf '%s\n' "$run_output" | awk '/^[[:space:]]*Latency/ {print; exit}')"
-        if [ -n "$latency_line" ]; then
-            latency_avg="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $2}')")"
-            latency_stdev="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $3}')")"
-            latency_max="$(to_ms "$(printf '%s\n' "$latency_line" | awk '{print $4}')")"
+        if [ "$USE_LOADGEN" -eq 1 ]; then
+            run_loadgen "$conn" "${ASSETS_DIR}/${safe_name}_${conn}" "${id}=${url}"
         else
-            latency_avg="0"; latency_stdev="0"; latency_max="0"
+            run_wrk "$conn" "$url"
         fi
-
-        transfer_mb="$(to_mbsec "$transfer_raw")"
         http_code="$(get_http_code "$url")"
 
-        printf '%s,%s,%s,%s,%s,%s,%s,%s,%s,"%s","%s",%s,OK\n' \
+        printf '%s,%s,%s,%s,%s,%s,%s,%s,%s,"%s","%s",%s,OK,%s\n' \
             "$id" "$conn" "$req_sec" "$latency_avg" "$latency_stdev" "$latency_max" \
             "$transfer_mb" "$total_requests" "$non_2xx" "$name" "$url" "$http_code" \
-            >> "$CSV_FILE"
+            "$latency_p99" >> "$CSV_FILE"
 
         printf 'OK (%.1f req/s)\n' "$req_sec"
         if [ "$SMOKE_ONLY" -eq 1 ]; then
@@ -319,9 +534,71 @@ done
 
 if [ "$SMOKE_ONLY" -eq 1 ]; then
     printf '\nSmoke benchmark complete (3 endpoints, %ss each).\n' "$TEST_DURATION"
+    finish_run
     exit 0
 fi
 
+# ---------------------------------------------------------------------------
+# Endpoint mix (miniweb-loadgen): every healthy endpoint in one run, each
+# request picking one at random
+# ---------------------------------------------------------------------------
+MIX_SECTION=""
+if [ "$USE_LOADGEN" -eq 1 ]; then
+    set -A mix_args --
+    set -A mix_plots -- "All requests:${ASSETS_DIR}/mix.hgrm"
+    i=0
+    n=0
+    while [ "$i" -lt "$total_endpoints" ]; do
+        id="${ENDPOINT_IDS[$i]}"
+        if awk -F, -v eid="$id" '$1==eid && $13=="OK" {f=1} END {exit !f}' "$CSV_FILE"; then
+            safe_name="$(printf '%s' "$id" | tr '[:upper:]' '[:lower:]')"
+            mix_args[$n]="${id}=${ENDPOINT_URLS[$i]}"
+            n=$((n + 1))
+            mix_plots[$n]="${ENDPOINT_NAMES[$i]}:${ASSETS_DIR}/mix.${safe_name}.hgrm"
+        fi
+        i=$((i + 1))
+    done
+
+    if [ "$n" -gt 0 ]; then
+        sleep 5 ## cpu cooling pause
+        printf '\n▶ Testing: endpoint mix (%s endpoints)\n' "$n"
+        printf '  Connections: %3d ... ' "$MIX_CONNECTIONS"
+        run_loadgen "$MIX_CONNECTIONS" "${ASSETS_DIR}/mix" "${mix_args[@]}"
+        printf 'OK (%.1f req/s)\n' "$req_sec"
+
+        plot_percentiles "${ASSETS_DIR}/mix_percentiles.svg" \
+            "Endpoint mix — Latency by percentile" "${mix_plots[@]}"
+
+        mix_rows="$(printf '%s\n' "$run_output" | awk -F'\t' 'NR>1 && NF==13 {
+            printf "<tr><td>%s</td><td>%s</td><td>%.1f</td><td>%.2f</td><td>%.2f</td><td>%.2f</td><td>%.2f</td><td>%.2f</td><td>%s</td></tr>\n",
+                $1, $2, $5, $7, $9, $11, $12, $13, $3 + $4
+        }')"
+        MIX_SECTION="
+      <section class=\"panel ep-section\" id=\"ep-mix\">
+        <h2>Endpoint mix</h2>
+        <p class=\"meta ep-url\">${n} endpoints, ${MIX_CONNECTIONS} connections, rate ${RATE}, pipeline ${PIPELINE}</p>
+        <div class=\"ep-graphs\">
+          <div class=\"graph\" data-src=\"/static/benchmark_assets/mix_percentiles.svg\" data-title=\"Endpoint mix — Latency by percentile\" title=\"Click to expand\">
+            <img src=\"/static/benchmark_assets/mix_percentiles.svg\" alt=\"Latency percentiles, endpoint mix\">
+          </div>
+        </div>
+        <div class=\"details\">
+          <table>
+            <thead>
+              <tr>
+                <th>Endpoint</th><th>Requests</th><th>Req/sec</th><th>Avg Latency (ms)</th>
+                <th>p50 (ms)</th><th>p99 (ms)</th><th>p99.9 (ms)</th><th>Max (ms)</th><th>Errors</th>
+              </tr>
+            </thead>
+            <tbody>
+${mix_rows}
+            </tbody>
+          </table>
+        </div>
+      </section>"
+    fi
+fi
+
 # ---------------------------------------------------------------------------
 # Gnuplot — overall graphs (aggregate all endpoints)
 # ---------------------------------------------------------------------------
@@ -419,6 +696,20 @@ while [ "$i" -lt "$total_endpoints" ]; do
         gnuplot "$gp_file"
     fi
 
+    if [ "$USE_LOADGEN" -eq 1 ]; then
+        set -A pct_args --
+        n=0
+        for conn in $CONNECTIONS; do
+            [ -f "${ASSETS_DIR}/${safe_name}_${conn}.hgrm" ] || continue
+            pct_args[$n]="${conn} connections:${ASSETS_DIR}/${safe_name}_${conn}.hgrm"
+            n=$((n + 1))
+        done
+        if [ "$n" -gt 0 ]; then
+            plot_percentiles "${ASSETS_DIR}/${safe_name}_percentiles.svg" \
+                "${name} — Latency by percentile" "${pct_args[@]}"
+        fi
+    fi
+
     i=$((i + 1))
 done
 
@@ -464,6 +755,13 @@ while [ "$i" -lt "$total_endpoints" ]; do
               </div>
             </div>"
     fi
+    pct_svg="${ASSETS_DIR}/${safe_name}_percentiles.svg"
+    if [ -n "$graph_block" ] && [ -f "$pct_svg" ]; then
+        graph_block="${graph_block%</div>}  <div class=\"graph\" data-src=\"/static/benchmark_assets/${safe_name}_percentiles.svg\" data-title=\"${name} — Latency by percentile\" title=\"Click to expand\">
+                <img src=\"/static/benchmark_assets/${safe_name}_percentiles.svg\" alt=\"Latency percentiles ${name}\">
+              </div>
+            </div>"
+    fi
 
     section="
       <section class=\"panel ep-section\" id=\"ep-${safe_name}\">
@@ -693,6 +991,7 @@ cat <<HTMLMID
       <!-- ===== PER-ENDPOINT SECTIONS ===== -->
 HTMLMID
 
+printf '%s\n' "$MIX_SECTION"
 printf '%s\n' "$ENDPOINT_SECTIONS"
 
 cat <<HTMLFOOT
@@ -780,3 +1079,5 @@ if [ "$health_check" = "200" ]; then
 else
     echo "❌ Server health check FAILED (HTTP ${health_check})"
 fi
+
+finish_run
@@ -0,0 +1,49 @@
+/* cache_admin.h - listing and targeted purge of the response caches */
+#ifndef MINIWEB_CORE_CACHE_ADMIN_H
+#define MINIWEB_CORE_CACHE_ADMIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_ADMIN_MAX_CACHES 16
+
+struct cache_admin_stats {
+	uint64_t bytes;
+	uint64_t entries;
+	uint64_t hits;
+	uint64_t misses;		/* 0 where not counted */
+};
+
+/*
+ * A cache that can be listed and purged. stats() fills in what it holds
+ * now; purge() drops the entry whose key is @p key, or with @p prefix
+ * every entry whose key starts with it, and returns how many it dropped.
+ * Keys are the ones the cache is looked up by, described next to each
+ * registration. Both take the cache's own locks and may be called from
+ * any worker.
+ */
+struct cache_admin_ops {
+	const char *name;
+	void (*stats)(struct cache_admin_stats *st, void *ctx);
+	size_t (*purge)(const char *key, int prefix, void *ctx);
+	void *ctx;
+};
+
+/** Add a cache; copies @p ops. Returns 0, or -1 when the table is full. */
+int cache_admin_register(const struct cache_admin_ops *ops);
+
+/** Call @p fn with the stats of every cache; returns the number of calls. */
+int cache_admin_foreach(void (*fn)(const char *name,
+    const struct cache_admin_stats *st, void *ctx), void *ctx);
+
+/**
+ * Purge @p key (or every key under prefix @p key) from cache @p name, or
+ * from every cache when @p name is NULL. Returns the entries dropped,
+ * or -1 when no cache is called @p name.
+ */
+long cache_admin_purge(const char *name, const char *key, int prefix);
+
+/** Whether @p key is @p want, or with @p prefix starts with it. */
+int cache_admin_match(const char *key, const char *want, int prefix);
+
+#endif /* MINIWEB_CORE_CACHE_ADMIN_H */
@@ -13,6 +13,8 @@
 #ifndef MINIWEB_CORE_CONF_H
 #define MINIWEB_CORE_CONF_H
 
+#include <stddef.h>
+
 #define CONF_STR_MAX  256   /* max length for string values */
 
 /* All configurable knobs in one place.
@@ -22,30 +24,72 @@ typedef struct miniweb_conf {
     /* Network */
     int  port;                      /* -p  default: 9001           */
     char bind_addr[CONF_STR_MAX];   /* -b  default: "127.0.0.1"   */
+    int  listen_tcp;                /*     default: 1 (port/bind_addr) */
+    char unix_socket[CONF_STR_MAX]; /*     default: "" (no Unix listener)
+                                     *   path of a stream socket a local
+                                     *   proxy connects to             */
+    char health_path[CONF_STR_MAX]; /*     default: "" (off) path the
+                                     *   dispatcher answers itself     */
 
     /* Worker pool */
     int  threads;                   /* -t  default: online CPU cores (max 32) */
     int  max_conns;                 /* -c  default: 1280           */
+    int  max_threads;               /*     default: 0 (= threads, fixed pool) */
+    int  thread_idle_timeout;       /*     default: 10 (seconds)   */
+    int  slow_threads;              /*     default: 2 (slow-lane workers) */
+    int  queue_deadline_ms;         /*     default: 10000 (0 = never shed) */
+    int  slow_queue_deadline_ms;    /*     default: 30000 (0 = never shed) */
+    int  dispatchers;               /*     default: 1 (kqueue shards) */
+    int  worker_kqueue;             /*     default: 0 (queue hand-off) */
+    int  heartbeat_kqueue;          /*     default: 0 (heartbeat thread) */
+    int  listen_backpressure;       /*     default: 0 (503 when full) */
+    int  overload_503;              /*     default: 1 (send 503 on shed) */
+    int  h2c;                       /*     default: 0 (HTTP/1.x only) */
+    int  h2c_threads;               /*     default: 8 (HTTP/2 streams) */
 
     /* Timeouts / limits */
     int  conn_timeout;              /*     default: 30  (seconds)  */
     int  max_req_size;              /*     default: 16384 (bytes)  */
     int  mandoc_timeout;            /*     default: 10  (seconds)  */
+    int  mandoc_helpers;            /*     default: 4 (0 = fork per page) */
+    int  man_stream;                /*     default: 1 (stream PDF and PS) */
+    int  subprocess_max;            /*     default: 16 (running at once) */
+    int  subprocess_queue;          /*     default: 64 (waiting at once) */
+    int  subprocess_wait_ms;        /*     default: 2000 */
+    int  rate_limit_fast;           /*     default: 0 (a minute; 0 = off) */
+    int  rate_limit_fast_burst;     /*     default: 60 */
+    int  rate_limit_slow;           /*     default: 0 (a minute; 0 = off) */
+    int  rate_limit_slow_burst;     /*     default: 10 */
 
     /* Filesystem */
     char static_dir[CONF_STR_MAX];    /*   default: "static"       */
     char templates_dir[CONF_STR_MAX]; /*   default: "templates"    */
+    int  embedded_assets;             /*   default: 1 (0 = disk only) */
     int  autoindex;                   /*   default: 0 (disabled)    */
+    int  file_cache_mb;               /*   default: 32 (0 = off)    */
+    int  warmup_mb;                   /*   default: 8 (0 = off)     */
+    int  response_cache_mb;           /*   default: 8 (0 = off)     */
+    int  man_cache_mb;                /*   default: 64 (0 = no cap) */
+    int  memory_budget_mb;            /*   default: 0 (measure only) */
     char mandoc_path[CONF_STR_MAX];   /*   default: "/usr/bin/mandoc" */
+    char db_path[CONF_STR_MAX];       /*   default: "/var/db/miniweb/miniweb.db"
+    *   "" keeps no state on disk */
+    int  metrics_flush_sec;           /*   default: 30 (0 = not kept) */
 
     /* Reverse proxy */
     char trusted_proxy[CONF_STR_MAX]; /*   default: "127.0.0.1"
     *   X-Forwarded-* headers only
     *   accepted from this IP   */
+    int  unix_socket_trusted;         /*   default: 1 (unix_socket
+    *   peers are proxies too)  */
 
     /* Logging */
     int  verbose;                   /* -v  default: 0              */
     char log_file[CONF_STR_MAX];    /*     default: "" (stderr)   */
+    char access_log[CONF_STR_MAX];  /*     default: "" (off)      */
+    int  access_log_sample;         /*     default: 1 (every request) */
+    int  trace_slow_ms;             /*     default: 0 (tracing off) */
+    int  profile_hz;                /*     default: 0 (profiler off) */
 
     /* Module toggles */
     int enable_views;
@@ -80,6 +124,16 @@ void conf_apply_cli(miniweb_conf_t *conf,
                     const char *cli_log_file,
                     int cli_verbose);
 
+/* Apply a configuration reloaded on SIGHUP onto *cur.
+ *   Fields a running server can change (timeouts, limits, cache budgets)
+ *   are stored at once; the names of the others that differ are written
+ *   to changed (may be NULL), comma separated.
+ *
+ * Returns the number of such fields: 0 means next is fully in force,
+ * more means only a new process can apply it. */
+int conf_reload(miniweb_conf_t *cur, const miniweb_conf_t *next,
+                char *changed, size_t changed_len);
+
 /* Print the active configuration to stderr (verbose mode). */
 void conf_dump(const miniweb_conf_t *conf);
 
@@ -0,0 +1,84 @@
+/* counters.h - per-thread server self-instrumentation counters */
+#ifndef MINIWEB_CORE_COUNTERS_H
+#define MINIWEB_CORE_COUNTERS_H
+
+#include <stdint.h>
+
+/*
+ * Monotonic event counters of the server itself. Grouped by the unit
+ * that bumps them; keep each group contiguous, since readers print them
+ * group by group in this order.
+ */
+typedef enum {
+	/* dispatcher */
+	CTR_ACCEPTS,			/* sockets accepted */
+	CTR_ACCEPTS_UNIX,		/* ... of them on unix_socket */
+	CTR_ACCEPT_ERRORS,		/* accept(2) failures but EAGAIN */
+	CTR_ACCEPT_PAUSES,		/* listen filter disabled, pool full */
+	CTR_ACCEPT_SHED,		/* accepted but no connection slot */
+	CTR_EVENTS_QUEUED,		/* readable sockets handed to workers */
+	CTR_QUEUE_DROPS,		/* ... dropped with the queue full */
+	CTR_HEALTH_CHECKS,		/* health_path answered in place */
+	CTR_TIMER_REARM_FAILURES,	/* idle checks kept back, no memory */
+	/* worker */
+	CTR_REQUESTS,			/* requests dispatched to a handler */
+	CTR_KEEPALIVE_REUSE,		/* ... on an already used connection */
+	CTR_LANE_HANDOFFS,		/* requests moved to the other lane */
+	CTR_SHED_FAST,			/* past deadline on the fast lane */
+	CTR_SHED_SLOW,			/* ... on the slow lane */
+	CTR_WRITE_PARKED,		/* responses left for EVFILT_WRITE */
+	CTR_KEVENT_CHANGES,		/* re-arms batched */
+	CTR_KEVENT_CALLS,		/* kevent() calls submitting them */
+	CTR_STATUS_503,			/* 503 answers, any path */
+	/* work queue */
+	CTR_QUEUE_PUSHES,
+	CTR_QUEUE_FULL,			/* pushes refused */
+	CTR_QUEUE_WAITS,		/* pops that parked on the condvar */
+	/* connection pool */
+	CTR_CONN_OPENED,
+	CTR_CONN_CLOSED,
+	CTR_CONN_REFUSED,		/* no slot or over max_conns */
+	/* response pool */
+	CTR_RESP_LOCAL,			/* from the thread's free list */
+	CTR_RESP_SHARED,		/* from the overflow pool */
+	CTR_RESP_ALLOC,			/* calloc'd */
+	/* caches */
+	CTR_VIEW_CACHE_HITS,
+	CTR_VIEW_CACHE_MISSES,
+	CTR_MAN_L2_HITS,
+	CTR_MAN_L2_MISSES,
+	CTR_RESPONSE_CACHE_HITS,	/* routes answered by the router cache */
+	CTR_RESPONSE_CACHE_MISSES,
+	/* HTTP/2 */
+	CTR_H2_SESSIONS,
+	CTR_H2_STREAMS,
+	CTR_H2_REFUSED,			/* sessions and streams turned away */
+	/* Rate limiter: requests answered 429, per route class */
+	CTR_RATE_LIMITED_FAST,
+	CTR_RATE_LIMITED_SLOW,
+	/* Keep-alive policy decisions (see keepalive.h) */
+	CTR_KEEPALIVE_EXTENDED,		/* connections reused past 64 requests */
+	CTR_KEEPALIVE_BUDGET_CLOSES,	/* ... closed as their budget ran out */
+	CTR_KEEPALIVE_IDLE_CLOSES,	/* idle, closed before conn_timeout */
+	CTR_COUNT
+} counter_id_t;
+
+/**
+ * Add @p n to counter @p id for the calling thread. Only the owner
+ * writes its block, so this is a plain load and relaxed store on an
+ * unshared cache line: no lock, no locked instruction.
+ */
+void counter_add(counter_id_t id, uint64_t n);
+
+#define counter_inc(id)	counter_add((id), 1)
+
+/** Sum every thread's counters, live and exited, into @p out. */
+void counters_read(uint64_t out[CTR_COUNT]);
+
+/** Group of counter @p id ("dispatcher", "worker", ...). */
+const char *counter_group(counter_id_t id);
+
+/** Name of counter @p id within its group ("accepts", ...). */
+const char *counter_name(counter_id_t id);
+
+#endif /* MINIWEB_CORE_COUNTERS_H */
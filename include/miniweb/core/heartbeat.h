@@ -5,6 +5,10 @@
 #include <stdint.h>
 #include <time.h>
 
+#define HEARTBEAT_MAX_TASKS 32
+/* Ident of the heartbeat's EVFILT_TIMER in heartbeat_use_kqueue() mode. */
+#define HEARTBEAT_TIMER_IDENT 0x6862
+
 /**
  * @brief Heartbeat task callback signature.
  * @param ctx Opaque context pointer registered with the task.
@@ -13,6 +17,10 @@ typedef void (*mw_heartbeat_cb_t)(void *ctx);
 
 /**
  * @brief Periodic task descriptor for heartbeat scheduling.
+ *
+ * Tasks run on a small worker pool, so a slow one delays only itself;
+ * a task never runs on two workers at once. Periods are in seconds here;
+ * heartbeat_register_ms() takes milliseconds instead.
  */
 struct hb_task {
 	const char *name;
@@ -30,8 +38,20 @@ struct hb_task_stats {
 	uint64_t overruns;
 	time_t last_run;
 	int last_error;
+	uint64_t last_duration_ms;	/* of the last completed run */
+	uint64_t period_ms;		/* effective, backoff included */
+	unsigned int backoff;		/* times the period was doubled */
 };
 
+/**
+ * @brief Hands a due task to a worker in heartbeat_use_kqueue() mode.
+ * @param item Task item, a value in 1..HEARTBEAT_MAX_TASKS cast to a
+ *             pointer, for heartbeat_run_item().
+ * @param ctx Context given to heartbeat_use_kqueue().
+ * @return 0 once queued, non-zero when it cannot be.
+ */
+typedef int (*mw_heartbeat_submit_t)(void *item, void *ctx);
+
 enum hb_register_result {
 	HB_REGISTER_ERROR = -1,
 	HB_REGISTER_DUPLICATE = 0,
@@ -40,14 +60,31 @@ enum hb_register_result {
 
 int heartbeat_init(void);
 int heartbeat_register(const struct hb_task *task);
+/* As heartbeat_register(), with the task's seconds fields ignored. */
+int heartbeat_register_ms(const struct hb_task *task,
+	unsigned int period_ms,
+	unsigned int initial_delay_ms);
 int heartbeat_unregister(const char *name);
 int heartbeat_update(const char *name,
 	unsigned int period_sec,
 	unsigned int initial_delay_sec,
 	void *ctx);
+int heartbeat_update_ms(const char *name,
+	unsigned int period_ms,
+	unsigned int initial_delay_ms,
+	void *ctx);
 int heartbeat_get_stats(const char *name, struct hb_task_stats *stats_out);
+/* Calls @p fn for every registered task, under the scheduler lock. */
+int heartbeat_foreach_stats(void (*fn)(const char *name,
+	const struct hb_task_stats *stats, void *ctx), void *ctx);
 int heartbeat_start(void);
 int heartbeat_stop(void);
 int heartbeat_shutdown(int drain);
 
+/* Scheduling from an event loop's kqueue instead of the heartbeat thread. */
+int heartbeat_use_kqueue(int kq_fd, mw_heartbeat_submit_t submit, void *ctx);
+int heartbeat_use_thread(void);
+void heartbeat_kqueue_tick(void);
+void heartbeat_run_item(void *item);
+
 #endif
@@ -0,0 +1,71 @@
+/* lockstat.h - contention statistics for named mutexes */
+#ifndef MINIWEB_CORE_LOCKSTAT_H
+#define MINIWEB_CORE_LOCKSTAT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Hot mutexes are taken through LOCKSTAT_LOCK() and friends, naming a
+ * site declared once per lock (or per family of locks, such as the
+ * file cache shards). A normal build turns the macros into the pthread
+ * calls they wrap. Built with -DMINIWEB_LOCKSTAT ("make lockstat"), a
+ * lock is tried first; a failed try counts as contended and the time
+ * until it is granted as wait. The time from grant to unlock is the
+ * hold; a condition wait ends the hold and starts a new one on wakeup.
+ * /api/stats/server lists the sites under "locks".
+ */
+
+typedef struct lockstat {
+	const char *name;
+	uint64_t acquired;
+	uint64_t contended;		/* ... after a failed trylock */
+	uint64_t wait_ns;
+	uint64_t wait_max_ns;
+	uint64_t hold_ns;
+	uint64_t hold_max_ns;
+	int linked;			/* on the registry list */
+	struct lockstat *next;
+} lockstat_t;
+
+/** Declare the statistics of lock site @p var, shown as @p name. */
+#define LOCKSTAT_SITE(var, name) \
+	static lockstat_t var = { name, 0, 0, 0, 0, 0, 0, 0, NULL }
+
+int lockstat_lock(pthread_mutex_t *m, lockstat_t *s);
+int lockstat_trylock(pthread_mutex_t *m, lockstat_t *s);
+int lockstat_unlock(pthread_mutex_t *m, lockstat_t *s);
+int lockstat_cond_wait(pthread_cond_t *c, pthread_mutex_t *m,
+    lockstat_t *s);
+int lockstat_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m,
+    lockstat_t *s, const struct timespec *abstime);
+
+/**
+ * Call @p fn for every site taken at least once, in first-use order.
+ * Returns the number of calls; always 0 without MINIWEB_LOCKSTAT.
+ */
+int lockstat_foreach(void (*fn)(const lockstat_t *s, void *ctx),
+    void *ctx);
+
+#ifdef MINIWEB_LOCKSTAT
+#define LOCKSTAT_LOCK(m, site)		lockstat_lock((m), &(site))
+#define LOCKSTAT_TRYLOCK(m, site)	lockstat_trylock((m), &(site))
+#define LOCKSTAT_UNLOCK(m, site)	lockstat_unlock((m), &(site))
+#define LOCKSTAT_COND_WAIT(c, m, site) \
+	lockstat_cond_wait((c), (m), &(site))
+#define LOCKSTAT_COND_TIMEDWAIT(c, m, site, ts) \
+	lockstat_cond_timedwait((c), (m), &(site), (ts))
+#else
+#define LOCKSTAT_LOCK(m, site)		((void)&(site), pthread_mutex_lock(m))
+#define LOCKSTAT_TRYLOCK(m, site) \
+	((void)&(site), pthread_mutex_trylock(m))
+#define LOCKSTAT_UNLOCK(m, site) \
+	((void)&(site), pthread_mutex_unlock(m))
+#define LOCKSTAT_COND_WAIT(c, m, site) \
+	((void)&(site), pthread_cond_wait((c), (m)))
+#define LOCKSTAT_COND_TIMEDWAIT(c, m, site, ts) \
+	((void)&(site), pthread_cond_timedwait((c), (m), (ts)))
+#endif
+
+#endif /* MINIWEB_CORE_LOCKSTAT_H */
@@ -3,6 +3,7 @@
 #define MINIWEB_CORE_LOG_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 int log_init(const char *path, int verbose);
 void log_close(void);
@@ -11,5 +12,6 @@ void log_info(const char *fmt, ...);
 void log_debug(const char *fmt, ...);
 void log_error(const char *fmt, ...);
 void log_errno(const char *context);
+uint64_t log_dropped(void);
 
 #endif
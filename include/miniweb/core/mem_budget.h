@@ -0,0 +1,60 @@
+/* mem_budget.h - process-wide memory budget across caches */
+#ifndef MINIWEB_CORE_MEM_BUDGET_H
+#define MINIWEB_CORE_MEM_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_BUDGET_MAX_CACHES 16
+
+/*
+ * A memory consumer. usage() reports the bytes it holds and its running
+ * hit count, which tells hot caches from cold ones; shrink() frees about
+ * @p bytes of its coldest entries and returns what it freed. Fixed
+ * allocations (rings) leave shrink NULL: they count towards the budget
+ * but are never asked to give memory back. Both are called one check
+ * at a time, from the heartbeat; they take their own locks and must not
+ * call back into the budget.
+ */
+struct mem_cache_ops {
+	const char *name;
+	size_t (*usage)(uint64_t *hits, void *ctx);
+	size_t (*shrink)(size_t bytes, void *ctx);
+	void *ctx;
+};
+
+struct mem_cache_stats {
+	size_t bytes;			/* as of the last check */
+	uint64_t hits;
+	uint64_t shrinks;		/* times asked to shrink */
+	uint64_t shrunk;		/* bytes it gave back */
+};
+
+/** Add a consumer; copies @p ops. Returns 0, or -1 when the table is full. */
+int mem_budget_register(const struct mem_cache_ops *ops);
+
+/** Add a fixed allocation of @p bytes; counted, never shrunk. */
+int mem_budget_register_fixed(const char *name, size_t bytes);
+
+/** Total bytes all consumers may hold; 0 only measures. */
+void mem_budget_set(size_t bytes);
+
+/**
+ * Measure every consumer and, over budget, shrink the coldest ones, by hit
+ * rate per byte held, until usage is back under 90% of the budget.
+ * Returns the bytes in use afterwards.
+ */
+size_t mem_budget_check(void);
+
+/** Run mem_budget_check() every second from the heartbeat. */
+int mem_budget_start(void);
+
+/**
+ * Call @p fn for every consumer; @p budget and @p used get the totals.
+ * Returns the number of consumers.
+ */
+int mem_budget_foreach(void (*fn)(const char *name,
+    const struct mem_cache_stats *stats, void *ctx), void *ctx,
+    size_t *budget, size_t *used);
+
+#endif /* MINIWEB_CORE_MEM_BUDGET_H */
@@ -0,0 +1,44 @@
+/* profile.h - in-process SIGPROF sampling profiler */
+#ifndef MINIWEB_CORE_PROFILE_H
+#define MINIWEB_CORE_PROFILE_H
+
+#include <stddef.h>
+
+/*
+ * While enabled, ITIMER_PROF delivers SIGPROF profile_hz times per second
+ * of CPU the process uses, to whichever thread is running, and the
+ * handler stores that thread's stack in the next slot of a preallocated
+ * ring. The ring holds the last PROFILE_SAMPLES stacks; samples are
+ * aggregated into folded stacks ("root;...;leaf count" lines, the input
+ * of flame graph tools) only when read.
+ */
+
+#define PROFILE_HZ_MAX		1000
+#define PROFILE_DEPTH		32	/* frames kept per sample */
+#define PROFILE_SAMPLES		8192
+
+/**
+ * Sample @p hz times per CPU second, or stop with 0. Starting from off
+ * clears the ring. Returns -1 when the buffer, the handler or the timer
+ * cannot be set up.
+ */
+int profile_enable(int hz);
+
+/** Current rate, 0 when off. */
+int profile_hz(void);
+
+/** Samples taken since the ring was last cleared. */
+unsigned long profile_samples(void);
+
+/**
+ * Folded stacks of the samples in the ring, most frequent first, as a
+ * heap string the caller frees. Frames are symbol names, or with @p raw
+ * (or when no symbol covers them) object+0xoffset for offline lookup.
+ * NULL on allocation failure.
+ */
+char *profile_folded(int raw, size_t *len);
+
+/** Stop sampling and free the ring. */
+void profile_cleanup(void);
+
+#endif /* MINIWEB_CORE_PROFILE_H */
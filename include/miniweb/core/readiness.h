@@ -0,0 +1,58 @@
+/* readiness.h - startup warm-up and the readiness state */
+#ifndef MINIWEB_CORE_READINESS_H
+#define MINIWEB_CORE_READINESS_H
+
+#include <stdint.h>
+
+/*
+ * Each part that warms up at startup (templates, rings, indexes, the
+ * static file cache) is expected by name before it starts and reports
+ * when it is done, from whichever thread did the work. Once startup has
+ * sealed the list and nothing is pending, the instance is ready, and it
+ * stays ready: later refreshes of the same parts do not count. The
+ * readiness endpoint, and relayd's check of it, keep traffic away from
+ * an instance that is still warming up.
+ */
+
+#define READINESS_MAX		16
+#define READINESS_NAME_MAX	32
+
+struct readiness_task {
+	char name[READINESS_NAME_MAX];
+	int done;
+	int rc;			/* what the task returned; 0 when reported */
+	uint64_t ms;		/* from the first expect to done */
+};
+
+/** Expect @p name to report. Returns 0, or -1 when the table is full. */
+int readiness_expect(const char *name);
+
+/** @p name is warm. Unknown names and second reports are ignored. */
+void readiness_done(const char *name);
+
+/**
+ * Expect @p name and run @p fn(@p arg) on a thread of its own, done
+ * when it returns. Returns 0, or -1 when it ran on the caller's thread
+ * because no thread could be started.
+ */
+int readiness_run(const char *name, int (*fn)(void *), void *arg);
+
+/** Wait until @p name is done; its result, or -1 when not expected. */
+int readiness_wait(const char *name);
+
+/** No more parts will be expected; ready as soon as none is pending. */
+void readiness_seal(void);
+
+/** Whether warm-up has finished. Lock free. */
+int readiness_ready(void);
+
+/** Milliseconds warm-up took, 0 while it runs. */
+uint64_t readiness_ms(void);
+
+/** Copy up to @p max tasks into @p out; returns the number copied. */
+int readiness_list(struct readiness_task *out, int max);
+
+/** Forget every task and the ready state. */
+void readiness_reset(void);
+
+#endif /* MINIWEB_CORE_READINESS_H */
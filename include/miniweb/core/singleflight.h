@@ -0,0 +1,39 @@
+/* singleflight.h - coalesce concurrent computations of the same key */
+#ifndef MINIWEB_CORE_SINGLEFLIGHT_H
+#define MINIWEB_CORE_SINGLEFLIGHT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define SINGLEFLIGHT_KEY_MAX	256
+
+/**
+ * @brief Produce the value for a key.
+ * @param arg Value given to singleflight_do().
+ * @param len Set to the byte length of the result.
+ * @return Heap buffer now owned by the group, or NULL on failure.
+ */
+typedef char *(*singleflight_fn)(void *arg, size_t *len);
+
+struct singleflight_call;
+
+/* Calls in flight for one cache; static storage, no setup needed. */
+typedef struct singleflight_group {
+	pthread_mutex_t lock;
+	struct singleflight_call *calls;
+} singleflight_group_t;
+
+#define SINGLEFLIGHT_GROUP_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, NULL }
+
+/**
+ * Run @p fn for @p key unless another thread already is, in which case
+ * wait for that run and share its result. Every caller gets its own heap
+ * copy (or the original, for the last one out) and must free it; a NULL
+ * result is handed to every waiter alike. @p shared, when not NULL, is
+ * set to 1 for callers that did not run @p fn themselves. Keys longer
+ * than SINGLEFLIGHT_KEY_MAX - 1 bytes are not coalesced.
+ */
+char *singleflight_do(singleflight_group_t *g, const char *key,
+    singleflight_fn fn, void *arg, size_t *len, int *shared);
+
+#endif
@@ -0,0 +1,49 @@
+/* snapshot.h - publish immutable, refcounted snapshots without reader locks */
+#ifndef MINIWEB_CORE_SNAPSHOT_H
+#define MINIWEB_CORE_SNAPSHOT_H
+
+#include <pthread.h>
+
+/*
+ * A snapshot is any structure that starts with a snapshot_t and is never
+ * changed once published. A slot holds the current one: readers take a
+ * reference with a few atomic operations and no lock, a writer swaps in
+ * the successor and the previous one is freed when its last reader lets
+ * go. Writers to one slot are serialized by its lock; readers never
+ * wait on them.
+ */
+typedef struct snapshot {
+	unsigned int refs;
+	void (*free)(struct snapshot *s);	/* run by the last release */
+} snapshot_t;
+
+/* Where a snapshot is published; static storage, no setup needed. */
+typedef struct snapshot_slot {
+	snapshot_t *cur;
+	unsigned int epoch;		/* its parity picks readers[] */
+	unsigned int readers[2];	/* between loading cur and ref */
+	pthread_mutex_t lock;		/* writers only */
+} snapshot_slot_t;
+
+#define SNAPSHOT_SLOT_INITIALIZER \
+	{ NULL, 0, { 0, 0 }, PTHREAD_MUTEX_INITIALIZER }
+
+/** Give @p s its first reference, to be dropped by @p free_fn. */
+void snapshot_init(snapshot_t *s, void (*free_fn)(snapshot_t *s));
+
+/** Take another reference on @p s (not NULL) and return it. */
+snapshot_t *snapshot_ref(snapshot_t *s);
+
+/** Drop one reference on @p s, which may be NULL. */
+void snapshot_release(snapshot_t *s);
+
+/** Reference on the current snapshot of @p slot, or NULL when none. */
+snapshot_t *snapshot_acquire(snapshot_slot_t *slot);
+
+/**
+ * Make @p s (may be NULL) current in @p slot, taking over the caller's
+ * reference, and drop the slot's reference on the previous one.
+ */
+void snapshot_publish(snapshot_slot_t *slot, snapshot_t *s);
+
+#endif /* MINIWEB_CORE_SNAPSHOT_H */
@@ -0,0 +1,59 @@
+/* snapshot_delta.h - which members of a polled JSON snapshot changed */
+#ifndef MINIWEB_CORE_SNAPSHOT_DELTA_H
+#define MINIWEB_CORE_SNAPSHOT_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_DELTA_SECTIONS	24
+#define SNAPSHOT_DELTA_WINDOW	128	/* versions a since= may name */
+
+/** One top-level member of a snapshot: bytes [off, off + len) of it. */
+typedef struct {
+	size_t off;
+	size_t len;
+} snapshot_span_t;
+
+/*
+ * Change history of one snapshot, guarded by the owner's snapshot lock.
+ * Zero-initialised storage is an empty history.
+ */
+typedef struct snapshot_delta {
+	size_t nsections;
+	uint64_t hash[SNAPSHOT_DELTA_SECTIONS];
+	unsigned long changed[SNAPSHOT_DELTA_SECTIONS];	/* last version */
+	unsigned long versions[SNAPSHOT_DELTA_WINDOW];
+	int64_t ts[SNAPSHOT_DELTA_WINDOW];	/* newest sample of each */
+	size_t head;
+	size_t count;
+} snapshot_delta_t;
+
+/**
+ * Record that @p version of the snapshot, built from samples up to @p ts,
+ * is @p json with its members at @p spans. A member whose bytes differ
+ * from the previous version's is marked changed at @p version; spans past
+ * SNAPSHOT_DELTA_SECTIONS are ignored.
+ */
+void snapshot_delta_publish(snapshot_delta_t *d, unsigned long version,
+    int64_t ts, const char *json, const snapshot_span_t *spans, size_t n);
+
+/**
+ * Map a since= value, either a version of the last SNAPSHOT_DELTA_WINDOW
+ * ones or a Unix time within them, to the version a client holding it
+ * has and the newest sample time of that version. Returns 0, or -1 when
+ * it is too old or unknown and the client needs the full snapshot.
+ */
+int snapshot_delta_resolve(const snapshot_delta_t *d,
+    unsigned long long since, unsigned long *version, int64_t *ts);
+
+/** Whether member @p section changed after @p version. */
+int snapshot_delta_changed(const snapshot_delta_t *d, size_t section,
+    unsigned long version);
+
+/**
+ * Read since=<number> from the query string @p qs (may be NULL).
+ * Returns 1 and sets @p since when present and numeric, 0 otherwise.
+ */
+int snapshot_delta_query(const char *qs, unsigned long long *since);
+
+#endif
@@ -0,0 +1,35 @@
+/* vnode_watch.h - kqueue EVFILT_VNODE change notifications */
+#ifndef MINIWEB_CORE_VNODE_WATCH_H
+#define MINIWEB_CORE_VNODE_WATCH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Change callback, run on the watch thread.
+ * @param fd Descriptor that was registered.
+ * @param fflags NOTE_* bits describing the change.
+ * @param token Value given to vnode_watch_add().
+ */
+typedef void (*vnode_watch_fn)(int fd, unsigned int fflags, uintptr_t token);
+
+typedef struct vnode_watch vnode_watch_t;
+
+/**
+ * Create a watch group delivering to @p fn. Each group owns a kqueue
+ * nested in the shared watch thread's, so callbacks of one group never
+ * see another group's descriptors. Returns NULL when kqueue is not
+ * available; callers then fall back to validating on access.
+ */
+vnode_watch_t *vnode_watch_create(vnode_watch_fn fn);
+
+/**
+ * Watch @p fd (a file or directory opened read-only) for writes, size or
+ * attribute changes, deletion, rename and revoke. The
+ * caller keeps the descriptor; close(2) ends the watch. Returns 0 or -1.
+ */
+int vnode_watch_add(vnode_watch_t *w, int fd, uintptr_t token);
+
+/** Stop the watch thread and free every group; none may be used after. */
+void vnode_watch_shutdown(void);
+
+#endif
@@ -0,0 +1,47 @@
+/* arena.h - Per-request bump allocator */
+
+#ifndef MINIWEB_HTTP_ARENA_H
+#define MINIWEB_HTTP_ARENA_H
+
+#include <stddef.h>
+
+#define HTTP_ARENA_CHUNK	(64 * 1024)
+
+/*
+ * Bump-pointer arena for memory that lives exactly as long as one request.
+ * Each worker thread owns one; the dispatcher attaches it to the request
+ * and resets it once the handler has returned, so handlers never free
+ * what they take from it. The first chunk is kept across resets; larger
+ * or overflow chunks go back to malloc.
+ */
+typedef struct http_arena_chunk {
+	struct http_arena_chunk *next;
+	size_t cap;
+	size_t used;
+} http_arena_chunk_t;
+
+typedef struct http_arena {
+	http_arena_chunk_t *head;   /* chunk currently bumped */
+	size_t bytes;               /* bytes handed out since the last reset */
+	size_t peak;                /* largest bytes seen at a reset */
+} http_arena_t;
+
+/** Return @p len bytes aligned for any scalar type, or NULL. */
+void *http_arena_alloc(http_arena_t *a, size_t len);
+
+/** Copy @p len bytes of @p src into the arena and NUL-terminate them. */
+char *http_arena_strndup(http_arena_t *a, const char *src, size_t len);
+
+/** Copy a NUL-terminated string into the arena. */
+char *http_arena_strdup(http_arena_t *a, const char *src);
+
+/** Drop every allocation, keeping the first chunk for reuse. */
+void http_arena_reset(http_arena_t *a);
+
+/** Release all chunks; the arena may be reused afterwards. */
+void http_arena_destroy(http_arena_t *a);
+
+/** The calling thread's arena, created on first use; NULL on failure. */
+http_arena_t *http_arena_thread(void);
+
+#endif /* MINIWEB_HTTP_ARENA_H */
@@ -0,0 +1,63 @@
+/* bundle.h - static files and templates compiled into the binary */
+#ifndef MINIWEB_HTTP_BUNDLE_H
+#define MINIWEB_HTTP_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <miniweb/http/handler.h>
+
+/*
+ * The make step runs miniweb-bundle over static/ and templates/ and
+ * compiles the table it writes (build/bundle_data.c) into the server.
+ * Each file is named by its path from the source tree, e.g.
+ * "static/css/app.css" or "templates/base.html", and carries the type,
+ * ETag and gzip variant the server would otherwise work out at run
+ * time. Entries are sorted by name; every body is followed by a NUL
+ * that len does not count.
+ */
+typedef struct bundle_file {
+	const char *name;
+	const char *mime;
+	const char *etag;		/* strong, from the content hash */
+	uint64_t hash;			/* FNV-1a of the body */
+	const unsigned char *data;
+	size_t len;
+	const unsigned char *gz;	/* gzip variant, or NULL */
+	size_t gz_len;
+	const char *gz_etag;		/* of the variant, which needs its own */
+} bundle_file_t;
+
+extern const bundle_file_t bundle_files[];
+extern const size_t bundle_file_count;
+
+/**
+ * Serve from the bundle (nonzero) or from static_dir and templates_dir
+ * only (0, the default until set). Startup only.
+ */
+void bundle_set_enabled(int enabled);
+
+/** Whether the bundle is in use. */
+int bundle_enabled(void);
+
+/**
+ * Entry named by the first @p len bytes of @p name, or NULL when there
+ * is none or the bundle is not in use.
+ */
+const bundle_file_t *bundle_lookup(const char *name, size_t len);
+
+/**
+ * Call @p fn for each entry whose name starts with @p prefix, in name
+ * order; nothing when the bundle is not in use.
+ */
+void bundle_foreach(const char *prefix, void (*fn)(const bundle_file_t *f,
+    void *ctx), void *ctx);
+
+/**
+ * Send @p f as http_send_file() would send the file: the gzip variant
+ * when accepted, 304 on a matching If-None-Match, one Range answered
+ * with 206. The body is written straight from the binary.
+ */
+int http_send_bundle(http_request_t *req, const bundle_file_t *f);
+
+#endif /* MINIWEB_HTTP_BUNDLE_H */
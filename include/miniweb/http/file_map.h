@@ -0,0 +1,47 @@
+/* file_map.h - Shared read-only mappings of large static files */
+
+#ifndef MINIWEB_HTTP_FILE_MAP_H
+#define MINIWEB_HTTP_FILE_MAP_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <time.h>
+
+#define HTTP_FILE_MAP_SLOTS 16
+
+/**
+ * One mmap'd file. Mappings of hot files stay in a small table keyed by
+ * path and validated against device, inode, size and mtime, so repeated
+ * downloads reuse the same pages. Every in-flight response holds a
+ * reference; a mapping leaves the table on eviction or when the file
+ * changes and is unmapped once the last reference is dropped.
+ */
+typedef struct http_file_map {
+	char path[512];
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	const char *base;   /* PROT_READ, MAP_SHARED */
+	size_t len;
+	int refs;           /* responses streaming from it */
+	int cached;         /* still reachable from the table */
+	time_t last_used;
+} http_file_map_t;
+
+/**
+ * Return a referenced mapping of @p fd (opened from @p path, described by
+ * @p st), reusing a cached one when it is still current. NULL when the
+ * file cannot be mapped; the caller keeps @p fd either way.
+ */
+http_file_map_t *http_file_map_acquire(const char *path, int fd,
+    const struct stat *st);
+
+/** Drop one reference taken by http_file_map_acquire(). */
+void http_file_map_release(http_file_map_t *m);
+
+/** Unmap every cached mapping nobody is streaming from. */
+void http_file_map_cleanup(void);
+
+#endif /* MINIWEB_HTTP_FILE_MAP_H */
@@ -0,0 +1,36 @@
+/* gzip.h - gzip content-coding for generated responses */
+
+#ifndef MINIWEB_HTTP_GZIP_H
+#define MINIWEB_HTTP_GZIP_H
+
+#include <stddef.h>
+
+#include <miniweb/http/handler.h>
+
+/* Bodies below this size go out as-is: the framing would eat the gain. */
+#define HTTP_GZIP_MIN_BYTES 1024
+
+/**
+ * Compress @p len bytes of @p data into a new single-reference blob with
+ * no prepared headers. Meant for payloads built once and served many
+ * times (heartbeat snapshots). Returns NULL on failure.
+ */
+http_blob_t *http_gzip_blob(const char *data, size_t len);
+
+/**
+ * Gzip the body of @p resp in place when its type compresses, it is at
+ * least HTTP_GZIP_MIN_BYTES and the client accepts gzip. The encoded body
+ * lives in req->arena (malloc'd and owned by @p resp without one); a
+ * previously owned body is freed. Compressible types always get
+ * Vary: Accept-Encoding. Returns 1 when the body was encoded, else 0.
+ */
+int http_response_gzip(http_request_t *req, http_response_t *resp);
+
+/**
+ * Point @p resp at a pre-compressed @p blob and add the encoding headers.
+ * The caller keeps its reference until the response has been sent.
+ */
+void http_response_set_gzip_blob(http_response_t *resp,
+								 const http_blob_t *blob);
+
+#endif /* MINIWEB_HTTP_GZIP_H */
@@ -4,8 +4,13 @@
 #define MINIWEB_HTTP_HANDLER_H
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <stddef.h>
+#include <time.h>
+#include <miniweb/http/arena.h>
+#include <miniweb/http/output.h>
+#include <miniweb/http/request_parser.h>
 #include <miniweb/render/template_engine.h>
 
 /* HTTP request structure.
@@ -13,21 +18,39 @@
  * hdr_scratch / ip_scratch are per-request buffers used by
  * http_request_get_header() and http_request_get_client_ip() so that
  * those helpers are thread-safe without any static storage.
+ *
+ * The hdr_* index is built by the first header lookup: one case-folded
+ * name hash per header, over the parser's spans or, for requests built
+ * without them, over hdr_spans parsed from @c buffer once.
  */
 typedef struct http_request {
 	int fd;                          /* Client socket */
 	const char *method;              /* GET, POST, etc. */
-	const char *url;                 /* Request path */
+	int method_id;                   /* HTTP_METHOD_*; 0: from method */
+	const char *url;                 /* Request target, query included */
+	size_t path_len;                 /* url bytes before '?'; 0: unsplit */
+	const char *query;               /* After '?' in url, or NULL */
 	const char *version;             /* HTTP/1.1 */
 	int keep_alive;                  /* 1 if connection should stay open */
 	const char *buffer;              /* Full raw request buffer */
 	size_t buffer_len;               /* Bytes in buffer */
-	struct sockaddr_in *client_addr; /* Peer address */
+	struct sockaddr_in *client_addr; /* Peer; AF_UNIX: unix_socket */
+	const http_header_span_t *headers; /* Parsed header offsets into buffer */
+	int header_count;                /* 0 when headers is NULL */
+	http_output_t *out;              /* Async write queue; NULL = blocking */
+	http_arena_t *arena;             /* Freed after the handler; may be NULL */
+	int status;                      /* Status of the last response sent */
+	size_t bytes_out;                /* Head and body bytes sent or queued */
+	size_t capture_max;              /* Keep a 200 body up to this; 0: off */
+	struct http_blob *captured;      /* That copy; the caller releases it */
 
 	/* Per-request scratch space — written by helper functions,
 	 * valid only for the lifetime of the request.            */
 	char hdr_scratch[1024];
 	char ip_scratch[INET_ADDRSTRLEN];
+	const char *hdr_index_of;        /* buffer hdr_hash[] describes */
+	uint32_t hdr_hash[HTTP_PARSER_MAX_HEADERS];
+	http_header_span_t hdr_spans[HTTP_PARSER_MAX_HEADERS]; /* no parser */
 } http_request_t;
 
 /* HTTP response structure */
@@ -37,11 +60,46 @@ typedef struct http_response {
 	char *body;
 	size_t body_len;
 	int free_body;
-	int pool_shard_idx;
+	int stream;                      /* HTTP_STREAM_*; body_len unused */
 	char headers[2048];
 	size_t headers_len;
 } http_response_t;
 
+/* http_response_t.stream: how a body of unknown length is delimited. */
+#define HTTP_STREAM_NONE 0               /* Content-Length: body_len */
+#define HTTP_STREAM_CHUNKED 1            /* Transfer-Encoding: chunked */
+#define HTTP_STREAM_CLOSE 2              /* until the connection closes */
+
+/*
+ * Body sent in pieces as it is produced. The writer waits for the socket
+ * whenever more than HTTP_STREAM_WINDOW bytes are queued, so memory stays
+ * bounded at any body size.
+ */
+typedef struct http_stream {
+	http_request_t *req;
+	int mode;                        /* HTTP_STREAM_CHUNKED or _CLOSE */
+	int failed;                      /* a write failed; the rest is dropped */
+} http_stream_t;
+
+/*
+ * Complete response kept ready to send: the body plus one serialized
+ * header block per Connection variant, so a hit is a single writev with
+ * no formatting. Immutable once published and shared by reference.
+ */
+#define HTTP_BLOB_HEAD_MAX 512
+
+typedef struct http_blob {
+	int refs;
+	int status;                      /* status code of the prepared head */
+	size_t head_len[2];              /* [keep_alive]; 0 = not prepared */
+	char head[2][HTTP_BLOB_HEAD_MAX];
+	size_t len;
+	char data[];
+} http_blob_t;
+
+#define HTTP_ETAG_MAX 64
+#define HTTP_DATE_MAX 32
+
 /* Handler function type */
 typedef int (*http_handler_t)(http_request_t *req);
 
@@ -62,6 +120,40 @@ void http_response_add_header(http_response_t *resp,
 /** Serialize and send a complete HTTP response to the client socket. */
 int  http_response_send(http_request_t *req, http_response_t *resp);
 
+/**
+ * Send @p resp with a body gathered from @p body; resp->body is ignored.
+ * The spans are only read during the call, so borrowed memory works.
+ */
+int  http_response_send_iov(http_request_t *req, http_response_t *resp,
+								const struct iovec *body, int iovcnt);
+
+/**
+ * Send the head of @p resp for a streamed body: chunked for HTTP/1.1,
+ * close-delimited (and no keep-alive) for HTTP/1.0. resp->body is ignored.
+ */
+int  http_stream_begin(http_stream_t *s, http_request_t *req,
+							http_response_t *resp);
+
+/** Send @p len bytes of the body; copied before the call returns. */
+int  http_stream_write(http_stream_t *s, const void *data, size_t len);
+
+/**
+ * Send the spans of @p body, at most 16, as one piece of the body; like
+ * http_stream_write(), they are only read during the call.
+ */
+int  http_stream_writev(http_stream_t *s, const struct iovec *body,
+							int iovcnt);
+
+/** Finish the body; returns -1 if any part of it failed to send. */
+int  http_stream_end(http_stream_t *s);
+
+/**
+ * Flush what is queued for @p req and return a duplicate of its socket
+ * that the caller owns; the request's connection closes after the
+ * handler. -1 on error.
+ */
+int  http_request_detach(http_request_t *req);
+
 /** Free response object and owned body buffer when configured. */
 void http_response_free(http_response_t *resp);
 
@@ -77,9 +169,124 @@ const char *http_request_get_client_ip(http_request_t *req);
 /** Return 1 when request is HTTPS (direct or forwarded), else 0. */
 int         http_request_is_https(http_request_t *req);
 
+/** HTTP_METHOD_* of @p req, interned from @c method when not parsed. */
+int         http_request_method(const http_request_t *req);
+
+/** Length of the path part of @p req->url, before any '?'. */
+size_t      http_request_path_len(const http_request_t *req);
+
+/** Query string of @p req without the '?', or NULL when it has none. */
+const char *http_request_query(const http_request_t *req);
+
+/** Allocate a blob with room for @p len body bytes and one reference. */
+http_blob_t *http_blob_alloc(size_t len);
+
+/** Take another reference on @p blob and return it. */
+http_blob_t *http_blob_ref(http_blob_t *blob);
+
+/** Drop one reference; the last holder frees the blob. */
+void http_blob_release(http_blob_t *blob);
+
+/**
+ * Serialize both header variants of @p resp (status, type, extra headers)
+ * for the blob's body. Returns -1 when they do not fit.
+ */
+int http_blob_prepare(http_blob_t *blob, const http_response_t *resp);
+
+/** Send a prepared blob with the header block matching req->keep_alive. */
+int http_blob_send(http_request_t *req, const http_blob_t *blob);
+
+/** Format a strong ETag for a file from its inode, size and mtime. */
+void http_etag_for_file(const struct stat *st, char *buf, size_t cap);
+
+/**
+ * Format an ETag for generated content identified by a version counter;
+ * @p kind tells resources apart (e.g. 'm' metrics, 'n' networking).
+ */
+void http_etag_for_version(char kind, unsigned long version, char *buf,
+						   size_t cap);
+
+/** Format @p t as an IMF-fixdate (Sun, 06 Nov 1994 08:49:37 GMT). */
+void http_format_date(time_t t, char *buf, size_t cap);
+
+/**
+ * Return 1 when the request's If-None-Match (or, without it,
+ * If-Modified-Since) shows the client already holds this representation.
+ * @p last_modified may be 0 when the resource has no modification time.
+ */
+int http_request_not_modified(http_request_t *req, const char *etag,
+							  time_t last_modified);
+
+/**
+ * Return 1 when Accept-Encoding lists @p coding (or "*") without q=0.
+ */
+int http_request_accepts_encoding(http_request_t *req, const char *coding);
+
+/** Add ETag and, when @p last_modified is non-zero, Last-Modified headers. */
+void http_response_add_validators(http_response_t *resp, const char *etag,
+								  time_t last_modified);
+
+/** Send 304 Not Modified carrying the validators; no body is touched. */
+int http_send_not_modified(http_request_t *req, const char *etag,
+						   time_t last_modified);
+
+/**
+ * Resolve the request's Range header against a @p size byte representation
+ * identified by @p etag / @p last_modified (checked against If-Range).
+ * Only a single "bytes=" range is honoured; anything else means the full
+ * body. Returns 1 with *off / *len set for a 206, 0 for a full 200, or -1
+ * when the range is not satisfiable (416).
+ */
+int http_request_range(http_request_t *req, size_t size, const char *etag,
+					   time_t last_modified, size_t *off, size_t *len);
+
+/**
+ * Apply the request's Range to the in-memory body of a 200 @p resp: on
+ * success it becomes a 206 carrying Content-Range and only the requested
+ * bytes; an unsatisfiable range turns it into an empty 416. Returns the
+ * resulting status code.
+ */
+int http_response_apply_range(http_request_t *req, http_response_t *resp,
+							  const char *etag, time_t last_modified);
+
+/**
+ * Set the total byte budget of the static file cache (file_cache_mb);
+ * 0 disables it. Call at startup, before requests are served.
+ */
+void http_file_cache_set_budget(size_t bytes);
+
+/** Static file cache occupancy and counters, summed over its shards. */
+typedef struct {
+	unsigned long entries;
+	size_t bytes;
+	size_t budget;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long inserts;
+	unsigned long rejects;          /* newcomers that lost to a victim */
+	unsigned long evictions;
+} http_file_cache_stats_t;
+
+void http_file_cache_stats(http_file_cache_stats_t *out);
+
+/**
+ * Preload up to @p budget bytes of the static tree under @p root into the
+ * file cache from a background thread (warmup_mb). Files get the same
+ * headers, ETag and gzip variant selection as on a miss.
+ * Returns 0, or -1 when the thread could not be started.
+ */
+int http_file_cache_warm_start(const char *root, size_t budget);
+
+/** Stop the warm-up, if still running, and join its thread. */
+void http_file_cache_warm_stop(void);
+
 /** Send a plain-text error response with the given status code. */
 int http_send_error(http_request_t *req, int status_code, const char *message);
 
+/** http_send_error() with Retry-After: @p retry_sec when it is above 0. */
+int http_send_error_retry(http_request_t *req, int status_code,
+    const char *message, int retry_sec);
+
 /** Send JSON with HTTP 200 status. */
 int http_send_json (http_request_t *req, const char *json);
 
@@ -90,6 +297,24 @@ int http_send_html (http_request_t *req, const char *html);
 int http_send_file (http_request_t *req, const char *path,
 						const char *content_type);
 
+/**
+ * Send @p resp (status, type, headers) with its body streamed from open
+ * file @p fd, zero-copy from a shared mapping on the async path, honouring
+ * Range and If-Range against @p etag. @p fd is always consumed; @p resp
+ * stays with the caller.
+ */
+int http_send_fd(http_request_t *req, http_response_t *resp,
+				 const char *path, int fd, const struct stat *st,
+				 const char *etag);
+
+/**
+ * Copy @p len bytes into the request arena (NUL-terminated), or into a
+ * malloc'd buffer when the request has none. @p owned is set to 1 in the
+ * malloc case so the caller can pass it straight to free_body.
+ */
+char *http_request_copy(http_request_t *req, const char *src, size_t len,
+						int *owned);
+
 /** Render a template response with optional fallback template name. */
 int http_render_template(http_request_t *req, struct template_data *data,
 							 const char *fallback_template);
@@ -0,0 +1,66 @@
+/* hpack.h - HPACK header compression for HTTP/2 (RFC 7541) */
+
+#ifndef MINIWEB_HTTP_HPACK_H
+#define MINIWEB_HTTP_HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_TABLE_SIZE	4096	/* SETTINGS_HEADER_TABLE_SIZE default */
+#define HPACK_ENTRY_OVERHEAD	32
+#define HPACK_MAX_ENTRIES	(HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+/*
+ * Decoder state of one connection: the dynamic table the peer's encoder
+ * mirrors, newest entry first. Entries are one allocation each, name
+ * and value back to back. A zeroed struct is not ready; use
+ * hpack_decoder_init().
+ */
+typedef struct hpack_entry {
+	char *name;		/* value follows the name's NUL */
+	size_t name_len;
+	size_t value_len;
+} hpack_entry_t;
+
+typedef struct hpack_decoder {
+	hpack_entry_t ent[HPACK_MAX_ENTRIES];
+	size_t first;		/* ring slot of the newest entry */
+	size_t count;
+	size_t size;		/* RFC 7541 size of the entries held */
+	size_t max_size;	/* set by the peer, at most limit */
+	size_t limit;		/* what we advertised */
+} hpack_decoder_t;
+
+/** Called once per decoded field; returning non-zero stops decoding. */
+typedef int (*hpack_emit_t)(const char *name, size_t name_len,
+    const char *value, size_t value_len, void *ctx);
+
+void hpack_decoder_init(hpack_decoder_t *d);
+void hpack_decoder_free(hpack_decoder_t *d);
+
+/**
+ * Decode one complete header block. Returns 0, -1 on a compression
+ * error (the connection is unusable after it), or the emitter's
+ * non-zero value.
+ */
+int hpack_decode(hpack_decoder_t *d, const uint8_t *block, size_t len,
+    hpack_emit_t emit, void *ctx);
+
+/**
+ * Encode one field at @p dst, from the static table where it helps and
+ * never into the dynamic table, so the encoder keeps no state. Names
+ * must already be lower case. Returns the bytes written, or 0 when
+ * @p cap is too small; hpack_encoded_max() bounds what is needed.
+ */
+size_t hpack_encode(uint8_t *dst, size_t cap, const char *name,
+    size_t name_len, const char *value, size_t value_len);
+
+/** Upper bound of hpack_encode() for a field of these lengths. */
+#define hpack_encoded_max(name_len, value_len) \
+	((name_len) + (value_len) + 16)
+
+/** Decode Huffman-coded @p src into @p dst; returns the length or -1. */
+long hpack_huffman_decode(const uint8_t *src, size_t len, char *dst,
+    size_t cap);
+
+#endif /* MINIWEB_HTTP_HPACK_H */
@@ -0,0 +1,74 @@
+/* json.h - Growable single-pass JSON writer */
+
+#ifndef MINIWEB_HTTP_JSON_H
+#define MINIWEB_HTTP_JSON_H
+
+#include <stddef.h>
+
+#include <miniweb/http/arena.h>
+
+/*
+ * A cursor over one growing buffer. Every call appends at the end, so a
+ * document costs one pass however it is assembled, and the buffer grows
+ * by doubling, so there is no truncation and amortised O(1) per byte.
+ * Backed by a request arena, growth takes a fresh block from it and the
+ * handler never frees; otherwise it is malloc'd and json_finish() hands
+ * it to the caller. A failed allocation poisons the writer: later calls
+ * do nothing and json_finish() returns NULL, so callers check once.
+ */
+typedef struct json_writer {
+	char *buf;		/* NUL-terminated once anything was written */
+	size_t len;
+	size_t cap;
+	http_arena_t *arena;	/* backing store, or NULL for malloc */
+	int failed;
+} json_writer_t;
+
+/** Start an empty document of about @p hint bytes; 0 on success. */
+int json_init(json_writer_t *w, http_arena_t *arena, size_t hint);
+
+/**
+ * Room for @p n more bytes and a NUL at the end of @p w, for appenders
+ * that format into a plain buffer; json_commit() then claims what they
+ * wrote. NULL once the writer failed.
+ */
+char *json_reserve(json_writer_t *w, size_t n);
+
+/** Claim @p n bytes written at json_reserve()'s pointer. */
+void json_commit(json_writer_t *w, size_t n);
+
+/** Append @p len raw bytes. */
+void json_raw(json_writer_t *w, const char *s, size_t len);
+
+/** Append a raw NUL-terminated string. */
+void json_puts(json_writer_t *w, const char *s);
+
+/** Append one raw character. */
+void json_putc(json_writer_t *w, char c);
+
+/** Append printf output, raw. */
+void json_printf(json_writer_t *w, const char *fmt, ...);
+
+/** Append @p len bytes of @p s escaped, without quotes. */
+void json_escaped(json_writer_t *w, const char *s, size_t len);
+
+/** Append @p s as a quoted, escaped string; NULL becomes null. */
+void json_str(json_writer_t *w, const char *s);
+
+/**
+ * The document, NUL-terminated, with its length in @p len (may be NULL).
+ * A malloc'd buffer passes to the caller. NULL if anything failed; the
+ * writer's memory is released then.
+ */
+char *json_finish(json_writer_t *w, size_t *len);
+
+/** Drop what was written. */
+void json_discard(json_writer_t *w);
+
+/** Bytes @p len bytes of @p s take once escaped. */
+size_t json_escaped_len(const char *s, size_t len);
+
+/** Escape @p len bytes of @p s at @p dst; returns the end, unterminated. */
+char *json_escape_put(char *dst, const char *s, size_t len);
+
+#endif /* MINIWEB_HTTP_JSON_H */
@@ -0,0 +1,73 @@
+/* output.h - Per-connection pending output for the async write path */
+
+#ifndef MINIWEB_HTTP_OUTPUT_H
+#define MINIWEB_HTTP_OUTPUT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stddef.h>
+
+#define HTTP_OUTPUT_FILE_CHUNK (64 * 1024)
+#define HTTP_OUTPUT_MAP_WINDOW (256 * 1024)
+/* Unsent bytes one queue may buffer, above the largest body built. */
+#define HTTP_OUTPUT_QUEUED_MAX (16 * 1024 * 1024)
+
+struct http_file_map;
+
+/**
+ * Bytes a handler could not write without blocking. The worker hands the
+ * connection back to the event loop with EVFILT_WRITE and the rest is
+ * flushed when the socket drains. A zeroed struct is an empty queue.
+ * Queuing past HTTP_OUTPUT_QUEUED_MAX fails, which closes the connection,
+ * and the buffers of all queues count towards the memory budget as
+ * "output".
+ */
+typedef struct http_output {
+	char *buf;          /* queued bytes (owned) */
+	size_t len;
+	size_t off;         /* bytes of buf already written */
+	size_t cap;
+	int file_queued;    /* file tail below is pending */
+	int file_fd;        /* owned; closed once fully sent */
+	off_t file_off;
+	off_t file_left;
+	struct http_file_map *map; /* referenced; released once fully sent */
+	size_t map_off;
+	size_t map_left;
+	int keep_alive;     /* keep-alive decision of the request in flight */
+} http_output_t;
+
+/** Return 1 when bytes are still queued for the socket. */
+int http_output_pending(const http_output_t *o);
+
+/** Write @p iov without blocking and queue whatever the socket refused. */
+int http_output_writev(http_output_t *o, int sock, struct iovec *iov,
+    int iovcnt);
+
+/** Queue bytes without attempting a write; the next flush sends them. */
+int http_output_queue(http_output_t *o, const void *data, size_t n);
+
+/** Queue @p len bytes of @p fd from @p off; takes ownership of @p fd. */
+int http_output_queue_file(http_output_t *o, int fd, off_t off, off_t len);
+
+/**
+ * Queue @p len bytes of the mapping @p m from @p off; takes over the
+ * caller's reference. Written straight from the mapping, together with
+ * any queued header bytes, in HTTP_OUTPUT_MAP_WINDOW slices.
+ */
+int http_output_queue_map(http_output_t *o, struct http_file_map *m,
+    size_t off, size_t len);
+
+/**
+ * Write queued bytes until drained or the socket would block.
+ * @return 1 when drained, 0 on EAGAIN, -1 on socket or file error.
+ */
+int http_output_flush(http_output_t *o, int sock);
+
+/** Drop queued output, free the buffer, close/release any queued file. */
+void http_output_reset(http_output_t *o);
+
+/** Bytes held by the buffers of every output queue. */
+size_t http_output_held(void);
+
+#endif /* MINIWEB_HTTP_OUTPUT_H */
@@ -0,0 +1,111 @@
+/* request_parser.h - Resumable HTTP/1.x request-head parser */
+
+#ifndef MINIWEB_HTTP_REQUEST_PARSER_H
+#define MINIWEB_HTTP_REQUEST_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_PARSER_MAX_HEADERS 32
+#define HTTP_PARSER_METHOD_MAX  32
+#define HTTP_PARSER_URL_MAX     512
+#define HTTP_PARSER_VERSION_MAX 32
+
+enum http_parser_state {
+	HTTP_PARSER_REQUEST_LINE = 0,	/* zeroed parser is ready to use */
+	HTTP_PARSER_HEADERS,
+	HTTP_PARSER_DONE,
+	HTTP_PARSER_ERROR
+};
+
+/* Request methods, interned while the request line is parsed. */
+enum http_method {
+	HTTP_METHOD_OTHER = 0,	/* not below; the text is all there is */
+	HTTP_METHOD_GET,
+	HTTP_METHOD_HEAD,
+	HTTP_METHOD_POST,
+	HTTP_METHOD_PUT,
+	HTTP_METHOD_DELETE,
+	HTTP_METHOD_OPTIONS,
+	HTTP_METHOD_PATCH,
+	HTTP_METHOD_COUNT
+};
+
+enum http_version {
+	HTTP_VERSION_OTHER = 0,
+	HTTP_VERSION_1_0,
+	HTTP_VERSION_1_1
+};
+
+enum http_connection_hint {
+	HTTP_CONN_DEFAULT = 0,	/* no Connection header: version decides */
+	HTTP_CONN_CLOSE,
+	HTTP_CONN_KEEP_ALIVE
+};
+
+/* How the request says its body is framed. */
+enum http_body_framing {
+	HTTP_BODY_NONE = 0,	/* no body */
+	HTTP_BODY_LENGTH,	/* content_length bytes follow the head */
+	HTTP_BODY_CHUNKED,	/* any Transfer-Encoding */
+	HTTP_BODY_INVALID	/* bad or conflicting Content-Length */
+};
+
+#define HTTP_BODY_LENGTH_MAX	(1ULL << 53)	/* larger is INVALID */
+
+/** Offsets of one header line inside the connection buffer. */
+typedef struct http_header_span {
+	uint16_t name_off;
+	uint16_t name_len;
+	uint16_t value_off;
+	uint16_t value_len;
+} http_header_span_t;
+
+/**
+ * Parser state kept in the connection between recv() calls.
+ * Every byte is examined once: feeding more data resumes at @c pos.
+ * Offsets are relative to the start of the request buffer.
+ */
+typedef struct http_request_parser {
+	int state;
+	size_t pos;             /* next byte to scan */
+	size_t line_start;      /* start of the line being scanned */
+	size_t head_len;        /* request head length incl. blank line */
+	uint16_t method_off, method_len;
+	uint16_t url_off, url_len;
+	uint16_t version_off, version_len;
+	uint16_t path_len;      /* URL bytes before '?' */
+	uint8_t method;         /* HTTP_METHOD_* */
+	uint8_t version;        /* HTTP_VERSION_* */
+	int connection;         /* HTTP_CONN_* from the Connection header */
+	int body;               /* HTTP_BODY_* */
+	uint64_t content_length; /* with HTTP_BODY_LENGTH */
+	int header_count;
+	http_header_span_t headers[HTTP_PARSER_MAX_HEADERS];
+} http_request_parser_t;
+
+/** Reset parser state for a new request. */
+void http_request_parser_reset(http_request_parser_t *p);
+
+/**
+ * Scan bytes [p->pos, len) of @p buf.
+ * @return 1 when the request head is complete, 0 when more data is needed,
+ * -1 on a malformed request line.
+ */
+int http_request_parser_feed(http_request_parser_t *p, const char *buf,
+    size_t len);
+
+/** HTTP_METHOD_* for the @p len bytes at @p s; HTTP_METHOD_OTHER if unknown. */
+int http_method_parse(const char *s, size_t len);
+
+/** Canonical name of @p method, or NULL for HTTP_METHOD_OTHER. */
+const char *http_method_name(int method);
+
+/** "HTTP/1.0" or "HTTP/1.1" for @p version, or NULL for HTTP_VERSION_OTHER. */
+const char *http_version_name(int version);
+
+/** Resolve keep-alive from the parsed version and Connection header. */
+int http_request_parser_keep_alive(const http_request_parser_t *p,
+    const char *buf);
+
+#endif /* MINIWEB_HTTP_REQUEST_PARSER_H */
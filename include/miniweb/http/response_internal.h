@@ -7,24 +7,55 @@
 
 #define WRITE_RETRY_LIMIT 5
 #define WRITE_WAIT_MS 50
-#define FILE_CACHE_SLOTS 32
 #define FILE_CACHE_MAX_BYTES (256 * 1024)
-#define FILE_CACHE_INSERTS_PER_SEC 8
-#define FILE_CACHE_MAX_AGE_SEC 240
-#define RESPONSE_POOL_SHARDS 16
+#define FILE_CACHE_BUDGET_BYTES (32 * 1024 * 1024)
+#define RESPONSE_CACHE_LOCAL 16         /* free responses kept per thread */
+#define RESPONSE_CACHE_GLOBAL 256       /* shared overflow pool */
 #define FILE_CACHE_SHARDS 16
+#define FILE_CACHE_BUCKETS 128          /* per shard, power of two */
+#define FILE_CACHE_MAX_ENTRIES (FILE_CACHE_BUCKETS * 3 / 4)
+#define FILE_CACHE_EVICT_MAX 8          /* victims one insert may displace */
+#define FILE_CACHE_SKETCH_ROWS 4
+#define FILE_CACHE_SKETCH_WIDTH 256     /* per row, power of two */
+#define FILE_CACHE_SKETCH_SAMPLE 2048   /* requests between halvings */
+#define FILE_CACHE_WATCH_DIRS 64        /* directories with a vnode watch */
+#define FILE_CACHE_WATCH_MAX 256        /* descriptors held by file watches */
+#define FILE_CACHE_PATH_MAX 1024
+#define HTTP_HEAD_END_MAX 48            /* "Date: ...\r\n\r\n" */
+#define HTTP_SEND_IOV_MAX 16            /* body spans per http_response_send_iov() */
+#define HTTP_STREAM_WINDOW (64 * 1024)  /* queued stream bytes before waiting */
+
+/* http_file_cache_peek() modes. */
+#define FILE_CACHE_PEEK_ANY 0
+#define FILE_CACHE_PEEK_NOGZ 1
+#define FILE_CACHE_PEEK_SIDECAR 2
 
 void http_handler_globals_init_once(void);
-void http_response_pool_init_shards(void);
 
 http_response_t *http_response_pool_acquire(void);
 int http_response_pool_release(http_response_t *resp);
+void http_response_pool_cleanup(void);
 
-int http_file_cache_lookup(const char *path, const struct stat *st, char **out,
-    size_t *out_len);
+http_blob_t *http_file_cache_lookup(const char *path, const struct stat *st,
+    unsigned long nogz_epoch);
+http_blob_t *http_file_cache_peek(const char *path, int mode,
+    struct stat *st);
 void http_file_cache_store(const char *path, const struct stat *st,
-    const char *data, size_t len);
+    http_blob_t *blob, unsigned long nogz_epoch);
+unsigned long http_file_cache_epoch(void);
+int http_file_cache_hot(void (*fn)(const char *path, void *ctx), void *ctx);
+long http_file_preload(const char *path, const char *mime,
+    const char *encoding);
+
+int http_response_format_head(const http_response_t *resp, int keep_alive,
+    char *buf, size_t cap);
+size_t http_response_head_end(char *buf);
+int http_response_emit(http_request_t *req, struct iovec *iov, int iovcnt);
+void http_response_capture(http_request_t *req, const http_response_t *resp,
+    const struct iovec *body, int iovcnt);
+void http_response_capture_drop(http_request_t *req);
 
+int http_response_drain(http_request_t *req, size_t keep);
 int http_response_write_all(int fd, const void *buf, size_t n);
 int http_response_writev_all(int fd, struct iovec *iov, int iovcnt);
 const char *http_response_status_text(int status_code);
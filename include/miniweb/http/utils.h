@@ -4,6 +4,7 @@
 #define MINIWEB_HTTP_UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /** Escape a UTF-8 string for safe embedding in JSON values. */
 char *json_escape_string(const char *src);
@@ -17,6 +18,9 @@ int url_decode(const char *src, char *dst, size_t dst_len);
 /** Return a best-effort content type for a path by extension. */
 const char *mime_type_for_path(const char *path);
 
+/** Return 1 for text-like types worth serving with a content-coding. */
+int mime_type_is_compressible(const char *mime);
+
 /**
  * Execute a shell command and capture stdout/stderr up to max_size bytes.
  *
@@ -39,4 +43,66 @@ char *safe_popen_read(const char *cmd, size_t max_size);
 char *safe_popen_read_argv(const char *path, char *const argv[],
 							   size_t max_size, int timeout_seconds, size_t *out_len);
 
+/** safe_popen_stream_argv() consumer; nonzero stops reading. */
+typedef int (*safe_popen_cb)(const char *data, size_t len, void *ctx);
+
+/**
+ * Execute a binary with argv[] and pass its stdout to @p cb as it arrives.
+ *
+ * @param path Executable absolute/relative path.
+ * @param argv Argument vector for execv (must be NULL-terminated).
+ * @param timeout_seconds Hard timeout for child process.
+ * @param cb Called with each piece of output.
+ * @param ctx Passed through to @p cb.
+ * @return 0 at end of output, 1 when @p cb stopped it, -1 on failure/timeout.
+ */
+int safe_popen_stream_argv(const char *path, char *const argv[],
+						   int timeout_seconds, safe_popen_cb cb, void *ctx);
+
+/* Counters of one subprocess governor budget. */
+struct subprocess_stats {
+	int limit;			/* runs allowed at once */
+	int running;
+	int queued;			/* callers waiting for a slot */
+	uint64_t started;
+	uint64_t rejected;		/* queue full, or no slot in time */
+	uint64_t p99_ms;		/* runtime, over the last 128 runs */
+};
+
+/**
+ * Set the subprocess governor's global limits: runs at once, callers
+ * waiting at once (0: none wait), and the longest wait in milliseconds.
+ */
+void subprocess_governor_configure(int max_running, int max_queued,
+								   int wait_ms);
+
+/**
+ * Call @p fn for the global budget ("all"), then for each command's.
+ * Runs under the governor lock. Returns the number of calls.
+ */
+int subprocess_foreach_stats(void (*fn)(const char *name,
+	const struct subprocess_stats *stats, void *ctx), void *ctx);
+
+/**
+ * Fork the helper that starts subprocesses, so the server is not forked
+ * once it is large. Call early, before threads are started.
+ *
+ * @return 0 on success, -1 when commands will be forked directly.
+ */
+int spawn_helper_start(void);
+
+/** Stop the spawn helper, killing commands it still runs. */
+void spawn_helper_stop(void);
+
+/**
+ * Have the spawn helper run a binary with stdout on a pipe.
+ *
+ * @param path Executable path.
+ * @param argv Argument vector for execv (must be NULL-terminated).
+ * @param timeout_seconds Hard timeout, enforced by the helper.
+ * @return Read end of the pipe, or -1 when the helper cannot run it.
+ */
+int spawn_helper_run(const char *path, char *const argv[],
+					 int timeout_seconds);
+
 #endif /* MINIWEB_HTTP_UTILS_H */
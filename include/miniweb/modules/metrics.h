@@ -39,8 +39,12 @@ typedef struct {
 	long total_mb;
 	long used_mb;
 	int percent_used;
+	int stale;		/* last probe overdue or failed */
 } DiskInfo;
 
+/* Mounted filesystems tracked by the disk collector. */
+#define METRICS_DISKS_MAX 16
+
 typedef struct {
 	int port;
 	char protocol[16];
@@ -63,6 +67,9 @@ typedef struct {
 	char command[256];
 } ProcessInfo;
 
+/* Length of the top CPU and top memory process lists. */
+#define METRICS_TOP_PROCS 10
+
 /* --- Main Functions --- */
 
 /**
@@ -76,9 +83,54 @@ typedef struct {
 char *get_system_metrics_json(void);
 
 /**
- * cpu frequency sample for json
+ * Same snapshot as get_system_metrics_json(), copied into @p arena so the
+ * caller frees nothing. A NULL @p arena falls back to a malloc'd copy.
+ * @p version (optional) receives the snapshot version, used as its ETag.
+ */
+char *get_system_metrics_json_arena(http_arena_t *arena,
+    unsigned long *version);
+
+/**
+ * Like get_system_metrics_json_arena(), but returns NULL instead of
+ * collecting inline when the snapshot is missing or stale. For pages
+ * that embed the snapshot and must not wait for a collection.
+ */
+char *metrics_snapshot_json_arena(http_arena_t *arena,
+    unsigned long *version);
+
+/**
+ * Version of the snapshot that would be served now, or 0 when it is
+ * missing or stale. Lets a handler answer 304 without copying the JSON.
+ */
+unsigned long metrics_snapshot_version(void);
+
+/**
+ * Gzip form of the snapshot, compressed once when it was published.
+ * Returns a reference (release with http_blob_release()) and its version,
+ * or NULL under the same conditions metrics_snapshot_version() returns 0.
+ */
+http_blob_t *metrics_snapshot_gzip(unsigned long *version);
+
+/**
+ * What changed in the snapshot since the client's @p since, a version it
+ * was sent or a Unix time: the members that differ and the history
+ * samples after it, copied into @p arena (malloc'd when NULL). Returns
+ * NULL when the snapshot is missing or stale, or @p since is too old to
+ * answer from; the caller then sends the full snapshot.
+ */
+char *metrics_snapshot_delta_arena(http_arena_t *arena,
+    unsigned long long since, unsigned long *version);
+
+/**
+ * History covering the last @p span seconds as min/avg/max buckets, from
+ * the finest downsampled tier that spans it, copied into @p arena
+ * (malloc'd when NULL). NULL when the sampler is not running.
  */
-void metrics_json_append_cpu_freq(char *buffer, size_t size);
+char *metrics_history_json_arena(http_arena_t *arena, unsigned int span);
+
+/** Start the sampler, refilling its history from the store when open. */
+void metrics_snapshot_start(void);
+
 void metrics_init_cpu_freq(void);
 int  metrics_get_cpu_freq_mhz(void);
 
@@ -93,6 +145,84 @@ int  metrics_get_cpu_freq_mhz(void);
  */
 int metrics_handler(http_request_t *req);
 
+/**
+ * @brief HTTP handler for /api/metrics/history?span=<seconds>.
+ *
+ * Downsampled min/avg/max history; 600 seconds when span is absent.
+ */
+int metrics_history_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/metrics/stream.
+ *
+ * Server-Sent Events: the snapshot, then a delta after every update.
+ */
+int metrics_sse_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/dashboard?fields=<name>,...
+ *
+ * The cached metrics and networking snapshots, or those named by fields,
+ * as the members of one object.
+ */
+int metrics_dashboard_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/stats/server.
+ *
+ * The server's own counters, summed across threads at request time.
+ */
+int metrics_server_stats_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/stats/trace.
+ *
+ * Phase breakdowns of the latest and the slowest traced requests.
+ */
+int metrics_trace_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/admin/caches.
+ *
+ * Size, entries and hit ratio of every cache; loopback clients only.
+ */
+int metrics_caches_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for POST /api/admin/caches/purge.
+ *
+ * Drops one key, or every key under a prefix; loopback clients only.
+ */
+int metrics_caches_purge_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /api/stats/profile.
+ *
+ * Folded stacks from the sampling profiler; loopback clients only.
+ */
+int metrics_profile_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for POST /api/admin/profile.
+ *
+ * Starts, retunes or stops the sampling profiler; loopback clients only.
+ */
+int metrics_profile_admin_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for GET /api/ready.
+ *
+ * 200 once startup warm-up is done, 503 before, with each warm-up task.
+ */
+int metrics_ready_handler(http_request_t *req);
+
+/**
+ * @brief HTTP handler for /metrics.
+ *
+ * OpenMetrics text exposition as rendered on the last sampler tick.
+ */
+int metrics_openmetrics_handler(http_request_t *req);
+
 /* --- Collection Helpers --- */
 
 /**
@@ -154,7 +284,9 @@ int metrics_get_uptime(char *uptime_str, size_t size);
 int metrics_get_hostname(char *hostname, size_t size);
 
 /**
- * Collect mounted filesystem usage information.
+ * Collect mounted filesystem usage information, as last probed by the
+ * metrics.disks task; a mount whose probe is overdue keeps its last good
+ * numbers with stale set.
  *
  * @param disks Output array populated with disk stats.
  * @param max_disks Maximum number of entries that can be written into disks.
@@ -181,21 +313,22 @@ int metrics_get_top_ports(PortInfo *ports, int max_ports);
 int metrics_get_network_interfaces(NetworkInterface *interfaces, int max_interfaces);
 
 /**
- * Collect top processes sorted by CPU usage.
+ * Collect top processes sorted by CPU usage, from the process sample
+ * shared with the metrics snapshot.
  *
  * @param processes Output array receiving process rows.
  * @param max_processes Maximum number of processes to return.
- * @return Number of entries written.
+ * @return Number of entries written, at most METRICS_TOP_PROCS.
  */
 int metrics_get_top_cpu_processes(ProcessInfo *processes, int max_processes);
 
 
 /**
- * Collect top processes sorted by memory usage.
+ * Collect top processes sorted by memory usage, from the same sample.
  *
  * @param processes Output array receiving process rows.
  * @param max_processes Maximum number of processes to return.
- * @return Number of entries written.
+ * @return Number of entries written, at most METRICS_TOP_PROCS.
  */
 int metrics_get_top_memory_processes(ProcessInfo *processes, int max_processes);
 
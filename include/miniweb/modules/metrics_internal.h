@@ -3,6 +3,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
+
+#include <miniweb/core/snapshot.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
 
 typedef struct {
 	int64_t ts;
@@ -16,79 +21,159 @@ typedef struct {
 	uint32_t net_tx;
 } MetricSample;
 
-/**
- * @brief Append the history section to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
- * @param history History samples in chronological order.
- * @param count Number of samples in history.
- */
-void metrics_json_append_history(char *buffer, size_t size, MetricSample *history,
-				 size_t count);
+/* Downsampled history: 1 s for 10 min, 10 s for 6 h, 1 min for 7 days. */
+#define METRIC_TIERS 3
+#define METRIC_TIER_MAX_SPAN (7 * 24 * 3600)
 
-/**
- * @brief Append current CPU statistics to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
- */
-void metrics_json_append_cpu_stats(char *buffer, size_t size);
+/** min/avg/max of one metric over a bucket; the average is sum / n. */
+typedef struct {
+	float min;
+	float max;
+	float sum;
+} MetricStat;
 
-/**
- * @brief Append current memory and swap statistics to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
- */
-void metrics_json_append_memory_stats(char *buffer, size_t size);
+/** One bucket of a tier, aggregated as samples are pushed. */
+typedef struct {
+	int64_t ts;		/* bucket start, a multiple of the step */
+	uint32_t n;		/* samples folded in */
+	uint32_t mem_total;	/* as of the last one */
+	MetricStat cpu;
+	MetricStat mem_used;
+	MetricStat swap_used;
+	MetricStat net_rx;
+	MetricStat net_tx;
+} MetricBucket;
 
-/**
- * @brief Append system load averages to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
- */
-void metrics_json_append_load_average(char *buffer, size_t size);
+typedef struct {
+	unsigned int step;	/* seconds per bucket */
+	size_t capacity;	/* buckets kept */
+	MetricBucket *buf;
+	size_t head;
+	size_t count;
+} MetricTier;
+
+typedef struct {
+	MetricTier tier[METRIC_TIERS];
+} MetricTiers;
 
 /**
- * @brief Append OS identification fields to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
+ * @brief Allocate every tier's buckets.
+ * @return 0 on success, -1 on allocation failure.
  */
-void metrics_json_append_os_info(char *buffer, size_t size);
+int metric_tiers_init(MetricTiers *t);
+
+/** @brief Fold @p s into the current bucket of each tier. */
+void metric_tiers_push(MetricTiers *t, const MetricSample *s);
 
 /**
- * @brief Append human-readable uptime data to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
+ * @brief Copy the buckets of the finest tier that covers @p span seconds.
+ * @param out Destination, chronological; at most @p max buckets, the newest.
+ * @param step Receives the chosen tier's step.
+ * @return Number of buckets copied.
  */
-void metrics_json_append_uptime(char *buffer, size_t size);
+size_t metric_tiers_query(const MetricTiers *t, unsigned int span,
+    MetricBucket *out, size_t max, unsigned int *step);
+
+/** @brief Buckets a query for @p span may return, at most. */
+size_t metric_tiers_capacity(const MetricTiers *t, unsigned int span);
+
+void metric_tiers_free(MetricTiers *t);
+
+/* History store (metrics_store.c): batched SQLite writes of the samples. */
+int metrics_store_start(const char *path, int flush_sec);
+void metrics_store_add(const MetricSample *s);
+int metrics_store_flush(void);
+int64_t metrics_store_reload(int64_t since,
+    void (*fn)(const MetricSample *, void *), void *ctx);
+void metrics_store_cleanup(void);
+
+/* OpenMetrics exposition (metrics_openmetrics.c), rendered once per tick. */
+void metrics_openmetrics_update(const MetricSample *s);
+void metrics_openmetrics_cleanup(void);
+
+/* Process table (metrics_process.c), sampled once per tick. */
+void metrics_process_sample(void);
+void metrics_process_users_refresh(void *ctx);
+void metrics_process_cleanup(void);
+
+/* Disk usage (metrics_disk.c), probed by threads the task never waits on. */
+void metrics_disk_collect(void *ctx);
+void metrics_disk_cleanup(void);
+
+/* The published /api/metrics snapshot (metrics_snapshot.c), immutable. */
+typedef struct metrics_snap {
+	snapshot_t hdr;
+	char *json;
+	size_t len;
+	http_blob_t *gz;		/* same JSON, gzipped; may be NULL */
+	unsigned long version;
+	time_t updated_at;
+} metrics_snap_t;
 
 /**
- * @brief Append mounted filesystem usage data to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
+ * Reference on the current snapshot, rebuilt inline first when it is
+ * missing or stale and @p refresh is set; NULL when there is none fresh.
  */
-void metrics_json_append_disk_info(char *buffer, size_t size);
+metrics_snap_t *metrics_snapshot_acquire(int refresh);
+void metrics_snapshot_release(metrics_snap_t *s);
 
-/**
- * @brief Append top-ports data to a metrics JSON document.
- * @param buffer Destination buffer.
- * @param size Destination buffer size.
+/*
+ * Whether @p req came straight from a loopback or Unix-domain client
+ * (metrics_caches.c); the admin and profile endpoints answer no other.
  */
-void metrics_json_append_top_ports(char *buffer, size_t size);
+int metrics_admin_local(http_request_t *req);
 
-/**
- * @brief Append process-focused metrics sections to a metrics JSON document.
- * @param top_cpu_json Output buffer for top CPU processes.
- * @param top_cpu_json_size Size of top_cpu_json.
- * @param top_mem_json Output buffer for top memory processes.
- * @param top_mem_json_size Size of top_mem_json.
- * @param proc_stats_json Output buffer for aggregate process counts.
- * @param proc_stats_json_size Size of proc_stats_json.
+/* Event stream (metrics_sse.c): one event per update, fanned out. */
+void metrics_sse_publish(void);
+void metrics_sse_cleanup(void);
+
+/*
+ * JSON sections (metrics_json.c), each appended to @p w as one or more
+ * members without the separating comma.
  */
-void metrics_process_append_json_sections(char *top_cpu_json,
-					  size_t top_cpu_json_size,
-					  char *top_mem_json,
-					  size_t top_mem_json_size,
-					  char *proc_stats_json,
-					  size_t proc_stats_json_size);
+
+/** Serialise downsampled history, @p count buckets of @p step seconds. */
+void metrics_json_append_tier(json_writer_t *w, unsigned int span,
+    unsigned int step, const MetricBucket *b, size_t count);
+
+/** The "history" member: @p count samples in chronological order. */
+void metrics_json_append_history(json_writer_t *w, const MetricSample *history,
+    size_t count);
+
+/** "cpu": current CPU statistics. */
+void metrics_json_append_cpu_stats(json_writer_t *w);
+
+/** "cpu_freq_mhz". */
+void metrics_json_append_cpu_freq(json_writer_t *w);
+
+/** "memory" and "swap". */
+void metrics_json_append_memory_stats(json_writer_t *w);
+
+/** "load": system load averages. */
+void metrics_json_append_load_average(json_writer_t *w);
+
+/** "os": OS identification fields. */
+void metrics_json_append_os_info(json_writer_t *w);
+
+/** "uptime", human readable. */
+void metrics_json_append_uptime(json_writer_t *w);
+
+/** "disks": mounted filesystem usage. */
+void metrics_json_append_disk_info(json_writer_t *w);
+
+/** "top_ports": local ports with the most sockets. */
+void metrics_json_append_top_ports(json_writer_t *w);
+
+/** "workers": worker pool size and grow/retire counters. */
+void metrics_json_append_worker_pool(json_writer_t *w);
+
+/** "view_cache": rendered-view cache hit and miss counters. */
+void metrics_json_append_view_cache(json_writer_t *w);
+
+/** "server": self-instrumentation counters and gauges. */
+void metrics_json_append_server(json_writer_t *w);
+
+/** "top_cpu_processes", "top_memory_processes" and "process_stats". */
+void metrics_process_append_json(json_writer_t *w);
 
 #endif
@@ -49,6 +49,13 @@ typedef struct {
     char state[16];
 } NetworkConnection;
 
+typedef struct {
+    char protocol[8];
+    int port;
+    int connections;    /* sockets bound to the local port */
+    int listening;      /* of them, listening TCP or unconnected UDP */
+} NetworkPort;
+
 /* --- Core Collection API --- */
 
 /** Collect kernel routing entries. */
@@ -63,9 +70,42 @@ int networking_get_if_stats(NetStats *stats, int max_interfaces);
 /** Collect active TCP/UDP socket connection entries. */
 int networking_get_connections(NetworkConnection *conns, int max_conns);
 
+/** Local ports with the most sockets, busiest first. */
+int networking_get_top_ports(NetworkPort *ports, int max_ports);
+
 /** Build a JSON payload with networking diagnostics. */
 char *networking_get_json(void);
 
+/**
+ * Same payload as networking_get_json(), copied into @p arena; @p version
+ * (optional) receives its version, used as the ETag.
+ */
+char *networking_get_json_arena(http_arena_t *arena, unsigned long *version);
+
+/** Version of the cached payload, or 0 when none is cached. */
+unsigned long networking_json_version(void);
+
+/**
+ * Gzip form of the cached payload, compressed once per heartbeat. Returns
+ * a reference (release with http_blob_release()), or NULL when none.
+ */
+http_blob_t *networking_json_gzip(unsigned long *version);
+
+/**
+ * The members of the cached payload that changed since @p since, a
+ * version or a Unix time, copied into @p arena (malloc'd when NULL).
+ * NULL when nothing is cached or @p since is too old; send the full one.
+ */
+char *networking_json_delta_arena(http_arena_t *arena,
+    unsigned long long since, unsigned long *version);
+
+/**
+ * Append interface counters, connection and route gauges from the last
+ * sample to @p buf as OpenMetrics families. Returns the length written,
+ * 0 when nothing has been sampled yet or it did not fit.
+ */
+size_t networking_append_openmetrics(char *buf, size_t size);
+
 /* --- HTTP Handlers --- */
 
 /**
@@ -84,6 +124,14 @@ int networking_handler(http_request_t *req);
  */
 int networking_api_handler(http_request_t *req);
 
+/**
+ * Serve the per-interface rate history as JSON.
+ *
+ * @param req Request context.
+ * @return HTTP send result code.
+ */
+int networking_rates_handler(http_request_t *req);
+
 /* Optional compatibility alias. */
 #define networking_page_handler networking_handler
 
@@ -0,0 +1,52 @@
+/* access_log.h - sampled binary access log */
+#ifndef MINIWEB_NET_ACCESS_LOG_H
+#define MINIWEB_NET_ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * File format, all integers little-endian. Every access_log_open()
+ * appends a header naming the routes of this run:
+ *
+ *	"MWAL", version (u8), record size (u8), route count (u16),
+ *	then per route: id (u16), name length (u8), name ("GET /path")
+ *
+ * followed by fixed-size records, each starting with ALOG_REC_REQUEST
+ * so that a header (which starts with 'M') is told apart:
+ *
+ *	 0 kind (u8)      1 method (u8, HTTP_METHOD_*)
+ *	 2 route id (u16) 4 status (u16)  6 reserved (u16)
+ *	 8 IPv4 address, network order (4 bytes)
+ *	12 latency in microseconds (u32, saturated)
+ *	16 bytes sent (u64)
+ *	24 wall-clock time in microseconds since the epoch (u64)
+ *
+ * miniweb-logdump decodes it.
+ */
+#define ALOG_MAGIC		"MWAL"
+#define ALOG_VERSION		1
+#define ALOG_RECORD_SIZE	32
+#define ALOG_REC_REQUEST	1
+
+/**
+ * Start logging to @p path, appending, one request in @p sample (every
+ * 5xx answer is kept regardless). Call after the routes are registered.
+ * @return 0 on success or when @p path is empty, -1 on error.
+ */
+int access_log_open(const char *path, int sample);
+
+/**
+ * Record one request served by the calling thread. A no-op when the log
+ * is closed; otherwise it copies 32 bytes into this thread's buffer.
+ */
+void access_log_record(int route_id, int method, int status, size_t bytes,
+    uint64_t usec, uint32_t addr);
+
+/** Write what is buffered, stop the flusher and close the file. */
+void access_log_close(void);
+
+/** Records written, and records lost to a full flush queue. */
+void access_log_stats(uint64_t *written, uint64_t *dropped);
+
+#endif /* MINIWEB_NET_ACCESS_LOG_H */
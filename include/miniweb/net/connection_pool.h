@@ -2,31 +2,66 @@
 #define MINIWEB_NET_CONNECTION_POOL_H
 
 #include <netinet/in.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 
+#include <miniweb/http/output.h>
+#include <miniweb/http/request_parser.h>
+
 #define MINIWEB_MAX_CONNECTIONS 4096
 #define MINIWEB_REQUEST_BUFFER_SIZE 16384
 
+/*
+ * kevent udata and work-queue items carry a packed (fd, generation) token
+ * instead of a raw pointer: the low bits hold the fd slot, the rest the
+ * generation (truncated on 32-bit targets). Generations start at 1, so a
+ * valid token is never 0/NULL.
+ */
+#define MINIWEB_CONN_TOKEN_FD_BITS 12	/* log2(MINIWEB_MAX_CONNECTIONS) */
+#define MINIWEB_CONN_TOKEN_FD_MASK \
+	(((uintptr_t)1 << MINIWEB_CONN_TOKEN_FD_BITS) - 1)
+#define MINIWEB_CONN_TOKEN_PACK(fd, gen) \
+	((void *)(((uintptr_t)(gen) << MINIWEB_CONN_TOKEN_FD_BITS) | \
+	    ((uintptr_t)(fd) & MINIWEB_CONN_TOKEN_FD_MASK)))
+#define MINIWEB_CONN_TOKEN_FD(tok) \
+	((int)((uintptr_t)(tok) & MINIWEB_CONN_TOKEN_FD_MASK))
+/*
+ * Queue items with generation 0 are never connections; the slow lane
+ * carries heartbeat task items (see heartbeat_use_kqueue()) as those.
+ */
+#define MINIWEB_CONN_TOKEN_IS_TASK(tok) \
+	((tok) != NULL && ((uintptr_t)(tok) >> MINIWEB_CONN_TOKEN_FD_BITS) == 0)
+
 typedef struct miniweb_connection {
 	int fd;
 	struct sockaddr_in addr;
-	char buffer[MINIWEB_REQUEST_BUFFER_SIZE];
+	char *buffer;			/* request buffer; NULL while idle */
+	size_t buffer_cap;
 	size_t bytes_read;
+	http_request_parser_t parser;	/* resumes where the last recv() stopped */
+	http_output_t out;		/* response bytes awaiting EVFILT_WRITE */
+	uint64_t body_left;		/* body of the last request yet to drop */
+	uint64_t enqueued_ms;		/* monotonic ms of the last queue push */
+	uint64_t trace_queued_ns;	/* same in ns, while tracing */
 	time_t created;
 	time_t last_activity;
 	int requests_served;
 	unsigned int gen;
+	int busy;			/* a worker or the idle timer owns it */
 } miniweb_connection_t;
 
+/**
+ * fd-indexed connection table. All fields are accessed with atomics: the
+ * free-list is a tagged Treiber stack (head = tag << 32 | slot + 1) and
+ * conn_gen[] is bumped with release ordering on every free.
+ */
 typedef struct miniweb_connection_pool {
 	miniweb_connection_t *connections[MINIWEB_MAX_CONNECTIONS];
 	unsigned int conn_gen[MINIWEB_MAX_CONNECTIONS];
-	pthread_mutex_t lock;
 	int active_connections;
 	miniweb_connection_t pool[MINIWEB_MAX_CONNECTIONS];
-	int free_stack[MINIWEB_MAX_CONNECTIONS];
-	int free_top;
+	int free_next[MINIWEB_MAX_CONNECTIONS];
+	uint64_t free_head;
 } miniweb_connection_pool_t;
 
 /** Initialize the in-memory O(1) connection pool and free-list. */
@@ -34,10 +69,21 @@ void miniweb_connection_pool_init(miniweb_connection_pool_t *pool);
 /** Allocate a connection slot for an accepted socket. */
 miniweb_connection_t *miniweb_connection_alloc(miniweb_connection_pool_t *pool,
     int fd, struct sockaddr_in *addr, int max_conns);
+/** Number of connection slots currently in use. */
+int miniweb_connection_pool_active(miniweb_connection_pool_t *pool);
 /** Free an fd-backed connection slot and bump generation counter. */
 void miniweb_connection_free(miniweb_connection_pool_t *pool, int fd);
 /** Validate kevent udata against fd slot and generation counter. */
 int miniweb_connection_is_stale(miniweb_connection_pool_t *pool, int fd,
     miniweb_connection_t *conn);
+/** Pack the (fd, generation) token used as kevent udata / queue item. */
+void *miniweb_connection_token(const miniweb_connection_t *conn);
+/** Resolve a token to its live connection, or NULL when it is stale. */
+miniweb_connection_t *miniweb_connection_from_token(
+    miniweb_connection_pool_t *pool, void *token);
+/** Take @p conn for serving or closing; 0 when someone else has it. */
+int miniweb_connection_claim(miniweb_connection_t *conn);
+/** Give @p conn back to its kqueue, restarting its idle time. */
+void miniweb_connection_release(miniweb_connection_t *conn);
 
 #endif
@@ -0,0 +1,58 @@
+/* h2.h - HTTP/2 over cleartext TCP with prior knowledge (RFC 9113) */
+
+#ifndef MINIWEB_NET_H2_H
+#define MINIWEB_NET_H2_H
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+/*
+ * A client that knows the server speaks h2c opens with the connection
+ * preface instead of a request line; with h2c enabled the worker hands
+ * such a connection to a session thread of its own, which multiplexes
+ * its streams. Each stream becomes an HTTP/1.1 request head that the
+ * regular dispatch path answers on one end of a socketpair, from a
+ * shared pool of h2c_threads stream threads; the session reads the
+ * response off the other end and frames it. Handlers never know.
+ */
+
+#define H2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN		24
+#define H2_MAX_SESSIONS		64	/* beyond: GOAWAY ENHANCE_YOUR_CALM */
+#define H2_MAX_STREAMS		100	/* SETTINGS_MAX_CONCURRENT_STREAMS */
+#define H2_HEAD_MAX		16384	/* request head handed to dispatch */
+
+/**
+ * Answer the request head @p head (@p len bytes, NUL terminated and
+ * writable) on @p fd, then return; the caller closes @p fd.
+ */
+typedef void (*h2_dispatch_t)(int fd, struct sockaddr_in *addr, char *head,
+    size_t len);
+
+/**
+ * Set the stream pool size, taken when the first session starts, the
+ * idle timeout of a session and the dispatch function. Called again on
+ * reload, only the timeout changes.
+ */
+void h2_configure(int threads, int idle_sec, h2_dispatch_t dispatch);
+
+/**
+ * Compare the first @p len bytes read on a connection with the preface.
+ * Returns 1 when they start with all of it, 0 when they are a prefix of
+ * it (read more) and -1 when the connection speaks something else.
+ */
+int h2_preface_match(const char *buf, size_t len);
+
+/**
+ * Serve @p fd, whose first @p len bytes @p buf (preface included) were
+ * already read, on a session thread. The session works on a duplicate
+ * of @p fd, so the caller closes and forgets its own. Returns 0, or -1
+ * when the session could not start and the client was told so.
+ */
+int h2_session_start(int fd, const struct sockaddr_in *addr,
+    const char *buf, size_t len);
+
+/** Sessions being served now. */
+int h2_session_count(void);
+
+#endif /* MINIWEB_NET_H2_H */
@@ -0,0 +1,84 @@
+#ifndef MINIWEB_NET_HANDOFF_H
+#define MINIWEB_NET_HANDOFF_H
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Listener handoff to a successor process. The running server forks and
+ * re-executes its own binary with the listen sockets inherited as fds
+ * 3..3+n-1 (named in MINIWEB_LISTEN_FDS) and the write end of a pipe
+ * (MINIWEB_READY_FD). The successor adopts the listeners, starts serving
+ * and writes one byte to the pipe; on that byte the predecessor stops
+ * accepting and drains. EOF without the byte means the successor died
+ * and the predecessor keeps serving.
+ *
+ * Caches hand over what they hold through a third fd (MINIWEB_STATE_FD):
+ * an unlinked file of sections, one per handoff_state_register() caller,
+ * each a "@name" line followed by the lines that caller wrote.
+ */
+
+#define HANDOFF_MAX_LISTENERS 17	/* MINIWEB_MAX_DISPATCHERS + Unix */
+
+/**
+ * Remember argv and the binary path for handoff_spawn(), and pick up the
+ * listeners and ready pipe of a predecessor, if any. Call first in main().
+ */
+int handoff_init(int argc, char *argv[]);
+
+/** Absolute path of the running binary, or NULL when unknown. */
+const char *handoff_self_path(void);
+
+/** Number of listeners inherited from a predecessor. */
+int handoff_inherited(void);
+
+/**
+ * Inherited listener @p index when it is bound to @p sa, or -1. One that
+ * is bound elsewhere (the port changed) is closed.
+ */
+int handoff_take_listener(int index, const struct sockaddr_in *sa);
+
+/**
+ * The inherited Unix-domain listener bound to @p path, wherever it is
+ * in the list, or -1. Take it before the TCP listeners, whose indices
+ * it may occupy.
+ */
+int handoff_take_unix_listener(const char *path);
+
+/**
+ * Close the inherited listeners no shard took and tell the predecessor
+ * this process is serving. No-op when not started by a handoff.
+ */
+void handoff_ready(void);
+
+/* One cache taking part in the state handoff. */
+struct handoff_state_ops {
+	const char *name;		/* section name: no spaces, unique */
+	/* Predecessor, before the successor starts: write lines to @p f. */
+	void (*save)(FILE *f, void *ctx);
+	/* Successor: one inherited line of the section, without '\n'. */
+	void (*load)(const char *line, void *ctx);
+	void *ctx;
+};
+
+/**
+ * Take part in handoffs. The inherited lines of the section, if any, go
+ * to load() before this returns. Returns 0, or -1 when the table is full.
+ */
+int handoff_state_register(const struct handoff_state_ops *ops);
+
+/**
+ * Write every section to a new unlinked file; returns its fd, rewound,
+ * or -1.
+ */
+int handoff_state_save(void);
+
+/**
+ * Start a successor holding @p fds as its listeners and @p state_fd
+ * (from handoff_state_save(), or -1) as its state. On success returns
+ * its pid and stores the read end of its ready pipe in @p ready_fd.
+ */
+pid_t handoff_spawn(const int *fds, int nfds, int state_fd, int *ready_fd);
+
+#endif
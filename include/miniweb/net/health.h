@@ -0,0 +1,65 @@
+/* health.h - health checks answered by the dispatcher */
+#ifndef MINIWEB_NET_HEALTH_H
+#define MINIWEB_NET_HEALTH_H
+
+#include <stddef.h>
+
+#include <miniweb/net/work_queue.h>
+
+/*
+ * A GET or HEAD of health_path that arrives whole as the first request
+ * of a connection is answered by the dispatcher shard that saw it
+ * readable: one peek, one send of a response serialized at startup, and
+ * the socket is closed. No worker, parser or route is involved, so the
+ * answer does not queue behind the traffic it reports on. Anything else,
+ * including a check split over several reads, goes through the worker
+ * as usual and gets the same answer from the route health_path also
+ * registers.
+ *
+ * The state is worked out from what is cheap to read: readiness, drain
+ * mode and the depth of the shard's work queue.
+ */
+
+#define HEALTH_PATH_MAX		64
+#define HEALTH_PEEK_MAX		512	/* request bytes looked at */
+#define HEALTH_QUEUE_BUSY	(MINIWEB_QUEUE_CAPACITY / 4 * 3)
+
+typedef enum {
+	HEALTH_OK = 0,
+	HEALTH_STARTING,		/* warm-up not done */
+	HEALTH_BUSY,			/* work queue close to full */
+	HEALTH_DRAINING,		/* a new process is serving */
+	HEALTH_COUNT
+} health_state_t;
+
+/**
+ * Answer health checks for @p path, "" for none. Serializes every
+ * response; -1 when @p path is too long or not absolute.
+ */
+int health_configure(const char *path);
+
+/** The configured path, "" when off. */
+const char *health_path(void);
+
+/** State for a work queue @p depth deep, or draining. */
+health_state_t health_state(unsigned long depth, int draining);
+
+/**
+ * Length of the request in @p buf when it is exactly one complete GET or
+ * HEAD of the health path, or 0. @p head is set for HEAD.
+ */
+size_t health_match(const char *buf, size_t len, int *head);
+
+/** Serialized response for @p state, without a body for @p head. */
+const char *health_response(health_state_t state, int head, size_t *len);
+
+/** Body text of @p state, as the route sends it. */
+const char *health_body(health_state_t state);
+
+/**
+ * Answer on @p fd when it holds a health check: 1 when it was, and the
+ * caller closes it; 0 to hand the socket to a worker.
+ */
+int health_answer(int fd, unsigned long depth, int draining);
+
+#endif /* MINIWEB_NET_HEALTH_H */
@@ -0,0 +1,29 @@
+/* keepalive.h - keep-alive budget and idle timeout scaled by pool load */
+#ifndef MINIWEB_NET_KEEPALIVE_H
+#define MINIWEB_NET_KEEPALIVE_H
+
+/*
+ * Both are worked out from how many of max_conns slots are busy when
+ * they are needed. With headroom, a connection is reused for many more
+ * requests than before, saving clients the handshakes; close to the
+ * limit, it serves a few and idle ones between requests are closed well
+ * before conn_timeout, so the slots go to new clients instead of 503s.
+ */
+
+#define KEEPALIVE_REQUESTS	64	/* between half and three quarters full */
+#define KEEPALIVE_REQUESTS_MAX	1024	/* below half */
+#define KEEPALIVE_REQUESTS_MIN	4	/* from 90% */
+#define KEEPALIVE_IDLE_MIN	2	/* seconds, with every slot busy */
+#define KEEPALIVE_IDLE_RECHECK	2	/* seconds between looks at an idle one */
+
+/** Requests a connection may serve with @p active of @p max slots busy. */
+int keepalive_budget(int active, int max);
+
+/**
+ * Seconds a keep-alive connection may wait for its next request:
+ * @p conn_timeout up to half the slots busy, then less in proportion,
+ * down to KEEPALIVE_IDLE_MIN when all are.
+ */
+int keepalive_idle_timeout(int conn_timeout, int active, int max);
+
+#endif /* MINIWEB_NET_KEEPALIVE_H */
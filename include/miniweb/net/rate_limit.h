@@ -0,0 +1,40 @@
+/* rate_limit.h - per-client token buckets for each route class */
+#ifndef MINIWEB_NET_RATE_LIMIT_H
+#define MINIWEB_NET_RATE_LIMIT_H
+
+#include <stdint.h>
+
+#include <miniweb/router/routes.h>
+
+/*
+ * A client, as named by http_request_get_client_ip(), holds one bucket
+ * per route class: burst tokens, refilled at a per-minute rate; each
+ * request takes one. Buckets live in a fixed table of hashed keys, so
+ * memory does not grow with the number of clients. A bucket that has
+ * refilled completely is as good as none and its slot is reused; when
+ * every slot probed is busy, the one refilled longest ago is, and that
+ * client starts afresh.
+ */
+
+#define RATE_LIMIT_SHARDS	16
+#define RATE_LIMIT_SLOTS	512	/* per shard and class, 16 bytes each */
+#define RATE_LIMIT_PROBE	8
+
+/**
+ * Allow @p per_minute requests a minute to each client of route class
+ * @p cls, @p burst of them back to back. 0 turns the class off. Live:
+ * buckets keep their tokens, capped at the new burst.
+ */
+void rate_limit_configure(route_class_t cls, int per_minute, int burst);
+
+/** Whether class @p cls is limited at all. */
+int rate_limit_enabled(route_class_t cls);
+
+/**
+ * Take a token from the bucket of @p client for class @p cls at
+ * monotonic time @p now_ms. Returns 0 when the request may go ahead,
+ * or the seconds until a token is back, at least 1.
+ */
+int rate_limit_take(route_class_t cls, const char *client, uint64_t now_ms);
+
+#endif /* MINIWEB_NET_RATE_LIMIT_H */
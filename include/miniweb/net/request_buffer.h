@@ -0,0 +1,35 @@
+#ifndef MINIWEB_NET_REQUEST_BUFFER_H
+#define MINIWEB_NET_REQUEST_BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * Size-classed request buffers. A connection holds one only while a
+ * request is being read or answered; idle keep-alive sockets hold none.
+ * The largest class must cover MINIWEB_REQUEST_BUFFER_SIZE.
+ */
+#define MINIWEB_REQBUF_SMALL	1024
+#define MINIWEB_REQBUF_MEDIUM	4096
+#define MINIWEB_REQBUF_LARGE	16384
+#define MINIWEB_REQBUF_CLASSES	3
+
+/**
+ * Return a buffer of at least @p need bytes (rounded up to its class) and
+ * store the usable size in @p cap. Returns NULL when @p need exceeds the
+ * largest class or memory is exhausted.
+ */
+char *miniweb_reqbuf_get(size_t need, size_t *cap);
+
+/** Grow @p buf to the next class up, keeping the first @p used bytes. */
+char *miniweb_reqbuf_grow(char *buf, size_t used, size_t *cap);
+
+/** Return @p buf (of class size @p cap) to its free list. */
+void miniweb_reqbuf_put(char *buf, size_t cap);
+
+/** Bytes currently handed out across all classes. */
+size_t miniweb_reqbuf_in_use(void);
+
+/** Release every cached free buffer. */
+void miniweb_reqbuf_cleanup(void);
+
+#endif /* MINIWEB_NET_REQUEST_BUFFER_H */
@@ -1,27 +1,84 @@
 #ifndef MINIWEB_NET_SERVER_H
 #define MINIWEB_NET_SERVER_H
 
+#include <pthread.h>
 #include <signal.h>
+#include <sys/types.h>
+#include <time.h>
 
 #include <miniweb/core/conf.h>
 #include <miniweb/net/connection_pool.h>
+#include <miniweb/net/timer_wheel.h>
 #include <miniweb/net/work_queue.h>
+#include <miniweb/net/worker.h>
 
 #define MINIWEB_MAX_EVENTS 256
-#define MINIWEB_THREAD_POOL_SIZE 32
 #define MINIWEB_LISTEN_BACKLOG 1024
+#define MINIWEB_MAX_DISPATCHERS 16
+#define MINIWEB_PAUSED_POLL_MS 10	/* slot poll while accept is paused */
+#define MINIWEB_DRAIN_IDLE_SEC 2	/* idle keep-alive kept while draining */
+
+struct miniweb_server_runtime;
+
+/**
+ * One dispatcher shard: kqueue, and the work queue drained by the workers
+ * bound to it. Every shard accepts on the one TCP listen socket, and only
+ * shard 0 on the Unix-domain one. Shard 0 runs on the thread that called
+ * miniweb_server_run(); the others get their own dispatcher thread.
+ * In worker-kqueue mode the shard only accepts, handing each new socket to
+ * one of its workers' private kqueues (worker_kq) round-robin.
+ * With slow_threads set, slow-class routes are moved from queue to
+ * slow_queue once parsed and served by the shard's slow_workers.
+ */
+typedef struct miniweb_dispatcher {
+	int index;
+	int kq_fd;
+	int listen_fd;			/* shared TCP, -1 with listen_tcp off */
+	int unix_fd;			/* shard 0: Unix-domain listener */
+	int thread_started;
+	pthread_t thread;
+	miniweb_work_queue_t queue;
+	int worker_kq[MINIWEB_THREAD_POOL_SIZE]; /* worker-kqueue mode only */
+	int worker_count;
+	unsigned int next_worker;
+	miniweb_timer_wheel_t idle_wheel; /* connections accepted by this shard */
+	int accept_paused;		/* listen filter disabled at max_conns */
+	miniweb_worker_pool_t workers;	/* queue mode only */
+	int workers_started;
+	miniweb_work_queue_t slow_queue; /* ROUTE_CLASS_SLOW lane */
+	miniweb_worker_pool_t slow_workers;
+	int slow_started;
+	struct miniweb_server_runtime *server;
+} miniweb_dispatcher_t;
 
 /** Runtime server object containing dispatcher, queue, and pool resources. */
 typedef struct miniweb_server_runtime {
 	volatile sig_atomic_t running;  /* Changed from plain int */
-	int kq_fd;
-	int listen_fd;
+	int kq_fd;                      /* shard 0 kqueue */
+	int listen_fd;                  /* TCP listener all shards share */
+	int unix_fd;                    /* unix_socket listener, or -1 */
 	int signal_pipe_rfd;
 	int signal_pipe_wfd;
 	int spare_fd;
 	miniweb_conf_t *config;
-	miniweb_work_queue_t queue;
-	miniweb_connection_pool_t pool;
+	miniweb_dispatcher_t *dispatchers;
+	int dispatcher_count;
+	miniweb_connection_pool_t pool; /* fd-indexed, shared by all shards */
+	miniweb_work_queue_t reject_queue; /* shed sockets awaiting a 503 */
+	pthread_t reject_thread;
+	int reject_started;
+	int heartbeat_kqueue;           /* heartbeat on shard 0's kqueue */
+	/*
+	 * SIGHUP hook, run on shard 0: reload the configuration and return
+	 * 1 when it needs a new process, which then gets the listeners.
+	 * SIGUSR2 starts one unconditionally. The application ignores both
+	 * signals; shard 0 reads them through EVFILT_SIGNAL.
+	 */
+	int (*reload)(struct miniweb_server_runtime *rt);
+	int handoff_fd;                 /* successor's ready pipe, or -1 */
+	pid_t handoff_pid;
+	volatile sig_atomic_t draining; /* successor serving: finish, exit */
+	time_t drain_deadline;
 } miniweb_server_runtime_t;
 
 /** Initialize listen socket, kqueue dispatcher, queue/pool, and worker threads. */
@@ -30,4 +87,7 @@ int miniweb_server_run(miniweb_server_runtime_t *rt);
 /** Request asynchronous server shutdown from signal handler context. */
 void miniweb_server_stop(miniweb_server_runtime_t *rt);
 
+/** Whether a successor took over: answers carry Connection: close. */
+int miniweb_server_draining(void);
+
 #endif
@@ -0,0 +1,45 @@
+#ifndef MINIWEB_NET_TIMER_WHEEL_H
+#define MINIWEB_NET_TIMER_WHEEL_H
+
+#include <time.h>
+
+#define MINIWEB_TIMER_WHEEL_SLOTS 64	/* one-second ticks, power of two */
+
+/** One scheduled idle check: fd/generation token and absolute deadline. */
+typedef struct {
+	int fd;
+	unsigned gen;
+	time_t deadline;
+} miniweb_timer_entry_t;
+
+typedef struct {
+	miniweb_timer_entry_t *items;
+	int count;
+	int cap;
+} miniweb_timer_slot_t;
+
+/**
+ * Hashed timing wheel owned by a single dispatcher thread (no locking).
+ * Deadlines further than one revolution away simply stay in their slot
+ * and are re-queued when it comes round again.
+ */
+typedef struct {
+	miniweb_timer_slot_t slots[MINIWEB_TIMER_WHEEL_SLOTS];
+	time_t last_tick;
+} miniweb_timer_wheel_t;
+
+/**
+ * Expiry callback. Return 0 to drop the entry (connection gone or closed by
+ * the callback) or a new deadline to re-arm the entry.
+ */
+typedef time_t (*miniweb_timer_check_fn)(void *ctx, int fd, unsigned gen,
+    time_t now);
+
+void miniweb_timer_wheel_init(miniweb_timer_wheel_t *w, time_t now);
+int miniweb_timer_wheel_add(miniweb_timer_wheel_t *w, int fd, unsigned gen,
+    time_t deadline);
+int miniweb_timer_wheel_advance(miniweb_timer_wheel_t *w, time_t now,
+    miniweb_timer_check_fn check, void *ctx);
+void miniweb_timer_wheel_destroy(miniweb_timer_wheel_t *w);
+
+#endif
@@ -0,0 +1,127 @@
+/* trace.h - per-request phase timestamps kept in per-thread rings */
+#ifndef MINIWEB_NET_TRACE_H
+#define MINIWEB_NET_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A worker stamps the request it serves at each phase boundary and sums
+ * the time it spends blocked in recv(2), on a child process and waiting
+ * for the socket to drain. When the request ends its record goes into
+ * the thread's ring of recent requests and, if it took trace_slow_ms or
+ * longer, into a second ring that fast traffic does not overwrite.
+ * GET /api/stats/trace reads both.
+ *
+ * With tracing off (trace_slow_ms 0) a probe is a load and a branch;
+ * on, a clock read and a store into the thread's record. Building with
+ * -DMINIWEB_NO_TRACE removes the probes altogether.
+ */
+
+#define TRACE_RING		256	/* recent requests, per thread */
+#define TRACE_SLOW_RING		64	/* slow requests, per thread */
+#define TRACE_PATH_MAX		96
+
+/* Phase boundaries, in request order. */
+typedef enum {
+	TRACE_PARSED,		/* request head complete */
+	TRACE_ROUTED,		/* handler looked up */
+	TRACE_HANDLED,		/* handler returned */
+	TRACE_MARKS
+} trace_mark_t;
+
+/* Waits that may happen anywhere in a request; each is summed. */
+typedef enum {
+	TRACE_WAIT_RECV,	/* recv(2) */
+	TRACE_WAIT_SUBPROCESS,	/* subprocess admission, spawn and output */
+	TRACE_WAIT_WRITE,	/* poll(2) between response write retries */
+	TRACE_WAITS
+} trace_wait_t;
+
+/* Where a request's time went, as trace_phases() splits it. */
+typedef enum {
+	TRACE_PH_QUEUE,		/* work queue, before the worker took it */
+	TRACE_PH_RECV,
+	TRACE_PH_PARSE,
+	TRACE_PH_ROUTE,
+	TRACE_PH_HANDLER,	/* handler, less subprocess and write waits */
+	TRACE_PH_SUBPROCESS,
+	TRACE_PH_WRITE_WAIT,
+	TRACE_PH_FINISH,	/* accounting and logging after the handler */
+	TRACE_PHASES
+} trace_phase_t;
+
+typedef struct trace_record {
+	uint64_t start_ns;		/* monotonic; request began */
+	uint64_t queue_ns;		/* time queued before start_ns */
+	uint64_t total_ns;		/* start_ns to the end of the request */
+	uint64_t at[TRACE_MARKS];	/* ns after start_ns; 0: not reached */
+	uint64_t wait[TRACE_WAITS];
+	uint64_t bytes;
+	int route_id;
+	int status;
+	unsigned int thread;		/* ring it was read from */
+	char path[TRACE_PATH_MAX];
+} trace_record_t;
+
+/* Non-zero while tracing; read by the probes. */
+extern int trace_on;
+
+/** Trace requests and keep those of @p slow_ms or more; 0 turns it off. */
+void trace_enable(int slow_ms);
+
+/** Current threshold in milliseconds, 0 when tracing is off. */
+int trace_slow_ms(void);
+
+/** Monotonic clock in nanoseconds. */
+uint64_t trace_now(void);
+
+/** Start a record for the calling thread, @p queued_ns after its push. */
+void trace_begin(uint64_t queued_ns);
+
+/** Stamp boundary @p m of the calling thread's request. */
+void trace_mark(trace_mark_t m);
+
+/** Add the time since @p since to wait @p w of the current request. */
+void trace_wait(trace_wait_t w, uint64_t since);
+
+/** Close the current record and file it into the thread's rings. */
+void trace_end(int route_id, int status, size_t bytes, const char *path,
+    size_t path_len);
+
+/**
+ * Copy up to @p max records, newest first, from every thread's recent
+ * ring or, with @p slow, its slow ring. Returns how many were copied.
+ */
+size_t trace_snapshot(trace_record_t *out, size_t max, int slow);
+
+/** Split @p r into TRACE_PHASES durations in nanoseconds. */
+void trace_phases(const trace_record_t *r, uint64_t out[TRACE_PHASES]);
+
+/** Name of phase @p p ("queue", "recv", ...). */
+const char *trace_phase_name(trace_phase_t p);
+
+#ifndef MINIWEB_NO_TRACE
+#define TRACE_ON()	__atomic_load_n(&trace_on, __ATOMIC_RELAXED)
+#define TRACE_NOW()	(TRACE_ON() ? trace_now() : 0)
+#define TRACE_BEGIN(queued_ns) \
+	do { if (TRACE_ON()) trace_begin(queued_ns); } while (0)
+#define TRACE_MARK(m) \
+	do { if (TRACE_ON()) trace_mark(m); } while (0)
+#define TRACE_WAIT(w, since) \
+	do { if (since) trace_wait((w), (since)); } while (0)
+#define TRACE_END(id, status, bytes, path, len) \
+	do { \
+		if (TRACE_ON()) \
+			trace_end((id), (status), (bytes), (path), (len)); \
+	} while (0)
+#else
+#define TRACE_ON()	0
+#define TRACE_NOW()	((uint64_t)0)
+#define TRACE_BEGIN(queued_ns)	((void)(queued_ns))
+#define TRACE_MARK(m)		((void)0)
+#define TRACE_WAIT(w, since)	((void)(since))
+#define TRACE_END(id, status, bytes, path, len)	((void)0)
+#endif
+
+#endif /* MINIWEB_NET_TRACE_H */
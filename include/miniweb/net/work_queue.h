@@ -4,21 +4,39 @@
 #include <signal.h>
 #include <pthread.h>
 
-#define MINIWEB_QUEUE_CAPACITY 4096
+#define MINIWEB_QUEUE_CAPACITY 4096	/* must be a power of two */
+#define MINIWEB_QUEUE_CACHELINE 64
 
+/** One ring cell; seq tells producers/consumers whose turn the cell is. */
 typedef struct {
-	void *items[MINIWEB_QUEUE_CAPACITY];
-	int head;
-	int tail;
-	int count;
+	unsigned long seq;
+	void *item;
+} miniweb_work_cell_t;
+
+/**
+ * Bounded MPMC ring (sequence-numbered cells). push/pop are lock-free;
+ * the mutex/condvar pair is only used to park consumers on an empty ring.
+ */
+typedef struct {
+	miniweb_work_cell_t cells[MINIWEB_QUEUE_CAPACITY];
+	char pad0[MINIWEB_QUEUE_CACHELINE];
+	unsigned long tail;		/* producer cursor */
+	char pad1[MINIWEB_QUEUE_CACHELINE];
+	unsigned long head;		/* consumer cursor */
+	char pad2[MINIWEB_QUEUE_CACHELINE];
+	int waiters;
 	pthread_mutex_t lock;
 	pthread_cond_t not_empty;
 } miniweb_work_queue_t;
 
 void miniweb_work_queue_init(miniweb_work_queue_t *q);
 int miniweb_work_queue_push(miniweb_work_queue_t *q, void *item);
+void *miniweb_work_queue_try_pop(miniweb_work_queue_t *q);
 void *miniweb_work_queue_pop(miniweb_work_queue_t *q,
     volatile sig_atomic_t *running);
+void *miniweb_work_queue_pop_timed(miniweb_work_queue_t *q,
+    volatile sig_atomic_t *running, int timeout_ms);
+unsigned long miniweb_work_queue_depth(miniweb_work_queue_t *q);
 void miniweb_work_queue_broadcast_shutdown(miniweb_work_queue_t *q);
 
 #endif
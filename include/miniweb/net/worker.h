@@ -1,23 +1,137 @@
 #ifndef MINIWEB_NET_WORKER_H
 #define MINIWEB_NET_WORKER_H
 
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <sys/event.h>
 
 #include <miniweb/core/conf.h>
 #include <miniweb/net/connection_pool.h>
 #include <miniweb/net/work_queue.h>
 
-/** Worker runtime wiring shared by all worker threads. */
+#define MINIWEB_WORKER_MAX_EVENTS 64
+#define MINIWEB_THREAD_POOL_SIZE 32
+#define MINIWEB_WORKER_SUPERVISE_MS 50	/* elastic pool supervisor period */
+#define MINIWEB_WORKER_LANES 2		/* one per route_class_t */
+#define MINIWEB_WORKER_CHANGE_BATCH 32	/* kevent changes held per thread */
+
+/**
+ * Worker runtime wiring. In queue mode one instance is shared by every
+ * worker of a dispatcher shard lane and kq_fd points at the shard kqueue;
+ * in worker-kqueue mode each worker has its own instance and private
+ * kqueue. With lanes enabled, queue is lanes[lane] and a parsed request
+ * whose route class names another lane is pushed to that lane's queue.
+ */
 typedef struct miniweb_worker_runtime {
 	volatile sig_atomic_t *running;
 	int *kq_fd;
 	miniweb_conf_t *config;
 	miniweb_work_queue_t *queue;
 	miniweb_connection_pool_t *pool;
+	int own_kq_fd;
+	int lane;
+	miniweb_work_queue_t *lanes[MINIWEB_WORKER_LANES]; /* NULL: no lanes */
 } miniweb_worker_runtime_t;
 
-/** Process queued sockets and execute HTTP handlers in worker threads. */
-void *miniweb_worker_thread(void *arg);
+/**
+ * Per-thread kevent changelist. Re-arms are appended here instead of
+ * costing one kevent() each; queue-mode workers submit the batch when
+ * it fills or their queue runs dry, worker-kqueue threads hand it to
+ * their next wait. Closing a socket needs no entry: close(2) drops its
+ * knotes, so pending changes for that fd are simply discarded.
+ */
+typedef struct miniweb_worker_changes {
+	struct kevent ev[MINIWEB_WORKER_CHANGE_BATCH];
+	int n;
+} miniweb_worker_changes_t;
+
+struct miniweb_worker_pool;
+
+/** One thread slot of an elastic worker pool. */
+typedef struct miniweb_worker_slot {
+	struct miniweb_worker_pool *wp;
+	int index;
+	int state;			/* free / running / exited (joinable) */
+	pthread_t thread;
+} miniweb_worker_slot_t;
+
+/**
+ * Elastic queue-mode worker set of one dispatcher shard. min_threads stay
+ * up for the server lifetime; a supervisor adds threads up to max_threads
+ * while the queue backs up with every worker busy, and extra threads retire
+ * after idle_ms without work. live/busy are read and written atomically.
+ */
+typedef struct miniweb_worker_pool {
+	miniweb_worker_runtime_t *rt;
+	int min_threads;
+	int max_threads;
+	int idle_ms;
+	int live;			/* threads running */
+	int busy;			/* threads inside a request */
+	pthread_mutex_t lock;		/* slot states */
+	miniweb_worker_slot_t slots[MINIWEB_THREAD_POOL_SIZE];
+	pthread_t supervisor;
+	int supervisor_started;
+	struct miniweb_worker_pool *next;	/* stats registry */
+} miniweb_worker_pool_t;
+
+/** Process-wide worker pool counters, summed across shards. */
+typedef struct miniweb_worker_pool_stats {
+	int min_threads;
+	int max_threads;
+	int live;
+	int busy;
+	int peak;
+	unsigned long queue_depth;
+	unsigned long spawned;
+	unsigned long retired;
+	unsigned long spawn_failures;
+	unsigned long shed[MINIWEB_WORKER_LANES]; /* past queue deadline */
+	unsigned long kevent_changes;	/* changes queued by workers */
+	unsigned long kevent_calls;	/* kevent() calls that submitted them */
+} miniweb_worker_pool_stats_t;
+
+/** Monotonic clock in milliseconds, used to stamp queue pushes. */
+uint64_t miniweb_worker_now_ms(void);
+
+/** Number of requests shed on @p lane for waiting past their deadline. */
+unsigned long miniweb_worker_shed_count(int lane);
+
+/** kevent() changes queued and submissions made by all workers so far. */
+void miniweb_worker_change_counts(unsigned long *changes,
+    unsigned long *calls);
+
+/**
+ * Resolve a queue token and serve its connection on the calling thread;
+ * re-arms land in @p chg.
+ */
+void miniweb_worker_serve(miniweb_worker_runtime_t *rt,
+    miniweb_worker_changes_t *chg, void *token);
+
+/**
+ * Parse the request head @p head (@p len bytes, NUL terminated) and
+ * answer it on @p fd, blocking, as one HTTP/2 stream; see h2.h.
+ */
+void miniweb_worker_dispatch_head(int fd, struct sockaddr_in *addr,
+    char *head, size_t len);
+
+/** Submit every change pending in @p chg to the runtime's kqueue. */
+void miniweb_worker_changes_flush(miniweb_worker_runtime_t *rt,
+    miniweb_worker_changes_t *chg);
+
+/** Start min_threads workers and, when max > min, the supervisor. */
+int miniweb_worker_pool_start(miniweb_worker_pool_t *wp,
+    miniweb_worker_runtime_t *rt, int min_threads, int max_threads,
+    int idle_ms);
+
+/** Join every worker and the supervisor; the queue must be woken first. */
+void miniweb_worker_pool_join(miniweb_worker_pool_t *wp);
+
+/** Snapshot the counters of every running pool. */
+void miniweb_worker_pool_stats(miniweb_worker_pool_stats_t *out);
+
+/** Serve connections registered on the worker's own kqueue (kq_fd). */
+void *miniweb_worker_kqueue_thread(void *arg);
 
 #endif
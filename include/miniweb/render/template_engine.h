@@ -3,6 +3,9 @@
 #ifndef MINIWEB_RENDER_TEMPLATE_ENGINE_H
 #define MINIWEB_RENDER_TEMPLATE_ENGINE_H
 
+#include <stddef.h>
+#include <sys/uio.h>
+
 struct template_data {
 	const char *title;	     /* Page title (mandatory) */
 	const char *page_content;    /* Main content file (mandatory) */
@@ -19,6 +22,35 @@ struct template_data {
  */
 int template_render_with_data(struct template_data *data, char **output);
 
+/* Spans of a base template around its five slots, at most. */
+#define TEMPLATE_IOV_MAX 11
+
+/**
+ * A page rendered by reference: spans pointing into the template cache,
+ * ready to be appended to a response writev.
+ */
+struct template_iov {
+	struct iovec iov[TEMPLATE_IOV_MAX];
+	int iovcnt;
+	size_t len;		/* sum of iov_len */
+	unsigned long version;	/* template_cache_version() of the spans */
+	void *pin;		/* template set the spans belong to */
+	int data_at;		/* iov index of the {{data}} slot, or -1 */
+	size_t data_off;	/* page offset of the {{data}} slot */
+};
+
+/**
+ * Render like template_render_with_data() without copying: @p out gets
+ * borrowed spans that stay valid until template_iov_release().
+ *
+ * @return 0 on success, -1 on failure (nothing to release).
+ */
+int template_render_iov(const struct template_data *data,
+	struct template_iov *out);
+
+/** Release the spans of a template_render_iov() result. */
+void template_iov_release(struct template_iov *out);
+
 /**
  * Convenience wrapper that renders a single page by name.
  *
@@ -35,6 +67,38 @@ int template_render(const char *page, char **output);
  */
 int template_cache_init(void);
 
+/**
+ * Digest of the loaded template set; changes whenever a template file
+ * does. Used as the ETag of rendered views. 0 until the cache is loaded.
+ */
+unsigned long template_cache_version(void);
+
+/**
+ * Build and publish a fresh snapshot now, on the calling thread. Renders
+ * keep using the previous snapshot meanwhile, and keep it if the load
+ * fails. Returns 0 on success, -1 on failure.
+ */
+int template_cache_reload(void);
+
+/**
+ * Mark the template cache stale; the next render or version query
+ * reloads it. Safe to call from any thread.
+ */
+void template_cache_invalidate(void);
+
+/**
+ * Select reloads on template_cache_invalidate() (nonzero) instead of on
+ * the 60 second TTL (zero, the default).
+ */
+void template_cache_set_watched(int watched);
+
+/**
+ * Watch the templates directory and every template in it, invalidating
+ * the cache on change. Returns 0 when watching, -1 when the TTL stays
+ * in charge (no kqueue, directory unreadable).
+ */
+int template_watch_start(void);
+
 /**
  * Free all in-memory template cache entries.
  */
@@ -0,0 +1,71 @@
+/* response_cache.h - router-level cache of GET responses */
+#ifndef MINIWEB_ROUTER_RESPONSE_CACHE_H
+#define MINIWEB_ROUTER_RESPONSE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <miniweb/http/handler.h>
+
+/*
+ * Answers of the routes registered with a route_cache_policy_t, as the
+ * blobs their handlers were sent from. An entry is found by route id,
+ * gzip variant and key: the path, then '?' and the query parameters
+ * sorted, empty ones dropped. Hits take a reference on the blob and
+ * send it after the shard lock is dropped. Shards evict least recently
+ * used entries to stay within their share of the byte budget. Routes
+ * with a stale window are served stale and refreshed on the heartbeat.
+ */
+
+#define RESPONSE_CACHE_SHARDS		16
+#define RESPONSE_CACHE_BUCKETS		64	/* per shard, power of two */
+#define RESPONSE_CACHE_KEY_MAX		512
+#define RESPONSE_CACHE_PARAMS_MAX	16
+#define RESPONSE_CACHE_BUDGET_BYTES	(8 * 1024 * 1024)
+#define RESPONSE_CACHE_HOT_HITS		2	/* then refreshed early */
+#define RESPONSE_CACHE_REFRESH_MAX	32	/* queued refreshes */
+#define RESPONSE_CACHE_REFRESH_PER_TICK	2
+#define RESPONSE_CACHE_REFRESH_MS	250
+
+/**
+ * Run @p handler for @p req, matched to route @p route, or answer from
+ * the cache when the route opted in and a fresh copy is held. Requests
+ * that are conditional, ranged or carry credentials always reach the
+ * handler; "Cache-Control: no-cache" refreshes the copy.
+ * Returns the handler's result, or that of the send.
+ */
+int response_cache_serve(http_request_t *req, int route,
+    http_handler_t handler, uint64_t now_ms);
+
+/**
+ * Write the key of the first @p path_len bytes of @p path with query
+ * @p query (may be NULL) into @p buf. Returns its length, or -1 when it
+ * does not fit or has more than RESPONSE_CACHE_PARAMS_MAX parameters.
+ */
+int response_cache_key(const char *path, size_t path_len, const char *query,
+    char *buf, size_t cap);
+
+/** Reference on the entry for @p key, or NULL when none is fresh. */
+http_blob_t *response_cache_get(int route, int variant, const char *key,
+    size_t len, uint64_t now_ms);
+
+/** Keep a reference on @p blob for @p key until @p expires_ms. */
+void response_cache_put(int route, int variant, const char *key, size_t len,
+    http_blob_t *blob, uint64_t expires_ms);
+
+/**
+ * Replay up to @p max queued refreshes through their handlers, keeping
+ * the answers as fresh at @p now_ms. Returns the entries refreshed.
+ */
+int response_cache_refresh(int max, uint64_t now_ms);
+
+/** Run the queued refreshes on the heartbeat; 0, or -1 on failure. */
+int response_cache_start(void);
+
+/** Bytes all entries may hold; 0 turns the cache off and empties it. */
+void response_cache_set_budget(size_t bytes);
+
+/** Drop every entry and queued refresh. */
+void response_cache_cleanup(void);
+
+#endif /* MINIWEB_ROUTER_RESPONSE_CACHE_H */
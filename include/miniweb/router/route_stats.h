@@ -0,0 +1,47 @@
+/* route_stats.h - per-route request counters and latency histograms */
+#ifndef MINIWEB_ROUTER_ROUTE_STATS_H
+#define MINIWEB_ROUTER_ROUTE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <miniweb/http/handler.h>
+#include <miniweb/router/urls.h>
+
+/* Requests no route matched (404/405) are counted under this id. */
+#define ROUTE_STATS_UNMATCHED	ROUTE_ID_COUNT
+#define ROUTE_STATS_IDS		(ROUTE_ID_COUNT + 1)
+
+/*
+ * Log-linear latency buckets over microseconds: exact below 4 us, then
+ * four sub-buckets per power of two, so a bucket is at most 25% wide.
+ * The last bucket takes everything from about 59 s up.
+ */
+#define ROUTE_STATS_BUCKETS	100
+
+/**
+ * Count one request served by the calling thread: route @p id (or
+ * ROUTE_STATS_UNMATCHED), the status it answered, the bytes it sent and
+ * how long its handler ran. Lock-free; touches only this thread's block.
+ */
+void route_stats_record(int id, int status, size_t bytes, uint64_t usec);
+
+/**
+ * Append the aggregated counters of every thread to @p buf as a
+ * "routes" JSON member. @p detail adds the non-empty histogram buckets.
+ * Routes that did not fit are left out; the JSON stays well formed.
+ */
+void route_stats_append_json(char *buf, size_t size, int detail);
+
+/**
+ * Append the same counters to @p buf as OpenMetrics families: requests
+ * by route and status class, bytes sent, and handler latency as a
+ * histogram over fixed bounds. Returns the length written; the families
+ * of routes that did not fit are cut at a line boundary.
+ */
+size_t route_stats_append_openmetrics(char *buf, size_t size);
+
+/** GET /api/stats/routes: every route's counters and histogram. */
+int route_stats_handler(http_request_t *req);
+
+#endif /* MINIWEB_ROUTER_ROUTE_STATS_H */
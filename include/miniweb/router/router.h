@@ -8,9 +8,11 @@
 
 struct router {
 	int (*register_fn)(void *ctx, const char *method, const char *path,
-		route_handler_t handler);
+		route_handler_t handler, route_class_t cls,
+		const route_cache_policy_t *cache);
 	int (*register_prefix_fn)(void *ctx, const char *method,
-		const char *prefix, int min_slashes, route_handler_t handler);
+		const char *prefix, int min_slashes, route_handler_t handler,
+		route_class_t cls, const route_cache_policy_t *cache);
 	void *ctx;
 };
 
@@ -20,4 +22,21 @@ int router_register(struct router *r, const char *method,
 int router_register_prefix(struct router *r, const char *method,
 	const char *prefix, int min_slashes, route_handler_t handler);
 
+/* Same as above for routes that must run on a specific lane. */
+int router_register_class(struct router *r, route_class_t cls,
+	const char *method, const char *path, route_handler_t handler);
+
+int router_register_prefix_class(struct router *r, route_class_t cls,
+	const char *method, const char *prefix, int min_slashes,
+	route_handler_t handler);
+
+/* Same again, with answers kept by the response cache under @p cache. */
+int router_register_cached(struct router *r, route_class_t cls,
+	const char *method, const char *path, route_handler_t handler,
+	const route_cache_policy_t *cache);
+
+int router_register_prefix_cached(struct router *r, route_class_t cls,
+	const char *method, const char *prefix, int min_slashes,
+	route_handler_t handler, const route_cache_policy_t *cache);
+
 #endif
@@ -11,15 +11,64 @@ struct router;
  * one canonical type defined in http_handler.h. */
 typedef http_handler_t route_handler_t;
 
+/*
+ * Cost class declared when a route is registered. Each class is served by
+ * its own work-queue lane, so cheap requests never wait behind expensive
+ * subprocess-backed ones. Values double as lane indexes.
+ */
+typedef enum route_class {
+	ROUTE_CLASS_FAST = 0,	/* in-memory / cached answers */
+	ROUTE_CLASS_SLOW,	/* mandoc, pkg_* and other subprocess routes */
+	ROUTE_CLASS_COUNT
+} route_class_t;
+
+/*
+ * Response caching a route opts into when it is registered. GET answers
+ * of 200 with a body of at most max_bytes are kept for ttl_ms per path,
+ * query (parameters sorted) and gzip variant, and later requests are
+ * answered from the copy without running the handler. Only routes whose
+ * answer depends on nothing else should opt in. For stale_ms past the
+ * TTL an expired copy is still sent while the handler refreshes it in
+ * the background, and copies hit often are refreshed just before they
+ * expire.
+ */
+typedef struct route_cache_policy {
+	int ttl_ms;		/* 0: not cached */
+	size_t max_bytes;	/* largest body kept */
+	int stale_ms;		/* served stale this long; 0: never */
+} route_cache_policy_t;
+
 /** Initialize and register all static routes. */
 void init_routes(void *module_cfg);
 
 /** Resolve the best handler for an HTTP method/path pair. */
 route_handler_t route_match(const char *method, const char *path);
 
+/** Like route_match(), also reporting the route class (FAST when unknown). */
+route_handler_t route_match_class(const char *method, const char *path,
+	route_class_t *cls);
+
+/**
+ * Resolve an interned HTTP_METHOD_* on the first @p len bytes of @p path,
+ * which exclude the query; the form the worker uses. @p id (optional)
+ * receives the route id, ROUTE_ID_NONE when nothing matches.
+ */
+route_handler_t route_lookup(int method, const char *path, size_t len,
+	route_class_t *cls, int *id);
+
 /** Render a template-backed view page from the route table. */
 int view_template_handler(http_request_t *req);
 
+/* Rendered-view cache counters since startup. */
+typedef struct view_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long entries;	/* views currently cached */
+} view_cache_stats_t;
+
+/** Copy the rendered-view cache counters into @p out. */
+void view_cache_stats(view_cache_stats_t *out);
+
 /** Serve /favicon.svg content. */
 int favicon_handler(http_request_t *req);
 
@@ -6,32 +6,49 @@
 #include <miniweb/router/routes.h>
 
 #define MAX_ROUTES 32
+#define MAX_PREFIX_ROUTES 16
+
+/* Route ids: routes[i] is i, prefix_routes[i] is MAX_ROUTES + i. */
+#define ROUTE_ID_NONE	(-1)
+#define ROUTE_ID_COUNT	(MAX_ROUTES + MAX_PREFIX_ROUTES)
 
 /* Internal route table entry */
 struct route {
-    const char    *method;
+    int            method;	/* HTTP_METHOD_* */
     const char    *path;
     route_handler_t handler;
+    route_class_t  cls;
+    route_cache_policy_t cache;	/* ttl_ms 0: not cached */
     /* handler_cls removed: new handler signature is handler(req),
      * per-handler context is not needed. */
 };
 
 /* Declarative prefix-backed route. */
 struct prefix_route {
-	const char *method;
+	int method;		/* HTTP_METHOD_* */
 	const char *prefix;
 	int min_slashes;
 	route_handler_t handler;
+	route_class_t cls;
+	route_cache_policy_t cache;	/* ttl_ms 0: not cached */
 };
 
+/*
+ * Snapshot embedded into a view at its {{data}} slot, so the page's
+ * script starts without fetching it: JSON copied into @p arena (malloc'd
+ * when NULL), or NULL when none is ready.
+ */
+typedef char *(*view_embed_fn)(http_arena_t *arena, unsigned long *version);
+
 /* Declarative template-backed view route. */
 struct view_route {
-	const char *method;
+	int method;		/* HTTP_METHOD_* */
 	const char *path;
 	const char *title;
 	const char *page;
 	const char *extra_head;
 	const char *extra_js;
+	view_embed_fn embed;	/* NULL: the page carries no data */
 };
 
 /** Initialize static route registrations. */
@@ -40,21 +57,48 @@ void init_routes(void *module_cfg);
 /** Return the matching handler for method/path, or NULL when not found. */
 route_handler_t route_match(const char *method, const char *path);
 
-/** Return non-zero when the path exists for any supported method. */
+/** Return non-zero when the path (any query ignored) exists for any method. */
 int route_path_known(const char *path);
 
 /** Build an Allow-header method list for a known path. */
 int route_allow_methods(const char *path, char *buf, size_t buf_len);
 
+/**
+ * Name route @p id as "GET /path", or "GET /prefix*" for a prefix route.
+ * Returns 0 when no route has that id.
+ */
+int route_describe(int id, char *buf, size_t buf_len);
+
+/**
+ * Response-cache policy route @p id was registered with, or NULL when
+ * its answers are not cached.
+ */
+const route_cache_policy_t *route_cache_policy(int id);
+
 /** Register one method/path to handler mapping into the route table. */
 void register_route(const char *method, const char *path,
-                               route_handler_t handler);
+                               route_handler_t handler, route_class_t cls,
+                               const route_cache_policy_t *cache);
 
 /** Register one prefix route mapping for dynamic path matching. */
 void register_prefix_route(const char *method, const char *prefix,
-	int min_slashes, route_handler_t handler);
+	int min_slashes, route_handler_t handler, route_class_t cls,
+	const route_cache_policy_t *cache);
+
+/**
+ * Find a declarative view route by method and the first @p len bytes of
+ * @p path, or NULL if not found.
+ */
+const struct view_route *find_view_route(int method, const char *path,
+	size_t len);
+
+/** Number of declarative view routes. */
+size_t view_route_count(void);
+
+/** Position of @p view among the declarative view routes. */
+size_t view_route_index(const struct view_route *view);
 
-/** Find a declarative view route by method/path, or NULL if not found. */
-const struct view_route *find_view_route(const char *method, const char *path);
+/** View route @p i of view_route_count(), or NULL past the end. */
+const struct view_route *view_route_at(size_t i);
 
 #endif /* MINIWEB_ROUTER_URLS_H */
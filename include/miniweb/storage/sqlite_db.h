@@ -6,9 +6,23 @@
 
 struct mw_db;
 
+/* mw_db_open() flags */
+#define MW_DB_READONLY	0x1	/* fail instead of creating the file */
+#define MW_DB_WAL	0x2	/* WAL journal, writes on a writer thread */
+/* Also open @p n read-only connections for mw_db_reader(). */
+#define MW_DB_READERS(n)	(((n) & 0xff) << 8)
+#define MW_DB_MAX_READERS	16
+
+/* Mutation run by mw_db_write()/mw_db_post(); non-zero undoes it. */
+typedef int (*mw_db_write_fn)(struct mw_db *db, void *ctx);
+
 int mw_db_open(const char *path, int flags, struct mw_db **out_db);
 void mw_db_close(struct mw_db *db);
 int mw_db_exec_schema(struct mw_db *db, const char *schema_sql);
+int mw_db_write(struct mw_db *db, mw_db_write_fn fn, void *ctx);
+int mw_db_post(struct mw_db *db, mw_db_write_fn fn, void *ctx);
+struct mw_db *mw_db_reader(struct mw_db *db);
+void mw_db_reader_put(struct mw_db *db, struct mw_db *reader);
 
 /** @brief Create a logical database handle.
  * @param name Logical DB name.
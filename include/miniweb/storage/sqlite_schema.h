@@ -11,7 +11,7 @@ struct mw_migration {
 	const char *sql;
 };
 
-int mw_db_migrate(struct mw_db *db,
+int mw_db_migrate(struct mw_db *db, const char *name,
 	const struct mw_migration *migrations, size_t count);
 int mw_tx_begin(struct mw_db *db);
 int mw_tx_commit(struct mw_db *db);
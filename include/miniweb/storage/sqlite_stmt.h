@@ -9,10 +9,15 @@ struct mw_db;
 struct mw_stmt;
 
 int mw_stmt_prepare(struct mw_db *db, const char *sql, struct mw_stmt **out_stmt);
+int mw_stmt_prepare_cached(struct mw_db *db, const char *sql,
+	struct mw_stmt **out_stmt);
 int mw_bind_text(struct mw_stmt *stmt, int idx, const char *value);
 int mw_bind_int64(struct mw_stmt *stmt, int idx, int64_t value);
 int mw_bind_null(struct mw_stmt *stmt, int idx);
 int mw_stmt_step(struct mw_stmt *stmt);
+int mw_stmt_reset(struct mw_stmt *stmt);
+const char *mw_column_text(struct mw_stmt *stmt, int col);
+int64_t mw_column_int64(struct mw_stmt *stmt, int col);
 void mw_stmt_finalize(struct mw_stmt *stmt);
 
 #endif
@@ -7,24 +7,46 @@
 #include <miniweb/core/conf.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/profile.h>
+#include <miniweb/core/readiness.h>
+#include <miniweb/core/vnode_watch.h>
+#include <miniweb/http/bundle.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/utils.h>
 #include <miniweb/modules/man.h>
 #include <miniweb/modules/metrics.h>
 #include <miniweb/modules/networking.h>
 #include <miniweb/modules/pkg_manager.h>
+#include <miniweb/net/access_log.h>
+#include <miniweb/net/h2.h>
+#include <miniweb/net/handoff.h>
+#include <miniweb/net/health.h>
+#include <miniweb/net/rate_limit.h>
+#include <miniweb/net/request_buffer.h>
 #include <miniweb/net/server.h>
+#include <miniweb/net/trace.h>
 #include <miniweb/platform/openbsd/security.h>
 #include <miniweb/render/template_engine.h>
+#include <miniweb/router/response_cache.h>
 #include <miniweb/router/routes.h>
 
 miniweb_conf_t config;
+static int reload_config(miniweb_server_runtime_t *rt);
 static miniweb_server_runtime_t g_server = {
 	.kq_fd = -1,
 	.listen_fd = -1,
 	.signal_pipe_rfd = -1,
 	.signal_pipe_wfd = -1,
 	.spare_fd = -1,
+	.reload = reload_config,
 };
 
+/* Command line, kept to reload the configuration the same way. */
+static const char *cli_conf_file;
+static int cli_port = -1, cli_threads = -1, cli_conns = -1, cli_verbose;
+static const char *cli_bind, *cli_log_file;
+
 int config_verbose = 0;
 char config_static_dir[CONF_STR_MAX] = "static";
 char config_templates_dir[CONF_STR_MAX] = "templates";
@@ -48,17 +70,84 @@ usage(const char *prog)
 		 MINIWEB_THREAD_POOL_SIZE, config.max_conns);
 }
 
+/** Keep @p c within what the server was built for. */
+static void
+clamp_config(miniweb_conf_t *c)
+{
+	if (c->threads < 1)
+		c->threads = 1;
+	if (c->threads > MINIWEB_THREAD_POOL_SIZE)
+		c->threads = MINIWEB_THREAD_POOL_SIZE;
+	if (c->max_threads > MINIWEB_THREAD_POOL_SIZE)
+		c->max_threads = MINIWEB_THREAD_POOL_SIZE;
+	if (c->slow_threads > MINIWEB_THREAD_POOL_SIZE)
+		c->slow_threads = MINIWEB_THREAD_POOL_SIZE;
+	if (c->dispatchers > MINIWEB_MAX_DISPATCHERS)
+		c->dispatchers = MINIWEB_MAX_DISPATCHERS;
+	if (c->dispatchers > c->threads)
+		c->dispatchers = c->threads;
+	if (c->max_conns > MINIWEB_MAX_CONNECTIONS)
+		c->max_conns = MINIWEB_MAX_CONNECTIONS;
+	if (c->max_req_size > MINIWEB_REQUEST_BUFFER_SIZE)
+		c->max_req_size = MINIWEB_REQUEST_BUFFER_SIZE;
+	if (c->mandoc_helpers > 16)
+		c->mandoc_helpers = 16;
+	if (c->file_cache_mb > 4096)
+		c->file_cache_mb = 4096;
+	if (c->warmup_mb > c->file_cache_mb)
+		c->warmup_mb = c->file_cache_mb;
+	if (c->response_cache_mb > 4096)
+		c->response_cache_mb = 4096;
+	if (c->man_cache_mb > 65536)
+		c->man_cache_mb = 65536;
+	if (c->memory_budget_mb > 65536)
+		c->memory_budget_mb = 65536;
+	if (c->metrics_flush_sec > 3600)
+		c->metrics_flush_sec = 3600;
+	if (c->trace_slow_ms > 600000)
+		c->trace_slow_ms = 600000;
+	if (c->profile_hz > PROFILE_HZ_MAX)
+		c->profile_hz = PROFILE_HZ_MAX;
+	if (c->h2c_threads > 256)
+		c->h2c_threads = 256;
+	if (c->rate_limit_fast_burst > 100000)
+		c->rate_limit_fast_burst = 100000;
+	if (c->rate_limit_slow_burst > 100000)
+		c->rate_limit_slow_burst = 100000;
+}
+
+/** Hand the live settings to the modules that keep their own copy. */
+static void
+apply_live_config(void)
+{
+	config_verbose = config.verbose;
+	config_autoindex = config.autoindex;
+	http_file_cache_set_budget((size_t)config.file_cache_mb * 1024 * 1024);
+	response_cache_set_budget((size_t)config.response_cache_mb * 1024 *
+	    1024);
+	mem_budget_set((size_t)config.memory_budget_mb * 1024 * 1024);
+	subprocess_governor_configure(config.subprocess_max,
+	    config.subprocess_queue, config.subprocess_wait_ms);
+	trace_enable(config.trace_slow_ms);
+	if (profile_enable(config.profile_hz) != 0)
+		log_error("Unable to start the profiler at %d Hz",
+		    config.profile_hz);
+	h2_configure(config.h2c_threads, config.conn_timeout,
+	    miniweb_worker_dispatch_head);
+	rate_limit_configure(ROUTE_CLASS_FAST, config.rate_limit_fast,
+	    config.rate_limit_fast_burst);
+	rate_limit_configure(ROUTE_CLASS_SLOW, config.rate_limit_slow,
+	    config.rate_limit_slow_burst);
+}
+
 /** Parse CLI/config values and propagate global module settings. */
 static void
 parse_args(int argc, char *argv[])
 {
-	const char *conf_file = NULL;
-	int cli_port = -1, cli_threads = -1, cli_conns = -1, cli_verbose = 0;
-	const char *cli_bind = NULL, *cli_log_file = NULL;
 	int opt;
 	while ((opt = getopt(argc, argv, "f:p:b:t:c:l:vh")) != -1) {
 		switch (opt) {
-			case 'f': conf_file = optarg; break;
+			case 'f': cli_conf_file = optarg; break;
 			case 'p': cli_port = atoi(optarg); break;
 			case 'b': cli_bind = optarg; break;
 			case 't': cli_threads = atoi(optarg); break;
@@ -70,22 +159,54 @@ parse_args(int argc, char *argv[])
 		}
 	}
 	conf_defaults(&config);
-	if (conf_load(conf_file, &config) != 0)
+	if (conf_load(cli_conf_file, &config) != 0)
 		exit(1);
 	conf_apply_cli(&config, cli_port, cli_bind, cli_threads, cli_conns,
 				   cli_log_file, cli_verbose);
-	if (config.threads < 1)
-		config.threads = 1;
-	if (config.threads > MINIWEB_THREAD_POOL_SIZE)
-		config.threads = MINIWEB_THREAD_POOL_SIZE;
-	if (config.max_conns > MINIWEB_MAX_CONNECTIONS)
-		config.max_conns = MINIWEB_MAX_CONNECTIONS;
-	if (config.max_req_size > MINIWEB_REQUEST_BUFFER_SIZE)
-		config.max_req_size = MINIWEB_REQUEST_BUFFER_SIZE;
-	config_verbose = config.verbose;
+	clamp_config(&config);
 	strlcpy(config_static_dir, config.static_dir, sizeof(config_static_dir));
 	strlcpy(config_templates_dir, config.templates_dir, sizeof(config_templates_dir));
-	config_autoindex = config.autoindex;
+	apply_live_config();
+}
+
+/**
+ * SIGHUP: load the configuration again, as at startup, and apply what
+ * can change in place. Returns 1 when the rest needs a new process.
+ */
+static int
+reload_config(miniweb_server_runtime_t *rt)
+{
+	miniweb_conf_t next;
+	char changed[CONF_STR_MAX];
+	int restart;
+
+	(void)rt;
+	conf_defaults(&next);
+	if (conf_load(cli_conf_file, &next) != 0) {
+		log_error("Reload: configuration rejected; nothing changed");
+		return 0;
+	}
+	conf_apply_cli(&next, cli_port, cli_bind, cli_threads, cli_conns,
+				   cli_log_file, cli_verbose);
+	clamp_config(&next);
+	restart = conf_reload(&config, &next, changed, sizeof(changed));
+	apply_live_config();
+	log_set_verbose(config.verbose);
+	if (restart == 0) {
+		log_info("Reload: configuration applied in place");
+		return 0;
+	}
+	log_info("Reload: %s need%s a new process", changed,
+			 restart == 1 ? "s" : "");
+	return 1;
+}
+
+/** Warm-up: load the templates while the modules start. */
+static int
+load_templates(void *arg)
+{
+	(void)arg;
+	return template_cache_init();
 }
 
 /** Stop the server on signal-driven shutdown requests. */
@@ -100,24 +221,63 @@ handle_signal(int sig)
 int
 main(int argc, char *argv[])
 {
+	(void)handoff_init(argc, argv);
 	parse_args(argc, argv);
 	if (log_init(config.log_file, config.verbose) != 0)
 		return 1;
 	log_set_verbose(config.verbose);
 
-	log_info("MiniWeb starting on %s:%d (%d thread(s))",
-			 config.bind_addr, config.port, config.threads);
+	if (config.listen_tcp)
+		log_info("MiniWeb starting on %s:%d (%d thread(s))",
+				 config.bind_addr, config.port, config.threads);
+	else
+		log_info("MiniWeb starting on %s (%d thread(s))",
+				 config.unix_socket, config.threads);
 	log_info("Static dir: %s  Templates dir: %s",
 			 config.static_dir, config.templates_dir);
 
 	if (config.verbose)
 		conf_dump(&config);
 
-	if (template_cache_init() != 0) {
-		log_error("template_cache_init failed");
+	/* Fork the spawn helper while the process is still small. */
+	if (spawn_helper_start() != 0)
+		log_info("Spawn helper unavailable; forking commands directly");
+	bundle_set_enabled(config.embedded_assets);
+	if (bundle_enabled())
+		log_info("Serving %zu bundled files", bundle_file_count);
+	/* Before init_routes(): health_path is also a route. */
+	if (health_configure(config.health_path) != 0) {
+		log_error("health_path %s rejected", config.health_path);
 		return 1;
 	}
+	/*
+	 * Templates load, and the modules build their indexes and rings, on
+	 * threads of their own; the instance reports ready once all of them
+	 * are done.
+	 */
+	(void)readiness_run("templates", load_templates, NULL);
 	init_routes(&config);
+	if (readiness_wait("templates") != 0) {
+		log_error("template_cache_init failed");
+		return 1;
+	}
+	/* Bundled templates never change: nothing to watch or reload. */
+	if (bundle_enabled())
+		template_cache_set_watched(1);
+	else if (template_watch_start() != 0)
+		log_info("Template watch unavailable; reloading every 60s");
+	/* After init_routes(): the header names the routes. */
+	if (access_log_open(config.access_log, config.access_log_sample) != 0)
+		return 1;
+	if (!bundle_enabled() && http_file_cache_warm_start(config_static_dir,
+	    (size_t)config.warmup_mb * 1024 * 1024) != 0)
+		log_error("static warm-up could not start");
+	/* After init_routes(): the modules have registered their caches. */
+	if (mem_budget_start() != 0)
+		log_info("Memory budget checks unavailable");
+	if (response_cache_start() != 0)
+		log_info("Response cache refreshes unavailable");
+	readiness_seal();
 	log_info("Routes registered — listening");
 
 	g_server.config = &config;
@@ -129,17 +289,26 @@ main(int argc, char *argv[])
 	(void)sigaction(SIGINT, &sa, NULL);
 	(void)sigaction(SIGTERM, &sa, NULL);
 	(void)signal(SIGPIPE, SIG_IGN);
+	(void)signal(SIGHUP, SIG_IGN);	/* read through shard 0's kqueue */
+	(void)signal(SIGUSR2, SIG_IGN);	/* likewise: binary upgrade */
 	metrics_init_cpu_freq();
 	miniweb_apply_openbsd_security(&config);
 	(void)miniweb_server_run(&g_server);
 
 	log_info("MiniWeb shutting down");
+	profile_cleanup();
+	access_log_close();
+	http_file_cache_warm_stop();
+	vnode_watch_shutdown();
 	man_module_cleanup();
 	networking_module_cleanup();
 	metrics_module_cleanup();
 	packages_cache_cleanup();
+	response_cache_cleanup();
 	http_handler_globals_cleanup();
+	miniweb_reqbuf_cleanup();
 	template_cache_cleanup();
+	spawn_helper_stop();
 	log_close();
 	return 0;
 }
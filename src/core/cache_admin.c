@@ -0,0 +1,120 @@
+/* cache_admin.c - listing and targeted purge of the response caches */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <miniweb/core/cache_admin.h>
+#include <miniweb/core/log.h>
+
+/*
+ * The table only grows, at startup, so a purge copies the callbacks out
+ * and runs them without the table lock: a slow purge (the man L2 tree,
+ * a template reload) holds up nothing but itself.
+ */
+
+static pthread_mutex_t cache_admin_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_admin_ops cache_admin_slots[CACHE_ADMIN_MAX_CACHES];
+static int cache_admin_count;
+
+/**
+ * @brief Add a cache to the admin listing.
+ * @param ops Callbacks and context; copied.
+ * @return 0 on success, -1 when CACHE_ADMIN_MAX_CACHES are registered.
+ */
+int
+cache_admin_register(const struct cache_admin_ops *ops)
+{
+	int rc = -1;
+
+	if (ops == NULL || ops->name == NULL || ops->stats == NULL)
+		return -1;
+	pthread_mutex_lock(&cache_admin_lock);
+	if (cache_admin_count < CACHE_ADMIN_MAX_CACHES) {
+		cache_admin_slots[cache_admin_count++] = *ops;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&cache_admin_lock);
+	if (rc != 0)
+		log_error("[CACHE] no room to list %s", ops->name);
+	return rc;
+}
+
+/** A copy of the table, so callbacks run without cache_admin_lock. */
+static int
+cache_admin_snapshot(struct cache_admin_ops *out)
+{
+	int n;
+
+	pthread_mutex_lock(&cache_admin_lock);
+	n = cache_admin_count;
+	memcpy(out, cache_admin_slots, (size_t)n * sizeof(*out));
+	pthread_mutex_unlock(&cache_admin_lock);
+	return n;
+}
+
+/**
+ * @brief Report every registered cache, in registration order.
+ * @param fn Called with each cache's name and stats.
+ * @param ctx Passed to @p fn.
+ * @return Number of caches reported.
+ */
+int
+cache_admin_foreach(void (*fn)(const char *name,
+    const struct cache_admin_stats *st, void *ctx), void *ctx)
+{
+	struct cache_admin_ops ops[CACHE_ADMIN_MAX_CACHES];
+	struct cache_admin_stats st;
+	int n = cache_admin_snapshot(ops);
+
+	for (int i = 0; i < n; i++) {
+		memset(&st, 0, sizeof(st));
+		ops[i].stats(&st, ops[i].ctx);
+		fn(ops[i].name, &st, ctx);
+	}
+	return n;
+}
+
+/**
+ * @brief Drop one key, or every key under a prefix.
+ * @param name Cache to purge; NULL for all of them.
+ * @param key Exact key or prefix; never NULL.
+ * @param prefix Non-zero to match @p key as a prefix.
+ * @return Entries dropped, or -1 when @p name is not registered.
+ */
+long
+cache_admin_purge(const char *name, const char *key, int prefix)
+{
+	struct cache_admin_ops ops[CACHE_ADMIN_MAX_CACHES];
+	int n = cache_admin_snapshot(ops), found = 0;
+	long dropped = 0;
+
+	if (key == NULL)
+		return -1;
+	for (int i = 0; i < n; i++) {
+		if (name != NULL && strcmp(ops[i].name, name) != 0)
+			continue;
+		found = 1;
+		if (ops[i].purge != NULL)
+			dropped += (long)ops[i].purge(key, prefix, ops[i].ctx);
+	}
+	if (!found)
+		return -1;
+	log_info("[CACHE] purged %ld from %s: %s%s", dropped,
+	    name ? name : "all caches", key, prefix ? "*" : "");
+	return dropped;
+}
+
+/**
+ * @brief Match a cache key against a purge request.
+ * @param key Key of the cached entry.
+ * @param want Key or prefix asked for.
+ * @param prefix Non-zero to match @p want as a prefix.
+ * @return 1 on a match, 0 otherwise.
+ */
+int
+cache_admin_match(const char *key, const char *want, int prefix)
+{
+	if (prefix)
+		return strncmp(key, want, strlen(want)) == 0;
+	return strcmp(key, want) == 0;
+}
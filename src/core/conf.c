@@ -77,30 +77,104 @@ conf_apply_kv(miniweb_conf_t *conf, const char *key, const char *val)
 	} else if (strcasecmp(key, "bind_addr") == 0 ||
 		strcasecmp(key, "bind") == 0) {
 		strlcpy(conf->bind_addr, val, sizeof(conf->bind_addr));
+	} else if (strcasecmp(key, "listen_tcp") == 0) {
+		conf->listen_tcp = parse_bool(val);
+	} else if (strcasecmp(key, "unix_socket") == 0) {
+		strlcpy(conf->unix_socket, val, sizeof(conf->unix_socket));
+	} else if (strcasecmp(key, "health_path") == 0) {
+		strlcpy(conf->health_path, val, sizeof(conf->health_path));
 	} else if (strcasecmp(key, "threads") == 0) {
 		conf->threads = atoi(val);
 	} else if (strcasecmp(key, "max_conns") == 0) {
 		conf->max_conns = atoi(val);
+	} else if (strcasecmp(key, "max_threads") == 0) {
+		conf->max_threads = atoi(val);
+	} else if (strcasecmp(key, "thread_idle_timeout") == 0) {
+		conf->thread_idle_timeout = atoi(val);
+	} else if (strcasecmp(key, "slow_threads") == 0) {
+		conf->slow_threads = atoi(val);
+	} else if (strcasecmp(key, "queue_deadline_ms") == 0) {
+		conf->queue_deadline_ms = atoi(val);
+	} else if (strcasecmp(key, "slow_queue_deadline_ms") == 0) {
+		conf->slow_queue_deadline_ms = atoi(val);
+	} else if (strcasecmp(key, "dispatchers") == 0) {
+		conf->dispatchers = atoi(val);
+	} else if (strcasecmp(key, "worker_kqueue") == 0) {
+		conf->worker_kqueue = parse_bool(val);
+	} else if (strcasecmp(key, "heartbeat_kqueue") == 0) {
+		conf->heartbeat_kqueue = parse_bool(val);
+	} else if (strcasecmp(key, "listen_backpressure") == 0) {
+		conf->listen_backpressure = parse_bool(val);
+	} else if (strcasecmp(key, "overload_503") == 0) {
+		conf->overload_503 = parse_bool(val);
+	} else if (strcasecmp(key, "h2c") == 0) {
+		conf->h2c = parse_bool(val);
+	} else if (strcasecmp(key, "h2c_threads") == 0) {
+		conf->h2c_threads = atoi(val);
 	} else if (strcasecmp(key, "conn_timeout") == 0) {
 		conf->conn_timeout = atoi(val);
 	} else if (strcasecmp(key, "max_req_size") == 0) {
 		conf->max_req_size = atoi(val);
 	} else if (strcasecmp(key, "mandoc_timeout") == 0) {
 		conf->mandoc_timeout = atoi(val);
+	} else if (strcasecmp(key, "mandoc_helpers") == 0) {
+		conf->mandoc_helpers = atoi(val);
+	} else if (strcasecmp(key, "man_stream") == 0) {
+		conf->man_stream = parse_bool(val);
+	} else if (strcasecmp(key, "subprocess_max") == 0) {
+		conf->subprocess_max = atoi(val);
+	} else if (strcasecmp(key, "subprocess_queue") == 0) {
+		conf->subprocess_queue = atoi(val);
+	} else if (strcasecmp(key, "subprocess_wait_ms") == 0) {
+		conf->subprocess_wait_ms = atoi(val);
+	} else if (strcasecmp(key, "rate_limit_fast") == 0) {
+		conf->rate_limit_fast = atoi(val);
+	} else if (strcasecmp(key, "rate_limit_fast_burst") == 0) {
+		conf->rate_limit_fast_burst = atoi(val);
+	} else if (strcasecmp(key, "rate_limit_slow") == 0) {
+		conf->rate_limit_slow = atoi(val);
+	} else if (strcasecmp(key, "rate_limit_slow_burst") == 0) {
+		conf->rate_limit_slow_burst = atoi(val);
 	} else if (strcasecmp(key, "static_dir") == 0) {
 		strlcpy(conf->static_dir, val, sizeof(conf->static_dir));
 	} else if (strcasecmp(key, "templates_dir") == 0) {
 		strlcpy(conf->templates_dir, val, sizeof(conf->templates_dir));
+	} else if (strcasecmp(key, "embedded_assets") == 0) {
+		conf->embedded_assets = parse_bool(val);
 	} else if (strcasecmp(key, "autoindex") == 0) {
 		conf->autoindex = parse_bool(val);
+	} else if (strcasecmp(key, "file_cache_mb") == 0) {
+		conf->file_cache_mb = atoi(val);
+	} else if (strcasecmp(key, "warmup_mb") == 0) {
+		conf->warmup_mb = atoi(val);
+	} else if (strcasecmp(key, "response_cache_mb") == 0) {
+		conf->response_cache_mb = atoi(val);
+	} else if (strcasecmp(key, "man_cache_mb") == 0) {
+		conf->man_cache_mb = atoi(val);
+	} else if (strcasecmp(key, "memory_budget_mb") == 0) {
+		conf->memory_budget_mb = atoi(val);
 	} else if (strcasecmp(key, "mandoc_path") == 0) {
 		strlcpy(conf->mandoc_path, val, sizeof(conf->mandoc_path));
+	} else if (strcasecmp(key, "db_path") == 0) {
+		strlcpy(conf->db_path, val, sizeof(conf->db_path));
+	} else if (strcasecmp(key, "metrics_flush_sec") == 0) {
+		conf->metrics_flush_sec = atoi(val);
 	} else if (strcasecmp(key, "trusted_proxy") == 0) {
 		strlcpy(conf->trusted_proxy, val, sizeof(conf->trusted_proxy));
+	} else if (strcasecmp(key, "unix_socket_trusted") == 0) {
+		conf->unix_socket_trusted = parse_bool(val);
 	} else if (strcasecmp(key, "verbose") == 0) {
 		conf->verbose = parse_bool(val);
 	} else if (strcasecmp(key, "log_file") == 0) {
 		strlcpy(conf->log_file, val, sizeof(conf->log_file));
+	} else if (strcasecmp(key, "access_log") == 0) {
+		strlcpy(conf->access_log, val, sizeof(conf->access_log));
+	} else if (strcasecmp(key, "access_log_sample") == 0) {
+		conf->access_log_sample = atoi(val);
+	} else if (strcasecmp(key, "trace_slow_ms") == 0) {
+		conf->trace_slow_ms = atoi(val);
+	} else if (strcasecmp(key, "profile_hz") == 0) {
+		conf->profile_hz = atoi(val);
 	} else if (strcasecmp(key, "enable_views") == 0) {
 		conf->enable_views = parse_bool(val);
 	} else if (strcasecmp(key, "enable_metrics") == 0) {
@@ -37,23 +37,59 @@ conf_defaults(miniweb_conf_t *conf)
 
 	conf->port = 9001;
 	strlcpy(conf->bind_addr, "127.0.0.1", sizeof(conf->bind_addr));
+	conf->listen_tcp = 1;
 
 	conf->threads = conf_default_threads();
 	conf->max_conns = 1280;
+	conf->max_threads = 0;
+	conf->thread_idle_timeout = 10;
+	conf->slow_threads = 2;
+	conf->queue_deadline_ms = 10000;
+	conf->slow_queue_deadline_ms = 30000;
+	conf->dispatchers = 1;
+	conf->worker_kqueue = 0;
+	conf->heartbeat_kqueue = 0;
+	conf->listen_backpressure = 0;
+	conf->overload_503 = 1;
+	conf->h2c = 0;
+	conf->h2c_threads = 8;
 
 	conf->conn_timeout = 30;
 	conf->max_req_size = 16384;
 	conf->mandoc_timeout = 10;
+	conf->mandoc_helpers = 4;
+	conf->man_stream = 1;
+	conf->subprocess_max = 16;
+	conf->subprocess_queue = 64;
+	conf->subprocess_wait_ms = 2000;
+	conf->rate_limit_fast = 0;
+	conf->rate_limit_fast_burst = 60;
+	conf->rate_limit_slow = 0;
+	conf->rate_limit_slow_burst = 10;
 
 	strlcpy(conf->static_dir, "static", sizeof(conf->static_dir));
 	strlcpy(conf->templates_dir, "templates", sizeof(conf->templates_dir));
+	conf->embedded_assets = 1;
 	conf->autoindex = 0;
+	conf->file_cache_mb = 32;
+	conf->warmup_mb = 8;
+	conf->response_cache_mb = 8;
+	conf->man_cache_mb = 64;
+	conf->memory_budget_mb = 0;
 	strlcpy(conf->mandoc_path, "/usr/bin/mandoc", sizeof(conf->mandoc_path));
+	strlcpy(conf->db_path, "/var/db/miniweb/miniweb.db",
+		sizeof(conf->db_path));
+	conf->metrics_flush_sec = 30;
 
 	strlcpy(conf->trusted_proxy, "127.0.0.1", sizeof(conf->trusted_proxy));
+	conf->unix_socket_trusted = 1;
 
 	conf->verbose = 0;
 	conf->log_file[0] = '\0';
+	conf->access_log[0] = '\0';
+	conf->access_log_sample = 1;
+	conf->trace_slow_ms = 0;
+	conf->profile_hz = 0;
 
 	conf->enable_views = 1;
 	conf->enable_metrics = 1;
@@ -111,19 +147,61 @@ conf_dump(const miniweb_conf_t *conf)
 	fprintf(stderr, "=== miniweb active configuration ===\n");
 	fprintf(stderr, "  port          : %d\n", conf->port);
 	fprintf(stderr, "  bind_addr     : %s\n", conf->bind_addr);
+	fprintf(stderr, "  listen_tcp    : %d\n", conf->listen_tcp);
+	fprintf(stderr, "  unix_socket   : %s\n",
+		conf->unix_socket[0] ? conf->unix_socket : "(none)");
+	fprintf(stderr, "  health_path   : %s\n",
+		conf->health_path[0] ? conf->health_path : "(none)");
 	fprintf(stderr, "  threads       : %d\n", conf->threads);
 	fprintf(stderr, "  max_conns     : %d\n", conf->max_conns);
+	fprintf(stderr, "  max_threads   : %d\n", conf->max_threads);
+	fprintf(stderr, "  thread_idle   : %d\n", conf->thread_idle_timeout);
+	fprintf(stderr, "  slow_threads  : %d\n", conf->slow_threads);
+	fprintf(stderr, "  queue_deadline: %d ms\n", conf->queue_deadline_ms);
+	fprintf(stderr, "  slow_deadline : %d ms\n", conf->slow_queue_deadline_ms);
+	fprintf(stderr, "  dispatchers   : %d\n", conf->dispatchers);
+	fprintf(stderr, "  worker_kqueue : %d\n", conf->worker_kqueue);
+	fprintf(stderr, "  hb_kqueue     : %d\n", conf->heartbeat_kqueue);
+	fprintf(stderr, "  backpressure  : %d\n", conf->listen_backpressure);
+	fprintf(stderr, "  overload_503  : %d\n", conf->overload_503);
+	fprintf(stderr, "  h2c           : %d\n", conf->h2c);
+	fprintf(stderr, "  h2c_threads   : %d\n", conf->h2c_threads);
 	fprintf(stderr, "  conn_timeout  : %d\n", conf->conn_timeout);
 	fprintf(stderr, "  max_req_size  : %d\n", conf->max_req_size);
 	fprintf(stderr, "  mandoc_timeout: %d\n", conf->mandoc_timeout);
+	fprintf(stderr, "  mandoc_helpers: %d\n", conf->mandoc_helpers);
+	fprintf(stderr, "  man_stream    : %d\n", conf->man_stream);
+	fprintf(stderr, "  subproc_max   : %d\n", conf->subprocess_max);
+	fprintf(stderr, "  subproc_queue : %d\n", conf->subprocess_queue);
+	fprintf(stderr, "  subproc_wait  : %d\n", conf->subprocess_wait_ms);
+	fprintf(stderr, "  rate_fast     : %d/min, burst %d\n",
+		conf->rate_limit_fast, conf->rate_limit_fast_burst);
+	fprintf(stderr, "  rate_slow     : %d/min, burst %d\n",
+		conf->rate_limit_slow, conf->rate_limit_slow_burst);
 	fprintf(stderr, "  static_dir    : %s\n", conf->static_dir);
 	fprintf(stderr, "  templates_dir : %s\n", conf->templates_dir);
+	fprintf(stderr, "  embedded      : %d\n", conf->embedded_assets);
 	fprintf(stderr, "  autoindex     : %d\n", conf->autoindex);
+	fprintf(stderr, "  file_cache_mb : %d\n", conf->file_cache_mb);
+	fprintf(stderr, "  warmup_mb     : %d\n", conf->warmup_mb);
+	fprintf(stderr, "  resp_cache_mb : %d\n", conf->response_cache_mb);
+	fprintf(stderr, "  man_cache_mb  : %d\n", conf->man_cache_mb);
+	fprintf(stderr, "  memory_mb     : %d\n", conf->memory_budget_mb);
 	fprintf(stderr, "  mandoc_path   : %s\n", conf->mandoc_path);
+	fprintf(stderr, "  db_path       : %s\n",
+		conf->db_path[0] ? conf->db_path : "(none)");
+	fprintf(stderr, "  metrics_flush_sec: %d\n", conf->metrics_flush_sec);
 	fprintf(stderr, "  trusted_proxy : %s\n", conf->trusted_proxy);
+	fprintf(stderr, "  unix_socket_trusted: %d\n",
+		conf->unix_socket_trusted);
 	fprintf(stderr, "  verbose       : %d\n", conf->verbose);
 	fprintf(stderr, "  log_file      : %s\n",
 		conf->log_file[0] ? conf->log_file : "(stderr)");
+	fprintf(stderr, "  access_log    : %s\n",
+		conf->access_log[0] ? conf->access_log : "(off)");
+	fprintf(stderr, "  access_sample : %d\n", conf->access_log_sample);
+	fprintf(stderr, "  trace_slow_ms : %d\n", conf->trace_slow_ms);
+	fprintf(stderr, "  profile_hz    : %d\n", conf->profile_hz);
 	fprintf(stderr, "  enable_views  : %d\n", conf->enable_views);
 	fprintf(stderr, "  enable_metrics: %d\n", conf->enable_metrics);
 	fprintf(stderr, "  enable_networking: %d\n", conf->enable_networking);
@@ -0,0 +1,131 @@
+#include <stddef.h>
+#include <string.h>
+
+#include <miniweb/core/conf.h>
+
+/*
+ * Every knob, and whether a running server can take a new value for it.
+ * Live ones are read where they are used (or handed to their module by
+ * the caller right after conf_reload()); the others size or wire
+ * something at startup — threads, listeners, modules, paths — and only
+ * a new process can apply them.
+ */
+typedef struct {
+	const char *name;
+	size_t off;
+	int is_str;
+	int live;
+} conf_field_t;
+
+#define CONF_INT(f, live)	{ #f, offsetof(miniweb_conf_t, f), 0, live }
+#define CONF_STR(f)		{ #f, offsetof(miniweb_conf_t, f), 1, 0 }
+
+static const conf_field_t conf_fields[] = {
+	CONF_INT(port, 0),
+	CONF_STR(bind_addr),
+	CONF_INT(listen_tcp, 0),
+	CONF_STR(unix_socket),
+	CONF_STR(health_path),
+	CONF_INT(threads, 0),
+	CONF_INT(max_conns, 1),
+	CONF_INT(max_threads, 0),
+	CONF_INT(thread_idle_timeout, 0),
+	CONF_INT(slow_threads, 0),
+	CONF_INT(queue_deadline_ms, 1),
+	CONF_INT(slow_queue_deadline_ms, 1),
+	CONF_INT(dispatchers, 0),
+	CONF_INT(worker_kqueue, 0),
+	CONF_INT(heartbeat_kqueue, 0),
+	CONF_INT(listen_backpressure, 1),
+	CONF_INT(overload_503, 0),
+	CONF_INT(h2c, 1),
+	CONF_INT(h2c_threads, 0),
+	CONF_INT(conn_timeout, 1),
+	CONF_INT(max_req_size, 1),
+	CONF_INT(mandoc_timeout, 0),
+	CONF_INT(mandoc_helpers, 0),
+	CONF_INT(man_stream, 1),
+	CONF_INT(subprocess_max, 1),
+	CONF_INT(subprocess_queue, 1),
+	CONF_INT(subprocess_wait_ms, 1),
+	CONF_INT(rate_limit_fast, 1),
+	CONF_INT(rate_limit_fast_burst, 1),
+	CONF_INT(rate_limit_slow, 1),
+	CONF_INT(rate_limit_slow_burst, 1),
+	CONF_STR(static_dir),
+	CONF_STR(templates_dir),
+	CONF_INT(embedded_assets, 0),
+	CONF_INT(autoindex, 1),
+	CONF_INT(file_cache_mb, 1),
+	CONF_INT(warmup_mb, 1),		/* startup only: nothing to redo */
+	CONF_INT(response_cache_mb, 1),
+	CONF_INT(man_cache_mb, 0),
+	CONF_INT(memory_budget_mb, 1),
+	CONF_STR(mandoc_path),
+	CONF_STR(db_path),
+	CONF_INT(metrics_flush_sec, 0),
+	CONF_STR(trusted_proxy),
+	CONF_INT(unix_socket_trusted, 0),
+	CONF_INT(verbose, 1),
+	CONF_STR(log_file),
+	CONF_STR(access_log),
+	CONF_INT(access_log_sample, 0),
+	CONF_INT(trace_slow_ms, 1),
+	CONF_INT(profile_hz, 1),
+	CONF_INT(enable_views, 0),
+	CONF_INT(enable_metrics, 0),
+	CONF_INT(enable_networking, 0),
+	CONF_INT(enable_man, 0),
+	CONF_INT(enable_packages, 0),
+};
+
+/**
+ * @brief Take what a running server can from a freshly loaded config.
+ *
+ * @details Live fields of @p next are stored into @p cur atomically, as
+ * workers read them unlocked; the rest of @p cur is left alone.
+ *
+ * @param cur Configuration in force.
+ * @param next Configuration just loaded and clamped.
+ * @param changed Receives the names of the fields that differ but are
+ * not live, comma separated; may be NULL.
+ * @param changed_len Size of @p changed.
+ *
+ * @return Number of such fields: 0 when @p next is fully in force.
+ */
+int
+conf_reload(miniweb_conf_t *cur, const miniweb_conf_t *next, char *changed,
+	size_t changed_len)
+{
+	int restart = 0;
+
+	if (changed != NULL && changed_len > 0)
+		changed[0] = '\0';
+	for (size_t i = 0; i < sizeof(conf_fields) / sizeof(conf_fields[0]);
+		i++) {
+		const conf_field_t *f = &conf_fields[i];
+		char *c = (char *)cur + f->off;
+		const char *n = (const char *)next + f->off;
+
+		if (f->is_str) {
+			if (strcmp(c, n) == 0)
+				continue;
+		} else {
+			int v = *(const int *)n;
+
+			if (*(int *)c == v)
+				continue;
+			if (f->live) {
+				__atomic_store_n((int *)c, v, __ATOMIC_RELAXED);
+				continue;
+			}
+		}
+		if (changed != NULL && changed_len > 0) {
+			if (restart > 0)
+				strlcat(changed, ", ", changed_len);
+			strlcat(changed, f->name, changed_len);
+		}
+		restart++;
+	}
+	return restart;
+}
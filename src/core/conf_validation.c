@@ -1,4 +1,9 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #include <miniweb/core/conf.h>
+#include <miniweb/net/health.h>
 
 /**
  * @brief conf_validate operation.
@@ -14,15 +19,73 @@ conf_validate(miniweb_conf_t *conf)
 {
 	if (conf->port <= 0 || conf->port > 65535)
 		return -1;
+	/* Some listener, and a socket path that is absolute and fits. */
+	if (!conf->listen_tcp && conf->unix_socket[0] == '\0')
+		return -1;
+	if (conf->unix_socket[0] != '\0' && (conf->unix_socket[0] != '/' ||
+		strlen(conf->unix_socket) >=
+		sizeof(((struct sockaddr_un *)0)->sun_path)))
+		return -1;
+	/* Matched byte for byte against the request line. */
+	if (conf->health_path[0] != '\0' && (conf->health_path[0] != '/' ||
+		strlen(conf->health_path) >= HEALTH_PATH_MAX ||
+		strcspn(conf->health_path, " ?#") != strlen(conf->health_path)))
+		return -1;
 	if (conf->threads <= 0)
 		return -1;
 	if (conf->max_conns <= 0)
 		return -1;
+	if (conf->max_threads < 0)
+		return -1;
+	if (conf->thread_idle_timeout <= 0)
+		return -1;
+	if (conf->slow_threads < 0)
+		return -1;
+	if (conf->queue_deadline_ms < 0 || conf->slow_queue_deadline_ms < 0)
+		return -1;
+	if (conf->dispatchers <= 0)
+		return -1;
+	if (conf->h2c_threads <= 0)
+		return -1;
 	if (conf->conn_timeout <= 0)
 		return -1;
 	if (conf->max_req_size <= 0)
 		return -1;
 	if (conf->mandoc_timeout <= 0)
 		return -1;
+	if (conf->mandoc_helpers < 0)
+		return -1;
+	if (conf->subprocess_max <= 0 || conf->subprocess_queue < 0 ||
+		conf->subprocess_wait_ms < 0)
+		return -1;
+	if (conf->rate_limit_fast < 0 || conf->rate_limit_fast_burst <= 0 ||
+		conf->rate_limit_slow < 0 || conf->rate_limit_slow_burst <= 0)
+		return -1;
+	if (conf->access_log_sample <= 0)
+		return -1;
+	if (conf->trace_slow_ms < 0)
+		return -1;
+	if (conf->profile_hz < 0)
+		return -1;
+	if (conf->file_cache_mb < 0)
+		return -1;
+	if (conf->warmup_mb < 0)
+		return -1;
+	if (conf->response_cache_mb < 0)
+		return -1;
+	if (conf->man_cache_mb < 0)
+		return -1;
+	if (conf->memory_budget_mb < 0)
+		return -1;
+	if (conf->metrics_flush_sec < 0)
+		return -1;
+	/* A database under static_dir could be downloaded. */
+	if (conf->db_path[0] != '\0') {
+		size_t n = strlen(conf->static_dir);
+
+		if (strncmp(conf->db_path, conf->static_dir, n) == 0 &&
+			conf->db_path[n] == '/')
+			return -1;
+	}
 	return 0;
 }
@@ -0,0 +1,188 @@
+/* counters.c - per-thread server self-instrumentation counters */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/counters.h>
+
+/*
+ * Same layout as the route stats: every thread owns a block, reached
+ * through a pthread key, that only it writes. Blocks are cache-line
+ * aligned and padded so two threads never share a line, and a thread
+ * that exits folds its block into counters_retired. Readers sum the
+ * registered blocks under counters_lock.
+ */
+
+#define COUNTERS_LINE	64
+
+struct counters_data {
+	uint64_t v[CTR_COUNT];
+	union counters_block *next;
+};
+
+typedef union counters_block {
+	struct counters_data d;
+	char pad[(sizeof(struct counters_data) + COUNTERS_LINE - 1) /
+	    COUNTERS_LINE * COUNTERS_LINE];
+} counters_block_t;
+
+static const struct {
+	const char *group;
+	const char *name;
+} counters_info[CTR_COUNT] = {
+	[CTR_ACCEPTS] = { "dispatcher", "accepts" },
+	[CTR_ACCEPTS_UNIX] = { "dispatcher", "accepts_unix" },
+	[CTR_ACCEPT_ERRORS] = { "dispatcher", "accept_errors" },
+	[CTR_ACCEPT_PAUSES] = { "dispatcher", "accept_pauses" },
+	[CTR_ACCEPT_SHED] = { "dispatcher", "accept_shed" },
+	[CTR_EVENTS_QUEUED] = { "dispatcher", "events_queued" },
+	[CTR_QUEUE_DROPS] = { "dispatcher", "queue_drops" },
+	[CTR_HEALTH_CHECKS] = { "dispatcher", "health_checks" },
+	[CTR_TIMER_REARM_FAILURES] = { "dispatcher", "timer_rearm_failures" },
+	[CTR_REQUESTS] = { "worker", "requests" },
+	[CTR_KEEPALIVE_REUSE] = { "worker", "keepalive_reuse" },
+	[CTR_LANE_HANDOFFS] = { "worker", "lane_handoffs" },
+	[CTR_SHED_FAST] = { "worker", "shed_fast" },
+	[CTR_SHED_SLOW] = { "worker", "shed_slow" },
+	[CTR_WRITE_PARKED] = { "worker", "write_parked" },
+	[CTR_KEVENT_CHANGES] = { "worker", "kevent_changes" },
+	[CTR_KEVENT_CALLS] = { "worker", "kevent_calls" },
+	[CTR_STATUS_503] = { "worker", "status_503" },
+	[CTR_QUEUE_PUSHES] = { "queue", "pushes" },
+	[CTR_QUEUE_FULL] = { "queue", "full" },
+	[CTR_QUEUE_WAITS] = { "queue", "waits" },
+	[CTR_CONN_OPENED] = { "connections", "opened" },
+	[CTR_CONN_CLOSED] = { "connections", "closed" },
+	[CTR_CONN_REFUSED] = { "connections", "refused" },
+	[CTR_RESP_LOCAL] = { "responses", "local" },
+	[CTR_RESP_SHARED] = { "responses", "shared" },
+	[CTR_RESP_ALLOC] = { "responses", "alloc" },
+	[CTR_VIEW_CACHE_HITS] = { "caches", "view_hits" },
+	[CTR_VIEW_CACHE_MISSES] = { "caches", "view_misses" },
+	[CTR_MAN_L2_HITS] = { "caches", "man_l2_hits" },
+	[CTR_MAN_L2_MISSES] = { "caches", "man_l2_misses" },
+	[CTR_RESPONSE_CACHE_HITS] = { "caches", "response_hits" },
+	[CTR_RESPONSE_CACHE_MISSES] = { "caches", "response_misses" },
+	[CTR_H2_SESSIONS] = { "h2", "sessions" },
+	[CTR_H2_STREAMS] = { "h2", "streams" },
+	[CTR_H2_REFUSED] = { "h2", "refused" },
+	[CTR_RATE_LIMITED_FAST] = { "rate_limit", "fast" },
+	[CTR_RATE_LIMITED_SLOW] = { "rate_limit", "slow" },
+	[CTR_KEEPALIVE_EXTENDED] = { "keepalive", "extended" },
+	[CTR_KEEPALIVE_BUDGET_CLOSES] = { "keepalive", "budget_closes" },
+	[CTR_KEEPALIVE_IDLE_CLOSES] = { "keepalive", "idle_closes" },
+};
+
+static pthread_key_t counters_key;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+static int counters_key_ok;
+
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static counters_block_t *counters_blocks;
+static uint64_t counters_retired[CTR_COUNT];
+/* Threads without a block of their own share this one, atomically. */
+static uint64_t counters_shared[CTR_COUNT];
+
+/** pthread_key destructor: keep a departing thread's counts. */
+static void
+counters_thread_free(void *p)
+{
+	counters_block_t *blk = p;
+	counters_block_t **pp;
+
+	pthread_mutex_lock(&counters_lock);
+	for (pp = &counters_blocks; *pp; pp = &(*pp)->d.next) {
+		if (*pp == blk) {
+			*pp = blk->d.next;
+			break;
+		}
+	}
+	for (int i = 0; i < CTR_COUNT; i++)
+		counters_retired[i] += blk->d.v[i];
+	pthread_mutex_unlock(&counters_lock);
+	free(blk);
+}
+
+static void
+counters_key_init(void)
+{
+	counters_key_ok = pthread_key_create(&counters_key,
+	    counters_thread_free) == 0;
+}
+
+/** Calling thread's block, created on first use; NULL if unavailable. */
+static counters_block_t *
+counters_thread(void)
+{
+	counters_block_t *blk;
+	void *mem;
+
+	(void)pthread_once(&counters_once, counters_key_init);
+	if (!counters_key_ok)
+		return NULL;
+	blk = pthread_getspecific(counters_key);
+	if (blk)
+		return blk;
+	if (posix_memalign(&mem, COUNTERS_LINE, sizeof(*blk)) != 0)
+		return NULL;
+	blk = mem;
+	memset(blk, 0, sizeof(*blk));
+	if (pthread_setspecific(counters_key, blk) != 0) {
+		free(blk);
+		return NULL;
+	}
+	pthread_mutex_lock(&counters_lock);
+	blk->d.next = counters_blocks;
+	counters_blocks = blk;
+	pthread_mutex_unlock(&counters_lock);
+	return blk;
+}
+
+/**
+ * @brief Add @p n to counter @p id for the calling thread.
+ */
+void
+counter_add(counter_id_t id, uint64_t n)
+{
+	counters_block_t *blk;
+
+	if ((unsigned int)id >= CTR_COUNT)
+		return;
+	if ((blk = counters_thread()) == NULL) {
+		__atomic_add_fetch(&counters_shared[id], n, __ATOMIC_RELAXED);
+		return;
+	}
+	/* Owner-only increment: readers may load the field at any time. */
+	__atomic_store_n(&blk->d.v[id], blk->d.v[id] + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sum every thread's counters into @p out.
+ * @param out CTR_COUNT entries.
+ */
+void
+counters_read(uint64_t out[CTR_COUNT])
+{
+	pthread_mutex_lock(&counters_lock);
+	for (int i = 0; i < CTR_COUNT; i++)
+		out[i] = counters_retired[i] +
+		    __atomic_load_n(&counters_shared[i], __ATOMIC_RELAXED);
+	for (counters_block_t *blk = counters_blocks; blk; blk = blk->d.next) {
+		for (int i = 0; i < CTR_COUNT; i++)
+			out[i] += __atomic_load_n(&blk->d.v[i], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&counters_lock);
+}
+
+const char *
+counter_group(counter_id_t id)
+{
+	return (unsigned int)id < CTR_COUNT ? counters_info[id].group : "";
+}
+
+const char *
+counter_name(counter_id_t id)
+{
+	return (unsigned int)id < CTR_COUNT ? counters_info[id].name : "";
+}
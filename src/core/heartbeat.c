@@ -1,5 +1,6 @@
 /* heartbeat.c - unique heartbeat logic */
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
@@ -12,9 +13,15 @@ int g_hb_initialized;
 int g_hb_running;
 int g_hb_stop_requested;
 int g_hb_drain_on_stop;
+int g_hb_workers_exit;
+int g_hb_wanted;	/* started and not shut down, whichever the mode */
 pthread_t g_hb_thread;
+pthread_t g_hb_workers[HB_WORKERS];
+int g_hb_nworkers;
 pthread_mutex_t g_hb_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t g_hb_cond;
+pthread_cond_t g_hb_work_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t g_hb_idle_cond = PTHREAD_COND_INITIALIZER;
 
 static void *heartbeat_thread(void *arg);
 
@@ -44,25 +51,18 @@ heartbeat_init(void)
 	return 0;
 }
 
-/**
- * @brief heartbeat_register operation.
- *
- * @details Performs the core heartbeat_register routine for this module.
- *
- * @param task Input parameter for heartbeat_register.
- *
- * @return Return value produced by heartbeat_register.
- */
-int
-heartbeat_register(const struct hb_task *task)
+/** Insert @p task with its period and delay in milliseconds. */
+static int
+hb_register(const struct hb_task *task, uint64_t period_ms,
+	uint64_t initial_delay_ms)
 {
-	time_t now;
+	uint64_t now;
 
-	if (!task || !task->name || !task->cb || task->period_sec == 0)
+	if (!task || !task->name || !task->cb || period_ms == 0)
 		return HB_REGISTER_ERROR;
 
 	(void)heartbeat_init();
-	now = time(NULL);
+	now = hb_now_ms();
 
 	pthread_mutex_lock(&g_hb_lock);
 	for (int i = 0; i < HB_MAX_TASKS; i++) {
@@ -75,13 +75,17 @@ heartbeat_register(const struct hb_task *task)
 	}
 
 	for (int i = 0; i < HB_MAX_TASKS; i++) {
-		if (g_hb_slots[i].active)
+		hb_slot_t *s = &g_hb_slots[i];
+
+		if (s->active)
 			continue;
-		g_hb_slots[i].task = *task;
-		g_hb_slots[i].next_run = now + (time_t)task->initial_delay_sec;
-		memset(&g_hb_slots[i].stats, 0, sizeof(g_hb_slots[i].stats));
-		g_hb_slots[i].active = 1;
-		pthread_cond_signal(&g_hb_cond);
+		s->task = *task;
+		s->period_ms = period_ms;
+		memset(&s->stats, 0, sizeof(s->stats));
+		hb_schedule_first(s, now, initial_delay_ms);
+		s->state = HB_IDLE;
+		s->active = 1;
+		hb_wake();
 		pthread_mutex_unlock(&g_hb_lock);
 		return HB_REGISTER_INSERTED;
 	}
@@ -89,6 +93,40 @@ heartbeat_register(const struct hb_task *task)
 	return HB_REGISTER_ERROR;
 }
 
+/**
+ * @brief Register a task with its period and delay in seconds.
+ *
+ * @param task Task descriptor; copied.
+ *
+ * @return HB_REGISTER_INSERTED, HB_REGISTER_DUPLICATE for a name already
+ *         registered, or HB_REGISTER_ERROR.
+ */
+int
+heartbeat_register(const struct hb_task *task)
+{
+	if (!task)
+		return HB_REGISTER_ERROR;
+	return hb_register(task, (uint64_t)task->period_sec * 1000,
+	    (uint64_t)task->initial_delay_sec * 1000);
+}
+
+/**
+ * @brief Register a task with its period and delay in milliseconds.
+ *
+ * @param task Task descriptor; copied, its seconds fields ignored.
+ * @param period_ms Period in milliseconds; must be non-zero.
+ * @param initial_delay_ms Delay before the first run in milliseconds.
+ *
+ * @return As heartbeat_register().
+ */
+int
+heartbeat_register_ms(const struct hb_task *task,
+	unsigned int period_ms,
+	unsigned int initial_delay_ms)
+{
+	return hb_register(task, period_ms, initial_delay_ms);
+}
+
 /**
  * @brief heartbeat_unregister operation.
  *
@@ -110,8 +148,22 @@ heartbeat_unregister(const char *name)
 		if (!g_hb_slots[i].active)
 			continue;
 		if (strcmp(g_hb_slots[i].task.name, name) == 0) {
-			memset(&g_hb_slots[i], 0, sizeof(g_hb_slots[i]));
-			pthread_cond_signal(&g_hb_cond);
+			hb_slot_t *s = &g_hb_slots[i];
+			unsigned int gen = s->gen;
+
+			/*
+			 * Wait out a queued or running callback, so the caller
+			 * may free its context, unless it is that callback.
+			 */
+			while (s->gen == gen && s->state != HB_IDLE &&
+			    !(s->state == HB_RUNNING &&
+			    pthread_equal(s->runner, pthread_self())))
+				pthread_cond_wait(&g_hb_idle_cond, &g_hb_lock);
+			if (s->gen == gen) {
+				memset(s, 0, sizeof(*s));
+				s->gen = gen + 1;
+				hb_wake();
+			}
 			pthread_mutex_unlock(&g_hb_lock);
 			return 0;
 		}
@@ -120,6 +172,37 @@ heartbeat_unregister(const char *name)
 	return -1;
 }
 
+/** Reschedule @p name with its period and delay in milliseconds. */
+static int
+hb_update(const char *name, uint64_t period_ms, uint64_t initial_delay_ms,
+	void *ctx)
+{
+	uint64_t now;
+
+	if (!name || period_ms == 0)
+		return -1;
+
+	(void)heartbeat_init();
+	now = hb_now_ms();
+	pthread_mutex_lock(&g_hb_lock);
+	for (int i = 0; i < HB_MAX_TASKS; i++) {
+		hb_slot_t *s = &g_hb_slots[i];
+
+		if (!s->active)
+			continue;
+		if (strcmp(s->task.name, name) != 0)
+			continue;
+		s->period_ms = period_ms;
+		s->task.ctx = ctx;
+		hb_schedule_first(s, now, initial_delay_ms);
+		hb_wake();
+		pthread_mutex_unlock(&g_hb_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&g_hb_lock);
+	return -1;
+}
+
 /**
  * @brief heartbeat_update operation.
  *
@@ -138,24 +221,53 @@ heartbeat_update(const char *name,
 	unsigned int initial_delay_sec,
 	void *ctx)
 {
-	time_t now;
+	return hb_update(name, (uint64_t)period_sec * 1000,
+	    (uint64_t)initial_delay_sec * 1000, ctx);
+}
+
+/**
+ * @brief As heartbeat_update(), with the period and delay in milliseconds.
+ *
+ * @param name Registered task name.
+ * @param period_ms New period in milliseconds; must be non-zero.
+ * @param initial_delay_ms Delay before the next run in milliseconds.
+ * @param ctx New callback context.
+ *
+ * @return 0 on success, -1 when @p name is not registered.
+ */
+int
+heartbeat_update_ms(const char *name,
+	unsigned int period_ms,
+	unsigned int initial_delay_ms,
+	void *ctx)
+{
+	return hb_update(name, period_ms, initial_delay_ms, ctx);
+}
 
-	if (!name || period_sec == 0)
+/**
+ * @brief heartbeat_get_stats operation.
+ *
+ * @details Performs the core heartbeat_get_stats routine for this module.
+ *
+ * @param name Input parameter for heartbeat_get_stats.
+ * @param stats_out Input parameter for heartbeat_get_stats.
+ *
+ * @return Return value produced by heartbeat_get_stats.
+ */
+int
+heartbeat_get_stats(const char *name, struct hb_task_stats *stats_out)
+{
+	if (!name || !stats_out)
 		return -1;
 
 	(void)heartbeat_init();
-	now = time(NULL);
 	pthread_mutex_lock(&g_hb_lock);
 	for (int i = 0; i < HB_MAX_TASKS; i++) {
 		if (!g_hb_slots[i].active)
 			continue;
 		if (strcmp(g_hb_slots[i].task.name, name) != 0)
 			continue;
-		g_hb_slots[i].task.period_sec = period_sec;
-		g_hb_slots[i].task.initial_delay_sec = initial_delay_sec;
-		g_hb_slots[i].task.ctx = ctx;
-		g_hb_slots[i].next_run = now + (time_t)initial_delay_sec;
-		pthread_cond_signal(&g_hb_cond);
+		*stats_out = g_hb_slots[i].stats;
 		pthread_mutex_unlock(&g_hb_lock);
 		return 0;
 	}
@@ -164,19 +276,23 @@ heartbeat_update(const char *name,
 }
 
 /**
- * @brief heartbeat_get_stats operation.
+ * @brief Report the counters of every registered task.
  *
- * @details Performs the core heartbeat_get_stats routine for this module.
+ * @details @p fn runs with the scheduler lock held, so it must not call
+ * back into the heartbeat API.
  *
- * @param name Input parameter for heartbeat_get_stats.
- * @param stats_out Input parameter for heartbeat_get_stats.
+ * @param fn Called with each task's name and counters.
+ * @param ctx Passed to @p fn.
  *
- * @return Return value produced by heartbeat_get_stats.
+ * @return Number of tasks reported, or -1 when @p fn is NULL.
  */
 int
-heartbeat_get_stats(const char *name, struct hb_task_stats *stats_out)
+heartbeat_foreach_stats(void (*fn)(const char *name,
+	const struct hb_task_stats *stats, void *ctx), void *ctx)
 {
-	if (!name || !stats_out)
+	int n = 0;
+
+	if (!fn)
 		return -1;
 
 	(void)heartbeat_init();
@@ -184,35 +300,56 @@ heartbeat_get_stats(const char *name, struct hb_task_stats *stats_out)
 	for (int i = 0; i < HB_MAX_TASKS; i++) {
 		if (!g_hb_slots[i].active)
 			continue;
-		if (strcmp(g_hb_slots[i].task.name, name) != 0)
-			continue;
-		*stats_out = g_hb_slots[i].stats;
-		pthread_mutex_unlock(&g_hb_lock);
-		return 0;
+		fn(g_hb_slots[i].task.name, &g_hb_slots[i].stats, ctx);
+		n++;
 	}
 	pthread_mutex_unlock(&g_hb_lock);
-	return -1;
+	return n;
 }
 
 /**
- * @brief heartbeat_start operation.
+ * @brief Start the scheduler thread and its HB_WORKERS task workers.
  *
- * @details Performs the core heartbeat_start routine for this module.
+ * @details In heartbeat_use_kqueue() mode no thread is started; tasks
+ * start firing from the kqueue timer instead.
  *
- * @return Return value produced by heartbeat_start.
+ * @return 0 on success, -1 when no thread could be started.
  */
 int
 heartbeat_start(void)
 {
+	int n;
+
 	(void)heartbeat_init();
 	pthread_mutex_lock(&g_hb_lock);
-	if (g_hb_running) {
+	g_hb_wanted = 1;
+	if (g_hb_kq >= 0)
+		hb_wake();
+	if (g_hb_running || g_hb_kq >= 0) {
 		pthread_mutex_unlock(&g_hb_lock);
 		return 0;
 	}
 	g_hb_stop_requested = 0;
 	g_hb_drain_on_stop = 0;
-	if (pthread_create(&g_hb_thread, NULL, heartbeat_thread, NULL) != 0) {
+	g_hb_workers_exit = 0;
+	for (n = 0; n < HB_WORKERS; n++) {
+		if (pthread_create(&g_hb_workers[n], NULL, hb_worker_thread,
+		    NULL) != 0)
+			break;
+	}
+	g_hb_nworkers = n;
+	if (n == 0 ||
+	    pthread_create(&g_hb_thread, NULL, heartbeat_thread, NULL) != 0) {
+		pthread_t workers[HB_WORKERS];
+
+		memcpy(workers, g_hb_workers, sizeof(workers));
+		g_hb_workers_exit = 1;
+		pthread_cond_broadcast(&g_hb_work_cond);
+		pthread_mutex_unlock(&g_hb_lock);
+		for (int i = 0; i < n; i++)
+			(void)pthread_join(workers[i], NULL);
+		pthread_mutex_lock(&g_hb_lock);
+		hb_mark_stopped();
 		pthread_mutex_unlock(&g_hb_lock);
 		return -1;
 	}
@@ -235,20 +372,15 @@ heartbeat_stop(void)
 }
 
 /**
- * @brief heartbeat_shutdown operation.
+ * @brief Stop the scheduler thread and its workers, if running.
  *
- * @details Performs the core heartbeat_shutdown routine for this module.
- *
- * @param drain Input parameter for heartbeat_shutdown.
- *
- * @return Return value produced by heartbeat_shutdown.
+ * @param drain Non-zero to run every idle task a final time first.
  */
-int
-heartbeat_shutdown(int drain)
+void
+hb_stop_thread(int drain)
 {
 	int should_join = 0;
 
-	(void)heartbeat_init();
 	pthread_mutex_lock(&g_hb_lock);
 	if (g_hb_running) {
 		g_hb_stop_requested = 1;
@@ -260,63 +392,80 @@ heartbeat_shutdown(int drain)
 
 	if (should_join)
 		(void)pthread_join(g_hb_thread, NULL);
+}
 
+/**
+ * @brief Stop running tasks until the next heartbeat_start().
+ *
+ * @details In heartbeat_use_kqueue() mode the drain runs on the caller,
+ * since the loop that would run it may be stopping too.
+ *
+ * @param drain Non-zero to run every idle task a final time first.
+ *
+ * @return 0.
+ */
+int
+heartbeat_shutdown(int drain)
+{
+	(void)heartbeat_init();
+	pthread_mutex_lock(&g_hb_lock);
+	g_hb_wanted = 0;
+	if (g_hb_kq >= 0 && drain) {
+		for (int i = 0; i < HB_MAX_TASKS; i++) {
+			hb_slot_t *s = &g_hb_slots[i];
+
+			if (!s->active || s->state != HB_IDLE)
+				continue;
+			s->state = HB_QUEUED;
+			s->stats.runs++;
+			s->stats.last_run = time(NULL);
+			hb_run_slot(i);
+		}
+	}
+	pthread_mutex_unlock(&g_hb_lock);
+	hb_stop_thread(drain);
 	return 0;
 }
 
 /**
- * @brief heartbeat_thread operation.
+ * @brief Scheduler loop: queue due tasks for the workers, then sleep.
  *
- * @details Performs the core heartbeat_thread routine for this module.
+ * @details On stop it queues a final run of every idle task when asked
+ * to drain, then lets the workers empty the queue and joins them.
  *
- * @param arg Input parameter for heartbeat_thread.
+ * @param arg Unused.
  *
- * @return Return value produced by heartbeat_thread.
+ * @return NULL.
  */
 static void *
 heartbeat_thread(void *arg)
 {
-	(void)arg;
+	pthread_t workers[HB_WORKERS];
+	int n;
 
-	for (;;) {
-		time_t now;
-		time_t wake_at = 0;
-		hb_task_batch_t todo;
-		int should_stop;
-		int drain;
-
-		hb_batch_reset(&todo);
-		pthread_mutex_lock(&g_hb_lock);
-		now = time(NULL);
-		hb_collect_due_tasks(now, &wake_at, &todo);
+	(void)arg;
 
-		should_stop = g_hb_stop_requested;
-		drain = g_hb_drain_on_stop;
-		if (todo.count == 0 && !should_stop) {
-			hb_wait_for_next_tick(now, wake_at);
-			pthread_mutex_unlock(&g_hb_lock);
-			continue;
-		}
-		pthread_mutex_unlock(&g_hb_lock);
+	pthread_mutex_lock(&g_hb_lock);
+	while (!g_hb_stop_requested) {
+		uint64_t now = hb_now_ms();
+		uint64_t wake_at = 0;
 
-		hb_batch_run(&todo);
-
-		if (should_stop) {
-			if (drain) {
-				hb_task_batch_t final_tasks;
-				hb_batch_reset(&final_tasks);
-				pthread_mutex_lock(&g_hb_lock);
-				now = time(NULL);
-				hb_collect_all_active(now, &final_tasks);
-				pthread_mutex_unlock(&g_hb_lock);
-				hb_batch_run(&final_tasks);
-			}
-			pthread_mutex_lock(&g_hb_lock);
-			hb_mark_stopped();
-			pthread_mutex_unlock(&g_hb_lock);
-			break;
-		}
+		hb_collect_due_tasks(now, &wake_at);
+		hb_wait_for_next_tick(now, wake_at);
 	}
+	if (g_hb_drain_on_stop)
+		hb_collect_all_active();
+	g_hb_workers_exit = 1;
+	pthread_cond_broadcast(&g_hb_work_cond);
+	n = g_hb_nworkers;
+	memcpy(workers, g_hb_workers, sizeof(workers));
+	pthread_mutex_unlock(&g_hb_lock);
+
+	for (int i = 0; i < n; i++)
+		(void)pthread_join(workers[i], NULL);
 
+	pthread_mutex_lock(&g_hb_lock);
+	hb_mark_stopped();
+	pthread_mutex_unlock(&g_hb_lock);
 	return NULL;
 }
@@ -1,44 +1,264 @@
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <stdint.h>
+#include <time.h>
+
 #include "heartbeat_internal.h"
 
+/*
+ * Due tasks wait here, by slot, for a worker. A slot is queued only
+ * while it is idle, so the ring never holds more than
+ * HB_MAX_TASKS entries and a task never runs on two workers at once.
+ */
+static int g_hb_queue[HB_MAX_TASKS];
+static int g_hb_qhead;
+static int g_hb_qlen;
+
+/*
+ * Kqueue mode: one-shot EVFILT_TIMER on the dispatcher's kqueue for the
+ * earliest deadline, and due tasks submitted to the server as items.
+ */
+int g_hb_kq = -1;
+static mw_heartbeat_submit_t g_hb_submit;
+static void *g_hb_submit_ctx;
+
 /**
- * @brief hb_batch_reset operation.
+ * @brief Hand slot @p i to the workers; called with the lock held.
  *
- * @details Performs the core hb_batch_reset routine for this module.
+ * @details In kqueue mode the slot goes to the server's submit hook; a
+ * refusal (full queue) skips this deadline and counts an overrun.
  *
- * @param batch Input parameter for hb_batch_reset.
+ * @param i Slot of a due task that is idle.
  */
 void
-hb_batch_reset(hb_task_batch_t *batch)
+hb_queue_slot(int i)
 {
-	batch->count = 0;
+	hb_slot_t *s = &g_hb_slots[i];
+
+	if (s->state != HB_IDLE)
+		return;
+	if (g_hb_kq >= 0) {
+		if (g_hb_submit(HB_ITEM(i), g_hb_submit_ctx) != 0) {
+			s->stats.overruns++;
+			return;
+		}
+	} else {
+		if (g_hb_qlen >= HB_MAX_TASKS)
+			return;
+		g_hb_queue[(g_hb_qhead + g_hb_qlen++) % HB_MAX_TASKS] = i;
+		pthread_cond_signal(&g_hb_work_cond);
+	}
+	s->state = HB_QUEUED;
+	s->stats.runs++;
+	s->stats.last_run = time(NULL);
+	s->stats.last_error = 0;
 }
 
 /**
- * @brief hb_batch_push operation.
+ * @brief Run queued slot @p i on the calling thread.
  *
- * @details Performs the core hb_batch_push routine for this module.
+ * @details Called and returns with the lock held, dropping it around the
+ * callback. Does nothing unless the slot is queued, so a stale item for
+ * a slot already run, reset or reused is ignored.
  *
- * @param batch Input parameter for hb_batch_push.
- * @param task Input parameter for hb_batch_push.
+ * @param i Slot to run.
  */
 void
-hb_batch_push(hb_task_batch_t *batch, const struct hb_task *task)
+hb_run_slot(int i)
 {
-	if (batch->count >= HB_MAX_TASKS)
+	hb_slot_t *s = &g_hb_slots[i];
+	struct hb_task task;
+	unsigned int gen;
+	uint64_t start;
+
+	if (!s->active || s->state != HB_QUEUED)
 		return;
-	batch->tasks[batch->count++] = *task;
+	task = s->task;
+	gen = s->gen;
+	s->state = HB_RUNNING;
+	s->runner = pthread_self();
+	pthread_mutex_unlock(&g_hb_lock);
+
+	start = hb_now_ms();
+	task.cb(task.ctx);
+
+	pthread_mutex_lock(&g_hb_lock);
+	/* Not if it was unregistered meanwhile, or the slot reused. */
+	if (s->gen == gen) {
+		hb_run_finished(s, hb_now_ms() - start);
+		s->state = HB_IDLE;
+	}
+	pthread_cond_broadcast(&g_hb_idle_cond);
+}
+
+/**
+ * @brief Worker loop: run queued tasks until told to exit.
+ *
+ * @details Exits only once the queue is empty, so tasks queued before a
+ * stop, the final drain run included, still run.
+ *
+ * @param arg Unused.
+ *
+ * @return NULL.
+ */
+void *
+hb_worker_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&g_hb_lock);
+	for (;;) {
+		int i;
+
+		while (g_hb_qlen == 0 && !g_hb_workers_exit)
+			pthread_cond_wait(&g_hb_work_cond, &g_hb_lock);
+		if (g_hb_qlen == 0)
+			break;
+		i = g_hb_queue[g_hb_qhead];
+		g_hb_qhead = (g_hb_qhead + 1) % HB_MAX_TASKS;
+		g_hb_qlen--;
+		hb_run_slot(i);
+	}
+	pthread_mutex_unlock(&g_hb_lock);
+	return NULL;
+}
+
+/** Arm the kqueue timer @p delay_ms out; called with the lock held. */
+static void
+hb_kqueue_arm(uint64_t delay_ms)
+{
+	struct kevent kev;
+
+	if (delay_ms == 0)
+		delay_ms = 1;
+	if (delay_ms > HB_IDLE_WAIT_MS)
+		delay_ms = HB_IDLE_WAIT_MS;
+	EV_SET(&kev, HEARTBEAT_TIMER_IDENT, EVFILT_TIMER, EV_ADD | EV_ONESHOT,
+	    0, (int64_t)delay_ms, NULL);
+	(void)kevent(g_hb_kq, &kev, 1, NULL, 0, NULL);
+}
+
+/**
+ * @brief Tell whichever mechanism schedules tasks that the table changed.
+ *
+ * @details Called with the lock held.
+ */
+void
+hb_wake(void)
+{
+	if (g_hb_kq >= 0)
+		hb_kqueue_arm(1);
+	else
+		pthread_cond_signal(&g_hb_cond);
 }
 
 /**
- * @brief hb_batch_run operation.
+ * @brief Schedule tasks from an event loop's kqueue instead of a thread.
+ *
+ * @details Stops the scheduler thread and its workers, if running, and
+ * arms an EVFILT_TIMER with ident HEARTBEAT_TIMER_IDENT on @p kq_fd. The
+ * loop polling @p kq_fd calls heartbeat_kqueue_tick() when it fires;
+ * due tasks are passed to @p submit, whose consumer hands each item back
+ * to heartbeat_run_item(). Whether tasks run is still governed by
+ * heartbeat_start() and heartbeat_shutdown().
  *
- * @details Performs the core hb_batch_run routine for this module.
+ * @param kq_fd Kqueue of the event loop.
+ * @param submit Queues an item for a worker; non-zero when it cannot.
+ * @param ctx Passed to @p submit.
  *
- * @param batch Input parameter for hb_batch_run.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int
+heartbeat_use_kqueue(int kq_fd, mw_heartbeat_submit_t submit, void *ctx)
+{
+	if (kq_fd < 0 || !submit)
+		return -1;
+
+	(void)heartbeat_init();
+	hb_stop_thread(0);
+	pthread_mutex_lock(&g_hb_lock);
+	g_hb_kq = kq_fd;
+	g_hb_submit = submit;
+	g_hb_submit_ctx = ctx;
+	hb_kqueue_arm(1);
+	pthread_mutex_unlock(&g_hb_lock);
+	return 0;
+}
+
+/**
+ * @brief Go back to the scheduler thread after heartbeat_use_kqueue().
+ *
+ * @details Call once the kqueue's loop and the submit consumers have
+ * stopped: tasks still queued there are forgotten, and become due again
+ * on the thread, which is restarted when heartbeat_start() was called.
+ *
+ * @return 0, or -1 when the thread could not be restarted.
+ */
+int
+heartbeat_use_thread(void)
+{
+	struct kevent kev;
+	int wanted;
+
+	(void)heartbeat_init();
+	pthread_mutex_lock(&g_hb_lock);
+	if (g_hb_kq < 0) {
+		pthread_mutex_unlock(&g_hb_lock);
+		return 0;
+	}
+	EV_SET(&kev, HEARTBEAT_TIMER_IDENT, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	(void)kevent(g_hb_kq, &kev, 1, NULL, 0, NULL);
+	g_hb_kq = -1;
+	g_hb_submit = NULL;
+	g_hb_submit_ctx = NULL;
+	for (int i = 0; i < HB_MAX_TASKS; i++) {
+		if (g_hb_slots[i].state == HB_QUEUED)
+			g_hb_slots[i].state = HB_IDLE;
+	}
+	pthread_cond_broadcast(&g_hb_idle_cond);
+	wanted = g_hb_wanted;
+	pthread_mutex_unlock(&g_hb_lock);
+	return wanted ? heartbeat_start() : 0;
+}
+
+/**
+ * @brief Handle the heartbeat's EVFILT_TIMER event: submit every due
+ * task and re-arm for the next deadline.
+ */
+void
+heartbeat_kqueue_tick(void)
+{
+	uint64_t now, wake_at = 0;
+
+	pthread_mutex_lock(&g_hb_lock);
+	if (g_hb_kq < 0) {
+		pthread_mutex_unlock(&g_hb_lock);
+		return;
+	}
+	now = hb_now_ms();
+	if (g_hb_wanted)
+		hb_collect_due_tasks(now, &wake_at);
+	if (wake_at == 0)
+		hb_kqueue_arm(HB_IDLE_WAIT_MS);
+	else
+		hb_kqueue_arm(wake_at > now ? wake_at - now : 1);
+	pthread_mutex_unlock(&g_hb_lock);
+}
+
+/**
+ * @brief Run a task item passed to the submit hook, on the calling thread.
+ *
+ * @param item Item from the submit hook.
  */
 void
-hb_batch_run(const hb_task_batch_t *batch)
+heartbeat_run_item(void *item)
 {
-	for (int i = 0; i < batch->count; i++)
-		batch->tasks[i].cb(batch->tasks[i].ctx);
+	uintptr_t n = (uintptr_t)item;
+
+	if (n == 0 || n > HB_MAX_TASKS)
+		return;
+	pthread_mutex_lock(&g_hb_lock);
+	hb_run_slot((int)n - 1);
+	pthread_mutex_unlock(&g_hb_lock);
 }
@@ -2,40 +2,72 @@
 #define MINIWEB_CORE_HEARTBEAT_INTERNAL_H
 
 #include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 
 #include <miniweb/core/heartbeat.h>
 
-#define HB_MAX_TASKS 32
-#define HB_IDLE_WAIT_SEC 3600
+#define HB_MAX_TASKS HEARTBEAT_MAX_TASKS
+#define HB_WORKERS 4
+#define HB_IDLE_WAIT_MS (3600 * 1000)
+#define HB_PHASE_MAX_MS 1000	/* spread of first runs with no delay */
+#define HB_JITTER_DIV 20	/* jitter up to period / HB_JITTER_DIV */
+#define HB_JITTER_MAX_MS 50
+#define HB_BACKOFF_MAX 3	/* period doubled at most this many times */
+#define HB_BACKOFF_AFTER 3	/* busy deadlines in a row before a doubling */
+#define HB_BACKOFF_RECOVER 5	/* quick runs in a row before a halving */
+
+/* Kqueue-mode item for slot @p i: 1..HB_MAX_TASKS, never NULL. */
+#define HB_ITEM(i) ((void *)(uintptr_t)((i) + 1))
+
+enum hb_slot_state {
+	HB_IDLE,
+	HB_QUEUED,		/* waiting for a worker */
+	HB_RUNNING,		/* in its callback on hb_slot_t.runner */
+};
 
 typedef struct {
 	struct hb_task task;
-	time_t next_run;
+	uint64_t period_ms;	/* as registered; stats hold the effective one */
+	uint64_t due;		/* phase-locked deadline, CLOCK_MONOTONIC ms */
+	uint64_t next_run;	/* due plus this run's jitter */
 	struct hb_task_stats stats;
+	uint32_t rng;		/* jitter state, seeded from the name */
+	unsigned int busy;	/* deadlines in a row that found it busy */
+	unsigned int calm;	/* runs in a row well within the period */
+	unsigned int gen;	/* bumped whenever the slot is cleared */
 	int active;
+	int state;		/* hb_slot_state; never queued twice */
+	pthread_t runner;	/* valid while HB_RUNNING */
 } hb_slot_t;
 
-typedef struct {
-	struct hb_task tasks[HB_MAX_TASKS];
-	int count;
-} hb_task_batch_t;
-
 extern hb_slot_t g_hb_slots[HB_MAX_TASKS];
 extern int g_hb_initialized;
 extern int g_hb_running;
 extern int g_hb_stop_requested;
 extern int g_hb_drain_on_stop;
+extern int g_hb_workers_exit;
+extern int g_hb_wanted;
+extern int g_hb_kq;
 extern pthread_t g_hb_thread;
+extern pthread_t g_hb_workers[HB_WORKERS];
+extern int g_hb_nworkers;
 extern pthread_mutex_t g_hb_lock;
 extern pthread_cond_t g_hb_cond;
+extern pthread_cond_t g_hb_work_cond;
+extern pthread_cond_t g_hb_idle_cond;
 
-void hb_batch_reset(hb_task_batch_t *batch);
-void hb_batch_push(hb_task_batch_t *batch, const struct hb_task *task);
-void hb_batch_run(const hb_task_batch_t *batch);
-void hb_collect_due_tasks(time_t now, time_t *wake_at, hb_task_batch_t *todo);
-void hb_collect_all_active(time_t now, hb_task_batch_t *todo);
+uint64_t hb_now_ms(void);
+void hb_schedule_first(hb_slot_t *s, uint64_t now, uint64_t initial_delay_ms);
+void hb_run_finished(hb_slot_t *s, uint64_t duration_ms);
+void hb_queue_slot(int i);
+void hb_run_slot(int i);
+void hb_wake(void);
+void hb_stop_thread(int drain);
+void *hb_worker_thread(void *arg);
+void hb_collect_due_tasks(uint64_t now, uint64_t *wake_at);
+void hb_collect_all_active(void);
 void hb_mark_stopped(void);
-void hb_wait_for_next_tick(time_t now, time_t wake_at);
+void hb_wait_for_next_tick(uint64_t now, uint64_t wake_at);
 
 #endif
@@ -4,63 +4,153 @@
 #include "heartbeat_internal.h"
 
 /**
- * @brief hb_collect_due_tasks operation.
+ * @brief Current CLOCK_MONOTONIC time in milliseconds.
  *
- * @details Performs the core hb_collect_due_tasks routine for this module.
+ * @return Milliseconds since an arbitrary fixed point.
+ */
+uint64_t
+hb_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/** xorshift32 step of @p s's jitter state. */
+static uint32_t
+hb_rand(hb_slot_t *s)
+{
+	uint32_t x = s->rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return s->rng = x;
+}
+
+/** Jitter to add to a deadline @p period_ms apart from the last. */
+static uint64_t
+hb_jitter_ms(hb_slot_t *s, uint64_t period_ms)
+{
+	uint64_t max = period_ms / HB_JITTER_DIV;
+
+	if (max > HB_JITTER_MAX_MS)
+		max = HB_JITTER_MAX_MS;
+	return max ? hb_rand(s) % max : 0;
+}
+
+/**
+ * @brief Set the first deadline of a task just registered or updated.
+ *
+ * @details With no delay asked for, the first run lands at a phase
+ * derived from the task name, within one period and at most
+ * HB_PHASE_MAX_MS away, so tasks registered together on the same
+ * period do not fire in one burst. Resets the backoff.
  *
- * @param now Input parameter for hb_collect_due_tasks.
- * @param wake_at Input parameter for hb_collect_due_tasks.
- * @param todo Input parameter for hb_collect_due_tasks.
+ * @param s Slot holding the task; called with the lock held.
+ * @param now Current monotonic time in milliseconds.
+ * @param initial_delay_ms Delay asked for.
  */
 void
-hb_collect_due_tasks(time_t now, time_t *wake_at, hb_task_batch_t *todo)
+hb_schedule_first(hb_slot_t *s, uint64_t now, uint64_t initial_delay_ms)
 {
-	for (int i = 0; i < HB_MAX_TASKS; i++) {
-		uint64_t missed;
-		time_t period;
-		time_t elapsed;
+	uint32_t h = 2166136261u;
 
-		if (!g_hb_slots[i].active)
-			continue;
-		if (*wake_at == 0 || g_hb_slots[i].next_run < *wake_at)
-			*wake_at = g_hb_slots[i].next_run;
-		if (now < g_hb_slots[i].next_run)
-			continue;
+	for (const char *p = s->task.name; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	s->rng = h ? h : 1;
+	if (initial_delay_ms == 0) {
+		uint64_t spread = s->period_ms < HB_PHASE_MAX_MS ?
+		    s->period_ms : HB_PHASE_MAX_MS;
 
-		period = (time_t)g_hb_slots[i].task.period_sec;
-		elapsed = now - g_hb_slots[i].next_run;
-		missed = 0;
-		if (period > 0 && elapsed > 0)
-			missed = (uint64_t)(elapsed / period);
-
-		hb_batch_push(todo, &g_hb_slots[i].task);
-		g_hb_slots[i].stats.runs++;
-		g_hb_slots[i].stats.overruns += missed;
-		g_hb_slots[i].stats.last_run = now;
-		g_hb_slots[i].stats.last_error = 0;
-		g_hb_slots[i].next_run +=
-			(time_t)((missed + 1U) * (uint64_t)g_hb_slots[i].task.period_sec);
+		initial_delay_ms = h % spread;
 	}
+	s->due = s->next_run = now + initial_delay_ms;
+	s->busy = s->calm = 0;
+	s->stats.backoff = 0;
+	s->stats.period_ms = s->period_ms;
 }
 
 /**
- * @brief hb_collect_all_active operation.
+ * @brief Account a completed run of @p s; called with the lock held.
  *
- * @details Performs the core hb_collect_all_active routine for this module.
+ * @details Runs that take under half the registered period undo one
+ * backoff doubling after HB_BACKOFF_RECOVER in a row.
  *
- * @param now Input parameter for hb_collect_all_active.
- * @param todo Input parameter for hb_collect_all_active.
+ * @param s Slot of the task.
+ * @param duration_ms How long the callback took.
  */
 void
-hb_collect_all_active(time_t now, hb_task_batch_t *todo)
+hb_run_finished(hb_slot_t *s, uint64_t duration_ms)
+{
+	s->stats.last_duration_ms = duration_ms;
+	if (duration_ms * 2 >= s->period_ms) {
+		s->calm = 0;
+		return;
+	}
+	if (++s->calm >= HB_BACKOFF_RECOVER && s->stats.backoff > 0) {
+		s->stats.backoff--;
+		s->stats.period_ms = s->period_ms << s->stats.backoff;
+		s->calm = 0;
+	}
+}
+
+/**
+ * @brief Queue every due task and find the next deadline.
+ *
+ * @details Deadlines advance by whole effective periods from where they
+ * were, so a task keeps its phase however late it runs, and each run is
+ * then pushed back by a small jitter that does not accumulate. Every
+ * period missed counts as an overrun, and so does a deadline that finds
+ * the task still queued or running: it is skipped rather than queued
+ * behind itself, and after HB_BACKOFF_AFTER of those in a row the
+ * effective period doubles, up to HB_BACKOFF_MAX times.
+ *
+ * @param now Current monotonic time in milliseconds.
+ * @param wake_at Receives the earliest deadline, or 0 with no tasks.
+ */
+void
+hb_collect_due_tasks(uint64_t now, uint64_t *wake_at)
 {
 	for (int i = 0; i < HB_MAX_TASKS; i++) {
-		if (!g_hb_slots[i].active)
+		hb_slot_t *s = &g_hb_slots[i];
+		uint64_t missed;
+
+		if (!s->active)
 			continue;
-		hb_batch_push(todo, &g_hb_slots[i].task);
-		g_hb_slots[i].stats.runs++;
-		g_hb_slots[i].stats.last_run = now;
-		g_hb_slots[i].stats.last_error = 0;
+		if (now >= s->next_run) {
+			missed = (now - s->due) / s->stats.period_ms;
+			s->stats.overruns += missed;
+			if (s->state == HB_IDLE) {
+				s->busy = 0;
+				hb_queue_slot(i);
+			} else {
+				s->stats.overruns++;
+				if (++s->busy >= HB_BACKOFF_AFTER &&
+				    s->stats.backoff < HB_BACKOFF_MAX) {
+					s->stats.backoff++;
+					s->busy = s->calm = 0;
+				}
+			}
+			s->due += (missed + 1) * s->stats.period_ms;
+			s->stats.period_ms = s->period_ms << s->stats.backoff;
+			s->next_run = s->due + hb_jitter_ms(s, s->stats.period_ms);
+		}
+		if (*wake_at == 0 || s->next_run < *wake_at)
+			*wake_at = s->next_run;
+	}
+}
+
+/**
+ * @brief Queue every idle active task, for a final drain.
+ */
+void
+hb_collect_all_active(void)
+{
+	for (int i = 0; i < HB_MAX_TASKS; i++) {
+		if (g_hb_slots[i].active)
+			hb_queue_slot(i);
 	}
 }
 
@@ -75,33 +165,29 @@ hb_mark_stopped(void)
 	g_hb_running = 0;
 	g_hb_stop_requested = 0;
 	g_hb_drain_on_stop = 0;
+	g_hb_workers_exit = 0;
+	g_hb_nworkers = 0;
 }
 
 /**
- * @brief hb_wait_for_next_tick operation.
- *
- * @details Performs the core hb_wait_for_next_tick routine for this module.
+ * @brief Sleep until @p wake_at or a change to the task table.
  *
- * @param now Input parameter for hb_wait_for_next_tick.
- * @param wake_at Input parameter for hb_wait_for_next_tick.
+ * @param now Current monotonic time in milliseconds.
+ * @param wake_at Next deadline, or 0 with no tasks.
  */
 void
-hb_wait_for_next_tick(time_t now, time_t wake_at)
+hb_wait_for_next_tick(uint64_t now, uint64_t wake_at)
 {
 	struct timespec ts;
-	struct timespec now_mono;
-
-	clock_gettime(CLOCK_MONOTONIC, &now_mono);
-	if (wake_at != 0 && wake_at > now) {
-		time_t delta = wake_at - now;
-		ts.tv_sec = now_mono.tv_sec + delta;
-		ts.tv_nsec = now_mono.tv_nsec;
-	} else if (wake_at == 0) {
-		ts.tv_sec = now_mono.tv_sec + HB_IDLE_WAIT_SEC;
-		ts.tv_nsec = now_mono.tv_nsec;
-	} else {
-		ts.tv_sec = now_mono.tv_sec;
-		ts.tv_nsec = now_mono.tv_nsec;
-	}
+	uint64_t until;
+
+	if (wake_at == 0)
+		until = now + HB_IDLE_WAIT_MS;
+	else if (wake_at > now)
+		until = wake_at;
+	else
+		until = now;
+	ts.tv_sec = (time_t)(until / 1000);
+	ts.tv_nsec = (long)(until % 1000) * 1000000;
 	(void)pthread_cond_timedwait(&g_hb_cond, &g_hb_lock, &ts);
 }
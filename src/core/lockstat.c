@@ -0,0 +1,236 @@
+/* lockstat.c - contention statistics for named mutexes */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <miniweb/core/lockstat.h>
+
+/*
+ * A site is shared by every thread taking its lock, and a family site
+ * by every lock of the family, so its sums are atomic adds. The grant
+ * time needed for the hold is kept per thread instead, on a short stack
+ * of the locks the thread holds: locks nest, but never deeply. A lock
+ * taken past the stack's depth is still counted, without its hold.
+ */
+
+#define LOCKSTAT_DEPTH	8
+
+struct lockstat_held {
+	int n;
+	struct {
+		const pthread_mutex_t *m;
+		uint64_t since;
+	} e[LOCKSTAT_DEPTH];
+};
+
+static pthread_mutex_t lockstat_registry = PTHREAD_MUTEX_INITIALIZER;
+static lockstat_t *lockstat_sites;
+static lockstat_t **lockstat_tail = &lockstat_sites;
+
+static pthread_key_t lockstat_key;
+static pthread_once_t lockstat_once = PTHREAD_ONCE_INIT;
+static int lockstat_key_ok;
+
+static void
+lockstat_key_init(void)
+{
+	lockstat_key_ok = pthread_key_create(&lockstat_key, free) == 0;
+}
+
+static uint64_t
+lockstat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/** Calling thread's held-lock stack, created on first use. */
+static struct lockstat_held *
+lockstat_held(void)
+{
+	struct lockstat_held *h;
+
+	(void)pthread_once(&lockstat_once, lockstat_key_init);
+	if (!lockstat_key_ok)
+		return NULL;
+	if ((h = pthread_getspecific(lockstat_key)) != NULL)
+		return h;
+	if ((h = calloc(1, sizeof(*h))) == NULL)
+		return NULL;
+	if (pthread_setspecific(lockstat_key, h) != 0) {
+		free(h);
+		return NULL;
+	}
+	return h;
+}
+
+/** Raise *@p max to @p v. */
+static void
+lockstat_max(uint64_t *max, uint64_t v)
+{
+	uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+	while (v > cur && !__atomic_compare_exchange_n(max, &cur, v, 0,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/** Put @p s on the registry list the first time it is taken. */
+static void
+lockstat_link(lockstat_t *s)
+{
+	if (__atomic_load_n(&s->linked, __ATOMIC_ACQUIRE))
+		return;
+	pthread_mutex_lock(&lockstat_registry);
+	if (!s->linked) {
+		*lockstat_tail = s;
+		lockstat_tail = &s->next;
+		__atomic_store_n(&s->linked, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lockstat_registry);
+}
+
+/** Start the hold of @p m, now granted to the calling thread. */
+static void
+lockstat_hold_begin(const pthread_mutex_t *m)
+{
+	struct lockstat_held *h = lockstat_held();
+
+	if (h == NULL || h->n == LOCKSTAT_DEPTH)
+		return;
+	h->e[h->n].m = m;
+	h->e[h->n].since = lockstat_now();
+	h->n++;
+}
+
+/** End the hold of @p m and charge it to @p s. */
+static void
+lockstat_hold_end(const pthread_mutex_t *m, lockstat_t *s)
+{
+	struct lockstat_held *h = lockstat_held();
+	uint64_t held;
+	int i;
+
+	if (h == NULL)
+		return;
+	for (i = h->n - 1; i >= 0 && h->e[i].m != m; i--)
+		;
+	if (i < 0)
+		return;
+	held = lockstat_now() - h->e[i].since;
+	for (h->n--; i < h->n; i++)
+		h->e[i] = h->e[i + 1];
+	__atomic_add_fetch(&s->hold_ns, held, __ATOMIC_RELAXED);
+	lockstat_max(&s->hold_max_ns, held);
+}
+
+/** Count a grant of @p m that waited @p waited ns (0: uncontended). */
+static void
+lockstat_granted(const pthread_mutex_t *m, lockstat_t *s, int contended,
+    uint64_t waited)
+{
+	lockstat_link(s);
+	__atomic_add_fetch(&s->acquired, 1, __ATOMIC_RELAXED);
+	if (contended) {
+		__atomic_add_fetch(&s->contended, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&s->wait_ns, waited, __ATOMIC_RELAXED);
+		lockstat_max(&s->wait_max_ns, waited);
+	}
+	lockstat_hold_begin(m);
+}
+
+/** pthread_mutex_lock(3), trying first and timing the wait if busy. */
+int
+lockstat_lock(pthread_mutex_t *m, lockstat_t *s)
+{
+	uint64_t start;
+	int rc;
+
+	if (pthread_mutex_trylock(m) == 0) {
+		lockstat_granted(m, s, 0, 0);
+		return 0;
+	}
+	start = lockstat_now();
+	if ((rc = pthread_mutex_lock(m)) != 0)
+		return rc;
+	lockstat_granted(m, s, 1, lockstat_now() - start);
+	return 0;
+}
+
+/** pthread_mutex_trylock(3); a busy lock counts as contended. */
+int
+lockstat_trylock(pthread_mutex_t *m, lockstat_t *s)
+{
+	int rc;
+
+	if ((rc = pthread_mutex_trylock(m)) == 0) {
+		lockstat_granted(m, s, 0, 0);
+		return 0;
+	}
+	lockstat_link(s);
+	__atomic_add_fetch(&s->contended, 1, __ATOMIC_RELAXED);
+	return rc;
+}
+
+int
+lockstat_unlock(pthread_mutex_t *m, lockstat_t *s)
+{
+	lockstat_hold_end(m, s);
+	return pthread_mutex_unlock(m);
+}
+
+int
+lockstat_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, lockstat_t *s)
+{
+	int rc;
+
+	lockstat_hold_end(m, s);
+	rc = pthread_cond_wait(c, m);
+	lockstat_hold_begin(m);
+	return rc;
+}
+
+int
+lockstat_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m,
+    lockstat_t *s, const struct timespec *abstime)
+{
+	int rc;
+
+	lockstat_hold_end(m, s);
+	rc = pthread_cond_timedwait(c, m, abstime);
+	lockstat_hold_begin(m);
+	return rc;
+}
+
+static uint64_t
+lockstat_load(const uint64_t *v)
+{
+	return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+/** Sites are read with atomic loads; each sum is exact, not the set. */
+int
+lockstat_foreach(void (*fn)(const lockstat_t *s, void *ctx), void *ctx)
+{
+	lockstat_t *s, copy;
+	int n = 0;
+
+	pthread_mutex_lock(&lockstat_registry);
+	for (s = lockstat_sites; s != NULL; s = s->next, n++) {
+		copy.name = s->name;
+		copy.acquired = lockstat_load(&s->acquired);
+		copy.contended = lockstat_load(&s->contended);
+		copy.wait_ns = lockstat_load(&s->wait_ns);
+		copy.wait_max_ns = lockstat_load(&s->wait_max_ns);
+		copy.hold_ns = lockstat_load(&s->hold_ns);
+		copy.hold_max_ns = lockstat_load(&s->hold_max_ns);
+		copy.linked = 1;
+		copy.next = NULL;
+		fn(&copy, ctx);
+	}
+	pthread_mutex_unlock(&lockstat_registry);
+	return n;
+}
@@ -3,36 +3,328 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <pthread.h>
 
+#include <miniweb/core/lockstat.h>
 #include <miniweb/core/log.h>
 
+/*
+ * Every thread formats its lines into a ring of its own, reached through
+ * a pthread key, that only it writes; a writer thread started by
+ * log_init() copies the rings into one buffer and writes it out in a
+ * single call. A thread that finds its ring full drops the line and
+ * counts it instead of waiting. Before log_init(), after log_close() and
+ * in forked children, lines are written directly under log_mutex.
+ */
+
+#define LOG_RING_SIZE   (64 * 1024)     /* per thread, power of two */
+#define LOG_LINE_MAX    2048            /* longer lines are truncated */
+#define LOG_BATCH_SIZE  (2 * LOG_RING_SIZE)
+#define LOG_IDLE_MS     50              /* writer poll when idle */
+
+typedef struct log_ring {
+    uint32_t         head;              /* written by the owner */
+    uint32_t         tail;              /* written by the writer */
+    int              dead;              /* owner exited */
+    time_t           ts_sec;            /* owner's cached timestamp */
+    char             ts[32];
+    struct log_ring *next;
+    char             data[LOG_RING_SIZE];
+} log_ring_t;
+
 static FILE            *log_fp      = NULL;
 static int              log_verbose = 0;
 static pthread_mutex_t  log_mutex   = PTHREAD_MUTEX_INITIALIZER;
+LOCKSTAT_SITE(lockstat_log, "log");
+static time_t           log_ts_sec  = -1;   /* under log_mutex */
+static char             log_ts[32];
+
+static pthread_key_t    log_key;
+static pthread_once_t   log_once    = PTHREAD_ONCE_INIT;
+static int              log_key_ok;
+
+static pthread_mutex_t  log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+LOCKSTAT_SITE(lockstat_rings, "log_rings");
+static log_ring_t      *log_rings;
+static int              log_async;          /* writer is running */
+static int              log_writer_on;      /* under log_rings_lock */
+static pthread_t        log_writer;
+static pthread_mutex_t  log_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   log_wake    = PTHREAD_COND_INITIALIZER;
+static int              log_stop;           /* under log_wake_lock */
+static uint64_t         log_dropped_lines;
 
 /**
- * @brief Write an ISO-8601 timestamp into @p buf.
+ * @brief Write an ISO-8601 timestamp for @p now into @p buf.
+ * @param now Time to format.
  * @param buf Destination buffer.
  * @param len Capacity of @p buf in bytes.
  */
 static void
-log_timestamp(char *buf, size_t len)
+log_timestamp(time_t now, char *buf, size_t len)
 {
-    time_t     now = time(NULL);
     struct tm  tm;
 
     localtime_r(&now, &tm);
     strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
 }
 
+/**
+ * @brief Format one line, newline included, into @p buf.
+ * @return Line length; at most LOG_LINE_MAX.
+ */
+static size_t
+log_format(char buf[LOG_LINE_MAX], const char *ts, const char *level,
+           const char *fmt, va_list ap)
+{
+    int n, m;
+
+    n = snprintf(buf, LOG_LINE_MAX, "[%s] [%s] ", ts, level);
+    if (n < 0)
+        n = 0;
+    if (n < LOG_LINE_MAX - 1) {
+        /* The terminating NUL lands where the newline goes. */
+        m = vsnprintf(buf + n, (size_t)(LOG_LINE_MAX - n), fmt, ap);
+        if (m > 0)
+            n += m;
+    }
+    if (n > LOG_LINE_MAX - 1)
+        n = LOG_LINE_MAX - 1;
+    buf[n++] = '\n';
+    return (size_t)n;
+}
+
+/** @brief Write @p len bytes to the log destination. */
+static void
+log_output(const char *buf, size_t len)
+{
+    FILE *fp;
+
+    LOCKSTAT_LOCK(&log_mutex, lockstat_log);
+    fp = (log_fp != NULL) ? log_fp : stderr;
+    fwrite(buf, 1, len, fp);
+    fflush(fp);
+    LOCKSTAT_UNLOCK(&log_mutex, lockstat_log);
+}
+
+/** @brief pthread_key destructor: hand a departing thread's ring over. */
+static void
+log_ring_free(void *p)
+{
+    log_ring_t  *r = p;
+    log_ring_t **pp;
+
+    LOCKSTAT_LOCK(&log_rings_lock, lockstat_rings);
+    if (log_writer_on) {
+        /* The writer frees it once drained. */
+        __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+        LOCKSTAT_UNLOCK(&log_rings_lock, lockstat_rings);
+        return;
+    }
+    for (pp = &log_rings; *pp; pp = &(*pp)->next) {
+        if (*pp == r) {
+            *pp = r->next;
+            break;
+        }
+    }
+    LOCKSTAT_UNLOCK(&log_rings_lock, lockstat_rings);
+    free(r);
+}
+
+/** @brief Forked children have no writer: log directly. */
+static void
+log_atfork_child(void)
+{
+    __atomic_store_n(&log_async, 0, __ATOMIC_RELAXED);
+    log_writer_on = 0;
+    pthread_mutex_init(&log_mutex, NULL);
+    pthread_mutex_init(&log_rings_lock, NULL);
+}
+
+static void
+log_key_init(void)
+{
+    log_key_ok = pthread_key_create(&log_key, log_ring_free) == 0;
+    (void)pthread_atfork(NULL, NULL, log_atfork_child);
+}
+
+/** @brief Calling thread's ring, created on first use; NULL if unavailable. */
+static log_ring_t *
+log_thread_ring(void)
+{
+    log_ring_t *r;
+
+    if (!log_key_ok)
+        return NULL;
+    r = pthread_getspecific(log_key);
+    if (r != NULL)
+        return r;
+    if ((r = calloc(1, sizeof(*r))) == NULL)
+        return NULL;
+    r->ts_sec = -1;
+    if (pthread_setspecific(log_key, r) != 0) {
+        free(r);
+        return NULL;
+    }
+    LOCKSTAT_LOCK(&log_rings_lock, lockstat_rings);
+    r->next = log_rings;
+    log_rings = r;
+    LOCKSTAT_UNLOCK(&log_rings_lock, lockstat_rings);
+    return r;
+}
+
+/**
+ * @brief Queue one line on the calling thread's ring.
+ * @return 0 when queued or dropped, -1 when it must be written directly.
+ */
+static int
+log_enqueue(const char *level, const char *fmt, va_list ap)
+{
+    char        line[LOG_LINE_MAX];
+    log_ring_t *r;
+    time_t      now;
+    uint32_t    head, used, off, first;
+    size_t      len;
+
+    if ((r = log_thread_ring()) == NULL)
+        return -1;
+    now = time(NULL);
+    if (now != r->ts_sec) {
+        log_timestamp(now, r->ts, sizeof(r->ts));
+        r->ts_sec = now;
+    }
+    len = log_format(line, r->ts, level, fmt, ap);
+
+    head = r->head;
+    used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (LOG_RING_SIZE - used < len) {
+        __atomic_add_fetch(&log_dropped_lines, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    off = head & (LOG_RING_SIZE - 1);
+    first = LOG_RING_SIZE - off;
+    if (first > len)
+        first = (uint32_t)len;
+    memcpy(r->data + off, line, first);
+    memcpy(r->data, line + first, len - first);
+    __atomic_store_n(&r->head, head + (uint32_t)len, __ATOMIC_RELEASE);
+
+    /* Wake the writer early rather than let a busy ring fill up. */
+    if (used + len > LOG_RING_SIZE / 2)
+        pthread_cond_signal(&log_wake);
+    return 0;
+}
+
+/**
+ * @brief Copy every ring into @p batch and write it out.
+ * @param batch   LOG_BATCH_SIZE bytes.
+ * @param dropped Drops already reported; updated.
+ * @return Number of bytes written.
+ */
+static size_t
+log_drain(char *batch, uint64_t *dropped)
+{
+    log_ring_t **pp, *r;
+    uint32_t     head, tail, avail, off, first;
+    uint64_t     d;
+    size_t       n = 0, total = 0;
+    int          dead;
+    char         ts[32];
+
+    LOCKSTAT_LOCK(&log_rings_lock, lockstat_rings);
+    pp = &log_rings;
+    while ((r = *pp) != NULL) {
+        /* Load dead first: a dead owner's last line is then visible. */
+        dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        tail = r->tail;
+        avail = head - tail;
+        if (avail > LOG_BATCH_SIZE - n) {
+            log_output(batch, n);
+            total += n;
+            n = 0;
+        }
+        off = tail & (LOG_RING_SIZE - 1);
+        first = LOG_RING_SIZE - off;
+        if (first > avail)
+            first = avail;
+        memcpy(batch + n, r->data + off, first);
+        memcpy(batch + n + first, r->data, avail - first);
+        n += avail;
+        __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+        if (dead) {
+            *pp = r->next;
+            free(r);
+        } else {
+            pp = &r->next;
+        }
+    }
+    LOCKSTAT_UNLOCK(&log_rings_lock, lockstat_rings);
+
+    d = __atomic_load_n(&log_dropped_lines, __ATOMIC_RELAXED);
+    if (d != *dropped && LOG_BATCH_SIZE - n >= 128) {
+        log_timestamp(time(NULL), ts, sizeof(ts));
+        n += (size_t)snprintf(batch + n, 128,
+                              "[%s] [ERROR] log: %llu line(s) dropped\n",
+                              ts, (unsigned long long)(d - *dropped));
+        *dropped = d;
+    }
+    if (n > 0) {
+        log_output(batch, n);
+        total += n;
+    }
+    return total;
+}
+
+/** @brief Writer thread: drain the rings until log_close(). */
+static void *
+log_writer_main(void *arg)
+{
+    struct timespec deadline;
+    uint64_t        dropped = 0;
+    char           *batch = arg;
+    int             stop;
+
+    for (;;) {
+        pthread_mutex_lock(&log_wake_lock);
+        stop = log_stop;
+        pthread_mutex_unlock(&log_wake_lock);
+        if (log_drain(batch, &dropped) > 0 && !stop)
+            continue;
+        if (stop)
+            break;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_IDLE_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&log_wake_lock);
+        if (!log_stop)
+            (void)pthread_cond_timedwait(&log_wake, &log_wake_lock,
+                                         &deadline);
+        pthread_mutex_unlock(&log_wake_lock);
+    }
+
+    /* From here exiting threads free their own rings; drain the rest. */
+    LOCKSTAT_LOCK(&log_rings_lock, lockstat_rings);
+    log_writer_on = 0;
+    LOCKSTAT_UNLOCK(&log_rings_lock, lockstat_rings);
+    while (log_drain(batch, &dropped) > 0)
+        ;
+    free(batch);
+    return NULL;
+}
+
 /**
  * @brief Open the log destination and configure verbosity.
  *
- * When @p path is NULL or empty, log output goes to stderr.
+ * When @p path is NULL or empty, log output goes to stderr. Lines are
+ * written by a background thread from here until log_close().
  *
  * @param path    Log file path, or NULL/empty for stderr.
  * @param verbose Non-zero to enable debug-level messages.
@@ -41,6 +333,8 @@ log_timestamp(char *buf, size_t len)
 int
 log_init(const char *path, int verbose)
 {
+    char *batch;
+
     log_verbose = verbose;
 
     if (path != NULL && path[0] != '\0') {
@@ -54,23 +348,43 @@ log_init(const char *path, int verbose)
         log_fp = stderr;
     }
 
+    (void)pthread_once(&log_once, log_key_init);
+    if (!log_key_ok || __atomic_load_n(&log_async, __ATOMIC_ACQUIRE))
+        return 0;
+    if ((batch = malloc(LOG_BATCH_SIZE)) == NULL)
+        return 0;
+    log_stop = 0;
+    log_writer_on = 1;
+    if (pthread_create(&log_writer, NULL, log_writer_main, batch) != 0) {
+        /* Keep writing directly. */
+        log_writer_on = 0;
+        free(batch);
+        return 0;
+    }
+    __atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
     return 0;
 }
 
 /**
- * @brief log_close operation.
- *
- * @details Performs the core log_close routine for this module.
+ * @brief Drain queued lines, stop the writer and close the log file.
  */
 void
 log_close(void)
 {
-    pthread_mutex_lock(&log_mutex);
+    if (__atomic_exchange_n(&log_async, 0, __ATOMIC_ACQ_REL)) {
+        pthread_mutex_lock(&log_wake_lock);
+        log_stop = 1;
+        pthread_cond_signal(&log_wake);
+        pthread_mutex_unlock(&log_wake_lock);
+        pthread_join(log_writer, NULL);
+    }
+
+    LOCKSTAT_LOCK(&log_mutex, lockstat_log);
     if (log_fp != NULL && log_fp != stderr) {
         fclose(log_fp);
     }
     log_fp = NULL;
-    pthread_mutex_unlock(&log_mutex);
+    LOCKSTAT_UNLOCK(&log_mutex, lockstat_log);
 }
 
 /**
@@ -83,6 +397,15 @@ log_set_verbose(int verbose)
     log_verbose = verbose;
 }
 
+/**
+ * @brief Number of lines dropped because a thread's ring was full.
+ */
+uint64_t
+log_dropped(void)
+{
+    return __atomic_load_n(&log_dropped_lines, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Format and emit one log line with the given severity label.
  * @param level Severity label string (e.g., "INFO", "ERROR").
@@ -92,18 +415,32 @@ log_set_verbose(int verbose)
 static void
 log_write(const char *level, const char *fmt, va_list ap)
 {
-    char ts[32];
-    FILE *fp;
+    char    line[LOG_LINE_MAX];
+    time_t  now;
+    size_t  len;
+    FILE   *fp;
+    va_list cp;
 
-    log_timestamp(ts, sizeof(ts));
+    if (__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+        va_copy(cp, ap);
+        if (log_enqueue(level, fmt, cp) == 0) {
+            va_end(cp);
+            return;
+        }
+        va_end(cp);
+    }
 
-    pthread_mutex_lock(&log_mutex);
+    now = time(NULL);
+    LOCKSTAT_LOCK(&log_mutex, lockstat_log);
+    if (now != log_ts_sec) {
+        log_timestamp(now, log_ts, sizeof(log_ts));
+        log_ts_sec = now;
+    }
+    len = log_format(line, log_ts, level, fmt, ap);
     fp = (log_fp != NULL) ? log_fp : stderr;
-    fprintf(fp, "[%s] [%s] ", ts, level);
-    vfprintf(fp, fmt, ap);
-    fputc('\n', fp);
+    fwrite(line, 1, len, fp);
     fflush(fp);
-    pthread_mutex_unlock(&log_mutex);
+    LOCKSTAT_UNLOCK(&log_mutex, lockstat_log);
 }
 
 /**
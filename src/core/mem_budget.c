@@ -0,0 +1,230 @@
+/* mem_budget.c - process-wide memory budget across caches */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+
+/*
+ * Caches size themselves against their own limits; the budget bounds
+ * their sum. Once a second every consumer is measured, and when the
+ * total is over budget the consumers that earn the fewest hits per byte
+ * held are shrunk first, down to MEM_BUDGET_LOW_WATER percent, so a cold
+ * cache gives memory back before a hot one loses entries.
+ */
+
+#define MEM_BUDGET_LOW_WATER	90	/* percent of the budget */
+
+typedef struct {
+	struct mem_cache_ops ops;
+	struct mem_cache_stats st;	/* under mem_lock */
+	uint64_t last_hits;		/* under mem_check_lock */
+	double heat;			/* hits per check, decaying */
+} mem_slot_t;
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_slot_t mem_slots[MEM_BUDGET_MAX_CACHES];
+static int mem_count;
+static size_t mem_used;			/* under mem_lock */
+static size_t mem_budget;
+/* One check at a time; consumers' callbacks run under it. */
+static pthread_mutex_t mem_check_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Add a memory consumer.
+ * @param ops Callbacks and context; copied.
+ * @return 0 on success, -1 when MEM_BUDGET_MAX_CACHES are registered.
+ */
+int
+mem_budget_register(const struct mem_cache_ops *ops)
+{
+	int rc = -1;
+
+	if (ops == NULL || ops->usage == NULL)
+		return -1;
+	pthread_mutex_lock(&mem_lock);
+	if (mem_count < MEM_BUDGET_MAX_CACHES) {
+		memset(&mem_slots[mem_count], 0, sizeof(mem_slots[0]));
+		mem_slots[mem_count].ops = *ops;
+		mem_count++;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&mem_lock);
+	if (rc != 0)
+		log_error("[MEM] no room to track %s", ops->name);
+	return rc;
+}
+
+/** usage() of a fixed consumer: the size it registered with. */
+static size_t
+mem_fixed_usage(uint64_t *hits, void *ctx)
+{
+	(void)hits;
+	return (size_t)(uintptr_t)ctx;
+}
+
+/**
+ * @brief Add a fixed allocation, such as a sample ring.
+ * @param name Reported name.
+ * @param bytes Bytes it holds for the life of the process.
+ * @return As mem_budget_register().
+ */
+int
+mem_budget_register_fixed(const char *name, size_t bytes)
+{
+	return mem_budget_register(&(struct mem_cache_ops){
+		.name = name,
+		.usage = mem_fixed_usage,
+		.ctx = (void *)(uintptr_t)bytes,
+	});
+}
+
+/**
+ * @brief Set the total bytes caches may hold.
+ * @param bytes Budget; 0 measures without shrinking.
+ */
+void
+mem_budget_set(size_t bytes)
+{
+	__atomic_store_n(&mem_budget, bytes, __ATOMIC_RELAXED);
+}
+
+/** Hits per byte: what keeping @p s costs for what it earns. */
+static double
+mem_slot_density(const mem_slot_t *s, size_t bytes)
+{
+	return s->heat / ((double)bytes / (1024 * 1024) + 1);
+}
+
+/**
+ * @brief Measure every consumer and shrink the coldest over budget.
+ * @return Bytes in use after shrinking.
+ */
+size_t
+mem_budget_check(void)
+{
+	size_t bytes[MEM_BUDGET_MAX_CACHES];
+	uint64_t hits[MEM_BUDGET_MAX_CACHES];
+	size_t shrunk[MEM_BUDGET_MAX_CACHES];
+	int order[MEM_BUDGET_MAX_CACHES];
+	size_t budget, total = 0, before, goal, need, freed;
+	int n, nord = 0, asked = 0;
+
+	pthread_mutex_lock(&mem_check_lock);
+	pthread_mutex_lock(&mem_lock);
+	n = mem_count;
+	pthread_mutex_unlock(&mem_lock);
+
+	for (int i = 0; i < n; i++) {
+		mem_slot_t *s = &mem_slots[i];
+
+		hits[i] = 0;
+		bytes[i] = s->ops.usage(&hits[i], s->ops.ctx);
+		s->heat = s->heat / 2 + (double)(hits[i] - s->last_hits);
+		s->last_hits = hits[i];
+		shrunk[i] = 0;
+		total += bytes[i];
+	}
+
+	budget = __atomic_load_n(&mem_budget, __ATOMIC_RELAXED);
+	if (budget > 0 && total > budget) {
+		before = total;
+		goal = budget / 100 * MEM_BUDGET_LOW_WATER;
+		need = total - goal;
+		/* Coldest first: insertion sort by density. */
+		for (int i = 0; i < n; i++) {
+			int j;
+
+			if (mem_slots[i].ops.shrink == NULL || bytes[i] == 0)
+				continue;
+			for (j = nord; j > 0 && mem_slot_density(
+			    &mem_slots[order[j - 1]], bytes[order[j - 1]]) >
+			    mem_slot_density(&mem_slots[i], bytes[i]); j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+			nord++;
+		}
+		for (int k = 0; k < nord && need > 0; k++) {
+			mem_slot_t *s = &mem_slots[order[k]];
+
+			asked++;
+			freed = s->ops.shrink(need, s->ops.ctx);
+			if (freed > bytes[order[k]])
+				freed = bytes[order[k]];
+			bytes[order[k]] -= freed;
+			shrunk[order[k]] = freed;
+			total -= freed;
+			need = freed < need ? need - freed : 0;
+		}
+		log_debug("[MEM] %zu bytes over a budget of %zu: shrunk to %zu",
+		    before, budget, total);
+	}
+
+	pthread_mutex_lock(&mem_lock);
+	for (int i = 0; i < n; i++) {
+		mem_slots[i].st.bytes = bytes[i];
+		mem_slots[i].st.hits = hits[i];
+		mem_slots[i].st.shrunk += shrunk[i];
+	}
+	for (int k = 0; k < asked; k++)
+		mem_slots[order[k]].st.shrinks++;
+	mem_used = total;
+	pthread_mutex_unlock(&mem_lock);
+	pthread_mutex_unlock(&mem_check_lock);
+	return total;
+}
+
+/** Heartbeat task body. */
+static void
+mem_budget_tick(void *ctx)
+{
+	(void)ctx;
+	(void)mem_budget_check();
+}
+
+/**
+ * @brief Schedule the check every second.
+ * @return 0 on success, -1 when the heartbeat cannot take the task.
+ */
+int
+mem_budget_start(void)
+{
+	if (heartbeat_register(&(struct hb_task){
+		.name = "memory.budget",
+		.period_sec = 1,
+		.initial_delay_sec = 1,
+		.cb = mem_budget_tick,
+		.ctx = NULL,
+	    }) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/**
+ * @brief Report every consumer as of the last check.
+ * @param fn Called once per consumer, under the registry lock.
+ * @param ctx Passed to @p fn.
+ * @param budget Receives the budget; may be NULL.
+ * @param used Receives the bytes in use; may be NULL.
+ * @return Number of consumers.
+ */
+int
+mem_budget_foreach(void (*fn)(const char *name,
+    const struct mem_cache_stats *stats, void *ctx), void *ctx,
+    size_t *budget, size_t *used)
+{
+	int n;
+
+	pthread_mutex_lock(&mem_lock);
+	n = mem_count;
+	for (int i = 0; i < n; i++)
+		fn(mem_slots[i].ops.name, &mem_slots[i].st, ctx);
+	if (budget)
+		*budget = __atomic_load_n(&mem_budget, __ATOMIC_RELAXED);
+	if (used)
+		*used = mem_used;
+	pthread_mutex_unlock(&mem_lock);
+	return n;
+}
@@ -0,0 +1,361 @@
+/* profile.c - in-process SIGPROF sampling profiler */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/profile.h>
+
+/*
+ * The handler takes no lock and allocates nothing: it claims a slot by
+ * bumping profile_head and writes the stack there, with the slot's
+ * sequence number odd while it does, as the trace rings do; a reader
+ * keeps a copy only when the number was even and unchanged around it.
+ * The ring is allocated the first time profiling starts and stays until
+ * cleanup, since a signal may still be in flight after the timer stops.
+ *
+ * backtrace(3) is called once before the handler is installed, so the
+ * unwinder has loaded and set itself up by the time a signal needs it.
+ * Its first PROFILE_SKIP frames are the handler and the signal
+ * trampoline.
+ *
+ * backtrace(3) is not async-signal-safe, and this is a known limitation
+ * of a profiler only an admin turns on. The unwinder finds its tables
+ * through dl_iterate_phdr(3), which takes the dynamic linker's lock: a
+ * signal that lands while the interrupted thread holds that lock, in
+ * dladdr(3), dlopen(3) or a lazy symbol binding, deadlocks the thread.
+ * The server is linked with -z now and -fno-plt, so nothing is bound
+ * lazily; it does not dlopen() once serving, and profile_folded() keeps
+ * SIGPROF blocked around its dladdr() calls. What is left is a library
+ * taking the lock on its own, and that risk is why the profiler is off
+ * by default. Walking frame pointers by hand would avoid the unwinder,
+ * but most of libc is built without them.
+ */
+
+#define PROFILE_SKIP	2
+#define PROFILE_NAME_MAX 128
+
+typedef struct {
+	unsigned int seq;	/* odd while written; 0 never written */
+	unsigned int depth;
+	void *pc[PROFILE_DEPTH];
+} profile_sample_t;
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static profile_sample_t *profile_ring;
+static unsigned long profile_head;	/* samples claimed since cleared */
+static int profile_rate;
+static int profile_installed;		/* profile_lock */
+
+/** SIGPROF: file the interrupted thread's stack into the next slot. */
+static void
+profile_signal(int sig)
+{
+	void *pc[PROFILE_DEPTH + PROFILE_SKIP];
+	profile_sample_t *s, *ring;
+	unsigned long i;
+	int saved = errno, n;
+
+	(void)sig;
+	ring = __atomic_load_n(&profile_ring, __ATOMIC_ACQUIRE);
+	if (ring == NULL || !__atomic_load_n(&profile_rate, __ATOMIC_RELAXED))
+		return;
+	n = backtrace(pc, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+	if (n <= 0) {
+		errno = saved;
+		return;
+	}
+	i = __atomic_fetch_add(&profile_head, 1, __ATOMIC_RELAXED);
+	s = &ring[i % PROFILE_SAMPLES];
+	__atomic_store_n(&s->seq, (unsigned int)(2 * i + 1), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->depth = (unsigned int)n;
+	memcpy(s->pc, pc + PROFILE_SKIP, (size_t)n * sizeof(pc[0]));
+	__atomic_store_n(&s->seq, (unsigned int)(2 * i + 2), __ATOMIC_RELEASE);
+	errno = saved;
+}
+
+/** Allocate the ring and install the handler, once. */
+static int
+profile_setup(void)
+{
+	struct sigaction sa;
+	void *warm[4];
+
+	if (profile_installed)
+		return 0;
+	if (profile_ring == NULL) {
+		profile_sample_t *ring = calloc(PROFILE_SAMPLES, sizeof(*ring));
+
+		if (ring == NULL)
+			return -1;
+		__atomic_store_n(&profile_ring, ring, __ATOMIC_RELEASE);
+		(void)mem_budget_register_fixed("profile",
+		    PROFILE_SAMPLES * sizeof(*ring));
+	}
+	(void)backtrace(warm, 4);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = profile_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) != 0)
+		return -1;
+	profile_installed = 1;
+	return 0;
+}
+
+/**
+ * @brief Start, retune or stop sampling.
+ * @param hz Samples per CPU second, clamped to PROFILE_HZ_MAX; 0 stops.
+ * @return 0, or -1 when profiling could not be started.
+ */
+int
+profile_enable(int hz)
+{
+	struct itimerval it;
+	int rc = 0;
+
+	if (hz < 0)
+		hz = 0;
+	if (hz > PROFILE_HZ_MAX)
+		hz = PROFILE_HZ_MAX;
+
+	pthread_mutex_lock(&profile_lock);
+	if (hz == profile_rate)
+		goto out;
+	if (hz > 0 && profile_setup() != 0) {
+		rc = -1;
+		goto out;
+	}
+	memset(&it, 0, sizeof(it));
+	if (hz == 1)
+		it.it_interval.tv_sec = 1;
+	else if (hz > 0)
+		it.it_interval.tv_usec = 1000000 / hz;
+	it.it_value = it.it_interval;
+	/* A fresh profile starts from an empty ring. */
+	if (profile_rate == 0) {
+		memset(profile_ring, 0, PROFILE_SAMPLES * sizeof(*profile_ring));
+		__atomic_store_n(&profile_head, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&profile_rate, hz, __ATOMIC_RELAXED);
+	if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+		__atomic_store_n(&profile_rate, 0, __ATOMIC_RELAXED);
+		rc = -1;
+	}
+out:
+	pthread_mutex_unlock(&profile_lock);
+	return rc;
+}
+
+/** @brief Current sampling rate, 0 when off. */
+int
+profile_hz(void)
+{
+	return __atomic_load_n(&profile_rate, __ATOMIC_RELAXED);
+}
+
+/** @brief Samples taken since the ring was last cleared. */
+unsigned long
+profile_samples(void)
+{
+	return __atomic_load_n(&profile_head, __ATOMIC_RELAXED);
+}
+
+/** Order samples by depth, then frames; equal stacks end up adjacent. */
+static int
+profile_cmp(const void *a, const void *b)
+{
+	const profile_sample_t *x = a, *y = b;
+
+	if (x->depth != y->depth)
+		return x->depth < y->depth ? -1 : 1;
+	return memcmp(x->pc, y->pc, x->depth * sizeof(x->pc[0]));
+}
+
+typedef struct {
+	const profile_sample_t *s;
+	size_t count;
+} profile_stack_t;
+
+/** Most frequent first. */
+static int
+profile_stack_cmp(const void *a, const void *b)
+{
+	const profile_stack_t *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Name of the function containing @p pc (a return address: the call is
+ * the byte before it), or object+0xoffset with @p raw or no symbol.
+ */
+static void
+profile_name(void *pc, int raw, char *buf, size_t size)
+{
+	uintptr_t a = (uintptr_t)pc - 1;
+	const char *obj;
+	Dl_info dl;
+
+	if (dladdr((void *)a, &dl) == 0 || dl.dli_fname == NULL) {
+		snprintf(buf, size, "0x%lx", (unsigned long)a);
+		return;
+	}
+	if (!raw && dl.dli_sname != NULL) {
+		strlcpy(buf, dl.dli_sname, size);
+		return;
+	}
+	obj = strrchr(dl.dli_fname, '/');
+	snprintf(buf, size, "%s+0x%lx", obj ? obj + 1 : dl.dli_fname,
+	    (unsigned long)(a - (uintptr_t)dl.dli_fbase));
+}
+
+/** Append @p n bytes at @p *len, growing @p *buf; -1 on failure. */
+static int
+profile_put(char **buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+	if (*len + n + 1 > *cap) {
+		size_t ncap = *cap ? *cap : 4096;
+		char *p;
+
+		while (*len + n + 1 > ncap)
+			ncap *= 2;
+		if ((p = realloc(*buf, ncap)) == NULL)
+			return -1;
+		*buf = p;
+		*cap = ncap;
+	}
+	memcpy(*buf + *len, s, n);
+	*len += n;
+	(*buf)[*len] = '\0';
+	return 0;
+}
+
+/**
+ * @brief Aggregate the ring into folded stacks.
+ * @param raw Name frames object+0xoffset rather than by symbol.
+ * @param len Receives the length of the text; may be NULL.
+ * @return Heap text, empty when there are no samples; NULL on failure.
+ */
+char *
+profile_folded(int raw, size_t *len)
+{
+	profile_sample_t *copy;
+	profile_stack_t *stacks;
+	sigset_t prof, saved;
+	size_t n = 0, nstacks = 0, off = 0, cap = 0;
+	char *out = NULL, name[PROFILE_NAME_MAX], tail[32];
+	profile_sample_t *ring = __atomic_load_n(&profile_ring,
+	    __ATOMIC_ACQUIRE);
+
+	if (len)
+		*len = 0;
+	if ((copy = malloc(PROFILE_SAMPLES * sizeof(*copy))) == NULL)
+		return NULL;
+	for (size_t i = 0; ring != NULL && i < PROFILE_SAMPLES; i++) {
+		profile_sample_t *s = &ring[i];
+		unsigned int seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == 0 || (seq & 1))
+			continue;
+		copy[n] = *s;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq &&
+		    copy[n].depth > 0 && copy[n].depth <= PROFILE_DEPTH)
+			n++;
+	}
+	if (n > 1)
+		qsort(copy, n, sizeof(copy[0]), profile_cmp);
+
+	if ((stacks = malloc((n ? n : 1) * sizeof(*stacks))) == NULL) {
+		free(copy);
+		return NULL;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (nstacks > 0 &&
+		    profile_cmp(stacks[nstacks - 1].s, &copy[i]) == 0) {
+			stacks[nstacks - 1].count++;
+			continue;
+		}
+		stacks[nstacks].s = &copy[i];
+		stacks[nstacks++].count = 1;
+	}
+	if (nstacks > 1)
+		qsort(stacks, nstacks, sizeof(stacks[0]), profile_stack_cmp);
+
+	if (profile_put(&out, &off, &cap, "", 0) != 0)
+		goto fail;
+	/* Not sampled inside dladdr(): the unwinder wants its lock too. */
+	sigemptyset(&prof);
+	sigaddset(&prof, SIGPROF);
+	(void)pthread_sigmask(SIG_BLOCK, &prof, &saved);
+	/* Root first: backtrace(3) lists the innermost frame first. */
+	for (size_t i = 0; i < nstacks; i++) {
+		const profile_sample_t *s = stacks[i].s;
+		int tl;
+
+		for (unsigned int f = s->depth; f-- > 0; ) {
+			profile_name(s->pc[f], raw, name, sizeof(name));
+			/* ';' separates frames and ' ' ends the stack. */
+			for (char *c = name; *c; c++) {
+				if (*c == ';' || *c == ' ')
+					*c = '_';
+			}
+			if (profile_put(&out, &off, &cap, name,
+			    strlen(name)) != 0 || (f > 0 &&
+			    profile_put(&out, &off, &cap, ";", 1) != 0))
+				goto unblock;
+		}
+		tl = snprintf(tail, sizeof(tail), " %zu\n", stacks[i].count);
+		if (profile_put(&out, &off, &cap, tail, (size_t)tl) != 0)
+			goto unblock;
+	}
+	(void)pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	free(stacks);
+	free(copy);
+	if (len)
+		*len = off;
+	return out;
+
+unblock:
+	(void)pthread_sigmask(SIG_SETMASK, &saved, NULL);
+fail:
+	free(out);
+	free(stacks);
+	free(copy);
+	return NULL;
+}
+
+/** @brief Stop the timer, restore SIGPROF and free the ring. */
+void
+profile_cleanup(void)
+{
+	struct itimerval it;
+	profile_sample_t *ring;
+
+	pthread_mutex_lock(&profile_lock);
+	memset(&it, 0, sizeof(it));
+	(void)setitimer(ITIMER_PROF, &it, NULL);
+	__atomic_store_n(&profile_rate, 0, __ATOMIC_RELAXED);
+	if (profile_installed) {
+		/* A signal already queued is then ignored. */
+		(void)signal(SIGPROF, SIG_IGN);
+		profile_installed = 0;
+	}
+	ring = profile_ring;
+	__atomic_store_n(&profile_ring, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&profile_lock);
+	free(ring);
+}
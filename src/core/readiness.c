@@ -0,0 +1,227 @@
+/* readiness.c - startup warm-up and the readiness state */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/core/log.h>
+#include <miniweb/core/readiness.h>
+
+/*
+ * A handful of tasks, each reported once: a table under one mutex, with
+ * a condition variable for readiness_wait(). The ready flag is also
+ * kept apart, set once, so the per-request check is a single load.
+ */
+
+typedef struct {
+	int (*fn)(void *);
+	void *arg;
+	char name[READINESS_NAME_MAX];
+} readiness_job_t;
+
+static pthread_mutex_t readiness_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readiness_cond = PTHREAD_COND_INITIALIZER;
+static struct readiness_task readiness_tasks[READINESS_MAX];
+static int readiness_count, readiness_pending, readiness_sealed;
+static uint64_t readiness_t0;		/* first expect, monotonic ms */
+static uint64_t readiness_took;
+static int readiness_flag;
+
+static uint64_t
+readiness_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/** Task named @p name, or NULL. Lock held. */
+static struct readiness_task *
+readiness_find(const char *name)
+{
+	for (int i = 0; i < readiness_count; i++) {
+		if (strcmp(readiness_tasks[i].name, name) == 0)
+			return &readiness_tasks[i];
+	}
+	return NULL;
+}
+
+/** Flip to ready when sealed with nothing pending. Lock held. */
+static void
+readiness_check(uint64_t now)
+{
+	if (!readiness_sealed || readiness_pending > 0 ||
+	    __atomic_load_n(&readiness_flag, __ATOMIC_RELAXED))
+		return;
+	readiness_took = readiness_t0 ? now - readiness_t0 : 0;
+	__atomic_store_n(&readiness_flag, 1, __ATOMIC_RELEASE);
+	log_info("Warm-up done in %llu ms (%d tasks); ready",
+	    (unsigned long long)readiness_took, readiness_count);
+}
+
+/**
+ * @brief Expect @p name to report before the instance is ready.
+ * @return 0 (also when already expected), or -1 when the table is full.
+ */
+int
+readiness_expect(const char *name)
+{
+	struct readiness_task *t;
+	int rc = 0;
+
+	pthread_mutex_lock(&readiness_lock);
+	if (readiness_find(name) == NULL) {
+		if (readiness_count == READINESS_MAX) {
+			rc = -1;
+		} else {
+			t = &readiness_tasks[readiness_count++];
+			memset(t, 0, sizeof(*t));
+			strlcpy(t->name, name, sizeof(t->name));
+			if (readiness_t0 == 0)
+				readiness_t0 = readiness_now_ms();
+			readiness_pending++;
+		}
+	}
+	pthread_mutex_unlock(&readiness_lock);
+	if (rc != 0)
+		log_error("No room to track warm-up of %s", name);
+	return rc;
+}
+
+/** Mark @p name done with result @p rc. */
+static void
+readiness_finish(const char *name, int rc)
+{
+	struct readiness_task *t;
+	uint64_t now = readiness_now_ms();
+
+	pthread_mutex_lock(&readiness_lock);
+	if ((t = readiness_find(name)) != NULL && !t->done) {
+		t->done = 1;
+		t->rc = rc;
+		t->ms = now - readiness_t0;
+		readiness_pending--;
+		readiness_check(now);
+		pthread_cond_broadcast(&readiness_cond);
+	}
+	pthread_mutex_unlock(&readiness_lock);
+}
+
+/** @brief Report @p name warm. */
+void
+readiness_done(const char *name)
+{
+	readiness_finish(name, 0);
+}
+
+static void *
+readiness_thread(void *arg)
+{
+	readiness_job_t *j = arg;
+
+	readiness_finish(j->name, j->fn(j->arg));
+	free(j);
+	return NULL;
+}
+
+/**
+ * @brief Expect @p name and run @p fn on a detached thread.
+ * @return 0; -1 when it had to run on the calling thread instead.
+ */
+int
+readiness_run(const char *name, int (*fn)(void *), void *arg)
+{
+	readiness_job_t *j;
+	pthread_t tid;
+
+	(void)readiness_expect(name);
+	if ((j = malloc(sizeof(*j))) != NULL) {
+		j->fn = fn;
+		j->arg = arg;
+		strlcpy(j->name, name, sizeof(j->name));
+		if (pthread_create(&tid, NULL, readiness_thread, j) == 0) {
+			(void)pthread_detach(tid);
+			return 0;
+		}
+		free(j);
+	}
+	readiness_finish(name, fn(arg));
+	return -1;
+}
+
+/**
+ * @brief Block until @p name is done.
+ * @return The task's result, or -1 when @p name was never expected.
+ */
+int
+readiness_wait(const char *name)
+{
+	struct readiness_task *t;
+	int rc = -1;
+
+	pthread_mutex_lock(&readiness_lock);
+	while ((t = readiness_find(name)) != NULL && !t->done)
+		pthread_cond_wait(&readiness_cond, &readiness_lock);
+	if (t != NULL)
+		rc = t->rc;
+	pthread_mutex_unlock(&readiness_lock);
+	return rc;
+}
+
+/** @brief Close the list of expected tasks. */
+void
+readiness_seal(void)
+{
+	pthread_mutex_lock(&readiness_lock);
+	readiness_sealed = 1;
+	readiness_check(readiness_now_ms());
+	pthread_mutex_unlock(&readiness_lock);
+}
+
+/** @brief Whether every expected task is done and the list sealed. */
+int
+readiness_ready(void)
+{
+	return __atomic_load_n(&readiness_flag, __ATOMIC_ACQUIRE);
+}
+
+/** @brief Warm-up time in milliseconds, 0 until ready. */
+uint64_t
+readiness_ms(void)
+{
+	uint64_t ms;
+
+	pthread_mutex_lock(&readiness_lock);
+	ms = readiness_took;
+	pthread_mutex_unlock(&readiness_lock);
+	return ms;
+}
+
+/**
+ * @brief Copy the tasks, in the order they were expected.
+ * @return Tasks copied.
+ */
+int
+readiness_list(struct readiness_task *out, int max)
+{
+	int n;
+
+	pthread_mutex_lock(&readiness_lock);
+	n = readiness_count < max ? readiness_count : max;
+	memcpy(out, readiness_tasks, (size_t)(n > 0 ? n : 0) * sizeof(*out));
+	pthread_mutex_unlock(&readiness_lock);
+	return n;
+}
+
+/** @brief Forget every task; the instance is not ready again. */
+void
+readiness_reset(void)
+{
+	pthread_mutex_lock(&readiness_lock);
+	readiness_count = readiness_pending = readiness_sealed = 0;
+	readiness_t0 = readiness_took = 0;
+	__atomic_store_n(&readiness_flag, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&readiness_lock);
+}
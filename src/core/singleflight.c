@@ -0,0 +1,143 @@
+/* singleflight.c - coalesce concurrent computations of the same key */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/singleflight.h>
+
+/*
+ * The first caller for a key links a call into the group and runs the
+ * computation without holding the lock; later callers for the same key
+ * take a reference and sleep on the call's condition variable. Once the
+ * result is published the call leaves the group, so a caller arriving
+ * after that starts a new run (by then the caller's own cache should
+ * answer it). The result buffer is immutable after publication: each
+ * holder copies it outside the lock, and whoever drops the last
+ * reference keeps the original instead of copying.
+ */
+
+struct singleflight_call {
+	char key[SINGLEFLIGHT_KEY_MAX];
+	pthread_cond_t done_cond;
+	int done;
+	int refs;
+	char *val;
+	size_t len;
+	struct singleflight_call *next;
+};
+
+/** Unlink @p c from @p g. Called with the group lock held. */
+static void
+singleflight_unlink(singleflight_group_t *g, struct singleflight_call *c)
+{
+	struct singleflight_call **pp;
+
+	for (pp = &g->calls; *pp; pp = &(*pp)->next) {
+		if (*pp == c) {
+			*pp = c->next;
+			return;
+		}
+	}
+}
+
+/**
+ * Take the result out of published call @p c and drop a reference.
+ * Called with the group lock held; returns with it released.
+ */
+static char *
+singleflight_collect(singleflight_group_t *g, struct singleflight_call *c,
+    size_t *len)
+{
+	char *out;
+
+	*len = c->len;
+	if (c->refs == 1) {
+		out = c->val;
+		pthread_mutex_unlock(&g->lock);
+		pthread_cond_destroy(&c->done_cond);
+		free(c);
+		return out;
+	}
+	pthread_mutex_unlock(&g->lock);
+
+	out = NULL;
+	if (c->val && (out = malloc(c->len + 1)) != NULL) {
+		memcpy(out, c->val, c->len);
+		out[c->len] = '\0';
+	}
+	if (!out)
+		*len = 0;
+
+	pthread_mutex_lock(&g->lock);
+	if (--c->refs > 0) {
+		pthread_mutex_unlock(&g->lock);
+		return out;
+	}
+	pthread_mutex_unlock(&g->lock);
+	pthread_cond_destroy(&c->done_cond);
+	free(c->val);
+	free(c);
+	return out;
+}
+
+/**
+ * @brief Run @p fn once for concurrent callers asking for @p key.
+ *
+ * @param g Group the key belongs to.
+ * @param key Cache key of the value.
+ * @param fn Computation of the value.
+ * @param arg Argument for @p fn.
+ * @param len Set to the result length.
+ * @param shared Set to 1 when another caller ran @p fn; may be NULL.
+ *
+ * @return char* Heap-allocated result for this caller, or NULL.
+ */
+char *
+singleflight_do(singleflight_group_t *g, const char *key,
+    singleflight_fn fn, void *arg, size_t *len, int *shared)
+{
+	struct singleflight_call *c;
+	size_t klen = strlen(key);
+
+	*len = 0;
+	if (shared)
+		*shared = 0;
+	if (klen >= SINGLEFLIGHT_KEY_MAX)
+		return fn(arg, len);
+
+	pthread_mutex_lock(&g->lock);
+	for (c = g->calls; c; c = c->next) {
+		if (strcmp(c->key, key) == 0)
+			break;
+	}
+	if (c) {
+		c->refs++;
+		while (!c->done)
+			pthread_cond_wait(&c->done_cond, &g->lock);
+		if (shared)
+			*shared = 1;
+		return singleflight_collect(g, c, len);
+	}
+
+	if ((c = calloc(1, sizeof(*c))) == NULL ||
+	    pthread_cond_init(&c->done_cond, NULL) != 0) {
+		pthread_mutex_unlock(&g->lock);
+		free(c);
+		return fn(arg, len);
+	}
+	memcpy(c->key, key, klen + 1);
+	c->refs = 1;
+	c->next = g->calls;
+	g->calls = c;
+	pthread_mutex_unlock(&g->lock);
+
+	c->val = fn(arg, &c->len);
+	if (!c->val)
+		c->len = 0;
+
+	pthread_mutex_lock(&g->lock);
+	singleflight_unlink(g, c);
+	c->done = 1;
+	pthread_cond_broadcast(&c->done_cond);
+	return singleflight_collect(g, c, len);
+}
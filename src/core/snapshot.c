@@ -0,0 +1,89 @@
+/* snapshot.c - publish immutable, refcounted snapshots without reader locks */
+
+#include <sched.h>
+
+#include <miniweb/core/snapshot.h>
+
+/*
+ * The one race is between a reader loading slot->cur and raising the
+ * snapshot's count: a writer that swapped it out in between must not
+ * drop its reference yet. Readers therefore announce themselves in
+ * readers[] for that window, on the counter the epoch's parity picks.
+ * After the swap the writer flips the epoch and waits for the counter
+ * readers were using to drain, then does the same for the other: any
+ * reader still holding the old pointer was counted in one of them
+ * since before the swap. New readers land on the counter not being
+ * waited for, so a steady stream of them cannot hold a writer off, and
+ * the window is a handful of instructions, so the writer only yields.
+ */
+
+/**
+ * @brief Set up a snapshot holding one reference.
+ * @param s Snapshot heading the caller's structure.
+ * @param free_fn Frees the structure once the last reference is gone.
+ */
+void
+snapshot_init(snapshot_t *s, void (*free_fn)(snapshot_t *s))
+{
+	s->refs = 1;
+	s->free = free_fn;
+}
+
+/** @brief Take another reference on @p s. */
+snapshot_t *
+snapshot_ref(snapshot_t *s)
+{
+	__atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+	return s;
+}
+
+/** @brief Drop one reference; the last holder frees the snapshot. */
+void
+snapshot_release(snapshot_t *s)
+{
+	if (s != NULL && __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		s->free(s);
+}
+
+/**
+ * @brief Reference the snapshot current in @p slot, without locking.
+ * @return The reference, which the caller releases, or NULL.
+ */
+snapshot_t *
+snapshot_acquire(snapshot_slot_t *slot)
+{
+	unsigned int i = __atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST) & 1;
+	snapshot_t *s;
+
+	__atomic_add_fetch(&slot->readers[i], 1, __ATOMIC_SEQ_CST);
+	s = __atomic_load_n(&slot->cur, __ATOMIC_SEQ_CST);
+	if (s != NULL)
+		__atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&slot->readers[i], 1, __ATOMIC_SEQ_CST);
+	return s;
+}
+
+/**
+ * @brief Swap @p s into @p slot and retire the snapshot it replaces.
+ *
+ * @details Returns once no reader can still be about to reference the
+ * old snapshot; it is freed then unless a reader holds it, in which case
+ * that reader's release frees it.
+ */
+void
+snapshot_publish(snapshot_slot_t *slot, snapshot_t *s)
+{
+	snapshot_t *old;
+
+	pthread_mutex_lock(&slot->lock);
+	old = __atomic_exchange_n(&slot->cur, s, __ATOMIC_SEQ_CST);
+	for (int pass = 0; old != NULL && pass < 2; pass++) {
+		unsigned int i = __atomic_fetch_add(&slot->epoch, 1,
+		    __ATOMIC_SEQ_CST) & 1;
+
+		while (__atomic_load_n(&slot->readers[i], __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+	pthread_mutex_unlock(&slot->lock);
+	snapshot_release(old);
+}
@@ -0,0 +1,121 @@
+/* snapshot_delta.c - which members of a polled JSON snapshot changed */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/snapshot_delta.h>
+
+/*
+ * Dashboards poll their snapshot every second. Each publish hashes the
+ * snapshot's top-level members and remembers the version that last
+ * changed each one, plus the versions of the last SNAPSHOT_DELTA_WINDOW
+ * publishes, so a poller that names the version it holds can be sent
+ * only the members that changed since, and the samples it has not seen.
+ */
+
+/** FNV-1a, 64-bit. */
+static uint64_t
+snapshot_delta_hash(const char *p, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+void
+snapshot_delta_publish(snapshot_delta_t *d, unsigned long version,
+    int64_t ts, const char *json, const snapshot_span_t *spans, size_t n)
+{
+	int reset;
+
+	if (n > SNAPSHOT_DELTA_SECTIONS)
+		n = SNAPSHOT_DELTA_SECTIONS;
+	/* A different layout, or the first publish: everything changed. */
+	reset = d->count == 0 || n != d->nsections;
+	for (size_t i = 0; i < n; i++) {
+		uint64_t h = snapshot_delta_hash(json + spans[i].off,
+		    spans[i].len);
+
+		if (reset || h != d->hash[i])
+			d->changed[i] = version;
+		d->hash[i] = h;
+	}
+	d->nsections = n;
+
+	d->versions[d->head] = version;
+	d->ts[d->head] = ts;
+	d->head = (d->head + 1) % SNAPSHOT_DELTA_WINDOW;
+	if (d->count < SNAPSHOT_DELTA_WINDOW)
+		d->count++;
+}
+
+int
+snapshot_delta_resolve(const snapshot_delta_t *d, unsigned long long since,
+    unsigned long *version, int64_t *ts)
+{
+	size_t oldest, i, slot;
+
+	if (d->count == 0)
+		return -1;
+	oldest = (d->head + SNAPSHOT_DELTA_WINDOW - d->count) %
+	    SNAPSHOT_DELTA_WINDOW;
+
+	/* A version, newest first. */
+	for (i = 0; i < d->count; i++) {
+		slot = (d->head + SNAPSHOT_DELTA_WINDOW - 1 - i) %
+		    SNAPSHOT_DELTA_WINDOW;
+		if (d->versions[slot] == since) {
+			*version = d->versions[slot];
+			*ts = d->ts[slot];
+			return 0;
+		}
+	}
+
+	/* A time: the newest version not built from later samples. */
+	if ((long long)since < (long long)d->ts[oldest])
+		return -1;
+	for (i = 0; i < d->count; i++) {
+		slot = (d->head + SNAPSHOT_DELTA_WINDOW - 1 - i) %
+		    SNAPSHOT_DELTA_WINDOW;
+		if ((long long)d->ts[slot] <= (long long)since) {
+			*version = d->versions[slot];
+			*ts = d->ts[slot];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int
+snapshot_delta_changed(const snapshot_delta_t *d, size_t section,
+    unsigned long version)
+{
+	return section < d->nsections && d->changed[section] > version;
+}
+
+int
+snapshot_delta_query(const char *qs, unsigned long long *since)
+{
+	const char *p = qs;
+	char *end;
+
+	while (p != NULL && *p != '\0') {
+		if (strncmp(p, "since=", 6) == 0) {
+			p += 6;
+			if (*p < '0' || *p > '9')
+				return 0;
+			errno = 0;
+			*since = strtoull(p, &end, 10);
+			if (errno != 0 || (*end != '\0' && *end != '&'))
+				return 0;
+			return 1;
+		}
+		if ((p = strchr(p, '&')) != NULL)
+			p++;
+	}
+	return 0;
+}
@@ -0,0 +1,178 @@
+/* vnode_watch.c - one thread delivering EVFILT_VNODE events */
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <miniweb/core/log.h>
+#include <miniweb/core/vnode_watch.h>
+
+#define VNODE_WATCH_BATCH 32
+#define VNODE_WATCH_EVENTS \
+	(NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME | \
+	 NOTE_REVOKE)
+
+struct vnode_watch {
+	int kq;
+	vnode_watch_fn fn;
+	struct vnode_watch *next;
+};
+
+static pthread_mutex_t g_vw_lock = PTHREAD_MUTEX_INITIALIZER;
+static vnode_watch_t *g_vw_groups;
+static pthread_t g_vw_thread;
+static int g_vw_running;
+static int g_vw_kq = -1;
+static int g_vw_pipe[2] = {-1, -1};
+
+/** Deliver everything pending on one group's kqueue. */
+static void
+vnode_watch_drain(vnode_watch_t *w)
+{
+	struct kevent ev[VNODE_WATCH_BATCH];
+	struct timespec zero = {0, 0};
+	int n;
+
+	do {
+		n = kevent(w->kq, NULL, 0, ev, VNODE_WATCH_BATCH, &zero);
+		for (int i = 0; i < n; i++)
+			w->fn((int)ev[i].ident, ev[i].fflags,
+			    (uintptr_t)ev[i].udata);
+	} while (n == VNODE_WATCH_BATCH);
+}
+
+/**
+ * @brief Watch thread: wait on the parent kqueue, in which every group's
+ * kqueue and the stop pipe are registered for EVFILT_READ.
+ */
+static void *
+vnode_watch_thread(void *arg)
+{
+	struct kevent ev[8];
+	int n;
+
+	(void)arg;
+	for (;;) {
+		n = kevent(g_vw_kq, NULL, 0, ev, 8, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error("[VNODE] kevent: errno=%d", errno);
+			return NULL;
+		}
+		for (int i = 0; i < n; i++) {
+			if ((int)ev[i].ident == g_vw_pipe[0])
+				return NULL;
+			vnode_watch_drain(ev[i].udata);
+		}
+	}
+}
+
+/** Create the parent kqueue, the stop pipe and the thread; lock held. */
+static int
+vnode_watch_start_locked(void)
+{
+	struct kevent ev;
+
+	if (g_vw_running)
+		return 0;
+	if ((g_vw_kq = kqueue()) < 0)
+		return -1;
+	if (pipe(g_vw_pipe) != 0) {
+		close(g_vw_kq);
+		g_vw_kq = -1;
+		return -1;
+	}
+	EV_SET(&ev, g_vw_pipe[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(g_vw_kq, &ev, 1, NULL, 0, NULL) != 0 ||
+	    pthread_create(&g_vw_thread, NULL, vnode_watch_thread, NULL) != 0) {
+		close(g_vw_pipe[0]);
+		close(g_vw_pipe[1]);
+		close(g_vw_kq);
+		g_vw_pipe[0] = g_vw_pipe[1] = g_vw_kq = -1;
+		return -1;
+	}
+	g_vw_running = 1;
+	return 0;
+}
+
+/**
+ * @brief Create a watch group; starts the watch thread on first use.
+ * @param fn Callback for the group's events.
+ * @return New group, or NULL on failure.
+ */
+vnode_watch_t *
+vnode_watch_create(vnode_watch_fn fn)
+{
+	struct kevent ev;
+	vnode_watch_t *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->fn = fn;
+	pthread_mutex_lock(&g_vw_lock);
+	if (vnode_watch_start_locked() != 0 || (w->kq = kqueue()) < 0) {
+		pthread_mutex_unlock(&g_vw_lock);
+		free(w);
+		return NULL;
+	}
+	EV_SET(&ev, w->kq, EVFILT_READ, EV_ADD, 0, 0, w);
+	if (kevent(g_vw_kq, &ev, 1, NULL, 0, NULL) != 0) {
+		pthread_mutex_unlock(&g_vw_lock);
+		close(w->kq);
+		free(w);
+		return NULL;
+	}
+	w->next = g_vw_groups;
+	g_vw_groups = w;
+	pthread_mutex_unlock(&g_vw_lock);
+	return w;
+}
+
+/**
+ * @brief Register @p fd with a group.
+ * @return 0 on success, -1 on failure.
+ */
+int
+vnode_watch_add(vnode_watch_t *w, int fd, uintptr_t token)
+{
+	struct kevent ev;
+
+	if (!w || fd < 0)
+		return -1;
+	EV_SET(&ev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, VNODE_WATCH_EVENTS,
+	    0, (void *)token);
+	return kevent(w->kq, &ev, 1, NULL, 0, NULL) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Join the watch thread and release all groups. Descriptors
+ * registered by callers stay theirs to close.
+ */
+void
+vnode_watch_shutdown(void)
+{
+	vnode_watch_t *w;
+
+	pthread_mutex_lock(&g_vw_lock);
+	if (g_vw_running) {
+		(void)write(g_vw_pipe[1], "x", 1);
+		pthread_join(g_vw_thread, NULL);
+		close(g_vw_pipe[0]);
+		close(g_vw_pipe[1]);
+		close(g_vw_kq);
+		g_vw_pipe[0] = g_vw_pipe[1] = g_vw_kq = -1;
+		g_vw_running = 0;
+	}
+	while ((w = g_vw_groups) != NULL) {
+		g_vw_groups = w->next;
+		close(w->kq);
+		free(w);
+	}
+	pthread_mutex_unlock(&g_vw_lock);
+}
@@ -0,0 +1,90 @@
+/* bundle.c - lookups in the compiled-in file table */
+
+#include <string.h>
+
+#include <miniweb/http/bundle.h>
+
+/* Set once before the workers start; read without a lock after. */
+static int bundle_on = 0;
+
+/**
+ * @brief Use the bundle, or the directories alone.
+ * @param enabled Nonzero to serve bundled files first.
+ */
+void
+bundle_set_enabled(int enabled)
+{
+	bundle_on = enabled != 0 && bundle_file_count > 0;
+}
+
+/** @brief Whether the bundle is in use. */
+int
+bundle_enabled(void)
+{
+	return bundle_on;
+}
+
+/** Order @p name against the first @p len bytes of @p key, as strcmp(3). */
+static int
+bundle_cmp(const char *key, size_t len, const char *name)
+{
+	size_t n = strlen(name);
+	int c = memcmp(key, name, len < n ? len : n);
+
+	if (c != 0)
+		return c;
+	return len < n ? -1 : len > n;
+}
+
+/**
+ * @brief Binary search of the table, which the bundler sorted by name.
+ * @return The entry, or NULL.
+ */
+const bundle_file_t *
+bundle_lookup(const char *name, size_t len)
+{
+	size_t lo = 0, hi = bundle_file_count;
+
+	if (!bundle_on || name == NULL)
+		return NULL;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = bundle_cmp(name, len, bundle_files[mid].name);
+
+		if (c == 0)
+			return &bundle_files[mid];
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Visit the entries under @p prefix.
+ *
+ * @details They are adjacent in the sorted table: the first is found by
+ * binary search and the walk stops at the first name without it.
+ */
+void
+bundle_foreach(const char *prefix, void (*fn)(const bundle_file_t *f,
+    void *ctx), void *ctx)
+{
+	size_t plen = strlen(prefix);
+	size_t lo = 0, hi = bundle_file_count;
+
+	if (!bundle_on)
+		return;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (bundle_cmp(prefix, plen, bundle_files[mid].name) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < bundle_file_count &&
+	    strncmp(bundle_files[lo].name, prefix, plen) == 0; lo++)
+		fn(&bundle_files[lo], ctx);
+}
@@ -0,0 +1,436 @@
+/* hpack.c - HPACK header compression for HTTP/2 (RFC 7541) */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/http/hpack.h>
+
+/* RFC 7541 Appendix A; index 0 is unused. */
+static const struct {
+	const char *name;
+	const char *value;
+} hpack_static[] = {
+	{ NULL, NULL },
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+#define HPACK_STATIC_COUNT \
+	(sizeof(hpack_static) / sizeof(hpack_static[0]) - 1)
+
+/*
+ * The Huffman code of Appendix B is canonical, so it is fully given by
+ * how many codes each length has and the symbols in code order; the
+ * decoder walks it a bit at a time, as puff.c does for deflate. The
+ * code after the last symbol, index 256, is EOS.
+ */
+#define HPACK_HUFF_MAXLEN	30
+#define HPACK_HUFF_EOS		256
+
+static const uint16_t hpack_huff_count[HPACK_HUFF_MAXLEN + 1] = {
+	[5] = 10, [6] = 26, [7] = 32, [8] = 6, [10] = 5, [11] = 3,
+	[12] = 2, [13] = 6, [14] = 2, [15] = 3, [19] = 3, [20] = 8,
+	[21] = 13, [22] = 26, [23] = 29, [24] = 12, [25] = 4, [26] = 15,
+	[27] = 19, [28] = 29, [30] = 4,
+};
+
+static const uint8_t hpack_huff_syms[256] = {
+	 48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+	 45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+	 95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	 58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+	 77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+	106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+	 88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+	  0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+	  6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+	 21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+	249,  10,  13,  22,
+};
+
+long
+hpack_huffman_decode(const uint8_t *src, size_t len, char *dst, size_t cap)
+{
+	uint32_t code = 0, first = 0;
+	size_t index = 0, out = 0;
+	int bits = 0;		/* of the symbol being read */
+
+	for (size_t i = 0; i < len; i++) {
+		for (int b = 7; b >= 0; b--) {
+			size_t sym;
+
+			code |= (src[i] >> b) & 1;
+			bits++;
+			if (code - first < hpack_huff_count[bits]) {
+				sym = index + (code - first);
+				if (sym == HPACK_HUFF_EOS || out == cap)
+					return -1;
+				dst[out++] = (char)hpack_huff_syms[sym];
+				code = first = 0;
+				index = 0;
+				bits = 0;
+				continue;
+			}
+			if (bits == HPACK_HUFF_MAXLEN)
+				return -1;
+			index += hpack_huff_count[bits];
+			first = (first + hpack_huff_count[bits]) << 1;
+			code <<= 1;
+		}
+	}
+	/* Padding is the EOS prefix: fewer than 8 bits, all ones. */
+	if (bits > 7 || (bits > 0 && (code >> 1) != (1u << bits) - 1))
+		return -1;
+	return (long)out;
+}
+
+/**
+ * Decode an integer with an @p n bit prefix at *@p pp. Values are kept
+ * below 2^28, far above any length or index a header block can hold.
+ */
+static int
+hpack_int(const uint8_t **pp, const uint8_t *end, int n, size_t *out)
+{
+	const uint8_t *p = *pp;
+	size_t max = ((size_t)1 << n) - 1, v;
+	int shift = 0;
+
+	if (p == end)
+		return -1;
+	v = *p++ & max;
+	if (v == max) {
+		uint8_t c;
+
+		do {
+			if (p == end || shift > 21)
+				return -1;
+			c = *p++;
+			v += (size_t)(c & 0x7f) << shift;
+			shift += 7;
+		} while (c & 0x80);
+	}
+	*pp = p;
+	*out = v;
+	return 0;
+}
+
+/**
+ * Read one string literal, pointing *@p s at it: into the block when
+ * raw, into @p scratch (advanced past it) when Huffman coded.
+ */
+static int
+hpack_string(const uint8_t **pp, const uint8_t *end, char **scratch,
+    char *scratch_end, const char **s, size_t *len)
+{
+	int huff;
+	size_t n;
+	long dn;
+
+	if (*pp == end)
+		return -1;
+	huff = **pp & 0x80;
+	if (hpack_int(pp, end, 7, &n) == -1 || n > (size_t)(end - *pp))
+		return -1;
+	if (!huff) {
+		*s = (const char *)*pp;
+		*len = n;
+		*pp += n;
+		return 0;
+	}
+	dn = hpack_huffman_decode(*pp, n, *scratch,
+	    (size_t)(scratch_end - *scratch));
+	if (dn < 0)
+		return -1;
+	*s = *scratch;
+	*len = (size_t)dn;
+	*scratch += dn;
+	*pp += n;
+	return 0;
+}
+
+void
+hpack_decoder_init(hpack_decoder_t *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->max_size = d->limit = HPACK_TABLE_SIZE;
+}
+
+static size_t
+hpack_entry_size(const hpack_entry_t *e)
+{
+	return e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+}
+
+/** Drop the oldest entries until the table holds at most @p size. */
+static void
+hpack_evict(hpack_decoder_t *d, size_t size)
+{
+	while (d->count > 0 && d->size > size) {
+		hpack_entry_t *e = &d->ent[(d->first + d->count - 1) %
+		    HPACK_MAX_ENTRIES];
+
+		d->size -= hpack_entry_size(e);
+		free(e->name);
+		e->name = NULL;
+		d->count--;
+	}
+}
+
+void
+hpack_decoder_free(hpack_decoder_t *d)
+{
+	hpack_evict(d, 0);
+}
+
+/**
+ * Insert a field as the newest entry. One too large for the table only
+ * empties it (RFC 7541, 4.4); a failed allocation is a decoding error.
+ */
+static int
+hpack_insert(hpack_decoder_t *d, const char *name, size_t name_len,
+    const char *value, size_t value_len)
+{
+	size_t need = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	hpack_entry_t *e;
+	char *buf;
+
+	if (need > d->max_size) {
+		hpack_evict(d, 0);
+		return 0;
+	}
+	/* Copied first: the name may be an entry that is about to go. */
+	if ((buf = malloc(name_len + value_len + 2)) == NULL)
+		return -1;
+	memcpy(buf, name, name_len);
+	buf[name_len] = '\0';
+	memcpy(buf + name_len + 1, value, value_len);
+	buf[name_len + 1 + value_len] = '\0';
+	hpack_evict(d, d->max_size - need);
+	/* 32 bytes per entry at least: the ring cannot be full here. */
+	d->first = (d->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+	e = &d->ent[d->first];
+	e->name = buf;
+	e->name_len = name_len;
+	e->value_len = value_len;
+	d->count++;
+	d->size += need;
+	return 0;
+}
+
+/** Resolve index @p i of the combined address space (2.3.3). */
+static int
+hpack_lookup(const hpack_decoder_t *d, size_t i, const char **name,
+    size_t *name_len, const char **value, size_t *value_len)
+{
+	const hpack_entry_t *e;
+
+	if (i == 0)
+		return -1;
+	if (i <= HPACK_STATIC_COUNT) {
+		*name = hpack_static[i].name;
+		*name_len = strlen(*name);
+		*value = hpack_static[i].value;
+		*value_len = strlen(*value);
+		return 0;
+	}
+	i -= HPACK_STATIC_COUNT + 1;
+	if (i >= d->count)
+		return -1;
+	e = &d->ent[(d->first + i) % HPACK_MAX_ENTRIES];
+	*name = e->name;
+	*name_len = e->name_len;
+	*value = e->name + e->name_len + 1;
+	*value_len = e->value_len;
+	return 0;
+}
+
+int
+hpack_decode(hpack_decoder_t *d, const uint8_t *block, size_t len,
+    hpack_emit_t emit, void *ctx)
+{
+	const uint8_t *p = block, *end = block + len;
+	char *scratch, *sp, *send;
+	int fields = 0, rc = 0;
+
+	/* Huffman codes are 5 bits at least: 8/5 of the block holds all. */
+	if ((scratch = malloc(len * 8 / 5 + 1)) == NULL)
+		return -1;
+	sp = scratch;
+	send = scratch + len * 8 / 5 + 1;
+	while (p < end && rc == 0) {
+		const char *name, *value;
+		size_t name_len, value_len, i;
+		uint8_t c = *p;
+		int prefix, index;
+
+		if (c & 0x80) {
+			/* Indexed field. */
+			if (hpack_int(&p, end, 7, &i) == -1 ||
+			    hpack_lookup(d, i, &name, &name_len, &value,
+			    &value_len) == -1)
+				goto fail;
+			fields++;
+			rc = emit(name, name_len, value, value_len, ctx);
+			continue;
+		}
+		if ((c & 0xe0) == 0x20) {
+			/* Table size update: only before the first field. */
+			if (fields > 0 || hpack_int(&p, end, 5, &i) == -1 ||
+			    i > d->limit)
+				goto fail;
+			d->max_size = i;
+			hpack_evict(d, i);
+			continue;
+		}
+		/* Literal: with incremental indexing, without or never. */
+		index = (c & 0xc0) == 0x40;
+		prefix = index ? 6 : 4;
+		if (hpack_int(&p, end, prefix, &i) == -1)
+			goto fail;
+		if (i > 0) {
+			const char *unused;
+			size_t unused_len;
+
+			if (hpack_lookup(d, i, &name, &name_len, &unused,
+			    &unused_len) == -1)
+				goto fail;
+		} else if (hpack_string(&p, end, &sp, send, &name,
+		    &name_len) == -1)
+			goto fail;
+		if (hpack_string(&p, end, &sp, send, &value, &value_len) == -1)
+			goto fail;
+		fields++;
+		rc = emit(name, name_len, value, value_len, ctx);
+		/* After the emitter: insertion may evict what it points at. */
+		if (index && hpack_insert(d, name, name_len, value,
+		    value_len) == -1)
+			goto fail;
+	}
+	free(scratch);
+	return rc;
+fail:
+	free(scratch);
+	return -1;
+}
+
+/** Write @p v with an @p n bit prefix, OR-ing @p flags into the first. */
+static size_t
+hpack_put_int(uint8_t *dst, uint8_t flags, int n, size_t v)
+{
+	size_t max = ((size_t)1 << n) - 1, len = 0;
+
+	if (v < max) {
+		dst[len++] = flags | (uint8_t)v;
+		return len;
+	}
+	dst[len++] = flags | (uint8_t)max;
+	for (v -= max; v >= 0x80; v >>= 7)
+		dst[len++] = (uint8_t)(v & 0x7f) | 0x80;
+	dst[len++] = (uint8_t)v;
+	return len;
+}
+
+static size_t
+hpack_put_string(uint8_t *dst, const char *s, size_t len)
+{
+	size_t n = hpack_put_int(dst, 0, 7, len);
+
+	memcpy(dst + n, s, len);
+	return n + len;
+}
+
+size_t
+hpack_encode(uint8_t *dst, size_t cap, const char *name, size_t name_len,
+    const char *value, size_t value_len)
+{
+	size_t name_index = 0, n;
+
+	if (cap < hpack_encoded_max(name_len, value_len))
+		return 0;
+	for (size_t i = 1; i <= HPACK_STATIC_COUNT; i++) {
+		if (strlen(hpack_static[i].name) != name_len ||
+		    memcmp(hpack_static[i].name, name, name_len) != 0)
+			continue;
+		if (strlen(hpack_static[i].value) == value_len &&
+		    memcmp(hpack_static[i].value, value, value_len) == 0)
+			return hpack_put_int(dst, 0x80, 7, i);
+		if (name_index == 0)
+			name_index = i;
+	}
+	/* Literal without indexing, the name from the table if it is there. */
+	n = hpack_put_int(dst, 0x00, 4, name_index);
+	if (name_index == 0)
+		n += hpack_put_string(dst + n, name, name_len);
+	n += hpack_put_string(dst + n, value, value_len);
+	return n;
+}
@@ -0,0 +1,242 @@
+/* json.c - Growable single-pass JSON writer */
+
+#include <miniweb/http/json.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MIN_CAP	256
+
+/*
+ * What each byte becomes inside a string: 0 copies it, 'u' writes
+ * \u00XX, anything else is the letter after the backslash. Bytes from
+ * 0x80 up are copied, so UTF-8 passes through unchanged.
+ */
+static const char json_esc[256] = {
+	['\0'] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u',
+	[0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+	['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0b] = 'u',
+	['\f'] = 'f', ['\r'] = 'r', [0x0e] = 'u', [0x0f] = 'u',
+	[0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+	[0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u',
+	[0x18] = 'u', [0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u',
+	[0x1c] = 'u', [0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
+
+static const char json_hex[16] = "0123456789abcdef";
+
+/** Poison @p w, releasing a malloc'd buffer. */
+static void
+json_fail(json_writer_t *w)
+{
+	if (!w->arena)
+		free(w->buf);
+	w->buf = NULL;
+	w->len = w->cap = 0;
+	w->failed = 1;
+}
+
+/** Grow @p w to hold @p n more bytes and a NUL; -1 once failed. */
+static int
+json_grow(json_writer_t *w, size_t n)
+{
+	size_t cap;
+	char *buf;
+
+	if (w->failed)
+		return -1;
+	if (n < w->cap - w->len)
+		return 0;
+	if (n > SIZE_MAX / 2 - w->len) {
+		json_fail(w);
+		return -1;
+	}
+	cap = w->cap ? w->cap : JSON_MIN_CAP;
+	while (cap <= w->len + n)
+		cap *= 2;
+	if (w->arena) {
+		/* The old block stays in the arena until its reset. */
+		buf = http_arena_alloc(w->arena, cap);
+		if (buf && w->len)
+			memcpy(buf, w->buf, w->len + 1);
+	} else {
+		buf = realloc(w->buf, cap);
+	}
+	if (!buf) {
+		json_fail(w);
+		return -1;
+	}
+	w->buf = buf;
+	w->cap = cap;
+	return 0;
+}
+
+int
+json_init(json_writer_t *w, http_arena_t *arena, size_t hint)
+{
+	memset(w, 0, sizeof(*w));
+	w->arena = arena;
+	if (json_grow(w, hint) != 0)
+		return -1;
+	w->buf[0] = '\0';
+	return 0;
+}
+
+char *
+json_reserve(json_writer_t *w, size_t n)
+{
+	if (json_grow(w, n) != 0)
+		return NULL;
+	return w->buf + w->len;
+}
+
+void
+json_commit(json_writer_t *w, size_t n)
+{
+	if (w->failed || n >= w->cap - w->len)
+		return;
+	w->len += n;
+	w->buf[w->len] = '\0';
+}
+
+void
+json_raw(json_writer_t *w, const char *s, size_t len)
+{
+	if (json_grow(w, len) != 0)
+		return;
+	memcpy(w->buf + w->len, s, len);
+	w->len += len;
+	w->buf[w->len] = '\0';
+}
+
+void
+json_puts(json_writer_t *w, const char *s)
+{
+	json_raw(w, s, strlen(s));
+}
+
+void
+json_putc(json_writer_t *w, char c)
+{
+	json_raw(w, &c, 1);
+}
+
+void
+json_printf(json_writer_t *w, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (json_grow(w, 0) != 0)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		w->buf[w->len] = '\0';
+		return;
+	}
+	if ((size_t)n >= w->cap - w->len) {
+		/* Didn't fit: grow once to the exact size and format again. */
+		if (json_grow(w, (size_t)n) != 0)
+			return;
+		va_start(ap, fmt);
+		(void)vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+		va_end(ap);
+	}
+	w->len += (size_t)n;
+}
+
+size_t
+json_escaped_len(const char *s, size_t len)
+{
+	size_t n = len;
+
+	for (size_t i = 0; i < len; i++) {
+		char e = json_esc[(unsigned char)s[i]];
+
+		if (e)
+			n += e == 'u' ? 5 : 1;
+	}
+	return n;
+}
+
+char *
+json_escape_put(char *dst, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)s[i];
+		char e = json_esc[c];
+
+		if (!e) {
+			*dst++ = (char)c;
+			continue;
+		}
+		*dst++ = '\\';
+		if (e == 'u') {
+			memcpy(dst, "u00", 3);
+			dst[3] = json_hex[c >> 4];
+			dst[4] = json_hex[c & 0xf];
+			dst += 5;
+		} else {
+			*dst++ = e;
+		}
+	}
+	return dst;
+}
+
+void
+json_escaped(json_writer_t *w, const char *s, size_t len)
+{
+	size_t n = json_escaped_len(s, len);
+
+	if (json_grow(w, n) != 0)
+		return;
+	if (n == len)
+		memcpy(w->buf + w->len, s, len);
+	else
+		(void)json_escape_put(w->buf + w->len, s, len);
+	w->len += n;
+	w->buf[w->len] = '\0';
+}
+
+void
+json_str(json_writer_t *w, const char *s)
+{
+	if (!s) {
+		json_raw(w, "null", 4);
+		return;
+	}
+	json_putc(w, '"');
+	json_escaped(w, s, strlen(s));
+	json_putc(w, '"');
+}
+
+char *
+json_finish(json_writer_t *w, size_t *len)
+{
+	char *buf;
+
+	if (w->failed || json_grow(w, 0) != 0)
+		return NULL;
+	buf = w->buf;
+	buf[w->len] = '\0';
+	if (len)
+		*len = w->len;
+	w->buf = NULL;
+	w->len = w->cap = 0;
+	return buf;
+}
+
+void
+json_discard(json_writer_t *w)
+{
+	if (!w->arena)
+		free(w->buf);
+	w->buf = NULL;
+	w->len = w->cap = 0;
+}
@@ -0,0 +1,79 @@
+/* mime.c - content types by file extension */
+
+#include <string.h>
+
+#include <miniweb/http/utils.h>
+
+/*
+ * Kept apart from utils.c so the asset bundler, built before the server,
+ * can link it and record the same type the server would pick.
+ */
+
+/**
+ * @brief mime_type_for_path operation.
+ *
+ * @details Performs the core mime_type_for_path routine for this module.
+ *
+ * @param path Input parameter for mime_type_for_path.
+ *
+ * @return Return value produced by mime_type_for_path.
+ */
+const char *
+mime_type_for_path(const char *path)
+{
+	const char *ext;
+
+	if (!path)
+		return "application/octet-stream";
+
+	ext = strrchr(path, '.');
+	if (!ext)
+		return "application/octet-stream";
+
+	if (strcmp(ext, ".html") == 0)
+		return "text/html";
+	if (strcmp(ext, ".css") == 0)
+		return "text/css";
+	if (strcmp(ext, ".js") == 0)
+		return "application/javascript";
+	if (strcmp(ext, ".png") == 0)
+		return "image/png";
+	if (strcmp(ext, ".svg") == 0)
+		return "image/svg+xml";
+	if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0)
+		return "image/jpeg";
+	if (strcmp(ext, ".gif") == 0)
+		return "image/gif";
+	if (strcmp(ext, ".ico") == 0)
+		return "image/x-icon";
+	if (strcmp(ext, ".pdf") == 0)
+		return "application/pdf";
+	if (strcmp(ext, ".ps") == 0)
+		return "application/postscript";
+	if (strcmp(ext, ".md") == 0)
+		return "text/markdown; charset=utf-8";
+	if (strcmp(ext, ".txt") == 0)
+		return "text/plain; charset=utf-8";
+
+	return "application/octet-stream";
+}
+
+/**
+ * @brief Tell whether a content type benefits from gzip.
+ *
+ * @param mime Content type as returned by mime_type_for_path().
+ *
+ * @return 1 for text, JavaScript, JSON and SVG, otherwise 0.
+ */
+int
+mime_type_is_compressible(const char *mime)
+{
+	if (!mime)
+		return 0;
+	if (strncmp(mime, "text/", 5) == 0)
+		return 1;
+	if (strncmp(mime, "application/javascript", 22) == 0 ||
+	    strncmp(mime, "application/json", 16) == 0)
+		return 1;
+	return strncmp(mime, "image/svg+xml", 13) == 0;
+}
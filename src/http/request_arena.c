@@ -0,0 +1,153 @@
+#include <miniweb/http/arena.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN	16
+#define ARENA_HDR	((sizeof(http_arena_chunk_t) + ARENA_ALIGN - 1) & \
+			    ~(size_t)(ARENA_ALIGN - 1))
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static int arena_key_ok;
+
+/** Usable bytes of @p c start right after its aligned header. */
+static char *
+chunk_data(http_arena_chunk_t *c)
+{
+	return (char *)c + ARENA_HDR;
+}
+
+/** Push a fresh chunk able to hold at least @p need bytes. */
+static http_arena_chunk_t *
+arena_grow(http_arena_t *a, size_t need)
+{
+	size_t cap = need > HTTP_ARENA_CHUNK ? need : HTTP_ARENA_CHUNK;
+	if (cap > SIZE_MAX - ARENA_HDR)
+		return NULL;
+	http_arena_chunk_t *c = malloc(ARENA_HDR + cap);
+	if (!c)
+		return NULL;
+	c->next = a->head;
+	c->cap = cap;
+	c->used = 0;
+	a->head = c;
+	return c;
+}
+
+void *
+http_arena_alloc(http_arena_t *a, size_t len)
+{
+	if (!a)
+		return NULL;
+	if (len == 0)
+		len = 1;
+	if (len > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+	size_t want = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	http_arena_chunk_t *c = a->head;
+	if (!c || c->cap - c->used < want) {
+		c = arena_grow(a, want);
+		if (!c)
+			return NULL;
+	}
+	void *p = chunk_data(c) + c->used;
+	c->used += want;
+	a->bytes += want;
+	return p;
+}
+
+char *
+http_arena_strndup(http_arena_t *a, const char *src, size_t len)
+{
+	char *dst = http_arena_alloc(a, len + 1);
+	if (!dst)
+		return NULL;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	return dst;
+}
+
+char *
+http_arena_strdup(http_arena_t *a, const char *src)
+{
+	return src ? http_arena_strndup(a, src, strlen(src)) : NULL;
+}
+
+/**
+ * Keep only the oldest chunk when it is the standard size; anything a
+ * single large response forced us to allocate is returned at once.
+ */
+void
+http_arena_reset(http_arena_t *a)
+{
+	if (!a)
+		return;
+	if (a->bytes > a->peak)
+		a->peak = a->bytes;
+	a->bytes = 0;
+
+	http_arena_chunk_t *keep = NULL;
+	http_arena_chunk_t *c = a->head;
+	while (c) {
+		http_arena_chunk_t *next = c->next;
+		if (!next && c->cap == HTTP_ARENA_CHUNK) {
+			keep = c;
+			keep->used = 0;
+		} else {
+			free(c);
+		}
+		c = next;
+	}
+	a->head = keep;
+}
+
+void
+http_arena_destroy(http_arena_t *a)
+{
+	if (!a)
+		return;
+	while (a->head) {
+		http_arena_chunk_t *next = a->head->next;
+		free(a->head);
+		a->head = next;
+	}
+	a->bytes = 0;
+}
+
+/** pthread_key destructor: runs when a worker thread exits. */
+static void
+arena_thread_free(void *p)
+{
+	http_arena_destroy(p);
+	free(p);
+}
+
+static void
+arena_key_init(void)
+{
+	arena_key_ok = pthread_key_create(&arena_key, arena_thread_free) == 0;
+}
+
+http_arena_t *
+http_arena_thread(void)
+{
+	(void)pthread_once(&arena_once, arena_key_init);
+	if (!arena_key_ok)
+		return NULL;
+
+	http_arena_t *a = pthread_getspecific(arena_key);
+	if (a)
+		return a;
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return NULL;
+	if (pthread_setspecific(arena_key, a) != 0) {
+		free(a);
+		return NULL;
+	}
+	return a;
+}
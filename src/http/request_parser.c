@@ -0,0 +1,232 @@
+#include <miniweb/http/request_parser.h>
+
+#include <string.h>
+#include <strings.h>
+
+/** Return 1 when [s, s+len) equals the literal @p lit, ignoring case. */
+static int
+span_ieq(const char *s, size_t len, const char *lit)
+{
+	size_t n = strlen(lit);
+	return len == n && strncasecmp(s, lit, n) == 0;
+}
+
+static const char *const http_method_names[HTTP_METHOD_COUNT] = {
+	[HTTP_METHOD_GET] = "GET",
+	[HTTP_METHOD_HEAD] = "HEAD",
+	[HTTP_METHOD_POST] = "POST",
+	[HTTP_METHOD_PUT] = "PUT",
+	[HTTP_METHOD_DELETE] = "DELETE",
+	[HTTP_METHOD_OPTIONS] = "OPTIONS",
+	[HTTP_METHOD_PATCH] = "PATCH",
+};
+
+/** HTTP_METHOD_* for the @p len bytes at @p s; methods are case-sensitive. */
+int
+http_method_parse(const char *s, size_t len)
+{
+	for (int m = HTTP_METHOD_OTHER + 1; m < HTTP_METHOD_COUNT; m++) {
+		if (strlen(http_method_names[m]) == len &&
+		    memcmp(http_method_names[m], s, len) == 0)
+			return m;
+	}
+	return HTTP_METHOD_OTHER;
+}
+
+/** Canonical name of @p method, or NULL for HTTP_METHOD_OTHER. */
+const char *
+http_method_name(int method)
+{
+	if (method <= HTTP_METHOD_OTHER || method >= HTTP_METHOD_COUNT)
+		return NULL;
+	return http_method_names[method];
+}
+
+/** "HTTP/1.0" or "HTTP/1.1", or NULL for HTTP_VERSION_OTHER. */
+const char *
+http_version_name(int version)
+{
+	switch (version) {
+	case HTTP_VERSION_1_0:
+		return "HTTP/1.0";
+	case HTTP_VERSION_1_1:
+		return "HTTP/1.1";
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Split "METHOD SP URL SP VERSION" into offsets and intern the method
+ * and version; -1 on malformed input.
+ */
+static int
+parse_request_line(http_request_parser_t *p, const char *buf, size_t start,
+    size_t end)
+{
+	const char *line = buf + start;
+	size_t len = end - start;
+	const char *sp1 = memchr(line, ' ', len);
+	if (!sp1 || sp1 == line)
+		return -1;
+	const char *rest = sp1 + 1;
+	const char *sp2 = memchr(rest, ' ', len - (size_t)(rest - line));
+	if (!sp2 || sp2 == rest || sp2 + 1 == line + len)
+		return -1;
+
+	size_t mlen = (size_t)(sp1 - line);
+	size_t ulen = (size_t)(sp2 - rest);
+	size_t vlen = len - (size_t)(sp2 + 1 - line);
+	if (mlen >= HTTP_PARSER_METHOD_MAX || ulen >= HTTP_PARSER_URL_MAX ||
+	    vlen >= HTTP_PARSER_VERSION_MAX)
+		return -1;
+	p->method_off = (uint16_t)start;
+	p->method_len = (uint16_t)mlen;
+	p->url_off = (uint16_t)(rest - buf);
+	p->url_len = (uint16_t)ulen;
+	p->version_off = (uint16_t)(sp2 + 1 - buf);
+	p->version_len = (uint16_t)vlen;
+
+	const char *q = memchr(rest, '?', ulen);
+	p->path_len = (uint16_t)(q ? (size_t)(q - rest) : ulen);
+	p->method = (uint8_t)http_method_parse(line, mlen);
+	if (span_ieq(sp2 + 1, vlen, "HTTP/1.1"))
+		p->version = HTTP_VERSION_1_1;
+	else if (span_ieq(sp2 + 1, vlen, "HTTP/1.0"))
+		p->version = HTTP_VERSION_1_0;
+	else
+		p->version = HTTP_VERSION_OTHER;
+	return 0;
+}
+
+/**
+ * Note the body framing a Content-Length or Transfer-Encoding line
+ * announces. Transfer-Encoding wins over any length; a length that is
+ * not all digits, or differs from an earlier one, makes it invalid.
+ */
+static void
+parse_body_framing(http_request_parser_t *p, const char *name,
+    size_t name_len, const char *v, size_t vlen)
+{
+	uint64_t n = 0;
+
+	if (span_ieq(name, name_len, "Transfer-Encoding")) {
+		p->body = HTTP_BODY_CHUNKED;
+		return;
+	}
+	if (!span_ieq(name, name_len, "Content-Length") ||
+	    p->body == HTTP_BODY_CHUNKED || p->body == HTTP_BODY_INVALID)
+		return;
+	if (vlen == 0)
+		n = HTTP_BODY_LENGTH_MAX;
+	for (size_t i = 0; i < vlen && n < HTTP_BODY_LENGTH_MAX; i++) {
+		if (v[i] < '0' || v[i] > '9')
+			n = HTTP_BODY_LENGTH_MAX;
+		else
+			n = n * 10 + (uint64_t)(v[i] - '0');
+	}
+	if (n >= HTTP_BODY_LENGTH_MAX ||
+	    (p->body == HTTP_BODY_LENGTH && p->content_length != n)) {
+		p->body = HTTP_BODY_INVALID;
+		p->content_length = 0;
+		return;
+	}
+	p->body = HTTP_BODY_LENGTH;
+	p->content_length = n;
+}
+
+/** Record one "Name: value" line; lines without a colon are ignored. */
+static void
+parse_header_line(http_request_parser_t *p, const char *buf, size_t start,
+    size_t end)
+{
+	const char *line = buf + start;
+	const char *colon = memchr(line, ':', end - start);
+	if (!colon || colon == line)
+		return;
+
+	size_t name_len = (size_t)(colon - line);
+	size_t v = (size_t)(colon + 1 - buf);
+	size_t vend = end;
+	while (v < vend && (buf[v] == ' ' || buf[v] == '\t'))
+		v++;
+	while (vend > v && (buf[vend - 1] == ' ' || buf[vend - 1] == '\t'))
+		vend--;
+
+	if (p->connection == HTTP_CONN_DEFAULT &&
+	    span_ieq(line, name_len, "Connection")) {
+		if (vend - v >= 5 && strncasecmp(buf + v, "close", 5) == 0)
+			p->connection = HTTP_CONN_CLOSE;
+		else if (vend - v >= 10 && strncasecmp(buf + v, "keep-alive", 10) == 0)
+			p->connection = HTTP_CONN_KEEP_ALIVE;
+	}
+	parse_body_framing(p, line, name_len, buf + v, vend - v);
+	if (p->header_count >= HTTP_PARSER_MAX_HEADERS)
+		return;
+	http_header_span_t *h = &p->headers[p->header_count++];
+	h->name_off = (uint16_t)start;
+	h->name_len = (uint16_t)name_len;
+	h->value_off = (uint16_t)v;
+	h->value_len = (uint16_t)(vend - v);
+}
+
+/** Reset parser state for a new request. */
+void
+http_request_parser_reset(http_request_parser_t *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+/** Resume scanning at p->pos; see request_parser.h for return codes. */
+int
+http_request_parser_feed(http_request_parser_t *p, const char *buf, size_t len)
+{
+	if (p->state == HTTP_PARSER_DONE)
+		return 1;
+	if (p->state == HTTP_PARSER_ERROR)
+		return -1;
+
+	while (p->pos < len) {
+		const char *nl = memchr(buf + p->pos, '\n', len - p->pos);
+		if (!nl) {
+			p->pos = len;
+			return 0;
+		}
+		size_t eol = (size_t)(nl - buf);
+		size_t end = eol;
+		if (end > p->line_start && buf[end - 1] == '\r')
+			end--;
+		p->pos = eol + 1;
+
+		if (p->state == HTTP_PARSER_REQUEST_LINE) {
+			if (end == p->line_start) {
+				/* Tolerate stray CRLF before the request line. */
+				p->line_start = p->pos;
+				continue;
+			}
+			if (parse_request_line(p, buf, p->line_start, end) != 0) {
+				p->state = HTTP_PARSER_ERROR;
+				return -1;
+			}
+			p->state = HTTP_PARSER_HEADERS;
+		} else if (end == p->line_start) {
+			p->state = HTTP_PARSER_DONE;
+			p->head_len = p->pos;
+			return 1;
+		} else {
+			parse_header_line(p, buf, p->line_start, end);
+		}
+		p->line_start = p->pos;
+	}
+	return 0;
+}
+
+/** Resolve keep-alive from the parsed version and Connection header. */
+int
+http_request_parser_keep_alive(const http_request_parser_t *p, const char *buf)
+{
+	(void)buf;
+	if (p->connection != HTTP_CONN_DEFAULT)
+		return p->connection == HTTP_CONN_KEEP_ALIVE;
+	return p->version == HTTP_VERSION_1_1;
+}
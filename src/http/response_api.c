@@ -2,6 +2,7 @@
 
 #include <miniweb/core/log.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,12 +21,8 @@ http_response_create(void)
 
 	http_handler_globals_init_once();
 	resp = http_response_pool_acquire();
-	if (!resp) {
-		resp = calloc(1, sizeof(*resp));
-		if (!resp)
-			return NULL;
-		resp->pool_shard_idx = -1;
-	}
+	if (!resp)
+		return NULL;
 
 	resp->status_code = 200;
 	resp->content_type = "text/html; charset=utf-8";
@@ -78,18 +75,55 @@ void
 http_response_add_header(http_response_t *resp, const char *name,
     const char *value)
 {
-	int len;
-	size_t space;
+	size_t nlen = strlen(name);
+	size_t vlen = strlen(value);
+	char *p;
 
-	if (resp->headers_len >= sizeof(resp->headers))
+	/* A header that does not fit is dropped whole, never truncated. */
+	if (resp->headers_len >= sizeof(resp->headers) ||
+	    nlen + vlen + 4 >= sizeof(resp->headers) - resp->headers_len)
 		return;
-	space = sizeof(resp->headers) - resp->headers_len;
-	len = snprintf(resp->headers + resp->headers_len, space,
-	    "%s: %s\r\n", name, value);
-	if (len > 0 && (size_t)len < space)
-		resp->headers_len += (size_t)len;
-	else if (space > 0)
-		resp->headers_len = sizeof(resp->headers) - 1;
+	p = resp->headers + resp->headers_len;
+	memcpy(p, name, nlen);
+	p += nlen;
+	*p++ = ':';
+	*p++ = ' ';
+	memcpy(p, value, vlen);
+	p += vlen;
+	*p++ = '\r';
+	*p++ = '\n';
+	*p = '\0';
+	resp->headers_len = (size_t)(p - resp->headers);
+}
+
+/**
+ * @brief Write a serialized header block and optional body.
+ *
+ * @details The iovecs hold the header block, possibly in pieces, then
+ * the body if any. Connections with an output queue never block.
+ *
+ * @return 0 on success, -1 on write failure.
+ */
+int
+http_response_emit(http_request_t *req, struct iovec *iov, int iovcnt)
+{
+	if (req->out) {
+		/* Whatever the socket refuses is flushed on EVFILT_WRITE. */
+		if (http_output_writev(req->out, req->fd, iov, iovcnt) < 0) {
+			log_error("[HTTP] Error writing response");
+			return -1;
+		}
+	} else if (iovcnt > 1) {
+		if (http_response_writev_all(req->fd, iov, iovcnt) < 0) {
+			log_error("[HTTP] Error writing response");
+			return -1;
+		}
+	} else if (http_response_write_all(req->fd, iov[0].iov_base,
+	    iov[0].iov_len) < 0) {
+		log_error("[HTTP] Error writing headers");
+		return -1;
+	}
+	return 0;
 }
 
 /**
@@ -108,50 +142,209 @@ http_response_send(http_request_t *req, http_response_t *resp)
 	char header[4096];
 	struct iovec iov[2];
 	int header_len;
-	size_t space;
-	size_t used;
-
-	header_len = snprintf(header, sizeof(header),
-	    "HTTP/1.1 %d %s\r\n"
-	    "Content-Type: %s\r\n"
-	    "Content-Length: %zu\r\n"
-	    "Connection: %s\r\n"
-	    "Server: MiniWeb/kqueue\r\n",
-	    resp->status_code, http_response_status_text(resp->status_code),
-	    resp->content_type, resp->body_len,
-	    req->keep_alive ? "keep-alive" : "close");
-	if (header_len < 0 || (size_t)header_len >= sizeof(header))
+
+	header_len = http_response_format_head(resp, req->keep_alive, header,
+	    sizeof(header) - HTTP_HEAD_END_MAX);
+	if (header_len < 0)
 		return -1;
+	header_len += (int)http_response_head_end(header + header_len);
+	iov[1].iov_base = resp->body;
+	iov[1].iov_len = resp->body_len;
+	if (!resp->body && resp->body_len > 0)
+		http_response_capture_drop(req);
+	else if (req->capture_max > 0)
+		http_response_capture(req, resp, &iov[1], 1);
+	req->status = resp->status_code;
+	req->bytes_out += (size_t)header_len + resp->body_len;
 
-	if (resp->headers_len > 0) {
-		used = (size_t)header_len;
-		space = sizeof(header) - used;
-		if (resp->headers_len < space) {
-			memcpy(header + used, resp->headers, resp->headers_len);
-			header_len += (int)resp->headers_len;
-		}
+	if (req->out && !resp->body && resp->body_len > 0) {
+		/* The caller streams the body next; send both in one go. */
+		return http_output_queue(req->out, header, (size_t)header_len);
 	}
-	if ((size_t)header_len + 2 >= sizeof(header))
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = (size_t)header_len;
+	return http_response_emit(req, iov,
+	    (resp->body && resp->body_len > 0) ? 2 : 1);
+}
+
+/**
+ * @brief Send @p resp with its body taken from @p body.
+ *
+ * @details Head and spans leave in one writev; whatever the socket does
+ * not take is copied into the output queue, so the spans need only live
+ * for the duration of the call.
+ *
+ * @return 0 on success, -1 on write failure or too many spans.
+ */
+int
+http_response_send_iov(http_request_t *req, http_response_t *resp,
+    const struct iovec *body, int iovcnt)
+{
+	char header[4096];
+	struct iovec iov[HTTP_SEND_IOV_MAX + 1];
+	int header_len;
+	int n = 1;
+
+	if (iovcnt < 0 || iovcnt > HTTP_SEND_IOV_MAX)
 		return -1;
-	header[header_len++] = '\r';
-	header[header_len++] = '\n';
+	resp->body_len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		resp->body_len += body[i].iov_len;
+
+	header_len = http_response_format_head(resp, req->keep_alive, header,
+	    sizeof(header) - HTTP_HEAD_END_MAX);
+	if (header_len < 0)
+		return -1;
+	header_len += (int)http_response_head_end(header + header_len);
+	if (req->capture_max > 0)
+		http_response_capture(req, resp, body, iovcnt);
+	req->status = resp->status_code;
+	req->bytes_out += (size_t)header_len + resp->body_len;
 
 	iov[0].iov_base = header;
 	iov[0].iov_len = (size_t)header_len;
-	iov[1].iov_base = resp->body;
-	iov[1].iov_len = resp->body_len;
+	for (int i = 0; i < iovcnt; i++) {
+		if (body[i].iov_len > 0)
+			iov[n++] = body[i];
+	}
+	return http_response_emit(req, iov, n);
+}
 
-	if (resp->body && resp->body_len > 0) {
-		if (http_response_writev_all(req->fd, iov, 2) < 0) {
-			log_error("[HTTP] Error writing response");
-			return -1;
-		}
-	} else if (http_response_write_all(req->fd, header, (size_t)header_len) <
-	    0) {
-		log_error("[HTTP] Error writing headers");
+/**
+ * @brief Send the head of a response whose body follows in pieces.
+ *
+ * @details HTTP/1.0 clients cannot parse chunked encoding; for them the
+ * body ends when the connection does, so keep-alive is turned off.
+ *
+ * @return 0 on success, -1 on write failure.
+ */
+int
+http_stream_begin(http_stream_t *s, http_request_t *req, http_response_t *resp)
+{
+	char header[4096];
+	struct iovec iov[1];
+	int header_len;
+
+	s->req = req;
+	s->failed = 0;
+	http_response_capture_drop(req);
+	if (req->version && strcmp(req->version, "HTTP/1.0") == 0) {
+		s->mode = HTTP_STREAM_CLOSE;
+		req->keep_alive = 0;
+	} else {
+		s->mode = HTTP_STREAM_CHUNKED;
+	}
+	resp->stream = s->mode;
+	resp->body_len = 0;
+
+	header_len = http_response_format_head(resp, req->keep_alive, header,
+	    sizeof(header) - HTTP_HEAD_END_MAX);
+	if (header_len < 0) {
+		s->failed = 1;
 		return -1;
 	}
+	header_len += (int)http_response_head_end(header + header_len);
+	req->status = resp->status_code;
+	req->bytes_out += (size_t)header_len;
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = (size_t)header_len;
+	if (http_response_emit(req, iov, 1) < 0)
+		s->failed = 1;
+	return s->failed ? -1 : 0;
+}
 
+/**
+ * @brief Send one piece of a streamed body.
+ *
+ * @return 0 on success, -1 once any write has failed.
+ */
+int
+http_stream_write(http_stream_t *s, const void *data, size_t len)
+{
+	struct iovec iov[1];
+
+	iov[0].iov_base = (void *)(uintptr_t)data;
+	iov[0].iov_len = len;
+	return http_stream_writev(s, iov, 1);
+}
+
+/**
+ * @brief Send the spans of @p body as the next piece of a streamed body.
+ *
+ * @details The spans make one chunk, framed around them in the same
+ * gather write, so a piece assembled from borrowed memory (a cached
+ * snapshot between literals, say) is never copied into a buffer first.
+ * With an output queue the write is non-blocking, then waits until no
+ * more than HTTP_STREAM_WINDOW bytes are still queued.
+ *
+ * @return 0 on success, -1 on too many spans or once any write has failed.
+ */
+int
+http_stream_writev(http_stream_t *s, const struct iovec *body, int iovcnt)
+{
+	char size_line[24];
+	struct iovec iov[HTTP_SEND_IOV_MAX + 2];
+	size_t len = 0;
+	int n = 0;
+
+	if (s->failed)
+		return -1;
+	if (iovcnt < 0 || iovcnt > HTTP_SEND_IOV_MAX)
+		return -1;
+	for (int i = 0; i < iovcnt; i++)
+		len += body[i].iov_len;
+	if (len == 0)
+		return 0;	/* a zero-size chunk would end the body */
+	if (s->mode == HTTP_STREAM_CHUNKED) {
+		iov[n].iov_base = size_line;
+		iov[n++].iov_len = (size_t)snprintf(size_line, sizeof(size_line),
+		    "%zx\r\n", len);
+	}
+	for (int i = 0; i < iovcnt; i++) {
+		if (body[i].iov_len > 0)
+			iov[n++] = body[i];
+	}
+	if (s->mode == HTTP_STREAM_CHUNKED) {
+		iov[n].iov_base = "\r\n";
+		iov[n++].iov_len = 2;
+	}
+	s->req->bytes_out += len;
+	if (http_response_emit(s->req, iov, n) < 0 ||
+	    http_response_drain(s->req, HTTP_STREAM_WINDOW) < 0) {
+		s->failed = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Finish a streamed body with the last chunk.
+ *
+ * @details A failed stream leaves the client with a truncated body; the
+ * caller should not reuse the connection.
+ *
+ * @return 0 when the whole body was sent or queued, -1 otherwise.
+ */
+int
+http_stream_end(http_stream_t *s)
+{
+	struct iovec iov[1];
+
+	if (s->failed) {
+		s->req->keep_alive = 0;
+		return -1;
+	}
+	if (s->mode != HTTP_STREAM_CHUNKED)
+		return 0;
+	iov[0].iov_base = "0\r\n\r\n";
+	iov[0].iov_len = 5;
+	if (http_response_emit(s->req, iov, 1) < 0) {
+		s->failed = 1;
+		s->req->keep_alive = 0;
+		return -1;
+	}
 	return 0;
 }
 
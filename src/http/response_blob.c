@@ -0,0 +1,172 @@
+#include <miniweb/http/response_internal.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Allocate a blob for @p len body bytes holding one reference.
+ *
+ * @details The caller fills data[] and prepares the headers before the
+ * blob is shared; neither changes afterwards.
+ *
+ * @return New blob, or NULL on allocation failure.
+ */
+http_blob_t *
+http_blob_alloc(size_t len)
+{
+	http_blob_t *blob;
+
+	if (len >= SIZE_MAX - sizeof(*blob))
+		return NULL;
+	blob = malloc(sizeof(*blob) + len + 1);
+	if (!blob)
+		return NULL;
+	blob->refs = 1;
+	blob->status = 0;
+	blob->head_len[0] = blob->head_len[1] = 0;
+	blob->len = len;
+	blob->data[len] = '\0';
+	return blob;
+}
+
+/** Take another reference on @p blob and return it. */
+http_blob_t *
+http_blob_ref(http_blob_t *blob)
+{
+	__atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+	return blob;
+}
+
+/** Drop one reference; the last holder frees the blob. */
+void
+http_blob_release(http_blob_t *blob)
+{
+	if (blob && __atomic_sub_fetch(&blob->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(blob);
+}
+
+/**
+ * @brief Serialize the keep-alive and close header blocks for @p blob.
+ *
+ * @details Status, content type and extra headers come from @p resp; the
+ * Content-Length is always the blob's own. The Date line is added per
+ * send.
+ *
+ * @return 0 on success, -1 when a header block exceeds HTTP_BLOB_HEAD_MAX.
+ */
+int
+http_blob_prepare(http_blob_t *blob, const http_response_t *resp)
+{
+	http_response_t tmpl = *resp;
+	int n;
+
+	tmpl.body_len = blob->len;
+	blob->status = resp->status_code;
+	for (int ka = 0; ka < 2; ka++) {
+		n = http_response_format_head(&tmpl, ka, blob->head[ka],
+		    sizeof(blob->head[ka]));
+		if (n < 0) {
+			blob->head_len[0] = blob->head_len[1] = 0;
+			return -1;
+		}
+		blob->head_len[ka] = (size_t)n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Whether the response about to go out on @p req may be kept:
+ * the request asked for a copy, nothing was sent before it, and it is
+ * a 200 with a body of at most req->capture_max bytes.
+ */
+static int
+capture_wanted(http_request_t *req, int status, size_t len)
+{
+	if (req->capture_max == 0)
+		return 0;
+	if (req->bytes_out > 0 || status != 200 || len > req->capture_max) {
+		http_response_capture_drop(req);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Keep a copy of a response sent with a complete body, for the
+ * router's response cache.
+ *
+ * @details The body is gathered from @p body into a blob prepared from
+ * @p resp's head. A response that sets a cookie or forbids storing is
+ * never kept. Called before the send accounts for its bytes.
+ */
+void
+http_response_capture(http_request_t *req, const http_response_t *resp,
+    const struct iovec *body, int iovcnt)
+{
+	http_blob_t *blob;
+	size_t len = 0, off = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		len += body[i].iov_len;
+	if (!capture_wanted(req, resp->status_code, len))
+		return;
+	if (strstr(resp->headers, "Set-Cookie:") != NULL ||
+	    strstr(resp->headers, "no-store") != NULL ||
+	    (blob = http_blob_alloc(len)) == NULL) {
+		http_response_capture_drop(req);
+		return;
+	}
+	for (int i = 0; i < iovcnt; i++) {
+		if (body[i].iov_len == 0)
+			continue;
+		memcpy(blob->data + off, body[i].iov_base, body[i].iov_len);
+		off += body[i].iov_len;
+	}
+	if (http_blob_prepare(blob, resp) < 0) {
+		http_blob_release(blob);
+		http_response_capture_drop(req);
+		return;
+	}
+	req->captured = blob;
+}
+
+/**
+ * @brief Stop keeping a copy of what @p req sends: its answer is not
+ * one response with a known body, or not one worth keeping.
+ */
+void
+http_response_capture_drop(http_request_t *req)
+{
+	req->capture_max = 0;
+	http_blob_release(req->captured);
+	req->captured = NULL;
+}
+
+/**
+ * @brief Send @p blob: the precomputed head, the cached Date line and
+ * the body, with no formatting.
+ *
+ * @return 0 on success, -1 on write failure or an unprepared blob.
+ */
+int
+http_blob_send(http_request_t *req, const http_blob_t *blob)
+{
+	char tail[HTTP_HEAD_END_MAX];
+	struct iovec iov[3];
+	int ka = req->keep_alive ? 1 : 0;
+
+	if (blob->head_len[ka] == 0)
+		return -1;
+	iov[0].iov_base = (char *)blob->head[ka];
+	iov[0].iov_len = blob->head_len[ka];
+	iov[1].iov_base = tail;
+	iov[1].iov_len = http_response_head_end(tail);
+	iov[2].iov_base = (char *)blob->data;
+	iov[2].iov_len = blob->len;
+	if (capture_wanted(req, blob->status, blob->len))
+		req->captured = http_blob_ref((http_blob_t *)blob);
+	req->status = blob->status;
+	req->bytes_out += iov[0].iov_len + iov[1].iov_len + blob->len;
+	return http_response_emit(req, iov, blob->len > 0 ? 3 : 2);
+}
@@ -1,7 +1,12 @@
 #include <miniweb/http/response_internal.h>
+#include <miniweb/http/bundle.h>
+#include <miniweb/http/file_map.h>
+#include <miniweb/http/utils.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -39,10 +44,199 @@ read_entire_file(int fd, char *buf, size_t len)
 	return (total > 0) ? (int)total : -1;
 }
 
+/**
+ * @brief Pick the on-disk variant of @p path to serve.
+ *
+ * @details A fresh gzip sidecar (path.gz, no older than the original) is
+ * preferred when the content type compresses and the client accepts it.
+ * The sidecar is a separate file, so the file cache, ETag and mapping
+ * all key it apart from the identity variant without extra bookkeeping.
+ *
+ * @param req Request carrying Accept-Encoding.
+ * @param path Identity file path.
+ * @param st stat(2) of @p path.
+ * @param gzpath Buffer receiving the sidecar path.
+ * @param cap Capacity of @p gzpath.
+ * @param gzst Receives stat(2) of the sidecar when it is chosen.
+ *
+ * @return 1 when the sidecar should be served, otherwise 0.
+ */
+static int
+select_gzip_variant(http_request_t *req, const char *path,
+    const struct stat *st, char *gzpath, size_t cap, struct stat *gzst)
+{
+	int n;
+
+	if (!http_request_accepts_encoding(req, "gzip"))
+		return 0;
+	n = snprintf(gzpath, cap, "%s.gz", path);
+	if (n < 0 || (size_t)n >= cap)
+		return 0;
+	if (stat(gzpath, gzst) != 0 || !S_ISREG(gzst->st_mode))
+		return 0;
+	return gzst->st_mtime >= st->st_mtime;
+}
+
+/**
+ * @brief Build the 200 response shared by every path of http_send_file().
+ *
+ * @return New response, or NULL on allocation failure.
+ */
+static http_response_t *
+file_response_create(const char *mime, const char *encoding,
+    int compressible, const char *etag, time_t mtime)
+{
+	http_response_t *resp;
+
+	resp = http_response_create();
+	if (!resp)
+		return NULL;
+	resp->content_type = mime;
+	if (mime && strncmp(mime, "text/plain", 10) == 0)
+		http_response_add_header(resp, "Content-Disposition", "inline");
+	if (encoding)
+		http_response_add_header(resp, "Content-Encoding", encoding);
+	if (compressible)
+		http_response_add_header(resp, "Vary", "Accept-Encoding");
+	http_response_add_header(resp, "Accept-Ranges", "bytes");
+	http_response_add_validators(resp, etag, mtime);
+	return resp;
+}
+
+/**
+ * @brief Answer a Range request from an in-memory (cached) file body.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int
+send_blob_range(http_request_t *req, const http_blob_t *blob,
+    const char *mime, const char *encoding, int compressible,
+    const char *etag, time_t mtime)
+{
+	http_response_t *resp;
+	int rc;
+
+	resp = file_response_create(mime, encoding, compressible, etag, mtime);
+	if (!resp)
+		return -1;
+	http_response_set_body(resp, (char *)(uintptr_t)blob->data, blob->len,
+	    0);
+	http_response_apply_range(req, resp, etag, mtime);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
+}
+
+/**
+ * @brief Serve @p path from a watched cache entry, before any stat(2).
+ *
+ * @details The sidecar entry is tried first when gzip is acceptable; the
+ * identity entry then only answers if it knows no sidecar is preferred.
+ *
+ * @return Result of sending, or 1 when the caller must take the stat path.
+ */
+static int
+send_watched(http_request_t *req, const char *path, const char *mime,
+    int compressible, int gzip_ok, int ranged)
+{
+	char etag[HTTP_ETAG_MAX];
+	char gzpath[1024];
+	const char *encoding = NULL;
+	http_blob_t *blob = NULL;
+	struct stat st;
+	int n;
+	int rc;
+
+	if (gzip_ok) {
+		n = snprintf(gzpath, sizeof(gzpath), "%s.gz", path);
+		if (n > 0 && (size_t)n < sizeof(gzpath))
+			blob = http_file_cache_peek(gzpath,
+			    FILE_CACHE_PEEK_SIDECAR, &st);
+		if (blob)
+			encoding = "gzip";
+	}
+	if (!blob)
+		blob = http_file_cache_peek(path, gzip_ok ?
+		    FILE_CACHE_PEEK_NOGZ : FILE_CACHE_PEEK_ANY, &st);
+	if (!blob)
+		return 1;
+
+	http_etag_for_file(&st, etag, sizeof(etag));
+	if (http_request_not_modified(req, etag, st.st_mtime))
+		rc = http_send_not_modified(req, etag, st.st_mtime);
+	else if (ranged)
+		rc = send_blob_range(req, blob, mime, encoding, compressible,
+		    etag, st.st_mtime);
+	else
+		rc = http_blob_send(req, blob);
+	http_blob_release(blob);
+	return rc;
+}
+
+/**
+ * @brief Load @p path into the file cache as http_send_file() would.
+ *
+ * @details The blob carries the same MIME type, encoding, validators and
+ * serialized header variants a miss would produce, so the first request
+ * for the file is already a hit.
+ *
+ * @param path Cache key, i.e. the path http_send_file() will be given.
+ * @param mime Content type of the identity variant.
+ * @param encoding Content-Encoding of @p path, or NULL.
+ *
+ * @return Bytes cached, or -1 when the file was skipped or unreadable.
+ */
+long
+http_file_preload(const char *path, const char *mime, const char *encoding)
+{
+	char etag[HTTP_ETAG_MAX];
+	http_response_t *resp;
+	http_blob_t *blob;
+	struct stat st;
+	long cached = -1;
+	int fd;
+	int n;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    (size_t)st.st_size > FILE_CACHE_MAX_BYTES) {
+		close(fd);
+		return -1;
+	}
+
+	http_etag_for_file(&st, etag, sizeof(etag));
+	resp = file_response_create(mime, encoding,
+	    mime_type_is_compressible(mime), etag, st.st_mtime);
+	blob = resp ? http_blob_alloc((size_t)st.st_size) : NULL;
+	if (!blob) {
+		if (resp)
+			http_response_free(resp);
+		close(fd);
+		return -1;
+	}
+	n = read_entire_file(fd, blob->data, blob->len);
+	close(fd);
+	if (n == (int)blob->len) {
+		blob->data[blob->len] = '\0';
+		if (http_blob_prepare(blob, resp) == 0) {
+			http_file_cache_store(path, &st, blob, 0);
+			cached = (long)blob->len;
+		}
+	}
+	http_response_free(resp);
+	http_blob_release(blob);
+	return cached;
+}
+
 /**
  * @brief http_send_file operation.
  *
  * @details Performs the core http_send_file routine for this module.
+ * A single "bytes=" Range is answered with 206 from the cached blob, the
+ * file read on a miss, or straight from the mapping of a large file.
+ * Watched cache entries are served before any filesystem access.
  *
  * @param req Input parameter for http_send_file.
  * @param path Input parameter for http_send_file.
@@ -53,15 +247,57 @@ read_entire_file(int fd, char *buf, size_t len)
 int
 http_send_file(http_request_t *req, const char *path, const char *mime)
 {
-	char *body;
-	char *cached;
-	char buf[65536];
+	char etag[HTTP_ETAG_MAX];
+	char gzpath[1024];
+	http_blob_t *blob;
 	http_response_t *resp;
+	const char *encoding = NULL;
+	unsigned long epoch;
+	unsigned long nogz = 0;
+	int compressible;
+	int gzip_ok;
+	int prepared;
+	int ranged;
 	int fd;
 	int rc;
-	size_t cached_len;
-	ssize_t n;
 	struct stat st;
+	struct stat gzst;
+
+	/*
+	 * Watched entries need no syscall at all. Otherwise revalidations
+	 * are answered from stat(2) alone; cache hits are complete responses
+	 * with no open(2) and no header formatting.
+	 */
+	compressible = mime_type_is_compressible(mime);
+	gzip_ok = compressible && http_request_accepts_encoding(req, "gzip");
+	ranged = http_request_get_header(req, "Range") != NULL;
+	rc = send_watched(req, path, mime, compressible, gzip_ok, ranged);
+	if (rc != 1)
+		return rc;
+
+	/* Read before the sidecar check, so a concurrent change ages it. */
+	epoch = http_file_cache_epoch();
+	if (stat(path, &st) == 0) {
+		if (gzip_ok && select_gzip_variant(req, path, &st, gzpath,
+		    sizeof(gzpath), &gzst)) {
+			path = gzpath;
+			st = gzst;
+			encoding = "gzip";
+		} else if (gzip_ok) {
+			nogz = epoch;
+		}
+		http_etag_for_file(&st, etag, sizeof(etag));
+		if (http_request_not_modified(req, etag, st.st_mtime))
+			return http_send_not_modified(req, etag, st.st_mtime);
+		blob = http_file_cache_lookup(path, &st, nogz);
+		if (blob) {
+			rc = ranged ? send_blob_range(req, blob, mime, encoding,
+			    compressible, etag, st.st_mtime) :
+			    http_blob_send(req, blob);
+			http_blob_release(blob);
+			return rc;
+		}
+	}
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0)
@@ -71,62 +307,178 @@ http_send_file(http_request_t *req, const char *path, const char *mime)
 		return http_send_error(req, 500, "Cannot stat file");
 	}
 
-	resp = http_response_create();
+	http_etag_for_file(&st, etag, sizeof(etag));
+	resp = file_response_create(mime, encoding, compressible, etag,
+	    st.st_mtime);
 	if (!resp) {
 		close(fd);
 		return -1;
 	}
-	resp->content_type = mime;
-	if (mime && strncmp(mime, "text/plain", 10) == 0)
-		http_response_add_header(resp, "Content-Disposition", "inline");
-
-	cached = NULL;
-	cached_len = 0;
-	if (http_file_cache_lookup(path, &st, &cached, &cached_len)) {
-		http_response_set_body(resp, cached, cached_len, 1);
-		rc = http_response_send(req, resp);
-		http_response_free(resp);
-		close(fd);
-		return rc;
-	}
 
 	if (st.st_size > 0 && (size_t)st.st_size <= FILE_CACHE_MAX_BYTES * 4) {
-		body = malloc((size_t)st.st_size);
-		if (!body) {
+		blob = http_blob_alloc((size_t)st.st_size);
+		if (!blob) {
 			http_response_free(resp);
 			close(fd);
 			return -1;
 		}
-		rc = read_entire_file(fd, body, (size_t)st.st_size);
+		rc = read_entire_file(fd, blob->data, blob->len);
 		close(fd);
 		if (rc < 0) {
-			free(body);
+			http_blob_release(blob);
 			http_response_free(resp);
 			return http_send_error(req, 500, "Read error");
 		}
+		blob->len = (size_t)rc;
+		blob->data[blob->len] = '\0';
 
-		http_response_set_body(resp, body, (size_t)rc, 1);
-		rc = http_response_send(req, resp);
-		if (rc == 0)
-			http_file_cache_store(path, &st, body, (size_t)rc);
+		/* Serialize both header variants once; the cache keeps them. */
+		prepared = http_blob_prepare(blob, resp) == 0;
+		if (prepared && !ranged) {
+			rc = http_blob_send(req, blob);
+		} else {
+			http_response_set_body(resp, blob->data, blob->len, 0);
+			http_response_apply_range(req, resp, etag, st.st_mtime);
+			rc = http_response_send(req, resp);
+		}
+		if (rc == 0 && prepared)
+			http_file_cache_store(path, &st, blob, nogz);
 		http_response_free(resp);
+		http_blob_release(blob);
 		return rc;
 	}
 
-	req->keep_alive = 0;
-	http_response_set_body(resp, NULL, (size_t)st.st_size, 0);
+	rc = http_send_fd(req, resp, path, fd, &st, etag);
+	http_response_free(resp);
+	return rc;
+}
+
+/**
+ * @brief Send a bundled file, with no filesystem access at all.
+ *
+ * @details Headers match those of http_send_file() but for
+ * Last-Modified: a bundled file has no mtime, its ETag is the hash of
+ * its bytes. The body is referenced where it was compiled in; only what
+ * the socket does not take at once is copied to the output queue.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+http_send_bundle(http_request_t *req, const bundle_file_t *f)
+{
+	const unsigned char *body = f->data;
+	const char *encoding = NULL;
+	const char *etag = f->etag;
+	http_response_t *resp;
+	size_t len = f->len;
+	int rc;
+
+	if (f->gz && http_request_accepts_encoding(req, "gzip")) {
+		body = f->gz;
+		len = f->gz_len;
+		encoding = "gzip";
+		etag = f->gz_etag;
+	}
+	if (http_request_not_modified(req, etag, 0))
+		return http_send_not_modified(req, etag, 0);
+
+	resp = file_response_create(f->mime, encoding, f->gz != NULL, etag, 0);
+	if (!resp)
+		return -1;
+	http_response_set_body(resp, (char *)(uintptr_t)body, len, 0);
+	if (http_request_get_header(req, "Range") != NULL)
+		http_response_apply_range(req, resp, etag, 0);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
+}
+
+/**
+ * @brief Send @p resp with the body read from open file @p fd.
+ *
+ * @details Honours Range against @p etag / the file mtime. On the async
+ * path the body is queued zero-copy from a shared mapping of the file
+ * (pread streaming when it cannot be mapped); otherwise it is copied
+ * through a stack buffer. resp->body is ignored.
+ *
+ * @param req Request being answered.
+ * @param resp Status, type and headers; still owned by the caller.
+ * @param path Path @p fd was opened from, the mapping cache key.
+ * @param fd Open file; always consumed.
+ * @param st fstat(2) of @p fd.
+ * @param etag Validator for If-Range, or NULL.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+http_send_fd(http_request_t *req, http_response_t *resp, const char *path,
+    int fd, const struct stat *st, const char *etag)
+{
+	char buf[65536];
+	char range[96];
+	http_file_map_t *map;
+	size_t off;
+	size_t len;
+	ssize_t n;
+	int rc;
+
+	off = 0;
+	len = (size_t)st->st_size;
+	rc = http_request_range(req, (size_t)st->st_size, etag, st->st_mtime,
+	    &off, &len);
+	if (rc < 0) {
+		close(fd);
+		resp->status_code = 416;
+		snprintf(range, sizeof(range), "bytes */%lld",
+		    (long long)st->st_size);
+		http_response_add_header(resp, "Content-Range", range);
+		return http_response_send(req, resp);
+	}
+	if (rc > 0) {
+		resp->status_code = 206;
+		snprintf(range, sizeof(range), "bytes %zu-%zu/%lld", off,
+		    off + len - 1, (long long)st->st_size);
+		http_response_add_header(resp, "Content-Range", range);
+	}
+
+	if (!req->out)
+		req->keep_alive = 0;
+	http_response_set_body(resp, NULL, len, 0);
 	if (http_response_send(req, resp) < 0) {
-		http_response_free(resp);
 		close(fd);
 		return -1;
 	}
-	http_response_free(resp);
 
-	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+	/*
+	 * Async path: the body goes out straight from a (shared, reused)
+	 * mapping as the socket drains, so the connection stays keep-alive.
+	 * Files that cannot be mapped are streamed through pread instead.
+	 */
+	if (req->out) {
+		map = http_file_map_acquire(path, fd, st);
+		if (map) {
+			close(fd);
+			rc = http_output_queue_map(req->out, map, off, len);
+		} else {
+			rc = http_output_queue_file(req->out, fd, (off_t)off,
+			    (off_t)len);
+		}
+		if (rc < 0 || http_output_flush(req->out, req->fd) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (off > 0 && lseek(fd, (off_t)off, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+	while (len > 0 && (n = read(fd, buf,
+	    len < sizeof(buf) ? len : sizeof(buf))) > 0) {
 		if (http_response_write_all(req->fd, buf, (size_t)n) < 0) {
 			close(fd);
 			return -1;
 		}
+		len -= (size_t)n;
 	}
 	close(fd);
 	return 0;
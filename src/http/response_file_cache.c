@@ -1,350 +1,928 @@
 #include <miniweb/http/response_internal.h>
+#include <miniweb/http/file_map.h>
+#include <miniweb/core/cache_admin.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/vnode_watch.h>
 
-#include <miniweb/core/log.h>
-
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-
+#include <unistd.h>
+
+/*
+ * Each shard is an open-addressing (linear probing) table of entries
+ * bounded by a byte budget, not a slot count. Admission and eviction are
+ * TinyLFU over CLOCK: a small count-min sketch estimates how often each
+ * path was requested lately, the CLOCK hand proposes a victim that has
+ * not been hit since its last pass, and a newcomer only displaces it when
+ * the sketch says the newcomer is requested more often. One-off scans
+ * therefore cannot flush hot assets, while a working set that fits the
+ * budget stays resident indefinitely.
+ *
+ * Entries are normally watched with EVFILT_VNODE: a change to the file
+ * drops its entry (and its .gz sidecar's) from the watch thread, so a
+ * watched entry is current by construction and a hit costs no syscall.
+ * Directory watches bump file_cache_epoch whenever a file appears or
+ * disappears, which ages the "no sidecar here" knowledge held by
+ * identity entries. A cached sidecar also watches its original, since
+ * it is only servable while no older than that file. Entries left
+ * unwatched (no kqueue, or FILE_CACHE_WATCH_MAX descriptors in use) are
+ * validated against stat(2) on each lookup as before.
+ */
 typedef struct {
-	char path[512];
-	char *data;
-	size_t len;
+	uint64_t hash;
+	char *path;                     /* NULL = empty bucket */
+	http_blob_t *blob;
+	ino_t ino;
 	time_t mtime;
-	time_t atime;
+	int watch_fd;                   /* EVFILT_VNODE descriptor, or -1 */
+	int base_fd;                    /* sidecars: watch on the original */
+	int dir_watched;                /* parent directory is watched */
+	unsigned long nogz_epoch;       /* no usable sidecar as of epoch */
+	unsigned char ref;              /* CLOCK reference bit */
 } file_cache_entry_t;
 
 typedef struct {
-	char path[512];
-	unsigned int hits;
-	time_t atime;
-} file_cache_candidate_t;
-
-typedef struct {
-	file_cache_entry_t entries[FILE_CACHE_SLOTS];
-	file_cache_candidate_t candidates[FILE_CACHE_SLOTS * 2];
+	file_cache_entry_t table[FILE_CACHE_BUCKETS];
+	unsigned char sketch[FILE_CACHE_SKETCH_ROWS][FILE_CACHE_SKETCH_WIDTH];
+	unsigned int sketch_ops;        /* increments since the last halving */
+	size_t bytes;                   /* body bytes held by this shard */
+	int count;
+	int hand;
 	pthread_mutex_t lock;
-	int cache_insert_tokens;
-	time_t cache_insert_window;
-	unsigned int window_hits;
-	unsigned int window_misses;
-	unsigned int window_inserts;
-	unsigned int window_throttles;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long inserts;
+	unsigned long rejects;
+	unsigned long evictions;
 } file_cache_shard_t;
 
 static file_cache_shard_t file_cache_shards[FILE_CACHE_SHARDS];
+static size_t file_cache_shard_budget =
+    FILE_CACHE_BUDGET_BYTES / FILE_CACHE_SHARDS;
 static pthread_once_t http_globals_once = PTHREAD_ONCE_INIT;
 static int g_http_globals_initialized;
 
-
-/**
- * @brief file_cache_shard_index operation.
- *
- * @details Performs the core file_cache_shard_index routine for this module.
- *
- * @param path Input parameter for file_cache_shard_index.
- *
- * @return Return value produced by file_cache_shard_index.
- */
-static int
-file_cache_shard_index(const char *path)
+static pthread_once_t file_cache_watch_once = PTHREAD_ONCE_INIT;
+static vnode_watch_t *file_cache_watch;     /* cached files */
+static vnode_watch_t *file_cache_dir_watch; /* their directories */
+static unsigned long file_cache_epoch = 1;
+static int file_cache_watch_fds;            /* open watch descriptors */
+
+static pthread_mutex_t watched_dir_lock = PTHREAD_MUTEX_INITIALIZER;
+LOCKSTAT_SITE(lockstat_dirs, "file_cache_dirs");
+LOCKSTAT_SITE(lockstat_shard, "file_cache_shard");	/* all shards */
+static struct {
+	uint64_t hash;
+	int fd;
+} watched_dirs[FILE_CACHE_WATCH_DIRS];
+static int watched_dir_count;
+
+/** Odd multipliers giving each sketch row an independent index. */
+static const uint64_t sketch_seeds[FILE_CACHE_SKETCH_ROWS] = {
+	0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+};
+
+/** FNV-1a over @p path; picks the shard, the bucket and sketch cells. */
+static uint64_t
+file_cache_hash(const char *path)
 {
 	const unsigned char *p;
-	unsigned long hash;
+	uint64_t hash;
 
-	hash = 1469598103934665603UL;
+	hash = 1469598103934665603ULL;
 	for (p = (const unsigned char *)path; *p; p++) {
 		hash ^= *p;
-		hash *= 1099511628211UL;
+		hash *= 1099511628211ULL;
 	}
+	return hash;
+}
 
-	return (int)(hash % FILE_CACHE_SHARDS);
+/** Sketch cell of @p hash in row @p row. */
+static unsigned int
+sketch_index(uint64_t hash, int row)
+{
+	return (unsigned int)((hash * sketch_seeds[row]) >> 54) &
+	    (FILE_CACHE_SKETCH_WIDTH - 1);
 }
 
 /**
- * @brief file_cache_init_shards operation.
- *
- * @details Performs the core file_cache_init_shards routine for this module.
+ * Count one request for @p hash. Counters saturate at 15 and the whole
+ * sketch is halved every FILE_CACHE_SKETCH_SAMPLE requests, so the
+ * estimate follows recent popularity instead of all-time totals.
  */
 static void
-file_cache_init_shards(void)
+sketch_touch_locked(file_cache_shard_t *shard, uint64_t hash)
 {
-	int i;
+	for (int r = 0; r < FILE_CACHE_SKETCH_ROWS; r++) {
+		unsigned char *c = &shard->sketch[r][sketch_index(hash, r)];
+		if (*c < 15)
+			(*c)++;
+	}
+	if (++shard->sketch_ops < FILE_CACHE_SKETCH_SAMPLE)
+		return;
+	shard->sketch_ops = 0;
+	for (int r = 0; r < FILE_CACHE_SKETCH_ROWS; r++)
+		for (int i = 0; i < FILE_CACHE_SKETCH_WIDTH; i++)
+			shard->sketch[r][i] >>= 1;
+}
 
-	for (i = 0; i < FILE_CACHE_SHARDS; i++) {
-		pthread_mutex_init(&file_cache_shards[i].lock, NULL);
-		file_cache_shards[i].cache_insert_tokens = FILE_CACHE_INSERTS_PER_SEC;
+/** Estimated recent request count of @p hash (count-min). */
+static unsigned int
+sketch_estimate_locked(const file_cache_shard_t *shard, uint64_t hash)
+{
+	unsigned int best = 15;
+
+	for (int r = 0; r < FILE_CACHE_SKETCH_ROWS; r++) {
+		unsigned int c = shard->sketch[r][sketch_index(hash, r)];
+		if (c < best)
+			best = c;
+	}
+	return best;
+}
+
+/** Bucket holding @p path, or -1. */
+static int
+file_cache_find_locked(const file_cache_shard_t *shard, uint64_t hash,
+    const char *path)
+{
+	int mask = FILE_CACHE_BUCKETS - 1;
+	int i = (int)(hash >> 8) & mask;
+
+	for (int n = 0; n < FILE_CACHE_BUCKETS; n++, i = (i + 1) & mask) {
+		const file_cache_entry_t *e = &shard->table[i];
+		if (e->path == NULL)
+			return -1;
+		if (e->hash == hash && strcmp(e->path, path) == 0)
+			return i;
 	}
+	return -1;
+}
+
+/** Open @p path for a watch within FILE_CACHE_WATCH_MAX descriptors. */
+static int
+file_cache_watch_open(const char *path)
+{
+	int fd;
+
+	if (__atomic_add_fetch(&file_cache_watch_fds, 1, __ATOMIC_RELAXED) >
+	    FILE_CACHE_WATCH_MAX ||
+	    (fd = open(path, O_RDONLY)) < 0) {
+		__atomic_sub_fetch(&file_cache_watch_fds, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return fd;
+}
+
+/** Close a descriptor from file_cache_watch_open(); ignores -1. */
+static void
+file_cache_watch_close(int fd)
+{
+	if (fd < 0)
+		return;
+	close(fd);
+	__atomic_sub_fetch(&file_cache_watch_fds, 1, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief http_handler_globals_init operation.
- *
- * @details Performs the core http_handler_globals_init routine for this module.
+ * Empty bucket @p i and shift later members of its probe run back, so
+ * lookups never need tombstones. The caller releases the returned blob
+ * after dropping the lock.
  */
-static void
-http_handler_globals_init(void)
+static http_blob_t *
+file_cache_remove_locked(file_cache_shard_t *shard, int i)
 {
-	http_response_pool_init_shards();
-	file_cache_init_shards();
-	g_http_globals_initialized = 1;
+	int mask = FILE_CACHE_BUCKETS - 1;
+	http_blob_t *blob = shard->table[i].blob;
+	int j = i;
+
+	shard->bytes -= blob->len;
+	shard->count--;
+	file_cache_watch_close(shard->table[i].watch_fd);
+	file_cache_watch_close(shard->table[i].base_fd);
+	free(shard->table[i].path);
+	memset(&shard->table[i], 0, sizeof(shard->table[i]));
+	for (;;) {
+		j = (j + 1) & mask;
+		file_cache_entry_t *e = &shard->table[j];
+		if (e->path == NULL)
+			break;
+		int home = (int)(e->hash >> 8) & mask;
+		/* Move e into the hole unless its home lies in (i, j]. */
+		if ((j > i && (home <= i || home > j)) ||
+		    (j < i && (home <= i && home > j))) {
+			shard->table[i] = *e;
+			memset(e, 0, sizeof(*e));
+			i = j;
+		}
+	}
+	return blob;
 }
 
 /**
- * @brief http_handler_globals_init_once operation.
- *
- * @details Performs the core http_handler_globals_init_once routine for this module.
+ * Advance the CLOCK hand to the next entry whose reference bit is clear,
+ * clearing bits on the way. Returns its bucket, or -1 when empty.
  */
-void
-http_handler_globals_init_once(void)
+static int
+file_cache_clock_victim_locked(file_cache_shard_t *shard)
 {
-	pthread_once(&http_globals_once, http_handler_globals_init);
+	if (shard->count == 0)
+		return -1;
+	for (;;) {
+		file_cache_entry_t *e = &shard->table[shard->hand];
+		int i = shard->hand;
+		shard->hand = (shard->hand + 1) & (FILE_CACHE_BUCKETS - 1);
+		if (e->path == NULL)
+			continue;
+		if (e->ref) {
+			e->ref = 0;
+			continue;
+		}
+		return i;
+	}
+}
+
+/** Drop the entry for @p path, if cached. */
+static void
+file_cache_invalidate(const char *path)
+{
+	file_cache_shard_t *shard;
+	http_blob_t *blob = NULL;
+	uint64_t hash;
+	int i;
+
+	hash = file_cache_hash(path);
+	shard = &file_cache_shards[hash % FILE_CACHE_SHARDS];
+	LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+	i = file_cache_find_locked(shard, hash, path);
+	if (i >= 0)
+		blob = file_cache_remove_locked(shard, i);
+	LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+	http_blob_release(blob);
 }
 
 /**
- * @brief file_cache_refill_budget_locked operation.
- *
- * @details Performs the core file_cache_refill_budget_locked routine for this module.
+ * @brief Watch callback for cached files: drop the changed entry and
+ * its gzip sidecar, whose freshness was judged against the old file.
  *
- * @param shard Input parameter for file_cache_refill_budget_locked.
- * @param now Input parameter for file_cache_refill_budget_locked.
- * @param shard_idx Input parameter for file_cache_refill_budget_locked.
+ * @param fd Watched descriptor, matched against the shard's entries
+ *        (their own file, or the original a sidecar was made from).
+ * @param fflags Unused; any change invalidates.
+ * @param token Path hash; selects the shard.
  */
 static void
-file_cache_refill_budget_locked(file_cache_shard_t *shard, time_t now,
-    int shard_idx)
-{
-	if (shard->cache_insert_window == 0 || now != shard->cache_insert_window) {
-		if (shard->cache_insert_window != 0) {
-			log_debug("[FILE_CACHE] shard=%d/sec=%ld hits=%u "
-			    "misses=%u inserts=%u throttles=%u budget=%d",
-			    shard_idx, (long)shard->cache_insert_window,
-			    shard->window_hits, shard->window_misses,
-			    shard->window_inserts, shard->window_throttles,
-			    FILE_CACHE_INSERTS_PER_SEC);
+file_cache_file_changed(int fd, unsigned int fflags, uintptr_t token)
+{
+	file_cache_shard_t *shard = &file_cache_shards[token % FILE_CACHE_SHARDS];
+	http_blob_t *blob = NULL;
+	char gzpath[FILE_CACHE_PATH_MAX];
+	int n = -1;
+
+	(void)fflags;
+	LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+	for (int i = 0; i < FILE_CACHE_BUCKETS; i++) {
+		file_cache_entry_t *e = &shard->table[i];
+		if (e->path == NULL)
+			continue;
+		if (e->base_fd == fd) {
+			blob = file_cache_remove_locked(shard, i);
+			break;
 		}
-		shard->cache_insert_window = now;
-		shard->cache_insert_tokens = FILE_CACHE_INSERTS_PER_SEC;
-		shard->window_hits = 0;
-		shard->window_misses = 0;
-		shard->window_inserts = 0;
-		shard->window_throttles = 0;
+		if (e->watch_fd != fd)
+			continue;
+		n = snprintf(gzpath, sizeof(gzpath), "%s.gz", e->path);
+		blob = file_cache_remove_locked(shard, i);
+		break;
 	}
+	LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+	http_blob_release(blob);
+	if (n > 0 && (size_t)n < sizeof(gzpath))
+		file_cache_invalidate(gzpath);
+}
+
+/** Watch callback for directories: a new or removed name ages epochs. */
+static void
+file_cache_dir_changed(int fd, unsigned int fflags, uintptr_t token)
+{
+	(void)fd;
+	(void)fflags;
+	(void)token;
+	__atomic_add_fetch(&file_cache_epoch, 1, __ATOMIC_RELEASE);
+}
+
+/** Create both watch groups; they stay NULL where kqueue is missing. */
+static void
+file_cache_watch_init(void)
+{
+	file_cache_watch = vnode_watch_create(file_cache_file_changed);
+	if (file_cache_watch)
+		file_cache_dir_watch = vnode_watch_create(file_cache_dir_changed);
 }
 
 /**
- * @brief file_cache_evict_stale_locked operation.
+ * @brief Make sure the directory holding @p path is watched.
  *
- * @details Performs the core file_cache_evict_stale_locked routine for this module.
+ * @details A directory registered now bumps the epoch, so negative
+ * sidecar checks made before the watch existed are never trusted.
  *
- * @param shard Input parameter for file_cache_evict_stale_locked.
- * @param now Input parameter for file_cache_evict_stale_locked.
+ * @return 1 when the directory is watched, otherwise 0.
  */
-static void
-file_cache_evict_stale_locked(file_cache_shard_t *shard, time_t now)
+static int
+file_cache_watch_dir(const char *path)
 {
+	char dir[FILE_CACHE_PATH_MAX];
+	const char *slash;
+	uint64_t hash;
+	int fd;
 	int i;
 
-	for (i = 0; i < FILE_CACHE_SLOTS; i++) {
-		if (shard->entries[i].path[0] == '\0')
-			continue;
-		if ((now - shard->entries[i].atime) > FILE_CACHE_MAX_AGE_SEC) {
-			free(shard->entries[i].data);
-			memset(&shard->entries[i], 0, sizeof(shard->entries[i]));
+	if (!file_cache_dir_watch)
+		return 0;
+	slash = strrchr(path, '/');
+	if (!slash)
+		snprintf(dir, sizeof(dir), ".");
+	else if ((size_t)(slash - path) < sizeof(dir))
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	else
+		return 0;
+	hash = file_cache_hash(dir);
+
+	LOCKSTAT_LOCK(&watched_dir_lock, lockstat_dirs);
+	for (i = 0; i < watched_dir_count; i++) {
+		if (watched_dirs[i].hash == hash) {
+			LOCKSTAT_UNLOCK(&watched_dir_lock, lockstat_dirs);
+			return 1;
 		}
 	}
+	if (watched_dir_count == FILE_CACHE_WATCH_DIRS ||
+	    (fd = open(dir, O_RDONLY)) < 0) {
+		LOCKSTAT_UNLOCK(&watched_dir_lock, lockstat_dirs);
+		return 0;
+	}
+	if (vnode_watch_add(file_cache_dir_watch, fd, 0) != 0) {
+		close(fd);
+		LOCKSTAT_UNLOCK(&watched_dir_lock, lockstat_dirs);
+		return 0;
+	}
+	watched_dirs[watched_dir_count].hash = hash;
+	watched_dirs[watched_dir_count].fd = fd;
+	watched_dir_count++;
+	__atomic_add_fetch(&file_cache_epoch, 1, __ATOMIC_RELEASE);
+	LOCKSTAT_UNLOCK(&watched_dir_lock, lockstat_dirs);
+	return 1;
+}
 
-	for (i = 0; i < FILE_CACHE_SLOTS * 2; i++) {
-		if (shard->candidates[i].path[0] == '\0')
-			continue;
-		if ((now - shard->candidates[i].atime) > FILE_CACHE_MAX_AGE_SEC)
-			memset(&shard->candidates[i], 0, sizeof(shard->candidates[i]));
+/**
+ * @brief Open and watch the file about to be cached.
+ *
+ * @return Watched descriptor, or -1 when the entry must be validated by
+ *         stat(2) instead.
+ */
+static int
+file_cache_watch_file(const char *path, uint64_t hash)
+{
+	int fd;
+
+	pthread_once(&file_cache_watch_once, file_cache_watch_init);
+	if (!file_cache_watch || (fd = file_cache_watch_open(path)) < 0)
+		return -1;
+	if (vnode_watch_add(file_cache_watch, fd, (uintptr_t)hash) != 0) {
+		file_cache_watch_close(fd);
+		return -1;
 	}
+	return fd;
 }
 
 /**
- * @brief file_cache_admit_locked operation.
+ * @brief Watch the original of a sidecar that is about to be cached.
  *
- * @details Performs the core file_cache_admit_locked routine for this module.
+ * @return Watched descriptor, or -1 when @p path is no sidecar or its
+ *         original is missing.
+ */
+static int
+file_cache_watch_base(const char *path, uint64_t hash)
+{
+	char base[FILE_CACHE_PATH_MAX];
+	size_t len = strlen(path);
+	int fd;
+
+	if (!file_cache_watch || len <= 3 || len >= sizeof(base) ||
+	    strcmp(path + len - 3, ".gz") != 0)
+		return -1;
+	memcpy(base, path, len - 3);
+	base[len - 3] = '\0';
+	if ((fd = file_cache_watch_open(base)) < 0)
+		return -1;
+	if (vnode_watch_add(file_cache_watch, fd, (uintptr_t)hash) != 0) {
+		file_cache_watch_close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Check freshly armed watches against the state being cached.
  *
- * @param shard Input parameter for file_cache_admit_locked.
- * @param path Input parameter for file_cache_admit_locked.
- * @param now Input parameter for file_cache_admit_locked.
+ * @details Runs under the shard lock: a change before this point shows
+ * here, a later one reaches the callback, which waits for the lock and
+ * then finds the entry.
  *
- * @return Return value produced by file_cache_admit_locked.
+ * @return 1 when the file (or a sidecar's original) moved on already.
  */
 static int
-file_cache_admit_locked(file_cache_shard_t *shard, const char *path, time_t now)
+file_cache_watch_stale(int wfd, int bfd, const struct stat *st)
+{
+	struct stat now;
+
+	if (wfd >= 0 && (fstat(wfd, &now) != 0 ||
+	    now.st_ino != st->st_ino || now.st_mtime != st->st_mtime ||
+	    now.st_size != st->st_size))
+		return 1;
+	return bfd >= 0 && (fstat(bfd, &now) != 0 ||
+	    now.st_mtime > st->st_mtime);
+}
+
+/**
+ * @brief Current directory epoch, read before a sidecar check.
+ * @return Epoch value to hand to lookup/store as nogz_epoch.
+ */
+unsigned long
+http_file_cache_epoch(void)
+{
+	return __atomic_load_n(&file_cache_epoch, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief file_cache_init_shards operation.
+ *
+ * @details Performs the core file_cache_init_shards routine for this module.
+ */
+static void
+file_cache_init_shards(void)
 {
-	time_t oldest;
 	int i;
-	int slot;
 
-	slot = -1;
-	oldest = 0;
-	for (i = 0; i < FILE_CACHE_SLOTS * 2; i++) {
-		if (shard->candidates[i].path[0] == '\0') {
-			slot = i;
-			break;
-		}
-		if (strcmp(shard->candidates[i].path, path) == 0) {
-			shard->candidates[i].hits++;
-			shard->candidates[i].atime = now;
-			return shard->candidates[i].hits >= 2;
-		}
-		if (slot == -1 || shard->candidates[i].atime < oldest) {
-			oldest = shard->candidates[i].atime;
-			slot = i;
+	for (i = 0; i < FILE_CACHE_SHARDS; i++)
+		pthread_mutex_init(&file_cache_shards[i].lock, NULL);
+}
+
+/**
+ * @brief Set the total byte budget of the static file cache.
+ *
+ * @details Split evenly across the shards. Meant for startup, before the
+ * first request; a smaller budget takes effect as entries are replaced.
+ *
+ * @param bytes Total bytes of file bodies the cache may hold; 0 disables
+ *        caching.
+ */
+void
+http_file_cache_set_budget(size_t bytes)
+{
+	__atomic_store_n(&file_cache_shard_budget, bytes / FILE_CACHE_SHARDS,
+	    __ATOMIC_RELAXED);
+}
+
+/** mem_budget usage(): body bytes held and hits, all shards. */
+static size_t
+file_cache_mem_usage(uint64_t *hits, void *ctx)
+{
+	http_file_cache_stats_t st;
+
+	(void)ctx;
+	http_file_cache_stats(&st);
+	*hits = st.hits;
+	return st.bytes;
+}
+
+/**
+ * mem_budget shrink(): evict CLOCK victims shard by shard, a few per
+ * lock hold, until @p bytes are freed or the cache is empty.
+ */
+static size_t
+file_cache_mem_shrink(size_t bytes, void *ctx)
+{
+	http_blob_t *dropped[FILE_CACHE_EVICT_MAX];
+	size_t freed = 0;
+	int idle = 0;
+
+	(void)ctx;
+	for (int s = 0; freed < bytes && idle < FILE_CACHE_SHARDS;
+	    s = (s + 1) % FILE_CACHE_SHARDS) {
+		file_cache_shard_t *shard = &file_cache_shards[s];
+		int n = 0, v;
+
+		LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+		while (n < FILE_CACHE_EVICT_MAX && freed < bytes &&
+		    (v = file_cache_clock_victim_locked(shard)) >= 0) {
+			freed += shard->table[v].blob->len;
+			dropped[n++] = file_cache_remove_locked(shard, v);
+			shard->evictions++;
 		}
+		LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+		idle = n > 0 ? 0 : idle + 1;
+		for (int i = 0; i < n; i++)
+			http_blob_release(dropped[i]);
 	}
-	if (slot < 0)
-		return 0;
+	return freed;
+}
 
-	strlcpy(shard->candidates[slot].path, path,
-	    sizeof(shard->candidates[slot].path));
-	shard->candidates[slot].hits = 1;
-	shard->candidates[slot].atime = now;
-	return 0;
+/** cache_admin stats(): all shards together. */
+static void
+file_cache_admin_stats(struct cache_admin_stats *out, void *ctx)
+{
+	http_file_cache_stats_t st;
+
+	(void)ctx;
+	http_file_cache_stats(&st);
+	out->bytes = st.bytes;
+	out->entries = st.entries;
+	out->hits = st.hits;
+	out->misses = st.misses;
+}
+
+/**
+ * cache_admin purge(): keys are the file paths served. An exact key
+ * lives in one shard; a prefix walks them all, a few drops per hold.
+ */
+static size_t
+file_cache_admin_purge(const char *key, int prefix, void *ctx)
+{
+	http_blob_t *dropped[FILE_CACHE_EVICT_MAX];
+	size_t purged = 0;
+	int s, end;
+
+	(void)ctx;
+	if (prefix) {
+		s = 0;
+		end = FILE_CACHE_SHARDS;
+	} else {
+		s = (int)(file_cache_hash(key) % FILE_CACHE_SHARDS);
+		end = s + 1;
+	}
+	for (; s < end; s++) {
+		file_cache_shard_t *shard = &file_cache_shards[s];
+		int i = 0, n;
+
+		do {
+			n = 0;
+			LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+			/* A removal shifts a later entry into i: look again. */
+			while (i < FILE_CACHE_BUCKETS &&
+			    n < FILE_CACHE_EVICT_MAX) {
+				const char *path = shard->table[i].path;
+
+				if (path != NULL &&
+				    cache_admin_match(path, key, prefix))
+					dropped[n++] =
+					    file_cache_remove_locked(shard, i);
+				else
+					i++;
+			}
+			LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+			for (int k = 0; k < n; k++)
+				http_blob_release(dropped[k]);
+			purged += (size_t)n;
+		} while (n == FILE_CACHE_EVICT_MAX);
+	}
+	return purged;
+}
+
+/**
+ * @brief http_handler_globals_init operation.
+ *
+ * @details Performs the core http_handler_globals_init routine for this module.
+ */
+static void
+http_handler_globals_init(void)
+{
+	file_cache_init_shards();
+	g_http_globals_initialized = 1;
+	(void)mem_budget_register(&(struct mem_cache_ops){
+		.name = "file_cache",
+		.usage = file_cache_mem_usage,
+		.shrink = file_cache_mem_shrink,
+	});
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "file_cache",
+		.stats = file_cache_admin_stats,
+		.purge = file_cache_admin_purge,
+	});
+}
+
+/**
+ * @brief http_handler_globals_init_once operation.
+ *
+ * @details Performs the core http_handler_globals_init_once routine for this module.
+ */
+void
+http_handler_globals_init_once(void)
+{
+	pthread_once(&http_globals_once, http_handler_globals_init);
 }
 
 /**
  * @brief http_file_cache_store operation.
  *
- * @details Performs the core http_file_cache_store routine for this module.
+ * @details Publishes @p blob under @p path when it fits the shard budget,
+ * evicting CLOCK victims the sketch rates as less popular than @p path.
+ * A newcomer that loses to a victim is not cached. The cache takes its
+ * own reference; the caller keeps theirs.
  *
  * @param path Input parameter for http_file_cache_store.
  * @param st Input parameter for http_file_cache_store.
- * @param data Input parameter for http_file_cache_store.
- * @param len Input parameter for http_file_cache_store.
+ * @param blob Prepared blob; immutable from here on.
+ * @param nogz_epoch Epoch at which the caller found no usable gzip
+ *        sidecar for @p path, or 0 when it did not look.
  */
 void
-http_file_cache_store(const char *path, const struct stat *st, const char *data,
-    size_t len)
+http_file_cache_store(const char *path, const struct stat *st,
+    http_blob_t *blob, unsigned long nogz_epoch)
 {
 	file_cache_shard_t *shard;
-	time_t now;
-	time_t oldest;
+	http_blob_t *dropped[FILE_CACHE_EVICT_MAX + 1];
+	uint64_t hash;
+	size_t budget;
+	unsigned int freq;
+	char *copy;
+	int mask = FILE_CACHE_BUCKETS - 1;
+	int ndropped = 0;
+	int dir_watched = 0;
+	int bfd = -1;
+	int wfd;
 	int i;
-	int shard_idx;
-	int slot;
 
-	if (!path || !st || !data || len == 0 || len > FILE_CACHE_MAX_BYTES)
+	budget = __atomic_load_n(&file_cache_shard_budget, __ATOMIC_RELAXED);
+	if (!path || !st || !blob || blob->len == 0 ||
+	    blob->len > FILE_CACHE_MAX_BYTES || blob->len > budget)
+		return;
+	copy = strdup(path);
+	if (!copy)
 		return;
 
 	http_handler_globals_init_once();
-	shard_idx = file_cache_shard_index(path);
-	shard = &file_cache_shards[shard_idx];
-
-	pthread_mutex_lock(&shard->lock);
-	now = time(NULL);
-	file_cache_refill_budget_locked(shard, now, shard_idx);
-	file_cache_evict_stale_locked(shard, now);
-
-	if (shard->cache_insert_tokens <= 0) {
-		shard->window_throttles++;
-		pthread_mutex_unlock(&shard->lock);
-		return;
-	}
-	if (!file_cache_admit_locked(shard, path, now)) {
-		pthread_mutex_unlock(&shard->lock);
-		return;
+	hash = file_cache_hash(path);
+	shard = &file_cache_shards[hash % FILE_CACHE_SHARDS];
+	wfd = file_cache_watch_file(path, hash);
+	if (wfd >= 0) {
+		dir_watched = file_cache_watch_dir(path);
+		bfd = file_cache_watch_base(path, hash);
 	}
 
-	slot = -1;
-	oldest = 0;
-	for (i = 0; i < FILE_CACHE_SLOTS; i++) {
-		if (shard->entries[i].path[0] == '\0') {
-			slot = i;
-			break;
-		}
-		if (slot == -1 || shard->entries[i].atime < oldest) {
-			oldest = shard->entries[i].atime;
-			slot = i;
-		}
+	LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+	i = file_cache_find_locked(shard, hash, path);
+	if (i >= 0)
+		dropped[ndropped++] = file_cache_remove_locked(shard, i);
+
+	if (file_cache_watch_stale(wfd, bfd, st)) {
+		LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+		file_cache_watch_close(wfd);
+		file_cache_watch_close(bfd);
+		free(copy);
+		for (i = 0; i < ndropped; i++)
+			http_blob_release(dropped[i]);
+		return;
 	}
 
-	if (slot >= 0) {
-		shard->cache_insert_tokens--;
-		free(shard->entries[slot].data);
-		shard->entries[slot].data = malloc(len);
-		if (shard->entries[slot].data) {
-			memcpy(shard->entries[slot].data, data, len);
-			strlcpy(shard->entries[slot].path, path,
-			    sizeof(shard->entries[slot].path));
-			shard->entries[slot].len = len;
-			shard->entries[slot].mtime = st->st_mtime;
-			shard->entries[slot].atime = now;
-			shard->window_inserts++;
-		} else {
-			memset(&shard->entries[slot], 0, sizeof(shard->entries[slot]));
+	freq = sketch_estimate_locked(shard, hash);
+	while (shard->bytes + blob->len > budget ||
+	    shard->count >= FILE_CACHE_MAX_ENTRIES) {
+		int v = ndropped < FILE_CACHE_EVICT_MAX ?
+		    file_cache_clock_victim_locked(shard) : -1;
+		if (v < 0 || sketch_estimate_locked(shard,
+		    shard->table[v].hash) >= freq) {
+			/* Keep the incumbent; leave its bit clear. */
+			shard->rejects++;
+			LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+			file_cache_watch_close(wfd);
+			file_cache_watch_close(bfd);
+			free(copy);
+			for (i = 0; i < ndropped; i++)
+				http_blob_release(dropped[i]);
+			return;
 		}
+		dropped[ndropped++] = file_cache_remove_locked(shard, v);
+		shard->evictions++;
 	}
 
-	pthread_mutex_unlock(&shard->lock);
+	i = (int)(hash >> 8) & mask;
+	while (shard->table[i].path != NULL)
+		i = (i + 1) & mask;
+	shard->table[i].hash = hash;
+	shard->table[i].path = copy;
+	shard->table[i].blob = http_blob_ref(blob);
+	shard->table[i].ino = st->st_ino;
+	shard->table[i].mtime = st->st_mtime;
+	shard->table[i].watch_fd = wfd;
+	shard->table[i].base_fd = bfd;
+	shard->table[i].dir_watched = dir_watched;
+	shard->table[i].nogz_epoch = dir_watched ? nogz_epoch : 0;
+	shard->table[i].ref = 0;
+	shard->bytes += blob->len;
+	shard->count++;
+	shard->inserts++;
+	LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+
+	for (i = 0; i < ndropped; i++)
+		http_blob_release(dropped[i]);
 }
 
 /**
  * @brief http_file_cache_lookup operation.
  *
- * @details Performs the core http_file_cache_lookup routine for this module.
+ * @details Every call counts towards the path's popularity. A hit takes
+ * one reference on the cached blob and sets its CLOCK bit; an entry whose
+ * file changed is dropped on the spot. The caller sends the blob with
+ * http_blob_send() and releases it.
  *
  * @param path Input parameter for http_file_cache_lookup.
  * @param st Input parameter for http_file_cache_lookup.
- * @param out Input parameter for http_file_cache_lookup.
- * @param out_len Input parameter for http_file_cache_lookup.
+ * @param nogz_epoch Epoch of a failed sidecar check for @p path, recorded
+ *        on the entry so later hits can skip the check; 0 for none.
  *
- * @return Return value produced by http_file_cache_lookup.
+ * @return Referenced blob on a hit, NULL on a miss.
  */
-int
-http_file_cache_lookup(const char *path, const struct stat *st, char **out,
-    size_t *out_len)
+http_blob_t *
+http_file_cache_lookup(const char *path, const struct stat *st,
+    unsigned long nogz_epoch)
 {
 	file_cache_shard_t *shard;
-	time_t now;
-	int found;
+	file_cache_entry_t *e;
+	http_blob_t *found;
+	http_blob_t *stale;
+	uint64_t hash;
 	int i;
-	int shard_idx;
 
-	if (!path || !st || !out || !out_len || st->st_size <= 0 ||
+	if (!path || !st || st->st_size <= 0 ||
 	    (size_t)st->st_size > FILE_CACHE_MAX_BYTES)
-		return 0;
+		return NULL;
 
 	http_handler_globals_init_once();
-	shard_idx = file_cache_shard_index(path);
-	shard = &file_cache_shards[shard_idx];
-	found = 0;
+	hash = file_cache_hash(path);
+	shard = &file_cache_shards[hash % FILE_CACHE_SHARDS];
+	found = NULL;
+	stale = NULL;
+
+	LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+	sketch_touch_locked(shard, hash);
+	i = file_cache_find_locked(shard, hash, path);
+	if (i >= 0) {
+		e = &shard->table[i];
+		/* The prepared headers carry an ETag built from all three. */
+		if (e->mtime != st->st_mtime || e->ino != st->st_ino ||
+		    e->blob->len != (size_t)st->st_size) {
+			stale = file_cache_remove_locked(shard, i);
+		} else {
+			found = http_blob_ref(e->blob);
+			e->ref = 1;
+			if (nogz_epoch != 0 && e->dir_watched)
+				e->nogz_epoch = nogz_epoch;
+		}
+	}
+	if (found)
+		shard->hits++;
+	else
+		shard->misses++;
+	LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
 
-	pthread_mutex_lock(&shard->lock);
-	now = time(NULL);
-	file_cache_refill_budget_locked(shard, now, shard_idx);
-	file_cache_evict_stale_locked(shard, now);
+	http_blob_release(stale);
+	return found;
+}
 
-	for (i = 0; i < FILE_CACHE_SLOTS; i++) {
-		if (shard->entries[i].path[0] == '\0')
-			continue;
-		if (strcmp(shard->entries[i].path, path) != 0)
-			continue;
-		if (shard->entries[i].mtime != st->st_mtime)
-			continue;
+/**
+ * @brief Serve a watched entry without touching the filesystem.
+ *
+ * @param path Path of the variant wanted.
+ * @param mode FILE_CACHE_PEEK_ANY; FILE_CACHE_PEEK_NOGZ to hit only when
+ *        the entry knows, as of the current epoch, that no gzip sidecar
+ *        would be preferred; FILE_CACHE_PEEK_SIDECAR to hit only while
+ *        the original of a sidecar is watched.
+ * @param st Receives st_ino, st_size and st_mtime of the cached file.
+ *
+ * @return Referenced blob, or NULL when the caller must stat(2).
+ */
+http_blob_t *
+http_file_cache_peek(const char *path, int mode, struct stat *st)
+{
+	file_cache_shard_t *shard;
+	file_cache_entry_t *e;
+	http_blob_t *found = NULL;
+	uint64_t hash;
+	int i;
 
-		*out = malloc(shard->entries[i].len);
-		if (*out) {
-			memcpy(*out, shard->entries[i].data, shard->entries[i].len);
-			*out_len = shard->entries[i].len;
-			shard->entries[i].atime = now;
-			shard->window_hits++;
-			found = 1;
+	http_handler_globals_init_once();
+	hash = file_cache_hash(path);
+	shard = &file_cache_shards[hash % FILE_CACHE_SHARDS];
+
+	LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+	i = file_cache_find_locked(shard, hash, path);
+	if (i >= 0) {
+		e = &shard->table[i];
+		if (e->watch_fd >= 0 &&
+		    (mode != FILE_CACHE_PEEK_NOGZ ||
+		    e->nogz_epoch == http_file_cache_epoch()) &&
+		    (mode != FILE_CACHE_PEEK_SIDECAR || e->base_fd >= 0)) {
+			found = http_blob_ref(e->blob);
+			e->ref = 1;
+			memset(st, 0, sizeof(*st));
+			st->st_ino = e->ino;
+			st->st_mtime = e->mtime;
+			st->st_size = (off_t)e->blob->len;
+			/* Misses are counted by the lookup that follows. */
+			sketch_touch_locked(shard, hash);
+			shard->hits++;
 		}
-		break;
 	}
-	if (!found)
-		shard->window_misses++;
-	pthread_mutex_unlock(&shard->lock);
-
+	LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
 	return found;
 }
 
+typedef struct {
+	unsigned int freq;
+	char *path;
+} file_cache_hot_t;
+
+/** qsort(3): most requested first. */
+static int
+file_cache_hot_cmp(const void *a, const void *b)
+{
+	const file_cache_hot_t *x = a;
+	const file_cache_hot_t *y = b;
+
+	return (x->freq < y->freq) - (x->freq > y->freq);
+}
+
+/**
+ * @brief Call @p fn with the path of every entry, most requested first.
+ *
+ * @details Paths are copied shard by shard and @p fn runs with no lock
+ * held, so it may use the cache.
+ *
+ * @return Number of paths passed to @p fn, or -1 when out of memory.
+ */
+int
+http_file_cache_hot(void (*fn)(const char *path, void *ctx), void *ctx)
+{
+	file_cache_hot_t *v;
+	int n = 0;
+
+	v = calloc(FILE_CACHE_SHARDS * FILE_CACHE_MAX_ENTRIES, sizeof(*v));
+	if (!v)
+		return -1;
+	http_handler_globals_init_once();
+	for (int s = 0; s < FILE_CACHE_SHARDS; s++) {
+		file_cache_shard_t *shard = &file_cache_shards[s];
+
+		LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+		for (int i = 0; i < FILE_CACHE_BUCKETS; i++) {
+			const file_cache_entry_t *e = &shard->table[i];
+
+			if (!e->path || (v[n].path = strdup(e->path)) == NULL)
+				continue;
+			v[n++].freq = sketch_estimate_locked(shard, e->hash);
+		}
+		LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+	}
+	qsort(v, (size_t)n, sizeof(*v), file_cache_hot_cmp);
+	for (int i = 0; i < n; i++) {
+		fn(v[i].path, ctx);
+		free(v[i].path);
+	}
+	free(v);
+	return n;
+}
+
+/**
+ * @brief Sum the counters of every shard.
+ *
+ * @param out Receives the totals.
+ */
+void
+http_file_cache_stats(http_file_cache_stats_t *out)
+{
+	memset(out, 0, sizeof(*out));
+	http_handler_globals_init_once();
+	for (int s = 0; s < FILE_CACHE_SHARDS; s++) {
+		file_cache_shard_t *shard = &file_cache_shards[s];
+		LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+		out->entries += (unsigned long)shard->count;
+		out->bytes += shard->bytes;
+		out->hits += shard->hits;
+		out->misses += shard->misses;
+		out->inserts += shard->inserts;
+		out->rejects += shard->rejects;
+		out->evictions += shard->evictions;
+		LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
+	}
+	out->budget = __atomic_load_n(&file_cache_shard_budget,
+	    __ATOMIC_RELAXED) * FILE_CACHE_SHARDS;
+}
+
 /**
  * @brief http_handler_globals_cleanup operation.
  *
@@ -362,14 +940,26 @@ http_handler_globals_cleanup(void)
 
 	for (shard_idx = 0; shard_idx < FILE_CACHE_SHARDS; shard_idx++) {
 		shard = &file_cache_shards[shard_idx];
-		pthread_mutex_lock(&shard->lock);
-		for (i = 0; i < FILE_CACHE_SLOTS; i++) {
-			free(shard->entries[i].data);
-			shard->entries[i].data = NULL;
-			memset(shard->entries[i].path, 0,
-			    sizeof(shard->entries[i].path));
-			shard->entries[i].len = 0;
+		LOCKSTAT_LOCK(&shard->lock, lockstat_shard);
+		for (i = 0; i < FILE_CACHE_BUCKETS; i++) {
+			if (shard->table[i].path) {
+				file_cache_watch_close(shard->table[i].watch_fd);
+				file_cache_watch_close(shard->table[i].base_fd);
+			}
+			http_blob_release(shard->table[i].blob);
+			free(shard->table[i].path);
+			memset(&shard->table[i], 0, sizeof(shard->table[i]));
 		}
-		pthread_mutex_unlock(&shard->lock);
+		shard->bytes = 0;
+		shard->count = 0;
+		shard->hand = 0;
+		LOCKSTAT_UNLOCK(&shard->lock, lockstat_shard);
 	}
+	LOCKSTAT_LOCK(&watched_dir_lock, lockstat_dirs);
+	for (i = 0; i < watched_dir_count; i++)
+		close(watched_dirs[i].fd);
+	watched_dir_count = 0;
+	LOCKSTAT_UNLOCK(&watched_dir_lock, lockstat_dirs);
+	http_response_pool_cleanup();
+	http_file_map_cleanup();
 }
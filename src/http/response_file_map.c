@@ -0,0 +1,167 @@
+#include <miniweb/http/file_map.h>
+
+#include <sys/mman.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/log.h>
+
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static http_file_map_t *map_slots[HTTP_FILE_MAP_SLOTS];
+
+/** Unmap and free @p m; called once it is unreferenced and uncached. */
+static void
+map_destroy(http_file_map_t *m)
+{
+	munmap((void *)m->base, m->len);
+	free(m);
+}
+
+/** Take @p slot out of the table; returns 1 when it can be destroyed now. */
+static int
+map_evict_locked(int slot)
+{
+	http_file_map_t *m = map_slots[slot];
+	map_slots[slot] = NULL;
+	m->cached = 0;
+	return m->refs == 0;
+}
+
+/** 1 when @p m still describes the file behind @p st. */
+static int
+map_current(const http_file_map_t *m, const struct stat *st)
+{
+	return m->dev == st->st_dev && m->ino == st->st_ino &&
+	    m->size == st->st_size && m->mtime == st->st_mtime;
+}
+
+/**
+ * @brief Look up or create a mapping for a large static file.
+ *
+ * @details The cache is consulted under the lock; mmap(2) itself runs
+ * outside it. A new mapping replaces a stale entry for the same path,
+ * else takes a free slot, else the least recently used idle one. When
+ * every slot is streaming, the mapping is served uncached.
+ */
+http_file_map_t *
+http_file_map_acquire(const char *path, int fd, const struct stat *st)
+{
+	http_file_map_t *doomed = NULL;
+	time_t now = time(NULL);
+
+	if (st->st_size <= 0 || (unsigned long long)st->st_size > SIZE_MAX)
+		return NULL;
+
+	pthread_mutex_lock(&map_lock);
+	for (int i = 0; i < HTTP_FILE_MAP_SLOTS; i++) {
+		http_file_map_t *m = map_slots[i];
+		if (!m || strcmp(m->path, path) != 0)
+			continue;
+		if (map_current(m, st)) {
+			m->refs++;
+			m->last_used = now;
+			pthread_mutex_unlock(&map_lock);
+			return m;
+		}
+		if (map_evict_locked(i))
+			doomed = m;
+		break;
+	}
+	pthread_mutex_unlock(&map_lock);
+	if (doomed)
+		map_destroy(doomed);
+
+	void *base = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED,
+	    fd, 0);
+	if (base == MAP_FAILED) {
+		log_debug("[HTTP] mmap %s failed, falling back to pread", path);
+		return NULL;
+	}
+	(void)madvise(base, (size_t)st->st_size, MADV_SEQUENTIAL);
+
+	http_file_map_t *m = calloc(1, sizeof(*m));
+	if (!m) {
+		munmap(base, (size_t)st->st_size);
+		return NULL;
+	}
+	(void)snprintf(m->path, sizeof(m->path), "%s", path);
+	m->dev = st->st_dev;
+	m->ino = st->st_ino;
+	m->size = st->st_size;
+	m->mtime = st->st_mtime;
+	m->base = base;
+	m->len = (size_t)st->st_size;
+	m->refs = 1;
+	m->last_used = now;
+
+	doomed = NULL;
+	pthread_mutex_lock(&map_lock);
+	int slot = -1;
+	for (int i = 0; i < HTTP_FILE_MAP_SLOTS; i++) {
+		http_file_map_t *c = map_slots[i];
+		if (!c) {
+			if (slot < 0 || map_slots[slot])
+				slot = i;
+			continue;
+		}
+		if (strcmp(c->path, path) == 0 && map_current(c, st)) {
+			/* Another worker mapped it meanwhile; share theirs. */
+			c->refs++;
+			c->last_used = now;
+			pthread_mutex_unlock(&map_lock);
+			map_destroy(m);
+			return c;
+		}
+		if (c->refs == 0 && (slot < 0 || (map_slots[slot] &&
+		    c->last_used < map_slots[slot]->last_used)))
+			slot = i;
+	}
+	if (slot >= 0) {
+		http_file_map_t *old = map_slots[slot];
+		if (old && map_evict_locked(slot))
+			doomed = old;
+		m->cached = 1;
+		map_slots[slot] = m;
+	}
+	pthread_mutex_unlock(&map_lock);
+	if (doomed)
+		map_destroy(doomed);
+	return m;
+}
+
+/** Drop one reference; the last one out unmaps an evicted mapping. */
+void
+http_file_map_release(http_file_map_t *m)
+{
+	int destroy;
+
+	if (!m)
+		return;
+	pthread_mutex_lock(&map_lock);
+	destroy = --m->refs == 0 && !m->cached;
+	pthread_mutex_unlock(&map_lock);
+	if (destroy)
+		map_destroy(m);
+}
+
+/** Unmap every cached mapping nobody is streaming from. */
+void
+http_file_map_cleanup(void)
+{
+	http_file_map_t *doomed[HTTP_FILE_MAP_SLOTS];
+	int n = 0;
+
+	pthread_mutex_lock(&map_lock);
+	for (int i = 0; i < HTTP_FILE_MAP_SLOTS; i++) {
+		http_file_map_t *m = map_slots[i];
+		if (m && map_evict_locked(i))
+			doomed[n++] = m;
+	}
+	pthread_mutex_unlock(&map_lock);
+	for (int i = 0; i < n; i++)
+		map_destroy(doomed[i]);
+}
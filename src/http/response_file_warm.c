@@ -0,0 +1,268 @@
+#include <miniweb/http/handler.h>
+#include <miniweb/http/response_internal.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/readiness.h>
+#include <miniweb/net/handoff.h>
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define WARM_MAX_DEPTH	8	/* directory levels below the root */
+#define WARM_HOT_MAX	4096	/* inherited paths kept */
+
+typedef struct {
+	size_t budget;
+	size_t used;
+	unsigned long files;
+} warm_state_t;
+
+static pthread_mutex_t warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t warm_thread;
+static int warm_started;
+static int warm_stop;
+static char warm_root[PATH_MAX];
+static size_t warm_budget;
+static int warm_registered;
+static char **warm_hot;		/* inherited paths, hottest first */
+static int warm_hot_count;
+
+/**
+ * @brief Preload one file, as the identity or the gzip variant.
+ *
+ * @details A .gz file is only loaded when it is the sidecar
+ * http_send_file() would pick: its original exists, compresses and is
+ * not newer than it.
+ */
+static void
+warm_file(warm_state_t *ws, const char *path, const struct stat *st)
+{
+	char base[PATH_MAX];
+	struct stat bst;
+	const char *mime;
+	const char *encoding = NULL;
+	size_t len = strlen(path);
+	long n;
+
+	if (st->st_size <= 0 || (size_t)st->st_size > FILE_CACHE_MAX_BYTES ||
+	    ws->used + (size_t)st->st_size > ws->budget)
+		return;
+	if (len > 3 && strcmp(path + len - 3, ".gz") == 0) {
+		memcpy(base, path, len - 3);
+		base[len - 3] = '\0';
+		mime = mime_type_for_path(base);
+		if (!mime_type_is_compressible(mime) ||
+		    stat(base, &bst) != 0 || bst.st_mtime > st->st_mtime)
+			return;
+		encoding = "gzip";
+	} else {
+		mime = mime_type_for_path(path);
+	}
+	n = http_file_preload(path, mime, encoding);
+	if (n > 0) {
+		ws->used += (size_t)n;
+		ws->files++;
+	}
+}
+
+/**
+ * @brief Walk @p dir depth-first, stopping at the budget or on shutdown.
+ *
+ * @details Paths are built as "%s/%s" from the root, the same way
+ * static_handler() builds them, so the cache keys match.
+ */
+static void
+warm_dir(warm_state_t *ws, const char *dir, int depth)
+{
+	DIR *d;
+	struct dirent *entry;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+	while ((entry = readdir(d)) != NULL) {
+		char path[PATH_MAX];
+		struct stat st;
+		int n;
+
+		if (__atomic_load_n(&warm_stop, __ATOMIC_RELAXED) ||
+		    ws->used >= ws->budget)
+			break;
+		if (entry->d_name[0] == '.')
+			continue;
+		n = snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (n < 0 || (size_t)n >= sizeof(path) || lstat(path, &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode) && depth < WARM_MAX_DEPTH)
+			warm_dir(ws, path, depth + 1);
+		else if (S_ISREG(st.st_mode))
+			warm_file(ws, path, &st);
+	}
+	closedir(d);
+}
+
+/**
+ * @brief Load the paths a predecessor had cached, hottest first.
+ *
+ * @details Only paths under the current root are taken, so a changed
+ * static_dir falls back to the walk.
+ */
+static void
+warm_hot_replay(warm_state_t *ws)
+{
+	size_t rootlen = strlen(warm_root);
+	struct stat st;
+
+	for (int i = 0; i < warm_hot_count; i++) {
+		const char *path = warm_hot[i];
+
+		if (__atomic_load_n(&warm_stop, __ATOMIC_RELAXED) ||
+		    ws->used >= ws->budget)
+			break;
+		if (strncmp(path, warm_root, rootlen) == 0 &&
+		    path[rootlen] == '/' && strstr(path, "/../") == NULL &&
+		    lstat(path, &st) == 0 && S_ISREG(st.st_mode))
+			warm_file(ws, path, &st);
+	}
+}
+
+/** Warm-up thread body. */
+static void *
+warm_main(void *arg)
+{
+	warm_state_t ws = {warm_budget, 0, 0};
+	struct timespec t0;
+	struct timespec t1;
+	int inherited = warm_hot_count > 0;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (inherited)
+		warm_hot_replay(&ws);
+	else
+		warm_dir(&ws, warm_root, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	log_info("[WARMUP] %lu files, %zu KiB cached from %s in %ld ms",
+	    ws.files, ws.used / 1024,
+	    inherited ? "the previous process" : warm_root,
+	    (long)((t1.tv_sec - t0.tv_sec) * 1000 +
+	    (t1.tv_nsec - t0.tv_nsec) / 1000000));
+	readiness_done("static");
+	return NULL;
+}
+
+/** handoff save(): what the file cache holds, for the successor. */
+static void
+warm_state_put(const char *path, void *ctx)
+{
+	if (strchr(path, '\n') == NULL)
+		fprintf(ctx, "%s\n", path);
+}
+
+/** handoff save() of the "warm" section. */
+static void
+warm_state_save(FILE *f, void *ctx)
+{
+	(void)ctx;
+	(void)http_file_cache_hot(warm_state_put, f);
+}
+
+/** handoff load(): one path the predecessor had cached. */
+static void
+warm_state_load(const char *line, void *ctx)
+{
+	char **v;
+
+	(void)ctx;
+	if (warm_hot_count == WARM_HOT_MAX || line[0] != '/')
+		return;
+	v = realloc(warm_hot, (size_t)(warm_hot_count + 1) * sizeof(*v));
+	if (!v)
+		return;
+	warm_hot = v;
+	if ((warm_hot[warm_hot_count] = strdup(line)) != NULL)
+		warm_hot_count++;
+}
+
+/** Free the inherited paths; the warm-up thread is not running. */
+static void
+warm_hot_free(void)
+{
+	for (int i = 0; i < warm_hot_count; i++)
+		free(warm_hot[i]);
+	free(warm_hot);
+	warm_hot = NULL;
+	warm_hot_count = 0;
+}
+
+/**
+ * @brief Preload the static tree into the file cache in the background.
+ *
+ * @details Also hands the cached paths to a successor on a handoff. A
+ * server started by one loads its predecessor's paths, hottest first,
+ * instead of walking the tree, within @p budget or, when that is 0, the
+ * file cache budget.
+ *
+ * @param root Static directory, as in config_static_dir.
+ * @param budget Bytes of file bodies to load at most; 0 does nothing
+ *        unless paths were inherited.
+ *
+ * @return 0 when the warm-up thread was started or not needed, -1 on
+ *         failure.
+ */
+int
+http_file_cache_warm_start(const char *root, size_t budget)
+{
+	http_file_cache_stats_t st;
+	int rc = 0;
+
+	pthread_mutex_lock(&warm_lock);
+	if (!warm_registered) {
+		warm_registered = 1;
+		if (handoff_state_register(&(struct handoff_state_ops){
+			.name = "warm",
+			.save = warm_state_save,
+			.load = warm_state_load,
+			.ctx = NULL,
+		    }) < 0)
+			log_error("[WARMUP] cache state handoff unavailable");
+	}
+	if (budget == 0 && warm_hot_count > 0) {
+		http_file_cache_stats(&st);
+		budget = st.budget;
+	}
+	if (budget > 0 && root && *root && !warm_started) {
+		strlcpy(warm_root, root, sizeof(warm_root));
+		warm_budget = budget;
+		__atomic_store_n(&warm_stop, 0, __ATOMIC_RELAXED);
+		(void)readiness_expect("static");
+		if (pthread_create(&warm_thread, NULL, warm_main, NULL) == 0) {
+			warm_started = 1;
+		} else {
+			readiness_done("static");
+			rc = -1;
+		}
+	}
+	pthread_mutex_unlock(&warm_lock);
+	return rc;
+}
+
+/** Stop a running warm-up and wait for its thread. */
+void
+http_file_cache_warm_stop(void)
+{
+	pthread_mutex_lock(&warm_lock);
+	if (warm_started) {
+		__atomic_store_n(&warm_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(warm_thread, NULL);
+		warm_started = 0;
+	}
+	warm_hot_free();
+	pthread_mutex_unlock(&warm_lock);
+}
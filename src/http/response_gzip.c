@@ -0,0 +1,152 @@
+#include <miniweb/http/gzip.h>
+#include <miniweb/http/utils.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define GZIP_WINDOW_BITS	(15 + 16)	/* deflate window, gzip framing */
+#define GZIP_MEM_LEVEL		8
+#define GZIP_CHUNK		(64 * 1024)	/* input fed per deflate() call */
+
+/**
+ * @brief Deflate @p src into @p dst with gzip framing.
+ *
+ * @details Input is fed in GZIP_CHUNK slices so zlib works on a bounded
+ * window of the source at a time; @p cap must be at least deflateBound()
+ * for @p len, which guarantees the output never runs short.
+ *
+ * @return Number of bytes written to @p dst, or 0 on failure.
+ */
+static size_t
+gzip_deflate(const char *src, size_t len, unsigned char *dst, size_t cap,
+    int level)
+{
+	z_stream zs;
+	size_t fed = 0;
+	size_t out;
+	int rc;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level, Z_DEFLATED, GZIP_WINDOW_BITS,
+	    GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+	zs.next_out = dst;
+	zs.avail_out = (uInt)cap;
+	do {
+		size_t slice = len - fed < GZIP_CHUNK ? len - fed : GZIP_CHUNK;
+		zs.next_in = (Bytef *)(uintptr_t)(src + fed);
+		zs.avail_in = (uInt)slice;
+		fed += slice;
+		rc = deflate(&zs, fed == len ? Z_FINISH : Z_NO_FLUSH);
+	} while (rc == Z_OK && fed < len);
+	out = rc == Z_STREAM_END ? zs.total_out : 0;
+	deflateEnd(&zs);
+	return out;
+}
+
+/** Upper bound of the gzip output for @p len input bytes, 0 if too large. */
+static size_t
+gzip_bound(size_t len)
+{
+	z_stream zs;
+	uLong bound;
+
+	if (len > 0xffffffffUL - GZIP_CHUNK)
+		return 0;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED,
+	    GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+	bound = deflateBound(&zs, (uLong)len);
+	deflateEnd(&zs);
+	return (size_t)bound;
+}
+
+/**
+ * @brief Build a gzip blob for a payload that is served many times.
+ *
+ * @details Compressed at the best level: the cost is paid once per
+ * snapshot, not per request. The blob is shrunk to the encoded size.
+ *
+ * @return New blob holding one reference, or NULL on failure.
+ */
+http_blob_t *
+http_gzip_blob(const char *data, size_t len)
+{
+	http_blob_t *blob;
+	http_blob_t *small;
+	size_t cap;
+	size_t n;
+
+	if (!data || (cap = gzip_bound(len)) == 0)
+		return NULL;
+	blob = http_blob_alloc(cap);
+	if (!blob)
+		return NULL;
+	n = gzip_deflate(data, len, (unsigned char *)blob->data, cap,
+	    Z_BEST_COMPRESSION);
+	if (n == 0) {
+		http_blob_release(blob);
+		return NULL;
+	}
+	small = realloc(blob, sizeof(*blob) + n + 1);
+	if (small)
+		blob = small;
+	blob->len = n;
+	blob->data[n] = '\0';
+	return blob;
+}
+
+/**
+ * @brief Encode a generated response body on the fly.
+ *
+ * @param req Request providing Accept-Encoding and the arena.
+ * @param resp Response whose body is replaced when encoding pays off.
+ *
+ * @return 1 when the body is now gzip-encoded, otherwise 0.
+ */
+int
+http_response_gzip(http_request_t *req, http_response_t *resp)
+{
+	unsigned char *dst;
+	size_t cap;
+	size_t n;
+
+	if (!resp || !mime_type_is_compressible(resp->content_type))
+		return 0;
+	http_response_add_header(resp, "Vary", "Accept-Encoding");
+	if (!resp->body || resp->body_len < HTTP_GZIP_MIN_BYTES ||
+	    !http_request_accepts_encoding(req, "gzip"))
+		return 0;
+	if ((cap = gzip_bound(resp->body_len)) == 0)
+		return 0;
+
+	dst = req->arena ? http_arena_alloc(req->arena, cap) : malloc(cap);
+	if (!dst)
+		return 0;
+	n = gzip_deflate(resp->body, resp->body_len, dst, cap,
+	    Z_DEFAULT_COMPRESSION);
+	if (n == 0 || n >= resp->body_len) {
+		if (!req->arena)
+			free(dst);
+		return 0;
+	}
+	if (resp->free_body)
+		free(resp->body);
+	http_response_set_body(resp, (char *)dst, n, req->arena == NULL);
+	http_response_add_header(resp, "Content-Encoding", "gzip");
+	return 1;
+}
+
+/** Serve @p blob's bytes as the gzip-encoded body of @p resp. */
+void
+http_response_set_gzip_blob(http_response_t *resp, const http_blob_t *blob)
+{
+	http_response_set_body(resp, (char *)(uintptr_t)blob->data, blob->len,
+	    0);
+	http_response_add_header(resp, "Content-Encoding", "gzip");
+	http_response_add_header(resp, "Vary", "Accept-Encoding");
+}
@@ -0,0 +1,214 @@
+#include <miniweb/http/response_internal.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Response heads are assembled from pre-rendered pieces: a full status
+ * line per known code, constant header fragments and a Date line that
+ * is formatted once per second. Only Content-Type and Content-Length
+ * vary per response; everything is copied with memcpy, no printf.
+ */
+
+#define STATUS_ENTRY(code, text) \
+	{ code, text, "HTTP/1.1 " #code " " text "\r\n", \
+	  sizeof("HTTP/1.1 " #code " " text "\r\n") - 1 }
+
+#define FRAG(s) s, sizeof(s) - 1
+
+typedef struct {
+	int code;
+	const char *text;
+	const char *line;
+	size_t line_len;
+} status_entry_t;
+
+static const status_entry_t status_table[] = {
+	STATUS_ENTRY(200, "OK"),
+	STATUS_ENTRY(206, "Partial Content"),
+	STATUS_ENTRY(301, "Moved Permanently"),
+	STATUS_ENTRY(302, "Found"),
+	STATUS_ENTRY(304, "Not Modified"),
+	STATUS_ENTRY(400, "Bad Request"),
+	STATUS_ENTRY(403, "Forbidden"),
+	STATUS_ENTRY(404, "Not Found"),
+	STATUS_ENTRY(405, "Method Not Allowed"),
+	STATUS_ENTRY(416, "Range Not Satisfiable"),
+	STATUS_ENTRY(429, "Too Many Requests"),
+	STATUS_ENTRY(500, "Internal Server Error"),
+	STATUS_ENTRY(501, "Not Implemented"),
+	STATUS_ENTRY(503, "Service Unavailable"),
+};
+
+#define STATUS_COUNT (sizeof(status_table) / sizeof(status_table[0]))
+
+/*
+ * Date lines rotate through a few slots: the writer fills the slot after
+ * the published one, so a reader copying the current line is never
+ * overwritten unless it stalls for DATE_SLOTS - 1 seconds.
+ */
+#define DATE_SLOTS 4
+
+static struct {
+	time_t sec;
+	size_t len;
+	char line[HTTP_HEAD_END_MAX];
+} date_slots[DATE_SLOTS];
+static unsigned int date_current;
+static pthread_mutex_t date_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Table entry for @p code, or NULL for codes without one. */
+static const status_entry_t *
+status_lookup(int code)
+{
+	for (size_t i = 0; i < STATUS_COUNT; i++) {
+		if (status_table[i].code == code)
+			return &status_table[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Reason phrase for @p status_code.
+ * @return Static string; "Unknown" for codes outside the table.
+ */
+const char *
+http_response_status_text(int status_code)
+{
+	const status_entry_t *s = status_lookup(status_code);
+
+	return s ? s->text : "Unknown";
+}
+
+/** Append @p n bytes at @p p; NULL once the buffer is exhausted. */
+static char *
+head_put(char *p, const char *end, const char *src, size_t n)
+{
+	if (!p || (size_t)(end - p) < n)
+		return NULL;
+	memcpy(p, src, n);
+	return p + n;
+}
+
+/** Append the decimal form of @p v. */
+static char *
+head_put_size(char *p, const char *end, size_t v)
+{
+	char digits[24];
+	size_t n = sizeof(digits);
+
+	do {
+		digits[--n] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v > 0);
+	return head_put(p, end, digits + n, sizeof(digits) - n);
+}
+
+/** Status line for codes outside the table: "HTTP/1.1 NNN Unknown". */
+static char *
+head_put_status(char *p, const char *end, int code)
+{
+	const status_entry_t *s = status_lookup(code);
+
+	if (s)
+		return head_put(p, end, s->line, s->line_len);
+	p = head_put(p, end, FRAG("HTTP/1.1 "));
+	p = head_put_size(p, end, code > 0 ? (size_t)code : 0);
+	return head_put(p, end, FRAG(" Unknown\r\n"));
+}
+
+/**
+ * @brief Serialize the status line and headers of @p resp.
+ *
+ * @details The block stops short of the Date line and the blank line;
+ * http_response_head_end() supplies both at send time, so prepared heads
+ * never carry a stale date.
+ *
+ * @param resp Response whose status, type, length and extra headers are used.
+ * @param keep_alive Selects the Connection header value.
+ * @param buf Destination buffer.
+ * @param cap Size of @p buf.
+ *
+ * @return Header block length, or -1 if it does not fit.
+ */
+int
+http_response_format_head(const http_response_t *resp, int keep_alive,
+    char *buf, size_t cap)
+{
+	const char *end = buf + cap;
+	char *p = buf;
+
+	p = head_put_status(p, end, resp->status_code);
+	if (resp->status_code != 304) {
+		/* 304 carries no representation metadata beyond validators. */
+		if (resp->content_type) {
+			p = head_put(p, end, FRAG("Content-Type: "));
+			p = head_put(p, end, resp->content_type,
+			    strlen(resp->content_type));
+			p = head_put(p, end, FRAG("\r\n"));
+		}
+		if (resp->stream == HTTP_STREAM_CHUNKED) {
+			p = head_put(p, end,
+			    FRAG("Transfer-Encoding: chunked\r\n"));
+		} else if (resp->stream == HTTP_STREAM_NONE) {
+			p = head_put(p, end, FRAG("Content-Length: "));
+			p = head_put_size(p, end, resp->body_len);
+			p = head_put(p, end, FRAG("\r\n"));
+		}
+	}
+	if (keep_alive)
+		p = head_put(p, end, FRAG("Connection: keep-alive\r\n"));
+	else
+		p = head_put(p, end, FRAG("Connection: close\r\n"));
+	p = head_put(p, end, FRAG("Server: MiniWeb/kqueue\r\n"));
+	if (!p)
+		return -1;
+
+	if (resp->headers_len > 0 && resp->headers_len < (size_t)(end - p))
+		p = head_put(p, end, resp->headers, resp->headers_len);
+	return (int)(p - buf);
+}
+
+/**
+ * @brief Copy the closing "Date: ...\r\n\r\n" of a response head.
+ *
+ * @param buf Destination, at least HTTP_HEAD_END_MAX bytes.
+ *
+ * @return Bytes written.
+ */
+size_t
+http_response_head_end(char *buf)
+{
+	time_t now = time(NULL);
+	unsigned int i = __atomic_load_n(&date_current, __ATOMIC_ACQUIRE);
+
+	if (date_slots[i].sec != now) {
+		pthread_mutex_lock(&date_lock);
+		i = date_current;
+		if (date_slots[i].sec != now) {
+			char date[HTTP_DATE_MAX];
+			char *p;
+			unsigned int next = (i + 1) % DATE_SLOTS;
+			const char *end = date_slots[next].line +
+			    sizeof(date_slots[next].line);
+
+			http_format_date(now, date, sizeof(date));
+			p = head_put(date_slots[next].line, end, FRAG("Date: "));
+			p = head_put(p, end, date, strlen(date));
+			p = head_put(p, end, FRAG("\r\n\r\n"));
+			date_slots[next].len = p ?
+			    (size_t)(p - date_slots[next].line) : 0;
+			date_slots[next].sec = now;
+			__atomic_store_n(&date_current, next, __ATOMIC_RELEASE);
+			i = next;
+		}
+		pthread_mutex_unlock(&date_lock);
+	}
+	if (date_slots[i].len == 0) {
+		memcpy(buf, "\r\n", 2);
+		return 2;
+	}
+	memcpy(buf, date_slots[i].line, date_slots[i].len);
+	return date_slots[i].len;
+}
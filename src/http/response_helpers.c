@@ -1,63 +1,127 @@
 #include <miniweb/http/handler.h>
+#include <miniweb/http/gzip.h>
 
 #include <arpa/inet.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/conf.h>
 #include <miniweb/router/urls.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
 
 extern miniweb_conf_t config;
 
+/** FNV-1a over @p len bytes of a header name, folded to lower case. */
+static uint32_t
+header_name_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)name[i];
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c + ('a' - 'A'));
+		h = (h ^ c) * 16777619u;
+	}
+	return h;
+}
+
+/**
+ * @brief Build the request's header index on first use.
+ *
+ * @details Requests from the worker carry the parser's spans; any other
+ * request (tests, synthetic error replies) has @c buffer scanned once by
+ * the same parser. Only the name hashes are new work either way.
+ */
+static void
+header_index_build(http_request_t *req)
+{
+	if (!req->headers || req->headers == req->hdr_spans) {
+		http_request_parser_t p;
+		size_t len = req->buffer_len ? req->buffer_len :
+		    strlen(req->buffer);
+
+		http_request_parser_reset(&p);
+		(void)http_request_parser_feed(&p, req->buffer, len);
+		memcpy(req->hdr_spans, p.headers,
+		    (size_t)p.header_count * sizeof(p.headers[0]));
+		req->headers = req->hdr_spans;
+		req->header_count = p.header_count;
+	}
+	for (int i = 0; i < req->header_count; i++)
+		req->hdr_hash[i] = header_name_hash(
+		    req->buffer + req->headers[i].name_off,
+		    req->headers[i].name_len);
+	req->hdr_index_of = req->buffer;
+}
+
 /**
- * @brief http_request_get_header operation.
+ * @brief Look up a request header by name, case-insensitively.
  *
- * @details Performs the core http_request_get_header routine for this module.
+ * @details The first call indexes every header (see handler.h); later
+ * calls compare one hash per header and confirm matches by name.
  *
- * @param req Input parameter for http_request_get_header.
- * @param name Input parameter for http_request_get_header.
+ * @param req Request to search.
+ * @param name Header name.
  *
- * @return Return value produced by http_request_get_header.
+ * @return Value copied into req->hdr_scratch, or NULL when absent. The
+ *         next lookup overwrites it.
  */
 const char *
 http_request_get_header(http_request_t *req, const char *name)
 {
-	const char *colon;
-	const char *end;
-	const char *header;
-	const char *val;
-	char search[256];
+	size_t name_len;
 	size_t len;
+	uint32_t hash;
 
-	snprintf(search, sizeof(search), "\r\n%s:", name);
-	header = strcasestr(req->buffer, search);
-	if (!header) {
-		snprintf(search, sizeof(search), "%s:", name);
-		header = strcasestr(req->buffer, search);
-		if (!header)
-			return NULL;
-	}
-
-	colon = strchr(header, ':');
-	if (!colon)
+	if (!req->buffer)
 		return NULL;
-	val = colon + 1;
-	while (*val == ' ' || *val == '\t')
-		val++;
+	if (req->hdr_index_of != req->buffer)
+		header_index_build(req);
 
-	end = strstr(val, "\r\n");
-	if (!end)
-		return NULL;
-	len = (size_t)(end - val);
-	if (len >= sizeof(req->hdr_scratch))
-		len = sizeof(req->hdr_scratch) - 1;
+	name_len = strlen(name);
+	hash = header_name_hash(name, name_len);
+	for (int i = 0; i < req->header_count; i++) {
+		const http_header_span_t *h = &req->headers[i];
+		if (req->hdr_hash[i] != hash || h->name_len != name_len ||
+		    strncasecmp(req->buffer + h->name_off, name, name_len) != 0)
+			continue;
+		len = h->value_len;
+		if (len >= sizeof(req->hdr_scratch))
+			len = sizeof(req->hdr_scratch) - 1;
+		memcpy(req->hdr_scratch, req->buffer + h->value_off, len);
+		req->hdr_scratch[len] = '\0';
+		return req->hdr_scratch;
+	}
+	return NULL;
+}
 
-	memcpy(req->hdr_scratch, val, len);
-	req->hdr_scratch[len] = '\0';
-	return req->hdr_scratch;
+/**
+ * @brief Format the peer of @p req into @p peer_ip and say whether its
+ * forwarding headers are to be believed.
+ *
+ * @details A peer on the Unix-domain listener is a local proxy unless
+ * unix_socket_trusted is off: who may connect, and so choose the client
+ * address the rate limiter and the logs see, is up to the socket file's
+ * permissions. Its address is "unix".
+ */
+static int
+request_from_proxy(http_request_t *req, char *peer_ip, size_t len)
+{
+	if (req->client_addr && req->client_addr->sin_family == AF_UNIX) {
+		strlcpy(peer_ip, "unix", len);
+		return config.unix_socket_trusted;
+	}
+	if (req->client_addr)
+		inet_ntop(AF_INET, &req->client_addr->sin_addr, peer_ip,
+		    (socklen_t)len);
+	return config.trusted_proxy[0] != '\0' &&
+	    strcmp(peer_ip, config.trusted_proxy) == 0;
 }
 
 /**
@@ -78,13 +142,7 @@ http_request_get_client_ip(http_request_t *req)
 	const char *real_ip;
 	size_t len;
 
-	if (req->client_addr) {
-		inet_ntop(AF_INET, &req->client_addr->sin_addr, peer_ip,
-		    sizeof(peer_ip));
-	}
-
-	if (config.trusted_proxy[0] != '\0' &&
-	    strcmp(peer_ip, config.trusted_proxy) == 0) {
+	if (request_from_proxy(req, peer_ip, sizeof(peer_ip))) {
 		real_ip = http_request_get_header(req, "X-Real-IP");
 		if (real_ip && real_ip[0]) {
 			strlcpy(req->ip_scratch, real_ip, sizeof(req->ip_scratch));
@@ -122,18 +180,51 @@ http_request_is_https(http_request_t *req)
 	char peer_ip[INET_ADDRSTRLEN] = {0};
 	const char *proto;
 
-	if (req->client_addr) {
-		inet_ntop(AF_INET, &req->client_addr->sin_addr, peer_ip,
-		    sizeof(peer_ip));
-	}
-	if (!(config.trusted_proxy[0] != '\0' &&
-	    strcmp(peer_ip, config.trusted_proxy) == 0))
+	if (!request_from_proxy(req, peer_ip, sizeof(peer_ip)))
 		return 0;
 
 	proto = http_request_get_header(req, "X-Forwarded-Proto");
 	return proto && strcmp(proto, "https") == 0;
 }
 
+/**
+ * @brief Method of @p req as an HTTP_METHOD_* value.
+ *
+ * @details The worker interns it while parsing; requests built by hand
+ * carry only the string, which is interned here.
+ */
+int
+http_request_method(const http_request_t *req)
+{
+	if (req->method_id != HTTP_METHOD_OTHER)
+		return req->method_id;
+	return req->method ? http_method_parse(req->method,
+	    strlen(req->method)) : HTTP_METHOD_OTHER;
+}
+
+/** Length of the path part of @p req->url, split by the parser if set. */
+size_t
+http_request_path_len(const http_request_t *req)
+{
+	if (req->path_len != 0 || !req->url)
+		return req->path_len;
+	return strcspn(req->url, "?");
+}
+
+/** Query string of @p req without the '?', or NULL when there is none. */
+const char *
+http_request_query(const http_request_t *req)
+{
+	size_t n;
+
+	if (!req->url)
+		return NULL;
+	if (req->path_len != 0)
+		return req->query;
+	n = strcspn(req->url, "?");
+	return req->url[n] == '?' ? req->url + n + 1 : NULL;
+}
+
 /**
  * @brief http_send_error operation.
  *
@@ -147,8 +238,23 @@ http_request_is_https(http_request_t *req)
  */
 int
 http_send_error(http_request_t *req, int status_code, const char *message)
+{
+	return http_send_error_retry(req, status_code, message, 0);
+}
+
+/**
+ * @brief Send an error page telling the client when to come back.
+ *
+ * @param retry_sec Seconds for Retry-After; no header when 0 or less.
+ *
+ * @return As http_send_error().
+ */
+int
+http_send_error_retry(http_request_t *req, int status_code,
+    const char *message, int retry_sec)
 {
 	char allow[256];
+	char retry[16];
 	char body[2048];
 	int body_len;
 	int ret;
@@ -177,12 +283,294 @@ http_send_error(http_request_t *req, int status_code, const char *message)
 		if (route_allow_methods(req->url, allow, sizeof(allow)) > 0)
 			http_response_add_header(resp, "Allow", allow);
 	}
+	if (retry_sec > 0) {
+		snprintf(retry, sizeof(retry), "%d", retry_sec);
+		http_response_add_header(resp, "Retry-After", retry);
+	}
 
 	ret = http_response_send(req, resp);
 	http_response_free(resp);
 	return ret;
 }
 
+/**
+ * @brief Format a strong ETag for a file.
+ *
+ * @param st File status; inode, size and mtime all feed the tag.
+ * @param buf Destination, at least HTTP_ETAG_MAX bytes.
+ * @param cap Size of @p buf.
+ */
+void
+http_etag_for_file(const struct stat *st, char *buf, size_t cap)
+{
+	snprintf(buf, cap, "\"%llx-%llx-%llx\"",
+	    (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+	    (unsigned long long)st->st_mtime);
+}
+
+/**
+ * @brief Format an ETag for versioned generated content.
+ *
+ * @param kind One-letter namespace for the resource.
+ * @param version Content version; changes whenever the body does.
+ * @param buf Destination, at least HTTP_ETAG_MAX bytes.
+ * @param cap Size of @p buf.
+ */
+void
+http_etag_for_version(char kind, unsigned long version, char *buf,
+    size_t cap)
+{
+	snprintf(buf, cap, "\"%c%lx\"", kind, version);
+}
+
+/**
+ * @brief Format an HTTP date.
+ *
+ * @param t Seconds since the epoch.
+ * @param buf Destination, at least HTTP_DATE_MAX bytes.
+ * @param cap Size of @p buf.
+ */
+void
+http_format_date(time_t t, char *buf, size_t cap)
+{
+	struct tm tm;
+
+	if (gmtime_r(&t, &tm) == NULL ||
+	    strftime(buf, cap, "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0) {
+		if (cap > 0)
+			buf[0] = '\0';
+	}
+}
+
+/**
+ * @brief Parse an IMF-fixdate; the obsolete RFC 850 and asctime forms
+ * are treated as absent.
+ *
+ * @return Seconds since the epoch, or -1 when @p s is not a valid date.
+ */
+static time_t
+http_parse_date(const char *s)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	char wday[4], mon[4];
+	struct tm tm;
+	const char *m;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(s, "%3s, %2d %3s %4d %2d:%2d:%2d GMT", wday, &tm.tm_mday,
+	    mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 7)
+		return -1;
+	m = strstr(months, mon);
+	if (m == NULL || strlen(mon) != 3 || (m - months) % 3 != 0)
+		return -1;
+	tm.tm_mon = (int)((m - months) / 3);
+	tm.tm_year -= 1900;
+	return timegm(&tm);
+}
+
+/**
+ * @brief Return 1 when one entity tag of an If-None-Match list equals
+ * @p etag. Weak comparison: a W/ prefix on either side is ignored.
+ */
+static int
+http_etag_list_matches(const char *list, const char *etag)
+{
+	const char *p = list;
+	size_t elen;
+
+	if (etag[0] == 'W' && etag[1] == '/')
+		etag += 2;
+	elen = strlen(etag);
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ',')
+			p++;
+		if (*p == '*')
+			return 1;
+		if (p[0] == 'W' && p[1] == '/')
+			p += 2;
+		const char *end = p;
+		while (*end && *end != ',')
+			end++;
+		size_t len = (size_t)(end - p);
+		while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+			len--;
+		if (len == elen && memcmp(p, etag, elen) == 0)
+			return 1;
+		p = end;
+	}
+	return 0;
+}
+
+/**
+ * @brief Evaluate the request's conditional GET headers.
+ *
+ * @param req Request carrying If-None-Match / If-Modified-Since.
+ * @param etag Current entity tag, or NULL.
+ * @param last_modified Current modification time, or 0 when unknown.
+ *
+ * @return 1 when a 304 may be sent, otherwise 0.
+ */
+int
+http_request_not_modified(http_request_t *req, const char *etag,
+    time_t last_modified)
+{
+	const char *v;
+	time_t since;
+
+	switch (http_request_method(req)) {
+	case HTTP_METHOD_GET:
+	case HTTP_METHOD_HEAD:
+		break;
+	default:
+		return 0;
+	}
+	v = http_request_get_header(req, "If-None-Match");
+	if (v != NULL)
+		return etag != NULL && http_etag_list_matches(v, etag);
+	if (last_modified == 0)
+		return 0;
+	v = http_request_get_header(req, "If-Modified-Since");
+	if (v == NULL || (since = http_parse_date(v)) < 0)
+		return 0;
+	return last_modified <= since;
+}
+
+/**
+ * @brief Check whether the client accepts a content-coding.
+ *
+ * @details Scans Accept-Encoding for @p coding (or "*") and honours an
+ * explicit q=0 as a refusal; other q-values are not ranked.
+ *
+ * @param req Request carrying Accept-Encoding.
+ * @param coding Coding name such as "gzip".
+ *
+ * @return 1 when a response in @p coding is acceptable, otherwise 0.
+ */
+int
+http_request_accepts_encoding(http_request_t *req, const char *coding)
+{
+	const char *p;
+	const char *name_end;
+	const char *end;
+	const char *q;
+	size_t clen;
+	size_t len;
+	int refused;
+	int star = 0;
+
+	p = http_request_get_header(req, "Accept-Encoding");
+	if (p == NULL)
+		return 0;
+	clen = strlen(coding);
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ',')
+			p++;
+		end = strchr(p, ',');
+		if (end == NULL)
+			end = p + strlen(p);
+		name_end = memchr(p, ';', (size_t)(end - p));
+		if (name_end == NULL)
+			name_end = end;
+		len = (size_t)(name_end - p);
+		while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+			len--;
+
+		refused = 0;
+		for (q = name_end; q + 2 <= end; q++) {
+			if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+				refused = strtod(q + 2, NULL) <= 0.0;
+				break;
+			}
+		}
+		if (len == clen && strncasecmp(p, coding, clen) == 0)
+			return !refused;
+		if (len == 1 && *p == '*')
+			star = !refused;
+		p = end;
+	}
+	return star;
+}
+
+/**
+ * @brief Add validator headers to a 200 or 304 response.
+ *
+ * @param resp Response to extend.
+ * @param etag Entity tag, or NULL.
+ * @param last_modified Modification time, or 0 to omit Last-Modified.
+ */
+void
+http_response_add_validators(http_response_t *resp, const char *etag,
+    time_t last_modified)
+{
+	char date[HTTP_DATE_MAX];
+
+	if (etag != NULL && etag[0] != '\0')
+		http_response_add_header(resp, "ETag", etag);
+	if (last_modified != 0) {
+		http_format_date(last_modified, date, sizeof(date));
+		if (date[0] != '\0')
+			http_response_add_header(resp, "Last-Modified", date);
+	}
+}
+
+/**
+ * @brief Send 304 Not Modified.
+ *
+ * @param req Request being answered.
+ * @param etag Entity tag to repeat, or NULL.
+ * @param last_modified Modification time to repeat, or 0.
+ *
+ * @return 0 on success, -1 on write failure.
+ */
+int
+http_send_not_modified(http_request_t *req, const char *etag,
+    time_t last_modified)
+{
+	http_response_t *resp;
+	int ret;
+
+	resp = http_response_create();
+	if (!resp)
+		return -1;
+	resp->status_code = 304;
+	http_response_add_validators(resp, etag, last_modified);
+	ret = http_response_send(req, resp);
+	http_response_free(resp);
+	return ret;
+}
+
+/**
+ * @brief Copy a payload into request-lifetime storage.
+ *
+ * @details Prefers the per-request arena so the response can borrow the
+ * bytes with free_body = 0; falls back to malloc when no arena is
+ * attached (tests, direct callers) and reports that through @p owned.
+ *
+ * @param req Request whose arena receives the copy.
+ * @param src Bytes to copy.
+ * @param len Number of bytes in @p src.
+ * @param owned Set to 1 when the caller must free the result.
+ *
+ * @return NUL-terminated copy of @p src, or NULL on allocation failure.
+ */
+char *
+http_request_copy(http_request_t *req, const char *src, size_t len,
+    int *owned)
+{
+	char *dst;
+
+	*owned = 0;
+	if (req->arena != NULL)
+		return http_arena_strndup(req->arena, src, len);
+	dst = malloc(len + 1);
+	if (dst == NULL)
+		return NULL;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	*owned = 1;
+	return dst;
+}
+
 /**
  * @brief http_send_json operation.
  *
@@ -204,6 +592,7 @@ http_send_json(http_request_t *req, const char *json)
 		return -1;
 	resp->content_type = "application/json";
 	http_response_set_body(resp, (char *)json, strlen(json), 0);
+	http_response_gzip(req, resp);
 	ret = http_response_send(req, resp);
 	http_response_free(resp);
 	return ret;
@@ -4,6 +4,8 @@
 #include <poll.h>
 #include <unistd.h>
 
+#include <miniweb/net/trace.h>
+
 /**
  * @brief http_response_wait_fd_writable operation.
  *
@@ -23,7 +25,9 @@ http_response_wait_fd_writable(int fd)
 	pfd.events = POLLOUT;
 	pfd.revents = 0;
 	for (;;) {
+		uint64_t since = TRACE_NOW();
 		rc = poll(&pfd, 1, WRITE_WAIT_MS);
+		TRACE_WAIT(TRACE_WAIT_WRITE, since);
 		if (rc > 0) {
 			if (pfd.revents & POLLOUT)
 				return 0;
@@ -138,39 +142,60 @@ http_response_writev_all(int fd, struct iovec *iov, int iovcnt)
 }
 
 /**
- * @brief http_response_status_text operation.
- *
- * @details Performs the core http_response_status_text routine for this module.
+ * @brief Flush the output queue of @p req until at most @p keep bytes
+ * remain, waiting for the socket as a blocking write would.
  *
- * @param status_code Input parameter for http_response_status_text.
+ * @details Lets a handler that produces a body piece by piece bound what
+ * it leaves queued. Requests without an output queue write blocking
+ * already and return at once.
  *
- * @return Return value produced by http_response_status_text.
+ * @return 0 on success, -1 on socket error or when the peer stalls.
  */
-const char *
-http_response_status_text(int status_code)
+int
+http_response_drain(http_request_t *req, size_t keep)
 {
-	switch (status_code) {
-	case 200:
-		return "OK";
-	case 301:
-		return "Moved Permanently";
-	case 302:
-		return "Found";
-	case 304:
-		return "Not Modified";
-	case 400:
-		return "Bad Request";
-	case 403:
-		return "Forbidden";
-	case 404:
-		return "Not Found";
-	case 405:
-		return "Method Not Allowed";
-	case 500:
-		return "Internal Server Error";
-	case 503:
-		return "Service Unavailable";
-	default:
-		return "Unknown";
+	http_output_t *o = req->out;
+	int retries = 0;
+
+	while (o && o->len - o->off > keep) {
+		size_t before = o->len - o->off;
+		int rc = http_output_flush(o, req->fd);
+
+		if (rc < 0)
+			return -1;
+		if (rc > 0)
+			break;
+		if (o->len - o->off < before)
+			retries = 0;
+		else if (retries++ > WRITE_RETRY_LIMIT)
+			return -1;
+		if (http_response_wait_fd_writable(req->fd) < 0)
+			return -1;
 	}
+	return 0;
+}
+
+/**
+ * @brief Hand the socket of @p req over to the caller.
+ *
+ * @details Everything queued for the request is written first, then the
+ * socket is duplicated and keep-alive turned off, so the worker closes
+ * its own descriptor after the handler while the copy keeps the
+ * connection open. Used by responses that outlive their request, such
+ * as event streams fed from another thread.
+ *
+ * @return A descriptor the caller owns and must close, or -1 on error.
+ */
+int
+http_request_detach(http_request_t *req)
+{
+	int fd;
+
+	http_response_capture_drop(req);
+	if (http_response_drain(req, 0) < 0)
+		return -1;
+	if ((fd = dup(req->fd)) < 0)
+		return -1;
+	req->keep_alive = 0;
+	return fd;
 }
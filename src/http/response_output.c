@@ -0,0 +1,293 @@
+#include <miniweb/http/output.h>
+#include <miniweb/http/file_map.h>
+#include <miniweb/core/mem_budget.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * A client that stops reading leaves its response here, so both what
+ * one queue holds and the sum over all of them are bounded: the first
+ * by HTTP_OUTPUT_QUEUED_MAX, the second by the memory budget, which
+ * sees output_held. Nothing can be shrunk; the budget takes it out of
+ * the caches instead.
+ */
+
+static pthread_once_t output_budget_once = PTHREAD_ONCE_INIT;
+static size_t output_held;	/* buffer capacity of every queue */
+
+static size_t
+output_mem_usage(uint64_t *hits, void *ctx)
+{
+	(void)ctx;
+	*hits = 0;
+	return __atomic_load_n(&output_held, __ATOMIC_RELAXED);
+}
+
+static void
+output_budget_register(void)
+{
+	(void)mem_budget_register(&(struct mem_cache_ops){
+		.name = "output",
+		.usage = output_mem_usage,
+	});
+}
+
+/** Grow or shrink @p o's buffer to @p ncap, keeping output_held. */
+static int
+output_resize(http_output_t *o, size_t ncap)
+{
+	char *nbuf = realloc(o->buf, ncap);
+
+	if (!nbuf)
+		return -1;
+	(void)pthread_once(&output_budget_once, output_budget_register);
+	if (ncap > o->cap)
+		__atomic_add_fetch(&output_held, ncap - o->cap,
+		    __ATOMIC_RELAXED);
+	else
+		__atomic_sub_fetch(&output_held, o->cap - ncap,
+		    __ATOMIC_RELAXED);
+	o->buf = nbuf;
+	o->cap = ncap;
+	return 0;
+}
+
+/** @brief Bytes held by the buffers of every output queue. */
+size_t
+http_output_held(void)
+{
+	return __atomic_load_n(&output_held, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Append bytes to the pending buffer, compacting sent bytes first.
+ *
+ * @param o Output queue.
+ * @param data Bytes to append.
+ * @param n Number of bytes.
+ *
+ * @return int 0 on success, -1 on allocation failure or when the queue
+ * would hold more than HTTP_OUTPUT_QUEUED_MAX unsent bytes.
+ */
+static int
+output_append(http_output_t *o, const void *data, size_t n)
+{
+	if (n == 0)
+		return 0;
+	if (n > HTTP_OUTPUT_QUEUED_MAX - (o->len - o->off))
+		return -1;
+	if (o->off > 0) {
+		memmove(o->buf, o->buf + o->off, o->len - o->off);
+		o->len -= o->off;
+		o->off = 0;
+	}
+	if (o->len + n > o->cap) {
+		size_t ncap = o->cap ? o->cap : 4096;
+		while (ncap < o->len + n)
+			ncap *= 2;
+		if (output_resize(o, ncap) < 0)
+			return -1;
+	}
+	memcpy(o->buf + o->len, data, n);
+	o->len += n;
+	return 0;
+}
+
+/** Return 1 when bytes are still queued for the socket. */
+int
+http_output_pending(const http_output_t *o)
+{
+	return o->off < o->len || o->file_queued || o->map != NULL;
+}
+
+/**
+ * @brief Write an iovec without blocking; queue the unsent remainder.
+ *
+ * @details When output is already queued the iovec is appended as-is to
+ * keep bytes in order.
+ *
+ * @param o Output queue.
+ * @param sock Non-blocking client socket.
+ * @param iov Buffers to write; advanced in place.
+ * @param iovcnt Number of iovec entries.
+ *
+ * @return int 0 when written or queued, -1 on socket error or OOM.
+ */
+int
+http_output_writev(http_output_t *o, int sock, struct iovec *iov, int iovcnt)
+{
+	int idx = 0;
+
+	while (!http_output_pending(o) && idx < iovcnt) {
+		ssize_t w = writev(sock, &iov[idx], iovcnt - idx);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		size_t left = (size_t)w;
+		while (idx < iovcnt && left >= iov[idx].iov_len) {
+			left -= iov[idx].iov_len;
+			idx++;
+		}
+		if (idx < iovcnt && left > 0) {
+			iov[idx].iov_base = (char *)iov[idx].iov_base + left;
+			iov[idx].iov_len -= left;
+		}
+	}
+	for (; idx < iovcnt; idx++) {
+		if (output_append(o, iov[idx].iov_base, iov[idx].iov_len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/** Queue bytes without attempting a write; the next flush sends them. */
+int
+http_output_queue(http_output_t *o, const void *data, size_t n)
+{
+	return output_append(o, data, n);
+}
+
+/** Queue @p len bytes of @p fd from @p off; takes ownership of @p fd. */
+int
+http_output_queue_file(http_output_t *o, int fd, off_t off, off_t len)
+{
+	if (o->file_queued || o->map) {
+		close(fd);
+		return -1;
+	}
+	o->file_queued = 1;
+	o->file_fd = fd;
+	o->file_off = off;
+	o->file_left = len;
+	return 0;
+}
+
+/** Queue a slice of a shared file mapping; takes over the reference. */
+int
+http_output_queue_map(http_output_t *o, struct http_file_map *m, size_t off,
+    size_t len)
+{
+	if (o->file_queued || o->map || off > m->len || len > m->len - off) {
+		http_file_map_release(m);
+		return -1;
+	}
+	o->map = m;
+	o->map_off = off;
+	o->map_left = len;
+	return 0;
+}
+
+/**
+ * @brief Send queued header bytes and the next window of the mapping.
+ *
+ * @details One writev(2) carries what is left of the buffer followed by
+ * up to HTTP_OUTPUT_MAP_WINDOW bytes read directly out of the mapping,
+ * so the first slice of a download leaves with its headers.
+ *
+ * @return int 1 when the mapping is fully sent, 0 on EAGAIN, -1 on error.
+ */
+static int
+output_flush_map(http_output_t *o, int sock)
+{
+	struct iovec iov[2];
+
+	for (;;) {
+		int n = 0;
+		size_t head = o->len - o->off;
+		if (head > 0) {
+			iov[n].iov_base = o->buf + o->off;
+			iov[n++].iov_len = head;
+		}
+		size_t win = o->map_left < HTTP_OUTPUT_MAP_WINDOW ?
+		    o->map_left : HTTP_OUTPUT_MAP_WINDOW;
+		if (win > 0) {
+			iov[n].iov_base = (char *)o->map->base + o->map_off;
+			iov[n++].iov_len = win;
+		}
+		if (n == 0) {
+			http_file_map_release(o->map);
+			o->map = NULL;
+			o->off = o->len = 0;
+			return 1;
+		}
+		ssize_t w = writev(sock, iov, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;	/* EFAULT if the file shrank under us */
+		}
+		size_t done = (size_t)w;
+		size_t from_head = done < head ? done : head;
+		o->off += from_head;
+		done -= from_head;
+		o->map_off += done;
+		o->map_left -= done;
+	}
+}
+
+/** Write queued bytes until drained or the socket would block. */
+int
+http_output_flush(http_output_t *o, int sock)
+{
+	if (o->map)
+		return output_flush_map(o, sock);
+	for (;;) {
+		while (o->off < o->len) {
+			ssize_t w = write(sock, o->buf + o->off, o->len - o->off);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				return -1;
+			}
+			o->off += (size_t)w;
+		}
+		o->off = o->len = 0;
+		if (!o->file_queued)
+			return 1;
+
+		/* Refill the buffer with the next slice of the queued file. */
+		size_t want = HTTP_OUTPUT_FILE_CHUNK;
+		if (o->file_left < (off_t)want)
+			want = (size_t)o->file_left;
+		if (want == 0) {
+			close(o->file_fd);
+			o->file_queued = 0;
+			return 1;
+		}
+		if (o->cap < want && output_resize(o, want) < 0)
+			return -1;
+		ssize_t r = pread(o->file_fd, o->buf, want, o->file_off);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		o->len = (size_t)r;
+		o->file_off += r;
+		o->file_left -= r;
+	}
+}
+
+/** Drop queued output, free the buffer, close/release any queued file. */
+void
+http_output_reset(http_output_t *o)
+{
+	if (o->cap > 0)
+		__atomic_sub_fetch(&output_held, o->cap, __ATOMIC_RELAXED);
+	free(o->buf);
+	if (o->file_queued)
+		close(o->file_fd);
+	http_file_map_release(o->map);
+	memset(o, 0, sizeof(*o));
+}
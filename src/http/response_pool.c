@@ -2,149 +2,197 @@
 
 #include <pthread.h>
 #include <stddef.h>
-#include <stdint.h>
 #include <stdlib.h>
-#include <string.h>
 
-typedef struct {
-	http_response_t items[1024];
-	int free_stack[1024];
-	int free_top;
-	pthread_mutex_t lock;
-	int initialized;
-} response_pool_t;
-
-static response_pool_t response_pools[RESPONSE_POOL_SHARDS];
+#include <miniweb/core/counters.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/core/mem_budget.h>
 
-/**
- * @brief thread_hash operation.
- *
- * @details Performs the core thread_hash routine for this module.
- *
- * @return Return value produced by thread_hash.
+/*
+ * Response objects are recycled through a small free list per thread,
+ * reached through a pthread key the way request arenas are, so the
+ * common acquire/release pair takes no lock. A thread whose list is
+ * full (it frees more than it allocates) spills into a shared overflow
+ * pool, which threads with an empty list drain before calling calloc.
  */
-static inline unsigned long
-thread_hash(void)
-{
-	uintptr_t tid;
 
-	tid = (uintptr_t)pthread_self();
-	return (unsigned long)(tid ^ (tid >> 7) ^ (tid >> 13));
-}
+typedef struct {
+	http_response_t *items[RESPONSE_CACHE_LOCAL];
+	int count;
+} response_cache_t;
 
-/**
- * @brief response_pool_shard_index operation.
- *
- * @details Performs the core response_pool_shard_index routine for this module.
- *
- * @return Return value produced by response_pool_shard_index.
- */
+static pthread_key_t response_cache_key;
+static pthread_once_t response_cache_once = PTHREAD_ONCE_INIT;
+static int response_cache_key_ok;
+
+static pthread_mutex_t response_overflow_lock = PTHREAD_MUTEX_INITIALIZER;
+LOCKSTAT_SITE(lockstat_overflow, "response_pool");
+static http_response_t *response_overflow[RESPONSE_CACHE_GLOBAL];
+static int response_overflow_count;
+static uint64_t response_overflow_hits;
+
+/** Hand @p resp to the overflow pool; 0 when that is full too. */
 static int
-response_pool_shard_index(void)
+response_overflow_put(http_response_t *resp)
 {
-	return (int)(thread_hash() % RESPONSE_POOL_SHARDS);
+	int ok = 0;
+
+	LOCKSTAT_LOCK(&response_overflow_lock, lockstat_overflow);
+	if (response_overflow_count < RESPONSE_CACHE_GLOBAL) {
+		response_overflow[response_overflow_count++] = resp;
+		ok = 1;
+	}
+	LOCKSTAT_UNLOCK(&response_overflow_lock, lockstat_overflow);
+	return ok;
 }
 
-/**
- * @brief response_pool_init_locked operation.
- *
- * @details Performs the core response_pool_init_locked routine for this module.
- *
- * @param pool Input parameter for response_pool_init_locked.
- */
+/** pthread_key destructor: a departing worker donates its list. */
 static void
-response_pool_init_locked(response_pool_t *pool)
+response_cache_thread_free(void *p)
 {
-	int i;
+	response_cache_t *c = p;
 
-	if (pool->initialized)
-		return;
+	for (int i = 0; i < c->count; i++) {
+		if (!response_overflow_put(c->items[i]))
+			free(c->items[i]);
+	}
+	free(c);
+}
 
-	pool->free_top = 1024;
-	for (i = 0; i < 1024; i++)
-		pool->free_stack[i] = 1023 - i;
-	pool->initialized = 1;
+/** mem_budget usage(): the overflow pool; thread lists are not counted. */
+static size_t
+response_pool_mem_usage(uint64_t *hits, void *ctx)
+{
+	size_t bytes;
+
+	(void)ctx;
+	LOCKSTAT_LOCK(&response_overflow_lock, lockstat_overflow);
+	bytes = (size_t)response_overflow_count * sizeof(http_response_t);
+	*hits = response_overflow_hits;
+	LOCKSTAT_UNLOCK(&response_overflow_lock, lockstat_overflow);
+	return bytes;
 }
 
-/**
- * @brief http_response_pool_init_shards operation.
- *
- * @details Performs the core http_response_pool_init_shards routine for this module.
- */
-void
-http_response_pool_init_shards(void)
+/** mem_budget shrink(): free pooled objects; they are calloc'd again. */
+static size_t
+response_pool_mem_shrink(size_t bytes, void *ctx)
+{
+	http_response_t *drop[RESPONSE_CACHE_GLOBAL];
+	size_t freed = 0;
+	int n = 0;
+
+	(void)ctx;
+	LOCKSTAT_LOCK(&response_overflow_lock, lockstat_overflow);
+	while (freed < bytes && response_overflow_count > 0) {
+		drop[n++] = response_overflow[--response_overflow_count];
+		freed += sizeof(http_response_t);
+	}
+	LOCKSTAT_UNLOCK(&response_overflow_lock, lockstat_overflow);
+	for (int i = 0; i < n; i++)
+		free(drop[i]);
+	return freed;
+}
+
+static void
+response_cache_key_init(void)
 {
-	int i;
+	response_cache_key_ok = pthread_key_create(&response_cache_key,
+	    response_cache_thread_free) == 0;
+	(void)mem_budget_register(&(struct mem_cache_ops){
+		.name = "response_pool",
+		.usage = response_pool_mem_usage,
+		.shrink = response_pool_mem_shrink,
+	});
+}
 
-	for (i = 0; i < RESPONSE_POOL_SHARDS; i++)
-		pthread_mutex_init(&response_pools[i].lock, NULL);
+/** Calling thread's free list, created on first use; NULL if unavailable. */
+static response_cache_t *
+response_cache_thread(void)
+{
+	response_cache_t *c;
+
+	(void)pthread_once(&response_cache_once, response_cache_key_init);
+	if (!response_cache_key_ok)
+		return NULL;
+	c = pthread_getspecific(response_cache_key);
+	if (c)
+		return c;
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	if (pthread_setspecific(response_cache_key, c) != 0) {
+		free(c);
+		return NULL;
+	}
+	return c;
 }
 
 /**
- * @brief http_response_pool_acquire operation.
+ * @brief Take a response object for http_response_create().
  *
- * @details Performs the core http_response_pool_acquire routine for this module.
+ * @details Recycled objects were reset on release; only the fields a
+ * response sets are cleared, never the 2 KB header buffer.
  *
- * @return Return value produced by http_response_pool_acquire.
+ * @return Response object, or NULL on allocation failure.
  */
 http_response_t *
 http_response_pool_acquire(void)
 {
-	response_pool_t *pool;
-	http_response_t *resp;
-	int idx;
-	int shard_idx;
-
-	shard_idx = response_pool_shard_index();
-	pool = &response_pools[shard_idx];
-	resp = NULL;
-
-	pthread_mutex_lock(&pool->lock);
-	response_pool_init_locked(pool);
-	if (pool->free_top > 0) {
-		idx = pool->free_stack[--pool->free_top];
-		resp = &pool->items[idx];
-		memset(resp, 0, sizeof(*resp));
+	response_cache_t *c = response_cache_thread();
+	http_response_t *resp = NULL;
+
+	if (c && c->count > 0) {
+		counter_inc(CTR_RESP_LOCAL);
+		return c->items[--c->count];
 	}
-	pthread_mutex_unlock(&pool->lock);
 
-	if (resp)
-		resp->pool_shard_idx = shard_idx;
-	return resp;
+	LOCKSTAT_LOCK(&response_overflow_lock, lockstat_overflow);
+	if (response_overflow_count > 0) {
+		resp = response_overflow[--response_overflow_count];
+		response_overflow_hits++;
+	}
+	LOCKSTAT_UNLOCK(&response_overflow_lock, lockstat_overflow);
+	if (resp) {
+		counter_inc(CTR_RESP_SHARED);
+		return resp;
+	}
+	counter_inc(CTR_RESP_ALLOC);
+	return calloc(1, sizeof(*resp));
 }
 
 /**
- * @brief http_response_pool_release operation.
- *
- * @details Performs the core http_response_pool_release routine for this module.
+ * @brief Recycle @p resp, whose body the caller has already released.
  *
- * @param resp Input parameter for http_response_pool_release.
- *
- * @return Return value produced by http_response_pool_release.
+ * @return 1 when the object was kept, 0 when the caller must free it.
  */
 int
 http_response_pool_release(http_response_t *resp)
 {
-	response_pool_t *pool;
-	ptrdiff_t idx;
-	int shard_idx;
+	response_cache_t *c;
 
 	if (!resp)
 		return 0;
+	resp->body = NULL;
+	resp->body_len = 0;
+	resp->free_body = 0;
+	resp->stream = HTTP_STREAM_NONE;
+	resp->headers_len = 0;
+	resp->headers[0] = '\0';
+
+	c = response_cache_thread();
+	if (c && c->count < RESPONSE_CACHE_LOCAL) {
+		c->items[c->count++] = resp;
+		return 1;
+	}
+	return response_overflow_put(resp);
+}
 
-	shard_idx = resp->pool_shard_idx;
-	if (shard_idx < 0 || shard_idx >= RESPONSE_POOL_SHARDS)
-		return 0;
-
-	pool = &response_pools[shard_idx];
-	if (resp < pool->items || resp >= (pool->items + 1024))
-		return 0;
-
-	idx = resp - pool->items;
-	pthread_mutex_lock(&pool->lock);
-	memset(resp, 0, sizeof(*resp));
-	if (pool->free_top < 1024)
-		pool->free_stack[pool->free_top++] = (int)idx;
-	pthread_mutex_unlock(&pool->lock);
-	return 1;
+/** Free the overflow pool; thread lists go with their threads. */
+void
+http_response_pool_cleanup(void)
+{
+	LOCKSTAT_LOCK(&response_overflow_lock, lockstat_overflow);
+	while (response_overflow_count > 0)
+		free(response_overflow[--response_overflow_count]);
+	LOCKSTAT_UNLOCK(&response_overflow_lock, lockstat_overflow);
 }
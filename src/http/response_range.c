@@ -0,0 +1,182 @@
+#include <miniweb/http/response_internal.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Parse one unsigned decimal byte position.
+ *
+ * @return Pointer past the digits, or NULL when there are none or the
+ *         value overflows.
+ */
+static const char *
+range_parse_pos(const char *p, size_t *out)
+{
+	size_t v = 0;
+
+	if (*p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9') {
+		size_t d = (size_t)(*p - '0');
+		if (v > (SIZE_MAX - d) / 10)
+			return NULL;
+		v = v * 10 + d;
+		p++;
+	}
+	*out = v;
+	return p;
+}
+
+/**
+ * @brief Decide whether If-Range still names the current representation.
+ *
+ * @details An entity tag must match exactly (strong comparison, so a weak
+ * tag never does); a date must equal Last-Modified as we would send it.
+ *
+ * @return 1 when the Range may be honoured, otherwise 0.
+ */
+static int
+range_if_range_matches(http_request_t *req, const char *etag,
+    time_t last_modified)
+{
+	char date[HTTP_DATE_MAX];
+	const char *v;
+
+	v = http_request_get_header(req, "If-Range");
+	if (v == NULL)
+		return 1;
+	while (*v == ' ' || *v == '\t')
+		v++;
+	if (v[0] == '"' || (v[0] == 'W' && v[1] == '/'))
+		return etag != NULL && strcmp(v, etag) == 0;
+	if (last_modified == 0)
+		return 0;
+	http_format_date(last_modified, date, sizeof(date));
+	return strcmp(v, date) == 0;
+}
+
+/**
+ * @brief Resolve a single byte range for a @p size byte body.
+ *
+ * @param req Request carrying Range and If-Range.
+ * @param size Full representation length.
+ * @param etag Current entity tag, or NULL.
+ * @param last_modified Current modification time, or 0.
+ * @param off Receives the first byte of the range.
+ * @param len Receives the range length.
+ *
+ * @return 1 for a partial response, 0 for the full body, -1 for 416.
+ */
+int
+http_request_range(http_request_t *req, size_t size, const char *etag,
+    time_t last_modified, size_t *off, size_t *len)
+{
+	char spec[64];
+	const char *v;
+	size_t first;
+	size_t last;
+
+	if (http_request_method(req) != HTTP_METHOD_GET)
+		return 0;
+	v = http_request_get_header(req, "Range");
+	if (v == NULL)
+		return 0;
+	while (*v == ' ' || *v == '\t')
+		v++;
+	if (strncasecmp(v, "bytes=", 6) != 0)
+		return 0;
+	/* Multi-range responses are not produced; send the whole body. */
+	if (strchr(v, ',') != NULL || strlen(v + 6) >= sizeof(spec))
+		return 0;
+	/* The header scratch buffer is reused by the If-Range lookup. */
+	memcpy(spec, v + 6, strlen(v + 6) + 1);
+	if (!range_if_range_matches(req, etag, last_modified))
+		return 0;
+	v = spec;
+
+	if (*v == '-') {
+		/* Suffix range: the last N bytes. */
+		v = range_parse_pos(v + 1, &last);
+		if (v == NULL || (*v != '\0' && *v != ' '))
+			return 0;
+		if (last == 0 || size == 0)
+			return -1;
+		if (last > size)
+			last = size;
+		*off = size - last;
+		*len = last;
+		return 1;
+	}
+
+	v = range_parse_pos(v, &first);
+	if (v == NULL || *v != '-')
+		return 0;
+	v++;
+	if (*v == '\0' || *v == ' ') {
+		last = size > 0 ? size - 1 : 0;
+	} else {
+		v = range_parse_pos(v, &last);
+		if (v == NULL || (*v != '\0' && *v != ' ') || last < first)
+			return 0;
+	}
+	if (first >= size)
+		return -1;
+	if (last >= size)
+		last = size - 1;
+	*off = first;
+	*len = last - first + 1;
+	return 1;
+}
+
+/**
+ * @brief Narrow an in-memory 200 response to the requested range.
+ *
+ * @details Borrowed bodies are re-pointed at the range; owned ones have
+ * the range moved to the front so the original pointer can still be
+ * freed by http_response_free().
+ *
+ * @param req Request carrying Range and If-Range.
+ * @param resp Response holding the full body.
+ * @param etag Entity tag sent with the body, or NULL.
+ * @param last_modified Last-Modified sent with the body, or 0.
+ *
+ * @return The response status after the range was applied.
+ */
+int
+http_response_apply_range(http_request_t *req, http_response_t *resp,
+    const char *etag, time_t last_modified)
+{
+	char value[96];
+	size_t off;
+	size_t len;
+	int rc;
+
+	if (resp->status_code != 200 || !resp->body)
+		return resp->status_code;
+	rc = http_request_range(req, resp->body_len, etag, last_modified,
+	    &off, &len);
+	if (rc == 0)
+		return resp->status_code;
+
+	if (rc < 0) {
+		snprintf(value, sizeof(value), "bytes */%zu", resp->body_len);
+		if (resp->free_body)
+			free(resp->body);
+		http_response_set_body(resp, NULL, 0, 0);
+		resp->status_code = 416;
+	} else {
+		snprintf(value, sizeof(value), "bytes %zu-%zu/%zu", off,
+		    off + len - 1, resp->body_len);
+		if (resp->free_body)
+			memmove(resp->body, resp->body + off, len);
+		else
+			resp->body += off;
+		resp->body_len = len;
+		resp->status_code = 206;
+	}
+	http_response_add_header(resp, "Content-Range", value);
+	return resp->status_code;
+}
@@ -1,5 +1,6 @@
 /* utils.c - Utility functions: JSON escaping, string sanitization. */
 
+#include <miniweb/http/json.h>
 #include <miniweb/http/utils.h>
 
 #include <ctype.h>
@@ -8,70 +9,26 @@
 #include <string.h>
 
 /**
- * @brief json_escape_string operation.
+ * @brief Escape a string for a JSON value into an exactly sized copy.
  *
- * @details Performs the core json_escape_string routine for this module.
+ * @param src NUL-terminated input; NULL yields "".
  *
- * @param src Input parameter for json_escape_string.
- *
- * @return Return value produced by json_escape_string.
+ * @return Heap-allocated escaped copy owned by the caller.
  */
 char *
 json_escape_string(const char *src)
 {
+	size_t len, n;
+	char *dest;
+
 	if (!src)
 		return strdup("");
-
-	size_t len = strlen(src);
-	size_t max_out = len * 6 + 1;
-	char *dest = malloc(max_out);
+	len = strlen(src);
+	n = json_escaped_len(src, len);
+	dest = malloc(n + 1);
 	if (!dest)
 		return strdup("");
-
-	size_t d = 0;
-	for (size_t s = 0; src[s] != '\0'; s++) {
-		if (d + 7 >= max_out - 1)
-			break;
-
-		switch (src[s]) {
-		case '"':
-			dest[d++] = '\\';
-			dest[d++] = '"';
-			break;
-		case '\\':
-			dest[d++] = '\\';
-			dest[d++] = '\\';
-			break;
-		case '\b':
-			dest[d++] = '\\';
-			dest[d++] = 'b';
-			break;
-		case '\f':
-			dest[d++] = '\\';
-			dest[d++] = 'f';
-			break;
-		case '\n':
-			dest[d++] = '\\';
-			dest[d++] = 'n';
-			break;
-		case '\r':
-			dest[d++] = '\\';
-			dest[d++] = 'r';
-			break;
-		case '\t':
-			dest[d++] = '\\';
-			dest[d++] = 't';
-			break;
-		default:
-			if ((unsigned char)src[s] < 0x20)
-				d += snprintf(dest + d, max_out - d, "\\u%04x",
-					(unsigned char)src[s]);
-			else
-				dest[d++] = src[s];
-			break;
-		}
-	}
-	dest[d] = '\0';
+	*json_escape_put(dest, src, len) = '\0';
 	return dest;
 }
 
@@ -160,52 +117,3 @@ url_decode(const char *src, char *dst, size_t dst_len)
 	dst[out] = '\0';
 	return 0;
 }
-
-/**
- * @brief mime_type_for_path operation.
- *
- * @details Performs the core mime_type_for_path routine for this module.
- *
- * @param path Input parameter for mime_type_for_path.
- *
- * @return Return value produced by mime_type_for_path.
- */
-const char *
-mime_type_for_path(const char *path)
-{
-	const char *ext;
-
-	if (!path)
-		return "application/octet-stream";
-
-	ext = strrchr(path, '.');
-	if (!ext)
-		return "application/octet-stream";
-
-	if (strcmp(ext, ".html") == 0)
-		return "text/html";
-	if (strcmp(ext, ".css") == 0)
-		return "text/css";
-	if (strcmp(ext, ".js") == 0)
-		return "application/javascript";
-	if (strcmp(ext, ".png") == 0)
-		return "image/png";
-	if (strcmp(ext, ".svg") == 0)
-		return "image/svg+xml";
-	if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0)
-		return "image/jpeg";
-	if (strcmp(ext, ".gif") == 0)
-		return "image/gif";
-	if (strcmp(ext, ".ico") == 0)
-		return "image/x-icon";
-	if (strcmp(ext, ".pdf") == 0)
-		return "application/pdf";
-	if (strcmp(ext, ".ps") == 0)
-		return "application/postscript";
-	if (strcmp(ext, ".md") == 0)
-		return "text/markdown; charset=utf-8";
-	if (strcmp(ext, ".txt") == 0)
-		return "text/plain; charset=utf-8";
-
-	return "application/octet-stream";
-}
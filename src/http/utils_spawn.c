@@ -0,0 +1,444 @@
+/* utils_spawn.c - pre-forked helper that spawns subprocesses */
+
+#include <miniweb/core/log.h>
+#include <miniweb/http/utils.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * fork(2) from the server copies the page tables of a large multithreaded
+ * process, which costs milliseconds and a burst of RSS on every man,
+ * apropos or pkg_info call. spawn_helper_start() forks one small helper
+ * while the process is still small and single-threaded. The helper reads
+ * (timeout, path, argv) requests from a socketpair, forks and execs the
+ * command with stdout on a pipe, and passes the read end back with
+ * SCM_RIGHTS; the caller reads it as before. The helper reaps its
+ * children and kills those still running at their deadline.
+ *
+ * Requests take a lock only for the exchange, a few microseconds. When
+ * the helper is not running, died, or cannot take a request, callers
+ * fork themselves.
+ */
+
+#define SPAWN_SOCK_FD		3
+#define SPAWN_MAX_ARGS		64
+#define SPAWN_MAX_BYTES		8192	/* path and argv, NUL-separated */
+#define SPAWN_MAX_CHILDREN	64
+
+struct spawn_req {
+	int32_t timeout;	/* seconds, > 0 */
+	uint32_t argc;
+	uint32_t len;		/* bytes of strings that follow */
+};
+
+/* Helper side: children not yet reaped. */
+static struct {
+	pid_t pid;		/* 0: free */
+	time_t deadline;	/* CLOCK_MONOTONIC seconds */
+} spawn_children[SPAWN_MAX_CHILDREN];
+
+/* Server side. */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int spawn_fd = -1;
+static pid_t spawn_pid = -1;
+
+/** Read exactly @p len bytes; 1 on success, 0 at EOF, -1 on error. */
+static int
+spawn_read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+
+		if (n == 0)
+			return 0;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+/** Write all @p len bytes; 0 on success, -1 on error. */
+static int
+spawn_write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/** Send status word @p status, with descriptor @p fd unless it is -1. */
+static int
+spawn_send_fd(int sock, int32_t status, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+	struct iovec iov = { &status, sizeof(status) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd != -1) {
+		memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+		msg.msg_control = cmsgbuf.buf;
+		msg.msg_controllen = sizeof(cmsgbuf.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	while (sendmsg(sock, &msg, 0) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+/** Receive a status word and the descriptor sent with it, if any. */
+static int
+spawn_recv_fd(int sock, int32_t *status, int *fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+	struct iovec iov = { status, sizeof(*status) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+	while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	if (n != (ssize_t)sizeof(*status))
+		return -1;
+	*fd = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	return 0;
+}
+
+/** Monotonic seconds, for child deadlines. */
+static time_t
+spawn_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/**
+ * Reap exited children and kill those past their deadline.
+ *
+ * @return Milliseconds to the next deadline, -1 with no children.
+ */
+static int
+spawn_helper_reap(void)
+{
+	time_t now = spawn_now(), next = 0;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		for (int i = 0; i < SPAWN_MAX_CHILDREN; i++) {
+			if (spawn_children[i].pid == pid)
+				spawn_children[i].pid = 0;
+		}
+	}
+	for (int i = 0; i < SPAWN_MAX_CHILDREN; i++) {
+		if (spawn_children[i].pid == 0)
+			continue;
+		if (now >= spawn_children[i].deadline) {
+			kill(spawn_children[i].pid, SIGKILL);
+			while (waitpid(spawn_children[i].pid, NULL, 0) == -1 &&
+			    errno == EINTR)
+				;
+			spawn_children[i].pid = 0;
+		} else if (next == 0 || spawn_children[i].deadline < next) {
+			next = spawn_children[i].deadline;
+		}
+	}
+	return next == 0 ? -1 : (int)(next - now) * 1000;
+}
+
+/** Fork and exec @p argv with stdout on a pipe; the read end or -1. */
+static int
+spawn_helper_exec(const char *path, char *const argv[], int timeout)
+{
+	int pfd[2], slot = -1, devnull;
+	pid_t pid;
+
+	for (int i = 0; i < SPAWN_MAX_CHILDREN && slot < 0; i++) {
+		if (spawn_children[i].pid == 0)
+			slot = i;
+	}
+	if (slot < 0 || pipe(pfd) == -1)
+		return -1;
+	pid = fork();
+	if (pid == -1) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(pfd[0]);
+		if (dup2(pfd[1], STDOUT_FILENO) < 0)
+			_exit(127);
+		close(pfd[1]);
+		devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0) {
+			dup2(devnull, STDERR_FILENO);
+			close(devnull);
+		}
+		execv(path, argv);
+		_exit(127);
+	}
+	close(pfd[1]);
+	spawn_children[slot].pid = pid;
+	spawn_children[slot].deadline = spawn_now() + timeout;
+	return pfd[0];
+}
+
+/** Body of the helper: serve requests until the server hangs up. */
+static void
+spawn_helper_main(int sock)
+{
+	static char buf[SPAWN_MAX_BYTES];
+	static char *argv[SPAWN_MAX_ARGS + 1];
+	struct spawn_req req;
+	char *p, *end;
+	int fd, pr;
+
+	for (;;) {
+		struct pollfd pfd = { .fd = sock, .events = POLLIN };
+
+		pr = poll(&pfd, 1, spawn_helper_reap());
+		if (pr == 0 || (pr < 0 && errno == EINTR))
+			continue;
+		if (pr < 0 || spawn_read_full(sock, &req, sizeof(req)) != 1)
+			break;
+		if (req.argc == 0 || req.argc > SPAWN_MAX_ARGS ||
+		    req.len == 0 || req.len > sizeof(buf) || req.timeout <= 0 ||
+		    spawn_read_full(sock, buf, req.len) != 1)
+			break;
+		/* path, then argc strings, each NUL-terminated. */
+		buf[req.len - 1] = '\0';
+		end = buf + req.len;
+		p = buf + strlen(buf) + 1;
+		for (uint32_t i = 0; i < req.argc; i++) {
+			if (p >= end)
+				break;
+			argv[i] = p;
+			argv[i + 1] = NULL;
+			p += strlen(p) + 1;
+		}
+		fd = p <= end ? spawn_helper_exec(buf, argv, req.timeout) : -1;
+		if (spawn_send_fd(sock, fd == -1 ? ENOMEM : 0, fd) != 0)
+			break;
+		if (fd != -1)
+			close(fd);
+	}
+	/* The server is gone: so are the commands it wanted. */
+	for (int i = 0; i < SPAWN_MAX_CHILDREN; i++) {
+		if (spawn_children[i].pid != 0)
+			kill(spawn_children[i].pid, SIGKILL);
+	}
+	while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+		;
+	_exit(0);
+}
+
+/**
+ * @brief Fork the spawn helper.
+ *
+ * @details Call early in startup, while the process is small and has a
+ * single thread; later subprocesses are forked by the helper.
+ *
+ * @return 0 on success, -1 when it could not be started; commands are
+ * then forked by the server itself.
+ */
+int
+spawn_helper_start(void)
+{
+	struct sigaction sa;
+	sigset_t all;
+	int sv[2];
+	pid_t pid;
+
+	pthread_mutex_lock(&spawn_lock);
+	if (spawn_fd != -1) {
+		pthread_mutex_unlock(&spawn_lock);
+		return 0;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		log_error("[UTILS] spawn helper socketpair: %s",
+		    strerror(errno));
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+	pid = fork();
+	if (pid == -1) {
+		log_error("[UTILS] spawn helper fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+	if (pid == 0) {
+		/* Drop the server's handlers, mask and descriptors. */
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGHUP, &sa, NULL);
+		sigaction(SIGCHLD, &sa, NULL);
+		sa.sa_handler = SIG_IGN;
+		sigaction(SIGPIPE, &sa, NULL);
+		sigemptyset(&all);
+		sigprocmask(SIG_SETMASK, &all, NULL);
+		if (sv[1] != SPAWN_SOCK_FD && dup2(sv[1], SPAWN_SOCK_FD) == -1)
+			_exit(127);
+		/* Commands must not inherit the socket. */
+		fcntl(SPAWN_SOCK_FD, F_SETFD, FD_CLOEXEC);
+		closefrom(SPAWN_SOCK_FD + 1);
+#ifdef __OpenBSD__
+		if (pledge("stdio rpath proc exec sendfd", NULL) == -1)
+			_exit(127);
+#endif
+		spawn_helper_main(SPAWN_SOCK_FD);
+		_exit(0);
+	}
+	close(sv[1]);
+	spawn_fd = sv[0];
+	spawn_pid = pid;
+	pthread_mutex_unlock(&spawn_lock);
+	log_debug("[UTILS] Spawn helper started (pid %ld)", (long)pid);
+	return 0;
+}
+
+/** Close the helper's socket; called with spawn_lock held. */
+static void
+spawn_helper_close(void)
+{
+	close(spawn_fd);
+	spawn_fd = -1;
+	while (waitpid(spawn_pid, NULL, 0) == -1 && errno == EINTR)
+		;
+	spawn_pid = -1;
+}
+
+/**
+ * @brief Stop the spawn helper; commands it started are killed.
+ */
+void
+spawn_helper_stop(void)
+{
+	pthread_mutex_lock(&spawn_lock);
+	if (spawn_fd != -1)
+		spawn_helper_close();
+	pthread_mutex_unlock(&spawn_lock);
+}
+
+/**
+ * @brief Have the helper run @p path with @p argv, stdout on a pipe.
+ *
+ * @details The helper kills the command once @p timeout_seconds have
+ * passed, and reaps it.
+ *
+ * @param path Executable path.
+ * @param argv Argument vector, NULL-terminated.
+ * @param timeout_seconds Hard timeout for the command, > 0.
+ *
+ * @return Read end of the command's stdout, or -1 when the helper is not
+ * running or could not start it; the caller should fork itself then.
+ */
+int
+spawn_helper_run(const char *path, char *const argv[], int timeout_seconds)
+{
+	char msg[sizeof(struct spawn_req) + SPAWN_MAX_BYTES];
+	struct spawn_req req;
+	size_t off = sizeof(req), n;
+	int32_t status;
+	int fd = -1;
+
+	req.timeout = timeout_seconds;
+	req.argc = 0;
+	n = strlen(path) + 1;
+	if (n > SPAWN_MAX_BYTES)
+		return -1;
+	memcpy(msg + off, path, n);
+	off += n;
+	for (; argv[req.argc]; req.argc++) {
+		n = strlen(argv[req.argc]) + 1;
+		if (req.argc >= SPAWN_MAX_ARGS || n > sizeof(msg) - off)
+			return -1;
+		memcpy(msg + off, argv[req.argc], n);
+		off += n;
+	}
+	if (req.argc == 0)
+		return -1;
+	req.len = (uint32_t)(off - sizeof(req));
+	memcpy(msg, &req, sizeof(req));
+
+	pthread_mutex_lock(&spawn_lock);
+	if (spawn_fd == -1) {
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+	if (spawn_write_full(spawn_fd, msg, off) != 0 ||
+	    spawn_recv_fd(spawn_fd, &status, &fd) != 0) {
+		log_error("[UTILS] Spawn helper gone; forking from the server");
+		spawn_helper_close();
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&spawn_lock);
+	if (status != 0 && fd != -1) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
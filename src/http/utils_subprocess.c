@@ -1,9 +1,11 @@
 #include <miniweb/core/log.h>
 #include <miniweb/http/utils.h>
+#include <miniweb/net/trace.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,30 +13,235 @@
 #include <time.h>
 #include <unistd.h>
 
+#define POPEN_READ_CHUNK (16 * 1024)
+
+/*
+ * Subprocess governor. Every command run through safe_popen_stream_argv()
+ * takes a slot of its own budget, by executable name, and one of the
+ * global limit. A caller finding either full waits in a bounded queue
+ * for at most the configured wait, or the command's timeout if shorter;
+ * a full queue or an expired wait rejects the run, so a burst of package
+ * searches sheds load instead of forking without end.
+ */
+#define POPEN_SAMPLES	128	/* runtimes kept per command for the p99 */
+
+typedef struct {
+	const char *name;	/* executable basename; NULL: the rest */
+	int budget;		/* concurrent runs, clamped to popen_max */
+	struct subprocess_stats st;
+	uint32_t samples[POPEN_SAMPLES];	/* ms, a ring */
+	unsigned int nsamples;
+} popen_class_t;
+
+static popen_class_t popen_total = { .name = "all" };
+static popen_class_t popen_classes[] = {
+	{ .name = "mandoc", .budget = 8 },
+	{ .name = "apropos", .budget = 4 },
+	{ .name = "man", .budget = 4 },
+	{ .name = "pkg_info", .budget = 4 },
+	{ .name = "sh", .budget = 4 },
+	{ .name = NULL, .budget = 4 },
+};
+#define POPEN_NCLASSES	(sizeof(popen_classes) / sizeof(popen_classes[0]))
+
+static pthread_mutex_t popen_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Broadcast whenever a run ends. */
+static pthread_cond_t popen_cond = PTHREAD_COND_INITIALIZER;
+static int popen_max = 16;
+static int popen_queue_max = 64;
+static int popen_wait_ms = 2000;
+
 /**
- * @brief safe_popen_read_argv operation.
+ * @brief Set the governor's global limits.
  *
- * @details Performs the core safe_popen_read_argv routine for this module.
+ * @param max_running Subprocesses running at once, at least 1.
+ * @param max_queued Callers waiting for a slot at once; 0 rejects any run
+ * that would have to wait.
+ * @param wait_ms Longest wait for a slot.
+ */
+void
+subprocess_governor_configure(int max_running, int max_queued, int wait_ms)
+{
+	pthread_mutex_lock(&popen_lock);
+	popen_max = max_running > 0 ? max_running : 1;
+	popen_queue_max = max_queued > 0 ? max_queued : 0;
+	popen_wait_ms = wait_ms > 0 ? wait_ms : 0;
+	pthread_cond_broadcast(&popen_cond);
+	pthread_mutex_unlock(&popen_lock);
+}
+
+/** Budget of @p c in force; called with popen_lock held. */
+static int
+popen_limit(const popen_class_t *c)
+{
+	return c->budget < popen_max ? c->budget : popen_max;
+}
+
+/** Whether @p c may start a run now; called with popen_lock held. */
+static int
+popen_can_run(const popen_class_t *c)
+{
+	return popen_total.st.running < popen_max &&
+	    c->st.running < popen_limit(c);
+}
+
+/**
+ * @brief Take a slot for running @p path, waiting for one if needed.
  *
- * @param path Input parameter for safe_popen_read_argv.
- * @param argv Input parameter for safe_popen_read_argv.
- * @param max_size Input parameter for safe_popen_read_argv.
- * @param timeout_seconds Input parameter for safe_popen_read_argv.
- * @param out_len Input parameter for safe_popen_read_argv.
+ * @return popen_class_t* Class to hand to popen_release(), or NULL when
+ * the run is rejected.
+ */
+static popen_class_t *
+popen_admit(const char *path, int timeout_seconds)
+{
+	const char *base = strrchr(path, '/');
+	popen_class_t *c = &popen_classes[POPEN_NCLASSES - 1];
+	struct timespec deadline;
+	long wait_ms;
+	int rc = 0;
+
+	base = base ? base + 1 : path;
+	for (size_t i = 0; i + 1 < POPEN_NCLASSES; i++) {
+		if (strcmp(popen_classes[i].name, base) == 0) {
+			c = &popen_classes[i];
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&popen_lock);
+	if (!popen_can_run(c)) {
+		if (popen_total.st.queued >= popen_queue_max)
+			goto reject;
+		wait_ms = popen_wait_ms;
+		if (wait_ms > (long)timeout_seconds * 1000)
+			wait_ms = (long)timeout_seconds * 1000;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += wait_ms / 1000;
+		deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		popen_total.st.queued++;
+		c->st.queued++;
+		while (!popen_can_run(c) && rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&popen_cond, &popen_lock,
+			    &deadline);
+		popen_total.st.queued--;
+		c->st.queued--;
+		if (!popen_can_run(c))
+			goto reject;
+	}
+	popen_total.st.running++;
+	popen_total.st.started++;
+	c->st.running++;
+	c->st.started++;
+	pthread_mutex_unlock(&popen_lock);
+	return c;
+
+reject:
+	popen_total.st.rejected++;
+	c->st.rejected++;
+	pthread_mutex_unlock(&popen_lock);
+	log_debug("[UTILS] %s rejected: subprocess budget exhausted", path);
+	return NULL;
+}
+
+/** Record a runtime sample of @p ms in @p c; popen_lock held. */
+static void
+popen_sample(popen_class_t *c, uint32_t ms)
+{
+	c->samples[c->nsamples++ % POPEN_SAMPLES] = ms;
+}
+
+/**
+ * @brief Give back the slot of a run that began at @p start, or that
+ * never started when @p start is NULL.
+ */
+static void
+popen_release(popen_class_t *c, const struct timespec *start)
+{
+	struct timespec now;
+	uint32_t ms = 0;
+
+	if (start) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (uint32_t)((now.tv_sec - start->tv_sec) * 1000 +
+		    (now.tv_nsec - start->tv_nsec) / 1000000);
+	}
+	pthread_mutex_lock(&popen_lock);
+	popen_total.st.running--;
+	c->st.running--;
+	if (start) {
+		popen_sample(&popen_total, ms);
+		popen_sample(c, ms);
+	}
+	pthread_cond_broadcast(&popen_cond);
+	pthread_mutex_unlock(&popen_lock);
+}
+
+static int
+popen_cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** Hand a copy of @p c's stats, with limit and p99, to @p fn. */
+static void
+popen_report(popen_class_t *c, const char *name, int limit,
+    void (*fn)(const char *, const struct subprocess_stats *, void *),
+    void *ctx)
+{
+	uint32_t sorted[POPEN_SAMPLES];
+	struct subprocess_stats st = c->st;
+	size_t n = c->nsamples < POPEN_SAMPLES ? c->nsamples : POPEN_SAMPLES;
+
+	st.limit = limit;
+	st.p99_ms = 0;
+	if (n > 0) {
+		memcpy(sorted, c->samples, n * sizeof(sorted[0]));
+		qsort(sorted, n, sizeof(sorted[0]), popen_cmp_u32);
+		st.p99_ms = sorted[(n * 99 + 99) / 100 - 1];
+	}
+	fn(name, &st, ctx);
+}
+
+/**
+ * @brief Call @p fn with the governor's counters: first the global ones
+ * as "all", then each command budget, "other" last.
  *
- * @return Return value produced by safe_popen_read_argv.
+ * @details Runs under the governor lock; @p fn must not start
+ * subprocesses.
+ *
+ * @return int Number of calls made.
  */
-char *
-safe_popen_read_argv(const char *path, char *const argv[],
-	size_t max_size, int timeout_seconds, size_t *out_len)
+int
+subprocess_foreach_stats(void (*fn)(const char *name,
+    const struct subprocess_stats *stats, void *ctx), void *ctx)
 {
-	int pipefd[2];
+	pthread_mutex_lock(&popen_lock);
+	popen_report(&popen_total, "all", popen_max, fn, ctx);
+	for (size_t i = 0; i < POPEN_NCLASSES; i++) {
+		popen_class_t *c = &popen_classes[i];
 
-	log_debug("[UTILS] Executing: %s", path);
+		popen_report(c, c->name ? c->name : "other", popen_limit(c),
+		    fn, ctx);
+	}
+	pthread_mutex_unlock(&popen_lock);
+	return (int)POPEN_NCLASSES + 1;
+}
+
+/** Fork and exec @p argv with stdout on a pipe; the read end or -1. */
+static int
+popen_fork(const char *path, char *const argv[], pid_t *pidp)
+{
+	int pipefd[2];
 
 	if (pipe(pipefd) == -1) {
 		log_debug("[UTILS] pipe() failed: %s", strerror(errno));
-		return NULL;
+		return -1;
 	}
 
 	pid_t pid = fork();
@@ -42,7 +249,7 @@ safe_popen_read_argv(const char *path, char *const argv[],
 		log_debug("[UTILS] fork() failed: %s", strerror(errno));
 		close(pipefd[0]);
 		close(pipefd[1]);
-		return NULL;
+		return -1;
 	}
 
 	if (pid == 0) {
@@ -63,21 +270,63 @@ safe_popen_read_argv(const char *path, char *const argv[],
 	}
 
 	close(pipefd[1]);
+	*pidp = pid;
+	return pipefd[0];
+}
 
-	char *buffer = malloc(max_size + 1);
-	if (!buffer) {
-		log_debug("[UTILS] malloc(%zu) failed", max_size + 1);
-		close(pipefd[0]);
-		kill(pid, SIGKILL);
-		waitpid(pid, NULL, 0);
-		return NULL;
+/**
+ * @brief Run @p path with @p argv and hand its stdout to @p cb as it
+ * arrives.
+ *
+ * @details stderr goes to /dev/null. @p cb receives each read, at most
+ * POPEN_READ_CHUNK bytes; returning nonzero stops reading, and the child
+ * gets SIGPIPE on its next write. A child still running at the deadline
+ * is killed. The spawn helper starts the child when it runs, so this
+ * process is not forked; otherwise it is forked here. The run first takes
+ * a slot of the subprocess governor, and fails when none frees up in
+ * time.
+ *
+ * @param path Executable path.
+ * @param argv Argument vector for execv (must be NULL-terminated).
+ * @param timeout_seconds Hard timeout for the child; 0 means 5 seconds.
+ * @param cb Output consumer.
+ * @param ctx Passed through to @p cb.
+ *
+ * @return 0 at end of output, 1 when @p cb stopped it, -1 when the child
+ * was rejected, could not be started or timed out.
+ */
+int
+safe_popen_stream_argv(const char *path, char *const argv[],
+	int timeout_seconds, safe_popen_cb cb, void *ctx)
+{
+	int timeout = timeout_seconds > 0 ? timeout_seconds : 5;
+	struct timespec start;
+	popen_class_t *c;
+	pid_t pid = -1;
+	int fd;
+	uint64_t since = TRACE_NOW();
+
+	c = popen_admit(path, timeout);
+	TRACE_WAIT(TRACE_WAIT_SUBPROCESS, since);
+	if (c == NULL)
+		return -1;
+	log_debug("[UTILS] Executing: %s", path);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* The helper reaps the child and kills it at the deadline itself. */
+	since = TRACE_NOW();
+	fd = spawn_helper_run(path, argv, timeout);
+	if (fd == -1 && (fd = popen_fork(path, argv, &pid)) == -1) {
+		popen_release(c, NULL);
+		return -1;
 	}
+	TRACE_WAIT(TRACE_WAIT_SUBPROCESS, since);
 
-	size_t total = 0;
-	int timed_out = 0;
-	time_t deadline = time(NULL) + (timeout_seconds > 0 ? timeout_seconds : 5);
+	char chunk[POPEN_READ_CHUNK];
+	int timed_out = 0, stopped = 0;
+	time_t deadline = time(NULL) + timeout;
 
-	while (total < max_size) {
+	while (!stopped) {
 		time_t now = time(NULL);
 		if (now >= deadline) {
 			timed_out = 1;
@@ -85,8 +334,10 @@ safe_popen_read_argv(const char *path, char *const argv[],
 		}
 
 		int wait_ms = (int)((deadline - now) * 1000);
-		struct pollfd pfd = { .fd = pipefd[0], .events = POLLIN };
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		since = TRACE_NOW();
 		int pr = poll(&pfd, 1, wait_ms > 0 ? wait_ms : 0);
+		TRACE_WAIT(TRACE_WAIT_SUBPROCESS, since);
 
 		if (pr == 0) {
 			timed_out = 1;
@@ -99,38 +350,98 @@ safe_popen_read_argv(const char *path, char *const argv[],
 		}
 
 		if (pfd.revents & POLLIN) {
-			ssize_t n = read(pipefd[0], buffer + total, max_size - total);
+			ssize_t n = read(fd, chunk, sizeof(chunk));
 			if (n < 0) {
-				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				if (errno == EAGAIN || errno == EWOULDBLOCK ||
+					errno == EINTR)
 					continue;
 				break;
 			}
 			if (n == 0)
 				break;
-			total += (size_t)n;
+			if (cb(chunk, (size_t)n, ctx) != 0)
+				stopped = 1;
+			continue;
 		}
 		if (pfd.revents & (POLLERR | POLLHUP))
 			break;
 	}
 
-	close(pipefd[0]);
+	close(fd);
+
+	if (pid != -1) {
+		if (timed_out)
+			kill(pid, SIGKILL);
+
+		int status;
+		waitpid(pid, &status, 0);
+	}
+	popen_release(c, &start);
 
 	if (timed_out)
-		kill(pid, SIGKILL);
+		return -1;
+	return stopped;
+}
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t max;
+} popen_buffer_t;
+
+/** safe_popen_stream_argv() consumer: append, stopping at the limit. */
+static int
+popen_buffer_append(const char *data, size_t len, void *ctx)
+{
+	popen_buffer_t *b = ctx;
+
+	if (len > b->max - b->len)
+		len = b->max - b->len;
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+	return b->len == b->max;
+}
+
+/**
+ * @brief safe_popen_read_argv operation.
+ *
+ * @details Collects the output of safe_popen_stream_argv() into one
+ * buffer, keeping the first @p max_size bytes.
+ *
+ * @param path Input parameter for safe_popen_read_argv.
+ * @param argv Input parameter for safe_popen_read_argv.
+ * @param max_size Input parameter for safe_popen_read_argv.
+ * @param timeout_seconds Input parameter for safe_popen_read_argv.
+ * @param out_len Input parameter for safe_popen_read_argv.
+ *
+ * @return Return value produced by safe_popen_read_argv.
+ */
+char *
+safe_popen_read_argv(const char *path, char *const argv[],
+	size_t max_size, int timeout_seconds, size_t *out_len)
+{
+	popen_buffer_t b = { NULL, 0, max_size };
+	int rc;
+
+	b.buf = malloc(max_size + 1);
+	if (!b.buf) {
+		log_debug("[UTILS] malloc(%zu) failed", max_size + 1);
+		return NULL;
+	}
 
-	int status;
-	waitpid(pid, &status, 0);
+	rc = safe_popen_stream_argv(path, argv, timeout_seconds,
+		popen_buffer_append, &b);
 
 	if (out_len)
-		*out_len = total;
+		*out_len = b.len;
 
-	if (timed_out || total == 0) {
-		free(buffer);
+	if (rc < 0 || b.len == 0) {
+		free(b.buf);
 		return NULL;
 	}
 
-	buffer[total] = '\0';
-	return buffer;
+	b.buf[b.len] = '\0';
+	return b.buf;
 }
 
 /**
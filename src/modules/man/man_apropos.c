@@ -0,0 +1,1276 @@
+/* man_apropos.c - in-process apropos index over the man trees */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/readiness.h>
+#include <miniweb/core/snapshot.h>
+#include <miniweb/http/json.h>
+#include "man_internal.h"
+
+/*
+ * Names and one-line descriptions of every page, parsed from the NAME
+ * section of the sources, with an inverted index over their words for
+ * searches and a hash table over (name, section) for path resolution.
+ * Each manN directory is scanned into a block that later snapshots
+ * share for as long as the directory's mtime holds, so a refresh only
+ * re-reads what changed. Snapshots are immutable once published; a
+ * search takes a reference without locking and runs on it, and
+ * man_apropos_lock only guards the block counts snapshots share.
+ *
+ * Type-ahead runs over a sorted array of every (name, section) the hash
+ * table resolves: the names starting with a prefix are one run of it.
+ * The run found for a prefix is remembered, so the next keystroke only
+ * bisects inside the run of the prefix it extends.
+ */
+
+#define MAN_APROPOS_HEAD_MAX     16384   /* bytes read looking for NAME */
+#define MAN_APROPOS_TEXT_MAX     512
+#define MAN_APROPOS_DIRS_MAX     256
+#define MAN_APROPOS_PERIOD_SEC   60
+#define MAN_APROPOS_MAX_RESULTS  1000
+#define MAN_APROPOS_PREFIX_SLOTS 128
+#define MAN_APROPOS_PREFIX_MAX   64
+#define MAN_APROPOS_PREFIX_LIMIT 100     /* matches per response */
+
+typedef struct {
+    char *names;            /* "printf, fprintf" as in the NAME section */
+    char *desc;
+    char *path;
+    char *words;            /* lowercased words, NUL-separated, "" ends */
+    char *keys;             /* file stem, then NAME names; same layout */
+    char section[16];
+} man_apropos_page_t;
+
+typedef struct {
+    int refs;
+    int rank;               /* root order * 2, + 1 in a machine subdir */
+    char *path;
+    struct timespec mtime;
+    man_apropos_page_t *pages;
+    size_t count;
+} man_apropos_dir_t;
+
+typedef struct {
+    const char *word;
+    uint32_t page;
+} man_apropos_posting_t;
+
+typedef struct {
+    const char *name;       /* NULL marks an empty slot */
+    const man_apropos_page_t *page;
+    uint32_t hash;
+    int rank;               /* dir rank * 2, + 1 for a NAME alias */
+} man_apropos_key_t;
+
+typedef struct {
+    const char *name;
+    const man_apropos_page_t *page;
+} man_apropos_name_t;
+
+typedef struct {
+    snapshot_t hdr;
+    uint64_t gen;                       /* publication number */
+    man_apropos_dir_t **dirs;
+    size_t ndirs;
+    const man_apropos_page_t **pages;   /* by name, then section */
+    size_t npages;
+    man_apropos_posting_t *postings;    /* by word, then page */
+    size_t npostings;
+    man_apropos_key_t *keys;            /* open addressing */
+    size_t keys_mask;
+    man_apropos_name_t *names;          /* keys by name, then section */
+    size_t nnames;
+} man_apropos_set_t;
+
+typedef struct {
+    uint64_t gen;           /* snapshot the run belongs to; 0 unused */
+    char prefix[MAN_APROPOS_PREFIX_MAX];    /* lowercased */
+    size_t lo, hi;          /* run of set->names starting with it */
+} man_apropos_prefix_t;
+
+static const char *const man_apropos_roots[] = {
+    "/usr/share/man", "/usr/X11R6/man", "/usr/local/man"
+};
+
+static pthread_mutex_t man_apropos_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t man_apropos_build_lock = PTHREAD_MUTEX_INITIALIZER;
+static snapshot_slot_t man_apropos_current = SNAPSHOT_SLOT_INITIALIZER;
+static time_t man_apropos_miss_refresh;
+static uint64_t man_apropos_gen;                    /* build lock */
+static pthread_mutex_t man_apropos_prefix_lock = PTHREAD_MUTEX_INITIALIZER;
+static man_apropos_prefix_t man_apropos_prefixes[MAN_APROPOS_PREFIX_SLOTS];
+static const char *const *man_apropos_last_roots;   /* build lock */
+static size_t man_apropos_last_nroots;
+
+/**
+ * @brief Strip roff escapes, quotes and extra blanks from @p s in place.
+ *
+ * @details Only what NAME sections use: dashes and special characters
+ * become '-', font and string escapes vanish, a comment ends the text.
+ */
+static void
+man_apropos_unroff(char *s)
+{
+    char *w = s;
+    int blank = 1;
+
+    for (char *r = s; *r; ) {
+        char c = *r++;
+
+        if (c == '\\') {
+            c = *r ? *r++ : '\0';
+            switch (c) {
+            case '\0':
+            case '"':
+                goto done;
+            case '-':
+                c = '-';
+                break;
+            case 'e':
+                c = '\\';
+                break;
+            case ' ':
+            case '~':
+                c = ' ';
+                break;
+            case '(':
+                /* \(em, \(en and \(mi read as dashes; others drop. */
+                c = strncmp(r, "em", 2) == 0 || strncmp(r, "en", 2) == 0 ||
+                    strncmp(r, "mi", 2) == 0 ? '-' : '\0';
+                for (int i = 0; i < 2 && *r; i++)
+                    r++;
+                break;
+            case '[':
+                while (*r && *r != ']')
+                    r++;
+                if (*r)
+                    r++;
+                c = '\0';
+                break;
+            case 'f':
+            case '*':
+                if (*r == '(') {
+                    for (int i = 0; i < 3 && *r; i++)
+                        r++;
+                } else if (*r == '[') {
+                    while (*r && *r != ']')
+                        r++;
+                    if (*r)
+                        r++;
+                } else if (*r) {
+                    r++;
+                }
+                c = '\0';
+                break;
+            case '&':
+            case '|':
+            case '^':
+            case '%':
+                c = '\0';
+                break;
+            default:
+                break;
+            }
+            if (c == '\0')
+                continue;
+        } else if (c == '"') {
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            if (!blank)
+                *w++ = ' ';
+            blank = 1;
+            continue;
+        }
+        *w++ = c;
+        blank = 0;
+    }
+done:
+    while (w > s && w[-1] == ' ')
+        w--;
+    *w = '\0';
+}
+
+/** Whether @p line is the roff request @p macro (".Sh", ".Nm", ...). */
+static int
+man_apropos_is_macro(const char *line, const char *macro)
+{
+    size_t len = strlen(macro);
+
+    return strncmp(line, macro, len) == 0 &&
+        (line[len] == '\0' || isspace((unsigned char)line[len]));
+}
+
+/** Whether @p line opens the NAME section in mdoc or man syntax. */
+static int
+man_apropos_is_name_header(const char *line)
+{
+    if (!man_apropos_is_macro(line, ".Sh") &&
+        !man_apropos_is_macro(line, ".SH"))
+        return 0;
+    line += 3;
+    while (isspace((unsigned char)*line) || *line == '"')
+        line++;
+    return strncasecmp(line, "NAME", 4) == 0 &&
+        (line[4] == '\0' || line[4] == '"' ||
+         isspace((unsigned char)line[4]));
+}
+
+/** Append the arguments of an mdoc ".Nm" line to @p names. */
+static void
+man_apropos_add_nm(char *names, size_t size, char *args)
+{
+    char *save = NULL;
+
+    for (char *tok = strtok_r(args, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        size_t len = strlen(tok);
+
+        while (len > 0 && tok[len - 1] == ',')
+            tok[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (names[0] != '\0')
+            strlcat(names, ", ", size);
+        strlcat(names, tok, size);
+    }
+}
+
+/**
+ * @brief Read the NAME section of the page at @p path.
+ *
+ * @details mdoc pages list their names on .Nm lines and describe
+ * themselves on .Nd; man(7) pages use one text line, "names \- text".
+ *
+ * @return 1 when a name was found, 0 otherwise.
+ */
+static int
+man_apropos_parse(const char *path, char *names, char *desc)
+{
+    char buf[MAN_APROPOS_HEAD_MAX + 1];
+    char text[MAN_APROPOS_TEXT_MAX];
+    char *save = NULL;
+    ssize_t n;
+    int fd, in_name = 0;
+
+    names[0] = desc[0] = text[0] = '\0';
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    n = read(fd, buf, MAN_APROPOS_HEAD_MAX);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+
+    for (char *line = strtok_r(buf, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        if (!in_name) {
+            in_name = man_apropos_is_name_header(line);
+            continue;
+        }
+        if (man_apropos_is_macro(line, ".Sh") ||
+            man_apropos_is_macro(line, ".SH") ||
+            man_apropos_is_macro(line, ".SS"))
+            break;
+        if (man_apropos_is_macro(line, ".Nm")) {
+            man_apropos_add_nm(names, MAN_APROPOS_TEXT_MAX, line + 3);
+        } else if (man_apropos_is_macro(line, ".Nd")) {
+            strlcpy(desc, line + 3, MAN_APROPOS_TEXT_MAX);
+            break;
+        } else if (line[0] != '.' && line[0] != '\'') {
+            if (text[0] != '\0')
+                strlcat(text, " ", sizeof(text));
+            strlcat(text, line, sizeof(text));
+        }
+    }
+
+    if (names[0] == '\0' && text[0] != '\0') {
+        char *dash = strstr(text, "\\-");
+        size_t skip = 2;
+
+        if (!dash) {
+            dash = strstr(text, " - ");
+            skip = 3;
+        }
+        if (dash) {
+            strlcpy(desc, dash + skip, MAN_APROPOS_TEXT_MAX);
+            *dash = '\0';
+        }
+        strlcpy(names, text, MAN_APROPOS_TEXT_MAX);
+    }
+    man_apropos_unroff(names);
+    man_apropos_unroff(desc);
+    return names[0] != '\0';
+}
+
+/**
+ * @brief Lowercased copy of @p names and @p desc split into words: runs
+ * of the characters a search token may hold, without trailing dots.
+ *
+ * @return Heap list of NUL-terminated words ending with an empty one.
+ */
+static char *
+man_apropos_words(const char *names, const char *desc)
+{
+    size_t nlen = strlen(names), dlen = strlen(desc);
+    char *words = malloc(nlen + dlen + 3);
+    char *w;
+
+    if (!words)
+        return NULL;
+    w = words;
+    for (int part = 0; part < 2; part++) {
+        const char *r = part == 0 ? names : desc;
+
+        while (*r) {
+            char *start = w;
+
+            while (*r && !isalnum((unsigned char)*r))
+                r++;
+            while (isalnum((unsigned char)*r) || *r == '.' || *r == '_' ||
+                *r == '-' || *r == '+')
+                *w++ = (char)tolower((unsigned char)*r++);
+            while (w > start && (w[-1] == '.' || w[-1] == '-'))
+                w--;
+            if (w > start)
+                *w++ = '\0';
+        }
+    }
+    *w = '\0';
+    return words;
+}
+
+/**
+ * @brief Names @p stem resolves under: the file stem, then each name in
+ * @p names ("a, b") that differs from it.
+ *
+ * @return Heap list of NUL-terminated names ending with an empty one.
+ */
+static char *
+man_apropos_keys(const char *stem, const char *names)
+{
+    size_t slen = strlen(stem);
+    char *keys = malloc(slen + strlen(names) + 3);
+    char *w;
+
+    if (!keys)
+        return NULL;
+    memcpy(keys, stem, slen + 1);
+    w = keys + slen + 1;
+    for (const char *p = names; *p; ) {
+        size_t end = strcspn(p, ","), n = end;
+
+        while (n > 0 && p[n - 1] == ' ')
+            n--;
+        if (n > 0 && (n != slen || strncmp(p, stem, n) != 0)) {
+            memcpy(w, p, n);
+            w[n] = '\0';
+            w += n + 1;
+        }
+        p += end;
+        while (*p == ',' || *p == ' ')
+            p++;
+    }
+    *w = '\0';
+    return keys;
+}
+
+/** Free a directory block no snapshot references any more. */
+static void
+man_apropos_dir_free(man_apropos_dir_t *dir)
+{
+    if (!dir)
+        return;
+    for (size_t i = 0; i < dir->count; i++) {
+        free(dir->pages[i].names);
+        free(dir->pages[i].desc);
+        free(dir->pages[i].path);
+        free(dir->pages[i].words);
+        free(dir->pages[i].keys);
+    }
+    free(dir->pages);
+    free(dir->path);
+    free(dir);
+}
+
+/**
+ * @brief Index every page file in @p path.
+ *
+ * @details Pages without a readable NAME section (compressed ones, for
+ * instance) are still listed under their file name.
+ *
+ * @return New block with one reference, or NULL on allocation failure.
+ */
+static man_apropos_dir_t *
+man_apropos_dir_scan(const char *path, struct timespec mtime, int rank)
+{
+    man_apropos_dir_t *dir = calloc(1, sizeof(*dir));
+    size_t cap = 0;
+    struct dirent *de;
+    DIR *d;
+
+    if (!dir || !(dir->path = strdup(path))) {
+        free(dir);
+        return NULL;
+    }
+    dir->refs = 1;
+    dir->rank = rank;
+    dir->mtime = mtime;
+    if (!(d = opendir(path)))
+        return dir;
+
+    while ((de = readdir(d)) != NULL) {
+        char file[PATH_MAX], names[MAN_APROPOS_TEXT_MAX];
+        char desc[MAN_APROPOS_TEXT_MAX], section[16], stem[NAME_MAX + 1];
+        char *dot;
+        man_apropos_page_t *page;
+        struct stat st;
+        int n;
+
+        if (de->d_name[0] == '.' ||
+            !man_parse_section_from_filename(de->d_name, section,
+            sizeof(section)))
+            continue;
+        n = snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+        if (n < 0 || (size_t)n >= sizeof(file) || stat(file, &st) != 0 ||
+            !S_ISREG(st.st_mode))
+            continue;
+        /* "name.1.gz" -> "name": cut at the section suffix. */
+        strlcpy(stem, de->d_name, sizeof(stem));
+        while ((dot = strrchr(stem, '.')) != NULL) {
+            *dot = '\0';
+            if (strcmp(dot + 1, section) == 0)
+                break;
+        }
+        if (!man_apropos_parse(file, names, desc)) {
+            strlcpy(names, stem, sizeof(names));
+            desc[0] = '\0';
+        }
+
+        if (dir->count == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            man_apropos_page_t *np = realloc(dir->pages,
+                ncap * sizeof(*np));
+
+            if (!np)
+                break;
+            dir->pages = np;
+            cap = ncap;
+        }
+        page = &dir->pages[dir->count];
+        page->names = strdup(names);
+        page->desc = strdup(desc);
+        page->path = strdup(file);
+        page->words = man_apropos_words(names, desc);
+        page->keys = man_apropos_keys(stem, names);
+        strlcpy(page->section, section, sizeof(page->section));
+        if (!page->names || !page->desc || !page->path || !page->words ||
+            !page->keys) {
+            free(page->names);
+            free(page->desc);
+            free(page->path);
+            free(page->words);
+            free(page->keys);
+            break;
+        }
+        dir->count++;
+    }
+    closedir(d);
+    return dir;
+}
+
+/** Free @p s once its last reference is gone. */
+static void
+man_apropos_set_free(snapshot_t *s)
+{
+    man_apropos_set_t *set = (man_apropos_set_t *)s;
+
+    pthread_mutex_lock(&man_apropos_lock);
+    /* Blocks still used by a newer set are the newer set's to free. */
+    for (size_t i = 0; i < set->ndirs; i++) {
+        if (--set->dirs[i]->refs > 0)
+            set->dirs[i] = NULL;
+    }
+    pthread_mutex_unlock(&man_apropos_lock);
+    for (size_t i = 0; i < set->ndirs; i++)
+        man_apropos_dir_free(set->dirs[i]);
+    free(set->dirs);
+    free(set->pages);
+    free(set->postings);
+    free(set->keys);
+    free(set->names);
+    free(set);
+}
+
+/** Drop a reference on @p set; the last one frees it. */
+static void
+man_apropos_set_release(man_apropos_set_t *set)
+{
+    if (set)
+        snapshot_release(&set->hdr);
+}
+
+/** Reference on the published snapshot, or NULL before the first build. */
+static man_apropos_set_t *
+man_apropos_set_acquire(void)
+{
+    return (man_apropos_set_t *)snapshot_acquire(&man_apropos_current);
+}
+
+/** Publish @p set (may be NULL) and drop the previous snapshot. */
+static void
+man_apropos_publish(man_apropos_set_t *set)
+{
+    snapshot_publish(&man_apropos_current, set ? &set->hdr : NULL);
+}
+
+static int
+man_apropos_page_cmp(const void *a, const void *b)
+{
+    const man_apropos_page_t *const *l = a;
+    const man_apropos_page_t *const *r = b;
+    int c = strcasecmp((*l)->names, (*r)->names);
+
+    return c != 0 ? c : strcmp((*l)->section, (*r)->section);
+}
+
+static int
+man_apropos_name_cmp(const void *a, const void *b)
+{
+    const man_apropos_name_t *l = a;
+    const man_apropos_name_t *r = b;
+    int c = strcasecmp(l->name, r->name);
+
+    return c != 0 ? c : strcmp(l->page->section, r->page->section);
+}
+
+static int
+man_apropos_posting_cmp(const void *a, const void *b)
+{
+    const man_apropos_posting_t *l = a;
+    const man_apropos_posting_t *r = b;
+    int c = strcmp(l->word, r->word);
+
+    if (c != 0)
+        return c;
+    return (l->page > r->page) - (l->page < r->page);
+}
+
+static int
+man_apropos_path_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/** FNV-1a over @p name, a NUL and @p section. */
+static uint32_t
+man_apropos_key_hash(const char *name, const char *section)
+{
+    uint32_t h = 2166136261u;
+
+    for (const char *p = name; *p; p++)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    h *= 16777619u;
+    for (const char *p = section; *p; p++)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    return h;
+}
+
+/** Slot holding (@p name, @p section), or the empty slot it would take. */
+static man_apropos_key_t *
+man_apropos_key_slot(const man_apropos_set_t *set, const char *name,
+    const char *section, uint32_t hash)
+{
+    for (size_t i = hash & set->keys_mask; ; i = (i + 1) & set->keys_mask) {
+        man_apropos_key_t *k = &set->keys[i];
+
+        if (!k->name || (k->hash == hash && strcmp(k->name, name) == 0 &&
+            strcmp(k->page->section, section) == 0))
+            return k;
+    }
+}
+
+/**
+ * @brief Fill the (name, section) table of @p set.
+ *
+ * @details Where several pages claim a name, the one in the earliest
+ * root wins, as with man -M; within a root a file named after the page
+ * beats a NAME alias.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int
+man_apropos_set_keys(man_apropos_set_t *set)
+{
+    size_t nkeys = 0, size = 16;
+
+    for (size_t i = 0; i < set->npages; i++) {
+        for (const char *k = set->pages[i]->keys; *k; k += strlen(k) + 1)
+            nkeys++;
+    }
+    while (size < nkeys * 2)
+        size *= 2;
+    set->keys = calloc(size, sizeof(*set->keys));
+    if (!set->keys)
+        return -1;
+    set->keys_mask = size - 1;
+
+    for (size_t d = 0; d < set->ndirs; d++) {
+        const man_apropos_dir_t *dir = set->dirs[d];
+
+        for (size_t i = 0; i < dir->count; i++) {
+            const man_apropos_page_t *page = &dir->pages[i];
+            int alias = 0;
+
+            for (const char *k = page->keys; *k; k += strlen(k) + 1) {
+                uint32_t h = man_apropos_key_hash(k, page->section);
+                man_apropos_key_t *slot = man_apropos_key_slot(set, k,
+                    page->section, h);
+                int rank = dir->rank * 2 + alias;
+
+                alias = 1;
+                if (slot->name && slot->rank <= rank)
+                    continue;
+                slot->name = k;
+                slot->page = page;
+                slot->hash = h;
+                slot->rank = rank;
+            }
+        }
+    }
+
+    /* The winners again, sorted for prefix lookups. */
+    set->names = calloc(nkeys ? nkeys : 1, sizeof(*set->names));
+    if (!set->names)
+        return -1;
+    for (size_t i = 0; i <= set->keys_mask; i++) {
+        if (!set->keys[i].name)
+            continue;
+        set->names[set->nnames].name = set->keys[i].name;
+        set->names[set->nnames].page = set->keys[i].page;
+        set->nnames++;
+    }
+    qsort(set->names, set->nnames, sizeof(*set->names),
+        man_apropos_name_cmp);
+    return 0;
+}
+
+/**
+ * @brief Build the page table and inverted index of a set whose
+ * directory blocks are in place.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int
+man_apropos_set_index(man_apropos_set_t *set)
+{
+    size_t np = 0, nw = 0, k = 0;
+
+    for (size_t i = 0; i < set->ndirs; i++)
+        np += set->dirs[i]->count;
+    if (np > UINT32_MAX)
+        return -1;
+    set->pages = calloc(np ? np : 1, sizeof(*set->pages));
+    if (!set->pages)
+        return -1;
+    for (size_t i = 0; i < set->ndirs; i++) {
+        for (size_t j = 0; j < set->dirs[i]->count; j++)
+            set->pages[set->npages++] = &set->dirs[i]->pages[j];
+    }
+    qsort(set->pages, set->npages, sizeof(*set->pages),
+        man_apropos_page_cmp);
+
+    for (size_t i = 0; i < set->npages; i++) {
+        for (const char *w = set->pages[i]->words; *w; w += strlen(w) + 1)
+            nw++;
+    }
+    set->postings = calloc(nw ? nw : 1, sizeof(*set->postings));
+    if (!set->postings)
+        return -1;
+    for (size_t i = 0; i < set->npages; i++) {
+        for (const char *w = set->pages[i]->words; *w;
+             w += strlen(w) + 1) {
+            set->postings[k].word = w;
+            set->postings[k].page = (uint32_t)i;
+            k++;
+        }
+    }
+    qsort(set->postings, k, sizeof(*set->postings),
+        man_apropos_posting_cmp);
+
+    /* A page repeating a word posts it once. */
+    set->npostings = 0;
+    for (size_t i = 0; i < k; i++) {
+        man_apropos_posting_t *last = set->npostings ?
+            &set->postings[set->npostings - 1] : NULL;
+
+        if (last && last->page == set->postings[i].page &&
+            strcmp(last->word, set->postings[i].word) == 0)
+            continue;
+        set->postings[set->npostings++] = set->postings[i];
+    }
+    return man_apropos_set_keys(set);
+}
+
+/**
+ * @brief Collect the manN directories under @p roots, plus one level of
+ * machine subdirectories (man4/amd64), sorted by path.
+ * @return Number of heap paths stored in @p paths.
+ */
+static size_t
+man_apropos_list_dirs(const char *const *roots, size_t nroots,
+    char **paths, struct timespec *mtimes, int *ranks)
+{
+    size_t n = 0;
+
+    for (size_t r = 0; r < nroots; r++) {
+        DIR *d = opendir(roots[r]);
+        struct dirent *de;
+
+        if (!d)
+            continue;
+        while ((de = readdir(d)) != NULL && n < MAN_APROPOS_DIRS_MAX) {
+            char path[PATH_MAX];
+            struct stat st;
+            size_t first = n;
+            DIR *sub;
+            struct dirent *se;
+
+            if (strncmp(de->d_name, "man", 3) != 0)
+                continue;
+            if ((size_t)snprintf(path, sizeof(path), "%s/%s", roots[r],
+                de->d_name) >= sizeof(path) || stat(path, &st) != 0 ||
+                !S_ISDIR(st.st_mode) || !(paths[n] = strdup(path)))
+                continue;
+            ranks[n] = (int)r * 2;
+            mtimes[n++] = st.st_mtim;
+
+            if (!(sub = opendir(paths[first])))
+                continue;
+            while ((se = readdir(sub)) != NULL && n < MAN_APROPOS_DIRS_MAX) {
+                if (se->d_name[0] == '.')
+                    continue;
+                if ((size_t)snprintf(path, sizeof(path), "%s/%s",
+                    paths[first], se->d_name) >= sizeof(path) ||
+                    stat(path, &st) != 0 || !S_ISDIR(st.st_mode) ||
+                    !(paths[n] = strdup(path)))
+                    continue;
+                ranks[n] = (int)r * 2 + 1;
+                mtimes[n++] = st.st_mtim;
+            }
+            closedir(sub);
+        }
+        closedir(d);
+    }
+
+    /* Insertion sort, keeping each mtime and rank next to its path. */
+    for (size_t i = 1; i < n; i++) {
+        for (size_t j = i; j > 0 &&
+             man_apropos_path_cmp(&paths[j - 1], &paths[j]) > 0; j--) {
+            char *tp = paths[j];
+            struct timespec tm = mtimes[j];
+            int tr = ranks[j];
+
+            paths[j] = paths[j - 1];
+            mtimes[j] = mtimes[j - 1];
+            ranks[j] = ranks[j - 1];
+            paths[j - 1] = tp;
+            mtimes[j - 1] = tm;
+            ranks[j - 1] = tr;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Bring the index up to date with the man trees under @p roots.
+ *
+ * @details Directories whose mtime is unchanged keep their parsed pages;
+ * only new or modified ones are re-read. When nothing changed the
+ * published snapshot stays as it is.
+ *
+ * @param roots Man tree roots, e.g. "/usr/share/man"; NULL for the ones
+ * the previous refresh used.
+ * @param nroots Number of entries in @p roots.
+ *
+ * @return 0 on success, -1 when a new snapshot could not be built.
+ */
+int
+man_apropos_refresh(const char *const *roots, size_t nroots)
+{
+    char *paths[MAN_APROPOS_DIRS_MAX];
+    struct timespec mtimes[MAN_APROPOS_DIRS_MAX];
+    int ranks[MAN_APROPOS_DIRS_MAX];
+    man_apropos_set_t *old, *set;
+    size_t ndirs, o = 0, rescanned = 0;
+    int rc = -1;
+
+    pthread_mutex_lock(&man_apropos_build_lock);
+    if (roots) {
+        man_apropos_last_roots = roots;
+        man_apropos_last_nroots = nroots;
+    } else {
+        roots = man_apropos_last_roots;
+        nroots = man_apropos_last_nroots;
+    }
+    old = man_apropos_set_acquire();
+    ndirs = man_apropos_list_dirs(roots, nroots, paths, mtimes, ranks);
+
+    set = calloc(1, sizeof(*set));
+    if (!set)
+        goto out;
+    snapshot_init(&set->hdr, man_apropos_set_free);
+    if (!(set->dirs = calloc(ndirs ? ndirs : 1, sizeof(*set->dirs))))
+        goto out;
+    for (size_t i = 0; i < ndirs; i++) {
+        man_apropos_dir_t *dir = NULL;
+
+        /* Both lists are sorted by path: walk them side by side. */
+        while (old && o < old->ndirs &&
+               strcmp(old->dirs[o]->path, paths[i]) < 0)
+            o++;
+        if (old && o < old->ndirs &&
+            strcmp(old->dirs[o]->path, paths[i]) == 0 &&
+            old->dirs[o]->rank == ranks[i] &&
+            old->dirs[o]->mtime.tv_sec == mtimes[i].tv_sec &&
+            old->dirs[o]->mtime.tv_nsec == mtimes[i].tv_nsec) {
+            dir = old->dirs[o];
+            pthread_mutex_lock(&man_apropos_lock);
+            dir->refs++;
+            pthread_mutex_unlock(&man_apropos_lock);
+        } else {
+            dir = man_apropos_dir_scan(paths[i], mtimes[i], ranks[i]);
+            rescanned++;
+        }
+        if (!dir)
+            goto out;
+        set->dirs[set->ndirs++] = dir;
+    }
+
+    if (old && rescanned == 0 && ndirs == old->ndirs) {
+        rc = 0;
+        goto out;
+    }
+    if (man_apropos_set_index(set) != 0)
+        goto out;
+    log_debug("[MAN] apropos index: %zu pages, %zu directories (%zu read)",
+        set->npages, set->ndirs, rescanned);
+    set->gen = ++man_apropos_gen;
+    man_apropos_publish(set);
+    set = NULL;
+    rc = 0;
+
+out:
+    man_apropos_set_release(set);
+    man_apropos_set_release(old);
+    pthread_mutex_unlock(&man_apropos_build_lock);
+    for (size_t i = 0; i < ndirs; i++)
+        free(paths[i]);
+    return rc;
+}
+
+typedef struct {
+    int rank;               /* 0 name is the query, 1 starts with it, 2 */
+    const man_apropos_page_t *page;
+} man_apropos_hit_t;
+
+static int
+man_apropos_hit_cmp(const void *a, const void *b)
+{
+    const man_apropos_hit_t *l = a;
+    const man_apropos_hit_t *r = b;
+
+    if (l->rank != r->rank)
+        return l->rank - r->rank;
+    return man_apropos_page_cmp(&l->page, &r->page);
+}
+
+/** How closely one of @p names ("a, b, c") matches @p q of @p len bytes. */
+static int
+man_apropos_rank(const char *names, const char *q, size_t len)
+{
+    int rank = 2;
+
+    for (const char *p = names; *p; ) {
+        size_t n = strcspn(p, ",");
+
+        if (n >= len && strncasecmp(p, q, len) == 0) {
+            if (n == len)
+                return 0;
+            rank = 1;
+        }
+        p += n;
+        while (*p == ',' || *p == ' ')
+            p++;
+    }
+    return rank;
+}
+
+/** Append @p s to the growing buffer @p *buf; -1 on allocation failure. */
+static int
+man_apropos_put(char **buf, size_t *len, size_t *cap, const char *s)
+{
+    size_t n = strlen(s);
+
+    if (*len + n + 1 > *cap) {
+        size_t ncap = *cap ? *cap : 4096;
+        char *nb;
+
+        while (*len + n + 1 > ncap)
+            ncap *= 2;
+        if (!(nb = realloc(*buf, ncap)))
+            return -1;
+        *buf = nb;
+        *cap = ncap;
+    }
+    memcpy(*buf + *len, s, n + 1);
+    *len += n;
+    return 0;
+}
+
+/**
+ * @brief Search the index for pages with a name or description word
+ * starting with @p query, case-insensitively.
+ *
+ * @details Output follows apropos(1), one "names(section) - description"
+ * line per page: pages named @p query first, then names starting with
+ * it, then description matches, each group by name.
+ *
+ * @param query Validated search token.
+ *
+ * @return Heap text, "" for no match; NULL while the index is not built
+ * yet or on allocation failure, so callers can fall back to apropos(1).
+ */
+char *
+man_apropos_search(const char *query)
+{
+    man_apropos_set_t *set = man_apropos_set_acquire();
+    char q[MAN_APROPOS_TEXT_MAX];
+    size_t qlen, lo, hi, nhits = 0, len = 0, cap = 0;
+    man_apropos_hit_t *hits = NULL;
+    unsigned char *seen = NULL;
+    char *out = NULL;
+
+    if (!set)
+        return NULL;
+    qlen = strlcpy(q, query, sizeof(q));
+    if (qlen >= sizeof(q))
+        qlen = sizeof(q) - 1;
+    for (size_t i = 0; i < qlen; i++)
+        q[i] = (char)tolower((unsigned char)q[i]);
+
+    /* First posting whose word is not below the query. */
+    lo = 0;
+    hi = set->npostings;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(set->postings[mid].word, q) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    seen = calloc(set->npages / 8 + 1, 1);
+    hits = malloc(MAN_APROPOS_MAX_RESULTS * sizeof(*hits));
+    if (!seen || !hits || man_apropos_put(&out, &len, &cap, "") != 0)
+        goto fail;
+    for (size_t i = lo; i < set->npostings &&
+         strncmp(set->postings[i].word, q, qlen) == 0; i++) {
+        uint32_t p = set->postings[i].page;
+
+        if (seen[p / 8] & (1u << (p % 8)))
+            continue;
+        seen[p / 8] |= (unsigned char)(1u << (p % 8));
+        if (nhits == MAN_APROPOS_MAX_RESULTS)
+            break;
+        hits[nhits].page = set->pages[p];
+        hits[nhits].rank = man_apropos_rank(set->pages[p]->names, q, qlen);
+        nhits++;
+    }
+    qsort(hits, nhits, sizeof(*hits), man_apropos_hit_cmp);
+
+    for (size_t i = 0; i < nhits; i++) {
+        char line[3 * MAN_APROPOS_TEXT_MAX];
+
+        snprintf(line, sizeof(line), "%s(%s) - %s\n", hits[i].page->names,
+            hits[i].page->section, hits[i].page->desc);
+        if (man_apropos_put(&out, &len, &cap, line) != 0)
+            goto fail;
+    }
+    free(seen);
+    free(hits);
+    man_apropos_set_release(set);
+    return out;
+
+fail:
+    free(seen);
+    free(hits);
+    free(out);
+    man_apropos_set_release(set);
+    return NULL;
+}
+
+/** Bounds of the names in [@p *lo, @p *hi) starting with @p p. */
+static void
+man_apropos_prefix_run(const man_apropos_set_t *set, const char *p,
+    size_t len, size_t *lo, size_t *hi)
+{
+    size_t l = *lo, h = *hi;
+
+    while (l < h) {
+        size_t mid = l + (h - l) / 2;
+
+        if (strncasecmp(set->names[mid].name, p, len) < 0)
+            l = mid + 1;
+        else
+            h = mid;
+    }
+    *lo = l;
+    h = *hi;
+    while (l < h) {
+        size_t mid = l + (h - l) / 2;
+
+        if (strncasecmp(set->names[mid].name, p, len) <= 0)
+            l = mid + 1;
+        else
+            h = mid;
+    }
+    *hi = l;
+}
+
+/** Cache slot of lowercased prefix @p p of @p len bytes. */
+static man_apropos_prefix_t *
+man_apropos_prefix_slot(const char *p, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    return &man_apropos_prefixes[h % MAN_APROPOS_PREFIX_SLOTS];
+}
+
+/**
+ * @brief Run of @p set->names starting with @p p, from the cache or by
+ * narrowing the run of its longest cached parent.
+ */
+static void
+man_apropos_prefix_find(const man_apropos_set_t *set, const char *p,
+    size_t len, size_t *lo, size_t *hi)
+{
+    man_apropos_prefix_t *e;
+    size_t n;
+
+    *lo = 0;
+    *hi = set->nnames;
+    if (len == 0)
+        return;
+    pthread_mutex_lock(&man_apropos_prefix_lock);
+    for (n = len; n > 0; n--) {
+        e = man_apropos_prefix_slot(p, n);
+        if (e->gen == set->gen && strncmp(e->prefix, p, n) == 0 &&
+            e->prefix[n] == '\0') {
+            *lo = e->lo;
+            *hi = e->hi;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&man_apropos_prefix_lock);
+    if (n == len)
+        return;
+
+    man_apropos_prefix_run(set, p, len, lo, hi);
+    pthread_mutex_lock(&man_apropos_prefix_lock);
+    e = man_apropos_prefix_slot(p, len);
+    e->gen = set->gen;
+    memcpy(e->prefix, p, len);
+    e->prefix[len] = '\0';
+    e->lo = *lo;
+    e->hi = *hi;
+    pthread_mutex_unlock(&man_apropos_prefix_lock);
+}
+
+/**
+ * @brief List the pages whose name starts with @p prefix, for type-ahead.
+ *
+ * @details Matches are (name, section) pairs as man_apropos_resolve()
+ * knows them, NAME aliases included, sorted by name so a page named
+ * exactly @p prefix comes first. The output is
+ * {"prefix":..., "total":N, "matches":[{"name", "section", "desc"}],
+ * "next":C}, where C is the cursor of the following match, or null.
+ *
+ * @param prefix Validated name prefix; "" matches every name.
+ * @param cursor Position of the first match to return.
+ * @param limit Most matches to return, at most MAN_APROPOS_PREFIX_LIMIT.
+ *
+ * @return Heap JSON; NULL while the index is not built yet or on
+ * allocation failure.
+ */
+char *
+man_apropos_prefix_json(const char *prefix, size_t cursor, size_t limit)
+{
+    man_apropos_set_t *set = man_apropos_set_acquire();
+    char p[MAN_APROPOS_PREFIX_MAX];
+    size_t plen, lo, hi, end;
+    json_writer_t w;
+
+    if (!set)
+        return NULL;
+    plen = strlcpy(p, prefix, sizeof(p));
+    if (plen >= sizeof(p))
+        plen = sizeof(p) - 1;
+    for (size_t i = 0; i < plen; i++)
+        p[i] = (char)tolower((unsigned char)p[i]);
+    if (limit > MAN_APROPOS_PREFIX_LIMIT)
+        limit = MAN_APROPOS_PREFIX_LIMIT;
+
+    man_apropos_prefix_find(set, p, plen, &lo, &hi);
+    if (cursor > hi - lo)
+        cursor = hi - lo;
+    end = lo + cursor + (limit < hi - lo - cursor ? limit : hi - lo - cursor);
+
+    if (json_init(&w, NULL, 128 + (end - lo - cursor) * 96) != 0) {
+        man_apropos_set_release(set);
+        return NULL;
+    }
+    json_puts(&w, "{\"prefix\":");
+    json_str(&w, prefix);
+    json_printf(&w, ",\"total\":%zu,\"matches\":[", hi - lo);
+    for (size_t i = lo + cursor; i < end; i++) {
+        const man_apropos_name_t *m = &set->names[i];
+
+        json_puts(&w, i > lo + cursor ? ",{\"name\":" : "{\"name\":");
+        json_str(&w, m->name);
+        json_puts(&w, ",\"section\":");
+        json_str(&w, m->page->section);
+        json_puts(&w, ",\"desc\":");
+        json_str(&w, m->page->desc);
+        json_putc(&w, '}');
+    }
+    if (end < hi)
+        json_printf(&w, "],\"next\":%zu}", end - lo);
+    else
+        json_puts(&w, "],\"next\":null}");
+    man_apropos_set_release(set);
+    return json_finish(&w, NULL);
+}
+
+/**
+ * @brief Find the page file for @p name in @p section.
+ *
+ * @details A name the index does not know makes it check the man trees
+ * for changes right away, at most once a second, so a page installed
+ * since the last heartbeat is found without waiting for the next one.
+ *
+ * @param name Validated page name.
+ * @param section Validated section.
+ * @param path Receives a heap copy of the absolute path when found.
+ *
+ * @return 1 when found, 0 when no such page exists, -1 while the index
+ * is not built yet or on allocation failure.
+ */
+int
+man_apropos_resolve(const char *name, const char *section, char **path)
+{
+    uint32_t h = man_apropos_key_hash(name, section);
+
+    *path = NULL;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        man_apropos_set_t *set = man_apropos_set_acquire();
+        const man_apropos_key_t *slot;
+        time_t now, last;
+
+        if (!set)
+            return -1;
+        slot = man_apropos_key_slot(set, name, section, h);
+        if (slot->name && access(slot->page->path, R_OK) == 0) {
+            *path = strdup(slot->page->path);
+            man_apropos_set_release(set);
+            return *path ? 1 : -1;
+        }
+        man_apropos_set_release(set);
+
+        now = time(NULL);
+        last = __atomic_load_n(&man_apropos_miss_refresh, __ATOMIC_RELAXED);
+        if (attempt > 0 || now == last ||
+            !__atomic_compare_exchange_n(&man_apropos_miss_refresh, &last,
+            now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        (void)man_apropos_refresh(NULL, 0);
+    }
+    return 0;
+}
+
+/** Heartbeat task: re-read the directories that changed. */
+static void
+man_apropos_heartbeat(void *ctx)
+{
+    (void)ctx;
+    (void)man_apropos_refresh(man_apropos_roots,
+        sizeof(man_apropos_roots) / sizeof(man_apropos_roots[0]));
+}
+
+/** Startup thread: the first build reads every page, off the heartbeat. */
+static void *
+man_apropos_build_thread(void *arg)
+{
+    (void)arg;
+    if (man_apropos_refresh(man_apropos_roots,
+        sizeof(man_apropos_roots) / sizeof(man_apropos_roots[0])) != 0)
+        log_error("[MAN] apropos index build failed; forking apropos");
+    readiness_done("man.apropos");
+    return NULL;
+}
+
+/**
+ * @brief Build the index in the background and keep it current.
+ *
+ * @details Until the first build is published, searches fall back to
+ * apropos(1). Calling it again is harmless.
+ *
+ * @return 0 on success, -1 when the refresh task could not be set up.
+ */
+int
+man_apropos_start(void)
+{
+    static int started;
+    pthread_t tid;
+
+    if (__atomic_exchange_n(&started, 1, __ATOMIC_ACQ_REL))
+        return 0;
+    (void)readiness_expect("man.apropos");
+    if (pthread_create(&tid, NULL, man_apropos_build_thread, NULL) == 0)
+        (void)pthread_detach(tid);
+    else
+        readiness_done("man.apropos");
+    if (heartbeat_register(&(struct hb_task){
+        .name = "man.apropos",
+        .period_sec = MAN_APROPOS_PERIOD_SEC,
+        .initial_delay_sec = MAN_APROPOS_PERIOD_SEC,
+        .cb = man_apropos_heartbeat,
+        .ctx = NULL,
+        }) < 0)
+        return -1;
+    return heartbeat_start();
+}
+
+/** Drop the published index; searches fork apropos(1) again. */
+void
+man_apropos_cleanup(void)
+{
+    pthread_mutex_lock(&man_apropos_build_lock);
+    man_apropos_publish(NULL);
+    pthread_mutex_unlock(&man_apropos_build_lock);
+}
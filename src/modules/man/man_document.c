@@ -0,0 +1,346 @@
+/* man_document.c - resolved page sources and background page renders */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "man_internal.h"
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+
+/*
+ * mandoc(1) runs out of process, so its parse of a page cannot be kept
+ * between formats; what can is everything around it. A page (section,
+ * name) is resolved to its source once, which may have cost an apropos
+ * lookup or a man -w run, and the path is kept with the file's mtime for
+ * MAN_DOC_TTL_SEC: each later format, and the render after the handler's
+ * own lookup, only pays a stat(2). A source whose mtime changed, or that
+ * went away, is resolved again and its formats start over.
+ *
+ * When a request renders one format of a page, the text siblings it does
+ * not have yet (html, txt, md) are queued and rendered on the heartbeat
+ * while no mandoc helper serves a request, through the same single-flight
+ * group and caches as requests; a user who asks for the html and then the
+ * text finds it ready. PDF and PostScript are left to demand: they cost
+ * the most and are mostly downloads.
+ *
+ * L1 entries that were served stale, or are hot and about to expire,
+ * are queued for a refresh by the render cache and taken first on each
+ * tick, busy helpers or not: each one stands for a request that would
+ * otherwise have waited on the render. A fresh L2 file is copied back
+ * into L1; only without one does mandoc run again.
+ */
+
+#define MAN_DOC_SLOTS		64
+#define MAN_DOC_TTL_SEC		120
+#define MAN_DOC_PENDING		32
+#define MAN_DOC_REFRESHES	16
+#define MAN_DOC_PERIOD_MS	500
+#define MAN_DOC_PER_TICK	2
+
+static const char *const man_doc_formats[] = { "html", "txt", "md" };
+#define MAN_DOC_NFORMATS \
+	(int)(sizeof(man_doc_formats) / sizeof(man_doc_formats[0]))
+
+typedef struct {
+	char section[16];
+	char page[64];
+	char path[PATH_MAX];
+	struct timespec mtime;
+	time_t expires;		/* 0: free slot */
+	unsigned int formats;	/* man_doc_formats[] done or queued */
+} man_doc_t;
+
+typedef struct {
+	char area[32];
+	char section[16];
+	char page[64];
+	char format[8];
+} man_doc_job_t;
+
+static pthread_mutex_t man_doc_lock = PTHREAD_MUTEX_INITIALIZER;
+static man_doc_t man_doc[MAN_DOC_SLOTS];
+static man_doc_job_t man_doc_pending[MAN_DOC_PENDING];
+static size_t man_doc_head, man_doc_count;
+static man_doc_job_t man_doc_refreshes[MAN_DOC_REFRESHES];
+static size_t man_doc_refresh_head, man_doc_refresh_count;
+static int man_doc_running;
+
+/** Slot of (section, page), fresh at @p now, or NULL. Lock held. */
+static man_doc_t *
+man_doc_find(const char *section, const char *page, time_t now)
+{
+	for (int i = 0; i < MAN_DOC_SLOTS; i++) {
+		man_doc_t *d = &man_doc[i];
+
+		if (d->expires > now && strcmp(d->page, page) == 0 &&
+		    strcmp(d->section, section) == 0)
+			return d;
+	}
+	return NULL;
+}
+
+/** Index of @p format in man_doc_formats[], or -1. */
+static int
+man_doc_format_index(const char *format)
+{
+	for (int i = 0; i < MAN_DOC_NFORMATS; i++) {
+		if (strcmp(format, man_doc_formats[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/** Remember @p path as the source of (section, page). */
+static void
+man_doc_store(const char *section, const char *page, const char *path,
+    const struct stat *st)
+{
+	time_t now = time(NULL);
+	man_doc_t *d, *victim = &man_doc[0];
+
+	pthread_mutex_lock(&man_doc_lock);
+	if ((d = man_doc_find(section, page, now)) == NULL) {
+		for (int i = 0; i < MAN_DOC_SLOTS; i++) {
+			if (man_doc[i].expires < victim->expires)
+				victim = &man_doc[i];
+		}
+		d = victim;
+		strlcpy(d->section, section, sizeof(d->section));
+		strlcpy(d->page, page, sizeof(d->page));
+		d->formats = 0;
+	}
+	if (strcmp(d->path, path) != 0 ||
+	    d->mtime.tv_sec != st->st_mtim.tv_sec ||
+	    d->mtime.tv_nsec != st->st_mtim.tv_nsec)
+		d->formats = 0;
+	strlcpy(d->path, path, sizeof(d->path));
+	d->mtime = st->st_mtim;
+	d->expires = now + MAN_DOC_TTL_SEC;
+	pthread_mutex_unlock(&man_doc_lock);
+}
+
+/**
+ * @brief Absolute source path of a page, from the cache while the file
+ * is unchanged.
+ *
+ * @param section Manual section token.
+ * @param page Manual page name.
+ *
+ * @return char* Heap-allocated path, or NULL when the page is not found.
+ */
+char *
+man_document_path(const char *section, const char *page)
+{
+	char path[PATH_MAX];
+	struct timespec mtime;
+	struct stat st;
+	man_doc_t *d;
+	char *resolved;
+
+	path[0] = '\0';
+	memset(&mtime, 0, sizeof(mtime));
+	pthread_mutex_lock(&man_doc_lock);
+	if ((d = man_doc_find(section, page, time(NULL))) != NULL) {
+		strlcpy(path, d->path, sizeof(path));
+		mtime = d->mtime;
+	}
+	pthread_mutex_unlock(&man_doc_lock);
+	if (path[0] != '\0' && stat(path, &st) == 0 &&
+	    st.st_mtim.tv_sec == mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == mtime.tv_nsec)
+		return strdup(path);
+
+	resolved = man_resolve_path(page, section);
+	if (resolved && resolved[0] == '/' && strlen(resolved) < PATH_MAX &&
+	    stat(resolved, &st) == 0)
+		man_doc_store(section, page, resolved, &st);
+	return resolved;
+}
+
+/**
+ * @brief Note that a request rendered @p format of a page, and queue the
+ * text formats it has not had since its source was resolved.
+ *
+ * @param area Logical area.
+ * @param section Manual section the page was found in.
+ * @param page Manual page name.
+ * @param format Output format just rendered.
+ */
+void
+man_document_rendered(const char *area, const char *section,
+    const char *page, const char *format)
+{
+	int fi = man_doc_format_index(format);
+	man_doc_t *d;
+
+	pthread_mutex_lock(&man_doc_lock);
+	if (!man_doc_running ||
+	    (d = man_doc_find(section, page, time(NULL))) == NULL) {
+		pthread_mutex_unlock(&man_doc_lock);
+		return;
+	}
+	if (fi >= 0)
+		d->formats |= 1u << fi;
+	for (int i = 0; i < MAN_DOC_NFORMATS; i++) {
+		man_doc_job_t *j;
+
+		if ((d->formats & (1u << i)) ||
+		    man_doc_count == MAN_DOC_PENDING)
+			continue;
+		d->formats |= 1u << i;
+		j = &man_doc_pending[(man_doc_head + man_doc_count++) %
+		    MAN_DOC_PENDING];
+		strlcpy(j->area, area, sizeof(j->area));
+		strlcpy(j->section, section, sizeof(j->section));
+		strlcpy(j->page, page, sizeof(j->page));
+		strlcpy(j->format, man_doc_formats[i], sizeof(j->format));
+	}
+	pthread_mutex_unlock(&man_doc_lock);
+}
+
+/**
+ * @brief Queue a refresh of the L1 entry of a page variant.
+ *
+ * @param area Logical area.
+ * @param section Manual section.
+ * @param page Manual page name.
+ * @param format Output format.
+ *
+ * @return int 0 when queued, -1 when not running or the queue is full.
+ */
+int
+man_document_refresh(const char *area, const char *section, const char *page,
+    const char *format)
+{
+	man_doc_job_t *j;
+	int rc = -1;
+
+	pthread_mutex_lock(&man_doc_lock);
+	if (man_doc_running && man_doc_refresh_count < MAN_DOC_REFRESHES) {
+		j = &man_doc_refreshes[(man_doc_refresh_head +
+		    man_doc_refresh_count++) % MAN_DOC_REFRESHES];
+		strlcpy(j->area, area, sizeof(j->area));
+		strlcpy(j->section, section, sizeof(j->section));
+		strlcpy(j->page, page, sizeof(j->page));
+		strlcpy(j->format, format, sizeof(j->format));
+		rc = 0;
+	}
+	pthread_mutex_unlock(&man_doc_lock);
+	return rc;
+}
+
+/**
+ * @brief Run up to @p max queued L1 refreshes.
+ *
+ * @return int Entries refreshed.
+ */
+int
+man_document_refresh_run(int max)
+{
+	man_doc_job_t j;
+	int done = 0;
+
+	for (int i = 0; i < max; i++) {
+		pthread_mutex_lock(&man_doc_lock);
+		if (man_doc_refresh_count == 0) {
+			pthread_mutex_unlock(&man_doc_lock);
+			break;
+		}
+		j = man_doc_refreshes[man_doc_refresh_head];
+		man_doc_refresh_head = (man_doc_refresh_head + 1) %
+		    MAN_DOC_REFRESHES;
+		man_doc_refresh_count--;
+		pthread_mutex_unlock(&man_doc_lock);
+
+		if (man_render_rehydrate(j.area, j.section, j.page,
+		    j.format) || man_render_prerender(j.area, j.section,
+		    j.page, j.format, 0) > 0)
+			done++;
+	}
+	return done;
+}
+
+/**
+ * @brief Render up to @p max queued sibling formats, stopping as soon as
+ * a request is waiting on mandoc.
+ *
+ * @return int Formats rendered.
+ */
+int
+man_document_speculate(int max)
+{
+	man_doc_job_t j;
+	int rendered = 0;
+
+	while (rendered < max && man_mandoc_busy() == 0) {
+		pthread_mutex_lock(&man_doc_lock);
+		if (man_doc_count == 0) {
+			pthread_mutex_unlock(&man_doc_lock);
+			break;
+		}
+		j = man_doc_pending[man_doc_head];
+		man_doc_head = (man_doc_head + 1) % MAN_DOC_PENDING;
+		man_doc_count--;
+		pthread_mutex_unlock(&man_doc_lock);
+
+		/* A recent L2 file means it is there already. */
+		if (man_render_prerender(j.area, j.section, j.page, j.format,
+		    MAN_FS_CACHE_TTL_SEC / 2) > 0)
+			rendered++;
+	}
+	return rendered;
+}
+
+/**
+ * Heartbeat: a few L1 refreshes per tick, then a few sibling renders
+ * while mandoc is idle.
+ */
+static void
+man_document_heartbeat(void *ctx)
+{
+	int n;
+
+	(void)ctx;
+	if ((n = man_document_refresh_run(MAN_DOC_PER_TICK)) > 0)
+		log_debug("[MAN] Refreshed %d cached pages", n);
+	if ((n = man_document_speculate(MAN_DOC_PER_TICK)) > 0)
+		log_debug("[MAN] Rendered %d sibling formats ahead", n);
+}
+
+/**
+ * @brief Start refreshing L1 and rendering sibling formats ahead of
+ * requests.
+ *
+ * @return int 0 on success, -1 when the task could not be registered.
+ */
+int
+man_document_start(void)
+{
+	if (heartbeat_register_ms(&(struct hb_task){
+		.name = "man.refresh",
+		.cb = man_document_heartbeat,
+		.ctx = NULL,
+	    }, MAN_DOC_PERIOD_MS, MAN_DOC_PERIOD_MS) < 0)
+		return -1;
+	pthread_mutex_lock(&man_doc_lock);
+	man_doc_running = 1;
+	pthread_mutex_unlock(&man_doc_lock);
+	return heartbeat_start();
+}
+
+/** Stop rendering ahead and forget every resolved source. */
+void
+man_document_cleanup(void)
+{
+	(void)heartbeat_unregister("man.refresh");
+	pthread_mutex_lock(&man_doc_lock);
+	man_doc_running = 0;
+	memset(man_doc, 0, sizeof(man_doc));
+	man_doc_head = man_doc_count = 0;
+	man_doc_refresh_head = man_doc_refresh_count = 0;
+	pthread_mutex_unlock(&man_doc_lock);
+}
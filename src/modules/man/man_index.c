@@ -1,9 +1,13 @@
 #include <dirent.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <miniweb/http/gzip.h>
+#include <miniweb/http/json.h>
 #include <miniweb/http/utils.h>
 #include <miniweb/modules/man.h>
 #include "man_internal.h"
@@ -71,6 +75,9 @@ select_resolved_man_path(char *raw_output)
 /**
  * @brief Resolve a man page name/section to an absolute file path.
  *
+ * @details A hash lookup in the in-process index; `man -w` is forked
+ * only until the first index build is published.
+ *
  * @param name Manual page name (e.g. `ls`).
  * @param section Section token (e.g. `1`, `3p`).
  *
@@ -82,6 +89,10 @@ man_resolve_path(const char *name, const char *section)
     if (!man_is_valid_token(name) || !man_is_valid_section(section))
         return NULL;
 
+    char *indexed = NULL;
+    if (man_apropos_resolve(name, section, &indexed) >= 0)
+        return indexed;
+
     char *const argv[] = {
         "man",
         "-M", "/usr/share/man:/usr/local/man:/usr/X11R6/man",
@@ -147,99 +158,339 @@ man_get_sections_json(void)
         "]}}");
 }
 
-/**
- * @brief Enumerate all pages within a specific area/section as JSON.
- *
- * @param area Area identifier (`system`, `x11`, or `packages`).
- * @param section Section identifier to filter file names.
- *
- * @return char* Heap-allocated JSON object with a `pages` array.
+/*
+ * Section listings: the sorted page names of one manN directory and the
+ * serialized {"pages":[...]} document, plain and gzipped, kept per
+ * (area, section). A request stats the directory; the listing is
+ * rebuilt only when its mtime moved. Listings are shared by reference,
+ * so a rebuild never pulls one from under a send, and looked up without
+ * a lock: a slot's key is written once, under man_section_lock, before
+ * the slot is marked used, and its listing is swapped by publishing.
  */
-char *
-man_get_section_pages_json(const char *area, const char *section)
-{
-    char dir_path[256];
-    char *pages[8192];
-    size_t page_count = 0;
-    const char *base = "/usr/share/man";
+#define MAN_SECTION_SLOTS 64
 
-    if (strcmp(area, "packages") == 0)
-        base = "/usr/local/man";
-    else if (strcmp(area, "x11") == 0)
-        base = "/usr/X11R6/man";
+typedef struct {
+    int used;                   /* key set; only ever raised */
+    char area[16];
+    char section[16];
+    snapshot_slot_t listing;
+} man_section_slot_t;
 
-    snprintf(dir_path, sizeof(dir_path), "%s/man%s", base, section);
+static pthread_mutex_t man_section_lock = PTHREAD_MUTEX_INITIALIZER;
+static man_section_slot_t man_section_slots[MAN_SECTION_SLOTS];
+static pthread_once_t man_section_once = PTHREAD_ONCE_INIT;
+static unsigned long man_section_version;
 
-    DIR *dr = opendir(dir_path);
-    if (!dr)
-        return strdup("{\"pages\":[]}");
+/** Give every slot its publishing lock. */
+static void
+man_section_init(void)
+{
+    for (int i = 0; i < MAN_SECTION_SLOTS; i++)
+        pthread_mutex_init(&man_section_slots[i].listing.lock, NULL);
+}
 
-    char *json = malloc(MAN_MAX_JSON_SIZE);
-    if (!json) {
-        closedir(dr);
-        return NULL;
+/** Tree root of @p area; unknown areas browse the base system. */
+static const char *
+man_section_root(const char *area, const char **canonical)
+{
+    if (area && strcmp(area, "packages") == 0) {
+        *canonical = "packages";
+        return "/usr/local/man";
+    }
+    if (area && strcmp(area, "x11") == 0) {
+        *canonical = "x11";
+        return "/usr/X11R6/man";
     }
+    *canonical = "system";
+    return "/usr/share/man";
+}
+
+/** Free @p l once its last reference is gone; called without the lock. */
+static void
+man_section_listing_free(man_section_listing_t *l)
+{
+    for (size_t i = 0; i < l->count; i++)
+        free(l->names[i]);
+    free(l->names);
+    http_blob_release(l->json);
+    http_blob_release(l->gz);
+    free(l);
+}
 
-    #define JSON_CLOSE_RESERVE 4
-    int n = snprintf(json, MAN_MAX_JSON_SIZE, "{\"pages\":[");
-    size_t used = (n > 0) ? (size_t)n : 0;
+/** snapshot_t destructor for a listing. */
+static void
+man_section_listing_destroy(snapshot_t *s)
+{
+    man_section_listing_free((man_section_listing_t *)s);
+}
+
+/**
+ * @brief Drop a reference taken by man_section_listing_get().
+ *
+ * @param l Listing, or NULL.
+ */
+void
+man_section_listing_release(man_section_listing_t *l)
+{
+    if (l)
+        snapshot_release(&l->hdr);
+}
 
+/**
+ * @brief Read @p dir_path into a sorted, serialized listing of the pages
+ * whose file name carries @p section.
+ *
+ * @return New listing with one reference, or NULL on failure.
+ */
+static man_section_listing_t *
+man_section_listing_build(const char *dir_path, const char *section,
+                          struct timespec mtime)
+{
+    man_section_listing_t *l = calloc(1, sizeof(*l));
+    size_t cap = 0, json_len, kept;
     struct dirent *de;
-    int first = 1;
+    char *p;
+    DIR *dr;
 
+    if (!l)
+        return NULL;
+    snapshot_init(&l->hdr, man_section_listing_destroy);
+    l->mtime = mtime;
+    if (!(dr = opendir(dir_path))) {
+        free(l);
+        return NULL;
+    }
     while ((de = readdir(dr)) != NULL) {
-        if (de->d_name[0] == '.')
-            continue;
-        if (de->d_type == DT_DIR)
-            continue;
-
         char resolved_section[16];
+        char *name, *last_dot;
+        int printable = 1;
+
+        if (de->d_name[0] == '.' || de->d_type == DT_DIR)
+            continue;
         if (!man_parse_section_from_filename(de->d_name, resolved_section,
-            sizeof(resolved_section)))
+            sizeof(resolved_section)) ||
+            strcmp(resolved_section, section) != 0)
             continue;
-        if (strcmp(resolved_section, section) != 0)
+        for (const unsigned char *c = (const unsigned char *)de->d_name;
+             *c; c++) {
+            if (*c < 0x20)
+                printable = 0;
+        }
+        if (!printable)
             continue;
+        if (l->count == cap) {
+            size_t ncap = cap ? cap * 2 : 256;
+            char **nn = realloc(l->names, ncap * sizeof(*nn));
 
-        // Extract the page name by removing the .section suffix
-        // But keep any other dots in the name (e.g., cupsd.conf.5 -> cupsd.conf)
-        char name[128];
-        strlcpy(name, de->d_name, sizeof(name));
-
-        // Find the last dot (which is the section separator)
-        char *last_dot = strrchr(name, '.');
-        if (last_dot) {
-            *last_dot = '\0';  // Remove the section suffix
+            if (!nn)
+                break;
+            l->names = nn;
+            cap = ncap;
         }
+        // Keep any other dots in the name (cupsd.conf.5 -> cupsd.conf)
+        if (!(name = strdup(de->d_name)))
+            break;
+        if ((last_dot = strrchr(name, '.')) != NULL)
+            *last_dot = '\0';
+        l->names[l->count++] = name;
+    }
+    closedir(dr);
 
-        if (page_count < (sizeof(pages) / sizeof(pages[0]))) {
-            pages[page_count] = strdup(name);
-            if (pages[page_count])
-                page_count++;
+    if (l->count > 1)
+        qsort(l->names, l->count, sizeof(l->names[0]), compare_string_ptrs);
+    /* foo.1 and foo.1.gz list once. */
+    kept = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        if (kept > 0 && strcmp(l->names[kept - 1], l->names[i]) == 0) {
+            free(l->names[i]);
+            continue;
         }
+        l->names[kept++] = l->names[i];
     }
-    closedir(dr);
+    l->count = kept;
 
-    if (page_count > 1)
-        qsort(pages, page_count, sizeof(pages[0]), compare_string_ptrs);
+    json_len = 64;
+    for (size_t i = 0; i < l->count; i++)
+        json_len += json_escaped_len(l->names[i], strlen(l->names[i])) + 3;
+    if (!(l->json = http_blob_alloc(json_len))) {
+        man_section_listing_free(l);
+        return NULL;
+    }
+    p = l->json->data;
+    p += snprintf(p, json_len, "{\"pages\":[");
+    for (size_t i = 0; i < l->count; i++) {
+        if (i > 0)
+            *p++ = ',';
+        *p++ = '"';
+        p = json_escape_put(p, l->names[i], strlen(l->names[i]));
+        *p++ = '"';
+    }
+    p += snprintf(p, json_len - (size_t)(p - l->json->data),
+                  "],\"total\":%zu}", l->count);
+    l->json->len = (size_t)(p - l->json->data);
+    if (l->json->len >= HTTP_GZIP_MIN_BYTES)
+        l->gz = http_gzip_blob(l->json->data, l->json->len);
+    l->version = __atomic_add_fetch(&man_section_version, 1,
+                                    __ATOMIC_RELAXED);
+    return l;
+}
 
-    for (size_t i = 0; i < page_count; i++) {
-        size_t name_len = strlen(pages[i]);
-        size_t entry_len = (first ? 0 : 1) + 1 + name_len + 1;
-        if (used + entry_len + JSON_CLOSE_RESERVE >= MAN_MAX_JSON_SIZE) {
-            free(pages[i]);
+/**
+ * @brief Current listing of @p section in @p area, rebuilt first when
+ * its directory changed since the cached one was read.
+ *
+ * @param area Area identifier (`system`, `x11`, or `packages`).
+ * @param section Section identifier.
+ *
+ * @return Listing to release with man_section_listing_release(), or
+ * NULL when the section does not exist.
+ */
+man_section_listing_t *
+man_section_listing_get(const char *area, const char *section)
+{
+    man_section_listing_t *l = NULL;
+    man_section_slot_t *slot = NULL;
+    const char *canonical;
+    const char *base = man_section_root(area, &canonical);
+    char dir_path[256];
+    struct stat st;
+
+    if (!man_is_valid_section(section))
+        return NULL;
+    snprintf(dir_path, sizeof(dir_path), "%s/man%s", base, section);
+    if (stat(dir_path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    (void)pthread_once(&man_section_once, man_section_init);
+    for (int i = 0; i < MAN_SECTION_SLOTS; i++) {
+        man_section_slot_t *s = &man_section_slots[i];
+
+        if (!__atomic_load_n(&s->used, __ATOMIC_ACQUIRE))
+            break;
+        if (strcmp(s->area, canonical) != 0 ||
+            strcmp(s->section, section) != 0)
             continue;
+        l = (man_section_listing_t *)snapshot_acquire(&s->listing);
+        if (l && (l->mtime.tv_sec != st.st_mtim.tv_sec ||
+            l->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+            man_section_listing_release(l);
+            l = NULL;
         }
-        n = snprintf(json + used, MAN_MAX_JSON_SIZE - used - JSON_CLOSE_RESERVE,
-                     "%s\"%s\"", first ? "" : ",", pages[i]);
-        free(pages[i]);
-        if (n > 0) {
-            used += (size_t)n;
-            first = 0;
+        break;
+    }
+    if (l)
+        return l;
+
+    if (!(l = man_section_listing_build(dir_path, section, st.st_mtim)))
+        return NULL;
+
+    /* Slots fill in order, so the first unused one ends the search. */
+    pthread_mutex_lock(&man_section_lock);
+    for (int i = 0; i < MAN_SECTION_SLOTS && !slot; i++) {
+        man_section_slot_t *s = &man_section_slots[i];
+
+        if (!s->used || (strcmp(s->area, canonical) == 0 &&
+            strcmp(s->section, section) == 0))
+            slot = s;
+    }
+    if (slot) {
+        snapshot_publish(&slot->listing, snapshot_ref(&l->hdr));
+        if (!slot->used) {
+            strlcpy(slot->area, canonical, sizeof(slot->area));
+            strlcpy(slot->section, section, sizeof(slot->section));
+            __atomic_store_n(&slot->used, 1, __ATOMIC_RELEASE);
         }
     }
-    (void)snprintf(json + used, MAN_MAX_JSON_SIZE - used, "]}");
-    #undef JSON_CLOSE_RESERVE
+    pthread_mutex_unlock(&man_section_lock);
+    return l;
+}
+
+/**
+ * @brief Serialize part of a listing: the names starting with @p prefix,
+ * skipping @p offset of them and keeping at most @p limit.
+ *
+ * @return Heap JSON with the slice, the match count and the offset.
+ */
+char *
+man_section_listing_json(const man_section_listing_t *l, const char *prefix,
+                         size_t offset, size_t limit)
+{
+    size_t plen = strlen(prefix), lo = 0, hi = l->count, end, total;
+    size_t json_len = 96;
+    char *json, *p;
+
+    /* Names are sorted: the prefix matches form one run. */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(l->names[mid], prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (end = lo; end < l->count &&
+         strncmp(l->names[end], prefix, plen) == 0; end++)
+        ;
+    total = end - lo;
+    lo += offset < total ? offset : total;
+    if (end - lo > limit)
+        end = lo + limit;
 
+    for (size_t i = lo; i < end; i++)
+        json_len += json_escaped_len(l->names[i], strlen(l->names[i])) + 3;
+    if (!(json = malloc(json_len)))
+        return NULL;
+    p = json + snprintf(json, json_len, "{\"pages\":[");
+    for (size_t i = lo; i < end; i++) {
+        if (i > lo)
+            *p++ = ',';
+        *p++ = '"';
+        p = json_escape_put(p, l->names[i], strlen(l->names[i]));
+        *p++ = '"';
+    }
+    snprintf(p, json_len - (size_t)(p - json),
+             "],\"total\":%zu,\"offset\":%zu}", total, offset);
+    return json;
+}
+
+/** Drop every cached listing; ones still being sent go with their send. */
+void
+man_section_listing_cleanup(void)
+{
+    (void)pthread_once(&man_section_once, man_section_init);
+    pthread_mutex_lock(&man_section_lock);
+    for (int i = 0; i < MAN_SECTION_SLOTS; i++) {
+        man_section_slot_t *s = &man_section_slots[i];
+
+        __atomic_store_n(&s->used, 0, __ATOMIC_RELEASE);
+        snapshot_publish(&s->listing, NULL);
+        s->area[0] = s->section[0] = '\0';
+    }
+    pthread_mutex_unlock(&man_section_lock);
+}
+
+/**
+ * @brief Enumerate all pages within a specific area/section as JSON.
+ *
+ * @param area Area identifier (`system`, `x11`, or `packages`).
+ * @param section Section identifier to filter file names.
+ *
+ * @return char* Heap-allocated JSON object with a `pages` array.
+ */
+char *
+man_get_section_pages_json(const char *area, const char *section)
+{
+    man_section_listing_t *l = man_section_listing_get(area, section);
+    char *json;
+
+    if (!l)
+        return strdup("{\"pages\":[],\"total\":0}");
+    json = malloc(l->json->len + 1);
+    if (json) {
+        memcpy(json, l->json->data, l->json->len);
+        json[l->json->len] = '\0';
+    }
+    man_section_listing_release(l);
     return json;
 }
 
@@ -258,31 +509,44 @@ man_get_page_metadata_json(const char *area, const char *section, const char *na
     char *filepath = man_resolve_path(name, section);
     if (!filepath)
         return strdup("{\"error\":\"Not found\"}");
-    char *json = malloc(1024);
-    if (!json) {
-        free(filepath);
-        return strdup("{\"error\":\"OOM\"}");
+    json_writer_t w;
+    char *json;
+
+    if (json_init(&w, NULL, 256) == 0) {
+        json_puts(&w, "{\"name\":");
+        json_str(&w, name);
+        json_puts(&w, ",\"section\":");
+        json_str(&w, section);
+        json_puts(&w, ",\"area\":");
+        json_str(&w, area);
+        json_puts(&w, ",\"path\":");
+        json_str(&w, filepath);
+        json_putc(&w, '}');
     }
-    snprintf(json, 1024,
-             "{\"name\":\"%s\",\"section\":\"%s\",\"area\":\"%s\","
-             "\"path\":\"%s\"}",
-             name, section, area, filepath);
     free(filepath);
+    if (!(json = json_finish(&w, NULL)))
+        return strdup("{\"error\":\"OOM\"}");
     return json;
 }
 
 /**
- * @brief Run apropos search for a validated query token.
+ * @brief Search manual pages for a validated query token.
+ *
+ * @details Answers from the in-process index; apropos(1) is forked only
+ * until the first index build is published.
  *
  * @param query Search term.
  *
- * @return char* Heap-allocated raw apropos output; empty string on failure.
+ * @return char* Heap-allocated apropos-style output; empty string on failure.
  */
 char *
 man_api_search(const char *query)
 {
     if (!man_is_valid_token(query))
         return strdup("");
+    char *indexed = man_apropos_search(query);
+    if (indexed)
+        return indexed;
     char *const argv[] = {
         "apropos",
         "-M", "/usr/share/man:/usr/local/man:/usr/X11R6/man",
@@ -296,7 +560,7 @@ man_api_search(const char *query)
 }
 
 /**
- * @brief Run apropos search and provide minimal fallback output.
+ * @brief Search manual pages and provide minimal fallback output.
  *
  * @param query Search term from API clients.
  *
@@ -309,13 +573,16 @@ man_api_search_raw(const char *query)
     if (!query || strlen(query) < 2 || !man_is_valid_token(query))
         return strdup("");
 
-    char *const argv[] = {
-        "apropos",
-        "-M", "/usr/share/man:/usr/local/man:/usr/X11R6/man",
-        (char *)query, NULL
-    };
-    char *output = safe_popen_read_argv("/usr/bin/apropos", argv,
-                                        1024 * 1024, 5, NULL);
+    char *output = man_apropos_search(query);
+    if (!output) {
+        char *const argv[] = {
+            "apropos",
+            "-M", "/usr/share/man:/usr/local/man:/usr/X11R6/man",
+            (char *)query, NULL
+        };
+        output = safe_popen_read_argv("/usr/bin/apropos", argv,
+                                      1024 * 1024, 5, NULL);
+    }
     if (!output)
         output = strdup("");
 
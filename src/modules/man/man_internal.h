@@ -2,14 +2,17 @@
 #define MINIWEB_MODULES_MAN_INTERNAL_H
 
 #include <stddef.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <miniweb/core/snapshot.h>
 #include <miniweb/http/handler.h>
+#include <miniweb/http/utils.h>
 
-#define MAN_MAX_JSON_SIZE       (256 * 1024)
 #define MAN_MAX_OUTPUT_SIZE     (10 * 1024 * 1024)
 #define MAN_FS_CACHE_TTL_SEC    300
 
 int man_path_matches_endpoint(const char *path, const char *endpoint);
-int man_get_query_value(const char *url, const char *key, char *out, size_t out_size);
+int man_get_query_value(const char *qs, const char *key, char *out, size_t out_size);
 int man_parse_section_from_filename(const char *filename, char *section_out,
                                     size_t section_out_len);
 int man_is_valid_token(const char *s);
@@ -19,6 +22,67 @@ const char *man_area_from_path(const char *filepath);
 char *man_resolve_path(const char *name, const char *section);
 char *man_api_search_raw(const char *query);
 
+int man_apropos_start(void);
+int man_apropos_refresh(const char *const *roots, size_t nroots);
+char *man_apropos_search(const char *query);
+char *man_apropos_prefix_json(const char *prefix, size_t cursor, size_t limit);
+int man_apropos_resolve(const char *name, const char *section, char **path);
+void man_apropos_cleanup(void);
+
+int man_mandoc_start(const char *mandoc, int timeout, int helpers);
+int man_mandoc_render(const char *path, const char *type, size_t max_size,
+                      char **out, size_t *out_len);
+int man_mandoc_stream(const char *path, const char *type, size_t max_size,
+                      safe_popen_cb cb, void *ctx);
+int man_mandoc_busy(void);
+void man_mandoc_cleanup(void);
+
+char *man_document_path(const char *section, const char *page);
+void man_document_rendered(const char *area, const char *section,
+                           const char *page, const char *format);
+int man_document_refresh(const char *area, const char *section,
+                         const char *page, const char *format);
+int man_document_refresh_run(int max);
+int man_document_speculate(int max);
+int man_document_start(void);
+void man_document_cleanup(void);
+
+int man_render_rehydrate(const char *area, const char *section,
+                         const char *page, const char *format);
+int man_render_prerender(const char *area, const char *section,
+                         const char *page, const char *format,
+                         time_t max_age);
+
+int man_l2_open(const char *path, struct stat *st);
+void man_l2_compact(void);
+char *man_l2_stats_json(void);
+int man_l2_start(size_t budget);
+void man_l2_cleanup(void);
+
+void man_popularity_note(const char *area, const char *section,
+                         const char *page, const char *format);
+int man_prerender_start(void);
+void man_prerender_cleanup(void);
+
+/* One section directory's sorted pages, shared by reference. */
+typedef struct man_section_listing {
+    snapshot_t hdr;
+    char **names;               /* sorted, without the section suffix */
+    size_t count;
+    http_blob_t *json;          /* {"pages":[...],"total":N} */
+    http_blob_t *gz;            /* gzip of json; NULL when too small */
+    unsigned long version;      /* changes on every rebuild */
+    struct timespec mtime;      /* directory mtime it was read at */
+} man_section_listing_t;
+
+man_section_listing_t *man_section_listing_get(const char *area,
+                                               const char *section);
+void man_section_listing_release(man_section_listing_t *l);
+char *man_section_listing_json(const man_section_listing_t *l,
+                               const char *prefix, size_t offset,
+                               size_t limit);
+void man_section_listing_cleanup(void);
+
 const char *man_mime_for_format(const char *format);
 void man_add_content_disposition_for_format(http_response_t *resp,
                                             const char *format,
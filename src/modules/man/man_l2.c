@@ -0,0 +1,345 @@
+/* man_l2.c - man L2 cache: lookups, byte budget and compaction */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "man_internal.h"
+#include <miniweb/core/cache_admin.h>
+#include <miniweb/core/counters.h>
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+
+extern char config_static_dir[];
+
+/*
+ * L2 files live under {static_dir}/man/{area}/{section}/{page}.{format}
+ * and are sent straight from the file (see http_send_fd()). A hit bumps
+ * the file's access time, at most once a minute, so the access time is a
+ * usable LRU clock even on noatime mounts and for mmap'd reads.
+ *
+ * The "man.l2" heartbeat task walks the tree every minute. Files past
+ * MAN_FS_CACHE_TTL_SEC are never served again and are removed; if the
+ * rest still exceeds the byte budget, the least recently used files go
+ * until it is back under MAN_L2_LOW_WATER percent of it.
+ */
+
+#define MAN_L2_PERIOD_SEC	60
+#define MAN_L2_TOUCH_SEC	60
+#define MAN_L2_LOW_WATER	90
+
+typedef struct {
+	char *path;
+	off_t size;
+	time_t atime;
+} man_l2_file_t;
+
+typedef struct {
+	man_l2_file_t *files;
+	size_t count;
+	size_t cap;
+	uint64_t bytes;
+	uint64_t expired;
+} man_l2_walk_t;
+
+static size_t man_l2_budget;
+static uint64_t man_l2_expired;
+static uint64_t man_l2_evicted;
+static uint64_t man_l2_bytes;
+static uint64_t man_l2_files;
+static time_t man_l2_swept;
+
+/**
+ * @brief Open the L2 file for a variant if it may still be served.
+ *
+ * @param path L2 file path from build_cache_paths().
+ * @param st Filled with the file's status on success.
+ *
+ * @return int Open descriptor, or -1 on a miss (absent, empty or expired).
+ */
+int
+man_l2_open(const char *path, struct stat *st)
+{
+	time_t now = time(NULL);
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd >= 0 && (fstat(fd, st) != 0 || st->st_size <= 0 ||
+	    now - st->st_mtime > MAN_FS_CACHE_TTL_SEC)) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		counter_inc(CTR_MAN_L2_MISSES);
+		return -1;
+	}
+	counter_inc(CTR_MAN_L2_HITS);
+
+	if (now - st->st_atime >= MAN_L2_TOUCH_SEC) {
+		struct timespec ts[2];
+
+		ts[0].tv_sec = now;
+		ts[0].tv_nsec = 0;
+		ts[1].tv_sec = 0;
+		ts[1].tv_nsec = UTIME_OMIT;	/* mtime drives the TTL */
+		(void)futimens(fd, ts);
+	}
+	return fd;
+}
+
+/** Remember one file of the tree. */
+static void
+man_l2_walk_add(man_l2_walk_t *w, const char *path, const struct stat *st)
+{
+	man_l2_file_t *nf;
+
+	if (w->count == w->cap) {
+		size_t ncap = w->cap ? w->cap * 2 : 256;
+
+		nf = realloc(w->files, ncap * sizeof(*nf));
+		if (!nf)
+			return;
+		w->files = nf;
+		w->cap = ncap;
+	}
+	if ((w->files[w->count].path = strdup(path)) == NULL)
+		return;
+	w->files[w->count].size = st->st_size;
+	w->files[w->count].atime = st->st_atime;
+	w->count++;
+	w->bytes += (uint64_t)st->st_size;
+}
+
+/**
+ * Walk @p dir, @p depth levels above the page files; expired files are
+ * unlinked on the way, the others collected into @p w.
+ */
+static void
+man_l2_walk(man_l2_walk_t *w, const char *dir, int depth, time_t now)
+{
+	struct dirent *de;
+	struct stat st;
+	char path[1024];
+	DIR *d;
+
+	if ((d = opendir(dir)) == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		/* Also skips ".popularity" and half-written temporaries. */
+		if (de->d_name[0] == '.')
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >=
+		    (int)sizeof(path))
+			continue;
+		if (lstat(path, &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			if (depth > 0)
+				man_l2_walk(w, path, depth - 1, now);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode) || depth != 0)
+			continue;
+		if (now - st.st_mtime > MAN_FS_CACHE_TTL_SEC) {
+			if (unlink(path) == 0)
+				w->expired++;
+			continue;
+		}
+		man_l2_walk_add(w, path, &st);
+	}
+	closedir(d);
+}
+
+/** qsort(3) order: least recently used first. */
+static int
+man_l2_lru_cmp(const void *a, const void *b)
+{
+	const man_l2_file_t *x = a, *y = b;
+
+	if (x->atime != y->atime)
+		return x->atime < y->atime ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @brief Drop expired L2 files, then enforce the byte budget LRU-first.
+ *
+ * @return void.
+ */
+void
+man_l2_compact(void)
+{
+	man_l2_walk_t w = {0};
+	uint64_t evicted = 0;
+	char root[512];
+	time_t now = time(NULL);
+
+	if (snprintf(root, sizeof(root), "%s/man", config_static_dir) >=
+	    (int)sizeof(root))
+		return;
+	/* man/{area}/{section}/{page}.{format} */
+	man_l2_walk(&w, root, 2, now);
+
+	if (man_l2_budget > 0 && w.bytes > man_l2_budget) {
+		uint64_t target = (uint64_t)man_l2_budget * MAN_L2_LOW_WATER / 100;
+
+		qsort(w.files, w.count, sizeof(*w.files), man_l2_lru_cmp);
+		for (size_t i = 0; i < w.count && w.bytes > target; i++) {
+			if (unlink(w.files[i].path) != 0)
+				continue;
+			w.bytes -= (uint64_t)w.files[i].size;
+			evicted++;
+		}
+	}
+	for (size_t i = 0; i < w.count; i++)
+		free(w.files[i].path);
+	free(w.files);
+
+	__atomic_store_n(&man_l2_bytes, w.bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&man_l2_files, (uint64_t)(w.count - evicted),
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&man_l2_expired, w.expired, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&man_l2_evicted, evicted, __ATOMIC_RELAXED);
+	__atomic_store_n(&man_l2_swept, now, __ATOMIC_RELAXED);
+	if (w.expired > 0 || evicted > 0)
+		log_debug("[MAN] L2 compaction: %llu expired, %llu evicted, "
+		    "%llu bytes kept", (unsigned long long)w.expired,
+		    (unsigned long long)evicted, (unsigned long long)w.bytes);
+}
+
+/** cache_admin stats(): as of the last compaction. */
+static void
+man_l2_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	uint64_t v[CTR_COUNT];
+
+	(void)ctx;
+	counters_read(v);
+	st->bytes = __atomic_load_n(&man_l2_bytes, __ATOMIC_RELAXED);
+	st->entries = __atomic_load_n(&man_l2_files, __ATOMIC_RELAXED);
+	st->hits = v[CTR_MAN_L2_HITS];
+	st->misses = v[CTR_MAN_L2_MISSES];
+}
+
+/**
+ * cache_admin purge(): keys are the L1 ones, "area/section/page.format",
+ * matched against the files the tree holds, so a key never names a path
+ * outside it.
+ */
+static size_t
+man_l2_admin_purge(const char *key, int prefix, void *ctx)
+{
+	man_l2_walk_t w = {0};
+	size_t purged = 0;
+	char root[512];
+	size_t rootlen;
+
+	(void)ctx;
+	if (snprintf(root, sizeof(root), "%s/man", config_static_dir) >=
+	    (int)sizeof(root))
+		return 0;
+	rootlen = strlen(root) + 1;
+	man_l2_walk(&w, root, 2, time(NULL));
+	for (size_t i = 0; i < w.count; i++) {
+		if (cache_admin_match(w.files[i].path + rootlen, key, prefix) &&
+		    unlink(w.files[i].path) == 0) {
+			w.bytes -= (uint64_t)w.files[i].size;
+			purged++;
+		}
+		free(w.files[i].path);
+	}
+	free(w.files);
+
+	__atomic_store_n(&man_l2_bytes, w.bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&man_l2_files, (uint64_t)(w.count - purged),
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&man_l2_expired, w.expired, __ATOMIC_RELAXED);
+	return purged;
+}
+
+static void
+man_l2_heartbeat(void *ctx)
+{
+	(void)ctx;
+	man_l2_compact();
+}
+
+/**
+ * @brief Format L2 cache statistics as a JSON object.
+ *
+ * @details Size and file counts are those of the last compaction pass;
+ * hit, miss and removal counters are cumulative.
+ *
+ * @return char* Heap-allocated JSON, or NULL on allocation failure.
+ */
+char *
+man_l2_stats_json(void)
+{
+	uint64_t v[CTR_COUNT], hits, misses;
+	char *json;
+
+	counters_read(v);
+	hits = v[CTR_MAN_L2_HITS];
+	misses = v[CTR_MAN_L2_MISSES];
+	json = malloc(512);
+	if (!json)
+		return NULL;
+	snprintf(json, 512,
+	    "{\"l2\": {\"bytes\": %llu, \"files\": %llu, \"budget\": %llu, "
+	    "\"hits\": %llu, \"misses\": %llu, \"hit_ratio\": %.4f, "
+	    "\"expired\": %llu, \"evicted\": %llu, \"last_sweep\": %lld}}",
+	    (unsigned long long)__atomic_load_n(&man_l2_bytes,
+	    __ATOMIC_RELAXED),
+	    (unsigned long long)__atomic_load_n(&man_l2_files,
+	    __ATOMIC_RELAXED),
+	    (unsigned long long)man_l2_budget,
+	    (unsigned long long)hits, (unsigned long long)misses,
+	    hits + misses ? (double)hits / (double)(hits + misses) : 0.0,
+	    (unsigned long long)__atomic_load_n(&man_l2_expired,
+	    __ATOMIC_RELAXED),
+	    (unsigned long long)__atomic_load_n(&man_l2_evicted,
+	    __ATOMIC_RELAXED),
+	    (long long)__atomic_load_n(&man_l2_swept, __ATOMIC_RELAXED));
+	return json;
+}
+
+/**
+ * @brief Set the L2 byte budget and register the compaction task.
+ *
+ * @param budget Bytes the L2 tree may hold; 0 only removes expired files.
+ *
+ * @return int 0 on success, -1 when the task could not be registered.
+ */
+int
+man_l2_start(size_t budget)
+{
+	man_l2_budget = budget;
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "man_l2",
+		.stats = man_l2_admin_stats,
+		.purge = man_l2_admin_purge,
+	});
+	if (heartbeat_register(&(struct hb_task){
+		.name = "man.l2",
+		.period_sec = MAN_L2_PERIOD_SEC,
+		.initial_delay_sec = 5,
+		.cb = man_l2_heartbeat,
+		.ctx = NULL,
+	    }) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/** Stop compacting; the files stay for the next start. */
+void
+man_l2_cleanup(void)
+{
+	(void)heartbeat_unregister("man.l2");
+}
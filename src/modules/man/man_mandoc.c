@@ -0,0 +1,631 @@
+/* man_mandoc.c - pool of long-lived mandoc(1) helper processes */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "man_internal.h"
+#include <miniweb/core/log.h>
+
+/*
+ * Forking mandoc straight from the server means copying the page tables
+ * of a large multithreaded process for every cache miss. Instead a few
+ * helpers are forked once; each is a small single-threaded process that
+ * reads (format, path) requests from a socketpair, runs mandoc itself and
+ * streams the output back as length-prefixed frames, ending with an empty
+ * frame and a status word. The helpers may be (re)spawned while worker
+ * threads are running, so everything they do after fork(2) is limited to
+ * async-signal-safe calls on static buffers: no malloc, no stdio, no log.
+ *
+ * A request holds its helper for the whole exchange; taking a free slot
+ * replaces the mandoc semaphore. A helper that dies or breaks the protocol
+ * is reaped and forked again on the next request.
+ */
+
+#define MAN_MANDOC_MAX_HELPERS	16
+#define MAN_MANDOC_CHUNK	16384
+#define MAN_MANDOC_SOCK_FD	3
+
+#define MAN_MANDOC_OK		0
+#define MAN_MANDOC_FAILED	1	/* timed out, or a bad request */
+
+struct man_mandoc_req {
+	uint32_t max_size;
+	char type[16];
+	char path[PATH_MAX];
+};
+
+typedef struct {
+	pid_t pid;		/* -1 when the slot has no helper */
+	int fd;
+	int busy;
+} man_mandoc_helper_t;
+
+static pthread_mutex_t man_mandoc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t man_mandoc_cond = PTHREAD_COND_INITIALIZER;
+static man_mandoc_helper_t man_mandoc_helpers[MAN_MANDOC_MAX_HELPERS];
+static int man_mandoc_nhelpers;		/* 0: pool disabled */
+static int man_mandoc_nfree;
+
+/* Set before the first fork and never changed while helpers run. */
+static char man_mandoc_path[PATH_MAX];
+static int man_mandoc_timeout;
+
+/** Read exactly @p len bytes; 1 on success, 0 at EOF, -1 on error. */
+static int
+man_mandoc_read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+
+		if (n == 0)
+			return 0;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+/** Write all of @p buf; 0 on success, -1 on error. */
+static int
+man_mandoc_write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/** Milliseconds left until @p deadline on the monotonic clock, at least 0. */
+static int
+man_mandoc_ms_left(const struct timespec *deadline)
+{
+	struct timespec now;
+	long long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000 +
+	    (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	if (ms < 0)
+		return 0;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+/** Push @p deadline back by the time elapsed since @p since. */
+static void
+man_mandoc_extend(struct timespec *deadline, const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline->tv_sec += now.tv_sec - since->tv_sec;
+	deadline->tv_nsec += now.tv_nsec - since->tv_nsec;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	} else if (deadline->tv_nsec < 0) {
+		deadline->tv_sec--;
+		deadline->tv_nsec += 1000000000L;
+	}
+}
+
+/** Send the closing frame of a reply: an empty chunk, then @p status. */
+static int
+man_mandoc_helper_end(int sock, uint32_t status)
+{
+	uint32_t end[2] = {0, status};
+
+	return man_mandoc_write_full(sock, end, sizeof(end));
+}
+
+/**
+ * Helper side of one request: run mandoc on @p req and forward what it
+ * writes, at most req->max_size bytes, as frames on @p sock.
+ * Async-signal-safe.
+ */
+static int
+man_mandoc_helper_run(int sock, struct man_mandoc_req *req)
+{
+	static char frame[sizeof(uint32_t) + MAN_MANDOC_CHUNK];
+	static const char *const types[] = {
+		"html", "pdf", "ps", "markdown", "ascii"
+	};
+	struct timespec deadline, sent;
+	char *argv[7];
+	size_t total = 0;
+	int argc = 0, known = 0, timed_out = 0, pfd[2], devnull;
+	pid_t pid;
+
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+		if (strcmp(req->type, types[i]) == 0)
+			known = 1;
+	if (!known || req->path[0] != '/')
+		return man_mandoc_helper_end(sock, MAN_MANDOC_FAILED);
+
+	argv[argc++] = "mandoc";
+	argv[argc++] = "-T";
+	argv[argc++] = req->type;
+	if (strcmp(req->type, "html") == 0)
+		argv[argc++] = "-Ostyle=/static/css/custom.css";
+	argv[argc++] = req->path;
+	argv[argc] = NULL;
+
+	if (pipe(pfd) == -1)
+		return man_mandoc_helper_end(sock, MAN_MANDOC_FAILED);
+	pid = fork();
+	if (pid == -1) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return man_mandoc_helper_end(sock, MAN_MANDOC_FAILED);
+	}
+	if (pid == 0) {
+		close(pfd[0]);
+		if (dup2(pfd[1], STDOUT_FILENO) < 0)
+			_exit(127);
+		close(pfd[1]);
+		devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0) {
+			dup2(devnull, STDERR_FILENO);
+			close(devnull);
+		}
+		execv(man_mandoc_path, argv);
+		_exit(127);
+	}
+	close(pfd[1]);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += man_mandoc_timeout;
+	while (total < req->max_size) {
+		struct pollfd p = { .fd = pfd[0], .events = POLLIN };
+		size_t want = req->max_size - total;
+		uint32_t len;
+		ssize_t n;
+		int pr;
+
+		pr = poll(&p, 1, man_mandoc_ms_left(&deadline));
+		if (pr == 0) {
+			timed_out = 1;
+			break;
+		}
+		if (pr < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (want > MAN_MANDOC_CHUNK)
+			want = MAN_MANDOC_CHUNK;
+		n = read(pfd[0], frame + sizeof(len), want);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			break;
+		len = (uint32_t)n;
+		memcpy(frame, &len, sizeof(len));
+		clock_gettime(CLOCK_MONOTONIC, &sent);
+		if (man_mandoc_write_full(sock, frame, sizeof(len) + len) != 0) {
+			/* The server is gone: stop. */
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			_exit(0);
+		}
+		/* Waiting on a slow streaming client is not mandoc's time. */
+		man_mandoc_extend(&deadline, &sent);
+		total += (size_t)n;
+	}
+	close(pfd[0]);
+	if (timed_out)
+		kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		;
+	return man_mandoc_helper_end(sock,
+	    timed_out ? MAN_MANDOC_FAILED : MAN_MANDOC_OK);
+}
+
+/** Body of a helper process: serve requests until the server hangs up. */
+static void
+man_mandoc_helper_main(int sock)
+{
+	static struct man_mandoc_req req;
+
+	for (;;) {
+		if (man_mandoc_read_full(sock, &req, sizeof(req)) != 1)
+			_exit(0);
+		req.type[sizeof(req.type) - 1] = '\0';
+		req.path[sizeof(req.path) - 1] = '\0';
+		if (man_mandoc_helper_run(sock, &req) != 0)
+			_exit(0);
+	}
+}
+
+/** Fork a helper into slot @p h. Caller owns the slot; 0 or -1. */
+static int
+man_mandoc_spawn(man_mandoc_helper_t *h)
+{
+	struct sigaction sa;
+	sigset_t all;
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		log_error("[MAN] mandoc helper socketpair: %s", strerror(errno));
+		return -1;
+	}
+	pid = fork();
+	if (pid == -1) {
+		log_error("[MAN] mandoc helper fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		/* Drop the server's handlers, mask and descriptors. */
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGHUP, &sa, NULL);
+		sa.sa_handler = SIG_IGN;
+		sigaction(SIGPIPE, &sa, NULL);
+		sigemptyset(&all);
+		sigprocmask(SIG_SETMASK, &all, NULL);
+		if (sv[1] != MAN_MANDOC_SOCK_FD &&
+		    dup2(sv[1], MAN_MANDOC_SOCK_FD) == -1)
+			_exit(127);
+		/* mandoc itself must not inherit the socket. */
+		fcntl(MAN_MANDOC_SOCK_FD, F_SETFD, FD_CLOEXEC);
+		closefrom(MAN_MANDOC_SOCK_FD + 1);
+#ifdef __OpenBSD__
+		if (pledge("stdio rpath proc exec", NULL) == -1)
+			_exit(127);
+#endif
+		man_mandoc_helper_main(MAN_MANDOC_SOCK_FD);
+		_exit(0);
+	}
+	close(sv[1]);
+	h->pid = pid;
+	h->fd = sv[0];
+	return 0;
+}
+
+/** Close and reap the helper in slot @p h; the slot stays owned. */
+static void
+man_mandoc_reap(man_mandoc_helper_t *h)
+{
+	if (h->pid == -1)
+		return;
+	close(h->fd);
+	kill(h->pid, SIGKILL);
+	while (waitpid(h->pid, NULL, 0) == -1 && errno == EINTR)
+		;
+	h->pid = -1;
+	h->fd = -1;
+}
+
+/** Wait for a free helper slot; NULL when the pool is disabled. */
+static man_mandoc_helper_t *
+man_mandoc_acquire(void)
+{
+	man_mandoc_helper_t *h = NULL;
+
+	pthread_mutex_lock(&man_mandoc_lock);
+	while (man_mandoc_nhelpers > 0 && man_mandoc_nfree == 0)
+		pthread_cond_wait(&man_mandoc_cond, &man_mandoc_lock);
+	for (int i = 0; i < man_mandoc_nhelpers; i++) {
+		if (!man_mandoc_helpers[i].busy) {
+			h = &man_mandoc_helpers[i];
+			h->busy = 1;
+			man_mandoc_nfree--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&man_mandoc_lock);
+	return h;
+}
+
+static void
+man_mandoc_release(man_mandoc_helper_t *h)
+{
+	pthread_mutex_lock(&man_mandoc_lock);
+	h->busy = 0;
+	man_mandoc_nfree++;
+	pthread_cond_signal(&man_mandoc_cond);
+	pthread_mutex_unlock(&man_mandoc_lock);
+}
+
+/** Poll for @p fd readable, then read exactly @p len bytes; 1 or -1. */
+static int
+man_mandoc_recv(int fd, void *buf, size_t len, const struct timespec *deadline)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ssize_t n;
+		int pr;
+
+		pr = poll(&pfd, 1, man_mandoc_ms_left(deadline));
+		if (pr == 0)
+			return -1;
+		if (pr < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+/**
+ * Run one request on helper @p h, handing each frame to @p cb. 0 at the
+ * end of the output, 1 when mandoc failed or @p cb stopped it, -1 when
+ * the helper itself misbehaved; *delivered is set once @p cb saw data.
+ */
+static int
+man_mandoc_exchange(man_mandoc_helper_t *h, const struct man_mandoc_req *req,
+    safe_popen_cb cb, void *ctx, int *delivered)
+{
+	struct timespec deadline;
+	char chunk[MAN_MANDOC_CHUNK];
+	size_t total = 0;
+	uint32_t len, status;
+	int stopped = 0;
+
+	if (man_mandoc_write_full(h->fd, req, sizeof(*req)) != 0)
+		return -1;
+
+	/* The helper enforces the timeout; allow it time to report. */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += man_mandoc_timeout + 2;
+	for (;;) {
+		if (man_mandoc_recv(h->fd, &len, sizeof(len), &deadline) != 1)
+			return -1;
+		if (len == 0)
+			break;
+		if (len > MAN_MANDOC_CHUNK || len > req->max_size - total)
+			return -1;
+		if (man_mandoc_recv(h->fd, chunk, len, &deadline) != 1)
+			return -1;
+		total += len;
+		/* Frames after a stop are read and dropped: the helper stays. */
+		if (!stopped) {
+			struct timespec since;
+
+			*delivered = 1;
+			clock_gettime(CLOCK_MONOTONIC, &since);
+			stopped = cb(chunk, len, ctx) != 0;
+			man_mandoc_extend(&deadline, &since);
+		}
+	}
+	if (man_mandoc_recv(h->fd, &status, sizeof(status), &deadline) != 1)
+		return -1;
+	return stopped || status != MAN_MANDOC_OK || total == 0 ? 1 : 0;
+}
+
+/**
+ * @brief Render @p path with `mandoc -T @p type` on a pooled helper,
+ * handing the output to @p cb as it arrives.
+ *
+ * @details @p cb gets at most 16 KB at a time; returning nonzero stops
+ * delivery. Time spent in @p cb does not count against the mandoc
+ * timeout. A helper that dies before any output is replaced and the
+ * request retried; once @p cb has seen output, it is not.
+ *
+ * @param path Absolute path of the page source.
+ * @param type mandoc output type (`html`, `pdf`, `ps`, `markdown`, `ascii`).
+ * @param max_size Largest output accepted.
+ * @param cb Output consumer.
+ * @param ctx Passed through to @p cb.
+ *
+ * @return int 0 at the end of the output, 1 when mandoc failed, timed out
+ * or @p cb stopped it, -1 when nothing was delivered and the caller should
+ * fork mandoc itself.
+ */
+int
+man_mandoc_stream(const char *path, const char *type, size_t max_size,
+    safe_popen_cb cb, void *ctx)
+{
+	struct man_mandoc_req req;
+	man_mandoc_helper_t *h;
+	int delivered = 0, ret = -1;
+
+	if (strlen(path) >= sizeof(req.path) || strlen(type) >= sizeof(req.type))
+		return -1;
+	if ((h = man_mandoc_acquire()) == NULL)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.max_size = max_size > UINT32_MAX ? UINT32_MAX : (uint32_t)max_size;
+	strlcpy(req.type, type, sizeof(req.type));
+	strlcpy(req.path, path, sizeof(req.path));
+
+	/* A dead helper is replaced once; a second failure means fork it here. */
+	for (int attempt = 0; attempt < 2 && ret == -1; attempt++) {
+		if (h->pid == -1 && man_mandoc_spawn(h) != 0)
+			break;
+		ret = man_mandoc_exchange(h, &req, cb, ctx, &delivered);
+		if (ret == -1) {
+			log_debug("[MAN] mandoc helper %d failed, respawning",
+			    (int)h->pid);
+			man_mandoc_reap(h);
+			/* Output already went out; a rerun would repeat it. */
+			if (delivered)
+				ret = 1;
+		}
+	}
+	man_mandoc_release(h);
+	return ret;
+}
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+} man_mandoc_buf_t;
+
+/** man_mandoc_stream() consumer for man_mandoc_render(): append. */
+static int
+man_mandoc_buf_append(const char *data, size_t len, void *ctx)
+{
+	man_mandoc_buf_t *b = ctx;
+	char *nbuf;
+
+	if (b->len + len + 1 > b->cap) {
+		size_t ncap = b->cap ? b->cap * 2 : 65536;
+
+		while (ncap < b->len + len + 1)
+			ncap *= 2;
+		if ((nbuf = realloc(b->buf, ncap)) == NULL)
+			return 1;
+		b->buf = nbuf;
+		b->cap = ncap;
+	}
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+	b->buf[b->len] = '\0';
+	return 0;
+}
+
+/**
+ * @brief Render @p path with `mandoc -T @p type` on a pooled helper.
+ *
+ * @param path Absolute path of the page source.
+ * @param type mandoc output type (`html`, `pdf`, `ps`, `markdown`, `ascii`).
+ * @param max_size Largest output kept; anything past it is dropped.
+ * @param out Heap-allocated, NUL-terminated output, or NULL on failure.
+ * @param out_len Output byte length.
+ *
+ * @return int 1 when the pool handled the request (even if mandoc failed),
+ * -1 when the caller should fork mandoc itself.
+ */
+int
+man_mandoc_render(const char *path, const char *type, size_t max_size,
+    char **out, size_t *out_len)
+{
+	man_mandoc_buf_t b = { NULL, 0, 0 };
+	int ret;
+
+	*out = NULL;
+	*out_len = 0;
+	ret = man_mandoc_stream(path, type, max_size, man_mandoc_buf_append,
+	    &b);
+	if (ret != 0) {
+		free(b.buf);
+		return ret == 1 ? 1 : -1;
+	}
+	*out = b.buf;
+	*out_len = b.len;
+	return 1;
+}
+
+/**
+ * @brief Number of helpers rendering right now.
+ *
+ * @return int Busy helpers; 0 when idle or when the pool is disabled.
+ */
+int
+man_mandoc_busy(void)
+{
+	int busy;
+
+	pthread_mutex_lock(&man_mandoc_lock);
+	busy = man_mandoc_nhelpers - man_mandoc_nfree;
+	pthread_mutex_unlock(&man_mandoc_lock);
+	return busy;
+}
+
+/**
+ * @brief Fork @p helpers mandoc helper processes.
+ *
+ * @param mandoc Path of the mandoc binary.
+ * @param timeout Seconds one rendering may take.
+ * @param helpers Pool size, clamped to 16; 0 leaves the pool disabled.
+ *
+ * @return int Number of helpers started, or -1 when none could be.
+ */
+int
+man_mandoc_start(const char *mandoc, int timeout, int helpers)
+{
+	int started = 0;
+
+	if (helpers > MAN_MANDOC_MAX_HELPERS)
+		helpers = MAN_MANDOC_MAX_HELPERS;
+	if (helpers <= 0)
+		return 0;
+
+	pthread_mutex_lock(&man_mandoc_lock);
+	if (man_mandoc_nhelpers > 0) {
+		pthread_mutex_unlock(&man_mandoc_lock);
+		return man_mandoc_nhelpers;
+	}
+	strlcpy(man_mandoc_path, mandoc, sizeof(man_mandoc_path));
+	man_mandoc_timeout = timeout > 0 ? timeout : 10;
+	for (int i = 0; i < helpers; i++) {
+		man_mandoc_helpers[i].pid = -1;
+		man_mandoc_helpers[i].fd = -1;
+		man_mandoc_helpers[i].busy = 0;
+		if (man_mandoc_spawn(&man_mandoc_helpers[i]) == 0)
+			started++;
+	}
+	/* Slots whose fork failed are retried on first use. */
+	if (started > 0) {
+		man_mandoc_nhelpers = helpers;
+		man_mandoc_nfree = helpers;
+		log_info("[MAN] %d mandoc helpers started", started);
+	}
+	pthread_mutex_unlock(&man_mandoc_lock);
+	return started > 0 ? started : -1;
+}
+
+/**
+ * @brief Stop every helper; later renders fork mandoc directly.
+ *
+ * @details Waits for in-flight requests to hand their helpers back.
+ */
+void
+man_mandoc_cleanup(void)
+{
+	pthread_mutex_lock(&man_mandoc_lock);
+	while (man_mandoc_nfree < man_mandoc_nhelpers)
+		pthread_cond_wait(&man_mandoc_cond, &man_mandoc_lock);
+	for (int i = 0; i < man_mandoc_nhelpers; i++)
+		man_mandoc_reap(&man_mandoc_helpers[i]);
+	man_mandoc_nhelpers = 0;
+	man_mandoc_nfree = 0;
+	pthread_cond_broadcast(&man_mandoc_cond);
+	pthread_mutex_unlock(&man_mandoc_lock);
+}
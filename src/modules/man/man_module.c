@@ -1,7 +1,10 @@
 #include <miniweb/modules/man.h>
 #include "man_internal.h"
+#include <miniweb/core/conf.h>
 #include <miniweb/router/router.h>
 
+extern miniweb_conf_t config;
+
 /**
  * @brief Release resources owned by the man module.
  *
@@ -13,7 +16,13 @@
 void
 man_module_cleanup(void)
 {
+    man_document_cleanup();
+    man_prerender_cleanup();
+    man_l2_cleanup();
+    man_mandoc_cleanup();
     man_render_cache_cleanup();
+    man_apropos_cleanup();
+    man_section_listing_cleanup();
 }
 
 /**
@@ -26,11 +35,25 @@ man_module_cleanup(void)
 int
 man_module_attach_routes(struct router *r)
 {
-    if (router_register_prefix(r, "GET", "/man/", 2, man_render_handler) != 0)
+    /* mandoc / apropos subprocesses: keep them off the fast lane. */
+    if (router_register_prefix_class(r, ROUTE_CLASS_SLOW, "GET", "/man/", 2,
+        man_render_handler) != 0)
         return -1;
-    if (router_register_prefix(r, "GET", "/api/man", 0, man_api_handler) != 0)
+    if (router_register_prefix_class(r, ROUTE_CLASS_SLOW, "GET", "/api/man", 0,
+        man_api_handler) != 0)
         return -1;
     if (router_register(r, "GET", "/api/man/sections", man_api_handler) != 0)
         return -1;
+    /* Searches are answered in-process once the index is built. */
+    (void)man_apropos_start();
+    /* Renders go to long-lived helpers instead of forking the server. */
+    (void)man_mandoc_start(config.mandoc_path, config.mandoc_timeout,
+        config.mandoc_helpers);
+    /* Popular pages are rendered again before their L2 copy expires. */
+    (void)man_prerender_start();
+    /* A page's other text formats render while mandoc is idle. */
+    (void)man_document_start();
+    /* Expired and least recently used L2 files are swept every minute. */
+    (void)man_l2_start((size_t)config.man_cache_mb * 1024 * 1024);
     return 0;
 }
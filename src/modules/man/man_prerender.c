@@ -0,0 +1,376 @@
+/* man_prerender.c - page popularity, L2 pre-rendering and warm restarts */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "man_internal.h"
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/net/handoff.h>
+
+extern char config_static_dir[];
+
+/*
+ * Every page variant served is counted in a small table; when it is full
+ * the least popular entry is replaced and the newcomer inherits its count
+ * plus one, so steady favourites are never pushed out by a burst of
+ * one-off pages. Counts are halved every MAN_POPULAR_DECAY_TICKS ticks.
+ *
+ * Each tick the most popular variants whose L2 file is about to expire
+ * are rendered again, a few at a time and only while no mandoc helper is
+ * busy serving a request. The table is then written to
+ * {static_dir}/man/.popularity; a restarted server reads it back, seeds
+ * the table and loads the still-fresh L2 files into L1 in that order.
+ * Before a handoff the table is written out as well, so the successor
+ * starts from the current ranking rather than one up to a tick old.
+ */
+
+#define MAN_POPULAR_MAX			256
+#define MAN_POPULAR_DECAY_TICKS		10
+#define MAN_PRERENDER_PERIOD_SEC	60
+#define MAN_PRERENDER_TOP		32	/* variants kept warm */
+#define MAN_PRERENDER_PER_TICK		8
+#define MAN_PRERENDER_MIN_SCORE		2
+#define MAN_REHYDRATE_MAX		128
+#define MAN_POPULAR_FILE		"man/.popularity"
+#define MAN_POPULAR_HEADER		"# miniweb man popularity v1\n"
+
+typedef struct {
+	char area[32];
+	char section[16];
+	char page[64];
+	char format[8];
+	uint32_t hash;
+	unsigned int score;
+} man_popular_t;
+
+static pthread_mutex_t man_popular_lock = PTHREAD_MUTEX_INITIALIZER;
+static man_popular_t man_popular[MAN_POPULAR_MAX];
+static pthread_mutex_t man_popular_save_lock = PTHREAD_MUTEX_INITIALIZER;
+static int man_popular_count;
+
+static unsigned int man_prerender_ticks;	/* heartbeat thread only */
+static int man_prerender_loaded;
+
+/** FNV-1a over the four key parts. */
+static uint32_t
+man_popular_hash(const char *area, const char *section, const char *page,
+    const char *format)
+{
+	const char *parts[4] = {area, section, page, format};
+	uint32_t h = 2166136261u;
+
+	for (int i = 0; i < 4; i++) {
+		for (const unsigned char *p = (const unsigned char *)parts[i];
+		    *p; p++) {
+			h ^= *p;
+			h *= 16777619u;
+		}
+		h ^= '/';
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/** Add @p score to a variant. Called with man_popular_lock held. */
+static void
+man_popular_add(const char *area, const char *section, const char *page,
+    const char *format, unsigned int score)
+{
+	uint32_t h = man_popular_hash(area, section, page, format);
+	man_popular_t *e = NULL;
+	int i;
+
+	for (i = 0; i < man_popular_count; i++) {
+		e = &man_popular[i];
+		if (e->hash == h && strcmp(e->page, page) == 0 &&
+		    strcmp(e->section, section) == 0 &&
+		    strcmp(e->format, format) == 0 &&
+		    strcmp(e->area, area) == 0) {
+			e->score = e->score > UINT32_MAX - score ?
+			    UINT32_MAX : e->score + score;
+			return;
+		}
+	}
+
+	if (man_popular_count < MAN_POPULAR_MAX) {
+		e = &man_popular[man_popular_count++];
+		e->score = score;
+	} else {
+		e = &man_popular[0];
+		for (i = 1; i < MAN_POPULAR_MAX; i++)
+			if (man_popular[i].score < e->score)
+				e = &man_popular[i];
+		e->score += score;
+	}
+	strlcpy(e->area, area, sizeof(e->area));
+	strlcpy(e->section, section, sizeof(e->section));
+	strlcpy(e->page, page, sizeof(e->page));
+	strlcpy(e->format, format, sizeof(e->format));
+	e->hash = h;
+}
+
+/**
+ * @brief Count one response for a page variant.
+ *
+ * @param area Logical area.
+ * @param section Manual section the page was found in.
+ * @param page Manual page name.
+ * @param format Output format.
+ */
+void
+man_popularity_note(const char *area, const char *section, const char *page,
+    const char *format)
+{
+	pthread_mutex_lock(&man_popular_lock);
+	man_popular_add(area, section, page, format, 1);
+	pthread_mutex_unlock(&man_popular_lock);
+}
+
+/** qsort(3) order: most popular first. */
+static int
+man_popular_cmp(const void *a, const void *b)
+{
+	const man_popular_t *x = a, *y = b;
+
+	if (x->score != y->score)
+		return x->score > y->score ? -1 : 1;
+	return 0;
+}
+
+/** Copy the table into @p out, most popular first; returns the count. */
+static int
+man_popular_snapshot(man_popular_t *out)
+{
+	int n;
+
+	pthread_mutex_lock(&man_popular_lock);
+	n = man_popular_count;
+	memcpy(out, man_popular, (size_t)n * sizeof(*out));
+	pthread_mutex_unlock(&man_popular_lock);
+	qsort(out, (size_t)n, sizeof(*out), man_popular_cmp);
+	return n;
+}
+
+/** Forget a variant that no longer renders. */
+static void
+man_popular_drop(const man_popular_t *v)
+{
+	pthread_mutex_lock(&man_popular_lock);
+	for (int i = 0; i < man_popular_count; i++) {
+		man_popular_t *e = &man_popular[i];
+
+		if (e->hash == v->hash && strcmp(e->page, v->page) == 0 &&
+		    strcmp(e->section, v->section) == 0 &&
+		    strcmp(e->format, v->format) == 0 &&
+		    strcmp(e->area, v->area) == 0) {
+			*e = man_popular[--man_popular_count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&man_popular_lock);
+}
+
+/** Halve every count and drop the variants that reach zero. */
+static void
+man_popular_decay(void)
+{
+	int i = 0;
+
+	pthread_mutex_lock(&man_popular_lock);
+	while (i < man_popular_count) {
+		man_popular[i].score /= 2;
+		if (man_popular[i].score == 0)
+			man_popular[i] = man_popular[--man_popular_count];
+		else
+			i++;
+	}
+	pthread_mutex_unlock(&man_popular_lock);
+}
+
+/** Output formats a variant may name, as man_render_handler() accepts. */
+static int
+man_popular_valid_format(const char *format)
+{
+	return strcmp(format, "html") == 0 || strcmp(format, "pdf") == 0 ||
+	    strcmp(format, "ps") == 0 || strcmp(format, "md") == 0 ||
+	    strcmp(format, "txt") == 0;
+}
+
+/** Write the table to the popularity file, replacing it atomically. */
+static void
+man_popular_save(void)
+{
+	man_popular_t *v;
+	char path[512], tmp[520];
+	FILE *f;
+	int n;
+
+	if (snprintf(path, sizeof(path), "%s/%s", config_static_dir,
+	    MAN_POPULAR_FILE) >= (int)sizeof(path))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((v = malloc(sizeof(man_popular))) == NULL)
+		return;
+	n = man_popular_snapshot(v);
+	pthread_mutex_lock(&man_popular_save_lock);	/* one writer of tmp */
+	if ((f = fopen(tmp, "w")) == NULL) {
+		pthread_mutex_unlock(&man_popular_save_lock);
+		free(v);
+		return;
+	}
+	fputs(MAN_POPULAR_HEADER, f);
+	for (int i = 0; i < n; i++)
+		fprintf(f, "%u %s %s %s %s\n", v[i].score, v[i].area,
+		    v[i].section, v[i].page, v[i].format);
+	free(v);
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		log_debug("[MAN] Could not write %s", path);
+		(void)unlink(tmp);
+	}
+	pthread_mutex_unlock(&man_popular_save_lock);
+}
+
+/**
+ * Seed the table from the popularity file a previous run left, then load
+ * the fresh L2 files of the most popular variants into L1.
+ */
+static void
+man_popular_load(void)
+{
+	char path[512], line[256];
+	char area[32], section[16], page[64], format[8];
+	man_popular_t *v;
+	unsigned int score;
+	int n, loaded = 0;
+	FILE *f;
+
+	if (snprintf(path, sizeof(path), "%s/%s", config_static_dir,
+	    MAN_POPULAR_FILE) >= (int)sizeof(path))
+		return;
+	if ((f = fopen(path, "r")) == NULL)
+		return;
+	pthread_mutex_lock(&man_popular_lock);
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%u %31s %15s %63s %7s", &score, area,
+		    section, page, format) != 5 || score == 0)
+			continue;
+		if (!man_is_valid_token(area) || !man_is_valid_token(page) ||
+		    !man_is_valid_section(section) ||
+		    !man_popular_valid_format(format))
+			continue;
+		man_popular_add(area, section, page, format, score);
+	}
+	pthread_mutex_unlock(&man_popular_lock);
+	fclose(f);
+
+	if ((v = malloc(sizeof(man_popular))) == NULL)
+		return;
+	n = man_popular_snapshot(v);
+	for (int i = 0; i < n && loaded < MAN_REHYDRATE_MAX; i++)
+		loaded += man_render_rehydrate(v[i].area, v[i].section,
+		    v[i].page, v[i].format);
+	free(v);
+	if (n > 0)
+		log_info("[MAN] Popularity log: %d pages, %d loaded from L2",
+		    n, loaded);
+}
+
+/** Heartbeat: keep the most popular variants rendered, then save. */
+static void
+man_prerender_heartbeat(void *ctx)
+{
+	man_popular_t *v;
+	int n, rendered = 0;
+
+	(void)ctx;
+	if (!__atomic_load_n(&man_prerender_loaded, __ATOMIC_ACQUIRE)) {
+		man_popular_load();
+		__atomic_store_n(&man_prerender_loaded, 1, __ATOMIC_RELEASE);
+	}
+
+	if ((v = malloc(sizeof(man_popular))) == NULL)
+		return;
+	n = man_popular_snapshot(v);
+	if (n > MAN_PRERENDER_TOP)
+		n = MAN_PRERENDER_TOP;
+	for (int i = 0; i < n && rendered < MAN_PRERENDER_PER_TICK; i++) {
+		int r;
+
+		if (v[i].score < MAN_PRERENDER_MIN_SCORE)
+			break;
+		/* Requests are waiting on mandoc: not idle, try next tick. */
+		if (man_mandoc_busy() > 0)
+			break;
+		/* Refresh before the file expires, not after. */
+		r = man_render_prerender(v[i].area, v[i].section, v[i].page,
+		    v[i].format, MAN_FS_CACHE_TTL_SEC - MAN_PRERENDER_PERIOD_SEC);
+		if (r > 0)
+			rendered++;
+		else if (r < 0)
+			man_popular_drop(&v[i]);
+	}
+	free(v);
+	if (rendered > 0)
+		log_debug("[MAN] Pre-rendered %d popular pages", rendered);
+
+	if (++man_prerender_ticks % MAN_POPULAR_DECAY_TICKS == 0)
+		man_popular_decay();
+	man_popular_save();
+}
+
+/**
+ * handoff save(): the successor finds the L2 files on disk and their
+ * ranking in the popularity log, so only the log needs to be current.
+ */
+static void
+man_prerender_handoff(FILE *f, void *ctx)
+{
+	(void)f;
+	(void)ctx;
+	if (__atomic_load_n(&man_prerender_loaded, __ATOMIC_ACQUIRE))
+		man_popular_save();
+}
+
+/**
+ * @brief Register the pre-render task; its first run restores the
+ * popularity log and warms L1 from L2.
+ *
+ * @return int 0 on success, -1 when the task could not be registered.
+ */
+int
+man_prerender_start(void)
+{
+	if (handoff_state_register(&(struct handoff_state_ops){
+		.name = "man",
+		.save = man_prerender_handoff,
+		.load = NULL,
+		.ctx = NULL,
+	    }) < 0)
+		log_info("[MAN] Popularity log not flushed on handoff");
+	if (heartbeat_register(&(struct hb_task){
+		.name = "man.prerender",
+		.period_sec = MAN_PRERENDER_PERIOD_SEC,
+		.initial_delay_sec = 1,
+		.cb = man_prerender_heartbeat,
+		.ctx = NULL,
+	    }) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/** Stop pre-rendering and keep the popularity log for the next start. */
+void
+man_prerender_cleanup(void)
+{
+	(void)heartbeat_unregister("man.prerender");
+	/* Before the first run the table holds nothing worth keeping. */
+	if (__atomic_load_n(&man_prerender_loaded, __ATOMIC_ACQUIRE))
+		man_popular_save();
+}
@@ -62,9 +62,10 @@ url_decode_into(const char *src, char *dst, size_t dst_size)
 }
 
 /**
- * @brief Extract and decode a query parameter from a URL.
+ * @brief Extract and decode a query parameter from a query string.
  *
- * @param url Full URL containing an optional query string.
+ * @param qs Query string without the '?', as from http_request_query();
+ *        may be NULL.
  * @param key Parameter name to find.
  * @param out Output buffer receiving decoded parameter value.
  * @param out_size Capacity of @p out in bytes.
@@ -72,17 +73,12 @@ url_decode_into(const char *src, char *dst, size_t dst_size)
  * @return int Returns 1 when the key is present and decoded, otherwise 0.
  */
 int
-man_get_query_value(const char *url, const char *key, char *out, size_t out_size)
+man_get_query_value(const char *qs, const char *key, char *out, size_t out_size)
 {
-    const char *qs;
     size_t key_len;
 
-    if (!url || !key || !out || out_size == 0)
+    if (!qs || !key || !out || out_size == 0)
         return 0;
-    qs = strchr(url, '?');
-    if (!qs)
-        return 0;
-    qs++;
     key_len = strlen(key);
 
     while (*qs) {
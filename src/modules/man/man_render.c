@@ -1,7 +1,8 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,9 +12,13 @@
 #include <unistd.h>
 
 #include "man_internal.h"
+#include <miniweb/core/cache_admin.h>
 #include <miniweb/core/conf.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/singleflight.h>
+#include <miniweb/http/gzip.h>
 #include <miniweb/http/utils.h>
 #include <miniweb/modules/man.h>
 
@@ -23,43 +28,182 @@ extern char config_static_dir[];
 #define MAN_RENDER_CACHE_SHARDS 8
 #define MAN_RENDER_CACHE_SLOTS 64
 #define MAN_RENDER_CACHE_TTL 600
+#define MAN_RENDER_CACHE_STALE 300 /* served past the TTL while refreshed */
+#define MAN_RENDER_CACHE_AHEAD 60  /* hot entries refreshed this early */
+#define MAN_RENDER_CACHE_HOT 2     /* hits that make an entry hot */
+#define MAN_STREAM_L1_MAX (1024 * 1024) /* larger streamed pages skip L1 */
 
 typedef struct {
 	char key[192];
 	char *body;
 	size_t len;
 	time_t inserted;
+	unsigned int hits;	/* since inserted */
+	int refreshing;		/* queued with man_document_refresh() */
 } man_render_slot_t;
 
 typedef struct {
 	man_render_slot_t slots[MAN_RENDER_CACHE_SLOTS];
 	pthread_mutex_t lock;
+	unsigned long hits;
+	unsigned long misses;
 } man_render_shard_t;
 
 static man_render_shard_t g_man_cache[MAN_RENDER_CACHE_SHARDS];
 static pthread_once_t g_man_cache_once = PTHREAD_ONCE_INIT;
 static int g_man_cache_initialized = 0;
 
-static sem_t g_mandoc_semaphore;
-static pthread_once_t g_mandoc_sem_once = PTHREAD_ONCE_INIT;
-static int g_mandoc_sem_initialized = 0;
+/*
+ * Render sent to the client as mandoc produces it, in chunks, while the
+ * output is copied to a temporary L2 file and, up to MAN_STREAM_L1_MAX,
+ * to an L1 buffer.
+ */
+typedef struct {
+	http_request_t *req;
+	const char *format;
+	const char *page;
+	http_stream_t s;
+	int ran;		/* a helper took the render */
+	int begun;		/* head sent: the response is committed */
+	size_t total;
+	int l2_fd;		/* temporary L2 file, or -1 */
+	char l2_tmp[528];
+	char *buf;		/* L1 copy; NULL once given up */
+	size_t len;
+	size_t cap;
+	int over;		/* past MAN_STREAM_L1_MAX */
+} man_render_stream_t;
+
+/* Page being rendered for one L1 key, shared by concurrent misses. */
+typedef struct {
+	const char *area;
+	const char *section;
+	const char *page;
+	const char *format;
+	const char *cache_abs;	/* L2 file to write, or NULL */
+	man_render_stream_t *stream;	/* leader streams to its client */
+} man_render_job_t;
+
+static singleflight_group_t g_man_render_flights =
+    SINGLEFLIGHT_GROUP_INITIALIZER;
+
+/** mem_budget usage(): rendered bytes held and hits, all shards. */
+static size_t
+man_render_mem_usage(uint64_t *hits, void *ctx)
+{
+	size_t bytes = 0;
+
+	(void)ctx;
+	for (int si = 0; si < MAN_RENDER_CACHE_SHARDS; si++) {
+		man_render_shard_t *shard = &g_man_cache[si];
+
+		pthread_mutex_lock(&shard->lock);
+		for (int i = 0; i < MAN_RENDER_CACHE_SLOTS; i++) {
+			if (shard->slots[i].body)
+				bytes += shard->slots[i].len;
+		}
+		*hits += shard->hits;
+		pthread_mutex_unlock(&shard->lock);
+	}
+	return bytes;
+}
 
 /**
- * @brief Initialize mandoc concurrency semaphore.
- *
- * @details Sets the semaphore limit relative to configured worker threads and
- * caps it to avoid excessive parallel mandoc executions.
- *
- * @return void.
+ * mem_budget shrink(): drop the oldest entry of each shard in turn until
+ * @p bytes are freed. Pages dropped here are still in L2.
  */
+static size_t
+man_render_mem_shrink(size_t bytes, void *ctx)
+{
+	size_t freed = 0;
+	int idle = 0;
+
+	(void)ctx;
+	for (int si = 0; freed < bytes && idle < MAN_RENDER_CACHE_SHARDS;
+	    si = (si + 1) % MAN_RENDER_CACHE_SHARDS) {
+		man_render_shard_t *shard = &g_man_cache[si];
+		man_render_slot_t *victim = NULL;
+		char *body = NULL;
+
+		pthread_mutex_lock(&shard->lock);
+		for (int i = 0; i < MAN_RENDER_CACHE_SLOTS; i++) {
+			man_render_slot_t *s = &shard->slots[i];
+
+			if (s->body &&
+			    (!victim || s->inserted < victim->inserted))
+				victim = s;
+		}
+		if (victim) {
+			body = victim->body;
+			freed += victim->len;
+			victim->body = NULL;
+			victim->len = 0;
+			victim->key[0] = '\0';
+		}
+		pthread_mutex_unlock(&shard->lock);
+		idle = victim ? 0 : idle + 1;
+		free(body);
+	}
+	return freed;
+}
+
+/** cache_admin stats(): rendered pages held, all shards. */
 static void
-mandoc_semaphore_init(void)
+man_render_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	(void)ctx;
+	for (int si = 0; si < MAN_RENDER_CACHE_SHARDS; si++) {
+		man_render_shard_t *shard = &g_man_cache[si];
+
+		pthread_mutex_lock(&shard->lock);
+		for (int i = 0; i < MAN_RENDER_CACHE_SLOTS; i++) {
+			if (shard->slots[i].body) {
+				st->bytes += shard->slots[i].len;
+				st->entries++;
+			}
+		}
+		st->hits += shard->hits;
+		st->misses += shard->misses;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+static int man_render_cache_shard(const char *key);
+
+/**
+ * cache_admin purge(): keys are "area/section/page.format". The L2 copy
+ * stays unless purged too, and refills L1 on the next request.
+ */
+static size_t
+man_render_admin_purge(const char *key, int prefix, void *ctx)
 {
-	int max_concurrent = config.threads * 2;
-	if (max_concurrent > 16)
-		max_concurrent = 16;
-	if (sem_init(&g_mandoc_semaphore, 0, max_concurrent) == 0)
-		g_mandoc_sem_initialized = 1;
+	size_t purged = 0;
+	int si = prefix ? 0 : man_render_cache_shard(key);
+	int end = prefix ? MAN_RENDER_CACHE_SHARDS : si + 1;
+
+	(void)ctx;
+	for (; si < end; si++) {
+		man_render_shard_t *shard = &g_man_cache[si];
+		char *bodies[MAN_RENDER_CACHE_SLOTS];
+		int n = 0;
+
+		pthread_mutex_lock(&shard->lock);
+		for (int i = 0; i < MAN_RENDER_CACHE_SLOTS; i++) {
+			man_render_slot_t *s = &shard->slots[i];
+
+			if (!s->body || !cache_admin_match(s->key, key, prefix))
+				continue;
+			bodies[n++] = s->body;
+			s->body = NULL;
+			s->len = 0;
+			s->key[0] = '\0';
+		}
+		pthread_mutex_unlock(&shard->lock);
+		for (int i = 0; i < n; i++)
+			free(bodies[i]);
+		purged += (size_t)n;
+	}
+	return purged;
 }
 
 /**
@@ -73,6 +217,16 @@ man_render_cache_init(void)
 	for (int i = 0; i < MAN_RENDER_CACHE_SHARDS; i++)
 		pthread_mutex_init(&g_man_cache[i].lock, NULL);
 	g_man_cache_initialized = 1;
+	(void)mem_budget_register(&(struct mem_cache_ops){
+		.name = "man_render",
+		.usage = man_render_mem_usage,
+		.shrink = man_render_mem_shrink,
+	});
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "man_l1",
+		.stats = man_render_admin_stats,
+		.purge = man_render_admin_purge,
+	});
 }
 
 /**
@@ -118,14 +272,24 @@ man_render_cache_shard(const char *key)
  * @param area Logical area.
  * @param section Manual section.
  * @param page Manual page name.
+ * @details With @p stale_ok an entry up to MAN_RENDER_CACHE_STALE
+ * seconds past its TTL is returned as well, and queued for one refresh;
+ * so is an entry hit MAN_RENDER_CACHE_HOT times in the last
+ * MAN_RENDER_CACHE_AHEAD seconds of its TTL. Entries past both are
+ * freed.
+ *
+ * @param area Logical area.
+ * @param section Manual section.
+ * @param page Manual page name.
  * @param format Response format.
  * @param out_len Output byte length on cache hit.
+ * @param stale_ok Whether an expired entry may still be returned.
  *
  * @return char* Heap-allocated copy of cached body, or NULL on miss/expiry.
  */
 static char *
 man_render_cache_get(const char *area, const char *section, const char *page,
-		     const char *format, size_t *out_len)
+		     const char *format, size_t *out_len, int stale_ok)
 {
 	char key[192];
 	man_render_cache_key(area, section, page, format, key, sizeof(key));
@@ -140,22 +304,34 @@ man_render_cache_get(const char *area, const char *section, const char *page,
 		man_render_slot_t *s = &shard->slots[i];
 		if (!s->body || strcmp(s->key, key) != 0)
 			continue;
-		if ((now - s->inserted) > MAN_RENDER_CACHE_TTL) {
+		time_t age = now - s->inserted;
+		if (age > MAN_RENDER_CACHE_TTL + MAN_RENDER_CACHE_STALE) {
 			free(s->body);
 			s->body = NULL;
 			s->len = 0;
 			break;
 		}
+		if (age > MAN_RENDER_CACHE_TTL && !stale_ok)
+			break;
+		if (s->hits < UINT_MAX)
+			s->hits++;
+		if (!s->refreshing && (age > MAN_RENDER_CACHE_TTL ||
+		    (age > MAN_RENDER_CACHE_TTL - MAN_RENDER_CACHE_AHEAD &&
+		    s->hits >= MAN_RENDER_CACHE_HOT)) &&
+		    man_document_refresh(area, section, page, format) == 0)
+			s->refreshing = 1;
 		char *copy = malloc(s->len + 1);
 		if (copy) {
 			memcpy(copy, s->body, s->len);
 			copy[s->len] = '\0';
 			*out_len = s->len;
+			shard->hits++;
 			pthread_mutex_unlock(&shard->lock);
 			return copy;
 		}
 		break;
 	}
+	shard->misses++;
 	pthread_mutex_unlock(&shard->lock);
 	return NULL;
 }
@@ -203,6 +379,8 @@ man_render_cache_put(const char *area, const char *section, const char *page,
 				s->len = len;
 				s->inserted = now;
 			}
+			s->hits = 0;
+			s->refreshing = 0;
 			pthread_mutex_unlock(&shard->lock);
 			return;
 		}
@@ -228,6 +406,8 @@ man_render_cache_put(const char *area, const char *section, const char *page,
 			s->len = len;
 			s->inserted = now;
 		}
+		s->hits = 0;
+		s->refreshing = 0;
 	}
 
 	pthread_mutex_unlock(&shard->lock);
@@ -335,6 +515,21 @@ mkdir_p(const char *dir, const char *base_dir)
 	return 0;
 }
 
+/** Write all @p len bytes of @p buf to @p fd; 0 or -1. */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		ssize_t w = write(fd, buf + off, len - off);
+		if (w <= 0)
+			return -1;
+		off += (size_t)w;
+	}
+	return 0;
+}
+
 /**
  * @brief Persist binary response content to disk.
  *
@@ -352,17 +547,50 @@ write_file_binary(const char *path, const char *buf, size_t len)
 	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
 	if (fd < 0)
 		return -1;
-	size_t off = 0;
-	while (off < len) {
-		ssize_t w = write(fd, buf + off, len - off);
-		if (w <= 0) {
-			close(fd);
-			return -1;
-		}
-		off += (size_t)w;
+	int rc = write_all(fd, buf, len);
+	close(fd);
+	return rc;
+}
+
+/**
+ * @brief Read an L2 cache file that is still within its TTL.
+ *
+ * @param cache_abs Filesystem path of the cached variant.
+ * @param out_len Body length when the file is usable.
+ *
+ * @return char* Heap-allocated file contents, or NULL when missing,
+ * expired or unreadable.
+ */
+static char *
+man_render_l2_load(const char *cache_abs, size_t *out_len)
+{
+	struct stat st;
+	char *body;
+	ssize_t nr;
+	int fd;
+
+	fd = open(cache_abs, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+	    time(NULL) - st.st_mtime > MAN_FS_CACHE_TTL_SEC) {
+		close(fd);
+		return NULL;
+	}
+	body = malloc((size_t)st.st_size + 1);
+	if (!body) {
+		close(fd);
+		return NULL;
 	}
+	nr = read(fd, body, (size_t)st.st_size);
 	close(fd);
-	return 0;
+	if (nr != (ssize_t)st.st_size) {
+		free(body);
+		return NULL;
+	}
+	body[nr] = '\0';
+	*out_len = (size_t)nr;
+	return body;
 }
 
 /**
@@ -415,74 +643,120 @@ man_add_content_disposition_for_format(http_response_t *resp,
 	}
 }
 
+/** Fill @p argv (8 slots) with the mandoc command line for @p t_arg. */
+static void
+man_mandoc_argv(char *argv[], const char *t_arg, const char *filepath)
+{
+	int argc = 0;
+
+	argv[argc++] = "mandoc";
+	argv[argc++] = "-T";
+	argv[argc++] = (char *)t_arg;
+	if (strcmp(t_arg, "html") == 0)
+		argv[argc++] = "-Ostyle=/static/css/custom.css";
+	argv[argc++] = (char *)filepath;
+	argv[argc] = NULL;
+}
+
 /**
- * @brief Render a manual page to a requested output format.
+ * @brief Run `mandoc -T @p t_arg` on @p filepath.
  *
- * @param area Logical area (currently unused by renderer).
- * @param section Manual section token.
- * @param page Manual page name.
- * @param format Output format (`html`, `pdf`, `ps`, `md`, `txt`).
+ * @details Hands the job to a pooled helper process when the pool is up;
+ * otherwise forks mandoc here, within the subprocess governor's mandoc
+ * budget.
+ *
+ * @param filepath Absolute path of the page source.
+ * @param t_arg mandoc output type.
  * @param out_len Output byte length when rendering succeeds.
  *
- * @return char* Heap-allocated rendered body, or NULL on failure.
+ * @return char* Heap-allocated mandoc output, or NULL on failure.
  */
-char *
-man_render_page(const char *area, const char *section, const char *page,
-		const char *format, size_t *out_len)
+static char *
+man_render_mandoc(const char *filepath, const char *t_arg, size_t *out_len)
 {
-	(void)area;
-	pthread_once(&g_mandoc_sem_once, mandoc_semaphore_init);
+	char *output;
+
+	if (man_mandoc_render(filepath, t_arg, MAN_MAX_OUTPUT_SIZE, &output,
+	    out_len) == 1)
+		return output;
 
+	char *argv_m[8];
+	man_mandoc_argv(argv_m, t_arg, filepath);
+
+	output = safe_popen_read_argv(config.mandoc_path, argv_m,
+				      MAN_MAX_OUTPUT_SIZE,
+				      config.mandoc_timeout, out_len);
+	return output;
+}
+
+/**
+ * @brief Resolve the source of a page and the mandoc type for @p format.
+ *
+ * @param section Manual section token.
+ * @param page Manual page name.
+ * @param format Output format.
+ * @param t_arg Set to the mandoc output type.
+ *
+ * @return char* Heap-allocated absolute path, or NULL when not found.
+ */
+static char *
+man_render_source(const char *section, const char *page, const char *format,
+		  const char **t_arg)
+{
 	char *filepath = NULL;
 	if (man_is_valid_section(section))
-		filepath = man_resolve_path(page, section);
+		filepath = man_document_path(section, page);
 
 	if (!filepath || filepath[0] != '/') {
 		free(filepath);
 		return NULL;
 	}
 
-	const char *t_arg = "html";
+	*t_arg = "html";
 	if (strcmp(format, "pdf") == 0)
-		t_arg = "pdf";
+		*t_arg = "pdf";
 	else if (strcmp(format, "ps") == 0)
-		t_arg = "ps";
+		*t_arg = "ps";
 	else if (strcmp(format, "md") == 0)
-		t_arg = "markdown";
+		*t_arg = "markdown";
 	else if (strcmp(format, "txt") == 0)
-		t_arg = "ascii";
+		*t_arg = "ascii";
+	return filepath;
+}
 
-	if (sem_wait(&g_mandoc_semaphore) != 0) {
-		log_error("[MAN] Failed to acquire mandoc semaphore");
-		free(filepath);
+/**
+ * @brief Render a manual page to a requested output format.
+ *
+ * @details Markdown that mandoc cannot produce falls back to the text
+ * variant, taken from L1 when a sibling render left it there.
+ *
+ * @param area Logical area.
+ * @param section Manual section token.
+ * @param page Manual page name.
+ * @param format Output format (`html`, `pdf`, `ps`, `md`, `txt`).
+ * @param out_len Output byte length when rendering succeeds.
+ *
+ * @return char* Heap-allocated rendered body, or NULL on failure.
+ */
+char *
+man_render_page(const char *area, const char *section, const char *page,
+		const char *format, size_t *out_len)
+{
+	const char *t_arg;
+	char *filepath = man_render_source(section, page, format, &t_arg);
+	if (!filepath)
 		return NULL;
-	}
 
-	char *argv_m[10];
-	int argc = 0;
-	argv_m[argc++] = "mandoc";
-	argv_m[argc++] = "-T";
-	argv_m[argc++] = (char *)t_arg;
-	if (strcmp(t_arg, "html") == 0)
-		argv_m[argc++] = "-Ostyle=/static/css/custom.css";
-	argv_m[argc++] = filepath;
-	argv_m[argc++] = NULL;
-
-	char *output = safe_popen_read_argv("/usr/bin/mandoc", argv_m,
-					    MAN_MAX_OUTPUT_SIZE, 10, out_len);
-	sem_post(&g_mandoc_semaphore);
+	char *output = man_render_mandoc(filepath, t_arg, out_len);
 
 	if (output && *out_len > 0 && strcmp(format, "txt") == 0)
 		man_strip_overstrike_ascii(output, out_len);
 
 	if (!output && strcmp(format, "md") == 0) {
-		if (sem_wait(&g_mandoc_semaphore) == 0) {
-			char *const argv_ascii[] = {"mandoc", "-T", "ascii",
-						    filepath, NULL};
-			output = safe_popen_read_argv(
-			    "/usr/bin/mandoc", argv_ascii, MAN_MAX_OUTPUT_SIZE,
-			    10, out_len);
-			sem_post(&g_mandoc_semaphore);
+		output = man_render_cache_get(area, section, page, "txt",
+					      out_len, 0);
+		if (!output) {
+			output = man_render_mandoc(filepath, "ascii", out_len);
 			if (output && *out_len > 0)
 				man_strip_overstrike_ascii(output, out_len);
 		}
@@ -492,6 +766,341 @@ man_render_page(const char *area, const char *section, const char *page,
 	return output;
 }
 
+/**
+ * @brief Create the response shell shared by every rendered page variant.
+ *
+ * @param format Output format.
+ * @param page Manual page name, for download file names.
+ *
+ * @return http_response_t* New response without a body, or NULL.
+ */
+static http_response_t *
+man_render_response_create(const char *format, const char *page)
+{
+	http_response_t *resp = http_response_create();
+	if (!resp)
+		return NULL;
+
+	resp->content_type = man_mime_for_format(format);
+	http_response_add_header(resp, "Cache-Control", "public, max-age=300");
+	man_add_content_disposition_for_format(resp, format, page);
+	http_response_add_header(resp, "Accept-Ranges", "bytes");
+	return resp;
+}
+
+/**
+ * @brief Whether @p format is streamed while it renders.
+ *
+ * @details PDF and PostScript are the large variants, sent untouched and
+ * never gzipped; text and markdown are rewritten after rendering.
+ */
+static int
+man_render_streamable(const char *format)
+{
+	return strcmp(format, "pdf") == 0 || strcmp(format, "ps") == 0;
+}
+
+/** Give up the L2 copy of @p ms, removing the partial file. */
+static void
+man_render_stream_drop_l2(man_render_stream_t *ms)
+{
+	if (ms->l2_fd == -1)
+		return;
+	close(ms->l2_fd);
+	unlink(ms->l2_tmp);
+	ms->l2_fd = -1;
+}
+
+/**
+ * @brief man_mandoc_stream() consumer: send a chunk and copy it to the
+ * caches.
+ *
+ * @details The head goes out with the first chunk, so a render that
+ * fails before any output still gets an error page. A client that goes
+ * away does not stop the render while a cache still takes the output.
+ *
+ * @return int Nonzero to stop: output past MAN_MAX_OUTPUT_SIZE, or no one
+ * left to take it.
+ */
+static int
+man_render_stream_chunk(const char *data, size_t len, void *ctx)
+{
+	man_render_stream_t *ms = ctx;
+
+	if (len > MAN_MAX_OUTPUT_SIZE - ms->total)
+		return 1;
+	if (!ms->begun) {
+		http_response_t *resp =
+		    man_render_response_create(ms->format, ms->page);
+		if (!resp)
+			return 1;
+		ms->begun = 1;
+		(void)http_stream_begin(&ms->s, ms->req, resp);
+		http_response_free(resp);
+	}
+	ms->total += len;
+	(void)http_stream_write(&ms->s, data, len);
+
+	if (ms->l2_fd != -1 && write_all(ms->l2_fd, data, len) != 0)
+		man_render_stream_drop_l2(ms);
+	if (!ms->over && ms->len + len > MAN_STREAM_L1_MAX) {
+		free(ms->buf);
+		ms->buf = NULL;
+		ms->over = 1;
+	}
+	if (!ms->over) {
+		if (ms->len + len + 1 > ms->cap) {
+			size_t ncap = ms->cap ? ms->cap * 2 : 65536;
+			char *nbuf;
+
+			while (ncap < ms->len + len + 1)
+				ncap *= 2;
+			if ((nbuf = realloc(ms->buf, ncap)) == NULL) {
+				free(ms->buf);
+				ms->buf = NULL;
+				ms->over = 1;
+				goto out;
+			}
+			ms->buf = nbuf;
+			ms->cap = ncap;
+		}
+		memcpy(ms->buf + ms->len, data, len);
+		ms->len += len;
+		ms->buf[ms->len] = '\0';
+	}
+out:
+	return ms->s.failed && ms->l2_fd == -1 && ms->over;
+}
+
+/**
+ * @brief Stream a render to the leader's client and fill the caches.
+ *
+ * @details Needs the mandoc helper pool, whose timeout leaves out the
+ * time spent waiting on the client; without it the page is rendered into
+ * memory as usual and sent by the caller. The L2 file is written under a
+ * temporary name and renamed once the output is complete.
+ *
+ * @param job Page, with the stream of the request running it.
+ * @param len Length of the returned L1 copy.
+ *
+ * @return char* The L1 copy, or NULL when the render failed, was too
+ * large for L1 or found no helper; job->stream->ran and begun tell which
+ * and whether the client got it.
+ */
+static char *
+man_render_stream_fill(const man_render_job_t *job, size_t *len)
+{
+	man_render_stream_t *ms = job->stream;
+	const char *t_arg;
+	char *filepath, *body = NULL;
+	int rc;
+
+	filepath = man_render_source(job->section, job->page, job->format,
+				     &t_arg);
+	if (!filepath)
+		return NULL;
+
+	if (job->cache_abs) {
+		char cache_dir[512];
+		strlcpy(cache_dir, job->cache_abs, sizeof(cache_dir));
+		char *last_slash = strrchr(cache_dir, '/');
+		if (last_slash) {
+			*last_slash = '\0';
+			snprintf(ms->l2_tmp, sizeof(ms->l2_tmp), "%s.tmp.XXXXXX",
+				 job->cache_abs);
+			if (mkdir_p(cache_dir, config_static_dir) == 0)
+				ms->l2_fd = mkstemp(ms->l2_tmp);
+		}
+	}
+
+	rc = man_mandoc_stream(filepath, t_arg, MAN_MAX_OUTPUT_SIZE,
+			       man_render_stream_chunk, ms);
+	free(filepath);
+	if (rc == -1) {
+		man_render_stream_drop_l2(ms);
+		return NULL;
+	}
+	ms->ran = 1;
+
+	if (rc != 0 || ms->total == 0) {
+		/* The client sees the body cut off, never a short page. */
+		man_render_stream_drop_l2(ms);
+		ms->s.failed = 1;
+		free(ms->buf);
+		ms->buf = NULL;
+		return NULL;
+	}
+	if (ms->l2_fd != -1) {
+		if (fchmod(ms->l2_fd, 0644) != 0 || close(ms->l2_fd) != 0 ||
+		    rename(ms->l2_tmp, job->cache_abs) != 0)
+			unlink(ms->l2_tmp);
+		ms->l2_fd = -1;
+	}
+	if (ms->buf) {
+		man_render_cache_put(job->area, job->section, job->page,
+				     job->format, ms->buf, ms->len);
+		body = ms->buf;
+		*len = ms->len;
+		ms->buf = NULL;
+	}
+	return body;
+}
+
+/**
+ * @brief Render a page for man_render_handler() and fill both caches.
+ *
+ * @details Run once per key by singleflight_do(); the L1 entry is stored
+ * before the waiters are woken, so later requests hit it.
+ *
+ * @param arg man_render_job_t describing the page.
+ * @param len Output byte length.
+ *
+ * @return char* Heap-allocated rendered body, or NULL on failure.
+ */
+static char *
+man_render_fill(void *arg, size_t *len)
+{
+	const man_render_job_t *job = arg;
+	char *body;
+
+	if (job->stream) {
+		body = man_render_stream_fill(job, len);
+		if (body || job->stream->ran)
+			return body;
+		/* No helper free to stream it: render into memory. */
+	}
+	body = man_render_page(job->area, job->section, job->page,
+			       job->format, len);
+	if (!body)
+		return NULL;
+
+	man_render_cache_put(job->area, job->section, job->page, job->format,
+			     body, *len);
+
+	if (job->cache_abs) {
+		char cache_dir[512];
+		strlcpy(cache_dir, job->cache_abs, sizeof(cache_dir));
+		char *last_slash = strrchr(cache_dir, '/');
+		if (last_slash) {
+			*last_slash = '\0';
+			if (mkdir_p(cache_dir, config_static_dir) == 0)
+				(void)write_file_binary(job->cache_abs, body,
+							*len);
+		}
+	}
+	return body;
+}
+
+/**
+ * @brief Copy a page variant's L2 file into L1, if it is still fresh.
+ *
+ * @param area Logical area.
+ * @param section Manual section.
+ * @param page Manual page name.
+ * @param format Output format.
+ *
+ * @return int 1 when the entry was loaded, 0 otherwise.
+ */
+int
+man_render_rehydrate(const char *area, const char *section, const char *page,
+		     const char *format)
+{
+	char cache_abs[512];
+	size_t len = 0;
+	char *body;
+
+	if (build_cache_paths(area, section, page, format, NULL, 0, cache_abs,
+			      sizeof(cache_abs)) != 0)
+		return 0;
+	body = man_render_l2_load(cache_abs, &len);
+	if (!body)
+		return 0;
+	man_render_cache_put(area, section, page, format, body, len);
+	free(body);
+	return 1;
+}
+
+/**
+ * @brief Render a page variant ahead of demand unless L2 is recent.
+ *
+ * @details Goes through the same single-flight group as requests, so a
+ * request for the page while it renders waits for this render.
+ *
+ * @param area Logical area.
+ * @param section Manual section.
+ * @param page Manual page name.
+ * @param format Output format.
+ * @param max_age Age in seconds under which the L2 file is left alone.
+ *
+ * @return int 1 when the page was rendered, 0 when L2 was recent enough,
+ * -1 when rendering failed.
+ */
+int
+man_render_prerender(const char *area, const char *section, const char *page,
+		     const char *format, time_t max_age)
+{
+	char cache_abs[512];
+	char key[192];
+	struct stat st;
+	size_t len = 0;
+	char *body;
+
+	if (build_cache_paths(area, section, page, format, NULL, 0, cache_abs,
+			      sizeof(cache_abs)) != 0)
+		return -1;
+	if (stat(cache_abs, &st) == 0 && st.st_size > 0 &&
+	    time(NULL) - st.st_mtime <= max_age)
+		return 0;
+
+	man_render_job_t job = {area, section, page, format, cache_abs, NULL};
+
+	man_render_cache_key(area, section, page, format, key, sizeof(key));
+	body = singleflight_do(&g_man_render_flights, key, man_render_fill,
+			       &job, &len, NULL);
+	if (!body)
+		return -1;
+	free(body);
+	return 1;
+}
+
+/**
+ * @brief Send a page variant from its L2 file, if it is still fresh.
+ *
+ * @details Sent from the file itself, without an L1 copy.
+ *
+ * @param req Incoming HTTP request.
+ * @param area Logical area.
+ * @param section Manual section.
+ * @param page Manual page name.
+ * @param format Output format.
+ * @param cache_abs L2 file of the variant.
+ * @param ret Send result, when the file was used.
+ *
+ * @return int 1 when the file was sent, 0 when there is none.
+ */
+static int
+man_render_send_l2(http_request_t *req, const char *area, const char *section,
+		   const char *page, const char *format, const char *cache_abs,
+		   int *ret)
+{
+	struct stat st;
+	int fd = man_l2_open(cache_abs, &st);
+	if (fd < 0)
+		return 0;
+
+	log_debug("[MAN] Serving from filesystem cache");
+	man_popularity_note(area, section, page, format);
+	http_response_t *resp = man_render_response_create(format, page);
+	if (!resp) {
+		close(fd);
+		*ret = -1;
+		return 1;
+	}
+	*ret = http_send_fd(req, resp, cache_abs, fd, &st, NULL);
+	http_response_free(resp);
+	return 1;
+}
+
 /**
  * @brief Handle `/man/{area}/{section}/{page}[.format]` requests.
  *
@@ -638,59 +1247,24 @@ man_render_handler(http_request_t *req)
 	size_t response_len = 0;
 
 	response_body =
-	    man_render_cache_get(area, section, page, format, &response_len);
+	    man_render_cache_get(area, section, page, format, &response_len, 0);
 	if (response_body) {
 		log_debug("[MAN] Cache hit");
 		goto send_response;
 	}
 	log_debug("[MAN] Cache miss");
 
-	if (have_paths) {
-		struct stat st;
-		if (stat(cache_abs, &st) == 0 && st.st_size > 0) {
-			time_t now = time(NULL);
-			if ((now - st.st_mtime) <= MAN_FS_CACHE_TTL_SEC) {
-				int fd = open(cache_abs, O_RDONLY);
-				if (fd >= 0) {
-					if (fstat(fd, &st) == 0 &&
-					    st.st_size > 0) {
-						response_body = malloc(
-						    (size_t)st.st_size + 1);
-						if (response_body) {
-							ssize_t nr = read(
-							    fd, response_body,
-							    (size_t)st.st_size);
-							if (nr ==
-							    (ssize_t)
-								st.st_size) {
-								response_body
-								    [nr] = '\0';
-								response_len =
-								    (size_t)nr;
-								close(fd);
-								man_render_cache_put(
-								    area,
-								    section,
-								    page,
-								    format,
-								    response_body,
-								    response_len);
-								log_debug(
-								    "[MAN] "
-								    "Loaded "
-								    "from "
-								    "filesystem"
-								    " cache");
-								goto send_response;
-							}
-							free(response_body);
-							response_body = NULL;
-						}
-					}
-					close(fd);
-				}
-			}
-		}
+	int ret;
+	if (have_paths && man_render_send_l2(req, area, section, page, format,
+					     cache_abs, &ret))
+		return ret;
+
+	/* Rather than wait for mandoc, send what expired lately. */
+	response_body =
+	    man_render_cache_get(area, section, page, format, &response_len, 1);
+	if (response_body) {
+		log_debug("[MAN] Stale hit, refresh queued");
+		goto send_response;
 	}
 
 	log_debug("[MAN] Rendering page with man_render_page(area=%s, "
@@ -698,7 +1272,7 @@ man_render_handler(http_request_t *req)
 		  area, section, page, format);
 
 	// First try with the requested section.
-	char *test_path = man_resolve_path(page, section);
+	char *test_path = man_document_path(section, page);
 	if (!test_path) {
 		log_debug("[MAN] Failed to resolve with section %s, probing "
 			  "other sections...",
@@ -714,7 +1288,7 @@ man_render_handler(http_request_t *req)
 			if (strcmp(probe_sections[i], section) == 0)
 				continue; // Already tried.
 
-			test_path = man_resolve_path(page, probe_sections[i]);
+			test_path = man_document_path(probe_sections[i], page);
 			if (test_path) {
 				log_debug("[MAN] Found page in section %s",
 					  probe_sections[i]);
@@ -735,47 +1309,158 @@ man_render_handler(http_request_t *req)
 		return http_send_error(req, 404, "Manual page not found");
 	}
 
-	response_body =
-	    man_render_page(area, section, page, format, &response_len);
+	/* Concurrent misses for one page wait for a single render. */
+	man_render_job_t job = {area, section, page, format,
+				have_paths ? cache_abs : NULL, NULL};
+	man_render_stream_t ms;
+	char key[192];
+	int shared = 0;
+
+	/* Range requests are answered from a complete render. */
+	if (config.man_stream && man_render_streamable(format) &&
+	    !http_request_get_header(req, "Range")) {
+		memset(&ms, 0, sizeof(ms));
+		ms.req = req;
+		ms.format = format;
+		ms.page = page;
+		ms.l2_fd = -1;
+		job.stream = &ms;
+	}
+
+	man_render_cache_key(area, section, page, format, key, sizeof(key));
+	response_body = singleflight_do(&g_man_render_flights, key,
+					man_render_fill, &job, &response_len,
+					&shared);
+	/* The other text formats are likely next: render them when idle. */
+	if (!shared && (response_body || (job.stream && ms.begun)))
+		man_document_rendered(area, section, page, format);
+	if (job.stream && !shared && ms.begun) {
+		/* Sent while it rendered. */
+		log_debug("[MAN] Streamed %zu bytes", ms.total);
+		man_popularity_note(area, section, page, format);
+		free(response_body);
+		return http_stream_end(&ms.s);
+	}
+	/* A streamed page too large for L1 is shared through L2. */
+	if (!response_body && shared && have_paths &&
+	    man_render_send_l2(req, area, section, page, format, cache_abs,
+			       &ret))
+		return ret;
 	if (!response_body) {
 		log_debug("[MAN] man_render_page failed");
 		return http_send_error(req, 404, "Manual page not found");
 	}
-	log_debug("[MAN] Rendering successful, got %zu bytes", response_len);
-
-	man_render_cache_put(area, section, page, format, response_body,
-			     response_len);
-
-	if (have_paths) {
-		char cache_dir[512];
-		strlcpy(cache_dir, cache_abs, sizeof(cache_dir));
-		char *last_slash = strrchr(cache_dir, '/');
-		if (last_slash) {
-			*last_slash = '\0';
-			if (mkdir_p(cache_dir, config_static_dir) == 0)
-				(void)write_file_binary(
-				    cache_abs, response_body, response_len);
-		}
-	}
+	log_debug("[MAN] Rendering successful, got %zu bytes%s", response_len,
+		  shared ? " (shared)" : "");
 
 send_response: {
-	http_response_t *resp = http_response_create();
+	man_popularity_note(area, section, page, format);
+
+	http_response_t *resp = man_render_response_create(format, page);
 	if (!resp) {
 		free(response_body);
 		return -1;
 	}
 
-	resp->content_type = man_mime_for_format(format);
-	http_response_add_header(resp, "Cache-Control", "public, max-age=300");
-	man_add_content_disposition_for_format(resp, format, page);
 	http_response_set_body(resp, response_body, response_len, 1);
+	/* PDF viewers seek and download managers resume with Range. */
+	http_response_apply_range(req, resp, NULL, 0);
 
-	int ret = http_response_send(req, resp);
+	ret = http_response_send(req, resp);
 	http_response_free(resp);
 	return ret;
 }
 }
 
+/**
+ * @brief Send the page listing of one section.
+ *
+ * @details The whole listing goes out as the cached document, gzipped
+ * ahead of time, with an ETag that changes when the directory does.
+ * `prefix`, `offset` and `limit` select a run of the sorted names
+ * instead, serialized for this request.
+ *
+ * @param req Incoming HTTP request.
+ * @param area Area identifier.
+ * @param section Section identifier.
+ * @param qs Query string, or NULL.
+ *
+ * @return int HTTP send status/result code.
+ */
+static int
+man_api_send_section(http_request_t *req, const char *area,
+    const char *section, const char *qs)
+{
+	static char empty[] = "{\"pages\":[],\"total\":0}";
+	char prefix[128] = {0};
+	char num[24];
+	char etag[HTTP_ETAG_MAX];
+	size_t offset = 0, limit = SIZE_MAX;
+	int paged = 0, ret;
+	man_section_listing_t *l;
+	http_response_t *resp;
+
+	if (man_get_query_value(qs, "prefix", prefix, sizeof(prefix)))
+		paged = 1;
+	if (man_get_query_value(qs, "offset", num, sizeof(num))) {
+		offset = (size_t)strtoul(num, NULL, 10);
+		paged = 1;
+	}
+	if (man_get_query_value(qs, "limit", num, sizeof(num))) {
+		limit = (size_t)strtoul(num, NULL, 10);
+		paged = 1;
+	}
+
+	l = man_section_listing_get(area, section);
+	if (l && !paged) {
+		int gzip = http_request_accepts_encoding(req, "gzip") &&
+		    l->gz != NULL;
+
+		http_etag_for_version(gzip ? 'L' : 'l', l->version, etag,
+		    sizeof(etag));
+		if (http_request_not_modified(req, etag, 0)) {
+			man_section_listing_release(l);
+			return http_send_not_modified(req, etag, 0);
+		}
+	}
+
+	if (!(resp = http_response_create())) {
+		man_section_listing_release(l);
+		return http_send_error(req, 500, "Internal Server Error");
+	}
+	http_response_set_status(resp, 200);
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
+	if (!l) {
+		http_response_set_body(resp, empty, sizeof(empty) - 1, 0);
+	} else if (paged) {
+		char *json = man_section_listing_json(l, prefix, offset, limit);
+
+		if (!json) {
+			http_response_free(resp);
+			man_section_listing_release(l);
+			return http_send_error(req, 500, "Internal Server Error");
+		}
+		http_response_set_body(resp, json, strlen(json), 1);
+		http_response_gzip(req, resp);
+	} else {
+		if (l->gz && http_request_accepts_encoding(req, "gzip")) {
+			http_response_set_gzip_blob(resp, l->gz);
+		} else {
+			http_response_set_body(resp, l->json->data, l->json->len,
+			    0);
+			if (l->gz)
+				http_response_add_header(resp, "Vary",
+				    "Accept-Encoding");
+		}
+		http_response_add_validators(resp, etag, 0);
+	}
+	ret = http_response_send(req, resp);
+	http_response_free(resp);
+	man_section_listing_release(l);
+	return ret;
+}
+
 /**
  * @brief Handle `/api/man*` endpoints.
  *
@@ -790,6 +1475,7 @@ int
 man_api_handler(http_request_t *req)
 {
 	char *json = NULL;
+	const char *qs = http_request_query(req);
 
 	const char *api_base = "/api/man";
 	const char *path = strstr(req->url, api_base);
@@ -804,14 +1490,17 @@ man_api_handler(http_request_t *req)
 	if (man_path_matches_endpoint(path, "/sections")) {
 		json = man_get_sections_json();
 
+	} else if (man_path_matches_endpoint(path, "/cache")) {
+		json = man_l2_stats_json();
+
 	} else if (man_path_matches_endpoint(path, "/pages")) {
 		char section[16] = {0};
 		char area[16] = "system";
-		if (man_get_query_value(req->url, "section", section,
+		if (man_get_query_value(qs, "section", section,
 					sizeof(section))) {
-			(void)man_get_query_value(req->url, "area", area,
+			(void)man_get_query_value(qs, "area", area,
 						  sizeof(area));
-			json = man_get_section_pages_json(area, section);
+			return man_api_send_section(req, area, section, qs);
 		} else {
 			json =
 			    strdup("{\"error\":\"Missing section parameter\"}");
@@ -820,9 +1509,9 @@ man_api_handler(http_request_t *req)
 	} else if (man_path_matches_endpoint(path, "/resolve")) {
 		char name_buf[64] = {0};
 		char section_buf[16] = {0};
-		(void)man_get_query_value(req->url, "name", name_buf,
+		(void)man_get_query_value(qs, "name", name_buf,
 					  sizeof(name_buf));
-		(void)man_get_query_value(req->url, "section", section_buf,
+		(void)man_get_query_value(qs, "section", section_buf,
 					  sizeof(section_buf));
 
 		if (name_buf[0] == '\0' || !man_is_valid_token(name_buf) ||
@@ -901,12 +1590,29 @@ man_api_handler(http_request_t *req)
 			}
 		}
 
+	} else if (man_path_matches_endpoint(path, "/prefix")) {
+		char prefix[64] = {0};
+		char num[24];
+		size_t cursor = 0, limit = 10;
+
+		(void)man_get_query_value(qs, "q", prefix, sizeof(prefix));
+		if (man_get_query_value(qs, "cursor", num, sizeof(num)))
+			cursor = (size_t)strtoul(num, NULL, 10);
+		if (man_get_query_value(qs, "limit", num, sizeof(num)))
+			limit = (size_t)strtoul(num, NULL, 10);
+		if (prefix[0] != '\0' && !man_is_valid_token(prefix))
+			json = strdup("{\"error\":\"invalid prefix\"}");
+		else if (!(json = man_apropos_prefix_json(prefix, cursor,
+		    limit)))
+			/* Index not built yet: clients fall back to /search. */
+			return http_send_error(req, 503, "Service Unavailable");
+
 	} else if (strncmp(path, "/search", 7) == 0) {
 		const char *query = NULL;
 		char query_buf[256] = {0};
 		if (path[7] == '/') {
 			query = path + 8;
-		} else if (man_get_query_value(req->url, "q", query_buf,
+		} else if (man_get_query_value(qs, "q", query_buf,
 					       sizeof(query_buf))) {
 			query = query_buf;
 		}
@@ -922,8 +1628,8 @@ man_api_handler(http_request_t *req)
 			path_tmp[path_len] = '\0';
 			if (sscanf(path_tmp, "/%31[^/]/%15s", area, section) ==
 			    2)
-				json =
-				    man_get_section_pages_json(area, section);
+				return man_api_send_section(req, area, section,
+				    qs);
 		}
 		if (!json)
 			json = strdup("{\"error\":\"Unknown API endpoint or "
@@ -944,6 +1650,7 @@ man_api_handler(http_request_t *req)
 				 : "application/json";
 	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
 	http_response_set_body(resp, json, strlen(json), 1);
+	http_response_gzip(req, resp);
 
 	int ret = http_response_send(req, resp);
 	http_response_free(resp);
@@ -974,6 +1681,4 @@ man_render_cache_cleanup(void)
 			pthread_mutex_unlock(&shard->lock);
 		}
 	}
-	if (g_mandoc_sem_initialized)
-		(void)sem_destroy(&g_mandoc_semaphore);
 }
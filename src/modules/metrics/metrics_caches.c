@@ -0,0 +1,162 @@
+/* metrics_caches.c - loopback-only listing and purge of the caches */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <miniweb/core/cache_admin.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+
+#define CACHES_KEY_MAX	512
+
+/*
+ * Only a client on the loopback interface or the Unix-domain socket
+ * itself may list or purge: a request relayed by a proxy on the same
+ * host arrives there too, so one carrying a forwarding header is
+ * refused as well. The profiler endpoints share the check.
+ */
+int
+metrics_admin_local(http_request_t *req)
+{
+	if (req->client_addr == NULL ||
+	    (req->client_addr->sin_family != AF_UNIX &&
+	    (ntohl(req->client_addr->sin_addr.s_addr) >> 24) != 127))
+		return 0;
+	return http_request_get_header(req, "X-Forwarded-For") == NULL &&
+	    http_request_get_header(req, "X-Real-IP") == NULL;
+}
+
+/**
+ * Decode query parameter @p name into @p out. Returns 1 when present,
+ * 0 when absent, -1 when empty, too long or badly encoded.
+ */
+static int
+caches_param(const char *q, const char *name, char *out, size_t outlen)
+{
+	size_t nlen = strlen(name);
+	char raw[CACHES_KEY_MAX * 3];
+
+	while (q && *q) {
+		if (strncmp(q, name, nlen) == 0 && q[nlen] == '=') {
+			const char *v = q + nlen + 1;
+			size_t vlen = strcspn(v, "&");
+
+			if (vlen == 0 || vlen >= sizeof(raw))
+				return -1;
+			memcpy(raw, v, vlen);
+			raw[vlen] = '\0';
+			if (url_decode(raw, out, outlen) != 0 || out[0] == '\0')
+				return -1;
+			return 1;
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return 0;
+}
+
+struct caches_list {
+	json_writer_t *w;
+	int n;
+};
+
+/** cache_admin_foreach() callback: one cache as a JSON object. */
+static void
+caches_item(const char *name, const struct cache_admin_stats *st, void *ctx)
+{
+	struct caches_list *l = ctx;
+	json_writer_t *w = l->w;
+	uint64_t lookups = st->hits + st->misses;
+
+	json_printf(w, "%s{\"name\": ", l->n++ ? ", " : "");
+	json_str(w, name);
+	json_printf(w, ", \"bytes\": %llu, \"entries\": %llu, "
+	    "\"hits\": %llu, \"misses\": %llu, \"hit_ratio\": ",
+	    (unsigned long long)st->bytes, (unsigned long long)st->entries,
+	    (unsigned long long)st->hits, (unsigned long long)st->misses);
+	if (lookups > 0)
+		json_printf(w, "%.4f}", (double)st->hits / (double)lookups);
+	else
+		json_puts(w, "null}");
+}
+
+/**
+ * @brief Handle GET /api/admin/caches.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_caches_handler(http_request_t *req)
+{
+	json_writer_t w;
+	struct caches_list l = { &w, 0 };
+	char *json;
+	int rc;
+
+	if (!metrics_admin_local(req))
+		return http_send_error(req, 403, "Loopback clients only");
+	if (json_init(&w, req->arena, 2048) == 0) {
+		json_puts(&w, "{\"caches\": [");
+		(void)cache_admin_foreach(caches_item, &l);
+		json_puts(&w, "]}");
+	}
+	if ((json = json_finish(&w, NULL)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	rc = http_send_json(req, json);
+	if (req->arena == NULL)
+		free(json);
+	return rc;
+}
+
+/**
+ * @brief Handle POST /api/admin/caches/purge?[cache=<name>&]key=<k>
+ * or ...&prefix=<p>; without a cache every cache is purged.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_caches_purge_handler(http_request_t *req)
+{
+	const char *q = http_request_query(req);
+	char name[64], key[CACHES_KEY_MAX];
+	int has_name, has_key, has_prefix;
+	json_writer_t w;
+	long dropped;
+	char *json;
+	int rc;
+
+	if (!metrics_admin_local(req))
+		return http_send_error(req, 403, "Loopback clients only");
+	has_name = caches_param(q, "cache", name, sizeof(name));
+	has_key = caches_param(q, "key", key, sizeof(key));
+	has_prefix = has_key == 0 ?
+	    caches_param(q, "prefix", key, sizeof(key)) : 0;
+	if (has_name < 0 || has_key < 0 || has_prefix < 0 ||
+	    has_key + has_prefix != 1)
+		return http_send_error(req, 400,
+		    "Expected one of key= or prefix=");
+	dropped = cache_admin_purge(has_name ? name : NULL, key, has_prefix);
+	if (dropped < 0)
+		return http_send_error(req, 404, "Unknown cache");
+
+	if (json_init(&w, req->arena, 128 + 2 * strlen(key)) == 0) {
+		json_puts(&w, "{\"cache\": ");
+		json_str(&w, has_name ? name : NULL);
+		json_printf(&w, ", \"%s\": ", has_prefix ? "prefix" : "key");
+		json_str(&w, key);
+		json_printf(&w, ", \"purged\": %ld}", dropped);
+	}
+	if ((json = json_finish(&w, NULL)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	rc = http_send_json(req, json);
+	if (req->arena == NULL)
+		free(json);
+	return rc;
+}
@@ -5,7 +5,6 @@
 #include <time.h>
 #include <sys/types.h>
 
-#include <sys/mount.h>
 #ifdef __OpenBSD__
 #include <sys/sched.h> /* CPUSTATES, CP_USER, CP_SYS, CP_IDLE, CP_INTR */
 #include <sys/swap.h>
@@ -18,6 +17,7 @@
 #include <unistd.h>
 
 #include <miniweb/modules/metrics.h>
+#include <miniweb/modules/networking.h>
 
 #define MB (1024 * 1024)
 
@@ -237,69 +237,32 @@ metrics_get_hostname(char *hostname, size_t size)
 }
 
 /**
- * @brief metrics_get_disk_usage operation.
+ * @brief Local ports with the most sockets, from the networking module.
  *
- * @details Performs the core metrics_get_disk_usage routine for this module.
+ * @details The connection table is sampled by the networking heartbeat;
+ * this only copies its busiest ports.
  *
- * @param disks Input parameter for metrics_get_disk_usage.
- * @param max_disks Input parameter for metrics_get_disk_usage.
+ * @param ports Output array.
+ * @param max_ports Capacity of @p ports.
  *
- * @return Return value produced by metrics_get_disk_usage.
- */
-int
-metrics_get_disk_usage(DiskInfo *disks, int max_disks)
-{
-#ifdef __OpenBSD__
-	struct statfs *mntbuf;
-	int mntsize, count = 0;
-	mntsize = getmntinfo(&mntbuf, MNT_NOWAIT);
-	if (mntsize == 0)
-		return 0;
-	for (int i = 0; i < mntsize && count < max_disks; i++) {
-		struct statfs *fs = &mntbuf[i];
-		if (strcmp(fs->f_fstypename, "tmpfs") == 0 ||
-		    strcmp(fs->f_fstypename, "procfs") == 0 ||
-		    strcmp(fs->f_fstypename, "devfs") == 0 ||
-		    strcmp(fs->f_fstypename, "fdescfs") == 0 ||
-		    fs->f_blocks == 0)
-			continue;
-		DiskInfo *disk = &disks[count++];
-		strlcpy(disk->device, fs->f_mntfromname, sizeof(disk->device));
-		strlcpy(disk->mount_point, fs->f_mntonname,
-		    sizeof(disk->mount_point));
-		unsigned long total = fs->f_blocks * fs->f_bsize;
-		unsigned long available = fs->f_bavail * fs->f_bsize;
-		disk->total_mb = total / MB;
-		disk->used_mb = (total - available) / MB;
-		disk->percent_used =
-		    disk->total_mb > 0
-			? (int)((disk->used_mb * 100) / disk->total_mb)
-			: 0;
-	}
-	return count;
-#else
-	(void)disks;
-	(void)max_disks;
-	return 0;
-#endif
-}
-
-/**
- * @brief metrics_get_top_ports operation.
- *
- * @details Performs the core metrics_get_top_ports routine for this module.
- *
- * @param ports Input parameter for metrics_get_top_ports.
- * @param max_ports Input parameter for metrics_get_top_ports.
- *
- * @return Return value produced by metrics_get_top_ports.
+ * @return Number of entries written.
  */
 int
 metrics_get_top_ports(PortInfo *ports, int max_ports)
 {
-	(void)ports;
-	(void)max_ports;
-	return 0;
+	NetworkPort np[20];
+	int n;
+
+	n = networking_get_top_ports(np, max_ports < 20 ? max_ports : 20);
+	for (int i = 0; i < n; i++) {
+		ports[i].port = np[i].port;
+		strlcpy(ports[i].protocol, np[i].protocol,
+		    sizeof(ports[i].protocol));
+		ports[i].connection_count = np[i].connections;
+		snprintf(ports[i].state, sizeof(ports[i].state), "%s",
+		    np[i].listening > 0 ? "LISTEN" : "ACTIVE");
+	}
+	return n;
 }
 
 /**
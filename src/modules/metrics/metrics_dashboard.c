@@ -0,0 +1,187 @@
+/* metrics_dashboard.c - GET /api/dashboard, several snapshots in one reply */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <miniweb/core/conf.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+#include <miniweb/modules/networking.h>
+
+extern miniweb_conf_t config;
+
+/*
+ * Each snapshot is already serialized once per heartbeat by its module;
+ * the bundle is those bytes between a few literals, sent in one gather
+ * write and never parsed or rebuilt here. The metrics one is sent from
+ * the published snapshot by reference, without a copy.
+ */
+
+#define DASH_METRICS		0x1
+#define DASH_NETWORKING		0x2
+#define DASH_FIELDS_MAX		64
+
+static const struct {
+	const char *name;
+	unsigned int bit;
+} dash_fields[] = {
+	{ "metrics", DASH_METRICS },
+	{ "networking", DASH_NETWORKING },
+};
+
+/** Fields that may be asked for: networking only with its module on. */
+static unsigned int
+dash_available(void)
+{
+	return DASH_METRICS | (config.enable_networking ? DASH_NETWORKING : 0);
+}
+
+/**
+ * Parse fields=<name>[,<name>...] from @p q into a mask of DASH_*.
+ * Returns every available field when absent, 0 when empty, malformed
+ * or naming one that is not available.
+ */
+static unsigned int
+dash_parse_fields(const char *q)
+{
+	char raw[DASH_FIELDS_MAX * 3], buf[DASH_FIELDS_MAX];
+	unsigned int mask = 0, avail = dash_available();
+
+	while (q && *q && strncmp(q, "fields=", 7) != 0) {
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	if (q == NULL || *q == '\0')
+		return avail;
+	q += 7;
+	size_t len = strcspn(q, "&");
+	if (len == 0 || len >= sizeof(raw))
+		return 0;
+	memcpy(raw, q, len);
+	raw[len] = '\0';
+	if (url_decode(raw, buf, sizeof(buf)) != 0)
+		return 0;
+
+	for (char *p = buf; ; ) {
+		size_t n = strcspn(p, ",");
+		unsigned int bit = 0;
+
+		for (size_t i = 0; i < sizeof(dash_fields) /
+		    sizeof(dash_fields[0]); i++) {
+			if (strlen(dash_fields[i].name) == n &&
+			    strncmp(dash_fields[i].name, p, n) == 0)
+				bit = dash_fields[i].bit;
+		}
+		if ((bit & avail) == 0)
+			return 0;
+		mask |= bit;
+		if (p[n] == '\0')
+			break;
+		p += n + 1;
+	}
+	return mask;
+}
+
+/**
+ * @brief Handle GET /api/dashboard?fields=metrics,networking.
+ *
+ * @details Members appear in the order above, each the same JSON its own
+ * endpoint serves. The ETag names the fields and the version of each
+ * snapshot, so a poller holding all of them gets a bodiless 304. The
+ * bundle is sent uncompressed: the pieces are shared, and compressing
+ * their concatenation per request would cost more than it saves a
+ * local dashboard.
+ *
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_dashboard_handler(http_request_t *req)
+{
+	struct iovec iov[5];
+	char etag[HTTP_ETAG_MAX];
+	metrics_snap_t *metrics = NULL;
+	char *net = NULL;
+	http_response_t *resp;
+	unsigned long mv = 0, nv = 0;
+	unsigned int mask;
+	int n = 0, ret;
+
+	mask = dash_parse_fields(http_request_query(req));
+	if (mask == 0)
+		return http_send_error(req, 400, "Unknown or empty fields");
+
+	/* Validate against the versions alone, before copying anything. */
+	if (mask & DASH_METRICS)
+		mv = metrics_snapshot_version();
+	if (mask & DASH_NETWORKING)
+		nv = networking_json_version();
+	if (((mask & DASH_METRICS) == 0 || mv != 0) &&
+	    ((mask & DASH_NETWORKING) == 0 || nv != 0)) {
+		snprintf(etag, sizeof(etag), "\"d%x.%lx.%lx\"", mask, mv, nv);
+		if (http_request_not_modified(req, etag, 0))
+			return http_send_not_modified(req, etag, 0);
+	}
+
+	if (mask & DASH_METRICS) {
+		if ((metrics = metrics_snapshot_acquire(1)) == NULL)
+			goto fail;
+		mv = metrics->version;
+	}
+	if ((mask & DASH_NETWORKING) &&
+	    (net = networking_get_json_arena(req->arena, &nv)) == NULL)
+		goto fail;
+
+	if ((resp = http_response_create()) == NULL)
+		goto fail;
+	resp->status_code = 200;
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	/* A payload built without a ring to cache it in has no version. */
+	if (((mask & DASH_METRICS) == 0 || mv != 0) &&
+	    ((mask & DASH_NETWORKING) == 0 || nv != 0)) {
+		snprintf(etag, sizeof(etag), "\"d%x.%lx.%lx\"", mask, mv, nv);
+		http_response_add_validators(resp, etag, 0);
+	}
+
+#define DASH_SPAN(s, l) do {						\
+	iov[n].iov_base = (void *)(uintptr_t)(s);			\
+	iov[n].iov_len = (l);						\
+	n++;								\
+} while (0)
+#define DASH_LIT(s)	DASH_SPAN(s, sizeof(s) - 1)
+	if (metrics) {
+		DASH_LIT("{\"metrics\": ");
+		DASH_SPAN(metrics->json, metrics->len);
+	}
+	if (net) {
+		if (metrics)
+			DASH_LIT(", \"networking\": ");
+		else
+			DASH_LIT("{\"networking\": ");
+		DASH_SPAN(net, strlen(net));
+	}
+	DASH_LIT("}");
+#undef DASH_LIT
+#undef DASH_SPAN
+
+	ret = http_response_send_iov(req, resp, iov, n);
+	http_response_free(resp);
+	metrics_snapshot_release(metrics);
+	if (req->arena == NULL)
+		free(net);
+	return ret;
+
+fail:
+	metrics_snapshot_release(metrics);
+	if (req->arena == NULL)
+		free(net);
+	return http_send_error(req, 500, "Unable to generate dashboard");
+}
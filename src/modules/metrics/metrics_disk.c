@@ -0,0 +1,252 @@
+/* metrics_disk.c - Mounted filesystem usage, probed off the heartbeat */
+
+#include <sys/types.h>
+#include <sys/mount.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/core/config.h>
+#include <miniweb/core/log.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+
+#define LOG(...)                                                               \
+	do {                                                                   \
+		if (config_verbose)                                            \
+			log_debug("[METRICS] " __VA_ARGS__);                   \
+	} while (0)
+
+/*
+ * statfs(2) on a mount whose server went away can block for good, so
+ * the metrics.disks task never calls it. Each run lists the mounts with
+ * getmntinfo(MNT_NOWAIT), which only copies what the kernel has cached,
+ * and starts a detached probe thread for every mount without one in
+ * flight; the probe stores fresh numbers when statfs returns. A probe
+ * out for longer than DISK_TIMEOUT marks its mount stale: the last good
+ * numbers stay, flagged, and no second probe is stacked on a hung one.
+ * Readers copy the table and never wait on a mount.
+ */
+
+#define MB (1024 * 1024)
+#define DISK_TIMEOUT	3	/* seconds a probe may take */
+
+typedef struct {
+	DiskInfo info;
+	int used;			/* slot holds a mount */
+	int seen;			/* listed by the current run */
+	unsigned int gen;		/* bumped whenever the slot changes hands */
+	time_t probing;			/* start of the probe in flight, or 0 */
+} disk_slot_t;
+
+typedef struct {
+	int slot;
+	unsigned int gen;
+	char path[sizeof(((DiskInfo *)0)->mount_point)];
+} disk_probe_t;
+
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static disk_slot_t disk_slots[METRICS_DISKS_MAX];
+static int disk_collected;
+
+#ifdef __OpenBSD__
+/* Serialises collection runs; getmntinfo() reuses a static buffer. */
+static pthread_mutex_t disk_collect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Pseudo and empty filesystems are not listed. */
+static int
+disk_skip(const struct statfs *fs)
+{
+	return strcmp(fs->f_fstypename, "tmpfs") == 0 ||
+	    strcmp(fs->f_fstypename, "procfs") == 0 ||
+	    strcmp(fs->f_fstypename, "devfs") == 0 ||
+	    strcmp(fs->f_fstypename, "fdescfs") == 0 ||
+	    fs->f_blocks == 0;
+}
+
+/** Fill @p disk from @p fs. */
+static void
+disk_fill(DiskInfo *disk, const struct statfs *fs)
+{
+	unsigned long total = fs->f_blocks * fs->f_bsize;
+	unsigned long available = fs->f_bavail * fs->f_bsize;
+
+	strlcpy(disk->device, fs->f_mntfromname, sizeof(disk->device));
+	strlcpy(disk->mount_point, fs->f_mntonname, sizeof(disk->mount_point));
+	disk->total_mb = total / MB;
+	disk->used_mb = (total - available) / MB;
+	disk->percent_used = disk->total_mb > 0 ?
+	    (int)((disk->used_mb * 100) / disk->total_mb) : 0;
+	disk->stale = 0;
+}
+
+/** Detached probe: statfs() one mount, however long it takes. */
+static void *
+disk_probe_thread(void *arg)
+{
+	disk_probe_t *p = arg;
+	struct statfs fs;
+	int rc = statfs(p->path, &fs);
+
+	pthread_mutex_lock(&disk_lock);
+	disk_slot_t *s = &disk_slots[p->slot];
+	/* Not if the mount went away, or the slot was reused, meanwhile. */
+	if (s->used && s->gen == p->gen) {
+		if (rc == 0 && fs.f_blocks != 0)
+			disk_fill(&s->info, &fs);
+		else
+			s->info.stale = 1;
+		s->probing = 0;
+	}
+	pthread_mutex_unlock(&disk_lock);
+	free(p);
+	return NULL;
+}
+
+/** Start a probe of slot @p i; called with disk_lock held. */
+static void
+disk_probe_start(int i, time_t now)
+{
+	disk_slot_t *s = &disk_slots[i];
+	disk_probe_t *p = malloc(sizeof(*p));
+	pthread_t tid;
+
+	if (p == NULL)
+		return;
+	p->slot = i;
+	p->gen = s->gen;
+	strlcpy(p->path, s->info.mount_point, sizeof(p->path));
+	if (pthread_create(&tid, NULL, disk_probe_thread, p) != 0) {
+		LOG("pthread_create failed for disk probe of %s", p->path);
+		free(p);
+		return;
+	}
+	(void)pthread_detach(tid);
+	s->probing = now;
+}
+
+/** Slot holding the mount of @p fs, else a free one seeded from it; or -1. */
+static int
+disk_slot_for(const struct statfs *fs)
+{
+	int free_slot = -1;
+
+	for (int i = 0; i < METRICS_DISKS_MAX; i++) {
+		if (!disk_slots[i].used) {
+			if (free_slot < 0)
+				free_slot = i;
+			continue;
+		}
+		if (strcmp(disk_slots[i].info.mount_point, fs->f_mntonname) == 0)
+			return i;
+	}
+	if (free_slot >= 0) {
+		disk_slot_t *s = &disk_slots[free_slot];
+
+		/* Seeded from the kernel's cached numbers until probed. */
+		s->used = 1;
+		s->gen++;
+		s->probing = 0;
+		disk_fill(&s->info, fs);
+	}
+	return free_slot;
+}
+#endif
+
+/**
+ * @brief Heartbeat callback refreshing the mount table and its probes.
+ * @param ctx Unused callback context.
+ */
+void
+metrics_disk_collect(void *ctx)
+{
+#ifdef __OpenBSD__
+	struct statfs *mntbuf;
+	int mntsize;
+	time_t now = time(NULL);
+
+	(void)ctx;
+	pthread_mutex_lock(&disk_collect_lock);
+	mntsize = getmntinfo(&mntbuf, MNT_NOWAIT);
+
+	pthread_mutex_lock(&disk_lock);
+	for (int i = 0; i < METRICS_DISKS_MAX; i++)
+		disk_slots[i].seen = 0;
+	for (int i = 0; i < mntsize; i++) {
+		int slot;
+
+		if (disk_skip(&mntbuf[i]))
+			continue;
+		if ((slot = disk_slot_for(&mntbuf[i])) >= 0)
+			disk_slots[slot].seen = 1;
+	}
+	for (int i = 0; i < METRICS_DISKS_MAX; i++) {
+		disk_slot_t *s = &disk_slots[i];
+
+		if (!s->used)
+			continue;
+		if (!s->seen) {
+			/* Unmounted: a probe still out finds the slot gone. */
+			s->used = 0;
+			s->gen++;
+			continue;
+		}
+		if (s->probing == 0)
+			disk_probe_start(i, now);
+		else if (now - s->probing > DISK_TIMEOUT)
+			s->info.stale = 1;
+	}
+	disk_collected = 1;
+	pthread_mutex_unlock(&disk_lock);
+	pthread_mutex_unlock(&disk_collect_lock);
+#else
+	(void)ctx;
+	pthread_mutex_lock(&disk_lock);
+	disk_collected = 1;
+	pthread_mutex_unlock(&disk_lock);
+#endif
+}
+
+/**
+ * @brief Copy the last known usage of each mounted filesystem.
+ * @param disks Output array populated with disk stats.
+ * @param max_disks Maximum number of entries that can be written into disks.
+ * @return Number of entries written.
+ */
+int
+metrics_get_disk_usage(DiskInfo *disks, int max_disks)
+{
+	int count = 0;
+	int collected;
+
+	pthread_mutex_lock(&disk_lock);
+	collected = disk_collected;
+	pthread_mutex_unlock(&disk_lock);
+	/* Before the task's first run; this does not wait on a mount. */
+	if (!collected)
+		metrics_disk_collect(NULL);
+
+	pthread_mutex_lock(&disk_lock);
+	for (int i = 0; i < METRICS_DISKS_MAX && count < max_disks; i++) {
+		if (disk_slots[i].used)
+			disks[count++] = disk_slots[i].info;
+	}
+	pthread_mutex_unlock(&disk_lock);
+	return count;
+}
+
+/** Forget every mount; probes still out discard their results. */
+void
+metrics_disk_cleanup(void)
+{
+	pthread_mutex_lock(&disk_lock);
+	for (int i = 0; i < METRICS_DISKS_MAX; i++) {
+		disk_slots[i].used = 0;
+		disk_slots[i].probing = 0;
+		disk_slots[i].gen++;
+	}
+	disk_collected = 0;
+	pthread_mutex_unlock(&disk_lock);
+}
@@ -2,60 +2,94 @@
 #include <miniweb/modules/metrics_internal.h>
 
 #include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/net/access_log.h>
+#include <miniweb/net/request_buffer.h>
+#include <miniweb/net/worker.h>
+#include <miniweb/router/routes.h>
 
 /**
  * @brief Append history samples to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  * @param history Chronological metrics samples.
  * @param count Number of samples in @p history.
  */
 void
-metrics_json_append_history(char *buffer, size_t size, MetricSample *history,
-			    size_t count)
-{
-	char *ptr = buffer;
-	int written = snprintf(ptr, size, "\"history\": [");
-	if (written < 0 || (size_t)written >= size) {
-		if (size > 0)
-			buffer[0] = '\0';
-		return;
-	}
-	ptr += written;
-	size -= (size_t)written;
-
-	for (size_t i = 0; i < count && size > 0; i++) {
-		written = snprintf(
-		    ptr, size,
+metrics_json_append_history(json_writer_t *w, const MetricSample *history,
+    size_t count)
+{
+	json_puts(w, "\"history\": [");
+	for (size_t i = 0; i < count; i++) {
+		json_printf(w,
 		    "%s{\"ts\": %lld, \"cpu\": %.2f, \"mem_used_mb\": %u, "
 		    "\"mem_total_mb\": %u, \"swap_used_mb\": %u, "
 		    "\"net_rx\": %u, \"net_tx\": %u}",
 		    (i > 0) ? ", " : "", (long long)history[i].ts,
 		    history[i].cpu, history[i].mem_used, history[i].mem_total,
 		    history[i].swap_used, history[i].net_rx, history[i].net_tx);
-		if (written < 0 || (size_t)written >= size)
-			break;
-		ptr += written;
-		size -= (size_t)written;
 	}
+	json_putc(w, ']');
+}
 
-	if (size > 0)
-		snprintf(ptr, size, "]");
+/**
+ * @brief Append downsampled history as a JSON document.
+ * @param w Destination JSON writer.
+ * @param span Requested span in seconds.
+ * @param step Seconds per bucket of the tier that served it.
+ * @param b Chronological buckets.
+ * @param count Number of buckets in @p b.
+ */
+void
+metrics_json_append_tier(json_writer_t *w, unsigned int span,
+    unsigned int step, const MetricBucket *b, size_t count)
+{
+	json_printf(w, "{\"span\": %u, \"step\": %u, \"samples\": [", span,
+	    step);
+
+	/* Each metric is [min, avg, max] over the bucket. */
+	for (size_t i = 0; i < count; i++) {
+		float n = (float)b[i].n;
+
+		json_printf(w,
+		    "%s{\"ts\": %lld, \"n\": %u, "
+		    "\"cpu\": [%.2f, %.2f, %.2f], "
+		    "\"mem_used_mb\": [%.0f, %.0f, %.0f], "
+		    "\"mem_total_mb\": %u, "
+		    "\"swap_used_mb\": [%.0f, %.0f, %.0f], "
+		    "\"net_rx\": [%.0f, %.0f, %.0f], "
+		    "\"net_tx\": [%.0f, %.0f, %.0f]}",
+		    (i > 0) ? ", " : "", (long long)b[i].ts, b[i].n,
+		    b[i].cpu.min, b[i].cpu.sum / n, b[i].cpu.max,
+		    b[i].mem_used.min, b[i].mem_used.sum / n, b[i].mem_used.max,
+		    b[i].mem_total,
+		    b[i].swap_used.min, b[i].swap_used.sum / n,
+		    b[i].swap_used.max,
+		    b[i].net_rx.min, b[i].net_rx.sum / n, b[i].net_rx.max,
+		    b[i].net_tx.min, b[i].net_tx.sum / n, b[i].net_tx.max);
+	}
+	json_puts(w, "]}");
 }
 
 /**
  * @brief Append CPU usage statistics to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_cpu_stats(char *buffer, size_t size)
+metrics_json_append_cpu_stats(json_writer_t *w)
 {
 	CpuStats stats;
 	if (metrics_get_cpu_stats(&stats) == 0) {
 		int used =
 		    stats.user + stats.nice + stats.system + stats.interrupt;
-		snprintf(buffer, size,
+		json_printf(w,
 			 "\"cpu\": {"
 			 "\"used_pct\": %d,"
 			 "\"user_pct\": %d,"
@@ -67,38 +101,36 @@ metrics_json_append_cpu_stats(char *buffer, size_t size)
 			 used, stats.user, stats.nice, stats.system,
 			 stats.interrupt, stats.idle);
 	} else {
-		snprintf(buffer, size, "\"cpu\": null");
+		json_puts(w, "\"cpu\": null");
 	}
 }
 
 /**
  * @brief Append CPU frequency in MHz to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size   Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_cpu_freq(char *buffer, size_t size)
+metrics_json_append_cpu_freq(json_writer_t *w)
 {
 	int freq_mhz = metrics_get_cpu_freq_mhz();
 
 	if (freq_mhz > 0)
-		snprintf(buffer, size, "\"cpu_freq_mhz\": %d", freq_mhz);
+		json_printf(w, "\"cpu_freq_mhz\": %d", freq_mhz);
 	else
-		snprintf(buffer, size, "\"cpu_freq_mhz\": null");
+		json_puts(w, "\"cpu_freq_mhz\": null");
 }
 
 
 /**
  * @brief Append memory and swap statistics to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_memory_stats(char *buffer, size_t size)
+metrics_json_append_memory_stats(json_writer_t *w)
 {
 	MemoryStats stats;
 	if (metrics_get_memory_stats(&stats) == 0) {
-		snprintf(buffer, size,
+		json_printf(w,
 			 "\"memory\": {\"total_mb\": %ld, \"free_mb\": %ld, "
 			 "\"active_mb\": %ld, \"inactive_mb\": %ld, "
 			 "\"wired_mb\": %ld, "
@@ -108,8 +140,7 @@ metrics_json_append_memory_stats(char *buffer, size_t size)
 			 stats.inactive_mb, stats.wired_mb, stats.cache_mb,
 			 stats.swap_total_mb, stats.swap_used_mb);
 	} else {
-		snprintf(
-		    buffer, size,
+		json_puts(w,
 		    "\"memory\": {\"total_mb\": 0, \"free_mb\": 0, "
 		    "\"active_mb\": 0, \"inactive_mb\": 0, \"wired_mb\": 0, "
 		    "\"cache_mb\": 0}, "
@@ -119,42 +150,42 @@ metrics_json_append_memory_stats(char *buffer, size_t size)
 
 /**
  * @brief Append system load averages to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_load_average(char *buffer, size_t size)
+metrics_json_append_load_average(json_writer_t *w)
 {
 	LoadAverage load;
 	if (metrics_get_load_average(&load) == 0) {
-		snprintf(buffer, size,
+		json_printf(w,
 			 "\"load\": {\"1min\": %.2f, \"5min\": %.2f, "
 			 "\"15min\": %.2f}",
 			 load.load_1min, load.load_5min, load.load_15min);
 	} else {
-		snprintf(
-		    buffer, size,
+		json_puts(w,
 		    "\"load\": {\"1min\": 0.0, \"5min\": 0.0, \"15min\": 0.0}");
 	}
 }
 
 /**
  * @brief Append operating system information to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_os_info(char *buffer, size_t size)
+metrics_json_append_os_info(json_writer_t *w)
 {
 	char os_type[64], os_release[64], machine[64];
 	if (metrics_get_os_info(os_type, os_release, machine,
 				sizeof(os_type)) == 0) {
-		snprintf(buffer, size,
-			 "\"os\": {\"type\": \"%s\", \"release\": \"%s\", "
-			 "\"machine\": \"%s\"}",
-			 os_type, os_release, machine);
+		json_puts(w, "\"os\": {\"type\": ");
+		json_str(w, os_type);
+		json_puts(w, ", \"release\": ");
+		json_str(w, os_release);
+		json_puts(w, ", \"machine\": ");
+		json_str(w, machine);
+		json_putc(w, '}');
 	} else {
-		snprintf(buffer, size,
+		json_puts(w,
 			 "\"os\": {\"type\": \"Unknown\", \"release\": "
 			 "\"Unknown\", \"machine\": \"Unknown\"}");
 	}
@@ -162,90 +193,222 @@ metrics_json_append_os_info(char *buffer, size_t size)
 
 /**
  * @brief Append human-readable uptime data to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_uptime(char *buffer, size_t size)
+metrics_json_append_uptime(json_writer_t *w)
 {
 	char uptime_str[128];
+	json_puts(w, "\"uptime\": ");
 	if (metrics_get_uptime(uptime_str, sizeof(uptime_str)) == 0)
-		snprintf(buffer, size, "\"uptime\": \"%s\"", uptime_str);
+		json_str(w, uptime_str);
 	else
-		snprintf(buffer, size, "\"uptime\": \"unknown\"");
+		json_puts(w, "\"unknown\"");
 }
 
 /**
  * @brief Append mounted filesystem usage to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_disk_info(char *buffer, size_t size)
-{
-	DiskInfo disks[16];
-	int count = metrics_get_disk_usage(disks, 16);
-
-	char *ptr = buffer;
-	int written = 0;
-
-	written = snprintf(ptr, size, "\"disks\": [");
-	ptr += written;
-	size -= written;
-
-	for (int i = 0; i < count && size > 0; i++) {
-		if (i > 0) {
-			written = snprintf(ptr, size, ", ");
-			ptr += written;
-			size -= written;
-		}
-
-		written = snprintf(
-		    ptr, size,
-		    "{\"device\": \"%s\", \"mount\": \"%s\", \"total_mb\": "
-		    "%ld, \"used_mb\": %ld, \"percent\": %d}",
-		    disks[i].device, disks[i].mount_point, disks[i].total_mb,
-		    disks[i].used_mb, disks[i].percent_used);
-		ptr += written;
-		size -= written;
-	}
+metrics_json_append_disk_info(json_writer_t *w)
+{
+	DiskInfo disks[METRICS_DISKS_MAX];
+	int count = metrics_get_disk_usage(disks, METRICS_DISKS_MAX);
 
-	snprintf(ptr, size, "]");
+	json_puts(w, "\"disks\": [");
+	for (int i = 0; i < count; i++) {
+		json_puts(w, i > 0 ? ", {\"device\": " : "{\"device\": ");
+		json_str(w, disks[i].device);
+		json_puts(w, ", \"mount\": ");
+		json_str(w, disks[i].mount_point);
+		json_printf(w, ", \"total_mb\": %ld, \"used_mb\": %ld, "
+		    "\"percent\": %d, \"stale\": %s}",
+		    disks[i].total_mb, disks[i].used_mb, disks[i].percent_used,
+		    disks[i].stale ? "true" : "false");
+	}
+	json_putc(w, ']');
 }
 
 /**
  * @brief Append top-port information to a JSON section.
- * @param buffer Destination JSON buffer.
- * @param size Destination buffer size.
+ * @param w Destination JSON writer.
  */
 void
-metrics_json_append_top_ports(char *buffer, size_t size)
+metrics_json_append_top_ports(json_writer_t *w)
 {
 	PortInfo ports[20];
 	int count = metrics_get_top_ports(ports, 20);
 
-	char *ptr = buffer;
-	int written = 0;
-
-	written = snprintf(ptr, size, "\"top_ports\": [");
-	ptr += written;
-	size -= written;
-
-	for (int i = 0; i < count && size > 0; i++) {
-		if (i > 0) {
-			written = snprintf(ptr, size, ", ");
-			ptr += written;
-			size -= written;
-		}
-
-		written = snprintf(ptr, size,
-				   "{\"port\": %d, \"protocol\": \"%s\", "
-				   "\"connections\": %d, \"state\": \"%s\"}",
-				   ports[i].port, ports[i].protocol,
-				   ports[i].connection_count, ports[i].state);
-		ptr += written;
-		size -= written;
+	json_puts(w, "\"top_ports\": [");
+	for (int i = 0; i < count; i++) {
+		json_printf(w, "%s{\"port\": %d, \"protocol\": ",
+		    i > 0 ? ", " : "", ports[i].port);
+		json_str(w, ports[i].protocol);
+		json_printf(w, ", \"connections\": %d, \"state\": ",
+		    ports[i].connection_count);
+		json_str(w, ports[i].state);
+		json_putc(w, '}');
 	}
+	json_putc(w, ']');
+}
+
+/**
+ * @brief Append worker pool size and grow/retire counters to a JSON section.
+ * @param w Destination JSON writer.
+ */
+void
+metrics_json_append_worker_pool(json_writer_t *w)
+{
+	miniweb_worker_pool_stats_t st;
+
+	miniweb_worker_pool_stats(&st);
+	json_printf(w,
+	    "\"workers\": {\"min\": %d, \"max\": %d, \"live\": %d, "
+	    "\"busy\": %d, \"peak\": %d, \"queue_depth\": %lu, "
+	    "\"spawned\": %lu, \"retired\": %lu, \"spawn_failures\": %lu, "
+	    "\"shed\": {\"fast\": %lu, \"slow\": %lu}, "
+	    "\"kevent\": {\"changes\": %lu, \"calls\": %lu}}",
+	    st.min_threads, st.max_threads, st.live, st.busy, st.peak,
+	    st.queue_depth, st.spawned, st.retired, st.spawn_failures,
+	    st.shed[0], st.shed[1], st.kevent_changes, st.kevent_calls);
+}
+
+/**
+ * @brief Append rendered-view cache counters to a JSON section.
+ * @param w Destination JSON writer.
+ */
+void
+metrics_json_append_view_cache(json_writer_t *w)
+{
+	view_cache_stats_t st;
+
+	view_cache_stats(&st);
+	json_printf(w,
+	    "\"view_cache\": {\"hits\": %lu, \"misses\": %lu, "
+	    "\"entries\": %lu}",
+	    st.hits, st.misses, st.entries);
+}
+
+/** subprocess_foreach_stats() callback: one budget; "all" comes first. */
+static void
+metrics_json_subprocess(const char *name, const struct subprocess_stats *st,
+    void *ctx)
+{
+	json_writer_t *w = ctx;
 
-	snprintf(ptr, size, "]");
+	json_printf(w,
+	    "%s\"%s\": {\"limit\": %d, \"running\": %d, \"queued\": %d, "
+	    "\"started\": %llu, \"rejected\": %llu, \"p99_ms\": %llu}",
+	    strcmp(name, "all") == 0 ? "" : ", ", name, st->limit,
+	    st->running, st->queued, (unsigned long long)st->started,
+	    (unsigned long long)st->rejected, (unsigned long long)st->p99_ms);
+}
+
+/** mem_budget_foreach() and lockstat_foreach() context: the writer and
+ * the entries so far. */
+struct metrics_json_mem {
+	json_writer_t *w;
+	int n;
+};
+
+/** mem_budget_foreach() callback: one memory consumer. */
+static void
+metrics_json_memory(const char *name, const struct mem_cache_stats *st,
+    void *ctx)
+{
+	struct metrics_json_mem *m = ctx;
+
+	json_printf(m->w,
+	    "%s\"%s\": {\"bytes\": %zu, \"hits\": %llu, \"shrinks\": %llu, "
+	    "\"shrunk\": %llu}",
+	    m->n++ ? ", " : "", name, st->bytes,
+	    (unsigned long long)st->hits, (unsigned long long)st->shrinks,
+	    (unsigned long long)st->shrunk);
+}
+
+/** lockstat_foreach() callback: one lock site. */
+static void
+metrics_json_lock(const lockstat_t *s, void *ctx)
+{
+	struct metrics_json_mem *m = ctx;
+
+	json_printf(m->w,
+	    "%s\"%s\": {\"acquired\": %llu, \"contended\": %llu, "
+	    "\"wait_us\": %llu, \"wait_max_us\": %llu, \"hold_us\": %llu, "
+	    "\"hold_max_us\": %llu}",
+	    m->n++ ? ", " : "", s->name, (unsigned long long)s->acquired,
+	    (unsigned long long)s->contended,
+	    (unsigned long long)(s->wait_ns / 1000),
+	    (unsigned long long)(s->wait_max_ns / 1000),
+	    (unsigned long long)(s->hold_ns / 1000),
+	    (unsigned long long)(s->hold_max_ns / 1000));
+}
+
+/**
+ * @brief Append the server's own counters, by unit, to a JSON section.
+ *
+ * @details Every counter of miniweb/core/counters.h under its group, the
+ * file cache's own shard counters with the other caches, and the gauges
+ * the counters do not give: queue depth, open connections, request buffer
+ * bytes and the file cache occupancy; then the subprocess governor's
+ * budgets, the memory budget's consumers and, in a lockstat build, the
+ * contention of each instrumented lock.
+ *
+ * @param w Destination JSON writer.
+ */
+void
+metrics_json_append_server(json_writer_t *w)
+{
+	uint64_t v[CTR_COUNT];
+	miniweb_worker_pool_stats_t wp;
+	http_file_cache_stats_t fc;
+	uint64_t alog_written, alog_dropped;
+	struct metrics_json_mem mem = { w, 0 };
+	size_t mem_limit, mem_used;
+	const char *group = NULL;
+
+	counters_read(v);
+	miniweb_worker_pool_stats(&wp);
+	http_file_cache_stats(&fc);
+	json_puts(w, "\"server\": {");
+	for (int i = 0; i < CTR_COUNT; i++) {
+		const char *g = counter_group((counter_id_t)i);
+
+		if (g != group)
+			json_printf(w, "%s\"%s\": {\"%s\": %llu",
+			    group ? "}, " : "", g,
+			    counter_name((counter_id_t)i),
+			    (unsigned long long)v[i]);
+		else
+			json_printf(w, ", \"%s\": %llu",
+			    counter_name((counter_id_t)i),
+			    (unsigned long long)v[i]);
+		group = g;
+	}
+	/* "caches" is the last group: the file cache joins it. */
+	json_printf(w,
+	    ", \"file_hits\": %lu, \"file_misses\": %lu, "
+	    "\"file_evictions\": %lu}, "
+	    "\"gauges\": {\"queue_depth\": %lu, \"connections\": %llu, "
+	    "\"request_buffer_bytes\": %zu, \"file_cache_entries\": %lu, "
+	    "\"file_cache_bytes\": %zu}, \"subprocesses\": {",
+	    fc.hits, fc.misses, fc.evictions, wp.queue_depth,
+	    (unsigned long long)(v[CTR_CONN_OPENED] - v[CTR_CONN_CLOSED]),
+	    miniweb_reqbuf_in_use(), fc.entries, fc.bytes);
+	(void)subprocess_foreach_stats(metrics_json_subprocess, w);
+	access_log_stats(&alog_written, &alog_dropped);
+	json_printf(w, "}, \"log\": {\"dropped\": %llu}, "
+	    "\"access_log\": {\"written\": %llu, \"dropped\": %llu}, "
+	    "\"memory\": {\"caches\": {",
+	    (unsigned long long)log_dropped(),
+	    (unsigned long long)alog_written,
+	    (unsigned long long)alog_dropped);
+	(void)mem_budget_foreach(metrics_json_memory, &mem, &mem_limit,
+	    &mem_used);
+	json_printf(w, "}, \"budget\": %zu, \"used\": %zu}, \"locks\": {",
+	    mem_limit, mem_used);
+	mem.n = 0;
+	(void)lockstat_foreach(metrics_json_lock, &mem);
+	json_puts(w, "}}");
 }
@@ -1,14 +1,24 @@
 /* metrics_module.c - Metrics API routing and endpoint orchestration */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <miniweb/core/conf.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/readiness.h>
+#include <miniweb/core/snapshot_delta.h>
+#include <miniweb/http/gzip.h>
 #include <miniweb/http/handler.h>
 #include <miniweb/http/utils.h>
 #include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+#include <miniweb/router/route_stats.h>
 #include <miniweb/router/router.h>
 
+extern miniweb_conf_t config;
+
 /**
  * @brief Handle GET /api/metrics by returning the latest metrics snapshot.
  * @param req Request context used by the HTTP layer.
@@ -17,32 +27,234 @@
 int
 metrics_handler(http_request_t *req)
 {
-	char *json = get_system_metrics_json();
-	if (!json)
-		return http_send_error(req, 500, "Unable to generate metrics");
+	char etag[HTTP_ETAG_MAX];
+	int gzip = http_request_accepts_encoding(req, "gzip");
+	unsigned long version = metrics_snapshot_version();
+
+	/*
+	 * Pollers that already hold this snapshot get a bodiless 304. The
+	 * gzip representation has its own tag ('M'), as strong ETags must
+	 * differ between encodings.
+	 */
+	if (version != 0) {
+		http_etag_for_version(gzip ? 'M' : 'm', version, etag,
+		    sizeof(etag));
+		if (http_request_not_modified(req, etag, 0))
+			return http_send_not_modified(req, etag, 0);
+	}
 
 	http_response_t *resp = http_response_create();
-	if (!resp) {
-		free(json);
+	if (!resp)
 		return http_send_error(req, 500, "Unable to allocate response");
-	}
 
 	resp->status_code = 200;
 	resp->content_type = "application/json";
 
 	/* Allow access from external dashboards. */
 	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
-	http_response_add_header(resp, "Cache-Control", "no-store");
+	http_response_add_header(resp, "Cache-Control", "no-cache");
 
-	/* Attach JSON as response body.
-	 * The '1' flag tells the response layer to free memory automatically. */
-	http_response_set_body(resp, json, strlen(json), 1);
+	/*
+	 * ?since=<version|ts>: only the members and history samples that
+	 * changed after it. The reply is per client, so it carries no
+	 * validators; an unknown since falls through to the full snapshot.
+	 */
+	unsigned long long since;
+	if (snapshot_delta_query(http_request_query(req), &since)) {
+		char *delta = metrics_snapshot_delta_arena(req->arena, since,
+		    &version);
+		if (delta) {
+			http_response_set_body(resp, delta, strlen(delta),
+			    req->arena == NULL);
+			http_response_gzip(req, resp);
+			int ret = http_response_send(req, resp);
+			http_response_free(resp);
+			return ret;
+		}
+	}
+
+	/* Fresh snapshot, gzip client: send the pre-compressed bytes. */
+	http_blob_t *gz = gzip ? metrics_snapshot_gzip(&version) : NULL;
+	if (gz) {
+		http_response_set_gzip_blob(resp, gz);
+		http_etag_for_version('M', version, etag, sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+		int ret = http_response_send(req, resp);
+		http_response_free(resp);
+		http_blob_release(gz);
+		return ret;
+	}
+
+	metrics_snap_t *snap = metrics_snapshot_acquire(1);
+	if (!snap) {
+		http_response_free(resp);
+		return http_send_error(req, 500, "Unable to generate metrics");
+	}
+
+	/* The body is the published snapshot itself, held until sent. */
+	http_response_set_body(resp, snap->json, snap->len, 0);
+	gzip = http_response_gzip(req, resp);
+	http_etag_for_version(gzip ? 'M' : 'm', snap->version, etag,
+	    sizeof(etag));
+	http_response_add_validators(resp, etag, 0);
+
+	int ret = http_response_send(req, resp);
+	http_response_free(resp);
+	metrics_snapshot_release(snap);
+	return ret;
+}
+
+/**
+ * @brief Read span=<seconds> from @p query.
+ * @return The span, 600 when absent, or 0 when malformed.
+ */
+static unsigned int
+metrics_history_span(const char *query)
+{
+	const char *q = query;
+	unsigned long v;
+	char *end;
+
+	while (q) {
+		if (strncmp(q, "span=", 5) == 0) {
+			errno = 0;
+			v = strtoul(q + 5, &end, 10);
+			if (errno != 0 || end == q + 5 || v == 0 ||
+			    (*end != '\0' && *end != '&'))
+				return 0;
+			return v > METRIC_TIER_MAX_SPAN ?
+			    METRIC_TIER_MAX_SPAN : (unsigned int)v;
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return 600;
+}
+
+/**
+ * @brief Handle GET /api/metrics/history?span=<seconds>.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_history_handler(http_request_t *req)
+{
+	unsigned int span = metrics_history_span(http_request_query(req));
+
+	if (span == 0)
+		return http_send_error(req, 400, "Invalid span parameter");
+
+	char *json = metrics_history_json_arena(req->arena, span);
+	if (!json)
+		return http_send_error(req, 503, "Metrics history unavailable");
+
+	http_response_t *resp = http_response_create();
+	if (!resp) {
+		if (req->arena == NULL)
+			free(json);
+		return http_send_error(req, 500, "Unable to allocate response");
+	}
+	resp->status_code = 200;
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	http_response_set_body(resp, json, strlen(json), req->arena == NULL);
+	http_response_gzip(req, resp);
 
 	int ret = http_response_send(req, resp);
 	http_response_free(resp);
 	return ret;
 }
 
+/**
+ * @brief Handle GET /api/stats/server with the live server counters.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_server_stats_handler(http_request_t *req)
+{
+	json_writer_t w;
+	char *json;
+	int rc;
+
+	if (json_init(&w, req->arena, 2048) == 0) {
+		json_putc(&w, '{');
+		metrics_json_append_server(&w);
+		json_putc(&w, '}');
+	}
+	if ((json = json_finish(&w, NULL)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	rc = http_send_json(req, json);
+	if (req->arena == NULL)
+		free(json);
+	return rc;
+}
+
+/**
+ * @brief Handle GET /api/ready: whether startup warm-up is done.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_ready_handler(http_request_t *req)
+{
+	struct readiness_task tasks[READINESS_MAX];
+	int n = readiness_list(tasks, READINESS_MAX);
+	int ready = readiness_ready();
+	http_response_t *resp;
+	json_writer_t w;
+	size_t len;
+	char *json;
+	int rc;
+
+	if (json_init(&w, req->arena, 512) == 0) {
+		json_printf(&w, "{\"ready\":%s,\"warmup_ms\":%llu,\"tasks\":[",
+		    ready ? "true" : "false",
+		    (unsigned long long)readiness_ms());
+		for (int i = 0; i < n; i++) {
+			json_puts(&w, i > 0 ? ",{\"name\":" : "{\"name\":");
+			json_str(&w, tasks[i].name);
+			if (tasks[i].done)
+				json_printf(&w, ",\"done\":true,\"ms\":%llu}",
+				    (unsigned long long)tasks[i].ms);
+			else
+				json_puts(&w, ",\"done\":false}");
+		}
+		json_puts(&w, "]}");
+	}
+	if ((json = json_finish(&w, &len)) == NULL ||
+	    (resp = http_response_create()) == NULL) {
+		if (req->arena == NULL)
+			free(json);
+		return http_send_error(req, 500, "Unable to allocate response");
+	}
+	/* relayd checks the status: send it nowhere until warm. */
+	resp->status_code = ready ? 200 : 503;
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Cache-Control", "no-store");
+	if (!ready)
+		http_response_add_header(resp, "Retry-After", "1");
+	http_response_set_body(resp, json, len, req->arena == NULL);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
+}
+
+/** Warm-up: open the history store and start sampling from it. */
+static int
+metrics_warm(void *arg)
+{
+	(void)arg;
+	if (config.db_path[0] != '\0' && config.metrics_flush_sec > 0 &&
+	    metrics_store_start(config.db_path, config.metrics_flush_sec) != 0)
+		log_info("[METRICS] History store unavailable; metrics history "
+		    "starts empty");
+	metrics_snapshot_start();
+	return 0;
+}
+
 /**
  * @brief Attach metrics API routes to the router.
  * @param r Router to receive route registrations.
@@ -53,7 +265,47 @@ metrics_module_attach_routes(struct router *r)
 {
 	if (router_register(r, "GET", "/api/metrics", metrics_handler) != 0)
 		return -1;
+	if (router_register(r, "GET", "/api/metrics/history",
+	    metrics_history_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/metrics/stream",
+	    metrics_sse_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/dashboard",
+	    metrics_dashboard_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/stats/routes",
+	    route_stats_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/stats/server",
+	    metrics_server_stats_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/stats/trace",
+	    metrics_trace_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/stats/profile",
+	    metrics_profile_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/admin/caches",
+	    metrics_caches_handler) != 0)
+		return -1;
+	if (router_register(r, "POST", "/api/admin/caches/purge",
+	    metrics_caches_purge_handler) != 0)
+		return -1;
+	if (router_register(r, "POST", "/api/admin/profile",
+	    metrics_profile_admin_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/metrics",
+	    metrics_openmetrics_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/ready", metrics_ready_handler) != 0)
+		return -1;
 
 	/* Compatibility alias for clients that call singular form. */
-	return router_register(r, "GET", "/api/metric", metrics_handler);
+	if (router_register(r, "GET", "/api/metric", metrics_handler) != 0)
+		return -1;
+
+	/* Sample from startup, on top of the history kept before it. */
+	(void)readiness_run("metrics", metrics_warm, NULL);
+	return 0;
 }
@@ -0,0 +1,368 @@
+/* metrics_openmetrics.c - OpenMetrics text exposition for /metrics */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/http/gzip.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+#include <miniweb/modules/networking.h>
+#include <miniweb/net/worker.h>
+#include <miniweb/router/route_stats.h>
+#include <miniweb/router/routes.h>
+
+/*
+ * Scrapers used to fetch /api/metrics and re-parse it. Instead, the
+ * metrics heartbeat renders the exposition once per tick into a buffer
+ * kept across ticks, straight from the sample and the counters, and
+ * publishes it as a prepared blob with a gzip twin; a scrape is then a
+ * single writev of bytes that already exist.
+ */
+
+#define OPENMETRICS_BUFFER_SIZE	(256 * 1024)
+#define OPENMETRICS_EOF		"# EOF\n"
+#define OPENMETRICS_TYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static pthread_mutex_t om_lock = PTHREAD_MUTEX_INITIALIZER;
+static http_blob_t *om_blob;		/* identity, headers prepared */
+static http_blob_t *om_gz;		/* the same body, gzipped */
+static char *om_buf;			/* render buffer, heartbeat only */
+
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len;
+} om_out_t;
+
+/** Append to @p o; a line that does not fit is left out whole. */
+static void
+om_printf(om_out_t *o, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (o->len >= o->size)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (size_t)n >= o->size - o->len) {
+		o->buf[o->len] = '\0';
+		return;
+	}
+	o->len += (size_t)n;
+}
+
+/** Append what another unit formatted with its own appender. */
+static void
+om_append(om_out_t *o, size_t (*fn)(char *, size_t))
+{
+	if (o->len < o->size)
+		o->len += fn(o->buf + o->len, o->size - o->len);
+}
+
+/* One heartbeat family per pass over the tasks. */
+typedef struct {
+	om_out_t *o;
+	int family;
+} om_hb_ctx_t;
+
+static void
+om_heartbeat_task(const char *name, const struct hb_task_stats *st,
+    void *ctx)
+{
+	om_hb_ctx_t *c = ctx;
+
+	switch (c->family) {
+	case 0:
+		om_printf(c->o, "miniweb_heartbeat_runs_total{task=\"%s\"} "
+		    "%llu\n", name, (unsigned long long)st->runs);
+		break;
+	case 1:
+		om_printf(c->o, "miniweb_heartbeat_overruns_total{task=\"%s\"} "
+		    "%llu\n", name, (unsigned long long)st->overruns);
+		break;
+	case 2:
+		om_printf(c->o, "miniweb_heartbeat_last_run_timestamp_seconds"
+		    "{task=\"%s\"} %lld\n", name, (long long)st->last_run);
+		break;
+	default:
+		om_printf(c->o, "miniweb_heartbeat_last_duration_seconds"
+		    "{task=\"%s\"} %.3f\n", name,
+		    (double)st->last_duration_ms / 1000.0);
+		break;
+	}
+}
+
+/* Same context: one subprocess family per pass over the budgets. */
+static void
+om_subprocess(const char *name, const struct subprocess_stats *st,
+    void *ctx)
+{
+	om_hb_ctx_t *c = ctx;
+
+	switch (c->family) {
+	case 0:
+		om_printf(c->o, "miniweb_subprocess_limit{command=\"%s\"} %d\n",
+		    name, st->limit);
+		break;
+	case 1:
+		om_printf(c->o, "miniweb_subprocess_running{command=\"%s\"} "
+		    "%d\n", name, st->running);
+		break;
+	case 2:
+		om_printf(c->o, "miniweb_subprocess_queued{command=\"%s\"} "
+		    "%d\n", name, st->queued);
+		break;
+	case 3:
+		om_printf(c->o, "miniweb_subprocess_started_total"
+		    "{command=\"%s\"} %llu\n", name,
+		    (unsigned long long)st->started);
+		break;
+	case 4:
+		om_printf(c->o, "miniweb_subprocess_rejected_total"
+		    "{command=\"%s\"} %llu\n", name,
+		    (unsigned long long)st->rejected);
+		break;
+	default:
+		om_printf(c->o, "miniweb_subprocess_runtime_p99_seconds"
+		    "{command=\"%s\"} %.3f\n", name,
+		    (double)st->p99_ms / 1000.0);
+		break;
+	}
+}
+
+/* Same context: one memory budget family per pass over the consumers. */
+static void
+om_memory(const char *name, const struct mem_cache_stats *st, void *ctx)
+{
+	om_hb_ctx_t *c = ctx;
+
+	if (c->family == 0)
+		om_printf(c->o, "miniweb_cache_memory_bytes{cache=\"%s\"} %zu\n",
+		    name, st->bytes);
+	else
+		om_printf(c->o, "miniweb_cache_memory_shrunk_bytes_total"
+		    "{cache=\"%s\"} %llu\n", name,
+		    (unsigned long long)st->shrunk);
+}
+
+/** Render the whole exposition into @p o. */
+static void
+om_render(om_out_t *o, const MetricSample *s)
+{
+	miniweb_worker_pool_stats_t wp;
+	uint64_t v[CTR_COUNT];
+	size_t mem_limit;
+
+	if (s != NULL) {
+		om_printf(o, "# TYPE miniweb_cpu_usage_ratio gauge\n"
+		    "miniweb_cpu_usage_ratio %.4f\n"
+		    "# TYPE miniweb_memory_used_bytes gauge\n"
+		    "# UNIT miniweb_memory_used_bytes bytes\n"
+		    "miniweb_memory_used_bytes %llu\n"
+		    "# TYPE miniweb_memory_total_bytes gauge\n"
+		    "# UNIT miniweb_memory_total_bytes bytes\n"
+		    "miniweb_memory_total_bytes %llu\n"
+		    "# TYPE miniweb_swap_used_bytes gauge\n"
+		    "# UNIT miniweb_swap_used_bytes bytes\n"
+		    "miniweb_swap_used_bytes %llu\n"
+		    "# TYPE miniweb_sample_timestamp_seconds gauge\n"
+		    "miniweb_sample_timestamp_seconds %lld\n",
+		    (double)s->cpu / 100.0,
+		    (unsigned long long)s->mem_used << 20,
+		    (unsigned long long)s->mem_total << 20,
+		    (unsigned long long)s->swap_used << 20,
+		    (long long)s->ts);
+	}
+
+	om_append(o, networking_append_openmetrics);
+
+	/* A family's samples must follow its own TYPE line. */
+	for (int f = 0; f < 4; f++) {
+		static const char *const types[4] = {
+			"# TYPE miniweb_heartbeat_runs counter\n",
+			"# TYPE miniweb_heartbeat_overruns counter\n",
+			"# TYPE miniweb_heartbeat_last_run_timestamp_seconds "
+			    "gauge\n",
+			"# TYPE miniweb_heartbeat_last_duration_seconds gauge\n",
+		};
+		om_hb_ctx_t c = { o, f };
+
+		om_printf(o, "%s", types[f]);
+		(void)heartbeat_foreach_stats(om_heartbeat_task, &c);
+	}
+	for (int f = 0; f < 6; f++) {
+		static const char *const types[6] = {
+			"# TYPE miniweb_subprocess_limit gauge\n",
+			"# TYPE miniweb_subprocess_running gauge\n",
+			"# TYPE miniweb_subprocess_queued gauge\n",
+			"# TYPE miniweb_subprocess_started counter\n",
+			"# TYPE miniweb_subprocess_rejected counter\n",
+			"# TYPE miniweb_subprocess_runtime_p99_seconds gauge\n",
+		};
+		om_hb_ctx_t c = { o, f };
+
+		om_printf(o, "%s", types[f]);
+		(void)subprocess_foreach_stats(om_subprocess, &c);
+	}
+	for (int f = 0; f < 2; f++) {
+		static const char *const types[2] = {
+			"# TYPE miniweb_cache_memory_bytes gauge\n"
+			    "# UNIT miniweb_cache_memory_bytes bytes\n",
+			"# TYPE miniweb_cache_memory_shrunk_bytes counter\n"
+			    "# UNIT miniweb_cache_memory_shrunk_bytes bytes\n",
+		};
+		om_hb_ctx_t c = { o, f };
+
+		om_printf(o, "%s", types[f]);
+		(void)mem_budget_foreach(om_memory, &c, &mem_limit, NULL);
+	}
+	om_printf(o, "# TYPE miniweb_cache_memory_budget_bytes gauge\n"
+	    "# UNIT miniweb_cache_memory_budget_bytes bytes\n"
+	    "miniweb_cache_memory_budget_bytes %zu\n", mem_limit);
+
+	miniweb_worker_pool_stats(&wp);
+	om_printf(o, "# TYPE miniweb_workers gauge\n"
+	    "miniweb_workers{state=\"live\"} %d\n"
+	    "miniweb_workers{state=\"busy\"} %d\n"
+	    "miniweb_workers{state=\"max\"} %d\n"
+	    "# TYPE miniweb_queue_depth gauge\n"
+	    "miniweb_queue_depth %lu\n"
+	    "# TYPE miniweb_workers_spawned counter\n"
+	    "miniweb_workers_spawned_total %lu\n",
+	    wp.live, wp.busy, wp.max_threads, wp.queue_depth, wp.spawned);
+
+	/* The self-instrumentation counters, one family each. */
+	counters_read(v);
+	for (int i = 0; i < CTR_COUNT; i++) {
+		const char *g = counter_group((counter_id_t)i);
+		const char *n = counter_name((counter_id_t)i);
+
+		om_printf(o, "# TYPE miniweb_%s_%s counter\n"
+		    "miniweb_%s_%s_total %llu\n", g, n, g, n,
+		    (unsigned long long)v[i]);
+	}
+
+	om_append(o, route_stats_append_openmetrics);
+
+	/* The caller kept room for the terminator. */
+	memcpy(o->buf + o->len, OPENMETRICS_EOF, sizeof(OPENMETRICS_EOF));
+	o->len += sizeof(OPENMETRICS_EOF) - 1;
+}
+
+/**
+ * @brief Render the exposition for @p s and publish it for scrapes.
+ *
+ * @details Runs from the metrics heartbeat, which is the only writer of
+ * the render buffer.
+ *
+ * @param s Latest sample, or NULL when there is none yet.
+ */
+void
+metrics_openmetrics_update(const MetricSample *s)
+{
+	om_out_t o;
+	http_blob_t *blob, *gz, *old, *old_gz;
+	http_response_t *resp;
+
+	if (om_buf == NULL && (om_buf = malloc(OPENMETRICS_BUFFER_SIZE)) == NULL)
+		return;
+	o.buf = om_buf;
+	o.size = OPENMETRICS_BUFFER_SIZE - sizeof(OPENMETRICS_EOF);
+	o.len = 0;
+	om_buf[0] = '\0';
+	om_render(&o, s);
+
+	if ((resp = http_response_create()) == NULL)
+		return;
+	resp->status_code = 200;
+	resp->content_type = OPENMETRICS_TYPE;
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	blob = http_blob_alloc(o.len);
+	if (blob != NULL) {
+		memcpy(blob->data, o.buf, o.len);
+		if (http_blob_prepare(blob, resp) != 0) {
+			http_blob_release(blob);
+			blob = NULL;
+		}
+	}
+	http_response_free(resp);
+	if (blob == NULL)
+		return;
+	gz = http_gzip_blob(o.buf, o.len);
+
+	pthread_mutex_lock(&om_lock);
+	old = om_blob;
+	old_gz = om_gz;
+	om_blob = blob;
+	om_gz = gz;
+	pthread_mutex_unlock(&om_lock);
+	http_blob_release(old);
+	http_blob_release(old_gz);
+}
+
+/**
+ * @brief Handle GET /metrics with the exposition of the last tick.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_openmetrics_handler(http_request_t *req)
+{
+	int gzip = http_request_accepts_encoding(req, "gzip");
+	http_blob_t *blob = NULL, *gz = NULL;
+	int ret;
+
+	metrics_snapshot_start();
+	pthread_mutex_lock(&om_lock);
+	if (gzip && om_gz != NULL)
+		gz = http_blob_ref(om_gz);
+	else if (om_blob != NULL)
+		blob = http_blob_ref(om_blob);
+	pthread_mutex_unlock(&om_lock);
+
+	if (blob != NULL) {
+		ret = http_blob_send(req, blob);
+		http_blob_release(blob);
+		return ret;
+	}
+	if (gz == NULL)
+		return http_send_error(req, 503, "Metrics not sampled yet");
+
+	http_response_t *resp = http_response_create();
+	if (!resp) {
+		http_blob_release(gz);
+		return http_send_error(req, 500, "Unable to allocate response");
+	}
+	resp->status_code = 200;
+	resp->content_type = OPENMETRICS_TYPE;
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	http_response_set_gzip_blob(resp, gz);
+	ret = http_response_send(req, resp);
+	http_response_free(resp);
+	http_blob_release(gz);
+	return ret;
+}
+
+/** Drop the published exposition and the render buffer. */
+void
+metrics_openmetrics_cleanup(void)
+{
+	pthread_mutex_lock(&om_lock);
+	http_blob_release(om_blob);
+	http_blob_release(om_gz);
+	om_blob = om_gz = NULL;
+	pthread_mutex_unlock(&om_lock);
+	free(om_buf);
+	om_buf = NULL;
+}
@@ -2,6 +2,7 @@
 
 #include <miniweb/core/config.h>
 #include <miniweb/core/log.h>
+#include <miniweb/http/json.h>
 #include <miniweb/modules/metrics.h>
 #include <miniweb/modules/metrics_internal.h>
 
@@ -10,10 +11,12 @@
 #include <sys/sysctl.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LOG(...)                                                               \
@@ -22,28 +25,41 @@
 			log_debug("[METRICS] " __VA_ARGS__);                   \
 	} while (0)
 
-/**
- * @brief Compare process entries by resident memory size in descending order.
- * @param a Left-hand process entry.
- * @param b Right-hand process entry.
- * @return Negative when @p a should come first, positive when @p b should
- * come first, or 0 when equal.
+/*
+ * uid -> user name cache. Sampling only ever reads it: a uid it has not
+ * seen is shown as its number and queued, and the metrics.users
+ * heartbeat task does the getpwuid_r() calls, which may be network
+ * round trips with YP or LDAP behind passwd, off the sampling path.
+ * Names are re-resolved after USERS_TTL, failures after USERS_NEG_TTL,
+ * and a uid no process has shown for USERS_IDLE is forgotten.
+ *
+ * Each uid has USERS_PROBE candidate slots from its hash; lookups scan
+ * them all, so freed slots never break a chain, and a full set evicts
+ * the entry used least recently.
  */
-static int
-compare_memory_desc(const void *a, const void *b)
-{
-	const struct kinfo_proc *pa = a;
-	const struct kinfo_proc *pb = b;
 
-	if (pa->p_vm_rssize < pb->p_vm_rssize)
-		return 1;
-	if (pa->p_vm_rssize > pb->p_vm_rssize)
-		return -1;
-	return 0;
-}
+#define USERS_SLOTS	256
+#define USERS_PROBE	8
+#define USERS_TTL	300
+#define USERS_NEG_TTL	60
+#define USERS_IDLE	(2 * USERS_TTL)
+#define USERS_BATCH	32	/* lookups per refresh run */
+
+enum { USER_EMPTY, USER_PENDING, USER_FOUND, USER_MISSING };
+
+typedef struct {
+	uid_t uid;
+	int state;
+	time_t expires;			/* due for a refresh after this */
+	time_t used;			/* last asked for */
+	char name[32];
+} metrics_user_t;
+
+static pthread_mutex_t users_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_user_t users[USERS_SLOTS];
 
 /**
- * @brief Resolve a user name for a process uid.
+ * @brief Copy the cached user name for @p uid, queueing it when unknown.
  * @param uid Process user identifier.
  * @param user Destination output buffer.
  * @param size Destination buffer size.
@@ -51,270 +67,401 @@ compare_memory_desc(const void *a, const void *b)
 static void
 metrics_resolve_username(uid_t uid, char *user, size_t size)
 {
-	struct passwd pwd;
-	struct passwd *result = NULL;
-	char pwbuf[1024];
+	metrics_user_t *u, *victim = NULL;
+	time_t now = time(NULL);
+	unsigned int h = (unsigned int)uid * 2654435761U;
+
+	pthread_mutex_lock(&users_lock);
+	for (int i = 0; i < USERS_PROBE; i++) {
+		u = &users[(h + i) % USERS_SLOTS];
+		if (u->state != USER_EMPTY && u->uid == uid) {
+			u->used = now;
+			strlcpy(user, u->name, size);
+			pthread_mutex_unlock(&users_lock);
+			return;
+		}
+		if (victim == NULL || (victim->state != USER_EMPTY &&
+		    (u->state == USER_EMPTY || u->used < victim->used)))
+			victim = u;
+	}
+	victim->uid = uid;
+	victim->state = USER_PENDING;
+	victim->expires = 0;
+	victim->used = now;
+	snprintf(victim->name, sizeof(victim->name), "%u", (unsigned int)uid);
+	strlcpy(user, victim->name, size);
+	pthread_mutex_unlock(&users_lock);
+}
 
-	if (getpwuid_r(uid, &pwd, pwbuf, sizeof(pwbuf), &result) == 0 &&
-	    result != NULL) {
-		strlcpy(user, pwd.pw_name, size);
-		return;
+/**
+ * @brief Heartbeat callback resolving queued and expired cache entries.
+ * @param ctx Unused callback context.
+ */
+void
+metrics_process_users_refresh(void *ctx)
+{
+	uid_t todo[USERS_BATCH];
+	int ntodo = 0;
+	time_t now = time(NULL);
+
+	(void)ctx;
+	pthread_mutex_lock(&users_lock);
+	for (int i = 0; i < USERS_SLOTS && ntodo < USERS_BATCH; i++) {
+		metrics_user_t *u = &users[i];
+
+		if (u->state == USER_EMPTY)
+			continue;
+		if (now - u->used > USERS_IDLE)
+			u->state = USER_EMPTY;
+		else if (u->expires <= now)
+			todo[ntodo++] = u->uid;
+	}
+	pthread_mutex_unlock(&users_lock);
+
+	for (int i = 0; i < ntodo; i++) {
+		struct passwd pwd;
+		struct passwd *result = NULL;
+		char pwbuf[1024];
+		unsigned int h = (unsigned int)todo[i] * 2654435761U;
+		int found;
+
+		found = getpwuid_r(todo[i], &pwd, pwbuf, sizeof(pwbuf),
+		    &result) == 0 && result != NULL;
+		now = time(NULL);
+
+		pthread_mutex_lock(&users_lock);
+		for (int j = 0; j < USERS_PROBE; j++) {
+			metrics_user_t *u = &users[(h + j) % USERS_SLOTS];
+
+			if (u->state == USER_EMPTY || u->uid != todo[i])
+				continue;
+			if (found) {
+				u->state = USER_FOUND;
+				u->expires = now + USERS_TTL;
+				strlcpy(u->name, pwd.pw_name, sizeof(u->name));
+			} else {
+				/* Keep a name that was good: this may be an outage. */
+				if (u->state != USER_FOUND) {
+					u->state = USER_MISSING;
+					snprintf(u->name, sizeof(u->name), "%u",
+					    (unsigned int)todo[i]);
+				}
+				u->expires = now + USERS_NEG_TTL;
+			}
+			break;
+		}
+		pthread_mutex_unlock(&users_lock);
 	}
-	snprintf(user, size, "%u", (unsigned int)uid);
 }
 
+/*
+ * The process table is read once per metrics tick into a buffer kept
+ * across ticks. One pass over it counts the scheduler states and keeps
+ * the METRICS_TOP_PROCS heaviest processes by CPU and by RSS in two
+ * bounded min-heaps: O(n log k), no copy or sort of the whole table, and
+ * no allocation once the buffer fits. Only the winners get a user name,
+ * from the cache above. The JSON snapshot and the getters below all read
+ * the result; a reader only samples itself when the tick is overdue.
+ */
+
+#define METRICS_PROCS_MAX_AGE	2	/* seconds */
+
+typedef struct {
+	ProcessInfo top_cpu[METRICS_TOP_PROCS];
+	ProcessInfo top_mem[METRICS_TOP_PROCS];
+	int ncpu;
+	int nmem;
+	int total;
+	int running;
+	int sleeping;
+	int zombie;
+	time_t taken_at;		/* 0 until the first good sample */
+} metrics_procs_t;
+
+typedef struct {
+	uint64_t key;
+	size_t idx;			/* into procs_buf */
+} proc_heap_ent_t;
+
+/* Serialises sampling; owns the table buffer. */
+static pthread_mutex_t procs_sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kinfo_proc *procs_buf;
+static size_t procs_cap;		/* entries */
+
+static pthread_mutex_t procs_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_procs_t procs_snap;
+
 /**
- * @brief Snapshot the current process table.
+ * @brief Read the process table into procs_buf, growing it as needed.
  * @param nprocs Receives number of process entries.
- * @return Heap-allocated process array on success, NULL on failure.
+ * @return 0 on success, -1 on failure.
  */
-static struct kinfo_proc *
-metrics_get_procs_snapshot(size_t *nprocs)
+static int
+metrics_procs_read(size_t *nprocs)
 {
 	int mib[6];
 	size_t size;
-	struct kinfo_proc *kp = NULL;
+	size_t elem_size = sizeof(struct kinfo_proc);
+	size_t need;
 	int retry;
-	size_t elem_size;
-	int nelem;
 
 	mib[0] = CTL_KERN;
 	mib[1] = KERN_PROC;
 	mib[2] = KERN_PROC_ALL;
 	mib[3] = 0;
 	mib[4] = sizeof(struct kinfo_proc);
-	mib[5] = 0;
-	elem_size = sizeof(struct kinfo_proc);
 
 	for (retry = 0; retry < 4; retry++) {
-		if (sysctl(mib, 6, NULL, &size, NULL, 0) == -1) {
-			LOG("sysctl size query failed: %s", strerror(errno));
-			return NULL;
-		}
-
-		nelem = size / elem_size;
-		nelem = nelem * (5 + retry) / 4;
-		size = nelem * elem_size;
-		mib[5] = nelem;
-
-		kp = malloc(size);
-		if (kp == NULL) {
-			LOG("malloc failed for %zu bytes", size);
-			return NULL;
+		/* A buffer that fitted last tick usually fits: skip the probe. */
+		if (retry > 0 || procs_cap == 0) {
+			mib[5] = 0;
+			if (sysctl(mib, 6, NULL, &size, NULL, 0) == -1) {
+				LOG("sysctl size query failed: %s",
+				    strerror(errno));
+				return -1;
+			}
+			need = size / elem_size * (5 + retry) / 4;
+			if (need > procs_cap) {
+				struct kinfo_proc *kp = realloc(procs_buf,
+				    need * elem_size);
+
+				if (kp == NULL) {
+					LOG("malloc failed for %zu bytes",
+					    need * elem_size);
+					return -1;
+				}
+				procs_buf = kp;
+				procs_cap = need;
+			}
 		}
 
-		if (sysctl(mib, 6, kp, &size, NULL, 0) == 0) {
+		mib[5] = (int)procs_cap;
+		size = procs_cap * elem_size;
+		if (sysctl(mib, 6, procs_buf, &size, NULL, 0) == 0) {
 			*nprocs = size / elem_size;
-			return kp;
+			return 0;
 		}
-
 		if (errno != ENOMEM) {
 			LOG("sysctl data query failed: %s", strerror(errno));
-			free(kp);
-			return NULL;
+			return -1;
 		}
-		free(kp);
-		kp = NULL;
 	}
 
 	LOG("Failed to get process list after %d retries", retry);
-	return NULL;
+	return -1;
 }
 
 /**
- * @brief Build top-process and process-stats JSON sections.
- * @param top_cpu_json Output buffer for top CPU processes section.
- * @param top_cpu_json_size Size of top_cpu_json.
- * @param top_mem_json Output buffer for top memory processes section.
- * @param top_mem_json_size Size of top_mem_json.
- * @param proc_stats_json Output buffer for process stats section.
- * @param proc_stats_json_size Size of proc_stats_json.
+ * @brief Offer entry @p idx to a bounded min-heap of the largest keys.
+ * @param h Heap of METRICS_TOP_PROCS entries; h[0] is the smallest kept.
+ * @param n Entries in use, advanced while the heap fills.
+ * @param key Sort key of the entry.
+ * @param idx Index of the entry in the process table.
+ */
+static void
+proc_heap_offer(proc_heap_ent_t *h, int *n, uint64_t key, size_t idx)
+{
+	int i, c;
+
+	if (*n < METRICS_TOP_PROCS) {
+		for (i = (*n)++; i > 0 && h[(i - 1) / 2].key > key;
+		    i = (i - 1) / 2)
+			h[i] = h[(i - 1) / 2];
+		h[i].key = key;
+		h[i].idx = idx;
+		return;
+	}
+	if (key <= h[0].key)
+		return;
+	for (i = 0; (c = 2 * i + 1) < *n; i = c) {
+		if (c + 1 < *n && h[c + 1].key < h[c].key)
+			c++;
+		if (h[c].key >= key)
+			break;
+		h[i] = h[c];
+	}
+	h[i].key = key;
+	h[i].idx = idx;
+}
+
+/** Order the @p n kept entries of @p h largest first. */
+static void
+proc_heap_sort_desc(proc_heap_ent_t *h, int n)
+{
+	for (int i = 1; i < n; i++) {
+		proc_heap_ent_t e = h[i];
+		int j;
+
+		for (j = i; j > 0 && h[j - 1].key < e.key; j--)
+			h[j] = h[j - 1];
+		h[j] = e;
+	}
+}
+
+/** Fill @p info from table entry @p kp. */
+static void
+metrics_proc_info(const struct kinfo_proc *kp, ProcessInfo *info,
+    long page_size, long total_memory_kb)
+{
+	long mem_kb = ((long)kp->p_vm_rssize * page_size) / 1024;
+
+	info->pid = kp->p_pid;
+	info->cpu_percent = (100.0f * kp->p_pctcpu) / FSCALE;
+	info->memory_mb = (int)(mem_kb / 1024);
+	info->memory_percent = total_memory_kb > 0 ?
+	    (100.0f * mem_kb) / total_memory_kb : 0.0f;
+	strlcpy(info->command, kp->p_comm, sizeof(info->command));
+	metrics_resolve_username(kp->p_uid, info->user, sizeof(info->user));
+}
+
+/**
+ * @brief Sample the process table and publish the top lists and counts.
+ *
+ * @details Called by the metrics heartbeat once per tick, before the
+ * snapshot is rebuilt from it.
  */
 void
-metrics_process_append_json_sections(char *top_cpu_json, size_t top_cpu_json_size,
-    char *top_mem_json, size_t top_mem_json_size, char *proc_stats_json,
-    size_t proc_stats_json_size)
+metrics_process_sample(void)
 {
+	proc_heap_ent_t cpu[METRICS_TOP_PROCS];
+	proc_heap_ent_t mem[METRICS_TOP_PROCS];
+	metrics_procs_t snap;
+	MemoryStats mem_stats;
+	long total_memory_kb = 0;
+	long page_size = sysconf(_SC_PAGESIZE);
 	size_t nprocs = 0;
-	struct kinfo_proc *kp = metrics_get_procs_snapshot(&nprocs);
-	if (!kp) {
-		snprintf(top_cpu_json, top_cpu_json_size,
-		    "\"top_cpu_processes\": []");
-		snprintf(top_mem_json, top_mem_json_size,
-		    "\"top_memory_processes\": []");
-		snprintf(proc_stats_json, proc_stats_json_size,
-		    "\"process_stats\": null");
+
+	if (metrics_get_memory_stats(&mem_stats) == 0)
+		total_memory_kb = mem_stats.total_mb * 1024;
+
+	pthread_mutex_lock(&procs_sample_lock);
+	if (metrics_procs_read(&nprocs) != 0) {
+		pthread_mutex_unlock(&procs_sample_lock);
 		return;
 	}
 
-	int total = (int)nprocs;
-	int running = 0;
-	int sleeping = 0;
-	int zombie = 0;
+	memset(&snap, 0, sizeof(snap));
+	snap.total = (int)nprocs;
 	for (size_t i = 0; i < nprocs; i++) {
-		if (kp[i].p_stat == SRUN || kp[i].p_stat == SONPROC)
-			running++;
-		else if (kp[i].p_stat == SSLEEP)
-			sleeping++;
-		else if (kp[i].p_stat == SZOMB)
-			zombie++;
-	}
-	snprintf(proc_stats_json, proc_stats_json_size,
-	    "\"process_stats\": {\"total\": %d, \"running\": %d, "
-	    "\"sleeping\": %d, \"zombie\": %d}", total, running, sleeping,
-	    zombie);
-
-	ProcessInfo top_cpu[10];
-	int top_cpu_count = 0;
-	for (size_t i = 0; i < nprocs && top_cpu_count < 10; i++) {
-		if (kp[i].p_stat == SZOMB)
+		const struct kinfo_proc *kp = &procs_buf[i];
+
+		if (kp->p_stat == SRUN || kp->p_stat == SONPROC)
+			snap.running++;
+		else if (kp->p_stat == SSLEEP)
+			snap.sleeping++;
+		else if (kp->p_stat == SZOMB) {
+			snap.zombie++;
 			continue;
-		top_cpu[top_cpu_count].pid = kp[i].p_pid;
-		top_cpu[top_cpu_count].cpu_percent = (100.0f * kp[i].p_pctcpu) / FSCALE;
-		strlcpy(top_cpu[top_cpu_count].command, kp[i].p_comm,
-		    sizeof(top_cpu[top_cpu_count].command));
-		metrics_resolve_username(kp[i].p_uid, top_cpu[top_cpu_count].user,
-		    sizeof(top_cpu[top_cpu_count].user));
-		top_cpu_count++;
-	}
-	for (int i = 0; i < top_cpu_count - 1; i++) {
-		for (int j = 0; j < top_cpu_count - i - 1; j++) {
-			if (top_cpu[j].cpu_percent < top_cpu[j + 1].cpu_percent) {
-				ProcessInfo tmp = top_cpu[j];
-				top_cpu[j] = top_cpu[j + 1];
-				top_cpu[j + 1] = tmp;
-			}
 		}
+		proc_heap_offer(cpu, &snap.ncpu, kp->p_pctcpu, i);
+		proc_heap_offer(mem, &snap.nmem, (uint64_t)kp->p_vm_rssize, i);
 	}
 
-	char *cpu_ptr = top_cpu_json;
-	size_t cpu_left = top_cpu_json_size;
-	int w = snprintf(cpu_ptr, cpu_left, "\"top_cpu_processes\": [");
-	cpu_ptr += w;
-	cpu_left -= (size_t)w;
-	for (int i = 0; i < top_cpu_count && cpu_left > 100; i++) {
-		if (i > 0) {
-			w = snprintf(cpu_ptr, cpu_left, ", ");
-			cpu_ptr += w;
-			cpu_left -= (size_t)w;
-		}
-		w = snprintf(cpu_ptr, cpu_left,
-		    "{\"user\": \"%s\", \"pid\": %d, \"cpu_percent\": %.1f, "
-		    "\"command\": \"%s\"}",
-		    top_cpu[i].user, top_cpu[i].pid, top_cpu[i].cpu_percent,
-		    top_cpu[i].command);
-		cpu_ptr += w;
-		cpu_left -= (size_t)w;
-	}
-	snprintf(cpu_ptr, cpu_left, "]");
+	proc_heap_sort_desc(cpu, snap.ncpu);
+	proc_heap_sort_desc(mem, snap.nmem);
+	for (int i = 0; i < snap.ncpu; i++)
+		metrics_proc_info(&procs_buf[cpu[i].idx], &snap.top_cpu[i],
+		    page_size, total_memory_kb);
+	for (int i = 0; i < snap.nmem; i++)
+		metrics_proc_info(&procs_buf[mem[i].idx], &snap.top_mem[i],
+		    page_size, total_memory_kb);
+	pthread_mutex_unlock(&procs_sample_lock);
+
+	snap.taken_at = time(NULL);
+	pthread_mutex_lock(&procs_lock);
+	procs_snap = snap;
+	pthread_mutex_unlock(&procs_lock);
+}
+
+/**
+ * @brief Copy the current process sample, taking one if it is overdue.
+ * @param out Receives the sample.
+ * @return 0 on success, -1 when no sample could be taken.
+ */
+static int
+metrics_procs_get(metrics_procs_t *out)
+{
+	time_t now = time(NULL);
+	int stale;
+
+	pthread_mutex_lock(&procs_lock);
+	stale = procs_snap.taken_at == 0 ||
+	    now - procs_snap.taken_at > METRICS_PROCS_MAX_AGE;
+	pthread_mutex_unlock(&procs_lock);
+	if (stale)
+		metrics_process_sample();
+
+	pthread_mutex_lock(&procs_lock);
+	*out = procs_snap;
+	pthread_mutex_unlock(&procs_lock);
+	return out->taken_at != 0 ? 0 : -1;
+}
+
+/**
+ * @brief Append the top-process lists and the process counts.
+ *
+ * @details The three members come from one sample, so they agree.
+ *
+ * @param w Destination JSON writer.
+ */
+void
+metrics_process_append_json(json_writer_t *w)
+{
+	metrics_procs_t snap;
 
-	struct kinfo_proc *kmem = malloc(nprocs * sizeof(struct kinfo_proc));
-	if (!kmem) {
-		snprintf(top_mem_json, top_mem_json_size,
-		    "\"top_memory_processes\": []");
-		free(kp);
+	if (metrics_procs_get(&snap) != 0) {
+		json_puts(w, "\"top_cpu_processes\": [], "
+		    "\"top_memory_processes\": [], \"process_stats\": null");
 		return;
 	}
-	memcpy(kmem, kp, nprocs * sizeof(struct kinfo_proc));
-	qsort(kmem, nprocs, sizeof(struct kinfo_proc), compare_memory_desc);
 
-	MemoryStats mem_stats;
-	long total_memory_kb = 0;
-	if (metrics_get_memory_stats(&mem_stats) == 0)
-		total_memory_kb = mem_stats.total_mb * 1024;
-	long page_size = sysconf(_SC_PAGESIZE);
+	json_puts(w, "\"top_cpu_processes\": [");
+	for (int i = 0; i < snap.ncpu; i++) {
+		const ProcessInfo *p = &snap.top_cpu[i];
 
-	char *mem_ptr = top_mem_json;
-	size_t mem_left = top_mem_json_size;
-	w = snprintf(mem_ptr, mem_left, "\"top_memory_processes\": [");
-	mem_ptr += w;
-	mem_left -= (size_t)w;
+		json_puts(w, i > 0 ? ", {\"user\": " : "{\"user\": ");
+		json_str(w, p->user);
+		json_printf(w, ", \"pid\": %d, \"cpu_percent\": %.1f, "
+		    "\"command\": ", p->pid, p->cpu_percent);
+		json_str(w, p->command);
+		json_putc(w, '}');
+	}
 
-	int mem_count = 0;
-	for (size_t i = 0; i < nprocs && mem_count < 10 && mem_left > 100; i++) {
-		if (kmem[i].p_stat == SZOMB)
-			continue;
-		ProcessInfo proc;
-		proc.pid = kmem[i].p_pid;
-		proc.memory_mb = (kmem[i].p_vm_rssize * page_size) / (1024 * 1024);
-		if (total_memory_kb > 0) {
-			long mem_kb = (kmem[i].p_vm_rssize * page_size) / 1024;
-			proc.memory_percent = (100.0f * mem_kb) / total_memory_kb;
-		} else {
-			proc.memory_percent = 0.0f;
-		}
-		strlcpy(proc.command, kmem[i].p_comm, sizeof(proc.command));
-		metrics_resolve_username(kmem[i].p_uid, proc.user,
-		    sizeof(proc.user));
-		if (mem_count > 0) {
-			w = snprintf(mem_ptr, mem_left, ", ");
-			mem_ptr += w;
-			mem_left -= (size_t)w;
-		}
-		w = snprintf(mem_ptr, mem_left,
-		    "{\"user\": \"%s\", \"pid\": %d, \"memory_percent\": %.1f, "
-		    "\"memory_mb\": %d, \"command\": \"%s\"}",
-		    proc.user, proc.pid, proc.memory_percent, proc.memory_mb,
-		    proc.command);
-		mem_ptr += w;
-		mem_left -= (size_t)w;
-		mem_count++;
+	json_puts(w, "], \"top_memory_processes\": [");
+	for (int i = 0; i < snap.nmem; i++) {
+		const ProcessInfo *p = &snap.top_mem[i];
+
+		json_puts(w, i > 0 ? ", {\"user\": " : "{\"user\": ");
+		json_str(w, p->user);
+		json_printf(w, ", \"pid\": %d, \"memory_percent\": %.1f, "
+		    "\"memory_mb\": %d, \"command\": ", p->pid,
+		    p->memory_percent, p->memory_mb);
+		json_str(w, p->command);
+		json_putc(w, '}');
 	}
-	snprintf(mem_ptr, mem_left, "]");
 
-	free(kmem);
-	free(kp);
+	json_printf(w, "], \"process_stats\": {\"total\": %d, "
+	    "\"running\": %d, \"sleeping\": %d, \"zombie\": %d}",
+	    snap.total, snap.running, snap.sleeping, snap.zombie);
 }
 
 /**
  * @brief Collect top processes sorted by CPU usage.
  * @param processes Output array receiving process rows.
  * @param max_processes Maximum number of processes to return.
- * @return Number of entries written.
+ * @return Number of entries written, at most METRICS_TOP_PROCS.
  */
 int
 metrics_get_top_cpu_processes(ProcessInfo *processes, int max_processes)
 {
-	size_t nprocs = 0;
-	struct kinfo_proc *kp = metrics_get_procs_snapshot(&nprocs);
-	if (!kp)
-		return 0;
+	metrics_procs_t snap;
+	int count;
 
-	ProcessInfo *temp = calloc(nprocs, sizeof(ProcessInfo));
-	if (!temp) {
-		free(kp);
+	if (metrics_procs_get(&snap) != 0)
 		return 0;
-	}
-
-	int valid_count = 0;
-	for (size_t i = 0; i < nprocs; i++) {
-		if (kp[i].p_stat == SZOMB)
-			continue;
-		temp[valid_count].pid = kp[i].p_pid;
-		temp[valid_count].cpu_percent = (100.0f * kp[i].p_pctcpu) / FSCALE;
-		strlcpy(temp[valid_count].command, kp[i].p_comm,
-		    sizeof(temp[valid_count].command));
-		metrics_resolve_username(kp[i].p_uid, temp[valid_count].user,
-		    sizeof(temp[valid_count].user));
-		valid_count++;
-	}
-
-	for (int i = 0; i < valid_count - 1; i++) {
-		for (int j = 0; j < valid_count - i - 1; j++) {
-			if (temp[j].cpu_percent < temp[j + 1].cpu_percent) {
-				ProcessInfo swap = temp[j];
-				temp[j] = temp[j + 1];
-				temp[j + 1] = swap;
-			}
-		}
-	}
-
-	int count = (valid_count < max_processes) ? valid_count : max_processes;
+	count = snap.ncpu < max_processes ? snap.ncpu : max_processes;
 	for (int i = 0; i < count; i++)
-		processes[i] = temp[i];
-
-	free(temp);
-	free(kp);
+		processes[i] = snap.top_cpu[i];
 	return count;
 }
 
@@ -322,47 +469,19 @@ metrics_get_top_cpu_processes(ProcessInfo *processes, int max_processes)
  * @brief Collect top processes sorted by memory usage.
  * @param processes Output array receiving process rows.
  * @param max_processes Maximum number of processes to return.
- * @return Number of entries written.
+ * @return Number of entries written, at most METRICS_TOP_PROCS.
  */
 int
 metrics_get_top_memory_processes(ProcessInfo *processes, int max_processes)
 {
-	size_t nprocs = 0;
-	struct kinfo_proc *kp = metrics_get_procs_snapshot(&nprocs);
-	if (!kp)
-		return 0;
+	metrics_procs_t snap;
+	int count;
 
-	qsort(kp, nprocs, sizeof(struct kinfo_proc), compare_memory_desc);
-
-	MemoryStats mem_stats;
-	long total_memory_kb = 0;
-	if (metrics_get_memory_stats(&mem_stats) == 0)
-		total_memory_kb = mem_stats.total_mb * 1024;
-
-	int count = 0;
-	long page_size = sysconf(_SC_PAGESIZE);
-	for (size_t i = 0; i < nprocs && count < max_processes; i++) {
-		if (kp[i].p_stat == SZOMB)
-			continue;
-
-		processes[count].pid = kp[i].p_pid;
-		processes[count].memory_mb =
-		    (kp[i].p_vm_rssize * page_size) / (1024 * 1024);
-		if (total_memory_kb > 0) {
-			long mem_kb = (kp[i].p_vm_rssize * page_size) / 1024;
-			processes[count].memory_percent =
-			    (100.0f * mem_kb) / total_memory_kb;
-		} else {
-			processes[count].memory_percent = 0.0f;
-		}
-		strlcpy(processes[count].command, kp[i].p_comm,
-		    sizeof(processes[count].command));
-		metrics_resolve_username(kp[i].p_uid, processes[count].user,
-		    sizeof(processes[count].user));
-		count++;
-	}
-
-	free(kp);
+	if (metrics_procs_get(&snap) != 0)
+		return 0;
+	count = snap.nmem < max_processes ? snap.nmem : max_processes;
+	for (int i = 0; i < count; i++)
+		processes[i] = snap.top_mem[i];
 	return count;
 }
 
@@ -377,23 +496,30 @@ metrics_get_top_memory_processes(ProcessInfo *processes, int max_processes)
 int
 metrics_get_process_stats(int *total, int *running, int *sleeping, int *zombie)
 {
-	size_t nprocs = 0;
-	struct kinfo_proc *kp = metrics_get_procs_snapshot(&nprocs);
-	if (!kp)
-		return -1;
+	metrics_procs_t snap;
 
-	*total = (int)nprocs;
-	*running = 0;
-	*sleeping = 0;
-	*zombie = 0;
-	for (size_t i = 0; i < nprocs; i++) {
-		if (kp[i].p_stat == SRUN || kp[i].p_stat == SONPROC)
-			(*running)++;
-		else if (kp[i].p_stat == SSLEEP)
-			(*sleeping)++;
-		else if (kp[i].p_stat == SZOMB)
-			(*zombie)++;
-	}
-	free(kp);
+	if (metrics_procs_get(&snap) != 0)
+		return -1;
+	*total = snap.total;
+	*running = snap.running;
+	*sleeping = snap.sleeping;
+	*zombie = snap.zombie;
 	return 0;
 }
+
+/** Free the process table buffer, forget the last sample and the names. */
+void
+metrics_process_cleanup(void)
+{
+	pthread_mutex_lock(&procs_sample_lock);
+	free(procs_buf);
+	procs_buf = NULL;
+	procs_cap = 0;
+	pthread_mutex_unlock(&procs_sample_lock);
+	pthread_mutex_lock(&procs_lock);
+	memset(&procs_snap, 0, sizeof(procs_snap));
+	pthread_mutex_unlock(&procs_lock);
+	pthread_mutex_lock(&users_lock);
+	memset(users, 0, sizeof(users));
+	pthread_mutex_unlock(&users_lock);
+}
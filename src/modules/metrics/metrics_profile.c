@@ -0,0 +1,110 @@
+/* metrics_profile.c - folded stacks from the sampling profiler */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/profile.h>
+#include <miniweb/http/gzip.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+
+/** Value of integer query parameter @p name: 1 set, 0 absent, -1 bad. */
+static int
+profile_param(const char *q, const char *name, int *out)
+{
+	size_t nlen = strlen(name);
+
+	while (q && *q) {
+		if (strncmp(q, name, nlen) == 0 && q[nlen] == '=') {
+			char *end;
+			long v = strtol(q + nlen + 1, &end, 10);
+
+			if (end == q + nlen + 1 || v < 0 || v > 1000000 ||
+			    (*end != '\0' && *end != '&'))
+				return -1;
+			*out = (int)v;
+			return 1;
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return 0;
+}
+
+/**
+ * @brief Handle GET /api/stats/profile[?raw=1].
+ *
+ * @details One line per distinct stack, root first and most frequent
+ * first, as flamegraph.pl and speedscope read them. Frame addresses are
+ * exposed, so only loopback clients are answered.
+ *
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_profile_handler(http_request_t *req)
+{
+	http_response_t *resp;
+	char hdr[32], *text;
+	size_t len;
+	int raw = 0, rc;
+
+	if (!metrics_admin_local(req))
+		return http_send_error(req, 403, "Loopback clients only");
+	if (profile_param(http_request_query(req), "raw", &raw) < 0)
+		return http_send_error(req, 400, "Invalid raw parameter");
+	if ((text = profile_folded(raw, &len)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	if ((resp = http_response_create()) == NULL) {
+		free(text);
+		return http_send_error(req, 500, "Unable to allocate response");
+	}
+	http_response_set_status(resp, 200);
+	resp->content_type = "text/plain; charset=utf-8";
+	snprintf(hdr, sizeof(hdr), "%d", profile_hz());
+	http_response_add_header(resp, "X-Profile-Hz", hdr);
+	snprintf(hdr, sizeof(hdr), "%lu", profile_samples());
+	http_response_add_header(resp, "X-Profile-Samples", hdr);
+	http_response_add_header(resp, "Cache-Control", "no-store");
+	http_response_set_body(resp, text, len, 1);
+	http_response_gzip(req, resp);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
+}
+
+/**
+ * @brief Handle POST /api/admin/profile?hz=<n>: start, retune or stop
+ * (hz=0) sampling until the next reload applies profile_hz again.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_profile_admin_handler(http_request_t *req)
+{
+	json_writer_t w;
+	char *json;
+	int hz, rc;
+
+	if (!metrics_admin_local(req))
+		return http_send_error(req, 403, "Loopback clients only");
+	if (profile_param(http_request_query(req), "hz", &hz) != 1)
+		return http_send_error(req, 400, "Expected hz=<n>");
+	if (profile_enable(hz) != 0)
+		return http_send_error(req, 500, "Unable to start the profiler");
+
+	if (json_init(&w, req->arena, 128) == 0)
+		json_printf(&w, "{\"profile\": {\"hz\": %d, \"samples\": %lu}}",
+		    profile_hz(), profile_samples());
+	if ((json = json_finish(&w, NULL)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	rc = http_send_json(req, json);
+	if (req->arena == NULL)
+		free(json);
+	return rc;
+}
@@ -15,10 +15,15 @@
 #include <miniweb/core/config.h>
 #include <miniweb/core/heartbeat.h>
 #include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/snapshot_delta.h>
+#include <miniweb/http/gzip.h>
 #include <miniweb/modules/metrics.h>
 #include <miniweb/modules/metrics_internal.h>
+#include <miniweb/router/route_stats.h>
 
-#define JSON_BUFFER_SIZE 65536
+#define METRICS_JSON_HINT 65536	/* first payload's buffer */
+#define METRICS_ROUTES_JSON_MAX 8192
 #define RING_CAPACITY (1024 * 1024 / sizeof(MetricSample))
 #define METRICS_HISTORY_WINDOW 120
 
@@ -36,6 +41,7 @@ typedef struct {
 	MetricSample *buf;
 	size_t head;
 	size_t count;
+	MetricTiers tiers;	/* downsampled as samples are pushed */
 	pthread_mutex_t lock;
 } MetricRing;
 
@@ -43,9 +49,20 @@ static MetricRing g_metrics_ring;
 static pthread_once_t g_metrics_once = PTHREAD_ONCE_INIT;
 static int g_metrics_ring_ready = 0;
 
+/*
+ * Readers take the published snapshot by reference without a lock; the
+ * snapshot lock only keeps the delta state below in step with it.
+ */
+static snapshot_slot_t g_metrics_slot = SNAPSHOT_SLOT_INITIALIZER;
 static pthread_mutex_t g_metrics_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
-static char *g_metrics_snapshot_json = NULL;
-static time_t g_metrics_snapshot_updated_at = 0;
+static unsigned long g_metrics_snapshot_version = 0;	/* update lock */
+static int64_t g_metrics_snapshot_ts = 0;	/* newest sample in it */
+static snapshot_span_t g_metrics_spans[SNAPSHOT_DELTA_SECTIONS];
+static size_t g_metrics_nspans = 0;
+static snapshot_delta_t g_metrics_delta;
+static size_t g_metrics_json_hint = METRICS_JSON_HINT;	/* update lock */
+/* One snapshot is built at a time, so its version is known up front. */
+static pthread_mutex_t g_metrics_update_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int ring_init(MetricRing *r);
 static void ring_push(MetricRing *r, const MetricSample *s);
@@ -56,7 +73,8 @@ static void metrics_heartbeat_cb(void *ctx);
 static void metrics_take_sample(MetricSample *sample);
 static int metrics_read_cpu_ticks(uint64_t *total_ticks, uint64_t *idle_ticks);
 static char *build_system_metrics_json(MetricSample *history,
-					       size_t history_count);
+    size_t history_count, unsigned long version, snapshot_span_t *spans,
+    size_t *nspans);
 static void metrics_snapshot_update(void);
 
 /**
@@ -107,6 +125,11 @@ ring_init(MetricRing *r)
 	r->buf = malloc(RING_CAPACITY * sizeof(MetricSample));
 	if (!r->buf)
 		return -1;
+	if (metric_tiers_init(&r->tiers) != 0) {
+		free(r->buf);
+		r->buf = NULL;
+		return -1;
+	}
 	r->head = 0;
 	r->count = 0;
 	pthread_mutex_init(&r->lock, NULL);
@@ -126,6 +149,7 @@ ring_push(MetricRing *r, const MetricSample *s)
 	r->head = (r->head + 1) % RING_CAPACITY;
 	if (r->count < RING_CAPACITY)
 		r->count++;
+	metric_tiers_push(&r->tiers, s);
 	pthread_mutex_unlock(&r->lock);
 }
 
@@ -163,6 +187,7 @@ static void
 ring_free(MetricRing *r)
 {
 	free(r->buf);
+	metric_tiers_free(&r->tiers);
 	pthread_mutex_destroy(&r->lock);
 	r->buf = NULL;
 	r->count = 0;
@@ -233,7 +258,18 @@ metrics_heartbeat_cb(void *ctx)
 	(void)ctx;
 	metrics_take_sample(&sample);
 	ring_push(&g_metrics_ring, &sample);
+	metrics_store_add(&sample);
+	metrics_process_sample();
 	metrics_snapshot_update();
+	metrics_sse_publish();
+	metrics_openmetrics_update(&sample);
+}
+
+/** metrics_store_reload() callback: refill the ring, and so the tiers. */
+static void
+metrics_reload_push(const MetricSample *s, void *ctx)
+{
+	ring_push(ctx, s);
 }
 
 /**
@@ -248,6 +284,13 @@ metrics_ring_bootstrap(void)
 		LOG("Failed to allocate 1MB metrics ring");
 		return;
 	}
+	(void)mem_budget_register_fixed("metrics_ring",
+	    RING_CAPACITY * sizeof(MetricSample));
+	/* History from before a restart, when a store is open. */
+	int64_t reloaded = metrics_store_reload((int64_t)time(NULL) -
+	    METRIC_TIER_MAX_SPAN, metrics_reload_push, &g_metrics_ring);
+	if (reloaded > 0)
+		LOG("Reloaded %lld stored samples", (long long)reloaded);
 	/*
 	 * heartbeat_register() returns HB_REGISTER_INSERTED (1) on success,
 	 * HB_REGISTER_DUPLICATE (0) if the task name was already registered,
@@ -265,6 +308,23 @@ metrics_ring_bootstrap(void)
 		ring_free(&g_metrics_ring);
 		return;
 	}
+	/* Sampling only reads the user name cache; this fills it. */
+	if (heartbeat_register(&(struct hb_task){
+		.name = "metrics.users",
+		.period_sec = 1,
+		.initial_delay_sec = 0,
+		.cb = metrics_process_users_refresh,
+		.ctx = NULL,
+	    }) < 0)
+		LOG("Failed to register user name refresh task");
+	if (heartbeat_register(&(struct hb_task){
+		.name = "metrics.disks",
+		.period_sec = 5,
+		.initial_delay_sec = 0,
+		.cb = metrics_disk_collect,
+		.ctx = NULL,
+	    }) < 0)
+		LOG("Failed to register disk collector task");
 	if (heartbeat_start() != 0) {
 		LOG("Failed to start heartbeat scheduler");
 		ring_free(&g_metrics_ring);
@@ -276,37 +336,83 @@ metrics_ring_bootstrap(void)
 	metrics_snapshot_update();
 }
 
+/**
+ * @brief Append one member of the payload, recording where it went.
+ * @param w Payload being written.
+ * @param fn Appender of the member, or members.
+ * @param spans Receives the member's span.
+ * @param nspans Number of spans recorded so far, advanced.
+ */
+static void
+metrics_json_member(json_writer_t *w, void (*fn)(json_writer_t *),
+    snapshot_span_t *spans, size_t *nspans)
+{
+	size_t start;
+
+	if (w->len > 1)
+		json_putc(w, ',');
+	start = w->len;
+	fn(w);
+	if (*nspans < SNAPSHOT_DELTA_SECTIONS) {
+		spans[*nspans].off = start;
+		spans[*nspans].len = w->len - start;
+		(*nspans)++;
+	}
+}
+
+/** route_stats_append_json() into the writer. */
+static void
+metrics_json_append_routes(json_writer_t *w)
+{
+	char *p = json_reserve(w, METRICS_ROUTES_JSON_MAX);
+
+	if (p != NULL) {
+		route_stats_append_json(p, METRICS_ROUTES_JSON_MAX, 0);
+		json_commit(w, strlen(p));
+	}
+}
+
 /**
  * @brief Build a complete metrics JSON payload.
  * @param history History ring samples in chronological order.
  * @param history_count Number of samples in history.
+ * @param version Version the payload will be published as.
+ * @param spans Receives the span of each member but the history.
+ * @param nspans Receives the number of spans.
  * @return Heap-allocated JSON string on success, NULL on failure.
  */
 static char *
-build_system_metrics_json(MetricSample *history, size_t history_count)
+build_system_metrics_json(MetricSample *history, size_t history_count,
+    unsigned long version, snapshot_span_t *spans, size_t *nspans)
 {
-	char *json = malloc(JSON_BUFFER_SIZE);
-	if (!json) {
-		LOG("Failed to allocate JSON buffer");
-		return NULL;
-	}
-
+	static void (*const members[])(json_writer_t *) = {
+		metrics_json_append_cpu_stats,
+		metrics_json_append_memory_stats,
+		metrics_json_append_load_average,
+		metrics_json_append_os_info,
+		metrics_json_append_uptime,
+		metrics_json_append_disk_info,
+		metrics_json_append_top_ports,
+		metrics_process_append_json,
+		metrics_json_append_cpu_freq,
+		metrics_json_append_worker_pool,
+		metrics_json_append_view_cache,
+		metrics_json_append_server,
+		metrics_json_append_routes,
+	};
+	json_writer_t w;
 	char timestamp[64];
 	char hostname[256];
 	time_t now;
 	struct tm tm_buf;
-	char cpu_json[256];
-	char memory_json[512];
-	char load_json[256];
-	char os_json[512];
-	char uptime_json[256];
-	char disks_json[2048];
-	char ports_json[2048];
-	char top_cpu_json[2048];
-	char top_mem_json[2048];
-	char proc_stats_json[256];
-	char cpu_freq_json[64];
-	char history_json[32768];
+	size_t start;
+	char *json;
+
+	/* About the size of the last one, so it rarely grows. */
+	if (json_init(&w, NULL, g_metrics_json_hint) != 0) {
+		LOG("Failed to allocate JSON buffer");
+		return NULL;
+	}
 
 	time(&now);
 	struct tm *tm_ptr = localtime_r(&now, &tm_buf);
@@ -320,43 +426,43 @@ build_system_metrics_json(MetricSample *history, size_t history_count)
 	if (metrics_get_hostname(hostname, sizeof(hostname)) == -1)
 		strlcpy(hostname, "localhost", sizeof(hostname));
 
-	metrics_json_append_cpu_stats(cpu_json, sizeof(cpu_json));
-	metrics_json_append_memory_stats(memory_json, sizeof(memory_json));
-	metrics_json_append_load_average(load_json, sizeof(load_json));
-	metrics_json_append_os_info(os_json, sizeof(os_json));
-	metrics_json_append_uptime(uptime_json, sizeof(uptime_json));
-	metrics_json_append_disk_info(disks_json, sizeof(disks_json));
-	metrics_json_append_top_ports(ports_json, sizeof(ports_json));
-	metrics_json_append_cpu_freq(cpu_freq_json, sizeof(cpu_freq_json));
-	metrics_process_append_json_sections(top_cpu_json,
-	    sizeof(top_cpu_json), top_mem_json, sizeof(top_mem_json),
-	    proc_stats_json, sizeof(proc_stats_json));
-	metrics_json_append_history(history_json, sizeof(history_json), history,
-				    history_count);
-
-	snprintf(json, JSON_BUFFER_SIZE,
-		"{"
-		"\"timestamp\": \"%s\","
-		"\"hostname\": \"%s\","
-		"%s,"   // cpu_json
-		"%s,"   // memory_json
-		"%s,"   // load_json
-		"%s,"   // os_json
-		"%s,"   // uptime_json
-		"%s,"   // disks_json
-		"%s,"   // ports_json
-		"%s,"   // top_cpu_json
-		"%s,"   // top_mem_json
-		"%s,"   // proc_stats_json
-		"%s,"   // cpu_freq_json
-		"%s"    // history_json
-		"}",
-		timestamp, hostname, cpu_json, memory_json, load_json, os_json,
-		uptime_json, disks_json, ports_json, top_cpu_json,
-		top_mem_json, proc_stats_json, cpu_freq_json, history_json);
+	/* Every member but the history is a span a delta may resend. */
+	*nspans = 0;
+	json_putc(&w, '{');
+	start = w.len;
+	json_puts(&w, "\"timestamp\": ");
+	json_str(&w, timestamp);
+	json_puts(&w, ",\"hostname\": ");
+	json_str(&w, hostname);
+	json_printf(&w, ",\"version\": %lu", version);
+	spans[0].off = start;
+	spans[0].len = w.len - start;
+	*nspans = 1;
+	for (size_t i = 0; i < sizeof(members) / sizeof(members[0]); i++)
+		metrics_json_member(&w, members[i], spans, nspans);
+	json_putc(&w, ',');
+	metrics_json_append_history(&w, history, history_count);
+	json_putc(&w, '}');
+
+	if ((json = json_finish(&w, &start)) == NULL) {
+		LOG("Failed to allocate JSON buffer");
+		return NULL;
+	}
+	g_metrics_json_hint = start + start / 8;
 	return json;
 }
 
+/** Free a snapshot once its last reader has released it. */
+static void
+metrics_snap_free(snapshot_t *s)
+{
+	metrics_snap_t *snap = (metrics_snap_t *)s;
+
+	free(snap->json);
+	http_blob_release(snap->gz);
+	free(snap);
+}
+
 /**
  * @brief metrics_snapshot_update operation.
  *
@@ -366,59 +472,326 @@ static void
 metrics_snapshot_update(void)
 {
 	MetricSample history[METRICS_HISTORY_WINDOW];
+	snapshot_span_t spans[SNAPSHOT_DELTA_SECTIONS];
+	metrics_snap_t *snap;
+	size_t nspans;
+	unsigned long version;
+	int64_t ts;
+
+	pthread_mutex_lock(&g_metrics_update_lock);
 	size_t history_count =
 	    ring_last(&g_metrics_ring, METRICS_HISTORY_WINDOW, history);
-	char *json = build_system_metrics_json(history, history_count);
-	if (!json)
+	ts = history_count ? history[history_count - 1].ts :
+	    (int64_t)time(NULL);
+	version = g_metrics_snapshot_version + 1;
+
+	char *json = build_system_metrics_json(history, history_count,
+	    version, spans, &nspans);
+	if (!json || (snap = calloc(1, sizeof(*snap))) == NULL) {
+		free(json);
+		pthread_mutex_unlock(&g_metrics_update_lock);
 		return;
+	}
+	snapshot_init(&snap->hdr, metrics_snap_free);
+	snap->json = json;
+	snap->len = strlen(json);
+	/* Compressed once here, before publishing, for every gzip client. */
+	snap->gz = http_gzip_blob(json, snap->len);
+	snap->version = version;
+	snap->updated_at = time(NULL);
+	g_metrics_snapshot_version = version;
 
 	pthread_mutex_lock(&g_metrics_snapshot_lock);
-	free(g_metrics_snapshot_json);
-	g_metrics_snapshot_json = json;
-	g_metrics_snapshot_updated_at = time(NULL);
+	snapshot_publish(&g_metrics_slot, &snap->hdr);
+	g_metrics_snapshot_ts = ts;
+	memcpy(g_metrics_spans, spans, nspans * sizeof(spans[0]));
+	g_metrics_nspans = nspans;
+	snapshot_delta_publish(&g_metrics_delta, version, ts, json, spans,
+	    nspans);
 	pthread_mutex_unlock(&g_metrics_snapshot_lock);
+	pthread_mutex_unlock(&g_metrics_update_lock);
+}
+
+/** Copy @p json into @p arena, or strdup it when @p arena is NULL. */
+static char *
+snapshot_copy(http_arena_t *arena, const char *json)
+{
+	return arena ? http_arena_strdup(arena, json) : strdup(json);
 }
 
 /**
- * @brief Get a stable metrics JSON snapshot for HTTP responses.
- * @return Newly allocated JSON string, or NULL on allocation failure.
+ * Reference on the published snapshot when the heartbeat refreshed it
+ * within the last 5 seconds; a staler one is due an inline rebuild.
+ */
+static metrics_snap_t *
+metrics_snapshot_fresh(void)
+{
+	metrics_snap_t *snap;
+
+	snap = (metrics_snap_t *)snapshot_acquire(&g_metrics_slot);
+	if (snap != NULL && time(NULL) - snap->updated_at > 5) {
+		snapshot_release(&snap->hdr);
+		snap = NULL;
+	}
+	return snap;
+}
+
+/**
+ * @brief Reference the snapshot for serving it in place.
+ * @param refresh Rebuild it inline first when missing or stale.
+ * @return A reference for metrics_snapshot_release(), or NULL.
+ */
+metrics_snap_t *
+metrics_snapshot_acquire(int refresh)
+{
+	metrics_snap_t *snap;
+
+	(void)pthread_once(&g_metrics_once, metrics_ring_bootstrap);
+	if ((snap = metrics_snapshot_fresh()) != NULL || !refresh)
+		return snap;
+	/*
+	 * Fallback refresh: if the heartbeat has not updated the snapshot
+	 * for more than 5 seconds, regenerate it inline so stale data is
+	 * never served indefinitely.
+	 */
+	metrics_snapshot_update();
+	return (metrics_snap_t *)snapshot_acquire(&g_metrics_slot);
+}
+
+/** @brief Drop a reference from metrics_snapshot_acquire(). */
+void
+metrics_snapshot_release(metrics_snap_t *snap)
+{
+	if (snap != NULL)
+		snapshot_release(&snap->hdr);
+}
+
+/**
+ * @brief Version of the snapshot a request would be served right now.
+ * @return Snapshot version, or 0 when none exists or it is due an inline
+ *         refresh (so the caller must not answer 304 from it).
+ */
+unsigned long
+metrics_snapshot_version(void)
+{
+	metrics_snap_t *snap = metrics_snapshot_fresh();
+	unsigned long version = 0;
+
+	if (snap != NULL) {
+		version = snap->version;
+		snapshot_release(&snap->hdr);
+	}
+	return version;
+}
+
+/**
+ * @brief Reference the gzip form of the current snapshot.
+ * @param version Receives the snapshot version; may be NULL.
+ * @return A reference the caller releases, or NULL when the snapshot is
+ *         missing, stale (so the caller takes the refreshing plain path)
+ *         or could not be compressed.
+ */
+http_blob_t *
+metrics_snapshot_gzip(unsigned long *version)
+{
+	metrics_snap_t *snap = metrics_snapshot_fresh();
+	http_blob_t *gz = NULL;
+
+	if (snap == NULL)
+		return NULL;
+	if (snap->gz != NULL) {
+		gz = http_blob_ref(snap->gz);
+		if (version)
+			*version = snap->version;
+	}
+	snapshot_release(&snap->hdr);
+	return gz;
+}
+
+/**
+ * @brief Copy the current snapshot without ever refreshing it inline.
+ * @param arena Request arena receiving the copy, or NULL for malloc.
+ * @param version Receives the snapshot version; may be NULL.
+ * @return The copy, or NULL when the snapshot is missing or stale.
  */
 char *
-get_system_metrics_json(void)
+metrics_snapshot_json_arena(http_arena_t *arena, unsigned long *version)
+{
+	metrics_snap_t *snap = metrics_snapshot_fresh();
+	char *copy;
+
+	if (snap == NULL)
+		return NULL;
+	copy = snapshot_copy(arena, snap->json);
+	if (version)
+		*version = snap->version;
+	snapshot_release(&snap->hdr);
+	return copy;
+}
+
+/**
+ * @brief Build what changed in the snapshot since @p since.
+ *
+ * @details The reply holds "delta": true, the version it starts from as
+ * "since", the members whose bytes changed after that version (the
+ * timestamp and the new version always among them) and the history
+ * samples newer than it. A poller that sends back the version each
+ * reply carries gets a few hundred bytes per second instead of the
+ * whole history.
+ *
+ * @param arena Request arena receiving the reply, or NULL for malloc.
+ * @param since Version the client holds, or a Unix time.
+ * @param version Receives the current version; may be NULL.
+ * @return The reply, or NULL when the snapshot is missing or stale or
+ *         @p since cannot be answered from the recent versions.
+ */
+char *
+metrics_snapshot_delta_arena(http_arena_t *arena, unsigned long long since,
+    unsigned long *version)
 {
+	MetricSample history[METRICS_HISTORY_WINDOW];
+	metrics_snap_t *snap;
+	unsigned long have;
+	int64_t have_ts;
+	size_t count, first = 0, last, len;
+	json_writer_t w;
+	char *out;
+
 	(void)pthread_once(&g_metrics_once, metrics_ring_bootstrap);
-	time_t now = time(NULL);
-	int should_refresh = 0;
+	count = ring_last(&g_metrics_ring, METRICS_HISTORY_WINDOW, history);
 
+	/* Under the lock the published snapshot is the one the spans index. */
 	pthread_mutex_lock(&g_metrics_snapshot_lock);
-	if (g_metrics_snapshot_json == NULL) {
-		should_refresh = 1;
-	} else if (g_metrics_snapshot_updated_at == 0 ||
-		   (now - g_metrics_snapshot_updated_at) > 5) {
-		/*
-		 * Fallback refresh: if the heartbeat has not updated the
-		 * snapshot for more than 5 seconds, regenerate it inline so
-		 * stale data is never served indefinitely.
-		 */
-		should_refresh = 1;
+	if ((snap = metrics_snapshot_fresh()) == NULL ||
+	    snapshot_delta_resolve(&g_metrics_delta, since, &have,
+	    &have_ts) != 0) {
+		pthread_mutex_unlock(&g_metrics_snapshot_lock);
+		metrics_snapshot_release(snap);
+		return NULL;
 	}
+	/* Samples the client lacks, and none the snapshot does not hold. */
+	while (first < count && history[first].ts <= have_ts)
+		first++;
+	last = count;
+	while (last > first && history[last - 1].ts > g_metrics_snapshot_ts)
+		last--;
+
+	len = 64 + (last - first) * 192;	/* about right; the writer grows */
+	for (size_t i = 0; i < g_metrics_nspans; i++) {
+		if (snapshot_delta_changed(&g_metrics_delta, i, have))
+			len += g_metrics_spans[i].len + 1;
+	}
+	if (json_init(&w, arena, len) != 0) {
+		pthread_mutex_unlock(&g_metrics_snapshot_lock);
+		metrics_snapshot_release(snap);
+		return NULL;
+	}
+	json_printf(&w, "{\"delta\": true, \"since\": %lu", have);
+	for (size_t i = 0; i < g_metrics_nspans; i++) {
+		if (!snapshot_delta_changed(&g_metrics_delta, i, have))
+			continue;
+		json_putc(&w, ',');
+		json_raw(&w, snap->json + g_metrics_spans[i].off,
+		    g_metrics_spans[i].len);
+	}
+	json_putc(&w, ',');
+	metrics_json_append_history(&w, history + first, last - first);
+	json_putc(&w, '}');
+	out = json_finish(&w, NULL);
+	if (out != NULL && version)
+		*version = snap->version;
 	pthread_mutex_unlock(&g_metrics_snapshot_lock);
+	metrics_snapshot_release(snap);
+	return out;
+}
+
+/**
+ * @brief Start sampling now rather than on the first metrics request.
+ *
+ * @details Called once the history store is open, so the ring is
+ * refilled from it and the gap a restart leaves is only the downtime.
+ */
+void
+metrics_snapshot_start(void)
+{
+	(void)pthread_once(&g_metrics_once, metrics_ring_bootstrap);
+}
 
-	if (should_refresh)
-		metrics_snapshot_update();
+/**
+ * @brief Serialise the downsampled history covering @p span seconds.
+ *
+ * @details Served from the finest tier that spans it: one point per
+ * second up to ten minutes, per ten seconds up to six hours, per minute
+ * up to a week.
+ *
+ * @param arena Request arena receiving the JSON, or NULL for malloc.
+ * @param span Seconds of history wanted, clamped to a week.
+ * @return The JSON, or NULL when the ring is not running or on
+ *         allocation failure.
+ */
+char *
+metrics_history_json_arena(http_arena_t *arena, unsigned int span)
+{
+	MetricRing *r = &g_metrics_ring;
+	MetricBucket *buckets;
+	unsigned int step;
+	size_t max, n;
+	json_writer_t w;
 
-	pthread_mutex_lock(&g_metrics_snapshot_lock);
-	if (g_metrics_snapshot_json) {
-		char *copy = strdup(g_metrics_snapshot_json);
-		pthread_mutex_unlock(&g_metrics_snapshot_lock);
-		if (copy)
-			return copy;
+	(void)pthread_once(&g_metrics_once, metrics_ring_bootstrap);
+	if (!g_metrics_ring_ready || r->buf == NULL)
+		return NULL;
+	if (span == 0)
+		span = 1;
+	if (span > METRIC_TIER_MAX_SPAN)
+		span = METRIC_TIER_MAX_SPAN;
+
+	max = metric_tiers_capacity(&r->tiers, span);
+	if ((buckets = calloc(max, sizeof(*buckets))) == NULL)
+		return NULL;
+	pthread_mutex_lock(&r->lock);
+	n = metric_tiers_query(&r->tiers, span, buckets, max, &step);
+	pthread_mutex_unlock(&r->lock);
+
+	if (json_init(&w, arena, 64 + n * 256) != 0) {
+		free(buckets);
+		return NULL;
 	}
+	metrics_json_append_tier(&w, span, step, buckets, n);
+	free(buckets);
+	return json_finish(&w, NULL);
+}
 
-	char *fallback =
-	    g_metrics_snapshot_json ? strdup(g_metrics_snapshot_json) : NULL;
-	pthread_mutex_unlock(&g_metrics_snapshot_lock);
-	return fallback;
+/**
+ * @brief Get a stable metrics JSON snapshot for HTTP responses.
+ * @param arena Request arena receiving the copy, or NULL for malloc.
+ * @param version Receives the version of the copied snapshot; may be NULL.
+ * @return Copy of the snapshot owned by @p arena (or the caller when
+ *         @p arena is NULL), or NULL on allocation failure.
+ */
+char *
+get_system_metrics_json_arena(http_arena_t *arena, unsigned long *version)
+{
+	metrics_snap_t *snap = metrics_snapshot_acquire(1);
+	char *copy;
+
+	if (snap == NULL)
+		return NULL;
+	copy = snapshot_copy(arena, snap->json);
+	if (version)
+		*version = snap->version;
+	snapshot_release(&snap->hdr);
+	return copy;
+}
+
+/**
+ * @brief Get a stable metrics JSON snapshot for HTTP responses.
+ * @return Newly allocated JSON string, or NULL on allocation failure.
+ */
+char *
+get_system_metrics_json(void)
+{
+	return get_system_metrics_json_arena(NULL, NULL);
 }
 
 /**
@@ -429,10 +802,15 @@ get_system_metrics_json(void)
 void
 metrics_module_cleanup(void)
 {
+	metrics_store_cleanup();
+	metrics_sse_cleanup();
+	metrics_openmetrics_cleanup();
+	metrics_process_cleanup();
+	metrics_disk_cleanup();
 	pthread_mutex_lock(&g_metrics_snapshot_lock);
-	free(g_metrics_snapshot_json);
-	g_metrics_snapshot_json = NULL;
-	g_metrics_snapshot_updated_at = 0;
+	snapshot_publish(&g_metrics_slot, NULL);
+	g_metrics_nspans = 0;
+	memset(&g_metrics_delta, 0, sizeof(g_metrics_delta));
 	pthread_mutex_unlock(&g_metrics_snapshot_lock);
 
 	if (g_metrics_ring_ready)
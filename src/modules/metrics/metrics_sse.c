@@ -0,0 +1,280 @@
+/* metrics_sse.c - Server-Sent Events stream of the metrics snapshot */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <miniweb/http/handler.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/modules/metrics_internal.h>
+
+/*
+ * A subscriber sends one request; its socket is then detached from the
+ * worker and kept here. After each snapshot update the metrics heartbeat
+ * formats one event, a delta from the version every subscriber holds,
+ * into a single shared blob framed as an HTTP chunk, and writes it to
+ * every socket without blocking. Close-delimited (HTTP/1.0) subscribers
+ * get the same bytes minus the chunk framing. A subscriber still behind
+ * on the previous event when the next one is due is dropped; its
+ * EventSource reconnects and starts over from a full snapshot.
+ */
+
+#define METRICS_SSE_MAX		256
+#define METRICS_SSE_CHUNK_MAX	24	/* "%zx\r\n" */
+
+typedef struct {
+	int fd;
+	int chunked;
+	unsigned long version;		/* last event it was sent */
+	http_blob_t *pending;		/* event not fully written, or NULL */
+	size_t off;			/* next byte of it to write */
+	size_t end;
+} metrics_sse_sub_t;
+
+typedef struct {
+	http_blob_t *blob;
+	size_t body_off;		/* event bytes without the chunk framing */
+	size_t body_len;
+} metrics_sse_event_t;
+
+static pthread_mutex_t sse_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_sse_sub_t sse_subs[METRICS_SSE_MAX];
+static int sse_nsubs;
+static unsigned long sse_version;	/* version deltas are taken from */
+
+/**
+ * Frame @p json as an SSE event inside an HTTP chunk. The snapshot has
+ * no raw newlines, which SSE data lines cannot carry; any that slipped
+ * in become spaces, which JSON ignores between tokens.
+ */
+static int
+metrics_sse_event(metrics_sse_event_t *ev, const char *kind,
+    unsigned long version, const char *json)
+{
+	char head[64];
+	char chunk[METRICS_SSE_CHUNK_MAX];
+	size_t json_len = strlen(json), head_len, chunk_len, body_len;
+	char *p;
+
+	head_len = (size_t)snprintf(head, sizeof(head),
+	    "id: %lu\nevent: %s\ndata: ", version, kind);
+	body_len = head_len + json_len + 2;
+	chunk_len = (size_t)snprintf(chunk, sizeof(chunk), "%zx\r\n",
+	    body_len);
+	ev->blob = http_blob_alloc(chunk_len + body_len + 2);
+	if (ev->blob == NULL)
+		return -1;
+	p = ev->blob->data;
+	memcpy(p, chunk, chunk_len);
+	memcpy(p + chunk_len, head, head_len);
+	p += chunk_len + head_len;
+	for (size_t i = 0; i < json_len; i++)
+		p[i] = json[i] == '\n' || json[i] == '\r' ? ' ' : json[i];
+	memcpy(p + json_len, "\n\n\r\n", 4);
+	ev->body_off = chunk_len;
+	ev->body_len = body_len;
+	return 0;
+}
+
+/** Close @p i and move the last subscriber into its slot. */
+static void
+metrics_sse_drop(int i)
+{
+	metrics_sse_sub_t *s = &sse_subs[i];
+
+	close(s->fd);
+	http_blob_release(s->pending);
+	if (i != --sse_nsubs)
+		*s = sse_subs[sse_nsubs];
+	memset(&sse_subs[sse_nsubs], 0, sizeof(sse_subs[0]));
+}
+
+/**
+ * Write what @p s has pending without blocking.
+ * @return 1 when it is all written, 0 when the socket is full, -1 when
+ *         the peer is gone.
+ */
+static int
+metrics_sse_flush(metrics_sse_sub_t *s)
+{
+	while (s->pending && s->off < s->end) {
+		ssize_t n = write(s->fd, s->pending->data + s->off,
+		    s->end - s->off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		s->off += (size_t)n;
+	}
+	http_blob_release(s->pending);
+	s->pending = NULL;
+	return 1;
+}
+
+/** Queue @p ev on @p s and start writing it; as metrics_sse_flush(). */
+static int
+metrics_sse_send(metrics_sse_sub_t *s, const metrics_sse_event_t *ev,
+    unsigned long version)
+{
+	s->pending = http_blob_ref(ev->blob);
+	if (s->chunked) {
+		s->off = 0;
+		s->end = ev->blob->len;
+	} else {
+		s->off = ev->body_off;
+		s->end = ev->body_off + ev->body_len;
+	}
+	s->version = version;
+	return metrics_sse_flush(s);
+}
+
+/**
+ * @brief Push the snapshot just published to every subscriber.
+ *
+ * @details Called by the metrics heartbeat after each update. Costs one
+ * delta and one event whatever the number of subscribers, and nothing
+ * when there are none.
+ */
+void
+metrics_sse_publish(void)
+{
+	metrics_sse_event_t ev;
+	unsigned long version = 0;
+	const char *kind = "delta";
+	char *json;
+
+	pthread_mutex_lock(&sse_lock);
+	if (sse_nsubs == 0) {
+		pthread_mutex_unlock(&sse_lock);
+		return;
+	}
+	json = metrics_snapshot_delta_arena(NULL, sse_version, &version);
+	if (json == NULL) {
+		/* The base version aged out of the window: start over. */
+		kind = "snapshot";
+		json = metrics_snapshot_json_arena(NULL, &version);
+	}
+	if (json == NULL || version == sse_version ||
+	    metrics_sse_event(&ev, kind, version, json) != 0) {
+		free(json);
+		pthread_mutex_unlock(&sse_lock);
+		return;
+	}
+	free(json);
+
+	for (int i = 0; i < sse_nsubs; ) {
+		metrics_sse_sub_t *s = &sse_subs[i];
+		int rc = 1;
+
+		/* Joined after the update: it has this version already. */
+		if (s->version >= version) {
+			i++;
+			continue;
+		}
+		if (s->pending)
+			rc = metrics_sse_flush(s);
+		if (rc == 1)
+			rc = metrics_sse_send(s, &ev, version);
+		else
+			rc = -1;	/* still behind on the last event */
+		if (rc < 0) {
+			metrics_sse_drop(i);
+			continue;
+		}
+		i++;
+	}
+	sse_version = version;
+	pthread_mutex_unlock(&sse_lock);
+	http_blob_release(ev.blob);
+}
+
+/**
+ * @brief Handle GET /api/metrics/stream: an event per snapshot update.
+ *
+ * @details The first event is the full snapshot ("snapshot"); later
+ * ones carry what changed ("delta"), in the same shape as a ?since=
+ * reply. The event id is the snapshot version.
+ *
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_sse_handler(http_request_t *req)
+{
+	metrics_sse_event_t ev;
+	http_response_t *resp;
+	http_stream_t st;
+	unsigned long version = 0;
+	char *json;
+	int fd, rc;
+
+	metrics_snapshot_start();
+	json = metrics_snapshot_json_arena(NULL, &version);
+	if (json == NULL)
+		return http_send_error(req, 503, "Metrics not sampled yet");
+	rc = metrics_sse_event(&ev, "snapshot", version, json);
+	free(json);
+	if (rc != 0)
+		return http_send_error(req, 500, "Unable to allocate response");
+
+	pthread_mutex_lock(&sse_lock);
+	rc = sse_nsubs < METRICS_SSE_MAX;
+	pthread_mutex_unlock(&sse_lock);
+	if (!rc) {
+		http_blob_release(ev.blob);
+		return http_send_error(req, 503, "Too many metrics streams");
+	}
+
+	if ((resp = http_response_create()) == NULL) {
+		http_blob_release(ev.blob);
+		return http_send_error(req, 500, "Unable to allocate response");
+	}
+	resp->status_code = 200;
+	resp->content_type = "text/event-stream";
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
+	req->keep_alive = 0;
+	rc = http_stream_begin(&st, req, resp);
+	http_response_free(resp);
+	if (rc != 0 || (fd = http_request_detach(req)) < 0) {
+		http_blob_release(ev.blob);
+		return -1;
+	}
+
+	pthread_mutex_lock(&sse_lock);
+	if (sse_nsubs == METRICS_SSE_MAX) {
+		pthread_mutex_unlock(&sse_lock);
+		close(fd);
+		http_blob_release(ev.blob);
+		return -1;
+	}
+	metrics_sse_sub_t *s = &sse_subs[sse_nsubs];
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->chunked = st.mode == HTTP_STREAM_CHUNKED;
+	/* The oldest version held decides where the next delta starts. */
+	if (sse_nsubs == 0 || version < sse_version)
+		sse_version = version;
+	sse_nsubs++;
+	if (metrics_sse_send(s, &ev, version) < 0)
+		metrics_sse_drop(sse_nsubs - 1);
+	pthread_mutex_unlock(&sse_lock);
+	http_blob_release(ev.blob);
+	return 0;
+}
+
+/** Close every stream. */
+void
+metrics_sse_cleanup(void)
+{
+	pthread_mutex_lock(&sse_lock);
+	while (sse_nsubs > 0)
+		metrics_sse_drop(sse_nsubs - 1);
+	sse_version = 0;
+	pthread_mutex_unlock(&sse_lock);
+}
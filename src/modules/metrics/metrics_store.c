@@ -0,0 +1,301 @@
+/* metrics_store.c - metrics history kept across restarts in SQLite */
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/modules/metrics_internal.h>
+#include <miniweb/storage/sqlite_db.h>
+#include <miniweb/storage/sqlite_schema.h>
+#include <miniweb/storage/sqlite_stmt.h>
+
+/*
+ * The metrics heartbeat hands every sample to metrics_store_add(), which
+ * only appends it to a pending buffer. The "metrics.store" task swaps the
+ * buffer out every flush period and hands it to the database's writer
+ * thread, which writes it in one transaction with cached statements,
+ * pruning rows older than the coarsest history tier, so a sample costs
+ * no fsync of its own. The WAL journal keeps reads of the history off
+ * the write lock. At startup the retained window is read back into the
+ * ring, which fills the tiers again.
+ */
+
+#define METRICS_STORE_RETENTION	METRIC_TIER_MAX_SPAN
+
+/* Version 1 predates versioning, hence IF NOT EXISTS. */
+static const struct mw_migration metrics_store_migrations[] = {
+	{ 1, "CREATE TABLE IF NOT EXISTS metrics_samples ("
+	    " ts INTEGER PRIMARY KEY,"
+	    " cpu INTEGER NOT NULL,"		/* hundredths of a percent */
+	    " mem_used INTEGER NOT NULL,"
+	    " mem_total INTEGER NOT NULL,"
+	    " swap_used INTEGER NOT NULL,"
+	    " net_rx INTEGER NOT NULL,"
+	    " net_tx INTEGER NOT NULL);" },
+};
+
+/* Samples not yet written; swapped with the flushing buffer. */
+static pthread_mutex_t metrics_store_pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static MetricSample *metrics_store_pending;
+static size_t metrics_store_npending;
+static size_t metrics_store_cap;
+static uint64_t metrics_store_dropped;
+
+/* Guards the connection and the flushing buffer. */
+static pthread_mutex_t metrics_store_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mw_db *metrics_store_db;
+static MetricSample *metrics_store_flushing;
+
+/* What metrics_store_write() writes, on the database's writer thread. */
+struct metrics_store_batch {
+	size_t n;		/* samples in metrics_store_flushing */
+	int64_t now;
+};
+
+/**
+ * Write the samples in the flushing buffer, on the writer thread; the
+ * flush waiting for it holds metrics_store_lock.
+ */
+static int
+metrics_store_write(struct mw_db *db, void *ctx)
+{
+	const struct metrics_store_batch *b = ctx;
+	struct mw_stmt *put, *prune;
+	int rc = 0;
+
+	if (mw_stmt_prepare_cached(db, "INSERT OR REPLACE INTO metrics_samples"
+	    "(ts, cpu, mem_used, mem_total, swap_used, net_rx, net_tx)"
+	    " VALUES (?, ?, ?, ?, ?, ?, ?)", &put) != 0)
+		return -1;
+	for (size_t i = 0; i < b->n && rc == 0; i++) {
+		const MetricSample *s = &metrics_store_flushing[i];
+		float cpu = s->cpu * 100.0f + 0.5f;
+
+		if (mw_bind_int64(put, 1, s->ts) != 0 ||
+		    mw_bind_int64(put, 2, (int64_t)cpu) != 0 ||
+		    mw_bind_int64(put, 3, s->mem_used) != 0 ||
+		    mw_bind_int64(put, 4, s->mem_total) != 0 ||
+		    mw_bind_int64(put, 5, s->swap_used) != 0 ||
+		    mw_bind_int64(put, 6, s->net_rx) != 0 ||
+		    mw_bind_int64(put, 7, s->net_tx) != 0 ||
+		    mw_stmt_step(put) < 0)
+			rc = -1;
+		(void)mw_stmt_reset(put);
+	}
+	mw_stmt_finalize(put);
+	if (rc != 0 || mw_stmt_prepare_cached(db,
+	    "DELETE FROM metrics_samples WHERE ts < ?", &prune) != 0)
+		return -1;
+	if (mw_bind_int64(prune, 1, b->now - METRICS_STORE_RETENTION) != 0 ||
+	    mw_stmt_step(prune) < 0)
+		rc = -1;
+	mw_stmt_finalize(prune);
+	return rc;
+}
+
+/**
+ * @brief Write every pending sample in one transaction.
+ *
+ * @return Samples written, 0 when none were pending or no store is open,
+ *         or -1 when the batch could not be written; it is then lost.
+ */
+int
+metrics_store_flush(void)
+{
+	struct metrics_store_batch batch;
+	MetricSample *swap;
+	size_t n;
+	int rc;
+
+	pthread_mutex_lock(&metrics_store_lock);
+	if (metrics_store_db == NULL) {
+		pthread_mutex_unlock(&metrics_store_lock);
+		return 0;
+	}
+	pthread_mutex_lock(&metrics_store_pending_lock);
+	swap = metrics_store_pending;
+	metrics_store_pending = metrics_store_flushing;
+	metrics_store_flushing = swap;
+	n = metrics_store_npending;
+	metrics_store_npending = 0;
+	pthread_mutex_unlock(&metrics_store_pending_lock);
+
+	batch.n = n;
+	batch.now = (int64_t)time(NULL);
+	rc = n == 0 ? 0 : mw_db_write(metrics_store_db, metrics_store_write,
+	    &batch);
+	pthread_mutex_unlock(&metrics_store_lock);
+	if (rc != 0) {
+		log_error("[METRICS] Cannot write %zu samples to the history "
+		    "store", n);
+		return -1;
+	}
+	return (int)n;
+}
+
+static void
+metrics_store_heartbeat(void *ctx)
+{
+	(void)ctx;
+	(void)metrics_store_flush();
+}
+
+/**
+ * @brief Queue @p s for the next flush. Never blocks on the database.
+ */
+void
+metrics_store_add(const MetricSample *s)
+{
+	pthread_mutex_lock(&metrics_store_pending_lock);
+	if (metrics_store_pending == NULL) {
+		/* No store open. */
+	} else if (metrics_store_npending < metrics_store_cap) {
+		metrics_store_pending[metrics_store_npending++] = *s;
+	} else if (metrics_store_dropped++ == 0) {
+		log_error("[METRICS] History store is not keeping up; "
+		    "dropping samples");
+	}
+	pthread_mutex_unlock(&metrics_store_pending_lock);
+}
+
+/**
+ * @brief Read the stored samples newer than @p since, oldest first.
+ *
+ * @param since Unix time; older rows are skipped.
+ * @param fn Called with each sample.
+ * @param ctx Passed to @p fn.
+ *
+ * @return Samples read, or -1 when no store is open or the read failed.
+ */
+int64_t
+metrics_store_reload(int64_t since, void (*fn)(const MetricSample *, void *),
+    void *ctx)
+{
+	struct mw_stmt *st;
+	MetricSample s;
+	int64_t n = 0;
+	int rc;
+
+	pthread_mutex_lock(&metrics_store_lock);
+	if (metrics_store_db == NULL || mw_stmt_prepare_cached(metrics_store_db,
+	    "SELECT ts, cpu, mem_used, mem_total, swap_used, net_rx, net_tx"
+	    " FROM metrics_samples WHERE ts > ? ORDER BY ts", &st) != 0) {
+		pthread_mutex_unlock(&metrics_store_lock);
+		return -1;
+	}
+	if (mw_bind_int64(st, 1, since) != 0) {
+		mw_stmt_finalize(st);
+		pthread_mutex_unlock(&metrics_store_lock);
+		return -1;
+	}
+	while ((rc = mw_stmt_step(st)) == 0) {
+		memset(&s, 0, sizeof(s));
+		s.ts = mw_column_int64(st, 0);
+		s.cpu = (float)mw_column_int64(st, 1) / 100.0f;
+		s.mem_used = (uint32_t)mw_column_int64(st, 2);
+		s.mem_total = (uint32_t)mw_column_int64(st, 3);
+		s.swap_used = (uint32_t)mw_column_int64(st, 4);
+		s.net_rx = (uint32_t)mw_column_int64(st, 5);
+		s.net_tx = (uint32_t)mw_column_int64(st, 6);
+		fn(&s, ctx);
+		n++;
+	}
+	mw_stmt_finalize(st);
+	pthread_mutex_unlock(&metrics_store_lock);
+	return rc < 0 ? -1 : n;
+}
+
+/**
+ * @brief Open the history store in @p path and flush it every
+ * @p flush_sec seconds.
+ *
+ * @return 0 on success, -1 when the database cannot be opened or the
+ *         flush task registered.
+ */
+int
+metrics_store_start(const char *path, int flush_sec)
+{
+	struct mw_db *db;
+	char dir[PATH_MAX];
+	size_t cap;
+
+	if (!path || *path == '\0' || flush_sec <= 0)
+		return -1;
+	strlcpy(dir, path, sizeof(dir));
+	if (mkdir(dirname(dir), 0750) != 0 && errno != EEXIST)
+		log_debug("[METRICS] Cannot create the directory of %s", path);
+	if (mw_db_open(path, MW_DB_WAL, &db) != 0)
+		return -1;
+	if (mw_db_migrate(db, "metrics", metrics_store_migrations,
+	    sizeof(metrics_store_migrations) /
+	    sizeof(metrics_store_migrations[0])) != 0) {
+		log_error("[METRICS] %s: cannot create the history store", path);
+		mw_db_close(db);
+		return -1;
+	}
+
+	/* Room for two periods of 1 s samples, should a flush be late. */
+	cap = (size_t)flush_sec * 2 + 16;
+	pthread_mutex_lock(&metrics_store_lock);
+	if (metrics_store_db != NULL) {
+		pthread_mutex_unlock(&metrics_store_lock);
+		mw_db_close(db);
+		return 0;
+	}
+	metrics_store_db = db;
+	if ((metrics_store_flushing = calloc(cap, sizeof(MetricSample))) ==
+	    NULL) {
+		pthread_mutex_unlock(&metrics_store_lock);
+		metrics_store_cleanup();
+		return -1;
+	}
+	pthread_mutex_lock(&metrics_store_pending_lock);
+	metrics_store_pending = calloc(cap, sizeof(MetricSample));
+	metrics_store_cap = metrics_store_pending ? cap : 0;
+	pthread_mutex_unlock(&metrics_store_pending_lock);
+	pthread_mutex_unlock(&metrics_store_lock);
+	if (metrics_store_cap == 0) {
+		metrics_store_cleanup();
+		return -1;
+	}
+
+	if (heartbeat_register(&(struct hb_task){
+		.name = "metrics.store",
+		.period_sec = (unsigned int)flush_sec,
+		.initial_delay_sec = (unsigned int)flush_sec,
+		.cb = metrics_store_heartbeat,
+		.ctx = NULL,
+	    }) < 0) {
+		metrics_store_cleanup();
+		return -1;
+	}
+	return heartbeat_start();
+}
+
+/** Write what is pending, stop flushing and close the store. */
+void
+metrics_store_cleanup(void)
+{
+	(void)heartbeat_unregister("metrics.store");
+	(void)metrics_store_flush();
+
+	pthread_mutex_lock(&metrics_store_lock);
+	mw_db_close(metrics_store_db);
+	metrics_store_db = NULL;
+	free(metrics_store_flushing);
+	metrics_store_flushing = NULL;
+	pthread_mutex_lock(&metrics_store_pending_lock);
+	free(metrics_store_pending);
+	metrics_store_pending = NULL;
+	metrics_store_npending = metrics_store_cap = 0;
+	metrics_store_dropped = 0;
+	pthread_mutex_unlock(&metrics_store_pending_lock);
+	pthread_mutex_unlock(&metrics_store_lock);
+}
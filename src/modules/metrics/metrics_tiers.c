@@ -0,0 +1,158 @@
+/* metrics_tiers.c - RRD-style downsampled tiers of the metrics history */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/modules/metrics_internal.h>
+
+/*
+ * Each tier is a ring of fixed-width buckets holding min/avg/max of every
+ * charted metric. A pushed sample is folded into the newest bucket of
+ * each tier, or opens the next one, so a week of history costs the same
+ * to serve at one point per minute as ten minutes does at one per second.
+ */
+static const struct {
+	unsigned int step;
+	unsigned int span;
+} metric_tier_spec[METRIC_TIERS] = {
+	{ 1, 10 * 60 },
+	{ 10, 6 * 3600 },
+	{ 60, METRIC_TIER_MAX_SPAN },
+};
+
+static void
+stat_first(MetricStat *st, float v)
+{
+	st->min = st->max = st->sum = v;
+}
+
+static void
+stat_fold(MetricStat *st, float v)
+{
+	if (v < st->min)
+		st->min = v;
+	if (v > st->max)
+		st->max = v;
+	st->sum += v;
+}
+
+int
+metric_tiers_init(MetricTiers *t)
+{
+	memset(t, 0, sizeof(*t));
+	for (int i = 0; i < METRIC_TIERS; i++) {
+		MetricTier *tier = &t->tier[i];
+
+		tier->step = metric_tier_spec[i].step;
+		tier->capacity = metric_tier_spec[i].span /
+		    metric_tier_spec[i].step;
+		tier->buf = calloc(tier->capacity, sizeof(MetricBucket));
+		if (tier->buf == NULL) {
+			metric_tiers_free(t);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void
+metric_tiers_push(MetricTiers *t, const MetricSample *s)
+{
+	for (int i = 0; i < METRIC_TIERS; i++) {
+		MetricTier *tier = &t->tier[i];
+		int64_t start = s->ts - s->ts % (int64_t)tier->step;
+		MetricBucket *b = NULL;
+
+		if (tier->buf == NULL)
+			continue;
+		if (tier->count > 0) {
+			b = &tier->buf[(tier->head + tier->capacity - 1) %
+			    tier->capacity];
+			/* A clock stepped back keeps folding into the newest. */
+			if (start > b->ts)
+				b = NULL;
+		}
+		if (b == NULL) {
+			b = &tier->buf[tier->head];
+			tier->head = (tier->head + 1) % tier->capacity;
+			if (tier->count < tier->capacity)
+				tier->count++;
+			b->ts = start;
+			b->n = 1;
+			b->mem_total = s->mem_total;
+			stat_first(&b->cpu, s->cpu);
+			stat_first(&b->mem_used, (float)s->mem_used);
+			stat_first(&b->swap_used, (float)s->swap_used);
+			stat_first(&b->net_rx, (float)s->net_rx);
+			stat_first(&b->net_tx, (float)s->net_tx);
+			continue;
+		}
+		b->n++;
+		b->mem_total = s->mem_total;
+		stat_fold(&b->cpu, s->cpu);
+		stat_fold(&b->mem_used, (float)s->mem_used);
+		stat_fold(&b->swap_used, (float)s->swap_used);
+		stat_fold(&b->net_rx, (float)s->net_rx);
+		stat_fold(&b->net_tx, (float)s->net_tx);
+	}
+}
+
+/** The finest tier whose ring spans @p span seconds, else the coarsest. */
+static const MetricTier *
+metric_tier_for(const MetricTiers *t, unsigned int span)
+{
+	for (int i = 0; i < METRIC_TIERS; i++) {
+		if (t->tier[i].step * t->tier[i].capacity >= span)
+			return &t->tier[i];
+	}
+	return &t->tier[METRIC_TIERS - 1];
+}
+
+size_t
+metric_tiers_capacity(const MetricTiers *t, unsigned int span)
+{
+	const MetricTier *tier = metric_tier_for(t, span);
+	size_t n = (span + tier->step - 1) / tier->step;
+
+	return n < tier->capacity ? n : tier->capacity;
+}
+
+size_t
+metric_tiers_query(const MetricTiers *t, unsigned int span,
+    MetricBucket *out, size_t max, unsigned int *step)
+{
+	const MetricTier *tier = metric_tier_for(t, span);
+	size_t n = 0, start;
+	int64_t since;
+
+	*step = tier->step;
+	if (tier->buf == NULL || tier->count == 0)
+		return 0;
+
+	/* Buckets that start within span of the newest one. */
+	since = tier->buf[(tier->head + tier->capacity - 1) %
+	    tier->capacity].ts - (int64_t)span;
+	while (n < tier->count && n < max) {
+		const MetricBucket *b = &tier->buf[(tier->head +
+		    tier->capacity - 1 - n) % tier->capacity];
+
+		if (b->ts <= since)
+			break;
+		n++;
+	}
+	start = (tier->head + tier->capacity - n) % tier->capacity;
+	for (size_t i = 0; i < n; i++)
+		out[i] = tier->buf[(start + i) % tier->capacity];
+	return n;
+}
+
+void
+metric_tiers_free(MetricTiers *t)
+{
+	for (int i = 0; i < METRIC_TIERS; i++) {
+		free(t->tier[i].buf);
+		t->tier[i].buf = NULL;
+		t->tier[i].head = 0;
+		t->tier[i].count = 0;
+	}
+}
@@ -0,0 +1,119 @@
+/* metrics_trace.c - GET /api/stats/trace over the request trace rings */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/modules/metrics.h>
+#include <miniweb/net/trace.h>
+#include <miniweb/router/route_stats.h>
+#include <miniweb/router/urls.h>
+
+#define TRACE_RECENT_DEFAULT	100
+#define TRACE_RECENT_MAX	1000
+
+/** ?limit=<n> for the recent list; 0 when malformed. */
+static size_t
+trace_limit(const char *q)
+{
+	while (q && *q) {
+		if (strncmp(q, "limit=", 6) == 0) {
+			char *end;
+			unsigned long v = strtoul(q + 6, &end, 10);
+
+			if (end == q + 6 || v == 0 ||
+			    (*end != '\0' && *end != '&'))
+				return 0;
+			return v > TRACE_RECENT_MAX ? TRACE_RECENT_MAX : v;
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return TRACE_RECENT_DEFAULT;
+}
+
+/** Append one record as a JSON object; ages are relative to @p now. */
+static void
+trace_item(json_writer_t *w, const trace_record_t *r, uint64_t now)
+{
+	uint64_t ph[TRACE_PHASES];
+	char name[256];
+
+	if (r->route_id == ROUTE_STATS_UNMATCHED ||
+	    !route_describe(r->route_id, name, sizeof(name)))
+		strlcpy(name, "unmatched", sizeof(name));
+	json_printf(w, "{\"thread\": %u, \"route\": ", r->thread);
+	json_str(w, name);
+	json_puts(w, ", \"path\": ");
+	json_str(w, r->path);
+	json_printf(w, ", \"status\": %d, \"bytes\": %llu, "
+	    "\"total_us\": %llu, \"age_ms\": %llu, \"phases_us\": {",
+	    r->status, (unsigned long long)r->bytes,
+	    (unsigned long long)(r->total_ns / 1000),
+	    (unsigned long long)(now > r->start_ns ?
+	    (now - r->start_ns) / 1000000 : 0));
+	trace_phases(r, ph);
+	for (int p = 0; p < TRACE_PHASES; p++)
+		json_printf(w, "%s\"%s\": %llu", p ? ", " : "",
+		    trace_phase_name((trace_phase_t)p),
+		    (unsigned long long)(ph[p] / 1000));
+	json_puts(w, "}}");
+}
+
+/** Append "key": [records...]. */
+static void
+trace_list(json_writer_t *w, const char *key, const trace_record_t *r,
+    size_t n, uint64_t now)
+{
+	json_printf(w, ", \"%s\": [", key);
+	for (size_t i = 0; i < n; i++) {
+		if (i)
+			json_puts(w, ", ");
+		trace_item(w, &r[i], now);
+	}
+	json_putc(w, ']');
+}
+
+/**
+ * @brief Handle GET /api/stats/trace[?limit=<n>].
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+metrics_trace_handler(http_request_t *req)
+{
+	size_t limit = trace_limit(http_request_query(req));
+	trace_record_t *recs;
+	size_t recent, slow;
+	json_writer_t w;
+	uint64_t now;
+	char *json;
+	int rc;
+
+	if (limit == 0)
+		return http_send_error(req, 400, "Invalid limit parameter");
+	recs = calloc(limit + TRACE_SLOW_RING, sizeof(*recs));
+	if (recs == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	recent = trace_snapshot(recs, limit, 0);
+	slow = trace_snapshot(recs + recent, TRACE_SLOW_RING, 1);
+	now = trace_now();
+
+	if (json_init(&w, req->arena, 256 * (recent + slow) + 128) == 0) {
+		json_printf(&w, "{\"trace\": {\"enabled\": %s, \"slow_ms\": %d",
+		    TRACE_ON() ? "true" : "false", trace_slow_ms());
+		trace_list(&w, "recent", recs, recent, now);
+		trace_list(&w, "slow", recs + recent, slow, now);
+		json_puts(&w, "}}");
+	}
+	free(recs);
+	if ((json = json_finish(&w, NULL)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	rc = http_send_json(req, json);
+	if (req->arena == NULL)
+		free(json);
+	return rc;
+}
@@ -0,0 +1,600 @@
+/* networking_conns.c - TCP/UDP connection table, diffed sample to sample */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef __OpenBSD__
+#include <sys/file.h>
+#include <sys/sysctl.h>
+#endif
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "networking_internal.h"
+
+/*
+ * Every networking heartbeat reads the inet sockets from the kern.file
+ * sysctl, as fstat(1) does, which unprivileged processes may do under the
+ * "ps" promise. The sample is merged into the table kept from the previous
+ * one: a socket already there is only marked as seen, a new one is added,
+ * and those left unmarked are removed. Only additions, removals and state
+ * changes touch the per-port aggregates and the totals, and the JSON
+ * section is formatted again only after a sample that changed something,
+ * so a host with tens of thousands of idle sockets pays one hash lookup
+ * per socket per second.
+ */
+
+#define NET_TCPS_LISTEN		1
+#define NET_TCPS_ESTABLISHED	4
+#define NET_PORT_SLOTS		(2 * 65536)	/* TCP ports, then UDP */
+#define NET_CONNS_BUCKETS_MIN	1024
+
+typedef struct {
+	net_conn_t c;
+	uint32_t hash;
+	int32_t next;		/* in the bucket chain, -1 ends it */
+	uint64_t gen;		/* sample that last saw it */
+} net_conn_entry_t;
+
+static const char *const net_tcp_states[] = {
+	"CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED",
+	"CLOSE_WAIT", "FIN_WAIT_1", "CLOSING", "LAST_ACK", "FIN_WAIT_2",
+	"TIME_WAIT"
+};
+
+static struct {
+	pthread_mutex_t lock;
+	net_conn_entry_t *ents;
+	size_t count;
+	size_t cap;
+	int32_t *buckets;
+	size_t nbuckets;	/* power of two */
+	uint32_t *port_index;	/* port slot -> index in ports + 1, 0 none */
+	net_port_t *ports;
+	size_t nports;
+	size_t ports_cap;
+	net_port_t top[NET_CONNS_TOP_PORTS];
+	int ntop;
+	net_conns_stats_t stats;
+	uint64_t gen;
+	char json[NET_CONNS_JSON_MAX];
+	size_t json_len;
+} net_conns = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+#ifdef __OpenBSD__
+/* Sample buffers, used by the heartbeat thread only. */
+static struct kinfo_file *net_kf;
+static size_t net_kf_size;
+static net_conn_t *net_socks;
+static size_t net_socks_cap;
+#endif
+
+/** FNV-1a over the fields that identify a socket. */
+static uint32_t
+net_conn_hash(const net_conn_t *c)
+{
+	uint8_t key[38];
+	uint32_t h = 2166136261u;
+
+	key[0] = c->family;
+	key[1] = c->proto;
+	key[2] = (uint8_t)(c->lport >> 8);
+	key[3] = (uint8_t)c->lport;
+	key[4] = (uint8_t)(c->fport >> 8);
+	key[5] = (uint8_t)c->fport;
+	memcpy(key + 6, c->laddr, 16);
+	memcpy(key + 22, c->faddr, 16);
+	for (size_t i = 0; i < sizeof(key); i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+net_conn_same(const net_conn_t *a, const net_conn_t *b)
+{
+	return a->family == b->family && a->proto == b->proto &&
+	    a->lport == b->lport && a->fport == b->fport &&
+	    memcmp(a->laddr, b->laddr, 16) == 0 &&
+	    memcmp(a->faddr, b->faddr, 16) == 0;
+}
+
+static int
+net_conn_listening(const net_conn_t *c)
+{
+	if (c->proto == IPPROTO_TCP)
+		return c->state == NET_TCPS_LISTEN;
+	return c->fport == 0;
+}
+
+static net_conn_entry_t *
+net_conns_lookup(const net_conn_t *c, uint32_t h)
+{
+	int32_t i;
+
+	if (net_conns.nbuckets == 0)
+		return NULL;
+	for (i = net_conns.buckets[h & (net_conns.nbuckets - 1)]; i >= 0;
+	    i = net_conns.ents[i].next) {
+		if (net_conns.ents[i].hash == h &&
+		    net_conn_same(&net_conns.ents[i].c, c))
+			return &net_conns.ents[i];
+	}
+	return NULL;
+}
+
+/** The chain link that points at entry @p i. */
+static int32_t *
+net_conns_link(size_t i)
+{
+	int32_t *link;
+
+	link = &net_conns.buckets[net_conns.ents[i].hash &
+	    (net_conns.nbuckets - 1)];
+	while (*link != (int32_t)i)
+		link = &net_conns.ents[*link].next;
+	return link;
+}
+
+static int
+net_conns_rehash(size_t nbuckets)
+{
+	int32_t *b;
+	size_t i;
+
+	if ((b = malloc(nbuckets * sizeof(*b))) == NULL)
+		return -1;
+	for (i = 0; i < nbuckets; i++)
+		b[i] = -1;
+	for (i = 0; i < net_conns.count; i++) {
+		size_t slot = net_conns.ents[i].hash & (nbuckets - 1);
+
+		net_conns.ents[i].next = b[slot];
+		b[slot] = (int32_t)i;
+	}
+	free(net_conns.buckets);
+	net_conns.buckets = b;
+	net_conns.nbuckets = nbuckets;
+	return 0;
+}
+
+static int
+net_conns_insert(const net_conn_t *c, uint32_t h)
+{
+	net_conn_entry_t *e;
+	size_t slot;
+
+	if (net_conns.count == net_conns.cap) {
+		size_t ncap = net_conns.cap ? net_conns.cap * 2 : 1024;
+
+		e = realloc(net_conns.ents, ncap * sizeof(*e));
+		if (e == NULL)
+			return -1;
+		net_conns.ents = e;
+		net_conns.cap = ncap;
+	}
+	if (net_conns.count >= net_conns.nbuckets &&
+	    net_conns_rehash(net_conns.nbuckets ? net_conns.nbuckets * 2 :
+	    NET_CONNS_BUCKETS_MIN) != 0)
+		return -1;
+
+	e = &net_conns.ents[net_conns.count];
+	e->c = *c;
+	e->hash = h;
+	e->gen = net_conns.gen;
+	slot = h & (net_conns.nbuckets - 1);
+	e->next = net_conns.buckets[slot];
+	net_conns.buckets[slot] = (int32_t)net_conns.count;
+	net_conns.count++;
+	return 0;
+}
+
+/** Drop entry @p i; the last entry takes its place. */
+static void
+net_conns_remove(size_t i)
+{
+	size_t last = net_conns.count - 1;
+
+	*net_conns_link(i) = net_conns.ents[i].next;
+	if (i != last) {
+		*net_conns_link(last) = (int32_t)i;
+		net_conns.ents[i] = net_conns.ents[last];
+	}
+	net_conns.count--;
+}
+
+/** Add (@p delta 1) or take away (-1) @p c from its port and the totals. */
+static void
+net_conns_account(const net_conn_t *c, int delta)
+{
+	size_t slot = (c->proto == IPPROTO_UDP ? 65536u : 0u) + c->lport;
+	int listening = net_conn_listening(c);
+	net_port_t *p;
+	uint32_t idx = net_conns.port_index[slot];
+
+	if (idx == 0) {
+		if (delta < 0)
+			return;
+		if (net_conns.nports == net_conns.ports_cap) {
+			size_t ncap = net_conns.ports_cap ?
+			    net_conns.ports_cap * 2 : 256;
+
+			p = realloc(net_conns.ports, ncap * sizeof(*p));
+			if (p == NULL)
+				return;
+			net_conns.ports = p;
+			net_conns.ports_cap = ncap;
+		}
+		p = &net_conns.ports[net_conns.nports++];
+		memset(p, 0, sizeof(*p));
+		p->proto = c->proto;
+		p->port = c->lport;
+		idx = (uint32_t)net_conns.nports;
+		net_conns.port_index[slot] = idx;
+	}
+	p = &net_conns.ports[idx - 1];
+	p->conns += (uint32_t)delta;
+	p->listening += (uint32_t)(listening * delta);
+
+	net_conns.stats.total += (uint32_t)delta;
+	if (c->proto == IPPROTO_TCP)
+		net_conns.stats.tcp += (uint32_t)delta;
+	else
+		net_conns.stats.udp += (uint32_t)delta;
+	net_conns.stats.listening += (uint32_t)(listening * delta);
+	if (c->proto == IPPROTO_TCP && c->state == NET_TCPS_ESTABLISHED)
+		net_conns.stats.established += (uint32_t)delta;
+
+	if (p->conns == 0) {
+		net_port_t *end = &net_conns.ports[net_conns.nports - 1];
+
+		net_conns.port_index[slot] = 0;
+		if (p != end) {
+			*p = *end;
+			net_conns.port_index[(end->proto == IPPROTO_UDP ?
+			    65536u : 0u) + end->port] = idx;
+		}
+		net_conns.nports--;
+	}
+}
+
+/** Busier port first, then the lower port number, TCP before UDP. */
+static int
+net_port_before(const net_port_t *a, const net_port_t *b)
+{
+	if (a->conns != b->conns)
+		return a->conns > b->conns;
+	if (a->port != b->port)
+		return a->port < b->port;
+	return a->proto < b->proto;
+}
+
+static void
+net_conns_rank(void)
+{
+	net_conns.ntop = 0;
+	for (size_t i = 0; i < net_conns.nports; i++) {
+		const net_port_t *p = &net_conns.ports[i];
+		int j;
+
+		if (net_conns.ntop < NET_CONNS_TOP_PORTS)
+			j = net_conns.ntop++;
+		else if (net_port_before(p,
+		    &net_conns.top[NET_CONNS_TOP_PORTS - 1]))
+			j = NET_CONNS_TOP_PORTS - 1;
+		else
+			continue;
+		while (j > 0 && net_port_before(p, &net_conns.top[j - 1])) {
+			net_conns.top[j] = net_conns.top[j - 1];
+			j--;
+		}
+		net_conns.top[j] = *p;
+	}
+}
+
+static void
+net_conns_format(void)
+{
+	const net_conns_stats_t *st = &net_conns.stats;
+	size_t size = sizeof(net_conns.json);
+	char *p = net_conns.json;
+	int n;
+
+	n = snprintf(p, size, "\"connections\":{\"total\":%u,\"tcp\":%u,"
+	    "\"udp\":%u,\"listening\":%u,\"established\":%u,\"ports\":%u,"
+	    "\"added\":%u,\"removed\":%u,\"changed\":%u,\"top_ports\":[",
+	    st->total, st->tcp, st->udp, st->listening, st->established,
+	    st->ports, st->added, st->removed, st->changed);
+	for (int i = 0; i < net_conns.ntop && n > 0 && (size_t)n < size; i++) {
+		const net_port_t *tp = &net_conns.top[i];
+
+		n += snprintf(p + n, size - (size_t)n, "%s{\"protocol\":\"%s\","
+		    "\"port\":%u,\"connections\":%u,\"listening\":%u}",
+		    i > 0 ? "," : "", tp->proto == IPPROTO_TCP ? "tcp" : "udp",
+		    (unsigned)tp->port, tp->conns, tp->listening);
+	}
+	if (n > 0 && (size_t)n < size)
+		n += snprintf(p + n, size - (size_t)n, "]}");
+	net_conns.json_len = n > 0 && (size_t)n < size ? (size_t)n : 0;
+	if (net_conns.json_len == 0)
+		net_conns.json[0] = '\0';
+}
+
+/**
+ * @brief Merge one sample of the socket table into the kept table.
+ *
+ * @param socks Sockets seen now; duplicates (one socket open in several
+ *        descriptors) are counted once.
+ * @param n Number of entries in @p socks.
+ * @param now Time of the sample.
+ *
+ * @return int 0 on success, -1 when the port index cannot be allocated.
+ */
+int
+net_conns_update(const net_conn_t *socks, size_t n, time_t now)
+{
+	net_conns_stats_t *st = &net_conns.stats;
+	uint32_t added = 0, removed = 0, changed = 0;
+	int redo;
+
+	pthread_mutex_lock(&net_conns.lock);
+	if (net_conns.port_index == NULL &&
+	    (net_conns.port_index = calloc(NET_PORT_SLOTS,
+	    sizeof(*net_conns.port_index))) == NULL) {
+		pthread_mutex_unlock(&net_conns.lock);
+		return -1;
+	}
+	net_conns.gen++;
+
+	for (size_t i = 0; i < n; i++) {
+		const net_conn_t *c = &socks[i];
+		uint32_t h = net_conn_hash(c);
+		net_conn_entry_t *e;
+
+		if (c->proto != IPPROTO_TCP && c->proto != IPPROTO_UDP)
+			continue;
+		if ((e = net_conns_lookup(c, h)) != NULL) {
+			if (e->gen == net_conns.gen)
+				continue;
+			e->gen = net_conns.gen;
+			if (e->c.state != c->state) {
+				net_conns_account(&e->c, -1);
+				e->c.state = c->state;
+				net_conns_account(&e->c, 1);
+				changed++;
+			}
+			continue;
+		}
+		if (net_conns_insert(c, h) != 0)
+			continue;
+		net_conns_account(c, 1);
+		added++;
+	}
+
+	for (size_t i = 0; i < net_conns.count;) {
+		if (net_conns.ents[i].gen == net_conns.gen) {
+			i++;
+			continue;
+		}
+		net_conns_account(&net_conns.ents[i].c, -1);
+		net_conns_remove(i);
+		removed++;
+	}
+
+	/* Also once after a busy sample, so the counters drop back to 0. */
+	redo = st->samples == 0 || added || removed || changed ||
+	    st->added || st->removed || st->changed;
+	st->samples++;
+	st->ports = (uint32_t)net_conns.nports;
+	st->added = added;
+	st->removed = removed;
+	st->changed = changed;
+	st->added_total += added;
+	st->removed_total += removed;
+	st->updated = now;
+	if (redo) {
+		net_conns_rank();
+		net_conns_format();
+	}
+	pthread_mutex_unlock(&net_conns.lock);
+	return 0;
+}
+
+/**
+ * @brief Read the inet sockets from the kernel and merge them in.
+ *
+ * @param now Time of the sample.
+ *
+ * @return int 0 on success, -1 when the table cannot be read.
+ */
+int
+net_conns_collect(time_t now)
+{
+#ifdef __OpenBSD__
+	int mib[6] = {CTL_KERN, KERN_FILE, KERN_FILE_BYFILE, DTYPE_SOCKET,
+	    sizeof(struct kinfo_file), 0};
+	size_t len, n, nsocks = 0;
+
+	for (int tries = 0;; tries++) {
+		if (sysctl(mib, 6, NULL, &len, NULL, 0) == -1)
+			return -1;
+		/* Room for sockets opened between the two calls. */
+		len += len / 8 + 16 * sizeof(struct kinfo_file);
+		if (len > net_kf_size) {
+			struct kinfo_file *kf = realloc(net_kf, len);
+
+			if (kf == NULL)
+				return -1;
+			net_kf = kf;
+			net_kf_size = len;
+		}
+		mib[5] = (int)(net_kf_size / sizeof(struct kinfo_file));
+		len = net_kf_size;
+		if (sysctl(mib, 6, net_kf, &len, NULL, 0) == 0)
+			break;
+		if (errno != ENOMEM || tries == 2)
+			return -1;
+	}
+
+	n = len / sizeof(struct kinfo_file);
+	if (n > net_socks_cap) {
+		net_conn_t *s = realloc(net_socks, n * sizeof(*s));
+
+		if (s == NULL)
+			return -1;
+		net_socks = s;
+		net_socks_cap = n;
+	}
+	for (size_t i = 0; i < n; i++) {
+		const struct kinfo_file *k = &net_kf[i];
+		net_conn_t *s = &net_socks[nsocks];
+		size_t alen;
+
+		if (k->so_family == AF_INET)
+			alen = 4;
+		else if (k->so_family == AF_INET6)
+			alen = 16;
+		else
+			continue;
+		if (k->so_protocol != IPPROTO_TCP &&
+		    k->so_protocol != IPPROTO_UDP)
+			continue;
+		memset(s, 0, sizeof(*s));
+		s->family = (uint8_t)k->so_family;
+		s->proto = (uint8_t)k->so_protocol;
+		if (s->proto == IPPROTO_TCP)
+			s->state = (uint8_t)k->t_state;
+		s->lport = ntohs(k->inp_lport);
+		s->fport = ntohs(k->inp_fport);
+		memcpy(s->laddr, k->inp_laddru, alen);
+		memcpy(s->faddr, k->inp_faddru, alen);
+		nsocks++;
+	}
+	return net_conns_update(net_socks, nsocks, now);
+#else
+	(void)now;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/** Copy the totals of the last sample into @p out. */
+void
+net_conns_stats(net_conns_stats_t *out)
+{
+	pthread_mutex_lock(&net_conns.lock);
+	*out = net_conns.stats;
+	pthread_mutex_unlock(&net_conns.lock);
+}
+
+/**
+ * @brief Copy the busiest local ports of the last sample.
+ *
+ * @return int Number of ports copied, at most NET_CONNS_TOP_PORTS.
+ */
+int
+net_conns_top_ports(net_port_t *out, int max)
+{
+	int n;
+
+	pthread_mutex_lock(&net_conns.lock);
+	n = net_conns.ntop < max ? net_conns.ntop : max;
+	if (n > 0)
+		memcpy(out, net_conns.top, (size_t)n * sizeof(*out));
+	pthread_mutex_unlock(&net_conns.lock);
+	return n < 0 ? 0 : n;
+}
+
+/**
+ * @brief Format up to @p max sockets of the table, in no given order.
+ *
+ * @return int Number of entries written.
+ */
+int
+net_conns_list(NetworkConnection *out, int max)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&net_conns.lock);
+	for (size_t i = 0; i < net_conns.count && n < max; i++, n++) {
+		const net_conn_t *c = &net_conns.ents[i].c;
+		NetworkConnection *o = &out[n];
+		int af = c->family == AF_INET6 ? AF_INET6 : AF_INET;
+
+		memset(o, 0, sizeof(*o));
+		snprintf(o->protocol, sizeof(o->protocol), "%s%s",
+		    c->proto == IPPROTO_TCP ? "tcp" : "udp",
+		    af == AF_INET6 ? "6" : "");
+		if (!inet_ntop(af, c->laddr, o->local_addr,
+		    sizeof(o->local_addr)))
+			o->local_addr[0] = '\0';
+		if (!inet_ntop(af, c->faddr, o->remote_addr,
+		    sizeof(o->remote_addr)))
+			o->remote_addr[0] = '\0';
+		o->local_port = c->lport;
+		o->remote_port = c->fport;
+		if (c->proto == IPPROTO_TCP && c->state <
+		    sizeof(net_tcp_states) / sizeof(net_tcp_states[0]))
+			snprintf(o->state, sizeof(o->state), "%s",
+			    net_tcp_states[c->state]);
+	}
+	pthread_mutex_unlock(&net_conns.lock);
+	return n;
+}
+
+/**
+ * @brief Copy the "connections" JSON member of the last sample.
+ *
+ * @return size_t Its length, or 0 when there is none or it does not fit.
+ */
+size_t
+net_conns_json(char *dst, size_t size)
+{
+	size_t len;
+
+	pthread_mutex_lock(&net_conns.lock);
+	len = net_conns.json_len;
+	if (len == 0 || len >= size)
+		len = 0;
+	else
+		memcpy(dst, net_conns.json, len + 1);
+	pthread_mutex_unlock(&net_conns.lock);
+	return len;
+}
+
+/** Release the table and the sample buffers. */
+void
+net_conns_cleanup(void)
+{
+	pthread_mutex_lock(&net_conns.lock);
+	free(net_conns.ents);
+	free(net_conns.buckets);
+	free(net_conns.port_index);
+	free(net_conns.ports);
+	net_conns.ents = NULL;
+	net_conns.buckets = NULL;
+	net_conns.port_index = NULL;
+	net_conns.ports = NULL;
+	net_conns.count = net_conns.cap = net_conns.nbuckets = 0;
+	net_conns.nports = net_conns.ports_cap = 0;
+	net_conns.ntop = 0;
+	memset(&net_conns.stats, 0, sizeof(net_conns.stats));
+	net_conns.json_len = 0;
+	net_conns.json[0] = '\0';
+	pthread_mutex_unlock(&net_conns.lock);
+#ifdef __OpenBSD__
+	free(net_kf);
+	free(net_socks);
+	net_kf = NULL;
+	net_socks = NULL;
+	net_kf_size = net_socks_cap = 0;
+#endif
+}
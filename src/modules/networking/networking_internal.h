@@ -0,0 +1,118 @@
+#ifndef MINIWEB_MODULES_NETWORKING_INTERNAL_H
+#define MINIWEB_MODULES_NETWORKING_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <miniweb/http/json.h>
+#include <miniweb/modules/networking.h>
+
+#define NET_CONNS_TOP_PORTS	20
+
+/** One TCP or UDP socket; everything but @c state identifies it. */
+typedef struct {
+	uint8_t family;		/* AF_INET or AF_INET6 */
+	uint8_t proto;		/* IPPROTO_TCP or IPPROTO_UDP */
+	uint8_t state;		/* TCPS_*, 0 for UDP */
+	uint8_t pad;
+	uint16_t lport;		/* host byte order */
+	uint16_t fport;
+	uint8_t laddr[16];	/* IPv4 in the first four bytes */
+	uint8_t faddr[16];
+} net_conn_t;
+
+/** Sockets bound to one local port. */
+typedef struct {
+	uint8_t proto;
+	uint16_t port;
+	uint32_t conns;
+	uint32_t listening;	/* TCP LISTEN, or UDP not connected */
+} net_port_t;
+
+typedef struct {
+	uint64_t samples;
+	uint32_t total;
+	uint32_t tcp;
+	uint32_t udp;
+	uint32_t listening;
+	uint32_t established;
+	uint32_t ports;		/* distinct local ports */
+	uint32_t added;		/* by the last sample */
+	uint32_t removed;
+	uint32_t changed;	/* state changes */
+	uint64_t added_total;
+	uint64_t removed_total;
+	time_t updated;
+} net_conns_stats_t;
+
+int net_conns_collect(time_t now);
+int net_conns_update(const net_conn_t *socks, size_t n, time_t now);
+void net_conns_stats(net_conns_stats_t *out);
+int net_conns_top_ports(net_port_t *out, int max);
+int net_conns_list(NetworkConnection *out, int max);
+/* The "connections" member is at most this long. */
+#define NET_CONNS_JSON_MAX 4096
+
+size_t net_conns_json(char *dst, size_t size);
+void net_conns_cleanup(void);
+
+/* Route table operations, as the RTM_* message that carries them. */
+#define NET_ROUTE_ADD		1
+#define NET_ROUTE_CHANGE	2
+#define NET_ROUTE_DELETE	3
+
+/** One route; family, priority, destination and mask are its key. */
+typedef struct {
+	uint8_t family;		/* of the destination */
+	uint8_t gw_family;	/* AF_INET, AF_INET6, AF_LINK or 0 */
+	uint8_t priority;
+	uint8_t has_mask;
+	uint16_t ifindex;
+	uint16_t gw_index;	/* interface of an AF_LINK gateway */
+	int flags;		/* RTF_* */
+	uint8_t dst[16];
+	uint8_t mask[16];
+	uint8_t gw[16];
+} net_route_t;
+
+int net_routes_apply(int op, const net_route_t *r);
+void net_routes_link(unsigned int ifindex, int up);
+void net_routes_forget_if(unsigned int ifindex);
+void net_routes_reset(void);
+int net_routes_copy(RouteEntry *out, int max);
+size_t net_routes_count(void);
+int net_routes_dump(void);
+int net_routes_start(void);
+int net_routes_live(void);
+void net_routes_cleanup(void);
+
+/*
+ * Per-interface rates (networking_rates.c): 1 s buckets for 10 min, 10 s
+ * for an hour, 1 min for a day.
+ */
+#define NET_RATE_IFS		10	/* interfaces with a slot, by name */
+#define NET_RATE_FIELDS		6	/* rx/tx bytes, packets, errs */
+#define NET_RATE_TIERS		3
+#define NET_RATE_MAX_SPAN	(24 * 3600)
+#define NET_RATE_BUCKETS	(600 + 360 + 1440)
+#define NET_RATE_FRAC		16	/* packet and error rates' divisor */
+
+/** One interface over one bucket: each rate's average and peak. */
+typedef struct {
+	uint32_t avg[NET_RATE_FIELDS];
+	uint32_t peak[NET_RATE_FIELDS];
+} net_rate_t;
+
+typedef struct {
+	int64_t ts;		/* bucket start, a step multiple */
+	uint16_t n[NET_RATE_IFS];	/* rates folded in; 0: not seen */
+	net_rate_t rate[NET_RATE_IFS];
+} net_rate_bucket_t;
+
+int net_rates_push(time_t ts, const NetStats *ifs, int n);
+unsigned long net_rates_version(void);
+void net_rates_json(json_writer_t *w, unsigned int span, const char *ifname);
+void net_rates_cleanup(void);
+
+#endif /* MINIWEB_MODULES_NETWORKING_INTERNAL_H */
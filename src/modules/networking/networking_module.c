@@ -2,24 +2,23 @@
 /*
  * networking_module.c - Network information collection for OpenBSD
  *
- * Collects routing tables, DNS config, and interface statistics
- * WITHOUT requiring root privileges (no pfctl)
+ * Collects routing tables, DNS config, interface statistics and the
+ * TCP/UDP connection table WITHOUT requiring root privileges (no pfctl)
  */
 
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <miniweb/router/router.h>
 #include <net/if.h>
-#include <net/if_dl.h>
-#include <net/route.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
-#include <sys/sysctl.h>
 #include <sys/types.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,17 +26,23 @@
 #include <unistd.h>
 
 /* Include del progetto */
+#include <miniweb/core/cache_admin.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/heartbeat.h>
+#include <miniweb/core/lockstat.h>
 #include <miniweb/core/log.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/core/readiness.h>
+#include <miniweb/core/snapshot.h>
+#include <miniweb/core/snapshot_delta.h>
+#include <miniweb/http/gzip.h>
 #include <miniweb/http/handler.h>
+#include <miniweb/http/json.h>
+#include <miniweb/http/utils.h>
 #include <miniweb/modules/networking.h>
 #include <miniweb/render/template_engine.h>
 
-#ifndef SA_SIZE
-#define SA_SIZE(sa)                                                            \
-	(((sa)->sa_len == 0) ? sizeof(struct sockaddr) : (size_t)(sa)->sa_len)
-#endif
+#include "networking_internal.h"
 
 /* Verbose logging */
 extern int config_verbose;
@@ -47,7 +52,7 @@ extern int config_verbose;
 			log_debug("[NETWORK] " __VA_ARGS__);                   \
 	} while (0)
 
-#define NETWORK_JSON_BUFFER_SIZE 65536
+#define NETWORK_JSON_SIZE_HINT 16384
 #define NETWORK_RING_BYTES (1024 * 1024)
 
 typedef struct {
@@ -62,170 +67,71 @@ typedef struct {
 #define NETWORK_RING_CAPACITY                                                  \
 	((size_t)(NETWORK_RING_BYTES / sizeof(NetworkingSample)))
 
+/* The cached payload, published by reference and never changed after. */
+typedef struct {
+	snapshot_t hdr;
+	char *json;
+	size_t len;
+	time_t ts;
+	unsigned long version;
+	http_blob_t *gz;		/* json, gzipped once; may be NULL */
+} NetworkingPayload;
+
 typedef struct {
 	NetworkingSample *buf;
 	size_t head;
 	size_t count;
 	pthread_mutex_t lock;
-	char *cached_json;
-	size_t cached_json_len;
-	time_t cached_json_ts;
+	snapshot_span_t spans[SNAPSHOT_DELTA_SECTIONS];	/* payload members */
+	size_t nspans;
+	snapshot_delta_t delta;		/* what each version changed */
 } NetworkingRing;
 
 static NetworkingRing g_networking_ring;
+LOCKSTAT_SITE(lockstat_ring, "networking_ring");
+/* Read without a lock; published under the ring lock, with the spans. */
+static snapshot_slot_t g_networking_payload = SNAPSHOT_SLOT_INITIALIZER;
+/* One payload is built at a time, so its version is known up front. */
+static pthread_mutex_t g_networking_update_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long g_networking_version;	/* update lock */
 static pthread_once_t g_networking_once = PTHREAD_ONCE_INIT;
 
 static int networking_ring_init(NetworkingRing *r);
 static void networking_ring_push(NetworkingRing *r, const NetworkingSample *s);
 static int networking_ring_last(NetworkingRing *r, NetworkingSample *out);
 static void networking_collect_sample(NetworkingSample *sample);
+static char *networking_cache_refresh(const NetworkingSample *sample,
+    unsigned long *version);
 static void networking_heartbeat_cb(void *ctx);
 static void networking_ring_bootstrap(void);
-static char *networking_build_json(const NetworkingSample *sample);
-static int networking_json_append(char *dst, size_t dst_size, size_t *offset,
-				  const char *fmt, ...);
-static int networking_json_append_escaped(char *dst, size_t dst_size,
-					  size_t *offset, const char *src);
+static char *networking_build_json(const NetworkingSample *sample,
+    unsigned long version, snapshot_span_t *spans, size_t *nspans);
 
 /* ========================================================================
  * ROUTING TABLE
  * ======================================================================== */
 
 /**
- * @brief Read the kernel routing table into @p routes.
+ * @brief Copy the first routes of the kernel routing table into @p routes.
+ *
+ * The table is kept current from a PF_ROUTE socket when one could be
+ * opened (see networking_routes.c); otherwise it is dumped again here.
+ *
  * @param routes     Caller-allocated array of route descriptor structs.
  * @param max_routes Capacity of @p routes.
- * @return Number of routes stored on success, -1 on failure.
+ * @return Number of routes stored.
  */
 int
 networking_get_routes(RouteEntry *routes, int max_routes)
 {
-	int mib[6];
-	size_t needed;
-	char *buf, *next, *lim;
-	struct rt_msghdr *rtm;
-	struct sockaddr *sa;
-	struct sockaddr_in *sin;
-	struct sockaddr_in6 *sin6;
-	// struct sockaddr_dl *sdl;
-	struct sockaddr_dl *sdl __attribute__((unused));
-	int count = 0;
+	int count;
 
 	LOG("Getting routing table...");
-
-	mib[0] = CTL_NET;
-	mib[1] = PF_ROUTE;
-	mib[2] = 0;
-	mib[3] = 0;
-	mib[4] = NET_RT_DUMP;
-	mib[5] = 0;
-
-	if (sysctl(mib, 6, NULL, &needed, NULL, 0) < 0) {
-		LOG("sysctl routing table size failed: %s", strerror(errno));
-		return 0;
-	}
-
-	buf = malloc(needed);
-	if (buf == NULL) {
-		LOG("malloc failed for routing table");
-		return 0;
-	}
-
-	if (sysctl(mib, 6, buf, &needed, NULL, 0) < 0) {
+	if (!net_routes_live() && net_routes_dump() != 0) {
 		LOG("sysctl routing table failed: %s", strerror(errno));
-		free(buf);
 		return 0;
 	}
-
-	lim = buf + needed;
-	for (next = buf; next < lim && count < max_routes;
-	     next += rtm->rtm_msglen) {
-		rtm = (struct rt_msghdr *)next;
-
-		if (rtm->rtm_version != RTM_VERSION) {
-			continue;
-		}
-		if (rtm->rtm_type != RTM_GET && rtm->rtm_type != RTM_ADD) {
-			continue;
-		}
-
-		sa = (struct sockaddr *)(rtm + 1);
-
-		/* Destination */
-		if (rtm->rtm_addrs & RTA_DST) {
-			if (sa->sa_family == AF_INET) {
-				sin = (struct sockaddr_in *)sa;
-				inet_ntop(AF_INET, &sin->sin_addr,
-					  routes[count].destination,
-					  sizeof(routes[count].destination));
-			} else if (sa->sa_family == AF_INET6) {
-				sin6 = (struct sockaddr_in6 *)sa;
-				inet_ntop(AF_INET6, &sin6->sin6_addr,
-					  routes[count].destination,
-					  sizeof(routes[count].destination));
-			} else {
-				strlcpy(routes[count].destination, "-",
-					sizeof(routes[count].destination));
-			}
-			sa = (struct sockaddr *)((char *)sa + SA_SIZE(sa));
-		}
-
-		/* Gateway */
-		if (rtm->rtm_addrs & RTA_GATEWAY) {
-			if (sa->sa_family == AF_INET) {
-				sin = (struct sockaddr_in *)sa;
-				inet_ntop(AF_INET, &sin->sin_addr,
-					  routes[count].gateway,
-					  sizeof(routes[count].gateway));
-			} else if (sa->sa_family == AF_INET6) {
-				sin6 = (struct sockaddr_in6 *)sa;
-				inet_ntop(AF_INET6, &sin6->sin6_addr,
-					  routes[count].gateway,
-					  sizeof(routes[count].gateway));
-			} else if (sa->sa_family == AF_LINK) {
-				sdl = (struct sockaddr_dl *)sa;
-				strlcpy(routes[count].gateway, "link#",
-					sizeof(routes[count].gateway));
-			} else {
-				strlcpy(routes[count].gateway, "-",
-					sizeof(routes[count].gateway));
-			}
-			sa = (struct sockaddr *)((char *)sa + SA_SIZE(sa));
-		}
-
-		/* Netmask */
-		if (rtm->rtm_addrs & RTA_NETMASK) {
-			if (sa->sa_family == AF_INET) {
-				sin = (struct sockaddr_in *)sa;
-				inet_ntop(AF_INET, &sin->sin_addr,
-					  routes[count].netmask,
-					  sizeof(routes[count].netmask));
-			} else {
-				strlcpy(routes[count].netmask, "-",
-					sizeof(routes[count].netmask));
-			}
-			sa = (struct sockaddr *)((char *)sa + SA_SIZE(sa));
-		}
-
-		/* Interface */
-		if (rtm->rtm_index > 0) {
-			if_indextoname(rtm->rtm_index, routes[count].interface);
-		}
-
-		/* Flags */
-		routes[count].flags = rtm->rtm_flags;
-		snprintf(routes[count].flags_str,
-			 sizeof(routes[count].flags_str), "%s%s%s%s%s",
-			 (rtm->rtm_flags & RTF_UP) ? "U" : "",
-			 (rtm->rtm_flags & RTF_GATEWAY) ? "G" : "",
-			 (rtm->rtm_flags & RTF_HOST) ? "H" : "",
-			 (rtm->rtm_flags & RTF_STATIC) ? "S" : "",
-			 (rtm->rtm_flags & RTF_DYNAMIC) ? "D" : "");
-
-		count++;
-	}
-
-	free(buf);
+	count = net_routes_copy(routes, max_routes);
 	LOG("Retrieved %d routes", count);
 	return count;
 }
@@ -391,22 +297,46 @@ networking_get_if_stats(NetStats *stats, int max_interfaces)
  * ======================================================================== */
 
 /**
- * @brief Enumerate active TCP/UDP connections via sysctl.
+ * @brief Copy active TCP/UDP connections from the sampled table.
+ *
+ * The table is read from the kern.file sysctl by the networking heartbeat
+ * (see networking_conns.c); this only copies its last state.
+ *
  * @param conns     Caller-allocated array of connection descriptor structs.
  * @param max_conns Capacity of @p conns.
- * @return Number of connections stored on success, -1 on failure.
+ * @return Number of connections stored.
  */
 int
 networking_get_connections(NetworkConnection *conns, int max_conns)
 {
-	/* This would use sysctl to get TCP/UDP connection table
-	 * Similar to: sysctl net.inet.tcp.pcblist
-	 * For simplicity, leaving this as a placeholder */
-	(void)conns;
-	(void)max_conns;
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	return net_conns_list(conns, max_conns);
+}
+
+/**
+ * @brief Copy the local ports with the most sockets, busiest first.
+ * @param ports     Caller-allocated array of port descriptor structs.
+ * @param max_ports Capacity of @p ports.
+ * @return Number of ports stored.
+ */
+int
+networking_get_top_ports(NetworkPort *ports, int max_ports)
+{
+	net_port_t top[NET_CONNS_TOP_PORTS];
+	int n;
 
-	LOG("Getting network connections (placeholder)...");
-	return 0;
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	n = net_conns_top_ports(top,
+	    max_ports < NET_CONNS_TOP_PORTS ? max_ports : NET_CONNS_TOP_PORTS);
+	for (int i = 0; i < n; i++) {
+		strlcpy(ports[i].protocol,
+		    top[i].proto == IPPROTO_TCP ? "tcp" : "udp",
+		    sizeof(ports[i].protocol));
+		ports[i].port = top[i].port;
+		ports[i].connections = (int)top[i].conns;
+		ports[i].listening = (int)top[i].listening;
+	}
+	return n;
 }
 
 /**
@@ -422,9 +352,6 @@ networking_ring_init(NetworkingRing *r)
 		return -1;
 	r->head = 0;
 	r->count = 0;
-	r->cached_json = NULL;
-	r->cached_json_len = 0;
-	r->cached_json_ts = 0;
 	pthread_mutex_init(&r->lock, NULL);
 	return 0;
 }
@@ -492,6 +419,84 @@ networking_collect_sample(NetworkingSample *sample)
 		sample->interface_count = 0;
 }
 
+/** Free a payload once its last reader has released it. */
+static void
+networking_payload_free(snapshot_t *s)
+{
+	NetworkingPayload *p = (NetworkingPayload *)s;
+
+	free(p->json);
+	http_blob_release(p->gz);
+	free(p);
+}
+
+/** Reference on the cached payload, or NULL when there is none yet. */
+static NetworkingPayload *
+networking_payload_acquire(void)
+{
+	return (NetworkingPayload *)snapshot_acquire(&g_networking_payload);
+}
+
+/**
+ * @brief Build the payload for @p sample and install it as the cached one,
+ * with its gzip form.
+ *
+ * @details Builds are serialised so the version embedded in the payload
+ * is the one it is published as. Compression runs before it is
+ * published, and readers take it by reference without waiting on it.
+ *
+ * @param sample Sample to build from.
+ * @param version Receives the new version; may be NULL.
+ *
+ * @return A heap copy of the payload for the caller to free() when
+ *         @p version is not NULL, otherwise NULL; NULL on failure.
+ */
+static char *
+networking_cache_refresh(const NetworkingSample *sample,
+    unsigned long *version)
+{
+	snapshot_span_t spans[SNAPSHOT_DELTA_SECTIONS];
+	NetworkingPayload *p;
+	size_t nspans;
+	unsigned long next;
+	char *json, *copy = NULL;
+
+	pthread_mutex_lock(&g_networking_update_lock);
+	next = g_networking_version + 1;
+
+	json = networking_build_json(sample, next, spans, &nspans);
+	if (json == NULL || (p = calloc(1, sizeof(*p))) == NULL) {
+		free(json);
+		pthread_mutex_unlock(&g_networking_update_lock);
+		return NULL;
+	}
+	if (version != NULL && (copy = strdup(json)) == NULL) {
+		free(json);
+		free(p);
+		pthread_mutex_unlock(&g_networking_update_lock);
+		return NULL;
+	}
+	snapshot_init(&p->hdr, networking_payload_free);
+	p->json = json;
+	p->len = strlen(json);
+	p->ts = sample->ts;
+	p->version = next;
+	p->gz = http_gzip_blob(json, p->len);
+	g_networking_version = next;
+
+	LOCKSTAT_LOCK(&g_networking_ring.lock, lockstat_ring);
+	snapshot_publish(&g_networking_payload, &p->hdr);
+	memcpy(g_networking_ring.spans, spans, nspans * sizeof(spans[0]));
+	g_networking_ring.nspans = nspans;
+	snapshot_delta_publish(&g_networking_ring.delta, next, sample->ts,
+	    json, spans, nspans);
+	LOCKSTAT_UNLOCK(&g_networking_ring.lock, lockstat_ring);
+	pthread_mutex_unlock(&g_networking_update_lock);
+	if (version)
+		*version = next;
+	return copy;
+}
+
 /**
  * @brief Heartbeat callback that samples networking state every tick.
  * @param ctx Unused context pointer (heartbeat API conformance).
@@ -500,21 +505,49 @@ static void
 networking_heartbeat_cb(void *ctx)
 {
 	NetworkingSample sample;
-	char *json;
 
 	(void)ctx;
 	networking_collect_sample(&sample);
-	json = networking_build_json(&sample);
+	if (net_conns_collect(sample.ts) != 0)
+		LOG("Connection table unavailable: %s", strerror(errno));
+	(void)net_rates_push(sample.ts, sample.interfaces,
+	    sample.interface_count);
 	networking_ring_push(&g_networking_ring, &sample);
+	(void)networking_cache_refresh(&sample, NULL);
+}
 
-	if (json != NULL) {
-		pthread_mutex_lock(&g_networking_ring.lock);
-		free(g_networking_ring.cached_json);
-		g_networking_ring.cached_json = json;
-		g_networking_ring.cached_json_len = strlen(json);
-		g_networking_ring.cached_json_ts = sample.ts;
-		pthread_mutex_unlock(&g_networking_ring.lock);
-	}
+/** cache_admin stats(): the cached payload and its gzip form. */
+static void
+networking_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	NetworkingPayload *p = networking_payload_acquire();
+
+	(void)ctx;
+	if (p == NULL)
+		return;
+	st->bytes = p->len + (p->gz != NULL ? p->gz->len : 0);
+	st->entries = 1;
+	snapshot_release(&p->hdr);
+}
+
+/**
+ * cache_admin purge(): the one key is "/api/networking". The payload is
+ * rebuilt from a fresh sample at once rather than dropped, since every
+ * reader expects one to be there.
+ */
+static size_t
+networking_admin_purge(const char *key, int prefix, void *ctx)
+{
+	NetworkingSample sample;
+
+	(void)ctx;
+	if (g_networking_ring.buf == NULL ||
+	    !cache_admin_match("/api/networking", key, prefix))
+		return 0;
+	networking_collect_sample(&sample);
+	networking_ring_push(&g_networking_ring, &sample);
+	(void)networking_cache_refresh(&sample, NULL);
+	return 1;
 }
 
 /**
@@ -529,6 +562,17 @@ networking_ring_bootstrap(void)
 		LOG("Failed to allocate 1MB networking ring");
 		return;
 	}
+	(void)mem_budget_register_fixed("networking_ring",
+	    NETWORK_RING_CAPACITY * sizeof(NetworkingSample));
+	(void)mem_budget_register_fixed("networking_rates",
+	    NET_RATE_BUCKETS * sizeof(net_rate_bucket_t));
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "networking_json",
+		.stats = networking_admin_stats,
+		.purge = networking_admin_purge,
+	});
+	if (net_routes_start() != 0)
+		LOG("No route socket, dumping the routing table per sample");
 
 	if (heartbeat_register(&(struct hb_task){
 		.name = "networking.sample",
@@ -550,87 +594,6 @@ networking_ring_bootstrap(void)
 	}
 }
 
-/**
- * @brief networking_json_append operation.
- *
- * @details Performs the core networking_json_append routine for this module.
- *
- * @param dst Input parameter for networking_json_append.
- * @param dst_size Input parameter for networking_json_append.
- * @param offset Input parameter for networking_json_append.
- * @param fmt Input parameter for networking_json_append.
- * @param ... Input parameter for networking_json_append.
- *
- * @return Return value produced by networking_json_append.
- */
-static int
-networking_json_append(char *dst, size_t dst_size, size_t *offset,
-		       const char *fmt, ...)
-{
-	va_list ap;
-	int written;
-
-	if (*offset >= dst_size)
-		return -1;
-
-	va_start(ap, fmt);
-	written = vsnprintf(dst + *offset, dst_size - *offset, fmt, ap);
-	va_end(ap);
-
-	if (written < 0)
-		return -1;
-	if ((size_t)written >= (dst_size - *offset)) {
-		*offset = dst_size;
-		return -1;
-	}
-
-	*offset += (size_t)written;
-	return 0;
-}
-
-/**
- * @brief networking_json_append_escaped operation.
- *
- * @details Performs the core networking_json_append_escaped routine for this module.
- *
- * @param dst Input parameter for networking_json_append_escaped.
- * @param dst_size Input parameter for networking_json_append_escaped.
- * @param offset Input parameter for networking_json_append_escaped.
- * @param src Input parameter for networking_json_append_escaped.
- *
- * @return Return value produced by networking_json_append_escaped.
- */
-static int
-networking_json_append_escaped(char *dst, size_t dst_size, size_t *offset,
-			       const char *src)
-{
-	const unsigned char *p = (const unsigned char *)src;
-
-	if (!src)
-		return networking_json_append(dst, dst_size, offset, "null");
-
-	if (networking_json_append(dst, dst_size, offset, "\"") != 0)
-		return -1;
-
-	for (; *p != '\0'; p++) {
-		if (*p == '"' || *p == '\\') {
-			if (networking_json_append(dst, dst_size, offset,
-						   "\\%c", *p) != 0)
-				return -1;
-		} else if (*p < 0x20) {
-			if (networking_json_append(dst, dst_size, offset,
-						   "\\u%04x", *p) != 0)
-				return -1;
-		} else {
-			if (networking_json_append(dst, dst_size, offset, "%c",
-						   *p) != 0)
-				return -1;
-		}
-	}
-
-	return networking_json_append(dst, dst_size, offset, "\"");
-}
-
 /* ========================================================================
  * JSON GENERATION
  * ======================================================================== */
@@ -642,21 +605,29 @@ networking_json_append_escaped(char *dst, size_t dst_size, size_t *offset,
  * the pre-built payload directly to avoid sysctl traversal on the
  * HTTP request path.
  *
+ * @details Each top-level member (the header, routes, DNS, interfaces
+ * and connections) is recorded in @p spans so a delta can resend only
+ * the ones that changed.
+ *
+ * @param sample Sample to serialise.
+ * @param version Version the payload will be published as.
+ * @param spans Receives the members' spans.
+ * @param nspans Receives the number of spans.
+ *
  * @return Heap-allocated JSON string that the caller must free(), or NULL.
  */
 static char *
-networking_build_json(const NetworkingSample *sample)
+networking_build_json(const NetworkingSample *sample, unsigned long version,
+    snapshot_span_t *spans, size_t *nspans)
 {
-	char *json = NULL;
-	size_t json_size = NETWORK_JSON_BUFFER_SIZE;
-	size_t offset = 0;
+	json_writer_t w;
+	size_t start;
 	struct tm tm_buf;
 	char timestamp[64];
 	struct tm *tm_ptr;
+	char *p, *json;
 
-	/* Allocate JSON buffer */
-	json = malloc(json_size);
-	if (!json) {
+	if (json_init(&w, NULL, NETWORK_JSON_SIZE_HINT) != 0) {
 		LOG("Failed to allocate JSON buffer");
 		return NULL;
 	}
@@ -670,158 +641,174 @@ networking_build_json(const NetworkingSample *sample)
 		strlcpy(timestamp, "unknown", sizeof(timestamp));
 	}
 
-	if (networking_json_append(json, json_size, &offset,
-				   "{\"timestamp\":") != 0)
-		goto fail;
-	if (networking_json_append_escaped(json, json_size, &offset,
-					   timestamp) != 0)
-		goto fail;
-	if (networking_json_append(json, json_size, &offset,
-				   ",\"timestamp_unix\":%lld,",
-				   (long long)sample->ts) != 0)
-		goto fail;
+	*nspans = 0;
+#define NET_JSON_SPAN(from)						\
+	do {								\
+		spans[*nspans].off = (from);				\
+		spans[*nspans].len = w.len - (from);			\
+		(*nspans)++;						\
+	} while (0)
+
+	json_putc(&w, '{');
+	start = w.len;
+	json_puts(&w, "\"timestamp\":");
+	json_str(&w, timestamp);
+	json_printf(&w, ",\"timestamp_unix\":%lld,\"version\":%lu",
+	    (long long)sample->ts, version);
+	NET_JSON_SPAN(start);
 
 	/* Routes */
-	if (networking_json_append(json, json_size, &offset, "\"routes\":[") !=
-	    0)
-		goto fail;
+	json_putc(&w, ',');
+	start = w.len;
+	json_puts(&w, "\"routes\":[");
 	for (int i = 0; i < sample->route_count; i++) {
-		if (networking_json_append(
-			json, json_size, &offset,
-			"%s{\"destination\":", i > 0 ? "," : "") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset,
-			sample->routes[i].destination) != 0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"gateway\":") != 0)
-			goto fail;
-		if (networking_json_append_escaped(json, json_size, &offset,
-						   sample->routes[i].gateway) !=
-		    0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"netmask\":") != 0)
-			goto fail;
-		if (networking_json_append_escaped(json, json_size, &offset,
-						   sample->routes[i].netmask) !=
-		    0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"interface\":") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset,
-			sample->routes[i].interface) != 0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"flags\":") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset,
-			sample->routes[i].flags_str) != 0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset, "}") != 0)
-			goto fail;
+		const RouteEntry *r = &sample->routes[i];
+
+		json_puts(&w, i > 0 ? ",{\"destination\":" : "{\"destination\":");
+		json_str(&w, r->destination);
+		json_puts(&w, ",\"gateway\":");
+		json_str(&w, r->gateway);
+		json_puts(&w, ",\"netmask\":");
+		json_str(&w, r->netmask);
+		json_puts(&w, ",\"interface\":");
+		json_str(&w, r->interface);
+		json_puts(&w, ",\"flags\":");
+		json_str(&w, r->flags_str);
+		json_putc(&w, '}');
 	}
-	if (networking_json_append(json, json_size, &offset, "],") != 0)
-		goto fail;
+	json_printf(&w, "],\"routes_total\":%zu", net_routes_count());
+	NET_JSON_SPAN(start);
 
 	/* DNS */
-	if (networking_json_append(json, json_size, &offset,
-				   "\"dns\":{\"nameservers\":[") != 0)
-		goto fail;
+	json_putc(&w, ',');
+	start = w.len;
+	json_puts(&w, "\"dns\":{\"nameservers\":[");
 	for (int i = 0; i < sample->dns.nameserver_count; i++) {
-		if (networking_json_append(json, json_size, &offset, "%s",
-					   i > 0 ? "," : "") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset, sample->dns.nameservers[i]) !=
-		    0)
-			goto fail;
+		if (i > 0)
+			json_putc(&w, ',');
+		json_str(&w, sample->dns.nameservers[i]);
 	}
-	if (networking_json_append(json, json_size, &offset, "],\"domain\":") !=
-	    0)
-		goto fail;
-	if (networking_json_append_escaped(json, json_size, &offset,
-					   sample->dns.domain) != 0)
-		goto fail;
-	if (networking_json_append(json, json_size, &offset, ",\"search\":") !=
-	    0)
-		goto fail;
-	if (networking_json_append_escaped(json, json_size, &offset,
-					   sample->dns.search) != 0)
-		goto fail;
-	if (networking_json_append(json, json_size, &offset, "},") != 0)
-		goto fail;
+	json_puts(&w, "],\"domain\":");
+	json_str(&w, sample->dns.domain);
+	json_puts(&w, ",\"search\":");
+	json_str(&w, sample->dns.search);
+	json_putc(&w, '}');
+	NET_JSON_SPAN(start);
 
 	/* Interface Stats */
-	if (networking_json_append(json, json_size, &offset,
-				   "\"interfaces\":[") != 0)
-		goto fail;
+	json_putc(&w, ',');
+	start = w.len;
+	json_puts(&w, "\"interfaces\":[");
 	for (int i = 0; i < sample->interface_count; i++) {
-		if (networking_json_append(
-			json, json_size, &offset,
-			"%s{\"interface\":", i > 0 ? "," : "") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset,
-			sample->interfaces[i].interface) != 0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"ipv4\":") != 0)
-			goto fail;
-		if (networking_json_append_escaped(
-			json, json_size, &offset, sample->interfaces[i].ipv4) !=
-		    0)
-			goto fail;
-		if (networking_json_append(json, json_size, &offset,
-					   ",\"rx_packets\":%llu,\"rx_bytes\":%"
-					   "llu,\"rx_errors\":%llu,"
-					   "\"tx_packets\":%llu,\"tx_bytes\":%"
-					   "llu,\"tx_errors\":%llu}",
-					   sample->interfaces[i].rx_packets,
-					   sample->interfaces[i].rx_bytes,
-					   sample->interfaces[i].rx_errors,
-					   sample->interfaces[i].tx_packets,
-					   sample->interfaces[i].tx_bytes,
-					   sample->interfaces[i].tx_errors) !=
-		    0)
-			goto fail;
+		const NetStats *s = &sample->interfaces[i];
+
+		json_puts(&w, i > 0 ? ",{\"interface\":" : "{\"interface\":");
+		json_str(&w, s->interface);
+		json_puts(&w, ",\"ipv4\":");
+		json_str(&w, s->ipv4);
+		json_printf(&w, ",\"rx_packets\":%llu,\"rx_bytes\":%llu,"
+		    "\"rx_errors\":%llu,\"tx_packets\":%llu,\"tx_bytes\":%llu,"
+		    "\"tx_errors\":%llu}", s->rx_packets, s->rx_bytes,
+		    s->rx_errors, s->tx_packets, s->tx_bytes, s->tx_errors);
 	}
-	if (networking_json_append(json, json_size, &offset, "]") != 0)
-		goto fail;
+	json_putc(&w, ']');
+	NET_JSON_SPAN(start);
+
+	/* Connection summary, formatted by the collector when it changed */
+	if ((p = json_reserve(&w, NET_CONNS_JSON_MAX + 1)) != NULL) {
+		size_t len;
+
+		p[0] = ',';
+		len = net_conns_json(p + 1, NET_CONNS_JSON_MAX);
+		if (len > 0) {
+			json_commit(&w, len + 1);
+			NET_JSON_SPAN(w.len - len);
+		}
+	}
+#undef NET_JSON_SPAN
 
-	if (networking_json_append(json, json_size, &offset, "}") != 0)
-		goto fail;
+	json_putc(&w, '}');
+	if ((json = json_finish(&w, NULL)) == NULL)
+		LOG("Failed to allocate JSON buffer");
 	return json;
+}
 
-fail:
-	free(json);
-	return NULL;
+/**
+ * @brief Version of the cached networking JSON.
+ *
+ * @return Version of the payload a request would be served now, or 0
+ *         when nothing is cached yet.
+ */
+unsigned long
+networking_json_version(void)
+{
+	NetworkingPayload *p;
+	unsigned long version;
+
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	if ((p = networking_payload_acquire()) == NULL)
+		return 0;
+	version = p->version;
+	snapshot_release(&p->hdr);
+	return version;
 }
 
 /**
- * @brief networking_get_json operation.
+ * @brief Reference the gzip form of the cached networking JSON.
  *
- * @details Performs the core networking_get_json routine for this module.
+ * @param version Receives the payload version; may be NULL.
  *
- * @return Return value produced by networking_get_json.
+ * @return A reference the caller releases, or NULL when nothing is
+ *         cached or it could not be compressed.
+ */
+http_blob_t *
+networking_json_gzip(unsigned long *version)
+{
+	NetworkingPayload *p;
+	http_blob_t *gz = NULL;
+
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	if ((p = networking_payload_acquire()) == NULL)
+		return NULL;
+	if (p->gz != NULL) {
+		gz = http_blob_ref(p->gz);
+		if (version)
+			*version = p->version;
+	}
+	snapshot_release(&p->hdr);
+	return gz;
+}
+
+/**
+ * @brief Return the networking JSON, copied into @p arena when given.
+ *
+ * @details Serves the ring's cached payload when one exists; otherwise
+ * builds it from the latest sample and refreshes the cache.
+ *
+ * @param arena Request arena receiving the copy, or NULL for malloc.
+ * @param version Receives the payload version; may be NULL. 0 when the
+ *        payload was built without a ring to cache it in.
+ *
+ * @return JSON owned by @p arena (or the caller when @p arena is NULL),
+ *         or NULL on failure.
  */
 char *
-networking_get_json(void)
+networking_get_json_arena(http_arena_t *arena, unsigned long *version)
 {
 	NetworkingSample sample;
+	NetworkingPayload *p;
 	char *json = NULL;
 
 	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
 
-	if (g_networking_ring.buf != NULL) {
-		pthread_mutex_lock(&g_networking_ring.lock);
-		if (g_networking_ring.cached_json != NULL)
-			json = strdup(g_networking_ring.cached_json);
-		pthread_mutex_unlock(&g_networking_ring.lock);
+	if (version)
+		*version = 0;
+	if ((p = networking_payload_acquire()) != NULL) {
+		json = arena ? http_arena_strndup(arena, p->json, p->len) :
+		    strdup(p->json);
+		if (json != NULL && version)
+			*version = p->version;
+		snapshot_release(&p->hdr);
 	}
 
 	if (json != NULL)
@@ -830,22 +817,189 @@ networking_get_json(void)
 	if (!networking_ring_last(&g_networking_ring, &sample))
 		networking_collect_sample(&sample);
 
-	json = networking_build_json(&sample);
-	if (json != NULL && g_networking_ring.buf != NULL) {
-		pthread_mutex_lock(&g_networking_ring.lock);
-		free(g_networking_ring.cached_json);
-		g_networking_ring.cached_json = strdup(json);
-		if (g_networking_ring.cached_json != NULL) {
-			g_networking_ring.cached_json_len =
-			    strlen(g_networking_ring.cached_json);
-			g_networking_ring.cached_json_ts = sample.ts;
-		}
-		pthread_mutex_unlock(&g_networking_ring.lock);
+	if (g_networking_ring.buf != NULL) {
+		unsigned long v;
+
+		json = networking_cache_refresh(&sample, &v);
+		if (json != NULL && version)
+			*version = v;
+	} else {
+		snapshot_span_t spans[SNAPSHOT_DELTA_SECTIONS];
+		size_t nspans;
+
+		json = networking_build_json(&sample, 0, spans, &nspans);
 	}
 
+	if (json != NULL && arena != NULL) {
+		char *copy = http_arena_strdup(arena, json);
+		free(json);
+		json = copy;
+	}
 	return json;
 }
 
+/**
+ * @brief Build what changed in the cached payload since @p since.
+ *
+ * @details The reply holds "delta": true, the version it starts from as
+ * "since", and the members whose bytes changed after it; the header
+ * with the new version and timestamp is always among them.
+ *
+ * @param arena Request arena receiving the reply, or NULL for malloc.
+ * @param since Version the client holds, or a Unix time.
+ * @param version Receives the current version; may be NULL.
+ *
+ * @return The reply, or NULL when nothing is cached or @p since cannot
+ *         be answered from the recent versions.
+ */
+char *
+networking_json_delta_arena(http_arena_t *arena, unsigned long long since,
+    unsigned long *version)
+{
+	NetworkingRing *r = &g_networking_ring;
+	NetworkingPayload *p;
+	unsigned long have;
+	int64_t have_ts;
+	size_t len = 48, off;
+	char *out = NULL;
+
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	if (r->buf == NULL)
+		return NULL;
+
+	/* Under the lock the published payload is the one the spans index. */
+	pthread_mutex_lock(&r->lock);
+	if ((p = networking_payload_acquire()) == NULL ||
+	    snapshot_delta_resolve(&r->delta, since, &have, &have_ts) != 0)
+		goto done;
+	for (size_t i = 0; i < r->nspans; i++) {
+		if (snapshot_delta_changed(&r->delta, i, have))
+			len += r->spans[i].len + 1;
+	}
+	out = arena ? http_arena_alloc(arena, len) : malloc(len);
+	if (out == NULL)
+		goto done;
+	off = (size_t)snprintf(out, len, "{\"delta\":true,\"since\":%lu",
+	    have);
+	for (size_t i = 0; i < r->nspans; i++) {
+		if (!snapshot_delta_changed(&r->delta, i, have))
+			continue;
+		out[off++] = ',';
+		memcpy(out + off, p->json + r->spans[i].off, r->spans[i].len);
+		off += r->spans[i].len;
+	}
+	out[off++] = '}';
+	out[off] = '\0';
+	if (version)
+		*version = p->version;
+done:
+	pthread_mutex_unlock(&r->lock);
+	if (p != NULL)
+		snapshot_release(&p->hdr);
+	return out;
+}
+
+/** Append printf output at @p *off; -1 when it does not fit. */
+static int
+networking_text_append(char *buf, size_t size, size_t *off, const char *fmt,
+    ...)
+{
+	va_list ap;
+	int n;
+
+	if (*off >= size)
+		return -1;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *off, size - *off, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (size_t)n >= size - *off)
+		return -1;
+	*off += (size_t)n;
+	return 0;
+}
+
+/**
+ * @brief Append the last sample as OpenMetrics families.
+ *
+ * @details Reads the ring and the collectors' state rather than the
+ * kernel, so it costs a copy per scrape render.
+ *
+ * @param buf Destination buffer.
+ * @param size Destination buffer size.
+ *
+ * @return Bytes written, or 0 when there is no sample yet or it did not
+ *         fit.
+ */
+size_t
+networking_append_openmetrics(char *buf, size_t size)
+{
+	static const struct {
+		const char *name;
+		size_t off;
+	} counters[] = {
+		{ "receive_packets", offsetof(NetStats, rx_packets) },
+		{ "receive_bytes", offsetof(NetStats, rx_bytes) },
+		{ "receive_errors", offsetof(NetStats, rx_errors) },
+		{ "transmit_packets", offsetof(NetStats, tx_packets) },
+		{ "transmit_bytes", offsetof(NetStats, tx_bytes) },
+		{ "transmit_errors", offsetof(NetStats, tx_errors) },
+	};
+	NetworkingSample sample;
+	net_conns_stats_t cs;
+	size_t off = 0;
+
+	if (size == 0 || !networking_ring_last(&g_networking_ring, &sample))
+		return 0;
+	for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+		if (networking_text_append(buf, size, &off,
+		    "# TYPE miniweb_network_%s counter\n", counters[c].name) != 0)
+			goto fail;
+		for (int i = 0; i < sample.interface_count; i++) {
+			const NetStats *st = &sample.interfaces[i];
+			unsigned long long v;
+
+			memcpy(&v, (const char *)st + counters[c].off, sizeof(v));
+			if (networking_text_append(buf, size, &off,
+			    "miniweb_network_%s_total{interface=\"%s\"} %llu\n",
+			    counters[c].name, st->interface, v) != 0)
+				goto fail;
+		}
+	}
+
+	net_conns_stats(&cs);
+	if (networking_text_append(buf, size, &off,
+	    "# TYPE miniweb_network_sockets gauge\n"
+	    "miniweb_network_sockets{proto=\"tcp\"} %u\n"
+	    "miniweb_network_sockets{proto=\"udp\"} %u\n"
+	    "# TYPE miniweb_network_sockets_listening gauge\n"
+	    "miniweb_network_sockets_listening %u\n"
+	    "# TYPE miniweb_network_sockets_established gauge\n"
+	    "miniweb_network_sockets_established %u\n"
+	    "# TYPE miniweb_network_routes gauge\n"
+	    "miniweb_network_routes %zu\n",
+	    cs.tcp, cs.udp, cs.listening, cs.established,
+	    net_routes_count()) != 0)
+		goto fail;
+	return off;
+
+fail:
+	buf[0] = '\0';
+	return 0;
+}
+
+/**
+ * @brief networking_get_json operation.
+ *
+ * @details Performs the core networking_get_json routine for this module.
+ *
+ * @return Return value produced by networking_get_json.
+ */
+char *
+networking_get_json(void)
+{
+	return networking_get_json_arena(NULL, NULL);
+}
+
 /* ========================================================================
  * HTTP HANDLERS
  * ======================================================================== */
@@ -875,27 +1029,199 @@ networking_handler(http_request_t *req)
 int
 networking_api_handler(http_request_t *req)
 {
-	char *json = networking_get_json();
+	char etag[HTTP_ETAG_MAX];
+	int gzip = http_request_accepts_encoding(req, "gzip");
+	unsigned long version = networking_json_version();
+
+	/* 'N' tags the gzip representation, 'n' the identity one. */
+	if (version != 0) {
+		http_etag_for_version(gzip ? 'N' : 'n', version, etag,
+		    sizeof(etag));
+		if (http_request_not_modified(req, etag, 0))
+			return http_send_not_modified(req, etag, 0);
+	}
+
+	http_response_t *resp = http_response_create();
+	if (!resp)
+		return http_send_error(req, 500, "Unable to allocate response");
+	resp->status_code = 200;
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+
+	/* ?since=<version|ts>: only the members that changed after it. */
+	unsigned long long since;
+	if (snapshot_delta_query(http_request_query(req), &since)) {
+		char *delta = networking_json_delta_arena(req->arena, since,
+		    &version);
+		if (delta) {
+			http_response_set_body(resp, delta, strlen(delta),
+			    req->arena == NULL);
+			http_response_gzip(req, resp);
+			int ret = http_response_send(req, resp);
+			http_response_free(resp);
+			return ret;
+		}
+	}
+
+	http_blob_t *gz = gzip ? networking_json_gzip(&version) : NULL;
+	if (gz) {
+		http_response_set_gzip_blob(resp, gz);
+		http_etag_for_version('N', version, etag, sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+		int ret = http_response_send(req, resp);
+		http_response_free(resp);
+		http_blob_release(gz);
+		return ret;
+	}
+
+	/* The cached payload itself is the body, held until it is sent. */
+	NetworkingPayload *p = networking_payload_acquire();
+	if (p) {
+		http_response_set_body(resp, p->json, p->len, 0);
+		gzip = http_response_gzip(req, resp);
+		http_etag_for_version(gzip ? 'N' : 'n', p->version, etag,
+		    sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+		int ret = http_response_send(req, resp);
+		http_response_free(resp);
+		snapshot_release(&p->hdr);
+		return ret;
+	}
+
+	char *json = networking_get_json_arena(req->arena, &version);
+	int owned = req->arena == NULL;
 	if (!json) {
+		http_response_free(resp);
 		return http_send_error(req, 500,
 				       "Network data collection failed");
 	}
+	http_response_set_body(resp, json, strlen(json), owned);
+	gzip = http_response_gzip(req, resp);
+	if (version != 0) {
+		http_etag_for_version(gzip ? 'N' : 'n', version, etag,
+		    sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+	}
+
+	int ret = http_response_send(req, resp);
+	http_response_free(resp);
+	return ret;
+}
+
+/**
+ * @brief Read span=<seconds> and interface=<name> from @p query.
+ * @param ifname Receives the interface, empty when absent.
+ * @param size Size of @p ifname.
+ * @return The span, 600 when absent, or 0 when either is malformed.
+ */
+static unsigned int
+networking_rates_query(const char *query, char *ifname, size_t size)
+{
+	unsigned int span = 600;
+	const char *q = query;
+
+	ifname[0] = '\0';
+	while (q) {
+		if (strncmp(q, "span=", 5) == 0) {
+			unsigned long v;
+			char *end;
+
+			errno = 0;
+			v = strtoul(q + 5, &end, 10);
+			if (errno != 0 || end == q + 5 || v == 0 ||
+			    (*end != '\0' && *end != '&'))
+				return 0;
+			span = v > NET_RATE_MAX_SPAN ? NET_RATE_MAX_SPAN :
+			    (unsigned int)v;
+		} else if (strncmp(q, "interface=", 10) == 0) {
+			char raw[IFNAMSIZ * 3];
+			size_t len = strcspn(q + 10, "&");
+
+			if (len == 0 || len >= sizeof(raw))
+				return 0;
+			memcpy(raw, q + 10, len);
+			raw[len] = '\0';
+			if (url_decode(raw, ifname, size) != 0)
+				return 0;
+			/* Interface names are letters and a unit number. */
+			for (const char *c = ifname; *c != '\0'; c++) {
+				if (!isalnum((unsigned char)*c))
+					return 0;
+			}
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return span;
+}
+
+/**
+ * @brief HTTP handler for GET /api/networking/rates.
+ *
+ * @details Serves ?span=<seconds> (600 by default, at most a day) of the
+ * per-interface rate history from the finest tier that spans it, for
+ * every interface or only ?interface=<name>. The ETag names the history
+ * version and the query, so pollers get a 304 until the next sample.
+ *
+ * @param req Incoming HTTP request context.
+ * @return 0 on success, -1 on response write failure.
+ */
+int
+networking_rates_handler(http_request_t *req)
+{
+	char ifname[IFNAMSIZ], etag[HTTP_ETAG_MAX];
+	unsigned int span;
+	unsigned long version;
+	json_writer_t w;
+	char *json;
+	size_t len;
+
+	span = networking_rates_query(http_request_query(req), ifname,
+	    sizeof(ifname));
+	if (span == 0)
+		return http_send_error(req, 400, "Invalid span or interface");
+
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	version = net_rates_version();
+	snprintf(etag, sizeof(etag), "\"r%lx.%x.%s\"", version, span,
+	    ifname);
+	if (http_request_not_modified(req, etag, 0))
+		return http_send_not_modified(req, etag, 0);
+
+	if (json_init(&w, req->arena, 1024) != 0)
+		return http_send_error(req, 500, "Unable to allocate response");
+	net_rates_json(&w, span, ifname[0] != '\0' ? ifname : NULL);
+	if ((json = json_finish(&w, &len)) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
 
 	http_response_t *resp = http_response_create();
 	if (!resp) {
-		free(json);
+		if (req->arena == NULL)
+			free(json);
 		return http_send_error(req, 500, "Unable to allocate response");
 	}
 	resp->status_code = 200;
 	resp->content_type = "application/json";
-	http_response_add_header(resp, "Cache-Control", "no-store");
-	http_response_set_body(resp, json, strlen(json), 1);
+	http_response_add_header(resp, "Cache-Control", "no-cache");
+	http_response_set_body(resp, json, len, req->arena == NULL);
+	http_response_gzip(req, resp);
+	http_response_add_validators(resp, etag, 0);
 
 	int ret = http_response_send(req, resp);
 	http_response_free(resp);
 	return ret;
 }
 
+/** Warm-up: the ring and its sampling task, before a request asks. */
+static int
+networking_warm(void *arg)
+{
+	(void)arg;
+	(void)pthread_once(&g_networking_once, networking_ring_bootstrap);
+	return 0;
+}
+
 /**
  * @brief Register all networking routes with the router.
  * @param r Router instance to attach routes to. Must not be NULL.
@@ -904,8 +1230,14 @@ networking_api_handler(http_request_t *req)
 int
 networking_module_attach_routes(struct router *r)
 {
-	return router_register(r, "GET", "/api/networking",
-			       networking_api_handler);
+	if (router_register(r, "GET", "/api/networking",
+	    networking_api_handler) != 0)
+		return -1;
+	if (router_register(r, "GET", "/api/networking/rates",
+	    networking_rates_handler) != 0)
+		return -1;
+	(void)readiness_run("networking", networking_warm, NULL);
+	return 0;
 }
 
 /**
@@ -919,15 +1251,17 @@ networking_module_cleanup(void)
 	if (g_networking_ring.buf == NULL)
 		return;
 
-	pthread_mutex_lock(&g_networking_ring.lock);
-	free(g_networking_ring.cached_json);
-	g_networking_ring.cached_json = NULL;
-	g_networking_ring.cached_json_len = 0;
-	g_networking_ring.cached_json_ts = 0;
+	LOCKSTAT_LOCK(&g_networking_ring.lock, lockstat_ring);
+	snapshot_publish(&g_networking_payload, NULL);
+	g_networking_ring.nspans = 0;
+	memset(&g_networking_ring.delta, 0, sizeof(g_networking_ring.delta));
 	free(g_networking_ring.buf);
 	g_networking_ring.buf = NULL;
 	g_networking_ring.head = 0;
 	g_networking_ring.count = 0;
-	pthread_mutex_unlock(&g_networking_ring.lock);
+	LOCKSTAT_UNLOCK(&g_networking_ring.lock, lockstat_ring);
 	pthread_mutex_destroy(&g_networking_ring.lock);
+	net_routes_cleanup();
+	net_conns_cleanup();
+	net_rates_cleanup();
 }
@@ -0,0 +1,342 @@
+/* networking_rates.c - per-interface rates, kept in downsampled tiers */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "networking_internal.h"
+
+/*
+ * Each heartbeat hands over the raw interface counters; the rates are
+ * the difference from the counters of the sample before, per second of
+ * the time between them, so nothing is ever recomputed from the full
+ * history. They are folded into three rings of fixed-width buckets, as
+ * metrics_tiers.c does for the system metrics, keeping the average and
+ * the peak of every rate for each interface slot. Interfaces are given
+ * a slot by name the first time they are seen and keep it; a counter
+ * that went backwards (a reset, or a new interface under an old name)
+ * only sets a new baseline.
+ *
+ * Rates are integers: bytes per second, and packets and errors in
+ * NET_RATE_FRAC-ths per second, saturating at UINT32_MAX.
+ */
+
+static const struct {
+	unsigned int step;
+	unsigned int span;
+} net_rate_spec[NET_RATE_TIERS] = {
+	{ 1, 600 },
+	{ 10, 3600 },
+	{ 60, NET_RATE_MAX_SPAN },
+};
+
+static const char *const net_rate_names[NET_RATE_FIELDS] = {
+	"rx_bytes", "tx_bytes", "rx_packets", "tx_packets", "rx_errors",
+	"tx_errors"
+};
+
+typedef struct {
+	net_rate_bucket_t *buf;
+	size_t capacity;
+	size_t head;
+	size_t count;
+} net_rate_tier_t;
+
+static struct {
+	pthread_mutex_t lock;
+	char names[NET_RATE_IFS][IFNAMSIZ];
+	uint64_t last[NET_RATE_IFS][NET_RATE_FIELDS];
+	time_t last_ts[NET_RATE_IFS];	/* 0: no baseline yet */
+	unsigned long version;		/* samples folded in */
+	net_rate_tier_t tier[NET_RATE_TIERS];
+	net_rate_bucket_t buf[NET_RATE_BUCKETS];
+} net_rates = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** Tier i's share of the one static array of buckets. */
+static void
+net_rates_layout(void)
+{
+	size_t off = 0;
+
+	for (int i = 0; i < NET_RATE_TIERS; i++) {
+		net_rate_tier_t *t = &net_rates.tier[i];
+
+		t->buf = &net_rates.buf[off];
+		t->capacity = net_rate_spec[i].span / net_rate_spec[i].step;
+		off += t->capacity;
+	}
+}
+
+/** Slot of interface @p name, taking a free one for a new name; -1: full. */
+static int
+net_rates_slot(const char *name)
+{
+	int free_slot = -1;
+
+	for (int i = 0; i < NET_RATE_IFS; i++) {
+		if (strcmp(net_rates.names[i], name) == 0)
+			return i;
+		if (free_slot < 0 && net_rates.names[i][0] == '\0')
+			free_slot = i;
+	}
+	if (free_slot >= 0)
+		strlcpy(net_rates.names[free_slot], name, IFNAMSIZ);
+	return free_slot;
+}
+
+/** (@p cur - @p prev) * @p scale / @p dt, saturated; -1 when it went back. */
+static int
+net_rate(uint64_t cur, uint64_t prev, uint64_t scale, uint64_t dt,
+    uint32_t *out)
+{
+	uint64_t d;
+
+	if (cur < prev)
+		return -1;
+	d = cur - prev;
+	if (d > UINT64_MAX / scale)
+		d = UINT64_MAX / scale;
+	d = d * scale / dt;
+	*out = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+	return 0;
+}
+
+/** The newest bucket of @p t for @p ts, opening the next one as needed. */
+static net_rate_bucket_t *
+net_rates_bucket(net_rate_tier_t *t, unsigned int step, time_t ts)
+{
+	int64_t start = (int64_t)ts - (int64_t)ts % (int64_t)step;
+	net_rate_bucket_t *b;
+
+	if (t->count > 0) {
+		b = &t->buf[(t->head + t->capacity - 1) % t->capacity];
+		/* A clock stepped back keeps folding into the newest. */
+		if (start <= b->ts)
+			return b;
+	}
+	b = &t->buf[t->head];
+	t->head = (t->head + 1) % t->capacity;
+	if (t->count < t->capacity)
+		t->count++;
+	memset(b, 0, sizeof(*b));
+	b->ts = start;
+	return b;
+}
+
+/**
+ * @brief Fold the rates since the previous sample into every tier.
+ * @param ts Time of the sample.
+ * @param ifs Raw counters of each interface.
+ * @param n Number of entries in @p ifs.
+ * @return Interfaces that got a rate: 0 for the first sample.
+ */
+int
+net_rates_push(time_t ts, const NetStats *ifs, int n)
+{
+	uint32_t rate[NET_RATE_IFS][NET_RATE_FIELDS];
+	unsigned int valid = 0;
+	int nvalid = 0;
+
+	pthread_mutex_lock(&net_rates.lock);
+	if (net_rates.tier[0].buf == NULL)
+		net_rates_layout();
+	for (int i = 0; i < n; i++) {
+		const NetStats *s = &ifs[i];
+		const uint64_t cur[NET_RATE_FIELDS] = {
+			s->rx_bytes, s->tx_bytes, s->rx_packets, s->tx_packets,
+			s->rx_errors, s->tx_errors
+		};
+		int slot = net_rates_slot(s->interface);
+		int ok;
+
+		if (slot < 0 || (valid & (1u << slot)))
+			continue;
+		ok = net_rates.last_ts[slot] != 0 &&
+		    ts > net_rates.last_ts[slot];
+		for (int f = 0; ok && f < NET_RATE_FIELDS; f++) {
+			if (net_rate(cur[f], net_rates.last[slot][f],
+			    f < 2 ? 1 : NET_RATE_FRAC,
+			    (uint64_t)(ts - net_rates.last_ts[slot]),
+			    &rate[slot][f]) != 0)
+				ok = 0;
+		}
+		memcpy(net_rates.last[slot], cur, sizeof(cur));
+		net_rates.last_ts[slot] = ts;
+		if (ok) {
+			valid |= 1u << slot;
+			nvalid++;
+		}
+	}
+
+	for (int i = 0; valid != 0 && i < NET_RATE_TIERS; i++) {
+		net_rate_bucket_t *b = net_rates_bucket(&net_rates.tier[i],
+		    net_rate_spec[i].step, ts);
+
+		for (int slot = 0; slot < NET_RATE_IFS; slot++) {
+			net_rate_t *r = &b->rate[slot];
+			uint64_t k;
+
+			if ((valid & (1u << slot)) == 0 || b->n[slot] == UINT16_MAX)
+				continue;
+			k = ++b->n[slot];
+			for (int f = 0; f < NET_RATE_FIELDS; f++) {
+				uint32_t v = rate[slot][f];
+
+				r->avg[f] = (uint32_t)(((uint64_t)r->avg[f] *
+				    (k - 1) + v) / k);
+				if (v > r->peak[f] || k == 1)
+					r->peak[f] = v;
+			}
+		}
+	}
+	if (valid != 0)
+		net_rates.version++;
+	pthread_mutex_unlock(&net_rates.lock);
+	return nvalid;
+}
+
+/** @brief Samples folded in so far; changes whenever the history does. */
+unsigned long
+net_rates_version(void)
+{
+	unsigned long v;
+
+	pthread_mutex_lock(&net_rates.lock);
+	v = net_rates.version;
+	pthread_mutex_unlock(&net_rates.lock);
+	return v;
+}
+
+/** The finest tier whose ring spans @p span seconds, else the coarsest. */
+static int
+net_rates_tier_for(unsigned int span)
+{
+	for (int i = 0; i < NET_RATE_TIERS; i++) {
+		if (net_rate_spec[i].span >= span)
+			return i;
+	}
+	return NET_RATE_TIERS - 1;
+}
+
+/** Append @p v, a packet or error rate, as a decimal number. */
+static void
+net_rates_put_frac(json_writer_t *w, uint32_t v)
+{
+	if (v % NET_RATE_FRAC == 0)
+		json_printf(w, "%u", v / NET_RATE_FRAC);
+	else
+		json_printf(w, "%.4f", (double)v / NET_RATE_FRAC);
+}
+
+/** Append one interface's @p which (0 avg, 1 peak) rates per bucket. */
+static void
+net_rates_put_series(json_writer_t *w, const net_rate_tier_t *t,
+    size_t first, size_t n, int slot, int which)
+{
+	json_putc(w, '[');
+	for (size_t i = 0; i < n; i++) {
+		const net_rate_bucket_t *b =
+		    &t->buf[(first + i) % t->capacity];
+		const uint32_t *v = which ? b->rate[slot].peak :
+		    b->rate[slot].avg;
+
+		if (i > 0)
+			json_putc(w, ',');
+		if (b->n[slot] == 0) {
+			json_puts(w, "null");
+			continue;
+		}
+		json_printf(w, "[%u,%u,", v[0], v[1]);
+		for (int f = 2; f < NET_RATE_FIELDS; f++) {
+			net_rates_put_frac(w, v[f]);
+			json_putc(w, f + 1 < NET_RATE_FIELDS ? ',' : ']');
+		}
+	}
+	json_putc(w, ']');
+}
+
+/**
+ * @brief Append the rate history of the last @p span seconds.
+ *
+ * @details One object with the tier's step, the field names, the bucket
+ * start times, and for every interface seen in those buckets the "avg"
+ * and "peak" rows: one array of the fields per bucket, or null where the
+ * interface had no rate.
+ *
+ * @param w Destination JSON writer.
+ * @param span Seconds of history wanted; the coarsest tier caps it.
+ * @param ifname Only this interface, or NULL for all of them.
+ */
+void
+net_rates_json(json_writer_t *w, unsigned int span, const char *ifname)
+{
+	int ti = net_rates_tier_for(span);
+	const net_rate_tier_t *t = &net_rates.tier[ti];
+	size_t n = 0, first;
+	int64_t since;
+	int any = 0;
+
+	pthread_mutex_lock(&net_rates.lock);
+	json_printf(w, "{\"span\":%u,\"step\":%u,\"version\":%lu,\"fields\":[",
+	    span, net_rate_spec[ti].step, net_rates.version);
+	for (int f = 0; f < NET_RATE_FIELDS; f++) {
+		if (f > 0)
+			json_putc(w, ',');
+		json_str(w, net_rate_names[f]);
+	}
+	json_puts(w, "],\"ts\":[");
+
+	/* Buckets that start within span of the newest one. */
+	if (t->buf != NULL && t->count > 0) {
+		since = t->buf[(t->head + t->capacity - 1) % t->capacity].ts -
+		    (int64_t)span;
+		while (n < t->count && t->buf[(t->head + t->capacity - 1 - n) %
+		    t->capacity].ts > since)
+			n++;
+	}
+	first = t->capacity > 0 ? (t->head + t->capacity - n) % t->capacity :
+	    0;
+	for (size_t i = 0; i < n; i++)
+		json_printf(w, "%s%lld", i > 0 ? "," : "",
+		    (long long)t->buf[(first + i) % t->capacity].ts);
+	json_puts(w, "],\"interfaces\":[");
+
+	for (int slot = 0; slot < NET_RATE_IFS; slot++) {
+		size_t seen = 0;
+
+		if (net_rates.names[slot][0] == '\0' || (ifname != NULL &&
+		    strcmp(ifname, net_rates.names[slot]) != 0))
+			continue;
+		for (size_t i = 0; i < n && seen == 0; i++)
+			seen = t->buf[(first + i) % t->capacity].n[slot];
+		if (seen == 0)
+			continue;
+		json_puts(w, any ? ",{\"interface\":" : "{\"interface\":");
+		json_str(w, net_rates.names[slot]);
+		json_puts(w, ",\"avg\":");
+		net_rates_put_series(w, t, first, n, slot, 0);
+		json_puts(w, ",\"peak\":");
+		net_rates_put_series(w, t, first, n, slot, 1);
+		json_putc(w, '}');
+		any = 1;
+	}
+	json_puts(w, "]}");
+	pthread_mutex_unlock(&net_rates.lock);
+}
+
+/** @brief Forget every interface and bucket. */
+void
+net_rates_cleanup(void)
+{
+	pthread_mutex_lock(&net_rates.lock);
+	memset(net_rates.names, 0, sizeof(net_rates.names));
+	memset(net_rates.last_ts, 0, sizeof(net_rates.last_ts));
+	for (int i = 0; i < NET_RATE_TIERS; i++) {
+		net_rates.tier[i].head = 0;
+		net_rates.tier[i].count = 0;
+	}
+	net_rates.version = 0;
+	pthread_mutex_unlock(&net_rates.lock);
+}
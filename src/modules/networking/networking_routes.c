@@ -0,0 +1,749 @@
+/* networking_routes.c - routing table kept current from a PF_ROUTE socket */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef __OpenBSD__
+#include <sys/sysctl.h>
+#include <net/if_dl.h>
+#include <net/route.h>
+#endif
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <miniweb/core/log.h>
+
+#include "networking_internal.h"
+
+/*
+ * The routing table is dumped with NET_RT_DUMP once, when the module
+ * starts, and then kept current by a thread reading a PF_ROUTE socket:
+ * RTM_ADD, RTM_CHANGE and RTM_DELETE update the table in place, RTM_IFINFO
+ * sets or clears RTF_UP on the routes through the interface, as the
+ * kernel does on a link state change, and RTM_IFANNOUNCE drops the routes
+ * of a departed interface. The socket only passes those messages, for
+ * table 0. When the kernel drops messages because the socket buffer
+ * overflowed (ENOBUFS), the table is dumped again. The heartbeat then
+ * only copies the first routes out of the table instead of walking the
+ * kernel's, which on a router fed a full BGP table is the expensive part.
+ *
+ * Without the socket (not OpenBSD, or it could not be opened) every
+ * sample dumps the table, as before.
+ */
+
+#ifndef __OpenBSD__
+#define RTF_UP		0x1
+#define RTF_GATEWAY	0x2
+#define RTF_HOST	0x4
+#define RTF_DYNAMIC	0x10
+#define RTF_STATIC	0x800
+#endif
+#ifndef AF_LINK
+#define AF_LINK		18
+#endif
+
+#define NET_ROUTES_BUCKETS_MIN	256
+#define NET_ROUTES_MSG_MAX	2048
+#define NET_ROUTES_IFCACHE	8
+
+typedef struct {
+	net_route_t r;
+	uint32_t hash;
+	int32_t hnext;		/* bucket chain; free list while unused */
+	int32_t prev;		/* table order, -1 ends it */
+	int32_t next;
+	int used;
+} net_route_slot_t;
+
+static struct {
+	pthread_mutex_t lock;
+	net_route_slot_t *slots;
+	size_t nslots;		/* ever used */
+	size_t cap;
+	int32_t free_head;
+	int32_t *buckets;
+	size_t nbuckets;	/* power of two */
+	int32_t head;
+	int32_t tail;
+	size_t count;
+} net_routes = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.free_head = -1,
+	.head = -1,
+	.tail = -1,
+};
+
+static pthread_t net_routes_tid;
+static int net_routes_running;
+static int net_routes_sock = -1;
+static int net_routes_pipe[2] = {-1, -1};
+
+/** FNV-1a over the key: family, priority, destination and mask. */
+static uint32_t
+net_route_hash(const net_route_t *r)
+{
+	uint32_t h = 2166136261u;
+	uint8_t key[34];
+
+	key[0] = r->family;
+	key[1] = r->priority;
+	memcpy(key + 2, r->dst, 16);
+	memcpy(key + 18, r->mask, 16);
+	for (size_t i = 0; i < sizeof(key); i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+net_route_same_key(const net_route_t *a, const net_route_t *b)
+{
+	return a->family == b->family && a->priority == b->priority &&
+	    memcmp(a->dst, b->dst, 16) == 0 &&
+	    memcmp(a->mask, b->mask, 16) == 0;
+}
+
+/** Same key and gateway: the same route, multipath ones told apart. */
+static int
+net_route_same(const net_route_t *a, const net_route_t *b)
+{
+	return net_route_same_key(a, b) && a->gw_family == b->gw_family &&
+	    a->gw_index == b->gw_index && memcmp(a->gw, b->gw, 16) == 0;
+}
+
+static int32_t
+net_routes_find(const net_route_t *r, uint32_t h, int by_key)
+{
+	int32_t i;
+
+	if (net_routes.nbuckets == 0)
+		return -1;
+	for (i = net_routes.buckets[h & (net_routes.nbuckets - 1)]; i >= 0;
+	    i = net_routes.slots[i].hnext) {
+		const net_route_slot_t *s = &net_routes.slots[i];
+
+		if (s->hash == h && (by_key ? net_route_same_key(&s->r, r) :
+		    net_route_same(&s->r, r)))
+			return i;
+	}
+	return -1;
+}
+
+static int
+net_routes_rehash(size_t nbuckets)
+{
+	int32_t *b;
+	size_t i;
+
+	if ((b = malloc(nbuckets * sizeof(*b))) == NULL)
+		return -1;
+	for (i = 0; i < nbuckets; i++)
+		b[i] = -1;
+	for (i = 0; i < net_routes.nslots; i++) {
+		net_route_slot_t *s = &net_routes.slots[i];
+
+		if (!s->used)
+			continue;
+		s->hnext = b[s->hash & (nbuckets - 1)];
+		b[s->hash & (nbuckets - 1)] = (int32_t)i;
+	}
+	free(net_routes.buckets);
+	net_routes.buckets = b;
+	net_routes.nbuckets = nbuckets;
+	return 0;
+}
+
+/** Append @p r to the table. */
+static int
+net_routes_insert(const net_route_t *r, uint32_t h)
+{
+	net_route_slot_t *s;
+	int32_t i;
+
+	if (net_routes.count >= net_routes.nbuckets &&
+	    net_routes_rehash(net_routes.nbuckets ? net_routes.nbuckets * 2 :
+	    NET_ROUTES_BUCKETS_MIN) != 0)
+		return -1;
+	if (net_routes.free_head >= 0) {
+		i = net_routes.free_head;
+		net_routes.free_head = net_routes.slots[i].hnext;
+	} else {
+		if (net_routes.nslots == net_routes.cap) {
+			size_t ncap = net_routes.cap ? net_routes.cap * 2 : 256;
+
+			s = realloc(net_routes.slots, ncap * sizeof(*s));
+			if (s == NULL)
+				return -1;
+			net_routes.slots = s;
+			net_routes.cap = ncap;
+		}
+		i = (int32_t)net_routes.nslots++;
+	}
+
+	s = &net_routes.slots[i];
+	s->r = *r;
+	s->hash = h;
+	s->used = 1;
+	s->hnext = net_routes.buckets[h & (net_routes.nbuckets - 1)];
+	net_routes.buckets[h & (net_routes.nbuckets - 1)] = i;
+	s->next = -1;
+	s->prev = net_routes.tail;
+	if (net_routes.tail >= 0)
+		net_routes.slots[net_routes.tail].next = i;
+	else
+		net_routes.head = i;
+	net_routes.tail = i;
+	net_routes.count++;
+	return 0;
+}
+
+static void
+net_routes_remove(int32_t i)
+{
+	net_route_slot_t *s = &net_routes.slots[i];
+	int32_t *link;
+
+	link = &net_routes.buckets[s->hash & (net_routes.nbuckets - 1)];
+	while (*link != i)
+		link = &net_routes.slots[*link].hnext;
+	*link = s->hnext;
+
+	if (s->prev >= 0)
+		net_routes.slots[s->prev].next = s->next;
+	else
+		net_routes.head = s->next;
+	if (s->next >= 0)
+		net_routes.slots[s->next].prev = s->prev;
+	else
+		net_routes.tail = s->prev;
+
+	s->used = 0;
+	s->hnext = net_routes.free_head;
+	net_routes.free_head = i;
+	net_routes.count--;
+}
+
+static int
+net_routes_apply_locked(int op, const net_route_t *r)
+{
+	uint32_t h = net_route_hash(r);
+	int32_t i;
+
+	switch (op) {
+	case NET_ROUTE_ADD:
+		if ((i = net_routes_find(r, h, 0)) >= 0) {
+			net_routes.slots[i].r = *r;
+			return 1;
+		}
+		return net_routes_insert(r, h) == 0;
+	case NET_ROUTE_CHANGE:
+		/* The gateway may be what changed: find it by key. */
+		if ((i = net_routes_find(r, h, 0)) >= 0 ||
+		    (i = net_routes_find(r, h, 1)) >= 0) {
+			net_routes.slots[i].r = *r;
+			return 1;
+		}
+		return net_routes_insert(r, h) == 0;
+	case NET_ROUTE_DELETE:
+		if ((i = net_routes_find(r, h, 0)) < 0)
+			return 0;
+		net_routes_remove(i);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Apply one route message to the table.
+ *
+ * @param op NET_ROUTE_ADD, NET_ROUTE_CHANGE or NET_ROUTE_DELETE.
+ * @param r The route the message carries.
+ *
+ * @return int 1 when the table changed, 0 otherwise.
+ */
+int
+net_routes_apply(int op, const net_route_t *r)
+{
+	int changed;
+
+	pthread_mutex_lock(&net_routes.lock);
+	changed = net_routes_apply_locked(op, r);
+	pthread_mutex_unlock(&net_routes.lock);
+	return changed;
+}
+
+/** Set (@p up) or clear RTF_UP on every route through @p ifindex. */
+void
+net_routes_link(unsigned int ifindex, int up)
+{
+	pthread_mutex_lock(&net_routes.lock);
+	for (int32_t i = net_routes.head; i >= 0;
+	    i = net_routes.slots[i].next) {
+		net_route_t *r = &net_routes.slots[i].r;
+
+		if (r->ifindex != ifindex)
+			continue;
+		if (up)
+			r->flags |= RTF_UP;
+		else
+			r->flags &= ~RTF_UP;
+	}
+	pthread_mutex_unlock(&net_routes.lock);
+}
+
+/** Drop every route through @p ifindex, which is gone. */
+void
+net_routes_forget_if(unsigned int ifindex)
+{
+	pthread_mutex_lock(&net_routes.lock);
+	for (int32_t i = net_routes.head, next; i >= 0; i = next) {
+		next = net_routes.slots[i].next;
+		if (net_routes.slots[i].r.ifindex == ifindex)
+			net_routes_remove(i);
+	}
+	pthread_mutex_unlock(&net_routes.lock);
+}
+
+static void
+net_routes_reset_locked(void)
+{
+	for (size_t i = 0; i < net_routes.nbuckets; i++)
+		net_routes.buckets[i] = -1;
+	net_routes.nslots = 0;
+	net_routes.free_head = -1;
+	net_routes.head = net_routes.tail = -1;
+	net_routes.count = 0;
+}
+
+/** Empty the table, keeping its memory. */
+void
+net_routes_reset(void)
+{
+	pthread_mutex_lock(&net_routes.lock);
+	net_routes_reset_locked();
+	pthread_mutex_unlock(&net_routes.lock);
+}
+
+/** Number of routes in the table. */
+size_t
+net_routes_count(void)
+{
+	size_t n;
+
+	pthread_mutex_lock(&net_routes.lock);
+	n = net_routes.count;
+	pthread_mutex_unlock(&net_routes.lock);
+	return n;
+}
+
+/** Interface name of @p ifindex, looked up once per copy. */
+static const char *
+net_routes_ifname(unsigned int ifindex, unsigned int *idx,
+    char (*names)[IFNAMSIZ], int *n)
+{
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		if (idx[i] == ifindex)
+			return names[i];
+	}
+	if (*n < NET_ROUTES_IFCACHE)
+		i = (*n)++;
+	else
+		i = NET_ROUTES_IFCACHE - 1;
+	idx[i] = ifindex;
+	if (if_indextoname(ifindex, names[i]) == NULL)
+		names[i][0] = '\0';
+	return names[i];
+}
+
+/**
+ * @brief Format the first @p max routes of the table, in table order.
+ *
+ * @return int Number of entries written.
+ */
+int
+net_routes_copy(RouteEntry *out, int max)
+{
+	unsigned int if_idx[NET_ROUTES_IFCACHE];
+	char if_names[NET_ROUTES_IFCACHE][IFNAMSIZ];
+	int if_n = 0;
+	net_route_t *tmp;
+	int n = 0;
+
+	if (max <= 0 || (tmp = malloc((size_t)max * sizeof(*tmp))) == NULL)
+		return 0;
+	pthread_mutex_lock(&net_routes.lock);
+	for (int32_t i = net_routes.head; i >= 0 && n < max;
+	    i = net_routes.slots[i].next)
+		tmp[n++] = net_routes.slots[i].r;
+	pthread_mutex_unlock(&net_routes.lock);
+
+	for (int i = 0; i < n; i++) {
+		const net_route_t *r = &tmp[i];
+		RouteEntry *e = &out[i];
+		int flags = r->flags;
+
+		memset(e, 0, sizeof(*e));
+		if ((r->family != AF_INET && r->family != AF_INET6) ||
+		    !inet_ntop(r->family, r->dst, e->destination,
+		    sizeof(e->destination)))
+			strlcpy(e->destination, "-", sizeof(e->destination));
+		if (r->gw_family == AF_LINK)
+			snprintf(e->gateway, sizeof(e->gateway), "link#%u",
+			    (unsigned)r->gw_index);
+		else if ((r->gw_family != AF_INET &&
+		    r->gw_family != AF_INET6) || !inet_ntop(r->gw_family,
+		    r->gw, e->gateway, sizeof(e->gateway)))
+			strlcpy(e->gateway, "-", sizeof(e->gateway));
+		if (!r->has_mask || r->family != AF_INET ||
+		    !inet_ntop(AF_INET, r->mask, e->netmask,
+		    sizeof(e->netmask)))
+			strlcpy(e->netmask, "-", sizeof(e->netmask));
+		if (r->ifindex > 0)
+			strlcpy(e->interface, net_routes_ifname(r->ifindex,
+			    if_idx, if_names, &if_n), sizeof(e->interface));
+		e->flags = flags;
+		snprintf(e->flags_str, sizeof(e->flags_str), "%s%s%s%s%s",
+		    (flags & RTF_UP) ? "U" : "",
+		    (flags & RTF_GATEWAY) ? "G" : "",
+		    (flags & RTF_HOST) ? "H" : "",
+		    (flags & RTF_STATIC) ? "S" : "",
+		    (flags & RTF_DYNAMIC) ? "D" : "");
+	}
+	free(tmp);
+	return n;
+}
+
+#ifdef __OpenBSD__
+#define NET_SA_ROUNDUP(a) \
+	((a) > 0 ? (1 + (((a) - 1) | (sizeof(long) - 1))) : sizeof(long))
+
+/** Copy the address of @p sa, @p off bytes in, as far as sa_len goes. */
+static void
+net_route_addr(const struct sockaddr *sa, size_t off, size_t alen,
+    uint8_t *dst)
+{
+	if (sa->sa_len > off)
+		memcpy(dst, (const char *)sa + off,
+		    (size_t)sa->sa_len - off < alen ?
+		    (size_t)sa->sa_len - off : alen);
+}
+
+/**
+ * Decode the route in a routing message. Returns 0, or -1 when it is not
+ * a table 0 IPv4/IPv6 route.
+ */
+static int
+net_route_parse(const struct rt_msghdr *rtm, net_route_t *r)
+{
+	const char *p = (const char *)rtm + rtm->rtm_hdrlen;
+	const char *end = (const char *)rtm + rtm->rtm_msglen;
+
+	if (rtm->rtm_version != RTM_VERSION || rtm->rtm_tableid != 0)
+		return -1;
+	memset(r, 0, sizeof(*r));
+	r->priority = rtm->rtm_priority;
+	r->ifindex = rtm->rtm_index;
+	r->flags = rtm->rtm_flags;
+
+	for (int i = 0; i < RTAX_MAX && p < end; i++) {
+		const struct sockaddr *sa = (const struct sockaddr *)p;
+
+		if ((rtm->rtm_addrs & (1 << i)) == 0)
+			continue;
+		if (p + sizeof(sa->sa_len) > end ||
+		    p + NET_SA_ROUNDUP(sa->sa_len) > end)
+			break;
+		p += NET_SA_ROUNDUP(sa->sa_len);
+		switch (i) {
+		case RTAX_DST:
+			r->family = sa->sa_family;
+			if (sa->sa_family == AF_INET)
+				net_route_addr(sa, offsetof(struct sockaddr_in,
+				    sin_addr), 4, r->dst);
+			else if (sa->sa_family == AF_INET6)
+				net_route_addr(sa, offsetof(struct
+				    sockaddr_in6, sin6_addr), 16, r->dst);
+			break;
+		case RTAX_GATEWAY:
+			r->gw_family = sa->sa_family;
+			if (sa->sa_family == AF_INET)
+				net_route_addr(sa, offsetof(struct sockaddr_in,
+				    sin_addr), 4, r->gw);
+			else if (sa->sa_family == AF_INET6)
+				net_route_addr(sa, offsetof(struct
+				    sockaddr_in6, sin6_addr), 16, r->gw);
+			else if (sa->sa_family == AF_LINK)
+				r->gw_index = ((const struct sockaddr_dl *)
+				    sa)->sdl_index;
+			break;
+		case RTAX_NETMASK:
+			/* Masks come trimmed, often without a family. */
+			r->has_mask = 1;
+			if (r->family == AF_INET)
+				net_route_addr(sa, offsetof(struct sockaddr_in,
+				    sin_addr), 4, r->mask);
+			else if (r->family == AF_INET6)
+				net_route_addr(sa, offsetof(struct
+				    sockaddr_in6, sin6_addr), 16, r->mask);
+			break;
+		}
+	}
+	return r->family == AF_INET || r->family == AF_INET6 ? 0 : -1;
+}
+#endif
+
+/**
+ * @brief Replace the table with a NET_RT_DUMP of the kernel's.
+ *
+ * @return int 0 on success, -1 when the table cannot be read.
+ */
+int
+net_routes_dump(void)
+{
+#ifdef __OpenBSD__
+	int mib[6] = {CTL_NET, PF_ROUTE, 0, 0, NET_RT_DUMP, 0};
+	char *buf = NULL, *next, *lim;
+	size_t needed;
+
+	/* Routes added between the two calls need the slack. */
+	for (int tries = 0;; tries++) {
+		char *nbuf;
+
+		if (sysctl(mib, 6, NULL, &needed, NULL, 0) == -1) {
+			free(buf);
+			return -1;
+		}
+		needed += needed / 8;
+		if ((nbuf = realloc(buf, needed)) == NULL) {
+			free(buf);
+			return -1;
+		}
+		buf = nbuf;
+		if (sysctl(mib, 6, buf, &needed, NULL, 0) == 0)
+			break;
+		if (errno != ENOMEM || tries == 2) {
+			free(buf);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&net_routes.lock);
+	net_routes_reset_locked();
+	lim = buf + needed;
+	for (next = buf; next + sizeof(struct rt_msghdr) <= lim;) {
+		const struct rt_msghdr *rtm = (const struct rt_msghdr *)next;
+		net_route_t r;
+
+		if (rtm->rtm_msglen == 0)
+			break;
+		next += rtm->rtm_msglen;
+		if (next > lim)
+			break;
+		if (rtm->rtm_type != RTM_GET && rtm->rtm_type != RTM_ADD)
+			continue;
+		if (net_route_parse(rtm, &r) == 0)
+			(void)net_routes_apply_locked(NET_ROUTE_ADD, &r);
+	}
+	pthread_mutex_unlock(&net_routes.lock);
+	free(buf);
+	return 0;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+#ifdef __OpenBSD__
+/** Apply one message read from the routing socket. */
+static void
+net_routes_message(const char *msg, size_t len)
+{
+	const struct rt_msghdr *rtm = (const struct rt_msghdr *)msg;
+	net_route_t r;
+
+	if (len < sizeof(rtm->rtm_msglen) + 2 || rtm->rtm_msglen > len ||
+	    rtm->rtm_version != RTM_VERSION)
+		return;
+
+	switch (rtm->rtm_type) {
+	case RTM_ADD:
+	case RTM_CHANGE:
+	case RTM_DELETE:
+		if (len < sizeof(*rtm) || net_route_parse(rtm, &r) != 0)
+			return;
+		(void)net_routes_apply(rtm->rtm_type == RTM_ADD ?
+		    NET_ROUTE_ADD : rtm->rtm_type == RTM_CHANGE ?
+		    NET_ROUTE_CHANGE : NET_ROUTE_DELETE, &r);
+		break;
+	case RTM_IFINFO: {
+		const struct if_msghdr *ifm = (const struct if_msghdr *)msg;
+
+		if (len < sizeof(*ifm))
+			return;
+		net_routes_link(ifm->ifm_index, (ifm->ifm_flags & IFF_UP) &&
+		    LINK_STATE_IS_UP(ifm->ifm_data.ifi_link_state));
+		break;
+	}
+	case RTM_IFANNOUNCE: {
+		const struct if_announcemsghdr *ifan =
+		    (const struct if_announcemsghdr *)msg;
+
+		if (len >= sizeof(*ifan) && ifan->ifan_what == IFAN_DEPARTURE)
+			net_routes_forget_if(ifan->ifan_index);
+		break;
+	}
+	}
+}
+
+/** Routing socket thread: apply messages until the stop pipe is written. */
+static void *
+net_routes_thread(void *arg)
+{
+	char msg[NET_ROUTES_MSG_MAX];
+	struct pollfd pfd[2];
+	ssize_t n;
+
+	(void)arg;
+	pfd[0].fd = net_routes_sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = net_routes_pipe[0];
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			log_error("[NETWORK] route socket poll: errno=%d", errno);
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if ((pfd[0].revents & POLLIN) == 0)
+			continue;
+		n = read(net_routes_sock, msg, sizeof(msg));
+		if (n > 0) {
+			net_routes_message(msg, (size_t)n);
+			continue;
+		}
+		if (n == -1 && errno == ENOBUFS) {
+			/* Messages were lost: the table may be stale. */
+			log_info("[NETWORK] route socket overflow, dumping "
+			    "the routing table again");
+			(void)net_routes_dump();
+			continue;
+		}
+		if (n == -1 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		log_error("[NETWORK] route socket read: errno=%d", errno);
+		break;
+	}
+	__atomic_store_n(&net_routes_running, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+#endif
+
+/**
+ * @brief Open the routing socket, dump the table and start the thread.
+ *
+ * @details The socket is opened before the dump, so changes made during
+ * it are applied after it and none is missed.
+ *
+ * @return int 0 when the table is kept current, -1 when every sample has
+ *         to dump it.
+ */
+int
+net_routes_start(void)
+{
+#ifdef __OpenBSD__
+	unsigned int filter = ROUTE_FILTER(RTM_ADD) |
+	    ROUTE_FILTER(RTM_CHANGE) | ROUTE_FILTER(RTM_DELETE) |
+	    ROUTE_FILTER(RTM_IFINFO) | ROUTE_FILTER(RTM_IFANNOUNCE);
+	unsigned int table = 0;
+
+	if (__atomic_load_n(&net_routes_running, __ATOMIC_ACQUIRE))
+		return 0;
+	net_routes_sock = socket(AF_ROUTE, SOCK_RAW, 0);
+	if (net_routes_sock == -1)
+		return -1;
+	(void)setsockopt(net_routes_sock, AF_ROUTE, ROUTE_MSGFILTER, &filter,
+	    sizeof(filter));
+	(void)setsockopt(net_routes_sock, AF_ROUTE, ROUTE_TABLEFILTER, &table,
+	    sizeof(table));
+	if (pipe(net_routes_pipe) == -1)
+		goto fail;
+	(void)fcntl(net_routes_sock, F_SETFD, FD_CLOEXEC);
+	(void)fcntl(net_routes_pipe[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(net_routes_pipe[1], F_SETFD, FD_CLOEXEC);
+	if (net_routes_dump() != 0)
+		goto fail;
+	__atomic_store_n(&net_routes_running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&net_routes_tid, NULL, net_routes_thread, NULL)
+	    != 0) {
+		__atomic_store_n(&net_routes_running, 0, __ATOMIC_RELEASE);
+		goto fail;
+	}
+	log_debug("[NETWORK] routing table: %zu routes, following the "
+	    "route socket", net_routes_count());
+	return 0;
+
+fail:
+	close(net_routes_sock);
+	net_routes_sock = -1;
+	if (net_routes_pipe[0] != -1) {
+		close(net_routes_pipe[0]);
+		close(net_routes_pipe[1]);
+		net_routes_pipe[0] = net_routes_pipe[1] = -1;
+	}
+	return -1;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/** Whether the routing socket thread keeps the table current. */
+int
+net_routes_live(void)
+{
+	return __atomic_load_n(&net_routes_running, __ATOMIC_ACQUIRE);
+}
+
+/** Stop the routing socket thread and free the table. */
+void
+net_routes_cleanup(void)
+{
+	if (net_routes_pipe[1] != -1) {
+		/* Failing that, the hang-up of the write end wakes it. */
+		if (write(net_routes_pipe[1], "x", 1) != 1) {
+			close(net_routes_pipe[1]);
+			net_routes_pipe[1] = -1;
+		}
+		pthread_join(net_routes_tid, NULL);
+		close(net_routes_pipe[0]);
+		if (net_routes_pipe[1] != -1)
+			close(net_routes_pipe[1]);
+		net_routes_pipe[0] = net_routes_pipe[1] = -1;
+		close(net_routes_sock);
+		net_routes_sock = -1;
+		net_routes_running = 0;
+	}
+	pthread_mutex_lock(&net_routes.lock);
+	free(net_routes.slots);
+	free(net_routes.buckets);
+	net_routes.slots = NULL;
+	net_routes.buckets = NULL;
+	net_routes.cap = net_routes.nbuckets = 0;
+	net_routes_reset_locked();
+	pthread_mutex_unlock(&net_routes.lock);
+}
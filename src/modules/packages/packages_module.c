@@ -1,54 +1,49 @@
-/* packages_module.c - pkg manager implementation with ring buffer cache */
+/* packages_module.c - pkg manager implementation */
 
 #include <ctype.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <miniweb/core/conf.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/heartbeat.h>
 #include <miniweb/core/log.h>
+#include <miniweb/http/gzip.h>
 #include <miniweb/http/handler.h>
 #include <miniweb/http/utils.h>
 #include <miniweb/modules/pkg_manager.h>
 #include <miniweb/router/router.h>
 
+#include "pkg_internal.h"
+
 #define PKG_JSON_MAX (1024 * 1024)
 #define PKG_CMD_MAX_OUTPUT (8 * 1024 * 1024)
 #define PKG_WHICH_TIMEOUT 60
 #define PKG_CACHE_TTL_SEC 30  /* Cache TTL of 30 seconds */
-
-/* Ring buffer for package queries - 2MB total for better cache capacity */
-#define PKG_RING_BYTES (2 * 1024 * 1024)
-
-/* Package query sample for ring buffer */
-typedef struct {
-	time_t ts;
-	char endpoint[16];        /* "search", "info", "which", "files", "list" */
-	char key[256];            /* query parameter or package name or file path */
-	char *json;                /* Cached JSON response */
-	size_t json_len;
-	unsigned int hits;         /* Track popularity */
-} PkgSample;
-
-/* Ring buffer capacity based on total size */
-#define PKG_RING_CAPACITY ((size_t)(PKG_RING_BYTES / sizeof(PkgSample)))
-
-typedef struct {
-	PkgSample *buf;
-	size_t head;
-	size_t count;
-	pthread_mutex_t lock;
-	unsigned int total_hits;
-	unsigned int total_misses;
-	time_t last_stats;
-} PkgRing;
-
-static PkgRing g_pkg_ring;
-static pthread_once_t g_packages_once = PTHREAD_ONCE_INIT;
-static int g_pkg_ring_ready = 0;
+#define PKG_CACHE_STALE_SEC 300 /* Served stale while pkg_* reruns */
+#define PKG_FILES_INLINE_MAX (256 * 1024)  /* larger file lists are streamed */
+#define PKG_STREAM_CHUNK (16 * 1024)
+#define PKG_STREAM_LINE_MAX 4096
+#define PKG_NOT_STREAMED (-2)
+
+extern miniweb_conf_t config;
+
+/*
+ * Answers are kept by the router's response cache, which the prefix
+ * route opts into: PKG_CACHE_TTL_SEC per path and query, bodies up to
+ * PKG_FILES_INLINE_MAX. Longer file lists are streamed and not kept.
+ * For PKG_CACHE_STALE_SEC after that the old answer is sent at once and
+ * the query reruns in the background, so a request does not wait on
+ * pkg_info(1) for an answer it had a moment ago.
+ */
+static const route_cache_policy_t pkg_cache_policy = {
+	.ttl_ms = PKG_CACHE_TTL_SEC * 1000,
+	.max_bytes = PKG_FILES_INLINE_MAX,
+	.stale_ms = PKG_CACHE_STALE_SEC * 1000,
+};
 
 /* Logging macro */
 #define LOG(...) do { \
@@ -57,178 +52,7 @@ if (config_verbose) \
 } while (0)
 
 /* =========================================================================
- * Ring buffer operations
- * ========================================================================= */
-
-/**
- * @brief pkg_ring_init operation.
- *
- * @details Performs the core pkg_ring_init routine for this module.
- *
- * @param r Input parameter for pkg_ring_init.
- *
- * @return Return value produced by pkg_ring_init.
- */
-static int
-pkg_ring_init(PkgRing *r)
-{
-	r->buf = calloc(PKG_RING_CAPACITY, sizeof(PkgSample));
-	if (!r->buf)
-		return -1;
-
-	r->head = 0;
-	r->count = 0;
-	r->total_hits = 0;
-	r->total_misses = 0;
-	r->last_stats = time(NULL);
-	pthread_mutex_init(&r->lock, NULL);
-
-	LOG("Ring buffer initialized: %zu slots, %.1f MB",
-		PKG_RING_CAPACITY, (double)PKG_RING_BYTES / (1024 * 1024));
-	return 0;
-}
-
-/**
- * @brief pkg_ring_push operation.
- *
- * @details Performs the core pkg_ring_push routine for this module.
- *
- * @param r Input parameter for pkg_ring_push.
- * @param endpoint Input parameter for pkg_ring_push.
- * @param key Input parameter for pkg_ring_push.
- * @param json Input parameter for pkg_ring_push.
- * @param json_len Input parameter for pkg_ring_push.
- */
-static void
-pkg_ring_push(PkgRing *r, const char *endpoint, const char *key,
-			  const char *json, size_t json_len)
-{
-	if (!r->buf || !endpoint || !key || !json || json_len == 0)
-		return;
-
-	pthread_mutex_lock(&r->lock);
-
-	/* Free old entry if exists */
-	if (r->buf[r->head].json)
-		free(r->buf[r->head].json);
-
-	/* Store new sample */
-	r->buf[r->head].ts = time(NULL);
-	strlcpy(r->buf[r->head].endpoint, endpoint, sizeof(r->buf[r->head].endpoint));
-	strlcpy(r->buf[r->head].key, key, sizeof(r->buf[r->head].key));
-	r->buf[r->head].json = malloc(json_len + 1);
-	if (r->buf[r->head].json) {
-		memcpy(r->buf[r->head].json, json, json_len);
-		r->buf[r->head].json[json_len] = '\0';
-		r->buf[r->head].json_len = json_len;
-		r->buf[r->head].hits = 1;
-	}
-
-	r->head = (r->head + 1) % PKG_RING_CAPACITY;
-	if (r->count < PKG_RING_CAPACITY)
-		r->count++;
-
-	pthread_mutex_unlock(&r->lock);
-}
-
-/**
- * @brief Find a recent sample in the ring buffer
- * @param endpoint The endpoint type (search, info, etc.)
- * @param key The query key
- * @param max_age_sec Maximum age in seconds
- * @return Newly allocated JSON string if found, NULL otherwise
- */
-static char *
-pkg_ring_find(PkgRing *r, const char *endpoint, const char *key, int max_age_sec)
-{
-	if (!r->buf || r->count == 0)
-		return NULL;
-
-	time_t now = time(NULL);
-	char *result = NULL;
-	int found_idx = -1;
-	time_t newest_ts = 0;
-
-	pthread_mutex_lock(&r->lock);
-
-	/* Search from newest to oldest */
-	size_t start = (r->head + PKG_RING_CAPACITY - 1) % PKG_RING_CAPACITY;
-	for (size_t i = 0; i < r->count; i++) {
-		size_t idx = (start + PKG_RING_CAPACITY - i) % PKG_RING_CAPACITY;
-		PkgSample *s = &r->buf[idx];
-
-		if (s->json &&
-			strcmp(s->endpoint, endpoint) == 0 &&
-			strcmp(s->key, key) == 0 &&
-			(now - s->ts) <= max_age_sec) {
-
-			/* Found a match - take the newest one */
-			if (s->ts > newest_ts) {
-				newest_ts = s->ts;
-				found_idx = idx;
-			}
-			}
-	}
-
-	if (found_idx >= 0) {
-		PkgSample *s = &r->buf[found_idx];
-		result = malloc(s->json_len + 1);
-		if (result) {
-			memcpy(result, s->json, s->json_len);
-			result[s->json_len] = '\0';
-			s->hits++;
-			r->total_hits++;
-			LOG("Ring cache HIT for %s:%s (age=%lds, hits=%u)",
-				endpoint, key, (long)(now - s->ts), s->hits);
-		}
-	}
-
-	if (!result) {
-		r->total_misses++;
-		LOG("Ring cache MISS for %s:%s", endpoint, key);
-	}
-
-	/* Log stats every 1000 requests */
-	if ((r->total_hits + r->total_misses) % 1000 == 0 &&
-		now - r->last_stats > 5) {
-		float hit_ratio = r->total_hits * 100.0 / (r->total_hits + r->total_misses);
-	LOG("Cache stats: hits=%u, misses=%u, hit ratio=%.1f%%",
-		r->total_hits, r->total_misses, hit_ratio);
-	r->last_stats = now;
-		}
-
-		pthread_mutex_unlock(&r->lock);
-
-		return result;
-}
-
-/**
- * @brief pkg_ring_free operation.
- *
- * @details Performs the core pkg_ring_free routine for this module.
- *
- * @param r Input parameter for pkg_ring_free.
- */
-static void
-pkg_ring_free(PkgRing *r)
-{
-	if (!r->buf)
-		return;
-
-	pthread_mutex_lock(&r->lock);
-	for (size_t i = 0; i < PKG_RING_CAPACITY; i++) {
-		free(r->buf[i].json);
-	}
-	free(r->buf);
-	r->buf = NULL;
-	r->count = 0;
-	r->head = 0;
-	pthread_mutex_unlock(&r->lock);
-	pthread_mutex_destroy(&r->lock);
-}
-
-/* =========================================================================
- * Package query functions with ring buffer integration
+ * Package query functions
  * ========================================================================= */
 
 /**
@@ -301,7 +125,7 @@ url_decode_into(const char *src, char *dst, size_t dst_size)
  *
  * @details Performs the core get_query_value routine for this module.
  *
- * @param url Input parameter for get_query_value.
+ * @param qs Query string of the request, without the '?'; may be NULL.
  * @param key Input parameter for get_query_value.
  * @param out Input parameter for get_query_value.
  * @param out_size Input parameter for get_query_value.
@@ -309,19 +133,13 @@ url_decode_into(const char *src, char *dst, size_t dst_size)
  * @return Return value produced by get_query_value.
  */
 static int
-get_query_value(const char *url, const char *key, char *out, size_t out_size)
+get_query_value(const char *qs, const char *key, char *out, size_t out_size)
 {
-	const char *qs;
 	size_t key_len;
 
-	if (!url || !key || !out || out_size == 0)
+	if (!qs || !key || !out || out_size == 0)
 		return 0;
 
-	qs = strchr(url, '?');
-	if (!qs)
-		return 0;
-	qs++;
-
 	key_len = strlen(key);
 
 	while (*qs) {
@@ -479,43 +297,242 @@ make_raw_json(const char *output)
 	return json;
 }
 
-/* Bootstrap function called via pthread_once */
+/* =========================================================================
+ * Answers from the package database model
+ * ========================================================================= */
+
 /**
- * @brief packages_cache_bootstrap operation.
+ * @brief Append @p s to the growing JSON buffer, as a quoted and
+ * escaped string when @p quote is set.
  *
- * @details Performs the core packages_cache_bootstrap routine for this module.
+ * @return 0 on success, -1 on allocation failure.
  */
-static void
-packages_cache_bootstrap(void)
+static int
+pkg_json_append(char **buf, size_t *len, size_t *cap, const char *s,
+    int quote)
 {
-	LOG("Initializing package cache ring buffer (2MB)");
+	char *esc = quote ? json_escape_string(s) : NULL;
+	const char *src = quote ? esc : s;
+	size_t n;
 
-	if (pkg_ring_init(&g_pkg_ring) != 0) {
-		LOG("Failed to initialize package ring buffer");
-		return;
+	if (!src)
+		return -1;
+	n = strlen(src) + (quote ? 2 : 0);
+	if (*len + n + 1 > *cap) {
+		size_t ncap = *cap ? *cap : 4096;
+		char *nb;
+
+		while (*len + n + 1 > ncap)
+			ncap *= 2;
+		if ((nb = realloc(*buf, ncap)) == NULL) {
+			free(esc);
+			return -1;
+		}
+		*buf = nb;
+		*cap = ncap;
 	}
-	g_pkg_ring_ready = 1;
+	snprintf(*buf + *len, *cap - *len, quote ? "\"%s\"" : "%s", src);
+	*len += n;
+	free(esc);
+	return 0;
+}
+
+/** Installed packages whose name contains @p query, ignoring case. */
+static char *
+pkg_db_search_json(const pkg_db_t *db, const char *query)
+{
+	size_t qlen = strlen(query), len = 0, cap = 0;
+	char *json = NULL;
+	int first = 1;
 
-	/* No heartbeat needed - ring buffer is populated on demand */
+	if (pkg_json_append(&json, &len, &cap, "{\"query\":", 0) != 0 ||
+	    pkg_json_append(&json, &len, &cap, query, 1) != 0 ||
+	    pkg_json_append(&json, &len, &cap, ",\"packages\":[", 0) != 0)
+		goto fail;
+	for (size_t i = 0; i < db->count; i++) {
+		const char *name = db->pkgs[i]->name;
+		int match = 0;
+
+		for (const char *p = name; *p && !match; p++)
+			match = strncasecmp(p, query, qlen) == 0;
+		if (!match)
+			continue;
+		if ((!first && pkg_json_append(&json, &len, &cap, ",", 0) != 0) ||
+		    pkg_json_append(&json, &len, &cap, name, 1) != 0)
+			goto fail;
+		first = 0;
+	}
+	if (pkg_json_append(&json, &len, &cap, "]}", 0) != 0)
+		goto fail;
+	return json;
 
-	LOG("Package cache initialized successfully");
+fail:
+	free(json);
+	return NULL;
 }
 
-/* =========================================================================
- * Public API functions with ring buffer caching
- * ========================================================================= */
+typedef struct {
+	char *json;
+	size_t len;
+	size_t cap;
+	int first;
+} pkg_json_list_t;
+
+/** pkg_catalog_search() callback: append one name to the list. */
+static int
+pkg_json_list_add(const char *name, void *ctx)
+{
+	pkg_json_list_t *l = ctx;
+
+	if ((!l->first && pkg_json_append(&l->json, &l->len, &l->cap, ",", 0) !=
+	    0) || pkg_json_append(&l->json, &l->len, &l->cap, name, 1) != 0)
+		return -1;
+	l->first = 0;
+	return 0;
+}
 
 /**
- * @brief pkg_search_json operation.
- *
- * @details Performs the core pkg_search_json routine for this module.
- *
- * @param query Input parameter for pkg_search_json.
- *
- * @return Return value produced by pkg_search_json.
+ * Packages the catalogue knows whose name or comment contains @p query;
+ * NULL when the catalogue cannot answer.
  */
-char *
-pkg_search_json(const char *query)
+static char *
+pkg_catalog_search_json(const char *query)
+{
+	pkg_json_list_t l = {NULL, 0, 0, 1};
+
+	if (pkg_json_append(&l.json, &l.len, &l.cap, "{\"query\":", 0) != 0 ||
+	    pkg_json_append(&l.json, &l.len, &l.cap, query, 1) != 0 ||
+	    pkg_json_append(&l.json, &l.len, &l.cap, ",\"packages\":[", 0) != 0 ||
+	    pkg_catalog_search(query, pkg_json_list_add, &l) < 0 ||
+	    pkg_json_append(&l.json, &l.len, &l.cap, "]}", 0) != 0) {
+		free(l.json);
+		return NULL;
+	}
+	return l.json;
+}
+
+/** pkg_info(1) style text for @p pkg, wrapped as {"raw", "found"}. */
+static char *
+pkg_db_info_json(const pkg_db_pkg_t *pkg)
+{
+	char *text, *json;
+	int n;
+
+	n = snprintf(NULL, 0, "Information for inst:%s\n\nComment:\n%s\n\n"
+	    "%s%s%sDescription:\n%s", pkg->name, pkg->comment,
+	    pkg->required_by[0] ? "Required by:\n" : "", pkg->required_by,
+	    pkg->required_by[0] ? "\n" : "", pkg->desc);
+	if (n < 0 || (text = malloc((size_t)n + 1)) == NULL)
+		return NULL;
+	snprintf(text, (size_t)n + 1, "Information for inst:%s\n\nComment:\n"
+	    "%s\n\n%s%s%sDescription:\n%s", pkg->name, pkg->comment,
+	    pkg->required_by[0] ? "Required by:\n" : "", pkg->required_by,
+	    pkg->required_by[0] ? "\n" : "", pkg->desc);
+	json = make_raw_json(text);
+	free(text);
+	return json;
+}
+
+/** Files of @p pkg as {"package", "files"}. */
+static char *
+pkg_db_files_json(const pkg_db_pkg_t *pkg, const char *package_name)
+{
+	size_t len = 0, cap = 0;
+	char *json = NULL;
+
+	if (pkg_json_append(&json, &len, &cap, "{\"package\":", 0) != 0 ||
+	    pkg_json_append(&json, &len, &cap, package_name, 1) != 0 ||
+	    pkg_json_append(&json, &len, &cap, ",\"files\":[", 0) != 0)
+		goto fail;
+	for (const char *f = pkg ? pkg->files : ""; *f; f += strlen(f) + 1) {
+		if ((f != pkg->files &&
+		    pkg_json_append(&json, &len, &cap, ",", 0) != 0) ||
+		    pkg_json_append(&json, &len, &cap, f, 1) != 0)
+			goto fail;
+	}
+	if (pkg_json_append(&json, &len, &cap, "]}", 0) != 0)
+		goto fail;
+	return json;
+
+fail:
+	free(json);
+	return NULL;
+}
+
+static int
+pkg_db_fuzzy_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/** Manually installed packages by fuzzy name, as pkg_info -qmz lists. */
+static char *
+pkg_db_list_json(const pkg_db_t *db)
+{
+	const char **names;
+	size_t n = 0, len = 0, cap = 0;
+	char *json = NULL;
+
+	if ((names = calloc(db->count ? db->count : 1, sizeof(*names))) == NULL)
+		return NULL;
+	for (size_t i = 0; i < db->count; i++) {
+		if (db->pkgs[i]->manual)
+			names[n++] = db->pkgs[i]->fuzzy;
+	}
+	qsort(names, n, sizeof(*names), pkg_db_fuzzy_cmp);
+	if (pkg_json_append(&json, &len, &cap, "{\"packages\":[", 0) != 0)
+		goto fail;
+	for (size_t i = 0; i < n; i++) {
+		if ((i > 0 && pkg_json_append(&json, &len, &cap, ",", 0) != 0) ||
+		    pkg_json_append(&json, &len, &cap, names[i], 1) != 0)
+			goto fail;
+	}
+	if (pkg_json_append(&json, &len, &cap, "]}", 0) != 0)
+		goto fail;
+	free(names);
+	return json;
+
+fail:
+	free(names);
+	free(json);
+	return NULL;
+}
+
+/** Wrap a heap JSON string into a blob, freeing the string. */
+static http_blob_t *
+pkg_blob_take(char *json)
+{
+	http_blob_t *blob;
+
+	if (!json)
+		return NULL;
+	blob = http_blob_alloc(strlen(json));
+	if (blob)
+		memcpy(blob->data, json, blob->len);
+	free(json);
+	return blob;
+}
+
+/** Heap copy of a blob's body, releasing the blob. */
+static char *
+pkg_blob_strdup(http_blob_t *blob)
+{
+	char *json;
+
+	if (!blob)
+		return NULL;
+	json = strdup(blob->data);
+	http_blob_release(blob);
+	return json;
+}
+
+/* =========================================================================
+ * Fills: build one response from the database or pkg_info(1)
+ * ========================================================================= */
+
+/** Search response for a non-empty @p query. */
+static char *
+pkg_search_fill(const char *query)
 {
 	char *output = NULL;
 	char *json = NULL;
@@ -523,26 +540,19 @@ pkg_search_json(const char *query)
 	int first = 1;
 	int count = 0;
 
-	LOG("pkg_search_json called with query: '%s'", query);
-
-	if (!query || strlen(query) < 1) {
-		LOG("Empty query");
-		return strdup("{\"query\":\"\",\"packages\":[]}");
-	}
-
-	/* Ensure cache is initialized */
-	pthread_once(&g_packages_once, packages_cache_bootstrap);
+	/* Available and installed packages, from the stored catalogue */
+	if ((json = pkg_catalog_search_json(query)) != NULL)
+		return json;
 
-	/* Try ring buffer cache first */
-	if (g_pkg_ring_ready) {
-		json = pkg_ring_find(&g_pkg_ring, "search", query, PKG_CACHE_TTL_SEC);
-		if (json) {
-			LOG("Returning cached result for '%s'", query);
-			return json;
-		}
+	/* Installed packages, straight from the database */
+	pkg_db_t *db = pkg_db_acquire();
+	if (db) {
+		json = pkg_db_search_json(db, query);
+		pkg_db_release(db);
+		return json ? json : strdup("{\"query\":\"\",\"packages\":[]}");
 	}
 
-	/* Try pkg_info -Q */
+	/* Database unreadable: try pkg_info -Q */
 	if (is_safe_pkg_name(query)) {
 		char *const argv[] = {"pkg_info", "-Q", (char *)query, NULL};
 		LOG("Executing: pkg_info -Q %s", query);
@@ -587,34 +597,6 @@ pkg_search_json(const char *query)
 		}
 	}
 
-	/* Last resort: direct popen */
-	if (!output || output[0] == '\0') {
-		LOG("Trying popen directly");
-		free(output);
-
-		char cmd[256];
-		snprintf(cmd, sizeof(cmd), "pkg_info -Q %s 2>&1", query);
-		FILE *fp = popen(cmd, "r");
-		if (fp) {
-			char buf[1024];
-			size_t total = 0;
-			output = malloc(PKG_CMD_MAX_OUTPUT);
-			if (output) {
-				output[0] = '\0';
-				while (fgets(buf, sizeof(buf), fp) &&
-					total < PKG_CMD_MAX_OUTPUT - 1) {
-					size_t len = strlen(buf);
-				if (total + len < PKG_CMD_MAX_OUTPUT - 1) {
-					strlcat(output, buf, PKG_CMD_MAX_OUTPUT);
-					total += len;
-				}
-					}
-					LOG("popen returned %zu bytes", total);
-			}
-			pclose(fp);
-		}
-	}
-
 	if (!output || output[0] == '\0') {
 		LOG("All methods failed, returning empty");
 		free(output);
@@ -660,81 +642,42 @@ pkg_search_json(const char *query)
 	free(output);
 
 	LOG("Final JSON with %d packages", count);
-
-	/* Store in ring buffer cache */
-	if (g_pkg_ring_ready) {
-		pkg_ring_push(&g_pkg_ring, "search", query, json, strlen(json));
-	}
-
 	return json;
 }
 
-/**
- * @brief pkg_info_json operation.
- *
- * @details Performs the core pkg_info_json routine for this module.
- *
- * @param package_name Input parameter for pkg_info_json.
- *
- * @return Return value produced by pkg_info_json.
- */
-char *
-pkg_info_json(const char *package_name)
+/** Info response for a validated @p package_name. */
+static char *
+pkg_info_fill(const char *package_name)
 {
-	if (!is_safe_pkg_name(package_name)) {
-		return strdup("{\"found\":false,\"raw\":\"invalid package name\"}");
-	}
-
-	/* Ensure cache is initialized */
-	pthread_once(&g_packages_once, packages_cache_bootstrap);
-
-	/* Try ring buffer cache first */
-	if (g_pkg_ring_ready) {
-		char *json = pkg_ring_find(&g_pkg_ring, "info", package_name, PKG_CACHE_TTL_SEC);
-		if (json) {
-			LOG("Returning cached info for '%s'", package_name);
-			return json;
-		}
-	}
-
-	char *const argv[] = {"pkg_info", (char *)package_name, NULL};
-	char *output = safe_popen_read_argv("/usr/sbin/pkg_info", argv,
-										PKG_CMD_MAX_OUTPUT, 5, NULL);
-	char *json = make_raw_json(output);
-	free(output);
+	char *json;
+	pkg_db_t *db = pkg_db_acquire();
+	if (db) {
+		const pkg_db_pkg_t *pkg = pkg_db_find(db, package_name);
 
-	if (json && g_pkg_ring_ready) {
-		pkg_ring_push(&g_pkg_ring, "info", package_name, json, strlen(json));
+		json = pkg ? pkg_db_info_json(pkg) : make_raw_json(NULL);
+		pkg_db_release(db);
+	} else {
+		char *const argv[] = {"pkg_info", (char *)package_name, NULL};
+		char *output = safe_popen_read_argv("/usr/sbin/pkg_info", argv,
+											PKG_CMD_MAX_OUTPUT, 5, NULL);
+		json = make_raw_json(output);
+		free(output);
 	}
 
 	return json ? json : strdup("{\"found\":false,\"raw\":\"\"}");
 }
 
-/**
- * @brief pkg_files_json operation.
- *
- * @details Performs the core pkg_files_json routine for this module.
- *
- * @param package_name Input parameter for pkg_files_json.
- *
- * @return Return value produced by pkg_files_json.
- */
-char *
-pkg_files_json(const char *package_name)
+/** File list response for a validated @p package_name. */
+static char *
+pkg_files_fill(const char *package_name)
 {
-	if (!is_safe_pkg_name(package_name))
-		return strdup("{\"error\":\"invalid package name\"}");
-
-	/* Ensure cache is initialized */
-	pthread_once(&g_packages_once, packages_cache_bootstrap);
+	pkg_db_t *db = pkg_db_acquire();
+	if (db) {
+		char *json = pkg_db_files_json(pkg_db_find(db, package_name),
+		    package_name);
 
-	/* Try ring buffer cache first */
-	if (g_pkg_ring_ready) {
-		char *json = pkg_ring_find(&g_pkg_ring, "files", package_name, PKG_CACHE_TTL_SEC);
-		if (json) {
-			LOG("Returning cached files for '%s'", package_name);
-			return json;
-		}
+		pkg_db_release(db);
+		return json;
 	}
 
 	char *const argv[] = {"pkg_info", "-L", (char *)package_name, NULL};
@@ -788,37 +731,23 @@ pkg_files_json(const char *package_name)
 	free(output);
 
 	offset += snprintf(json + offset, PKG_JSON_MAX - offset, "]}");
-
-	if (g_pkg_ring_ready) {
-		pkg_ring_push(&g_pkg_ring, "files", package_name, json, strlen(json));
-	}
-
 	return json;
 }
 
-/**
- * @brief pkg_list_json operation.
- *
- * @details Performs the core pkg_list_json routine for this module.
- *
- * @return Return value produced by pkg_list_json.
- */
-char *
-pkg_list_json(void)
+/** List of manually installed packages; @p key is unused. */
+static char *
+pkg_list_fill(const char *key)
 {
-	/* Ensure cache is initialized */
-	pthread_once(&g_packages_once, packages_cache_bootstrap);
+	(void)key;
+	LOG("Cache miss, generating fresh package list");
 
-	/* Try ring buffer cache first */
-	if (g_pkg_ring_ready) {
-		char *json = pkg_ring_find(&g_pkg_ring, "list", "all", PKG_CACHE_TTL_SEC);
-		if (json) {
-			LOG("Serving cached package list");
-			return json;
-		}
-	}
+	pkg_db_t *db = pkg_db_acquire();
+	if (db) {
+		char *json = pkg_db_list_json(db);
 
-	LOG("Cache miss, generating fresh package list");
+		pkg_db_release(db);
+		return json ? json : strdup("{\"packages\":[]}");
+	}
 
 	char *const argv[] = {"pkg_info", "-qmz", NULL};
 	char *output = safe_popen_read_argv("/usr/sbin/pkg_info", argv,
@@ -853,61 +782,348 @@ pkg_list_json(void)
 
 	offset += snprintf(json + offset, PKG_JSON_MAX - offset, "]}");
 	free(output);
+	return json;
+}
 
-	/* Store in ring buffer cache */
-	if (g_pkg_ring_ready) {
-		pkg_ring_push(&g_pkg_ring, "list", "all", json, strlen(json));
+/** Owning package response for a validated @p file_path. */
+static char *
+pkg_which_fill(const char *file_path)
+{
+	pkg_db_t *db = pkg_db_acquire();
+	if (db) {
+		const pkg_db_pkg_t *pkg = pkg_db_which(db, file_path);
+		char *json = NULL;
+
+		if (pkg) {
+			size_t n = strlen(file_path) + strlen(pkg->name) + 3;
+			char *text = malloc(n);
+
+			if (text) {
+				/* pkg_info -E format: "filename: pkgname" */
+				snprintf(text, n, "%s: %s", file_path, pkg->name);
+				json = make_raw_json(text);
+				free(text);
+			}
+		} else {
+			json = make_raw_json(NULL);
+		}
+		pkg_db_release(db);
+		return json ? json : strdup("{\"found\":false,\"raw\":\"\"}");
 	}
 
-	return json;
+	char *const argv_w[] = {"pkg_info", "-W", (char *)file_path, NULL};
+	char *output = safe_popen_read_argv("/usr/sbin/pkg_info", argv_w,
+										PKG_CMD_MAX_OUTPUT, PKG_WHICH_TIMEOUT, NULL);
+	if (!output || output[0] == '\0') {
+		free(output);
+		char *const argv_e[] = {"pkg_info", "-E", (char *)file_path, NULL};
+		output = safe_popen_read_argv("/usr/sbin/pkg_info", argv_e,
+									  PKG_CMD_MAX_OUTPUT, PKG_WHICH_TIMEOUT, NULL);
+	}
+	char *json = make_raw_json(output);
+	free(output);
+	return json ? json : strdup("{\"found\":false,\"raw\":\"\"}");
+}
+
+/* =========================================================================
+ * Public API: validate, then build the response
+ * ========================================================================= */
+
+/** Search response for @p query. */
+static http_blob_t *
+pkg_search_blob(const char *query)
+{
+	LOG("pkg_search_json called with query: '%s'", query);
+
+	if (!query || strlen(query) < 1) {
+		LOG("Empty query");
+		return pkg_blob_take(strdup("{\"query\":\"\",\"packages\":[]}"));
+	}
+	return pkg_blob_take(pkg_search_fill(query));
+}
+
+/** Info response for @p package_name. */
+static http_blob_t *
+pkg_info_blob(const char *package_name)
+{
+	if (!is_safe_pkg_name(package_name)) {
+		return pkg_blob_take(strdup(
+		    "{\"found\":false,\"raw\":\"invalid package name\"}"));
+	}
+	return pkg_blob_take(pkg_info_fill(package_name));
+}
+
+/** File list response for @p package_name. */
+static http_blob_t *
+pkg_files_blob(const char *package_name)
+{
+	if (!is_safe_pkg_name(package_name))
+		return pkg_blob_take(strdup("{\"error\":\"invalid package name\"}"));
+	return pkg_blob_take(pkg_files_fill(package_name));
+}
+
+/** Package list response. */
+static http_blob_t *
+pkg_list_blob(void)
+{
+	return pkg_blob_take(pkg_list_fill("all"));
+}
+
+/** Owning package response for @p file_path. */
+static http_blob_t *
+pkg_which_blob(const char *file_path)
+{
+	if (!is_safe_path(file_path)) {
+		return pkg_blob_take(strdup("{\"found\":false,\"raw\":\"path must "
+		"be absolute and contain no shell metacharacters\"}"));
+	}
+	return pkg_blob_take(pkg_which_fill(file_path));
+}
+
+/**
+ * @brief Search installed packages by name.
+ *
+ * @param query Substring to look for.
+ *
+ * @return char* Heap JSON the caller frees, or NULL on allocation failure.
+ */
+char *
+pkg_search_json(const char *query)
+{
+	return pkg_blob_strdup(pkg_search_blob(query));
 }
 
 /**
- * @brief pkg_which_json operation.
+ * @brief Describe an installed package as pkg_info(1) would.
  *
- * @details Performs the core pkg_which_json routine for this module.
+ * @param package_name Full package name or stem.
  *
- * @param file_path Input parameter for pkg_which_json.
+ * @return char* Heap JSON the caller frees, or NULL on allocation failure.
+ */
+char *
+pkg_info_json(const char *package_name)
+{
+	return pkg_blob_strdup(pkg_info_blob(package_name));
+}
+
+/**
+ * @brief List the files an installed package owns.
+ *
+ * @param package_name Full package name or stem.
  *
- * @return Return value produced by pkg_which_json.
+ * @return char* Heap JSON the caller frees, or NULL on allocation failure.
+ */
+char *
+pkg_files_json(const char *package_name)
+{
+	return pkg_blob_strdup(pkg_files_blob(package_name));
+}
+
+/**
+ * @brief List the manually installed packages.
+ *
+ * @return char* Heap JSON the caller frees, or NULL on allocation failure.
+ */
+char *
+pkg_list_json(void)
+{
+	return pkg_blob_strdup(pkg_list_blob());
+}
+
+/**
+ * @brief Find the package that installed a file.
+ *
+ * @param file_path Absolute path.
+ *
+ * @return char* Heap JSON the caller frees, or NULL on allocation failure.
  */
 char *
 pkg_which_json(const char *file_path)
 {
-	if (!is_safe_path(file_path)) {
-		return strdup("{\"found\":false,\"raw\":\"path must be absolute and "
-		"contain no shell metacharacters\"}");
+	return pkg_blob_strdup(pkg_which_blob(file_path));
+}
+
+/* =========================================================================
+ * Streamed file lists: texlive or chromium list too many files to buffer
+ * ========================================================================= */
+
+typedef struct {
+	http_stream_t s;
+	int first;
+	int overlong;             /* dropping the rest of an overlong line */
+	size_t len;
+	size_t line_len;          /* partial pkg_info line between reads */
+	char line[PKG_STREAM_LINE_MAX];
+	char buf[PKG_STREAM_CHUNK];
+} pkg_files_stream_t;
+
+/** Append to the window, sending it as one chunk whenever it fills. */
+static int
+pkg_stream_put(pkg_files_stream_t *fs, const char *p, size_t n)
+{
+	while (n > 0) {
+		size_t room = sizeof(fs->buf) - fs->len;
+		size_t take = n < room ? n : room;
+
+		memcpy(fs->buf + fs->len, p, take);
+		fs->len += take;
+		p += take;
+		n -= take;
+		if (fs->len == sizeof(fs->buf)) {
+			if (http_stream_write(&fs->s, fs->buf, fs->len) != 0)
+				return -1;
+			fs->len = 0;
+		}
 	}
+	return 0;
+}
+
+/** Append one path as the next element of the "files" array. */
+static int
+pkg_stream_path(pkg_files_stream_t *fs, const char *path)
+{
+	char *esc = json_escape_string(path);
+	int rc;
 
-	/* Ensure cache is initialized */
-	pthread_once(&g_packages_once, packages_cache_bootstrap);
+	if (!esc)
+		return -1;
+	rc = (!fs->first && pkg_stream_put(fs, ",", 1) != 0) ||
+	    pkg_stream_put(fs, "\"", 1) != 0 ||
+	    pkg_stream_put(fs, esc, strlen(esc)) != 0 ||
+	    pkg_stream_put(fs, "\"", 1) != 0 ? -1 : 0;
+	free(esc);
+	fs->first = 0;
+	return rc;
+}
 
-	/* Try ring buffer cache first */
-	if (g_pkg_ring_ready) {
-		char *json = pkg_ring_find(&g_pkg_ring, "which", file_path, PKG_CACHE_TTL_SEC);
-		if (json) {
-			LOG("Returning cached which for '%s'", file_path);
-			return json;
+/** safe_popen_stream_argv() consumer: absolute paths of pkg_info -L. */
+static int
+pkg_stream_lines(const char *data, size_t len, void *ctx)
+{
+	pkg_files_stream_t *fs = ctx;
+
+	for (size_t i = 0; i < len; i++) {
+		char c = data[i];
+
+		if (c != '\n') {
+			if (fs->line_len < sizeof(fs->line) - 1)
+				fs->line[fs->line_len++] = c;
+			else
+				fs->overlong = 1;
+			continue;
 		}
+		fs->line[fs->line_len] = '\0';
+		fs->line[strcspn(fs->line, "\r")] = '\0';
+		/* Only include lines that are absolute paths */
+		if (!fs->overlong && fs->line[0] == '/' &&
+		    pkg_stream_path(fs, fs->line) != 0)
+			return -1;
+		fs->line_len = 0;
+		fs->overlong = 0;
 	}
+	return 0;
+}
 
-	char *const argv_w[] = {"pkg_info", "-W", (char *)file_path, NULL};
-	char *output = safe_popen_read_argv("/usr/sbin/pkg_info", argv_w,
-										PKG_CMD_MAX_OUTPUT, PKG_WHICH_TIMEOUT, NULL);
-	if (!output || output[0] == '\0') {
-		free(output);
-		char *const argv_e[] = {"pkg_info", "-E", (char *)file_path, NULL};
-		output = safe_popen_read_argv("/usr/sbin/pkg_info", argv_e,
-									  PKG_CMD_MAX_OUTPUT, PKG_WHICH_TIMEOUT, NULL);
+/** Bytes the file list of @p pkg takes as JSON, before escaping. */
+static size_t
+pkg_files_json_size(const pkg_db_pkg_t *pkg)
+{
+	size_t n = 0;
+
+	for (const char *p = pkg->files; *p; p += strlen(p) + 1)
+		n += strlen(p) + 3;
+	return n;
+}
+
+/**
+ * @brief Send the file list of @p name as it is produced.
+ *
+ * @details Paths come from @p pkg when given, else from pkg_info -L as
+ * its output arrives; only the window and one line are held in memory.
+ * A listing that failed part way ends with "complete": false.
+ *
+ * @return 0 on success, -1 when the response could not be sent.
+ */
+static int
+pkg_files_stream(http_request_t *req, const char *name,
+    const pkg_db_pkg_t *pkg)
+{
+	pkg_files_stream_t *fs;
+	http_response_t *resp;
+	char *esc;
+	int rc = 0, ret;
+
+	if ((fs = malloc(sizeof(*fs))) == NULL ||
+	    (esc = json_escape_string(name)) == NULL) {
+		free(fs);
+		return http_send_error(req, 500, "Unable to query package manager");
 	}
-	char *json = make_raw_json(output);
-	free(output);
+	fs->first = 1;
+	fs->overlong = 0;
+	fs->len = 0;
+	fs->line_len = 0;
+
+	resp = http_response_create();
+	resp->status_code = 200;
+	resp->content_type = "application/json";
+	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
+	if (http_stream_begin(&fs->s, req, resp) == 0 &&
+	    pkg_stream_put(fs, "{\"package\":\"", 12) == 0 &&
+	    pkg_stream_put(fs, esc, strlen(esc)) == 0 &&
+	    pkg_stream_put(fs, "\",\"files\":[", 11) == 0) {
+		if (pkg) {
+			for (const char *p = pkg->files; *p && rc == 0;
+			    p += strlen(p) + 1)
+				rc = pkg_stream_path(fs, p);
+		} else {
+			char *const argv[] = {"pkg_info", "-L", (char *)name, NULL};
+
+			rc = safe_popen_stream_argv("/usr/sbin/pkg_info", argv, 5,
+			    pkg_stream_lines, fs);
+			/* A last line without its newline. */
+			if (rc == 0 && fs->line_len > 0)
+				rc = pkg_stream_lines("\n", 1, fs);
+		}
+		if (!fs->s.failed) {
+			const char *tail = rc == 0 ? "]}" : "],\"complete\":false}";
 
-	if (json && g_pkg_ring_ready) {
-		pkg_ring_push(&g_pkg_ring, "which", file_path, json, strlen(json));
+			if (pkg_stream_put(fs, tail, strlen(tail)) == 0 &&
+			    fs->len > 0)
+				(void)http_stream_write(&fs->s, fs->buf, fs->len);
+		}
 	}
+	ret = http_stream_end(&fs->s);
+	LOG("Streamed files of %s, ret=%d", name, ret);
+	http_response_free(resp);
+	free(esc);
+	free(fs);
+	return ret;
+}
 
-	return json ? json : strdup("{\"found\":false,\"raw\":\"\"}");
+/**
+ * @brief Stream the file list of @p name when it is too big to buffer.
+ *
+ * @return PKG_NOT_STREAMED when the cached buffered response should be
+ * used instead, else the result of pkg_files_stream().
+ */
+static int
+pkg_files_try_stream(http_request_t *req, const char *name)
+{
+	const pkg_db_pkg_t *pkg;
+	pkg_db_t *db;
+	int ret = PKG_NOT_STREAMED;
+
+	if (!is_safe_pkg_name(name))
+		return PKG_NOT_STREAMED;
+	if ((db = pkg_db_acquire()) == NULL) {
+		/* Database unreadable: pkg_info output has no known size. */
+		return pkg_files_stream(req, name, NULL);
+	}
+	pkg = pkg_db_find(db, name);
+	if (pkg && pkg_files_json_size(pkg) > PKG_FILES_INLINE_MAX)
+		ret = pkg_files_stream(req, name, pkg);
+	pkg_db_release(db);
+	return ret;
 }
 
 /**
@@ -922,10 +1138,11 @@ pkg_which_json(const char *file_path)
 int
 pkg_api_handler(http_request_t *req)
 {
-	char *json = NULL;
+	http_blob_t *json = NULL;
 	char value[1024];
 	const char *base = "/api/packages";
 	const char *path = req->url;
+	const char *qs = http_request_query(req);
 
 	LOG("Handling request: %s", req->url);
 
@@ -936,28 +1153,31 @@ pkg_api_handler(http_request_t *req)
 	path += strlen(base);
 
 	if (path_matches_endpoint(path, "/search")) {
-		if (!get_query_value(req->url, "q", value, sizeof(value)))
+		if (!get_query_value(qs, "q", value, sizeof(value)))
 			return http_send_error(req, 400, "Missing q parameter");
 		LOG("Search query: %s", value);
-		json = pkg_search_json(value);
+		json = pkg_search_blob(value);
 	} else if (path_matches_endpoint(path, "/info")) {
-		if (!get_query_value(req->url, "name", value, sizeof(value)))
+		if (!get_query_value(qs, "name", value, sizeof(value)))
 			return http_send_error(req, 400, "Missing name parameter");
 		LOG("Info for: %s", value);
-		json = pkg_info_json(value);
+		json = pkg_info_blob(value);
 	} else if (path_matches_endpoint(path, "/which")) {
-		if (!get_query_value(req->url, "path", value, sizeof(value)))
+		if (!get_query_value(qs, "path", value, sizeof(value)))
 			return http_send_error(req, 400, "Missing path parameter");
 		LOG("Which for path: %s", value);
-		json = pkg_which_json(value);
+		json = pkg_which_blob(value);
 	} else if (path_matches_endpoint(path, "/files")) {
-		if (!get_query_value(req->url, "name", value, sizeof(value)))
+		if (!get_query_value(qs, "name", value, sizeof(value)))
 			return http_send_error(req, 400, "Missing name parameter");
 		LOG("Files for: %s", value);
-		json = pkg_files_json(value);
+		int ret = pkg_files_try_stream(req, value);
+		if (ret != PKG_NOT_STREAMED)
+			return ret;
+		json = pkg_files_blob(value);
 	} else if (path_matches_endpoint(path, "/list")) {
 		LOG("Listing all packages");
-		json = pkg_list_json();
+		json = pkg_list_blob();
 	} else {
 		return http_send_error(req, 404, "Unknown packages endpoint");
 	}
@@ -967,16 +1187,19 @@ pkg_api_handler(http_request_t *req)
 		return http_send_error(req, 500, "Unable to query package manager");
 	}
 
-	LOG("Generated JSON (%zu bytes)", strlen(json));
+	LOG("Generated JSON (%zu bytes)", json->len);
 
 	http_response_t *resp = http_response_create();
 	resp->status_code = 200;
 	resp->content_type = "application/json";
 	http_response_add_header(resp, "Access-Control-Allow-Origin", "*");
-	http_response_set_body(resp, json, strlen(json), 1);
+	/* Borrowed: the send copies whatever it cannot write at once. */
+	http_response_set_body(resp, json->data, json->len, 0);
+	http_response_gzip(req, resp);
 
 	int ret = http_response_send(req, resp);
 	http_response_free(resp);
+	http_blob_release(json);
 
 	LOG("Response sent, ret=%d", ret);
 	return ret;
@@ -994,11 +1217,19 @@ pkg_api_handler(http_request_t *req)
 int
 packages_module_attach_routes(struct router *r)
 {
-	/* Register the prefix route for all packages endpoints. */
-	if (router_register_prefix(r, "GET", "/api/packages", 0,
-		pkg_api_handler) != 0)
+	/* Register the prefix route for all packages endpoints; pkg_info and
+	 * pkg_which may block for seconds, so they run on the slow lane. */
+	if (router_register_prefix_cached(r, ROUTE_CLASS_SLOW, "GET",
+		"/api/packages", 0, pkg_api_handler, &pkg_cache_policy) != 0)
 		return -1;
 
+	/* Build the package model and file index before the first query. */
+	if (pkg_db_start() != 0)
+		LOG("Package database refresh task not registered");
+	/* Searches are answered from the stored mirror catalogue. */
+	if (config.db_path[0] != '\0' && pkg_catalog_start(config.db_path) != 0)
+		LOG("Package catalogue unavailable; searching installed packages");
+
 	return 0;
 }
 
@@ -1012,5 +1243,6 @@ void
 packages_cache_cleanup(void)
 {
 	LOG("Cleaning up package caches");
-	pkg_ring_free(&g_pkg_ring);
+	pkg_catalog_cleanup();
+	pkg_db_cleanup();
 }
@@ -0,0 +1,425 @@
+/* pkg_catalog.c - persistent catalogue of available packages */
+
+#include <ctype.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/storage/sqlite_db.h>
+#include <miniweb/storage/sqlite_schema.h>
+#include <miniweb/storage/sqlite_stmt.h>
+#include "pkg_internal.h"
+
+/*
+ * pkg_info -Q asks the package mirror, which is slow and lost on restart.
+ * The catalogue keeps every package the mirror offers, plus the installed
+ * ones with their comments, in the pkg_catalog table of the db_path
+ * database, and searches run against a trigram FTS5 index over its names
+ * and comments. Triggers keep the index in step with the table.
+ *
+ * The "pkg.catalog" heartbeat task lists the mirror again once the stored
+ * copy is PKG_CATALOG_MAX_AGE_SEC old, surviving restarts in between.
+ * A refresh upserts every name with the refresh time and then deletes
+ * the names it did not see, so unchanged rows and their index entries are
+ * left alone. Without SQLite's FTS5 trigram tokenizer, searches scan the
+ * table with LIKE instead.
+ *
+ * The database runs in WAL mode: a refresh goes through its writer
+ * thread, and searches check out one of PKG_CATALOG_READERS read-only
+ * connections, so workers search in parallel, refresh or not.
+ */
+
+#define PKG_CATALOG_PERIOD_SEC	3600
+#define PKG_CATALOG_MAX_AGE_SEC	(6 * 3600)
+#define PKG_CATALOG_TIMEOUT	120
+#define PKG_CATALOG_MAX_OUTPUT	(4 * 1024 * 1024)
+#define PKG_CATALOG_MAX_RESULTS	500
+#define PKG_CATALOG_QUERY_MAX	256
+#define PKG_CATALOG_READERS	4
+
+/*
+ * Version 1 predates versioning, hence IF NOT EXISTS. The FTS index is
+ * not a migration: it is built by the first open whose SQLite has the
+ * trigram tokenizer.
+ */
+static const struct mw_migration pkg_catalog_migrations[] = {
+	{ 1, "CREATE TABLE IF NOT EXISTS pkg_catalog ("
+	    " id INTEGER PRIMARY KEY,"
+	    " name TEXT NOT NULL UNIQUE,"
+	    " stem TEXT NOT NULL,"
+	    " version TEXT NOT NULL,"
+	    " comment TEXT NOT NULL DEFAULT '',"
+	    " seen INTEGER NOT NULL);"
+	    "CREATE TABLE IF NOT EXISTS pkg_catalog_meta ("
+	    " key TEXT PRIMARY KEY,"
+	    " value INTEGER NOT NULL);" },
+};
+
+static const char pkg_catalog_fts_schema[] =
+    "CREATE VIRTUAL TABLE pkg_catalog_fts USING fts5(name, comment,"
+    " content='pkg_catalog', content_rowid='id', tokenize='trigram');"
+    "CREATE TRIGGER pkg_catalog_ai AFTER INSERT ON pkg_catalog BEGIN"
+    " INSERT INTO pkg_catalog_fts(rowid, name, comment)"
+    " VALUES (new.id, new.name, new.comment); END;"
+    "CREATE TRIGGER pkg_catalog_ad AFTER DELETE ON pkg_catalog BEGIN"
+    " INSERT INTO pkg_catalog_fts(pkg_catalog_fts, rowid, name, comment)"
+    " VALUES ('delete', old.id, old.name, old.comment); END;"
+    "CREATE TRIGGER pkg_catalog_au AFTER UPDATE OF comment ON pkg_catalog"
+    " BEGIN"
+    " INSERT INTO pkg_catalog_fts(pkg_catalog_fts, rowid, name, comment)"
+    " VALUES ('delete', old.id, old.name, old.comment);"
+    " INSERT INTO pkg_catalog_fts(rowid, name, comment)"
+    " VALUES (new.id, new.name, new.comment); END;"
+    /* Rows stored before the index existed. */
+    "INSERT INTO pkg_catalog_fts(pkg_catalog_fts) VALUES ('rebuild');";
+
+/*
+ * Held shared while the database is used, exclusively to open or close
+ * it; pkg_catalog_fts only changes with it held exclusively.
+ */
+static pthread_rwlock_t pkg_catalog_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct mw_db *pkg_catalog_db;
+static int pkg_catalog_fts;		/* trigram index available */
+static int64_t pkg_catalog_rows;	/* atomic */
+
+/* What pkg_catalog_write() stores, on the writer thread. */
+struct pkg_catalog_batch {
+	const char *listing;
+	const pkg_db_t *installed;
+	time_t now;
+};
+
+/** Run a statement that returns at most one integer; @p def otherwise. */
+static int64_t
+pkg_catalog_scalar(struct mw_db *db, const char *sql, int64_t def)
+{
+	struct mw_stmt *st;
+	int64_t v = def;
+
+	if (mw_stmt_prepare_cached(db, sql, &st) != 0)
+		return def;
+	if (mw_stmt_step(st) == 0)
+		v = mw_column_int64(st, 0);
+	mw_stmt_finalize(st);
+	return v;
+}
+
+/**
+ * @brief Open the catalogue in @p path, creating its tables.
+ *
+ * @return 0 on success, -1 when the database cannot be opened.
+ */
+int
+pkg_catalog_open(const char *path)
+{
+	struct mw_db *db;
+	char dir[PATH_MAX];
+
+	if (!path || *path == '\0')
+		return -1;
+	strlcpy(dir, path, sizeof(dir));
+	if (mkdir(dirname(dir), 0750) != 0 && errno != EEXIST)
+		log_debug("[PKG] Cannot create the directory of %s", path);
+	if (mw_db_open(path, MW_DB_WAL | MW_DB_READERS(PKG_CATALOG_READERS),
+	    &db) != 0)
+		return -1;
+	if (mw_db_migrate(db, "packages", pkg_catalog_migrations,
+	    sizeof(pkg_catalog_migrations) /
+	    sizeof(pkg_catalog_migrations[0])) != 0) {
+		log_error("[PKG] %s: cannot create the package catalogue", path);
+		mw_db_close(db);
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&pkg_catalog_lock);
+	mw_db_close(pkg_catalog_db);
+	pkg_catalog_db = db;
+	pkg_catalog_fts = pkg_catalog_scalar(db, "SELECT count(*)"
+	    " FROM sqlite_master WHERE name = 'pkg_catalog_fts'", 0) > 0;
+	if (!pkg_catalog_fts) {
+		/* All or nothing: a half-made index would miss rows. */
+		if (mw_tx_begin(db) == 0) {
+			if (mw_db_exec_schema(db, pkg_catalog_fts_schema) == 0 &&
+			    mw_tx_commit(db) == 0)
+				pkg_catalog_fts = 1;
+			else
+				(void)mw_tx_rollback(db);
+		}
+		if (!pkg_catalog_fts)
+			log_info("[PKG] No FTS5 trigram index; package searches "
+			    "scan the catalogue");
+	}
+	__atomic_store_n(&pkg_catalog_rows, pkg_catalog_scalar(db,
+	    "SELECT count(*) FROM pkg_catalog", 0), __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&pkg_catalog_lock);
+	return 0;
+}
+
+/** Upsert one name seen at @p gen; the stem ends at the first "-digit". */
+static int
+pkg_catalog_put(struct mw_stmt *st, const char *name, int64_t gen)
+{
+	char stem[PKG_CATALOG_QUERY_MAX];
+	const char *v = name;
+	int rc;
+
+	while ((v = strchr(v, '-')) != NULL && !isdigit((unsigned char)v[1]))
+		v++;
+	if (!v || (size_t)(v - name) >= sizeof(stem))
+		return 0;	/* not a package name */
+	memcpy(stem, name, (size_t)(v - name));
+	stem[v - name] = '\0';
+
+	rc = mw_bind_text(st, 1, name) == 0 && mw_bind_text(st, 2, stem) == 0 &&
+	    mw_bind_text(st, 3, v + 1) == 0 && mw_bind_int64(st, 4, gen) == 0 &&
+	    mw_stmt_step(st) > 0 ? 0 : -1;
+	(void)mw_stmt_reset(st);
+	return rc;
+}
+
+/** Store a refresh, on the writer thread; non-zero undoes it. */
+static int
+pkg_catalog_write(struct mw_db *db, void *ctx)
+{
+	const struct pkg_catalog_batch *b = ctx;
+	const pkg_db_t *installed = b->installed;
+	struct mw_stmt *put = NULL, *comment = NULL, *del = NULL, *meta = NULL;
+	int rc = -1;
+
+	if (mw_stmt_prepare_cached(db, "INSERT INTO pkg_catalog"
+	    "(name, stem, version, seen) VALUES (?, ?, ?, ?)"
+	    " ON CONFLICT(name) DO UPDATE SET seen = excluded.seen",
+	    &put) != 0 ||
+	    mw_stmt_prepare_cached(db, "UPDATE pkg_catalog SET comment = ?2"
+	    " WHERE name = ?1 AND comment <> ?2", &comment) != 0 ||
+	    mw_stmt_prepare_cached(db, "DELETE FROM pkg_catalog"
+	    " WHERE seen <> ?", &del) != 0 ||
+	    mw_stmt_prepare_cached(db, "INSERT OR REPLACE INTO"
+	    " pkg_catalog_meta(key, value) VALUES ('refreshed', ?)",
+	    &meta) != 0)
+		goto done;
+
+	for (const char *p = b->listing; p && *p; ) {
+		/* Installed packages are listed as "name (installed)". */
+		size_t n = strcspn(p, " \t\r\n");
+
+		if (n > 0 && n < PKG_CATALOG_QUERY_MAX) {
+			char name[PKG_CATALOG_QUERY_MAX];
+
+			memcpy(name, p, n);
+			name[n] = '\0';
+			if (pkg_catalog_put(put, name, (int64_t)b->now) != 0)
+				goto done;
+		}
+		p += strcspn(p, "\r\n");
+		p += strspn(p, "\r\n");
+	}
+	for (size_t i = 0; installed && i < installed->count; i++) {
+		const pkg_db_pkg_t *pkg = installed->pkgs[i];
+
+		if (pkg_catalog_put(put, pkg->name, (int64_t)b->now) != 0)
+			goto done;
+		if (mw_bind_text(comment, 1, pkg->name) != 0 ||
+		    mw_bind_text(comment, 2, pkg->comment ? pkg->comment : "") !=
+		    0 || mw_stmt_step(comment) <= 0)
+			goto done;
+		(void)mw_stmt_reset(comment);
+	}
+	if (mw_bind_int64(del, 1, (int64_t)b->now) == 0 &&
+	    mw_stmt_step(del) > 0 &&
+	    mw_bind_int64(meta, 1, (int64_t)b->now) == 0 &&
+	    mw_stmt_step(meta) > 0)
+		rc = 0;
+done:
+	mw_stmt_finalize(put);
+	mw_stmt_finalize(comment);
+	mw_stmt_finalize(del);
+	mw_stmt_finalize(meta);
+	return rc;
+}
+
+/**
+ * @brief Replace the catalogue with a pkg_info -Q listing and the
+ * installed packages.
+ *
+ * @param listing One package name per line; NULL stores only @p installed.
+ * @param installed Installed packages, whose comments are kept; may be NULL.
+ * @param now Refresh time, stored as the generation of every row seen.
+ *
+ * @return Rows in the catalogue, or -1 when it could not be written.
+ */
+int64_t
+pkg_catalog_load(const char *listing, const pkg_db_t *installed, time_t now)
+{
+	struct pkg_catalog_batch b = { listing, installed, now };
+	struct mw_db *r;
+	int64_t rows = -1;
+
+	pthread_rwlock_rdlock(&pkg_catalog_lock);
+	if (pkg_catalog_db &&
+	    mw_db_write(pkg_catalog_db, pkg_catalog_write, &b) == 0) {
+		r = mw_db_reader(pkg_catalog_db);
+		rows = pkg_catalog_scalar(r, "SELECT count(*) FROM pkg_catalog",
+		    0);
+		mw_db_reader_put(pkg_catalog_db, r);
+		__atomic_store_n(&pkg_catalog_rows, rows, __ATOMIC_RELAXED);
+	}
+	pthread_rwlock_unlock(&pkg_catalog_lock);
+	return rows;
+}
+
+/** Time of the last stored refresh, 0 when there was none. */
+time_t
+pkg_catalog_refreshed(void)
+{
+	struct mw_db *r;
+	time_t t = 0;
+
+	pthread_rwlock_rdlock(&pkg_catalog_lock);
+	if (pkg_catalog_db) {
+		r = mw_db_reader(pkg_catalog_db);
+		t = (time_t)pkg_catalog_scalar(r, "SELECT value"
+		    " FROM pkg_catalog_meta WHERE key = 'refreshed'", 0);
+		mw_db_reader_put(pkg_catalog_db, r);
+	}
+	pthread_rwlock_unlock(&pkg_catalog_lock);
+	return t;
+}
+
+/**
+ * @brief Call @p cb with each package whose name or comment contains
+ * @p query, ignoring case, in name order.
+ *
+ * @return Packages reported, or -1 when the catalogue is unavailable or
+ * empty and the caller should search elsewhere.
+ */
+int
+pkg_catalog_search(const char *query, pkg_catalog_cb cb, void *ctx)
+{
+	char pattern[2 * PKG_CATALOG_QUERY_MAX + 3], *o = pattern;
+	size_t qlen = strlen(query);
+	struct mw_stmt *st;
+	struct mw_db *r;
+	int count = 0, use_fts;
+
+	if (qlen == 0 || qlen >= PKG_CATALOG_QUERY_MAX)
+		return -1;
+
+	pthread_rwlock_rdlock(&pkg_catalog_lock);
+	/* Trigrams need three characters; shorter queries scan. */
+	use_fts = pkg_catalog_fts && qlen >= 3;
+	*o++ = use_fts ? '"' : '%';
+	for (const char *p = query; *p; p++) {
+		if (use_fts && *p == '"')
+			*o++ = '"';
+		else if (!use_fts && (*p == '%' || *p == '_' || *p == '\\'))
+			*o++ = '\\';
+		*o++ = *p;
+	}
+	*o++ = use_fts ? '"' : '%';
+	*o = '\0';
+
+	if (!pkg_catalog_db ||
+	    __atomic_load_n(&pkg_catalog_rows, __ATOMIC_RELAXED) == 0) {
+		pthread_rwlock_unlock(&pkg_catalog_lock);
+		return -1;
+	}
+	r = mw_db_reader(pkg_catalog_db);
+	if (mw_stmt_prepare_cached(r, use_fts ?
+	    "SELECT c.name FROM pkg_catalog_fts f JOIN pkg_catalog c"
+	    " ON c.id = f.rowid WHERE pkg_catalog_fts MATCH ?1"
+	    " ORDER BY c.name LIMIT ?2" :
+	    "SELECT name FROM pkg_catalog WHERE name LIKE ?1 ESCAPE '\\'"
+	    " OR comment LIKE ?1 ESCAPE '\\' ORDER BY name LIMIT ?2", &st) != 0) {
+		mw_db_reader_put(pkg_catalog_db, r);
+		pthread_rwlock_unlock(&pkg_catalog_lock);
+		return -1;
+	}
+	(void)mw_bind_text(st, 1, pattern);
+	(void)mw_bind_int64(st, 2, PKG_CATALOG_MAX_RESULTS);
+	while (mw_stmt_step(st) == 0) {
+		if (cb(mw_column_text(st, 0), ctx) != 0) {
+			count = -1;
+			break;
+		}
+		count++;
+	}
+	mw_stmt_finalize(st);
+	mw_db_reader_put(pkg_catalog_db, r);
+	pthread_rwlock_unlock(&pkg_catalog_lock);
+	return count;
+}
+
+/** Heartbeat: list the mirror again once the stored copy is too old. */
+static void
+pkg_catalog_heartbeat(void *ctx)
+{
+	char *const argv[] = {"pkg_info", "-Q", "-", NULL};
+	time_t now = time(NULL);
+	pkg_db_t *installed;
+	char *listing;
+	int64_t rows;
+
+	(void)ctx;
+	if (now - pkg_catalog_refreshed() < PKG_CATALOG_MAX_AGE_SEC)
+		return;
+	/* Every package name has a "-" before its version. */
+	listing = safe_popen_read_argv("/usr/sbin/pkg_info", argv,
+	    PKG_CATALOG_MAX_OUTPUT, PKG_CATALOG_TIMEOUT, NULL);
+	if (!listing || *listing == '\0') {
+		/* Mirror unreachable: keep what we have, try next tick. */
+		log_debug("[PKG] Package mirror listing failed");
+		free(listing);
+		return;
+	}
+	installed = pkg_db_acquire();
+	rows = pkg_catalog_load(listing, installed, now);
+	pkg_db_release(installed);
+	free(listing);
+	if (rows >= 0)
+		log_debug("[PKG] Package catalogue refreshed: %lld packages",
+		    (long long)rows);
+}
+
+/**
+ * @brief Open the catalogue in @p path and keep it refreshed.
+ *
+ * @return 0 on success, -1 when it cannot be opened or the task could not
+ * be registered.
+ */
+int
+pkg_catalog_start(const char *path)
+{
+	if (pkg_catalog_open(path) != 0)
+		return -1;
+	if (heartbeat_register(&(struct hb_task){
+		.name = "pkg.catalog",
+		.period_sec = PKG_CATALOG_PERIOD_SEC,
+		.initial_delay_sec = 30,
+		.cb = pkg_catalog_heartbeat,
+		.ctx = NULL,
+	    }) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/** Stop refreshing and close the database; the rows stay on disk. */
+void
+pkg_catalog_cleanup(void)
+{
+	(void)heartbeat_unregister("pkg.catalog");
+	pthread_rwlock_wrlock(&pkg_catalog_lock);
+	mw_db_close(pkg_catalog_db);
+	pkg_catalog_db = NULL;
+	pkg_catalog_fts = 0;
+	__atomic_store_n(&pkg_catalog_rows, 0, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&pkg_catalog_lock);
+}
@@ -0,0 +1,699 @@
+/* pkg_db.c - in-memory model of the installed-package database */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/readiness.h>
+#include "pkg_internal.h"
+
+/*
+ * pkg_add(1) keeps one directory per installed package under /var/db/pkg,
+ * holding the packing list (+CONTENTS), the description (+DESC) and the
+ * packages that depend on it (+REQUIRED_BY). The first query reads them
+ * all into an immutable snapshot; pkg_add and pkg_delete rename or remove
+ * entries, which moves the mtime of the root, and the next query after
+ * that reads the database again. A query takes a reference under
+ * pkg_db_lock and runs unlocked, as the man index does.
+ *
+ * A package whose directory and +REQUIRED_BY kept their mtimes is shared
+ * with the previous snapshot instead of being parsed again, so a refresh
+ * after pkg_add only reads the new packages. Each snapshot also has a
+ * hash table from every installed file to its package, filled from the
+ * path hashes each package computed when it was parsed. The "pkg.db"
+ * heartbeat task keeps the snapshot current between queries, so queries
+ * rarely wait for a refresh.
+ */
+
+#define PKG_DB_DESC_MAX		(64 * 1024)
+#define PKG_DB_LINE_MAX		4096
+#define PKG_DB_LOCALBASE	"/usr/local"
+#define PKG_DB_PERIOD_SEC	60
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+} pkg_db_buf_t;
+
+static pthread_mutex_t pkg_db_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pkg_db_build_lock = PTHREAD_MUTEX_INITIALIZER;
+static pkg_db_t *pkg_db_current;
+static char pkg_db_root[PATH_MAX] = PKG_DB_ROOT;	/* build lock */
+
+/** Append @p n bytes of @p s and a NUL to @p b; -1 on allocation failure. */
+static int
+pkg_db_buf_put(pkg_db_buf_t *b, const char *s, size_t n)
+{
+	if (b->len + n + 2 > b->cap) {
+		size_t ncap = b->cap ? b->cap : 4096;
+		char *nb;
+
+		while (b->len + n + 2 > ncap)
+			ncap *= 2;
+		if ((nb = realloc(b->buf, ncap)) == NULL)
+			return -1;
+		b->buf = nb;
+		b->cap = ncap;
+	}
+	memcpy(b->buf + b->len, s, n);
+	b->len += n;
+	b->buf[b->len++] = '\0';
+	return 0;
+}
+
+/** Read @p dir/@p file, up to @p max bytes; NULL when absent. */
+static char *
+pkg_db_slurp(const char *dir, const char *file, size_t max)
+{
+	char path[PATH_MAX];
+	char *buf;
+	size_t n;
+	FILE *f;
+
+	if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, file) >=
+	    sizeof(path))
+		return NULL;
+	if ((f = fopen(path, "r")) == NULL)
+		return NULL;
+	if ((buf = malloc(max + 1)) != NULL) {
+		n = fread(buf, 1, max, f);
+		buf[n] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+/** FNV-1a over @p s. */
+static uint32_t
+pkg_db_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+/**
+ * @brief Name pkg_add -z takes for @p name: stem, "--", flavor, and the
+ * "%branch" a versioned pkgpath (lang/python/3.11) carries.
+ */
+static char *
+pkg_db_fuzzy(const char *name, const char *pkgpath, size_t *stem_len)
+{
+	const char *ver = NULL, *flavor = "", *branch = "";
+	size_t blen = 0;
+	char *out;
+	int n;
+
+	/* The version is the first component that starts with a digit. */
+	for (const char *p = strchr(name, '-'); p; p = strchr(p + 1, '-')) {
+		if (isdigit((unsigned char)p[1])) {
+			ver = p;
+			break;
+		}
+	}
+	*stem_len = ver ? (size_t)(ver - name) : strlen(name);
+	if (ver && (flavor = strchr(ver + 1, '-')) != NULL)
+		flavor++;
+	else
+		flavor = "";
+
+	if (pkgpath) {
+		const char *s = strchr(pkgpath, '/');
+
+		if (s && (s = strchr(s + 1, '/')) != NULL &&
+		    isdigit((unsigned char)s[1])) {
+			branch = s + 1;
+			blen = strcspn(branch, ",/ ");
+		}
+	}
+
+	n = snprintf(NULL, 0, "%.*s--%s%s%.*s", (int)*stem_len, name, flavor,
+	    blen ? "%" : "", (int)blen, branch);
+	if (n < 0 || (out = malloc((size_t)n + 1)) == NULL)
+		return NULL;
+	snprintf(out, (size_t)n + 1, "%.*s--%s%s%.*s", (int)*stem_len, name,
+	    flavor, blen ? "%" : "", (int)blen, branch);
+	return out;
+}
+
+/** Packing-list keywords whose argument is an installed file. */
+static int
+pkg_db_file_keyword(const char *kw, size_t len)
+{
+	static const char *const kws[] = {
+		"bin", "file", "info", "lib", "man", "rcscript", "sample",
+		"shell", "so", "static-lib",
+	};
+
+	for (size_t i = 0; i < sizeof(kws) / sizeof(kws[0]); i++) {
+		if (strlen(kws[i]) == len && strncmp(kws[i], kw, len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/** Record file @p entry of the packing list, relative to @p cwd. */
+static int
+pkg_db_add_file(pkg_db_buf_t *files, size_t *nfiles, const char *cwd,
+    const char *entry)
+{
+	char path[PATH_MAX];
+	size_t n = strlen(entry);
+
+	/* Directories end in a slash; pkg_info -L lists files only. */
+	if (n == 0 || entry[n - 1] == '/')
+		return 0;
+	if (entry[0] != '/') {
+		n = (size_t)snprintf(path, sizeof(path), "%s%s%s", cwd,
+		    cwd[0] && cwd[strlen(cwd) - 1] == '/' ? "" : "/", entry);
+		if (n >= sizeof(path))
+			return 0;
+		entry = path;
+	}
+	(*nfiles)++;
+	return pkg_db_buf_put(files, entry, n);
+}
+
+/**
+ * @brief Parse the packing list in @p dir into @p pkg.
+ * @return 0 on success, -1 when it cannot be read.
+ */
+static int
+pkg_db_read_contents(pkg_db_pkg_t *pkg, const char *dir, char **pkgpath)
+{
+	char path[PATH_MAX], line[PKG_DB_LINE_MAX];
+	char cwd[PATH_MAX] = "";
+	pkg_db_buf_t files = {0};
+	const char *p;
+	FILE *f;
+	int rc = 0;
+
+	if ((size_t)snprintf(path, sizeof(path), "%s/+CONTENTS", dir) >=
+	    sizeof(path) || (f = fopen(path, "r")) == NULL)
+		return -1;
+	while (rc == 0 && fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\n");
+		const char *arg;
+		size_t kwlen;
+
+		/* A line too long for the buffer is not a path: skip it. */
+		if (line[len] != '\n' && !feof(f)) {
+			int c;
+
+			while ((c = fgetc(f)) != EOF && c != '\n')
+				;
+			continue;
+		}
+		line[len] = '\0';
+		if (line[0] != '@') {
+			/* Lines before the first @cwd name +DESC and friends. */
+			if (cwd[0] != '\0')
+				rc = pkg_db_add_file(&files, &pkg->nfiles, cwd,
+				    line);
+			continue;
+		}
+		kwlen = strcspn(line + 1, " ");
+		arg = line + 1 + kwlen;
+		while (*arg == ' ')
+			arg++;
+		if (kwlen == 4 && strncmp(line + 1, "name", 4) == 0) {
+			free(pkg->name);
+			if ((pkg->name = strdup(arg)) == NULL)
+				rc = -1;
+		} else if (kwlen == 3 && strncmp(line + 1, "cwd", 3) == 0) {
+			strlcpy(cwd, arg, sizeof(cwd));
+		} else if (kwlen == 6 && strncmp(line + 1, "option", 6) == 0) {
+			if (strcmp(arg, "manual-installation") == 0)
+				pkg->manual = 1;
+		} else if (kwlen == 7 && strncmp(line + 1, "comment", 7) == 0) {
+			if (!*pkgpath && strncmp(arg, "pkgpath=", 8) == 0 &&
+			    (*pkgpath = strdup(arg + 8)) != NULL)
+				(*pkgpath)[strcspn(*pkgpath, " ")] = '\0';
+		} else if (pkg_db_file_keyword(line + 1, kwlen)) {
+			if (cwd[0] == '\0')
+				strlcpy(cwd, PKG_DB_LOCALBASE, sizeof(cwd));
+			rc = pkg_db_add_file(&files, &pkg->nfiles, cwd, arg);
+		}
+	}
+	fclose(f);
+	if (rc == 0 && pkg_db_buf_put(&files, "", 0) != 0)
+		rc = -1;
+	if (rc != 0) {
+		free(files.buf);
+		return -1;
+	}
+	pkg->files = files.buf;
+	pkg->hashes = calloc(pkg->nfiles ? pkg->nfiles : 1,
+	    sizeof(*pkg->hashes));
+	if (!pkg->hashes)
+		return -1;
+	p = pkg->files;
+	for (size_t i = 0; *p != '\0'; p += strlen(p) + 1)
+		pkg->hashes[i++] = pkg_db_hash(p);
+	return 0;
+}
+
+/** Release what @p pkg owns, and @p pkg itself. */
+static void
+pkg_db_pkg_free(pkg_db_pkg_t *pkg)
+{
+	if (!pkg)
+		return;
+	free(pkg->entry);
+	free(pkg->name);
+	free(pkg->fuzzy);
+	free(pkg->comment);
+	free(pkg->desc);
+	free(pkg->required_by);
+	free(pkg->files);
+	free(pkg->hashes);
+	free(pkg);
+}
+
+/**
+ * @brief Read the package whose database entry is @p dir.
+ *
+ * @param entry Directory name, the package name when the packing list
+ * has no @name line.
+ * @param st Status of @p dir.
+ *
+ * @return The package with one reference, or NULL when the entry is
+ * unreadable or malformed.
+ */
+static pkg_db_pkg_t *
+pkg_db_read_pkg(const char *dir, const char *entry, const struct stat *st,
+    const struct timespec *req_mtime)
+{
+	char *pkgpath = NULL, *desc, *nl;
+	pkg_db_pkg_t *pkg;
+
+	if ((pkg = calloc(1, sizeof(*pkg))) == NULL)
+		return NULL;
+	pkg->refs = 1;
+	pkg->mtime = st->st_mtim;
+	pkg->req_mtime = *req_mtime;
+	if ((pkg->entry = strdup(entry)) == NULL ||
+	    pkg_db_read_contents(pkg, dir, &pkgpath) != 0)
+		goto fail;
+	if (!pkg->name && (pkg->name = strdup(entry)) == NULL)
+		goto fail;
+	pkg->fuzzy = pkg_db_fuzzy(pkg->name, pkgpath, &pkg->stem_len);
+
+	if ((desc = pkg_db_slurp(dir, "+DESC", PKG_DB_DESC_MAX)) == NULL)
+		desc = strdup("");
+	if (desc && (nl = strchr(desc, '\n')) != NULL) {
+		*nl = '\0';
+		pkg->desc = strdup(nl + 1);
+	} else {
+		pkg->desc = strdup("");
+	}
+	pkg->comment = desc;
+	if ((pkg->required_by = pkg_db_slurp(dir, "+REQUIRED_BY",
+	    PKG_DB_DESC_MAX)) == NULL)
+		pkg->required_by = strdup("");
+	if (!pkg->fuzzy || !pkg->comment || !pkg->desc || !pkg->required_by)
+		goto fail;
+	free(pkgpath);
+	return pkg;
+
+fail:
+	free(pkgpath);
+	pkg_db_pkg_free(pkg);
+	return NULL;
+}
+
+static int
+pkg_db_pkg_cmp(const void *a, const void *b)
+{
+	return strcmp((*(pkg_db_pkg_t *const *)a)->name,
+	    (*(pkg_db_pkg_t *const *)b)->name);
+}
+
+static int
+pkg_db_name_cmp(const void *key, const void *elem)
+{
+	return strcmp(key, (*(pkg_db_pkg_t *const *)elem)->name);
+}
+
+/** Drop a reference on each package of @p db, then free @p db. */
+static void
+pkg_db_free(pkg_db_t *db)
+{
+	if (!db)
+		return;
+	/* Packages still used by a newer snapshot are the newer one's. */
+	pthread_mutex_lock(&pkg_db_lock);
+	for (size_t i = 0; i < db->count; i++) {
+		if (--db->pkgs[i]->refs > 0)
+			db->pkgs[i] = NULL;
+	}
+	pthread_mutex_unlock(&pkg_db_lock);
+	for (size_t i = 0; i < db->count; i++)
+		pkg_db_pkg_free(db->pkgs[i]);
+	free(db->pkgs);
+	free(db->files);
+	free(db);
+}
+
+/** Slot holding @p path, or the empty slot it would take. */
+static pkg_db_file_t *
+pkg_db_file_slot(const pkg_db_t *db, const char *path, uint32_t hash)
+{
+	for (size_t i = hash & db->files_mask; ;
+	    i = (i + 1) & db->files_mask) {
+		pkg_db_file_t *f = &db->files[i];
+
+		if (!f->path || (f->hash == hash && strcmp(f->path, path) == 0))
+			return f;
+	}
+}
+
+/**
+ * @brief Fill the file table of @p db from the path hashes of its
+ * packages; where two packages claim a file, the first by name keeps it.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int
+pkg_db_index_files(pkg_db_t *db)
+{
+	size_t nfiles = 0, size = 16;
+
+	for (size_t i = 0; i < db->count; i++)
+		nfiles += db->pkgs[i]->nfiles;
+	while (size < nfiles * 2)
+		size *= 2;
+	if ((db->files = calloc(size, sizeof(*db->files))) == NULL)
+		return -1;
+	db->files_mask = size - 1;
+	for (size_t i = 0; i < db->count; i++) {
+		const pkg_db_pkg_t *pkg = db->pkgs[i];
+		const char *p = pkg->files;
+
+		for (size_t j = 0; *p != '\0'; p += strlen(p) + 1, j++) {
+			pkg_db_file_t *f = pkg_db_file_slot(db, p,
+			    pkg->hashes[j]);
+
+			if (f->path)
+				continue;
+			f->path = p;
+			f->hash = pkg->hashes[j];
+			f->pkg = (uint32_t)i;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Package @p entry of @p old, with a new reference, when its
+ * directory and +REQUIRED_BY still have the mtimes it was read with.
+ */
+static pkg_db_pkg_t *
+pkg_db_reuse(pkg_db_t *old, const char *entry, const struct stat *st,
+    const struct timespec *req_mtime)
+{
+	pkg_db_pkg_t **pp, *pkg;
+
+	if (!old)
+		return NULL;
+	/* Entries are named after their package. */
+	pp = bsearch(entry, old->pkgs, old->count, sizeof(*old->pkgs),
+	    pkg_db_name_cmp);
+	if (!pp)
+		return NULL;
+	pkg = *pp;
+	if (strcmp(pkg->entry, entry) != 0 ||
+	    pkg->mtime.tv_sec != st->st_mtim.tv_sec ||
+	    pkg->mtime.tv_nsec != st->st_mtim.tv_nsec ||
+	    pkg->req_mtime.tv_sec != req_mtime->tv_sec ||
+	    pkg->req_mtime.tv_nsec != req_mtime->tv_nsec)
+		return NULL;
+	pthread_mutex_lock(&pkg_db_lock);
+	pkg->refs++;
+	pthread_mutex_unlock(&pkg_db_lock);
+	return pkg;
+}
+
+/**
+ * @brief Read the packages under @p root, sharing the unchanged ones
+ * with @p old. Called with the build lock held.
+ */
+static pkg_db_t *
+pkg_db_build(const char *root, const struct timespec *mtime, pkg_db_t *old)
+{
+	struct dirent *de;
+	pkg_db_t *db;
+	size_t cap = 0, parsed = 0;
+	DIR *d;
+
+	if ((d = opendir(root)) == NULL)
+		return NULL;
+	if ((db = calloc(1, sizeof(*db))) == NULL) {
+		closedir(d);
+		return NULL;
+	}
+	db->refs = 1;
+	db->mtime = *mtime;
+	while ((de = readdir(d)) != NULL) {
+		struct timespec req_mtime = {0, 0};
+		char dir[PATH_MAX], req[PATH_MAX];
+		struct stat st, rst;
+		pkg_db_pkg_t *pkg;
+
+		if (de->d_name[0] == '.')
+			continue;
+		if ((size_t)snprintf(dir, sizeof(dir), "%s/%s", root,
+		    de->d_name) >= sizeof(dir) || stat(dir, &st) != 0 ||
+		    !S_ISDIR(st.st_mode))
+			continue;
+		/* Installing a dependent package rewrites this file only. */
+		if ((size_t)snprintf(req, sizeof(req), "%s/+REQUIRED_BY",
+		    dir) < sizeof(req) && stat(req, &rst) == 0)
+			req_mtime = rst.st_mtim;
+		if (db->count == cap) {
+			size_t ncap = cap ? cap * 2 : 256;
+			pkg_db_pkg_t **np = realloc(db->pkgs,
+			    ncap * sizeof(*np));
+
+			if (!np)
+				goto fail;
+			db->pkgs = np;
+			cap = ncap;
+		}
+		if ((pkg = pkg_db_reuse(old, de->d_name, &st,
+		    &req_mtime)) == NULL) {
+			pkg = pkg_db_read_pkg(dir, de->d_name, &st, &req_mtime);
+			parsed++;
+		}
+		if (pkg)
+			db->pkgs[db->count++] = pkg;
+	}
+	closedir(d);
+	d = NULL;
+	if (db->count > 0)
+		qsort(db->pkgs, db->count, sizeof(*db->pkgs), pkg_db_pkg_cmp);
+	if (db->count > UINT32_MAX || pkg_db_index_files(db) != 0)
+		goto fail;
+	log_debug("[PKG] package database: %zu packages (%zu read)",
+	    db->count, parsed);
+	return db;
+
+fail:
+	if (d)
+		closedir(d);
+	pkg_db_free(db);
+	return NULL;
+}
+
+/** Drop a reference on @p db; the last one frees it. */
+void
+pkg_db_release(pkg_db_t *db)
+{
+	if (!db)
+		return;
+	pthread_mutex_lock(&pkg_db_lock);
+	if (--db->refs > 0) {
+		pthread_mutex_unlock(&pkg_db_lock);
+		return;
+	}
+	pthread_mutex_unlock(&pkg_db_lock);
+	pkg_db_free(db);
+}
+
+/** Publish @p db (may be NULL) and drop the previous snapshot. */
+static void
+pkg_db_publish(pkg_db_t *db)
+{
+	pkg_db_t *old;
+
+	pthread_mutex_lock(&pkg_db_lock);
+	old = pkg_db_current;
+	pkg_db_current = db;
+	pthread_mutex_unlock(&pkg_db_lock);
+	pkg_db_release(old);
+}
+
+/**
+ * @brief Reference on an up-to-date snapshot of the package database.
+ *
+ * @details Reads the database on first use and again whenever the mtime
+ * of the root moved; callers wait for that read.
+ *
+ * @return Snapshot to pass to pkg_db_release(), or NULL when the
+ * database cannot be read, so callers can fall back to pkg_info(1).
+ */
+pkg_db_t *
+pkg_db_acquire(void)
+{
+	struct stat st;
+	pkg_db_t *db, *fresh;
+
+	pthread_mutex_lock(&pkg_db_build_lock);
+	if (stat(pkg_db_root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		pthread_mutex_unlock(&pkg_db_build_lock);
+		return NULL;
+	}
+	/* Publication only happens under the build lock we hold. */
+	pthread_mutex_lock(&pkg_db_lock);
+	if ((db = pkg_db_current) != NULL)
+		db->refs++;
+	pthread_mutex_unlock(&pkg_db_lock);
+	if (!db || db->mtime.tv_sec != st.st_mtim.tv_sec ||
+	    db->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+		if ((fresh = pkg_db_build(pkg_db_root, &st.st_mtim, db)) !=
+		    NULL) {
+			pkg_db_publish(fresh);
+			pkg_db_release(db);
+			pthread_mutex_lock(&pkg_db_lock);
+			fresh->refs++;
+			pthread_mutex_unlock(&pkg_db_lock);
+			db = fresh;
+		} else {
+			log_error("[PKG] Could not read %s", pkg_db_root);
+		}
+	}
+	pthread_mutex_unlock(&pkg_db_build_lock);
+	return db;
+}
+
+/**
+ * @brief Find a package by full name (curl-8.4.0) or by stem (curl).
+ * @return The package, or NULL when none matches.
+ */
+const pkg_db_pkg_t *
+pkg_db_find(const pkg_db_t *db, const char *name)
+{
+	pkg_db_pkg_t *const *pp;
+	size_t len = strlen(name);
+
+	pp = bsearch(name, db->pkgs, db->count, sizeof(*db->pkgs),
+	    pkg_db_name_cmp);
+	if (pp)
+		return *pp;
+	for (size_t i = 0; i < db->count; i++) {
+		if (db->pkgs[i]->stem_len == len &&
+		    strncmp(db->pkgs[i]->name, name, len) == 0)
+			return db->pkgs[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Find the package that installed @p path.
+ *
+ * @details A path not in any packing list is looked up again with its
+ * symbolic links resolved, for files reached through a linked directory.
+ *
+ * @return The package, or NULL when no package owns the file.
+ */
+const pkg_db_pkg_t *
+pkg_db_which(const pkg_db_t *db, const char *path)
+{
+	char real[PATH_MAX];
+	const pkg_db_file_t *f;
+
+	f = pkg_db_file_slot(db, path, pkg_db_hash(path));
+	if (!f->path && realpath(path, real) && strcmp(real, path) != 0)
+		f = pkg_db_file_slot(db, real, pkg_db_hash(real));
+	return f->path ? db->pkgs[f->pkg] : NULL;
+}
+
+/** Heartbeat task: pick up pkg_add and pkg_delete between queries. */
+static void
+pkg_db_heartbeat(void *ctx)
+{
+	(void)ctx;
+	pkg_db_release(pkg_db_acquire());
+}
+
+/** Startup thread: the first read parses every package, off the loop. */
+static void *
+pkg_db_build_thread(void *arg)
+{
+	(void)arg;
+	pkg_db_release(pkg_db_acquire());
+	readiness_done("pkg.db");
+	return NULL;
+}
+
+/**
+ * @brief Read the database in the background and keep it current.
+ *
+ * @details Queries arriving before the first read wait for it. Calling
+ * it again is harmless.
+ *
+ * @return 0 on success, -1 when the refresh task could not be set up.
+ */
+int
+pkg_db_start(void)
+{
+	static int started;
+	pthread_t tid;
+
+	if (__atomic_exchange_n(&started, 1, __ATOMIC_ACQ_REL))
+		return 0;
+	(void)readiness_expect("pkg.db");
+	if (pthread_create(&tid, NULL, pkg_db_build_thread, NULL) == 0)
+		(void)pthread_detach(tid);
+	else
+		readiness_done("pkg.db");
+	if (heartbeat_register(&(struct hb_task){
+		.name = "pkg.db",
+		.period_sec = PKG_DB_PERIOD_SEC,
+		.initial_delay_sec = PKG_DB_PERIOD_SEC,
+		.cb = pkg_db_heartbeat,
+		.ctx = NULL,
+	    }) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/** Read packages from @p root instead of /var/db/pkg from now on. */
+void
+pkg_db_set_root(const char *root)
+{
+	pthread_mutex_lock(&pkg_db_build_lock);
+	strlcpy(pkg_db_root, root, sizeof(pkg_db_root));
+	pkg_db_publish(NULL);
+	pthread_mutex_unlock(&pkg_db_build_lock);
+}
+
+/** Stop refreshing and drop the snapshot. */
+void
+pkg_db_cleanup(void)
+{
+	(void)heartbeat_unregister("pkg.db");
+	pthread_mutex_lock(&pkg_db_build_lock);
+	pkg_db_publish(NULL);
+	pthread_mutex_unlock(&pkg_db_build_lock);
+}
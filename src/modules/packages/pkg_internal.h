@@ -0,0 +1,63 @@
+#ifndef MINIWEB_MODULES_PKG_INTERNAL_H
+#define MINIWEB_MODULES_PKG_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PKG_DB_ROOT	"/var/db/pkg"
+
+/** One installed package, as its /var/db/pkg entry describes it. */
+typedef struct {
+	int refs;		/* snapshots sharing it */
+	char *entry;		/* directory under the root */
+	struct timespec mtime;	/* of the directory when it was read */
+	struct timespec req_mtime;	/* of +REQUIRED_BY, 0 when absent */
+	char *name;		/* curl-8.4.0p0 */
+	char *fuzzy;		/* curl--, as pkg_info -z prints it */
+	char *comment;		/* first line of +DESC */
+	char *desc;		/* rest of +DESC */
+	char *required_by;	/* +REQUIRED_BY, one name per line */
+	char *files;		/* absolute paths, NUL-separated, "" ends */
+	uint32_t *hashes;	/* of each file, in order */
+	size_t nfiles;
+	size_t stem_len;	/* "curl" in curl-8.4.0p0 */
+	int manual;		/* @option manual-installation */
+} pkg_db_pkg_t;
+
+typedef struct {
+	const char *path;	/* NULL marks an empty slot */
+	uint32_t hash;
+	uint32_t pkg;
+} pkg_db_file_t;
+
+/** Immutable snapshot of the package database. */
+typedef struct {
+	int refs;
+	struct timespec mtime;	/* of the root when it was read */
+	pkg_db_pkg_t **pkgs;	/* by name */
+	size_t count;
+	pkg_db_file_t *files;	/* file path to package, open addressing */
+	size_t files_mask;
+} pkg_db_t;
+
+void pkg_db_set_root(const char *root);
+int pkg_db_start(void);
+pkg_db_t *pkg_db_acquire(void);
+void pkg_db_release(pkg_db_t *db);
+const pkg_db_pkg_t *pkg_db_find(const pkg_db_t *db, const char *name);
+const pkg_db_pkg_t *pkg_db_which(const pkg_db_t *db, const char *path);
+void pkg_db_cleanup(void);
+
+/** Catalogue search callback; nonzero stops the search with an error. */
+typedef int (*pkg_catalog_cb)(const char *name, void *ctx);
+
+int pkg_catalog_open(const char *path);
+int pkg_catalog_start(const char *path);
+int64_t pkg_catalog_load(const char *listing, const pkg_db_t *installed,
+    time_t now);
+time_t pkg_catalog_refreshed(void);
+int pkg_catalog_search(const char *query, pkg_catalog_cb cb, void *ctx);
+void pkg_catalog_cleanup(void);
+
+#endif /* MINIWEB_MODULES_PKG_INTERNAL_H */
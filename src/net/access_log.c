@@ -0,0 +1,492 @@
+/* access_log.c - sampled binary access log */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/core/log.h>
+#include <miniweb/net/access_log.h>
+#include <miniweb/router/urls.h>
+
+/*
+ * Workers append records to a 64 KB chunk of their own, reached through
+ * a pthread key, under a mutex only the flusher ever contends. A full
+ * chunk goes on the pending list; once a second the flusher also takes
+ * the chunks being filled, and writes everything pending with writev(2).
+ * When the disk falls behind and the list is full, chunks are dropped
+ * and counted rather than making workers wait.
+ */
+
+#define ALOG_CHUNK_SIZE		(64 * 1024)
+#define ALOG_MAX_PENDING	64	/* 4 MB waiting for the disk */
+#define ALOG_FLUSH_MS		1000
+#define ALOG_IOV		64
+
+typedef struct alog_chunk {
+	struct alog_chunk *next;
+	size_t len;
+	unsigned char data[ALOG_CHUNK_SIZE];
+} alog_chunk_t;
+
+typedef struct alog_thread {
+	pthread_mutex_t lock;		/* cur, against the flusher */
+	alog_chunk_t *cur;		/* set only by the owner */
+	uint32_t seen;			/* requests, for sampling */
+	struct alog_thread *next;
+} alog_thread_t;
+
+static pthread_key_t alog_key;
+static pthread_once_t alog_once = PTHREAD_ONCE_INIT;
+static int alog_key_ok;
+
+static int alog_on;			/* records are taken */
+static int alog_fd = -1;
+static int alog_sample = 1;
+static uint64_t alog_written;
+static uint64_t alog_dropped;
+
+/* Everything below is under alog_lock. */
+static pthread_mutex_t alog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alog_cond = PTHREAD_COND_INITIALIZER;
+static alog_thread_t *alog_threads;
+static alog_chunk_t *alog_pending, **alog_pending_tail = &alog_pending;
+static int alog_npending;
+static alog_chunk_t *alog_free;
+static int alog_nfree;
+static int alog_running;		/* flusher started */
+static int alog_stop;
+static pthread_t alog_flusher;
+
+static void
+put16(unsigned char *p, uint16_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	put16(p, (uint16_t)v);
+	put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+	put32(p, (uint32_t)v);
+	put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/** Give @p c back to the free list, or free it. Under alog_lock. */
+static void
+alog_chunk_put_locked(alog_chunk_t *c)
+{
+	if (alog_nfree >= ALOG_MAX_PENDING) {
+		free(c);
+		return;
+	}
+	c->next = alog_free;
+	alog_free = c;
+	alog_nfree++;
+}
+
+/** An empty chunk; NULL when out of memory. */
+static alog_chunk_t *
+alog_chunk_get(void)
+{
+	alog_chunk_t *c;
+
+	pthread_mutex_lock(&alog_lock);
+	if ((c = alog_free) != NULL) {
+		alog_free = c->next;
+		alog_nfree--;
+	}
+	pthread_mutex_unlock(&alog_lock);
+	if (c == NULL && (c = malloc(sizeof(*c))) == NULL)
+		return NULL;
+	c->next = NULL;
+	c->len = 0;
+	return c;
+}
+
+/** Queue @p c for the flusher, or drop it when the queue is full. */
+static void
+alog_submit_locked(alog_chunk_t *c)
+{
+	if (c->len == 0 || !alog_running ||
+	    alog_npending >= ALOG_MAX_PENDING) {
+		__atomic_add_fetch(&alog_dropped, c->len / ALOG_RECORD_SIZE,
+		    __ATOMIC_RELAXED);
+		alog_chunk_put_locked(c);
+		return;
+	}
+	c->next = NULL;
+	*alog_pending_tail = c;
+	alog_pending_tail = &c->next;
+	alog_npending++;
+	pthread_cond_signal(&alog_cond);
+}
+
+/** pthread_key destructor: queue what a departing thread buffered. */
+static void
+alog_thread_free(void *p)
+{
+	alog_thread_t *t = p;
+	alog_thread_t **pp;
+
+	pthread_mutex_lock(&alog_lock);
+	for (pp = &alog_threads; *pp; pp = &(*pp)->next) {
+		if (*pp == t) {
+			*pp = t->next;
+			break;
+		}
+	}
+	if (t->cur != NULL)
+		alog_submit_locked(t->cur);
+	pthread_mutex_unlock(&alog_lock);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+static void
+alog_key_init(void)
+{
+	alog_key_ok = pthread_key_create(&alog_key, alog_thread_free) == 0;
+}
+
+/** Calling thread's block, created on first use; NULL if unavailable. */
+static alog_thread_t *
+alog_thread(void)
+{
+	alog_thread_t *t;
+
+	if (!alog_key_ok)
+		return NULL;
+	if ((t = pthread_getspecific(alog_key)) != NULL)
+		return t;
+	if ((t = calloc(1, sizeof(*t))) == NULL)
+		return NULL;
+	pthread_mutex_init(&t->lock, NULL);
+	if (pthread_setspecific(alog_key, t) != 0) {
+		pthread_mutex_destroy(&t->lock);
+		free(t);
+		return NULL;
+	}
+	pthread_mutex_lock(&alog_lock);
+	t->next = alog_threads;
+	alog_threads = t;
+	pthread_mutex_unlock(&alog_lock);
+	return t;
+}
+
+/** writev(2) every byte of @p iov, resuming after short writes. */
+static int
+alog_writev(struct iovec *iov, int n)
+{
+	ssize_t w;
+
+	while (n > 0) {
+		w = writev(alog_fd, iov, n);
+		if (w == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= (ssize_t)iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= (size_t)w;
+		}
+	}
+	return 0;
+}
+
+/** Write the chunks of @p list and give them back. */
+static void
+alog_write_list(alog_chunk_t *list)
+{
+	struct iovec iov[ALOG_IOV];
+	alog_chunk_t *batch, *next;
+	uint64_t records;
+	int n;
+
+	while (list != NULL) {
+		batch = list;
+		records = 0;
+		for (n = 0; n < ALOG_IOV && list != NULL; n++) {
+			iov[n].iov_base = list->data;
+			iov[n].iov_len = list->len;
+			records += list->len / ALOG_RECORD_SIZE;
+			list = list->next;
+		}
+		if (alog_writev(iov, n) == 0) {
+			__atomic_add_fetch(&alog_written, records,
+			    __ATOMIC_RELAXED);
+		} else {
+			log_error("[ACCESS] write: %s", strerror(errno));
+			__atomic_add_fetch(&alog_dropped, records,
+			    __ATOMIC_RELAXED);
+		}
+		pthread_mutex_lock(&alog_lock);
+		for (; batch != list; batch = next) {
+			next = batch->next;
+			alog_chunk_put_locked(batch);
+		}
+		pthread_mutex_unlock(&alog_lock);
+	}
+}
+
+/** Move every thread's chunk in progress to the pending list. */
+static void
+alog_steal_locked(void)
+{
+	alog_chunk_t *c;
+
+	for (alog_thread_t *t = alog_threads; t; t = t->next) {
+		pthread_mutex_lock(&t->lock);
+		c = t->cur;
+		if (c != NULL && c->len > 0)
+			t->cur = NULL;
+		else
+			c = NULL;
+		pthread_mutex_unlock(&t->lock);
+		if (c != NULL)
+			alog_submit_locked(c);
+	}
+}
+
+/** Flusher thread: write pending chunks as they fill, and every second. */
+static void *
+alog_flusher_main(void *arg)
+{
+	struct timespec tick, now;
+	alog_chunk_t *list;
+	int stop;
+
+	(void)arg;
+	clock_gettime(CLOCK_REALTIME, &tick);
+	pthread_mutex_lock(&alog_lock);
+	for (;;) {
+		while (!alog_stop && alog_pending == NULL) {
+			if (pthread_cond_timedwait(&alog_cond, &alog_lock,
+			    &tick) == ETIMEDOUT)
+				break;
+		}
+		clock_gettime(CLOCK_REALTIME, &now);
+		stop = alog_stop;
+		if (stop || now.tv_sec > tick.tv_sec ||
+		    (now.tv_sec == tick.tv_sec &&
+		    now.tv_nsec >= tick.tv_nsec)) {
+			alog_steal_locked();
+			tick = now;
+			tick.tv_sec += ALOG_FLUSH_MS / 1000;
+		}
+		list = alog_pending;
+		alog_pending = NULL;
+		alog_pending_tail = &alog_pending;
+		alog_npending = 0;
+		pthread_mutex_unlock(&alog_lock);
+		alog_write_list(list);
+		pthread_mutex_lock(&alog_lock);
+		if (stop)
+			break;
+	}
+	alog_running = 0;
+	pthread_mutex_unlock(&alog_lock);
+	return NULL;
+}
+
+/** Write the route table header; 0 on success. */
+static int
+alog_write_header(void)
+{
+	unsigned char *buf, *p;
+	char name[256];
+	struct iovec iov;
+	uint16_t count = 0;
+	size_t len;
+	int rc;
+
+	buf = malloc(8 + (size_t)ROUTE_ID_COUNT * (3 + 255));
+	if (buf == NULL)
+		return -1;
+	memcpy(buf, ALOG_MAGIC, 4);
+	buf[4] = ALOG_VERSION;
+	buf[5] = ALOG_RECORD_SIZE;
+	p = buf + 8;
+	for (int id = 0; id < ROUTE_ID_COUNT; id++) {
+		if (!route_describe(id, name, sizeof(name)))
+			continue;
+		len = strlen(name);
+		if (len > 255)
+			len = 255;
+		put16(p, (uint16_t)id);
+		p[2] = (unsigned char)len;
+		memcpy(p + 3, name, len);
+		p += 3 + len;
+		count++;
+	}
+	put16(buf + 6, count);
+	iov.iov_base = buf;
+	iov.iov_len = (size_t)(p - buf);
+	rc = alog_writev(&iov, 1);
+	free(buf);
+	return rc;
+}
+
+/**
+ * @brief Open @p path for appending and start the flusher thread.
+ *
+ * @param path   Log file; NULL or empty leaves the log off.
+ * @param sample Keep one request in this many (values below 1 mean 1).
+ * @return 0 on success or when disabled, -1 on error.
+ */
+int
+access_log_open(const char *path, int sample)
+{
+	if (path == NULL || path[0] == '\0')
+		return 0;
+	(void)pthread_once(&alog_once, alog_key_init);
+	if (!alog_key_ok || alog_fd != -1)
+		return -1;
+	alog_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+	if (alog_fd == -1) {
+		log_error("[ACCESS] %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (alog_write_header() != 0) {
+		log_error("[ACCESS] %s: %s", path, strerror(errno));
+		close(alog_fd);
+		alog_fd = -1;
+		return -1;
+	}
+	alog_sample = sample > 1 ? sample : 1;
+	pthread_mutex_lock(&alog_lock);
+	alog_stop = 0;
+	if (pthread_create(&alog_flusher, NULL, alog_flusher_main,
+	    NULL) != 0) {
+		pthread_mutex_unlock(&alog_lock);
+		log_error("[ACCESS] cannot start the flusher");
+		close(alog_fd);
+		alog_fd = -1;
+		return -1;
+	}
+	alog_running = 1;
+	pthread_mutex_unlock(&alog_lock);
+	__atomic_store_n(&alog_on, 1, __ATOMIC_RELEASE);
+	log_info("Access log: %s (1 request in %d)", path, alog_sample);
+	return 0;
+}
+
+/**
+ * @brief Append one record to the calling thread's chunk.
+ *
+ * @param route_id Route id, or ROUTE_STATS_UNMATCHED.
+ * @param method   HTTP_METHOD_* of the request.
+ * @param status   Status answered.
+ * @param bytes    Bytes sent.
+ * @param usec     Handler time in microseconds.
+ * @param addr     Peer IPv4 address, network order.
+ */
+void
+access_log_record(int route_id, int method, int status, size_t bytes,
+    uint64_t usec, uint32_t addr)
+{
+	unsigned char rec[ALOG_RECORD_SIZE];
+	alog_chunk_t *c, *full = NULL;
+	struct timespec now;
+	alog_thread_t *t;
+
+	if (!__atomic_load_n(&alog_on, __ATOMIC_ACQUIRE))
+		return;
+	if ((t = alog_thread()) == NULL)
+		return;
+	if (status < 500 && alog_sample > 1 &&
+	    ++t->seen % (uint32_t)alog_sample != 0)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec[0] = ALOG_REC_REQUEST;
+	rec[1] = (unsigned char)method;
+	put16(rec + 2, (uint16_t)route_id);
+	put16(rec + 4, (uint16_t)status);
+	put16(rec + 6, 0);
+	memcpy(rec + 8, &addr, 4);
+	put32(rec + 12, usec > UINT32_MAX ? UINT32_MAX : (uint32_t)usec);
+	put64(rec + 16, (uint64_t)bytes);
+	put64(rec + 24, (uint64_t)now.tv_sec * 1000000 +
+	    (uint64_t)now.tv_nsec / 1000);
+
+	pthread_mutex_lock(&t->lock);
+	if ((c = t->cur) == NULL) {
+		/* Only this thread sets cur, so it stays NULL meanwhile. */
+		pthread_mutex_unlock(&t->lock);
+		if ((c = alog_chunk_get()) == NULL) {
+			__atomic_add_fetch(&alog_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		pthread_mutex_lock(&t->lock);
+		t->cur = c;
+	}
+	memcpy(c->data + c->len, rec, ALOG_RECORD_SIZE);
+	c->len += ALOG_RECORD_SIZE;
+	if (c->len + ALOG_RECORD_SIZE > ALOG_CHUNK_SIZE) {
+		t->cur = NULL;
+		full = c;
+	}
+	pthread_mutex_unlock(&t->lock);
+	if (full != NULL) {
+		pthread_mutex_lock(&alog_lock);
+		alog_submit_locked(full);
+		pthread_mutex_unlock(&alog_lock);
+	}
+}
+
+/**
+ * @brief Stop taking records, write everything buffered and close.
+ */
+void
+access_log_close(void)
+{
+	alog_chunk_t *c;
+
+	if (!__atomic_exchange_n(&alog_on, 0, __ATOMIC_ACQ_REL))
+		return;
+	pthread_mutex_lock(&alog_lock);
+	alog_stop = 1;
+	pthread_cond_signal(&alog_cond);
+	pthread_mutex_unlock(&alog_lock);
+	pthread_join(alog_flusher, NULL);
+	close(alog_fd);
+	alog_fd = -1;
+
+	pthread_mutex_lock(&alog_lock);
+	while ((c = alog_free) != NULL) {
+		alog_free = c->next;
+		free(c);
+	}
+	alog_nfree = 0;
+	pthread_mutex_unlock(&alog_lock);
+}
+
+/**
+ * @brief Counters since startup.
+ * @param written Records written to the file.
+ * @param dropped Records lost: queue full, write error or no memory.
+ */
+void
+access_log_stats(uint64_t *written, uint64_t *dropped)
+{
+	*written = __atomic_load_n(&alog_written, __ATOMIC_RELAXED);
+	*dropped = __atomic_load_n(&alog_dropped, __ATOMIC_RELAXED);
+}
@@ -1,17 +1,58 @@
 
 #include <miniweb/net/connection_pool.h>
+#include <miniweb/net/request_buffer.h>
 
 #include <string.h>
 
+#include <miniweb/core/counters.h>
+
+#define FREE_HEAD_SLOT(h) ((int)((h) & 0xffffffffu) - 1)
+#define FREE_HEAD_TAG(h) ((h) >> 32)
+#define FREE_HEAD_MAKE(tag, slot) \
+	(((uint64_t)(tag) << 32) | (uint64_t)((slot) + 1))
+
+/** Pop a free pool slot, or -1 when exhausted. */
+static int
+free_stack_pop(miniweb_connection_pool_t *pool)
+{
+	uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		int slot = FREE_HEAD_SLOT(head);
+		if (slot < 0)
+			return -1;
+		int next = __atomic_load_n(&pool->free_next[slot], __ATOMIC_RELAXED);
+		uint64_t nhead = FREE_HEAD_MAKE(FREE_HEAD_TAG(head) + 1, next);
+		if (__atomic_compare_exchange_n(&pool->free_head, &head, nhead, 1,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return slot;
+	}
+}
+
+/** Push a pool slot back onto the free stack. */
+static void
+free_stack_push(miniweb_connection_pool_t *pool, int slot)
+{
+	uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+	for (;;) {
+		__atomic_store_n(&pool->free_next[slot], FREE_HEAD_SLOT(head),
+			__ATOMIC_RELAXED);
+		uint64_t nhead = FREE_HEAD_MAKE(FREE_HEAD_TAG(head) + 1, slot);
+		if (__atomic_compare_exchange_n(&pool->free_head, &head, nhead, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
 /** Initialize the in-memory O(1) connection pool and free-list. */
 void
 miniweb_connection_pool_init(miniweb_connection_pool_t *pool)
 {
 	memset(pool, 0, sizeof(*pool));
-	pthread_mutex_init(&pool->lock, NULL);
-	pool->free_top = MINIWEB_MAX_CONNECTIONS;
-	for (int i = 0; i < MINIWEB_MAX_CONNECTIONS; i++)
-		pool->free_stack[i] = MINIWEB_MAX_CONNECTIONS - 1 - i;
+	for (int i = 0; i < MINIWEB_MAX_CONNECTIONS; i++) {
+		pool->conn_gen[i] = 1;
+		pool->free_next[i] = i + 1 < MINIWEB_MAX_CONNECTIONS ? i + 1 : -1;
+	}
+	pool->free_head = FREE_HEAD_MAKE(0, 0);
 }
 
 /** Allocate a connection slot for an accepted socket. */
@@ -19,50 +60,68 @@ miniweb_connection_t *
 miniweb_connection_alloc(miniweb_connection_pool_t *pool, int fd,
 						 struct sockaddr_in *addr, int max_conns)
 {
-	if (fd < 0 || fd >= MINIWEB_MAX_CONNECTIONS)
+	if (fd < 0 || fd >= MINIWEB_MAX_CONNECTIONS ||
+	    __atomic_load_n(&pool->connections[fd], __ATOMIC_ACQUIRE) != NULL) {
+		counter_inc(CTR_CONN_REFUSED);
 		return NULL;
-	pthread_mutex_lock(&pool->lock);
-	if (pool->active_connections >= max_conns || pool->connections[fd] != NULL ||
-		pool->free_top <= 0) {
-		pthread_mutex_unlock(&pool->lock);
-	return NULL;
+	}
+
+	int active = __atomic_load_n(&pool->active_connections, __ATOMIC_RELAXED);
+	do {
+		if (active >= max_conns) {
+			counter_inc(CTR_CONN_REFUSED);
+			return NULL;
 		}
-		int slot = pool->free_stack[--pool->free_top];
-		miniweb_connection_t *conn = &pool->pool[slot];
-		memset(conn, 0, sizeof(*conn));
-		conn->fd = fd;
-		conn->created = time(NULL);
-		conn->last_activity = conn->created;
-		conn->gen = pool->conn_gen[fd];
-		if (addr)
-			memcpy(&conn->addr, addr, sizeof(*addr));
-	pool->connections[fd] = conn;
-	pool->active_connections++;
-	pthread_mutex_unlock(&pool->lock);
+	} while (!__atomic_compare_exchange_n(&pool->active_connections, &active,
+		active + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	int slot = free_stack_pop(pool);
+	if (slot < 0) {
+		__atomic_sub_fetch(&pool->active_connections, 1, __ATOMIC_RELAXED);
+		counter_inc(CTR_CONN_REFUSED);
+		return NULL;
+	}
+	miniweb_connection_t *conn = &pool->pool[slot];
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = fd;
+	conn->created = time(NULL);
+	conn->last_activity = conn->created;
+	conn->gen = __atomic_load_n(&pool->conn_gen[fd], __ATOMIC_ACQUIRE);
+	if (addr)
+		memcpy(&conn->addr, addr, sizeof(*addr));
+	__atomic_store_n(&pool->connections[fd], conn, __ATOMIC_RELEASE);
+	counter_inc(CTR_CONN_OPENED);
 	return conn;
 }
 
+/** Number of connection slots currently in use. */
+int
+miniweb_connection_pool_active(miniweb_connection_pool_t *pool)
+{
+	return __atomic_load_n(&pool->active_connections, __ATOMIC_RELAXED);
+}
+
 /** Free an fd-backed connection slot and bump generation counter. */
 void
 miniweb_connection_free(miniweb_connection_pool_t *pool, int fd)
 {
 	if (fd < 0 || fd >= MINIWEB_MAX_CONNECTIONS)
 		return;
-	pthread_mutex_lock(&pool->lock);
-	if (pool->connections[fd]) {
-		miniweb_connection_t *conn = pool->connections[fd];
-		int pool_idx = (int)(conn - pool->pool);
-		if (pool_idx >= 0 && pool_idx < MINIWEB_MAX_CONNECTIONS) {
-			memset(conn, 0, sizeof(*conn));
-			if (pool->free_top < MINIWEB_MAX_CONNECTIONS)
-				pool->free_stack[pool->free_top++] = pool_idx;
-		}
-		pool->connections[fd] = NULL;
-		pool->conn_gen[fd]++;
-		if (pool->active_connections > 0)
-			pool->active_connections--;
+	/* Only the caller that swaps the pointer out owns the release. */
+	miniweb_connection_t *conn = __atomic_exchange_n(&pool->connections[fd],
+		NULL, __ATOMIC_ACQ_REL);
+	if (!conn)
+		return;
+	__atomic_add_fetch(&pool->conn_gen[fd], 1, __ATOMIC_RELEASE);
+	int pool_idx = (int)(conn - pool->pool);
+	if (pool_idx >= 0 && pool_idx < MINIWEB_MAX_CONNECTIONS) {
+		http_output_reset(&conn->out);
+		miniweb_reqbuf_put(conn->buffer, conn->buffer_cap);
+		memset(conn, 0, sizeof(*conn));
+		free_stack_push(pool, pool_idx);
 	}
-	pthread_mutex_unlock(&pool->lock);
+	__atomic_sub_fetch(&pool->active_connections, 1, __ATOMIC_RELAXED);
+	counter_inc(CTR_CONN_CLOSED);
 }
 
 /** Validate kevent udata against fd slot and generation counter. */
@@ -70,10 +129,62 @@ int
 miniweb_connection_is_stale(miniweb_connection_pool_t *pool, int fd,
 							miniweb_connection_t *conn)
 {
-	int stale;
-	pthread_mutex_lock(&pool->lock);
-	stale = (!conn || pool->connections[fd] != conn ||
-	conn->gen != pool->conn_gen[fd]);
-	pthread_mutex_unlock(&pool->lock);
-	return stale;
+	return (!conn ||
+		__atomic_load_n(&pool->conn_gen[fd], __ATOMIC_ACQUIRE) != conn->gen ||
+		__atomic_load_n(&pool->connections[fd], __ATOMIC_RELAXED) != conn);
+}
+
+/** Pack the (fd, generation) token used as kevent udata / queue item. */
+void *
+miniweb_connection_token(const miniweb_connection_t *conn)
+{
+	return MINIWEB_CONN_TOKEN_PACK(conn->fd, conn->gen);
+}
+
+/**
+ * Resolve a token to its live connection. The fd generation is read
+ * before and after the slot pointer: a free in between bumps it, so a
+ * stale token never returns the connection that took the fd over. No
+ * lock is taken.
+ */
+miniweb_connection_t *
+miniweb_connection_from_token(miniweb_connection_pool_t *pool, void *token)
+{
+	if (!token)
+		return NULL;
+	int fd = MINIWEB_CONN_TOKEN_FD(token);
+	unsigned int gen = __atomic_load_n(&pool->conn_gen[fd], __ATOMIC_ACQUIRE);
+	if (MINIWEB_CONN_TOKEN_PACK(fd, gen) != token)
+		return NULL;
+	miniweb_connection_t *conn = __atomic_load_n(&pool->connections[fd],
+		__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&pool->conn_gen[fd], __ATOMIC_ACQUIRE) != gen)
+		return NULL;
+	return conn;
+}
+
+/**
+ * Take @p conn for serving or closing. The dispatcher claims it before
+ * queueing it, a worker-owned kqueue thread as it takes the event, and
+ * the idle timer before it closes one: whichever loses leaves it alone.
+ */
+int
+miniweb_connection_claim(miniweb_connection_t *conn)
+{
+	int idle = 0;
+
+	return __atomic_compare_exchange_n(&conn->busy, &idle, 1, 0,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Give @p conn back before re-arming it. The time it spent being served
+ * does not count as idle, so last_activity restarts here; that also keeps
+ * the timer off it until the re-arm has reached the kqueue.
+ */
+void
+miniweb_connection_release(miniweb_connection_t *conn)
+{
+	conn->last_activity = time(NULL);
+	__atomic_store_n(&conn->busy, 0, __ATOMIC_RELEASE);
 }
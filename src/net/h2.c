@@ -0,0 +1,1358 @@
+/* h2.c - HTTP/2 over cleartext TCP with prior knowledge (RFC 9113) */
+
+#include <miniweb/net/h2.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/http/hpack.h>
+#include <miniweb/net/server.h>
+
+/*
+ * One thread per session polls the client socket and the session end of
+ * every open stream. Frames are parsed out of a buffer that holds two of
+ * the largest we accept; everything sent is appended to one output
+ * buffer, drained as the socket takes it. While that backs up, stream
+ * responses are not read, so a client that stops reading stalls its own
+ * handlers (blocked on their socketpair) and, past idle_sec, is dropped.
+ *
+ * Request bodies are acknowledged and thrown away: no handler reads one.
+ * Responses are HTTP/1.1 as the handlers write them; the head becomes a
+ * HEADERS frame and the body, unchunked, DATA frames within the flow
+ * control windows.
+ */
+
+#define H2_FRAME_HDR		9
+#define H2_FRAME_MAX		16384	/* SETTINGS_MAX_FRAME_SIZE default */
+#define H2_FRAME_LIMIT		16777215
+#define H2_IN_BUF		(2 * (H2_FRAME_HDR + H2_FRAME_MAX))
+#define H2_BLOCK_MAX		16384	/* request header block, all frames */
+#define H2_RESP_BUF		16384	/* response bytes held per stream */
+#define H2_OUT_HIGH		65536	/* output at which streams stop */
+#define H2_WINDOW_DEFAULT	65535
+#define H2_WINDOW_MAX		0x7fffffffL
+#define H2_METHOD_MAX		32
+#define H2_PATH_MAX		1024
+#define H2_POLL_MS		1000
+
+enum h2_frame_type {
+	H2_DATA = 0,
+	H2_HEADERS,
+	H2_PRIORITY,
+	H2_RST_STREAM,
+	H2_SETTINGS,
+	H2_PUSH_PROMISE,
+	H2_PING,
+	H2_GOAWAY,
+	H2_WINDOW_UPDATE,
+	H2_CONTINUATION
+};
+
+#define H2_F_END_STREAM		0x01
+#define H2_F_ACK		0x01
+#define H2_F_END_HEADERS	0x04
+#define H2_F_PADDED		0x08
+#define H2_F_PRIORITY		0x20
+
+enum h2_error {
+	H2_NO_ERROR = 0,
+	H2_PROTOCOL_ERROR,
+	H2_INTERNAL_ERROR,
+	H2_FLOW_CONTROL_ERROR,
+	H2_SETTINGS_TIMEOUT,
+	H2_STREAM_CLOSED,
+	H2_FRAME_SIZE_ERROR,
+	H2_REFUSED_STREAM,
+	H2_CANCEL,
+	H2_COMPRESSION_ERROR,
+	H2_CONNECT_ERROR,
+	H2_ENHANCE_YOUR_CALM
+};
+
+enum h2_setting {
+	H2_SET_HEADER_TABLE_SIZE = 1,
+	H2_SET_ENABLE_PUSH,
+	H2_SET_MAX_CONCURRENT_STREAMS,
+	H2_SET_INITIAL_WINDOW_SIZE,
+	H2_SET_MAX_FRAME_SIZE,
+	H2_SET_MAX_HEADER_LIST_SIZE
+};
+
+/* How the rest of a stream's response is delimited. */
+enum h2_body {
+	H2_BODY_HEAD = 0,	/* the HTTP/1.1 head is still being read */
+	H2_BODY_LENGTH,		/* Content-Length bytes */
+	H2_BODY_CHUNKED,
+	H2_BODY_CLOSE		/* until the handler closes its end */
+};
+
+enum h2_chunk {
+	H2_CHUNK_SIZE = 0,
+	H2_CHUNK_DATA,
+	H2_CHUNK_CRLF,
+	H2_CHUNK_TRAILER
+};
+
+typedef struct h2_stream {
+	uint32_t id;		/* 0: slot free */
+	int fd;			/* session end of the socketpair */
+	int head_only;		/* HEAD: no body goes out */
+	int remote_closed;	/* the client sent END_STREAM */
+	int eof;		/* the handler closed its end */
+	int body;		/* H2_BODY_* */
+	int chunk;		/* H2_CHUNK_* of a chunked body */
+	uint64_t left;		/* of the body, or of the chunk */
+	long window;		/* bytes the client lets us send */
+	char *buf;		/* response bytes not yet framed */
+	size_t start, len;
+} h2_stream_t;
+
+typedef struct h2_session {
+	int fd;
+	struct sockaddr_in addr;
+	uint8_t in[H2_IN_BUF];
+	size_t in_len;
+	uint8_t *out;
+	size_t out_off, out_len, out_cap;
+	hpack_decoder_t dec;
+	h2_stream_t streams[H2_MAX_STREAMS];
+	int nstreams;
+	uint32_t last_id;	/* highest stream the client opened */
+	long window;		/* connection send window */
+	long init_window;	/* client's SETTINGS_INITIAL_WINDOW_SIZE */
+	uint32_t frame_max;	/* client's SETTINGS_MAX_FRAME_SIZE */
+	int got_settings;
+	int goaway;		/* sent or received: no new streams */
+	uint32_t error;		/* connection error to report */
+	uint32_t block_id;	/* stream of the header block being read */
+	int block_end_stream;
+	int block_open;		/* CONTINUATION expected */
+	uint8_t block[H2_BLOCK_MAX];
+	size_t block_len;
+	time_t last_io;
+} h2_session_t;
+
+/* A request head waiting for a stream thread. */
+struct h2_job {
+	int fd;
+	struct sockaddr_in addr;
+	char *head;
+	size_t len;
+	struct h2_job *next;
+};
+
+static pthread_mutex_t h2_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t h2_cond = PTHREAD_COND_INITIALIZER;
+static struct h2_job *h2_jobs;
+static struct h2_job **h2_jobs_tail = &h2_jobs;
+static int h2_threads = 8;
+static int h2_started;		/* stream threads running */
+static int h2_idle_sec = 30;
+static h2_dispatch_t h2_dispatch;
+static int h2_sessions;
+
+void
+h2_configure(int threads, int idle_sec, h2_dispatch_t dispatch)
+{
+	pthread_mutex_lock(&h2_lock);
+	if (!h2_started && threads > 0)
+		h2_threads = threads;
+	__atomic_store_n(&h2_idle_sec, idle_sec > 0 ? idle_sec : 30,
+	    __ATOMIC_RELAXED);
+	h2_dispatch = dispatch;
+	pthread_mutex_unlock(&h2_lock);
+}
+
+int
+h2_preface_match(const char *buf, size_t len)
+{
+	size_t n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+
+	if (n > 0 && memcmp(buf, H2_PREFACE, n) != 0)
+		return -1;
+	return len >= H2_PREFACE_LEN ? 1 : 0;
+}
+
+int
+h2_session_count(void)
+{
+	return __atomic_load_n(&h2_sessions, __ATOMIC_RELAXED);
+}
+
+/** Stream thread: answer queued request heads, one at a time. */
+static void *
+h2_stream_thread(void *arg)
+{
+	struct h2_job *job;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&h2_lock);
+		while (h2_jobs == NULL)
+			pthread_cond_wait(&h2_cond, &h2_lock);
+		job = h2_jobs;
+		if ((h2_jobs = job->next) == NULL)
+			h2_jobs_tail = &h2_jobs;
+		pthread_mutex_unlock(&h2_lock);
+
+		h2_dispatch(job->fd, &job->addr, job->head, job->len);
+		close(job->fd);
+		free(job->head);
+		free(job);
+	}
+	return NULL;
+}
+
+/** Start the stream threads with the first session. */
+static int
+h2_pool_start(void)
+{
+	pthread_t tid;
+	int ok;
+
+	pthread_mutex_lock(&h2_lock);
+	for (; h2_started < h2_threads && h2_dispatch != NULL; h2_started++) {
+		if (pthread_create(&tid, NULL, h2_stream_thread, NULL) != 0)
+			break;
+		(void)pthread_detach(tid);
+	}
+	ok = h2_started > 0;
+	pthread_mutex_unlock(&h2_lock);
+	return ok ? 0 : -1;
+}
+
+static int
+h2_job_push(int fd, const struct sockaddr_in *addr, char *head, size_t len)
+{
+	struct h2_job *job;
+
+	if ((job = malloc(sizeof(*job))) == NULL)
+		return -1;
+	job->fd = fd;
+	job->addr = *addr;
+	job->head = head;
+	job->len = len;
+	job->next = NULL;
+	pthread_mutex_lock(&h2_lock);
+	*h2_jobs_tail = job;
+	h2_jobs_tail = &job->next;
+	pthread_cond_signal(&h2_cond);
+	pthread_mutex_unlock(&h2_lock);
+	return 0;
+}
+
+static uint32_t
+h2_get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+static void
+h2_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+/** Record connection error @p err; the session ends with a GOAWAY. */
+static int
+h2_fail(h2_session_t *s, uint32_t err)
+{
+	s->error = err;
+	return -1;
+}
+
+/** Room for @p n more output bytes; returns where they go, or NULL. */
+static uint8_t *
+h2_out_reserve(h2_session_t *s, size_t n)
+{
+	if (s->out_off > 0 && s->out_off == s->out_len)
+		s->out_off = s->out_len = 0;
+	if (s->out_len + n > s->out_cap) {
+		size_t cap = s->out_cap ? s->out_cap : 16384;
+		uint8_t *p;
+
+		while (cap < s->out_len + n)
+			cap *= 2;
+		if ((p = realloc(s->out, cap)) == NULL)
+			return NULL;
+		s->out = p;
+		s->out_cap = cap;
+	}
+	return s->out + s->out_len;
+}
+
+static int
+h2_frame_out(h2_session_t *s, int type, int flags, uint32_t id,
+    const void *payload, size_t len)
+{
+	uint8_t *p;
+
+	if ((p = h2_out_reserve(s, H2_FRAME_HDR + len)) == NULL)
+		return h2_fail(s, H2_INTERNAL_ERROR);
+	p[0] = (uint8_t)(len >> 16);
+	p[1] = (uint8_t)(len >> 8);
+	p[2] = (uint8_t)len;
+	p[3] = (uint8_t)type;
+	p[4] = (uint8_t)flags;
+	h2_put32(p + 5, id & 0x7fffffff);
+	if (len > 0)
+		memcpy(p + H2_FRAME_HDR, payload, len);
+	s->out_len += H2_FRAME_HDR + len;
+	return 0;
+}
+
+static int
+h2_rst(h2_session_t *s, uint32_t id, uint32_t err)
+{
+	uint8_t p[4];
+
+	h2_put32(p, err);
+	return h2_frame_out(s, H2_RST_STREAM, 0, id, p, sizeof(p));
+}
+
+static int
+h2_goaway(h2_session_t *s, uint32_t err)
+{
+	uint8_t p[8];
+
+	h2_put32(p, s->last_id);
+	h2_put32(p + 4, err);
+	s->goaway = 1;
+	return h2_frame_out(s, H2_GOAWAY, 0, 0, p, sizeof(p));
+}
+
+static int
+h2_window_update(h2_session_t *s, uint32_t id, uint32_t inc)
+{
+	uint8_t p[4];
+
+	h2_put32(p, inc);
+	return h2_frame_out(s, H2_WINDOW_UPDATE, 0, id, p, sizeof(p));
+}
+
+/** Send header block @p b as HEADERS and as many CONTINUATIONs as needed. */
+static int
+h2_headers_out(h2_session_t *s, uint32_t id, const uint8_t *b, size_t len,
+    int end_stream)
+{
+	int type = H2_HEADERS, flags = end_stream ? H2_F_END_STREAM : 0;
+
+	do {
+		size_t n = len < s->frame_max ? len : s->frame_max;
+
+		if (h2_frame_out(s, type, flags |
+		    (n == len ? H2_F_END_HEADERS : 0), id, b, n) == -1)
+			return -1;
+		b += n;
+		len -= n;
+		type = H2_CONTINUATION;
+		flags = 0;
+	} while (len > 0);
+	return 0;
+}
+
+/** Write what the client socket takes; -1 when it is gone. */
+static int
+h2_flush(h2_session_t *s)
+{
+	while (s->out_off < s->out_len) {
+		ssize_t n = send(s->fd, s->out + s->out_off,
+		    s->out_len - s->out_off, 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		s->out_off += (size_t)n;
+		s->last_io = time(NULL);
+	}
+	s->out_off = s->out_len = 0;
+	return 0;
+}
+
+static size_t
+h2_out_pending(const h2_session_t *s)
+{
+	return s->out_len - s->out_off;
+}
+
+static h2_stream_t *
+h2_stream_find(h2_session_t *s, uint32_t id)
+{
+	for (int i = 0; i < H2_MAX_STREAMS; i++)
+		if (s->streams[i].id == id)
+			return &s->streams[i];
+	return NULL;
+}
+
+static void
+h2_stream_close(h2_session_t *s, h2_stream_t *st)
+{
+	if (st->fd >= 0)
+		close(st->fd);
+	free(st->buf);
+	memset(st, 0, sizeof(*st));
+	st->fd = -1;
+	s->nstreams--;
+}
+
+/**
+ * Our END_STREAM is out. A client still sending a body is told to stop
+ * (8.1); its DATA on the stream is ignored from now on.
+ */
+static int
+h2_stream_finish(h2_session_t *s, h2_stream_t *st)
+{
+	uint32_t id = st->id;
+	int remote_closed = st->remote_closed;
+
+	h2_stream_close(s, st);
+	return remote_closed ? 0 : h2_rst(s, id, H2_NO_ERROR);
+}
+
+/* Request head being put together from one header block. */
+struct h2_req {
+	char method[H2_METHOD_MAX];
+	char path[H2_PATH_MAX];
+	char authority[256];
+	char lines[H2_HEAD_MAX];
+	size_t lines_len;
+	char cookie[H2_HEAD_MAX];
+	size_t cookie_len;
+	int scheme;
+	int regular;		/* a regular field was seen */
+	int malformed;
+	int too_large;
+};
+
+/** Copy a pseudo-header value once; a second one is malformed. */
+static void
+h2_req_pseudo(struct h2_req *r, char *dst, size_t cap, const char *v,
+    size_t len)
+{
+	if (dst[0] != '\0' || len == 0)
+		r->malformed = 1;
+	else if (len >= cap)
+		r->too_large = 1;
+	else {
+		memcpy(dst, v, len);
+		dst[len] = '\0';
+	}
+}
+
+static int
+h2_span_eq(const char *s, size_t len, const char *lit)
+{
+	return strlen(lit) == len && memcmp(s, lit, len) == 0;
+}
+
+/* Fields that only mean something on one HTTP/1.1 hop (8.2.2). */
+static int
+h2_hop_field(const char *name, size_t len)
+{
+	return h2_span_eq(name, len, "connection") ||
+	    h2_span_eq(name, len, "keep-alive") ||
+	    h2_span_eq(name, len, "proxy-connection") ||
+	    h2_span_eq(name, len, "transfer-encoding") ||
+	    h2_span_eq(name, len, "upgrade");
+}
+
+static void
+h2_append(char *dst, size_t *len, size_t cap, int *too_large,
+    const char *s, size_t n)
+{
+	if (*len + n >= cap) {
+		*too_large = 1;
+		return;
+	}
+	memcpy(dst + *len, s, n);
+	*len += n;
+}
+
+/** hpack_emit_t: validate one field and add it to the request head. */
+static int
+h2_req_field(const char *name, size_t name_len, const char *value,
+    size_t value_len, void *ctx)
+{
+	struct h2_req *r = ctx;
+
+	if (name_len == 0 || memchr(value, '\0', value_len) != NULL ||
+	    memchr(value, '\r', value_len) != NULL ||
+	    memchr(value, '\n', value_len) != NULL) {
+		r->malformed = 1;
+		return 0;
+	}
+	if (name[0] == ':') {
+		if (r->regular)
+			r->malformed = 1;
+		else if (h2_span_eq(name, name_len, ":method"))
+			h2_req_pseudo(r, r->method, sizeof(r->method), value,
+			    value_len);
+		else if (h2_span_eq(name, name_len, ":path"))
+			h2_req_pseudo(r, r->path, sizeof(r->path), value,
+			    value_len);
+		else if (h2_span_eq(name, name_len, ":authority"))
+			h2_req_pseudo(r, r->authority, sizeof(r->authority),
+			    value, value_len);
+		else if (h2_span_eq(name, name_len, ":scheme"))
+			r->malformed |= r->scheme++ > 0;
+		else
+			r->malformed = 1;
+		return 0;
+	}
+	r->regular = 1;
+	for (size_t i = 0; i < name_len; i++) {
+		unsigned char c = (unsigned char)name[i];
+
+		if (c <= ' ' || c == ':' || (c >= 'A' && c <= 'Z') ||
+		    c >= 0x7f) {
+			r->malformed = 1;
+			return 0;
+		}
+	}
+	if (h2_hop_field(name, name_len) || (h2_span_eq(name, name_len, "te") &&
+	    !h2_span_eq(value, value_len, "trailers"))) {
+		r->malformed = 1;
+		return 0;
+	}
+	/* Bodies are not passed on; :authority stands in for Host. */
+	if (h2_span_eq(name, name_len, "content-length") ||
+	    (r->authority[0] != '\0' && h2_span_eq(name, name_len, "host")))
+		return 0;
+	if (h2_span_eq(name, name_len, "cookie")) {
+		if (r->cookie_len > 0)
+			h2_append(r->cookie, &r->cookie_len, sizeof(r->cookie),
+			    &r->too_large, "; ", 2);
+		h2_append(r->cookie, &r->cookie_len, sizeof(r->cookie),
+		    &r->too_large, value, value_len);
+		return 0;
+	}
+	h2_append(r->lines, &r->lines_len, sizeof(r->lines), &r->too_large,
+	    name, name_len);
+	h2_append(r->lines, &r->lines_len, sizeof(r->lines), &r->too_large,
+	    ": ", 2);
+	h2_append(r->lines, &r->lines_len, sizeof(r->lines), &r->too_large,
+	    value, value_len);
+	h2_append(r->lines, &r->lines_len, sizeof(r->lines), &r->too_large,
+	    "\r\n", 2);
+	return 0;
+}
+
+/** hpack_emit_t for blocks whose fields are not wanted. */
+static int
+h2_ignore_field(const char *name, size_t name_len, const char *value,
+    size_t value_len, void *ctx)
+{
+	(void)name;
+	(void)name_len;
+	(void)value;
+	(void)value_len;
+	(void)ctx;
+	return 0;
+}
+
+/** Answer a stream with a bodiless @p status, without a handler. */
+static int
+h2_status_only(h2_session_t *s, uint32_t id, const char *status)
+{
+	uint8_t b[32];
+	size_t n;
+
+	n = hpack_encode(b, sizeof(b), ":status", 7, status, strlen(status));
+	n += hpack_encode(b + n, sizeof(b) - n, "content-length", 14, "0", 1);
+	return h2_headers_out(s, id, b, n, 1);
+}
+
+/** Open a stream for @p r and queue its head for a stream thread. */
+static int
+h2_stream_open(h2_session_t *s, uint32_t id, struct h2_req *r, int end)
+{
+	h2_stream_t *st = h2_stream_find(s, 0);
+	char *head;
+	int pair[2];
+	int n;
+
+	if ((head = malloc(H2_HEAD_MAX)) == NULL)
+		return h2_rst(s, id, H2_INTERNAL_ERROR);
+	n = snprintf(head, H2_HEAD_MAX, "%s %s HTTP/1.1\r\n", r->method,
+	    r->path);
+	if (n > 0 && n < H2_HEAD_MAX && r->authority[0] != '\0')
+		n += snprintf(head + n, H2_HEAD_MAX - (size_t)n,
+		    "Host: %s\r\n", r->authority);
+	if (n > 0 && n < H2_HEAD_MAX && r->cookie_len > 0)
+		n += snprintf(head + n, H2_HEAD_MAX - (size_t)n,
+		    "Cookie: %.*s\r\n", (int)r->cookie_len, r->cookie);
+	if (n < 0 || (size_t)n + r->lines_len + 3 > H2_HEAD_MAX) {
+		free(head);
+		return h2_status_only(s, id, "431");
+	}
+	memcpy(head + n, r->lines, r->lines_len);
+	n += (int)r->lines_len;
+	memcpy(head + n, "\r\n", 3);
+	n += 2;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+		free(head);
+		return h2_rst(s, id, H2_REFUSED_STREAM);
+	}
+	(void)fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+	if ((st->buf = malloc(H2_RESP_BUF)) == NULL ||
+	    h2_job_push(pair[1], &s->addr, head, (size_t)n) == -1) {
+		free(st->buf);
+		st->buf = NULL;
+		free(head);
+		close(pair[0]);
+		close(pair[1]);
+		return h2_rst(s, id, H2_REFUSED_STREAM);
+	}
+	st->id = id;
+	st->fd = pair[0];
+	st->head_only = strcmp(r->method, "HEAD") == 0;
+	st->remote_closed = end;
+	st->body = H2_BODY_HEAD;
+	st->window = s->init_window;
+	s->nstreams++;
+	counter_inc(CTR_H2_STREAMS);
+	return 0;
+}
+
+/** A complete header block arrived on s->block_id. */
+static int
+h2_request(h2_session_t *s)
+{
+	uint32_t id = s->block_id;
+	h2_stream_t *st;
+	struct h2_req *r;
+	int rc;
+
+	s->block_open = 0;
+	if (id <= s->last_id || s->goaway || s->nstreams == H2_MAX_STREAMS) {
+		/* Trailers, or a stream we will not serve: keep HPACK going. */
+		if (hpack_decode(&s->dec, s->block, s->block_len,
+		    h2_ignore_field, NULL) != 0)
+			return h2_fail(s, H2_COMPRESSION_ERROR);
+		if (id <= s->last_id) {
+			if ((st = h2_stream_find(s, id)) != NULL &&
+			    !st->remote_closed && s->block_end_stream) {
+				st->remote_closed = 1;
+				return 0;
+			}
+			return h2_rst(s, id, H2_STREAM_CLOSED);
+		}
+		s->last_id = id;
+		if (s->goaway)
+			return 0;
+		counter_inc(CTR_H2_REFUSED);
+		return h2_rst(s, id, H2_REFUSED_STREAM);
+	}
+	s->last_id = id;
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return h2_fail(s, H2_INTERNAL_ERROR);
+	if (hpack_decode(&s->dec, s->block, s->block_len, h2_req_field,
+	    r) != 0) {
+		free(r);
+		return h2_fail(s, H2_COMPRESSION_ERROR);
+	}
+	if (r->malformed || r->method[0] == '\0' || r->path[0] == '\0' ||
+	    r->scheme != 1)
+		rc = h2_rst(s, id, H2_PROTOCOL_ERROR);
+	else if (r->too_large)
+		rc = h2_status_only(s, id, "431");
+	else
+		rc = h2_stream_open(s, id, r, s->block_end_stream);
+	free(r);
+	return rc;
+}
+
+static int
+h2_block_append(h2_session_t *s, const uint8_t *p, size_t len)
+{
+	if (len > H2_BLOCK_MAX - s->block_len)
+		return h2_fail(s, H2_ENHANCE_YOUR_CALM);
+	memcpy(s->block + s->block_len, p, len);
+	s->block_len += len;
+	return 0;
+}
+
+/** Strip the padding of a DATA or HEADERS payload. */
+static int
+h2_unpad(h2_session_t *s, int flags, const uint8_t **p, size_t *len)
+{
+	size_t pad;
+
+	if (!(flags & H2_F_PADDED))
+		return 0;
+	if (*len < 1)
+		return h2_fail(s, H2_FRAME_SIZE_ERROR);
+	pad = (*p)[0];
+	(*p)++;
+	(*len)--;
+	if (pad > *len)
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	*len -= pad;
+	return 0;
+}
+
+static int
+h2_on_headers(h2_session_t *s, int flags, uint32_t id, const uint8_t *p,
+    size_t len)
+{
+	if (id == 0 || (id & 1) == 0)
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	if (h2_unpad(s, flags, &p, &len) == -1)
+		return -1;
+	if (flags & H2_F_PRIORITY) {
+		if (len < 5)
+			return h2_fail(s, H2_FRAME_SIZE_ERROR);
+		if ((h2_get32(p) & 0x7fffffff) == id)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		p += 5;
+		len -= 5;
+	}
+	s->block_id = id;
+	s->block_end_stream = flags & H2_F_END_STREAM;
+	s->block_len = 0;
+	s->block_open = 1;
+	if (h2_block_append(s, p, len) == -1)
+		return -1;
+	return flags & H2_F_END_HEADERS ? h2_request(s) : 0;
+}
+
+static int
+h2_on_data(h2_session_t *s, int flags, uint32_t id, const uint8_t *p,
+    size_t len)
+{
+	size_t frame_len = len;
+	h2_stream_t *st;
+
+	if (id == 0 || id > s->last_id)
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	if (h2_unpad(s, flags, &p, &len) == -1)
+		return -1;
+	/* The body is discarded, so its credit comes straight back. */
+	if (frame_len > 0 && h2_window_update(s, 0, (uint32_t)frame_len) == -1)
+		return -1;
+	if ((st = h2_stream_find(s, id)) == NULL)
+		return 0;	/* answered already, or reset */
+	if (st->remote_closed) {
+		h2_stream_close(s, st);
+		return h2_rst(s, id, H2_STREAM_CLOSED);
+	}
+	if (flags & H2_F_END_STREAM)
+		st->remote_closed = 1;
+	else if (frame_len > 0)
+		return h2_window_update(s, id, (uint32_t)frame_len);
+	return 0;
+}
+
+static int
+h2_on_settings(h2_session_t *s, int flags, uint32_t id, const uint8_t *p,
+    size_t len)
+{
+	if (id != 0)
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	if (flags & H2_F_ACK)
+		return len == 0 ? 0 : h2_fail(s, H2_FRAME_SIZE_ERROR);
+	if (len % 6 != 0)
+		return h2_fail(s, H2_FRAME_SIZE_ERROR);
+	for (; len > 0; p += 6, len -= 6) {
+		unsigned int key = (unsigned int)p[0] << 8 | p[1];
+		uint32_t v = h2_get32(p + 2);
+
+		switch (key) {
+		case H2_SET_ENABLE_PUSH:
+			if (v > 1)
+				return h2_fail(s, H2_PROTOCOL_ERROR);
+			break;
+		case H2_SET_INITIAL_WINDOW_SIZE:
+			if (v > H2_WINDOW_MAX)
+				return h2_fail(s, H2_FLOW_CONTROL_ERROR);
+			for (int i = 0; i < H2_MAX_STREAMS; i++) {
+				h2_stream_t *st = &s->streams[i];
+
+				if (st->id == 0)
+					continue;
+				st->window += (long)v - s->init_window;
+				if (st->window > H2_WINDOW_MAX)
+					return h2_fail(s,
+					    H2_FLOW_CONTROL_ERROR);
+			}
+			s->init_window = (long)v;
+			break;
+		case H2_SET_MAX_FRAME_SIZE:
+			if (v < H2_FRAME_MAX || v > H2_FRAME_LIMIT)
+				return h2_fail(s, H2_PROTOCOL_ERROR);
+			s->frame_max = v;
+			break;
+		default:
+			/* Our encoder keeps no table; the rest is advice. */
+			break;
+		}
+	}
+	s->got_settings = 1;
+	return h2_frame_out(s, H2_SETTINGS, H2_F_ACK, 0, NULL, 0);
+}
+
+static int
+h2_on_window_update(h2_session_t *s, uint32_t id, const uint8_t *p,
+    size_t len)
+{
+	uint32_t inc;
+	h2_stream_t *st;
+
+	if (len != 4)
+		return h2_fail(s, H2_FRAME_SIZE_ERROR);
+	inc = h2_get32(p) & 0x7fffffff;
+	if (id == 0) {
+		if (inc == 0)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		s->window += (long)inc;
+		return s->window > H2_WINDOW_MAX ?
+		    h2_fail(s, H2_FLOW_CONTROL_ERROR) : 0;
+	}
+	if ((st = h2_stream_find(s, id)) == NULL)
+		return id > s->last_id ? h2_fail(s, H2_PROTOCOL_ERROR) : 0;
+	if (inc == 0 || (st->window += (long)inc) > H2_WINDOW_MAX) {
+		h2_stream_close(s, st);
+		return h2_rst(s, id, inc == 0 ? H2_PROTOCOL_ERROR :
+		    H2_FLOW_CONTROL_ERROR);
+	}
+	return 0;
+}
+
+/** Act on one frame; -1 is a connection error in s->error. */
+static int
+h2_frame(h2_session_t *s, int type, int flags, uint32_t id,
+    const uint8_t *p, size_t len)
+{
+	h2_stream_t *st;
+
+	if (s->block_open && (type != H2_CONTINUATION || id != s->block_id))
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	if (!s->got_settings && (type != H2_SETTINGS || (flags & H2_F_ACK)))
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	switch (type) {
+	case H2_DATA:
+		return h2_on_data(s, flags, id, p, len);
+	case H2_HEADERS:
+		return h2_on_headers(s, flags, id, p, len);
+	case H2_CONTINUATION:
+		if (!s->block_open)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		if (h2_block_append(s, p, len) == -1)
+			return -1;
+		return flags & H2_F_END_HEADERS ? h2_request(s) : 0;
+	case H2_PRIORITY:
+		if (id == 0)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		return len == 5 ? 0 : h2_rst(s, id, H2_FRAME_SIZE_ERROR);
+	case H2_RST_STREAM:
+		if (id == 0 || id > s->last_id)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		if (len != 4)
+			return h2_fail(s, H2_FRAME_SIZE_ERROR);
+		if ((st = h2_stream_find(s, id)) != NULL)
+			h2_stream_close(s, st);
+		return 0;
+	case H2_SETTINGS:
+		return h2_on_settings(s, flags, id, p, len);
+	case H2_PUSH_PROMISE:
+		return h2_fail(s, H2_PROTOCOL_ERROR);
+	case H2_PING:
+		if (id != 0)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		if (len != 8)
+			return h2_fail(s, H2_FRAME_SIZE_ERROR);
+		if (flags & H2_F_ACK)
+			return 0;
+		return h2_frame_out(s, H2_PING, H2_F_ACK, 0, p, len);
+	case H2_GOAWAY:
+		if (id != 0)
+			return h2_fail(s, H2_PROTOCOL_ERROR);
+		if (len < 8)
+			return h2_fail(s, H2_FRAME_SIZE_ERROR);
+		s->goaway = 1;
+		return 0;
+	case H2_WINDOW_UPDATE:
+		return h2_on_window_update(s, id, p, len);
+	default:
+		return 0;	/* unknown types are ignored (5.5) */
+	}
+}
+
+/** Parse and act on every complete frame in s->in. */
+static int
+h2_input(h2_session_t *s)
+{
+	size_t off = 0;
+
+	while (s->in_len - off >= H2_FRAME_HDR) {
+		const uint8_t *h = s->in + off;
+		size_t len = (size_t)h[0] << 16 | (size_t)h[1] << 8 | h[2];
+
+		if (len > H2_FRAME_MAX)
+			return h2_fail(s, H2_FRAME_SIZE_ERROR);
+		if (s->in_len - off < H2_FRAME_HDR + len)
+			break;
+		if (h2_frame(s, h[3], h[4], h2_get32(h + 5) & 0x7fffffff,
+		    h + H2_FRAME_HDR, len) == -1)
+			return -1;
+		off += H2_FRAME_HDR + len;
+	}
+	if (off > 0) {
+		memmove(s->in, s->in + off, s->in_len - off);
+		s->in_len -= off;
+	}
+	return 0;
+}
+
+static int
+h2_lower_eq(const char *s, size_t len, const char *lit)
+{
+	return strlen(lit) == len && strncasecmp(s, lit, len) == 0;
+}
+
+/**
+ * Turn the HTTP/1.1 head at the front of st->buf (@p head_len bytes,
+ * blank line included) into a HEADERS frame and pick the body mode.
+ */
+static int
+h2_response_head(h2_session_t *s, h2_stream_t *st, size_t head_len)
+{
+	char *line = st->buf + st->start, *end = line + head_len - 2;
+	char status[4], name[64];
+	uint8_t *b;
+	size_t n = 0, cap = head_len * 5 + 32;
+	int chunked = 0, have_length = 0, no_body;
+
+	if (head_len < 16 || strncmp(line, "HTTP/1.", 7) != 0 ||
+	    (line[12] != ' ' && line[12] != '\r'))
+		return h2_rst(s, st->id, H2_INTERNAL_ERROR);
+	memcpy(status, line + 9, 3);
+	status[3] = '\0';
+	if ((b = malloc(cap)) == NULL)
+		return h2_fail(s, H2_INTERNAL_ERROR);
+	n = hpack_encode(b, cap, ":status", 7, status, 3);
+	line = (char *)memchr(line, '\n', head_len) + 1;
+	while (line < end) {
+		char *eol = memchr(line, '\r', (size_t)(end - line));
+		char *colon, *v;
+		size_t name_len, vlen;
+
+		if (eol == NULL)
+			eol = end;
+		colon = memchr(line, ':', (size_t)(eol - line));
+		if (colon == NULL || (name_len = (size_t)(colon - line)) == 0 ||
+		    name_len >= sizeof(name))
+			goto next;
+		for (size_t i = 0; i < name_len; i++)
+			name[i] = (char)(line[i] >= 'A' && line[i] <= 'Z' ?
+			    line[i] - 'A' + 'a' : line[i]);
+		for (v = colon + 1; v < eol && (*v == ' ' || *v == '\t'); v++)
+			;
+		vlen = (size_t)(eol - v);
+		while (vlen > 0 && (v[vlen - 1] == ' ' || v[vlen - 1] == '\t'))
+			vlen--;
+		if (h2_span_eq(name, name_len, "transfer-encoding")) {
+			chunked = vlen >= 7 && h2_lower_eq(v + vlen - 7, 7,
+			    "chunked");
+			goto next;
+		}
+		if (h2_hop_field(name, name_len))
+			goto next;
+		if (h2_span_eq(name, name_len, "content-length")) {
+			have_length = 1;
+			st->left = strtoull(v, NULL, 10);
+		}
+		n += hpack_encode(b + n, cap - n, name, name_len, v, vlen);
+next:
+		line = eol + 2;
+	}
+
+	no_body = st->head_only || strcmp(status, "204") == 0 ||
+	    strcmp(status, "304") == 0 || status[0] == '1' ||
+	    (have_length && !chunked && st->left == 0);
+	if (chunked) {
+		st->body = H2_BODY_CHUNKED;
+		st->chunk = H2_CHUNK_SIZE;
+	} else
+		st->body = have_length ? H2_BODY_LENGTH : H2_BODY_CLOSE;
+	st->start += head_len;
+	st->len -= head_len;
+	if (h2_headers_out(s, st->id, b, n, no_body) == -1) {
+		free(b);
+		return -1;
+	}
+	free(b);
+	return no_body ? h2_stream_finish(s, st) : 0;
+}
+
+/** Send up to @p want body bytes from st->buf; returns bytes sent. */
+static size_t
+h2_body_out(h2_session_t *s, h2_stream_t *st, size_t want, int last)
+{
+	size_t n = want;
+
+	if ((long)n > st->window)
+		n = (size_t)(st->window > 0 ? st->window : 0);
+	if ((long)n > s->window)
+		n = (size_t)(s->window > 0 ? s->window : 0);
+	if (n > s->frame_max)
+		n = s->frame_max;
+	if (n == 0)
+		return 0;
+	if (h2_frame_out(s, H2_DATA, last && n == want ? H2_F_END_STREAM : 0,
+	    st->id, st->buf + st->start, n) == -1)
+		return 0;
+	st->start += n;
+	st->len -= n;
+	st->window -= (long)n;
+	s->window -= (long)n;
+	return n;
+}
+
+/** Find "\r\n" in the @p len bytes at @p p; returns its offset or -1. */
+static long
+h2_crlf(const char *p, size_t len)
+{
+	for (size_t i = 0; i + 1 < len; i++)
+		if (p[i] == '\r' && p[i + 1] == '\n')
+			return (long)i;
+	return -1;
+}
+
+/**
+ * Frame what the stream's handler wrote so far, as far as the windows
+ * allow. Returns -1 on a connection error; the stream may be closed.
+ */
+static int
+h2_relay(h2_session_t *s, h2_stream_t *st)
+{
+	uint32_t id = st->id;
+	long crlf;
+	size_t n;
+
+	while (st->id == id) {
+		char *p = st->buf + st->start;
+
+		switch (st->body) {
+		case H2_BODY_HEAD: {
+			char *e = NULL;
+
+			for (size_t i = 0; i + 3 < st->len; i++)
+				if (memcmp(p + i, "\r\n\r\n", 4) == 0) {
+					e = p + i + 4;
+					break;
+				}
+			if (e == NULL)
+				goto more;
+			if (h2_response_head(s, st, (size_t)(e - p)) == -1)
+				return -1;
+			continue;
+		}
+		case H2_BODY_LENGTH:
+			n = st->len < st->left ? st->len : (size_t)st->left;
+			if (n == 0)
+				goto more;
+			n = h2_body_out(s, st, n, n == st->left);
+			if (n == 0)
+				return s->error ? -1 : 0;
+			if ((st->left -= n) == 0 &&
+			    h2_stream_finish(s, st) == -1)
+				return -1;
+			continue;
+		case H2_BODY_CLOSE:
+			if (st->len == 0)
+				goto more;
+			if (h2_body_out(s, st, st->len, 0) == 0)
+				return s->error ? -1 : 0;
+			continue;
+		}
+
+		/* Chunked: sizes and CRLFs are dropped, the data framed. */
+		switch (st->chunk) {
+		case H2_CHUNK_SIZE:
+			if ((crlf = h2_crlf(p, st->len)) < 0)
+				goto more;
+			st->left = strtoull(p, NULL, 16);
+			st->chunk = st->left > 0 ? H2_CHUNK_DATA :
+			    H2_CHUNK_TRAILER;
+			st->start += (size_t)crlf + 2;
+			st->len -= (size_t)crlf + 2;
+			break;
+		case H2_CHUNK_DATA:
+			n = st->len < st->left ? st->len : (size_t)st->left;
+			if (n == 0)
+				goto more;
+			if ((n = h2_body_out(s, st, n, 0)) == 0)
+				return s->error ? -1 : 0;
+			if ((st->left -= n) == 0)
+				st->chunk = H2_CHUNK_CRLF;
+			break;
+		case H2_CHUNK_CRLF:
+			if (st->len < 2)
+				goto more;
+			st->start += 2;
+			st->len -= 2;
+			st->chunk = H2_CHUNK_SIZE;
+			break;
+		case H2_CHUNK_TRAILER:
+			if ((crlf = h2_crlf(p, st->len)) < 0)
+				goto more;
+			st->start += (size_t)crlf + 2;
+			st->len -= (size_t)crlf + 2;
+			if (crlf == 0) {
+				if (h2_frame_out(s, H2_DATA, H2_F_END_STREAM,
+				    id, NULL, 0) == -1 ||
+				    h2_stream_finish(s, st) == -1)
+					return -1;
+			}
+			break;
+		}
+	}
+	return 0;
+more:
+	if (!st->eof)
+		return 0;
+	/* The handler is done: only a close-delimited body may end so. */
+	if (st->body == H2_BODY_CLOSE) {
+		if (h2_frame_out(s, H2_DATA, H2_F_END_STREAM, id, NULL, 0) == -1)
+			return -1;
+		return h2_stream_finish(s, st);
+	}
+	h2_stream_close(s, st);
+	return h2_rst(s, id, H2_INTERNAL_ERROR);
+}
+
+/** Read what the handler of @p st wrote; then frame it. */
+static int
+h2_stream_read(h2_session_t *s, h2_stream_t *st)
+{
+	uint32_t id = st->id;
+	ssize_t n;
+
+	if (st->start > 0) {
+		memmove(st->buf, st->buf + st->start, st->len);
+		st->start = 0;
+	}
+	n = read(st->fd, st->buf + st->len, H2_RESP_BUF - st->len);
+	if (n > 0)
+		st->len += (size_t)n;
+	else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+	    errno != EINTR)) {
+		st->eof = 1;
+		close(st->fd);
+		st->fd = -1;
+	}
+	if (h2_relay(s, st) == -1)
+		return -1;
+	if (st->id == id && st->body == H2_BODY_HEAD &&
+	    st->len == H2_RESP_BUF) {
+		/* A head this large is not one a handler writes. */
+		h2_stream_close(s, st);
+		return h2_rst(s, id, H2_INTERNAL_ERROR);
+	}
+	return 0;
+}
+
+static int
+h2_client_read(h2_session_t *s)
+{
+	ssize_t n;
+
+	n = recv(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len, 0);
+	if (n == 0)
+		return -1;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR ? 0 : -1;
+	s->in_len += (size_t)n;
+	s->last_io = time(NULL);
+	if (h2_input(s) == -1) {
+		(void)h2_goaway(s, s->error);
+		return -1;
+	}
+	return 0;
+}
+
+/** Server preface: SETTINGS, the only one we send. */
+static int
+h2_settings_out(h2_session_t *s)
+{
+	uint8_t p[12];
+
+	p[0] = 0;
+	p[1] = H2_SET_MAX_CONCURRENT_STREAMS;
+	h2_put32(p + 2, H2_MAX_STREAMS);
+	p[6] = 0;
+	p[7] = H2_SET_MAX_HEADER_LIST_SIZE;
+	h2_put32(p + 8, H2_HEAD_MAX);
+	return h2_frame_out(s, H2_SETTINGS, 0, 0, p, sizeof(p));
+}
+
+/** Give what is left of the output a moment to leave, then close. */
+static void
+h2_session_end(h2_session_t *s)
+{
+	struct pollfd pfd = { s->fd, POLLOUT, 0 };
+
+	for (int i = 0; i < 10 && h2_out_pending(s) > 0; i++) {
+		if (poll(&pfd, 1, 100) <= 0 || h2_flush(s) == -1)
+			break;
+	}
+	for (int i = 0; i < H2_MAX_STREAMS; i++)
+		if (s->streams[i].id != 0)
+			h2_stream_close(s, &s->streams[i]);
+	hpack_decoder_free(&s->dec);
+	close(s->fd);
+	free(s->out);
+	free(s);
+	__atomic_sub_fetch(&h2_sessions, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+h2_session_main(void *arg)
+{
+	h2_session_t *s = arg;
+	struct pollfd pfd[1 + H2_MAX_STREAMS];
+	h2_stream_t *polled[1 + H2_MAX_STREAMS];
+
+	if (h2_settings_out(s) == -1 || h2_input(s) == -1) {
+		(void)h2_goaway(s, s->error);
+		goto done;
+	}
+	for (;;) {
+		int idle = __atomic_load_n(&h2_idle_sec, __ATOMIC_RELAXED);
+		int nfds = 1;
+
+		if (!s->goaway && miniweb_server_draining())
+			(void)h2_goaway(s, H2_NO_ERROR);
+		if (h2_flush(s) == -1)
+			break;
+		if (s->goaway && s->nstreams == 0)
+			break;
+		if (time(NULL) - s->last_io > idle &&
+		    (s->nstreams == 0 || h2_out_pending(s) > 0)) {
+			(void)h2_goaway(s, H2_NO_ERROR);
+			break;
+		}
+
+		pfd[0].fd = s->fd;
+		pfd[0].events = h2_out_pending(s) > 0 ? POLLOUT : 0;
+		if (h2_out_pending(s) < 4 * H2_OUT_HIGH &&
+		    s->in_len < sizeof(s->in))
+			pfd[0].events |= POLLIN;
+		pfd[0].revents = 0;
+		for (int i = 0; i < H2_MAX_STREAMS; i++) {
+			h2_stream_t *st = &s->streams[i];
+
+			if (st->id == 0 || st->fd < 0 ||
+			    st->len == H2_RESP_BUF ||
+			    h2_out_pending(s) >= H2_OUT_HIGH)
+				continue;
+			pfd[nfds].fd = st->fd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+			polled[nfds++] = st;
+		}
+		if (poll(pfd, (nfds_t)nfds, H2_POLL_MS) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (h2_client_read(s) == -1)
+				break;
+			/* WINDOW_UPDATEs may have let held bytes go. */
+			for (int i = 0; i < H2_MAX_STREAMS; i++) {
+				h2_stream_t *st = &s->streams[i];
+
+				if (st->id != 0 && st->len > 0 &&
+				    h2_relay(s, st) == -1)
+					goto fail;
+			}
+		}
+		for (int i = 1; i < nfds; i++) {
+			if (pfd[i].revents == 0 || polled[i]->fd != pfd[i].fd)
+				continue;
+			if (h2_stream_read(s, polled[i]) == -1)
+				goto fail;
+		}
+	}
+	goto done;
+fail:
+	(void)h2_goaway(s, s->error);
+done:
+	h2_session_end(s);
+	return NULL;
+}
+
+/** Tell a client we cannot take it, without a session. */
+static void
+h2_refuse(int fd)
+{
+	static const uint8_t msg[] = {
+		0, 0, 0, H2_SETTINGS, 0, 0, 0, 0, 0,
+		0, 0, 8, H2_GOAWAY, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, H2_ENHANCE_YOUR_CALM
+	};
+
+	(void)send(fd, msg, sizeof(msg), 0);
+	counter_inc(CTR_H2_REFUSED);
+}
+
+int
+h2_session_start(int fd, const struct sockaddr_in *addr, const char *buf,
+    size_t len)
+{
+	h2_session_t *s = NULL;
+	pthread_t tid;
+
+	if (__atomic_add_fetch(&h2_sessions, 1, __ATOMIC_RELAXED) >
+	    H2_MAX_SESSIONS || len < H2_PREFACE_LEN ||
+	    len - H2_PREFACE_LEN > H2_IN_BUF || h2_pool_start() == -1 ||
+	    (s = calloc(1, sizeof(*s))) == NULL)
+		goto refuse;
+	if ((s->fd = dup(fd)) == -1)
+		goto refuse;
+	s->addr = *addr;
+	s->in_len = len - H2_PREFACE_LEN;
+	memcpy(s->in, buf + H2_PREFACE_LEN, s->in_len);
+	hpack_decoder_init(&s->dec);
+	s->window = H2_WINDOW_DEFAULT;
+	s->init_window = H2_WINDOW_DEFAULT;
+	s->frame_max = H2_FRAME_MAX;
+	s->last_io = time(NULL);
+	for (int i = 0; i < H2_MAX_STREAMS; i++)
+		s->streams[i].fd = -1;
+	if (pthread_create(&tid, NULL, h2_session_main, s) != 0) {
+		close(s->fd);
+		goto refuse;
+	}
+	(void)pthread_detach(tid);
+	counter_inc(CTR_H2_SESSIONS);
+	return 0;
+refuse:
+	free(s);
+	__atomic_sub_fetch(&h2_sessions, 1, __ATOMIC_RELAXED);
+	h2_refuse(fd);
+	return -1;
+}
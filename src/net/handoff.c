@@ -0,0 +1,450 @@
+#include <miniweb/net/handoff.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <miniweb/core/log.h>
+
+#define HANDOFF_FD_BASE		3
+#define HANDOFF_ENV_LISTEN	"MINIWEB_LISTEN_FDS"
+#define HANDOFF_ENV_READY	"MINIWEB_READY_FD"
+#define HANDOFF_ENV_STATE	"MINIWEB_STATE_FD"
+#define HANDOFF_STATE_MAX	(8 * 1024 * 1024)	/* bytes read back */
+#define HANDOFF_STATE_SECTIONS	8
+#define HANDOFF_STATE_LINE	(PATH_MAX + 64)
+#define HANDOFF_STATE_TEMPLATE	"/tmp/miniweb-state.XXXXXXXXXX"
+
+extern char **environ;
+
+static char handoff_path[PATH_MAX];
+static char **handoff_argv;
+static int handoff_fds[HANDOFF_MAX_LISTENERS];	/* -1 once taken */
+static int handoff_nfds;
+static int handoff_ready_fd = -1;
+
+static pthread_mutex_t handoff_state_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct handoff_state_ops handoff_state_ops[HANDOFF_STATE_SECTIONS];
+static int handoff_state_count;
+static char *handoff_state_buf;	/* inherited state; NULL once serving */
+static size_t handoff_state_len;
+
+/** Resolve @p prog as execvp(3) would, into handoff_path. */
+static int
+handoff_resolve(const char *prog)
+{
+	char cand[PATH_MAX];
+	const char *path, *p, *end;
+
+	if (strchr(prog, '/') != NULL)
+		return realpath(prog, handoff_path) != NULL ? 0 : -1;
+	if ((path = getenv("PATH")) == NULL)
+		return -1;
+	for (p = path; *p != '\0'; p = *end ? end + 1 : end) {
+		end = strchr(p, ':');
+		if (end == NULL)
+			end = p + strlen(p);
+		if (snprintf(cand, sizeof(cand), "%.*s/%s", (int)(end - p), p,
+			prog) >= (int)sizeof(cand))
+			continue;
+		if (access(cand, X_OK) == 0)
+			return realpath(cand, handoff_path) != NULL ? 0 : -1;
+	}
+	return -1;
+}
+
+/** Parse a non-negative fd number; -1 when @p s is not one. */
+static int
+handoff_parse_fd(const char *s, const char **endp)
+{
+	long v;
+	char *e;
+
+	errno = 0;
+	v = strtol(s, &e, 10);
+	if (e == s || errno != 0 || v < 0 || v > INT_MAX)
+		return -1;
+	*endp = e;
+	return (int)v;
+}
+
+/** Read the inherited state file into handoff_state_buf and close it. */
+static void
+handoff_state_read(int fd)
+{
+	size_t cap = 0;
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		if (handoff_state_len == cap) {
+			if (cap >= HANDOFF_STATE_MAX)
+				break;
+			cap = cap ? cap * 2 : 64 * 1024;
+			if ((p = realloc(handoff_state_buf, cap + 1)) == NULL)
+				break;
+			handoff_state_buf = p;
+		}
+		n = read(fd, handoff_state_buf + handoff_state_len,
+			cap - handoff_state_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		handoff_state_len += (size_t)n;
+	}
+	close(fd);
+	if (handoff_state_buf != NULL)
+		handoff_state_buf[handoff_state_len] = '\0';
+}
+
+/**
+ * @brief Remember how to re-execute this binary; adopt inherited fds.
+ *
+ * @details The environment variables are cleared so that commands the
+ * server runs do not see them.
+ *
+ * @return Number of inherited listeners.
+ */
+int
+handoff_init(int argc, char *argv[])
+{
+	const char *s, *e;
+	int fd;
+
+	handoff_argv = argv;
+	if (argc < 1 || handoff_resolve(argv[0]) != 0)
+		handoff_path[0] = '\0';
+
+	if ((s = getenv(HANDOFF_ENV_LISTEN)) != NULL) {
+		while (handoff_nfds < HANDOFF_MAX_LISTENERS &&
+			(fd = handoff_parse_fd(s, &e)) >= 0) {
+			(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+			handoff_fds[handoff_nfds++] = fd;
+			if (*e != ',')
+				break;
+			s = e + 1;
+		}
+		(void)unsetenv(HANDOFF_ENV_LISTEN);
+	}
+	if ((s = getenv(HANDOFF_ENV_READY)) != NULL) {
+		if ((fd = handoff_parse_fd(s, &e)) >= 0) {
+			(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+			handoff_ready_fd = fd;
+		}
+		(void)unsetenv(HANDOFF_ENV_READY);
+	}
+	if ((s = getenv(HANDOFF_ENV_STATE)) != NULL) {
+		if ((fd = handoff_parse_fd(s, &e)) >= 0)
+			handoff_state_read(fd);
+		(void)unsetenv(HANDOFF_ENV_STATE);
+	}
+	return handoff_nfds;
+}
+
+/** @brief Absolute path of the running binary, or NULL. */
+const char *
+handoff_self_path(void)
+{
+	return handoff_path[0] != '\0' ? handoff_path : NULL;
+}
+
+/** @brief Number of listeners inherited from a predecessor. */
+int
+handoff_inherited(void)
+{
+	return handoff_nfds;
+}
+
+/**
+ * @brief Adopt inherited listener @p index if it listens on @p sa.
+ *
+ * @return The listener, or -1 when there is none for @p index or it is
+ * bound to another address (then it is closed).
+ */
+int
+handoff_take_listener(int index, const struct sockaddr_in *sa)
+{
+	struct sockaddr_in cur;
+	socklen_t len = sizeof(cur);
+	int fd;
+
+	if (index < 0 || index >= handoff_nfds || handoff_fds[index] < 0)
+		return -1;
+	fd = handoff_fds[index];
+	handoff_fds[index] = -1;
+	if (getsockname(fd, (struct sockaddr *)&cur, &len) != 0 ||
+		cur.sin_family != AF_INET || cur.sin_port != sa->sin_port ||
+		cur.sin_addr.s_addr != sa->sin_addr.s_addr) {
+		log_info("Inherited listener %d is bound elsewhere; closing it",
+			index);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Adopt the inherited Unix-domain listener bound to @p path.
+ *
+ * @details Other Unix-domain listeners are left for handoff_ready() to
+ * close; TCP ones are not looked at.
+ *
+ * @return The listener, or -1.
+ */
+int
+handoff_take_unix_listener(const char *path)
+{
+	struct sockaddr_un cur;
+	socklen_t len;
+	int fd;
+
+	for (int i = 0; i < handoff_nfds; i++) {
+		if ((fd = handoff_fds[i]) < 0)
+			continue;
+		len = sizeof(cur);
+		memset(&cur, 0, sizeof(cur));
+		if (getsockname(fd, (struct sockaddr *)&cur, &len) != 0 ||
+			cur.sun_family != AF_UNIX ||
+			strncmp(cur.sun_path, path, sizeof(cur.sun_path)) != 0)
+			continue;
+		handoff_fds[i] = -1;
+		return fd;
+	}
+	return -1;
+}
+
+/**
+ * @brief Release unused inherited listeners and signal the predecessor.
+ */
+void
+handoff_ready(void)
+{
+	const char b = 'r';
+
+	for (int i = 0; i < handoff_nfds; i++) {
+		if (handoff_fds[i] >= 0) {
+			close(handoff_fds[i]);
+			handoff_fds[i] = -1;
+		}
+	}
+	pthread_mutex_lock(&handoff_state_lock);
+	free(handoff_state_buf);
+	handoff_state_buf = NULL;
+	handoff_state_len = 0;
+	pthread_mutex_unlock(&handoff_state_lock);
+	if (handoff_ready_fd < 0)
+		return;
+	while (write(handoff_ready_fd, &b, 1) < 0 && errno == EINTR)
+		;
+	close(handoff_ready_fd);
+	handoff_ready_fd = -1;
+	log_info("Took over from the previous process");
+}
+
+/**
+ * @brief Take part in handoffs; replay the inherited lines of the section.
+ *
+ * @details Sections are found by their "@name" line and run up to the
+ * next "@" line. Lines longer than HANDOFF_STATE_LINE are skipped.
+ *
+ * @return 0, or -1 when the table is full or @p ops is incomplete.
+ */
+int
+handoff_state_register(const struct handoff_state_ops *ops)
+{
+	char line[HANDOFF_STATE_LINE];
+	const char *p, *nl;
+	size_t namelen, len;
+	int in = 0;
+
+	if (ops == NULL || ops->name == NULL || ops->save == NULL)
+		return -1;
+	pthread_mutex_lock(&handoff_state_lock);
+	if (handoff_state_count == HANDOFF_STATE_SECTIONS) {
+		pthread_mutex_unlock(&handoff_state_lock);
+		return -1;
+	}
+	handoff_state_ops[handoff_state_count++] = *ops;
+	namelen = strlen(ops->name);
+	for (p = handoff_state_buf; ops->load != NULL && p != NULL && *p;
+		p = *nl ? nl + 1 : nl) {
+		if ((nl = strchr(p, '\n')) == NULL)
+			nl = p + strlen(p);
+		len = (size_t)(nl - p);
+		if (*p == '@') {
+			in = len == namelen + 1 &&
+				strncmp(p + 1, ops->name, namelen) == 0;
+			continue;
+		}
+		if (!in || len >= sizeof(line))
+			continue;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		ops->load(line, ops->ctx);
+	}
+	pthread_mutex_unlock(&handoff_state_lock);
+	return 0;
+}
+
+/**
+ * @brief Write every registered section to a new, already unlinked file.
+ *
+ * @return Its descriptor, at offset 0, or -1.
+ */
+int
+handoff_state_save(void)
+{
+	char path[] = HANDOFF_STATE_TEMPLATE;
+	FILE *f;
+	int fd, ok;
+
+	if ((fd = mkstemp(path)) < 0)
+		return -1;
+	(void)unlink(path);
+	if ((f = fdopen(dup(fd), "w")) == NULL) {
+		close(fd);
+		return -1;
+	}
+	pthread_mutex_lock(&handoff_state_lock);
+	for (int i = 0; i < handoff_state_count; i++) {
+		const struct handoff_state_ops *o = &handoff_state_ops[i];
+
+		fprintf(f, "@%s\n", o->name);
+		o->save(f, o->ctx);
+	}
+	pthread_mutex_unlock(&handoff_state_lock);
+	ok = fclose(f) == 0;
+	if (!ok || lseek(fd, 0, SEEK_SET) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Whether @p var is NAME=... for NAME one of our variables. */
+static int
+handoff_env_ours(const char *var)
+{
+	static const char *const names[] = {
+		HANDOFF_ENV_LISTEN, HANDOFF_ENV_READY, HANDOFF_ENV_STATE,
+	};
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		size_t n = strlen(names[i]);
+
+		if (strncmp(var, names[i], n) == 0 && var[n] == '=')
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Copy of environ with our variables set to @p listen, @p ready and
+ * @p state; @p state may be NULL.
+ */
+static char **
+handoff_envp(const char *listen, const char *ready, const char *state)
+{
+	size_t n = 0, k = 0;
+	char **envp;
+
+	while (environ[n] != NULL)
+		n++;
+	if ((envp = calloc(n + 4, sizeof(*envp))) == NULL)
+		return NULL;
+	for (size_t i = 0; i < n; i++) {
+		if (!handoff_env_ours(environ[i]))
+			envp[k++] = environ[i];
+	}
+	envp[k++] = (char *)listen;
+	envp[k++] = (char *)ready;
+	envp[k] = (char *)state;
+	return envp;
+}
+
+/**
+ * @brief Fork and re-execute this binary with @p fds as its listeners.
+ *
+ * @details The child only moves descriptors and calls execve(2): the fds
+ * are first copied above the target range, so none is overwritten
+ * before it is moved, then placed at 3.. and everything above closed.
+ * The ready pipe follows the listeners and the state file, if any, the
+ * pipe.
+ *
+ * @param fds The TCP listen socket the dispatcher shards share, then the
+ * Unix one if any.
+ * @param nfds Number of @p fds, at most HANDOFF_MAX_LISTENERS.
+ * @param state_fd State file from handoff_state_save(), or -1; left open.
+ * @param ready_fd Receives the read end of the ready pipe.
+ *
+ * @return Child pid, or -1.
+ */
+pid_t
+handoff_spawn(const int *fds, int nfds, int state_fd, int *ready_fd)
+{
+	char listen[sizeof(HANDOFF_ENV_LISTEN) + HANDOFF_MAX_LISTENERS * 12];
+	char ready[sizeof(HANDOFF_ENV_READY) + 12];
+	char state[sizeof(HANDOFF_ENV_STATE) + 12];
+	int nmove = nfds + 1 + (state_fd >= 0);
+	int base = HANDOFF_FD_BASE + nmove;
+	int tmp[HANDOFF_MAX_LISTENERS + 2];
+	int pfd[2];
+	size_t off;
+	char **envp;
+	pid_t pid;
+
+	if (handoff_path[0] == '\0' || handoff_argv == NULL || nfds < 1 ||
+		nfds > HANDOFF_MAX_LISTENERS) {
+		errno = EINVAL;
+		return -1;
+	}
+	off = (size_t)snprintf(listen, sizeof(listen), "%s=",
+		HANDOFF_ENV_LISTEN);
+	for (int i = 0; i < nfds; i++)
+		off += (size_t)snprintf(listen + off, sizeof(listen) - off,
+			"%s%d", i ? "," : "", HANDOFF_FD_BASE + i);
+	snprintf(ready, sizeof(ready), "%s=%d", HANDOFF_ENV_READY,
+		HANDOFF_FD_BASE + nfds);
+	snprintf(state, sizeof(state), "%s=%d", HANDOFF_ENV_STATE,
+		HANDOFF_FD_BASE + nfds + 1);
+	envp = handoff_envp(listen, ready, state_fd >= 0 ? state : NULL);
+	if (envp == NULL)
+		return -1;
+	if (pipe(pfd) != 0) {
+		free(envp);
+		return -1;
+	}
+	(void)fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+
+	pid = fork();
+	if (pid == 0) {
+		for (int i = 0; i < nfds; i++)
+			tmp[i] = fcntl(fds[i], F_DUPFD, base);
+		tmp[nfds] = fcntl(pfd[1], F_DUPFD, base);
+		if (state_fd >= 0)
+			tmp[nfds + 1] = fcntl(state_fd, F_DUPFD, base);
+		for (int i = 0; i < nmove; i++) {
+			if (tmp[i] < 0 || dup2(tmp[i], HANDOFF_FD_BASE + i) < 0)
+				_exit(127);
+		}
+		closefrom(base);
+		execve(handoff_path, handoff_argv, envp);
+		_exit(127);
+	}
+	free(envp);
+	close(pfd[1]);
+	if (pid < 0) {
+		close(pfd[0]);
+		return -1;
+	}
+	*ready_fd = pfd[0];
+	return pid;
+}
@@ -0,0 +1,169 @@
+/* health.c - health checks answered by the dispatcher */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <miniweb/core/readiness.h>
+#include <miniweb/net/health.h>
+
+/*
+ * The responses are built once, before the dispatchers start, and only
+ * read afterwards. HEAD sends the same head, up to the blank line.
+ */
+
+static const struct {
+	int status;
+	const char *reason;
+	const char *body;
+} health_info[HEALTH_COUNT] = {
+	[HEALTH_OK] = { 200, "OK", "ok\n" },
+	[HEALTH_STARTING] = { 503, "Service Unavailable", "starting\n" },
+	[HEALTH_BUSY] = { 503, "Service Unavailable", "busy\n" },
+	[HEALTH_DRAINING] = { 503, "Service Unavailable", "draining\n" },
+};
+
+static char health_at[HEALTH_PATH_MAX];
+static char health_resp[HEALTH_COUNT][256];
+static size_t health_len[HEALTH_COUNT];
+static size_t health_head_len[HEALTH_COUNT];
+
+/**
+ * @brief Serialize the health responses for @p path.
+ * @return 0, or -1 when @p path is not absolute or too long.
+ */
+int
+health_configure(const char *path)
+{
+	if (path[0] != '\0' &&
+	    (path[0] != '/' || strlen(path) >= sizeof(health_at)))
+		return -1;
+	strlcpy(health_at, path, sizeof(health_at));
+	for (int s = 0; s < HEALTH_COUNT; s++) {
+		size_t blen = strlen(health_info[s].body);
+		int n;
+
+		n = snprintf(health_resp[s], sizeof(health_resp[s]),
+		    "HTTP/1.1 %d %s\r\n"
+		    "Content-Type: text/plain\r\n"
+		    "Content-Length: %zu\r\n"
+		    "Cache-Control: no-store\r\n"
+		    "%s"
+		    "Connection: close\r\n"
+		    "Server: MiniWeb/kqueue\r\n"
+		    "\r\n%s",
+		    health_info[s].status, health_info[s].reason, blen,
+		    health_info[s].status == 200 ? "" : "Retry-After: 1\r\n",
+		    health_info[s].body);
+		if (n < 0 || (size_t)n >= sizeof(health_resp[s]))
+			return -1;
+		health_len[s] = (size_t)n;
+		health_head_len[s] = (size_t)n - blen;
+	}
+	return 0;
+}
+
+/** @brief The configured path, "" when off. */
+const char *
+health_path(void)
+{
+	return health_at;
+}
+
+/** @brief State for a work queue @p depth deep, or draining. */
+health_state_t
+health_state(unsigned long depth, int draining)
+{
+	if (draining)
+		return HEALTH_DRAINING;
+	if (!readiness_ready())
+		return HEALTH_STARTING;
+	if (depth >= HEALTH_QUEUE_BUSY)
+		return HEALTH_BUSY;
+	return HEALTH_OK;
+}
+
+/**
+ * @brief Whether @p buf is one whole GET or HEAD of the health path.
+ * @return Its length, which is @p len; 0 for anything else.
+ */
+size_t
+health_match(const char *buf, size_t len, int *head)
+{
+	size_t plen = strlen(health_at), off;
+	const char *p, *end = buf + len;
+
+	if (plen == 0)
+		return 0;
+	if (len > 4 && memcmp(buf, "GET ", 4) == 0) {
+		*head = 0;
+		off = 4;
+	} else if (len > 5 && memcmp(buf, "HEAD ", 5) == 0) {
+		*head = 1;
+		off = 5;
+	} else
+		return 0;
+	if (len - off < plen || memcmp(buf + off, health_at, plen) != 0)
+		return 0;
+	p = buf + off + plen;
+	/* A query string is allowed and ignored. */
+	if (p < end && *p == '?') {
+		while (p < end && *p != ' ' && *p != '\r')
+			p++;
+	}
+	if ((size_t)(end - p) < 11 || memcmp(p, " HTTP/1.", 8) != 0 ||
+	    (p[8] != '0' && p[8] != '1') || p[9] != '\r' || p[10] != '\n')
+		return 0;
+	p += 9;
+	/* Headers are skipped; the request must end where the data does. */
+	for (; end - p >= 4; p++) {
+		if (memcmp(p, "\r\n\r\n", 4) == 0)
+			return p + 4 == end ? len : 0;
+	}
+	return 0;
+}
+
+/** @brief Serialized response for @p state, head only for @p head. */
+const char *
+health_response(health_state_t state, int head, size_t *len)
+{
+	*len = head ? health_head_len[state] : health_len[state];
+	return health_resp[state];
+}
+
+/** @brief Body text of @p state. */
+const char *
+health_body(health_state_t state)
+{
+	return health_info[state].body;
+}
+
+/**
+ * @brief Answer the health check waiting on @p fd, if that is what it is.
+ *
+ * The request is read off the socket before the answer goes out, so
+ * that closing it sends a FIN rather than a reset. A send that comes up
+ * short is left at that: the connection is new and the response small.
+ *
+ * @return 1 when answered, 0 to leave the socket to a worker.
+ */
+int
+health_answer(int fd, unsigned long depth, int draining)
+{
+	char buf[HEALTH_PEEK_MAX];
+	const char *resp;
+	size_t len, rlen;
+	ssize_t n;
+	int head;
+
+	if (health_at[0] == '\0')
+		return 0;
+	n = recv(fd, buf, sizeof(buf), MSG_PEEK);
+	if (n <= 0 || (len = health_match(buf, (size_t)n, &head)) == 0)
+		return 0;
+	/* Only the dispatcher reads it now: the peeked bytes are all there. */
+	(void)recv(fd, buf, len, 0);
+	resp = health_response(health_state(depth, draining), head, &rlen);
+	(void)send(fd, resp, rlen, 0);
+	return 1;
+}
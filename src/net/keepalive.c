@@ -0,0 +1,54 @@
+/* keepalive.c - keep-alive budget and idle timeout scaled by pool load */
+
+#include <miniweb/net/keepalive.h>
+
+/** Busy slots in percent; 0 when there is no limit to measure against. */
+static int
+keepalive_load(int active, int max)
+{
+	if (max <= 0 || active <= 0)
+		return 0;
+	if (active >= max)
+		return 100;
+	return (int)((long long)active * 100 / max);
+}
+
+/**
+ * @brief Keep-alive request budget for the current load.
+ * @param active Connection slots in use.
+ * @param max The max_conns limit.
+ * @return Requests one connection may serve before it is closed.
+ */
+int
+keepalive_budget(int active, int max)
+{
+	int load = keepalive_load(active, max);
+
+	if (load < 50)
+		return KEEPALIVE_REQUESTS_MAX;
+	if (load < 75)
+		return KEEPALIVE_REQUESTS;
+	if (load < 90)
+		return KEEPALIVE_REQUESTS / 4;
+	return KEEPALIVE_REQUESTS_MIN;
+}
+
+/**
+ * @brief Idle timeout between requests for the current load.
+ * @param conn_timeout The configured timeout, in seconds.
+ * @param active Connection slots in use.
+ * @param max The max_conns limit.
+ * @return Seconds, never more than @p conn_timeout.
+ */
+int
+keepalive_idle_timeout(int conn_timeout, int active, int max)
+{
+	int load = keepalive_load(active, max);
+	int t;
+
+	if (load <= 50 || conn_timeout <= KEEPALIVE_IDLE_MIN)
+		return conn_timeout;
+	t = conn_timeout - (conn_timeout - KEEPALIVE_IDLE_MIN) *
+	    (load - 50) / 50;
+	return t > KEEPALIVE_IDLE_MIN ? t : KEEPALIVE_IDLE_MIN;
+}
@@ -0,0 +1,183 @@
+/* rate_limit.c - per-client token buckets for each route class */
+
+#include <pthread.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/net/rate_limit.h>
+
+/*
+ * Tokens are counted in thousandths so that slow rates still refill a
+ * little on every look. Each class has its own shards, so every bucket
+ * in one refills at the same rate. A key is the 64-bit FNV-1a hash of
+ * the client; 0 marks a free slot. The shard is picked by the low bits
+ * of the key, the first slot probed by the next ones.
+ */
+
+#define RL_TOKEN		1000	/* one request */
+#define RL_BURST_MAX		100000
+#define RL_RATE_MAX		6000000	/* 100000 a second */
+
+typedef struct {
+	uint64_t key;
+	uint32_t tokens;		/* thousandths, at most burst * 1000 */
+	uint32_t last;			/* ms of the last refill, truncated */
+} rl_bucket_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	rl_bucket_t slot[RATE_LIMIT_SLOTS];
+} rl_shard_t;
+
+static rl_shard_t rl_shards[ROUTE_CLASS_COUNT][RATE_LIMIT_SHARDS];
+static pthread_once_t rl_once = PTHREAD_ONCE_INIT;
+static int rl_rate[ROUTE_CLASS_COUNT];	/* per minute; 0: off */
+static int rl_burst[ROUTE_CLASS_COUNT];
+
+static const counter_id_t rl_counter[ROUTE_CLASS_COUNT] = {
+	[ROUTE_CLASS_FAST] = CTR_RATE_LIMITED_FAST,
+	[ROUTE_CLASS_SLOW] = CTR_RATE_LIMITED_SLOW,
+};
+
+LOCKSTAT_SITE(lockstat_rate_limit, "rate_limit");
+
+static void
+rl_init(void)
+{
+	for (int c = 0; c < ROUTE_CLASS_COUNT; c++) {
+		for (int i = 0; i < RATE_LIMIT_SHARDS; i++)
+			pthread_mutex_init(&rl_shards[c][i].lock, NULL);
+	}
+}
+
+static uint64_t
+rl_key(const char *client)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *client != '\0'; client++)
+		h = (h ^ (unsigned char)*client) * 1099511628211ULL;
+	return h != 0 ? h : 1;
+}
+
+/**
+ * Add what @p b earned since its last refill, at @p per tokens a
+ * minute up to @p cap thousandths. Only the time that earned whole
+ * thousandths is consumed, so frequent looks lose nothing.
+ */
+static void
+rl_refill(rl_bucket_t *b, uint32_t now, uint64_t per, uint32_t cap)
+{
+	uint64_t add = (uint64_t)(uint32_t)(now - b->last) * per / 60;
+
+	if (b->tokens + add >= cap) {
+		b->tokens = cap;
+		b->last = now;
+	} else if (add > 0) {
+		b->tokens += (uint32_t)add;
+		b->last += (uint32_t)(add * 60 / per);
+	}
+}
+
+/**
+ * @brief Set the rate and burst of one route class.
+ *
+ * @details Values are clamped to RL_RATE_MAX a minute and RL_BURST_MAX;
+ * a burst below 1 is taken as 1. Workers read them without a lock.
+ */
+void
+rate_limit_configure(route_class_t cls, int per_minute, int burst)
+{
+	if ((int)cls < 0 || cls >= ROUTE_CLASS_COUNT)
+		return;
+	if (per_minute < 0)
+		per_minute = 0;
+	if (per_minute > RL_RATE_MAX)
+		per_minute = RL_RATE_MAX;
+	if (burst < 1)
+		burst = 1;
+	if (burst > RL_BURST_MAX)
+		burst = RL_BURST_MAX;
+	__atomic_store_n(&rl_burst[cls], burst, __ATOMIC_RELAXED);
+	__atomic_store_n(&rl_rate[cls], per_minute, __ATOMIC_RELAXED);
+}
+
+/** @brief Whether requests of class @p cls are limited. */
+int
+rate_limit_enabled(route_class_t cls)
+{
+	if ((int)cls < 0 || cls >= ROUTE_CLASS_COUNT)
+		return 0;
+	return __atomic_load_n(&rl_rate[cls], __ATOMIC_RELAXED) > 0;
+}
+
+/**
+ * @brief Spend one token of @p client's bucket for class @p cls.
+ *
+ * @details The bucket is found among RATE_LIMIT_PROBE slots; a new
+ * client takes a free or fully refilled slot there, or else the one
+ * refilled longest ago, and starts with a full bucket.
+ *
+ * @return 0 when allowed, else seconds until the next token (>= 1).
+ */
+int
+rate_limit_take(route_class_t cls, const char *client, uint64_t now_ms)
+{
+	rl_shard_t *sh;
+	rl_bucket_t *b = NULL, *spare = NULL, *oldest = NULL;
+	uint64_t key, per, wait;
+	uint32_t now = (uint32_t)now_ms, cap;
+	size_t first;
+	int per_minute, rc = 0;
+
+	if ((int)cls < 0 || cls >= ROUTE_CLASS_COUNT || client == NULL)
+		return 0;
+	per_minute = __atomic_load_n(&rl_rate[cls], __ATOMIC_RELAXED);
+	if (per_minute <= 0)
+		return 0;
+	per = (uint64_t)per_minute;
+	cap = (uint32_t)__atomic_load_n(&rl_burst[cls], __ATOMIC_RELAXED) *
+	    RL_TOKEN;
+	key = rl_key(client);
+	sh = &rl_shards[cls][key % RATE_LIMIT_SHARDS];
+	first = (size_t)(key / RATE_LIMIT_SHARDS);
+
+	pthread_once(&rl_once, rl_init);
+	LOCKSTAT_LOCK(&sh->lock, lockstat_rate_limit);
+	for (size_t i = 0; i < RATE_LIMIT_PROBE; i++) {
+		rl_bucket_t *e = &sh->slot[(first + i) % RATE_LIMIT_SLOTS];
+
+		if (e->key == key) {
+			b = e;
+			break;
+		}
+		if (spare != NULL)
+			continue;
+		if (e->key != 0)
+			rl_refill(e, now, per, cap);
+		if (e->key == 0 || e->tokens >= cap)
+			spare = e;
+		else if (oldest == NULL ||
+		    (uint32_t)(now - e->last) > (uint32_t)(now - oldest->last))
+			oldest = e;
+	}
+	if (b == NULL) {
+		b = spare != NULL ? spare : oldest;
+		b->key = key;
+		b->tokens = cap;
+		b->last = now;
+	}
+	rl_refill(b, now, per, cap);	/* also caps at a lowered burst */
+	if (b->tokens >= RL_TOKEN) {
+		b->tokens -= RL_TOKEN;
+	} else {
+		wait = ((RL_TOKEN - b->tokens) * 60 + per - 1) / per;
+		rc = (int)((wait + 999) / 1000);
+		if (rc < 1)
+			rc = 1;
+	}
+	LOCKSTAT_UNLOCK(&sh->lock, lockstat_rate_limit);
+	if (rc > 0)
+		counter_inc(rl_counter[cls]);
+	return rc;
+}
@@ -0,0 +1,128 @@
+#include <miniweb/net/request_buffer.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Free buffers are chained through their first bytes. */
+typedef struct reqbuf_free {
+	struct reqbuf_free *next;
+} reqbuf_free_t;
+
+typedef struct {
+	size_t size;
+	int keep;		/* free buffers retained before returning to malloc */
+	int nfree;
+	reqbuf_free_t *head;
+	pthread_mutex_t lock;
+} reqbuf_class_t;
+
+static reqbuf_class_t reqbuf_classes[MINIWEB_REQBUF_CLASSES] = {
+	{MINIWEB_REQBUF_SMALL, 1024, 0, NULL, PTHREAD_MUTEX_INITIALIZER},
+	{MINIWEB_REQBUF_MEDIUM, 256, 0, NULL, PTHREAD_MUTEX_INITIALIZER},
+	{MINIWEB_REQBUF_LARGE, 64, 0, NULL, PTHREAD_MUTEX_INITIALIZER},
+};
+
+static size_t reqbuf_bytes_in_use;
+
+/** Map a byte count to the smallest class that holds it, or -1. */
+static int
+reqbuf_class_for(size_t need)
+{
+	for (int i = 0; i < MINIWEB_REQBUF_CLASSES; i++) {
+		if (need <= reqbuf_classes[i].size)
+			return i;
+	}
+	return -1;
+}
+
+/** Return a buffer of at least @p need bytes and store its size in @p cap. */
+char *
+miniweb_reqbuf_get(size_t need, size_t *cap)
+{
+	int ci = reqbuf_class_for(need);
+	if (ci < 0)
+		return NULL;
+	reqbuf_class_t *c = &reqbuf_classes[ci];
+
+	pthread_mutex_lock(&c->lock);
+	reqbuf_free_t *f = c->head;
+	if (f) {
+		c->head = f->next;
+		c->nfree--;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	char *buf = f ? (char *)f : malloc(c->size);
+	if (!buf)
+		return NULL;
+	*cap = c->size;
+	__atomic_add_fetch(&reqbuf_bytes_in_use, c->size, __ATOMIC_RELAXED);
+	return buf;
+}
+
+/** Grow @p buf to the next class up, keeping the first @p used bytes. */
+char *
+miniweb_reqbuf_grow(char *buf, size_t used, size_t *cap)
+{
+	size_t ncap;
+	char *nbuf = miniweb_reqbuf_get(*cap + 1, &ncap);
+	if (!nbuf)
+		return NULL;
+	memcpy(nbuf, buf, used);
+	miniweb_reqbuf_put(buf, *cap);
+	*cap = ncap;
+	return nbuf;
+}
+
+/** Return @p buf (of class size @p cap) to its free list. */
+void
+miniweb_reqbuf_put(char *buf, size_t cap)
+{
+	if (!buf)
+		return;
+	int ci = reqbuf_class_for(cap);
+	__atomic_sub_fetch(&reqbuf_bytes_in_use, cap, __ATOMIC_RELAXED);
+	if (ci < 0 || reqbuf_classes[ci].size != cap) {
+		free(buf);
+		return;
+	}
+	reqbuf_class_t *c = &reqbuf_classes[ci];
+	reqbuf_free_t *f = (reqbuf_free_t *)(void *)buf;
+
+	pthread_mutex_lock(&c->lock);
+	if (c->nfree < c->keep) {
+		f->next = c->head;
+		c->head = f;
+		c->nfree++;
+		f = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+	free(f);
+}
+
+/** Bytes currently handed out across all classes. */
+size_t
+miniweb_reqbuf_in_use(void)
+{
+	return __atomic_load_n(&reqbuf_bytes_in_use, __ATOMIC_RELAXED);
+}
+
+/** Release every cached free buffer. */
+void
+miniweb_reqbuf_cleanup(void)
+{
+	for (int i = 0; i < MINIWEB_REQBUF_CLASSES; i++) {
+		reqbuf_class_t *c = &reqbuf_classes[i];
+		pthread_mutex_lock(&c->lock);
+		reqbuf_free_t *f = c->head;
+		c->head = NULL;
+		c->nfree = 0;
+		pthread_mutex_unlock(&c->lock);
+		while (f) {
+			reqbuf_free_t *next = f->next;
+			free(f);
+			f = next;
+		}
+	}
+}
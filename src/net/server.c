@@ -5,17 +5,30 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/event.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <miniweb/core/counters.h>
+#include <miniweb/core/heartbeat.h>
 #include <miniweb/core/log.h>
 #include <miniweb/http/handler.h>
+#include <miniweb/net/handoff.h>
+#include <miniweb/net/health.h>
+#include <miniweb/net/keepalive.h>
+#include <miniweb/net/trace.h>
 #include <miniweb/net/worker.h>
+#include <miniweb/router/routes.h>
+
+static volatile sig_atomic_t server_draining;
 
 /** Put a socket in non-blocking mode for dispatcher and worker cooperation. */
 static void
@@ -42,187 +55,807 @@ drain_signal_pipe(int fd)
 	}
 }
 
-/** Accept and register all pending client sockets for EV_DISPATCH reads. */
+/**
+ * Create, bind, and listen on the configured IPv4 address, or adopt the
+ * listener a predecessor handed over on that address. Every dispatcher
+ * shard watches this one socket from its own kqueue and accepts on it:
+ * SO_REUSEPORT would give each shard a socket, but OpenBSD hands every
+ * connection to the last one bound, so all but one shard would idle.
+ */
+static int
+open_listener(miniweb_server_runtime_t *rt)
+{
+	struct sockaddr_in sa;
+	int on = 1;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(rt->config->port);
+	if (inet_pton(AF_INET, rt->config->bind_addr, &sa.sin_addr) != 1)
+		return -1;
+	if ((fd = handoff_take_listener(0, &sa)) >= 0) {
+		set_nonblock(fd);
+		return fd;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	set_nonblock(fd);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+		listen(fd, MINIWEB_LISTEN_BACKLOG) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Whether a server accepts on the socket file at @p su; keeps errno. */
+static int
+unix_socket_live(const struct sockaddr_un *su)
+{
+	int saved_errno = errno;
+	int fd, live = 1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) {
+		live = connect(fd, (const struct sockaddr *)su,
+			sizeof(*su)) == 0 || errno != ECONNREFUSED;
+		close(fd);
+	}
+	errno = saved_errno;
+	return live;
+}
+
+/**
+ * Listen on unix_socket, or adopt the listener a predecessor handed over
+ * on that path. A socket file left by a server that is gone is replaced;
+ * one that still accepts connections is not.
+ */
+static int
+open_unix_listener(miniweb_server_runtime_t *rt)
+{
+	struct sockaddr_un su;
+	int fd, rc;
+
+	memset(&su, 0, sizeof(su));
+	su.sun_family = AF_UNIX;
+	if (strlcpy(su.sun_path, rt->config->unix_socket,
+		sizeof(su.sun_path)) >= sizeof(su.sun_path))
+		return -1;
+	if ((fd = handoff_take_unix_listener(su.sun_path)) >= 0) {
+		set_nonblock(fd);
+		return fd;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	rc = bind(fd, (struct sockaddr *)&su, sizeof(su));
+	if (rc < 0 && errno == EADDRINUSE && !unix_socket_live(&su) &&
+		unlink(su.sun_path) == 0)
+		rc = bind(fd, (struct sockaddr *)&su, sizeof(su));
+	if (rc < 0 || listen(fd, MINIWEB_LISTEN_BACKLOG) < 0) {
+		log_error("unix_socket %s: %s", su.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	set_nonblock(fd);
+	return fd;
+}
+
+/**
+ * Reject thread: answer shed sockets with 503 off the dispatcher threads.
+ * Items are fd + 1 so that fd 0 is not mistaken for an empty pop.
+ */
+static void *
+reject_thread(void *arg)
+{
+	miniweb_server_runtime_t *rt = arg;
+	for (;;) {
+		void *item = miniweb_work_queue_pop(&rt->reject_queue, &rt->running);
+		if (!item)
+			break;
+		int fd = (int)((intptr_t)item - 1);
+		http_request_t req = {.fd = fd,.method = "GET",.url = "/",
+			.version = "HTTP/1.1",.keep_alive = 0};
+		(void)http_send_error(&req, 503, "Server busy");
+		counter_inc(CTR_STATUS_503);
+		close(fd);
+	}
+	return NULL;
+}
+
+/** Hand a socket the pool cannot take to the reject path, or just close it. */
 static void
-handle_accept(miniweb_server_runtime_t *rt)
+shed_connection(miniweb_server_runtime_t *rt, int cfd)
 {
+	if (rt->reject_started &&
+		miniweb_work_queue_push(&rt->reject_queue,
+		(void *)((intptr_t)cfd + 1)) == 0)
+		return;
+	close(cfd);
+}
+
+/** Enable or disable this shard's listen filters for accept backpressure. */
+static void
+set_accept_paused(miniweb_dispatcher_t *d, int paused)
+{
+	struct kevent chg[2];
+	int n = 0;
+
+	if (d->listen_fd >= 0)
+		EV_SET(&chg[n++], d->listen_fd, EVFILT_READ,
+			paused ? EV_DISABLE : EV_ENABLE, 0, 0, NULL);
+	if (d->unix_fd >= 0)
+		EV_SET(&chg[n++], d->unix_fd, EVFILT_READ,
+			paused ? EV_DISABLE : EV_ENABLE, 0, 0, NULL);
+	if (kevent(d->kq_fd, chg, n, NULL, 0, NULL) == 0) {
+		d->accept_paused = paused;
+		if (paused)
+			counter_inc(CTR_ACCEPT_PAUSES);
+	}
+}
+
+/**
+ * Accept and register all pending client sockets on @p lfd for EV_DISPATCH
+ * reads. Peers on the Unix-domain listener have no address of their own:
+ * theirs is left zero with sin_family AF_UNIX, which the request helpers
+ * take as a local proxy.
+ */
+static void
+handle_accept(miniweb_dispatcher_t *d, int lfd)
+{
+	miniweb_server_runtime_t *rt = d->server;
+	int local = lfd == d->unix_fd;
+
 	for (;;) {
+		if (rt->config->listen_backpressure &&
+			miniweb_connection_pool_active(&rt->pool) >=
+			rt->config->max_conns) {
+			/* Leave the rest in the kernel backlog until slots free up. */
+			set_accept_paused(d, 1);
+			return;
+		}
 		struct sockaddr_in caddr;
 		socklen_t clen = sizeof(caddr);
-		int cfd = accept(rt->listen_fd, (struct sockaddr *)&caddr, &clen);
+		int cfd = local ? accept(lfd, NULL, NULL) :
+			accept(lfd, (struct sockaddr *)&caddr, &clen);
 		if (cfd < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
 				return;
 			if (errno == EINTR)
 				continue;
+			counter_inc(CTR_ACCEPT_ERRORS);
 			return;
 		}
+		counter_inc(CTR_ACCEPTS);
+		if (local) {
+			memset(&caddr, 0, sizeof(caddr));
+			caddr.sin_family = AF_UNIX;
+			counter_inc(CTR_ACCEPTS_UNIX);
+		}
 		set_nonblock(cfd);
 		miniweb_connection_t *conn = miniweb_connection_alloc(&rt->pool, cfd,
 									  &caddr, rt->config->max_conns);
 		if (!conn) {
-			http_request_t req = {.fd = cfd,.method = "GET",.url = "/",
-				.version = "HTTP/1.1",.keep_alive = 0};
-				(void)http_send_error(&req, 503, "Server busy");
-				close(cfd);
-				continue;
+			counter_inc(CTR_ACCEPT_SHED);
+			shed_connection(rt, cfd);
+			continue;
 		}
+		(void)miniweb_timer_wheel_add(&d->idle_wheel, cfd, conn->gen,
+			conn->created + rt->config->conn_timeout + 1);
+		int target_kq = d->kq_fd;
+		if (d->worker_count > 0)
+			target_kq = d->worker_kq[d->next_worker++ % d->worker_count];
 		struct kevent ev;
-		EV_SET(&ev, cfd, EVFILT_READ, EV_ADD | EV_DISPATCH, 0, 0, conn);
-		if (kevent(rt->kq_fd, &ev, 1, NULL, 0, NULL) < 0) {
+		EV_SET(&ev, cfd, EVFILT_READ, EV_ADD | EV_DISPATCH, 0, 0,
+			miniweb_connection_token(conn));
+		if (kevent(target_kq, &ev, 1, NULL, 0, NULL) < 0) {
 			close(cfd);
 			miniweb_connection_free(&rt->pool, cfd);
 		}
 	}
 }
 
-/** Close timed-out idle sockets discovered in the periodic sweep pass. */
+/**
+ * Idle-wheel callback: drop recycled fd tokens, re-arm connections that saw
+ * activity since they were scheduled, and close the ones that timed out.
+ * A connection between requests gets the shorter keepalive_idle_timeout()
+ * of the current load, and is looked at again every few seconds in case
+ * the load rises. One a worker has queued or is serving is never closed
+ * here: its idle time only starts once the worker re-arms it.
+ */
+static time_t
+idle_timer_check(void *ctx, int fd, unsigned gen, time_t now)
+{
+	miniweb_server_runtime_t *rt = ctx;
+	miniweb_connection_pool_t *pool = &rt->pool;
+
+	if (__atomic_load_n(&pool->conn_gen[fd], __ATOMIC_ACQUIRE) != gen)
+		return 0;
+	miniweb_connection_t *c = __atomic_load_n(&pool->connections[fd],
+		__ATOMIC_ACQUIRE);
+	if (!c)
+		return 0;
+	if (__atomic_load_n(&c->busy, __ATOMIC_ACQUIRE))
+		return now + 1;
+	int idle = c->buffer == NULL && !http_output_pending(&c->out);
+	int timeout = rt->config->conn_timeout;
+	if (idle)
+		timeout = keepalive_idle_timeout(timeout,
+			miniweb_connection_pool_active(pool),
+			rt->config->max_conns);
+	time_t deadline = c->last_activity + timeout;
+	/* Draining: keep-alive connections between requests go first. */
+	if (rt->draining && idle)
+		deadline = c->last_activity + MINIWEB_DRAIN_IDLE_SEC;
+	if (deadline >= now) {
+		if (rt->draining)
+			return now + 1;
+		if (idle && deadline > now + KEEPALIVE_IDLE_RECHECK)
+			return now + KEEPALIVE_IDLE_RECHECK;
+		return deadline + 1;
+	}
+	if (!miniweb_connection_claim(c))
+		return now + 1;
+	if (idle && !rt->draining &&
+		c->last_activity + rt->config->conn_timeout >= now)
+		counter_inc(CTR_KEEPALIVE_IDLE_CLOSES);
+	close(fd);
+	miniweb_connection_free(pool, fd);
+	return 0;
+}
+
+/** heartbeat_use_kqueue() hook: run due tasks on shard 0's slow lane. */
+static int
+heartbeat_submit(void *item, void *ctx)
+{
+	miniweb_dispatcher_t *d = ctx;
+
+	return miniweb_work_queue_push(&d->slow_queue, item);
+}
+
+/**
+ * Move the heartbeat onto shard 0's kqueue when heartbeat_kqueue asks for
+ * it and there is a slow lane to run its tasks.
+ */
 static void
-sweep_idle(miniweb_server_runtime_t *rt)
+heartbeat_attach(miniweb_server_runtime_t *rt)
 {
-	time_t now = time(NULL);
-	int to_close[MINIWEB_MAX_CONNECTIONS];
-	int close_count = 0;
+	miniweb_dispatcher_t *d = &rt->dispatchers[0];
 
-	pthread_mutex_lock(&rt->pool.lock);
-	for (int fd = 0; fd < MINIWEB_MAX_CONNECTIONS; fd++) {
-		miniweb_connection_t *c = rt->pool.connections[fd];
-		if (c && (now - c->last_activity) > rt->config->conn_timeout)
-			to_close[close_count++] = fd;
+	if (!rt->config->heartbeat_kqueue)
+		return;
+	if (!d->slow_started) {
+		log_info("heartbeat_kqueue needs a slow lane; keeping the "
+			"heartbeat thread");
+		return;
 	}
-	pthread_mutex_unlock(&rt->pool.lock);
+	if (heartbeat_use_kqueue(d->kq_fd, heartbeat_submit, d) == 0) {
+		rt->heartbeat_kqueue = 1;
+		log_info("Heartbeat timers on the dispatcher kqueue");
+	}
+}
 
-	for (int i = 0; i < close_count; i++) {
-		int fd = to_close[i];
-		close(fd);
-		miniweb_connection_free(&rt->pool, fd);
+/**
+ * Set up one shard: its own kqueue watching the shared rt->listen_fd
+ * (none with listen_tcp off), rt->unix_fd on shard 0, and the shared
+ * signal pipe so shutdown wakes every loop. A connection wakes every
+ * shard; the ones that lose the accept race get EAGAIN.
+ */
+static int
+dispatcher_setup(miniweb_dispatcher_t *d)
+{
+	miniweb_server_runtime_t *rt = d->server;
+	struct kevent chg;
+
+	d->listen_fd = rt->listen_fd;
+	if (d->index == 0)
+		d->unix_fd = rt->unix_fd;
+
+	d->kq_fd = kqueue();
+	if (d->kq_fd < 0)
+		return -1;
+	for (int i = 0; i < 2; i++) {
+		int lfd = i == 0 ? d->listen_fd : d->unix_fd;
+
+		if (lfd < 0)
+			continue;
+		EV_SET(&chg, lfd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
+		if (kevent(d->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
+			return -1;
+	}
+	EV_SET(&chg, rt->signal_pipe_rfd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
+	if (kevent(d->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
+		return -1;
+	if (d->index == 0 && rt->reload != NULL) {
+		EV_SET(&chg, SIGHUP, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+		if (kevent(d->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
+			return -1;
+	}
+	if (d->index == 0) {
+		EV_SET(&chg, SIGUSR2, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+		if (kevent(d->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
+			return -1;
 	}
+	return 0;
 }
 
-/** Initialize listen socket, kqueue dispatcher, queue/pool, and worker threads. */
-int
-miniweb_server_run(miniweb_server_runtime_t *rt)
+/**
+ * Successor serving: stop accepting on this shard. The successor holds
+ * the same sockets, so nothing queued on them is lost. The TCP one is
+ * shared by every shard, so each only stops watching it and it is closed
+ * on exit; the Unix one, shard 0's alone, is closed here and its file is
+ * now the successor's and stays.
+ */
+static void
+drain_listener(miniweb_dispatcher_t *d)
 {
-	struct sockaddr_in sa;
-	pthread_t threads[MINIWEB_THREAD_POOL_SIZE];
-	int started_threads = 0;
-	int rc = -1;
-	miniweb_worker_runtime_t worker_rt = {.running = &rt->running,
-		.kq_fd = &rt->kq_fd,.config = rt->config,.queue = &rt->queue,
-		.pool = &rt->pool};
+	struct kevent chg;
 
-	rt->running = 1;
-	rt->listen_fd = -1;
-	rt->kq_fd = -1;
-	rt->signal_pipe_rfd = -1;
-	rt->signal_pipe_wfd = -1;
-	miniweb_work_queue_init(&rt->queue);
-	miniweb_connection_pool_init(&rt->pool);
+	if (d->listen_fd >= 0) {
+		EV_SET(&chg, d->listen_fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+		(void)kevent(d->kq_fd, &chg, 1, NULL, 0, NULL);
+	}
+	if (d->unix_fd >= 0) {
+		close(d->unix_fd);
+		d->server->unix_fd = -1;
+	}
+	d->listen_fd = -1;
+	d->unix_fd = -1;
+	d->accept_paused = 0;
+}
 
-	int signal_pipe[2];
-	if (pipe(signal_pipe) < 0)
-		goto out;
-	rt->signal_pipe_rfd = signal_pipe[0];
-	rt->signal_pipe_wfd = signal_pipe[1];
-	set_nonblock(rt->signal_pipe_rfd);
-	set_nonblock(rt->signal_pipe_wfd);
+/**
+ * Enter drain mode on shard 0: every shard stops accepting, answers go
+ * out with Connection: close, idle keep-alive connections are closed on
+ * the next wheel pass and the loop ends once none is left, or after
+ * conn_timeout at the latest.
+ */
+static void
+drain_start(miniweb_dispatcher_t *d)
+{
+	miniweb_server_runtime_t *rt = d->server;
+	time_t now = time(NULL);
 
-	rt->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (rt->listen_fd < 0)
-		goto out;
+	rt->drain_deadline = now + rt->config->conn_timeout;
+	rt->draining = 1;
+	server_draining = 1;
+	for (int fd = 0; fd < MINIWEB_MAX_CONNECTIONS; fd++) {
+		miniweb_connection_t *c = __atomic_load_n(
+			&rt->pool.connections[fd], __ATOMIC_ACQUIRE);
+		if (c)
+			(void)miniweb_timer_wheel_add(&d->idle_wheel, fd, c->gen,
+				now + 1);
+	}
+	log_info("New process %d is serving; draining %d connection(s)",
+		(int)rt->handoff_pid, miniweb_connection_pool_active(&rt->pool));
+}
 
-	int on = 1;
-	setsockopt(rt->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-	set_nonblock(rt->listen_fd);
-	memset(&sa, 0, sizeof(sa));
-	sa.sin_family = AF_INET;
-	sa.sin_port = htons(rt->config->port);
-	if (inet_pton(AF_INET, rt->config->bind_addr, &sa.sin_addr) != 1)
-		goto out;
-	if (bind(rt->listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
-		listen(rt->listen_fd, MINIWEB_LISTEN_BACKLOG) < 0)
-		goto out;
+/** Shard 0 while draining: whether the loop may end. */
+static int
+drain_done(miniweb_server_runtime_t *rt)
+{
+	int left = miniweb_connection_pool_active(&rt->pool);
 
-	rt->kq_fd = kqueue();
-	if (rt->kq_fd < 0)
-		goto out;
+	if (left > 0 && time(NULL) < rt->drain_deadline)
+		return 0;
+	log_info("Drain over, %d connection(s) left; exiting", left);
+	return 1;
+}
 
+/** The successor's ready pipe is readable: one byte, or EOF if it died. */
+static void
+handoff_check(miniweb_dispatcher_t *d)
+{
+	miniweb_server_runtime_t *rt = d->server;
+	ssize_t n;
+	char b;
+
+	while ((n = read(rt->handoff_fd, &b, 1)) < 0 && errno == EINTR)
+		;
+	close(rt->handoff_fd);
+	rt->handoff_fd = -1;
+	if (n == 1) {
+		drain_start(d);
+		return;
+	}
+	(void)waitpid(rt->handoff_pid, NULL, 0);
+	log_error("New process %d exited before serving; keeping this one",
+		(int)rt->handoff_pid);
+	rt->handoff_pid = -1;
+}
+
+/**
+ * Signal on shard 0. SIGHUP lets the application reload and, when it
+ * asks for a new process, starts one holding the listeners and
+ * what the caches hand over; SIGUSR2 always does, to run a new binary.
+ */
+static void
+server_reload(miniweb_dispatcher_t *d, int sig)
+{
+	miniweb_server_runtime_t *rt = d->server;
+	int fds[HANDOFF_MAX_LISTENERS];
 	struct kevent chg;
-	EV_SET(&chg, rt->listen_fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
-	if (kevent(rt->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
-		goto out;
-	EV_SET(&chg, rt->signal_pipe_rfd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
-	if (kevent(rt->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
-		goto out;
+	int state_fd, nfds = 0;
 
-	for (int i = 0; i < rt->config->threads; i++) {
-		if (pthread_create(&threads[i], NULL, miniweb_worker_thread, &worker_rt)
-			!= 0) {
-			log_error("pthread_create failed for worker %d", i);
-			rt->running = 0;
-			miniweb_work_queue_broadcast_shutdown(&rt->queue);
-			goto out;
-		}
-		started_threads++;
+	if (rt->handoff_fd >= 0 || rt->draining) {
+		log_info("%s ignored: a new process is already taking over",
+			sig == SIGHUP ? "SIGHUP" : "SIGUSR2");
+		return;
+	}
+	if (sig == SIGHUP && rt->reload(rt) <= 0)
+		return;
+	/* The shared TCP listener at index 0; the Unix one follows. */
+	if (rt->listen_fd >= 0)
+		fds[nfds++] = rt->listen_fd;
+	if (rt->unix_fd >= 0)
+		fds[nfds++] = rt->unix_fd;
+	if ((state_fd = handoff_state_save()) < 0)
+		log_info("Cache state not handed over: %s", strerror(errno));
+	rt->handoff_pid = handoff_spawn(fds, nfds, state_fd, &rt->handoff_fd);
+	if (state_fd >= 0)
+		close(state_fd);
+	if (rt->handoff_pid < 0) {
+		rt->handoff_fd = -1;
+		log_error("Could not start a new process: %s", strerror(errno));
+		return;
 	}
+	log_info("Handing the listeners to new process %d",
+		(int)rt->handoff_pid);
+	EV_SET(&chg, rt->handoff_fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(d->kq_fd, &chg, 1, NULL, 0, NULL) < 0)
+		handoff_check(d);	/* cannot watch it: wait here */
+}
 
+/**
+ * Answer a health check in place when it is the first request of @p c:
+ * relayd opens a connection for each. 1 when answered, to be closed.
+ */
+static int
+dispatch_health(miniweb_dispatcher_t *d, miniweb_connection_t *c, int fd)
+{
+	if (c->requests_served > 0 || c->buffer != NULL ||
+		health_path()[0] == '\0')
+		return 0;
+	return health_answer(fd, miniweb_work_queue_depth(&d->queue),
+		d->server->draining);
+}
+
+/**
+ * Run one shard's event loop until shutdown.
+ * The connection pool is indexed by fd and so shared across shards; each
+ * shard expires the connections it accepted through its own idle wheel.
+ */
+static void
+dispatcher_loop(miniweb_dispatcher_t *d)
+{
+	miniweb_server_runtime_t *rt = d->server;
 	struct kevent events[MINIWEB_MAX_EVENTS];
-	time_t last_sweep = time(NULL);
+
 	while (rt->running) {
+		if (rt->draining) {
+			if (d->listen_fd >= 0 || d->unix_fd >= 0)
+				drain_listener(d);
+			if (d->index == 0 && drain_done(rt))
+				break;
+		}
+		/* Slots are freed by workers, so poll quickly while paused. */
 		struct timespec timeout = {1, 0};
-		int n = kevent(rt->kq_fd, NULL, 0, events, MINIWEB_MAX_EVENTS, &timeout);
+		if (d->accept_paused) {
+			timeout.tv_sec = 0;
+			timeout.tv_nsec = MINIWEB_PAUSED_POLL_MS * 1000000L;
+		}
+		int n = kevent(d->kq_fd, NULL, 0, events, MINIWEB_MAX_EVENTS, &timeout);
 		if (n < 0) {
 			if (errno == EINTR)
 				continue;
 			break;
 		}
-		if (time(NULL) - last_sweep >= 1) {
-			sweep_idle(rt);
-			last_sweep = time(NULL);
+		(void)miniweb_timer_wheel_advance(&d->idle_wheel, time(NULL),
+			idle_timer_check, rt);
+		if (d->accept_paused && miniweb_connection_pool_active(&rt->pool) <
+			rt->config->max_conns) {
+			set_accept_paused(d, 0);
+			/* Drain what queued up in the backlogs. */
+			if (d->listen_fd >= 0)
+				handle_accept(d, d->listen_fd);
+			if (d->unix_fd >= 0)
+				handle_accept(d, d->unix_fd);
 		}
 		for (int i = 0; i < n; i++) {
 			struct kevent *ev = &events[i];
+			if (ev->filter == EVFILT_TIMER) {
+				if (ev->ident == HEARTBEAT_TIMER_IDENT)
+					heartbeat_kqueue_tick();
+				continue;
+			}
+			if (ev->filter == EVFILT_SIGNAL) {
+				server_reload(d, (int)ev->ident);
+				continue;
+			}
+			if ((int)ev->ident == rt->handoff_fd) {
+				handoff_check(d);
+				continue;
+			}
 			if ((int)ev->ident == rt->signal_pipe_rfd) {
 				drain_signal_pipe(rt->signal_pipe_rfd);
 				rt->running = 0;
 				continue;
 			}
-			if ((int)ev->ident == rt->listen_fd) {
-				handle_accept(rt);
+			if ((int)ev->ident == d->listen_fd ||
+				(int)ev->ident == d->unix_fd) {
+				handle_accept(d, (int)ev->ident);
 				continue;
 			}
 			int fd = (int)ev->ident;
-			miniweb_connection_t *conn = (miniweb_connection_t *)ev->udata;
+			miniweb_connection_t *conn = NULL;
 			if (fd < 0 || fd >= MINIWEB_MAX_CONNECTIONS ||
-				miniweb_connection_is_stale(&rt->pool, fd, conn))
+				!(conn = miniweb_connection_from_token(&rt->pool, ev->udata)))
 				continue;
 			if (ev->flags & (EV_EOF | EV_ERROR)) {
 				close(fd);
 				miniweb_connection_free(&rt->pool, fd);
 				continue;
 			}
-			if (miniweb_work_queue_push(&rt->queue, conn) < 0) {
+			if (dispatch_health(d, conn, fd)) {
+				counter_inc(CTR_HEALTH_CHECKS);
+				close(fd);
+				miniweb_connection_free(&rt->pool, fd);
+				continue;
+			}
+			/* From here the idle timer leaves it to the worker. */
+			(void)miniweb_connection_claim(conn);
+			conn->enqueued_ms = miniweb_worker_now_ms();
+			conn->trace_queued_ns = TRACE_NOW();
+			if (miniweb_work_queue_push(&d->queue, ev->udata) < 0) {
+				counter_inc(CTR_QUEUE_DROPS);
 				close(fd);
 				miniweb_connection_free(&rt->pool, fd);
+				continue;
+			}
+			counter_inc(CTR_EVENTS_QUEUED);
+		}
+	}
+	rt->running = 0;
+}
+
+/** Thread entry point for dispatcher shards 1..N-1. */
+static void *
+dispatcher_thread(void *arg)
+{
+	dispatcher_loop(arg);
+	return NULL;
+}
+
+/** Initialize listen sockets, kqueue dispatchers, queues/pool, and worker threads. */
+int
+miniweb_server_run(miniweb_server_runtime_t *rt)
+{
+	pthread_t threads[MINIWEB_THREAD_POOL_SIZE];
+	miniweb_worker_runtime_t worker_rt[MINIWEB_MAX_DISPATCHERS];
+	miniweb_worker_runtime_t slow_rt[MINIWEB_MAX_DISPATCHERS];
+	miniweb_worker_runtime_t owned_rt[MINIWEB_THREAD_POOL_SIZE];
+	int owned_kqs = 0;
+	int started_threads = 0;
+	int rc = -1;
+	int count = rt->config->dispatchers;
+
+	if (count < 1)
+		count = 1;
+	if (count > MINIWEB_MAX_DISPATCHERS)
+		count = MINIWEB_MAX_DISPATCHERS;
+	if (count > rt->config->threads)
+		count = rt->config->threads;
+
+	rt->running = 1;
+	rt->listen_fd = -1;
+	rt->unix_fd = -1;
+	rt->kq_fd = -1;
+	rt->signal_pipe_rfd = -1;
+	rt->signal_pipe_wfd = -1;
+	rt->dispatcher_count = 0;
+	rt->reject_started = 0;
+	rt->heartbeat_kqueue = 0;
+	rt->handoff_fd = -1;
+	rt->handoff_pid = -1;
+	rt->draining = 0;
+	miniweb_connection_pool_init(&rt->pool);
+	miniweb_work_queue_init(&rt->reject_queue);
+
+	rt->dispatchers = calloc((size_t)count, sizeof(*rt->dispatchers));
+	if (!rt->dispatchers)
+		goto out;
+	rt->dispatcher_count = count;
+	for (int i = 0; i < count; i++) {
+		miniweb_dispatcher_t *d = &rt->dispatchers[i];
+		d->index = i;
+		d->kq_fd = -1;
+		d->listen_fd = -1;
+		d->unix_fd = -1;
+		d->server = rt;
+		miniweb_work_queue_init(&d->queue);
+		miniweb_work_queue_init(&d->slow_queue);
+		miniweb_timer_wheel_init(&d->idle_wheel, time(NULL));
+		worker_rt[i] = (miniweb_worker_runtime_t){.running = &rt->running,
+			.kq_fd = &d->kq_fd,.config = rt->config,.queue = &d->queue,
+			.pool = &rt->pool,.own_kq_fd = -1};
+	}
+
+	int signal_pipe[2];
+	if (pipe(signal_pipe) < 0)
+		goto out;
+	rt->signal_pipe_rfd = signal_pipe[0];
+	rt->signal_pipe_wfd = signal_pipe[1];
+	set_nonblock(rt->signal_pipe_rfd);
+	set_nonblock(rt->signal_pipe_wfd);
+
+	/* The Unix listener first: it may sit at a TCP shard's index. */
+	if (rt->config->unix_socket[0] != '\0') {
+		if ((rt->unix_fd = open_unix_listener(rt)) < 0)
+			goto out;
+		log_info("Listening on %s", rt->config->unix_socket);
+	}
+	if (rt->config->listen_tcp) {
+		rt->listen_fd = open_listener(rt);
+		if (rt->listen_fd < 0)
+			goto out;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (dispatcher_setup(&rt->dispatchers[i]) != 0)
+			goto out;
+	}
+	rt->kq_fd = rt->dispatchers[0].kq_fd;
+
+	if (rt->config->worker_kqueue) {
+		for (int i = 0; i < rt->config->threads; i++) {
+			struct kevent chg;
+			miniweb_dispatcher_t *d = &rt->dispatchers[i % count];
+			owned_rt[i] = worker_rt[i % count];
+			owned_rt[i].own_kq_fd = kqueue();
+			if (owned_rt[i].own_kq_fd < 0)
+				goto out;
+			owned_kqs++;
+			owned_rt[i].kq_fd = &owned_rt[i].own_kq_fd;
+			EV_SET(&chg, rt->signal_pipe_rfd, EVFILT_READ, EV_ADD | EV_CLEAR,
+				0, 0, NULL);
+			(void)kevent(owned_rt[i].own_kq_fd, &chg, 1, NULL, 0, NULL);
+			d->worker_kq[d->worker_count++] = owned_rt[i].own_kq_fd;
+		}
+	}
+
+	if (rt->config->worker_kqueue) {
+		for (int i = 0; i < rt->config->threads; i++) {
+			if (pthread_create(&threads[i], NULL,
+				miniweb_worker_kqueue_thread, &owned_rt[i]) != 0) {
+				log_error("pthread_create failed for worker %d", i);
+				goto out;
+			}
+			started_threads++;
+		}
+	} else {
+		int max_threads = rt->config->max_threads > rt->config->threads ?
+			rt->config->max_threads : rt->config->threads;
+		int slow_threads = rt->config->slow_threads;
+		for (int i = 0; i < count; i++) {
+			miniweb_dispatcher_t *d = &rt->dispatchers[i];
+			int min_i = rt->config->threads / count +
+				(i < rt->config->threads % count);
+			int max_i = max_threads / count + (i < max_threads % count);
+			int slow_i = slow_threads / count + (i < slow_threads % count);
+			if (slow_i > 0) {
+				worker_rt[i].lanes[ROUTE_CLASS_FAST] = &d->queue;
+				worker_rt[i].lanes[ROUTE_CLASS_SLOW] = &d->slow_queue;
+				slow_rt[i] = worker_rt[i];
+				slow_rt[i].queue = &d->slow_queue;
+				slow_rt[i].lane = ROUTE_CLASS_SLOW;
+				d->slow_started = 1;
+				if (miniweb_worker_pool_start(&d->slow_workers, &slow_rt[i],
+					slow_i, slow_i, 0) != 0) {
+					log_error("slow lane start failed for dispatcher %d", i);
+					goto out;
+				}
+			}
+			d->workers_started = 1;
+			if (miniweb_worker_pool_start(&d->workers, &worker_rt[i],
+				min_i, max_i, rt->config->thread_idle_timeout * 1000) != 0) {
+				log_error("worker pool start failed for dispatcher %d", i);
+				goto out;
 			}
 		}
+		if (max_threads > rt->config->threads)
+			log_info("Elastic worker pool: %d..%d threads",
+				rt->config->threads, max_threads);
+		if (slow_threads > 0)
+			log_info("Slow route lane: %d reserved threads", slow_threads);
+		heartbeat_attach(rt);
 	}
 
+	if (rt->config->overload_503) {
+		if (pthread_create(&rt->reject_thread, NULL, reject_thread, rt) != 0)
+			log_error("pthread_create failed for reject thread");
+		else
+			rt->reject_started = 1;
+	}
+
+	for (int i = 1; i < count; i++) {
+		miniweb_dispatcher_t *d = &rt->dispatchers[i];
+		if (pthread_create(&d->thread, NULL, dispatcher_thread, d) != 0) {
+			log_error("pthread_create failed for dispatcher %d", i);
+			goto out;
+		}
+		d->thread_started = 1;
+	}
+	if (count > 1)
+		log_info("Running %d dispatcher shards on one listener", count);
+	if (rt->config->worker_kqueue)
+		log_info("Connections owned by workers (per-worker kqueue)");
+	handoff_ready();
+
+	dispatcher_loop(&rt->dispatchers[0]);
 	rc = 0;
 
 out:
 	rt->running = 0;
-	miniweb_work_queue_broadcast_shutdown(&rt->queue);
+	if (rt->signal_pipe_wfd >= 0) {
+		const char b = 'x';
+		(void)write(rt->signal_pipe_wfd, &b, 1);
+	}
+	for (int i = 0; i < rt->dispatcher_count; i++) {
+		miniweb_dispatcher_t *d = &rt->dispatchers[i];
+		if (d->thread_started)
+			pthread_join(d->thread, NULL);
+		miniweb_work_queue_broadcast_shutdown(&d->queue);
+		miniweb_work_queue_broadcast_shutdown(&d->slow_queue);
+	}
 	for (int i = 0; i < started_threads; i++)
 		pthread_join(threads[i], NULL);
-	if (rt->kq_fd >= 0) {
-		close(rt->kq_fd);
-		rt->kq_fd = -1;
+	for (int i = 0; i < rt->dispatcher_count; i++) {
+		miniweb_dispatcher_t *d = &rt->dispatchers[i];
+		if (d->workers_started)
+			miniweb_worker_pool_join(&d->workers);
+		if (d->slow_started)
+			miniweb_worker_pool_join(&d->slow_workers);
+	}
+	if (rt->heartbeat_kqueue) {
+		/* Before its kqueue closes; the thread takes over again. */
+		(void)heartbeat_use_thread();
+		rt->heartbeat_kqueue = 0;
+	}
+	if (rt->reject_started) {
+		miniweb_work_queue_broadcast_shutdown(&rt->reject_queue);
+		pthread_join(rt->reject_thread, NULL);
+		rt->reject_started = 0;
+		void *item;
+		while ((item = miniweb_work_queue_try_pop(&rt->reject_queue)) != NULL)
+			close((int)((intptr_t)item - 1));
+	}
+	for (int i = 0; i < owned_kqs; i++)
+		close(owned_rt[i].own_kq_fd);
+	for (int i = 0; i < rt->dispatcher_count; i++) {
+		miniweb_dispatcher_t *d = &rt->dispatchers[i];
+		if (d->kq_fd >= 0)
+			close(d->kq_fd);
+		miniweb_timer_wheel_destroy(&d->idle_wheel);
 	}
+	free(rt->dispatchers);
+	rt->dispatchers = NULL;
+	rt->dispatcher_count = 0;
+	rt->kq_fd = -1;
 	if (rt->listen_fd >= 0) {
 		close(rt->listen_fd);
 		rt->listen_fd = -1;
 	}
+	if (rt->unix_fd >= 0) {
+		close(rt->unix_fd);
+		rt->unix_fd = -1;
+		/* Unless a successor holds it, the socket file goes too. */
+		if (rt->handoff_pid < 0)
+			(void)unlink(rt->config->unix_socket);
+	}
 	if (rt->signal_pipe_rfd >= 0) {
 		close(rt->signal_pipe_rfd);
 		rt->signal_pipe_rfd = -1;
@@ -231,6 +864,10 @@ out:
 		close(rt->signal_pipe_wfd);
 		rt->signal_pipe_wfd = -1;
 	}
+	if (rt->handoff_fd >= 0) {
+		close(rt->handoff_fd);
+		rt->handoff_fd = -1;
+	}
 	return rc;
 }
 
@@ -248,3 +885,10 @@ miniweb_server_stop(miniweb_server_runtime_t *rt)
 	}
 	errno = saved_errno;
 }
+
+/** Whether a successor took over and this process is draining. */
+int
+miniweb_server_draining(void)
+{
+	return server_draining;
+}
@@ -0,0 +1,99 @@
+#include <miniweb/net/timer_wheel.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/counters.h>
+
+#define WHEEL_MASK (MINIWEB_TIMER_WHEEL_SLOTS - 1)
+
+/** Initialize an empty wheel whose cursor starts at @p now. */
+void
+miniweb_timer_wheel_init(miniweb_timer_wheel_t *w, time_t now)
+{
+	memset(w, 0, sizeof(*w));
+	w->last_tick = now;
+}
+
+/** Append one entry to the slot for @p deadline; returns -1 on OOM. */
+int
+miniweb_timer_wheel_add(miniweb_timer_wheel_t *w, int fd, unsigned gen,
+    time_t deadline)
+{
+	if (deadline <= w->last_tick)
+		deadline = w->last_tick + 1;
+	miniweb_timer_slot_t *s = &w->slots[(size_t)deadline & WHEEL_MASK];
+	if (s->count == s->cap) {
+		int ncap = s->cap ? s->cap * 2 : 16;
+		miniweb_timer_entry_t *n = realloc(s->items,
+			(size_t)ncap * sizeof(*n));
+		if (!n)
+			return -1;
+		s->items = n;
+		s->cap = ncap;
+	}
+	s->items[s->count++] = (miniweb_timer_entry_t){.fd = fd,.gen = gen,
+		.deadline = deadline};
+	return 0;
+}
+
+/**
+ * Process every tick between the last call and @p now.
+ * Only entries hashed to the elapsed slots are touched, so the cost tracks
+ * the number of connections falling due rather than the table size.
+ * An entry that cannot move to its new slot for lack of memory stays
+ * where it is and is checked again when this slot comes round.
+ * Returns the number of entries handed to @p check.
+ */
+int
+miniweb_timer_wheel_advance(miniweb_timer_wheel_t *w, time_t now,
+    miniweb_timer_check_fn check, void *ctx)
+{
+	int checked = 0;
+	time_t tick = w->last_tick;
+
+	if (now - tick > MINIWEB_TIMER_WHEEL_SLOTS)
+		tick = now - MINIWEB_TIMER_WHEEL_SLOTS;
+	while (tick < now) {
+		tick++;
+		w->last_tick = tick;
+		size_t slot = (size_t)tick & WHEEL_MASK;
+		miniweb_timer_slot_t *s = &w->slots[slot];
+		int keep = 0;
+
+		/* Compact in place; entries re-armed elsewhere move to their slot. */
+		for (int i = 0; i < s->count; i++) {
+			miniweb_timer_entry_t e = s->items[i];
+			if (e.deadline <= now) {
+				checked++;
+				e.deadline = check(ctx, e.fd, e.gen, now);
+				if (e.deadline == 0)
+					continue;
+				if (e.deadline <= now)
+					e.deadline = now + 1;
+				if (((size_t)e.deadline & WHEEL_MASK) != slot) {
+					if (miniweb_timer_wheel_add(w, e.fd,
+					    e.gen, e.deadline) == 0)
+						continue;
+					counter_inc(CTR_TIMER_REARM_FAILURES);
+				}
+			}
+			s->items[keep++] = e;
+		}
+		s->count = keep;
+	}
+	w->last_tick = now;
+	return checked;
+}
+
+/** Release all slot storage. */
+void
+miniweb_timer_wheel_destroy(miniweb_timer_wheel_t *w)
+{
+	for (int i = 0; i < MINIWEB_TIMER_WHEEL_SLOTS; i++) {
+		free(w->slots[i].items);
+		w->slots[i].items = NULL;
+		w->slots[i].count = 0;
+		w->slots[i].cap = 0;
+	}
+}
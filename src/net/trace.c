@@ -0,0 +1,333 @@
+/* trace.c - per-request phase timestamps kept in per-thread rings */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/net/trace.h>
+
+/*
+ * Same layout as the counters and route stats: each serving thread owns
+ * a block, reached through a pthread key and created on its first traced
+ * request, and only that thread writes it. A ring slot carries a
+ * sequence number that is odd while the owner rewrites it, so a reader
+ * copies the slot and keeps the copy only when the number was even and
+ * unchanged around it. Readers walk the blocks under trace_lock; a
+ * thread that exits takes its rings with it.
+ */
+
+typedef struct {
+	unsigned int seq;
+	trace_record_t r;
+} trace_slot_t;
+
+typedef struct trace_block {
+	trace_record_t cur;		/* request in progress */
+	int active;
+	unsigned int id;
+	unsigned int recent_head;	/* slots written, ever */
+	unsigned int slow_head;
+	trace_slot_t recent[TRACE_RING];
+	trace_slot_t slow[TRACE_SLOW_RING];
+	struct trace_block *next;
+} trace_block_t;
+
+int trace_on;
+static uint64_t trace_slow_ns;
+
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static int trace_key_ok;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_block_t *trace_blocks;
+static unsigned int trace_next_id;
+
+static const char *const trace_phase_names[TRACE_PHASES] = {
+	[TRACE_PH_QUEUE] = "queue",
+	[TRACE_PH_RECV] = "recv",
+	[TRACE_PH_PARSE] = "parse",
+	[TRACE_PH_ROUTE] = "route",
+	[TRACE_PH_HANDLER] = "handler",
+	[TRACE_PH_SUBPROCESS] = "subprocess",
+	[TRACE_PH_WRITE_WAIT] = "write_wait",
+	[TRACE_PH_FINISH] = "finish",
+};
+
+/** pthread_key destructor: unlink and drop a departing thread's rings. */
+static void
+trace_thread_free(void *p)
+{
+	trace_block_t *blk = p;
+	trace_block_t **pp;
+
+	pthread_mutex_lock(&trace_lock);
+	for (pp = &trace_blocks; *pp; pp = &(*pp)->next) {
+		if (*pp == blk) {
+			*pp = blk->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	free(blk);
+}
+
+static void
+trace_key_init(void)
+{
+	trace_key_ok = pthread_key_create(&trace_key, trace_thread_free) == 0;
+}
+
+/** Calling thread's block, created on first use; NULL if unavailable. */
+static trace_block_t *
+trace_thread(int create)
+{
+	trace_block_t *blk;
+
+	(void)pthread_once(&trace_once, trace_key_init);
+	if (!trace_key_ok)
+		return NULL;
+	blk = pthread_getspecific(trace_key);
+	if (blk || !create)
+		return blk;
+	if ((blk = calloc(1, sizeof(*blk))) == NULL)
+		return NULL;
+	if (pthread_setspecific(trace_key, blk) != 0) {
+		free(blk);
+		return NULL;
+	}
+	pthread_mutex_lock(&trace_lock);
+	blk->id = trace_next_id++;
+	blk->next = trace_blocks;
+	trace_blocks = blk;
+	pthread_mutex_unlock(&trace_lock);
+	return blk;
+}
+
+void
+trace_enable(int slow_ms)
+{
+	__atomic_store_n(&trace_slow_ns,
+	    slow_ms > 0 ? (uint64_t)slow_ms * 1000000 : 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&trace_on, slow_ms > 0, __ATOMIC_RELAXED);
+}
+
+int
+trace_slow_ms(void)
+{
+	return (int)(__atomic_load_n(&trace_slow_ns, __ATOMIC_RELAXED) /
+	    1000000);
+}
+
+uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Start the calling thread's record, dropping one left unfinished
+ * (a request whose head has not fully arrived starts over when the
+ * connection is read again).
+ *
+ * @param queued_ns Monotonic time of the queue push that brought the
+ * connection here, or 0.
+ */
+void
+trace_begin(uint64_t queued_ns)
+{
+	trace_block_t *blk;
+
+	if ((blk = trace_thread(1)) == NULL)
+		return;
+	memset(&blk->cur, 0, sizeof(blk->cur));
+	blk->cur.start_ns = trace_now();
+	if (queued_ns != 0 && queued_ns < blk->cur.start_ns)
+		blk->cur.queue_ns = blk->cur.start_ns - queued_ns;
+	blk->active = 1;
+}
+
+void
+trace_mark(trace_mark_t m)
+{
+	trace_block_t *blk = trace_thread(0);
+
+	if (blk && blk->active && m < TRACE_MARKS)
+		blk->cur.at[m] = trace_now() - blk->cur.start_ns;
+}
+
+void
+trace_wait(trace_wait_t w, uint64_t since)
+{
+	trace_block_t *blk = trace_thread(0);
+	uint64_t now;
+
+	if (!blk || !blk->active || w >= TRACE_WAITS)
+		return;
+	now = trace_now();
+	if (now > since)
+		blk->cur.wait[w] += now - since;
+}
+
+/** Write @p r into the next slot of a @p n slot ring. */
+static void
+trace_put(trace_slot_t *ring, unsigned int n, unsigned int *head,
+    const trace_record_t *r)
+{
+	trace_slot_t *s = &ring[*head % n];
+	unsigned int seq = s->seq;
+
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->r = *r;
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(head, *head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Finish the calling thread's record and file it.
+ *
+ * @param route_id Route id, or ROUTE_STATS_UNMATCHED.
+ * @param status Status sent.
+ * @param bytes Bytes handed to the socket.
+ * @param path Request target; only the first TRACE_PATH_MAX - 1 bytes
+ * are kept.
+ * @param path_len Length of @p path.
+ */
+void
+trace_end(int route_id, int status, size_t bytes, const char *path,
+    size_t path_len)
+{
+	trace_block_t *blk = trace_thread(0);
+	trace_record_t *r;
+	uint64_t slow;
+
+	if (!blk || !blk->active)
+		return;
+	blk->active = 0;
+	r = &blk->cur;
+	r->total_ns = trace_now() - r->start_ns;
+	r->route_id = route_id;
+	r->status = status;
+	r->bytes = bytes;
+	r->thread = blk->id;
+	if (path_len >= sizeof(r->path))
+		path_len = sizeof(r->path) - 1;
+	memcpy(r->path, path, path_len);
+	r->path[path_len] = '\0';
+
+	trace_put(blk->recent, TRACE_RING, &blk->recent_head, r);
+	slow = __atomic_load_n(&trace_slow_ns, __ATOMIC_RELAXED);
+	if (slow > 0 && r->total_ns >= slow)
+		trace_put(blk->slow, TRACE_SLOW_RING, &blk->slow_head, r);
+}
+
+/** Copy slot @p s into @p out unless its owner is rewriting it. */
+static int
+trace_read_slot(const trace_slot_t *s, trace_record_t *out)
+{
+	unsigned int before, after;
+
+	before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+	if (before == 0 || (before & 1))
+		return 0;
+	memcpy(out, &s->r, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+	return before == after;
+}
+
+static int
+trace_cmp_newest(const void *a, const void *b)
+{
+	const trace_record_t *x = a, *y = b;
+
+	if (x->start_ns != y->start_ns)
+		return x->start_ns < y->start_ns ? 1 : -1;
+	return 0;
+}
+
+/**
+ * @brief Gather records from every thread, newest first.
+ *
+ * @details Every live slot is read, which is at most TRACE_RING (or
+ * TRACE_SLOW_RING) per thread; when there are more than @p max the
+ * oldest are dropped after sorting.
+ */
+size_t
+trace_snapshot(trace_record_t *out, size_t max, int slow)
+{
+	unsigned int n = slow ? TRACE_SLOW_RING : TRACE_RING;
+	trace_record_t *all;
+	size_t cap = 0, got = 0;
+
+	if (max == 0)
+		return 0;
+	pthread_mutex_lock(&trace_lock);
+	for (trace_block_t *blk = trace_blocks; blk; blk = blk->next)
+		cap += n;
+	if (cap == 0 || (all = calloc(cap, sizeof(*all))) == NULL) {
+		pthread_mutex_unlock(&trace_lock);
+		return 0;
+	}
+	for (trace_block_t *blk = trace_blocks; blk; blk = blk->next) {
+		const trace_slot_t *ring = slow ? blk->slow : blk->recent;
+
+		for (unsigned int i = 0; i < n && got < cap; i++)
+			if (trace_read_slot(&ring[i], &all[got]))
+				got++;
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	qsort(all, got, sizeof(*all), trace_cmp_newest);
+	if (got > max)
+		got = max;
+	memcpy(out, all, got * sizeof(*out));
+	free(all);
+	return got;
+}
+
+/** @p a - @p b, or 0 when the clock readings came out of order. */
+static uint64_t
+trace_sub(uint64_t a, uint64_t b)
+{
+	return a > b ? a - b : 0;
+}
+
+/**
+ * @brief Split a record into phases that add up to its total time.
+ *
+ * @details A boundary that was not reached (the handler failed, say)
+ * counts as the one before it. The subprocess and write waits run
+ * inside the handler and come out of its share; recv waits come out of
+ * the parse share.
+ */
+void
+trace_phases(const trace_record_t *r, uint64_t out[TRACE_PHASES])
+{
+	uint64_t parsed, routed, handled, inner;
+
+	parsed = r->at[TRACE_PARSED];
+	routed = r->at[TRACE_ROUTED] ? r->at[TRACE_ROUTED] : parsed;
+	handled = r->at[TRACE_HANDLED] ? r->at[TRACE_HANDLED] : routed;
+	inner = r->wait[TRACE_WAIT_SUBPROCESS] + r->wait[TRACE_WAIT_WRITE];
+
+	out[TRACE_PH_QUEUE] = r->queue_ns;
+	out[TRACE_PH_RECV] = r->wait[TRACE_WAIT_RECV];
+	out[TRACE_PH_PARSE] = trace_sub(parsed, r->wait[TRACE_WAIT_RECV]);
+	out[TRACE_PH_ROUTE] = trace_sub(routed, parsed);
+	out[TRACE_PH_HANDLER] = trace_sub(trace_sub(handled, routed), inner);
+	out[TRACE_PH_SUBPROCESS] = r->wait[TRACE_WAIT_SUBPROCESS];
+	out[TRACE_PH_WRITE_WAIT] = r->wait[TRACE_WAIT_WRITE];
+	out[TRACE_PH_FINISH] = trace_sub(r->total_ns, handled);
+}
+
+const char *
+trace_phase_name(trace_phase_t p)
+{
+	return p < TRACE_PHASES ? trace_phase_names[p] : "unknown";
+}
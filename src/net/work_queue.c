@@ -1,13 +1,25 @@
 
 #include <miniweb/net/work_queue.h>
 
+#include <errno.h>
 #include <string.h>
+#include <time.h>
 
-/** Initialize a thread-safe FIFO work queue. */
+#include <miniweb/core/counters.h>
+#include <miniweb/core/lockstat.h>
+
+#define QUEUE_MASK (MINIWEB_QUEUE_CAPACITY - 1)
+#define QUEUE_SPIN_TRIES 64
+
+LOCKSTAT_SITE(lockstat_work_queue, "work_queue");
+
+/** Initialize a lock-free bounded FIFO work queue. */
 void
 miniweb_work_queue_init(miniweb_work_queue_t *q)
 {
 	memset(q, 0, sizeof(*q));
+	for (unsigned long i = 0; i < MINIWEB_QUEUE_CAPACITY; i++)
+		q->cells[i].seq = i;
 	pthread_mutex_init(&q->lock, NULL);
 	pthread_cond_init(&q->not_empty, NULL);
 }
@@ -16,44 +28,142 @@ miniweb_work_queue_init(miniweb_work_queue_t *q)
 int
 miniweb_work_queue_push(miniweb_work_queue_t *q, void *item)
 {
-	pthread_mutex_lock(&q->lock);
-	if (q->count >= MINIWEB_QUEUE_CAPACITY) {
-		pthread_mutex_unlock(&q->lock);
-		return -1;
+	miniweb_work_cell_t *cell;
+	unsigned long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		cell = &q->cells[pos & QUEUE_MASK];
+		unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			counter_inc(CTR_QUEUE_FULL);
+			return -1;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->item = item;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	counter_inc(CTR_QUEUE_PUSHES);
+
+	/*
+	 * Pairs with the waiters increment in pop(): either the parked
+	 * consumer re-checks the ring after we published, or we see it here.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED) > 0) {
+		LOCKSTAT_LOCK(&q->lock, lockstat_work_queue);
+		pthread_cond_signal(&q->not_empty);
+		LOCKSTAT_UNLOCK(&q->lock, lockstat_work_queue);
 	}
-	q->items[q->tail] = item;
-	q->tail = (q->tail + 1) % MINIWEB_QUEUE_CAPACITY;
-	q->count++;
-	pthread_cond_signal(&q->not_empty);
-	pthread_mutex_unlock(&q->lock);
 	return 0;
 }
 
+/** Pop one item without blocking; returns NULL when the ring is empty. */
+void *
+miniweb_work_queue_try_pop(miniweb_work_queue_t *q)
+{
+	miniweb_work_cell_t *cell;
+	unsigned long pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		cell = &q->cells[pos & QUEUE_MASK];
+		unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	void *item = cell->item;
+	__atomic_store_n(&cell->seq, pos + MINIWEB_QUEUE_CAPACITY,
+		__ATOMIC_RELEASE);
+	return item;
+}
+
 /** Pop one item, blocking until available or shutdown is requested. */
 void *
 miniweb_work_queue_pop(miniweb_work_queue_t *q, volatile sig_atomic_t *running)
 {
 	void *item;
 
-	pthread_mutex_lock(&q->lock);
-	while (q->count == 0 && *running)
-		pthread_cond_wait(&q->not_empty, &q->lock);
-	if (q->count == 0) {
-		pthread_mutex_unlock(&q->lock);
-		return NULL;
+	for (int i = 0; i < QUEUE_SPIN_TRIES; i++) {
+		if ((item = miniweb_work_queue_try_pop(q)) != NULL)
+			return item;
+	}
+
+	counter_inc(CTR_QUEUE_WAITS);
+	LOCKSTAT_LOCK(&q->lock, lockstat_work_queue);
+	__atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while ((item = miniweb_work_queue_try_pop(q)) == NULL && *running)
+		LOCKSTAT_COND_WAIT(&q->not_empty, &q->lock, lockstat_work_queue);
+	__atomic_sub_fetch(&q->waiters, 1, __ATOMIC_RELAXED);
+	LOCKSTAT_UNLOCK(&q->lock, lockstat_work_queue);
+	return item;
+}
+
+/**
+ * Like miniweb_work_queue_pop() but give up after @p timeout_ms; returns
+ * NULL on timeout as well as on shutdown.
+ */
+void *
+miniweb_work_queue_pop_timed(miniweb_work_queue_t *q,
+    volatile sig_atomic_t *running, int timeout_ms)
+{
+	struct timespec deadline;
+	void *item;
+	int rc = 0;
+
+	for (int i = 0; i < QUEUE_SPIN_TRIES; i++) {
+		if ((item = miniweb_work_queue_try_pop(q)) != NULL)
+			return item;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
 	}
-	item = q->items[q->head];
-	q->head = (q->head + 1) % MINIWEB_QUEUE_CAPACITY;
-	q->count--;
-	pthread_mutex_unlock(&q->lock);
+
+	counter_inc(CTR_QUEUE_WAITS);
+	LOCKSTAT_LOCK(&q->lock, lockstat_work_queue);
+	__atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while ((item = miniweb_work_queue_try_pop(q)) == NULL && *running &&
+		rc != ETIMEDOUT)
+		rc = LOCKSTAT_COND_TIMEDWAIT(&q->not_empty, &q->lock,
+		    lockstat_work_queue, &deadline);
+	__atomic_sub_fetch(&q->waiters, 1, __ATOMIC_RELAXED);
+	LOCKSTAT_UNLOCK(&q->lock, lockstat_work_queue);
 	return item;
 }
 
+/** Approximate number of queued items (exact when producers are idle). */
+unsigned long
+miniweb_work_queue_depth(miniweb_work_queue_t *q)
+{
+	unsigned long head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	unsigned long tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	return tail > head ? tail - head : 0;
+}
+
 /** Wake all waiting workers so they can observe shutdown state. */
 void
 miniweb_work_queue_broadcast_shutdown(miniweb_work_queue_t *q)
 {
-	pthread_mutex_lock(&q->lock);
+	LOCKSTAT_LOCK(&q->lock, lockstat_work_queue);
 	pthread_cond_broadcast(&q->not_empty);
-	pthread_mutex_unlock(&q->lock);
+	LOCKSTAT_UNLOCK(&q->lock, lockstat_work_queue);
 }
@@ -2,127 +2,500 @@
 #include <miniweb/net/worker.h>
 
 #include <errno.h>
-#include <strings.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <miniweb/core/counters.h>
 #include <miniweb/http/handler.h>
+#include <miniweb/net/access_log.h>
+#include <miniweb/net/h2.h>
+#include <miniweb/net/keepalive.h>
+#include <miniweb/net/rate_limit.h>
+#include <miniweb/net/request_buffer.h>
+#include <miniweb/net/server.h>
+#include <miniweb/net/trace.h>
+#include <miniweb/router/response_cache.h>
+#include <miniweb/router/route_stats.h>
 #include <miniweb/router/routes.h>
 #include <miniweb/router/urls.h>
 
-#define MAX_KEEPALIVE_REQUESTS 64
+static const counter_id_t lane_shed[MINIWEB_WORKER_LANES] = {
+	CTR_SHED_FAST, CTR_SHED_SLOW
+};
 
-/** Parse the HTTP request start line into method/path/version buffers. */
+/** Emit a compact error response on fatal worker-side parsing/read errors. */
+static void
+send_error_response(int fd, int code, const char *msg)
+{
+	http_request_t req = {.fd = fd, .method = "GET", .url = "/",
+		.version = "HTTP/1.1", .keep_alive = 0};
+		(void)http_send_error(&req, code, msg);
+	if (code == 503)
+		counter_inc(CTR_STATUS_503);
+}
+
+/**
+ * Close fd and release pool bookkeeping. close(2) removes the fd's
+ * knotes, so the only kqueue work left is forgetting changes still
+ * queued for it; the fd number may be reused by the next accept.
+ */
+static void
+close_connection(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	int fd)
+{
+	int keep = 0;
+	for (int i = 0; i < chg->n; i++)
+		if ((int)chg->ev[i].ident != fd)
+			chg->ev[keep++] = chg->ev[i];
+	chg->n = keep;
+	close(fd);
+	miniweb_connection_free(rt->pool, fd);
+}
+
+/**
+ * Submit the batch on its own. EV_RECEIPT makes the kernel report every
+ * change instead of stopping at the first failure, and the call returns
+ * with the receipts without dequeuing events, so it is safe on a kqueue
+ * the dispatcher is polling. A failed re-arm leaves the connection with
+ * nobody to wake it, so it is closed here unless the idle timer already
+ * took it.
+ */
+void
+miniweb_worker_changes_flush(miniweb_worker_runtime_t *rt,
+	miniweb_worker_changes_t *chg)
+{
+	struct kevent res[MINIWEB_WORKER_CHANGE_BATCH];
+	struct timespec zero = {0, 0};
+	int n = chg->n;
+
+	if (n == 0)
+		return;
+	for (int i = 0; i < n; i++)
+		chg->ev[i].flags |= EV_RECEIPT;
+	int got = kevent(*rt->kq_fd, chg->ev, n, res, n, &zero);
+	chg->n = 0;
+	counter_inc(CTR_KEVENT_CALLS);
+	for (int i = 0; i < got; i++) {
+		if (!(res[i].flags & EV_ERROR) || res[i].data == 0)
+			continue;
+		miniweb_connection_t *conn =
+			miniweb_connection_from_token(rt->pool, res[i].udata);
+		if (conn && miniweb_connection_claim(conn))
+			close_connection(rt, chg, conn->fd);
+	}
+}
+
+/** Queue one change, submitting the batch first when it is full. */
 static int
-parse_request_line(const char *buf, char *method, char *url, char *version)
+queue_change(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	int fd, short filter, unsigned short flags, void *udata)
 {
-	const char *sp1 = strchr(buf, ' ');
-	if (!sp1 || sp1 == buf)
-		return -1;
-	const char *sp2 = strchr(sp1 + 1, ' ');
-	const char *eol = sp2 ? strstr(sp2 + 1, "\r\n") : NULL;
-	if (!sp2 || !eol || sp2 == sp1 + 1 || eol == sp2 + 1)
-		return -1;
-	size_t mlen = (size_t)(sp1 - buf), ulen = (size_t)(sp2 - (sp1 + 1));
-	size_t vlen = (size_t)(eol - (sp2 + 1));
-	if (mlen >= 32 || ulen >= 512 || vlen >= 32)
-		return -1;
-	memcpy(method, buf, mlen); method[mlen] = '\0';
-	memcpy(url, sp1 + 1, ulen); url[ulen] = '\0';
-	memcpy(version, sp2 + 1, vlen); version[vlen] = '\0';
-	return 0;
+	if (chg->n == MINIWEB_WORKER_CHANGE_BATCH)
+		miniweb_worker_changes_flush(rt, chg);
+	EV_SET(&chg->ev[chg->n], fd, filter, flags, 0, 0, udata);
+	chg->n++;
+	counter_inc(CTR_KEVENT_CHANGES);
+	return 1;
 }
 
-/** Return pointer to CRLF-CRLF request header terminator when complete. */
-static const char *
-find_header_end(const char *buf)
+/** kevent() changes queued and submissions made by all workers so far. */
+void
+miniweb_worker_change_counts(unsigned long *changes, unsigned long *calls)
 {
-	return strstr(buf, "\r\n\r\n");
+	uint64_t v[CTR_COUNT];
+
+	counters_read(v);
+	*changes = (unsigned long)v[CTR_KEVENT_CHANGES];
+	*calls = (unsigned long)v[CTR_KEVENT_CALLS];
 }
 
-/** Resolve keep-alive behavior from HTTP version and Connection header. */
+/** Re-enable the EV_DISPATCH read filter for this connection. */
 static int
-request_keep_alive(const char *buf, const char *version)
-{
-	int is_http11 = (strcmp(version, "HTTP/1.1") == 0);
-	const char *p = buf;
-	while ((p = strcasestr(p, "\r\nConnection:")) != NULL) {
-		p += 13;
-		while (*p == ' ' || *p == '\t') p++;
-		if (strncasecmp(p, "close", 5) == 0) return 0;
-		if (strncasecmp(p, "keep-alive", 10) == 0) return 1;
-	}
-	return is_http11 ? 1 : 0;
+rearm_read(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	miniweb_connection_t *conn)
+{
+	miniweb_connection_release(conn);
+	return queue_change(rt, chg, conn->fd, EVFILT_READ, EV_ENABLE,
+		miniweb_connection_token(conn));
 }
 
-/** Emit a compact error response on fatal worker-side parsing/read errors. */
-static void
-send_error_response(int fd, int code, const char *msg)
+/**
+ * Park the connection until the socket drains: a one-shot EVFILT_WRITE
+ * brings the token back to a worker, which resumes the flush. The read
+ * filter stays disabled meanwhile so responses cannot be reordered.
+ */
+static int
+arm_write(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	miniweb_connection_t *conn)
 {
-	http_request_t req = {.fd = fd, .method = "GET", .url = "/",
-		.version = "HTTP/1.1", .keep_alive = 0};
-		(void)http_send_error(&req, code, msg);
+	counter_inc(CTR_WRITE_PARKED);
+	miniweb_connection_release(conn);
+	return queue_change(rt, chg, conn->fd, EVFILT_WRITE,
+		EV_ADD | EV_ENABLE | EV_DISPATCH, miniweb_connection_token(conn));
 }
 
-/** Close fd, remove kevent registration, and release pool bookkeeping. */
+/** Return the request buffer of an idle connection to its size class. */
 static void
-close_connection(miniweb_worker_runtime_t *rt, int fd)
+release_buffer(miniweb_connection_t *conn)
 {
-	struct kevent ev;
-	EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-	(void)kevent(*rt->kq_fd, &ev, 1, NULL, 0, NULL);
-	close(fd);
-	miniweb_connection_free(rt->pool, fd);
+	miniweb_reqbuf_put(conn->buffer, conn->buffer_cap);
+	conn->buffer = NULL;
+	conn->buffer_cap = 0;
 }
 
-/** Re-enable EV_DISPATCH socket for next keep-alive request lifecycle. */
+/**
+ * Make room for the next recv(): attach the smallest buffer on the first
+ * read, then step up a class whenever the current one fills, up to
+ * @p limit bytes. Returns 0 when no buffer could be provided.
+ */
 static int
-try_rearm_keepalive(miniweb_worker_runtime_t *rt, miniweb_connection_t *conn)
+reserve_buffer(miniweb_connection_t *conn, size_t limit)
 {
-	if (!conn || conn->requests_served >= MAX_KEEPALIVE_REQUESTS)
+	if (!conn->buffer) {
+		conn->buffer = miniweb_reqbuf_get(MINIWEB_REQBUF_SMALL,
+			&conn->buffer_cap);
+		return conn->buffer != NULL;
+	}
+	if (conn->bytes_read + 1 < conn->buffer_cap ||
+	    conn->buffer_cap >= limit)
+		return 1;
+	char *nbuf = miniweb_reqbuf_grow(conn->buffer, conn->bytes_read + 1,
+		&conn->buffer_cap);
+	if (!nbuf)
 		return 0;
+	conn->buffer = nbuf;
+	return 1;
+}
+
+/**
+ * Drop the request just served, head and Content-Length body, and shift
+ * any pipelined bytes that followed it to the front of the buffer. No
+ * handler reads a body; what has not arrived yet is left in body_left
+ * for drop_body(), so none of it is ever parsed as a request.
+ */
+static void
+consume_request(miniweb_connection_t *conn)
+{
 	conn->requests_served++;
-	conn->bytes_read = 0;
-	conn->buffer[0] = '\0';
+	size_t used = conn->parser.head_len;
+	size_t left = conn->bytes_read > used ? conn->bytes_read - used : 0;
+	uint64_t body = conn->parser.body == HTTP_BODY_LENGTH ?
+		conn->parser.content_length : 0;
+	if (body >= left) {
+		conn->body_left = body - left;
+		used += left;
+		left = 0;
+	} else {
+		used += (size_t)body;
+		left -= (size_t)body;
+	}
+	if (left > 0)
+		memmove(conn->buffer, conn->buffer + used, left);
+	conn->bytes_read = left;
+	conn->buffer[left] = '\0';
+	http_request_parser_reset(&conn->parser);
 	conn->last_activity = time(NULL);
-	struct kevent ev;
-	EV_SET(&ev, conn->fd, EVFILT_READ, EV_ENABLE, 0, 0, conn);
-	return kevent(*rt->kq_fd, &ev, 1, NULL, 0, NULL) == 0;
 }
 
-/** Process queued sockets and execute HTTP handlers in worker threads. */
-void *
-miniweb_worker_thread(void *arg)
+/**
+ * Read and discard what is still to come of the last request's body.
+ * Returns 1 once it is gone, 0 when the socket would block first and -1
+ * on EOF or error.
+ */
+static int
+drop_body(miniweb_connection_t *conn)
 {
-	miniweb_worker_runtime_t *rt = arg;
-	while (*rt->running) {
-		miniweb_connection_t *conn =
-		(miniweb_connection_t *)miniweb_work_queue_pop(rt->queue, rt->running);
-		if (!conn)
-			break;
+	char scratch[4096];
 
-		/*
-		 * Queue entries are raw pointers. The dispatcher may close/free and
-		 * recycle a connection before a worker dequeues it (idle sweep, EOF,
-		 * queue backpressure). Validate that this pointer still owns fd/gen
-		 * before touching mutable fields like bytes_read/buffer.
-		 */
-		int fd = conn->fd;
-		if (fd < 0 || fd >= MINIWEB_MAX_CONNECTIONS ||
-			miniweb_connection_is_stale(rt->pool, fd, conn))
-			continue;
+	while (conn->body_left > 0) {
+		size_t want = conn->body_left < sizeof(scratch) ?
+			(size_t)conn->body_left : sizeof(scratch);
+		ssize_t n = recv(conn->fd, scratch, want, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		conn->body_left -= (uint64_t)n;
+		conn->last_activity = time(NULL);
+	}
+	return 1;
+}
+
+/**
+ * Toggle TCP_NOPUSH while answering a pipelined burst so the responses
+ * leave in as few segments as possible; clearing it flushes the tail.
+ */
+static void
+set_cork(int fd, int on)
+{
+#ifdef TCP_NOPUSH
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on));
+#else
+	(void)fd;
+	(void)on;
+#endif
+}
+
+/**
+ * Terminate the method, target and version inside the buffer so the
+ * request borrows them as C strings. Each is followed by a space or the
+ * line end, which nothing reads once the head is parsed.
+ */
+static void
+terminate_request_line(char *buffer, const http_request_parser_t *hp)
+{
+	buffer[hp->method_off + hp->method_len] = '\0';
+	buffer[hp->url_off + hp->url_len] = '\0';
+	buffer[hp->version_off + hp->version_len] = '\0';
+}
+
+/**
+ * Move a parsed request whose route class belongs to another lane onto
+ * that lane's queue. Returns 1 when the connection was handed off and
+ * must not be touched any more; 0 to serve it on this thread.
+ */
+static int
+handoff_to_lane(miniweb_worker_runtime_t *rt, miniweb_connection_t *conn)
+{
+	const http_request_parser_t *hp = &conn->parser;
+	route_class_t cls;
+
+	(void)route_lookup(hp->method, conn->buffer + hp->url_off, hp->path_len,
+		&cls, NULL);
+	if ((int)cls == rt->lane || (int)cls >= MINIWEB_WORKER_LANES ||
+	    !rt->lanes[cls])
+		return 0;
+	conn->enqueued_ms = miniweb_worker_now_ms();
+	conn->trace_queued_ns = TRACE_NOW();
+	if (miniweb_work_queue_push(rt->lanes[cls],
+	    miniweb_connection_token(conn)) != 0)
+		return 0;
+	counter_inc(CTR_LANE_HANDOFFS);
+	return 1;
+}
+
+/**
+ * Route the request parsed by @p hp out of @p buffer and run its handler
+ * on @p fd; returns the handler result. @p keep_ok is 0 when the
+ * connection closes after this response whatever the client asked.
+ */
+static int
+dispatch_parsed(int fd, struct sockaddr_in *addr, char *buffer,
+	const http_request_parser_t *hp, http_output_t *out, int keep_ok,
+	int *keep_alive)
+{
+	terminate_request_line(buffer, hp);
+	const char *path = buffer + hp->url_off;
+
+	struct timespec start, end;
+	uint64_t usec;
+	route_class_t cls;
+	int route_id, retry;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	http_handler_t handler = route_lookup(hp->method, path, hp->path_len,
+		&cls, &route_id);
+	TRACE_MARK(TRACE_ROUTED);
+	http_request_t req = {.fd = fd,
+		.method = buffer + hp->method_off,.method_id = hp->method,
+		.url = path,.path_len = hp->path_len,
+		.query = hp->path_len < hp->url_len ? path + hp->path_len + 1 : NULL,
+		.version = buffer + hp->version_off,
+		.keep_alive = keep_ok && !miniweb_server_draining() &&
+			http_request_parser_keep_alive(hp, buffer),
+		.buffer = buffer,.buffer_len = hp->head_len,
+		.client_addr = addr,.headers = hp->headers,
+		.header_count = hp->header_count,.out = out,
+		.arena = http_arena_thread()};
+	int handler_result = 0;
+	counter_inc(CTR_REQUESTS);
+	/* Over its class's rate, a client is turned away before the handler. */
+	if (handler && rate_limit_enabled(cls) &&
+		(retry = rate_limit_take(cls, http_request_get_client_ip(&req),
+		miniweb_worker_now_ms())) > 0){
+		handler_result = http_send_error_retry(&req, 429,
+			"Too many requests; try again later", retry);
+	}else if (handler){
+		handler_result = response_cache_serve(&req, route_id, handler,
+			miniweb_worker_now_ms());
+	}else{
+		int known_path = route_path_known(path);
+		handler_result = http_send_error(
+			&req,
+			known_path ? 405 : 404,
+			known_path ? "Method Not Allowed" : "Not Found");
+		route_id = ROUTE_STATS_UNMATCHED;
+	}
+	TRACE_MARK(TRACE_HANDLED);
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	if (req.status == 503)
+		counter_inc(CTR_STATUS_503);
+	usec = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+		(uint64_t)(end.tv_nsec - start.tv_nsec) / 1000;
+	route_stats_record(route_id, req.status, req.bytes_out, usec);
+	access_log_record(route_id, hp->method, req.status, req.bytes_out,
+		usec, addr->sin_addr.s_addr);
+	TRACE_END(route_id, req.status, req.bytes_out, path, hp->url_len);
+	/* Unsent bytes were copied into conn->out, so the arena can go. */
+	http_arena_reset(req.arena);
+	*keep_alive = req.keep_alive;
+	return handler_result;
+}
+
+/**
+ * Route the request parsed on @p conn and run its handler. The last
+ * request the keep-alive budget allows at the current load is answered
+ * with Connection: close.
+ */
+static int
+dispatch_request(miniweb_worker_runtime_t *rt, miniweb_connection_t *conn,
+	int *keep_alive)
+{
+	int budget = keepalive_budget(miniweb_connection_pool_active(rt->pool),
+		rt->config->max_conns);
+	int keep_ok = conn->requests_served + 1 < budget;
+
+	/* A body too large to be worth reading past closes the connection. */
+	if (conn->parser.body == HTTP_BODY_LENGTH &&
+	    conn->parser.content_length > (uint64_t)rt->config->max_req_size)
+		keep_ok = 0;
 
-		int close_conn = 1, done = 0;
-		while (!done) {
-			ssize_t n = recv(fd, conn->buffer + conn->bytes_read,
-							 (size_t)rt->config->max_req_size - conn->bytes_read - 1, 0);
+	if (conn->requests_served > 0) {
+		counter_inc(CTR_KEEPALIVE_REUSE);
+		if (!keep_ok)
+			counter_inc(CTR_KEEPALIVE_BUDGET_CLOSES);
+		else if (conn->requests_served == KEEPALIVE_REQUESTS)
+			counter_inc(CTR_KEEPALIVE_EXTENDED);
+	}
+	return dispatch_parsed(conn->fd, &conn->addr, conn->buffer,
+		&conn->parser, &conn->out, keep_ok, keep_alive);
+}
+
+/**
+ * h2_dispatch_t: answer one HTTP/2 stream, given as an HTTP/1.1 head,
+ * on its socketpair end. Writes block there until the session has read
+ * them, so the request is served as on a blocking socket.
+ */
+void
+miniweb_worker_dispatch_head(int fd, struct sockaddr_in *addr, char *head,
+	size_t len)
+{
+	http_request_parser_t hp;
+	int keep_alive;
+
+	TRACE_BEGIN(0);
+	http_request_parser_reset(&hp);
+	if (http_request_parser_feed(&hp, head, len) != 1) {
+		send_error_response(fd, 400, "Bad Request");
+		return;
+	}
+	TRACE_MARK(TRACE_PARSED);
+	(void)dispatch_parsed(fd, addr, head, &hp, NULL, 0, &keep_alive);
+}
+
+/**
+ * Hand a connection that opened with the HTTP/2 preface to a session
+ * of its own, which keeps a duplicate of the socket; this one is done.
+ */
+static void
+start_h2(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	miniweb_connection_t *conn)
+{
+	int fd = conn->fd;
+
+	(void)h2_session_start(fd, &conn->addr, conn->buffer, conn->bytes_read);
+	close_connection(rt, chg, fd);
+}
+
+/**
+ * Read, parse, and dispatch requests on @p conn until the socket would
+ * block, then re-arm it for keep-alive or close it. Requests pipelined
+ * behind the current one are served back to back before re-arming.
+ * A response the socket cannot take at once parks the connection on
+ * EVFILT_WRITE; the next call finishes it before reading further.
+ */
+static void
+serve_connection(miniweb_worker_runtime_t *rt, miniweb_worker_changes_t *chg,
+	miniweb_connection_t *conn)
+{
+	int fd = conn->fd;
+	int corked = 0;
+
+	TRACE_BEGIN(conn->trace_queued_ns);
+	conn->trace_queued_ns = 0;
+	if (http_output_pending(&conn->out)) {
+		int frc = http_output_flush(&conn->out, fd);
+		if (frc < 0)
+			goto drop;
+		conn->last_activity = time(NULL);
+		if (frc == 0) {
+			if (arm_write(rt, chg, conn))
+				return;
+			goto drop;
+		}
+		if (!conn->out.keep_alive)
+			goto drop;
+		consume_request(conn);
+		if (conn->bytes_read == 0) {
+			release_buffer(conn);
+			if (rearm_read(rt, chg, conn))
+				return;
+			goto drop;
+		}
+	}
+
+	for (;;) {
+		if (conn->body_left > 0) {
+			int drc = drop_body(conn);
+			if (drc < 0)
+				break;
+			if (drc == 0) {
+				if (corked)
+					set_cork(fd, 0);
+				release_buffer(conn);
+				(void)rearm_read(rt, chg, conn);
+				return;
+			}
+		}
+		/* Nothing is parsed as HTTP/1 until the preface is ruled out. */
+		int h2 = rt->config->h2c && conn->requests_served == 0 ?
+			h2_preface_match(conn->buffer, conn->bytes_read) : -1;
+		if (h2 > 0) {
+			start_h2(rt, chg, conn);
+			return;
+		}
+		int prc = h2 == 0 ? 0 : http_request_parser_feed(&conn->parser,
+			conn->buffer, conn->bytes_read);
+		if (prc < 0) {
+			send_error_response(fd, 400, "Bad Request");
+			break;
+		}
+		if (prc == 0) {
+			size_t limit = (size_t)rt->config->max_req_size;
+			if (conn->bytes_read >= limit - 1) {
+				send_error_response(fd, 400, "Request Too Large");
+				break;
+			}
+			if (!reserve_buffer(conn, limit)) {
+				send_error_response(fd, 503, "Service Unavailable");
+				break;
+			}
+			size_t room = (conn->buffer_cap < limit ?
+				conn->buffer_cap : limit) - conn->bytes_read - 1;
+			uint64_t since = TRACE_NOW();
+			ssize_t n = recv(fd, conn->buffer + conn->bytes_read, room, 0);
+			TRACE_WAIT(TRACE_WAIT_RECV, since);
 			if (n < 0) {
 				if (errno == EAGAIN || errno == EWOULDBLOCK) {
-					struct kevent ev;
-					EV_SET(&ev, fd, EVFILT_READ, EV_ENABLE, 0, 0, conn);
-					kevent(*rt->kq_fd, &ev, 1, NULL, 0, NULL);
-					goto next;
+					if (corked)
+						set_cork(fd, 0);
+					if (conn->bytes_read == 0)
+						release_buffer(conn);
+					(void)rearm_read(rt, chg, conn);
+					return;
 				}
 				break;
 			}
@@ -131,39 +504,166 @@ miniweb_worker_thread(void *arg)
 			conn->bytes_read += (size_t)n;
 			conn->last_activity = time(NULL);
 			conn->buffer[conn->bytes_read] = '\0';
-			if (find_header_end(conn->buffer)) done = 1;
-			else if (conn->bytes_read >= (size_t)rt->config->max_req_size - 1) {
-				send_error_response(fd, 400, "Request Too Large");
+			continue;
+		}
+
+		TRACE_MARK(TRACE_PARSED);
+		/* Bodies are skipped, not read: their length must be known. */
+		if (conn->parser.body == HTTP_BODY_CHUNKED) {
+			send_error_response(fd, 501, "Not Implemented");
+			break;
+		}
+		if (conn->parser.body == HTTP_BODY_INVALID) {
+			send_error_response(fd, 400, "Bad Request");
+			break;
+		}
+		if (rt->lanes[0] && handoff_to_lane(rt, conn)) {
+			if (corked)
+				set_cork(fd, 0);
+			return;
+		}
+		if (!corked && conn->bytes_read > conn->parser.head_len) {
+			set_cork(fd, 1);
+			corked = 1;
+		}
+		int keep_alive = 0;
+		int result = dispatch_request(rt, conn, &keep_alive);
+		if (http_output_pending(&conn->out)) {
+			if (result != 0)
 				break;
-			}
+			/* Finish this response before touching the next request. */
+			conn->out.keep_alive = keep_alive;
+			if (corked)
+				set_cork(fd, 0);
+			if (arm_write(rt, chg, conn))
+				return;
+			corked = 0;
+			break;
 		}
-		if (done) {
-			char method[32] = {0}, path[512] = {0}, version[32] = {0};
-			if (parse_request_line(conn->buffer, method, path, version) == 0) {
-				int keep_alive = request_keep_alive(conn->buffer, version);
-				http_handler_t handler = route_match(method, path);
-				http_request_t req = {.fd = fd,.method = method,.url = path,
-					.version = version,.keep_alive = keep_alive,.buffer = conn->buffer,
-					.buffer_len = conn->bytes_read,.client_addr = &conn->addr};
-				int handler_result = 0;
-				if (handler){
-					handler_result = handler(&req);
-				}else{
-					int known_path = route_path_known(path);
-					handler_result = http_send_error(
-						&req,
-						known_path ? 405 : 404,
-						known_path ? "Method Not Allowed" : "Not Found");
-				}
-				if (req.keep_alive && handler_result == 0 && try_rearm_keepalive(rt, conn)){
-					close_conn = 0;
-				}
+		if (result != 0 || !keep_alive)
+			break;
+		consume_request(conn);
+		if (conn->bytes_read == 0) {
+			if (corked)
+				set_cork(fd, 0);
+			release_buffer(conn);
+			if (rearm_read(rt, chg, conn))
+				return;
+			corked = 0;
+			break;
+		}
+		TRACE_BEGIN(0);		/* the next pipelined request */
+	}
+	if (corked)
+		set_cork(fd, 0);
+drop:
+	close_connection(rt, chg, fd);
+}
+
+/** Monotonic clock in milliseconds, used to stamp queue pushes. */
+uint64_t
+miniweb_worker_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
 
-			} else send_error_response(fd, 400, "Bad Request");
+/** Number of requests shed on @p lane for waiting past their deadline. */
+unsigned long
+miniweb_worker_shed_count(int lane)
+{
+	if (lane < 0 || lane >= MINIWEB_WORKER_LANES)
+		return 0;
+	uint64_t v[CTR_COUNT];
+
+	counters_read(v);
+	return (unsigned long)v[lane_shed[lane]];
+}
+
+/**
+ * Return 1 when @p conn waited in this lane's queue longer than the lane
+ * deadline. A half-written response is always finished, never shed.
+ */
+static int
+past_queue_deadline(miniweb_worker_runtime_t *rt, miniweb_connection_t *conn)
+{
+	int deadline = rt->lane == ROUTE_CLASS_SLOW ?
+		rt->config->slow_queue_deadline_ms : rt->config->queue_deadline_ms;
+	if (deadline <= 0 || conn->enqueued_ms == 0 ||
+	    http_output_pending(&conn->out))
+		return 0;
+	return miniweb_worker_now_ms() - conn->enqueued_ms > (uint64_t)deadline;
+}
+
+/** Resolve a queue token and serve its connection on the calling thread. */
+void
+miniweb_worker_serve(miniweb_worker_runtime_t *rt,
+	miniweb_worker_changes_t *chg, void *token)
+{
+	/*
+	 * Queue entries are (fd, generation) tokens. The dispatcher may
+	 * close/free and recycle a connection before a worker dequeues it
+	 * (idle expiry, EOF, queue backpressure). Resolve the token against
+	 * the current fd generation before touching bytes_read/buffer.
+	 */
+	miniweb_connection_t *conn = miniweb_connection_from_token(rt->pool, token);
+	if (!conn)
+		return;
+	if (past_queue_deadline(rt, conn)) {
+		/* Whoever sent this has most likely given up already. */
+		counter_inc(lane_shed[rt->lane]);
+		if (rt->config->overload_503)
+			send_error_response(conn->fd, 503, "Service Unavailable");
+		close_connection(rt, chg, conn->fd);
+		return;
+	}
+	serve_connection(rt, chg, conn);
+}
+
+/**
+ * Worker-owned connection loop: wait on this worker's private kqueue and
+ * serve every socket the acceptor handed over, re-arming it in place.
+ * Steady-state keep-alive traffic never crosses a thread boundary, and
+ * the re-arms of one round ride along with the next wait, so a served
+ * batch costs a single kevent() call.
+ */
+void *
+miniweb_worker_kqueue_thread(void *arg)
+{
+	miniweb_worker_runtime_t *rt = arg;
+	struct kevent events[MINIWEB_WORKER_MAX_EVENTS];
+	miniweb_worker_changes_t chg = {.n = 0};
+
+	while (*rt->running) {
+		struct timespec timeout = {1, 0};
+		int nchanges = chg.n;
+		chg.n = 0;
+		int n = kevent(*rt->kq_fd, chg.ev, nchanges, events,
+			MINIWEB_WORKER_MAX_EVENTS, &timeout);
+		if (nchanges > 0)
+			counter_inc(CTR_KEVENT_CALLS);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			struct kevent *ev = &events[i];
+			int fd = (int)ev->ident;
+			if (!ev->udata)
+				continue;	/* shutdown pipe */
+			miniweb_connection_t *conn =
+				miniweb_connection_from_token(rt->pool, ev->udata);
+			if (!conn || !miniweb_connection_claim(conn))
+				continue;	/* stale, or the timer has it */
+			/* EV_ERROR here is a rejected change from our batch. */
+			if (ev->flags & (EV_EOF | EV_ERROR)) {
+				close_connection(rt, &chg, fd);
+				continue;
+			}
+			serve_connection(rt, &chg, conn);
 		}
-		if (close_conn)
-			close_connection(rt, fd);
-		next:;
 	}
 	return NULL;
 }
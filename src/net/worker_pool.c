@@ -0,0 +1,264 @@
+
+#include <miniweb/net/worker.h>
+
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/log.h>
+#include <miniweb/router/routes.h>
+
+#define SLOT_FREE	0
+#define SLOT_RUNNING	1
+#define SLOT_EXITED	2
+
+#define SPAWN_BURST	4	/* threads added per supervisor tick at most */
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static miniweb_worker_pool_t *registry;
+
+static int pool_live_total;
+static int pool_peak;
+static unsigned long pool_spawned;
+static unsigned long pool_retired;
+static unsigned long pool_spawn_failures;
+
+static void *worker_pool_thread(void *arg);
+
+/** Account one more live worker and raise the process-wide peak. */
+static void
+note_spawn(void)
+{
+	int live = __atomic_add_fetch(&pool_live_total, 1, __ATOMIC_RELAXED);
+	int peak = __atomic_load_n(&pool_peak, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&pool_peak, &peak,
+	    live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	__atomic_add_fetch(&pool_spawned, 1, __ATOMIC_RELAXED);
+}
+
+/** Spawn one worker into a free slot; called with wp->lock held. */
+static int
+spawn_worker_locked(miniweb_worker_pool_t *wp)
+{
+	for (int i = 0; i < wp->max_threads; i++) {
+		miniweb_worker_slot_t *slot = &wp->slots[i];
+		if (slot->state == SLOT_EXITED) {
+			pthread_join(slot->thread, NULL);
+			slot->state = SLOT_FREE;
+		}
+		if (slot->state != SLOT_FREE)
+			continue;
+		slot->state = SLOT_RUNNING;
+		__atomic_add_fetch(&wp->live, 1, __ATOMIC_RELAXED);
+		if (pthread_create(&slot->thread, NULL, worker_pool_thread,
+		    slot) != 0) {
+			slot->state = SLOT_FREE;
+			__atomic_sub_fetch(&wp->live, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		note_spawn();
+		return 0;
+	}
+	__atomic_add_fetch(&pool_spawn_failures, 1, __ATOMIC_RELAXED);
+	return -1;
+}
+
+/**
+ * Let an idle worker leave while the pool is above min_threads.
+ * Returns 1 when the caller must exit.
+ */
+static int
+try_retire(miniweb_worker_slot_t *slot)
+{
+	miniweb_worker_pool_t *wp = slot->wp;
+	int retire = 0;
+
+	pthread_mutex_lock(&wp->lock);
+	if (__atomic_load_n(&wp->live, __ATOMIC_RELAXED) > wp->min_threads) {
+		__atomic_sub_fetch(&wp->live, 1, __ATOMIC_RELAXED);
+		slot->state = SLOT_EXITED;
+		retire = 1;
+	}
+	pthread_mutex_unlock(&wp->lock);
+	if (retire) {
+		__atomic_sub_fetch(&pool_live_total, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&pool_retired, 1, __ATOMIC_RELAXED);
+	}
+	return retire;
+}
+
+/**
+ * Queue-mode worker: pop tokens, serve them, retire when idle and extra.
+ * Re-arms are batched while the queue keeps feeding this thread and
+ * submitted once it runs dry, before the thread can block. Slow-lane
+ * workers submit after every request: their next one may take seconds.
+ */
+static void *
+worker_pool_thread(void *arg)
+{
+	miniweb_worker_slot_t *slot = arg;
+	miniweb_worker_pool_t *wp = slot->wp;
+	miniweb_worker_runtime_t *rt = wp->rt;
+	int elastic = wp->max_threads > wp->min_threads;
+	miniweb_worker_changes_t chg = {.n = 0};
+
+	while (*rt->running) {
+		void *token = elastic ?
+		    miniweb_work_queue_pop_timed(rt->queue, rt->running,
+			wp->idle_ms) :
+		    miniweb_work_queue_pop(rt->queue, rt->running);
+		if (!token) {
+			if (elastic && *rt->running && try_retire(slot))
+				return NULL;
+			continue;
+		}
+		__atomic_add_fetch(&wp->busy, 1, __ATOMIC_RELAXED);
+		if (MINIWEB_CONN_TOKEN_IS_TASK(token))
+			heartbeat_run_item(token);
+		else
+			miniweb_worker_serve(rt, &chg, token);
+		if (rt->lane == ROUTE_CLASS_SLOW ||
+		    miniweb_work_queue_depth(rt->queue) == 0)
+			miniweb_worker_changes_flush(rt, &chg);
+		__atomic_sub_fetch(&wp->busy, 1, __ATOMIC_RELAXED);
+	}
+	miniweb_worker_changes_flush(rt, &chg);
+	return NULL;
+}
+
+/**
+ * Supervisor: grow while requests wait and every live worker is busy
+ * (typically blocked in a subprocess route). Retired slots are reaped
+ * lazily when the next thread is spawned.
+ */
+static void *
+worker_pool_supervisor(void *arg)
+{
+	miniweb_worker_pool_t *wp = arg;
+	miniweb_worker_runtime_t *rt = wp->rt;
+	struct timespec tick = {0, MINIWEB_WORKER_SUPERVISE_MS * 1000000L};
+
+	while (*rt->running) {
+		nanosleep(&tick, NULL);
+		unsigned long depth = miniweb_work_queue_depth(rt->queue);
+		int live = __atomic_load_n(&wp->live, __ATOMIC_RELAXED);
+		int busy = __atomic_load_n(&wp->busy, __ATOMIC_RELAXED);
+		if (depth == 0 || busy < live || live >= wp->max_threads)
+			continue;
+
+		int want = depth < SPAWN_BURST ? (int)depth : SPAWN_BURST;
+		if (want > wp->max_threads - live)
+			want = wp->max_threads - live;
+		int added = 0;
+		pthread_mutex_lock(&wp->lock);
+		while (added < want && *rt->running &&
+		    spawn_worker_locked(wp) == 0)
+			added++;
+		pthread_mutex_unlock(&wp->lock);
+		if (added > 0)
+			log_debug("[WORKER] pool grew to %d threads (queue depth %lu)",
+			    live + added, depth);
+	}
+	return NULL;
+}
+
+/** Start min_threads workers and, when max > min, the supervisor. */
+int
+miniweb_worker_pool_start(miniweb_worker_pool_t *wp,
+    miniweb_worker_runtime_t *rt, int min_threads, int max_threads,
+    int idle_ms)
+{
+	memset(wp, 0, sizeof(*wp));
+	if (max_threads > MINIWEB_THREAD_POOL_SIZE)
+		max_threads = MINIWEB_THREAD_POOL_SIZE;
+	if (min_threads > max_threads)
+		max_threads = min_threads;
+	wp->rt = rt;
+	wp->min_threads = min_threads;
+	wp->max_threads = max_threads;
+	wp->idle_ms = idle_ms > 0 ? idle_ms : 1000;
+	pthread_mutex_init(&wp->lock, NULL);
+	for (int i = 0; i < MINIWEB_THREAD_POOL_SIZE; i++) {
+		wp->slots[i].wp = wp;
+		wp->slots[i].index = i;
+	}
+
+	pthread_mutex_lock(&registry_lock);
+	wp->next = registry;
+	registry = wp;
+	pthread_mutex_unlock(&registry_lock);
+
+	int rc = 0;
+	pthread_mutex_lock(&wp->lock);
+	for (int i = 0; i < min_threads && rc == 0; i++)
+		rc = spawn_worker_locked(wp);
+	pthread_mutex_unlock(&wp->lock);
+	if (rc != 0)
+		return -1;
+
+	if (max_threads > min_threads) {
+		if (pthread_create(&wp->supervisor, NULL, worker_pool_supervisor,
+		    wp) != 0)
+			return -1;
+		wp->supervisor_started = 1;
+	}
+	return 0;
+}
+
+/**
+ * Join every worker and the supervisor. The caller has cleared *running
+ * and woken the queue, so no thread spawns or retires concurrently.
+ */
+void
+miniweb_worker_pool_join(miniweb_worker_pool_t *wp)
+{
+	if (wp->supervisor_started) {
+		pthread_join(wp->supervisor, NULL);
+		wp->supervisor_started = 0;
+	}
+	for (int i = 0; i < MINIWEB_THREAD_POOL_SIZE; i++) {
+		miniweb_worker_slot_t *slot = &wp->slots[i];
+		if (slot->state == SLOT_FREE)
+			continue;
+		pthread_join(slot->thread, NULL);
+		if (slot->state == SLOT_RUNNING)
+			__atomic_sub_fetch(&pool_live_total, 1, __ATOMIC_RELAXED);
+		slot->state = SLOT_FREE;
+	}
+	wp->live = 0;
+
+	pthread_mutex_lock(&registry_lock);
+	for (miniweb_worker_pool_t **pp = &registry; *pp; pp = &(*pp)->next) {
+		if (*pp == wp) {
+			*pp = wp->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+	pthread_mutex_destroy(&wp->lock);
+}
+
+/** Snapshot the counters of every running pool. */
+void
+miniweb_worker_pool_stats(miniweb_worker_pool_stats_t *out)
+{
+	memset(out, 0, sizeof(*out));
+	pthread_mutex_lock(&registry_lock);
+	for (miniweb_worker_pool_t *p = registry; p; p = p->next) {
+		out->min_threads += p->min_threads;
+		out->max_threads += p->max_threads;
+		out->live += __atomic_load_n(&p->live, __ATOMIC_RELAXED);
+		out->busy += __atomic_load_n(&p->busy, __ATOMIC_RELAXED);
+		out->queue_depth += miniweb_work_queue_depth(p->rt->queue);
+	}
+	pthread_mutex_unlock(&registry_lock);
+	out->peak = __atomic_load_n(&pool_peak, __ATOMIC_RELAXED);
+	out->spawned = __atomic_load_n(&pool_spawned, __ATOMIC_RELAXED);
+	out->retired = __atomic_load_n(&pool_retired, __ATOMIC_RELAXED);
+	out->spawn_failures = __atomic_load_n(&pool_spawn_failures,
+	    __ATOMIC_RELAXED);
+	for (int i = 0; i < MINIWEB_WORKER_LANES; i++)
+		out->shed[i] = miniweb_worker_shed_count(i);
+	miniweb_worker_change_counts(&out->kevent_changes, &out->kevent_calls);
+}
@@ -2,9 +2,13 @@
 #include <miniweb/platform/openbsd/security.h>
 
 #include <fcntl.h>
+#include <libgen.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <miniweb/core/log.h>
+#include <miniweb/http/bundle.h>
+#include <miniweb/net/handoff.h>
 
 /**
  * Apply OpenBSD unveil(2)/pledge(2) sandboxing when available.
@@ -20,7 +24,15 @@ miniweb_apply_openbsd_security(const miniweb_conf_t *config)
 	unveil("/usr/local/man", "r");
 	unveil("/usr/local/share/man", "r");
 	unveil(config->static_dir, "rwc");
-	unveil(config->templates_dir, "r");
+	if (config->db_path[0] != '\0') {
+		char db_dir[CONF_STR_MAX];
+
+		/* SQLite keeps its journal next to the database. */
+		strlcpy(db_dir, config->db_path, sizeof(db_dir));
+		unveil(dirname(db_dir), "rwc");
+	}
+	if (!bundle_enabled())
+		unveil(config->templates_dir, "r");
 	unveil("/tmp", "rwc");
 	unveil("/dev", "r");
 	unveil("/var/run", "r");
@@ -34,11 +46,19 @@ miniweb_apply_openbsd_security(const miniweb_conf_t *config)
 	unveil("/etc/passwd", "r");
 	unveil("/etc/group", "r");
 	unveil("/etc/resolv.conf", "r");
+	/* The listener is bound after pledge; a stale file is replaced. */
+	if (config->unix_socket[0] != '\0')
+		unveil(config->unix_socket, "rwc");
+	/* SIGHUP may re-execute the server to apply a new configuration. */
+	if (handoff_self_path() != NULL)
+		unveil(handoff_self_path(), "rx");
 	unveil(NULL, NULL);
 
 	/* Pledge con tutti i permessi necessari per i child */
-	const char *promises =
-	"stdio rpath wpath cpath inet route proc exec vminfo ps getpw";
+	const char *promises = config->unix_socket[0] != '\0' ?
+	"stdio rpath wpath cpath inet unix route proc exec recvfd vminfo ps "
+	"getpw" :
+	"stdio rpath wpath cpath inet route proc exec recvfd vminfo ps getpw";
 
 	if (pledge(promises, NULL) == -1) {
 		log_errno("pledge");
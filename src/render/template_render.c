@@ -4,15 +4,55 @@
 #include <dirent.h>
 #include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
 
+#include <miniweb/core/cache_admin.h>
 #include <miniweb/core/config.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/http/bundle.h>
 #include <miniweb/render/template_engine.h>
 
+/*
+ * Placeholders a base template may carry. Each template is compiled at
+ * load time into literal spans and slots, so rendering never searches.
+ * Only the first occurrence of a placeholder is a slot; later ones stay
+ * literal text.
+ */
+enum {
+	TEMPLATE_SLOT_TITLE,
+	TEMPLATE_SLOT_PAGE_CONTENT,
+	TEMPLATE_SLOT_EXTRA_HEAD,
+	TEMPLATE_SLOT_EXTRA_JS,
+	TEMPLATE_SLOT_DATA,	/* filled per request, see struct template_iov */
+	TEMPLATE_SLOT_COUNT
+};
+
+static const struct {
+	const char *token;
+	size_t len;
+} template_slots[TEMPLATE_SLOT_COUNT] = {
+	{ "{{title}}", sizeof("{{title}}") - 1 },
+	{ "{{page_content}}", sizeof("{{page_content}}") - 1 },
+	{ "{{extra_head}}", sizeof("{{extra_head}}") - 1 },
+	{ "{{extra_js}}", sizeof("{{extra_js}}") - 1 },
+	{ "{{data}}", sizeof("{{data}}") - 1 },
+};
+
+/* One literal span around each slot, plus the slots themselves. */
+#define TEMPLATE_SEGMENTS_MAX (2 * TEMPLATE_SLOT_COUNT + 1)
+
+typedef struct template_segment {
+	size_t off;		/* literal: offset into content */
+	size_t len;		/* literal: length */
+	int slot;		/* TEMPLATE_SLOT_*, or -1 for a literal */
+} template_segment_t;
+
 /**
  * @brief Internal data structure.
  */
@@ -20,13 +60,36 @@ typedef struct template_entry {
 	char *filename;
 	char *content;
 	size_t len;
-	time_t mtime;
+	time_t mtime;		/* bundled: the content hash instead */
+	int borrowed;		/* content lives in the bundle */
+	uint32_t hash;		/* template_name_hash(filename) */
+	template_segment_t segs[TEMPLATE_SEGMENTS_MAX];
+	size_t nsegs;
 } template_entry_t;
 
-static template_entry_t *template_cache = NULL;
-static size_t template_cache_count = 0;
-static pthread_mutex_t template_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * One loaded generation of the templates directory, immutable once
+ * published. Readers take a reference without locking; a reload builds
+ * the next snapshot off to the side and swaps it in, and spans handed
+ * out by template_render_iov() stay valid until they are released.
+ */
+typedef struct template_set {
+	int refs;
+	template_entry_t *entries;
+	size_t count;
+	uint32_t *index;	/* entry number + 1 by filename hash; 0 empty */
+	size_t index_mask;
+	unsigned long version;
+} template_set_t;
+
+static template_set_t *template_current = NULL;	/* published snapshot */
+static pthread_mutex_t template_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* writers */
+LOCKSTAT_SITE(lockstat_templates, "template_cache");
+static unsigned int template_reader_epoch;
+static unsigned long template_readers[2];	/* readers between load and ref */
 static time_t template_cache_last_refresh = 0;
+static int template_cache_watched = 0;	/* reload on invalidate, not TTL */
+static int template_cache_dirty = 0;
 
 #define TEMPLATE_CACHE_TTL_SEC 60
 
@@ -87,46 +150,117 @@ read_file_content(const char *path, char **content)
 	return 0;
 }
 
+/** Drop one reference on @p set; the last holder frees it. */
+static void
+template_set_release(template_set_t *set)
+{
+	if (!set || __atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	for (size_t i = 0; i < set->count; i++) {
+		free(set->entries[i].filename);
+		if (!set->entries[i].borrowed)
+			free(set->entries[i].content);
+	}
+	free(set->entries);
+	free(set->index);
+	free(set);
+}
+
 /**
- * @brief Free all cached template entries and release associated resources.
- */
-/**
- * @brief template_cache_cleanup operation.
- *
- * @details Performs the core template_cache_cleanup routine for this module.
+ * @brief Hash of a template filename for the snapshot index.
  */
-void
-template_cache_cleanup(void)
+static uint32_t
+template_name_hash(const char *name)
 {
-	pthread_mutex_lock(&template_cache_lock);
+	uint32_t h = 2166136261u;
 
-	for (size_t i = 0; i < template_cache_count; i++) {
-		free(template_cache[i].filename);
-		free(template_cache[i].content);
+	for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+		h ^= *p;
+		h *= 16777619u;
 	}
-	free(template_cache);
-	template_cache = NULL;
-	template_cache_count = 0;
-	template_cache_last_refresh = 0;
+	return h;
+}
 
-	pthread_mutex_unlock(&template_cache_lock);
+/** Append a segment to @p e; the table is sized for the worst case. */
+static void
+template_segment_add(template_entry_t *e, size_t off, size_t len, int slot)
+{
+	if (slot < 0 && len == 0)
+		return;
+	e->segs[e->nsegs].off = off;
+	e->segs[e->nsegs].len = len;
+	e->segs[e->nsegs].slot = slot;
+	e->nsegs++;
 }
 
 /**
- * @brief template_cache_cleanup_locked operation.
- *
- * @details Performs the core template_cache_cleanup_locked routine for this module.
+ * @brief Split @p e->content into literal spans and placeholder slots.
+ * @param e Freshly loaded entry.
  */
 static void
-template_cache_cleanup_locked(void)
+template_compile(template_entry_t *e)
 {
-	for (size_t i = 0; i < template_cache_count; i++) {
-		free(template_cache[i].filename);
-		free(template_cache[i].content);
+	const char *s = e->content;
+	const char *lit = s;
+	const char *p = s;
+	unsigned int seen = 0;
+
+	e->nsegs = 0;
+	while ((p = strstr(p, "{{")) != NULL) {
+		int slot = -1;
+
+		for (int i = 0; i < TEMPLATE_SLOT_COUNT; i++) {
+			if (!(seen & (1u << i)) && strncmp(p,
+			    template_slots[i].token, template_slots[i].len) == 0) {
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0) {
+			p += 2;
+			continue;
+		}
+		seen |= 1u << slot;
+		template_segment_add(e, (size_t)(lit - s), (size_t)(p - lit), -1);
+		template_segment_add(e, 0, 0, slot);
+		p += template_slots[slot].len;
+		lit = p;
 	}
-	free(template_cache);
-	template_cache = NULL;
-	template_cache_count = 0;
+	template_segment_add(e, (size_t)(lit - s), e->len - (size_t)(lit - s),
+	    -1);
+}
+
+/**
+ * @brief Append a compiled entry for @p content to @p set.
+ * @param borrowed Nonzero when @p content is not the set's to free.
+ * @return 0 on success, -1 on allocation failure (@p content untouched).
+ */
+static int
+add_template_entry(template_set_t *set, const char *filename, char *content,
+    time_t mtime, int borrowed)
+{
+	template_entry_t *new_cache;
+	template_entry_t *e;
+
+	new_cache = realloc(set->entries, sizeof(*set->entries) *
+	(set->count + 1));
+	if (!new_cache)
+		return -1;
+	set->entries = new_cache;
+
+	e = &set->entries[set->count];
+	e->filename = strdup(filename);
+	if (!e->filename)
+		return -1;
+	e->content = content;
+	e->len = strlen(content);
+	e->mtime = mtime;
+	e->borrowed = borrowed;
+	e->hash = template_name_hash(filename);
+	template_compile(e);
+	set->count++;
+
+	return 0;
 }
 
 /**
@@ -138,60 +272,139 @@ template_cache_cleanup_locked(void)
  */
 /**
  * @brief Add one file to the in-memory template cache.
+ * @param set Set being loaded.
  * @param filename Basename of the template file.
  * @param path Absolute/relative filesystem path to read.
  * @return Returns 0 on success or -1 on failure.
  */
 static int
-add_template_to_cache(const char *filename, const char *path, time_t mtime)
+add_template_to_cache(template_set_t *set, const char *filename,
+    const char *path, time_t mtime)
 {
 	char *content = NULL;
-	template_entry_t *new_cache;
 
 	if (read_file_content(path, &content) != 0)
 		return -1;
-
-	new_cache = realloc(template_cache, sizeof(*template_cache) *
-	(template_cache_count + 1));
-	if (!new_cache) {
+	if (add_template_entry(set, filename, content, mtime, 0) != 0) {
 		free(content);
 		return -1;
 	}
-	template_cache = new_cache;
+	return 0;
+}
 
-	template_cache[template_cache_count].filename = strdup(filename);
-	if (!template_cache[template_cache_count].filename) {
-		free(content);
-		return -1;
-	}
-	template_cache[template_cache_count].content = content;
-	template_cache[template_cache_count].len = strlen(content);
-	template_cache[template_cache_count].mtime = mtime;
-	template_cache_count++;
+/** bundle_foreach() context of template_set_load(). */
+struct template_bundle_load {
+	template_set_t *set;
+	int failed;
+};
 
-	return 0;
+/**
+ * @brief Add one bundled template, referencing its bytes in place.
+ *
+ * @details Only files directly under templates/ are taken, as from the
+ * directory. Their content hash stands in for the mtime, so the set
+ * digest still changes with every rebuilt template.
+ */
+static void
+template_bundle_add(const bundle_file_t *f, void *ctx)
+{
+	struct template_bundle_load *l = ctx;
+	const char *base = f->name + sizeof("templates/") - 1;
+
+	if (l->failed || strchr(base, '/') != NULL)
+		return;
+	if (add_template_entry(l->set, base, (char *)(uintptr_t)f->data,
+	    (time_t)f->hash, 1) != 0)
+		l->failed = 1;
 }
 
 /**
- * @brief Reload all template files from disk while the cache mutex is held.
- * @return 0 on success, -1 on any load failure.
+ * @brief Summarise the loaded set (names, sizes, mtimes) in one number.
+ *
+ * @details Entries are combined by addition so directory order does not
+ * matter; a periodic reload of unchanged files yields the same value.
+ *
+ * @return Non-zero digest of the cache contents.
  */
+static unsigned long
+template_set_digest(const template_set_t *set)
+{
+	unsigned long digest = 0;
+
+	for (size_t i = 0; i < set->count; i++) {
+		unsigned long h = 1469598103934665603UL;
+		for (const unsigned char *p =
+		    (const unsigned char *)set->entries[i].filename; *p; p++) {
+			h ^= *p;
+			h *= 1099511628211UL;
+		}
+		h ^= (unsigned long)set->entries[i].mtime * 2654435761UL;
+		h ^= (unsigned long)set->entries[i].len << 17;
+		digest += h;
+	}
+	return digest ? digest : 1;
+}
+
 /**
- * @brief Preload template files from configured directory into memory.
- * @return Returns 0 on success or -1 on failure.
+ * @brief Build the open-addressing filename index of @p set.
+ * @return 0 on success, -1 on allocation failure.
  */
 static int
-template_cache_reload_locked(void)
+template_set_index(template_set_t *set)
+{
+	size_t size = 8;
+
+	while (size < set->count * 2)
+		size *= 2;
+	set->index = calloc(size, sizeof(*set->index));
+	if (!set->index)
+		return -1;
+	set->index_mask = size - 1;
+	for (size_t i = 0; i < set->count; i++) {
+		size_t slot = set->entries[i].hash & set->index_mask;
+
+		while (set->index[slot] != 0)
+			slot = (slot + 1) & set->index_mask;
+		set->index[slot] = (uint32_t)i + 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Load every regular file of the templates directory into a new,
+ * unpublished set; from the bundle instead when it is in use.
+ * @return The set holding one reference, or NULL when nothing could be
+ *         loaded.
+ */
+static template_set_t *
+template_set_load(void)
 {
+	struct template_bundle_load bl;
 	DIR *dir;
 	struct dirent *entry;
-	int loaded = 0;
+	template_set_t *set;
 
-	template_cache_cleanup_locked();
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+	set->refs = 1;
+
+	if (bundle_enabled()) {
+		bl.set = set;
+		bl.failed = 0;
+		bundle_foreach("templates/", template_bundle_add, &bl);
+		if (bl.failed) {
+			template_set_release(set);
+			return NULL;
+		}
+		goto loaded;
+	}
 
 	dir = opendir(config_templates_dir);
-	if (!dir)
-		return -1;
+	if (!dir) {
+		template_set_release(set);
+		return NULL;
+	}
 
 	while ((entry = readdir(dir)) != NULL) {
 		char path[PATH_MAX];
@@ -206,8 +419,8 @@ template_cache_reload_locked(void)
 					 entry->d_name);
 		if (n < 0 || (size_t)n >= sizeof(path)) {
 			closedir(dir);
-			template_cache_cleanup_locked();
-			return -1;
+			template_set_release(set);
+			return NULL;
 		}
 
 		if (stat(path, &st) != 0)
@@ -215,284 +428,387 @@ template_cache_reload_locked(void)
 		if (!S_ISREG(st.st_mode))
 			continue;
 
-		if (add_template_to_cache(entry->d_name, path, st.st_mtime) !=
-			0) {
+		if (add_template_to_cache(set, entry->d_name, path,
+			st.st_mtime) != 0) {
 			closedir(dir);
-		template_cache_cleanup_locked();
-		return -1;
-			}
-			loaded = 1;
+			template_set_release(set);
+			return NULL;
+		}
 	}
-
 	closedir(dir);
-	template_cache_last_refresh = time(NULL);
-	return loaded ? 0 : -1;
+
+loaded:
+	if (set->count == 0 || template_set_index(set) != 0) {
+		template_set_release(set);
+		return NULL;
+	}
+	set->version = template_set_digest(set);
+	return set;
 }
 
 /**
- * @brief Initialise and preload the template cache at server startup.
- * @return 0 on success, -1 on failure.
+ * @brief Wait until no reader can still be about to reference a set
+ * unpublished before this call.
+ *
+ * @details Readers count themselves in one of two counters, chosen by
+ * the epoch, for the few instructions between loading the snapshot
+ * pointer and taking their reference. Flipping the epoch and draining
+ * the old counter twice covers both; new readers always join the other
+ * counter, so the writer cannot be starved.
  */
-int
-template_cache_init(void)
+static void
+template_readers_drain(void)
 {
-	int rc;
+	for (int pass = 0; pass < 2; pass++) {
+		unsigned int old = __atomic_fetch_add(&template_reader_epoch, 1,
+		    __ATOMIC_SEQ_CST) & 1;
 
-	pthread_mutex_lock(&template_cache_lock);
-	rc = template_cache_reload_locked();
-	pthread_mutex_unlock(&template_cache_lock);
-
-	return rc;
+		while (__atomic_load_n(&template_readers[old],
+		    __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
 }
 
 /**
- * @brief Reload stale templates from disk while the cache mutex is held.
- * @return 0 on success, -1 on reload failure.
+ * @brief Publish @p set and retire the previous snapshot; called with
+ * the cache lock held.
  */
-static int
-template_cache_refresh_locked(void)
+static void
+template_publish_locked(template_set_t *set)
 {
-	time_t now = time(NULL);
-
-	if (template_cache_last_refresh != 0 &&
-		(now - template_cache_last_refresh) < TEMPLATE_CACHE_TTL_SEC)
-		return 0;
+	template_set_t *old = __atomic_exchange_n(&template_current, set,
+	    __ATOMIC_SEQ_CST);
 
-	return template_cache_reload_locked();
+	if (old) {
+		template_readers_drain();
+		template_set_release(old);
+	}
 }
 
 /**
- * @brief Read a template by base filename from the configured templates directory.
- * @param filename Template base filename.
- * @param content  Output pointer receiving the NUL-terminated file content.
- * @return 0 on success, -1 when the file is not found or unreadable.
- */
-/**
- * @brief Load a template file from the in-memory cache.
- * @param filename Template filename relative to the templates directory.
- * @param content Output pointer that receives the allocated template content.
- * @return Returns 0 on success or -1 on failure.
+ * @brief Build a new snapshot off to the side and publish it; a failed
+ * load keeps serving the previous one. Called with the cache lock held.
+ *
+ * @details A watched cache clears its dirty flag before reading, so a
+ * change landing mid-reload triggers another one.
+ *
+ * @return 0 on success, -1 on load failure.
  */
 static int
-read_template_file(const char *filename, char **content)
+template_cache_reload_locked(void)
 {
-	int ret = -1;
+	template_set_t *set;
+
+	if (__atomic_load_n(&template_cache_watched, __ATOMIC_ACQUIRE))
+		__atomic_store_n(&template_cache_dirty, 0, __ATOMIC_SEQ_CST);
+	set = template_set_load();
+	__atomic_store_n(&template_cache_last_refresh, time(NULL),
+	    __ATOMIC_RELEASE);
+	if (!set) {
+		if (__atomic_load_n(&template_cache_watched, __ATOMIC_ACQUIRE))
+			__atomic_store_n(&template_cache_dirty, 1,
+			    __ATOMIC_RELEASE);
+		return -1;
+	}
+	template_publish_locked(set);
+	return 0;
+}
 
-	pthread_mutex_lock(&template_cache_lock);
+static template_set_t *template_set_acquire(void);
 
-	if (template_cache_refresh_locked() != 0)
-		goto out;
+/** cache_admin stats(): templates in the published snapshot. */
+static void
+template_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	template_set_t *set = template_set_acquire();
 
-	for (size_t i = 0; i < template_cache_count; i++) {
-		if (strcmp(template_cache[i].filename, filename) == 0) {
-			*content = strdup(template_cache[i].content);
-			ret = *content ? 0 : -1;
-			goto out;
-		}
+	(void)ctx;
+	for (size_t i = 0; set && i < set->count; i++) {
+		st->bytes += set->entries[i].len;
+		st->entries++;
 	}
-
-	out:
-	pthread_mutex_unlock(&template_cache_lock);
-	return ret;
+	template_set_release(set);
 }
 
 /**
- * @brief load_template_component operation.
- *
- * @details Performs the core load_template_component routine for this module.
- *
- * @param filename Input parameter for load_template_component.
- * @param content Input parameter for load_template_component.
- *
- * @return Return value produced by load_template_component.
+ * cache_admin purge(): keys are template file names. A snapshot cannot
+ * lose one entry, so a match reloads the whole set from disk.
  */
-static int
-load_template_component(const char *filename, char **content)
+static size_t
+template_admin_purge(const char *key, int prefix, void *ctx)
 {
-	if (!filename) {
-		*content = NULL;
+	template_set_t *set = template_set_acquire();
+	size_t matched = 0;
+
+	(void)ctx;
+	for (size_t i = 0; set && i < set->count; i++)
+		if (cache_admin_match(set->entries[i].filename, key, prefix))
+			matched++;
+	template_set_release(set);
+	if (matched > 0 && template_cache_reload() != 0)
 		return 0;
-	}
-	if (read_template_file(filename, content) != 0) {
-		*content = NULL;
-		return -1;
-	}
-	return 0;
+	return matched;
 }
 
-/* Forward declaration for the single placeholder replacement logic */
-static char *replace_single(const char *str, const char *needle,
-							const char *value);
+/**
+ * @brief Initialise and preload the template cache at server startup.
+ * @return 0 on success, -1 on failure.
+ */
+int
+template_cache_init(void)
+{
+	int rc;
 
-struct placeholder_pair {
-	const char *needle;
-	const char *value;
-};
+	LOCKSTAT_LOCK(&template_cache_lock, lockstat_templates);
+	rc = template_cache_reload_locked();
+	LOCKSTAT_UNLOCK(&template_cache_lock, lockstat_templates);
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "templates",
+		.stats = template_admin_stats,
+		.purge = template_admin_purge,
+	});
+
+	return rc;
+}
 
 /**
- * @brief replace_placeholders operation.
+ * @brief Rebuild the snapshot now, on the calling thread.
  *
- * @details Performs the core replace_placeholders routine for this module.
+ * @details Meant for the template watcher, so request threads find a
+ * fresh snapshot instead of reloading one themselves.
  *
- * @param template_str Input parameter for replace_placeholders.
- * @param pairs Input parameter for replace_placeholders.
- * @param pair_count Input parameter for replace_placeholders.
- *
- * @return Return value produced by replace_placeholders.
+ * @return 0 on success, -1 on failure (the previous snapshot stays).
  */
-static char *
-replace_placeholders(const char *template_str,
-	const struct placeholder_pair *pairs, size_t pair_count)
+int
+template_cache_reload(void)
 {
-	char *result = strdup(template_str);
-	if (!result)
-		return NULL;
+	int rc;
 
-	for (size_t i = 0; i < pair_count; i++) {
-		char *next = replace_single(result, pairs[i].needle,
-			pairs[i].value ? pairs[i].value : "");
-		if (!next) {
-			free(result);
-			return NULL;
-		}
-		free(result);
-		result = next;
-	}
+	LOCKSTAT_LOCK(&template_cache_lock, lockstat_templates);
+	rc = template_cache_reload_locked();
+	LOCKSTAT_UNLOCK(&template_cache_lock, lockstat_templates);
+	return rc;
+}
 
-	return result;
+/** True when the published snapshot is due for a reload. */
+static int
+template_cache_stale(void)
+{
+	if (__atomic_load_n(&template_cache_watched, __ATOMIC_ACQUIRE))
+		return __atomic_load_n(&template_cache_dirty, __ATOMIC_ACQUIRE);
+	return time(NULL) - __atomic_load_n(&template_cache_last_refresh,
+	    __ATOMIC_ACQUIRE) >= TEMPLATE_CACHE_TTL_SEC;
 }
 
 /**
- * @brief Substitute all standard placeholders ({{TITLE}}, {{PAGE_CONTENT}}, etc.) in a template.
- * @param template_str Raw template text.
- * @param title        Replacement for {{TITLE}}.
- * @param page_content Replacement for {{PAGE_CONTENT}}.
- * @param extra_head   Replacement for {{EXTRA_HEAD}}.
- * @param extra_js     Replacement for {{EXTRA_JS}}.
- * @return Heap-allocated expanded string the caller must free(), or NULL.
+ * @brief Reload a stale snapshot without making readers wait for it.
+ *
+ * A watched cache reloads only after template_cache_invalidate(); the
+ * TTL applies otherwise. One reader takes the reload while the others
+ * keep using the published snapshot; only the very first load, with
+ * nothing published yet, is waited for.
  */
+static void
+template_cache_refresh(void)
+{
+	if (__atomic_load_n(&template_current, __ATOMIC_ACQUIRE) == NULL) {
+		LOCKSTAT_LOCK(&template_cache_lock, lockstat_templates);
+		if (__atomic_load_n(&template_current, __ATOMIC_ACQUIRE) == NULL)
+			(void)template_cache_reload_locked();
+		LOCKSTAT_UNLOCK(&template_cache_lock, lockstat_templates);
+		return;
+	}
+	if (!template_cache_stale() ||
+	    LOCKSTAT_TRYLOCK(&template_cache_lock, lockstat_templates) != 0)
+		return;
+	if (template_cache_stale())
+		(void)template_cache_reload_locked();
+	LOCKSTAT_UNLOCK(&template_cache_lock, lockstat_templates);
+}
+
 /**
- * @brief Replace all supported placeholders in the base template string.
- * @param template_str Base template text containing placeholders.
- * @param title Value for the {{title}} placeholder.
- * @param page_content Value for the {{page_content}} placeholder.
- * @param extra_head Value for the {{extra_head}} placeholder.
- * @param extra_js Value for the {{extra_js}} placeholder.
- * @return Newly allocated rendered string, or NULL on failure.
+ * @brief Take a reference on the published snapshot.
+ *
+ * @details Lock-free: one pointer load and one reference, bracketed by
+ * the reader counter template_readers_drain() waits for.
+ *
+ * @return Set to release with template_set_release(), or NULL.
  */
-static char *
-replace_all(const char *template_str, const char *title,
-			const char *page_content, const char *extra_head,
-			const char *extra_js)
+static template_set_t *
+template_set_acquire(void)
 {
-	const struct placeholder_pair pairs[] = {
-		{ "{{title}}", title },
-		{ "{{page_content}}", page_content },
-		{ "{{extra_head}}", extra_head },
-		{ "{{extra_js}}", extra_js },
-	};
+	template_set_t *set;
+	unsigned int idx;
+
+	template_cache_refresh();
+	idx = __atomic_load_n(&template_reader_epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&template_readers[idx], 1, __ATOMIC_SEQ_CST);
+	set = __atomic_load_n(&template_current, __ATOMIC_SEQ_CST);
+	if (set)
+		__atomic_add_fetch(&set->refs, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&template_readers[idx], 1, __ATOMIC_SEQ_CST);
+	return set;
+}
 
-	return replace_placeholders(template_str, pairs,
-		sizeof(pairs) / sizeof(pairs[0]));
+/**
+ * @brief Return the digest of the published templates, reloading them
+ * first when they are stale.
+ * @return Version value, or 0 before the cache has been loaded.
+ */
+unsigned long
+template_cache_version(void)
+{
+	template_set_t *set = template_set_acquire();
+	unsigned long v = set ? set->version : 0;
+
+	template_set_release(set);
+	return v;
 }
 
 /**
- * @brief load_layout_fragments operation.
- *
- * @details Performs the core load_layout_fragments routine for this module.
- *
- * @param data Input parameter for load_layout_fragments.
- * @param base_template Input parameter for load_layout_fragments.
- * @param page_content Input parameter for load_layout_fragments.
- * @param extra_head Input parameter for load_layout_fragments.
- * @param extra_js Input parameter for load_layout_fragments.
+ * @brief Free all cached template entries and release associated resources.
  *
- * @return Return value produced by load_layout_fragments.
+ * @details Renders still holding the snapshot keep it alive until they
+ * finish.
  */
-static int
-load_layout_fragments(const struct template_data *data,
-	char **base_template, char **page_content, char **extra_head,
-	char **extra_js)
+void
+template_cache_cleanup(void)
 {
-	if (read_template_file("base.html", base_template) != 0)
-		return -1;
-	if (read_template_file(data->page_content, page_content) != 0)
-		return -1;
-	(void)load_template_component(data->extra_head_file, extra_head);
-	(void)load_template_component(data->extra_js_file, extra_js);
-	return 0;
+	LOCKSTAT_LOCK(&template_cache_lock, lockstat_templates);
+	template_publish_locked(NULL);
+	__atomic_store_n(&template_cache_last_refresh, 0, __ATOMIC_RELEASE);
+	LOCKSTAT_UNLOCK(&template_cache_lock, lockstat_templates);
 }
 
 /**
- * @brief compose_layout operation.
- *
- * @details Performs the core compose_layout routine for this module.
- *
- * @param data Input parameter for compose_layout.
- * @param base_template Input parameter for compose_layout.
- * @param page_content Input parameter for compose_layout.
- * @param extra_head Input parameter for compose_layout.
- * @param extra_js Input parameter for compose_layout.
+ * @brief Mark the cache stale; the next access reloads it.
  *
- * @return Return value produced by compose_layout.
+ * Safe from any thread without the cache lock.
  */
-static char *
-compose_layout(const struct template_data *data, const char *base_template,
-	const char *page_content, const char *extra_head, const char *extra_js)
+void
+template_cache_invalidate(void)
 {
-	return replace_all(base_template, data->title, page_content,
-		extra_head ? extra_head : "", extra_js ? extra_js : "");
+	__atomic_store_n(&template_cache_dirty, 1, __ATOMIC_RELEASE);
 }
 
 /**
- * @brief Replace the first occurrence of a named placeholder in @p str.
- * @param str         String in which to replace the placeholder.
- * @param placeholder Placeholder token to search for.
- * @param value       Replacement value string.
- * @return Heap-allocated result string the caller must free(), or NULL.
+ * @brief Switch between invalidation-driven and TTL-driven reloads.
+ * @param watched Nonzero once a watcher calls template_cache_invalidate().
  */
+void
+template_cache_set_watched(int watched)
+{
+	__atomic_store_n(&template_cache_watched, watched != 0,
+	    __ATOMIC_RELEASE);
+}
+
 /**
- * @brief Replace the first occurrence of a token in a string.
- * @param str Source string to search.
- * @param needle Placeholder token to replace.
- * @param value Replacement value to inject.
- * @return Newly allocated string containing the replacement, or NULL on error.
+ * @brief Find a loaded template by base filename.
+ * @return Entry of @p set, or NULL.
  */
-static char *
-replace_single(const char *str, const char *needle, const char *value)
+static const template_entry_t *
+template_find(const template_set_t *set, const char *filename)
 {
-	char *pos = strstr(str, needle);
-	if (!pos) {
-		return strdup(str);
-	}
+	uint32_t h = template_name_hash(filename);
+	size_t slot = h & set->index_mask;
+	uint32_t i;
 
-	size_t before_len = (size_t)(pos - str);
-	size_t needle_len = strlen(needle);
-	size_t value_len = strlen(value);
-	size_t after_len = strlen(pos + needle_len);
+	while ((i = set->index[slot]) != 0) {
+		const template_entry_t *e = &set->entries[i - 1];
 
-	/* Allocate exact memory for the new string */
-	char *result = malloc(before_len + value_len + after_len + 1);
-	if (!result)
-		return NULL;
+		if (e->hash == h && strcmp(e->filename, filename) == 0)
+			return e;
+		slot = (slot + 1) & set->index_mask;
+	}
+	return NULL;
+}
 
-	/* Build the new string from parts: [before][value][after] */
-	memcpy(result, str, before_len);
-	memcpy(result + before_len, value, value_len);
-	memcpy(result + before_len + value_len, pos + needle_len,
-		   after_len + 1);
+/**
+ * @brief Look up the base template and fill the slot values for @p data.
+ *
+ * @details The optional head and JS fragments render empty when missing.
+ *
+ * @param values Slot values, indexed by TEMPLATE_SLOT_*; NULL is empty.
+ * @param lens Their lengths.
+ *
+ * @return Compiled base template, or NULL when it or the page is missing.
+ */
+static const template_entry_t *
+template_resolve(const template_set_t *set, const struct template_data *data,
+    const char *values[TEMPLATE_SLOT_COUNT], size_t lens[TEMPLATE_SLOT_COUNT])
+{
+	const template_entry_t *base = template_find(set, "base.html");
+	const template_entry_t *page = template_find(set, data->page_content);
+	const template_entry_t *head = NULL;
+	const template_entry_t *js = NULL;
 
-	return result;
+	if (!base || !page)
+		return NULL;
+	if (data->extra_head_file)
+		head = template_find(set, data->extra_head_file);
+	if (data->extra_js_file)
+		js = template_find(set, data->extra_js_file);
+
+	values[TEMPLATE_SLOT_TITLE] = data->title;
+	lens[TEMPLATE_SLOT_TITLE] = strlen(data->title);
+	values[TEMPLATE_SLOT_PAGE_CONTENT] = page->content;
+	lens[TEMPLATE_SLOT_PAGE_CONTENT] = page->len;
+	values[TEMPLATE_SLOT_EXTRA_HEAD] = head ? head->content : NULL;
+	lens[TEMPLATE_SLOT_EXTRA_HEAD] = head ? head->len : 0;
+	values[TEMPLATE_SLOT_EXTRA_JS] = js ? js->content : NULL;
+	lens[TEMPLATE_SLOT_EXTRA_JS] = js ? js->len : 0;
+	values[TEMPLATE_SLOT_DATA] = NULL;
+	lens[TEMPLATE_SLOT_DATA] = 0;
+	return base;
 }
 
 /**
- * @brief Render a template using the layout and content fields in @p data.
- * @param data   Template descriptor with layout name and page content.
- * @param output Output pointer receiving the rendered HTML string.
- * @return 0 on success, -1 on cache miss or rendering failure.
+ * @brief Concatenate the segments of @p base, filling each slot.
+ *
+ * @param base Compiled base template.
+ * @param values Slot values, indexed by TEMPLATE_SLOT_*; NULL is empty.
+ * @param lens Their lengths.
+ *
+ * @return Newly allocated page, or NULL on allocation failure.
  */
+static char *
+template_gather(const template_entry_t *base,
+    const char *const values[TEMPLATE_SLOT_COUNT],
+    const size_t lens[TEMPLATE_SLOT_COUNT])
+{
+	size_t total = 0;
+	char *out;
+	char *w;
+
+	for (size_t i = 0; i < base->nsegs; i++) {
+		const template_segment_t *s = &base->segs[i];
+		total += s->slot < 0 ? s->len : lens[s->slot];
+	}
+	out = malloc(total + 1);
+	if (!out)
+		return NULL;
+
+	w = out;
+	for (size_t i = 0; i < base->nsegs; i++) {
+		const template_segment_t *s = &base->segs[i];
+		if (s->slot < 0) {
+			memcpy(w, base->content + s->off, s->len);
+			w += s->len;
+		} else if (values[s->slot]) {
+			memcpy(w, values[s->slot], lens[s->slot]);
+			w += lens[s->slot];
+		}
+	}
+	*w = '\0';
+	return out;
+}
+
 /**
  * @brief Render a full HTML page using base and content templates.
+ *
+ * @details Fragments are copied straight out of the current template set
+ * into one buffer sized up front.
+ *
  * @param data Template metadata and optional fragment filenames.
  * @param output Output pointer that receives the rendered HTML buffer.
  * @return Returns 0 on success or -1 when rendering fails.
@@ -500,44 +816,103 @@ replace_single(const char *str, const char *needle, const char *value)
 int
 template_render_with_data(struct template_data *data, char **output)
 {
-	char *base_template = NULL;
-	char *page_content = NULL;
-	char *extra_head = NULL;
-	char *extra_js = NULL;
+	const char *values[TEMPLATE_SLOT_COUNT];
+	size_t lens[TEMPLATE_SLOT_COUNT];
+	const template_entry_t *base;
+	template_set_t *set;
 	char *result = NULL;
-	int ret = -1;
 
 	if (!data || !data->title || !data->page_content) {
 		/* Missing mandatory data for rendering */
 		return -1;
 	}
 
-	if (load_layout_fragments(data, &base_template, &page_content,
-		&extra_head, &extra_js) != 0) {
-		goto cleanup;
-	}
+	set = template_set_acquire();
+	if (!set)
+		return -1;
+	base = template_resolve(set, data, values, lens);
+	if (base)
+		result = template_gather(base, values, lens);
+	template_set_release(set);
+	if (!result)
+		return -1;
+	*output = result;
+	return 0;
+}
+
+/**
+ * @brief Render a page as spans borrowed from the template cache.
+ *
+ * @details No byte of the page is copied: literal spans point into the
+ * base template, slots at the cached fragments and at @p data->title.
+ * The {{data}} slot renders empty; its position is reported so callers
+ * can splice per-request data in. The template set stays pinned until
+ * template_iov_release().
+ *
+ * @param data Template metadata; the title must outlive @p out.
+ * @param out Receives the spans, their total length and the pin.
+ * @return 0 on success, -1 when rendering fails.
+ */
+int
+template_render_iov(const struct template_data *data, struct template_iov *out)
+{
+	const char *values[TEMPLATE_SLOT_COUNT];
+	size_t lens[TEMPLATE_SLOT_COUNT];
+	const template_entry_t *base;
+	template_set_t *set;
+
+	out->iovcnt = 0;
+	out->len = 0;
+	out->version = 0;
+	out->pin = NULL;
+	out->data_at = -1;
+	out->data_off = 0;
+	if (!data || !data->title || !data->page_content)
+		return -1;
 
-	result = compose_layout(data, base_template, page_content,
-		extra_head, extra_js);
-	if (!result) {
-		goto cleanup;
+	set = template_set_acquire();
+	if (!set)
+		return -1;
+	base = template_resolve(set, data, values, lens);
+	if (!base) {
+		template_set_release(set);
+		return -1;
+	}
+	for (size_t i = 0; i < base->nsegs; i++) {
+		const template_segment_t *s = &base->segs[i];
+		const char *p = s->slot < 0 ? base->content + s->off :
+		    values[s->slot];
+		size_t n = s->slot < 0 ? s->len : lens[s->slot];
+
+		if (s->slot == TEMPLATE_SLOT_DATA) {
+			out->data_at = out->iovcnt;
+			out->data_off = out->len;
+		}
+		if (!p || n == 0)
+			continue;
+		out->iov[out->iovcnt].iov_base = (void *)(uintptr_t)p;
+		out->iov[out->iovcnt].iov_len = n;
+		out->iovcnt++;
+		out->len += n;
 	}
+	out->version = set->version;
+	out->pin = set;
+	return 0;
+}
 
-	*output = result;
-	ret = 0;
-
-	cleanup:
-	/* Ensure all intermediate buffers are freed */
-	if (base_template)
-		free(base_template);
-	if (page_content)
-		free(page_content);
-	if (extra_head)
-		free(extra_head);
-	if (extra_js)
-		free(extra_js);
-
-	return ret;
+/**
+ * @brief Unpin the template set behind a template_render_iov() result.
+ */
+void
+template_iov_release(struct template_iov *out)
+{
+	if (!out)
+		return;
+	template_set_release(out->pin);
+	out->pin = NULL;
+	out->iovcnt = 0;
+	out->len = 0;
+	out->data_at = -1;
 }
 
 /**
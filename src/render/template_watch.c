@@ -0,0 +1,121 @@
+/* template_watch.c - reload templates on EVFILT_VNODE events */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <miniweb/core/config.h>
+#include <miniweb/core/log.h>
+#include <miniweb/core/vnode_watch.h>
+#include <miniweb/render/template_engine.h>
+
+#define TEMPLATE_WATCH_MAX 128
+
+static pthread_mutex_t template_watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static vnode_watch_t *template_watch;
+static int template_watch_dir = -1;
+static int template_watch_fds[TEMPLATE_WATCH_MAX];
+static int template_watch_count;
+
+/**
+ * @brief Re-open and watch every regular file in the templates directory.
+ *
+ * Files are watched by descriptor, so a template replaced by rename
+ * keeps the old vnode; re-arming after each event follows the new one.
+ */
+static void
+template_watch_arm_locked(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+
+	for (int i = 0; i < template_watch_count; i++)
+		close(template_watch_fds[i]);
+	template_watch_count = 0;
+
+	dir = opendir(config_templates_dir);
+	if (!dir)
+		return;
+	while ((entry = readdir(dir)) != NULL &&
+	    template_watch_count < TEMPLATE_WATCH_MAX) {
+		char path[PATH_MAX];
+		struct stat st;
+		int fd;
+		int n;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		n = snprintf(path, sizeof(path), "%s/%s", config_templates_dir,
+		    entry->d_name);
+		if (n < 0 || (size_t)n >= sizeof(path))
+			continue;
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+		    vnode_watch_add(template_watch, fd, 0) != 0) {
+			close(fd);
+			continue;
+		}
+		template_watch_fds[template_watch_count++] = fd;
+	}
+	closedir(dir);
+}
+
+/** Watch callback: any change to the directory or a template. */
+static void
+template_watch_changed(int fd, unsigned int fflags, uintptr_t token)
+{
+	(void)fd;
+	(void)fflags;
+	(void)token;
+	template_cache_invalidate();
+	pthread_mutex_lock(&template_watch_lock);
+	template_watch_arm_locked();
+	pthread_mutex_unlock(&template_watch_lock);
+	/* Reload here, off the request path; renders keep the old snapshot. */
+	(void)template_cache_reload();
+}
+
+/**
+ * @brief Start invalidation-driven template reloads.
+ * @return 0 when watching, -1 when the TTL stays in charge.
+ */
+int
+template_watch_start(void)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&template_watch_lock);
+	if (template_watch_dir >= 0) {
+		rc = 0;
+		goto out;
+	}
+	if (!template_watch)
+		template_watch = vnode_watch_create(template_watch_changed);
+	if (!template_watch)
+		goto out;
+	template_watch_dir = open(config_templates_dir, O_RDONLY);
+	if (template_watch_dir < 0)
+		goto out;
+	if (vnode_watch_add(template_watch, template_watch_dir, 0) != 0) {
+		close(template_watch_dir);
+		template_watch_dir = -1;
+		goto out;
+	}
+	template_watch_arm_locked();
+	template_cache_set_watched(1);
+	/* Anything that changed before the watches were armed. */
+	template_cache_invalidate();
+	rc = 0;
+	log_debug("[TEMPLATE] watching %d templates in %s",
+	    template_watch_count, config_templates_dir);
+
+	out:
+	pthread_mutex_unlock(&template_watch_lock);
+	return rc;
+}
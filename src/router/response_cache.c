@@ -0,0 +1,745 @@
+/* response_cache.c - router-level cache of GET responses */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/core/cache_admin.h>
+#include <miniweb/core/counters.h>
+#include <miniweb/core/heartbeat.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/core/mem_budget.h>
+#include <miniweb/router/response_cache.h>
+#include <miniweb/router/urls.h>
+
+/*
+ * Each shard chains its entries off a small hash table and keeps them on
+ * a list from most to least recently used. An entry costs its key, its
+ * blob and its own header against the shard's budget; entries that
+ * expire are dropped when next looked up, or when eviction reaches them.
+ * Blobs are only released once the lock is dropped.
+ *
+ * A route with a stale_ms window keeps its entries past their TTL: a
+ * request then gets the old copy at once and queues the one refresh
+ * the entry is allowed, and an entry hit RESPONSE_CACHE_HOT_HITS times
+ * is queued in the last tenth of its TTL, before anyone sees it expire.
+ * The heartbeat replays the GET through the route's handler, its output
+ * going to /dev/null and its copy into the cache; an entry whose
+ * refresh fails is served stale until the window closes, then dropped.
+ */
+
+typedef struct rc_entry {
+	struct rc_entry *next;		/* bucket chain */
+	struct rc_entry *newer;
+	struct rc_entry *older;
+	uint64_t hash;
+	uint64_t expires;		/* monotonic ms */
+	uint64_t stale;			/* served stale until; = expires: not */
+	uint64_t ahead;			/* hot hits from here refresh early */
+	http_handler_t handler;		/* refreshes; NULL: put directly */
+	http_blob_t *blob;
+	size_t cost;
+	unsigned int hits;
+	int refreshing;			/* queued or running */
+	int route;
+	int variant;
+	size_t len;
+	char key[];			/* NUL-terminated */
+} rc_entry_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	rc_entry_t *bucket[RESPONSE_CACHE_BUCKETS];
+	rc_entry_t *newest;
+	rc_entry_t *oldest;
+	size_t bytes;
+	size_t entries;
+	uint64_t hits;
+	uint64_t misses;
+} rc_shard_t;
+
+typedef struct {
+	int route;
+	int variant;
+	http_handler_t handler;
+	size_t len;
+	char key[RESPONSE_CACHE_KEY_MAX];
+} rc_refresh_t;
+
+static rc_shard_t rc_shards[RESPONSE_CACHE_SHARDS];
+static pthread_once_t rc_once = PTHREAD_ONCE_INIT;
+static size_t rc_budget = RESPONSE_CACHE_BUDGET_BYTES;
+
+/* Taken inside a shard lock, never the other way round. */
+static pthread_mutex_t rc_refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static rc_refresh_t rc_refresh_queue[RESPONSE_CACHE_REFRESH_MAX];
+static size_t rc_refresh_head, rc_refresh_count;
+static int rc_sink = -1;		/* /dev/null, for replayed output */
+
+LOCKSTAT_SITE(lockstat_response_cache, "response_cache");
+
+/** FNV-1a over the route, the variant and the key. */
+static uint64_t
+rc_hash(int route, int variant, const char *key, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	h = (h ^ (unsigned)route) * 1099511628211ULL;
+	h = (h ^ (unsigned)variant) * 1099511628211ULL;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+	return h;
+}
+
+static rc_shard_t *
+rc_shard(uint64_t hash)
+{
+	return &rc_shards[hash % RESPONSE_CACHE_SHARDS];
+}
+
+/** Chain of @p sh that entries hashing to @p hash are on. */
+static rc_entry_t **
+rc_bucket(rc_shard_t *sh, uint64_t hash)
+{
+	return &sh->bucket[(hash / RESPONSE_CACHE_SHARDS) &
+	    (RESPONSE_CACHE_BUCKETS - 1)];
+}
+
+/** Entry of @p sh for the key, or NULL. Called with the lock held. */
+static rc_entry_t *
+rc_find(rc_shard_t *sh, uint64_t h, int route, int variant, const char *key,
+    size_t len)
+{
+	rc_entry_t *e;
+
+	for (e = *rc_bucket(sh, h); e; e = e->next) {
+		if (e->hash == h && e->route == route &&
+		    e->variant == variant && e->len == len &&
+		    memcmp(e->key, key, len) == 0)
+			break;
+	}
+	return e;
+}
+
+/** Take @p e off the LRU list only. Called with the lock held. */
+static void
+rc_lru_remove(rc_shard_t *sh, rc_entry_t *e)
+{
+	if (e->newer)
+		e->newer->older = e->older;
+	else
+		sh->newest = e->older;
+	if (e->older)
+		e->older->newer = e->newer;
+	else
+		sh->oldest = e->newer;
+}
+
+/** Take @p e off its chain and the LRU list. Called with the lock held. */
+static void
+rc_unlink(rc_shard_t *sh, rc_entry_t *e)
+{
+	rc_entry_t **pp = rc_bucket(sh, e->hash);
+
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	rc_lru_remove(sh, e);
+	sh->bytes -= e->cost;
+	sh->entries--;
+}
+
+/** Put @p e at the most recently used end. Called with the lock held. */
+static void
+rc_push_newest(rc_shard_t *sh, rc_entry_t *e)
+{
+	e->older = sh->newest;
+	e->newer = NULL;
+	if (sh->newest)
+		sh->newest->newer = e;
+	else
+		sh->oldest = e;
+	sh->newest = e;
+}
+
+/** Free a list of unlinked entries chained through next. */
+static void
+rc_free_list(rc_entry_t *e)
+{
+	while (e) {
+		rc_entry_t *next = e->next;
+
+		http_blob_release(e->blob);
+		free(e);
+		e = next;
+	}
+}
+
+/**
+ * Unlink least recently used entries of @p sh until it holds at most
+ * @p limit bytes; they are chained onto *@p freed. Called with the lock
+ * held. Returns the bytes given back.
+ */
+static size_t
+rc_trim(rc_shard_t *sh, size_t limit, rc_entry_t **freed)
+{
+	size_t before = sh->bytes;
+
+	while (sh->bytes > limit && sh->oldest) {
+		rc_entry_t *e = sh->oldest;
+
+		rc_unlink(sh, e);
+		e->next = *freed;
+		*freed = e;
+	}
+	return before - sh->bytes;
+}
+
+/** mem_budget usage(): bytes held and hits so far. */
+static size_t
+rc_usage(uint64_t *hits, void *ctx)
+{
+	size_t bytes = 0;
+
+	(void)ctx;
+	*hits = 0;
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		bytes += sh->bytes;
+		*hits += sh->hits;
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+	}
+	return bytes;
+}
+
+/** mem_budget shrink(): the same share of @p bytes from every shard. */
+static size_t
+rc_shrink(size_t bytes, void *ctx)
+{
+	size_t share = bytes / RESPONSE_CACHE_SHARDS + 1;
+	size_t freed_bytes = 0;
+
+	(void)ctx;
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+		rc_entry_t *freed = NULL;
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		freed_bytes += rc_trim(sh, sh->bytes > share ?
+		    sh->bytes - share : 0, &freed);
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+		rc_free_list(freed);
+	}
+	return freed_bytes;
+}
+
+/** cache_admin stats(): what every shard holds. */
+static void
+rc_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	(void)ctx;
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		st->bytes += sh->bytes;
+		st->entries += sh->entries;
+		st->hits += sh->hits;
+		st->misses += sh->misses;
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+	}
+}
+
+/** cache_admin purge(): keys are the path and sorted query. */
+static size_t
+rc_admin_purge(const char *key, int prefix, void *ctx)
+{
+	size_t purged = 0;
+
+	(void)ctx;
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+		rc_entry_t *freed = NULL, *e, *older;
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		for (e = sh->newest; e; e = older) {
+			older = e->older;
+			if (!cache_admin_match(e->key, key, prefix))
+				continue;
+			rc_unlink(sh, e);
+			e->next = freed;
+			freed = e;
+			purged++;
+		}
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+		rc_free_list(freed);
+	}
+	return purged;
+}
+
+static void
+rc_init(void)
+{
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++)
+		pthread_mutex_init(&rc_shards[i].lock, NULL);
+	(void)mem_budget_register(&(struct mem_cache_ops){
+		.name = "response_cache",
+		.usage = rc_usage,
+		.shrink = rc_shrink,
+	});
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "response_cache",
+		.stats = rc_admin_stats,
+		.purge = rc_admin_purge,
+	});
+}
+
+/** Length of the parameter name at the start of @p p, @p len bytes. */
+static size_t
+rc_param_name_len(const char *p, size_t len)
+{
+	const char *eq = memchr(p, '=', len);
+
+	return eq ? (size_t)(eq - p) : len;
+}
+
+/**
+ * @brief Build the cache key for a path and query.
+ *
+ * @details Parameters are ordered by name with an insertion sort, which
+ * keeps repeated names in the order they came: handlers read the first
+ * one, so "a=1&a=2" and "a=2&a=1" are different answers.
+ */
+int
+response_cache_key(const char *path, size_t path_len, const char *query,
+    char *buf, size_t cap)
+{
+	const char *param[RESPONSE_CACHE_PARAMS_MAX];
+	size_t plen[RESPONSE_CACHE_PARAMS_MAX];
+	size_t n = 0, off;
+
+	for (const char *p = query; p && *p != '\0';) {
+		size_t len = strcspn(p, "&");
+
+		if (len > 0) {
+			if (n == RESPONSE_CACHE_PARAMS_MAX)
+				return -1;
+			param[n] = p;
+			plen[n++] = len;
+		}
+		p += len;
+		if (*p == '&')
+			p++;
+	}
+	for (size_t i = 1; i < n; i++) {
+		const char *pi = param[i];
+		size_t li = plen[i], ni = rc_param_name_len(pi, li), j;
+
+		for (j = i; j > 0; j--) {
+			size_t nj = rc_param_name_len(param[j - 1], plen[j - 1]);
+			int c = memcmp(param[j - 1], pi, nj < ni ? nj : ni);
+
+			if (c < 0 || (c == 0 && nj <= ni))
+				break;
+			param[j] = param[j - 1];
+			plen[j] = plen[j - 1];
+		}
+		param[j] = pi;
+		plen[j] = li;
+	}
+
+	if (path_len >= cap)
+		return -1;
+	memcpy(buf, path, path_len);
+	off = path_len;
+	for (size_t i = 0; i < n; i++) {
+		if (off + 1 + plen[i] >= cap)
+			return -1;
+		buf[off++] = i == 0 ? '?' : '&';
+		memcpy(buf + off, param[i], plen[i]);
+		off += plen[i];
+	}
+	buf[off] = '\0';
+	return (int)off;
+}
+
+/**
+ * Queue a refresh of @p e unless one is queued or running. Called with
+ * its shard's lock held.
+ */
+static void
+rc_refresh_queue_entry(rc_entry_t *e)
+{
+	rc_refresh_t *j;
+
+	if (e->handler == NULL || e->refreshing)
+		return;
+	pthread_mutex_lock(&rc_refresh_lock);
+	if (rc_refresh_count < RESPONSE_CACHE_REFRESH_MAX) {
+		j = &rc_refresh_queue[(rc_refresh_head + rc_refresh_count++) %
+		    RESPONSE_CACHE_REFRESH_MAX];
+		j->route = e->route;
+		j->variant = e->variant;
+		j->handler = e->handler;
+		j->len = e->len;
+		memcpy(j->key, e->key, e->len + 1);
+		e->refreshing = 1;
+	}
+	pthread_mutex_unlock(&rc_refresh_lock);
+}
+
+/**
+ * Look an entry up: a fresh one, or with @p stale_ok one inside its
+ * route's stale window, queueing a refresh for it. Entries past both
+ * are dropped.
+ */
+static http_blob_t *
+rc_lookup(int route, int variant, const char *key, size_t len,
+    uint64_t now_ms, int stale_ok)
+{
+	uint64_t h = rc_hash(route, variant, key, len);
+	rc_shard_t *sh = rc_shard(h);
+	rc_entry_t *e, *stale = NULL;
+	http_blob_t *blob = NULL;
+
+	pthread_once(&rc_once, rc_init);
+	LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+	e = rc_find(sh, h, route, variant, key, len);
+	if (e && e->stale <= now_ms) {
+		rc_unlink(sh, e);
+		e->next = NULL;
+		stale = e;
+	} else if (e && (e->expires > now_ms || stale_ok)) {
+		if (sh->newest != e) {
+			rc_lru_remove(sh, e);
+			rc_push_newest(sh, e);
+		}
+		if (e->hits < UINT_MAX)
+			e->hits++;
+		if (e->expires <= now_ms || (now_ms >= e->ahead &&
+		    e->hits >= RESPONSE_CACHE_HOT_HITS))
+			rc_refresh_queue_entry(e);
+		blob = http_blob_ref(e->blob);
+	}
+	if (blob)
+		sh->hits++;
+	else
+		sh->misses++;
+	LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+	rc_free_list(stale);
+	counter_inc(blob ? CTR_RESPONSE_CACHE_HITS : CTR_RESPONSE_CACHE_MISSES);
+	return blob;
+}
+
+/**
+ * @brief Look up a fresh entry.
+ *
+ * @return A blob reference (release with http_blob_release()), or NULL.
+ */
+http_blob_t *
+response_cache_get(int route, int variant, const char *key, size_t len,
+    uint64_t now_ms)
+{
+	return rc_lookup(route, variant, key, len, now_ms, 0);
+}
+
+/**
+ * Keep @p blob under @p key, replacing an entry already there, fresh
+ * until @p expires_ms and refreshed through @p handler (may be NULL)
+ * within @p p's stale window. An entry bigger than a shard's share of
+ * the budget is not kept; otherwise least recently used ones make room.
+ */
+static void
+rc_store(int route, int variant, const char *key, size_t len,
+    http_blob_t *blob, uint64_t expires_ms, http_handler_t handler,
+    const route_cache_policy_t *p)
+{
+	uint64_t h = rc_hash(route, variant, key, len);
+	rc_shard_t *sh = rc_shard(h);
+	size_t limit = __atomic_load_n(&rc_budget, __ATOMIC_RELAXED) /
+	    RESPONSE_CACHE_SHARDS;
+	rc_entry_t **head, *e, *old, *freed = NULL;
+	size_t cost;
+
+	pthread_once(&rc_once, rc_init);
+	cost = sizeof(*e) + len + 1 + sizeof(*blob) + blob->len;
+	if (cost > limit || (e = malloc(sizeof(*e) + len + 1)) == NULL)
+		return;
+	e->hash = h;
+	e->expires = expires_ms;
+	e->stale = expires_ms;
+	e->ahead = expires_ms;
+	e->handler = NULL;
+	if (handler && p && p->stale_ms > 0) {
+		e->stale += (uint64_t)p->stale_ms;
+		e->ahead -= (uint64_t)p->ttl_ms / 10;
+		e->handler = handler;
+	}
+	e->blob = http_blob_ref(blob);
+	e->cost = cost;
+	e->hits = 0;
+	e->refreshing = 0;
+	e->route = route;
+	e->variant = variant;
+	e->len = len;
+	memcpy(e->key, key, len);
+	e->key[len] = '\0';
+
+	LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+	if ((old = rc_find(sh, h, route, variant, key, len)) != NULL) {
+		rc_unlink(sh, old);
+		old->next = NULL;
+		freed = old;
+	}
+	(void)rc_trim(sh, limit - cost, &freed);
+	head = rc_bucket(sh, h);
+	e->next = *head;
+	*head = e;
+	rc_push_newest(sh, e);
+	sh->bytes += cost;
+	sh->entries++;
+	LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+	rc_free_list(freed);
+}
+
+/**
+ * @brief Keep @p blob under @p key, replacing an entry already there.
+ *
+ * @details An entry bigger than a shard's share of the budget is not
+ * kept; otherwise least recently used ones make room.
+ */
+void
+response_cache_put(int route, int variant, const char *key, size_t len,
+    http_blob_t *blob, uint64_t expires_ms)
+{
+	rc_store(route, variant, key, len, blob, expires_ms, NULL, NULL);
+}
+
+/** Let the entry for @p j be queued again after its refresh failed. */
+static void
+rc_refresh_failed(const rc_refresh_t *j)
+{
+	uint64_t h = rc_hash(j->route, j->variant, j->key, j->len);
+	rc_shard_t *sh = rc_shard(h);
+	rc_entry_t *e;
+
+	LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+	if ((e = rc_find(sh, h, j->route, j->variant, j->key, j->len)) != NULL)
+		e->refreshing = 0;
+	LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+}
+
+/** Replay the GET of @p j through its handler and keep the answer. */
+static int
+rc_replay(const rc_refresh_t *j, uint64_t now_ms)
+{
+	const route_cache_policy_t *p = route_cache_policy(j->route);
+	char head[RESPONSE_CACHE_KEY_MAX + 64];
+	http_request_t req;
+	int n, rc;
+
+	if (p == NULL || rc_sink < 0)
+		return -1;
+	n = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\n%s\r\n", j->key,
+	    j->variant ? "Accept-Encoding: gzip\r\n" : "");
+	if (n < 0 || (size_t)n >= sizeof(head))
+		return -1;
+	memset(&req, 0, sizeof(req));
+	req.fd = rc_sink;
+	req.method = "GET";
+	req.method_id = HTTP_METHOD_GET;
+	req.url = j->key;
+	req.version = "HTTP/1.1";
+	req.keep_alive = 1;
+	req.buffer = head;
+	req.buffer_len = (size_t)n;
+	req.capture_max = p->max_bytes;
+	rc = j->handler(&req);
+	if (rc == 0 && req.captured)
+		rc_store(j->route, j->variant, j->key, j->len, req.captured,
+		    now_ms + (uint64_t)p->ttl_ms, j->handler, p);
+	else
+		rc = -1;
+	http_blob_release(req.captured);
+	return rc;
+}
+
+/**
+ * @brief Run up to @p max queued refreshes.
+ *
+ * @return int Entries refreshed.
+ */
+int
+response_cache_refresh(int max, uint64_t now_ms)
+{
+	rc_refresh_t j;
+	int done = 0;
+
+	pthread_mutex_lock(&rc_refresh_lock);
+	if (rc_sink < 0)
+		rc_sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	pthread_mutex_unlock(&rc_refresh_lock);
+	for (int i = 0; i < max; i++) {
+		pthread_mutex_lock(&rc_refresh_lock);
+		if (rc_refresh_count == 0) {
+			pthread_mutex_unlock(&rc_refresh_lock);
+			break;
+		}
+		j = rc_refresh_queue[rc_refresh_head];
+		rc_refresh_head = (rc_refresh_head + 1) %
+		    RESPONSE_CACHE_REFRESH_MAX;
+		rc_refresh_count--;
+		pthread_mutex_unlock(&rc_refresh_lock);
+
+		if (rc_replay(&j, now_ms) == 0)
+			done++;
+		else
+			rc_refresh_failed(&j);
+	}
+	return done;
+}
+
+/** Heartbeat: the refreshes queued since the last tick, a few at most. */
+static void
+rc_refresh_tick(void *ctx)
+{
+	struct timespec ts;
+
+	(void)ctx;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	(void)response_cache_refresh(RESPONSE_CACHE_REFRESH_PER_TICK,
+	    (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Refresh stale and hot entries on the heartbeat.
+ *
+ * @details Opens /dev/null for the replayed output now, before the
+ * process is sandboxed.
+ *
+ * @return 0 on success, -1 when the heartbeat cannot take the task.
+ */
+int
+response_cache_start(void)
+{
+	pthread_mutex_lock(&rc_refresh_lock);
+	if (rc_sink < 0)
+		rc_sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	pthread_mutex_unlock(&rc_refresh_lock);
+	if (heartbeat_register_ms(&(struct hb_task){
+		.name = "response_cache.refresh",
+		.cb = rc_refresh_tick,
+		.ctx = NULL,
+	    }, RESPONSE_CACHE_REFRESH_MS, RESPONSE_CACHE_REFRESH_MS) < 0)
+		return -1;
+	return heartbeat_start();
+}
+
+/**
+ * @brief Set the byte budget; shards over their new share are trimmed
+ * at once.
+ */
+void
+response_cache_set_budget(size_t bytes)
+{
+	pthread_once(&rc_once, rc_init);
+	__atomic_store_n(&rc_budget, bytes, __ATOMIC_RELAXED);
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+		rc_entry_t *freed = NULL;
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		(void)rc_trim(sh, bytes / RESPONSE_CACHE_SHARDS, &freed);
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+		rc_free_list(freed);
+	}
+}
+
+/** @brief Drop every entry and queued refresh; the budget is left. */
+void
+response_cache_cleanup(void)
+{
+	pthread_once(&rc_once, rc_init);
+	(void)heartbeat_unregister("response_cache.refresh");
+	pthread_mutex_lock(&rc_refresh_lock);
+	rc_refresh_head = rc_refresh_count = 0;
+	pthread_mutex_unlock(&rc_refresh_lock);
+	for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+		rc_shard_t *sh = &rc_shards[i];
+		rc_entry_t *freed = NULL;
+
+		LOCKSTAT_LOCK(&sh->lock, lockstat_response_cache);
+		(void)rc_trim(sh, 0, &freed);
+		LOCKSTAT_UNLOCK(&sh->lock, lockstat_response_cache);
+		rc_free_list(freed);
+	}
+}
+
+/** Whether @p req must reach the handler without the cache at all. */
+static int
+rc_bypass(http_request_t *req)
+{
+	return http_request_get_header(req, "If-None-Match") != NULL ||
+	    http_request_get_header(req, "If-Modified-Since") != NULL ||
+	    http_request_get_header(req, "Range") != NULL ||
+	    http_request_get_header(req, "Authorization") != NULL ||
+	    http_request_get_header(req, "Cookie") != NULL;
+}
+
+/** Whether @p req asks for a fresh answer ("Cache-Control: no-cache"). */
+static int
+rc_no_cache(http_request_t *req)
+{
+	const char *cc = http_request_get_header(req, "Cache-Control");
+
+	return cc != NULL && strstr(cc, "no-cache") != NULL;
+}
+
+/**
+ * @brief Serve @p req from the cache or through @p handler.
+ *
+ * @details On a miss the handler runs with req->capture_max set, so the
+ * send keeps a copy of a complete 200; that copy is stored when the
+ * handler succeeded. Within the route's stale window an expired copy
+ * is sent and refreshed in the background.
+ */
+int
+response_cache_serve(http_request_t *req, int route, http_handler_t handler,
+    uint64_t now_ms)
+{
+	const route_cache_policy_t *p = route_cache_policy(route);
+	char key[RESPONSE_CACHE_KEY_MAX];
+	http_blob_t *blob;
+	int len, variant, rc;
+
+	if (p == NULL || __atomic_load_n(&rc_budget, __ATOMIC_RELAXED) == 0 ||
+	    http_request_method(req) != HTTP_METHOD_GET || rc_bypass(req) ||
+	    (len = response_cache_key(req->url, http_request_path_len(req),
+	    http_request_query(req), key, sizeof(key))) < 0)
+		return handler(req);
+
+	variant = http_request_accepts_encoding(req, "gzip");
+	if (!rc_no_cache(req) && (blob = rc_lookup(route, variant, key,
+	    (size_t)len, now_ms, 1)) != NULL) {
+		rc = http_blob_send(req, blob);
+		http_blob_release(blob);
+		return rc;
+	}
+
+	req->capture_max = p->max_bytes;
+	rc = handler(req);
+	if (rc == 0 && req->captured)
+		rc_store(route, variant, key, (size_t)len, req->captured,
+		    now_ms + (uint64_t)p->ttl_ms, handler, p);
+	req->capture_max = 0;
+	http_blob_release(req->captured);
+	req->captured = NULL;
+	return rc;
+}
@@ -0,0 +1,520 @@
+/* route_stats.c - per-route request counters and latency histograms */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/http/handler.h>
+#include <miniweb/router/route_stats.h>
+#include <miniweb/router/urls.h>
+
+/*
+ * Every thread that serves requests owns a block of counters, reached
+ * through a pthread key like the response free lists. Only the owner
+ * writes its block, with relaxed atomic stores, so recording takes no
+ * lock and shares no cache line with other workers. Readers walk the
+ * registered blocks under route_stats_lock and add them up; a thread
+ * that exits folds its block into route_stats_retired first.
+ */
+
+#define ROUTE_STATS_ITEM_MAX	3072
+#define ROUTE_STATS_JSON_MAX	65536
+
+typedef struct {
+	uint64_t requests;
+	uint64_t bytes;
+	uint64_t usec;			/* handler time, for the mean */
+	uint64_t max_usec;
+	uint64_t status[5];		/* 1xx .. 5xx */
+	uint64_t hist[ROUTE_STATS_BUCKETS];
+} route_stats_route_t;
+
+typedef struct route_stats_block {
+	route_stats_route_t routes[ROUTE_STATS_IDS];
+	struct route_stats_block *next;
+} route_stats_block_t;
+
+static pthread_key_t route_stats_key;
+static pthread_once_t route_stats_once = PTHREAD_ONCE_INIT;
+static int route_stats_key_ok;
+
+static pthread_mutex_t route_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static route_stats_block_t *route_stats_blocks;
+static route_stats_block_t route_stats_retired;
+
+/** Histogram bucket of a @p usec latency. */
+static unsigned int
+route_stats_bucket(uint64_t usec)
+{
+	unsigned int msb, b;
+
+	if (usec < 4)
+		return (unsigned int)usec;
+	msb = 63 - (unsigned int)__builtin_clzll(usec);
+	b = 4 * (msb - 1) + (unsigned int)((usec >> (msb - 2)) & 3);
+	return b < ROUTE_STATS_BUCKETS ? b : ROUTE_STATS_BUCKETS - 1;
+}
+
+/** Largest latency, in microseconds, that falls in bucket @p b. */
+static uint64_t
+route_stats_bucket_top(unsigned int b)
+{
+	unsigned int shift;
+
+	if (b < 4)
+		return b;
+	shift = b / 4 - 1;
+	return ((uint64_t)(4 + b % 4 + 1) << shift) - 1;
+}
+
+/** Add @p from into @p to; @p atomic when another thread owns @p from. */
+static void
+route_stats_fold(route_stats_route_t *to, const route_stats_route_t *from,
+    int atomic)
+{
+#define ROUTE_STATS_READ(f) \
+	(atomic ? __atomic_load_n(&(f), __ATOMIC_RELAXED) : (f))
+	uint64_t max;
+
+	to->requests += ROUTE_STATS_READ(from->requests);
+	to->bytes += ROUTE_STATS_READ(from->bytes);
+	to->usec += ROUTE_STATS_READ(from->usec);
+	max = ROUTE_STATS_READ(from->max_usec);
+	if (max > to->max_usec)
+		to->max_usec = max;
+	for (int i = 0; i < 5; i++)
+		to->status[i] += ROUTE_STATS_READ(from->status[i]);
+	for (int i = 0; i < ROUTE_STATS_BUCKETS; i++)
+		to->hist[i] += ROUTE_STATS_READ(from->hist[i]);
+#undef ROUTE_STATS_READ
+}
+
+/** pthread_key destructor: keep a departing thread's counts. */
+static void
+route_stats_thread_free(void *p)
+{
+	route_stats_block_t *blk = p;
+	route_stats_block_t **pp;
+
+	pthread_mutex_lock(&route_stats_lock);
+	for (pp = &route_stats_blocks; *pp; pp = &(*pp)->next) {
+		if (*pp == blk) {
+			*pp = blk->next;
+			break;
+		}
+	}
+	for (int i = 0; i < ROUTE_STATS_IDS; i++)
+		route_stats_fold(&route_stats_retired.routes[i],
+		    &blk->routes[i], 0);
+	pthread_mutex_unlock(&route_stats_lock);
+	free(blk);
+}
+
+static void
+route_stats_key_init(void)
+{
+	route_stats_key_ok = pthread_key_create(&route_stats_key,
+	    route_stats_thread_free) == 0;
+}
+
+/** Calling thread's block, created on first use; NULL if unavailable. */
+static route_stats_block_t *
+route_stats_thread(void)
+{
+	route_stats_block_t *blk;
+
+	(void)pthread_once(&route_stats_once, route_stats_key_init);
+	if (!route_stats_key_ok)
+		return NULL;
+	blk = pthread_getspecific(route_stats_key);
+	if (blk)
+		return blk;
+	blk = calloc(1, sizeof(*blk));
+	if (!blk)
+		return NULL;
+	if (pthread_setspecific(route_stats_key, blk) != 0) {
+		free(blk);
+		return NULL;
+	}
+	pthread_mutex_lock(&route_stats_lock);
+	blk->next = route_stats_blocks;
+	route_stats_blocks = blk;
+	pthread_mutex_unlock(&route_stats_lock);
+	return blk;
+}
+
+/* Owner-only increment: readers may load the field at any time. */
+#define ROUTE_STATS_ADD(f, n) \
+	__atomic_store_n(&(f), (f) + (n), __ATOMIC_RELAXED)
+
+/**
+ * @brief Count one request against route @p id.
+ *
+ * @param id Route id from route_lookup(), or ROUTE_STATS_UNMATCHED.
+ * @param status Status code sent, 0 when nothing was.
+ * @param bytes Bytes handed to the socket.
+ * @param usec Time the handler took.
+ */
+void
+route_stats_record(int id, int status, size_t bytes, uint64_t usec)
+{
+	route_stats_block_t *blk;
+	route_stats_route_t *r;
+
+	if (id < 0 || id >= ROUTE_STATS_IDS)
+		id = ROUTE_STATS_UNMATCHED;
+	if ((blk = route_stats_thread()) == NULL)
+		return;
+	r = &blk->routes[id];
+	ROUTE_STATS_ADD(r->requests, 1);
+	ROUTE_STATS_ADD(r->bytes, bytes);
+	ROUTE_STATS_ADD(r->usec, usec);
+	if (usec > r->max_usec)
+		__atomic_store_n(&r->max_usec, usec, __ATOMIC_RELAXED);
+	if (status >= 100 && status < 600)
+		ROUTE_STATS_ADD(r->status[status / 100 - 1], 1);
+	ROUTE_STATS_ADD(r->hist[route_stats_bucket(usec)], 1);
+}
+
+/** Sum every thread's counters into @p out, ROUTE_STATS_IDS entries. */
+static void
+route_stats_collect(route_stats_route_t *out)
+{
+	pthread_mutex_lock(&route_stats_lock);
+	memcpy(out, route_stats_retired.routes,
+	    sizeof(route_stats_retired.routes));
+	for (route_stats_block_t *blk = route_stats_blocks; blk;
+	    blk = blk->next) {
+		for (int i = 0; i < ROUTE_STATS_IDS; i++)
+			route_stats_fold(&out[i], &blk->routes[i], 1);
+	}
+	pthread_mutex_unlock(&route_stats_lock);
+}
+
+/**
+ * Latency under which @p pct percent of @p r's requests finished, as the
+ * top of the bucket that holds it, capped at the slowest one seen.
+ */
+static uint64_t
+route_stats_percentile(const route_stats_route_t *r, unsigned int pct)
+{
+	uint64_t want = (r->requests * pct + 99) / 100;
+	uint64_t seen = 0;
+
+	if (want == 0)
+		want = 1;
+	for (unsigned int b = 0; b < ROUTE_STATS_BUCKETS; b++) {
+		seen += r->hist[b];
+		if (seen >= want) {
+			uint64_t top = route_stats_bucket_top(b);
+
+			return top < r->max_usec ? top : r->max_usec;
+		}
+	}
+	return r->max_usec;
+}
+
+/** Format route @p id as one JSON object; length, or -1 if it overflowed. */
+static int
+route_stats_item(char *buf, size_t size, int id,
+    const route_stats_route_t *r, int detail)
+{
+	char name[256];
+	size_t len;
+	int n;
+
+	if (id == ROUTE_STATS_UNMATCHED)
+		strlcpy(name, "unmatched", sizeof(name));
+	else if (!route_describe(id, name, sizeof(name)))
+		return 0;
+
+	n = snprintf(buf, size,
+	    "{\"route\": \"%s\", \"requests\": %llu, "
+	    "\"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, "
+	    "\"4xx\": %llu, \"5xx\": %llu}, \"bytes\": %llu, "
+	    "\"mean_us\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, "
+	    "\"p99_us\": %llu, \"max_us\": %llu",
+	    name, (unsigned long long)r->requests,
+	    (unsigned long long)r->status[0], (unsigned long long)r->status[1],
+	    (unsigned long long)r->status[2], (unsigned long long)r->status[3],
+	    (unsigned long long)r->status[4], (unsigned long long)r->bytes,
+	    (unsigned long long)(r->usec / r->requests),
+	    (unsigned long long)route_stats_percentile(r, 50),
+	    (unsigned long long)route_stats_percentile(r, 90),
+	    (unsigned long long)route_stats_percentile(r, 99),
+	    (unsigned long long)r->max_usec);
+	if (n < 0 || (size_t)n >= size)
+		return -1;
+	len = (size_t)n;
+
+	if (detail) {
+		const char *sep = "";
+
+		n = snprintf(buf + len, size - len, ", \"histogram\": [");
+		if (n < 0 || (size_t)n >= size - len)
+			return -1;
+		len += (size_t)n;
+		/* [top_us, count] pairs for the buckets that saw requests. */
+		for (unsigned int b = 0; b < ROUTE_STATS_BUCKETS; b++) {
+			if (r->hist[b] == 0)
+				continue;
+			n = snprintf(buf + len, size - len, "%s[%llu, %llu]", sep,
+			    (unsigned long long)route_stats_bucket_top(b),
+			    (unsigned long long)r->hist[b]);
+			if (n < 0 || (size_t)n >= size - len)
+				return -1;
+			len += (size_t)n;
+			sep = ", ";
+		}
+		if (size - len < 2)
+			return -1;
+		buf[len++] = ']';
+		buf[len] = '\0';
+	}
+	if (size - len < 2)
+		return -1;
+	buf[len++] = '}';
+	buf[len] = '\0';
+	return (int)len;
+}
+
+/**
+ * @brief Append the "routes" member: one object per route that served
+ * at least one request, in route id order.
+ *
+ * @param buf Destination buffer.
+ * @param size Destination buffer size.
+ * @param detail Non-zero to include the histogram buckets.
+ */
+void
+route_stats_append_json(char *buf, size_t size, int detail)
+{
+	static const char open[] = "\"routes\": [";
+	route_stats_route_t *all;
+	char item[ROUTE_STATS_ITEM_MAX];
+	size_t len;
+
+	if (size < sizeof(open) + 1) {
+		if (size > 0)
+			buf[0] = '\0';
+		return;
+	}
+	memcpy(buf, open, sizeof(open) - 1);
+	len = sizeof(open) - 1;
+
+	all = calloc(ROUTE_STATS_IDS, sizeof(*all));
+	if (all) {
+		route_stats_collect(all);
+		for (int id = 0; id < ROUTE_STATS_IDS; id++) {
+			int n;
+
+			if (all[id].requests == 0)
+				continue;
+			n = route_stats_item(item, sizeof(item), id, &all[id],
+			    detail);
+			if (n <= 0)
+				continue;
+			/* Room for a separator, the item and the "]". */
+			if (len + (size_t)n + 3 >= size)
+				break;
+			if (buf[len - 1] != '[') {
+				buf[len++] = ',';
+				buf[len++] = ' ';
+			}
+			memcpy(buf + len, item, (size_t)n);
+			len += (size_t)n;
+		}
+		free(all);
+	}
+	buf[len++] = ']';
+	buf[len] = '\0';
+}
+
+/* Histogram bounds, in microseconds, exposed to scrapers. */
+static const uint64_t route_stats_om_bounds[] = {
+	100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000,
+};
+#define ROUTE_STATS_OM_BOUNDS \
+	(sizeof(route_stats_om_bounds) / sizeof(route_stats_om_bounds[0]))
+
+/** Append @p fmt to @p buf at @p *len; 0, or -1 when it did not fit. */
+static int
+route_stats_om_printf(char *buf, size_t size, size_t *len, const char *fmt,
+    ...)
+{
+	va_list ap;
+	int n;
+
+	if (*len >= size)
+		return -1;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *len, size - *len, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (size_t)n >= size - *len) {
+		buf[*len] = '\0';
+		return -1;
+	}
+	*len += (size_t)n;
+	return 0;
+}
+
+/** Route @p id's name as an OpenMetrics label value. */
+static int
+route_stats_om_label(int id, char *out, size_t size)
+{
+	char name[256];
+	size_t o = 0;
+
+	if (id == ROUTE_STATS_UNMATCHED)
+		strlcpy(name, "unmatched", sizeof(name));
+	else if (!route_describe(id, name, sizeof(name)))
+		return 0;
+	for (const char *p = name; *p && o + 3 < size; p++) {
+		if (*p == '"' || *p == '\\')
+			out[o++] = '\\';
+		if (*p == '\n') {
+			out[o++] = '\\';
+			out[o++] = 'n';
+			continue;
+		}
+		out[o++] = *p;
+	}
+	out[o] = '\0';
+	return 1;
+}
+
+/**
+ * @brief Append the request, byte and latency families of every route
+ * that served a request.
+ *
+ * @param buf Destination buffer.
+ * @param size Destination buffer size.
+ * @return Bytes written, up to the last family that fit whole.
+ */
+size_t
+route_stats_append_openmetrics(char *buf, size_t size)
+{
+	static const char *const classes[5] = {
+		"1xx", "2xx", "3xx", "4xx", "5xx"
+	};
+	route_stats_route_t *all;
+	char label[512];
+	size_t len = 0, mark;
+	int id;
+
+	if (size == 0)
+		return 0;
+	buf[0] = '\0';
+	if ((all = calloc(ROUTE_STATS_IDS, sizeof(*all))) == NULL)
+		return 0;
+	route_stats_collect(all);
+
+	mark = len;
+	if (route_stats_om_printf(buf, size, &len,
+	    "# TYPE miniweb_http_requests counter\n"
+	    "# HELP miniweb_http_requests Requests served, by route and "
+	    "status class.\n") != 0)
+		goto out;
+	for (id = 0; id < ROUTE_STATS_IDS; id++) {
+		if (all[id].requests == 0 ||
+		    !route_stats_om_label(id, label, sizeof(label)))
+			continue;
+		for (int c = 0; c < 5; c++) {
+			if (all[id].status[c] == 0)
+				continue;
+			if (route_stats_om_printf(buf, size, &len,
+			    "miniweb_http_requests_total{route=\"%s\","
+			    "code=\"%s\"} %llu\n", label, classes[c],
+			    (unsigned long long)all[id].status[c]) != 0)
+				goto cut;
+		}
+	}
+
+	mark = len;
+	if (route_stats_om_printf(buf, size, &len,
+	    "# TYPE miniweb_http_response_bytes counter\n"
+	    "# UNIT miniweb_http_response_bytes bytes\n") != 0)
+		goto cut;
+	for (id = 0; id < ROUTE_STATS_IDS; id++) {
+		if (all[id].requests == 0 ||
+		    !route_stats_om_label(id, label, sizeof(label)))
+			continue;
+		if (route_stats_om_printf(buf, size, &len,
+		    "miniweb_http_response_bytes_total{route=\"%s\"} %llu\n",
+		    label, (unsigned long long)all[id].bytes) != 0)
+			goto cut;
+	}
+
+	/* Cumulative counts at each bound, from the log-linear buckets. */
+	mark = len;
+	if (route_stats_om_printf(buf, size, &len,
+	    "# TYPE miniweb_http_handler_seconds histogram\n"
+	    "# UNIT miniweb_http_handler_seconds seconds\n") != 0)
+		goto cut;
+	for (id = 0; id < ROUTE_STATS_IDS; id++) {
+		const route_stats_route_t *r = &all[id];
+		uint64_t cum = 0;
+		unsigned int b = 0;
+
+		if (r->requests == 0 ||
+		    !route_stats_om_label(id, label, sizeof(label)))
+			continue;
+		for (size_t i = 0; i < ROUTE_STATS_OM_BOUNDS; i++) {
+			while (b < ROUTE_STATS_BUCKETS - 1 &&
+			    route_stats_bucket_top(b) <= route_stats_om_bounds[i])
+				cum += r->hist[b++];
+			if (route_stats_om_printf(buf, size, &len,
+			    "miniweb_http_handler_seconds_bucket{route=\"%s\","
+			    "le=\"%g\"} %llu\n", label,
+			    (double)route_stats_om_bounds[i] / 1e6,
+			    (unsigned long long)cum) != 0)
+				goto cut;
+		}
+		if (route_stats_om_printf(buf, size, &len,
+		    "miniweb_http_handler_seconds_bucket{route=\"%s\","
+		    "le=\"+Inf\"} %llu\n"
+		    "miniweb_http_handler_seconds_count{route=\"%s\"} %llu\n"
+		    "miniweb_http_handler_seconds_sum{route=\"%s\"} %.6f\n",
+		    label, (unsigned long long)r->requests,
+		    label, (unsigned long long)r->requests,
+		    label, (double)r->usec / 1e6) != 0)
+			goto cut;
+	}
+	goto out;
+
+cut:
+	/* Drop the family that did not fit rather than leave half of it. */
+	len = mark;
+	buf[len] = '\0';
+out:
+	free(all);
+	return len;
+}
+
+/**
+ * @brief Handle GET /api/stats/routes.
+ * @param req Request context used by the HTTP layer.
+ * @return HTTP send status code from the response layer.
+ */
+int
+route_stats_handler(http_request_t *req)
+{
+	char *json;
+	size_t len;
+	int ret;
+
+	json = malloc(ROUTE_STATS_JSON_MAX);
+	if (!json)
+		return http_send_error(req, 500, "Unable to allocate response");
+	json[0] = '{';
+	route_stats_append_json(json + 1, ROUTE_STATS_JSON_MAX - 2, 1);
+	len = strlen(json);
+	json[len++] = '}';
+	json[len] = '\0';
+	ret = http_send_json(req, json);
+	free(json);
+	return ret;
+}
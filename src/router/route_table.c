@@ -3,7 +3,9 @@
 
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,29 +13,41 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <miniweb/http/bundle.h>
 #include <miniweb/http/handler.h>
 #include <miniweb/http/utils.h>
+#include <miniweb/core/cache_admin.h>
 #include <miniweb/core/config.h>
+#include <miniweb/core/counters.h>
+#include <miniweb/core/lockstat.h>
+#include <miniweb/core/vnode_watch.h>
 #include <miniweb/router/routes.h>
 #include <miniweb/router/urls.h>
 
-#define HOT_VIEW_CACHE_TTL_SEC 10
-#define HOT_VIEW_CACHE_MAX 5
-
+/*
+ * Rendered views, one slot per declarative view route. Each holds a
+ * prepared response tagged with the template snapshot version it was
+ * rendered from; a new snapshot makes every slot miss once. Views that
+ * embed a data snapshot keep the page only: the data is spliced in at
+ * data_off on every send.
+ */
 typedef struct {
-	const char *path;
-	char *body;
-	time_t created_at;
-} hot_view_cache_entry_t;
-
-static hot_view_cache_entry_t g_hot_view_cache[HOT_VIEW_CACHE_MAX] = {
-	{ .path = "/" },
-	{ .path = "/docs" },
-	{ .path = "/networking" },
-	{ .path = "/packages" },
-	{ .path = "/apiroot" },
-};
-static pthread_mutex_t g_hot_view_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	http_blob_t *blob;	/* prepared response, shared with senders */
+	unsigned long version;	/* template_cache_version() of the render */
+	size_t data_off;	/* {{data}} offset in blob, or VIEW_NO_DATA */
+} view_cache_entry_t;
+
+#define VIEW_NO_DATA	SIZE_MAX
+#define VIEW_ADMIN_BATCH	8	/* purged blobs released per lock hold */
+
+#define VIEW_DATA_OPEN	"<script type=\"application/json\" id=\"miniweb-data\">"
+#define VIEW_DATA_CLOSE	"</script>"
+
+static view_cache_entry_t *g_view_cache;
+static size_t g_view_cache_count;
+static pthread_once_t g_view_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_view_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+LOCKSTAT_SITE(lockstat_views, "view_cache");
 
 /**
  * @brief html_escape operation.
@@ -120,35 +134,225 @@ append_str(char **buf, size_t *cap, size_t *len, const char *s)
 	return 0;
 }
 
+/*
+ * Rendered autoindex pages are cached per directory and page. An entry
+ * is trusted while the directory's inode and mtime match the stat(2)
+ * static_handler() already made, and is dropped early by an EVFILT_VNODE
+ * watch on the directory where kqueue is available. Large directories
+ * are split into pages so a hit never costs more than one page.
+ */
+#define AUTOINDEX_CACHE_MAX	32
+#define AUTOINDEX_PAGE_ENTRIES	500
+
+typedef struct {
+	char path[512];		/* directory, as built by static_handler() */
+	unsigned int page;	/* 1-based */
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtim;
+	int watch_fd;		/* watched directory descriptor, or -1 */
+	time_t used_at;
+	http_blob_t *blob;	/* NULL marks a free slot */
+} autoindex_cache_entry_t;
+
+static autoindex_cache_entry_t g_autoindex_cache[AUTOINDEX_CACHE_MAX];
+static pthread_mutex_t g_autoindex_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_autoindex_watch_once = PTHREAD_ONCE_INIT;
+static vnode_watch_t *g_autoindex_watch;
+
+/** Release a slot's listing and watch; called with the lock held. */
+static void
+autoindex_cache_drop_locked(autoindex_cache_entry_t *e)
+{
+	http_blob_release(e->blob);
+	e->blob = NULL;
+	if (e->watch_fd >= 0)
+		close(e->watch_fd);
+	e->watch_fd = -1;
+}
+
+/** Watch callback: any change to a listed directory drops its pages. */
+static void
+autoindex_dir_changed(int fd, unsigned int fflags, uintptr_t token)
+{
+	(void)fflags;
+	(void)token;
+	pthread_mutex_lock(&g_autoindex_cache_lock);
+	for (size_t i = 0; i < AUTOINDEX_CACHE_MAX; i++) {
+		if (g_autoindex_cache[i].blob &&
+		    g_autoindex_cache[i].watch_fd == fd)
+			autoindex_cache_drop_locked(&g_autoindex_cache[i]);
+	}
+	pthread_mutex_unlock(&g_autoindex_cache_lock);
+}
+
+static void
+autoindex_watch_init(void)
+{
+	g_autoindex_watch = vnode_watch_create(autoindex_dir_changed);
+}
+
+/** True when @p a and @p b describe the same directory state. */
+static int
+autoindex_same_dir(const struct stat *a, dev_t dev, ino_t ino,
+    const struct timespec *mtim)
+{
+	return a->st_dev == dev && a->st_ino == ino &&
+	    a->st_mtim.tv_sec == mtim->tv_sec &&
+	    a->st_mtim.tv_nsec == mtim->tv_nsec;
+}
+
 /**
- * @brief send_autoindex operation.
+ * @brief Cached listing for @p fullpath at @p page, if still current.
+ * @return New reference to the prepared blob, or NULL.
+ */
+static http_blob_t *
+autoindex_cache_get(const char *fullpath, unsigned int page,
+    const struct stat *st)
+{
+	http_blob_t *hit = NULL;
+
+	pthread_mutex_lock(&g_autoindex_cache_lock);
+	for (size_t i = 0; i < AUTOINDEX_CACHE_MAX; i++) {
+		autoindex_cache_entry_t *e = &g_autoindex_cache[i];
+
+		if (!e->blob || e->page != page ||
+		    strcmp(e->path, fullpath) != 0)
+			continue;
+		if (autoindex_same_dir(st, e->dev, e->ino, &e->mtim)) {
+			e->used_at = time(NULL);
+			hit = http_blob_ref(e->blob);
+		} else {
+			autoindex_cache_drop_locked(e);
+		}
+		break;
+	}
+	pthread_mutex_unlock(&g_autoindex_cache_lock);
+	return hit;
+}
+
+/**
+ * @brief Publish a rendered page.
  *
- * @details Performs the core send_autoindex routine for this module.
+ * @details @p fd was opened and watched before the directory was read.
+ * Its state is compared with @p st under the lock, like the file cache
+ * does: a change before this point shows here, a later one reaches the
+ * callback once the entry is in place. The slot takes over @p fd.
+ */
+static void
+autoindex_cache_put(const char *fullpath, unsigned int page,
+    const struct stat *st, int fd, http_blob_t *blob)
+{
+	autoindex_cache_entry_t *slot = NULL;
+	struct stat now;
+
+	pthread_mutex_lock(&g_autoindex_cache_lock);
+	if (fd >= 0 && (fstat(fd, &now) != 0 ||
+	    !autoindex_same_dir(&now, st->st_dev, st->st_ino, &st->st_mtim))) {
+		pthread_mutex_unlock(&g_autoindex_cache_lock);
+		close(fd);
+		return;
+	}
+	for (size_t i = 0; i < AUTOINDEX_CACHE_MAX; i++) {
+		autoindex_cache_entry_t *e = &g_autoindex_cache[i];
+
+		if (e->blob && e->page == page &&
+		    strcmp(e->path, fullpath) == 0) {
+			slot = e;
+			break;
+		}
+		if (!slot || (slot->blob &&
+		    (!e->blob || e->used_at < slot->used_at)))
+			slot = e;
+	}
+	if (slot->blob)
+		autoindex_cache_drop_locked(slot);
+	strlcpy(slot->path, fullpath, sizeof(slot->path));
+	slot->page = page;
+	slot->dev = st->st_dev;
+	slot->ino = st->st_ino;
+	slot->mtim = st->st_mtim;
+	slot->watch_fd = fd;
+	slot->used_at = time(NULL);
+	slot->blob = http_blob_ref(blob);
+	pthread_mutex_unlock(&g_autoindex_cache_lock);
+}
+
+/** Page number from a "page=N" query parameter; 1 when absent, 0 if bad. */
+static unsigned int
+autoindex_page(const char *query)
+{
+	const char *q = query;
+	unsigned long v;
+	char *end;
+
+	while (q) {
+		if (strncmp(q, "page=", 5) == 0) {
+			errno = 0;
+			v = strtoul(q + 5, &end, 10);
+			if (errno != 0 || end == q + 5 || v == 0 ||
+			    v > 1000000 || (*end != '\0' && *end != '&' &&
+			    *end != '#'))
+				return 0;
+			return (unsigned int)v;
+		}
+		q = strchr(q, '&');
+		if (q)
+			q++;
+	}
+	return 1;
+}
+
+/** True when the entry @p de in @p fullpath is a directory. */
+static int
+autoindex_is_dir(const char *fullpath, const struct dirent *de)
+{
+	char pbuf[1024];
+	struct stat st;
+
+	if (de->d_type == DT_DIR)
+		return 1;
+	if (de->d_type != DT_UNKNOWN && de->d_type != DT_LNK)
+		return 0;
+	snprintf(pbuf, sizeof(pbuf), "%s/%s", fullpath, de->d_name);
+	return stat(pbuf, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Render page @p page of the listing of @p fullpath.
+ *
+ * @details Entries before and after the page are only counted; names
+ * are escaped and typed for the page actually shown.
  *
- * @param req Input parameter for send_autoindex.
- * @param req_path Input parameter for send_autoindex.
- * @param fullpath Input parameter for send_autoindex.
+ * @param out Receives the malloc'd HTML on success.
+ * @param out_len Receives its length.
  *
- * @return Return value produced by send_autoindex.
+ * @return 0 on success, 404 when @p page is past the end, 403 when the
+ *         directory cannot be read, 500 when memory runs out.
  */
 static int
-send_autoindex(http_request_t *req, const char *req_path, const char *fullpath)
+autoindex_render(const char *req_path, const char *fullpath,
+    unsigned int page, char **out, size_t *out_len)
 {
 	DIR *dir;
 	struct dirent *de;
 	char *html;
 	char *escaped;
+	char item[1024];
 	size_t cap = 4096;
 	size_t len = 0;
+	size_t first = (size_t)(page - 1) * AUTOINDEX_PAGE_ENTRIES;
+	size_t total = 0;
+	size_t pages;
 
 	dir = opendir(fullpath);
 	if (!dir)
-		return http_send_error(req, 403, "Directory listing disabled");
+		return 403;
 
 	html = malloc(cap);
 	if (!html) {
 		closedir(dir);
-		return http_send_error(req, 500, "Out of memory");
+		return 500;
 	}
 	html[0] = '\0';
 
@@ -156,7 +360,7 @@ send_autoindex(http_request_t *req, const char *req_path, const char *fullpath)
 	if (!escaped) {
 		closedir(dir);
 		free(html);
-		return http_send_error(req, 500, "Out of memory");
+		return 500;
 	}
 
 	if (append_str(&html, &cap, &len,
@@ -172,29 +376,27 @@ send_autoindex(http_request_t *req, const char *req_path, const char *fullpath)
 		free(escaped);
 		closedir(dir);
 		free(html);
-		return http_send_error(req, 500, "Out of memory");
+		return 500;
 	}
 	free(escaped);
 
-	if (strcmp(req_path, "/static/") != 0) {
+	if (page == 1 && strcmp(req_path, "/static/") != 0) {
 		if (append_str(&html, &cap, &len,
 		    "<li><a href=\"../\">../</a></li>") != 0) {
 			closedir(dir);
 			free(html);
-			return http_send_error(req, 500, "Out of memory");
+			return 500;
 		}
 	}
 
 	while ((de = readdir(dir)) != NULL) {
-		char item[1024];
-		int is_dir = 0;
-		struct stat st;
-		char pbuf[1024];
+		int is_dir;
+
 		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
 			continue;
-		snprintf(pbuf, sizeof(pbuf), "%s/%s", fullpath, de->d_name);
-		if (stat(pbuf, &st) == 0 && S_ISDIR(st.st_mode))
-			is_dir = 1;
+		if (total++ < first || total > first + AUTOINDEX_PAGE_ENTRIES)
+			continue;
+		is_dir = autoindex_is_dir(fullpath, de);
 		escaped = html_escape(de->d_name);
 		if (!escaped)
 			continue;
@@ -204,26 +406,126 @@ send_autoindex(http_request_t *req, const char *req_path, const char *fullpath)
 		if (append_str(&html, &cap, &len, item) != 0) {
 			closedir(dir);
 			free(html);
-			return http_send_error(req, 500, "Out of memory");
+			return 500;
 		}
 	}
 	closedir(dir);
 
-	if (append_str(&html, &cap, &len, "</ul></div></body></html>") != 0) {
+	if (page > 1 && total <= first) {
+		free(html);
+		return 404;
+	}
+	if (append_str(&html, &cap, &len, "</ul>") != 0) {
 		free(html);
+		return 500;
+	}
+	pages = (total + AUTOINDEX_PAGE_ENTRIES - 1) / AUTOINDEX_PAGE_ENTRIES;
+	if (pages > 1) {
+		int n = snprintf(item, sizeof(item),
+		    "<p>Page %u of %zu (%zu entries)", page, pages, total);
+		if (n > 0 && page > 1)
+			n += snprintf(item + n, sizeof(item) - (size_t)n,
+			    " &middot; <a href=\"?page=%u\">previous</a>",
+			    page - 1);
+		if (n > 0 && (size_t)n < sizeof(item) && page < pages)
+			snprintf(item + n, sizeof(item) - (size_t)n,
+			    " &middot; <a href=\"?page=%u\">next</a>", page + 1);
+		if (append_str(&html, &cap, &len, item) != 0 ||
+		    append_str(&html, &cap, &len, "</p>") != 0) {
+			free(html);
+			return 500;
+		}
+	}
+	if (append_str(&html, &cap, &len, "</div></body></html>") != 0) {
+		free(html);
+		return 500;
+	}
+	*out = html;
+	*out_len = len;
+	return 0;
+}
+
+/**
+ * @brief Send the listing of a directory without an index file.
+ *
+ * @param req Request context for response generation.
+ * @param req_path Request path, with its trailing slash.
+ * @param fullpath Directory on disk.
+ * @param st stat(2) of @p fullpath, used to validate cached pages.
+ *
+ * @return Returns 0 on success or a negative value on failure.
+ */
+static int
+send_autoindex(http_request_t *req, const char *req_path, const char *fullpath,
+    const struct stat *st)
+{
+	unsigned int page = autoindex_page(http_request_query(req));
+	http_blob_t *blob;
+	char *html = NULL;
+	size_t len = 0;
+	int fd = -1;
+	int rc;
+
+	if (page == 0)
+		return http_send_error(req, 400, "Bad Request");
+
+	blob = autoindex_cache_get(fullpath, page, st);
+	if (blob) {
+		rc = http_blob_send(req, blob);
+		http_blob_release(blob);
+		return rc;
+	}
+
+	/* Arm the watch before reading, so no change slips in between. */
+	pthread_once(&g_autoindex_watch_once, autoindex_watch_init);
+	if (g_autoindex_watch && (fd = open(fullpath, O_RDONLY)) >= 0 &&
+	    vnode_watch_add(g_autoindex_watch, fd, 0) != 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	rc = autoindex_render(req_path, fullpath, page, &html, &len);
+	if (rc != 0) {
+		if (fd >= 0)
+			close(fd);
+		if (rc == 403)
+			return http_send_error(req, 403, "Directory listing disabled");
+		if (rc == 404)
+			return http_send_error(req, 404, "Not Found");
 		return http_send_error(req, 500, "Out of memory");
 	}
 
 	http_response_t *resp = http_response_create();
 	if (!resp) {
 		free(html);
+		if (fd >= 0)
+			close(fd);
 		return -1;
 	}
 	resp->content_type = "text/html; charset=utf-8";
+	blob = http_blob_alloc(len);
+	if (blob) {
+		memcpy(blob->data, html, len);
+		if (http_blob_prepare(blob, resp) != 0) {
+			http_blob_release(blob);
+			blob = NULL;
+		}
+	}
+	if (blob) {
+		free(html);
+		http_response_free(resp);
+		autoindex_cache_put(fullpath, page, st, fd, blob);
+		rc = http_blob_send(req, blob);
+		http_blob_release(blob);
+		return rc;
+	}
+
+	if (fd >= 0)
+		close(fd);
 	http_response_set_body(resp, html, len, 1);
-	int ret = http_response_send(req, resp);
+	rc = http_response_send(req, resp);
 	http_response_free(resp);
-	return ret;
+	return rc;
 }
 
 /**
@@ -252,21 +554,318 @@ send_redirect(http_request_t *req, int status_code, const char *location)
 	return ret;
 }
 
+/** cache_admin stats(): prepared views held. */
+static void
+view_cache_admin_stats(struct cache_admin_stats *st, void *ctx)
+{
+	uint64_t v[CTR_COUNT];
+
+	(void)ctx;
+	LOCKSTAT_LOCK(&g_view_cache_lock, lockstat_views);
+	for (size_t i = 0; i < g_view_cache_count; i++) {
+		if (g_view_cache[i].blob) {
+			st->bytes += g_view_cache[i].blob->len;
+			st->entries++;
+		}
+	}
+	LOCKSTAT_UNLOCK(&g_view_cache_lock, lockstat_views);
+	counters_read(v);
+	st->hits = v[CTR_VIEW_CACHE_HITS];
+	st->misses = v[CTR_VIEW_CACHE_MISSES];
+}
+
+/** cache_admin purge(): keys are the view paths, as in "/docs". */
+static size_t
+view_cache_admin_purge(const char *key, int prefix, void *ctx)
+{
+	http_blob_t *old[VIEW_ADMIN_BATCH];
+	size_t purged = 0;
+	size_t i = 0;
+	int n;
+
+	(void)ctx;
+	do {
+		n = 0;
+		LOCKSTAT_LOCK(&g_view_cache_lock, lockstat_views);
+		for (; i < g_view_cache_count && n < VIEW_ADMIN_BATCH; i++) {
+			if (g_view_cache[i].blob == NULL ||
+			    !cache_admin_match(view_route_at(i)->path, key,
+			    prefix))
+				continue;
+			old[n++] = g_view_cache[i].blob;
+			g_view_cache[i].blob = NULL;
+		}
+		LOCKSTAT_UNLOCK(&g_view_cache_lock, lockstat_views);
+		for (int k = 0; k < n; k++)
+			http_blob_release(old[k]);
+		purged += (size_t)n;
+	} while (i < g_view_cache_count);
+	return purged;
+}
+
+/** Size the view cache to the declarative view routes. */
+static void
+view_cache_init(void)
+{
+	g_view_cache_count = view_route_count();
+	g_view_cache = calloc(g_view_cache_count, sizeof(*g_view_cache));
+	if (g_view_cache == NULL)
+		g_view_cache_count = 0;
+	(void)cache_admin_register(&(struct cache_admin_ops){
+		.name = "view_cache",
+		.stats = view_cache_admin_stats,
+		.purge = view_cache_admin_purge,
+	});
+}
+
+/**
+ * @brief Send a view with one writev of cached template spans.
+ * @param req Request context for response generation.
+ * @param data View to render.
+ * @return Returns 0 on success or a negative value on failure.
+ */
+static int
+send_view_iov(http_request_t *req, const struct template_data *data)
+{
+	struct template_iov tiov;
+	char etag[HTTP_ETAG_MAX];
+	int ret;
+
+	if (template_render_iov(data, &tiov) != 0)
+		return http_send_error(req, 500, "Template rendering failed");
+
+	http_response_t *resp = http_response_create();
+	if (!resp) {
+		template_iov_release(&tiov);
+		return -1;
+	}
+	/* Tag with the template set the spans were taken from. */
+	if (tiov.version != 0) {
+		http_etag_for_version('t', tiov.version, etag, sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+	}
+	ret = http_response_send_iov(req, resp, tiov.iov, tiov.iovcnt);
+	http_response_free(resp);
+	template_iov_release(&tiov);
+	return ret;
+}
+
+/**
+ * @brief Cached rendering of @p view if it was made from @p version.
+ * @param data_off Receives the {{data}} offset of a hit.
+ * @return New reference to the prepared blob, or NULL on a miss.
+ */
+static http_blob_t *
+view_cache_get(const struct view_route *view, unsigned long version,
+    size_t *data_off)
+{
+	http_blob_t *hit = NULL;
+	size_t i;
+
+	pthread_once(&g_view_cache_once, view_cache_init);
+	i = view_route_index(view);
+	if (!g_view_cache || i >= g_view_cache_count) {
+		counter_inc(CTR_VIEW_CACHE_MISSES);
+		return NULL;
+	}
+	LOCKSTAT_LOCK(&g_view_cache_lock, lockstat_views);
+	if (g_view_cache[i].blob && g_view_cache[i].version == version) {
+		hit = http_blob_ref(g_view_cache[i].blob);
+		*data_off = g_view_cache[i].data_off;
+	}
+	LOCKSTAT_UNLOCK(&g_view_cache_lock, lockstat_views);
+	counter_inc(hit ? CTR_VIEW_CACHE_HITS : CTR_VIEW_CACHE_MISSES);
+	return hit;
+}
+
+/** Keep @p blob, rendered from template @p version, for @p view. */
+static void
+view_cache_put(const struct view_route *view, unsigned long version,
+    http_blob_t *blob, size_t data_off)
+{
+	http_blob_t *old = NULL;
+	size_t i = view_route_index(view);
+
+	if (!g_view_cache || i >= g_view_cache_count)
+		return;
+	/* A render from a snapshot replaced meanwhile is sent, not kept. */
+	if (version == 0 || version != template_cache_version())
+		return;
+	LOCKSTAT_LOCK(&g_view_cache_lock, lockstat_views);
+	old = g_view_cache[i].blob;
+	g_view_cache[i].blob = http_blob_ref(blob);
+	g_view_cache[i].version = version;
+	g_view_cache[i].data_off = data_off;
+	LOCKSTAT_UNLOCK(&g_view_cache_lock, lockstat_views);
+	http_blob_release(old);
+}
+
+/**
+ * @brief Render @p data into a prepared blob.
+ *
+ * @details The page is gathered from the template spans straight into
+ * the blob, the one copy a view costs per template version.
+ *
+ * @param tagged Whether the prepared head carries the template ETag;
+ *        pages that embed data change per request and carry none.
+ * @param version Receives the template version the blob was made from.
+ * @param data_off Receives the {{data}} offset, or VIEW_NO_DATA.
+ * @return Blob holding one reference, or NULL on failure.
+ */
+static http_blob_t *
+view_render_blob(const struct template_data *data, int tagged,
+    unsigned long *version, size_t *data_off)
+{
+	struct template_iov tiov;
+	char etag[HTTP_ETAG_MAX];
+	http_blob_t *blob;
+	http_response_t *resp;
+	size_t off = 0;
+
+	if (template_render_iov(data, &tiov) != 0)
+		return NULL;
+	blob = http_blob_alloc(tiov.len);
+	resp = blob ? http_response_create() : NULL;
+	if (!resp) {
+		http_blob_release(blob);
+		template_iov_release(&tiov);
+		return NULL;
+	}
+	for (int i = 0; i < tiov.iovcnt; i++) {
+		memcpy(blob->data + off, tiov.iov[i].iov_base,
+		    tiov.iov[i].iov_len);
+		off += tiov.iov[i].iov_len;
+	}
+	if (tagged && tiov.version != 0) {
+		http_etag_for_version('t', tiov.version, etag, sizeof(etag));
+		http_response_add_validators(resp, etag, 0);
+	}
+	*version = tiov.version;
+	*data_off = tiov.data_at >= 0 ? tiov.data_off : VIEW_NO_DATA;
+	template_iov_release(&tiov);
+	if (http_blob_prepare(blob, resp) != 0) {
+		http_blob_release(blob);
+		blob = NULL;
+	}
+	http_response_free(resp);
+	return blob;
+}
+
 /**
- * @brief Return a cached hot-view entry for @p url, or NULL if absent/expired.
- * @param url Request URL to look up.
- * @return Pointer to the cache entry, or NULL.
+ * @brief Escape every '<' in @p json as \u003c.
+ *
+ * @details '<' only occurs inside JSON strings, where the escape reads
+ * back the same; without it a string holding "</script>" would end the
+ * element early.
+ *
+ * @param len In: length of @p json. Out: length of the result.
+ * @param owned Set to 1 when the result was malloc'd.
+ * @return @p json itself when nothing needs escaping, the escaped copy,
+ *         or NULL on allocation failure.
  */
-static hot_view_cache_entry_t *
-find_hot_view_cache_entry(const char *path)
+static char *
+view_data_escape(http_request_t *req, char *json, size_t *len, int *owned)
+{
+	size_t lt = 0;
+	char *out;
+	char *w;
+
+	*owned = 0;
+	for (size_t i = 0; i < *len; i++)
+		lt += json[i] == '<';
+	if (lt == 0)
+		return json;
+	out = req->arena ? http_arena_alloc(req->arena, *len + 5 * lt) :
+	    malloc(*len + 5 * lt);
+	if (!out)
+		return NULL;
+	*owned = req->arena == NULL;
+	w = out;
+	for (size_t i = 0; i < *len; i++) {
+		if (json[i] == '<') {
+			memcpy(w, "\\u003c", 6);
+			w += 6;
+		} else
+			*w++ = json[i];
+	}
+	*len = (size_t)(w - out);
+	return out;
+}
+
+/**
+ * @brief Send a cached view page with its data snapshot spliced in.
+ *
+ * @details The page goes out in one writev, around a JSON script element
+ * holding @p view's current snapshot. Without a snapshot the prepared
+ * page is sent alone and its script fetches the data itself.
+ *
+ * @param blob Cached page of @p view.
+ * @param data_off Offset of the {{data}} slot in @p blob.
+ * @return Returns 0 on success or a negative value on failure.
+ */
+static int
+send_view_embedded(http_request_t *req, const struct view_route *view,
+    http_blob_t *blob, size_t data_off)
 {
-	for (size_t i = 0; i < HOT_VIEW_CACHE_MAX; i++) {
-		if (strcmp(g_hot_view_cache[i].path, path) == 0)
-			return &g_hot_view_cache[i];
+	struct iovec iov[5];
+	http_response_t *resp;
+	char *json;
+	char *esc;
+	size_t len;
+	int owned;
+	int ret;
+
+	json = view->embed(req->arena, NULL);
+	if (!json)
+		return http_blob_send(req, blob);
+	len = strlen(json);
+	esc = view_data_escape(req, json, &len, &owned);
+	resp = esc ? http_response_create() : NULL;
+	if (!resp) {
+		ret = http_blob_send(req, blob);
+		goto out;
 	}
-	return NULL;
+	iov[0].iov_base = blob->data;
+	iov[0].iov_len = data_off;
+	iov[1].iov_base = (void *)(uintptr_t)VIEW_DATA_OPEN;
+	iov[1].iov_len = sizeof(VIEW_DATA_OPEN) - 1;
+	iov[2].iov_base = esc;
+	iov[2].iov_len = len;
+	iov[3].iov_base = (void *)(uintptr_t)VIEW_DATA_CLOSE;
+	iov[3].iov_len = sizeof(VIEW_DATA_CLOSE) - 1;
+	iov[4].iov_base = blob->data + data_off;
+	iov[4].iov_len = blob->len - data_off;
+	ret = http_response_send_iov(req, resp, iov, 5);
+	http_response_free(resp);
+
+	out:
+	if (owned)
+		free(esc);
+	if (!req->arena)
+		free(json);
+	return ret;
 }
 
+/**
+ * @brief Copy the view cache counters.
+ * @param out Receives hits, misses and the number of cached views.
+ */
+void
+view_cache_stats(view_cache_stats_t *out)
+{
+	uint64_t v[CTR_COUNT];
+
+	counters_read(v);
+	out->hits = (unsigned long)v[CTR_VIEW_CACHE_HITS];
+	out->misses = (unsigned long)v[CTR_VIEW_CACHE_MISSES];
+	out->entries = 0;
+	LOCKSTAT_LOCK(&g_view_cache_lock, lockstat_views);
+	for (size_t i = 0; g_view_cache && i < g_view_cache_count; i++) {
+		if (g_view_cache[i].blob)
+			out->entries++;
+	}
+	LOCKSTAT_UNLOCK(&g_view_cache_lock, lockstat_views);
+}
 
 /**
  * @brief View template handler.
@@ -276,72 +875,51 @@ find_hot_view_cache_entry(const char *path)
 int
 view_template_handler(http_request_t *req)
 {
-	time_t now = time(NULL);
-	hot_view_cache_entry_t *cache_entry = NULL;
-
-	/* --- Cache hit path --- */
-	if (req->url && strchr(req->url, '?') == NULL) {
-		pthread_mutex_lock(&g_hot_view_cache_lock);
-		cache_entry = find_hot_view_cache_entry(req->url);
-		if (cache_entry && cache_entry->body &&
-			(now - cache_entry->created_at) <= HOT_VIEW_CACHE_TTL_SEC) {
-			char *cached = strdup(cache_entry->body);
-		pthread_mutex_unlock(&g_hot_view_cache_lock);
-		if (!cached) {
-			return http_send_error(req, 500, "Out of memory");
-		}
-		int ret = http_send_html(req, cached);
-		free(cached);
-		return ret;
-			}
-			pthread_mutex_unlock(&g_hot_view_cache_lock);
-	}
+	const struct view_route *view;
+	char etag[HTTP_ETAG_MAX];
+	unsigned long version;
+	size_t data_off = VIEW_NO_DATA;
+	http_blob_t *blob;
+	int ret;
 
-	/* --- Cache miss: render --- */
-	const struct view_route *view = find_view_route(req->method, req->url);
+	view = find_view_route(http_request_method(req), req->url,
+	    http_request_path_len(req));
 	if (view == NULL) {
 		return http_send_error(req, 404, "Not Found");
 	}
 
-	struct template_data data = {
-		.title           = view->title,
-		.page_content    = view->page,
-		.extra_head_file = view->extra_head,
-		.extra_js_file   = view->extra_js,
-	};
-
-	char *output = NULL;
-	if (template_render_with_data(&data, &output) != 0) {
-		if (data.page_content &&
-			template_render(data.page_content, &output) != 0) {
-			return http_send_error(req, 500, "Template rendering failed");
-			}
-	}
-	if (!output) {
-		return http_send_error(req, 500, "Template rendering failed");
+	/*
+	 * Views change only with their templates: revalidate against those.
+	 * Views embedding a data snapshot change on every send instead.
+	 */
+	version = template_cache_version();
+	if (version != 0 && !view->embed) {
+		http_etag_for_version('t', version, etag, sizeof(etag));
+		if (http_request_not_modified(req, etag, 0))
+			return http_send_not_modified(req, etag, 0);
 	}
 
-	/* Cache owns its own strdup copy — independent from the response buffer. */
-	if (cache_entry) {
-		char *cache_copy = strdup(output);
-		if (cache_copy) {
-			pthread_mutex_lock(&g_hot_view_cache_lock);
-			free(cache_entry->body);
-			cache_entry->body = cache_copy;
-			cache_entry->created_at = now;
-			pthread_mutex_unlock(&g_hot_view_cache_lock);
-		}
-	}
+	/* --- Cache hit path: a prepared response, sent by reference --- */
+	blob = view_cache_get(view, version, &data_off);
+	if (!blob) {
+		struct template_data data = {
+			.title           = view->title,
+			.page_content    = view->page,
+			.extra_head_file = view->extra_head,
+			.extra_js_file   = view->extra_js,
+		};
 
-	/* Response takes ownership of output and frees it (free_body = 1). */
-	http_response_t *resp = http_response_create();
-	if (!resp) {
-		free(output);
-		return -1;
+		blob = view_render_blob(&data, view->embed == NULL, &version,
+		    &data_off);
+		if (!blob)
+			return send_view_iov(req, &data);
+		view_cache_put(view, version, blob, data_off);
 	}
-	http_response_set_body(resp, output, strlen(output), 1);
-	int ret = http_response_send(req, resp);
-	http_response_free(resp);
+	if (view->embed && data_off != VIEW_NO_DATA)
+		ret = send_view_embedded(req, view, blob, data_off);
+	else
+		ret = http_blob_send(req, blob);
+	http_blob_release(blob);
 	return ret;
 }
 
@@ -353,7 +931,12 @@ view_template_handler(http_request_t *req)
 int
 favicon_handler(http_request_t *req)
 {
+	static const char name[] = "static/assets/favicon.svg";
+	const bundle_file_t *bf = bundle_lookup(name, sizeof(name) - 1);
 	char favicon_path[512];
+
+	if (bf)
+		return http_send_bundle(req, bf);
 	snprintf(favicon_path, sizeof(favicon_path), "%s/assets/favicon.svg", config_static_dir);
 	return http_send_file(req, favicon_path, "image/svg+xml");
 }
@@ -370,6 +953,8 @@ favicon_handler(http_request_t *req)
 	char req_path[512];
 	char redirect[512];
 	char index_path[512];
+	char bundle_name[520];
+	const bundle_file_t *bf;
 	const char *url;
 	const char *relpath;
 	const char *mime;
@@ -401,6 +986,13 @@ favicon_handler(http_request_t *req)
 	if (strstr(relpath, "..") || strstr(relpath, "//"))
 		return http_send_error(req, 403, "Forbidden");
 
+	/* Bundled files first: no stat(2), no open(2). Anything else,
+	 * directories included, is looked for on disk. */
+	n = snprintf(bundle_name, sizeof(bundle_name), "static/%s", relpath);
+	if (n > 0 && (size_t)n < sizeof(bundle_name) &&
+	    (bf = bundle_lookup(bundle_name, (size_t)n)) != NULL)
+		return http_send_bundle(req, bf);
+
 	n = snprintf(fullpath, sizeof(fullpath), "%s/%s", config_static_dir,
 	    relpath);
 	if (n < 0 || (size_t)n >= sizeof(fullpath))
@@ -429,7 +1021,7 @@ favicon_handler(http_request_t *req)
 		if (n > 0 && (size_t)n < sizeof(index_path) && access(index_path, R_OK) == 0)
 			return http_send_file(req, index_path, mime_type_for_path("index.htm"));
 
-		return send_autoindex(req, req_path, fullpath);
+		return send_autoindex(req, req_path, fullpath, &st);
 	}
 
 	mime = mime_type_for_path(relpath);
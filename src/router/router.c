@@ -1,4 +1,3 @@
-
 /* router.c - minimal routing */
 #include <miniweb/router/router.h>
 
@@ -14,9 +13,7 @@ int
 router_register(struct router *r, const char *method,
 				const char *path, route_handler_t handler)
 {
-	if (!r || !r->register_fn)
-		return -1;
-	return r->register_fn(r->ctx, method, path, handler);
+	return router_register_class(r, ROUTE_CLASS_FAST, method, path, handler);
 }
 
 /**
@@ -31,9 +28,84 @@ router_register(struct router *r, const char *method,
 int
 router_register_prefix(struct router *r, const char *method,
 					   const char *prefix, int min_slashes, route_handler_t handler)
+{
+	return router_register_prefix_class(r, ROUTE_CLASS_FAST, method, prefix,
+								 min_slashes, handler);
+}
+
+/**
+ * @brief Register an exact-match route on the work-queue lane @p cls.
+ * @param r       Router instance.
+ * @param cls     Route cost class.
+ * @param method  HTTP method string.
+ * @param path    Exact URL path.
+ * @param handler Route handler function.
+ * @return 0 on success, -1 on overflow or invalid input.
+ */
+int
+router_register_class(struct router *r, route_class_t cls,
+					  const char *method, const char *path, route_handler_t handler)
+{
+	return router_register_cached(r, cls, method, path, handler, NULL);
+}
+
+/**
+ * @brief Register a prefix-match route on the work-queue lane @p cls.
+ * @param r         Router instance.
+ * @param cls       Route cost class.
+ * @param method    HTTP method string.
+ * @param prefix    URL prefix to match.
+ * @param min_slashes Minimum slashes required after prefix.
+ * @param handler   Route handler function.
+ * @return 0 on success, -1 on overflow or invalid input.
+ */
+int
+router_register_prefix_class(struct router *r, route_class_t cls,
+							 const char *method, const char *prefix, int min_slashes,
+							 route_handler_t handler)
+{
+	return router_register_prefix_cached(r, cls, method, prefix,
+								 min_slashes, handler, NULL);
+}
+
+/**
+ * @brief Register an exact-match route whose answers may be cached.
+ * @param r       Router instance.
+ * @param cls     Route cost class.
+ * @param method  HTTP method string.
+ * @param path    Exact URL path.
+ * @param handler Route handler function.
+ * @param cache   Response-cache policy, copied; NULL for none.
+ * @return 0 on success, -1 on overflow or invalid input.
+ */
+int
+router_register_cached(struct router *r, route_class_t cls,
+					   const char *method, const char *path, route_handler_t handler,
+					   const route_cache_policy_t *cache)
+{
+	if (!r || !r->register_fn)
+		return -1;
+	return r->register_fn(r->ctx, method, path, handler, cls, cache);
+}
+
+/**
+ * @brief Register a prefix-match route whose answers may be cached.
+ * @param r         Router instance.
+ * @param cls       Route cost class.
+ * @param method    HTTP method string.
+ * @param prefix    URL prefix to match.
+ * @param min_slashes Minimum slashes required after prefix.
+ * @param handler   Route handler function.
+ * @param cache     Response-cache policy, copied; NULL for none.
+ * @return 0 on success, -1 on overflow or invalid input.
+ */
+int
+router_register_prefix_cached(struct router *r, route_class_t cls,
+							  const char *method, const char *prefix, int min_slashes,
+							  route_handler_t handler, const route_cache_policy_t *cache)
 {
 	if (!r || !r->register_prefix_fn)
 		return -1;
 	return r->register_prefix_fn(r->ctx, method, prefix,
-								 min_slashes, handler);
+								 min_slashes, handler, cls, cache);
 }
@@ -1,101 +1,221 @@
 /* url_registry.c - URL routing table */
 
+#include <stdint.h>
 #include <string.h>
 
 #include <miniweb/router/urls.h>
 
 #include "url_registry_internal.h"
 
+#if MAX_ROUTES > 32 || MAX_PREFIX_ROUTES > 32
+#error "route masks are 32 bits wide"
+#endif
+
 struct route routes[MAX_ROUTES];
 size_t route_count = 0;
 struct prefix_route prefix_routes[MAX_PREFIX_ROUTES];
 size_t prefix_route_count = 0;
 
+/*
+ * Lookup index, kept in step with the tables as routes are registered,
+ * which all happens in init_routes(). Exact paths go into an
+ * open-addressing hash whose slots hold the mask of routes[] entries on
+ * that path; prefixes go into a byte trie whose nodes hold the mask of
+ * prefix_routes[] entries ending there. Masks are walked from bit 0, so
+ * the first registration still wins. A request costs one probe and one
+ * walk along its path, however many modules attached routes.
+ */
+#define ROUTE_PATH_SLOTS	(2 * MAX_ROUTES)	/* power of two */
+#define PREFIX_TRIE_NODES	512
+
+struct route_path_slot {
+	const char *path;	/* NULL: free */
+	size_t len;
+	uint32_t hash;
+	uint32_t routes;	/* bit i: routes[i] has this path */
+};
+
+struct prefix_trie_node {
+	unsigned short child;	/* first child, 0 for none */
+	unsigned short sibling;	/* next sibling, 0 for none */
+	unsigned char ch;
+	uint32_t routes;	/* bit i: prefix_routes[i] ends here */
+};
+
+static struct route_path_slot route_paths[ROUTE_PATH_SLOTS];
+static struct prefix_trie_node prefix_trie[PREFIX_TRIE_NODES];
+static size_t prefix_trie_count = 1;	/* node 0 is the root */
+static int prefix_trie_full;		/* lookups fall back to scanning */
+static int prefix_route_slashes[MAX_PREFIX_ROUTES];
+
+/** FNV-1a over the @p len bytes of @p path. */
+static uint32_t
+route_path_hash(const char *path, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/** Slot holding @p path, or the free slot where it would go. */
+static struct route_path_slot *
+route_path_slot(const char *path, size_t len, uint32_t hash)
+{
+	size_t i = hash & (ROUTE_PATH_SLOTS - 1);
+
+	while (route_paths[i].path && (route_paths[i].hash != hash ||
+	    route_paths[i].len != len ||
+	    memcmp(route_paths[i].path, path, len) != 0))
+		i = (i + 1) & (ROUTE_PATH_SLOTS - 1);
+	return &route_paths[i];
+}
+
+/** Child of node @p n labelled @p ch, or 0. */
+static unsigned short
+prefix_trie_child(unsigned short n, unsigned char ch)
+{
+	unsigned short c;
+
+	for (c = prefix_trie[n].child; c != 0; c = prefix_trie[c].sibling) {
+		if (prefix_trie[c].ch == ch)
+			break;
+	}
+	return c;
+}
+
+/** Add prefix_routes[@p i] to the trie; on overflow, stop using it. */
+static void
+prefix_trie_insert(size_t i)
+{
+	const unsigned char *p = (const unsigned char *)prefix_routes[i].prefix;
+	unsigned short n = 0;
+
+	if (prefix_trie_full)
+		return;
+	for (; *p; p++) {
+		unsigned short c = prefix_trie_child(n, *p);
+
+		if (c == 0) {
+			if (prefix_trie_count >= PREFIX_TRIE_NODES) {
+				prefix_trie_full = 1;
+				return;
+			}
+			c = (unsigned short)prefix_trie_count++;
+			prefix_trie[c].ch = *p;
+			prefix_trie[c].child = 0;
+			prefix_trie[c].routes = 0;
+			prefix_trie[c].sibling = prefix_trie[n].child;
+			prefix_trie[n].child = c;
+		}
+		n = c;
+	}
+	prefix_trie[n].routes |= (uint32_t)1 << i;
+}
+
 /**
- * @brief path_slash_count operation.
- *
- * @details Performs the core path_slash_count routine for this module.
- *
- * @param path Input parameter for path_slash_count.
- *
- * @return Return value produced by path_slash_count.
+ * @brief Empty the route tables and their index.
  */
-int
-path_slash_count(const char *path)
+void
+url_registry_reset(void)
 {
-	int slashes = 0;
+	route_count = 0;
+	prefix_route_count = 0;
+	memset(route_paths, 0, sizeof(route_paths));
+	memset(prefix_trie, 0, sizeof(prefix_trie));
+	prefix_trie_count = 1;
+	prefix_trie_full = 0;
+}
 
-	while (*path)
-		if (*path++ == '/')
-			slashes++;
-	return slashes;
+/**
+ * @brief Routes registered on exactly the @p len bytes of @p path.
+ * @return Mask of routes[] indexes, 0 when the path has none.
+ */
+uint32_t
+route_path_lookup(const char *path, size_t len)
+{
+	return route_path_slot(path, len, route_path_hash(path, len))->routes;
 }
 
 /**
- * @brief prefix_route_matches operation.
- *
- * @details Performs the core prefix_route_matches routine for this module.
+ * @brief Prefix routes whose prefix starts @p path.
  *
- * @param pr Input parameter for prefix_route_matches.
- * @param method Input parameter for prefix_route_matches.
- * @param path Input parameter for prefix_route_matches.
+ * @param path Request path.
+ * @param len Bytes of @p path to consider.
+ * @param slashes Receives the number of '/' in those bytes, for
+ *        prefix_route_slashes_ok().
  *
- * @return Return value produced by prefix_route_matches.
+ * @return Mask of prefix_routes[] indexes.
  */
-int
-prefix_route_matches(const struct prefix_route *pr, const char *method,
-	const char *path)
+uint32_t
+prefix_route_lookup(const char *path, size_t len, int *slashes)
 {
-	if (strcmp(pr->method, method) != 0)
-		return 0;
-	if (strncmp(path, pr->prefix, strlen(pr->prefix)) != 0)
-		return 0;
-	if (pr->min_slashes <= 0)
-		return 1;
+	const unsigned char *p = (const unsigned char *)path;
+	const unsigned char *end = p + len;
+	uint32_t mask = prefix_trie[0].routes;
+	unsigned short n = 0;
+	int walking = 1;
+	int count = 0;
+
+	if (prefix_trie_full) {
+		mask = 0;
+		for (size_t i = 0; i < prefix_route_count; i++) {
+			size_t plen = strlen(prefix_routes[i].prefix);
 
-	return path_slash_count(path + strlen(pr->prefix)) >= pr->min_slashes;
+			if (plen <= len &&
+			    memcmp(path, prefix_routes[i].prefix, plen) == 0)
+				mask |= (uint32_t)1 << i;
+		}
+		walking = 0;
+	}
+	for (; p < end; p++) {
+		if (*p == '/')
+			count++;
+		if (!walking)
+			continue;	/* past the trie: only counting */
+		n = prefix_trie_child(n, *p);
+		if (n != 0)
+			mask |= prefix_trie[n].routes;
+		else
+			walking = 0;
+	}
+	*slashes = count;
+	return mask;
 }
 
 /**
- * @brief prefix_route_path_matches operation.
- *
- * @details Performs the core prefix_route_path_matches routine for this module.
- *
- * @param pr Input parameter for prefix_route_path_matches.
- * @param path Input parameter for prefix_route_path_matches.
- *
- * @return Return value produced by prefix_route_path_matches.
+ * @brief Whether a path with @p slashes '/' in all satisfies the
+ * min_slashes of prefix_routes[@p i], whose prefix it starts with.
  */
 int
-prefix_route_path_matches(const struct prefix_route *pr, const char *path)
+prefix_route_slashes_ok(size_t i, int slashes)
 {
-	if (strncmp(path, pr->prefix, strlen(pr->prefix)) != 0)
-		return 0;
-	if (pr->min_slashes <= 0)
+	if (prefix_routes[i].min_slashes <= 0)
 		return 1;
-
-	return path_slash_count(path + strlen(pr->prefix)) >= pr->min_slashes;
+	return slashes - prefix_route_slashes[i] >= prefix_routes[i].min_slashes;
 }
 
 /**
- * @brief route_method_seen_for_path operation.
+ * @brief path_slash_count operation.
  *
- * @details Performs the core route_method_seen_for_path routine for this module.
+ * @details Performs the core path_slash_count routine for this module.
  *
- * @param route_index Input parameter for route_method_seen_for_path.
- * @param path Input parameter for route_method_seen_for_path.
+ * @param path Input parameter for path_slash_count.
  *
- * @return Return value produced by route_method_seen_for_path.
+ * @return Return value produced by path_slash_count.
  */
 int
-route_method_seen_for_path(size_t route_index, const char *path)
+path_slash_count(const char *path)
 {
-	for (size_t j = 0; j < route_index; j++) {
-		if (strcmp(routes[j].path, path) == 0 &&
-			strcmp(routes[j].method, routes[route_index].method) == 0)
-			return 1;
-	}
-	return 0;
+	int slashes = 0;
+
+	while (*path)
+		if (*path++ == '/')
+			slashes++;
+	return slashes;
 }
 
 /**
@@ -106,14 +226,34 @@ route_method_seen_for_path(size_t route_index, const char *path)
  * @param method Input parameter for register_route.
  * @param path Input parameter for register_route.
  * @param handler Input parameter for register_route.
+ * @param cls Work-queue lane the route is served on.
+ * @param cache Response-cache policy, copied; NULL for none.
  */
 void
-register_route(const char *method, const char *path, route_handler_t handler)
+register_route(const char *method, const char *path, route_handler_t handler,
+	route_class_t cls, const route_cache_policy_t *cache)
 {
-	if (route_count < MAX_ROUTES) {
-		routes[route_count].method = method;
+	int m = http_method_parse(method, strlen(method));
+
+	if (route_count < MAX_ROUTES && m != HTTP_METHOD_OTHER) {
+		size_t len = strlen(path);
+		uint32_t hash = route_path_hash(path, len);
+		struct route_path_slot *slot = route_path_slot(path, len, hash);
+
+		routes[route_count].method = m;
 		routes[route_count].path = path;
 		routes[route_count].handler = handler;
+		routes[route_count].cls = cls;
+		memset(&routes[route_count].cache, 0,
+		    sizeof(routes[route_count].cache));
+		if (cache)
+			routes[route_count].cache = *cache;
+		if (!slot->path) {
+			slot->path = path;
+			slot->len = len;
+			slot->hash = hash;
+		}
+		slot->routes |= (uint32_t)1 << route_count;
 		route_count++;
 	}
 }
@@ -127,17 +267,29 @@ register_route(const char *method, const char *path, route_handler_t handler)
  * @param prefix Input parameter for register_prefix_route.
  * @param min_slashes Input parameter for register_prefix_route.
  * @param handler Input parameter for register_prefix_route.
+ * @param cls Work-queue lane the route is served on.
+ * @param cache Response-cache policy, copied; NULL for none.
  */
 void
 register_prefix_route(const char *method, const char *prefix, int min_slashes,
-	route_handler_t handler)
+	route_handler_t handler, route_class_t cls,
+	const route_cache_policy_t *cache)
 {
-	if (prefix_route_count >= MAX_PREFIX_ROUTES)
+	int m = http_method_parse(method, strlen(method));
+
+	if (prefix_route_count >= MAX_PREFIX_ROUTES || m == HTTP_METHOD_OTHER)
 		return;
 
-	prefix_routes[prefix_route_count].method = method;
+	prefix_routes[prefix_route_count].method = m;
 	prefix_routes[prefix_route_count].prefix = prefix;
 	prefix_routes[prefix_route_count].min_slashes = min_slashes;
 	prefix_routes[prefix_route_count].handler = handler;
+	prefix_routes[prefix_route_count].cls = cls;
+	memset(&prefix_routes[prefix_route_count].cache, 0,
+	    sizeof(prefix_routes[prefix_route_count].cache));
+	if (cache)
+		prefix_routes[prefix_route_count].cache = *cache;
+	prefix_route_slashes[prefix_route_count] = path_slash_count(prefix);
+	prefix_trie_insert(prefix_route_count);
 	prefix_route_count++;
 }
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <string.h>
 
 #include <miniweb/core/conf.h>
@@ -5,6 +6,7 @@
 #include <miniweb/modules/metrics.h>
 #include <miniweb/modules/networking.h>
 #include <miniweb/modules/pkg_manager.h>
+#include <miniweb/net/health.h>
 #include <miniweb/router/module_attach.h>
 #include <miniweb/router/routes.h>
 #include <miniweb/router/urls.h>
@@ -12,16 +14,18 @@
 #include "url_registry_internal.h"
 
 static const struct view_route view_routes[] = {
-	{"GET", "/", "MiniWeb - Dashboard", "dashboard.html",
-		"dashboard_extra_head.html", "dashboard_extra_js.html"},
-	{"GET", "/docs", "MiniWeb - Documentation", "docs.html",
-		"docs_extra_head.html", "docs_extra_js.html"},
-	{"GET", "/apiroot", "MiniWeb - API Root", "api.html",
-		"api_extra_head.html", "api_extra_js.html"},
-	{"GET", "/networking", "MiniWeb - Networking", "networking.html",
-		"networking_extra_head.html", "networking_extra_js.html"},
-	{"GET", "/packages", "MiniWeb - Package Manager", "packages.html",
-		"packages_extra_head.html", "packages_extra_js.html"},
+	{HTTP_METHOD_GET, "/", "MiniWeb - Dashboard", "dashboard.html",
+		"dashboard_extra_head.html", "dashboard_extra_js.html",
+		metrics_snapshot_json_arena},
+	{HTTP_METHOD_GET, "/docs", "MiniWeb - Documentation", "docs.html",
+		"docs_extra_head.html", "docs_extra_js.html", NULL},
+	{HTTP_METHOD_GET, "/apiroot", "MiniWeb - API Root", "api.html",
+		"api_extra_head.html", "api_extra_js.html", NULL},
+	{HTTP_METHOD_GET, "/networking", "MiniWeb - Networking", "networking.html",
+		"networking_extra_head.html", "networking_extra_js.html",
+		networking_get_json_arena},
+	{HTTP_METHOD_GET, "/packages", "MiniWeb - Package Manager", "packages.html",
+		"packages_extra_head.html", "packages_extra_js.html", NULL},
 };
 
 /**
@@ -33,15 +37,18 @@ static const struct view_route view_routes[] = {
  * @param method Input parameter for url_registry_register.
  * @param path Input parameter for url_registry_register.
  * @param handler Input parameter for url_registry_register.
+ * @param cls Input parameter for url_registry_register.
+ * @param cache Response-cache policy, or NULL.
  *
  * @return Return value produced by url_registry_register.
  */
 static int
 url_registry_register(void *ctx, const char *method, const char *path,
-	route_handler_t handler)
+	route_handler_t handler, route_class_t cls,
+	const route_cache_policy_t *cache)
 {
 	(void)ctx;
-	register_route(method, path, handler);
+	register_route(method, path, handler, cls, cache);
 	return 0;
 }
 
@@ -55,15 +62,18 @@ url_registry_register(void *ctx, const char *method, const char *path,
  * @param prefix Input parameter for url_registry_register_prefix.
  * @param min_slashes Input parameter for url_registry_register_prefix.
  * @param handler Input parameter for url_registry_register_prefix.
+ * @param cls Input parameter for url_registry_register_prefix.
+ * @param cache Response-cache policy, or NULL.
  *
  * @return Return value produced by url_registry_register_prefix.
  */
 static int
 url_registry_register_prefix(void *ctx, const char *method, const char *prefix,
-	int min_slashes, route_handler_t handler)
+	int min_slashes, route_handler_t handler, route_class_t cls,
+	const route_cache_policy_t *cache)
 {
 	(void)ctx;
-	register_prefix_route(method, prefix, min_slashes, handler);
+	register_prefix_route(method, prefix, min_slashes, handler, cls, cache);
 	return 0;
 }
 
@@ -80,8 +90,8 @@ int
 views_module_attach_routes(struct router *r)
 {
 	for (size_t i = 0; i < sizeof(view_routes) / sizeof(view_routes[0]); i++) {
-		if (router_register(r, view_routes[i].method, view_routes[i].path,
-			view_template_handler) != 0)
+		if (router_register(r, http_method_name(view_routes[i].method),
+			view_routes[i].path, view_template_handler) != 0)
 			return -1;
 	}
 	if (router_register(r, "GET", "/favicon.ico", favicon_handler) != 0)
@@ -96,23 +106,80 @@ views_module_attach_routes(struct router *r)
  *
  * @details Performs the core find_view_route routine for this module.
  *
- * @param method Input parameter for find_view_route.
- * @param path Input parameter for find_view_route.
+ * @param method HTTP_METHOD_* of the request.
+ * @param path Request path.
+ * @param len Length of the path part of @p path.
  *
  * @return Return value produced by find_view_route.
  */
 const struct view_route *
-find_view_route(const char *method, const char *path)
+find_view_route(int method, const char *path, size_t len)
 {
 	for (size_t i = 0; i < sizeof(view_routes) / sizeof(view_routes[0]); i++) {
-		if (strcmp(view_routes[i].method, method) == 0 &&
-			strcmp(view_routes[i].path, path) == 0)
+		if (view_routes[i].method == method &&
+			strncmp(view_routes[i].path, path, len) == 0 &&
+			view_routes[i].path[len] == '\0')
 			return &view_routes[i];
 	}
 
 	return NULL;
 }
 
+/** Number of declarative view routes. */
+size_t
+view_route_count(void)
+{
+	return sizeof(view_routes) / sizeof(view_routes[0]);
+}
+
+/** Position of @p view, as returned by find_view_route(), in the table. */
+size_t
+view_route_index(const struct view_route *view)
+{
+	return (size_t)(view - view_routes);
+}
+
+/** View route @p i of the table, or NULL past its end. */
+const struct view_route *
+view_route_at(size_t i)
+{
+	return i < view_route_count() ? &view_routes[i] : NULL;
+}
+
+/**
+ * @brief Handle health_path when the dispatcher left it to a worker.
+ *
+ * @details A check that got through the queue has no depth to report,
+ * and a draining process no longer accepts the connections relayd opens:
+ * only readiness is left.
+ *
+ * @param req Request context.
+ *
+ * @return Return value produced by http_response_send.
+ */
+static int
+health_handler(http_request_t *req)
+{
+	health_state_t state = health_state(0, 0);
+	const char *body = health_body(state);
+	http_response_t *resp;
+	int rc;
+
+	if ((resp = http_response_create()) == NULL)
+		return http_send_error(req, 500, "Unable to allocate response");
+	resp->status_code = state == HEALTH_OK ? 200 : 503;
+	resp->content_type = "text/plain";
+	http_response_add_header(resp, "Cache-Control", "no-store");
+	if (state != HEALTH_OK)
+		http_response_add_header(resp, "Retry-After", "1");
+	if (http_request_method(req) != HTTP_METHOD_HEAD)
+		http_response_set_body(resp, (char *)(uintptr_t)body,
+			strlen(body), 0);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
+}
+
 struct module_attach_config {
 	int enable_views;
 	int enable_metrics;
@@ -166,8 +233,14 @@ init_routes(void *module_cfg)
 			.enabled_by_default = defaults.enable_packages },
 	};
 
-	route_count = 0;
-	prefix_route_count = 0;
+	url_registry_reset();
+
+	if (health_path()[0] != '\0') {
+		register_route("GET", health_path(), health_handler,
+			ROUTE_CLASS_FAST, NULL);
+		register_route("HEAD", health_path(), health_handler,
+			ROUTE_CLASS_FAST, NULL);
+	}
 
 	(void)miniweb_module_attach_enabled(
 		&r, modules, sizeof(modules) / sizeof(modules[0]), NULL);
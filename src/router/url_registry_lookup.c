@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <string.h>
 
 #include <miniweb/router/urls.h>
@@ -17,20 +18,99 @@
 route_handler_t
 route_match(const char *method, const char *path)
 {
-	for (size_t i = 0; i < route_count; i++) {
-		if (strcmp(routes[i].method, method) == 0 &&
-			strcmp(routes[i].path, path) == 0)
+	return route_match_class(method, path, NULL);
+}
+
+/**
+ * @brief Resolve a handler and the lane class it was registered with.
+ *
+ * @param method HTTP method.
+ * @param path Request path; a query string is ignored.
+ * @param cls Optional output; ROUTE_CLASS_FAST when nothing matches.
+ *
+ * @return Matching handler, or NULL.
+ */
+route_handler_t
+route_match_class(const char *method, const char *path, route_class_t *cls)
+{
+	return route_lookup(http_method_parse(method, strlen(method)), path,
+		strcspn(path, "?"), cls, NULL);
+}
+
+/**
+ * @brief Resolve an interned method on a path already split from its query.
+ *
+ * @param method HTTP_METHOD_* value.
+ * @param path Request path.
+ * @param len Length of the path part of @p path.
+ * @param cls Optional output; ROUTE_CLASS_FAST when nothing matches.
+ * @param id Optional output; ROUTE_ID_NONE when nothing matches.
+ *
+ * @return Matching handler, or NULL.
+ */
+route_handler_t
+route_lookup(int method, const char *path, size_t len, route_class_t *cls,
+	int *id)
+{
+	uint32_t m;
+	int slashes;
+
+	if (cls)
+		*cls = ROUTE_CLASS_FAST;
+	if (id)
+		*id = ROUTE_ID_NONE;
+	if (method == HTTP_METHOD_OTHER)
+		return NULL;
+	for (m = route_path_lookup(path, len); m != 0; m &= m - 1) {
+		size_t i = (size_t)__builtin_ctz(m);
+
+		if (routes[i].method == method) {
+			if (cls)
+				*cls = routes[i].cls;
+			if (id)
+				*id = (int)i;
 			return routes[i].handler;
+		}
 	}
 
-	for (size_t i = 0; i < prefix_route_count; i++) {
-		if (prefix_route_matches(&prefix_routes[i], method, path))
+	for (m = prefix_route_lookup(path, len, &slashes); m != 0; m &= m - 1) {
+		size_t i = (size_t)__builtin_ctz(m);
+
+		if (prefix_routes[i].method == method &&
+			prefix_route_slashes_ok(i, slashes)) {
+			if (cls)
+				*cls = prefix_routes[i].cls;
+			if (id)
+				*id = MAX_ROUTES + (int)i;
 			return prefix_routes[i].handler;
+		}
 	}
 
 	return NULL;
 }
 
+/**
+ * @brief Response-cache policy of route @p id.
+ *
+ * @param id Route id as reported by route_lookup().
+ *
+ * @return The policy, or NULL for an unknown id or a route not cached.
+ */
+const route_cache_policy_t *
+route_cache_policy(int id)
+{
+	const route_cache_policy_t *p;
+
+	if (id >= 0 && (size_t)id < route_count)
+		p = &routes[id].cache;
+	else if (id >= MAX_ROUTES && (size_t)(id - MAX_ROUTES) <
+	    prefix_route_count)
+		p = &prefix_routes[id - MAX_ROUTES].cache;
+	else
+		return NULL;
+	return p->ttl_ms > 0 ? p : NULL;
+}
+
 /**
  * @brief route_path_known operation.
  *
@@ -43,16 +123,19 @@ route_match(const char *method, const char *path)
 int
 route_path_known(const char *path)
 {
+	uint32_t m;
+	size_t len;
+	int slashes;
+
 	if (!path)
 		return 0;
 
-	for (size_t i = 0; i < route_count; i++) {
-		if (strcmp(routes[i].path, path) == 0)
-			return 1;
-	}
+	len = strcspn(path, "?");
+	if (route_path_lookup(path, len) != 0)
+		return 1;
 
-	for (size_t i = 0; i < prefix_route_count; i++) {
-		if (prefix_route_path_matches(&prefix_routes[i], path))
+	for (m = prefix_route_lookup(path, len, &slashes); m != 0; m &= m - 1) {
+		if (prefix_route_slashes_ok((size_t)__builtin_ctz(m), slashes))
 			return 1;
 	}
 
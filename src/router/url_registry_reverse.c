@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -5,6 +6,17 @@
 
 #include "url_registry_internal.h"
 
+/** Whether a route in @p earlier, a mask of routes[] indexes, has @p method. */
+static int
+route_method_seen(uint32_t earlier, int method)
+{
+	for (; earlier != 0; earlier &= earlier - 1) {
+		if (routes[__builtin_ctz(earlier)].method == method)
+			return 1;
+	}
+	return 0;
+}
+
 /**
  * @brief route_allow_methods operation.
  *
@@ -25,16 +37,19 @@ route_allow_methods(const char *path, char *buf, size_t buf_len)
 	buf[0] = '\0';
 	size_t used = 0;
 	int count = 0;
+	size_t len = strcspn(path, "?");
+	uint32_t all = route_path_lookup(path, len);
+	int slashes;
 
-	for (size_t i = 0; i < route_count; i++) {
-		if (strcmp(routes[i].path, path) != 0)
-			continue;
+	for (uint32_t m = all; m != 0; m &= m - 1) {
+		size_t i = (size_t)__builtin_ctz(m);
 
-		if (route_method_seen_for_path(i, path))
+		if (route_method_seen(all & (((uint32_t)1 << i) - 1),
+			routes[i].method))
 			continue;
 
 		int wrote = snprintf(buf + used, buf_len - used, "%s%s",
-			count > 0 ? ", " : "", routes[i].method);
+			count > 0 ? ", " : "", http_method_name(routes[i].method));
 		if (wrote < 0 || (size_t)wrote >= buf_len - used)
 			return count;
 
@@ -42,18 +57,44 @@ route_allow_methods(const char *path, char *buf, size_t buf_len)
 		count++;
 	}
 
-	for (size_t i = 0; i < prefix_route_count; i++) {
-		if (strncmp(path, prefix_routes[i].prefix,
-			strlen(prefix_routes[i].prefix)) != 0)
-			continue;
+	uint32_t pm = prefix_route_lookup(path, len, &slashes);
+	if (pm != 0) {
+		size_t i = (size_t)__builtin_ctz(pm);
 
 		if (count == 0 && buf_len > 3)
-			(void)snprintf(buf, buf_len, "%s", prefix_routes[i].method);
+			(void)snprintf(buf, buf_len, "%s",
+				http_method_name(prefix_routes[i].method));
 
 		if (count == 0)
 			count = 1;
-		break;
 	}
 
 	return count;
 }
+
+/**
+ * @brief Name a route id for statistics.
+ *
+ * @param id Route id as reported by route_lookup().
+ * @param buf Destination.
+ * @param buf_len Size of @p buf.
+ *
+ * @return 1 when @p id names a registered route, otherwise 0.
+ */
+int
+route_describe(int id, char *buf, size_t buf_len)
+{
+	if (id >= 0 && (size_t)id < route_count) {
+		(void)snprintf(buf, buf_len, "%s %s",
+			http_method_name(routes[id].method), routes[id].path);
+		return 1;
+	}
+	id -= MAX_ROUTES;
+	if (id >= 0 && (size_t)id < prefix_route_count) {
+		(void)snprintf(buf, buf_len, "%s %s*",
+			http_method_name(prefix_routes[id].method),
+			prefix_routes[id].prefix);
+		return 1;
+	}
+	return 0;
+}
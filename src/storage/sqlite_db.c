@@ -3,46 +3,59 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <miniweb/storage/sqlite_db.h>
+#include <sqlite3.h>
 
-#define MW_MAX_TABLES 32
-#define MW_MAX_TABLE_NAME 64
+#include <miniweb/core/log.h>
+#include <miniweb/storage/sqlite_stmt.h>
+#include "sqlite_internal.h"
 
-struct mw_table_meta {
-	char name[MW_MAX_TABLE_NAME];
-};
+#define MW_BUSY_TIMEOUT_MS 5000
 
-/**
- * @brief Internal database handle used by the storage facade.
- */
-struct mw_db {
-	/** Configured database path. */
-	char *path;
-	/** Optional backend URL/DSN. */
-	char *url;
-	/** Friendly database name. */
-	char *name;
-	/** Implementation-defined open flags. */
-	int flags;
-	/** In-memory table registry for lightweight retrieval helpers. */
-	struct mw_table_meta tables[MW_MAX_TABLES];
-	size_t table_count;
-};
+/** Switch @p db to the WAL journal, which the file then keeps. */
+static void
+mw_db_use_wal(struct mw_db *db)
+{
+	struct mw_stmt *st;
+	int wal = 0;
+
+	if (mw_stmt_prepare(db, "PRAGMA journal_mode = WAL", &st) == 0) {
+		wal = mw_stmt_step(st) == 0 &&
+		    strcmp(mw_column_text(st, 0), "wal") == 0;
+		mw_stmt_finalize(st);
+	}
+	if (!wal)
+		log_info("[DB] %s: no WAL journal; reads wait for commits",
+		    db->path);
+}
 
 /**
- * @brief Allocate and initialize a database handle.
+ * @brief Open (creating it unless MW_DB_READONLY) a SQLite database.
+ *
+ * @details With MW_DB_WAL the file is switched to the WAL journal and a
+ * writer thread with a connection of its own serves mw_db_write() and
+ * mw_db_post(), group-committing their mutations. MW_DB_READERS(n) adds
+ * up to MW_DB_MAX_READERS read-only connections for mw_db_reader().
+ *
  * @param path Database file path.
- * @param flags Open flags interpreted by the backend implementation.
+ * @param flags MW_DB_* open flags.
  * @param out_db Output pointer receiving the allocated database handle.
- * @return 0 on success, -1 when inputs are invalid or allocation fails.
+ * @return 0 on success, -1 when inputs are invalid, allocation fails,
+ * SQLite cannot open the file or the writer cannot be started.
  */
 int
 mw_db_open(const char *path, int flags, struct mw_db **out_db)
 {
 	struct mw_db *db;
+	size_t readers;
+	int oflags;
 
 	if (!path || !out_db)
 		return -1;
+	if ((flags & MW_DB_WAL) && (flags & MW_DB_READONLY))
+		return -1;
+	readers = (size_t)(flags >> 8 & 0xff);
+	if (readers > MW_DB_MAX_READERS)
+		readers = MW_DB_MAX_READERS;
 	db = calloc(1, sizeof(*db));
 	if (!db)
 		return -1;
@@ -52,6 +65,30 @@ mw_db_open(const char *path, int flags, struct mw_db **out_db)
 		free(db);
 		return -1;
 	}
+	oflags = (flags & MW_DB_READONLY) ? SQLITE_OPEN_READONLY :
+	    SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	/* Callers serialize use of a handle themselves. */
+	oflags |= SQLITE_OPEN_NOMUTEX;
+	if (sqlite3_open_v2(path, &db->handle, oflags, NULL) != SQLITE_OK) {
+		log_error("[DB] Cannot open %s: %s", path,
+		    db->handle ? sqlite3_errmsg(db->handle) : "out of memory");
+		mw_db_close(db);
+		return -1;
+	}
+	(void)sqlite3_busy_timeout(db->handle, MW_BUSY_TIMEOUT_MS);
+	if (flags & MW_DB_WAL) {
+		mw_db_use_wal(db);
+		if (mw_db_writer_start(db) != 0) {
+			log_error("[DB] %s: cannot start the writer", path);
+			mw_db_close(db);
+			return -1;
+		}
+	}
+	if (readers > 0 && mw_db_pool_start(db, readers) != 0) {
+		log_error("[DB] %s: cannot open the readers", path);
+		mw_db_close(db);
+		return -1;
+	}
 	*out_db = db;
 	return 0;
 }
@@ -65,6 +102,11 @@ mw_db_close(struct mw_db *db)
 {
 	if (!db)
 		return;
+	mw_db_pool_stop(db);
+	mw_db_writer_stop(db);
+	mw_stmt_cache_clear(db);
+	/* Statements still open keep the connection until finalized. */
+	(void)sqlite3_close_v2(db->handle);
 	free(db->path);
 	free(db->url);
 	free(db->name);
@@ -74,14 +116,22 @@ mw_db_close(struct mw_db *db)
 /**
  * @brief Execute schema bootstrap SQL on an opened database.
  * @param db Open database handle.
- * @param schema_sql SQL text to execute.
- * @return 0 on success, -1 on invalid input.
+ * @param schema_sql One or more SQL statements, run in order.
+ * @return 0 on success, -1 on invalid input or when a statement fails.
  */
 int
 mw_db_exec_schema(struct mw_db *db, const char *schema_sql)
 {
-	if (!db || !schema_sql)
+	char *err = NULL;
+
+	if (!db || !db->handle || !schema_sql)
+		return -1;
+	if (sqlite3_exec(db->handle, schema_sql, NULL, NULL, &err) !=
+	    SQLITE_OK) {
+		log_debug("[DB] %s: %s", db->path, err ? err : "exec failed");
+		sqlite3_free(err);
 		return -1;
+	}
 	return 0;
 }
 
@@ -0,0 +1,58 @@
+/* sqlite_internal.h - storage facade handles shared by its sources */
+#ifndef MINIWEB_STORAGE_SQLITE_INTERNAL_H
+#define MINIWEB_STORAGE_SQLITE_INTERNAL_H
+
+#include <stddef.h>
+
+#include <sqlite3.h>
+
+#include <miniweb/storage/sqlite_db.h>
+
+#define MW_MAX_TABLES 32
+#define MW_MAX_TABLE_NAME 64
+#define MW_STMT_CACHE_MAX 32	/* cached statements per connection */
+#define MW_DB_MMAP_SIZE (64 * 1024 * 1024)	/* per reader connection */
+
+struct mw_stmt;
+struct mw_db_writer;
+struct mw_db_pool;
+
+struct mw_table_meta {
+	char name[MW_MAX_TABLE_NAME];
+};
+
+/**
+ * @brief Internal database handle used by the storage facade.
+ */
+struct mw_db {
+	/** SQLite connection. */
+	sqlite3 *handle;
+	/** Configured database path. */
+	char *path;
+	/** Optional backend URL/DSN. */
+	char *url;
+	/** Friendly database name. */
+	char *name;
+	/** MW_DB_* open flags. */
+	int flags;
+	/** In-memory table registry for lightweight retrieval helpers. */
+	struct mw_table_meta tables[MW_MAX_TABLES];
+	size_t table_count;
+	/** Open transactions: BEGIN, then one SAVEPOINT per nested level. */
+	int tx_depth;
+	/** Cached statements, most recently used first. */
+	struct mw_stmt *stmt_lru;
+	size_t stmt_count;
+	/** MW_DB_WAL writer thread and its connection, NULL otherwise. */
+	struct mw_db_writer *writer;
+	/** MW_DB_READERS() read-only connections, NULL otherwise. */
+	struct mw_db_pool *pool;
+};
+
+void mw_stmt_cache_clear(struct mw_db *db);
+int mw_db_writer_start(struct mw_db *db);
+void mw_db_writer_stop(struct mw_db *db);
+int mw_db_pool_start(struct mw_db *db, size_t n);
+void mw_db_pool_stop(struct mw_db *db);
+
+#endif /* MINIWEB_STORAGE_SQLITE_INTERNAL_H */
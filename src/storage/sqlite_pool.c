@@ -0,0 +1,126 @@
+/* sqlite_pool.c - pool of read-only connections */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <miniweb/core/log.h>
+#include "sqlite_internal.h"
+
+/*
+ * A database opened with MW_DB_READERS(n) keeps n read-only connections
+ * besides its own. mw_db_reader() checks one out, waiting while all are
+ * in use, and mw_db_reader_put() returns it; each is a struct mw_db of
+ * its own, so it carries its own statement cache and can be used by one
+ * thread at a time without further locking. Under the WAL journal the
+ * readers never wait for the writer.
+ */
+
+struct mw_db_pool {
+	pthread_mutex_t lock;
+	/** Signalled when a reader is returned. */
+	pthread_cond_t ready;
+	struct mw_db *conns[MW_DB_MAX_READERS];
+	size_t nconns;
+	/** Readers not checked out, a stack. */
+	struct mw_db *idle[MW_DB_MAX_READERS];
+	size_t nidle;
+};
+
+/**
+ * @brief Open @p n read-only connections to the file of @p db.
+ * @param db Open database handle.
+ * @param n Readers wanted, 1 to MW_DB_MAX_READERS.
+ * @return 0 on success, -1 on failure.
+ */
+int
+mw_db_pool_start(struct mw_db *db, size_t n)
+{
+	struct mw_db_pool *p;
+	char sql[64];
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -1;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->ready, NULL);
+	db->pool = p;
+	snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %d;", MW_DB_MMAP_SIZE);
+	for (; p->nconns < n; p->nconns++) {
+		struct mw_db *r;
+
+		if (mw_db_open(db->path, MW_DB_READONLY, &r) != 0) {
+			mw_db_pool_stop(db);
+			return -1;
+		}
+		/* A no-op where SQLite leaves mmap out, as on OpenBSD. */
+		(void)mw_db_exec_schema(r, sql);
+		p->conns[p->nconns] = r;
+		p->idle[p->nidle++] = r;
+	}
+	return 0;
+}
+
+/**
+ * @brief Close the readers of @p db; none may be checked out.
+ * @param db Database handle; nothing happens without a pool.
+ */
+void
+mw_db_pool_stop(struct mw_db *db)
+{
+	struct mw_db_pool *p = db->pool;
+
+	if (!p)
+		return;
+	if (p->nidle != p->nconns)
+		log_error("[DB] %s: closing with %zu readers checked out",
+		    db->path, p->nconns - p->nidle);
+	for (size_t i = 0; i < p->nconns; i++)
+		mw_db_close(p->conns[i]);
+	pthread_cond_destroy(&p->ready);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	db->pool = NULL;
+}
+
+/**
+ * @brief Check out a read-only connection of @p db.
+ *
+ * @details Waits while every reader is checked out. Without a pool, the
+ * handle itself is returned, for callers that serialize on it anyway.
+ *
+ * @param db Open database handle.
+ * @return A connection to pass to mw_db_reader_put(), NULL when @p db is.
+ */
+struct mw_db *
+mw_db_reader(struct mw_db *db)
+{
+	struct mw_db_pool *p;
+	struct mw_db *r;
+
+	if (!db || (p = db->pool) == NULL)
+		return db;
+	pthread_mutex_lock(&p->lock);
+	while (p->nidle == 0)
+		pthread_cond_wait(&p->ready, &p->lock);
+	r = p->idle[--p->nidle];
+	pthread_mutex_unlock(&p->lock);
+	return r;
+}
+
+/**
+ * @brief Return a connection checked out with mw_db_reader().
+ * @param db Database handle it came from.
+ * @param reader Connection to return; @p db itself or NULL are ignored.
+ */
+void
+mw_db_reader_put(struct mw_db *db, struct mw_db *reader)
+{
+	struct mw_db_pool *p;
+
+	if (!db || !reader || reader == db || (p = db->pool) == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	p->idle[p->nidle++] = reader;
+	pthread_cond_signal(&p->ready);
+	pthread_mutex_unlock(&p->lock);
+}
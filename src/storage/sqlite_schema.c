@@ -1,57 +1,213 @@
-
 /* sql_schema.c - miniweb model */
+#include <stdio.h>
+
+#include <miniweb/core/log.h>
 #include <miniweb/storage/sqlite_schema.h>
+#include <miniweb/storage/sqlite_stmt.h>
+#include "sqlite_internal.h"
+
+static const char mw_schema_version_sql[] =
+    "CREATE TABLE IF NOT EXISTS mw_schema_version ("
+    " name TEXT PRIMARY KEY,"
+    " version INTEGER NOT NULL);";
+
+/** Version of schema @p name, 0 before its first migration, -1 on error. */
+static int
+mw_db_schema_version(struct mw_db *db, const char *name)
+{
+	struct mw_stmt *st;
+	int rc, v = -1;
+
+	if (mw_stmt_prepare(db, "SELECT version FROM mw_schema_version"
+	    " WHERE name = ?", &st) != 0)
+		return -1;
+	if (mw_bind_text(st, 1, name) == 0) {
+		rc = mw_stmt_step(st);
+		if (rc == 0)
+			v = (int)mw_column_int64(st, 0);
+		else if (rc > 0)
+			v = 0;
+	}
+	mw_stmt_finalize(st);
+	return v;
+}
+
+/** Record @p version for schema @p name. */
+static int
+mw_db_set_schema_version(struct mw_db *db, const char *name, int version)
+{
+	struct mw_stmt *st;
+	int rc;
+
+	if (mw_stmt_prepare(db, "INSERT OR REPLACE INTO mw_schema_version"
+	    "(name, version) VALUES (?, ?)", &st) != 0)
+		return -1;
+	rc = mw_bind_text(st, 1, name) == 0 &&
+	    mw_bind_int64(st, 2, version) == 0 && mw_stmt_step(st) > 0 ? 0 : -1;
+	mw_stmt_finalize(st);
+	return rc;
+}
 
 /**
  * @brief Apply an ordered migration list to the database.
+ *
+ * @details Each schema sharing the file keeps its version under its own
+ * @p name in the mw_schema_version table. Every migration newer than it
+ * runs, in order, inside one transaction that also records the last
+ * version applied, so a failure leaves the schema as it was. A schema
+ * with a version newer than any known migration is refused.
+ *
  * @param db Open database handle.
- * @param migrations Array of migration descriptors.
+ * @param name Schema the migrations belong to, such as a module name.
+ * @param migrations Array of migration descriptors, versions strictly
+ * increasing from 1.
  * @param count Number of entries in @p migrations.
  * @return 0 on success, -1 on validation or execution failure.
  */
 int
-mw_db_migrate(struct mw_db *db,
+mw_db_migrate(struct mw_db *db, const char *name,
 			  const struct mw_migration *migrations, size_t count)
 {
-	(void)db;
-	(void)migrations;
-	(void)count;
+	int cur, last = 0;
+
+	if (!db || !db->handle || !name || (!migrations && count > 0))
+		return -1;
+	for (size_t i = 0; i < count; i++) {
+		if (migrations[i].version <= last || !migrations[i].sql)
+			return -1;
+		last = migrations[i].version;
+	}
+
+	if (mw_tx_begin(db) != 0)
+		return -1;
+	/* Read under the write lock, so two openers cannot both migrate. */
+	if (mw_db_exec_schema(db, mw_schema_version_sql) != 0 ||
+	    (cur = mw_db_schema_version(db, name)) < 0)
+		goto fail;
+	if (cur > last) {
+		log_error("[DB] %s: %s schema version %d is newer than %d",
+		    db->path, name, cur, last);
+		goto fail;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (migrations[i].version <= cur)
+			continue;
+		if (mw_db_exec_schema(db, migrations[i].sql) != 0) {
+			log_error("[DB] %s: %s migration %d failed", db->path,
+			    name, migrations[i].version);
+			goto fail;
+		}
+	}
+	if (last > cur && mw_db_set_schema_version(db, name, last) != 0)
+		goto fail;
+	if (mw_tx_commit(db) != 0)
+		goto fail;
+	if (last > cur)
+		log_debug("[DB] %s: %s schema version %d -> %d", db->path,
+		    name, cur, last);
 	return 0;
+
+fail:
+	(void)mw_tx_rollback(db);
+	return -1;
 }
 
+/** Forget the nesting when SQLite ended the transaction on its own. */
+static void
+mw_tx_sync(struct mw_db *db)
+{
+	if (sqlite3_get_autocommit(db->handle))
+		db->tx_depth = 0;
+}
 
 /**
- * @brief Start a transaction.
+ * @brief Start a transaction, taking the write lock up front.
+ *
+ * @details Inside a transaction already open, starts a savepoint that
+ * the matching commit releases and rollback undoes on its own.
+ *
  * @param db Open database handle.
  * @return 0 on success, -1 on failure.
  */
 int
 mw_tx_begin(struct mw_db *db)
 {
-	(void)db;
-	return 0;
+	char sql[64];
+	int rc;
+
+	if (!db || !db->handle)
+		return -1;
+	mw_tx_sync(db);
+	if (db->tx_depth == 0) {
+		rc = mw_db_exec_schema(db, "BEGIN IMMEDIATE;");
+	} else {
+		snprintf(sql, sizeof(sql), "SAVEPOINT mw_sp%d;", db->tx_depth);
+		rc = mw_db_exec_schema(db, sql);
+	}
+	if (rc == 0)
+		db->tx_depth++;
+	return rc;
 }
 
 /**
- * @brief Commit the active transaction.
+ * @brief Commit the innermost open transaction or savepoint.
+ *
+ * @details A failed commit (SQLITE_BUSY) leaves the transaction open for
+ * a retry or mw_tx_rollback().
+ *
  * @param db Open database handle.
  * @return 0 on success, -1 on failure.
  */
 int
 mw_tx_commit(struct mw_db *db)
 {
-	(void)db;
-	return 0;
+	char sql[64];
+	int rc;
+
+	if (!db || !db->handle)
+		return -1;
+	mw_tx_sync(db);
+	if (db->tx_depth == 0)
+		return -1;
+	if (db->tx_depth == 1) {
+		rc = mw_db_exec_schema(db, "COMMIT;");
+	} else {
+		snprintf(sql, sizeof(sql), "RELEASE mw_sp%d;",
+		    db->tx_depth - 1);
+		rc = mw_db_exec_schema(db, sql);
+	}
+	if (rc == 0)
+		db->tx_depth--;
+	mw_tx_sync(db);
+	return rc;
 }
 
 /**
- * @brief Roll back the active transaction.
+ * @brief Roll back the innermost open transaction or savepoint.
  * @param db Open database handle.
  * @return 0 on success, -1 on failure.
  */
 int
 mw_tx_rollback(struct mw_db *db)
 {
-	(void)db;
-	return 0;
+	char sql[64];
+	int rc;
+
+	if (!db || !db->handle)
+		return -1;
+	mw_tx_sync(db);
+	if (db->tx_depth == 0)
+		return -1;
+	if (db->tx_depth == 1) {
+		rc = mw_db_exec_schema(db, "ROLLBACK;");
+	} else {
+		snprintf(sql, sizeof(sql),
+		    "ROLLBACK TO mw_sp%d; RELEASE mw_sp%d;",
+		    db->tx_depth - 1, db->tx_depth - 1);
+		rc = mw_db_exec_schema(db, sql);
+	}
+	/* Whatever happened, this level is over. */
+	db->tx_depth--;
+	mw_tx_sync(db);
+	return rc;
 }
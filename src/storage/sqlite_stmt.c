@@ -1,29 +1,194 @@
-
 /* sqlite_stmt.c - statement prepare facility */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/log.h>
 #include <miniweb/storage/sqlite_stmt.h>
+#include "sqlite_internal.h"
 
 /**
  * @brief Prepared-statement wrapper used by the SQLite facade.
  */
 struct mw_stmt {
-	/** Reserved field for backend statement pointer/state. */
-	int reserved;
+	/** Compiled SQLite statement. */
+	sqlite3_stmt *handle;
+	/** Owning database, for error messages. */
+	struct mw_db *db;
+	/** Cache key when owned by the statement cache, NULL otherwise. */
+	char *sql;
+	/** FNV-1a hash of @c sql. */
+	uint32_t hash;
+	/** Checked out by mw_stmt_prepare_cached(). */
+	int busy;
+	/** Neighbours in the owning connection's LRU list. */
+	struct mw_stmt *prev, *next;
 };
 
+/** FNV-1a hash of @p sql, the cache key. */
+static uint32_t
+mw_stmt_hash(const char *sql)
+{
+	uint32_t h = 2166136261u;
+
+	for (const char *p = sql; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	return h;
+}
+
+/** Take @p stmt out of its connection's LRU list. */
+static void
+mw_stmt_unlink(struct mw_stmt *stmt)
+{
+	struct mw_db *db = stmt->db;
+
+	if (stmt->prev)
+		stmt->prev->next = stmt->next;
+	else
+		db->stmt_lru = stmt->next;
+	if (stmt->next)
+		stmt->next->prev = stmt->prev;
+	stmt->prev = stmt->next = NULL;
+	db->stmt_count--;
+}
+
+/** Put @p stmt at the head of its connection's LRU list. */
+static void
+mw_stmt_push(struct mw_stmt *stmt)
+{
+	struct mw_db *db = stmt->db;
+
+	stmt->prev = NULL;
+	stmt->next = db->stmt_lru;
+	if (db->stmt_lru)
+		db->stmt_lru->prev = stmt;
+	db->stmt_lru = stmt;
+	db->stmt_count++;
+}
+
+/** Finalize and free @p stmt, which is no longer in any list. */
+static void
+mw_stmt_free(struct mw_stmt *stmt)
+{
+	(void)sqlite3_finalize(stmt->handle);
+	free(stmt->sql);
+	free(stmt);
+}
+
 /**
  * @brief Compile an SQL statement for repeated execution.
  * @param db       Open database handle.
  * @param sql      SQL statement text.
  * @param out_stmt Output pointer receiving the prepared statement handle.
- * @return 0 on success, -1 on failure (stub: always -1 until implemented).
+ * @return 0 on success, -1 on failure.
  */
 int
 mw_stmt_prepare(struct mw_db *db, const char *sql, struct mw_stmt **out_stmt)
 {
-	(void)db;
-	(void)sql;
-	(void)out_stmt;
-	return -1;
+	struct mw_stmt *stmt;
+
+	if (!db || !db->handle || !sql || !out_stmt)
+		return -1;
+	stmt = calloc(1, sizeof(*stmt));
+	if (!stmt)
+		return -1;
+	if (sqlite3_prepare_v2(db->handle, sql, -1, &stmt->handle, NULL) !=
+	    SQLITE_OK) {
+		log_debug("[DB] %s: prepare: %s", db->path,
+		    sqlite3_errmsg(db->handle));
+		free(stmt);
+		return -1;
+	}
+	stmt->db = db;
+	*out_stmt = stmt;
+	return 0;
+}
+
+/**
+ * @brief Prepared statement for @p sql from the connection's cache.
+ *
+ * @details A statement already compiled for the same text is handed out
+ * again, skipping parsing and planning; otherwise one is prepared and
+ * kept, evicting the least recently used idle statement once
+ * MW_STMT_CACHE_MAX are cached. mw_stmt_finalize() returns it to the
+ * cache, reset and with its bindings cleared. While a statement is
+ * checked out, another request for the same text gets an uncached one.
+ *
+ * @param db       Open database handle.
+ * @param sql      SQL statement text, the cache key.
+ * @param out_stmt Output pointer receiving the statement.
+ * @return 0 on success, -1 on failure.
+ */
+int
+mw_stmt_prepare_cached(struct mw_db *db, const char *sql,
+    struct mw_stmt **out_stmt)
+{
+	struct mw_stmt *stmt, *victim;
+	uint32_t h;
+
+	if (!db || !db->handle || !sql || !out_stmt)
+		return -1;
+	h = mw_stmt_hash(sql);
+	for (stmt = db->stmt_lru; stmt; stmt = stmt->next) {
+		if (stmt->hash != h || strcmp(stmt->sql, sql) != 0)
+			continue;
+		if (stmt->busy)
+			return mw_stmt_prepare(db, sql, out_stmt);
+		if (stmt != db->stmt_lru) {
+			mw_stmt_unlink(stmt);
+			mw_stmt_push(stmt);
+		}
+		stmt->busy = 1;
+		*out_stmt = stmt;
+		return 0;
+	}
+
+	if (mw_stmt_prepare(db, sql, &stmt) != 0)
+		return -1;
+	if ((stmt->sql = strdup(sql)) == NULL) {
+		/* Still usable, just not kept. */
+		*out_stmt = stmt;
+		return 0;
+	}
+	stmt->hash = h;
+	stmt->busy = 1;
+	mw_stmt_push(stmt);
+	if (db->stmt_count > MW_STMT_CACHE_MAX) {
+		for (victim = db->stmt_lru; victim->next; victim = victim->next)
+			;
+		while (victim && victim->busy)
+			victim = victim->prev;
+		if (victim) {
+			mw_stmt_unlink(victim);
+			mw_stmt_free(victim);
+		}
+	}
+	*out_stmt = stmt;
+	return 0;
+}
+
+/**
+ * @brief Drop every cached statement of @p db, before it is closed.
+ *
+ * @details Statements still checked out leave the cache and are freed by
+ * their mw_stmt_finalize().
+ *
+ * @param db Database handle.
+ */
+void
+mw_stmt_cache_clear(struct mw_db *db)
+{
+	struct mw_stmt *stmt;
+
+	while ((stmt = db->stmt_lru) != NULL) {
+		mw_stmt_unlink(stmt);
+		if (stmt->busy) {
+			free(stmt->sql);
+			stmt->sql = NULL;
+		} else {
+			mw_stmt_free(stmt);
+		}
+	}
 }
 
 
@@ -31,16 +196,16 @@ mw_stmt_prepare(struct mw_db *db, const char *sql, struct mw_stmt **out_stmt)
  * @brief Bind a text value to a prepared-statement parameter.
  * @param stmt Prepared statement handle.
  * @param idx 1-based parameter index.
- * @param value Text value to bind.
+ * @param value Text value to bind; copied, so it may be released after.
  * @return 0 on success, -1 on failure.
  */
 int
 mw_bind_text(struct mw_stmt *stmt, int idx, const char *value)
 {
-	(void)stmt;
-	(void)idx;
-	(void)value;
-	return -1;
+	if (!stmt || !value)
+		return -1;
+	return sqlite3_bind_text(stmt->handle, idx, value, -1,
+	    SQLITE_TRANSIENT) == SQLITE_OK ? 0 : -1;
 }
 
 
@@ -54,10 +219,10 @@ mw_bind_text(struct mw_stmt *stmt, int idx, const char *value)
 int
 mw_bind_int64(struct mw_stmt *stmt, int idx, int64_t value)
 {
-	(void)stmt;
-	(void)idx;
-	(void)value;
-	return -1;
+	if (!stmt)
+		return -1;
+	return sqlite3_bind_int64(stmt->handle, idx, value) == SQLITE_OK ?
+	    0 : -1;
 }
 
 
@@ -70,9 +235,9 @@ mw_bind_int64(struct mw_stmt *stmt, int idx, int64_t value)
 int
 mw_bind_null(struct mw_stmt *stmt, int idx)
 {
-	(void)stmt;
-	(void)idx;
-	return -1;
+	if (!stmt)
+		return -1;
+	return sqlite3_bind_null(stmt->handle, idx) == SQLITE_OK ? 0 : -1;
 }
 
 
@@ -85,17 +250,88 @@ mw_bind_null(struct mw_stmt *stmt, int idx)
 int
 mw_stmt_step(struct mw_stmt *stmt)
 {
-	(void)stmt;
+	int rc;
+
+	if (!stmt)
+		return -1;
+	rc = sqlite3_step(stmt->handle);
+	if (rc == SQLITE_ROW)
+		return 0;
+	if (rc == SQLITE_DONE)
+		return 1;
+	log_debug("[DB] %s: step: %s", stmt->db->path,
+	    sqlite3_errmsg(stmt->db->handle));
 	return -1;
 }
 
 
 /**
- * @brief Finalize and release a prepared statement.
+ * @brief Rewind a statement for another execution, clearing its bindings.
  * @param stmt Prepared statement handle.
+ * @return 0 on success, -1 on failure.
+ */
+int
+mw_stmt_reset(struct mw_stmt *stmt)
+{
+	if (!stmt)
+		return -1;
+	/* The step already reported any error; only the rewind matters here. */
+	(void)sqlite3_reset(stmt->handle);
+	return sqlite3_clear_bindings(stmt->handle) == SQLITE_OK ? 0 : -1;
+}
+
+
+/**
+ * @brief Text of column @p col of the current row.
+ * @param stmt Statement positioned on a row by mw_stmt_step().
+ * @param col 0-based column index.
+ * @return Text valid until the next step, reset or finalize; "" for NULL.
+ */
+const char *
+mw_column_text(struct mw_stmt *stmt, int col)
+{
+	const unsigned char *text;
+
+	if (!stmt)
+		return "";
+	text = sqlite3_column_text(stmt->handle, col);
+	return text ? (const char *)text : "";
+}
+
+
+/**
+ * @brief Integer value of column @p col of the current row.
+ * @param stmt Statement positioned on a row by mw_stmt_step().
+ * @param col 0-based column index.
+ * @return The value, 0 for NULL.
+ */
+int64_t
+mw_column_int64(struct mw_stmt *stmt, int col)
+{
+	if (!stmt)
+		return 0;
+	return sqlite3_column_int64(stmt->handle, col);
+}
+
+
+/**
+ * @brief Finalize and release a prepared statement.
+ *
+ * @details A statement from mw_stmt_prepare_cached() is reset and handed
+ * back to its cache instead.
+ *
+ * @param stmt Prepared statement handle. May be NULL.
  */
 void
 mw_stmt_finalize(struct mw_stmt *stmt)
 {
-	(void)stmt;
+	if (!stmt)
+		return;
+	if (stmt->sql) {
+		(void)sqlite3_reset(stmt->handle);
+		(void)sqlite3_clear_bindings(stmt->handle);
+		stmt->busy = 0;
+		return;
+	}
+	mw_stmt_free(stmt);
 }
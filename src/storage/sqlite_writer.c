@@ -0,0 +1,294 @@
+/* sqlite_writer.c - single writer thread with group commit */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <miniweb/core/log.h>
+#include <miniweb/storage/sqlite_schema.h>
+#include "sqlite_internal.h"
+
+/*
+ * A database opened with MW_DB_WAL gets a second connection owned by one
+ * writer thread. mw_db_write() and mw_db_post() queue a mutation; the
+ * thread waits up to MW_DB_GROUP_MS after the first for more to arrive,
+ * then runs them all in one transaction, each inside a savepoint of its
+ * own, so one failing mutation undoes only itself and a batch costs one
+ * fsync however many callers fed it. WAL lets reads on other
+ * connections go on while the batch commits.
+ */
+
+#define MW_DB_GROUP_MS	2	/* linger for more writes after the first */
+#define MW_DB_GROUP_MAX	256	/* mutations per transaction at most */
+
+struct mw_db_job {
+	mw_db_write_fn fn;
+	void *ctx;
+	int rc;
+	int done;
+	int posted;		/* mw_db_post(): freed by the writer */
+	struct mw_db_job *next;
+};
+
+struct mw_db_writer {
+	/** Connection used only by the thread. */
+	struct mw_db *conn;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/** Signalled when a job is queued or the writer told to stop. */
+	pthread_cond_t work;
+	/** Broadcast when a batch is done. */
+	pthread_cond_t done;
+	struct mw_db_job *head, *tail;
+	size_t queued;
+	int stop;
+};
+
+/** Run @p job on the writer connection, in a savepoint of its own. */
+static void
+mw_db_run_job(struct mw_db *conn, struct mw_db_job *job)
+{
+	if (mw_tx_begin(conn) != 0) {
+		job->rc = -1;
+		return;
+	}
+	job->rc = job->fn(conn, job->ctx);
+	if (job->rc == 0 && mw_tx_commit(conn) == 0)
+		return;
+	if (job->rc == 0)
+		job->rc = -1;
+	(void)mw_tx_rollback(conn);
+}
+
+/** Commit @p batch in one transaction; sets every job's result. */
+static void
+mw_db_run_batch(struct mw_db *conn, struct mw_db_job *batch)
+{
+	struct mw_db_job *job;
+
+	if (mw_tx_begin(conn) != 0) {
+		for (job = batch; job; job = job->next)
+			job->rc = -1;
+		return;
+	}
+	for (job = batch; job; job = job->next)
+		mw_db_run_job(conn, job);
+	if (mw_tx_commit(conn) == 0)
+		return;
+	(void)mw_tx_rollback(conn);
+	log_error("[DB] %s: group commit failed", conn->path);
+	for (job = batch; job; job = job->next)
+		job->rc = -1;
+}
+
+/** Absolute CLOCK_REALTIME time @p ms from now, for a timed wait. */
+static void
+mw_db_deadline(struct timespec *ts, long ms)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += ms * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/** Writer loop: batch queued jobs until stopped and drained. */
+static void *
+mw_db_writer_thread(void *arg)
+{
+	struct mw_db_writer *w = arg;
+	struct mw_db_job *batch, *job, *next;
+	struct timespec ts;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->head == NULL && !w->stop)
+			pthread_cond_wait(&w->work, &w->lock);
+		if (w->head == NULL)
+			break;
+		/* Let a burst gather; a stop flushes right away. */
+		mw_db_deadline(&ts, MW_DB_GROUP_MS);
+		while (!w->stop && w->queued < MW_DB_GROUP_MAX) {
+			if (pthread_cond_timedwait(&w->work, &w->lock, &ts) ==
+			    ETIMEDOUT)
+				break;
+		}
+		batch = w->head;
+		w->head = w->tail = NULL;
+		w->queued = 0;
+		pthread_mutex_unlock(&w->lock);
+
+		mw_db_run_batch(w->conn, batch);
+
+		pthread_mutex_lock(&w->lock);
+		for (job = batch; job; job = next) {
+			next = job->next;
+			if (job->posted) {
+				if (job->rc != 0)
+					log_debug("[DB] %s: posted write "
+					    "failed", w->conn->path);
+				free(job);
+			} else {
+				job->done = 1;
+			}
+		}
+		pthread_cond_broadcast(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/** Queue @p job; -1 once the writer is stopping. */
+static int
+mw_db_enqueue(struct mw_db_writer *w, struct mw_db_job *job)
+{
+	if (w->stop)
+		return -1;
+	job->next = NULL;
+	if (w->tail)
+		w->tail->next = job;
+	else
+		w->head = job;
+	w->tail = job;
+	/* The first job wakes the thread, a full batch cuts the linger. */
+	if (++w->queued == 1 || w->queued >= MW_DB_GROUP_MAX)
+		pthread_cond_signal(&w->work);
+	return 0;
+}
+
+/**
+ * @brief Open the writer connection of @p db and start its thread.
+ * @param db Database opened with MW_DB_WAL.
+ * @return 0 on success, -1 on failure.
+ */
+int
+mw_db_writer_start(struct mw_db *db)
+{
+	struct mw_db_writer *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -1;
+	if (mw_db_open(db->path, 0, &w->conn) != 0) {
+		free(w);
+		return -1;
+	}
+	/* WAL makes NORMAL safe against corruption; only fsyncs go. */
+	(void)mw_db_exec_schema(w->conn, "PRAGMA synchronous = NORMAL;");
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->work, NULL);
+	pthread_cond_init(&w->done, NULL);
+	if (pthread_create(&w->thread, NULL, mw_db_writer_thread, w) != 0) {
+		pthread_cond_destroy(&w->done);
+		pthread_cond_destroy(&w->work);
+		pthread_mutex_destroy(&w->lock);
+		mw_db_close(w->conn);
+		free(w);
+		return -1;
+	}
+	db->writer = w;
+	return 0;
+}
+
+/**
+ * @brief Write what is queued, stop the writer thread of @p db and close
+ * its connection.
+ * @param db Database handle; nothing happens without a writer.
+ */
+void
+mw_db_writer_stop(struct mw_db *db)
+{
+	struct mw_db_writer *w = db->writer;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->work);
+	pthread_mutex_destroy(&w->lock);
+	mw_db_close(w->conn);
+	free(w);
+	db->writer = NULL;
+}
+
+/**
+ * @brief Run a mutation and wait until it is committed.
+ *
+ * @details With MW_DB_WAL, @p fn runs on the writer thread and is passed
+ * the writer's connection, batched with other writes into one
+ * transaction; called from that thread, or without a writer, it runs
+ * here in a transaction (or savepoint) of its own on @p db. Either way a
+ * non-zero return from @p fn undoes what it did.
+ *
+ * @param db Open database handle.
+ * @param fn Mutation: prepares, binds and steps on the connection given.
+ * @param ctx Passed to @p fn.
+ * @return 0 once committed; -1 when @p fn failed, the commit failed or
+ * the database is closing.
+ */
+int
+mw_db_write(struct mw_db *db, mw_db_write_fn fn, void *ctx)
+{
+	struct mw_db_writer *w;
+	struct mw_db_job job = { fn, ctx, 0, 0, 0, NULL };
+
+	if (!db || !db->handle || !fn)
+		return -1;
+	w = db->writer;
+	if (!w || pthread_equal(pthread_self(), w->thread)) {
+		mw_db_run_job(w ? w->conn : db, &job);
+		return job.rc;
+	}
+	pthread_mutex_lock(&w->lock);
+	if (mw_db_enqueue(w, &job) != 0) {
+		pthread_mutex_unlock(&w->lock);
+		return -1;
+	}
+	while (!job.done)
+		pthread_cond_wait(&w->done, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+	return job.rc;
+}
+
+/**
+ * @brief Queue a mutation without waiting for it.
+ *
+ * @details Like mw_db_write(), but returns once @p fn is queued; it runs
+ * exactly once, before mw_db_close() returns, so @p ctx must live until
+ * then or be released by @p fn. Failures are only logged.
+ *
+ * @param db Database opened with MW_DB_WAL.
+ * @param fn Mutation to run on the writer connection.
+ * @param ctx Passed to @p fn.
+ * @return 0 when queued, -1 without a writer, on allocation failure or
+ * when the database is closing.
+ */
+int
+mw_db_post(struct mw_db *db, mw_db_write_fn fn, void *ctx)
+{
+	struct mw_db_writer *w;
+	struct mw_db_job *job;
+
+	if (!db || !fn || (w = db->writer) == NULL)
+		return -1;
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -1;
+	job->fn = fn;
+	job->ctx = ctx;
+	job->posted = 1;
+	pthread_mutex_lock(&w->lock);
+	if (mw_db_enqueue(w, job) != 0) {
+		pthread_mutex_unlock(&w->lock);
+		free(job);
+		return -1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
@@ -0,0 +1,312 @@
+/* bundle.c - pack static files and templates into a C source file */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <miniweb/http/utils.h>
+
+/*
+ * miniweb-bundle [-x path] out.c dir ...
+ *
+ * Walks each directory and writes the bundle_files[] table declared in
+ * <miniweb/http/bundle.h>: one array per body, each followed by a NUL,
+ * and a gzip variant for compressible types when it is smaller. Names
+ * are the paths as walked, starting with the directory argument, and
+ * the table is sorted by them. Dot files, .gz sidecars and the paths
+ * given with -x (e.g. what the server itself writes under static/) are
+ * skipped.
+ * The output goes to out.c.tmp first, so a failed run leaves no stale
+ * or partial table behind for make.
+ */
+
+#define BUNDLE_PATH_MAX	1024
+#define BUNDLE_EXCLUDE_MAX	16
+
+typedef struct {
+	char *name;
+	unsigned char *data;
+	size_t len;
+	unsigned char *gz;
+	size_t gz_len;
+	uint64_t hash;
+} entry_t;
+
+static entry_t *entries;
+static size_t nentries, centries;
+static const char *excluded[BUNDLE_EXCLUDE_MAX];
+static int nexcluded;
+
+static uint64_t
+fnv1a(const unsigned char *p, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	while (len-- > 0)
+		h = (h ^ *p++) * 1099511628211ULL;
+	return h;
+}
+
+/** Gzip @p len bytes of @p in; 0 when it does not shrink them. */
+static size_t
+compress_gzip(const unsigned char *in, size_t len, unsigned char **out)
+{
+	z_stream zs;
+	uLong cap = compressBound((uLong)len) + 32;
+	size_t n;
+
+	*out = NULL;
+	if (len == 0 || (*out = malloc(cap)) == NULL)
+		return 0;
+	memset(&zs, 0, sizeof(zs));
+	/* No name or mtime in the header: builds stay reproducible. */
+	if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(*out);
+		*out = NULL;
+		return 0;
+	}
+	zs.next_in = (Bytef *)(uintptr_t)in;
+	zs.avail_in = (uInt)len;
+	zs.next_out = *out;
+	zs.avail_out = (uInt)cap;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= len) {
+		deflateEnd(&zs);
+		free(*out);
+		*out = NULL;
+		return 0;
+	}
+	n = zs.total_out;
+	deflateEnd(&zs);
+	return n;
+}
+
+static int
+read_file(const char *path, const struct stat *st, entry_t *e)
+{
+	FILE *fp;
+	size_t len = (size_t)st->st_size;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+		return -1;
+	e->data = malloc(len + 1);
+	if (e->data == NULL || fread(e->data, 1, len, fp) != len) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	e->data[len] = '\0';
+	e->len = len;
+	return 0;
+}
+
+static int
+add_file(const char *path, const struct stat *st)
+{
+	const char *mime = mime_type_for_path(path);
+	entry_t *e;
+
+	if (nentries == centries) {
+		size_t n = centries ? centries * 2 : 64;
+		entry_t *p = realloc(entries, n * sizeof(*p));
+
+		if (p == NULL)
+			return -1;
+		entries = p;
+		centries = n;
+	}
+	e = &entries[nentries];
+	memset(e, 0, sizeof(*e));
+	if ((e->name = strdup(path)) == NULL || read_file(path, st, e) != 0) {
+		fprintf(stderr, "miniweb-bundle: %s: %s\n", path,
+		    strerror(errno));
+		return -1;
+	}
+	e->hash = fnv1a(e->data, e->len);
+	if (mime_type_is_compressible(mime))
+		e->gz_len = compress_gzip(e->data, e->len, &e->gz);
+	nentries++;
+	return 0;
+}
+
+static int
+is_excluded(const char *path)
+{
+	for (int i = 0; i < nexcluded; i++) {
+		if (strcmp(path, excluded[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int
+walk(const char *dir)
+{
+	char path[BUNDLE_PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int rc = 0;
+
+	if ((d = opendir(dir)) == NULL) {
+		fprintf(stderr, "miniweb-bundle: %s: %s\n", dir,
+		    strerror(errno));
+		return -1;
+	}
+	while (rc == 0 && (de = readdir(d)) != NULL) {
+		size_t n = strlen(de->d_name);
+
+		if (de->d_name[0] == '.' ||
+		    (n > 3 && strcmp(de->d_name + n - 3, ".gz") == 0))
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >=
+		    (int)sizeof(path) || stat(path, &st) != 0) {
+			fprintf(stderr, "miniweb-bundle: %s/%s: cannot stat\n",
+			    dir, de->d_name);
+			rc = -1;
+		} else if (is_excluded(path)) {
+			continue;
+		} else if (S_ISDIR(st.st_mode)) {
+			rc = walk(path);
+		} else if (S_ISREG(st.st_mode)) {
+			rc = add_file(path, &st);
+		}
+	}
+	closedir(d);
+	return rc;
+}
+
+static int
+entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const entry_t *)a)->name, ((const entry_t *)b)->name);
+}
+
+/** Write @p len bytes and the trailing NUL as array @p tag@p i. */
+static void
+put_bytes(FILE *out, const char *tag, size_t i, const unsigned char *p,
+    size_t len)
+{
+	int col = 0;
+
+	fprintf(out, "static const unsigned char %s%zu[] = {\n", tag, i);
+	for (size_t j = 0; j <= len; j++) {
+		int v = j < len ? p[j] : 0;
+
+		if (col == 0)
+			col = fprintf(out, "\t");
+		col += fprintf(out, "%d,", v);
+		if (col >= 72 || j == len) {
+			fputc('\n', out);
+			col = 0;
+		}
+	}
+	fputs("};\n", out);
+}
+
+/** Write @p s as a C string literal. */
+static void
+put_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s != '\0'; s++) {
+		unsigned char c = (unsigned char)*s;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(out, "\\%03o", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static int
+write_table(FILE *out)
+{
+	fputs("/* Generated by miniweb-bundle; do not edit. */\n\n"
+	    "#include <miniweb/http/bundle.h>\n\n", out);
+	for (size_t i = 0; i < nentries; i++) {
+		put_bytes(out, "f", i, entries[i].data, entries[i].len);
+		if (entries[i].gz)
+			put_bytes(out, "z", i, entries[i].gz, entries[i].gz_len);
+	}
+
+	/* An empty bundle still needs one element to be valid C. */
+	fprintf(out, "\nconst bundle_file_t bundle_files[] = {\n");
+	for (size_t i = 0; i < nentries; i++) {
+		const entry_t *e = &entries[i];
+		unsigned long long h = (unsigned long long)e->hash;
+
+		fputs("\t{ ", out);
+		put_string(out, e->name);
+		fputs(", ", out);
+		put_string(out, mime_type_for_path(e->name));
+		fprintf(out, ",\n\t    \"\\\"b%016llx\\\"\", 0x%016llxULL, "
+		    "f%zu, %zu,\n", h, h, i, e->len);
+		if (e->gz)
+			fprintf(out, "\t    z%zu, %zu, \"\\\"B%016llx\\\"\" },\n",
+			    i, e->gz_len, h);
+		else
+			fputs("\t    NULL, 0, NULL },\n", out);
+	}
+	if (nentries == 0)
+		fputs("\t{ NULL, NULL, NULL, 0, NULL, 0, NULL, 0, NULL },\n",
+		    out);
+	fprintf(out, "};\n\nconst size_t bundle_file_count = %zu;\n",
+	    nentries);
+	return ferror(out) ? -1 : 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: miniweb-bundle [-x path] out.c dir ...\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmp[BUNDLE_PATH_MAX];
+	FILE *out;
+	int ch, rc;
+
+	while ((ch = getopt(argc, argv, "x:")) != -1) {
+		if (ch != 'x' || nexcluded == BUNDLE_EXCLUDE_MAX)
+			usage();
+		excluded[nexcluded++] = optarg;
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+	for (int i = 1; i < argc; i++) {
+		if (walk(argv[i]) != 0)
+			return 1;
+	}
+	if (nentries > 0)
+		qsort(entries, nentries, sizeof(entries[0]), entry_cmp);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", argv[0]);
+	if ((out = fopen(tmp, "w")) == NULL) {
+		fprintf(stderr, "miniweb-bundle: %s: %s\n", tmp,
+		    strerror(errno));
+		return 1;
+	}
+	rc = write_table(out);
+	if (fclose(out) != 0 || rc != 0 || rename(tmp, argv[0]) != 0) {
+		fprintf(stderr, "miniweb-bundle: %s: %s\n", argv[0],
+		    strerror(errno));
+		(void)remove(tmp);
+		return 1;
+	}
+	return 0;
+}
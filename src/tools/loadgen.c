@@ -0,0 +1,1033 @@
+/* loadgen.c - HTTP/1.1 load generator with latency histograms */
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * miniweb-loadgen [-C] [-c conns] [-d sec] [-o prefix] [-p depth]
+ *     [-r rate] [-t threads] host:port [id[*weight]=]path ...
+ *
+ * Each thread drives its share of the connections from one kqueue.
+ * Connections are kept alive (-C closes after every answer) and carry
+ * up to -p requests in flight. Requests pick a path at random, in
+ * proportion to the weights.
+ *
+ * With -r the arrival rate is fixed: request k of a thread is due at
+ * t0 + k / rate and goes to connection k mod n. A request that cannot
+ * be sent on time because its connection is busy or reconnecting waits
+ * for it, and its latency is still measured from when it was due, so a
+ * stalled server shows up in the tail instead of slowing the client
+ * (no coordinated omission). Without -r each connection sends again as
+ * soon as an answer comes back (closed loop).
+ *
+ * Latencies go into HDR-style histograms: 1 us resolution, three
+ * significant digits, up to about two minutes. stdout gets one
+ * tab-separated line for all requests ("ALL") and, with several paths,
+ * one per id:
+ *
+ *	endpoint requests errors non_2xx req_sec mb_sec mean_ms stdev_ms
+ *	p50_ms p90_ms p99_ms p999_ms max_ms
+ *
+ * -o writes the percentile distribution of each line, in the .hgrm
+ * text format of HdrHistogram, to prefix.hgrm and prefix.<id>.hgrm.
+ */
+
+#define LG_ENDPOINTS_MAX	64
+#define LG_PIPELINE_MAX		64
+#define LG_CONNS_MAX		10000
+#define LG_THREADS_MAX		64
+#define LG_REQ_MAX		1024	/* one request head */
+#define LG_RBUF			8192	/* answer heads must fit */
+#define LG_EVENTS		256
+#define LG_RETRY_NS		100000000LL	/* reconnect attempts */
+#define LG_NS			1000000000LL
+
+#define HIST_SUB_BITS	11
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_HALF	(HIST_SUB / 2)
+#define HIST_BUCKETS	17
+#define HIST_LEN	(HIST_SUB + (HIST_BUCKETS - 1) * HIST_HALF)
+#define HIST_TICKS	5	/* .hgrm lines per halving of 1 - p */
+
+typedef struct {
+	uint64_t counts[HIST_LEN];
+	uint64_t total;
+	uint64_t max;		/* us */
+	double sum;
+	double sumsq;
+} hist_t;
+
+typedef struct {
+	char id[64];
+	const char *path;
+	unsigned int weight;
+	char req[LG_REQ_MAX];
+	size_t reqlen;
+} endpoint_t;
+
+typedef struct {
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t non2xx;
+	uint64_t bytes;
+} ep_stats_t;
+
+enum { R_HEAD, R_BODY, R_CHUNK_SIZE, R_CHUNK_DATA, R_CHUNK_END, R_TRAILER,
+    R_UNTIL_EOF };
+
+struct worker;
+
+typedef struct {
+	struct worker *w;
+	int fd;			/* -1: closed */
+	int open;		/* connected */
+	int64_t retry_at;
+	char *wbuf;
+	size_t wlen, woff;
+	char rbuf[LG_RBUF];
+	size_t rlen;
+	int64_t due[LG_PIPELINE_MAX];	/* in flight, oldest at head */
+	int ep[LG_PIPELINE_MAX];
+	int head, inflight;
+	uint64_t next_tick;	/* open loop: oldest tick not yet sent */
+	int rstate;		/* answer being read */
+	uint64_t remain;
+	int status;
+	int chunked;
+	int close;
+} conn_t;
+
+typedef struct worker {
+	int kq;
+	conn_t *conns;
+	int nconns;
+	double rate;		/* requests/s of this thread; 0: closed */
+	uint64_t tick;		/* next tick not yet due */
+	hist_t *hist;		/* one per endpoint */
+	ep_stats_t *stats;
+	uint64_t connect_errors;
+	uint64_t rng;
+	pthread_t tid;
+} worker_t;
+
+static struct sockaddr_storage lg_addr;
+static socklen_t lg_addrlen;
+static endpoint_t lg_eps[LG_ENDPOINTS_MAX];
+static int lg_neps;
+static unsigned int lg_total_weight;
+static int lg_depth = 1;
+static int lg_close;
+static int64_t lg_t0, lg_tend;
+
+static void conn_reset(conn_t *c, int failed);
+
+/** Monotonic clock in nanoseconds. */
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * LG_NS + ts.tv_nsec;
+}
+
+/** Bucket of @p v microseconds; the last one takes everything above. */
+static int
+hist_index(uint64_t v)
+{
+	int b, i;
+
+	if (v < HIST_SUB)
+		return (int)v;
+	b = 63 - __builtin_clzll(v) - (HIST_SUB_BITS - 1);
+	i = HIST_SUB + (b - 1) * HIST_HALF + (int)((v >> b) - HIST_HALF);
+	return i < HIST_LEN ? i : HIST_LEN - 1;
+}
+
+/** Highest value, in microseconds, counted in bucket @p i. */
+static uint64_t
+hist_value(int i)
+{
+	int b;
+
+	if (i < HIST_SUB)
+		return (uint64_t)i;
+	b = (i - HIST_SUB) / HIST_HALF + 1;
+	return (((uint64_t)((i - HIST_SUB) % HIST_HALF + HIST_HALF) + 1) <<
+	    b) - 1;
+}
+
+static void
+hist_record(hist_t *h, uint64_t us)
+{
+	h->counts[hist_index(us)]++;
+	h->total++;
+	if (us > h->max)
+		h->max = us;
+	h->sum += (double)us;
+	h->sumsq += (double)us * (double)us;
+}
+
+static void
+hist_add(hist_t *to, const hist_t *from)
+{
+	for (int i = 0; i < HIST_LEN; i++)
+		to->counts[i] += from->counts[i];
+	to->total += from->total;
+	if (from->max > to->max)
+		to->max = from->max;
+	to->sum += from->sum;
+	to->sumsq += from->sumsq;
+}
+
+/** Latency at percentile @p p (0-100), in milliseconds. */
+static double
+hist_percentile(const hist_t *h, double p)
+{
+	uint64_t want, seen = 0;
+
+	if (h->total == 0)
+		return 0;
+	want = (uint64_t)ceil(p / 100.0 * (double)h->total);
+	if (want == 0)
+		want = 1;
+	for (int i = 0; i < HIST_LEN; i++) {
+		seen += h->counts[i];
+		if (seen >= want)
+			return (double)(hist_value(i) < h->max ?
+			    hist_value(i) : h->max) / 1000.0;
+	}
+	return (double)h->max / 1000.0;
+}
+
+static double
+hist_mean(const hist_t *h)
+{
+	return h->total ? h->sum / (double)h->total / 1000.0 : 0;
+}
+
+static double
+hist_stdev(const hist_t *h)
+{
+	double m, v;
+
+	if (h->total == 0)
+		return 0;
+	m = h->sum / (double)h->total;
+	v = h->sumsq / (double)h->total - m * m;
+	return v > 0 ? sqrt(v) / 1000.0 : 0;
+}
+
+/**
+ * Write @p h as HdrHistogram's percentile distribution: values in ms,
+ * HIST_TICKS lines per halving of the distance to 100%.
+ */
+static int
+hist_write(const hist_t *h, const char *path)
+{
+	double next = 0, pct;
+	uint64_t seen = 0;
+	FILE *f;
+	int done = 0;
+
+	if ((f = fopen(path, "w")) == NULL)
+		return -1;
+	fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile",
+	    "TotalCount", "1/(1-Percentile)");
+	for (int i = 0; i < HIST_LEN && !done; i++) {
+		double v;
+
+		if (h->counts[i] == 0)
+			continue;
+		seen += h->counts[i];
+		pct = 100.0 * (double)seen / (double)h->total;
+		v = (double)(hist_value(i) < h->max ? hist_value(i) : h->max) /
+		    1000.0;
+		while (next <= pct) {
+			double inv = 1.0 / (1.0 - next / 100.0);
+
+			/* Past one sample of resolution: only 100% is left. */
+			if (seen == h->total && inv > (double)h->total) {
+				fprintf(f, "%12.3f %14.12f %10llu\n", v, 1.0,
+				    (unsigned long long)seen);
+				done = 1;
+				break;
+			}
+			fprintf(f, "%12.3f %14.12f %10llu %14.2f\n", v,
+			    next / 100.0, (unsigned long long)seen, inv);
+			next += 100.0 / (HIST_TICKS *
+			    pow(2, floor(log2(100.0 / (100.0 - next))) + 1));
+		}
+	}
+	fprintf(f, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+	    hist_mean(h), hist_stdev(h));
+	fprintf(f, "#[Max     = %12.3f, Total count    = %12llu]\n",
+	    (double)h->max / 1000.0, (unsigned long long)h->total);
+	fprintf(f, "#[Buckets = %12d, SubBuckets     = %12d]\n", HIST_BUCKETS,
+	    HIST_SUB);
+	return fclose(f);
+}
+
+/** xorshift64*: endpoint picks. */
+static uint64_t
+rng_next(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+static int
+pick_endpoint(worker_t *w)
+{
+	unsigned int r;
+
+	if (lg_neps == 1)
+		return 0;
+	r = (unsigned int)(rng_next(&w->rng) % lg_total_weight);
+	for (int i = 0; i < lg_neps; i++) {
+		if (r < lg_eps[i].weight)
+			return i;
+		r -= lg_eps[i].weight;
+	}
+	return lg_neps - 1;
+}
+
+/** When tick @p t of @p w is due. */
+static int64_t
+tick_due(const worker_t *w, uint64_t t)
+{
+	return lg_t0 + (int64_t)((double)t * (double)LG_NS / w->rate);
+}
+
+/** (Re)arm the one-shot write filter of @p c. */
+static void
+conn_want_write(conn_t *c)
+{
+	struct kevent ev;
+
+	EV_SET(&ev, c->fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, c);
+	if (kevent(c->w->kq, &ev, 1, NULL, 0, NULL) < 0)
+		conn_reset(c, 1);
+}
+
+/** Write what is queued; the rest waits for EVFILT_WRITE. */
+static void
+conn_flush(conn_t *c)
+{
+	ssize_t n;
+
+	while (c->woff < c->wlen) {
+		n = write(c->fd, c->wbuf + c->woff, c->wlen - c->woff);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN) {
+			conn_want_write(c);
+			return;
+		}
+		if (n <= 0) {
+			conn_reset(c, 1);
+			return;
+		}
+		c->woff += (size_t)n;
+	}
+	c->woff = c->wlen = 0;
+}
+
+/** Queue one request due at @p due. */
+static void
+conn_enqueue(conn_t *c, int64_t due)
+{
+	const endpoint_t *e;
+	int ep = pick_endpoint(c->w);
+	int slot = (c->head + c->inflight) % LG_PIPELINE_MAX;
+
+	e = &lg_eps[ep];
+	if (c->woff > 0) {
+		memmove(c->wbuf, c->wbuf + c->woff, c->wlen - c->woff);
+		c->wlen -= c->woff;
+		c->woff = 0;
+	}
+	memcpy(c->wbuf + c->wlen, e->req, e->reqlen);
+	c->wlen += e->reqlen;
+	c->due[slot] = due;
+	c->ep[slot] = ep;
+	c->inflight++;
+}
+
+/** Send what @p c may: its overdue ticks, or a full pipeline. */
+static void
+conn_issue(conn_t *c, int64_t now)
+{
+	worker_t *w = c->w;
+	int queued = 0;
+
+	if (!c->open || now >= lg_tend)
+		return;
+	while (c->inflight < lg_depth) {
+		if (w->rate > 0) {
+			if (c->next_tick >= w->tick)
+				break;
+			conn_enqueue(c, tick_due(w, c->next_tick));
+			c->next_tick += (uint64_t)w->nconns;
+		} else {
+			conn_enqueue(c, now);
+		}
+		queued = 1;
+	}
+	if (queued)
+		conn_flush(c);
+}
+
+/** Start a non-blocking connect; failures retry after LG_RETRY_NS. */
+static void
+conn_open(conn_t *c, int64_t now)
+{
+	struct kevent ev;
+	int one = 1;
+
+	c->fd = socket(lg_addr.ss_family, SOCK_STREAM, 0);
+	if (c->fd < 0)
+		goto fail;
+	if (fcntl(c->fd, F_SETFL, O_NONBLOCK) < 0)
+		goto fail;
+	(void)setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	EV_SET(&ev, c->fd, EVFILT_READ, EV_ADD, 0, 0, c);
+	if (kevent(c->w->kq, &ev, 1, NULL, 0, NULL) < 0)
+		goto fail;
+	if (connect(c->fd, (struct sockaddr *)&lg_addr, lg_addrlen) == 0) {
+		c->open = 1;
+		conn_issue(c, now);
+		return;
+	}
+	if (errno == EINPROGRESS) {
+		conn_want_write(c);
+		return;
+	}
+fail:
+	c->w->connect_errors++;
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	c->retry_at = now + LG_RETRY_NS;
+}
+
+/**
+ * Close @p c and reconnect. With @p failed, the requests in flight are
+ * errors; their ticks are not sent again.
+ */
+static void
+conn_reset(conn_t *c, int failed)
+{
+	int64_t now = now_ns();
+
+	if (failed) {
+		for (int i = 0; i < c->inflight; i++) {
+			int ep = c->ep[(c->head + i) % LG_PIPELINE_MAX];
+
+			if (c->due[(c->head + i) % LG_PIPELINE_MAX] < lg_tend)
+				c->w->stats[ep].errors++;
+		}
+	}
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	c->open = 0;
+	c->wlen = c->woff = c->rlen = 0;
+	c->head = c->inflight = 0;
+	c->rstate = R_HEAD;
+	if (now < lg_tend)
+		conn_open(c, now);
+}
+
+/** Whether header line [p, end) is @p name with a value containing @p v. */
+static int
+header_has(const char *p, const char *end, const char *name, const char *v)
+{
+	size_t n = strlen(name), vn = strlen(v);
+
+	if ((size_t)(end - p) <= n || strncasecmp(p, name, n) != 0 ||
+	    p[n] != ':')
+		return 0;
+	for (p += n + 1; (size_t)(end - p) >= vn; p++)
+		if (strncasecmp(p, v, vn) == 0)
+			return 1;
+	return 0;
+}
+
+/** Parse the head at the start of rbuf; -1 on garbage. */
+static int
+resp_head(conn_t *c, size_t headlen)
+{
+	const char *p = c->rbuf, *end = c->rbuf + headlen, *nl;
+	int have_len = 0;
+
+	if (headlen < 12 || strncmp(p, "HTTP/1.", 7) != 0 ||
+	    !isdigit((unsigned char)p[9]))
+		return -1;
+	c->status = atoi(p + 9);
+	c->chunked = 0;
+	c->close = lg_close || p[7] == '0';
+	c->remain = 0;
+	for (p = (const char *)memchr(p, '\n', headlen) + 1; p < end;
+	    p = nl + 1) {
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+			break;
+		if (strncasecmp(p, "Content-Length:", 15) == 0) {
+			c->remain = strtoull(p + 15, NULL, 10);
+			have_len = 1;
+		} else if (header_has(p, nl, "Transfer-Encoding", "chunked")) {
+			c->chunked = 1;
+		} else if (header_has(p, nl, "Connection", "close")) {
+			c->close = 1;
+		} else if (header_has(p, nl, "Connection", "keep-alive")) {
+			c->close = lg_close;
+		}
+	}
+	if (c->status == 204 || c->status == 304 || c->status / 100 == 1)
+		c->rstate = R_HEAD;
+	else if (c->chunked)
+		c->rstate = R_CHUNK_SIZE;
+	else if (have_len)
+		c->rstate = c->remain > 0 ? R_BODY : R_HEAD;
+	else
+		c->rstate = R_UNTIL_EOF;
+	return 0;
+}
+
+/** Length of the head ending in a blank line in @p buf, or 0. */
+static size_t
+head_len(const char *buf, size_t len)
+{
+	for (size_t i = 3; i < len; i++)
+		if (memcmp(buf + i - 3, "\r\n\r\n", 4) == 0)
+			return i + 1;
+	return 0;
+}
+
+/** Drop the first @p n bytes of rbuf, counting them for endpoint @p ep. */
+static void
+rbuf_consume(conn_t *c, size_t n, int ep)
+{
+	c->w->stats[ep].bytes += n;
+	memmove(c->rbuf, c->rbuf + n, c->rlen - n);
+	c->rlen -= n;
+}
+
+/**
+ * Advance the answer at the head of the pipeline through rbuf.
+ * @return 1 when it is complete, 0 when more bytes are needed, -1 on a
+ * malformed answer.
+ */
+static int
+resp_parse(conn_t *c)
+{
+	int ep = c->ep[c->head];
+	char *nl;
+	size_t n;
+
+	for (;;) {
+		switch (c->rstate) {
+		case R_HEAD:
+			if ((n = head_len(c->rbuf, c->rlen)) == 0)
+				return c->rlen == sizeof(c->rbuf) ? -1 : 0;
+			if (resp_head(c, n) != 0)
+				return -1;
+			rbuf_consume(c, n, ep);
+			if (c->rstate == R_HEAD)
+				return 1;
+			break;
+		case R_BODY:
+		case R_CHUNK_DATA:
+			n = c->rlen < c->remain ? c->rlen : (size_t)c->remain;
+			rbuf_consume(c, n, ep);
+			c->remain -= n;
+			if (c->remain > 0)
+				return 0;
+			if (c->rstate == R_BODY) {
+				c->rstate = R_HEAD;
+				return 1;
+			}
+			c->rstate = R_CHUNK_END;
+			break;
+		case R_CHUNK_END:
+			if (c->rlen < 2)
+				return 0;
+			if (c->rbuf[0] != '\r' || c->rbuf[1] != '\n')
+				return -1;
+			rbuf_consume(c, 2, ep);
+			c->rstate = R_CHUNK_SIZE;
+			break;
+		case R_CHUNK_SIZE:
+		case R_TRAILER:
+			if ((nl = memchr(c->rbuf, '\n', c->rlen)) == NULL)
+				return c->rlen == sizeof(c->rbuf) ? -1 : 0;
+			n = (size_t)(nl - c->rbuf) + 1;
+			if (c->rstate == R_TRAILER) {
+				rbuf_consume(c, n, ep);
+				if (n <= 2) {
+					c->rstate = R_HEAD;
+					return 1;
+				}
+				break;
+			}
+			if (!isxdigit((unsigned char)c->rbuf[0]))
+				return -1;
+			c->remain = strtoull(c->rbuf, NULL, 16);
+			rbuf_consume(c, n, ep);
+			c->rstate = c->remain > 0 ? R_CHUNK_DATA : R_TRAILER;
+			break;
+		case R_UNTIL_EOF:
+			rbuf_consume(c, c->rlen, ep);
+			return 0;
+		}
+	}
+}
+
+/** One answer is complete: record it against its due time. */
+static void
+conn_answered(conn_t *c, int64_t now)
+{
+	worker_t *w = c->w;
+	int ep = c->ep[c->head];
+	int64_t due = c->due[c->head];
+
+	c->head = (c->head + 1) % LG_PIPELINE_MAX;
+	c->inflight--;
+	if (due >= lg_tend || now >= lg_tend)
+		return;
+	hist_record(&w->hist[ep], (uint64_t)(now - due) / 1000);
+	w->stats[ep].requests++;
+	if (c->status < 200 || c->status >= 400)
+		w->stats[ep].non2xx++;
+}
+
+static void
+conn_readable(conn_t *c, int64_t now)
+{
+	ssize_t n;
+	int rc;
+
+	n = read(c->fd, c->rbuf + c->rlen, sizeof(c->rbuf) - c->rlen);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (n <= 0) {
+		if (n == 0 && c->inflight > 0 && c->rstate == R_UNTIL_EOF) {
+			conn_answered(c, now);
+			conn_reset(c, 0);
+		} else {
+			conn_reset(c, c->inflight > 0);
+		}
+		return;
+	}
+	c->rlen += (size_t)n;
+	while (c->rlen > 0 || c->rstate != R_HEAD) {
+		if (c->inflight == 0) {
+			conn_reset(c, 1);	/* an answer nobody asked for */
+			return;
+		}
+		if ((rc = resp_parse(c)) < 0) {
+			conn_reset(c, 1);
+			return;
+		}
+		if (rc == 0)
+			break;
+		conn_answered(c, now);
+		if (c->close) {
+			conn_reset(c, c->inflight > 0);
+			return;
+		}
+	}
+	conn_issue(c, now);
+}
+
+static void
+conn_writable(conn_t *c, int64_t now)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (c->open) {
+		conn_flush(c);
+		return;
+	}
+	if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+	    err != 0) {
+		c->w->connect_errors++;
+		close(c->fd);
+		c->fd = -1;
+		c->retry_at = now + LG_RETRY_NS;
+		return;
+	}
+	c->open = 1;
+	conn_issue(c, now);
+}
+
+/** Reopen connections whose retry time has come; next retry time. */
+static int64_t
+worker_retry(worker_t *w, int64_t now)
+{
+	int64_t next = INT64_MAX;
+
+	for (int i = 0; i < w->nconns; i++) {
+		conn_t *c = &w->conns[i];
+
+		if (c->fd >= 0)
+			continue;
+		if (c->retry_at <= now)
+			conn_open(c, now);
+		if (c->fd < 0 && c->retry_at < next)
+			next = c->retry_at;
+	}
+	return next;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct kevent ev[LG_EVENTS];
+	struct timespec ts;
+	worker_t *w = arg;
+	int64_t now, wake, retry;
+	int n;
+
+	now = now_ns();
+	for (int i = 0; i < w->nconns; i++)
+		conn_open(&w->conns[i], now);
+	retry = now + LG_RETRY_NS;
+	while ((now = now_ns()) < lg_tend) {
+		/* Open loop: hand each tick that came due to its connection. */
+		while (w->rate > 0 && tick_due(w, w->tick) <= now) {
+			conn_t *c = &w->conns[w->tick % (uint64_t)w->nconns];
+
+			w->tick++;
+			conn_issue(c, now);
+		}
+		if (now >= retry)
+			retry = worker_retry(w, now);
+		wake = lg_tend;
+		if (w->rate > 0 && tick_due(w, w->tick) < wake)
+			wake = tick_due(w, w->tick);
+		if (retry < wake)
+			wake = retry;
+		wake = wake > now ? wake - now : 0;
+		ts.tv_sec = (time_t)(wake / LG_NS);
+		ts.tv_nsec = (long)(wake % LG_NS);
+		n = kevent(w->kq, NULL, 0, ev, LG_EVENTS, &ts);
+		if (n < 0 && errno != EINTR)
+			break;
+		now = now_ns();
+		for (int i = 0; i < n; i++) {
+			conn_t *c = ev[i].udata;
+
+			/* Closed and maybe reopened earlier in this batch. */
+			if (c->fd < 0 || (int)ev[i].ident != c->fd)
+				continue;
+			if (ev[i].filter == EVFILT_WRITE)
+				conn_writable(c, now);
+			else if (ev[i].filter == EVFILT_READ)
+				conn_readable(c, now);
+		}
+	}
+	for (int i = 0; i < w->nconns; i++)
+		if (w->conns[i].fd >= 0)
+			close(w->conns[i].fd);
+	close(w->kq);
+	return NULL;
+}
+
+/** Resolve host:port (or [v6]:port) into lg_addr. */
+static int
+parse_target(const char *arg)
+{
+	struct addrinfo hints, *res;
+	char host[256];
+	const char *colon, *h = arg;
+	size_t hl;
+
+	if ((colon = strrchr(arg, ':')) == NULL)
+		return -1;
+	hl = (size_t)(colon - arg);
+	if (arg[0] == '[' && hl > 2 && arg[hl - 1] == ']') {
+		h = arg + 1;
+		hl -= 2;
+	}
+	if (hl == 0 || hl >= sizeof(host))
+		return -1;
+	memcpy(host, h, hl);
+	host[hl] = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+		return -1;
+	memcpy(&lg_addr, res->ai_addr, res->ai_addrlen);
+	lg_addrlen = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+/** Parse [id[*weight]=]path and build its request head. */
+static int
+parse_endpoint(const char *arg, const char *hostport)
+{
+	endpoint_t *e = &lg_eps[lg_neps];
+	const char *eq = strchr(arg, '=');
+	const char *star;
+	size_t idlen;
+	int n;
+
+	e->weight = 1;
+	e->path = arg;
+	if (arg[0] != '/' && eq != NULL) {
+		e->path = eq + 1;
+		idlen = (size_t)(eq - arg);
+		if ((star = memchr(arg, '*', idlen)) != NULL) {
+			e->weight = (unsigned int)strtoul(star + 1, NULL, 10);
+			idlen = (size_t)(star - arg);
+		}
+		if (idlen == 0 || idlen >= sizeof(e->id) || e->weight == 0)
+			return -1;
+		memcpy(e->id, arg, idlen);
+		e->id[idlen] = '\0';
+	} else {
+		if (strlcpy(e->id, arg, sizeof(e->id)) >= sizeof(e->id))
+			return -1;
+	}
+	if (e->path[0] != '/')
+		return -1;
+	n = snprintf(e->req, sizeof(e->req), "GET %s HTTP/1.1\r\nHost: %s\r\n"
+	    "User-Agent: miniweb-loadgen\r\n%s\r\n", e->path, hostport,
+	    lg_close ? "Connection: close\r\n" : "");
+	if (n < 0 || (size_t)n >= sizeof(e->req))
+		return -1;
+	e->reqlen = (size_t)n;
+	lg_total_weight += e->weight;
+	lg_neps++;
+	return 0;
+}
+
+/** One stdout line for @p h and @p st over @p secs seconds. */
+static void
+print_line(const char *id, const hist_t *h, const ep_stats_t *st,
+    double secs)
+{
+	printf("%s\t%llu\t%llu\t%llu\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t"
+	    "%.3f\t%.3f\t%.3f\n", id, (unsigned long long)st->requests,
+	    (unsigned long long)st->errors, (unsigned long long)st->non2xx,
+	    (double)st->requests / secs,
+	    (double)st->bytes / secs / (1024.0 * 1024.0), hist_mean(h),
+	    hist_stdev(h), hist_percentile(h, 50), hist_percentile(h, 90),
+	    hist_percentile(h, 99), hist_percentile(h, 99.9),
+	    (double)h->max / 1000.0);
+}
+
+/** prefix.hgrm, or prefix.<id>.hgrm with @p id lowercased and made safe. */
+static void
+write_hgrm(const char *prefix, const char *id, const hist_t *h)
+{
+	char path[1024], safe[64];
+	size_t i;
+
+	if (id == NULL) {
+		snprintf(path, sizeof(path), "%s.hgrm", prefix);
+	} else {
+		for (i = 0; id[i] != '\0' && i < sizeof(safe) - 1; i++)
+			safe[i] = isalnum((unsigned char)id[i]) ?
+			    (char)tolower((unsigned char)id[i]) : '_';
+		safe[i] = '\0';
+		snprintf(path, sizeof(path), "%s.%s.hgrm", prefix, safe);
+	}
+	if (hist_write(h, path) != 0)
+		fprintf(stderr, "miniweb-loadgen: %s: %s\n", path,
+		    strerror(errno));
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: miniweb-loadgen [-C] [-c conns] [-d sec] "
+	    "[-o prefix] [-p depth]\n"
+	    "                       [-r rate] [-t threads] host:port "
+	    "[id[*weight]=]path ...\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	ep_stats_t all = {0, 0, 0, 0};
+	ep_stats_t *eps;
+	worker_t *workers;
+	hist_t *total, *sum;
+	const char *prefix = NULL;
+	double rate = 0, secs;
+	int conns = 16, threads = 1, duration = 10;
+	uint64_t connect_errors = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "Cc:d:o:p:r:t:")) != -1) {
+		switch (ch) {
+		case 'C':
+			lg_close = 1;
+			break;
+		case 'c':
+			conns = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'o':
+			prefix = optarg;
+			break;
+		case 'p':
+			lg_depth = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 2 || conns < 1 || conns > LG_CONNS_MAX || duration < 1 ||
+	    lg_depth < 1 || lg_depth > LG_PIPELINE_MAX || rate < 0 ||
+	    threads < 1 || threads > LG_THREADS_MAX)
+		usage();
+	if (lg_close)
+		lg_depth = 1;	/* nothing can follow a closing answer */
+	if (threads > conns)
+		threads = conns;
+	if (parse_target(argv[0]) != 0) {
+		fprintf(stderr, "miniweb-loadgen: cannot resolve %s\n",
+		    argv[0]);
+		return 1;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (lg_neps == LG_ENDPOINTS_MAX ||
+		    parse_endpoint(argv[i], argv[0]) != 0) {
+			fprintf(stderr, "miniweb-loadgen: bad path %s\n",
+			    argv[i]);
+			return 1;
+		}
+	}
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	workers = calloc((size_t)threads, sizeof(*workers));
+	total = calloc((size_t)lg_neps + 1, sizeof(*total));
+	eps = calloc((size_t)lg_neps, sizeof(*eps));
+	if (workers == NULL || total == NULL || eps == NULL)
+		goto nomem;
+	lg_t0 = now_ns() + LG_NS / 100;	/* connections open meanwhile */
+	lg_tend = lg_t0 + (int64_t)duration * LG_NS;
+	for (int t = 0; t < threads; t++) {
+		worker_t *w = &workers[t];
+
+		w->nconns = conns / threads + (t < conns % threads);
+		w->rate = rate * w->nconns / conns;
+		w->rng = 0x9e3779b97f4a7c15ULL * (uint64_t)(t + 1);
+		w->conns = calloc((size_t)w->nconns, sizeof(*w->conns));
+		w->hist = calloc((size_t)lg_neps, sizeof(*w->hist));
+		w->stats = calloc((size_t)lg_neps, sizeof(*w->stats));
+		if (w->conns == NULL || w->hist == NULL || w->stats == NULL)
+			goto nomem;
+		if ((w->kq = kqueue()) < 0) {
+			perror("miniweb-loadgen: kqueue");
+			return 1;
+		}
+		for (int i = 0; i < w->nconns; i++) {
+			conn_t *c = &w->conns[i];
+
+			c->w = w;
+			c->fd = -1;
+			c->next_tick = (uint64_t)i;
+			c->wbuf = malloc((size_t)lg_depth * LG_REQ_MAX);
+			if (c->wbuf == NULL)
+				goto nomem;
+		}
+	}
+	for (int t = 0; t < threads; t++) {
+		if (pthread_create(&workers[t].tid, NULL, worker_main,
+		    &workers[t]) != 0) {
+			perror("miniweb-loadgen: pthread_create");
+			return 1;
+		}
+	}
+	for (int t = 0; t < threads; t++) {
+		worker_t *w = &workers[t];
+
+		pthread_join(w->tid, NULL);
+		connect_errors += w->connect_errors;
+		for (int e = 0; e < lg_neps; e++) {
+			hist_add(&total[e], &w->hist[e]);
+			eps[e].requests += w->stats[e].requests;
+			eps[e].errors += w->stats[e].errors;
+			eps[e].non2xx += w->stats[e].non2xx;
+			eps[e].bytes += w->stats[e].bytes;
+		}
+	}
+	sum = &total[lg_neps];
+	all.errors = connect_errors;
+	for (int e = 0; e < lg_neps; e++) {
+		hist_add(sum, &total[e]);
+		all.requests += eps[e].requests;
+		all.errors += eps[e].errors;
+		all.non2xx += eps[e].non2xx;
+		all.bytes += eps[e].bytes;
+	}
+
+	secs = (double)(lg_tend - lg_t0) / (double)LG_NS;
+	printf("endpoint\trequests\terrors\tnon_2xx\treq_sec\tmb_sec\t"
+	    "mean_ms\tstdev_ms\tp50_ms\tp90_ms\tp99_ms\tp999_ms\tmax_ms\n");
+	print_line("ALL", sum, &all, secs);
+	for (int e = 0; lg_neps > 1 && e < lg_neps; e++)
+		print_line(lg_eps[e].id, &total[e], &eps[e], secs);
+	if (prefix != NULL) {
+		write_hgrm(prefix, NULL, sum);
+		for (int e = 0; lg_neps > 1 && e < lg_neps; e++)
+			write_hgrm(prefix, lg_eps[e].id, &total[e]);
+	}
+	if (rate > 0 && (double)all.requests < rate * secs * 0.9)
+		fprintf(stderr, "miniweb-loadgen: %.0f req/s asked, %.0f "
+		    "answered in time; see the tail latencies\n", rate,
+		    (double)all.requests / secs);
+	for (int t = 0; t < threads; t++) {
+		for (int i = 0; i < workers[t].nconns; i++)
+			free(workers[t].conns[i].wbuf);
+		free(workers[t].conns);
+		free(workers[t].hist);
+		free(workers[t].stats);
+	}
+	free(workers);
+	free(total);
+	free(eps);
+	return 0;
+nomem:
+	fprintf(stderr, "miniweb-loadgen: out of memory\n");
+	return 1;
+}
@@ -0,0 +1,168 @@
+/* logdump.c - print a miniweb binary access log as text */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/http/request_parser.h>
+#include <miniweb/net/access_log.h>
+
+/*
+ * One line per record:
+ *
+ *	2026-01-02T03:04:05.678901Z 192.0.2.7 GET 200 5120 850us GET /api/x
+ *
+ * time (UTC), client, method, status, bytes, handler time and the route
+ * as named by the header in force ("unmatched" for 404/405 answers).
+ */
+
+static const char *const method_names[HTTP_METHOD_COUNT] = {
+	[HTTP_METHOD_OTHER] = "-",
+	[HTTP_METHOD_GET] = "GET",
+	[HTTP_METHOD_HEAD] = "HEAD",
+	[HTTP_METHOD_POST] = "POST",
+	[HTTP_METHOD_PUT] = "PUT",
+	[HTTP_METHOD_DELETE] = "DELETE",
+	[HTTP_METHOD_OPTIONS] = "OPTIONS",
+	[HTTP_METHOD_PATCH] = "PATCH",
+};
+
+#define ROUTES_MAX	65536
+
+static char *routes[ROUTES_MAX];
+
+static uint16_t
+get16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return (uint32_t)get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+	return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+/** Read exactly @p len bytes; 0 on success, 1 at a clean EOF, -1 else. */
+static int
+read_full(FILE *fp, void *buf, size_t len)
+{
+	size_t n = fread(buf, 1, len, fp);
+
+	if (n == len)
+		return 0;
+	return n == 0 && feof(fp) ? 1 : -1;
+}
+
+/** Replace the route table with the header after the magic byte. */
+static int
+read_header(FILE *fp)
+{
+	unsigned char h[8], e[3];
+	char name[256];
+	uint16_t count;
+
+	if (read_full(fp, h + 1, 7) != 0 || memcmp(h + 1, ALOG_MAGIC + 1,
+	    3) != 0)
+		return -1;
+	if (h[4] != ALOG_VERSION || h[5] != ALOG_RECORD_SIZE)
+		return -1;
+	for (int i = 0; i < ROUTES_MAX; i++) {
+		free(routes[i]);
+		routes[i] = NULL;
+	}
+	count = get16(h + 6);
+	for (unsigned int i = 0; i < count; i++) {
+		if (read_full(fp, e, 3) != 0 ||
+		    read_full(fp, name, e[2]) != 0)
+			return -1;
+		name[e[2]] = '\0';
+		free(routes[get16(e)]);
+		if ((routes[get16(e)] = strdup(name)) == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+/** Print one record. */
+static void
+print_record(const unsigned char *r)
+{
+	char when[32], addr[INET_ADDRSTRLEN];
+	uint64_t us = get64(r + 24);
+	time_t sec = (time_t)(us / 1000000);
+	struct in_addr in;
+	struct tm tm;
+	const char *route;
+
+	gmtime_r(&sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+	memcpy(&in.s_addr, r + 8, 4);
+	if (inet_ntop(AF_INET, &in, addr, sizeof(addr)) == NULL)
+		strlcpy(addr, "-", sizeof(addr));
+	route = routes[get16(r + 2)];
+	printf("%s.%06luZ %s %s %u %" PRIu64 " %" PRIu32 "us %s\n", when,
+	    (unsigned long)(us % 1000000), addr,
+	    r[1] < HTTP_METHOD_COUNT ? method_names[r[1]] : "-",
+	    (unsigned int)get16(r + 4), get64(r + 16), get32(r + 12),
+	    route ? route : "unmatched");
+}
+
+/** Decode @p fp; 0 on success, -1 on a malformed file. */
+static int
+dump(FILE *fp, const char *name)
+{
+	unsigned char r[ALOG_RECORD_SIZE];
+	int have_header = 0, rc;
+
+	while ((rc = read_full(fp, r, 1)) == 0) {
+		if (r[0] == (unsigned char)ALOG_MAGIC[0]) {
+			if (read_header(fp) != 0)
+				break;
+			have_header = 1;
+			continue;
+		}
+		if (r[0] != ALOG_REC_REQUEST || !have_header ||
+		    read_full(fp, r + 1, ALOG_RECORD_SIZE - 1) != 0) {
+			rc = -1;
+			break;
+		}
+		print_record(r);
+	}
+	if (rc != 1) {
+		fprintf(stderr, "miniweb-logdump: %s: not a miniweb access "
+		    "log, or truncated\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *fp;
+	int rc = 0;
+
+	if (argc < 2)
+		return dump(stdin, "stdin") == 0 ? 0 : 1;
+	for (int i = 1; i < argc; i++) {
+		if ((fp = fopen(argv[i], "rb")) == NULL) {
+			perror(argv[i]);
+			rc = 1;
+			continue;
+		}
+		if (dump(fp, argv[i]) != 0)
+			rc = 1;
+		fclose(fp);
+	}
+	return rc;
+}
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <miniweb/net/access_log.h>
+#include <miniweb/router/urls.h>
+
+#define THREADS 4
+#define RECORDS 20000
+
+/* Two routes are registered: 0 and 5. */
+int
+route_describe(int id, char *buf, size_t buf_len)
+{
+	if (id != 0 && id != 5)
+		return 0;
+	snprintf(buf, buf_len, "GET /route%d", id);
+	return 1;
+}
+
+static void *
+writer(void *arg)
+{
+	uint32_t id = (uint32_t)(long)arg;
+
+	for (int i = 0; i < RECORDS; i++)
+		access_log_record(5, 1, 200, (size_t)i, 100, id);
+	return NULL;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return (uint32_t)(p[0] | p[1] << 8 | p[2] << 16 |
+	    (uint32_t)p[3] << 24);
+}
+
+/** Parse @p path; count records per client and 5xx records. */
+static void
+scan(const char *path, int headers, unsigned long per_client[THREADS],
+    unsigned long *errors)
+{
+	unsigned char r[ALOG_RECORD_SIZE], h[8], e[3];
+	char name[256];
+	int seen_headers = 0;
+	uint32_t client;
+	FILE *fp;
+
+	memset(per_client, 0, THREADS * sizeof(per_client[0]));
+	*errors = 0;
+	fp = fopen(path, "rb");
+	assert(fp != NULL);
+	while (fread(r, 1, 1, fp) == 1) {
+		if (r[0] == 'M') {
+			assert(fread(h + 1, 1, 7, fp) == 7);
+			assert(memcmp(h + 1, "WAL", 3) == 0);
+			assert(h[4] == ALOG_VERSION && h[5] == ALOG_RECORD_SIZE);
+			assert(h[6] == 2 && h[7] == 0);
+			for (int i = 0; i < 2; i++) {
+				assert(fread(e, 1, 3, fp) == 3);
+				assert(fread(name, 1, e[2], fp) == e[2]);
+				name[e[2]] = '\0';
+				assert(strcmp(name, e[0] ? "GET /route5" :
+				    "GET /route0") == 0);
+			}
+			seen_headers++;
+			continue;
+		}
+		assert(r[0] == ALOG_REC_REQUEST);
+		assert(fread(r + 1, 1, ALOG_RECORD_SIZE - 1, fp) ==
+		    ALOG_RECORD_SIZE - 1);
+		assert(r[1] == 1 && r[2] == 5 && r[3] == 0);
+		if (r[4] == 0xf4 && r[5] == 1) {	/* 500 */
+			(*errors)++;
+			continue;
+		}
+		assert(r[4] == 200 && r[5] == 0);
+		assert(get32(r + 12) == 100);
+		client = get32(r + 8);
+		assert(client < THREADS);
+		per_client[client]++;
+	}
+	fclose(fp);
+	assert(seen_headers == headers);
+}
+
+int
+main(void)
+{
+	char path[] = "/tmp/access_log_test.XXXXXX";
+	unsigned long per_client[THREADS], errors;
+	uint64_t written, dropped;
+	pthread_t t[THREADS];
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	/* Closed: records are ignored. */
+	access_log_record(5, 1, 200, 1, 1, 0);
+	assert(access_log_open("", 1) == 0);
+	access_log_record(5, 1, 200, 1, 1, 0);
+
+	assert(access_log_open(path, 1) == 0);
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_create(&t[i], NULL, writer,
+		    (void *)(long)i) == 0);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(t[i], NULL);
+	access_log_close();
+	access_log_stats(&written, &dropped);
+	assert(written + dropped == THREADS * RECORDS);
+	scan(path, 1, per_client, &errors);
+	for (int i = 0; i < THREADS; i++)
+		assert(per_client[i] <= RECORDS);
+	assert(per_client[0] + per_client[1] + per_client[2] +
+	    per_client[3] == written && errors == 0);
+
+	/* Reopened with sampling: a second header, one in ten, all 5xx. */
+	assert(access_log_open(path, 10) == 0);
+	for (int i = 0; i < 1000; i++)
+		access_log_record(5, 1, 200, 0, 100, 0);
+	for (int i = 0; i < 7; i++)
+		access_log_record(5, 1, 500, 0, 100, 0);
+	access_log_close();
+	scan(path, 2, per_client, &errors);
+	assert(per_client[0] <= RECORDS + 100 && errors == 7);
+	access_log_stats(&written, &dropped);
+	assert(written + dropped == THREADS * RECORDS + 107);
+
+	unlink(path);
+	printf("access_log_test: ok (%llu written, %llu dropped)\n",
+	    (unsigned long long)written, (unsigned long long)dropped);
+	return 0;
+}
@@ -0,0 +1,423 @@
+/* bench.c - in-process microbenchmarks of the hot paths */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/core/conf.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/request_parser.h>
+#include <miniweb/http/response_internal.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/net/work_queue.h>
+#include <miniweb/render/template_engine.h>
+#include <miniweb/router/routes.h>
+
+/*
+ * Each benchmark runs a loop of n operations; n doubles from 1 until one
+ * run takes BENCH_TIME_MS (default 200) and that run is reported, one
+ * tab-separated line per benchmark under a header:
+ *
+ *	benchmark	iterations	ns_op	allocs_op
+ *
+ * Allocations are counted by wrapping malloc, calloc, realloc and strdup
+ * at link time (-Wl,--wrap), so calls made inside libc itself are not
+ * seen. Arguments select benchmarks by substring; none runs them all.
+ */
+
+int config_verbose = 0;
+char config_static_dir[] = "static";
+char config_templates_dir[] = "templates";
+int config_autoindex = 0;
+miniweb_conf_t config = {0};
+
+#define BENCH_TIME_MS_DEFAULT	200
+#define BENCH_THREADS_DEFAULT	4
+#define BENCH_QUEUE_THREADS_MAX	64
+
+static unsigned long bench_allocs;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+char *__real_strdup(const char *);
+
+void *
+__wrap_malloc(size_t n)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t n)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, n);
+}
+
+char *
+__wrap_strdup(const char *s)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __real_strdup(s);
+}
+
+typedef void (*bench_fn)(long n, void *ctx);
+
+static long bench_time_ns;
+static int bench_argc;
+static char **bench_argv;
+
+/** Monotonic clock in nanoseconds. */
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Whether @p name was asked for on the command line. */
+static int
+bench_selected(const char *name)
+{
+	if (bench_argc < 2)
+		return 1;
+	for (int i = 1; i < bench_argc; i++)
+		if (strstr(name, bench_argv[i]) != NULL)
+			return 1;
+	return 0;
+}
+
+/** Grow n until a run of @p fn lasts bench_time_ns; print that run. */
+static void
+bench_run(const char *name, bench_fn fn, void *ctx)
+{
+	unsigned long a0;
+	int64_t t0, dt;
+	long n = 1;
+
+	if (!bench_selected(name))
+		return;
+	for (;;) {
+		a0 = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+		t0 = now_ns();
+		fn(n, ctx);
+		dt = now_ns() - t0;
+		if (dt >= bench_time_ns || n >= (1L << 30))
+			break;
+		/* Aim past the target, at most 100x per step. */
+		n = dt > 0 && bench_time_ns / dt < 100 ?
+		    (long)(n * (bench_time_ns * 1.2 / dt)) + 1 : n * 100;
+	}
+	printf("%s\t%ld\t%.1f\t%.2f\n", name, n, (double)dt / n,
+	    (double)(__atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - a0) /
+	    n);
+	fflush(stdout);
+}
+
+static const char bench_request[] =
+    "GET /static/css/custom.css?v=3 HTTP/1.1\r\n"
+    "Host: localhost:9001\r\n"
+    "User-Agent: Mozilla/5.0 (X11; OpenBSD amd64; rv:128.0)\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Connection: keep-alive\r\n"
+    "If-None-Match: \"5f3a-1c2b-65a1b2c3\"\r\n"
+    "\r\n";
+
+/** Request line and headers, in one feed as after a full recv(). */
+static void
+bench_parser(long n, void *ctx)
+{
+	http_request_parser_t p;
+
+	(void)ctx;
+	for (long i = 0; i < n; i++) {
+		http_request_parser_reset(&p);
+		if (http_request_parser_feed(&p, bench_request,
+		    sizeof(bench_request) - 1) != 1)
+			abort();
+	}
+}
+
+/** The same head arriving a few bytes per recv(). */
+static void
+bench_parser_split(long n, void *ctx)
+{
+	http_request_parser_t p;
+	size_t len;
+	int rc;
+
+	(void)ctx;
+	for (long i = 0; i < n; i++) {
+		http_request_parser_reset(&p);
+		rc = 0;
+		for (len = 16; rc == 0; len += 16) {
+			if (len > sizeof(bench_request) - 1)
+				len = sizeof(bench_request) - 1;
+			rc = http_request_parser_feed(&p, bench_request, len);
+		}
+		if (rc != 1)
+			abort();
+	}
+}
+
+/** route_match() on the path in @p ctx. */
+static void
+bench_route(long n, void *ctx)
+{
+	const char *path = ctx;
+
+	for (long i = 0; i < n; i++)
+		if (route_match("GET", path) == NULL)
+			abort();
+}
+
+/** The worker's lookup: interned method, path without the query. */
+static void
+bench_route_lookup(long n, void *ctx)
+{
+	const char *path = ctx;
+	size_t len = strlen(path);
+	route_class_t cls;
+	int id;
+
+	for (long i = 0; i < n; i++)
+		if (route_lookup(HTTP_METHOD_GET, path, len, &cls, &id) == NULL)
+			abort();
+}
+
+/** A full page into a heap copy. */
+static void
+bench_template(long n, void *ctx)
+{
+	struct template_data data = {
+		.title = "MiniWeb - Docs",
+		.page_content = "docs.html",
+	};
+	char *out;
+
+	(void)ctx;
+	for (long i = 0; i < n; i++) {
+		out = NULL;
+		if (template_render_with_data(&data, &out) != 0)
+			abort();
+		free(out);
+	}
+}
+
+/** A hit on the file in @p ctx; the caller stat(2)s once up front. */
+static void
+bench_file_cache(long n, void *ctx)
+{
+	const char *path = ctx;
+	http_blob_t *blob;
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		abort();
+	for (long i = 0; i < n; i++) {
+		if ((blob = http_file_cache_lookup(path, &st, 0)) == NULL)
+			abort();
+		http_blob_release(blob);
+	}
+}
+
+/** Read whatever is queued on @p fd. */
+static void
+drain_fd(int fd)
+{
+	char buf[16384];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+/** A small JSON answer written into a socketpair and read back. */
+static void
+bench_response_send(long n, void *ctx)
+{
+	static char body[] = "{\"status\": \"ok\", \"uptime\": 12345}";
+	http_request_t req;
+	http_response_t *resp;
+	int sv[2];
+
+	(void)ctx;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 ||
+	    fcntl(sv[1], F_SETFL, O_NONBLOCK) != 0)
+		abort();
+	for (long i = 0; i < n; i++) {
+		memset(&req, 0, sizeof(req));
+		req.fd = sv[0];
+		req.method = "GET";
+		req.url = "/api";
+		req.version = "HTTP/1.1";
+		req.keep_alive = 1;
+		if ((resp = http_response_create()) == NULL)
+			abort();
+		resp->content_type = "application/json";
+		http_response_set_body(resp, body, sizeof(body) - 1, 0);
+		if (http_response_send(&req, resp) != 0)
+			abort();
+		http_response_free(resp);
+		drain_fd(sv[1]);
+	}
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/** Escape a string with a few quotes, backslashes and controls. */
+static void
+bench_json_escape(long n, void *ctx)
+{
+	const char *s = "ls(1) - list \"directory\" contents\\\n\tsee also: "
+	    "find(1), stat(1)";
+	char *out;
+
+	(void)ctx;
+	for (long i = 0; i < n; i++) {
+		if ((out = json_escape_string(s)) == NULL)
+			abort();
+		free(out);
+	}
+}
+
+typedef struct {
+	miniweb_work_queue_t *q;
+	long ops;
+} queue_arg_t;
+
+/** One thread's share: push an item, then pop one. */
+static void *
+queue_worker(void *arg)
+{
+	queue_arg_t *a = arg;
+
+	for (long i = 0; i < a->ops; i++) {
+		while (miniweb_work_queue_push(a->q, (void *)(intptr_t)(i + 1))
+		    != 0)
+			;
+		while (miniweb_work_queue_try_pop(a->q) == NULL)
+			;
+	}
+	return NULL;
+}
+
+/** Push/pop pairs spread over the thread count in @p ctx. */
+static void
+bench_queue(long n, void *ctx)
+{
+	static miniweb_work_queue_t q;
+	pthread_t tid[BENCH_QUEUE_THREADS_MAX];
+	queue_arg_t arg[BENCH_QUEUE_THREADS_MAX];
+	int threads = *(int *)ctx;
+
+	miniweb_work_queue_init(&q);
+	for (int t = 0; t < threads; t++) {
+		arg[t].q = &q;
+		arg[t].ops = n / threads + (t < n % threads);
+		if (pthread_create(&tid[t], NULL, queue_worker, &arg[t]) != 0)
+			abort();
+	}
+	for (int t = 0; t < threads; t++)
+		pthread_join(tid[t], NULL);
+}
+
+/** Static file for the file cache benchmark, removed at exit. */
+static char bench_file[] = "/tmp/miniweb-bench.XXXXXX";
+
+static void
+bench_file_remove(void)
+{
+	(void)unlink(bench_file);
+}
+
+/** Write and preload a 4 KiB stylesheet-like file. */
+static int
+bench_file_setup(void)
+{
+	char buf[4096];
+	int fd;
+
+	if ((fd = mkstemp(bench_file)) < 0)
+		return -1;
+	atexit(bench_file_remove);
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = "body { margin: 0 }\n"[i % 19];
+	if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return http_file_preload(bench_file, "text/css", NULL) > 0 ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *s;
+	char name[64];
+	int threads = BENCH_THREADS_DEFAULT;
+	int one = 1;
+
+	bench_argc = argc;
+	bench_argv = argv;
+	bench_time_ns = (long)BENCH_TIME_MS_DEFAULT * 1000000;
+	if ((s = getenv("BENCH_TIME_MS")) != NULL && atoi(s) > 0)
+		bench_time_ns = (long)atoi(s) * 1000000;
+	if ((s = getenv("BENCH_THREADS")) != NULL && atoi(s) > 0)
+		threads = atoi(s);
+	if (threads > BENCH_QUEUE_THREADS_MAX)
+		threads = BENCH_QUEUE_THREADS_MAX;
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	init_routes(NULL);
+	if (template_cache_init() != 0) {
+		fprintf(stderr, "bench: templates not found; run from the "
+		    "source tree\n");
+		return 1;
+	}
+	if (bench_file_setup() != 0) {
+		fprintf(stderr, "bench: cannot prepare %s: %s\n", bench_file,
+		    strerror(errno));
+		return 1;
+	}
+
+	printf("benchmark\titerations\tns_op\tallocs_op\n");
+	bench_run("parser/full", bench_parser, NULL);
+	bench_run("parser/split16", bench_parser_split, NULL);
+	bench_run("route_match/exact", bench_route, "/api/metrics");
+	bench_run("route_match/prefix", bench_route, "/static/css/custom.css");
+	bench_run("route_match/dynamic", bench_route, "/man/system/1/ls");
+	bench_run("route_lookup/prefix", bench_route_lookup,
+	    "/static/css/custom.css");
+	bench_run("template_render_with_data", bench_template, NULL);
+	bench_run("http_file_cache_lookup", bench_file_cache, bench_file);
+	bench_run("http_response_send", bench_response_send, NULL);
+	bench_run("json_escape_string", bench_json_escape, NULL);
+	bench_run("work_queue/1", bench_queue, &one);
+	snprintf(name, sizeof(name), "work_queue/%d", threads);
+	if (threads > 1)
+		bench_run(name, bench_queue, &threads);
+	return 0;
+}
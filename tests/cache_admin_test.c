@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/cache_admin.h>
+
+/* A fake cache: a few keys, each dropped at most once. */
+struct fake {
+	const char *keys[4];
+	int live[4];
+	uint64_t hits, misses;
+};
+
+static void
+fake_stats(struct cache_admin_stats *st, void *ctx)
+{
+	struct fake *f = ctx;
+
+	for (int i = 0; i < 4; i++) {
+		if (f->keys[i] && f->live[i]) {
+			st->entries++;
+			st->bytes += strlen(f->keys[i]);
+		}
+	}
+	st->hits = f->hits;
+	st->misses = f->misses;
+}
+
+static size_t
+fake_purge(const char *key, int prefix, void *ctx)
+{
+	struct fake *f = ctx;
+	size_t n = 0;
+
+	for (int i = 0; i < 4; i++) {
+		if (f->keys[i] && f->live[i] &&
+		    cache_admin_match(f->keys[i], key, prefix)) {
+			f->live[i] = 0;
+			n++;
+		}
+	}
+	return n;
+}
+
+struct seen {
+	int n;
+	char names[4][16];
+	struct cache_admin_stats st[4];
+};
+
+static void
+collect(const char *name, const struct cache_admin_stats *st, void *ctx)
+{
+	struct seen *s = ctx;
+
+	strlcpy(s->names[s->n], name, sizeof(s->names[0]));
+	s->st[s->n++] = *st;
+}
+
+int
+main(void)
+{
+	struct fake man = {
+		{ "system/1/ls.html", "system/1/ls.utf8", "system/8/ntpd.html",
+		    NULL }, { 1, 1, 1, 0 }, 9, 3
+	};
+	struct fake pkg = {
+		{ "info:curl", "search:curl", "info:wget", NULL },
+		{ 1, 1, 1, 0 }, 0, 0
+	};
+	struct seen seen = { 0 };
+
+	assert(cache_admin_match("system/1/ls.html", "system/1/", 1));
+	assert(!cache_admin_match("system/1/ls.html", "system/1/", 0));
+	assert(cache_admin_match("info:curl", "info:curl", 0));
+	assert(cache_admin_match("anything", "", 1));
+	assert(!cache_admin_match("info:cur", "info:curl", 1));
+
+	assert(cache_admin_register(NULL) == -1);
+	assert(cache_admin_register(&(struct cache_admin_ops){
+		.name = "nostats" }) == -1);
+	assert(cache_admin_register(&(struct cache_admin_ops){
+		.name = "man", .stats = fake_stats, .purge = fake_purge,
+		.ctx = &man }) == 0);
+	assert(cache_admin_register(&(struct cache_admin_ops){
+		.name = "pkg", .stats = fake_stats, .purge = fake_purge,
+		.ctx = &pkg }) == 0);
+	/* Listed but read-only. */
+	assert(cache_admin_register(&(struct cache_admin_ops){
+		.name = "ro", .stats = fake_stats, .ctx = &pkg }) == 0);
+
+	/* Listed in registration order, with the cache's own numbers. */
+	assert(cache_admin_foreach(collect, &seen) == 3);
+	assert(strcmp(seen.names[0], "man") == 0);
+	assert(seen.st[0].entries == 3 && seen.st[0].hits == 9 &&
+	    seen.st[0].misses == 3);
+	assert(strcmp(seen.names[1], "pkg") == 0 && seen.st[1].entries == 3);
+
+	/* One exact key in one cache. */
+	assert(cache_admin_purge("man", "system/1/ls.utf8", 0) == 1);
+	assert(!man.live[1] && man.live[0] && man.live[2]);
+	assert(cache_admin_purge("man", "system/1/ls.utf8", 0) == 0);
+
+	/* A prefix, and an exact key that is only a prefix. */
+	assert(cache_admin_purge("man", "system/1/", 0) == 0);
+	assert(cache_admin_purge("man", "system/1/", 1) == 1);
+	assert(!man.live[0] && man.live[2]);
+
+	/* No name: every cache, read-only ones skipped. */
+	assert(cache_admin_purge(NULL, "info:", 1) == 2);
+	assert(!pkg.live[0] && pkg.live[1] && !pkg.live[2]);
+	assert(cache_admin_purge("ro", "search:curl", 0) == 0);
+	assert(pkg.live[1]);
+
+	/* Unknown caches and missing keys are refused. */
+	assert(cache_admin_purge("nostats", "x", 0) == -1);
+	assert(cache_admin_purge("man", NULL, 0) == -1);
+
+	seen.n = 0;
+	assert(cache_admin_foreach(collect, &seen) == 3);
+	assert(seen.st[0].entries == 1 && seen.st[1].entries == 1);
+	assert(seen.st[0].bytes == strlen("system/8/ntpd.html"));
+
+	printf("cache_admin_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,46 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/conf.h>
+
+int
+main(void)
+{
+	miniweb_conf_t cur, next;
+	char changed[CONF_STR_MAX];
+
+	conf_defaults(&cur);
+	next = cur;
+	assert(conf_reload(&cur, &next, changed, sizeof(changed)) == 0);
+	assert(changed[0] == '\0');
+
+	/* Limits and budgets are taken in place. */
+	next.conn_timeout = 5;
+	next.max_conns = 64;
+	next.file_cache_mb = 8;
+	next.verbose = 1;
+	assert(conf_reload(&cur, &next, changed, sizeof(changed)) == 0);
+	assert(cur.conn_timeout == 5 && cur.max_conns == 64);
+	assert(cur.file_cache_mb == 8 && cur.verbose == 1);
+
+	/* The rest is reported, not applied; live fields still are. */
+	next.threads = cur.threads + 1;
+	next.enable_man = !cur.enable_man;
+	strlcpy(next.static_dir, "/var/www", sizeof(next.static_dir));
+	next.queue_deadline_ms = 500;
+	assert(conf_reload(&cur, &next, changed, sizeof(changed)) == 3);
+	assert(strcmp(changed, "threads, static_dir, enable_man") == 0);
+	assert(cur.threads == next.threads - 1);
+	assert(strcmp(cur.static_dir, "static") == 0);
+	assert(cur.enable_man != next.enable_man);
+	assert(cur.queue_deadline_ms == 500);
+
+	/* A short buffer is truncated; the count stays right. */
+	assert(conf_reload(&cur, &next, changed, 8) == 3);
+	assert(strlen(changed) == 7);
+	assert(conf_reload(&cur, &next, NULL, 0) == 3);
+
+	printf("conf_reload_test: ok\n");
+	return 0;
+}
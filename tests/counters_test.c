@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/counters.h>
+
+#define THREADS	8
+#define ROUNDS	100000
+
+static void *
+bump(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < ROUNDS; i++) {
+		counter_inc(CTR_REQUESTS);
+		counter_add(CTR_QUEUE_PUSHES, 2);
+	}
+	return NULL;
+}
+
+int
+main(void)
+{
+	pthread_t t[THREADS];
+	uint64_t v[CTR_COUNT];
+
+	counters_read(v);
+	for (int i = 0; i < CTR_COUNT; i++)
+		assert(v[i] == 0);
+
+	/* Every counter is named, and each group is contiguous. */
+	for (int i = 0; i < CTR_COUNT; i++) {
+		const char *g = counter_group((counter_id_t)i);
+
+		assert(*g != '\0' && *counter_name((counter_id_t)i) != '\0');
+		for (int j = i + 2; j < CTR_COUNT; j++) {
+			if (strcmp(counter_group((counter_id_t)j), g) == 0)
+				assert(strcmp(counter_group((counter_id_t)(j - 1)),
+				    g) == 0);
+		}
+	}
+	assert(*counter_name(CTR_COUNT) == '\0');
+
+	/* Out of range ids are ignored. */
+	counter_inc(CTR_COUNT);
+
+	/* The main thread's block, and blocks of threads that exited. */
+	counter_inc(CTR_ACCEPTS);
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_create(&t[i], NULL, bump, NULL) == 0);
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_join(t[i], NULL) == 0);
+
+	counters_read(v);
+	assert(v[CTR_ACCEPTS] == 1);
+	assert(v[CTR_REQUESTS] == (uint64_t)THREADS * ROUNDS);
+	assert(v[CTR_QUEUE_PUSHES] == (uint64_t)THREADS * ROUNDS * 2);
+	assert(v[CTR_CONN_OPENED] == 0);
+
+	printf("counters_test: ok\n");
+	return 0;
+}
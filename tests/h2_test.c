@@ -0,0 +1,363 @@
+#include <assert.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/http/hpack.h>
+#include <miniweb/net/h2.h>
+
+/* h2.c asks the server whether it is draining. */
+int
+miniweb_server_draining(void)
+{
+	return 0;
+}
+
+static char big[100000];
+
+static void
+put(int fd, const char *s, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, s, len);
+
+		if (n <= 0)
+			return;	/* the session hung up: a test here */
+		s += n;
+		len -= (size_t)n;
+	}
+}
+
+/** Stand-in for the worker: answers by path, as handlers would. */
+static void
+dispatch(int fd, struct sockaddr_in *addr, char *head, size_t len)
+{
+	static const char hello[] = "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: text/plain\r\nContent-Length: 5\r\n"
+	    "Connection: keep-alive\r\nKeep-Alive: timeout=5\r\n\r\nhello";
+	char line[64];
+
+	(void)addr;
+	assert(strlen(head) == len);
+	assert(strcmp(head + len - 4, "\r\n\r\n") == 0);
+	sscanf(head, "%*s %63s", line);
+	if (strcmp(line, "/hello") == 0) {
+		assert(strstr(head, "\r\nHost: example.org\r\n") != NULL);
+		assert(strstr(head, "\r\nCookie: a=1; b=2\r\n") != NULL);
+		assert(strstr(head, "\r\naccept: */*\r\n") != NULL);
+		assert(strstr(head, "content-length") == NULL);
+		put(fd, hello, strncmp(head, "HEAD ", 5) == 0 ?
+		    sizeof(hello) - 6 : sizeof(hello) - 1);
+	} else if (strcmp(line, "/chunked") == 0) {
+		put(fd, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+		    "3;x=y\r\nabc\r\n", 59);
+		put(fd, "2\r\nde\r\n0\r\nX-Trailer: 1\r\n\r\n", 26);
+	} else if (strcmp(line, "/big") == 0) {
+		put(fd, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n", 38);
+		put(fd, big, sizeof(big));
+	} else if (strcmp(line, "/short") == 0)
+		put(fd, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc", 42);
+	else
+		put(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n",
+		    45);
+}
+
+struct frame {
+	size_t len;
+	int type, flags;
+	uint32_t id;
+	uint8_t p[16384];
+};
+
+static void
+send_frame(int fd, int type, int flags, uint32_t id, const void *p,
+    size_t len)
+{
+	uint8_t h[9] = { (uint8_t)(len >> 16), (uint8_t)(len >> 8),
+	    (uint8_t)len, (uint8_t)type, (uint8_t)flags, (uint8_t)(id >> 24),
+	    (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id };
+
+	put(fd, (const char *)h, sizeof(h));
+	put(fd, p, len);
+}
+
+static int
+read_full(int fd, uint8_t *p, size_t len)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+
+	while (len > 0) {
+		ssize_t n;
+
+		assert(poll(&pfd, 1, 5000) == 1);
+		if ((n = read(fd, p, len)) <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/** Next frame, or -1 once the session has closed the connection. */
+static int
+recv_frame(int fd, struct frame *f)
+{
+	uint8_t h[9];
+
+	if (read_full(fd, h, sizeof(h)) == -1)
+		return -1;
+	f->len = (size_t)h[0] << 16 | (size_t)h[1] << 8 | h[2];
+	f->type = h[3];
+	f->flags = h[4];
+	f->id = ((uint32_t)h[5] << 24 | (uint32_t)h[6] << 16 |
+	    (uint32_t)h[7] << 8 | h[8]) & 0x7fffffff;
+	assert(f->len <= sizeof(f->p));
+	assert(read_full(fd, f->p, f->len) == 0);
+	return 0;
+}
+
+static uint32_t
+u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+struct fields {
+	char text[1024];
+	size_t len;
+};
+
+static int
+collect(const char *name, size_t name_len, const char *value,
+    size_t value_len, void *ctx)
+{
+	struct fields *f = ctx;
+
+	f->len += (size_t)snprintf(f->text + f->len, sizeof(f->text) - f->len,
+	    "%.*s: %.*s\n", (int)name_len, name, (int)value_len, value);
+	return 0;
+}
+
+static size_t
+field(uint8_t *b, size_t n, const char *name, const char *value)
+{
+	return n + hpack_encode(b + n, 512 - n, name, strlen(name), value,
+	    strlen(value));
+}
+
+/** Send a GET (or HEAD) for @p path on stream @p id. */
+static void
+request(int fd, uint32_t id, const char *method, const char *path)
+{
+	uint8_t b[512];
+	size_t n = 0;
+
+	n = field(b, n, ":method", method);
+	n = field(b, n, ":scheme", "http");
+	n = field(b, n, ":path", path);
+	n = field(b, n, ":authority", "example.org");
+	n = field(b, n, "cookie", "a=1");
+	n = field(b, n, "accept", "*/*");
+	n = field(b, n, "cookie", "b=2");
+	n = field(b, n, "content-length", "0");
+	send_frame(fd, 1, 0x01 | 0x04, id, b, n);
+}
+
+/** Read the response of stream @p id: its head, body and how it ended. */
+static void
+response(int fd, hpack_decoder_t *dec, uint32_t id, struct fields *head,
+    char *body, size_t *body_len, uint32_t *rst)
+{
+	struct frame *f = malloc(sizeof(*f));
+
+	memset(head, 0, sizeof(*head));
+	*body_len = 0;
+	*rst = 0xffffffff;
+	for (;;) {
+		assert(recv_frame(fd, f) == 0);
+		if (f->id == 0)
+			continue;	/* WINDOW_UPDATE, SETTINGS ack */
+		assert(f->id == id);
+		if (f->type == 1) {
+			assert(f->flags & 0x04);
+			assert(hpack_decode(dec, f->p, f->len, collect,
+			    head) == 0);
+		} else if (f->type == 0) {
+			memcpy(body + *body_len, f->p, f->len);
+			*body_len += f->len;
+		} else if (f->type == 3) {
+			*rst = u32(f->p);
+			break;
+		}
+		if (f->flags & 0x01)
+			break;
+	}
+	free(f);
+}
+
+int
+main(void)
+{
+	static char body[sizeof(big)];
+	struct frame *f = malloc(sizeof(*f));
+	struct sockaddr_in addr;
+	hpack_decoder_t dec;
+	struct fields head;
+	uint64_t c[CTR_COUNT];
+	uint8_t p[8];
+	uint32_t rst;
+	size_t n;
+	int sv[2];
+
+	signal(SIGPIPE, SIG_IGN);
+	for (size_t i = 0; i < sizeof(big); i++)
+		big[i] = (char)('a' + i % 26);
+	memset(&addr, 0, sizeof(addr));
+
+	assert(h2_preface_match("", 0) == 0);
+	assert(h2_preface_match("PRI * HT", 8) == 0);
+	assert(h2_preface_match("GET / HTTP/1.1\r\n", 16) == -1);
+	assert(h2_preface_match(H2_PREFACE "\0\0", H2_PREFACE_LEN + 2) == 1);
+
+	/* No dispatch yet: the client is turned away with a GOAWAY. */
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(h2_session_start(sv[0], &addr, H2_PREFACE, H2_PREFACE_LEN) ==
+	    -1);
+	assert(recv_frame(sv[1], f) == 0 && f->type == 4);
+	assert(recv_frame(sv[1], f) == 0 && f->type == 7);
+	assert(u32(f->p + 4) == 11);
+	close(sv[0]);
+	close(sv[1]);
+
+	h2_configure(2, 5, dispatch);
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(h2_session_start(sv[0], &addr, H2_PREFACE, H2_PREFACE_LEN) ==
+	    0);
+	close(sv[0]);
+	assert(h2_session_count() == 1);
+
+	/* Settings both ways. */
+	assert(recv_frame(sv[1], f) == 0 && f->type == 4 && f->flags == 0);
+	assert(f->len == 12 && f->p[1] == 3 && u32(f->p + 2) == H2_MAX_STREAMS);
+	send_frame(sv[1], 4, 0, 0, NULL, 0);
+	assert(recv_frame(sv[1], f) == 0 && f->type == 4 && f->flags == 1);
+	send_frame(sv[1], 4, 1, 0, NULL, 0);
+
+	hpack_decoder_init(&dec);
+	request(sv[1], 1, "GET", "/hello");
+	response(sv[1], &dec, 1, &head, body, &n, &rst);
+	assert(strcmp(head.text, ":status: 200\ncontent-type: text/plain\n"
+	    "content-length: 5\n") == 0);
+	assert(n == 5 && memcmp(body, "hello", 5) == 0 && rst == 0xffffffff);
+
+	/* HEAD ends with the headers. */
+	request(sv[1], 3, "HEAD", "/hello");
+	response(sv[1], &dec, 3, &head, body, &n, &rst);
+	assert(strncmp(head.text, ":status: 200\n", 13) == 0 && n == 0);
+
+	/* A chunked body arrives without its framing or trailers. */
+	request(sv[1], 5, "GET", "/chunked");
+	response(sv[1], &dec, 5, &head, body, &n, &rst);
+	assert(strcmp(head.text, ":status: 200\n") == 0);
+	assert(n == 5 && memcmp(body, "abcde", 5) == 0 && rst == 0xffffffff);
+
+	/* PING is answered in kind. */
+	memcpy(p, "miniweb!", 8);
+	send_frame(sv[1], 6, 0, 0, p, 8);
+	assert(recv_frame(sv[1], f) == 0 && f->type == 6 && f->flags == 1);
+	assert(memcmp(f->p, "miniweb!", 8) == 0);
+
+	/*
+	 * A body past the windows waits for WINDOW_UPDATE. The connection
+	 * window is down by the 10 bytes sent so far.
+	 */
+	request(sv[1], 7, "GET", "/big");
+	n = 0;
+	for (;;) {
+		struct pollfd pfd = { sv[1], POLLIN, 0 };
+
+		if (poll(&pfd, 1, 300) == 0)
+			break;
+		assert(recv_frame(sv[1], f) == 0);
+		if (f->type == 0) {
+			assert(f->id == 7 && f->len <= 16384);
+			memcpy(body + n, f->p, f->len);
+			n += f->len;
+		}
+	}
+	assert(n == 65535 - 10);
+	p[0] = 0;
+	p[1] = 1;
+	p[2] = 0;
+	p[3] = 0;
+	send_frame(sv[1], 8, 0, 0, p, 4);
+	send_frame(sv[1], 8, 0, 7, p, 4);
+	{
+		size_t rest;
+
+		response(sv[1], &dec, 7, &head, body + n, &rest, &rst);
+		n += rest;
+	}
+	assert(n == sizeof(big) && memcmp(body, big, n) == 0);
+
+	/* A body cut short resets the stream. */
+	request(sv[1], 9, "GET", "/short");
+	response(sv[1], &dec, 9, &head, body, &n, &rst);
+	assert(strstr(head.text, "content-length: 10\n") != NULL);
+	assert(n == 3 && rst == 2);
+
+	/* Malformed requests are reset; HPACK state carries on. */
+	{
+		uint8_t b[512];
+		size_t bn = 0;
+
+		bn = field(b, bn, ":method", "GET");
+		bn = field(b, bn, ":scheme", "http");
+		bn = field(b, bn, ":path", "/hello");
+		bn = field(b, bn, "Accept", "*/*");
+		send_frame(sv[1], 1, 0x05, 11, b, bn);
+		assert(recv_frame(sv[1], f) == 0 && f->type == 3);
+		assert(f->id == 11 && u32(f->p) == 1);
+
+		bn = 0;
+		bn = field(b, bn, ":method", "GET");
+		bn = field(b, bn, ":scheme", "http");
+		bn = field(b, bn, ":path", "/hello");
+		bn = field(b, bn, "connection", "close");
+		send_frame(sv[1], 1, 0x05, 13, b, bn);
+		assert(recv_frame(sv[1], f) == 0 && f->type == 3);
+		assert(f->id == 13 && u32(f->p) == 1);
+	}
+	request(sv[1], 15, "GET", "/nope");
+	response(sv[1], &dec, 15, &head, body, &n, &rst);
+	assert(strncmp(head.text, ":status: 404\n", 13) == 0);
+
+	/* DATA on stream 0 ends the connection with PROTOCOL_ERROR. */
+	send_frame(sv[1], 0, 0, 0, "x", 1);
+	for (;;) {
+		assert(recv_frame(sv[1], f) == 0);
+		if (f->type == 7)
+			break;
+	}
+	assert(u32(f->p) == 15 && u32(f->p + 4) == 1);
+	assert(recv_frame(sv[1], f) == -1);
+	close(sv[1]);
+	hpack_decoder_free(&dec);
+
+	for (int i = 0; i < 100 && h2_session_count() > 0; i++)
+		usleep(10000);
+	assert(h2_session_count() == 0);
+	counters_read(c);
+	assert(c[CTR_H2_SESSIONS] == 1 && c[CTR_H2_STREAMS] == 6);
+	assert(c[CTR_H2_REFUSED] == 1);
+	free(f);
+
+	printf("h2_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <miniweb/net/handoff.h>
+
+/* Lines one section got back, joined with '|'. */
+struct got {
+	char buf[256];
+	int n;
+};
+
+static void
+save_warm(FILE *f, void *ctx)
+{
+	(void)ctx;
+	fputs("/var/www/index.html\n/var/www/app.js.gz\n", f);
+}
+
+static void
+save_man(FILE *f, void *ctx)
+{
+	(void)ctx;
+	fputs("@not-a-section-line\n", f);
+}
+
+static void
+save_none(FILE *f, void *ctx)
+{
+	(void)f;
+	(void)ctx;
+}
+
+static void
+load(const char *line, void *ctx)
+{
+	struct got *g = ctx;
+
+	if (g->n++ > 0)
+		strlcat(g->buf, "|", sizeof(g->buf));
+	strlcat(g->buf, line, sizeof(g->buf));
+}
+
+int
+main(void)
+{
+	struct got warm = { "", 0 }, man = { "", 0 }, none = { "", 0 };
+	char *argv[] = { "handoff_test", NULL };
+	struct sockaddr_in sa;
+	struct sockaddr_un su;
+	socklen_t salen = sizeof(sa);
+	char env[32];
+	int fd, tfd, ufd;
+
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "warm", .save = save_warm }) == 0);
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "man", .save = save_man }) == 0);
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "bad" }) == -1);
+
+	/* The predecessor writes its sections... */
+	assert((fd = handoff_state_save()) >= 0);
+	assert(lseek(fd, 0, SEEK_CUR) == 0);
+
+	/* ...a successor reads them back at startup. */
+	snprintf(env, sizeof(env), "%d", fd);
+	assert(setenv("MINIWEB_STATE_FD", env, 1) == 0);
+
+	/* Along with a TCP listener and a Unix-domain one. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert((tfd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+	assert(bind(tfd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+	assert(listen(tfd, 1) == 0);
+	assert(getsockname(tfd, (struct sockaddr *)&sa, &salen) == 0);
+	memset(&su, 0, sizeof(su));
+	su.sun_family = AF_UNIX;
+	snprintf(su.sun_path, sizeof(su.sun_path), "/tmp/handoff_test.%d",
+	    (int)getpid());
+	(void)unlink(su.sun_path);
+	assert((ufd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+	assert(bind(ufd, (struct sockaddr *)&su, sizeof(su)) == 0);
+	assert(listen(ufd, 1) == 0);
+	snprintf(env, sizeof(env), "%d,%d", tfd, ufd);
+	assert(setenv("MINIWEB_LISTEN_FDS", env, 1) == 0);
+
+	assert(handoff_init(1, argv) == 2);
+	assert(getenv("MINIWEB_STATE_FD") == NULL);
+	assert(fcntl(fd, F_GETFD) == -1);
+
+	/* The Unix listener is found by path, the TCP one by index. */
+	assert(handoff_take_unix_listener("/tmp/handoff_test.none") == -1);
+	assert(handoff_take_unix_listener(su.sun_path) == ufd);
+	assert(handoff_take_unix_listener(su.sun_path) == -1);
+	assert(handoff_take_listener(1, &sa) == -1);
+	assert(handoff_take_listener(0, &sa) == tfd);
+	close(tfd);
+	close(ufd);
+	(void)unlink(su.sun_path);
+
+	/* Each section sees its own lines only, in order. */
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "warm", .save = save_none, .load = load,
+		.ctx = &warm }) == 0);
+	assert(strcmp(warm.buf,
+	    "/var/www/index.html|/var/www/app.js.gz") == 0);
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "man", .save = save_none, .load = load,
+		.ctx = &man }) == 0);
+	assert(man.n == 0);
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "wa", .save = save_none, .load = load,
+		.ctx = &none }) == 0);
+	assert(none.n == 0);
+
+	/* Serving: the inherited state is gone. */
+	handoff_ready();
+	warm.n = 0;
+	assert(handoff_state_register(&(struct handoff_state_ops){
+		.name = "warm", .save = save_none, .load = load,
+		.ctx = &warm }) == 0);
+	assert(warm.n == 0);
+
+	printf("handoff_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <miniweb/core/readiness.h>
+#include <miniweb/net/health.h>
+
+#define MATCH(s, h)	health_match(s, strlen(s), h)
+
+int
+main(void)
+{
+	const char *req = "HEAD /health HTTP/1.0\r\nHost: a\r\n\r\n";
+	char buf[512];
+	const char *r;
+	size_t len;
+	int head = -1, sv[2];
+	ssize_t n;
+
+	/* Off until a path is configured, and only absolute ones are. */
+	assert(health_configure("") == 0 && MATCH(req, &head) == 0);
+	assert(health_configure("health") == -1);
+	assert(health_configure("/health") == 0);
+	assert(strcmp(health_path(), "/health") == 0);
+
+	/* Exactly one whole GET or HEAD of the path. */
+	assert(MATCH(req, &head) == strlen(req) && head == 1);
+	assert(MATCH("GET /health HTTP/1.1\r\n\r\n", &head) == 24 && !head);
+	assert(MATCH("GET /health?x=1 HTTP/1.1\r\n\r\n", &head) == 28);
+	assert(MATCH("GET /healthz HTTP/1.1\r\n\r\n", &head) == 0);
+	assert(MATCH("GET /health/x HTTP/1.1\r\n\r\n", &head) == 0);
+	assert(MATCH("POST /health HTTP/1.1\r\n\r\n", &head) == 0);
+	assert(MATCH("GET /health HTTP/2.0\r\n\r\n", &head) == 0);
+	/* Split over reads, or followed by more: left to a worker. */
+	assert(MATCH("GET /health HTTP/1.1\r\nHost: a\r\n", &head) == 0);
+	assert(MATCH("GET /health HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n",
+	    &head) == 0);
+
+	/* Draining, then warm-up, then queue depth. */
+	assert(health_state(0, 1) == HEALTH_DRAINING);
+	assert(health_state(0, 0) == HEALTH_STARTING);
+	readiness_seal();
+	assert(health_state(0, 0) == HEALTH_OK);
+	assert(health_state(HEALTH_QUEUE_BUSY - 1, 0) == HEALTH_OK);
+	assert(health_state(HEALTH_QUEUE_BUSY, 0) == HEALTH_BUSY);
+
+	/* HEAD sends the same head, without the body. */
+	r = health_response(HEALTH_OK, 0, &len);
+	assert(strncmp(r, "HTTP/1.1 200 OK\r\n", 17) == 0);
+	assert(len > 3 && memcmp(r + len - 3, "ok\n", 3) == 0);
+	assert(strstr(r, "Content-Length: 3\r\n") != NULL);
+	health_response(HEALTH_OK, 1, &len);
+	assert(memcmp(r + len - 4, "\r\n\r\n", 4) == 0);
+	r = health_response(HEALTH_BUSY, 0, &len);
+	assert(strncmp(r, "HTTP/1.1 503 ", 13) == 0);
+	assert(strstr(r, "Retry-After: 1\r\n") != NULL);
+	assert(strcmp(health_body(HEALTH_STARTING), "starting\n") == 0);
+
+	/* Answered on the socket, request consumed. */
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(write(sv[1], "GET / HTTP/1.1\r\n\r\n", 18) == 18);
+	assert(health_answer(sv[0], 0, 0) == 0);
+	assert(recv(sv[0], buf, sizeof(buf), 0) == 18);
+	assert(write(sv[1], req, strlen(req)) == (ssize_t)strlen(req));
+	assert(health_answer(sv[0], 0, 0) == 1);
+	assert(recv(sv[0], buf, sizeof(buf), MSG_DONTWAIT) < 0);
+	health_response(HEALTH_OK, 1, &len);
+	n = read(sv[1], buf, sizeof(buf));
+	assert(n == (ssize_t)len && strncmp(buf, "HTTP/1.1 200 OK", 15) == 0);
+	close(sv[0]);
+	close(sv[1]);
+
+	printf("health_test: ok\n");
+	return 0;
+}
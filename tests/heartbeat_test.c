@@ -1,3 +1,6 @@
+#include <sys/types.h>
+#include <sys/event.h>
+
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -47,6 +50,54 @@ counter_value(struct hb_counter_ctx *counter)
 	return v;
 }
 
+static int stats_seen;
+
+/** heartbeat_foreach_stats() callback: count the task named @p ctx. */
+static void
+stats_cb(const char *name, const struct hb_task_stats *stats, void *ctx)
+{
+	if (strcmp(name, ctx) == 0 && stats->runs >= 1)
+		stats_seen++;
+}
+
+struct hb_slow_ctx {
+	pthread_mutex_t lock;
+	int inside;
+	int max_inside;
+	int runs;
+};
+
+/** A task much slower than its period; records how many overlap. */
+static void
+slow_cb(void *ctx)
+{
+	struct hb_slow_ctx *slow = ctx;
+
+	pthread_mutex_lock(&slow->lock);
+	if (++slow->inside > slow->max_inside)
+		slow->max_inside = slow->inside;
+	pthread_mutex_unlock(&slow->lock);
+	usleep(300 * 1000);
+	pthread_mutex_lock(&slow->lock);
+	slow->inside--;
+	slow->runs++;
+	pthread_mutex_unlock(&slow->lock);
+}
+
+static void *submitted[HEARTBEAT_MAX_TASKS];
+static int nsubmitted;
+
+/** heartbeat_use_kqueue() hook: queue @p item for the test loop. */
+static int
+submit_cb(void *item, void *ctx)
+{
+	(void)ctx;
+	if (nsubmitted == HEARTBEAT_MAX_TASKS)
+		return -1;
+	submitted[nsubmitted++] = item;
+	return 0;
+}
+
 /**
  * @brief register_worker operation.
  *
@@ -129,6 +180,46 @@ main(void)
 	assert(heartbeat_get_stats(task.name, &stats) == 0);
 	assert(stats.runs >= 1);
 	assert(stats.last_run != 0);
+	stats_seen = 0;
+	assert(heartbeat_foreach_stats(stats_cb, "heartbeat-test") == 1);
+	assert(stats_seen == 1);
+	assert(heartbeat_foreach_stats(NULL, NULL) == -1);
+
+	/*
+	 * Millisecond periods, and a slow task on another worker neither
+	 * delays them nor runs twice at once.
+	 */
+	struct hb_counter_ctx fast;
+	struct hb_slow_ctx slow;
+	struct hb_task fast_task = { "heartbeat-fast", 0, 0, count_cb, &fast };
+	struct hb_task slow_task = { "heartbeat-slow", 0, 0, slow_cb, &slow };
+
+	memset(&fast, 0, sizeof(fast));
+	memset(&slow, 0, sizeof(slow));
+	assert(pthread_mutex_init(&fast.lock, NULL) == 0);
+	assert(pthread_mutex_init(&slow.lock, NULL) == 0);
+	assert(heartbeat_register_ms(&fast_task, 0, 0) == HB_REGISTER_ERROR);
+	assert(heartbeat_register_ms(&slow_task, 50, 0) ==
+	    HB_REGISTER_INSERTED);
+	assert(heartbeat_register_ms(&fast_task, 20, 0) ==
+	    HB_REGISTER_INSERTED);
+	usleep(1000 * 1000);
+	assert(counter_value(&fast) >= 20);
+	assert(heartbeat_get_stats("heartbeat-slow", &stats) == 0);
+	assert(stats.overruns > 0);
+	/* It kept overrunning, so its period backed off. */
+	assert(stats.backoff > 0 && stats.backoff <= 3);
+	assert(stats.period_ms == 50u << stats.backoff);
+	/* Returns only once the run in flight is over. */
+	assert(heartbeat_unregister("heartbeat-slow") == 0);
+	pthread_mutex_lock(&slow.lock);
+	assert(slow.inside == 0 && slow.max_inside == 1 && slow.runs >= 2);
+	pthread_mutex_unlock(&slow.lock);
+	assert(heartbeat_update_ms("heartbeat-fast", 10, 0, &fast) == 0);
+	assert(heartbeat_get_stats("heartbeat-fast", &stats) == 0);
+	assert(stats.runs >= 20);
+	assert(stats.backoff == 0 && stats.period_ms == 10);
+	assert(heartbeat_unregister("heartbeat-fast") == 0);
 
 	assert(heartbeat_stop() == 0);
 	assert(heartbeat_stop() == 0);
@@ -138,6 +229,34 @@ main(void)
 	assert(pthread_join(reg_thread, NULL) == 0);
 	assert(pthread_join(ss_thread, NULL) == 0);
 
+	/* Fired from a kqueue timer instead, and run by the loop's thread. */
+	int kq = kqueue();
+
+	assert(kq >= 0);
+	pthread_mutex_lock(&counter.lock);
+	counter.runs = 0;
+	pthread_mutex_unlock(&counter.lock);
+	assert(heartbeat_use_kqueue(-1, submit_cb, NULL) == -1);
+	assert(heartbeat_use_kqueue(kq, submit_cb, NULL) == 0);
+	assert(heartbeat_update_ms(task.name, 20, 0, &counter) == 0);
+	assert(heartbeat_start() == 0);
+	for (int i = 0; i < 100 && counter_value(&counter) < 3; i++) {
+		struct timespec timeout = {1, 0};
+		struct kevent ev;
+
+		if (kevent(kq, NULL, 0, &ev, 1, &timeout) == 1) {
+			assert(ev.filter == EVFILT_TIMER &&
+			    ev.ident == HEARTBEAT_TIMER_IDENT);
+			heartbeat_kqueue_tick();
+		}
+		while (nsubmitted > 0)
+			heartbeat_run_item(submitted[--nsubmitted]);
+	}
+	assert(counter_value(&counter) >= 3);
+	heartbeat_run_item(NULL);
+	assert(heartbeat_use_thread() == 0);
+	assert(close(kq) == 0);
+
 	assert(heartbeat_shutdown(1) == 0);
 	assert(heartbeat_unregister(task.name) == 0);
 	assert(heartbeat_unregister(task.name) == -1);
@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/http/hpack.h>
+
+/* Header blocks of RFC 7541 Appendix C. */
+static const char *const c3[] = {
+	"828684410f7777772e6578616d706c652e636f6d",
+	"828684be58086e6f2d6361636865",
+	"828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+};
+static const char *const c4[] = {
+	"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+	"828684be5886a8eb10649cbf",
+	"828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+};
+static const char *const c6[] = {
+	"488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e0"
+	"82a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+	"4883640effc1c0bf",
+	"88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839b"
+	"d9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab27"
+	"0fb5291f9587316065c003ed4ee5b1063d5007",
+};
+
+struct fields {
+	char text[1024];	/* "name: value\n" per field */
+	size_t len;
+	int n;
+};
+
+static int
+collect(const char *name, size_t name_len, const char *value,
+    size_t value_len, void *ctx)
+{
+	struct fields *f = ctx;
+	int w;
+
+	w = snprintf(f->text + f->len, sizeof(f->text) - f->len,
+	    "%.*s: %.*s\n", (int)name_len, name, (int)value_len, value);
+	assert(w > 0 && (size_t)w < sizeof(f->text) - f->len);
+	f->len += (size_t)w;
+	f->n++;
+	return 0;
+}
+
+static size_t
+unhex(const char *hex, uint8_t *out)
+{
+	size_t n = 0;
+	unsigned int b;
+
+	for (; hex[0] != '\0'; hex += 2) {
+		assert(sscanf(hex, "%2x", &b) == 1);
+		out[n++] = (uint8_t)b;
+	}
+	return n;
+}
+
+static int
+decode(hpack_decoder_t *d, const char *hex, struct fields *f)
+{
+	uint8_t block[256];
+	size_t len = unhex(hex, block);
+
+	memset(f, 0, sizeof(*f));
+	return hpack_decode(d, block, len, collect, f);
+}
+
+static void
+requests(const char *const *blocks)
+{
+	hpack_decoder_t d;
+	struct fields f;
+
+	hpack_decoder_init(&d);
+	assert(decode(&d, blocks[0], &f) == 0);
+	assert(strcmp(f.text, ":method: GET\n:scheme: http\n:path: /\n"
+	    ":authority: www.example.com\n") == 0);
+	assert(d.count == 1 && d.size == 57);
+
+	assert(decode(&d, blocks[1], &f) == 0);
+	assert(f.n == 5 && strstr(f.text, ":authority: www.example.com\n"
+	    "cache-control: no-cache\n") != NULL);
+	assert(d.count == 2 && d.size == 110);
+
+	assert(decode(&d, blocks[2], &f) == 0);
+	assert(strcmp(f.text, ":method: GET\n:scheme: https\n"
+	    ":path: /index.html\n:authority: www.example.com\n"
+	    "custom-key: custom-value\n") == 0);
+	assert(d.count == 3 && d.size == 164);
+	hpack_decoder_free(&d);
+}
+
+int
+main(void)
+{
+	hpack_decoder_t d;
+	struct fields f;
+	uint8_t buf[256], big[64];
+	char out[64];
+	size_t n, m;
+
+	requests(c3);
+	requests(c4);
+
+	/* Responses through a 256 byte table: entries are evicted. */
+	hpack_decoder_init(&d);
+	d.max_size = 256;
+	assert(decode(&d, c6[0], &f) == 0);
+	assert(strcmp(f.text, ":status: 302\ncache-control: private\n"
+	    "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+	    "location: https://www.example.com\n") == 0);
+	assert(d.count == 4 && d.size == 222);
+	assert(decode(&d, c6[1], &f) == 0);
+	assert(strncmp(f.text, ":status: 307\n", 13) == 0 && f.n == 4);
+	assert(d.count == 4 && d.size == 222);
+	assert(decode(&d, c6[2], &f) == 0);
+	assert(strstr(f.text, "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; "
+	    "max-age=3600; version=1\n") != NULL);
+	assert(d.count == 3 && d.size == 215);
+
+	/* A size update shrinks the table; one past the limit is refused. */
+	assert(decode(&d, "3f00", &f) == 0);	/* 31 */
+	assert(d.max_size == 31 && d.count == 0 && d.size == 0);
+	assert(decode(&d, "3fe21f", &f) == -1);	/* 4097 */
+	assert(decode(&d, "823f00", &f) == -1);	/* after a field */
+	hpack_decoder_free(&d);
+
+	/* Bad indices and truncated blocks. */
+	hpack_decoder_init(&d);
+	assert(decode(&d, "80", &f) == -1);
+	assert(decode(&d, "be", &f) == -1);	/* 62: table is empty */
+	assert(decode(&d, "4003666f", &f) == -1);
+	assert(decode(&d, "ff", &f) == -1);
+
+	/* Huffman: EOS, long padding and padding that is not ones. */
+	unhex("f1e3c2e5f23a6ba0ab90f4ff", buf);
+	assert(hpack_huffman_decode(buf, 12, out, sizeof(out)) == 15);
+	assert(memcmp(out, "www.example.com", 15) == 0);
+	assert(hpack_huffman_decode(buf, 12, out, 14) == -1);
+	unhex("ffffffff", buf);			/* EOS after 2 bits */
+	assert(hpack_huffman_decode(buf, 4, out, sizeof(out)) == -1);
+	unhex("07ff", buf);			/* '0' and 11 bits of 1 */
+	assert(hpack_huffman_decode(buf, 2, out, sizeof(out)) == -1);
+	unhex("06", buf);			/* '0' then 110 */
+	assert(hpack_huffman_decode(buf, 1, out, sizeof(out)) == -1);
+	unhex("07", buf);
+	assert(hpack_huffman_decode(buf, 1, out, sizeof(out)) == 1);
+	assert(out[0] == '0');
+
+	/* The encoder: exact matches indexed, names reused, no state. */
+	n = hpack_encode(buf, sizeof(buf), ":status", 7, "200", 3);
+	assert(n == 1 && buf[0] == 0x88);
+	n = hpack_encode(buf, sizeof(buf), ":status", 7, "302", 3);
+	assert(n == 5 && buf[0] == 0x08 && buf[1] == 3);
+	m = n;
+	m += hpack_encode(buf + m, sizeof(buf) - m, "x-miniweb", 9,
+	    "yes", 3);
+	assert(m == n + 15 && buf[n] == 0x00 && buf[n + 1] == 9);
+	memset(big, 'v', sizeof(big));
+	n = m;
+	m += hpack_encode(buf + m, sizeof(buf) - m, "content-type", 12,
+	    (char *)big, sizeof(big));
+	assert(m == n + 2 + 1 + sizeof(big));
+	assert(buf[n] == 0x0f && buf[n + 1] == 31 - 15);
+	assert(buf[n + 2] == sizeof(big));
+	assert(hpack_encode(buf + m, 8, "x-miniweb", 9, "yes", 3) == 0);
+
+	/* ... and what it writes decodes to the same fields. */
+	memset(&f, 0, sizeof(f));
+	assert(hpack_decode(&d, buf, m, collect, &f) == 0);
+	assert(f.n == 3 && strncmp(f.text, ":status: 302\n"
+	    "x-miniweb: yes\ncontent-type: vvv", 45) == 0);
+	assert(d.count == 0);
+	hpack_decoder_free(&d);
+
+	printf("hpack_test: ok\n");
+	return 0;
+}
@@ -82,6 +82,18 @@ echo "--- Metrics API ---"
 check_status   "GET /api/metrics"          "${BASE}/api/metrics"
 check_json_key "metrics has 'cpu'"         "${BASE}/api/metrics"  "cpu"
 
+check_status   "GET /api/dashboard"        "${BASE}/api/dashboard"
+check_json_key "dashboard has 'metrics'"   "${BASE}/api/dashboard"  "metrics"
+check_json_key "dashboard has 'networking'" \
+               "${BASE}/api/dashboard?fields=networking" "networking"
+check_status   "GET /api/dashboard?fields=bogus" \
+               "${BASE}/api/dashboard?fields=bogus" 400
+
+check_json_key "networking/rates has 'interfaces'" \
+               "${BASE}/api/networking/rates?span=60" "interfaces"
+check_status   "GET /api/networking/rates?span=x" \
+               "${BASE}/api/networking/rates?span=x" 400
+
 # ---------------------------------------------------------------------------
 # Packages API
 # ---------------------------------------------------------------------------
@@ -132,6 +144,35 @@ check_text_nonempty "man/search?q=ls non-empty"      "${BASE}/api/man/search?q=l
 check_status   "GET /api/man/resolve?name=ls"        "${BASE}/api/man/resolve?name=ls"
 check_json_key "man/resolve has 'name'"              "${BASE}/api/man/resolve?name=ls" "name"
 
+# ---------------------------------------------------------------------------
+# Pipelining
+# ---------------------------------------------------------------------------
+echo "--- Pipelining ---"
+# A body that reads like a request must be skipped, not served: one
+# answer for the POST, one for the request after it.
+body=$'GET /docs HTTP/1.1\r\nHost: a\r\n\r\n'
+answers=$(printf 'POST / HTTP/1.1\r\nHost: a\r\nContent-Length: %d\r\n\r\n%sGET /missing HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n' \
+	"${#body}" "${body}" | nc -N 127.0.0.1 "${PORT}" | tr -d '\r' |
+	grep '^HTTP/1\.1 ' | cut -d' ' -f2 | tr '\n' ' ' || true)
+if [ "${answers}" = "405 404 " ]; then
+	echo "  PASS  POST body not served as a request  (${answers% })"
+	PASS=$((PASS + 1))
+else
+	echo "  FAIL  POST body not served as a request  got: ${answers}"
+	FAIL=$((FAIL + 1))
+fi
+
+answers=$(printf 'POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\nGET /docs HTTP/1.1\r\nHost: a\r\n\r\n' |
+	nc -N 127.0.0.1 "${PORT}" | tr -d '\r' | grep '^HTTP/1\.1 ' |
+	cut -d' ' -f2 | tr '\n' ' ' || true)
+if [ "${answers}" = "501 " ]; then
+	echo "  PASS  chunked body refused and closed  (501)"
+	PASS=$((PASS + 1))
+else
+	echo "  FAIL  chunked body refused and closed  got: ${answers}"
+	FAIL=$((FAIL + 1))
+fi
+
 # ---------------------------------------------------------------------------
 # Summary
 # ---------------------------------------------------------------------------
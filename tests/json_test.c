@@ -0,0 +1,64 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/http/arena.h>
+#include <miniweb/http/json.h>
+
+int
+main(void)
+{
+	json_writer_t w;
+	char big[1000];
+	char *out, *p;
+	size_t len;
+
+	/* Quotes, backslashes and control bytes; UTF-8 passes through. */
+	assert(json_init(&w, NULL, 0) == 0);
+	json_putc(&w, '[');
+	json_str(&w, "a\"b\\c\n\t\x01\xc3\xa9");
+	json_putc(&w, ',');
+	json_str(&w, NULL);
+	json_putc(&w, ']');
+	out = json_finish(&w, &len);
+	assert(out && strcmp(out,
+	    "[\"a\\\"b\\\\c\\n\\t\\u0001\xc3\xa9\",null]") == 0);
+	assert(len == strlen(out));
+	free(out);
+	assert(json_escaped_len("a\"\x1f", 3) == 9);
+
+	/* Growth from a tiny hint, through printf and raw appends. */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	assert(json_init(&w, NULL, 1) == 0);
+	for (int i = 0; i < 50; i++)
+		json_printf(&w, "%s%d", big, i);
+	out = json_finish(&w, &len);
+	assert(out && len == 50 * 999 + 10 + 40 * 2);
+	assert(strncmp(out + 999, "0x", 2) == 0 &&
+	    strcmp(out + len - 2, "49") == 0);
+	free(out);
+
+	/* Appenders writing into a reservation. */
+	assert(json_init(&w, NULL, 4) == 0);
+	json_putc(&w, '{');
+	p = json_reserve(&w, 64);
+	assert(p != NULL);
+	strlcpy(p, "\"k\":1", 64);
+	json_commit(&w, strlen(p));
+	json_putc(&w, '}');
+	out = json_finish(&w, NULL);
+	assert(out && strcmp(out, "{\"k\":1}") == 0);
+	free(out);
+
+	/* Arena-backed: grows in the arena and is never freed. */
+	http_arena_t a = {0};
+
+	assert(json_init(&w, &a, 8) == 0);
+	for (int i = 0; i < 100; i++)
+		json_str(&w, "abcdefgh");
+	out = json_finish(&w, &len);
+	assert(out && len == 100 * 10 && out[len] == '\0');
+	http_arena_destroy(&a);
+	return 0;
+}
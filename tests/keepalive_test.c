@@ -0,0 +1,41 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include <miniweb/net/keepalive.h>
+
+int
+main(void)
+{
+	/* Plenty of headroom: reuse connections for much longer. */
+	assert(keepalive_budget(0, 1280) == KEEPALIVE_REQUESTS_MAX);
+	assert(keepalive_budget(639, 1280) == KEEPALIVE_REQUESTS_MAX);
+	assert(keepalive_budget(640, 1280) == KEEPALIVE_REQUESTS);
+	assert(keepalive_budget(959, 1280) == KEEPALIVE_REQUESTS);
+	assert(keepalive_budget(960, 1280) < KEEPALIVE_REQUESTS);
+	assert(keepalive_budget(1152, 1280) == KEEPALIVE_REQUESTS_MIN);
+	assert(keepalive_budget(5000, 1280) == KEEPALIVE_REQUESTS_MIN);
+	/* The budget never grows with the load. */
+	for (int a = 1; a <= 1280; a++)
+		assert(keepalive_budget(a, 1280) <= keepalive_budget(a - 1, 1280));
+	/* No limit to measure against. */
+	assert(keepalive_budget(100, 0) == KEEPALIVE_REQUESTS_MAX);
+
+	/* The idle timeout holds until half full, then falls to the floor. */
+	assert(keepalive_idle_timeout(30, 0, 1000) == 30);
+	assert(keepalive_idle_timeout(30, 500, 1000) == 30);
+	assert(keepalive_idle_timeout(30, 750, 1000) == 16);
+	assert(keepalive_idle_timeout(30, 1000, 1000) == KEEPALIVE_IDLE_MIN);
+	assert(keepalive_idle_timeout(30, 4000, 1000) == KEEPALIVE_IDLE_MIN);
+	for (int a = 1; a <= 1000; a++) {
+		int t = keepalive_idle_timeout(30, a, 1000);
+
+		assert(t <= keepalive_idle_timeout(30, a - 1, 1000));
+		assert(t >= KEEPALIVE_IDLE_MIN && t <= 30);
+	}
+	/* A timeout already below the floor is left alone. */
+	assert(keepalive_idle_timeout(1, 1000, 1000) == 1);
+	assert(keepalive_idle_timeout(30, 900, 0) == 30);
+
+	printf("keepalive_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/core/lockstat.h>
+
+#define THREADS	4
+#define ROUNDS	2000
+
+LOCKSTAT_SITE(lockstat_hot, "hot");
+LOCKSTAT_SITE(lockstat_cold, "cold");
+LOCKSTAT_SITE(lockstat_unused, "unused");
+
+static pthread_mutex_t hot = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cold = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+static unsigned long shared;
+
+static void *
+hammer(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < ROUNDS; i++) {
+		LOCKSTAT_LOCK(&hot, lockstat_hot);
+		shared++;
+		for (volatile int spin = 0; spin < 200; spin++)
+			;
+		LOCKSTAT_UNLOCK(&hot, lockstat_hot);
+	}
+	return NULL;
+}
+
+struct seen {
+	lockstat_t site[4];
+	int n;
+};
+
+static void
+collect(const lockstat_t *s, void *ctx)
+{
+	struct seen *seen = ctx;
+
+	seen->site[seen->n++] = *s;
+}
+
+int
+main(void)
+{
+	pthread_t t[THREADS];
+	struct timespec ts = { 0, 2000000 }, deadline;
+	struct seen seen = { .n = 0 };
+
+	/* Nothing is listed before it is taken. */
+	assert(lockstat_foreach(collect, &seen) == 0);
+
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_create(&t[i], NULL, hammer, NULL) == 0);
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_join(t[i], NULL) == 0);
+	assert(shared == THREADS * ROUNDS);
+
+	/* An uncontended lock held for 2 ms, nested inside another. */
+	LOCKSTAT_LOCK(&cold, lockstat_cold);
+	LOCKSTAT_LOCK(&hot, lockstat_hot);
+	LOCKSTAT_UNLOCK(&hot, lockstat_hot);
+	nanosleep(&ts, NULL);
+	LOCKSTAT_UNLOCK(&cold, lockstat_cold);
+
+	/* A wait on the condvar does not count as hold. */
+	LOCKSTAT_LOCK(&cold, lockstat_cold);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 20000000;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	assert(LOCKSTAT_COND_TIMEDWAIT(&cv, &cold, lockstat_cold,
+	    &deadline) == ETIMEDOUT);
+	LOCKSTAT_UNLOCK(&cold, lockstat_cold);
+
+	/* A busy trylock is contended but not acquired. */
+	LOCKSTAT_LOCK(&hot, lockstat_hot);
+	assert(LOCKSTAT_TRYLOCK(&hot, lockstat_hot) == EBUSY);
+	LOCKSTAT_UNLOCK(&hot, lockstat_hot);
+	assert(LOCKSTAT_TRYLOCK(&cold, lockstat_cold) == 0);
+	LOCKSTAT_UNLOCK(&cold, lockstat_cold);
+
+	assert(lockstat_foreach(collect, &seen) == 2);
+	assert(strcmp(seen.site[0].name, "hot") == 0);
+	assert(seen.site[0].acquired == THREADS * ROUNDS + 2);
+	assert(seen.site[0].contended >= 1);
+	assert(seen.site[0].contended <= seen.site[0].acquired + 1);
+	assert(seen.site[0].hold_ns > 0);
+	assert(seen.site[0].hold_max_ns <= seen.site[0].hold_ns);
+	assert(seen.site[0].wait_max_ns <= seen.site[0].wait_ns);
+
+	assert(strcmp(seen.site[1].name, "cold") == 0);
+	assert(seen.site[1].acquired == 3);
+	assert(seen.site[1].contended == 0 && seen.site[1].wait_ns == 0);
+	assert(seen.site[1].hold_max_ns >= 2000000);
+	assert(seen.site[1].hold_ns < 20000000);
+	(void)lockstat_unused;
+
+	printf("lockstat_test: ok\n");
+	return 0;
+}
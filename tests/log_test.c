@@ -0,0 +1,76 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <miniweb/core/log.h>
+
+#define THREADS 8
+#define LINES   5000
+
+static void *
+writer(void *arg)
+{
+	int id = (int)(long)arg;
+
+	for (int i = 0; i < LINES; i++)
+		log_info("thread %d line %d", id, i);
+	return NULL;
+}
+
+int
+main(void)
+{
+	char path[] = "/tmp/log_test.XXXXXX";
+	pthread_t t[THREADS];
+	char line[4096], big[3000];
+	unsigned long lines = 0, reports = 0, longest = 0;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	/* Before log_init() lines go straight to stderr. */
+	log_info("log_test: direct");
+	assert(log_init(path, 0) == 0);
+	log_debug("not verbose");
+	for (int i = 0; i < THREADS; i++)
+		assert(pthread_create(&t[i], NULL, writer,
+		    (void *)(long)i) == 0);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(t[i], NULL);
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	log_error("%s", big);
+	log_close();
+
+	fp = fopen(path, "r");
+	assert(fp != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		assert(line[0] == '[' && strchr(line, '\n') != NULL);
+		if (strlen(line) > longest)
+			longest = strlen(line);
+		if (strstr(line, "] [INFO] thread ") != NULL)
+			lines++;
+		else if (strstr(line, "line(s) dropped") != NULL)
+			reports++;
+		else
+			assert(strstr(line, "] [ERROR] xxx") != NULL);
+	}
+	fclose(fp);
+	unlink(path);
+
+	/* Every line was written or counted as dropped. */
+	assert(lines + log_dropped() == THREADS * LINES);
+	assert((reports > 0) == (log_dropped() > 0));
+	assert(longest == 2048);
+
+	log_info("log_test: direct again");
+	printf("log_test: ok (%lu written, %llu dropped)\n", lines,
+	    (unsigned long long)log_dropped());
+	return 0;
+}
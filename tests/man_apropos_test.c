@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../src/modules/man/man_internal.h"
+
+static char root[] = "/tmp/man_apropos_test.XXXXXX";
+
+/** Write @p body to @p rel under the test root. */
+static void
+put(const char *rel, const char *body)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, rel);
+	f = fopen(path, "w");
+	assert(f);
+	fputs(body, f);
+	fclose(f);
+}
+
+/** Give directory @p rel a distinct mtime, as a change a second later would. */
+static void
+bump(const char *rel, long sec)
+{
+	char path[256];
+	struct timeval tv[2] = {{sec, 0}, {sec, 0}};
+
+	snprintf(path, sizeof(path), "%s/%s", root, rel);
+	assert(utimes(path, tv) == 0);
+}
+
+int
+main(void)
+{
+	const char *roots[2];
+	char dir[300], other[256], want[300];
+	char *out;
+
+	assert(mkdtemp(root));
+	roots[0] = root;
+	snprintf(dir, sizeof(dir), "%s/man1", root);
+	assert(mkdir(dir, 0700) == 0);
+	snprintf(dir, sizeof(dir), "%s/man3", root);
+	assert(mkdir(dir, 0700) == 0);
+
+	/* Nothing indexed yet: callers fork apropos(1). */
+	assert(man_apropos_search("ls") == NULL);
+	assert(man_apropos_prefix_json("ls", 0, 10) == NULL);
+	assert(man_apropos_resolve("ls", "1", &out) == -1 && out == NULL);
+
+	put("man1/ls.1", ".Dd $Mdocdate$\n.Dt LS 1\n.Os\n.Sh NAME\n"
+	    ".Nm ls\n.Nd list directory contents\n.Sh SYNOPSIS\n.Nm ls\n");
+	put("man3/printf.3", ".Dd $Mdocdate$\n.Dt PRINTF 3\n.Sh NAME\n"
+	    ".Nm printf ,\n.Nm fprintf\n.Nd formatted output conversion\n");
+	put("man1/lesskey.1", ".TH LESSKEY 1\n.SH NAME\n"
+	    "lesskey \\- specify key bindings for \\fBless\\fP\n.SH SYNOPSIS\n");
+	put("man1/nohead.1.gz", "\037\213");
+	assert(man_apropos_refresh(roots, 1) == 0);
+
+	/* Name matches first, then names starting with the query. */
+	out = man_apropos_search("LS");
+	assert(out && strcmp(out, "ls(1) - list directory contents\n") == 0);
+	free(out);
+	out = man_apropos_search("print");
+	assert(out && strcmp(out,
+	    "printf, fprintf(3) - formatted output conversion\n") == 0);
+	free(out);
+	out = man_apropos_search("fprintf");
+	assert(out && strstr(out, "printf, fprintf(3)") == out);
+	free(out);
+
+	/* man(7) NAME line, roff escapes stripped; descriptions match too. */
+	out = man_apropos_search("bindings");
+	assert(out && strcmp(out,
+	    "lesskey(1) - specify key bindings for less\n") == 0);
+	free(out);
+	out = man_apropos_search("l");
+	assert(out && strcmp(out, "lesskey(1) - specify key bindings for less\n"
+	    "ls(1) - list directory contents\n") == 0);
+	free(out);
+
+	/* Unreadable pages are listed by file name. */
+	out = man_apropos_search("nohead");
+	assert(out && strcmp(out, "nohead(1) - \n") == 0);
+	free(out);
+	out = man_apropos_search("zzz");
+	assert(out && out[0] == '\0');
+	free(out);
+
+	/* Type-ahead: names and aliases by name, paged by cursor. */
+	out = man_apropos_prefix_json("L", 0, 10);
+	assert(out && strcmp(out, "{\"prefix\":\"L\",\"total\":2,\"matches\":["
+	    "{\"name\":\"lesskey\",\"section\":\"1\",\"desc\":"
+	    "\"specify key bindings for less\"},"
+	    "{\"name\":\"ls\",\"section\":\"1\",\"desc\":"
+	    "\"list directory contents\"}],\"next\":null}") == 0);
+	free(out);
+	out = man_apropos_prefix_json("", 1, 2);
+	assert(out && strstr(out, "\"total\":5,") &&
+	    strstr(out, "{\"name\":\"lesskey\"") &&
+	    strstr(out, "{\"name\":\"ls\"") && strstr(out, "\"next\":3}"));
+	free(out);
+	/* A longer prefix narrows the run cached for "l"; so does "f". */
+	out = man_apropos_prefix_json("le", 0, 10);
+	assert(out && strstr(out, "\"total\":1,") && strstr(out, "lesskey"));
+	free(out);
+	out = man_apropos_prefix_json("fp", 0, 10);
+	assert(out && strstr(out, "{\"name\":\"fprintf\",\"section\":\"3\""));
+	free(out);
+	out = man_apropos_prefix_json("lx", 0, 10);
+	assert(out && strcmp(out, "{\"prefix\":\"lx\",\"total\":0,"
+	    "\"matches\":[],\"next\":null}") == 0);
+	free(out);
+	out = man_apropos_prefix_json("l", 5, 10);
+	assert(out && strstr(out, "\"matches\":[],\"next\":null"));
+	free(out);
+
+	/* A directory whose mtime moved is read again. */
+	put("man1/lsof.1", ".Sh NAME\n.Nm lsof\n.Nd list open files\n");
+	assert(man_apropos_refresh(roots, 1) == 0);
+	out = man_apropos_search("lsof");
+	assert(out && strcmp(out, "lsof(1) - list open files\n") == 0);
+	free(out);
+	put("man3/printf.3", ".Sh NAME\n.Nm printf\n.Nd changed\n");
+	put("man1/ls.1", ".Sh NAME\n.Nm ls\n.Nd changed\n");
+	bump("man1", 1000000000);
+	bump("man3", 1000000000);
+	assert(man_apropos_refresh(roots, 1) == 0);
+	out = man_apropos_search("changed");
+	assert(out && strcmp(out, "ls(1) - changed\nprintf(3) - changed\n") == 0);
+	free(out);
+
+	/* Resolution: NAME aliases, the earlier root, then a miss re-scans. */
+	snprintf(other, sizeof(other), "%s/local", root);
+	assert(mkdir(other, 0700) == 0);
+	snprintf(dir, sizeof(dir), "%s/man1", other);
+	assert(mkdir(dir, 0700) == 0);
+	put("local/man1/ls.1", ".Sh NAME\n.Nm ls\n.Nd shadowed\n");
+	put("local/man1/gls.1", ".Sh NAME\n.Nm gls , ls\n.Nd GNU ls\n");
+	put("man3/printf.3", ".Sh NAME\n.Nm printf ,\n.Nm fprintf\n.Nd output\n");
+	bump("man3", 1000000001);
+	roots[1] = other;
+	assert(man_apropos_refresh(roots, 2) == 0);
+	assert(man_apropos_resolve("ls", "1", &out) == 1);
+	snprintf(want, sizeof(want), "%s/man1/ls.1", root);
+	assert(strcmp(out, want) == 0);
+	free(out);
+	assert(man_apropos_resolve("fprintf", "3", &out) == 1);
+	snprintf(want, sizeof(want), "%s/man3/printf.3", root);
+	assert(strcmp(out, want) == 0);
+	free(out);
+	assert(man_apropos_resolve("gls", "1", &out) == 1);
+	snprintf(want, sizeof(want), "%s/man1/gls.1", other);
+	assert(strcmp(out, want) == 0);
+	free(out);
+	/* A new snapshot does not see the runs cached for the old one. */
+	out = man_apropos_prefix_json("l", 0, 10);
+	assert(out && strstr(out, "\"total\":3,") && strstr(out, "lsof"));
+	free(out);
+	put("man1/fresh.1", ".Sh NAME\n.Nm fresh\n.Nd just installed\n");
+	assert(man_apropos_resolve("fresh", "1", &out) == 1);
+	free(out);
+	assert(man_apropos_resolve("printf", "1", &out) == 0 && out == NULL);
+
+	man_apropos_cleanup();
+	assert(man_apropos_search("ls") == NULL);
+	snprintf(dir, sizeof(dir), "rm -rf %s", root);
+	assert(system(dir) == 0);
+	puts("man_apropos_test: ok");
+	return 0;
+}
@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../src/modules/man/man_internal.h"
+#include <miniweb/core/heartbeat.h>
+
+static char root[] = "/tmp/man_document_test.XXXXXX";
+static char source[256];
+static int resolves;
+static int busy;
+static int l2_fresh;
+static int rehydrated;
+static char rendered[8][32];
+static int nrendered;
+
+/* Stubs for what man_document.c calls outside itself. */
+char *
+man_resolve_path(const char *name, const char *section)
+{
+	(void)name;
+	(void)section;
+	resolves++;
+	return strdup(source);
+}
+
+int
+man_render_prerender(const char *area, const char *section, const char *page,
+    const char *format, time_t max_age)
+{
+	(void)area;
+	(void)section;
+	(void)max_age;
+	assert(nrendered < 8);
+	snprintf(rendered[nrendered++], sizeof(rendered[0]), "%s.%s", page,
+	    format);
+	return 1;
+}
+
+int
+man_render_rehydrate(const char *area, const char *section, const char *page,
+    const char *format)
+{
+	(void)area;
+	(void)section;
+	(void)page;
+	(void)format;
+	rehydrated += l2_fresh;
+	return l2_fresh;
+}
+
+int
+man_mandoc_busy(void)
+{
+	return busy;
+}
+
+int
+heartbeat_register_ms(const struct hb_task *task, unsigned int period_ms,
+    unsigned int initial_delay_ms)
+{
+	(void)task;
+	(void)period_ms;
+	(void)initial_delay_ms;
+	return HB_REGISTER_INSERTED;
+}
+
+int
+heartbeat_unregister(const char *name)
+{
+	(void)name;
+	return 0;
+}
+
+int
+heartbeat_start(void)
+{
+	return 0;
+}
+
+/** Set the source's mtime to @p sec seconds after the epoch. */
+static void
+set_mtime(long sec)
+{
+	struct timeval tv[2] = { { sec, 0 }, { sec, 0 } };
+
+	assert(utimes(source, tv) == 0);
+}
+
+int
+main(void)
+{
+	FILE *f;
+	char *p;
+
+	assert(mkdtemp(root) != NULL);
+	snprintf(source, sizeof(source), "%s/ls.1", root);
+	assert((f = fopen(source, "w")) != NULL);
+	fputs(".Dd $Mdocdate$\n.Dt LS 1\n", f);
+	fclose(f);
+	set_mtime(1000000);
+	assert(man_document_start() == 0);
+
+	/* Resolved once, then answered from the cache. */
+	p = man_document_path("1", "ls");
+	assert(p && strcmp(p, source) == 0 && resolves == 1);
+	free(p);
+	p = man_document_path("1", "ls");
+	assert(p && strcmp(p, source) == 0 && resolves == 1);
+	free(p);
+	/* Keyed by section as well. */
+	free(man_document_path("8", "ls"));
+	assert(resolves == 2);
+
+	/* Rendering html queues the other text formats, once. */
+	man_document_rendered("system", "1", "ls", "html");
+	man_document_rendered("system", "1", "ls", "html");
+	busy = 1;
+	assert(man_document_speculate(8) == 0 && nrendered == 0);
+	busy = 0;
+	assert(man_document_speculate(1) == 1);
+	assert(man_document_speculate(8) == 1);
+	assert(nrendered == 2);
+	assert(strcmp(rendered[0], "ls.txt") == 0);
+	assert(strcmp(rendered[1], "ls.md") == 0);
+	man_document_rendered("system", "1", "ls", "txt");
+	assert(man_document_speculate(8) == 0);
+
+	/* A page that was never resolved has nothing to go on. */
+	man_document_rendered("system", "2", "open", "html");
+	assert(man_document_speculate(8) == 0);
+
+	/* A changed source is resolved again and its formats start over. */
+	set_mtime(2000000);
+	free(man_document_path("1", "ls"));
+	assert(resolves == 3);
+	free(man_document_path("1", "ls"));
+	assert(resolves == 3);
+	man_document_rendered("system", "1", "ls", "md");
+	assert(man_document_speculate(8) == 2 && nrendered == 4);
+	assert(strcmp(rendered[2], "ls.html") == 0);
+	assert(strcmp(rendered[3], "ls.txt") == 0);
+
+	/* Refreshes run with mandoc busy, from L2 when it is fresh. */
+	busy = 1;
+	assert(man_document_refresh("system", "1", "ls", "pdf") == 0);
+	l2_fresh = 1;
+	assert(man_document_refresh_run(8) == 1);
+	assert(rehydrated == 1 && nrendered == 4);
+	l2_fresh = 0;
+	assert(man_document_refresh("system", "1", "ls", "html") == 0);
+	assert(man_document_refresh_run(8) == 1 && nrendered == 5);
+	assert(strcmp(rendered[4], "ls.html") == 0);
+	assert(man_document_refresh_run(8) == 0);
+	busy = 0;
+	for (int i = 0; i < 16; i++)
+		assert(man_document_refresh("system", "1", "ls", "txt") == 0);
+	assert(man_document_refresh("system", "1", "ls", "txt") == -1);
+
+	/* A source that went away is looked up every time. */
+	assert(unlink(source) == 0);
+	free(man_document_path("1", "ls"));
+	free(man_document_path("1", "ls"));
+	assert(resolves == 5);
+
+	man_document_cleanup();
+	man_document_rendered("system", "8", "ls", "html");
+	assert(man_document_speculate(8) == 0);
+	assert(man_document_refresh("system", "1", "ls", "html") == -1);
+	assert(man_document_refresh_run(8) == 0);
+	assert(rmdir(root) == 0);
+	printf("man_document_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/modules/man/man_internal.h"
+
+static char root[] = "/tmp/man_mandoc_test.XXXXXX";
+
+struct sink {
+	size_t len;
+	int calls;
+	int stop_after;		/* 0: never */
+	useconds_t delay;
+};
+
+/** man_mandoc_stream() consumer: count, dawdle, stop when told to. */
+static int
+sink_cb(const char *data, size_t len, void *ctx)
+{
+	struct sink *k = ctx;
+
+	(void)data;
+	k->len += len;
+	k->calls++;
+	if (k->delay)
+		usleep(k->delay);
+	return k->stop_after && k->calls >= k->stop_after;
+}
+
+/** Write @p body to @p rel under the test root. */
+static void
+put(const char *rel, const char *body)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, rel);
+	f = fopen(path, "w");
+	assert(f);
+	fputs(body, f);
+	fclose(f);
+}
+
+int
+main(void)
+{
+	char fake[256], page[256], slow[256], crash[256], big[256], cmd[300];
+	struct sink k;
+	char *out;
+	size_t len;
+	FILE *f;
+
+	assert(mkdtemp(root));
+	/* Stands in for mandoc: "-T type" and the page, last. */
+	put("mandoc", "#!/bin/sh\n"
+	    "for f; do :; done\n"
+	    "case $f in *slow*) exec sleep 30;; *crash*) kill -9 $PPID;; esac\n"
+	    "echo \"$2:$$\"; cat \"$f\"\n");
+	snprintf(fake, sizeof(fake), "%s/mandoc", root);
+	assert(chmod(fake, 0700) == 0);
+	put("ls.1", "ls body\n");
+	snprintf(page, sizeof(page), "%s/ls.1", root);
+	put("slow.1", "never\n");
+	snprintf(slow, sizeof(slow), "%s/slow.1", root);
+	put("crash.1", "never\n");
+	snprintf(crash, sizeof(crash), "%s/crash.1", root);
+	snprintf(big, sizeof(big), "%s/big.1", root);
+	f = fopen(big, "w");
+	assert(f);
+	for (int i = 0; i < 256 * 1024; i++)
+		fputc('a' + i % 26, f);
+	fclose(f);
+
+	/* No pool yet: the caller forks mandoc itself. */
+	assert(man_mandoc_render(page, "html", 1024, &out, &len) == -1);
+	assert(out == NULL && len == 0);
+
+	assert(man_mandoc_start(fake, 1, 1) == 1);
+	assert(man_mandoc_render(page, "ascii", 1024, &out, &len) == 1);
+	assert(out && strncmp(out, "ascii:", 6) == 0);
+	assert(strstr(out, "\nls body\n") && len == strlen(out));
+	free(out);
+
+	/* Output past max_size is cut off. */
+	assert(man_mandoc_render(page, "html", 4, &out, &len) == 1);
+	assert(out && len == 4 && strcmp(out, "html") == 0);
+	free(out);
+
+	/* Unknown types and relative paths never reach mandoc. */
+	assert(man_mandoc_render(page, "sh", 1024, &out, &len) == 1);
+	assert(out == NULL);
+	assert(man_mandoc_render("ls.1", "html", 1024, &out, &len) == 1);
+	assert(out == NULL);
+
+	/* A render over mandoc_timeout fails, and the helper carries on. */
+	assert(man_mandoc_render(slow, "html", 1024, &out, &len) == 1);
+	assert(out == NULL && len == 0);
+	assert(man_mandoc_render(page, "html", 1024, &out, &len) == 1);
+	assert(out && strstr(out, "ls body"));
+	free(out);
+
+	/* Streamed output arrives in frames; a slow consumer is not a timeout. */
+	memset(&k, 0, sizeof(k));
+	k.delay = 250000;
+	assert(man_mandoc_stream(big, "pdf", 1 << 20, sink_cb, &k) == 0);
+	assert(k.len > 256 * 1024 && k.calls > 1);
+
+	/* A consumer that stops gets no more; the helper carries on. */
+	memset(&k, 0, sizeof(k));
+	k.stop_after = 1;
+	assert(man_mandoc_stream(big, "pdf", 1 << 20, sink_cb, &k) == 1);
+	assert(k.calls == 1);
+	memset(&k, 0, sizeof(k));
+	assert(man_mandoc_stream(page, "html", 1024, sink_cb, &k) == 0);
+	assert(k.len > 0 && k.len < 64);
+
+	/* A helper that dies is replaced; twice in a row, the caller forks. */
+	assert(man_mandoc_render(crash, "html", 1024, &out, &len) == -1);
+	assert(out == NULL);
+	assert(man_mandoc_render(page, "ps", 1024, &out, &len) == 1);
+	assert(out && strncmp(out, "ps:", 3) == 0);
+	free(out);
+
+	man_mandoc_cleanup();
+	assert(man_mandoc_render(page, "html", 1024, &out, &len) == -1);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+	assert(system(cmd) == 0);
+	puts("man_mandoc_test: ok");
+	return 0;
+}
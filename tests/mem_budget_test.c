@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/mem_budget.h>
+
+#define MB (1024 * 1024)
+/* Where a check over budget @p b shrinks usage to. */
+#define LOW_WATER(b) ((b) / 100 * 90)
+
+/* A fake cache: bytes held, hits so far, shrink requests seen. */
+struct fake {
+	size_t bytes;
+	uint64_t hits;
+	int shrinks;
+};
+
+static size_t
+fake_usage(uint64_t *hits, void *ctx)
+{
+	struct fake *f = ctx;
+
+	*hits += f->hits;
+	return f->bytes;
+}
+
+static size_t
+fake_shrink(size_t bytes, void *ctx)
+{
+	struct fake *f = ctx;
+	size_t freed = bytes < f->bytes ? bytes : f->bytes;
+
+	f->shrinks++;
+	f->bytes -= freed;
+	return freed;
+}
+
+struct seen {
+	int n;
+	size_t ring_bytes;
+	uint64_t hot_shrinks, cold_shrunk;
+};
+
+static void
+collect(const char *name, const struct mem_cache_stats *st, void *ctx)
+{
+	struct seen *s = ctx;
+
+	s->n++;
+	if (strcmp(name, "ring") == 0)
+		s->ring_bytes = st->bytes;
+	else if (strcmp(name, "hot") == 0)
+		s->hot_shrinks = st->shrinks;
+	else if (strcmp(name, "cold") == 0)
+		s->cold_shrunk = st->shrunk;
+}
+
+int
+main(void)
+{
+	struct fake hot = { 40 * MB, 0, 0 }, cold = { 40 * MB, 0, 0 };
+	struct seen seen;
+	size_t budget, used;
+
+	assert(mem_budget_register(&(struct mem_cache_ops){
+		.name = "hot", .usage = fake_usage, .shrink = fake_shrink,
+		.ctx = &hot }) == 0);
+	assert(mem_budget_register(&(struct mem_cache_ops){
+		.name = "cold", .usage = fake_usage, .shrink = fake_shrink,
+		.ctx = &cold }) == 0);
+	assert(mem_budget_register_fixed("ring", 20 * MB) == 0);
+	assert(mem_budget_register(&(struct mem_cache_ops){
+		.name = "bad" }) == -1);
+
+	/* No budget: measured only. */
+	assert(mem_budget_check() == 100 * MB);
+	assert(hot.shrinks == 0 && cold.shrinks == 0);
+
+	/* "hot" earns hits, "cold" none: only "cold" gives memory back. */
+	hot.hits = 1000;
+	cold.hits = 1;
+	mem_budget_set(90 * MB);
+	used = mem_budget_check();
+	assert(used == LOW_WATER(90 * MB));
+	assert(hot.shrinks == 0 && hot.bytes == 40 * MB);
+	assert(cold.shrinks == 1 && cold.bytes == used - 60 * MB);
+
+	/* Not enough in "cold": "hot" is next, the ring never is. */
+	hot.hits = 2000;
+	mem_budget_set(40 * MB);
+	used = mem_budget_check();
+	assert(used == LOW_WATER(40 * MB));
+	assert(cold.bytes == 0 && hot.bytes == used - 20 * MB);
+	assert(hot.shrinks == 1 && cold.shrinks == 2);
+
+	/* Under budget again: nothing more is asked. */
+	assert(mem_budget_check() == LOW_WATER(40 * MB));
+	assert(hot.shrinks == 1 && cold.shrinks == 2);
+
+	memset(&seen, 0, sizeof(seen));
+	assert(mem_budget_foreach(collect, &seen, &budget, &used) == 3);
+	assert(seen.n == 3 && seen.ring_bytes == 20 * MB);
+	assert(seen.hot_shrinks == 1 && seen.cold_shrunk == 40 * MB);
+	assert(budget == 40 * MB && used == LOW_WATER(40 * MB));
+
+	printf("mem_budget_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/modules/metrics_internal.h>
+
+#define DB "/tmp/metrics_store_test.db"
+
+static MetricSample got[16];
+static int ngot;
+
+static void
+collect(const MetricSample *s, void *ctx)
+{
+	(void)ctx;
+	if (ngot < 16)
+		got[ngot] = *s;
+	ngot++;
+}
+
+int
+main(void)
+{
+	int64_t now = (int64_t)time(NULL);
+	MetricSample s;
+
+	(void)unlink(DB);
+	assert(metrics_store_start("", 30) != 0);
+	assert(metrics_store_start(DB, 0) != 0);
+	/* Nothing open: samples are ignored and nothing reloads. */
+	memset(&s, 0, sizeof(s));
+	metrics_store_add(&s);
+	assert(metrics_store_flush() == 0);
+	assert(metrics_store_reload(0, collect, NULL) == -1);
+
+	assert(metrics_store_start(DB, 30) == 0);
+	assert(metrics_store_flush() == 0);
+
+	/* Three samples, written in one batch. */
+	for (int i = 0; i < 3; i++) {
+		memset(&s, 0, sizeof(s));
+		s.ts = now - 10 + i;
+		s.cpu = 12.34f + (float)i;
+		s.mem_used = 1000 + (uint32_t)i;
+		s.mem_total = 4096;
+		s.swap_used = 7;
+		s.net_rx = 123456;
+		s.net_tx = 654321;
+		s.cpu_total_ticks = 99;
+		metrics_store_add(&s);
+	}
+	/* A sample from before the retention window is pruned on flush. */
+	s.ts = now - METRIC_TIER_MAX_SPAN - 100;
+	metrics_store_add(&s);
+	assert(metrics_store_flush() == 4);
+	assert(metrics_store_flush() == 0);
+
+	assert(metrics_store_reload(0, collect, NULL) == 3);
+	assert(ngot == 3);
+	assert(got[0].ts == now - 10 && got[2].ts == now - 8);
+	assert(got[1].cpu > 13.33f && got[1].cpu < 13.35f);
+	assert(got[2].mem_used == 1002 && got[2].mem_total == 4096);
+	assert(got[0].swap_used == 7 && got[0].net_rx == 123456 &&
+	    got[0].net_tx == 654321);
+	/* Tick counters are not kept: the first CPU delta starts afresh. */
+	assert(got[0].cpu_total_ticks == 0);
+
+	/* Only rows newer than since, and the same ts replaces its row. */
+	ngot = 0;
+	assert(metrics_store_reload(now - 9, collect, NULL) == 1);
+	s = got[0];
+	s.mem_used = 5;
+	metrics_store_add(&s);
+	assert(metrics_store_flush() == 1);
+
+	/* Pending samples are written on cleanup, and survive a reopen. */
+	s.ts = now - 1;
+	metrics_store_add(&s);
+	metrics_store_cleanup();
+	assert(metrics_store_start(DB, 30) == 0);
+	ngot = 0;
+	assert(metrics_store_reload(0, collect, NULL) == 4);
+	assert(got[2].ts == now - 8 && got[2].mem_used == 5);
+	assert(got[3].ts == now - 1);
+	metrics_store_cleanup();
+
+	(void)unlink(DB);
+	printf("metrics_store_test: ok\n");
+	return 0;
+}
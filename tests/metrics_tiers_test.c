@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/modules/metrics_internal.h>
+
+static MetricSample
+sample(int64_t ts, float cpu, uint32_t mem)
+{
+	MetricSample s;
+
+	memset(&s, 0, sizeof(s));
+	s.ts = ts;
+	s.cpu = cpu;
+	s.mem_used = mem;
+	s.mem_total = 4096;
+	return s;
+}
+
+int
+main(void)
+{
+	static MetricTiers t;
+	MetricBucket *out;
+	MetricSample s;
+	unsigned int step;
+	size_t n;
+	int64_t base = 1699999980;	/* a multiple of 60 */
+
+	assert(metric_tiers_init(&t) == 0);
+	out = calloc(METRIC_TIER_MAX_SPAN / 60, sizeof(*out));
+	assert(out != NULL);
+
+	/* Empty tiers answer with nothing, but still name their step. */
+	assert(metric_tiers_query(&t, 600, out, 600, &step) == 0);
+	assert(step == 1);
+
+	/* Twenty seconds: cpu 0..19, mem 100 + i. */
+	for (int i = 0; i < 20; i++) {
+		s = sample(base + i, (float)i, 100 + (uint32_t)i);
+		metric_tiers_push(&t, &s);
+	}
+
+	/* The 1 s tier holds every sample. */
+	n = metric_tiers_query(&t, 600, out, 600, &step);
+	assert(step == 1 && n == 20);
+	assert(out[0].ts == base && out[19].ts == base + 19);
+	assert(out[5].n == 1 && out[5].cpu.min == 5.0f);
+
+	/* A span of the last five seconds. */
+	n = metric_tiers_query(&t, 5, out, 600, &step);
+	assert(n == 5 && out[0].ts == base + 15);
+
+	/* The 10 s tier: two buckets of ten, min/avg/max. */
+	n = metric_tiers_query(&t, 3600, out, 2160, &step);
+	assert(step == 10 && n == 2);
+	assert(out[0].ts == base && out[0].n == 10);
+	assert(out[0].cpu.min == 0.0f && out[0].cpu.max == 9.0f);
+	assert(out[0].cpu.sum / (float)out[0].n == 4.5f);
+	assert(out[1].mem_used.min == 110.0f && out[1].mem_used.max == 119.0f);
+	assert(out[1].mem_total == 4096);
+
+	/* The 1 min tier: one bucket so far. */
+	n = metric_tiers_query(&t, 24 * 3600, out, 10080, &step);
+	assert(step == 60 && n == 1 && out[0].n == 20);
+
+	/* Longer than a week still comes from the coarsest tier. */
+	n = metric_tiers_query(&t, 30 * 24 * 3600, out, 10080, &step);
+	assert(step == 60 && n == 1);
+	assert(metric_tiers_capacity(&t, 30 * 24 * 3600) == 10080);
+	assert(metric_tiers_capacity(&t, 90) == 90);
+	assert(metric_tiers_capacity(&t, 3600) == 360);
+
+	/* A clock stepped back folds into the newest bucket. */
+	s = sample(base + 3, 50.0f, 100);
+	metric_tiers_push(&t, &s);
+	n = metric_tiers_query(&t, 600, out, 600, &step);
+	assert(n == 20 && out[19].n == 2 && out[19].cpu.max == 50.0f);
+
+	/* The 1 s tier wraps after ten minutes; max keeps the newest. */
+	for (int i = 20; i < 1000; i++) {
+		s = sample(base + i, 1.0f, 100);
+		metric_tiers_push(&t, &s);
+	}
+	n = metric_tiers_query(&t, 600, out, 600, &step);
+	assert(n == 600 && out[599].ts == base + 999);
+	assert(out[0].ts == base + 400);
+	n = metric_tiers_query(&t, 600, out, 10, &step);
+	assert(n == 10 && out[9].ts == base + 999 && out[0].ts == base + 990);
+
+	metric_tiers_free(&t);
+	free(out);
+	printf("metrics_tiers_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../src/modules/networking/networking_internal.h"
+
+#define TCPS_LISTEN		1
+#define TCPS_ESTABLISHED	4
+#define TCPS_TIME_WAIT		10
+
+/** A TCP socket 127.0.0.1:@p lport <-> 10.0.0.@p host:@p fport. */
+static net_conn_t
+tcp(uint16_t lport, uint8_t host, uint16_t fport, uint8_t state)
+{
+	net_conn_t c;
+
+	memset(&c, 0, sizeof(c));
+	c.family = AF_INET;
+	c.proto = IPPROTO_TCP;
+	c.state = state;
+	c.lport = lport;
+	c.fport = fport;
+	c.laddr[0] = 127;
+	c.laddr[3] = 1;
+	if (fport != 0) {
+		c.faddr[0] = 10;
+		c.faddr[3] = host;
+	}
+	return c;
+}
+
+int
+main(void)
+{
+	static net_conn_t socks[3000];
+	NetworkConnection list[8];
+	net_conns_stats_t st;
+	net_port_t top[NET_CONNS_TOP_PORTS];
+	char json[4096];
+	size_t n = 0;
+	int i;
+
+	/* Nothing sampled yet: no JSON, no ports. */
+	assert(net_conns_json(json, sizeof(json)) == 0);
+	assert(net_conns_top_ports(top, NET_CONNS_TOP_PORTS) == 0);
+
+	socks[n++] = tcp(443, 0, 0, TCPS_LISTEN);
+	socks[n++] = tcp(22, 0, 0, TCPS_LISTEN);
+	for (i = 0; i < 5; i++)
+		socks[n++] = tcp(443, (uint8_t)(i + 1), 40000, TCPS_ESTABLISHED);
+	socks[n++] = tcp(22, 9, 50000, TCPS_ESTABLISHED);
+	/* The same socket in two descriptors counts once. */
+	socks[n] = socks[n - 1];
+	n++;
+	memset(&socks[n], 0, sizeof(socks[n]));
+	socks[n].family = AF_INET6;
+	socks[n].proto = IPPROTO_UDP;
+	socks[n].lport = 53;
+	n++;
+
+	assert(net_conns_update(socks, n, 100) == 0);
+	net_conns_stats(&st);
+	assert(st.total == 9 && st.tcp == 8 && st.udp == 1);
+	assert(st.added == 9 && st.removed == 0 && st.ports == 3);
+	assert(st.listening == 3 && st.established == 6);
+
+	assert(net_conns_top_ports(top, NET_CONNS_TOP_PORTS) == 3);
+	assert(top[0].port == 443 && top[0].conns == 6 && top[0].listening == 1);
+	assert(top[1].port == 22 && top[1].conns == 2);
+	assert(top[2].port == 53 && top[2].proto == IPPROTO_UDP);
+	assert(net_conns_json(json, sizeof(json)) > 0);
+	assert(strncmp(json, "\"connections\":{\"total\":9,", 25) == 0);
+	assert(strstr(json, "{\"protocol\":\"tcp\",\"port\":443,"
+	    "\"connections\":6,\"listening\":1}"));
+	assert(net_conns_json(json, 16) == 0);
+
+	assert(net_conns_list(list, 8) == 8);
+	for (i = 0; i < 8; i++) {
+		if (strcmp(list[i].protocol, "udp6") == 0)
+			assert(strcmp(list[i].local_addr, "::") == 0 &&
+			    list[i].state[0] == '\0');
+		else if (list[i].local_port == 22 && list[i].remote_port)
+			assert(strcmp(list[i].remote_addr, "10.0.0.9") == 0 &&
+			    strcmp(list[i].state, "ESTABLISHED") == 0);
+	}
+
+	/* One client goes to TIME_WAIT, another leaves, a third arrives. */
+	socks[2].state = TCPS_TIME_WAIT;
+	socks[3] = tcp(443, 200, 40001, TCPS_ESTABLISHED);
+	assert(net_conns_update(socks, n, 101) == 0);
+	net_conns_stats(&st);
+	assert(st.total == 9 && st.added == 1 && st.removed == 1);
+	assert(st.changed == 1 && st.established == 5);
+	assert(st.added_total == 10 && st.removed_total == 1);
+
+	/* A quiet sample resets the per-sample counters in the JSON too. */
+	assert(net_conns_update(socks, n, 102) == 0);
+	net_conns_stats(&st);
+	assert(st.added == 0 && st.removed == 0 && st.changed == 0);
+	assert(net_conns_json(json, sizeof(json)) > 0);
+	assert(strstr(json, "\"added\":0,\"removed\":0,\"changed\":0,"));
+
+	/* Many ephemeral clients: the table grows, then empties. */
+	for (n = 0; n < 3000; n++)
+		socks[n] = tcp((uint16_t)(1024 + n), (uint8_t)n, 443,
+		    TCPS_ESTABLISHED);
+	assert(net_conns_update(socks, n, 103) == 0);
+	net_conns_stats(&st);
+	assert(st.total == 3000 && st.removed == 9 && st.ports == 3000);
+	assert(net_conns_top_ports(top, 5) == 5 && top[0].port == 1024);
+	assert(net_conns_update(socks + 1500, 1500, 104) == 0);
+	net_conns_stats(&st);
+	assert(st.total == 1500 && st.removed == 1500 && st.ports == 1500);
+	assert(net_conns_top_ports(top, 1) == 1 && top[0].port == 2524);
+	assert(net_conns_update(NULL, 0, 105) == 0);
+	net_conns_stats(&st);
+	assert(st.total == 0 && st.ports == 0 && st.tcp == 0);
+	assert(net_conns_top_ports(top, NET_CONNS_TOP_PORTS) == 0);
+
+	net_conns_cleanup();
+	puts("networking_conns_test: ok");
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/modules/networking/networking_internal.h"
+
+static NetStats
+ifstat(const char *name, unsigned long long rx_bytes,
+    unsigned long long rx_packets, unsigned long long rx_errors)
+{
+	NetStats s;
+
+	memset(&s, 0, sizeof(s));
+	strlcpy(s.interface, name, sizeof(s.interface));
+	s.rx_bytes = rx_bytes;
+	s.tx_bytes = rx_bytes / 2;
+	s.rx_packets = rx_packets;
+	s.tx_packets = rx_packets;
+	s.rx_errors = rx_errors;
+	return s;
+}
+
+static char *
+rates(unsigned int span, const char *ifname)
+{
+	json_writer_t w;
+	char *json;
+
+	assert(json_init(&w, NULL, 256) == 0);
+	net_rates_json(&w, span, ifname);
+	json = json_finish(&w, NULL);
+	assert(json != NULL);
+	return json;
+}
+
+int
+main(void)
+{
+	NetStats s[2];
+	time_t base = 1699999980;	/* a multiple of 60 */
+	char *json;
+
+	/* Nothing yet: an empty history. */
+	json = rates(600, NULL);
+	assert(strcmp(json, "{\"span\":600,\"step\":1,\"version\":0,"
+	    "\"fields\":[\"rx_bytes\",\"tx_bytes\",\"rx_packets\","
+	    "\"tx_packets\",\"rx_errors\",\"tx_errors\"],\"ts\":[],"
+	    "\"interfaces\":[]}") == 0);
+	free(json);
+
+	/* The first sample only sets the baseline. */
+	s[0] = ifstat("em0", 1000, 10, 0);
+	assert(net_rates_push(base, s, 1) == 0);
+	assert(net_rates_version() == 0);
+
+	/* 2000 bytes, 20 packets and one error a second. */
+	s[0] = ifstat("em0", 3000, 30, 1);
+	assert(net_rates_push(base + 1, s, 1) == 1);
+	json = rates(600, NULL);
+	assert(strstr(json, "\"ts\":[1699999981]") != NULL);
+	assert(strstr(json, "{\"interface\":\"em0\","
+	    "\"avg\":[[2000,1000,20,20,1,0]],"
+	    "\"peak\":[[2000,1000,20,20,1,0]]}") != NULL);
+	free(json);
+
+	/* Two seconds later, with a second interface: per second of dt. */
+	s[0] = ifstat("em0", 7000, 33, 1);
+	s[1] = ifstat("lo0", 10, 1, 0);
+	assert(net_rates_push(base + 3, s, 2) == 1);
+	json = rates(600, "em0");
+	assert(strstr(json, "\"ts\":[1699999981,1699999983]") != NULL);
+	assert(strstr(json, "\"avg\":[[2000,1000,20,20,1,0],"
+	    "[2000,1000,1.5000,1.5000,0,0]]") != NULL);
+	assert(strstr(json, "lo0") == NULL);
+	free(json);
+
+	/* The 10 s tier folds all three: average and peak of each rate. */
+	s[0] = ifstat("em0", 7000, 33, 1);
+	s[1] = ifstat("lo0", 110, 11, 0);
+	assert(net_rates_push(base + 4, s, 2) == 2);
+	json = rates(3600, NULL);
+	assert(strstr(json, "\"step\":10") != NULL);
+	assert(strstr(json, "\"ts\":[1699999980]") != NULL);
+	assert(strstr(json, "{\"interface\":\"em0\","
+	    "\"avg\":[[1333,666,7.1250,7.1250,0.3125,0]],"
+	    "\"peak\":[[2000,1000,20,20,1,0]]}") != NULL);
+	assert(strstr(json, "{\"interface\":\"lo0\","
+	    "\"avg\":[[100,50,10,10,0,0]]") != NULL);
+	free(json);
+
+	/* A counter that went back (a reset) only sets a new baseline. */
+	s[0] = ifstat("em0", 10, 1, 0);
+	assert(net_rates_push(base + 5, s, 1) == 0);
+	s[0] = ifstat("em0", 20, 2, 0);
+	assert(net_rates_push(base + 6, s, 1) == 1);
+
+	/* The newest bucket is in every chosen span; a day is the most. */
+	json = rates(1, NULL);
+	assert(strstr(json, "\"ts\":[1699999986]") != NULL);
+	assert(strstr(json, "\"avg\":[[10,5,1,1,0,0]]") != NULL);
+	free(json);
+	json = rates(7 * 24 * 3600, NULL);
+	assert(strstr(json, "\"step\":60") != NULL);
+	free(json);
+
+	/* Interfaces past the slots are left out. */
+	for (int i = 0; i < 2 * NET_RATE_IFS; i++) {
+		char name[IFNAMSIZ];
+
+		snprintf(name, sizeof(name), "vlan%d", i);
+		s[0] = ifstat(name, 0, 0, 0);
+		(void)net_rates_push(base + 7, s, 1);
+	}
+	json = rates(600, NULL);
+	assert(strstr(json, "vlan7") == NULL);
+	free(json);
+
+	net_rates_cleanup();
+	assert(net_rates_version() == 0);
+
+	printf("networking_rates_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../src/modules/networking/networking_internal.h"
+
+/** 10.@p net.0.0/16 via 192.168.1.@p gw on interface @p ifindex. */
+static net_route_t
+route(uint8_t net, uint8_t gw, uint16_t ifindex)
+{
+	net_route_t r;
+
+	memset(&r, 0, sizeof(r));
+	r.family = AF_INET;
+	r.gw_family = AF_INET;
+	r.priority = 48;
+	r.has_mask = 1;
+	r.ifindex = ifindex;
+	r.flags = 0x1 | 0x2 | 0x800;	/* UP, GATEWAY, STATIC */
+	r.dst[0] = 10;
+	r.dst[1] = net;
+	r.mask[0] = r.mask[1] = 255;
+	r.gw[0] = 192;
+	r.gw[1] = 168;
+	r.gw[2] = 1;
+	r.gw[3] = gw;
+	return r;
+}
+
+int
+main(void)
+{
+	RouteEntry out[8];
+	net_route_t r;
+
+	assert(net_routes_live() == 0 && net_routes_count() == 0);
+	assert(net_routes_copy(out, 8) == 0);
+
+	for (int i = 0; i < 4; i++) {
+		r = route((uint8_t)i, 1, 1);
+		assert(net_routes_apply(NET_ROUTE_ADD, &r) == 1);
+	}
+	/* Multipath: same key, second gateway. */
+	r = route(2, 2, 1);
+	assert(net_routes_apply(NET_ROUTE_ADD, &r) == 1);
+	assert(net_routes_count() == 5);
+
+	assert(net_routes_copy(out, 8) == 5);
+	assert(strcmp(out[0].destination, "10.0.0.0") == 0);
+	assert(strcmp(out[0].gateway, "192.168.1.1") == 0);
+	assert(strcmp(out[0].netmask, "255.255.0.0") == 0);
+	assert(strcmp(out[0].flags_str, "UGS") == 0);
+	assert(strcmp(out[4].gateway, "192.168.1.2") == 0);
+
+	/* Deleting one path keeps the other, and the table order. */
+	r = route(2, 1, 1);
+	assert(net_routes_apply(NET_ROUTE_DELETE, &r) == 1);
+	assert(net_routes_apply(NET_ROUTE_DELETE, &r) == 0);
+	assert(net_routes_copy(out, 8) == 4);
+	assert(strcmp(out[2].destination, "10.3.0.0") == 0);
+	assert(strcmp(out[3].destination, "10.2.0.0") == 0);
+
+	/* A change finds the route by key when the gateway moved. */
+	r = route(3, 9, 2);
+	assert(net_routes_apply(NET_ROUTE_CHANGE, &r) == 1);
+	assert(net_routes_count() == 4);
+	assert(net_routes_copy(out, 8) == 4);
+	assert(strcmp(out[2].gateway, "192.168.1.9") == 0);
+
+	/* Link down on interface 1 clears RTF_UP there only. */
+	net_routes_link(1, 0);
+	assert(net_routes_copy(out, 8) == 4);
+	assert(strcmp(out[0].flags_str, "GS") == 0);
+	assert(strcmp(out[2].flags_str, "UGS") == 0);
+	net_routes_link(1, 1);
+	assert(net_routes_copy(out, 8) == 4);
+	assert(strcmp(out[0].flags_str, "UGS") == 0);
+
+	/* Interface 1 departs: only the route through 2 is left. */
+	net_routes_forget_if(1);
+	assert(net_routes_count() == 1);
+	assert(net_routes_copy(out, 8) == 1);
+	assert(strcmp(out[0].destination, "10.3.0.0") == 0);
+
+	/* Freed slots are reused; a large table rehashes. */
+	for (int i = 0; i < 2000; i++) {
+		r = route((uint8_t)i, (uint8_t)(i >> 8), 3);
+		(void)net_routes_apply(NET_ROUTE_ADD, &r);
+	}
+	assert(net_routes_count() == 2001);
+	assert(net_routes_copy(out, 2) == 2);
+	assert(strcmp(out[1].destination, "10.0.0.0") == 0);
+
+	net_routes_reset();
+	assert(net_routes_count() == 0 && net_routes_copy(out, 8) == 0);
+	r = route(7, 1, 1);
+	assert(net_routes_apply(NET_ROUTE_ADD, &r) == 1);
+	assert(net_routes_copy(out, 8) == 1);
+
+	net_routes_cleanup();
+	assert(net_routes_count() == 0);
+	puts("networking_routes_test: ok");
+	return 0;
+}
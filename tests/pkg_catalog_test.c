@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/modules/packages/pkg_internal.h"
+
+#define DB "/tmp/pkg_catalog_test.db"
+
+static char found[1024];
+
+/** Search callback: collect names as "a b c". */
+static int
+collect(const char *name, void *ctx)
+{
+	(void)ctx;
+	if (found[0] != '\0')
+		strlcat(found, " ", sizeof(found));
+	strlcat(found, name, sizeof(found));
+	return 0;
+}
+
+/** Search for @p q; the names found end up in found[]. */
+static int
+search(const char *q)
+{
+	found[0] = '\0';
+	return pkg_catalog_search(q, collect, NULL);
+}
+
+int
+main(void)
+{
+	pkg_db_pkg_t curl = {.name = "curl-8.4.0", .comment = "HTTP client"};
+	pkg_db_pkg_t *pkgs[] = {&curl};
+	pkg_db_t installed = {.pkgs = pkgs, .count = 1};
+
+	(void)unlink(DB);
+	assert(pkg_catalog_open("") != 0);
+	assert(pkg_catalog_open(DB) == 0);
+	/* Nothing stored yet: callers search elsewhere. */
+	assert(search("curl") < 0);
+	assert(pkg_catalog_refreshed() == 0);
+
+	assert(pkg_catalog_load("curl-8.4.0 (installed)\npy3-six-1.16.0\n"
+	    "py3-requests-2.31.0\r\nvim-9.0.2100-no_x11\nnot_a_package\n",
+	    &installed, 1000) == 4);
+	assert(pkg_catalog_refreshed() == 1000);
+
+	/* Substrings of names, ignoring case. */
+	assert(search("SIX") == 1 && strcmp(found, "py3-six-1.16.0") == 0);
+	assert(search("py3-") == 2 &&
+	    strcmp(found, "py3-requests-2.31.0 py3-six-1.16.0") == 0);
+	/* Short queries scan, and see comments too. */
+	assert(search("9.") == 1 && strcmp(found, "vim-9.0.2100-no_x11") == 0);
+	assert(search("client") == 1 && strcmp(found, "curl-8.4.0") == 0);
+	/* Quotes and wildcards are literal. */
+	assert(search("\"") == 0);
+	assert(search("%") == 0);
+	assert(search("six\" OR \"vim") == 0);
+	assert(search("nothing") == 0);
+
+	/* A refresh drops what the mirror no longer offers. */
+	curl.comment = "command line HTTP client";
+	assert(pkg_catalog_load("py3-six-1.16.0\n", &installed, 2000) == 2);
+	assert(search("requests") == 0);
+	assert(search("line") == 1 && strcmp(found, "curl-8.4.0") == 0);
+
+	/* Stored across restarts. */
+	pkg_catalog_cleanup();
+	assert(search("six") < 0);
+	assert(pkg_catalog_open(DB) == 0);
+	assert(pkg_catalog_refreshed() == 2000);
+	assert(search("six") == 1);
+	pkg_catalog_cleanup();
+
+	(void)unlink(DB);
+	puts("pkg_catalog_test: ok");
+	return 0;
+}
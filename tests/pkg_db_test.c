@@ -0,0 +1,158 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "../src/modules/packages/pkg_internal.h"
+
+static char root[] = "/tmp/pkg_db_test.XXXXXX";
+
+/** Write @p body to @p file of package entry @p pkg, creating it. */
+static void
+put(const char *pkg, const char *file, const char *body)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, pkg);
+	(void)mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/%s/%s", root, pkg, file);
+	f = fopen(path, "w");
+	assert(f);
+	fputs(body, f);
+	fclose(f);
+}
+
+/** Give the root a distinct mtime, as pkg_add a second later would. */
+static void
+bump(long sec)
+{
+	struct timeval tv[2] = {{sec, 0}, {sec, 0}};
+
+	assert(utimes(root, tv) == 0);
+}
+
+int
+main(void)
+{
+	const pkg_db_pkg_t *pkg;
+	const char *f;
+	pkg_db_t *db, *again;
+	char cmd[300];
+
+	assert(mkdtemp(root));
+	snprintf(cmd, sizeof(cmd), "%s/missing", root);
+	pkg_db_set_root(cmd);
+	assert(pkg_db_acquire() == NULL);
+	pkg_db_set_root(root);
+
+	put("curl-8.4.0", "+CONTENTS", "@name curl-8.4.0\n@version 3\n"
+	    "@comment pkgpath=net/curl cdrom=yes ftp=yes\n"
+	    "@option manual-installation\n+DESC\n@sha abc\n@size 10\n"
+	    "@depend www/nghttp2:nghttp2-*:nghttp2-1.58.0\n"
+	    "@cwd /usr/local\n@bin bin/curl\n@sha def\n@size 20\n"
+	    "include/curl/\ninclude/curl/curl.h\n@man man/man1/curl.1\n"
+	    "@sample /etc/curlrc\n");
+	put("curl-8.4.0", "+DESC", "transfer files with FTP, HTTP and more\n"
+	    "curl is a \"tool\".\n\nWWW: https://curl.se/\n");
+	put("python-3.11.7p1", "+CONTENTS", "@name python-3.11.7p1\n"
+	    "@comment pkgpath=lang/python/3.11,-main\n@cwd /usr/local\n"
+	    "bin/python3.11\n");
+	put("python-3.11.7p1", "+DESC", "interpreted language\n");
+	put("python-3.11.7p1", "+REQUIRED_BY", "py3-six-1.16.0\n");
+	put("vim-9.0.2100-no_x11", "+CONTENTS", "@name vim-9.0.2100-no_x11\n"
+	    "@option manual-installation\n@cwd /usr/local\nbin/vim\n");
+	/* No packing list: not a package. */
+	put("broken", "+DESC", "half installed\n");
+
+	db = pkg_db_acquire();
+	assert(db && db->count == 3);
+	assert(strcmp(db->pkgs[0]->name, "curl-8.4.0") == 0);
+
+	/* Full names and stems both find a package. */
+	pkg = pkg_db_find(db, "curl");
+	assert(pkg && pkg == pkg_db_find(db, "curl-8.4.0"));
+	assert(pkg_db_find(db, "cur") == NULL);
+	assert(pkg->manual && strcmp(pkg->fuzzy, "curl--") == 0);
+	assert(strcmp(pkg->comment, "transfer files with FTP, HTTP and more") ==
+	    0);
+	assert(strncmp(pkg->desc, "curl is a \"tool\".", 17) == 0);
+	assert(pkg->required_by[0] == '\0');
+
+	/* Files only, under @cwd; directories and +DESC are left out. */
+	assert(pkg->nfiles == 4);
+	f = pkg->files;
+	assert(strcmp(f, "/usr/local/bin/curl") == 0);
+	f += strlen(f) + 1;
+	assert(strcmp(f, "/usr/local/include/curl/curl.h") == 0);
+	f += strlen(f) + 1;
+	assert(strcmp(f, "/usr/local/man/man1/curl.1") == 0);
+	f += strlen(f) + 1;
+	assert(strcmp(f, "/etc/curlrc") == 0);
+	f += strlen(f) + 1;
+	assert(*f == '\0');
+
+	/* Fuzzy names keep the flavor and the pkgpath branch. */
+	pkg = pkg_db_find(db, "python");
+	assert(pkg && !pkg->manual && strcmp(pkg->fuzzy, "python--%3.11") == 0);
+	assert(strcmp(pkg->required_by, "py3-six-1.16.0\n") == 0);
+	pkg = pkg_db_find(db, "vim");
+	assert(pkg && strcmp(pkg->fuzzy, "vim--no_x11") == 0);
+
+	/* Which package owns a file: one table lookup. */
+	assert(pkg_db_which(db, "/usr/local/bin/curl") == pkg_db_find(db, "curl"));
+	assert(pkg_db_which(db, "/etc/curlrc") == pkg_db_find(db, "curl"));
+	assert(pkg_db_which(db, "/usr/local/bin/vim") == pkg_db_find(db, "vim"));
+	assert(pkg_db_which(db, "/usr/local/include/curl/") == NULL);
+	assert(pkg_db_which(db, "/usr/local/bin/nothing") == NULL);
+
+	/* Unchanged database: the same snapshot. */
+	again = pkg_db_acquire();
+	assert(again == db);
+	pkg_db_release(again);
+
+	/* pkg_delete moved the root's mtime: read again, old stays valid. */
+	snprintf(cmd, sizeof(cmd), "rm -rf %s/vim-9.0.2100-no_x11", root);
+	assert(system(cmd) == 0);
+	bump(1000000000);
+	again = pkg_db_acquire();
+	assert(again && again != db && again->count == 2);
+	assert(pkg_db_find(again, "vim") == NULL);
+	assert(pkg_db_which(again, "/usr/local/bin/vim") == NULL);
+	/* Unchanged packages are shared, not parsed again. */
+	assert(pkg_db_find(again, "curl") == pkg_db_find(db, "curl"));
+	assert(pkg_db_which(again, "/usr/local/bin/curl") ==
+	    pkg_db_find(db, "curl"));
+	assert(strcmp(pkg_db_find(db, "vim")->name, "vim-9.0.2100-no_x11") == 0);
+	pkg_db_release(again);
+	pkg_db_release(db);
+
+	/* A dependent package installed: only python is read again. */
+	db = pkg_db_acquire();
+	pkg = pkg_db_find(db, "python");
+	put("python-3.11.7p1", "+REQUIRED_BY", "py3-six-1.16.0\nx-1.0\n");
+	{
+		char req[256];
+		struct timeval tv[2] = {{1000000100, 0}, {1000000100, 0}};
+
+		snprintf(req, sizeof(req), "%s/python-3.11.7p1/+REQUIRED_BY",
+		    root);
+		assert(utimes(req, tv) == 0);
+	}
+	bump(1000000200);
+	again = pkg_db_acquire();
+	assert(pkg_db_find(again, "python") != pkg);
+	assert(strcmp(pkg_db_find(again, "python")->required_by,
+	    "py3-six-1.16.0\nx-1.0\n") == 0);
+	assert(pkg_db_find(again, "curl") == pkg_db_find(db, "curl"));
+	pkg_db_release(again);
+	pkg_db_release(db);
+
+	pkg_db_cleanup();
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+	assert(system(cmd) == 0);
+	puts("pkg_db_test: ok");
+	return 0;
+}
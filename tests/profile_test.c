@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/core/profile.h>
+
+static volatile unsigned long sink;
+
+/** Burn about @p ms of CPU time, so ITIMER_PROF has something to count. */
+void
+profile_test_spin(long ms)
+{
+	clock_t end = clock() + (clock_t)(ms * (CLOCKS_PER_SEC / 1000));
+
+	while (clock() < end)
+		for (int i = 0; i < 1000; i++)
+			sink += (unsigned long)i * 2654435761u;
+}
+
+/** Every line is "frame[;frame...] count"; returns the sum of counts. */
+static unsigned long
+check_folded(const char *text, size_t len, const char *want)
+{
+	unsigned long total = 0;
+	int found = want == NULL;
+
+	assert(strlen(text) == len);
+	for (const char *p = text; *p; ) {
+		const char *nl = strchr(p, '\n'), *sp;
+
+		assert(nl != NULL);
+		sp = nl;
+		while (sp > p && sp[-1] != ' ')
+			sp--;
+		assert(sp > p + 1 && sp < nl);
+		total += strtoul(sp, NULL, 10);
+		if (want && memchr(p, want[0], (size_t)(sp - p)) &&
+		    strstr(p, want) != NULL && strstr(p, want) < sp)
+			found = 1;
+		p = nl + 1;
+	}
+	assert(found);
+	return total;
+}
+
+int
+main(void)
+{
+	unsigned long samples;
+	size_t len;
+	char *text;
+
+	assert(profile_hz() == 0);
+	text = profile_folded(0, &len);
+	assert(text != NULL && len == 0);
+	free(text);
+
+	assert(profile_enable(5000) == 0);
+	assert(profile_hz() == PROFILE_HZ_MAX);
+	profile_test_spin(300);
+	assert(profile_enable(0) == 0);
+	assert(profile_hz() == 0);
+	samples = profile_samples();
+	assert(samples > 0);
+
+	/* Stopped: the ring keeps its samples until the next start. */
+	text = profile_folded(0, &len);
+	assert(text != NULL && len > 0);
+	assert(check_folded(text, len, NULL) ==
+	    (samples < PROFILE_SAMPLES ? samples : PROFILE_SAMPLES));
+	free(text);
+	text = profile_folded(1, &len);
+	assert(text != NULL && len > 0);
+	check_folded(text, len, "+0x");
+	free(text);
+
+	/* Starting again clears it. */
+	assert(profile_enable(100) == 0);
+	assert(profile_samples() < samples || samples < 3);
+	assert(profile_enable(0) == 0);
+
+	profile_cleanup();
+	assert(profile_hz() == 0);
+	text = profile_folded(0, &len);
+	assert(text != NULL && len == 0);
+	free(text);
+	puts("profile_test: ok");
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include <miniweb/core/counters.h>
+#include <miniweb/net/rate_limit.h>
+
+static uint64_t
+limited(counter_id_t id)
+{
+	uint64_t v[CTR_COUNT];
+
+	counters_read(v);
+	return v[id];
+}
+
+int
+main(void)
+{
+	uint64_t t = 5000, n;
+	char name[32];
+	int rc;
+
+	/* Off until configured. */
+	assert(!rate_limit_enabled(ROUTE_CLASS_SLOW));
+	for (int i = 0; i < 100; i++)
+		assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t) == 0);
+
+	/* One a second, three at once. */
+	rate_limit_configure(ROUTE_CLASS_SLOW, 60, 3);
+	assert(rate_limit_enabled(ROUTE_CLASS_SLOW));
+	assert(!rate_limit_enabled(ROUTE_CLASS_FAST));
+	for (int i = 0; i < 3; i++)
+		assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t) == 0);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t) == 1);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t + 500) == 1);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t + 1000) == 0);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.1", t + 1000) == 1);
+	assert(limited(CTR_RATE_LIMITED_SLOW) == 3);
+
+	/* Other clients and the other class have buckets of their own. */
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.2", t) == 0);
+	assert(rate_limit_take(ROUTE_CLASS_FAST, "10.0.0.1", t) == 0);
+
+	/* A slow rate still refills under frequent looks. */
+	rate_limit_configure(ROUTE_CLASS_SLOW, 1, 1);
+	t = 100000;
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.3", t) == 0);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.3", t) == 60);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.3", t + 30000) == 30);
+	n = limited(CTR_RATE_LIMITED_SLOW);
+	for (uint64_t ms = 30010; ms < 60000; ms += 10)
+		assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.3", t + ms) > 0);
+	assert(limited(CTR_RATE_LIMITED_SLOW) == n + 2999);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.3", t + 60000) == 0);
+
+	/* A lower burst caps the tokens a bucket already holds. */
+	rate_limit_configure(ROUTE_CLASS_SLOW, 60, 5);
+	t = 500000;
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.4", t) == 0);
+	rate_limit_configure(ROUTE_CLASS_SLOW, 60, 1);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.4", t) == 0);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, "10.0.0.4", t) == 1);
+
+	/* More clients than slots: newcomers get a full bucket. */
+	rate_limit_configure(ROUTE_CLASS_SLOW, 1, 1);
+	for (int i = 0; i < 4 * RATE_LIMIT_SHARDS * RATE_LIMIT_SLOTS; i++) {
+		snprintf(name, sizeof(name), "192.0.%d.%d", i / 256, i % 256);
+		assert(rate_limit_take(ROUTE_CLASS_SLOW, name, t) == 0);
+	}
+	rc = rate_limit_take(ROUTE_CLASS_SLOW, name, t);
+	assert(rc == 60);
+
+	/* Off again: everything passes. */
+	rate_limit_configure(ROUTE_CLASS_SLOW, 0, 1);
+	assert(rate_limit_take(ROUTE_CLASS_SLOW, name, t) == 0);
+
+	printf("rate_limit_test: ok\n");
+	return 0;
+}
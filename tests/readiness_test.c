@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/readiness.h>
+
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open;
+
+/* A warm-up task that holds until the test lets it finish. */
+static int
+slow_task(void *arg)
+{
+	pthread_mutex_lock(&gate_lock);
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	pthread_mutex_unlock(&gate_lock);
+	return *(int *)arg;
+}
+
+static int
+quick_task(void *arg)
+{
+	(void)arg;
+	return 0;
+}
+
+int
+main(void)
+{
+	struct readiness_task t[READINESS_MAX];
+	int fails = -1;
+	char name[16];
+
+	/* Not ready before the list is sealed, even with nothing pending. */
+	assert(!readiness_ready() && readiness_ms() == 0);
+	assert(readiness_expect("index") == 0);
+	assert(readiness_expect("index") == 0);
+	assert(readiness_run("templates", slow_task, &fails) == 0);
+	assert(readiness_run("ring", quick_task, NULL) == 0);
+	assert(readiness_wait("ring") == 0);
+	assert(readiness_wait("missing") == -1);
+	readiness_seal();
+	assert(!readiness_ready());
+
+	/* A second report and unknown names change nothing. */
+	readiness_done("index");
+	readiness_done("index");
+	readiness_done("unknown");
+	assert(!readiness_ready());
+	assert(readiness_list(t, READINESS_MAX) == 3);
+	assert(strcmp(t[0].name, "index") == 0 && t[0].done);
+	assert(strcmp(t[1].name, "templates") == 0 && !t[1].done);
+
+	/* The last task flips it, and a failure is kept for its waiter. */
+	pthread_mutex_lock(&gate_lock);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+	assert(readiness_wait("templates") == -1);
+	assert(readiness_ready());
+	assert(readiness_list(t, 2) == 2 && t[1].done && t[1].rc == -1);
+
+	/* Reset: expected again from scratch; the table is bounded. */
+	readiness_reset();
+	assert(!readiness_ready() && readiness_list(t, READINESS_MAX) == 0);
+	for (int i = 0; i < READINESS_MAX; i++) {
+		snprintf(name, sizeof(name), "task%d", i);
+		assert(readiness_expect(name) == 0);
+	}
+	assert(readiness_expect("one-more") == -1);
+	for (int i = 0; i < READINESS_MAX; i++) {
+		snprintf(name, sizeof(name), "task%d", i);
+		readiness_done(name);
+	}
+	assert(!readiness_ready());
+	readiness_seal();
+	assert(readiness_ready());
+
+	printf("readiness_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,42 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/http/arena.h>
+
+int
+main(void)
+{
+	http_arena_t a = {0};
+
+	char *s = http_arena_strdup(&a, "hello");
+	assert(s && strcmp(s, "hello") == 0);
+	void *p = http_arena_alloc(&a, 3);
+	assert(p && ((uintptr_t)p % 16) == 0);
+	assert(a.head && a.head->next == NULL);
+
+	/* A payload larger than a chunk gets its own, freed on reset. */
+	char *big = http_arena_alloc(&a, HTTP_ARENA_CHUNK * 2);
+	assert(big && a.head->next != NULL);
+	memset(big, 'x', HTTP_ARENA_CHUNK * 2);
+	assert(strcmp(s, "hello") == 0);
+
+	http_arena_chunk_t *first = a.head->next;
+	http_arena_reset(&a);
+	assert(a.head == first && a.head->used == 0 && a.bytes == 0);
+	assert(a.peak > HTTP_ARENA_CHUNK * 2);
+
+	char *t = http_arena_strndup(&a, "abcdef", 3);
+	assert(t == s && strcmp(t, "abc") == 0);
+
+	assert(http_arena_alloc(NULL, 8) == NULL);
+	http_arena_destroy(&a);
+	assert(a.head == NULL);
+
+	http_arena_t *mine = http_arena_thread();
+	assert(mine && mine == http_arena_thread());
+
+	puts("request_arena_test: ok");
+	return 0;
+}
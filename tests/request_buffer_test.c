@@ -0,0 +1,38 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/net/request_buffer.h>
+
+int
+main(void)
+{
+	size_t cap = 0;
+	char *small = miniweb_reqbuf_get(100, &cap);
+	assert(small && cap == MINIWEB_REQBUF_SMALL);
+	assert(miniweb_reqbuf_in_use() == MINIWEB_REQBUF_SMALL);
+
+	memset(small, 'x', cap);
+	char *grown = miniweb_reqbuf_grow(small, cap, &cap);
+	assert(grown && cap == MINIWEB_REQBUF_MEDIUM);
+	for (size_t i = 0; i < MINIWEB_REQBUF_SMALL; i++)
+		assert(grown[i] == 'x');
+	assert(miniweb_reqbuf_in_use() == MINIWEB_REQBUF_MEDIUM);
+
+	grown = miniweb_reqbuf_grow(grown, MINIWEB_REQBUF_SMALL, &cap);
+	assert(grown && cap == MINIWEB_REQBUF_LARGE);
+	assert(miniweb_reqbuf_grow(grown, cap, &cap) == NULL);
+	assert(cap == MINIWEB_REQBUF_LARGE);
+	assert(miniweb_reqbuf_get(MINIWEB_REQBUF_LARGE + 1, &cap) == NULL);
+
+	/* Released buffers are recycled by their class. */
+	miniweb_reqbuf_put(grown, MINIWEB_REQBUF_LARGE);
+	assert(miniweb_reqbuf_in_use() == 0);
+	char *again = miniweb_reqbuf_get(MINIWEB_REQBUF_LARGE, &cap);
+	assert(again == grown);
+	miniweb_reqbuf_put(again, cap);
+
+	miniweb_reqbuf_cleanup();
+	puts("request_buffer_test: ok");
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/http/request_parser.h>
+
+/**
+ * @brief Compare a parsed span against an expected literal.
+ *
+ * @param buf Request buffer the offsets refer to.
+ * @param off Span offset.
+ * @param len Span length.
+ * @param want Expected text.
+ *
+ * @return int 1 when equal, else 0.
+ */
+static int
+span_is(const char *buf, size_t off, size_t len, const char *want)
+{
+	return strlen(want) == len && memcmp(buf + off, want, len) == 0;
+}
+
+/**
+ * @brief Feed a request one byte at a time and check every recorded span.
+ *
+ * @return 0 on success; assertion failure otherwise.
+ */
+int
+main(void)
+{
+	static const char req[] =
+	    "GET /api/metrics?x=1 HTTP/1.1\r\n"
+	    "Host: localhost\r\n"
+	    "X-Forwarded-For:  10.0.0.1 \r\n"
+	    "Connection: close\r\n"
+	    "\r\n"
+	    "GET /next HTTP/1.1\r\n";
+	http_request_parser_t p;
+	size_t head_len = strlen(req) - strlen("GET /next HTTP/1.1\r\n");
+	int rc = 0;
+
+	http_request_parser_reset(&p);
+	for (size_t len = 1; len <= strlen(req) && rc == 0; len++) {
+		rc = http_request_parser_feed(&p, req, len);
+		assert(rc >= 0);
+		assert(rc == 1 || p.pos == len);
+	}
+	assert(rc == 1);
+	assert(p.head_len == head_len);
+	assert(span_is(req, p.method_off, p.method_len, "GET"));
+	assert(span_is(req, p.url_off, p.url_len, "/api/metrics?x=1"));
+	assert(span_is(req, p.version_off, p.version_len, "HTTP/1.1"));
+	assert(p.method == HTTP_METHOD_GET);
+	assert(p.version == HTTP_VERSION_1_1);
+	assert(span_is(req, p.url_off, p.path_len, "/api/metrics"));
+	assert(p.header_count == 3);
+	assert(span_is(req, p.headers[1].name_off, p.headers[1].name_len,
+	    "X-Forwarded-For"));
+	assert(span_is(req, p.headers[1].value_off, p.headers[1].value_len,
+	    "10.0.0.1"));
+	assert(http_request_parser_keep_alive(&p, req) == 0);
+
+	static const char http10[] = "GET / HTTP/1.0\r\n\r\n";
+	http_request_parser_reset(&p);
+	assert(http_request_parser_feed(&p, http10, strlen(http10)) == 1);
+	assert(http_request_parser_keep_alive(&p, http10) == 0);
+	assert(p.version == HTTP_VERSION_1_0 && p.path_len == p.url_len);
+
+	static const char other[] = "BREW /pot HTTP/2.0\r\n\r\n";
+	http_request_parser_reset(&p);
+	assert(http_request_parser_feed(&p, other, strlen(other)) == 1);
+	assert(p.method == HTTP_METHOD_OTHER && p.version == HTTP_VERSION_OTHER);
+	assert(http_method_parse("get", 3) == HTTP_METHOD_OTHER);
+	assert(strcmp(http_method_name(HTTP_METHOD_HEAD), "HEAD") == 0);
+
+	/* Body framing: a length, agreeing repeats, then everything else. */
+	static const char post[] = "POST /p HTTP/1.1\r\nContent-Length: 5\r\n"
+	    "content-length: 5\r\n\r\nGET /";
+	http_request_parser_reset(&p);
+	assert(http_request_parser_feed(&p, post, strlen(post)) == 1);
+	assert(p.body == HTTP_BODY_LENGTH && p.content_length == 5);
+	assert(p.head_len == strlen(post) - 5);
+	static const char *const framings[] = {
+		"Content-Length: 5\r\nContent-Length: 6\r\n",
+		"Content-Length: 5x\r\n",
+		"Content-Length: -1\r\n",
+		"Content-Length:\r\n",
+		"Content-Length: 99999999999999999999\r\n",
+		"Transfer-Encoding: chunked\r\nContent-Length: 5\r\n",
+		"Content-Length: 5\r\nTransfer-Encoding: chunked\r\n",
+	};
+	for (size_t i = 0; i < sizeof(framings) / sizeof(framings[0]); i++) {
+		char buf[256];
+
+		snprintf(buf, sizeof(buf), "POST /p HTTP/1.1\r\n%s\r\n",
+		    framings[i]);
+		http_request_parser_reset(&p);
+		assert(http_request_parser_feed(&p, buf, strlen(buf)) == 1);
+		assert(p.body == (i < 5 ? HTTP_BODY_INVALID :
+		    HTTP_BODY_CHUNKED));
+	}
+	http_request_parser_reset(&p);
+	assert(http_request_parser_feed(&p, http10, strlen(http10)) == 1);
+	assert(p.body == HTTP_BODY_NONE && p.content_length == 0);
+
+	static const char bad[] = "GARBAGE\r\n\r\n";
+	http_request_parser_reset(&p);
+	assert(http_request_parser_feed(&p, bad, strlen(bad)) == -1);
+
+	puts("request_parser_test: ok");
+	return 0;
+}
@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <miniweb/http/file_map.h>
+#include <miniweb/http/output.h>
+
+#define PAYLOAD_LEN (1024 * 1024)
+
+/**
+ * @brief Read everything available from @p fd into @p dst.
+ *
+ * @return Number of bytes read before the peer would block.
+ */
+static size_t
+drain(int fd, char *dst, size_t cap)
+{
+	size_t got = 0;
+	ssize_t n;
+	while (got < cap && (n = read(fd, dst + got, cap - got)) > 0)
+		got += (size_t)n;
+	return got;
+}
+
+/**
+ * @brief Queue more than the socket buffer accepts and flush it to completion.
+ */
+static void
+test_writev_queues_remainder(void)
+{
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	assert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+	char *payload = malloc(PAYLOAD_LEN);
+	char *seen = malloc(PAYLOAD_LEN + 16);
+	assert(payload && seen);
+	for (size_t i = 0; i < PAYLOAD_LEN; i++)
+		payload[i] = (char)('a' + i % 26);
+
+	http_output_t out;
+	memset(&out, 0, sizeof(out));
+	struct iovec iov[2];
+	iov[0].iov_base = "HEAD";
+	iov[0].iov_len = 4;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = PAYLOAD_LEN;
+	assert(http_output_writev(&out, sv[0], iov, 2) == 0);
+	assert(http_output_pending(&out));
+
+	size_t got = 0;
+	int rc;
+	do {
+		got += drain(sv[1], seen + got, PAYLOAD_LEN + 16 - got);
+		rc = http_output_flush(&out, sv[0]);
+		assert(rc >= 0);
+	} while (rc == 0);
+	got += drain(sv[1], seen + got, PAYLOAD_LEN + 16 - got);
+
+	assert(!http_output_pending(&out));
+	assert(got == PAYLOAD_LEN + 4);
+	assert(memcmp(seen, "HEAD", 4) == 0);
+	assert(memcmp(seen + 4, payload, PAYLOAD_LEN) == 0);
+
+	http_output_reset(&out);
+	free(payload);
+	free(seen);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/**
+ * @brief Stream a queued file tail behind already-queued header bytes.
+ */
+static void
+test_file_tail(void)
+{
+	char path[] = "/tmp/miniweb_output_XXXXXX";
+	int ffd = mkstemp(path);
+	assert(ffd >= 0);
+	unlink(path);
+	for (int i = 0; i < 5000; i++)
+		assert(write(ffd, "0123456789", 10) == 10);
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	assert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+	http_output_t out;
+	memset(&out, 0, sizeof(out));
+	assert(http_output_queue_file(&out, ffd, 10, 49990) == 0);
+
+	char seen[50000];
+	size_t got = 0;
+	int rc;
+	do {
+		rc = http_output_flush(&out, sv[0]);
+		assert(rc >= 0);
+		got += drain(sv[1], seen + got, sizeof(seen) - got);
+	} while (rc == 0);
+	got += drain(sv[1], seen + got, sizeof(seen) - got);
+
+	assert(got == 49990);
+	assert(memcmp(seen, "0123456789", 10) == 0);
+	assert(!http_output_pending(&out));
+	http_output_reset(&out);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/**
+ * @brief Send headers and a mapped file in one stream; reuse the mapping.
+ */
+static void
+test_mapped_file(void)
+{
+	char path[] = "/tmp/miniweb_output_XXXXXX";
+	int ffd = mkstemp(path);
+	assert(ffd >= 0);
+	for (int i = 0; i < 60000; i++)
+		assert(write(ffd, "0123456789", 10) == 10);
+	struct stat st;
+	assert(fstat(ffd, &st) == 0);
+
+	http_file_map_t *m = http_file_map_acquire(path, ffd, &st);
+	assert(m && m->len == 600000 && m->refs == 1);
+	http_file_map_t *again = http_file_map_acquire(path, ffd, &st);
+	assert(again == m && m->refs == 2);
+	http_file_map_release(again);
+	close(ffd);
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	assert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+	http_output_t out;
+	memset(&out, 0, sizeof(out));
+	assert(http_output_queue(&out, "HEAD", 4) == 0);
+	assert(http_output_queue_map(&out, m, 0, m->len) == 0);
+	assert(http_output_pending(&out));
+
+	char *seen = malloc(600004);
+	assert(seen);
+	size_t got = 0;
+	int rc;
+	do {
+		rc = http_output_flush(&out, sv[0]);
+		assert(rc >= 0);
+		got += drain(sv[1], seen + got, 600004 - got);
+	} while (rc == 0);
+	got += drain(sv[1], seen + got, 600004 - got);
+
+	assert(got == 600004);
+	assert(memcmp(seen, "HEAD0123456789", 14) == 0);
+	assert(memcmp(seen + 599994, "0123456789", 10) == 0);
+	assert(!http_output_pending(&out) && out.map == NULL);
+	assert(m->refs == 0 && m->cached);
+
+	http_output_reset(&out);
+	http_file_map_cleanup();
+	unlink(path);
+	free(seen);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/**
+ * @brief A client that reads nothing cannot make a queue grow past the
+ * cap, and what the queues hold is accounted for.
+ */
+static void
+test_queue_cap(void)
+{
+	http_output_t out;
+	char *chunk = calloc(1, PAYLOAD_LEN);
+	size_t queued = 0;
+
+	assert(chunk);
+	memset(&out, 0, sizeof(out));
+	assert(http_output_held() == 0);
+	while (queued + PAYLOAD_LEN <= HTTP_OUTPUT_QUEUED_MAX) {
+		assert(http_output_queue(&out, chunk, PAYLOAD_LEN) == 0);
+		queued += PAYLOAD_LEN;
+	}
+	assert(http_output_queue(&out, chunk, PAYLOAD_LEN) == -1);
+	assert(out.len == queued);
+	assert(http_output_held() == out.cap);
+	http_output_reset(&out);
+	assert(http_output_held() == 0);
+	free(chunk);
+}
+
+int
+main(void)
+{
+	test_queue_cap();
+	test_writev_queues_remainder();
+	test_file_tail();
+	test_mapped_file();
+	puts("response_output_test: ok");
+	return 0;
+}
@@ -1,9 +1,23 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <miniweb/core/cache_admin.h>
 #include <miniweb/core/config.h>
 #include <miniweb/core/conf.h>
+#include <miniweb/http/bundle.h>
+#include <miniweb/http/gzip.h>
+#include <miniweb/http/handler.h>
+#include <miniweb/http/response_internal.h>
+#include <miniweb/http/utils.h>
+#include <miniweb/net/health.h>
+#include <miniweb/render/template_engine.h>
+#include <miniweb/router/response_cache.h>
+#include <miniweb/router/route_stats.h>
 #include <miniweb/router/routes.h>
 #include <miniweb/router/urls.h>
 
@@ -12,6 +26,18 @@ char config_static_dir[] = "static";
 char config_templates_dir[] = "templates";
 int config_autoindex = 0;
 miniweb_conf_t config = {0};
+extern int pkg_api_calls;
+
+static int stats_route_id;
+
+/** Record one request on a thread that exits before the stats are read. */
+static void *
+stats_thread(void *arg)
+{
+	(void)arg;
+	route_stats_record(stats_route_id, 200, 1000, 3);
+	return NULL;
+}
 
 /**
  * @brief TODO: Describe main.
@@ -23,8 +49,13 @@ miniweb_conf_t config = {0};
  */
 int main(void)
 {
+	assert(health_configure("/health") == 0);
 	init_routes(NULL);
 
+	/* health_path, when the dispatcher leaves a check to a worker. */
+	assert(route_match("GET",  "/health")         != NULL);
+	assert(route_match("HEAD", "/health")         != NULL);
+
 	/* Exact routes registered in init_routes() */
 	assert(route_match("GET",  "/")               != NULL);
 	assert(route_match("GET",  "/docs")           != NULL);
@@ -58,6 +89,478 @@ int main(void)
 	assert(route_path_known("/missing")      == 0);
 	assert(route_match("GET",  "/missing") == NULL);
 	assert(route_match("GET",  "/man/x")   == NULL);
+	assert(route_match("GET",  "/api/metricsx") == NULL);
+	assert(route_match("GET",  "/docs?x=1") != NULL);
+	assert(route_lookup(HTTP_METHOD_GET, "/docs?x=1", 5, NULL, NULL) != NULL);
+	assert(route_lookup(HTTP_METHOD_GET, "/docs?x=1", 4, NULL, NULL) == NULL);
+	assert(route_lookup(HTTP_METHOD_HEAD, "/docs", 5, NULL, NULL) == NULL);
+	assert(route_path_known("/docs?x=1")   == 1);
+	http_request_t qreq = {.method = "GET", .url = "/api/packages/list?page=2"};
+	assert(http_request_method(&qreq) == HTTP_METHOD_GET);
+	assert(http_request_path_len(&qreq) == strlen("/api/packages/list"));
+	assert(strcmp(http_request_query(&qreq), "page=2") == 0);
+	qreq.url = "/docs";
+	assert(http_request_query(&qreq) == NULL);
+	assert(route_match("GET",  "/stat")    == NULL);
+	assert(route_path_known("/man/x")      == 0);
+	assert(route_path_known("/static")     == 0);
+	assert(route_allow_methods("/static/a.css", allow, sizeof(allow)) == 1);
+	assert(strcmp(allow, "GET") == 0);
+
+	/* Route classes pick the work-queue lane */
+	route_class_t cls = ROUTE_CLASS_SLOW;
+	assert(route_match_class("GET", "/static/js/app.js", &cls) != NULL);
+	assert(cls == ROUTE_CLASS_FAST);
+	assert(route_match_class("GET", "/man/system/1/ls", &cls) != NULL);
+	assert(cls == ROUTE_CLASS_SLOW);
+	assert(route_match_class("GET", "/missing", &cls) == NULL);
+	assert(cls == ROUTE_CLASS_FAST);
+
+	/* Conditional GET validators */
+	const char *inm = "GET / HTTP/1.1\r\n"
+	    "If-None-Match: W/\"t1\", \"t2\"\r\n\r\n";
+	http_request_t creq = {.method = "GET", .buffer = inm,
+	    .buffer_len = strlen(inm)};
+	assert(http_request_not_modified(&creq, "\"t1\"", 0) == 1);
+	assert(http_request_not_modified(&creq, "\"t2\"", 0) == 1);
+	assert(http_request_not_modified(&creq, "\"t3\"", 784111777) == 0);
+	const char *ims = "GET / HTTP/1.1\r\n"
+	    "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n";
+	creq.buffer = ims;
+	creq.buffer_len = strlen(ims);
+	assert(http_request_not_modified(&creq, "\"t1\"", 784111777) == 1);
+	assert(http_request_not_modified(&creq, "\"t1\"", 784111778) == 0);
+	assert(http_request_not_modified(&creq, "\"t1\"", 0) == 0);
+	char date[HTTP_DATE_MAX];
+	http_format_date(784111777, date, sizeof(date));
+	assert(strcmp(date, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+
+	/* Accept-Encoding negotiation */
+	const char *ae = "GET / HTTP/1.1\r\n"
+	    "Accept-Encoding: deflate, GZIP;q=0.5, br;q=0\r\n\r\n";
+	creq.buffer = ae;
+	creq.buffer_len = strlen(ae);
+	assert(http_request_accepts_encoding(&creq, "gzip") == 1);
+	assert(http_request_accepts_encoding(&creq, "br") == 0);
+	assert(http_request_accepts_encoding(&creq, "zstd") == 0);
+	ae = "GET / HTTP/1.1\r\nAccept-Encoding: *, gzip;q=0\r\n\r\n";
+	creq.buffer = ae;
+	creq.buffer_len = strlen(ae);
+	assert(http_request_accepts_encoding(&creq, "gzip") == 0);
+	assert(http_request_accepts_encoding(&creq, "br") == 1);
+	assert(mime_type_is_compressible(mime_type_for_path("a.css")) == 1);
+	assert(mime_type_is_compressible(mime_type_for_path("a.png")) == 0);
+
+	/* Header index: built on first lookup, rebuilt for a new buffer */
+	const char *hx = "GET / HTTP/1.1\r\nHost: a\r\n"
+	    "x-forwarded-proto: https\r\n\r\n";
+	creq.buffer = hx;
+	creq.buffer_len = strlen(hx);
+	assert(strcmp(http_request_get_header(&creq, "X-Forwarded-Proto"),
+	    "https") == 0);
+	assert(creq.hdr_index_of == hx && creq.header_count == 2);
+	assert(http_request_get_header(&creq, "X-Forwarded") == NULL);
+	assert(strcmp(http_request_get_header(&creq, "HOST"), "a") == 0);
+
+	/* gzip content-coding for generated JSON */
+	static char big[4096];
+	memset(big, 'a', sizeof(big) - 1);
+	big[0] = '[';
+	big[sizeof(big) - 2] = ']';
+	ae = "GET / HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n";
+	creq.buffer = ae;
+	creq.buffer_len = strlen(ae);
+	http_response_t *gresp = http_response_create();
+	assert(gresp != NULL);
+	gresp->content_type = "application/json";
+	http_response_set_body(gresp, big, strlen(big), 0);
+	assert(http_response_gzip(&creq, gresp) == 1);
+	assert(gresp->body_len < strlen(big));
+	assert((unsigned char)gresp->body[0] == 0x1f &&
+	    (unsigned char)gresp->body[1] == 0x8b);
+	assert(strstr(gresp->headers, "Content-Encoding: gzip") != NULL);
+	assert(strstr(gresp->headers, "Vary: Accept-Encoding") != NULL);
+	http_response_free(gresp);
+	http_blob_t *gblob = http_gzip_blob(big, strlen(big));
+	assert(gblob != NULL && gblob->len < strlen(big));
+	assert((unsigned char)gblob->data[0] == 0x1f);
+	http_blob_release(gblob);
+
+	/* Byte ranges */
+	size_t roff, rlen;
+	const char *rg = "GET / HTTP/1.1\r\nRange: bytes=10-19\r\n\r\n";
+	creq.buffer = rg;
+	creq.buffer_len = strlen(rg);
+	assert(http_request_range(&creq, 100, NULL, 0, &roff, &rlen) == 1);
+	assert(roff == 10 && rlen == 10);
+	assert(http_request_range(&creq, 15, NULL, 0, &roff, &rlen) == 1);
+	assert(roff == 10 && rlen == 5);
+	assert(http_request_range(&creq, 10, NULL, 0, &roff, &rlen) == -1);
+	rg = "GET / HTTP/1.1\r\nRange: bytes=-30\r\n\r\n";
+	creq.buffer = rg;
+	creq.buffer_len = strlen(rg);
+	assert(http_request_range(&creq, 100, NULL, 0, &roff, &rlen) == 1);
+	assert(roff == 70 && rlen == 30);
+	rg = "GET / HTTP/1.1\r\nRange: bytes=0-1, 5-6\r\n\r\n";
+	creq.buffer = rg;
+	creq.buffer_len = strlen(rg);
+	assert(http_request_range(&creq, 100, NULL, 0, &roff, &rlen) == 0);
+	rg = "GET / HTTP/1.1\r\nRange: bytes=5-\r\n"
+	    "If-Range: \"old\"\r\n\r\n";
+	creq.buffer = rg;
+	creq.buffer_len = strlen(rg);
+	assert(http_request_range(&creq, 100, "\"new\"", 0, &roff,
+	    &rlen) == 0);
+	assert(http_request_range(&creq, 100, "\"old\"", 0, &roff,
+	    &rlen) == 1);
+	assert(roff == 5 && rlen == 95);
+	http_response_t *rresp = http_response_create();
+	assert(rresp != NULL);
+	rresp->content_type = "text/plain";
+	http_response_set_body(rresp, big, 100, 0);
+	assert(http_response_apply_range(&creq, rresp, "\"old\"", 0) == 206);
+	assert(rresp->body == big + 5 && rresp->body_len == 95);
+	assert(strstr(rresp->headers, "Content-Range: bytes 5-99/100") != NULL);
+	http_response_free(rresp);
+
+	/* Head serializer: table status lines, fixed fragments, cached Date */
+	http_response_t *hresp = http_response_create();
+	char hbuf[512];
+	assert(hresp != NULL);
+	http_response_add_header(hresp, "X-Test", "1");
+	int hl = http_response_format_head(hresp, 1, hbuf, sizeof(hbuf));
+	assert(hl > 0);
+	hl += (int)http_response_head_end(hbuf + hl);
+	hbuf[hl] = '\0';
+	const char *want = "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: text/html; charset=utf-8\r\n"
+	    "Content-Length: 0\r\nConnection: keep-alive\r\n"
+	    "Server: MiniWeb/kqueue\r\nX-Test: 1\r\nDate: ";
+	assert(strncmp(hbuf, want, strlen(want)) == 0);
+	assert(strcmp(hbuf + hl - 8, " GMT\r\n\r\n") == 0);
+	hresp->status_code = 599;
+	hl = http_response_format_head(hresp, 0, hbuf, sizeof(hbuf));
+	assert(hl > 0 && strncmp(hbuf, "HTTP/1.1 599 Unknown\r\n", 22) == 0);
+	assert(http_response_format_head(hresp, 0, hbuf, 16) == -1);
+	http_response_free(hresp);
+	/* The thread's free list hands the same object back, reset. */
+	http_response_t *again = http_response_create();
+	assert(again == hresp && again->headers_len == 0 &&
+	    again->headers[0] == '\0' && again->status_code == 200 &&
+	    again->body == NULL);
+	http_response_free(again);
+
+	/* File cache: a one-off scan must not evict a hot entry */
+	http_file_cache_set_budget(FILE_CACHE_SHARDS * 3000);
+	struct stat fst;
+	memset(&fst, 0, sizeof(fst));
+	fst.st_ino = 1;
+	fst.st_mtime = 1;
+	fst.st_size = 2000;
+	http_blob_t *hot = http_blob_alloc(2000);
+	assert(hot != NULL);
+	for (int i = 0; i < 5; i++)
+		assert(http_file_cache_lookup("/hot", &fst, 0) == NULL);
+	http_file_cache_store("/hot", &fst, hot, 0);
+	http_blob_t *hit = http_file_cache_lookup("/hot", &fst, 0);
+	assert(hit == hot);
+	http_blob_release(hit);
+	for (int i = 0; i < 200; i++) {
+		char scan[32];
+		snprintf(scan, sizeof(scan), "/scan%d", i);
+		http_blob_t *one = http_blob_alloc(2000);
+		assert(one != NULL);
+		assert(http_file_cache_lookup(scan, &fst, 0) == NULL);
+		http_file_cache_store(scan, &fst, one, 0);
+		http_blob_release(one);
+	}
+	hit = http_file_cache_lookup("/hot", &fst, 0);
+	assert(hit == hot);
+	http_blob_release(hit);
+	/* Unwatched entries (no such file to watch) are never peeked. */
+	struct stat pst;
+	assert(http_file_cache_peek("/hot", FILE_CACHE_PEEK_ANY, &pst) == NULL);
+	http_file_cache_stats_t fcs;
+	http_file_cache_stats(&fcs);
+	assert(fcs.bytes <= fcs.budget && fcs.rejects > 0);
+	fst.st_mtime = 2;
+	assert(http_file_cache_lookup("/hot", &fst, 0) == NULL);
+	http_blob_release(hot);
+
+	/* Warm-up preload: the first lookup after it is a prepared hit */
+	struct stat tst;
+	assert(stat("static/test.txt", &tst) == 0);
+	assert(http_file_preload("static/test.txt", "text/plain",
+	    NULL) == (long)tst.st_size);
+	hit = http_file_cache_lookup("static/test.txt", &tst, 0);
+	assert(hit != NULL && hit->len == (size_t)tst.st_size);
+	http_blob_release(hit);
+	assert(http_file_preload("static/css", "text/css", NULL) == -1);
+	http_handler_globals_cleanup();
+	http_file_cache_set_budget(FILE_CACHE_BUDGET_BYTES);
+
+	/* Rendered views: one miss per template version, then hits */
+	assert(template_cache_init() == 0);
+	int devnull = open("/dev/null", O_WRONLY);
+	assert(devnull >= 0);
+	const char *vget = "GET /docs HTTP/1.1\r\n\r\n";
+	http_request_t vreq = {.fd = devnull, .method = "GET", .url = "/docs",
+	    .buffer = vget, .buffer_len = strlen(vget)};
+	view_cache_stats_t vs0, vs;
+	view_cache_stats(&vs0);
+	assert(view_template_handler(&vreq) == 0);
+	assert(view_template_handler(&vreq) == 0);
+	view_cache_stats(&vs);
+	assert(vs.misses == vs0.misses + 1 && vs.hits == vs0.hits + 1);
+	assert(vs.entries == 1);
+	close(devnull);
+
+	/* Embedded snapshot: spliced into the cached page, '<' escaped */
+	char vpath[] = "/tmp/routes_test.XXXXXX";
+	int vfd = mkstemp(vpath);
+	assert(vfd >= 0);
+	unlink(vpath);
+	http_request_t dreq = {.fd = vfd, .method = "GET", .url = "/",
+	    .buffer = vget, .buffer_len = strlen(vget)};
+	assert(view_template_handler(&dreq) == 0);
+	assert(view_template_handler(&dreq) == 0);
+	static char vout[256 * 1024];
+	ssize_t vn = pread(vfd, vout, sizeof(vout) - 1, 0);
+	assert(vn > 0 && (size_t)vn < sizeof(vout) - 1);
+	vout[vn] = '\0';
+	const char *embedded = "<script type=\"application/json\" "
+	    "id=\"miniweb-data\">{\"hostname\":\"\\u003c/script>\"}</script>";
+	char *first = strstr(vout, embedded);
+	assert(first && strstr(first + 1, embedded));
+	assert(strstr(vout, "ETag:") == NULL);
+	close(vfd);
+	template_cache_cleanup();
+
+	/* Per-route stats: an exited thread's counts are kept */
+	pthread_t st;
+	char sjson[4096];
+	assert(route_lookup(HTTP_METHOD_GET, "/docs", 5, NULL,
+	    &stats_route_id) != NULL);
+	assert(pthread_create(&st, NULL, stats_thread, NULL) == 0);
+	assert(pthread_join(st, NULL) == 0);
+	route_stats_record(stats_route_id, 200, 1000, 50);
+	route_stats_record(ROUTE_STATS_UNMATCHED, 404, 10, 7);
+	route_stats_append_json(sjson, sizeof(sjson), 1);
+	assert(strstr(sjson, "{\"route\": \"GET /docs\", \"requests\": 2, "
+	    "\"status\": {\"1xx\": 0, \"2xx\": 2, \"3xx\": 0, \"4xx\": 0, "
+	    "\"5xx\": 0}, \"bytes\": 2000, \"mean_us\": 26, \"p50_us\": 3, "
+	    "\"p90_us\": 50, \"p99_us\": 50, \"max_us\": 50, "
+	    "\"histogram\": [[3, 1], [55, 1]]}"));
+	assert(strstr(sjson, "{\"route\": \"unmatched\", \"requests\": 1, "));
+	route_stats_append_json(sjson, 64, 0);
+	assert(strcmp(sjson, "\"routes\": []") == 0);
+
+	/* Streamed bodies: chunked for HTTP/1.1, close-delimited for 1.0 */
+	char spath[] = "/tmp/routes_test.XXXXXX";
+	int sfd = mkstemp(spath);
+	assert(sfd >= 0);
+	unlink(spath);
+	http_request_t sreq = {.fd = sfd, .method = "GET", .url = "/s",
+	    .version = "HTTP/1.1", .keep_alive = 1};
+	http_response_t *sresp = http_response_create();
+	http_stream_t hs;
+	sresp->content_type = "text/plain";
+	assert(http_stream_begin(&hs, &sreq, sresp) == 0);
+	assert(http_stream_write(&hs, "hello, ", 7) == 0);
+	assert(http_stream_write(&hs, "", 0) == 0);
+	static char sbig[40000];
+	memset(sbig, 'x', sizeof(sbig));
+	assert(http_stream_write(&hs, sbig, sizeof(sbig)) == 0);
+	struct iovec sv[HTTP_SEND_IOV_MAX + 1] = {
+		{ .iov_base = "ab", .iov_len = 2 },
+		{ .iov_base = "", .iov_len = 0 },
+		{ .iov_base = "cde", .iov_len = 3 }
+	};
+	assert(http_stream_writev(&hs, sv, 3) == 0);
+	assert(http_stream_writev(&hs, sv + 1, 1) == 0);
+	assert(http_stream_writev(&hs, sv, HTTP_SEND_IOV_MAX + 1) == -1);
+	assert(http_stream_end(&hs) == 0);
+	assert(sreq.keep_alive == 1 && sreq.bytes_out > 40012);
+	static char sout[64 * 1024];
+	ssize_t sn = pread(sfd, sout, sizeof(sout) - 1, 0);
+	assert(sn > 0);
+	sout[sn] = '\0';
+	char *sbody = strstr(sout, "\r\n\r\n");
+	assert(sbody && strstr(sout, "Transfer-Encoding: chunked\r\n"));
+	assert(!strstr(sout, "Content-Length"));
+	sbody += 4;
+	assert(strncmp(sbody, "7\r\nhello, \r\n9c40\r\nxxx", 21) == 0);
+	assert(strcmp(sout + sn - 17, "\r\n5\r\nabcde\r\n0\r\n\r\n") == 0);
+	http_response_free(sresp);
+	assert(ftruncate(sfd, 0) == 0 && lseek(sfd, 0, SEEK_SET) == 0);
+
+	sreq.version = "HTTP/1.0";
+	sreq.bytes_out = 0;
+	sresp = http_response_create();
+	assert(http_stream_begin(&hs, &sreq, sresp) == 0);
+	assert(sreq.keep_alive == 0);
+	assert(http_stream_write(&hs, "raw", 3) == 0);
+	assert(http_stream_end(&hs) == 0);
+	sn = pread(sfd, sout, sizeof(sout) - 1, 0);
+	sout[sn] = '\0';
+	assert(strstr(sout, "Connection: close\r\n"));
+	assert(!strstr(sout, "Transfer-Encoding") && !strstr(sout, "Content-Length"));
+	assert(strcmp(sout + sn - 7, "\r\n\r\nraw") == 0);
+	/* A recycled response goes back to Content-Length */
+	http_response_free(sresp);
+	sresp = http_response_create();
+	assert(sresp->stream == HTTP_STREAM_NONE);
+	http_response_free(sresp);
+	close(sfd);
+
+	/* Subprocess output, piece by piece or buffered */
+	char *const pargv[] = {"sh", "-c", "printf 'a\\nbc'", NULL};
+	size_t plen = 0;
+	char *pout = safe_popen_read_argv("/bin/sh", pargv, 3, 5, &plen);
+	assert(pout && plen == 3 && strcmp(pout, "a\nb") == 0);
+	free(pout);
+	pout = safe_popen_read_argv("/bin/sh", pargv, 64, 5, &plen);
+	assert(pout && plen == 4 && strcmp(pout, "a\nbc") == 0);
+	free(pout);
+
+	/* Response cache: keys sort parameters by name, stably */
+	char ckey[RESPONSE_CACHE_KEY_MAX];
+	assert(response_cache_key("/a?x", 2, "b=2&&a=1&b=1", ckey,
+	    sizeof(ckey)) == 14);
+	assert(strcmp(ckey, "/a?a=1&b=2&b=1") == 0);
+	assert(response_cache_key("/a", 2, NULL, ckey, sizeof(ckey)) == 2);
+	assert(strcmp(ckey, "/a") == 0);
+	assert(response_cache_key("/a", 2, "x=1", ckey, 4) == -1);
+
+	/* One handler run per key until the TTL runs out */
+	char cpath[] = "/tmp/routes_test.XXXXXX";
+	int cfd = mkstemp(cpath);
+	assert(cfd >= 0);
+	unlink(cpath);
+	int crid;
+	http_handler_t ch = route_lookup(HTTP_METHOD_GET,
+	    "/api/packages/search", 20, NULL, &crid);
+	assert(ch != NULL && route_cache_policy(crid) != NULL);
+	const char *cget = "GET /api/packages/search?q=a&n=1 HTTP/1.1\r\n\r\n";
+	http_request_t cr1 = {.fd = cfd, .method = "GET",
+	    .url = "/api/packages/search?q=a&n=1", .version = "HTTP/1.1",
+	    .keep_alive = 1, .buffer = cget, .buffer_len = strlen(cget)};
+	http_request_t cr2 = cr1;
+	cr2.url = "/api/packages/search?n=1&q=a";
+	assert(response_cache_serve(&cr1, crid, ch, 5000) == 0);
+	assert(response_cache_serve(&cr2, crid, ch, 5500) == 0);
+	assert(pkg_api_calls == 1 && cr2.status == 200 &&
+	    cr2.bytes_out == cr1.bytes_out && cr2.captured == NULL);
+	static char cout[4096];
+	ssize_t cn = pread(cfd, cout, sizeof(cout) - 1, 0);
+	assert(cn > 0 && (size_t)cn == cr1.bytes_out * 2);
+	cout[cn] = '\0';
+	char *cbody = strstr(cout, "\r\n\r\n/api/packages/search?q=a&n=1");
+	assert(cbody && strstr(cbody + 1,
+	    "\r\n\r\n/api/packages/search?q=a&n=1"));
+	cr2.bytes_out = 0;
+	assert(response_cache_serve(&cr2, crid, ch, 6000) == 0);
+	assert(pkg_api_calls == 2);
+
+	/* Conditional requests and oversized bodies always reach the handler */
+	const char *cinm = "GET /api/packages/search?q=a&n=1 HTTP/1.1\r\n"
+	    "If-None-Match: \"x\"\r\n\r\n";
+	http_request_t cr3 = {.fd = cfd, .method = "GET", .url = cr1.url,
+	    .buffer = cinm, .buffer_len = strlen(cinm)};
+	assert(response_cache_serve(&cr3, crid, ch, 6100) == 0);
+	assert(response_cache_serve(&cr3, crid, ch, 6100) == 0);
+	assert(pkg_api_calls == 4);
+	http_request_t cr4 = cr1;
+	cr4.url = "/api/packages/search?q=0123456789012345678901234567890"
+	    "123456789abcdef";
+	cr4.bytes_out = 0;
+	assert(response_cache_serve(&cr4, crid, ch, 6200) == 0);
+	cr4.bytes_out = 0;
+	assert(response_cache_serve(&cr4, crid, ch, 6200) == 0);
+	assert(pkg_api_calls == 6);
+
+	/* Purged, or with the cache off, the handler runs again */
+	assert(cache_admin_purge("response_cache",
+	    "/api/packages/search?n=1&q=a", 0) == 1);
+	cr2.bytes_out = 0;
+	assert(response_cache_serve(&cr2, crid, ch, 6300) == 0);
+	assert(pkg_api_calls == 7);
+	response_cache_set_budget(0);
+	cr2.bytes_out = 0;
+	assert(response_cache_serve(&cr2, crid, ch, 6400) == 0);
+	assert(pkg_api_calls == 8);
+	response_cache_set_budget(RESPONSE_CACHE_BUDGET_BYTES);
+
+	/* Past the TTL the stale copy is sent and refreshed once, later */
+	int srid, scalls = pkg_api_calls;
+	http_handler_t sh = route_lookup(HTTP_METHOD_GET,
+	    "/api/packages/info", 18, NULL, &srid);
+	assert(sh != NULL && route_cache_policy(srid)->stale_ms == 1000);
+	const char *sget = "GET /api/packages/info?n=x HTTP/1.1\r\n\r\n";
+	http_request_t sr = {.fd = cfd, .method = "GET",
+	    .url = "/api/packages/info?n=x", .version = "HTTP/1.1",
+	    .keep_alive = 1, .buffer = sget, .buffer_len = strlen(sget)};
+	assert(response_cache_serve(&sr, srid, sh, 10000) == 0);
+	assert(response_cache_serve(&sr, srid, sh, 11500) == 0);
+	assert(response_cache_serve(&sr, srid, sh, 11600) == 0);
+	assert(pkg_api_calls == scalls + 1 && sr.status == 200);
+	assert(response_cache_get(srid, 0, "/api/packages/info?n=x", 22,
+	    11600) == NULL);
+	assert(response_cache_refresh(8, 11700) == 1);
+	assert(response_cache_refresh(8, 11700) == 0);
+	assert(pkg_api_calls == scalls + 2);
+	/* A hot copy is refreshed in the last tenth of its TTL */
+	assert(response_cache_serve(&sr, srid, sh, 12000) == 0);
+	assert(response_cache_refresh(8, 12000) == 0);
+	assert(response_cache_serve(&sr, srid, sh, 12650) == 0);
+	assert(response_cache_refresh(8, 12650) == 1);
+	assert(pkg_api_calls == scalls + 3);
+	/* Past the stale window as well, the request waits for the handler */
+	assert(response_cache_serve(&sr, srid, sh, 14651) == 0);
+	assert(pkg_api_calls == scalls + 4);
+	assert(response_cache_refresh(8, 14651) == 0);
+	response_cache_cleanup();
+	close(cfd);
+
+	/* Bundled static files: no filesystem, one ETag per encoding */
+	char bpath[] = "/tmp/routes_test.XXXXXX";
+	int bfd = mkstemp(bpath);
+	assert(bfd >= 0);
+	unlink(bpath);
+	const char *bget = "GET /static/bundled.css HTTP/1.1\r\n\r\n";
+	http_request_t br = {.fd = bfd, .method = "GET",
+	    .url = "/static/bundled.css", .version = "HTTP/1.1",
+	    .buffer = bget, .buffer_len = strlen(bget)};
+	assert(static_handler(&br) == 0 && br.status == 404);
+	bundle_set_enabled(1);
+	assert(bundle_lookup("static/bundled.cssx", 18) == &bundle_files[0]);
+	assert(bundle_lookup("static/bundled.cs", 17) == NULL);
+	br.bytes_out = 0;
+	assert(static_handler(&br) == 0 && br.status == 200);
+	const char *bgz = "GET /static/bundled.css HTTP/1.1\r\n"
+	    "Accept-Encoding: gzip\r\n\r\n";
+	br.buffer = bgz;
+	br.buffer_len = strlen(bgz);
+	assert(static_handler(&br) == 0 && br.status == 200);
+	const char *binm = "GET /static/bundled.css HTTP/1.1\r\n"
+	    "If-None-Match: \"b1\"\r\n\r\n";
+	br.buffer = binm;
+	br.buffer_len = strlen(binm);
+	assert(static_handler(&br) == 0 && br.status == 304);
+	static char bout[4096];
+	ssize_t bn = pread(bfd, bout, sizeof(bout) - 1, 0);
+	assert(bn > 0);
+	bout[bn] = '\0';
+	char *b200 = strstr(bout, "HTTP/1.1 200");
+	assert(b200 && strstr(b200, "ETag: \"b1\"\r\n"));
+	assert(strstr(b200, "\r\n\r\nbody { color: red }\n"));
+	char *bgz200 = strstr(b200 + 1, "HTTP/1.1 200");
+	assert(bgz200 && strstr(bgz200, "Content-Encoding: gzip\r\n") &&
+	    strstr(bgz200, "ETag: \"B1\"\r\n") &&
+	    strstr(bgz200, "\r\n\r\ngz"));
+	assert(strstr(bgz200, "HTTP/1.1 304"));
+	bundle_set_enabled(0);
+	close(bfd);
 
 	/* Module toggle: disable views only */
 	memset(&config, 0, sizeof(config));
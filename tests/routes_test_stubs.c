@@ -1,5 +1,9 @@
+#include <miniweb/http/bundle.h>
 #include <miniweb/http/handler.h>
 #include <miniweb/router/router.h>
+#include <miniweb/router/route_stats.h>
+
+#include <string.h>
 
 /**
  * @brief TODO: Describe metrics_handler.
@@ -49,16 +53,25 @@ man_render_handler(http_request_t *req)
 	return 0;
 }
 
+int pkg_api_calls;
+
 /**
- * @brief TODO: Describe pkg_api_handler.
- * @param req TODO: Describe this parameter.
- * @return TODO: Describe the return value.
+ * @brief Stand-in packages API: count the call and echo the target.
+ * @param req Request being served.
+ * @return Result of the send.
  */
 int
 pkg_api_handler(http_request_t *req)
 {
-	(void)req;
-	return 0;
+	http_response_t *resp = http_response_create();
+	int rc;
+
+	pkg_api_calls++;
+	resp->content_type = "application/json";
+	http_response_set_body(resp, (char *)req->url, strlen(req->url), 0);
+	rc = http_response_send(req, resp);
+	http_response_free(resp);
+	return rc;
 }
 
 /**
@@ -69,7 +82,10 @@ pkg_api_handler(http_request_t *req)
 int
 metrics_module_attach_routes(struct router *r)
 {
-	return router_register(r, "GET", "/api/metrics", metrics_handler);
+	if (router_register(r, "GET", "/api/metrics", metrics_handler) != 0)
+		return -1;
+	return router_register(r, "GET", "/api/stats/routes",
+	    route_stats_handler);
 }
 
 /**
@@ -94,10 +110,11 @@ networking_module_attach_routes(struct router *r)
 int
 man_module_attach_routes(struct router *r)
 {
-	if (router_register_prefix(r, "GET", "/api/man/", 0, man_api_handler) != 0)
+	if (router_register_prefix_class(r, ROUTE_CLASS_SLOW, "GET", "/api/man/",
+	    0, man_api_handler) != 0)
 		return -1;
-	return router_register_prefix(r, "GET", "/man/", 2,
-	    man_render_handler);
+	return router_register_prefix_class(r, ROUTE_CLASS_SLOW, "GET", "/man/",
+	    2, man_render_handler);
 }
 
 /**
@@ -110,9 +127,14 @@ packages_module_attach_routes(struct router *r)
 {
 	if (router_register(r, "GET", "/packages", view_template_handler) != 0)
 		return -1;
-	if (router_register(r, "GET", "/api/packages/search", pkg_api_handler) != 0)
+	if (router_register_cached(r, ROUTE_CLASS_SLOW, "GET",
+	    "/api/packages/search", pkg_api_handler,
+	    &(route_cache_policy_t){.ttl_ms = 1000, .max_bytes = 64}) != 0)
 		return -1;
-	if (router_register(r, "GET", "/api/packages/info", pkg_api_handler) != 0)
+	if (router_register_cached(r, ROUTE_CLASS_SLOW, "GET",
+	    "/api/packages/info", pkg_api_handler,
+	    &(route_cache_policy_t){.ttl_ms = 1000, .max_bytes = 64,
+	    .stale_ms = 1000}) != 0)
 		return -1;
 	if (router_register(r, "GET", "/api/packages/which", pkg_api_handler) != 0)
 		return -1;
@@ -120,3 +142,43 @@ packages_module_attach_routes(struct router *r)
 		return -1;
 	return router_register(r, "GET", "/api/packages/list", pkg_api_handler);
 }
+
+/**
+ * @brief Stand-in dashboard snapshot, with a string that must be escaped.
+ * @param arena Request arena, or NULL for malloc.
+ * @param version Unused.
+ * @return Copy of a fixed JSON document.
+ */
+char *
+metrics_snapshot_json_arena(http_arena_t *arena, unsigned long *version)
+{
+	static const char json[] = "{\"hostname\":\"</script>\"}";
+
+	(void)version;
+	return arena ? http_arena_strndup(arena, json, sizeof(json) - 1) :
+	    strdup(json);
+}
+
+/**
+ * @brief Stand-in networking snapshot: none is ready yet.
+ * @param arena Unused.
+ * @param version Unused.
+ * @return NULL.
+ */
+char *
+networking_get_json_arena(http_arena_t *arena, unsigned long *version)
+{
+	(void)arena;
+	(void)version;
+	return NULL;
+}
+
+/* One bundled file, with a stand-in for its gzip variant. */
+static const unsigned char bundled_css[] = "body { color: red }\n";
+static const unsigned char bundled_css_gz[] = "gz";
+
+const bundle_file_t bundle_files[] = {
+	{ "static/bundled.css", "text/css", "\"b1\"", 1, bundled_css,
+	    sizeof(bundled_css) - 1, bundled_css_gz, 2, "\"B1\"" },
+};
+const size_t bundle_file_count = 1;
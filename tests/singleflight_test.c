@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <miniweb/core/singleflight.h>
+
+#define CALLERS 8
+
+static singleflight_group_t group = SINGLEFLIGHT_GROUP_INITIALIZER;
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open;
+static int runs;
+
+/** Slow computation: count the run, then block until the gate opens. */
+static char *
+render(void *arg, size_t *len)
+{
+	const char *what = arg;
+
+	pthread_mutex_lock(&gate_lock);
+	runs++;
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	pthread_mutex_unlock(&gate_lock);
+	if (!what)
+		return NULL;
+	*len = strlen(what);
+	return strdup(what);
+}
+
+static void *
+caller(void *arg)
+{
+	size_t len;
+	char *out;
+
+	out = singleflight_do(&group, "pf.conf/5", render, arg, &len, NULL);
+	if (arg) {
+		assert(out && strcmp(out, arg) == 0 && len == strlen(arg));
+	} else {
+		assert(out == NULL && len == 0);
+	}
+	return out;
+}
+
+/** Start CALLERS threads on one key, release them once they all joined. */
+static void
+burst(const char *what)
+{
+	pthread_t th[CALLERS];
+	char *res[CALLERS];
+
+	runs = 0;
+	gate_open = 0;
+	for (int i = 0; i < CALLERS; i++)
+		assert(pthread_create(&th[i], NULL, caller, (void *)what) == 0);
+	/* Give the followers time to find the call in flight. */
+	usleep(200000);
+	pthread_mutex_lock(&gate_lock);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+	for (int i = 0; i < CALLERS; i++)
+		assert(pthread_join(th[i], (void **)&res[i]) == 0);
+	assert(runs == 1);
+	/* Each caller owns a distinct buffer. */
+	for (int i = 0; i < CALLERS; i++) {
+		for (int j = i + 1; what && j < CALLERS; j++)
+			assert(res[i] != res[j]);
+		free(res[i]);
+	}
+}
+
+int
+main(void)
+{
+	size_t len;
+	int shared = -1;
+	char *out;
+
+	burst("rendered page");
+	burst(NULL);
+
+	/* Nothing in flight: the caller runs it, for every call. */
+	gate_open = 1;
+	runs = 0;
+	out = singleflight_do(&group, "ls/1", render, "a", &len, &shared);
+	assert(out && strcmp(out, "a") == 0 && shared == 0);
+	free(out);
+	out = singleflight_do(&group, "ls/1", render, "b", &len, &shared);
+	assert(out && strcmp(out, "b") == 0 && runs == 2);
+	free(out);
+	assert(group.calls == NULL);
+
+	puts("singleflight_test: ok");
+	return 0;
+}
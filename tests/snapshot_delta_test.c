@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <miniweb/core/snapshot_delta.h>
+
+/** Publish "{a,b,c}" as @p version, recording the three members' spans. */
+static void
+publish(snapshot_delta_t *d, unsigned long version, int64_t ts,
+    const char *a, const char *b, const char *c)
+{
+	char json[256];
+	snapshot_span_t spans[3];
+	const char *m[3] = { a, b, c };
+	size_t off = 1;
+
+	json[0] = '{';
+	for (int i = 0; i < 3; i++) {
+		if (i > 0)
+			json[off++] = ',';
+		spans[i].off = off;
+		spans[i].len = strlen(m[i]);
+		memcpy(json + off, m[i], spans[i].len);
+		off += spans[i].len;
+	}
+	json[off++] = '}';
+	json[off] = '\0';
+	snapshot_delta_publish(d, version, ts, json, spans, 3);
+}
+
+int
+main(void)
+{
+	static snapshot_delta_t d;
+	unsigned long long since;
+	unsigned long have;
+	int64_t have_ts;
+
+	/* Nothing published: every since= needs the full snapshot. */
+	assert(snapshot_delta_resolve(&d, 1, &have, &have_ts) == -1);
+
+	publish(&d, 1, 1000, "\"t\":1", "\"cpu\":5", "\"os\":\"x\"");
+	publish(&d, 2, 1001, "\"t\":2", "\"cpu\":5", "\"os\":\"x\"");
+	publish(&d, 3, 1002, "\"t\":3", "\"cpu\":7", "\"os\":\"x\"");
+
+	/* By version: only what changed after it. */
+	assert(snapshot_delta_resolve(&d, 2, &have, &have_ts) == 0);
+	assert(have == 2 && have_ts == 1001);
+	assert(snapshot_delta_changed(&d, 0, have));
+	assert(snapshot_delta_changed(&d, 1, have));
+	assert(!snapshot_delta_changed(&d, 2, have));
+	assert(snapshot_delta_resolve(&d, 1, &have, &have_ts) == 0);
+	assert(snapshot_delta_changed(&d, 1, have));
+	assert(!snapshot_delta_changed(&d, 2, have));
+	assert(snapshot_delta_resolve(&d, 3, &have, &have_ts) == 0);
+	assert(!snapshot_delta_changed(&d, 0, have));
+	assert(!snapshot_delta_changed(&d, 3, have));
+
+	/* By time: the newest version not built from later samples. */
+	assert(snapshot_delta_resolve(&d, 1001, &have, &have_ts) == 0);
+	assert(have == 2);
+	assert(snapshot_delta_resolve(&d, 5000, &have, &have_ts) == 0);
+	assert(have == 3);
+	assert(snapshot_delta_resolve(&d, 999, &have, &have_ts) == -1);
+
+	/* A new layout marks every member changed. */
+	{
+		char json[] = "{\"t\":4}";
+		snapshot_span_t one = { 1, 5 };
+
+		snapshot_delta_publish(&d, 4, 1003, json, &one, 1);
+		assert(snapshot_delta_resolve(&d, 3, &have, &have_ts) == 0);
+		assert(snapshot_delta_changed(&d, 0, have));
+		assert(!snapshot_delta_changed(&d, 1, have));
+	}
+
+	/* Versions older than the window are forgotten. */
+	for (unsigned long v = 5; v < 5 + SNAPSHOT_DELTA_WINDOW; v++)
+		publish(&d, v, 1000 + (int64_t)v, "\"t\":0", "\"cpu\":0",
+		    "\"os\":\"x\"");
+	assert(snapshot_delta_resolve(&d, 4, &have, &have_ts) == -1);
+	assert(snapshot_delta_resolve(&d, 5, &have, &have_ts) == 0);
+
+	/* Query strings. */
+	assert(snapshot_delta_query("since=42", &since) && since == 42);
+	assert(snapshot_delta_query("a=1&since=7&b=2", &since) && since == 7);
+	assert(!snapshot_delta_query("since=", &since));
+	assert(!snapshot_delta_query("since=4x", &since));
+	assert(!snapshot_delta_query("nosince=4", &since));
+	assert(!snapshot_delta_query(NULL, &since));
+
+	printf("snapshot_delta_test: ok\n");
+	return 0;
+}
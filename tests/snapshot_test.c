@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/core/snapshot.h>
+
+#define READERS		4
+#define PUBLISHES	20000
+
+typedef struct {
+	snapshot_t hdr;
+	unsigned long version;
+	unsigned long check;	/* ~version while alive */
+} doc_t;
+
+static snapshot_slot_t slot = SNAPSHOT_SLOT_INITIALIZER;
+static unsigned long freed;
+static int done;
+
+static void
+doc_free(snapshot_t *s)
+{
+	doc_t *d = (doc_t *)s;
+
+	d->check = 0;
+	__atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+	free(d);
+}
+
+static doc_t *
+doc_new(unsigned long version)
+{
+	doc_t *d = malloc(sizeof(*d));
+
+	assert(d != NULL);
+	snapshot_init(&d->hdr, doc_free);
+	d->version = version;
+	d->check = ~version;
+	return d;
+}
+
+/** Keep acquiring: versions only move forward and never show freed. */
+static void *
+reader(void *arg)
+{
+	unsigned long last = 0, seen = 0;
+
+	(void)arg;
+	while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		doc_t *d = (doc_t *)snapshot_acquire(&slot);
+
+		if (d == NULL)
+			continue;
+		assert(d->check == ~d->version);
+		assert(d->version >= last);
+		last = d->version;
+		seen++;
+		snapshot_release(&d->hdr);
+	}
+	return (void *)(unsigned long)seen;
+}
+
+static void
+test_publish_release(void)
+{
+	doc_t *a = doc_new(1), *b = doc_new(2), *held;
+
+	assert(snapshot_acquire(&slot) == NULL);
+	snapshot_publish(&slot, &a->hdr);
+	held = (doc_t *)snapshot_acquire(&slot);
+	assert(held == a);
+
+	/* Replaced while held: freed by the holder's release, not before. */
+	snapshot_publish(&slot, &b->hdr);
+	assert(freed == 0);
+	assert(held->check == ~1UL);
+	snapshot_release(&held->hdr);
+	assert(freed == 1);
+
+	assert(snapshot_ref(&b->hdr) == &b->hdr);
+	snapshot_release(&b->hdr);
+	snapshot_publish(&slot, NULL);
+	assert(freed == 2);
+	assert(snapshot_acquire(&slot) == NULL);
+	snapshot_release(NULL);
+}
+
+static void
+test_concurrent(void)
+{
+	pthread_t th[READERS];
+	unsigned long start = freed;
+
+	for (int i = 0; i < READERS; i++)
+		assert(pthread_create(&th[i], NULL, reader, NULL) == 0);
+	for (unsigned long v = 1; v <= PUBLISHES; v++)
+		snapshot_publish(&slot, &doc_new(v)->hdr);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for (int i = 0; i < READERS; i++)
+		assert(pthread_join(th[i], NULL) == 0);
+	assert(freed - start == PUBLISHES - 1);
+	snapshot_publish(&slot, NULL);
+	assert(freed - start == PUBLISHES);
+}
+
+int
+main(void)
+{
+	test_publish_release();
+	test_concurrent();
+	puts("snapshot_test: ok");
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/http/utils.h>
+
+static char *const echo_argv[] = { "echo", "hello", "world", NULL };
+
+/** Run echo through safe_popen_read_argv() and check what came back. */
+static void
+check_echo(void)
+{
+	size_t len;
+	char *out;
+
+	out = safe_popen_read_argv("/bin/echo", echo_argv, 1024, 5, &len);
+	assert(out && strcmp(out, "hello world\n") == 0 && len == 12);
+	free(out);
+}
+
+static void *
+echo_thread(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < 50; i++)
+		check_echo();
+	return NULL;
+}
+
+int
+main(void)
+{
+	char *const sleep_argv[] = { "sleep", "30", NULL };
+	pthread_t threads[4];
+	char buf[64];
+	time_t start;
+	ssize_t n;
+	int fd;
+
+	/* Without the helper, commands are forked directly. */
+	assert(spawn_helper_run("/bin/echo", echo_argv, 5) == -1);
+	check_echo();
+
+	assert(spawn_helper_start() == 0);
+	assert(spawn_helper_start() == 0);
+	fd = spawn_helper_run("/bin/echo", echo_argv, 5);
+	assert(fd >= 0);
+	n = read(fd, buf, sizeof(buf));
+	assert(n == 12 && memcmp(buf, "hello world\n", 12) == 0);
+	assert(read(fd, buf, sizeof(buf)) == 0);
+	close(fd);
+	check_echo();
+
+	/* The helper kills a command at its deadline: the pipe closes. */
+	start = time(NULL);
+	fd = spawn_helper_run("/bin/sleep", sleep_argv, 1);
+	assert(fd >= 0);
+	assert(read(fd, buf, sizeof(buf)) == 0);
+	assert(time(NULL) - start < 10);
+	close(fd);
+	start = time(NULL);
+	assert(safe_popen_read_argv("/bin/sleep", sleep_argv, 64, 1,
+	    NULL) == NULL);
+	assert(time(NULL) - start < 10);
+
+	/* A missing binary exits 127 with no output. */
+	fd = spawn_helper_run("/nonexistent", echo_argv, 5);
+	assert(fd >= 0 && read(fd, buf, sizeof(buf)) == 0);
+	close(fd);
+
+	for (int i = 0; i < 4; i++)
+		assert(pthread_create(&threads[i], NULL, echo_thread,
+		    NULL) == 0);
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	spawn_helper_stop();
+	assert(spawn_helper_run("/bin/echo", echo_argv, 5) == -1);
+	check_echo();
+
+	printf("spawn_helper_test: ok\n");
+	return 0;
+}
@@ -1,7 +1,100 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <miniweb/storage/sqlite_db.h>
+#include <miniweb/storage/sqlite_schema.h>
+#include <miniweb/storage/sqlite_stmt.h>
+
+#define WRITERS 4
+#define WRITES 50
+
+static struct mw_db *wal_db;
+
+/** Insert the row numbered *ctx; odd multiples of 7 fail and vanish. */
+static int
+put_row(struct mw_db *db, void *ctx)
+{
+	struct mw_stmt *st;
+	int n = *(int *)ctx, rc;
+
+	if (mw_stmt_prepare_cached(db, "INSERT INTO w VALUES(?)", &st) != 0)
+		return -1;
+	rc = mw_bind_int64(st, 1, n) == 0 && mw_stmt_step(st) > 0 ? 0 : -1;
+	mw_stmt_finalize(st);
+	return rc == 0 && n % 14 == 7 ? -1 : rc;
+}
+
+/** A write nested in a write runs inline, in the same batch. */
+static int
+put_nested(struct mw_db *db, void *ctx)
+{
+	static int n = 100000;
+
+	(void)ctx;
+	if (put_row(db, &n) != 0)
+		return -1;
+	assert(mw_db_write(wal_db, put_row, &(int){ 100001 }) == 0);
+	return 0;
+}
+
+static void *
+writer(void *arg)
+{
+	int base = *(int *)arg;
+
+	for (int i = 0; i < WRITES; i++) {
+		int n = base + i;
+
+		assert(mw_db_write(wal_db, put_row, &n) ==
+		    (n % 14 == 7 ? -1 : 0));
+	}
+	return NULL;
+}
+
+static int64_t count_rows(struct mw_db *db);
+
+static struct mw_db *pool_db;
+static int pool_out, pool_peak;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Check readers out and count rows on them, alongside the others. */
+static void *
+reader(void *arg)
+{
+	int64_t want = *(int64_t *)arg;
+
+	for (int i = 0; i < 20; i++) {
+		struct mw_db *r = mw_db_reader(pool_db);
+
+		assert(r != NULL && r != pool_db);
+		pthread_mutex_lock(&pool_lock);
+		if (++pool_out > pool_peak)
+			pool_peak = pool_out;
+		pthread_mutex_unlock(&pool_lock);
+		assert(count_rows(r) == want);
+		pthread_mutex_lock(&pool_lock);
+		pool_out--;
+		pthread_mutex_unlock(&pool_lock);
+		mw_db_reader_put(pool_db, r);
+	}
+	return NULL;
+}
+
+static int64_t
+count_rows(struct mw_db *db)
+{
+	struct mw_stmt *st;
+	int64_t n;
+
+	assert(mw_stmt_prepare(db, "SELECT count(*) FROM w", &st) == 0);
+	assert(mw_stmt_step(st) == 0);
+	n = mw_column_int64(st, 0);
+	mw_stmt_finalize(st);
+	return n;
+}
 
 /**
  * @brief main operation.
@@ -14,6 +107,7 @@ int
 main(void)
 {
 	struct mw_db *db = NULL;
+	struct mw_stmt *st = NULL;
 	char out[128];
 
 	assert(create_db("main", "./test.db", &db) == 0);
@@ -22,6 +116,216 @@ main(void)
 	assert(retrieve_table(db, "metrics", 10, out, sizeof(out)) == 0);
 	assert(retrieve_column(db, "metrics", 5, out, sizeof(out)) == 0);
 	mw_db_close(db);
+	(void)unlink("./test.db");
+
+	/* Statements against a real file. */
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_READONLY, &db) != 0);
+	assert(mw_db_open("/tmp/sqlite_db_test.db", 0, &db) == 0);
+	assert(mw_db_exec_schema(db, "CREATE TABLE t(k TEXT PRIMARY KEY, "
+	    "v INTEGER); CREATE INDEX t_v ON t(v);") == 0);
+	assert(mw_db_exec_schema(db, "CREATE TABLE t(k TEXT);") != 0);
+	assert(mw_stmt_prepare(db, "SELECT nope FROM t", &st) != 0);
+
+	assert(mw_tx_begin(db) == 0);
+	assert(mw_stmt_prepare(db, "INSERT INTO t VALUES(?, ?)", &st) == 0);
+	for (int i = 0; i < 3; i++) {
+		char k[8];
+
+		snprintf(k, sizeof(k), "k%d", i);
+		assert(mw_bind_text(st, 1, k) == 0);
+		assert(mw_bind_int64(st, 2, i * 10) == 0);
+		assert(mw_stmt_step(st) > 0);
+		assert(mw_stmt_reset(st) == 0);
+	}
+	/* Duplicate key: an error, not a row or completion. */
+	assert(mw_bind_text(st, 1, "k0") == 0);
+	assert(mw_bind_null(st, 2) == 0);
+	assert(mw_stmt_step(st) < 0);
+	mw_stmt_finalize(st);
+	assert(mw_tx_commit(db) == 0);
+
+	/* Rolled back rows are gone. */
+	assert(mw_tx_begin(db) == 0);
+	assert(mw_db_exec_schema(db, "DELETE FROM t;") == 0);
+	assert(mw_tx_rollback(db) == 0);
+
+	assert(mw_stmt_prepare(db, "SELECT k, v FROM t WHERE v >= ? ORDER BY v",
+	    &st) == 0);
+	assert(mw_bind_int64(st, 1, 10) == 0);
+	assert(mw_stmt_step(st) == 0);
+	assert(strcmp(mw_column_text(st, 0), "k1") == 0);
+	assert(mw_column_int64(st, 1) == 10);
+	assert(mw_stmt_step(st) == 0);
+	assert(strcmp(mw_column_text(st, 0), "k2") == 0);
+	assert(mw_stmt_step(st) > 0);
+	mw_stmt_finalize(st);
+
+	/* Nested transactions: an inner rollback keeps the outer work. */
+	assert(mw_tx_commit(db) != 0 && mw_tx_rollback(db) != 0);
+	assert(mw_tx_begin(db) == 0);
+	assert(mw_db_exec_schema(db, "DELETE FROM t WHERE k = 'k0';") == 0);
+	assert(mw_tx_begin(db) == 0);
+	assert(mw_db_exec_schema(db, "DELETE FROM t;") == 0);
+	assert(mw_tx_rollback(db) == 0);
+	assert(mw_tx_begin(db) == 0);
+	assert(mw_db_exec_schema(db, "DELETE FROM t WHERE k = 'k1';") == 0);
+	assert(mw_tx_commit(db) == 0);
+	assert(mw_tx_commit(db) == 0);
+	assert(mw_tx_commit(db) != 0);
+
+	/* Cached statements come back reset, bindings cleared. */
+	struct mw_stmt *c1, *c2;
+
+	assert(mw_stmt_prepare_cached(db, "SELECT count(*) FROM t WHERE "
+	    "k = ?1 OR ?1 IS NULL", &c1) == 0);
+	assert(mw_bind_text(c1, 1, "k2") == 0);
+	assert(mw_stmt_step(c1) == 0 && mw_column_int64(c1, 0) == 1);
+	mw_stmt_finalize(c1);
+	assert(mw_stmt_prepare_cached(db, "SELECT count(*) FROM t WHERE "
+	    "k = ?1 OR ?1 IS NULL", &c2) == 0);
+	assert(c2 == c1);
+	assert(mw_stmt_step(c2) == 0 && mw_column_int64(c2, 0) == 1);
+	/* Checked out: the same text gets a statement of its own. */
+	assert(mw_stmt_prepare_cached(db, "SELECT count(*) FROM t WHERE "
+	    "k = ?1 OR ?1 IS NULL", &st) == 0);
+	assert(st != c2);
+	mw_stmt_finalize(st);
+	/* More texts than the cache holds; c2 is busy, so it stays. */
+	for (int i = 0; i < 40; i++) {
+		char sql[32];
+
+		snprintf(sql, sizeof(sql), "SELECT %d", i);
+		assert(mw_stmt_prepare_cached(db, sql, &st) == 0);
+		assert(mw_stmt_step(st) == 0 && mw_column_int64(st, 0) == i);
+		mw_stmt_finalize(st);
+	}
+	mw_stmt_finalize(c2);
+	assert(mw_stmt_prepare_cached(db, "SELECT count(*) FROM t WHERE "
+	    "k = ?1 OR ?1 IS NULL", &c1) == 0);
+	assert(c1 == c2);
+	/* Still checked out at close: freed by its finalize. */
+	mw_db_close(db);
+	mw_stmt_finalize(c1);
+	(void)unlink("/tmp/sqlite_db_test.db");
+
+	/* Migrations: applied once, in order, each set all or nothing. */
+	static const struct mw_migration m[] = {
+		{ 1, "CREATE TABLE a(x INTEGER);" },
+		{ 2, "INSERT INTO a VALUES (1);" },
+		{ 4, "ALTER TABLE a ADD COLUMN y TEXT;" },
+	};
+	static const struct mw_migration bad[] = {
+		{ 2, "CREATE TABLE a(x INTEGER);" },
+		{ 1, "INSERT INTO a VALUES (1);" },
+	};
+	static const struct mw_migration broken[] = {
+		{ 5, "CREATE TABLE b(x INTEGER);" },
+		{ 6, "no such statement;" },
+	};
+	static const struct mw_migration other[] = {
+		{ 1, "CREATE TABLE u(x INTEGER);" },
+	};
+	const struct mw_migration more[] = {
+		m[0], m[1], m[2],
+		{ 5, "CREATE TABLE b(x INTEGER);" },
+	};
+
+	assert(mw_db_open("/tmp/sqlite_db_test.db", 0, &db) == 0);
+	assert(mw_db_migrate(db, "t", bad, 2) != 0);
+	assert(mw_db_migrate(db, "t", m, 2) == 0);
+	assert(mw_db_migrate(db, "t", m, 3) == 0);
+	assert(mw_db_migrate(db, "t", m, 3) == 0);
+	assert(mw_stmt_prepare(db, "SELECT count(*), max(y IS NULL) FROM a",
+	    &st) == 0);
+	assert(mw_stmt_step(st) == 0);
+	assert(mw_column_int64(st, 0) == 1 && mw_column_int64(st, 1) == 1);
+	mw_stmt_finalize(st);
+	assert(mw_db_migrate(db, "t", broken, 2) != 0);
+	assert(mw_stmt_prepare(db, "SELECT * FROM b", &st) != 0);
+	assert(mw_db_migrate(db, "t", more, 4) == 0);
+	assert(mw_stmt_prepare(db, "SELECT version FROM mw_schema_version"
+	    " WHERE name = 't'", &st) == 0);
+	assert(mw_stmt_step(st) == 0 && mw_column_int64(st, 0) == 5);
+	mw_stmt_finalize(st);
+	/* Newer than this code knows. */
+	assert(mw_db_migrate(db, "t", m, 3) != 0);
+	/* Another schema in the same file has a version of its own. */
+	assert(mw_db_migrate(db, "u", other, 1) == 0);
+	assert(mw_stmt_prepare(db, "SELECT * FROM u", &st) == 0);
+	mw_stmt_finalize(st);
+	assert(mw_db_migrate(db, NULL, other, 1) != 0);
+	mw_db_close(db);
+	(void)unlink("/tmp/sqlite_db_test.db");
+
+	/* WAL: writes from many threads, group committed by the writer. */
+	pthread_t th[WRITERS];
+	int base[WRITERS];
+	int64_t expect = 0;
+	static int posted = 200000;
+
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_WAL | MW_DB_READONLY,
+	    &db) != 0);
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_WAL, &wal_db) == 0);
+	assert(mw_db_exec_schema(wal_db, "CREATE TABLE w(n INTEGER);") == 0);
+	for (int i = 0; i < WRITERS; i++) {
+		base[i] = i * 1000;
+		assert(pthread_create(&th[i], NULL, writer, &base[i]) == 0);
+	}
+	/* Reads on the other connection go on meanwhile. */
+	(void)count_rows(wal_db);
+	for (int i = 0; i < WRITERS; i++)
+		assert(pthread_join(th[i], NULL) == 0);
+	for (int i = 0; i < WRITERS * WRITES; i++) {
+		int n = (i / WRITES) * 1000 + i % WRITES;
+
+		expect += n % 14 != 7;
+	}
+	assert(count_rows(wal_db) == expect);
+	assert(mw_db_write(wal_db, put_nested, NULL) == 0);
+	assert(mw_db_post(wal_db, put_row, &posted) == 0);
+	assert(mw_db_post(NULL, put_row, &posted) != 0);
+	/* Close writes what was posted. */
+	mw_db_close(wal_db);
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_READONLY, &db) == 0);
+	assert(count_rows(db) == expect + 3);
+	mw_db_close(db);
+	/* Without a writer, mw_db_write() runs in place. */
+	assert(mw_db_open("/tmp/sqlite_db_test.db", 0, &db) == 0);
+	assert(mw_db_post(db, put_row, &posted) != 0);
+	assert(mw_db_write(db, put_row, &(int){ 7 }) != 0);
+	assert(mw_db_write(db, put_row, &(int){ 8 }) == 0);
+	assert(count_rows(db) == expect + 4);
+	mw_db_close(db);
+
+	/* Read pool: at most two readers out between eight threads. */
+	pthread_t rth[8];
+	struct mw_db *r;
+	int64_t want = expect + 4;
+
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_WAL |
+	    MW_DB_READERS(2), &pool_db) == 0);
+	for (int i = 0; i < 8; i++)
+		assert(pthread_create(&rth[i], NULL, reader, &want) == 0);
+	for (int i = 0; i < 8; i++)
+		assert(pthread_join(rth[i], NULL) == 0);
+	assert(pool_peak >= 1 && pool_peak <= 2);
+	/* Readers are read-only, each with a statement cache. */
+	r = mw_db_reader(pool_db);
+	assert(mw_db_exec_schema(r, "DELETE FROM w;") != 0);
+	assert(mw_stmt_prepare_cached(r, "SELECT 1", &c1) == 0);
+	mw_stmt_finalize(c1);
+	assert(mw_stmt_prepare_cached(r, "SELECT 1", &c2) == 0 && c2 == c1);
+	mw_stmt_finalize(c2);
+	mw_db_reader_put(pool_db, r);
+	mw_db_close(pool_db);
+	/* Without a pool, the handle reads for itself. */
+	assert(mw_db_open("/tmp/sqlite_db_test.db", MW_DB_READONLY, &db) == 0);
+	assert(mw_db_reader(db) == db);
+	mw_db_reader_put(db, db);
+	mw_db_close(db);
+	(void)unlink("/tmp/sqlite_db_test.db");
+	(void)unlink("/tmp/sqlite_db_test.db-wal");
+	(void)unlink("/tmp/sqlite_db_test.db-shm");
 
 	puts("sqlite_db_test: ok");
 	return 0;
@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miniweb/http/utils.h>
+
+static char *const echo_argv[] = { "echo", "hi", NULL };
+
+struct want {
+	const char *name;
+	struct subprocess_stats st;
+	int found;
+};
+
+static void
+find_cb(const char *name, const struct subprocess_stats *st, void *ctx)
+{
+	struct want *w = ctx;
+
+	if (strcmp(name, w->name) == 0) {
+		w->st = *st;
+		w->found = 1;
+	}
+}
+
+/** Counters of budget @p name. */
+static struct subprocess_stats
+stats(const char *name)
+{
+	struct want w = { name, { 0 }, 0 };
+
+	assert(subprocess_foreach_stats(find_cb, &w) > 1);
+	assert(w.found);
+	return w.st;
+}
+
+static void *
+sleeper(void *arg)
+{
+	char *const argv[] = { "sleep", "1", NULL };
+
+	(void)arg;
+	free(safe_popen_read_argv("/bin/sleep", argv, 64, 5, NULL));
+	return NULL;
+}
+
+/** Start a one-second sleep and wait until it holds its slot. */
+static void
+start_sleeper(pthread_t *t)
+{
+	assert(pthread_create(t, NULL, sleeper, NULL) == 0);
+	while (stats("all").running == 0)
+		usleep(1000);
+}
+
+/** Milliseconds elapsed since @p t0. */
+static long
+ms_since(const struct timespec *t0)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) * 1000 +
+	    (now.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+int
+main(void)
+{
+	struct subprocess_stats st;
+	struct timespec t0;
+	pthread_t t;
+	char *out;
+
+	out = safe_popen_read_argv("/bin/echo", echo_argv, 64, 5, NULL);
+	assert(out && strcmp(out, "hi\n") == 0);
+	free(out);
+	st = stats("all");
+	assert(st.limit == 16 && st.started == 1 && st.running == 0);
+	assert(stats("other").started == 1);
+
+	/* Budgets are capped at the global limit. */
+	subprocess_governor_configure(2, 0, 0);
+	assert(stats("mandoc").limit == 2 && stats("pkg_info").limit == 2);
+
+	/* No queue: a run that would wait is rejected at once. */
+	subprocess_governor_configure(1, 0, 0);
+	start_sleeper(&t);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	assert(safe_popen_read_argv("/bin/echo", echo_argv, 64, 5,
+	    NULL) == NULL);
+	assert(ms_since(&t0) < 500);
+	assert(stats("all").rejected == 1 && stats("other").rejected == 1);
+	pthread_join(t, NULL);
+
+	/* A queued run expires at its deadline... */
+	subprocess_governor_configure(1, 4, 200);
+	start_sleeper(&t);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	assert(safe_popen_read_argv("/bin/echo", echo_argv, 64, 5,
+	    NULL) == NULL);
+	assert(ms_since(&t0) >= 150 && ms_since(&t0) < 900);
+	assert(stats("all").rejected == 2);
+	pthread_join(t, NULL);
+
+	/* ...or runs once the slot frees up. */
+	subprocess_governor_configure(1, 4, 3000);
+	start_sleeper(&t);
+	out = safe_popen_read_argv("/bin/echo", echo_argv, 64, 5, NULL);
+	assert(out && strcmp(out, "hi\n") == 0);
+	free(out);
+	pthread_join(t, NULL);
+
+	st = stats("all");
+	assert(st.running == 0 && st.queued == 0 && st.rejected == 2);
+	assert(st.started == 5);
+	/* Three of five runs slept a second. */
+	assert(st.p99_ms >= 900);
+
+	printf("subprocess_test: ok\n");
+	return 0;
+}
@@ -1,12 +1,47 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <miniweb/http/bundle.h>
 #include <miniweb/render/template_engine.h>
 
 char config_templates_dir[] = "templates";
 
+static const unsigned char b_base[] =
+    "<html><title>{{title}}</title>{{page_content}}</html>";
+static const unsigned char b_page[] = "<p>bundled</p>";
+
+/* Sorted by name, as miniweb-bundle writes it. */
+const bundle_file_t bundle_files[] = {
+	{ "static/a.css", "text/css", "\"b1\"", 1, (const unsigned char *)"",
+	    0, NULL, 0, NULL },
+	{ "templates/base.html", "text/html", "\"b2\"", 2, b_base,
+	    sizeof(b_base) - 1, NULL, 0, NULL },
+	{ "templates/page.html", "text/html", "\"b3\"", 3, b_page,
+	    sizeof(b_page) - 1, NULL, 0, NULL },
+	{ "templates/sub/page.html", "text/html", "\"b4\"", 4,
+	    (const unsigned char *)"nested", 6, NULL, 0, NULL },
+};
+const size_t bundle_file_count = 4;
+
+/** Render repeatedly while the main thread swaps snapshots. */
+static void *
+render_loop(void *arg)
+{
+	struct template_data data = {.title = "T", .page_content = "docs.html"};
+	struct template_iov tiov;
+	size_t *len = arg;
+
+	for (int i = 0; i < 2000; i++) {
+		assert(template_render_iov(&data, &tiov) == 0);
+		assert(tiov.len == *len);
+		template_iov_release(&tiov);
+	}
+	return NULL;
+}
+
 /**
  * @brief TODO: Describe main.
  * @return TODO: Describe the return value.
@@ -37,9 +72,53 @@ main(void)
 	assert(template_render("api.html", &out) == 0);
 	assert(out != NULL);
 	assert(strstr(out, "<html") != NULL);
+
+	/* Borrowed spans concatenate to the copied render. */
+	struct template_iov tiov;
+	struct template_data plain = {.title = "MiniWeb",
+	    .page_content = "api.html"};
+	size_t off = 0;
+	assert(template_render_iov(&plain, &tiov) == 0);
+	assert(tiov.iovcnt > 1 && tiov.iovcnt <= TEMPLATE_IOV_MAX);
+	assert(tiov.len == strlen(out));
+	assert(tiov.version == template_cache_version());
+	for (int i = 0; i < tiov.iovcnt; i++) {
+		assert(memcmp(out + off, tiov.iov[i].iov_base,
+		    tiov.iov[i].iov_len) == 0);
+		off += tiov.iov[i].iov_len;
+	}
+	template_iov_release(&tiov);
 	free(out);
 
+	/* Readers never see a snapshot freed under them. */
+	pthread_t th[4];
+	struct template_data docs = {.title = "T", .page_content = "docs.html"};
+	size_t docs_len;
+	assert(template_render_iov(&docs, &tiov) == 0);
+	docs_len = tiov.len;
+	template_iov_release(&tiov);
+	for (int i = 0; i < 4; i++)
+		assert(pthread_create(&th[i], NULL, render_loop, &docs_len) == 0);
+	for (int i = 0; i < 50; i++)
+		assert(template_cache_reload() == 0);
+	for (int i = 0; i < 4; i++)
+		pthread_join(th[i], NULL);
+
+	template_cache_cleanup();
+
+	/* From the bundle: top-level templates only, the disk untouched. */
+	unsigned long disk_version = tiov.version;
+	bundle_set_enabled(1);
+	assert(template_cache_init() == 0);
+	assert(template_cache_version() != disk_version);
+	assert(template_render("page.html", &out) == 0);
+	assert(strcmp(out,
+	    "<html><title>MiniWeb</title><p>bundled</p></html>") == 0);
+	free(out);
+	assert(template_render("api.html", &out) != 0);
+	assert(template_render("sub/page.html", &out) != 0);
 	template_cache_cleanup();
+	bundle_set_enabled(0);
 	puts("template_test: ok");
 	return 0;
 }
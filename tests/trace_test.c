@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <miniweb/net/trace.h>
+
+static trace_record_t recs[TRACE_RING + 8];
+
+static void
+sleep_ms(int ms)
+{
+	struct timespec ts = { 0, ms * 1000000L };
+
+	while (nanosleep(&ts, &ts) != 0)
+		;
+}
+
+/** One request through every probe, @p ms inside the handler. */
+static void
+request(const char *path, int ms)
+{
+	uint64_t since;
+
+	TRACE_BEGIN(0);
+	since = TRACE_NOW();
+	TRACE_WAIT(TRACE_WAIT_RECV, since);
+	TRACE_MARK(TRACE_PARSED);
+	TRACE_MARK(TRACE_ROUTED);
+	if (ms > 0)
+		sleep_ms(ms);
+	TRACE_MARK(TRACE_HANDLED);
+	TRACE_END(7, 200, 512, path, strlen(path));
+}
+
+static void *
+other_thread(void *arg)
+{
+	(void)arg;
+	request("/other", 0);
+	assert(trace_snapshot(recs, TRACE_RING, 0) >= 1);
+	return NULL;
+}
+
+int
+main(void)
+{
+	uint64_t ph[TRACE_PHASES], sum;
+	char path[TRACE_PATH_MAX * 2];
+	pthread_t t;
+	size_t n;
+
+	/* Off: the probes do nothing and no ring exists. */
+	assert(!TRACE_ON());
+	assert(TRACE_NOW() == 0);
+	request("/off", 0);
+	assert(trace_snapshot(recs, TRACE_RING, 0) == 0);
+	assert(trace_slow_ms() == 0);
+
+	trace_enable(5);
+	assert(TRACE_ON());
+	assert(trace_slow_ms() == 5);
+
+	/* Every phase is accounted for, and queueing comes on top. */
+	TRACE_BEGIN(trace_now() - 2000000);
+	{
+		uint64_t since = TRACE_NOW();
+
+		sleep_ms(1);
+		TRACE_WAIT(TRACE_WAIT_RECV, since);
+	}
+	TRACE_MARK(TRACE_PARSED);
+	TRACE_MARK(TRACE_ROUTED);
+	{
+		uint64_t since = TRACE_NOW();
+
+		sleep_ms(1);
+		TRACE_WAIT(TRACE_WAIT_SUBPROCESS, since);
+	}
+	TRACE_MARK(TRACE_HANDLED);
+	TRACE_END(3, 404, 1234, "/x?y", 2);
+	assert(trace_snapshot(recs, TRACE_RING, 0) == 1);
+	assert(recs[0].route_id == 3 && recs[0].status == 404);
+	assert(recs[0].bytes == 1234 && strcmp(recs[0].path, "/x") == 0);
+	assert(recs[0].queue_ns >= 2000000);
+	trace_phases(&recs[0], ph);
+	assert(ph[TRACE_PH_RECV] >= 1000000);
+	assert(ph[TRACE_PH_SUBPROCESS] >= 1000000);
+	sum = 0;
+	for (int p = 0; p < TRACE_PHASES; p++)
+		sum += ph[p];
+	assert(sum == recs[0].total_ns + recs[0].queue_ns);
+	assert(strcmp(trace_phase_name(TRACE_PH_WRITE_WAIT),
+	    "write_wait") == 0);
+	assert(strcmp(trace_phase_name(TRACE_PHASES), "unknown") == 0);
+
+	/* A request begun again drops the unfinished one. */
+	TRACE_BEGIN(0);
+	request("/again", 0);
+	assert(trace_snapshot(recs, TRACE_RING, 0) == 2);
+	assert(strcmp(recs[0].path, "/again") == 0);
+
+	/* Only the slow request lands in the slow ring. */
+	request("/slow", 6);
+	request("/fast", 0);
+	assert(trace_snapshot(recs, TRACE_RING, 0) == 4);
+	assert(strcmp(recs[0].path, "/fast") == 0);
+	n = trace_snapshot(recs, TRACE_SLOW_RING, 1);
+	assert(n >= 1 && strcmp(recs[0].path, "/slow") == 0);
+	for (size_t i = 0; i < n; i++)
+		assert(recs[i].total_ns >= 5000000);
+
+	/* Long targets are cut. */
+	memset(path, 'a', sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+	request(path, 0);
+	assert(trace_snapshot(recs, 1, 0) == 1);
+	assert(strlen(recs[0].path) == TRACE_PATH_MAX - 1);
+
+	/* The ring keeps the newest TRACE_RING, newest first. */
+	for (int i = 0; i < TRACE_RING + 10; i++) {
+		snprintf(path, sizeof(path), "/r%d", i);
+		request(path, 0);
+	}
+	assert(trace_snapshot(recs, TRACE_RING + 8, 0) == TRACE_RING);
+	snprintf(path, sizeof(path), "/r%d", TRACE_RING + 9);
+	assert(strcmp(recs[0].path, path) == 0);
+	snprintf(path, sizeof(path), "/r%d", 10);
+	assert(strcmp(recs[TRACE_RING - 1].path, path) == 0);
+
+	/* Other threads have rings of their own, gone when they exit. */
+	assert(pthread_create(&t, NULL, other_thread, NULL) == 0);
+	assert(pthread_join(t, NULL) == 0);
+	assert(trace_snapshot(recs, TRACE_RING + 8, 0) == TRACE_RING);
+
+	/* Off again: nothing more is filed. */
+	trace_enable(0);
+	assert(!TRACE_ON() && trace_slow_ms() == 0);
+	request("/late", 0);
+	assert(trace_snapshot(recs, 1, 0) == 1);
+	assert(strcmp(recs[0].path, "/late") != 0);
+
+	printf("trace_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <miniweb/net/work_queue.h>
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS_PER_PRODUCER 100000
+
+static miniweb_work_queue_t queue;
+static volatile sig_atomic_t running = 1;
+static unsigned char seen[PRODUCERS * ITEMS_PER_PRODUCER + 1];
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+static long consumed;
+
+/**
+ * @brief Push a disjoint range of tagged items, retrying while the ring is full.
+ *
+ * @param arg Producer index cast through intptr_t.
+ *
+ * @return NULL.
+ */
+static void *
+producer(void *arg)
+{
+	intptr_t id = (intptr_t)arg;
+	for (intptr_t i = 1; i <= ITEMS_PER_PRODUCER; i++) {
+		intptr_t v = id * ITEMS_PER_PRODUCER + i;
+		while (miniweb_work_queue_push(&queue, (void *)v) != 0)
+			;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Drain the queue and record every item exactly once.
+ *
+ * @param arg Unused.
+ *
+ * @return NULL.
+ */
+static void *
+consumer(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		void *item = miniweb_work_queue_pop(&queue, &running);
+		if (!item)
+			break;
+		intptr_t v = (intptr_t)item;
+		pthread_mutex_lock(&seen_lock);
+		assert(v > 0 && v <= PRODUCERS * ITEMS_PER_PRODUCER);
+		assert(seen[v] == 0);
+		seen[v] = 1;
+		consumed++;
+		pthread_mutex_unlock(&seen_lock);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Exercise full/empty edges and a concurrent MPMC run.
+ *
+ * @return 0 on success; assertion failure otherwise.
+ */
+int
+main(void)
+{
+	pthread_t prod[PRODUCERS], cons[CONSUMERS];
+
+	miniweb_work_queue_init(&queue);
+	assert(miniweb_work_queue_try_pop(&queue) == NULL);
+	for (intptr_t i = 1; i <= MINIWEB_QUEUE_CAPACITY; i++)
+		assert(miniweb_work_queue_push(&queue, (void *)i) == 0);
+	assert(miniweb_work_queue_push(&queue, (void *)1) == -1);
+	for (intptr_t i = 1; i <= MINIWEB_QUEUE_CAPACITY; i++)
+		assert(miniweb_work_queue_try_pop(&queue) == (void *)i);
+	assert(miniweb_work_queue_try_pop(&queue) == NULL);
+
+	/* Timed pop: an empty ring times out, a queued item comes back. */
+	assert(miniweb_work_queue_depth(&queue) == 0);
+	assert(miniweb_work_queue_pop_timed(&queue, &running, 20) == NULL);
+	assert(miniweb_work_queue_push(&queue, (void *)7) == 0);
+	assert(miniweb_work_queue_depth(&queue) == 1);
+	assert(miniweb_work_queue_pop_timed(&queue, &running, 20) == (void *)7);
+
+	for (int i = 0; i < CONSUMERS; i++)
+		assert(pthread_create(&cons[i], NULL, consumer, NULL) == 0);
+	for (intptr_t i = 0; i < PRODUCERS; i++)
+		assert(pthread_create(&prod[i], NULL, producer, (void *)i) == 0);
+	for (int i = 0; i < PRODUCERS; i++)
+		assert(pthread_join(prod[i], NULL) == 0);
+
+	running = 0;
+	miniweb_work_queue_broadcast_shutdown(&queue);
+	for (int i = 0; i < CONSUMERS; i++)
+		assert(pthread_join(cons[i], NULL) == 0);
+
+	assert(consumed == PRODUCERS * ITEMS_PER_PRODUCER);
+	puts("work_queue_test: ok");
+	return 0;
+}